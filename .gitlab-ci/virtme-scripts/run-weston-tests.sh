@@ -39,6 +39,9 @@ seatd-launch -- meson test --no-rebuild --timeout-multiplier 4
 # note that we need to store the return value from the tests in order to
 # determine if the test suite ran successfully or not.
 TEST_RES=$?
+# DRM backend performance numbers on VKMS, kept as JSON in the artifacts
+seatd-launch -- meson test --no-rebuild --timeout-multiplier 4 \
+	--benchmark drm-kms-benchmark || TEST_RES=1
 dmesg &> dmesg.log
 echo 0x00 > /sys/module/drm/parameters/debug
 
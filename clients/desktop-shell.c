@@ -48,6 +48,7 @@
 #include "shared/xalloc.h"
 #include "shared/cairo-util.h"
 #include "shared/file-util.h"
+#include "shared/image-loader.h"
 #include "shared/process-util.h"
 #include "shared/timespec-util.h"
 
@@ -87,6 +88,8 @@ struct desktop {
 	enum cursor_type grab_cursor;
 
 	int painted;
+
+	struct wl_list scaled_backgrounds; /* scaled_background::link */
 };
 
 struct surface {
@@ -113,10 +116,21 @@ struct panel {
 	uint32_t color;
 };
 
+/* A background drawn for one output size and buffer scale */
+struct scaled_background {
+	struct wl_list link; /* desktop::scaled_backgrounds */
+	int32_t width, height;
+	int32_t scale;
+	cairo_surface_t *surface;
+	int refcount;
+};
+
 struct background {
 	struct surface base;
 
+	struct desktop *desktop;
 	struct output *owner;
+	struct scaled_background *scaled;
 
 	struct window *window;
 	struct widget *widget;
@@ -125,6 +139,7 @@ struct background {
 	char *image;
 	int type;
 	uint32_t color;
+	bool image_cache;
 };
 
 struct output {
@@ -432,7 +447,7 @@ clock_func(struct toytimer *tt)
 {
 	struct panel_clock *clock = container_of(tt, struct panel_clock, timer);
 
-	widget_schedule_redraw(clock->widget);
+	widget_schedule_partial_redraw(clock->widget);
 
 	clock_timer_reset(clock);
 }
@@ -781,10 +796,11 @@ enum {
 	BACKGROUND_CENTERED
 };
 
-static void
-background_draw(struct widget *widget, void *data)
+/* Draw the configured background into a new buffer-sized image */
+static cairo_surface_t *
+background_render(struct background *background, int32_t width,
+		  int32_t height, int32_t scale)
 {
-	struct background *background = data;
 	cairo_surface_t *surface, *image;
 	cairo_pattern_t *pattern;
 	cairo_matrix_t matrix;
@@ -792,11 +808,12 @@ background_draw(struct widget *widget, void *data)
 	double im_w, im_h;
 	double sx, sy, s;
 	double tx, ty;
-	struct rectangle allocation;
 
-	surface = window_get_surface(background->window);
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					     width * scale, height * scale);
+	cairo_surface_set_device_scale(surface, scale, scale);
 
-	cr = widget_cairo_create(background->widget);
+	cr = cairo_create(surface);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	if (background->color == 0)
 		cairo_set_source_rgba(cr, 0.0, 0.0, 0.2, 1.0);
@@ -804,9 +821,12 @@ background_draw(struct widget *widget, void *data)
 		set_hex_color(cr, background->color);
 	cairo_paint(cr);
 
-	widget_get_allocation(widget, &allocation);
 	image = NULL;
-	if (background->image)
+	if (background->image && background->image_cache)
+		image = load_cairo_surface_with_flags(background->image,
+						      WESTON_IMAGE_LOAD_ICC |
+						      WESTON_IMAGE_LOAD_CACHE);
+	else if (background->image)
 		image = load_cairo_surface(background->image);
 	else if (background->color == 0) {
 		char *name = file_name_with_datadir("pattern.png");
@@ -818,8 +838,8 @@ background_draw(struct widget *widget, void *data)
 	if (image && background->type != -1) {
 		im_w = cairo_image_surface_get_width(image);
 		im_h = cairo_image_surface_get_height(image);
-		sx = im_w / allocation.width;
-		sy = im_h / allocation.height;
+		sx = im_w / width;
+		sy = im_h / height;
 
 		pattern = cairo_pattern_create_for_surface(image);
 
@@ -832,8 +852,8 @@ background_draw(struct widget *widget, void *data)
 		case BACKGROUND_SCALE_CROP:
 			s = (sx < sy) ? sx : sy;
 			/* align center */
-			tx = (im_w - s * allocation.width) * 0.5;
-			ty = (im_h - s * allocation.height) * 0.5;
+			tx = (im_w - s * width) * 0.5;
+			ty = (im_h - s * height) * 0.5;
 			cairo_matrix_init_translate(&matrix, tx, ty);
 			cairo_matrix_scale(&matrix, s, s);
 			cairo_pattern_set_matrix(pattern, &matrix);
@@ -848,8 +868,8 @@ background_draw(struct widget *widget, void *data)
 				s = 1.0;
 
 			/* align center */
-			tx = (im_w - s * allocation.width) * 0.5;
-			ty = (im_h - s * allocation.height) * 0.5;
+			tx = (im_w - s * width) * 0.5;
+			ty = (im_h - s * height) * 0.5;
 
 			cairo_matrix_init_translate(&matrix, tx, ty);
 			cairo_matrix_scale(&matrix, s, s);
@@ -864,7 +884,78 @@ background_draw(struct widget *widget, void *data)
 	}
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+
+	return surface;
+}
+
+static void
+scaled_background_unref(struct scaled_background *scaled)
+{
+	if (!scaled || --scaled->refcount > 0)
+		return;
+
+	cairo_surface_destroy(scaled->surface);
+	wl_list_remove(&scaled->link);
+	free(scaled);
+}
+
+/*
+ * All backgrounds share the same configuration, so outputs of the same
+ * size and scale share one rendered background. It is only drawn again
+ * when an output gets a size or scale that no other one has.
+ */
+static struct scaled_background *
+scaled_background_get(struct background *background, int32_t width,
+		      int32_t height, int32_t scale)
+{
+	struct desktop *desktop = background->desktop;
+	struct scaled_background *scaled;
+
+	wl_list_for_each(scaled, &desktop->scaled_backgrounds, link) {
+		if (scaled->width == width && scaled->height == height &&
+		    scaled->scale == scale) {
+			scaled->refcount++;
+			return scaled;
+		}
+	}
+
+	scaled = xzalloc(sizeof *scaled);
+	scaled->width = width;
+	scaled->height = height;
+	scaled->scale = scale;
+	scaled->refcount = 1;
+	scaled->surface = background_render(background, width, height, scale);
+	wl_list_insert(&desktop->scaled_backgrounds, &scaled->link);
+
+	return scaled;
+}
+
+static void
+background_draw(struct widget *widget, void *data)
+{
+	struct background *background = data;
+	struct scaled_background *scaled = background->scaled;
+	struct rectangle allocation;
+	int32_t scale;
+	cairo_t *cr;
+
+	widget_get_allocation(widget, &allocation);
+	scale = window_get_buffer_scale(background->window);
+
+	if (!scaled || scaled->width != allocation.width ||
+	    scaled->height != allocation.height || scaled->scale != scale) {
+		scaled = scaled_background_get(background, allocation.width,
+					       allocation.height, scale);
+		scaled_background_unref(background->scaled);
+		background->scaled = scaled;
+	}
+
+	cr = widget_cairo_create(background->widget);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, scaled->surface,
+				 allocation.x, allocation.y);
+	cairo_paint(cr);
+	cairo_destroy(cr);
 
 	background->painted = 1;
 	check_desktop_ready(background->window);
@@ -1165,6 +1256,7 @@ background_destroy(struct background *background)
 	widget_destroy(background->widget);
 	window_destroy(background->window);
 
+	scaled_background_unref(background->scaled);
 	free(background->image);
 	free(background);
 }
@@ -1177,6 +1269,7 @@ background_create(struct desktop *desktop, struct output *output)
 	char *type;
 
 	background = xzalloc(sizeof *background);
+	background->desktop = desktop;
 	background->owner = output;
 	background->base.configure = background_configure;
 	background->window = window_create_custom(desktop->display);
@@ -1190,6 +1283,8 @@ background_create(struct desktop *desktop, struct output *output)
 					 &background->image, NULL);
 	weston_config_section_get_color(s, "background-color",
 					&background->color, 0x00000000);
+	weston_config_section_get_bool(s, "background-image-cache",
+				       &background->image_cache, false);
 
 	weston_config_section_get_string(s, "background-type",
 					 &type, "tile");
@@ -1565,6 +1660,7 @@ int main(int argc, char *argv[])
 
 	desktop.unlock_task.run = unlock_dialog_finish;
 	wl_list_init(&desktop.outputs);
+	wl_list_init(&desktop.scaled_backgrounds);
 
 	config_file = weston_config_get_name_from_env();
 	desktop.config = weston_config_parse(config_file);
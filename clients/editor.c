@@ -40,10 +40,30 @@
 
 #include <libweston/config-parser.h>
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
 #include "shared/xalloc.h"
 #include "window.h"
 #include "text-input-unstable-v1-client-protocol.h"
 
+/*
+ * The displayed text, with the preedit string inserted at the cursor, is
+ * laid out one paragraph per PangoLayout. After an edit, only the
+ * paragraphs whose text or attributes changed are laid out again, and
+ * only the lines that changed or moved are redrawn.
+ */
+struct text_line {
+	PangoLayout *layout;
+	char *text;		/* without the newline */
+	uint32_t start;		/* byte offset in the displayed text */
+	uint32_t length;
+	/* Selection and preedit string within the line, -1 if none */
+	int32_t sel_start, sel_end;
+	int32_t preedit_start, preedit_end;
+	uint32_t preedit_serial;
+	/* Logical extents from the top of the text, in Pango units */
+	int32_t y, height;
+};
+
 struct text_entry {
 	struct widget *widget;
 	struct window *window;
@@ -70,7 +90,13 @@ struct text_entry {
 		bool invalid_delete;
 	} pending_commit;
 	struct zwp_text_input_v1 *text_input;
-	PangoLayout *layout;
+	PangoContext *pango_context;
+	struct wl_array lines; /* struct text_line */
+	/* Bumped whenever the preedit attributes change */
+	uint32_t preedit_serial;
+	PangoRectangle cursor_pos;
+	/* Lines to redraw, in pixels from the top of the text */
+	int32_t damage_y1, damage_y2;
 	struct {
 		xkb_mod_mask_t shift_mask;
 	} keysym;
@@ -184,6 +210,8 @@ static void text_entry_reset_preedit(struct text_entry *entry);
 static void text_entry_commit_and_reset(struct text_entry *entry);
 static void text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rectangle);
 static void text_entry_update(struct text_entry *entry);
+static void text_entry_update_layout(struct text_entry *entry);
+static void text_entry_schedule_redraw(struct text_entry *entry);
 
 static void
 text_input_commit_string(void *data,
@@ -221,7 +249,7 @@ text_input_commit_string(void *data,
 
 	memset(&entry->pending_commit, 0, sizeof entry->pending_commit);
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static void
@@ -270,12 +298,13 @@ text_input_preedit_string(void *data,
 	text_entry_set_preedit(entry, text, entry->preedit_info.cursor);
 	entry->preedit.commit = strdup(commit);
 	entry->preedit.attr_list = pango_attr_list_ref(entry->preedit_info.attr_list);
+	entry->preedit_serial++;
 
 	clear_pending_preedit(entry);
 
 	text_entry_update(entry);
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static void
@@ -414,7 +443,7 @@ text_input_keysym(void *data,
 
 		if (!(modifiers & entry->keysym.shift_mask))
 			entry->anchor = entry->cursor;
-		widget_schedule_redraw(entry->widget);
+		text_entry_schedule_redraw(entry);
 
 		return;
 	}
@@ -431,7 +460,7 @@ text_input_keysym(void *data,
 
 		if (!(modifiers & entry->keysym.shift_mask))
 			entry->anchor = entry->cursor;
-		widget_schedule_redraw(entry->widget);
+		text_entry_schedule_redraw(entry);
 
 		return;
 	}
@@ -531,8 +560,8 @@ text_input_text_direction(void *data,
 			  uint32_t direction)
 {
 	struct text_entry *entry = data;
-	PangoContext *context = pango_layout_get_context(entry->layout);
 	PangoDirection pango_direction;
+	struct text_line *line;
 
 
 	switch (direction) {
@@ -547,7 +576,11 @@ text_input_text_direction(void *data,
 			pango_direction = PANGO_DIRECTION_NEUTRAL;
 	}
 
-	pango_context_set_base_dir(context, pango_direction);
+	pango_context_set_base_dir(entry->pango_context, pango_direction);
+	wl_array_for_each(line, &entry->lines)
+		pango_layout_context_changed(line->layout);
+
+	widget_schedule_redraw(entry->widget);
 }
 
 static const struct zwp_text_input_v1_listener text_input_listener = {
@@ -713,6 +746,11 @@ text_entry_create(struct editor *editor, const char *text)
 	zwp_text_input_v1_add_listener(entry->text_input,
 				       &text_input_listener, entry);
 
+	entry->pango_context =
+		pango_font_map_create_context(pango_cairo_font_map_get_default());
+	wl_array_init(&entry->lines);
+	text_entry_update_layout(entry);
+
 	widget_set_redraw_handler(entry->widget, text_entry_redraw_handler);
 	widget_set_button_handler(entry->widget, text_entry_button_handler);
 	widget_set_motion_handler(entry->widget, text_entry_motion_handler);
@@ -724,9 +762,16 @@ text_entry_create(struct editor *editor, const char *text)
 static void
 text_entry_destroy(struct text_entry *entry)
 {
+	struct text_line *line;
+
 	widget_destroy(entry->widget);
 	zwp_text_input_v1_destroy(entry->text_input);
-	g_clear_object(&entry->layout);
+	wl_array_for_each(line, &entry->lines) {
+		g_clear_object(&line->layout);
+		free(line->text);
+	}
+	wl_array_release(&entry->lines);
+	g_clear_object(&entry->pango_context);
 	free(entry->text);
 	free(entry->preferred_language);
 	free(entry);
@@ -736,14 +781,12 @@ static void
 redraw_handler(struct widget *widget, void *data)
 {
 	struct editor *editor = data;
-	cairo_surface_t *surface;
 	struct rectangle allocation;
 	cairo_t *cr;
 
-	surface = window_get_surface(editor->window);
 	widget_get_allocation(editor->widget, &allocation);
 
-	cr = cairo_create(surface);
+	cr = widget_cairo_create(widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
@@ -760,7 +803,6 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 static void
@@ -820,11 +862,198 @@ text_entry_deactivate(struct text_entry *entry,
 				     seat);
 }
 
+static void
+text_entry_damage(struct text_entry *entry, int32_t y, int32_t height)
+{
+	/* One pixel more, for underlines and rounding */
+	int32_t y1 = PANGO_PIXELS_FLOOR(y) - 1;
+	int32_t y2 = PANGO_PIXELS_CEIL(y + height) + 1;
+
+	if (entry->damage_y1 >= entry->damage_y2) {
+		entry->damage_y1 = y1;
+		entry->damage_y2 = y2;
+	} else {
+		entry->damage_y1 = MIN(entry->damage_y1, y1);
+		entry->damage_y2 = MAX(entry->damage_y2, y2);
+	}
+}
+
+static void
+text_line_release(struct text_line *line)
+{
+	g_clear_object(&line->layout);
+	free(line->text);
+	line->text = NULL;
+}
+
+static bool
+text_line_has_text(const struct text_line *line, const char *text,
+		   uint32_t length)
+{
+	return line->text && line->length == length &&
+	       memcmp(line->text, text, length) == 0;
+}
+
+/* The part of [start, end) within the line, relative to the line */
+static void
+text_line_clip_range(const struct text_line *line, uint32_t start,
+		     uint32_t end, int32_t *line_start, int32_t *line_end)
+{
+	uint32_t s = MAX(start, line->start);
+	uint32_t e = MIN(end, line->start + line->length);
+
+	if (s >= e) {
+		*line_start = -1;
+		*line_end = -1;
+	} else {
+		*line_start = s - line->start;
+		*line_end = e - line->start;
+	}
+}
+
+struct attr_slice {
+	PangoAttrList *attr_list;
+	uint32_t start;
+	uint32_t end;
+};
+
+static gboolean
+attr_slice_copy(PangoAttribute *attr, gpointer data)
+{
+	struct attr_slice *slice = data;
+	PangoAttribute *copy;
+
+	if (attr->end_index <= slice->start || attr->start_index >= slice->end)
+		return FALSE;
+
+	copy = pango_attribute_copy(attr);
+	copy->start_index = MAX(attr->start_index, slice->start) - slice->start;
+	copy->end_index = MIN(attr->end_index, slice->end) - slice->start;
+	pango_attr_list_insert(slice->attr_list, copy);
+
+	/* Keep the attribute in the entry list */
+	return FALSE;
+}
+
+static void
+text_line_set_attributes(struct text_entry *entry, struct text_line *line)
+{
+	PangoAttrList *attr_list = pango_attr_list_new();
+	PangoAttribute *attr;
+
+	if (line->preedit_start >= 0 && entry->preedit.attr_list) {
+		struct attr_slice slice = {
+			.attr_list = attr_list,
+			.start = line->start,
+			.end = line->start + line->length,
+		};
+
+		pango_attr_list_filter(entry->preedit.attr_list,
+				       attr_slice_copy, &slice);
+	} else if (line->preedit_start >= 0) {
+		attr = pango_attr_underline_new(PANGO_UNDERLINE_SINGLE);
+		attr->start_index = line->preedit_start;
+		attr->end_index = line->preedit_end;
+		pango_attr_list_insert(attr_list, attr);
+	}
+
+	if (line->sel_start >= 0) {
+		attr = pango_attr_background_new(0.3 * 65535, 0.3 * 65535, 65535);
+		attr->start_index = line->sel_start;
+		attr->end_index = line->sel_end;
+		pango_attr_list_insert(attr_list, attr);
+
+		attr = pango_attr_foreground_new(65535, 65535, 65535);
+		attr->start_index = line->sel_start;
+		attr->end_index = line->sel_end;
+		pango_attr_list_insert(attr_list, attr);
+	}
+
+	pango_layout_set_attributes(line->layout, attr_list);
+	pango_attr_list_unref(attr_list);
+}
+
+/* The line holding the byte at index of the displayed text */
+static struct text_line *
+text_entry_line_at_index(struct text_entry *entry, uint32_t index)
+{
+	struct text_line *lines = entry->lines.data;
+	size_t n = entry->lines.size / sizeof(*lines);
+	size_t i;
+
+	for (i = 1; i < n; i++) {
+		if (lines[i].start > index)
+			break;
+	}
+
+	return &lines[i - 1];
+}
+
+/* The line at y, in Pango units from the top of the text */
+static struct text_line *
+text_entry_line_at_y(struct text_entry *entry, int32_t y)
+{
+	struct text_line *lines = entry->lines.data;
+	size_t n = entry->lines.size / sizeof(*lines);
+	size_t i;
+
+	for (i = 0; i < n - 1; i++) {
+		if (y < lines[i].y + lines[i].height)
+			break;
+	}
+
+	return &lines[i];
+}
+
+/* Cursor position from the top of the text, height 0 when hidden */
+static void
+text_entry_get_cursor_pos(struct text_entry *entry, PangoRectangle *pos)
+{
+	uint32_t index = entry->cursor + entry->preedit.cursor;
+	struct text_line *line;
+
+	if (entry->preedit.text && entry->preedit.cursor < 0) {
+		memset(pos, 0, sizeof *pos);
+		return;
+	}
+
+	line = text_entry_line_at_index(entry, index);
+	pango_layout_get_cursor_pos(line->layout, index - line->start,
+				    pos, NULL);
+	pos->y += line->y;
+}
+
+/* Byte offset in the displayed text of the position x, y in pixels */
+static uint32_t
+text_entry_xy_to_index(struct text_entry *entry, int32_t x, int32_t y)
+{
+	struct text_line *line;
+	int index, trailing;
+
+	line = text_entry_line_at_y(entry, y * PANGO_SCALE);
+	pango_layout_xy_to_index(line->layout,
+				 x * PANGO_SCALE, y * PANGO_SCALE - line->y,
+				 &index, &trailing);
+
+	return line->start +
+	       (g_utf8_offset_to_pointer(line->text + index, trailing) -
+		line->text);
+}
+
 static void
 text_entry_update_layout(struct text_entry *entry)
 {
+	struct text_line *old_lines = entry->lines.data;
+	size_t n_old = entry->lines.size / sizeof(*old_lines);
+	struct text_line *new_lines, *line;
+	struct wl_array lines;
+	PangoRectangle logical, cursor_pos;
+	uint32_t sel_start = 0, sel_end = 0;
+	uint32_t preedit_start = 0, preedit_end = 0;
+	size_t n_new, prefix, suffix, i, j;
+	int32_t old_bottom, y;
+	const char *p, *nl;
 	char *text;
-	PangoAttrList *attr_list;
 
 	assert(entry->cursor <= (strlen(entry->text) +
 	       (entry->preedit.text ? strlen(entry->preedit.text) : 0)));
@@ -835,52 +1064,132 @@ text_entry_update_layout(struct text_entry *entry)
 		strcpy(text + entry->cursor, entry->preedit.text);
 		strcpy(text + entry->cursor + strlen(entry->preedit.text),
 		       entry->text + entry->cursor);
+
+		preedit_start = entry->cursor;
+		preedit_end = entry->cursor + strlen(entry->preedit.text);
 	} else {
 		text = strdup(entry->text);
 	}
 
 	if (entry->cursor != entry->anchor) {
-		int start_index = MIN(entry->cursor, entry->anchor);
-		int end_index = MAX(entry->cursor, entry->anchor);
-		PangoAttribute *attr;
+		sel_start = MIN(entry->cursor, entry->anchor);
+		sel_end = MAX(entry->cursor, entry->anchor);
+	}
 
-		attr_list = pango_attr_list_copy(entry->preedit.attr_list);
+	/* Split into paragraphs */
+	wl_array_init(&lines);
+	p = text;
+	do {
+		nl = strchrnul(p, '\n');
+		line = wl_array_add(&lines, sizeof *line);
+		memset(line, 0, sizeof *line);
+		line->start = p - text;
+		line->length = nl - p;
+		p = nl + 1;
+	} while (*nl);
+	new_lines = lines.data;
+	n_new = lines.size / sizeof(*new_lines);
+
+	/* Unchanged paragraphs at both ends keep their layouts; those in
+	 * between are reused for the changed ones. */
+	for (prefix = 0; prefix < MIN(n_old, n_new); prefix++) {
+		if (!text_line_has_text(&old_lines[prefix],
+					text + new_lines[prefix].start,
+					new_lines[prefix].length))
+			break;
+	}
+	for (suffix = 0; suffix < MIN(n_old, n_new) - prefix; suffix++) {
+		line = &new_lines[n_new - 1 - suffix];
 
-		if (!attr_list)
-			attr_list = pango_attr_list_new();
+		if (!text_line_has_text(&old_lines[n_old - 1 - suffix],
+					text + line->start, line->length))
+			break;
+	}
 
-		attr = pango_attr_background_new(0.3 * 65535, 0.3 * 65535, 65535);
-		attr->start_index = start_index;
-		attr->end_index = end_index;
-		pango_attr_list_insert(attr_list, attr);
+	old_bottom = n_old ? old_lines[n_old - 1].y +
+			     old_lines[n_old - 1].height : 0;
+
+	y = 0;
+	for (i = 0; i < n_new; i++) {
+		struct text_line *l = &new_lines[i];
+		uint32_t start = l->start, length = l->length;
+		int32_t old_y, old_height, ss, se, ps, pe;
+		bool changed = false;
+
+		if (i < prefix)
+			j = i;
+		else if (i >= n_new - suffix)
+			j = n_old - (n_new - i);
+		else if (i < n_old - suffix)
+			j = i;
+		else
+			j = n_old;
 
-		attr = pango_attr_foreground_new(65535, 65535, 65535);
-		attr->start_index = start_index;
-		attr->end_index = end_index;
-		pango_attr_list_insert(attr_list, attr);
-	} else {
-		attr_list = pango_attr_list_ref(entry->preedit.attr_list);
-	}
+		if (j < n_old) {
+			*l = old_lines[j];
+			old_lines[j].layout = NULL;
+			old_lines[j].text = NULL;
+		} else {
+			l->layout = pango_layout_new(entry->pango_context);
+			l->y = -1;
+		}
+		old_y = l->y;
+		old_height = l->height;
+		l->start = start;
+
+		if (!text_line_has_text(l, text + start, length)) {
+			free(l->text);
+			l->text = strndup(text + start, length);
+			l->length = length;
+			pango_layout_set_text(l->layout, l->text, length);
+			changed = true;
+		}
 
-	if (entry->preedit.text && !entry->preedit.attr_list) {
-		PangoAttribute *attr;
+		text_line_clip_range(l, sel_start, sel_end, &ss, &se);
+		text_line_clip_range(l, preedit_start, preedit_end, &ps, &pe);
+		if (changed ||
+		    ss != l->sel_start || se != l->sel_end ||
+		    ps != l->preedit_start || pe != l->preedit_end ||
+		    (ps >= 0 && l->preedit_serial != entry->preedit_serial)) {
+			l->sel_start = ss;
+			l->sel_end = se;
+			l->preedit_start = ps;
+			l->preedit_end = pe;
+			l->preedit_serial = entry->preedit_serial;
+			text_line_set_attributes(entry, l);
+			changed = true;
+		}
 
-		if (!attr_list)
-			attr_list = pango_attr_list_new();
+		pango_layout_get_extents(l->layout, NULL, &logical);
+		l->y = y;
+		l->height = logical.height;
+		y += logical.height;
 
-		attr = pango_attr_underline_new(PANGO_UNDERLINE_SINGLE);
-		attr->start_index = entry->cursor;
-		attr->end_index = entry->cursor + strlen(entry->preedit.text);
-		pango_attr_list_insert(attr_list, attr);
+		if (changed || l->y != old_y || l->height != old_height) {
+			if (old_y >= 0)
+				text_entry_damage(entry, old_y, old_height);
+			text_entry_damage(entry, l->y, l->height);
+		}
 	}
 
-	if (entry->layout) {
-		pango_layout_set_text(entry->layout, text, -1);
-		pango_layout_set_attributes(entry->layout, attr_list);
+	/* The text got shorter */
+	if (y < old_bottom)
+		text_entry_damage(entry, y, old_bottom - y);
+
+	for (j = 0; j < n_old; j++)
+		text_line_release(&old_lines[j]);
+	wl_array_release(&entry->lines);
+	entry->lines = lines;
+
+	text_entry_get_cursor_pos(entry, &cursor_pos);
+	if (memcmp(&cursor_pos, &entry->cursor_pos, sizeof cursor_pos) != 0) {
+		text_entry_damage(entry, entry->cursor_pos.y,
+				  entry->cursor_pos.height);
+		text_entry_damage(entry, cursor_pos.y, cursor_pos.height);
+		entry->cursor_pos = cursor_pos;
 	}
 
 	free(text);
-	pango_attr_list_unref(attr_list);
 }
 
 static void
@@ -934,9 +1243,7 @@ text_entry_insert_at_cursor(struct text_entry *entry, const char *text,
 	else
 		entry->cursor += 1 + cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 
 	text_entry_update(entry);
 }
@@ -954,6 +1261,7 @@ text_entry_reset_preedit(struct text_entry *entry)
 
 	pango_attr_list_unref(entry->preedit.attr_list);
 	entry->preedit.attr_list = NULL;
+	entry->preedit_serial++;
 }
 
 static void
@@ -988,9 +1296,7 @@ text_entry_set_preedit(struct text_entry *entry,
 	entry->preedit.text = strdup(preedit_text);
 	entry->preedit.cursor = preedit_cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static uint32_t
@@ -999,19 +1305,12 @@ text_entry_try_invoke_preedit_action(struct text_entry *entry,
 				     uint32_t button,
 				     enum wl_pointer_button_state state)
 {
-	int index, trailing;
 	uint32_t cursor;
-	const char *text;
 
 	if (!entry->preedit.text)
 		return 0;
 
-	pango_layout_xy_to_index(entry->layout,
-				 x * PANGO_SCALE, y * PANGO_SCALE,
-				 &index, &trailing);
-
-	text = pango_layout_get_text(entry->layout);
-	cursor = g_utf8_offset_to_pointer(text + index, trailing) - text;
+	cursor = text_entry_xy_to_index(entry, x, y);
 
 	if (cursor < entry->cursor ||
 	    cursor > entry->cursor + strlen(entry->preedit.text)) {
@@ -1037,17 +1336,9 @@ text_entry_set_cursor_position(struct text_entry *entry,
 			       int32_t x, int32_t y,
 			       bool move_anchor)
 {
-	int index, trailing;
-	const char *text;
 	uint32_t cursor;
 
-	pango_layout_xy_to_index(entry->layout,
-				 x * PANGO_SCALE, y * PANGO_SCALE,
-				 &index, &trailing);
-
-	text = pango_layout_get_text(entry->layout);
-
-	cursor = g_utf8_offset_to_pointer(text + index, trailing) - text;
+	cursor = text_entry_xy_to_index(entry, x, y);
 
 	if (move_anchor)
 		entry->anchor = cursor;
@@ -1063,9 +1354,7 @@ text_entry_set_cursor_position(struct text_entry *entry,
 
 	entry->cursor = cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 
 	text_entry_update(entry);
 }
@@ -1092,9 +1381,7 @@ text_entry_delete_text(struct text_entry *entry,
 
 	entry->anchor = entry->cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 
 	text_entry_update(entry);
 }
@@ -1117,7 +1404,6 @@ static void
 text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rectangle)
 {
 	struct rectangle allocation;
-	PangoRectangle extents;
 	PangoRectangle cursor_pos;
 
 	widget_get_allocation(entry->widget, &allocation);
@@ -1130,11 +1416,7 @@ text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rect
 		return;
 	}
 
-
-	pango_layout_get_extents(entry->layout, &extents, NULL);
-	pango_layout_get_cursor_pos(entry->layout,
-				    entry->cursor + entry->preedit.cursor,
-				    &cursor_pos, NULL);
+	text_entry_get_cursor_pos(entry, &cursor_pos);
 
 	rectangle->x = allocation.x + (allocation.height / 2) + PANGO_PIXELS(cursor_pos.x);
 	rectangle->y = allocation.y + 10 + PANGO_PIXELS(cursor_pos.y);
@@ -1145,17 +1427,11 @@ text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rect
 static void
 text_entry_draw_cursor(struct text_entry *entry, cairo_t *cr)
 {
-	PangoRectangle extents;
-	PangoRectangle cursor_pos;
+	PangoRectangle cursor_pos = entry->cursor_pos;
 
 	if (entry->preedit.text && entry->preedit.cursor < 0)
 		return;
 
-	pango_layout_get_extents(entry->layout, &extents, NULL);
-	pango_layout_get_cursor_pos(entry->layout,
-				    entry->cursor + entry->preedit.cursor,
-				    &cursor_pos, NULL);
-
 	cairo_set_line_width(cr, 1.0);
 	cairo_move_to(cr, PANGO_PIXELS(cursor_pos.x), PANGO_PIXELS(cursor_pos.y));
 	cairo_line_to(cr, PANGO_PIXELS(cursor_pos.x), PANGO_PIXELS(cursor_pos.y) + PANGO_PIXELS(cursor_pos.height));
@@ -1174,18 +1450,41 @@ text_offset_top(struct rectangle *allocation)
 	return allocation->height / 2;
 }
 
+/* Lay out the changes and redraw the lines that need it */
+static void
+text_entry_schedule_redraw(struct text_entry *entry)
+{
+	struct rectangle allocation;
+	struct rectangle area;
+
+	text_entry_update_layout(entry);
+
+	if (entry->damage_y1 >= entry->damage_y2)
+		return;
+
+	widget_get_allocation(entry->widget, &allocation);
+	area.x = allocation.x;
+	area.y = allocation.y + text_offset_top(&allocation) +
+		 entry->damage_y1;
+	area.width = allocation.width;
+	area.height = entry->damage_y2 - entry->damage_y1;
+	widget_schedule_redraw_area(entry->widget, &area);
+
+	entry->damage_y1 = entry->damage_y2 = 0;
+}
+
 static void
 text_entry_redraw_handler(struct widget *widget, void *data)
 {
 	struct text_entry *entry = data;
-	cairo_surface_t *surface;
 	struct rectangle allocation;
+	struct text_line *line;
+	double clip_x1, clip_y1, clip_x2, clip_y2;
 	cairo_t *cr;
 
-	surface = window_get_surface(entry->window);
 	widget_get_allocation(entry->widget, &allocation);
 
-	cr = cairo_create(surface);
+	cr = widget_cairo_create(widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
@@ -1213,14 +1512,23 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 			text_offset_left(&allocation),
 			text_offset_top(&allocation));
 
-	if (!entry->layout)
-		entry->layout = pango_cairo_create_layout(cr);
-	else
-		pango_cairo_update_layout(cr, entry->layout);
-
+	pango_cairo_update_context(cr, entry->pango_context);
 	text_entry_update_layout(entry);
+	entry->damage_y1 = entry->damage_y2 = 0;
 
-	pango_cairo_show_layout(cr, entry->layout);
+	/* Only the lines within the clip */
+	cairo_clip_extents(cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+	wl_array_for_each(line, &entry->lines) {
+		double y = (double) line->y / PANGO_SCALE;
+
+		if (y >= clip_y2)
+			break;
+		if (y + (double) line->height / PANGO_SCALE <= clip_y1)
+			continue;
+
+		cairo_move_to(cr, 0, y);
+		pango_cairo_show_layout(cr, line->layout);
+	}
 
 	text_entry_draw_cursor(entry, cr);
 
@@ -1228,7 +1536,6 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 static int
@@ -1445,7 +1752,7 @@ key_handler(struct window *window,
 				entry->cursor = new_char - entry->text;
 				if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 					entry->anchor = entry->cursor;
-				widget_schedule_redraw(entry->widget);
+				text_entry_schedule_redraw(entry);
 			}
 			break;
 		case XKB_KEY_Right:
@@ -1456,7 +1763,7 @@ key_handler(struct window *window,
 				entry->cursor = new_char - entry->text;
 				if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 					entry->anchor = entry->cursor;
-				widget_schedule_redraw(entry->widget);
+				text_entry_schedule_redraw(entry);
 			}
 			break;
 		case XKB_KEY_Up:
@@ -1465,7 +1772,7 @@ key_handler(struct window *window,
 			move_up(entry->text, &entry->cursor);
 			if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 				entry->anchor = entry->cursor;
-			widget_schedule_redraw(entry->widget);
+			text_entry_schedule_redraw(entry);
 			break;
 		case XKB_KEY_Down:
 			text_entry_commit_and_reset(entry);
@@ -1473,7 +1780,7 @@ key_handler(struct window *window,
 			move_down(entry->text, &entry->cursor);
 			if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 				entry->anchor = entry->cursor;
-			widget_schedule_redraw(entry->widget);
+			text_entry_schedule_redraw(entry);
 			break;
 		case XKB_KEY_Escape:
 			break;
@@ -1487,7 +1794,7 @@ key_handler(struct window *window,
 			break;
 	}
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static void
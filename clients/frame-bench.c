@@ -0,0 +1,390 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "frame-bench.h"
+#include "presentation-time-client-protocol.h"
+
+#define FRAME_BENCH_DEFAULT_FRAMES 1000
+
+struct frame_bench {
+	/* Exactly one of them is set */
+	uint64_t frames;
+	int64_t duration_nsec;
+
+	struct wp_presentation *presentation;
+	clockid_t clock_id;
+
+	struct wl_list frame_list; /* bench_frame::link */
+
+	bool started;
+	struct timespec begin;
+	struct timespec first_present;
+	struct timespec last_present;
+	uint32_t last_callback_time;
+
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t callbacks;
+
+	struct wl_array latencies; /* uint32_t, commit to present in us */
+	struct wl_array intervals; /* uint32_t, between frame callbacks in us */
+};
+
+struct bench_frame {
+	struct frame_bench *bench;
+	struct wl_list link;
+
+	struct timespec commit;
+	struct wp_presentation_feedback *feedback;
+	struct wl_callback *callback;
+};
+
+/** Create a benchmark
+ *
+ * \param arg What follows "--benchmark" on the command line: nothing,
+ * "=<frames>" or "=<seconds>s".
+ * \return NULL if arg is malformed.
+ */
+struct frame_bench *
+frame_bench_create(const char *arg)
+{
+	struct frame_bench *bench;
+	unsigned long value = FRAME_BENCH_DEFAULT_FRAMES;
+	const char *unit = "";
+	char *end;
+
+	if (arg[0] == '=') {
+		value = strtoul(arg + 1, &end, 10);
+		if (end == arg + 1 || value == 0)
+			return NULL;
+		unit = end;
+	} else if (arg[0] != '\0') {
+		return NULL;
+	}
+
+	if (unit[0] != '\0' && strcmp(unit, "s") != 0)
+		return NULL;
+
+	bench = xzalloc(sizeof *bench);
+	if (unit[0] == 's')
+		bench->duration_nsec = value * 1000000000LL;
+	else
+		bench->frames = value;
+
+	bench->clock_id = CLOCK_MONOTONIC;
+	wl_list_init(&bench->frame_list);
+	wl_array_init(&bench->latencies);
+	wl_array_init(&bench->intervals);
+
+	return bench;
+}
+
+static void
+bench_frame_destroy(struct bench_frame *frame)
+{
+	if (frame->feedback)
+		wp_presentation_feedback_destroy(frame->feedback);
+	if (frame->callback)
+		wl_callback_destroy(frame->callback);
+	wl_list_remove(&frame->link);
+	free(frame);
+}
+
+static void
+bench_frame_maybe_destroy(struct bench_frame *frame)
+{
+	if (!frame->feedback && !frame->callback)
+		bench_frame_destroy(frame);
+}
+
+void
+frame_bench_destroy(struct frame_bench *bench)
+{
+	struct bench_frame *frame, *tmp;
+
+	if (!bench)
+		return;
+
+	wl_list_for_each_safe(frame, tmp, &bench->frame_list, link)
+		bench_frame_destroy(frame);
+
+	if (bench->presentation)
+		wp_presentation_destroy(bench->presentation);
+
+	wl_array_release(&bench->latencies);
+	wl_array_release(&bench->intervals);
+	free(bench);
+}
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct frame_bench *bench = data;
+
+	bench->clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
+/** Bind the globals the benchmark needs, call for every global */
+void
+frame_bench_handle_global(struct frame_bench *bench,
+			  struct wl_registry *registry, uint32_t name,
+			  const char *interface, uint32_t version)
+{
+	if (!bench)
+		return;
+
+	if (strcmp(interface, wp_presentation_interface.name) == 0) {
+		bench->presentation =
+			wl_registry_bind(registry, name,
+					 &wp_presentation_interface, 1);
+		wp_presentation_add_listener(bench->presentation,
+					     &presentation_listener, bench);
+	}
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh_nsec, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct bench_frame *frame = data;
+	struct frame_bench *bench = frame->bench;
+	struct timespec present;
+	uint32_t *latency;
+
+	timespec_from_proto(&present, tv_sec_hi, tv_sec_lo, tv_nsec);
+
+	latency = wl_array_add(&bench->latencies, sizeof *latency);
+	if (latency)
+		*latency = timespec_sub_to_nsec(&present, &frame->commit) / 1000;
+
+	if (bench->presented == 0)
+		bench->first_present = present;
+	bench->last_present = present;
+	bench->presented++;
+
+	wp_presentation_feedback_destroy(frame->feedback);
+	frame->feedback = NULL;
+	bench_frame_maybe_destroy(frame);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct bench_frame *frame = data;
+
+	frame->bench->discarded++;
+
+	wp_presentation_feedback_destroy(frame->feedback);
+	frame->feedback = NULL;
+	bench_frame_maybe_destroy(frame);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static void
+frame_callback_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct bench_frame *frame = data;
+	struct frame_bench *bench = frame->bench;
+	uint32_t *interval;
+
+	if (bench->callbacks > 0) {
+		interval = wl_array_add(&bench->intervals, sizeof *interval);
+		if (interval)
+			*interval = (time - bench->last_callback_time) * 1000;
+	}
+	bench->last_callback_time = time;
+	bench->callbacks++;
+
+	wl_callback_destroy(frame->callback);
+	frame->callback = NULL;
+	bench_frame_maybe_destroy(frame);
+}
+
+static const struct wl_callback_listener frame_callback_listener = {
+	frame_callback_done
+};
+
+/** Track the next commit of the surface, call right before it */
+void
+frame_bench_frame(struct frame_bench *bench, struct wl_surface *surface)
+{
+	struct bench_frame *frame;
+
+	if (!bench)
+		return;
+
+	frame = xzalloc(sizeof *frame);
+	frame->bench = bench;
+	clock_gettime(bench->clock_id, &frame->commit);
+	wl_list_insert(bench->frame_list.prev, &frame->link);
+
+	if (!bench->started) {
+		bench->started = true;
+		bench->begin = frame->commit;
+	}
+
+	if (bench->presentation) {
+		frame->feedback = wp_presentation_feedback(bench->presentation,
+							   surface);
+		wp_presentation_feedback_add_listener(frame->feedback,
+						      &feedback_listener,
+						      frame);
+	}
+
+	frame->callback = wl_surface_frame(surface);
+	wl_callback_add_listener(frame->callback, &frame_callback_listener,
+				 frame);
+}
+
+/** Whether the client should stop */
+bool
+frame_bench_done(struct frame_bench *bench)
+{
+	struct timespec now;
+
+	if (!bench || !bench->started)
+		return false;
+
+	if (bench->duration_nsec) {
+		clock_gettime(bench->clock_id, &now);
+		return timespec_sub_to_nsec(&now, &bench->begin) >=
+		       bench->duration_nsec;
+	}
+
+	if (bench->presentation)
+		return bench->presented + bench->discarded >= bench->frames;
+
+	return bench->callbacks >= bench->frames;
+}
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t *)a;
+	uint32_t vb = *(const uint32_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+static uint32_t
+permille(const uint32_t *sorted, size_t count, unsigned int pm)
+{
+	if (count == 0)
+		return 0;
+
+	return sorted[MIN(count - 1, count * pm / 1000)];
+}
+
+static void
+print_distribution(const char *name, struct wl_array *array, bool last)
+{
+	uint32_t *values = array->data;
+	size_t count = array->size / sizeof(*values);
+	double sum = 0.0;
+	size_t i;
+
+	qsort(values, count, sizeof(*values), compare_uint32);
+	for (i = 0; i < count; i++)
+		sum += values[i];
+
+	printf("\t\"%s\": { \"count\": %zu, \"mean\": %.1f, \"p50\": %u, "
+	       "\"p99\": %u, \"p99.9\": %u }%s\n",
+	       name, count, count ? sum / count : 0.0,
+	       permille(values, count, 500), permille(values, count, 990),
+	       permille(values, count, 999), last ? "" : ",");
+}
+
+/** Print the results as JSON on stdout */
+void
+frame_bench_report(struct frame_bench *bench, const char *client)
+{
+	struct timespec end;
+	double duration = 0.0;
+	double fps = 0.0;
+	double secs;
+
+	if (!bench)
+		return;
+
+	clock_gettime(bench->clock_id, &end);
+	if (bench->started)
+		duration = timespec_sub_to_nsec(&end, &bench->begin) / 1e9;
+
+	/* Presentation timestamps if we have them, else the wall clock */
+	if (bench->presented > 1) {
+		secs = timespec_sub_to_nsec(&bench->last_present,
+					    &bench->first_present) / 1e9;
+		if (secs > 0)
+			fps = (bench->presented - 1) / secs;
+	} else if (duration > 0) {
+		fps = bench->callbacks / duration;
+	}
+
+	printf("{\n");
+	printf("\t\"client\": \"%s\",\n", client);
+	printf("\t\"duration_s\": %.3f,\n", duration);
+	printf("\t\"presentation_feedback\": %s,\n",
+	       bench->presentation ? "true" : "false");
+	printf("\t\"presented\": %" PRIu64 ",\n", bench->presented);
+	printf("\t\"discarded\": %" PRIu64 ",\n", bench->discarded);
+	printf("\t\"frame_callbacks\": %" PRIu64 ",\n", bench->callbacks);
+	printf("\t\"fps\": %.2f,\n", fps);
+	print_distribution("latency_us", &bench->latencies, false);
+	print_distribution("frame_interval_us", &bench->intervals, true);
+	printf("}\n");
+	fflush(stdout);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FRAME_BENCH_H
+#define FRAME_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+/*
+ * The --benchmark mode shared by the simple clients.
+ *
+ * Every frame asks for presentation feedback and a frame callback of its
+ * own. Once the requested number of frames was presented, or the requested
+ * time has passed, the client stops and frame_bench_report() prints the
+ * commit to present latency, the frame callback intervals and the frame
+ * rate as JSON on stdout.
+ *
+ * All functions accept a NULL bench and then do nothing, so that clients
+ * can call them unconditionally.
+ */
+
+struct frame_bench;
+
+#define FRAME_BENCH_USAGE \
+	"  --benchmark[=<n>|=<n>s]\n" \
+	"\tRun for n frames (default 1000) or n seconds, then print\n" \
+	"\tframe timing statistics as JSON\n"
+
+struct frame_bench *
+frame_bench_create(const char *arg);
+
+void
+frame_bench_destroy(struct frame_bench *bench);
+
+void
+frame_bench_handle_global(struct frame_bench *bench,
+			  struct wl_registry *registry, uint32_t name,
+			  const char *interface, uint32_t version);
+
+void
+frame_bench_frame(struct frame_bench *bench, struct wl_surface *surface);
+
+bool
+frame_bench_done(struct frame_bench *bench);
+
+void
+frame_bench_report(struct frame_bench *bench, const char *client);
+
+#endif /* FRAME_BENCH_H */
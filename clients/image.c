@@ -45,6 +45,7 @@
 #include "shared/cairo-util.h"
 #include "shared/helpers.h"
 #include "shared/image-loader.h"
+#include "shared/xalloc.h"
 
 bool verbose;
 
@@ -53,6 +54,25 @@ bool verbose;
 		fprintf(stderr, __VA_ARGS__); \
 } while (0)
 
+/*
+ * Zoomed out views are drawn from mipmap levels, each half the size of
+ * the previous one, so that Cairo never has to filter the whole image.
+ * The levels are made of TILE_SIZE square tiles, each downscaled from up
+ * to four tiles of the previous level when it first becomes visible.
+ * Tiles are kept in a cache with a byte budget, least recently used ones
+ * are dropped first. Level 0 is the decoded image itself.
+ */
+#define TILE_SIZE 512
+#define TILE_CACHE_BYTES (256 * 1024 * 1024)
+
+struct image_tile {
+	struct wl_list link; /* image::tiles, most recently used first */
+	int level;
+	int x, y; /* in tiles */
+	cairo_surface_t *surface;
+	size_t bytes;
+};
+
 struct image {
 	struct window *window;
 
@@ -77,6 +97,10 @@ struct image {
 
 	bool initialized;
 	cairo_matrix_t matrix;
+
+	int n_levels;
+	struct wl_list tiles; /* image_tile::link */
+	size_t tile_bytes;
 };
 
 struct cli_render_intent_option {
@@ -153,6 +177,150 @@ clamp_view(struct image *image)
 	}
 }
 
+static void
+level_get_size(struct image *image, int level, int *width, int *height)
+{
+	*width = MAX(1, (image->width + (1 << level) - 1) >> level);
+	*height = MAX(1, (image->height + (1 << level) - 1) >> level);
+}
+
+static void
+tile_destroy(struct image *image, struct image_tile *tile)
+{
+	image->tile_bytes -= tile->bytes;
+	cairo_surface_destroy(tile->surface);
+	wl_list_remove(&tile->link);
+	free(tile);
+}
+
+static void
+tile_cache_trim(struct image *image)
+{
+	struct image_tile *tile;
+
+	/* Always keep the most recent tile */
+	while (image->tile_bytes > TILE_CACHE_BYTES &&
+	       image->tiles.next != image->tiles.prev) {
+		tile = container_of(image->tiles.prev, struct image_tile, link);
+		tile_destroy(image, tile);
+	}
+}
+
+static struct image_tile *
+get_tile(struct image *image, int level, int tx, int ty)
+{
+	struct image_tile *tile;
+	cairo_pattern_t *pattern;
+	int width, height, w, h;
+	int dx, dy;
+	cairo_t *cr;
+
+	assert(level > 0);
+
+	wl_list_for_each(tile, &image->tiles, link) {
+		if (tile->level == level && tile->x == tx && tile->y == ty) {
+			wl_list_remove(&tile->link);
+			wl_list_insert(&image->tiles, &tile->link);
+			return tile;
+		}
+	}
+
+	level_get_size(image, level, &width, &height);
+	w = MIN(TILE_SIZE, width - tx * TILE_SIZE);
+	h = MIN(TILE_SIZE, height - ty * TILE_SIZE);
+
+	tile = xzalloc(sizeof *tile);
+	tile->level = level;
+	tile->x = tx;
+	tile->y = ty;
+	tile->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	tile->bytes = cairo_image_surface_get_stride(tile->surface) * h;
+
+	cr = cairo_create(tile->surface);
+	cairo_scale(cr, 0.5, 0.5);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	if (level == 1) {
+		cairo_set_source_surface(cr, image->image,
+					 -tx * 2 * TILE_SIZE,
+					 -ty * 2 * TILE_SIZE);
+		pattern = cairo_get_source(cr);
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+		cairo_pattern_set_filter(pattern, CAIRO_FILTER_GOOD);
+		cairo_paint(cr);
+	} else {
+		level_get_size(image, level - 1, &width, &height);
+
+		for (dy = 0; dy < 2; dy++) {
+			for (dx = 0; dx < 2; dx++) {
+				struct image_tile *child;
+
+				if ((tx * 2 + dx) * TILE_SIZE >= width ||
+				    (ty * 2 + dy) * TILE_SIZE >= height)
+					continue;
+
+				child = get_tile(image, level - 1,
+						 tx * 2 + dx, ty * 2 + dy);
+				cairo_set_source_surface(cr, child->surface,
+							 dx * TILE_SIZE,
+							 dy * TILE_SIZE);
+				pattern = cairo_get_source(cr);
+				cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+				cairo_pattern_set_filter(pattern, CAIRO_FILTER_GOOD);
+				cairo_rectangle(cr, dx * TILE_SIZE, dy * TILE_SIZE,
+						cairo_image_surface_get_width(child->surface),
+						cairo_image_surface_get_height(child->surface));
+				cairo_fill(cr);
+			}
+		}
+	}
+
+	cairo_destroy(cr);
+
+	wl_list_insert(&image->tiles, &tile->link);
+	image->tile_bytes += tile->bytes;
+	tile_cache_trim(image);
+
+	return tile;
+}
+
+/* Draw the visible tiles of a mipmap level, cr maps image pixels */
+static void
+draw_level(struct image *image, cairo_t *cr, int level)
+{
+	double x1, y1, x2, y2;
+	int width, height;
+	int tx, ty, tx1, ty1, tx2, ty2;
+	struct image_tile *tile;
+
+	level_get_size(image, level, &width, &height);
+
+	cairo_scale(cr, 1 << level, 1 << level);
+	cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+
+	tx1 = MAX(0, (int) floor(x1 / TILE_SIZE));
+	ty1 = MAX(0, (int) floor(y1 / TILE_SIZE));
+	tx2 = MIN((width + TILE_SIZE - 1) / TILE_SIZE, (int) ceil(x2 / TILE_SIZE));
+	ty2 = MIN((height + TILE_SIZE - 1) / TILE_SIZE, (int) ceil(y2 / TILE_SIZE));
+
+	/* Tile edges on whole pixels, or seams show between them */
+	cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+
+	for (ty = ty1; ty < ty2; ty++) {
+		for (tx = tx1; tx < tx2; tx++) {
+			tile = get_tile(image, level, tx, ty);
+			cairo_set_source_surface(cr, tile->surface,
+						 tx * TILE_SIZE, ty * TILE_SIZE);
+			cairo_pattern_set_extend(cairo_get_source(cr),
+						 CAIRO_EXTEND_PAD);
+			cairo_rectangle(cr, tx * TILE_SIZE, ty * TILE_SIZE,
+					cairo_image_surface_get_width(tile->surface),
+					cairo_image_surface_get_height(tile->surface));
+			cairo_fill(cr);
+		}
+	}
+}
+
 static void
 frame_redraw_handler(struct widget *widget, void *data)
 {
@@ -186,6 +354,7 @@ image_redraw_handler(struct widget *widget, void *data)
 	struct rectangle allocation;
 	cairo_t *cr;
 	double width, height, doc_aspect, window_aspect, scale;
+	int level = 0;
 
 	widget_get_allocation(widget, &allocation);
 
@@ -214,10 +383,19 @@ image_redraw_handler(struct widget *widget, void *data)
 		clamp_view(image);
 	}
 
+	/* The smallest level with at least one pixel per output pixel */
+	scale = get_scale(image);
+	while (level + 1 < image->n_levels && scale * (2 << level) <= 1.0)
+		level++;
+
 	cairo_set_matrix(cr, &image->matrix);
-	cairo_set_source_surface(cr, image->image, 0, 0);
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_paint(cr);
+	if (level == 0) {
+		cairo_set_source_surface(cr, image->image, 0, 0);
+		cairo_paint(cr);
+	} else {
+		draw_level(image, cr, level);
+	}
 	cairo_destroy(cr);
 }
 
@@ -406,11 +584,15 @@ close_handler(void *data)
 {
 	struct image *image = data;
 
+	struct image_tile *tile, *tmp;
+
 	*image->image_counter -= 1;
 
 	if (*image->image_counter == 0)
 		display_exit(image->display);
 
+	wl_list_for_each_safe(tile, tmp, &image->tiles, link)
+		tile_destroy(image, tile);
 	cairo_surface_destroy(image->image);
 
 	free(image->filename);
@@ -464,6 +646,20 @@ image_create(struct display *display, const char *filename,
 		return NULL;
 	}
 
+	image->width = cairo_image_surface_get_width(image->image);
+	image->height = cairo_image_surface_get_height(image->image);
+	/* Down to the first level that fits in a single tile */
+	image->n_levels = 1;
+	for (;;) {
+		int w, h;
+
+		level_get_size(image, image->n_levels - 1, &w, &h);
+		if (w <= TILE_SIZE && h <= TILE_SIZE)
+			break;
+		image->n_levels++;
+	}
+	wl_list_init(&image->tiles);
+
 	image->window = window_create(display);
 	window_set_title(image->window, title);
 	window_set_appid(image->window, "org.freedesktop.weston.wayland-image");
@@ -270,6 +270,18 @@ struct keyboard {
 	struct widget *widget;
 
 	enum keyboard_state state;
+
+	/* Index of the key held down in the current layout, -1 if none */
+	int pressed_key;
+
+	/* Prerendered keys of the layout in the current state: released
+	 * keys in the top half, pressed keys in the bottom half. Only the
+	 * keys that change get copied from it to the window. */
+	cairo_surface_t *atlas;
+	const struct layout *atlas_layout;
+	enum keyboard_state atlas_state;
+	uint32_t atlas_style;
+	uint32_t atlas_scale;
 };
 
 static void __attribute__ ((format (printf, 1, 2)))
@@ -308,7 +320,8 @@ draw_key(struct keyboard *keyboard,
 	 const struct key *key,
 	 cairo_t *cr,
 	 unsigned int row,
-	 unsigned int col)
+	 unsigned int col,
+	 bool pressed)
 {
 	const char *label;
 	cairo_text_extents_t extents;
@@ -319,6 +332,12 @@ draw_key(struct keyboard *keyboard,
 			key->width * key_width, key_height);
 	cairo_clip(cr);
 
+	if (pressed) {
+		cairo_set_source_rgba(cr, 0.5, 0.5, 0.5, 0.9);
+		cairo_paint(cr);
+		cairo_set_source_rgb(cr, 0, 0, 0);
+	}
+
 	/* Paint frame */
 	cairo_rectangle(cr,
 			col * key_width, row * key_height,
@@ -357,50 +376,178 @@ get_current_layout(struct virtual_keyboard *keyboard)
 	}
 }
 
+/* Row and column of a key, in key units */
+static void
+layout_get_key_position(const struct layout *layout, int index,
+			unsigned int *row, unsigned int *col)
+{
+	int i;
+
+	*row = 0;
+	*col = 0;
+	for (i = 0; i < index; ++i) {
+		*col += layout->keys[i].width;
+		if (*col >= layout->columns) {
+			*row += 1;
+			*col = 0;
+		}
+	}
+}
+
+/* Index of the key at x, y relative to the keyboard, -1 if none */
+static int
+layout_get_key_at(const struct layout *layout, int x, int y)
+{
+	int row, col;
+	unsigned int i;
+
+	if (x < 0 || y < 0)
+		return -1;
+
+	row = y / key_height;
+	col = x / key_width + row * layout->columns;
+	for (i = 0; i < layout->count; ++i) {
+		col -= layout->keys[i].width;
+		if (col < 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static bool
+keyboard_atlas_is_stale(struct keyboard *keyboard)
+{
+	return !keyboard->atlas ||
+	       keyboard->atlas_layout != get_current_layout(keyboard->keyboard) ||
+	       keyboard->atlas_state != keyboard->state ||
+	       keyboard->atlas_style != keyboard->keyboard->preedit_style ||
+	       keyboard->atlas_scale != window_get_buffer_scale(keyboard->window);
+}
+
+static void
+keyboard_update_atlas(struct keyboard *keyboard)
+{
+	const struct layout *layout = get_current_layout(keyboard->keyboard);
+	uint32_t scale = window_get_buffer_scale(keyboard->window);
+	double width = layout->columns * key_width;
+	double height = layout->rows * key_height;
+	unsigned int i, row, col;
+	cairo_t *cr;
+	int pressed;
+
+	if (!keyboard_atlas_is_stale(keyboard))
+		return;
+
+	if (keyboard->atlas)
+		cairo_surface_destroy(keyboard->atlas);
+	keyboard->atlas = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						     width * scale,
+						     2 * height * scale);
+	cairo_surface_set_device_scale(keyboard->atlas, scale, scale);
+
+	cr = cairo_create(keyboard->atlas);
+	cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 16);
+
+	for (pressed = 0; pressed < 2; pressed++) {
+		cairo_save(cr);
+		cairo_translate(cr, 0, pressed * height);
+
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_rgba(cr, 1, 1, 1, 0.75);
+		cairo_rectangle(cr, 0, 0, width, height);
+		cairo_fill(cr);
+
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+		row = 0;
+		col = 0;
+		for (i = 0; i < layout->count; ++i) {
+			cairo_set_source_rgb(cr, 0, 0, 0);
+			draw_key(keyboard, &layout->keys[i], cr, row, col,
+				 pressed);
+			col += layout->keys[i].width;
+			if (col >= layout->columns) {
+				row += 1;
+				col = 0;
+			}
+		}
+
+		cairo_restore(cr);
+	}
+
+	cairo_destroy(cr);
+
+	keyboard->atlas_layout = layout;
+	keyboard->atlas_state = keyboard->state;
+	keyboard->atlas_style = keyboard->keyboard->preedit_style;
+	keyboard->atlas_scale = scale;
+}
+
 static void
 redraw_handler(struct widget *widget, void *data)
 {
 	struct keyboard *keyboard = data;
-	cairo_surface_t *surface;
 	struct rectangle allocation;
-	cairo_t *cr;
-	unsigned int i;
-	unsigned int row = 0, col = 0;
 	const struct layout *layout;
+	unsigned int row, col;
+	const struct key *key;
+	cairo_t *cr;
 
 	layout = get_current_layout(keyboard->keyboard);
+	keyboard_update_atlas(keyboard);
 
-	surface = window_get_surface(keyboard->window);
 	widget_get_allocation(keyboard->widget, &allocation);
 
-	cr = cairo_create(surface);
+	cr = widget_cairo_create(widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
-	cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-	cairo_set_font_size(cr, 16);
-
 	cairo_translate(cr, allocation.x, allocation.y);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(cr, 1, 1, 1, 0.75);
-	cairo_rectangle(cr, 0, 0, layout->columns * key_width, layout->rows * key_height);
 	cairo_paint(cr);
 
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-
-	for (i = 0; i < layout->count; ++i) {
-		cairo_set_source_rgb(cr, 0, 0, 0);
-		draw_key(keyboard, &layout->keys[i], cr, row, col);
-		col += layout->keys[i].width;
-		if (col >= layout->columns) {
-			row += 1;
-			col = 0;
-		}
+	cairo_set_source_surface(cr, keyboard->atlas, 0, 0);
+	cairo_rectangle(cr, 0, 0, layout->columns * key_width, layout->rows * key_height);
+	cairo_fill(cr);
+
+	if (keyboard->pressed_key >= 0 &&
+	    (unsigned int) keyboard->pressed_key < layout->count) {
+		key = &layout->keys[keyboard->pressed_key];
+		layout_get_key_position(layout, keyboard->pressed_key,
+					&row, &col);
+		cairo_set_source_surface(cr, keyboard->atlas,
+					 0, -(layout->rows * key_height));
+		cairo_rectangle(cr, col * key_width, row * key_height,
+				key->width * key_width, key_height);
+		cairo_fill(cr);
 	}
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+}
+
+static void
+keyboard_schedule_key_redraw(struct keyboard *keyboard, int index)
+{
+	const struct layout *layout = get_current_layout(keyboard->keyboard);
+	struct rectangle allocation;
+	struct rectangle area;
+	unsigned int row, col;
+
+	if (index < 0 || (unsigned int) index >= layout->count)
+		return;
+
+	widget_get_allocation(keyboard->widget, &allocation);
+	layout_get_key_position(layout, index, &row, &col);
+
+	area.x = allocation.x + col * key_width;
+	area.y = allocation.y + row * key_height;
+	area.width = layout->keys[index].width * key_width;
+	area.height = key_height;
+	widget_schedule_redraw_area(keyboard->widget, &area);
 }
 
 static void
@@ -663,6 +810,40 @@ keyboard_handle_key(struct keyboard *keyboard, uint32_t time, const struct key *
 	}
 }
 
+/* Handle a press or release at x, y relative to the window, and redraw
+ * the keys that changed */
+static void
+keyboard_handle_press(struct keyboard *keyboard, uint32_t time,
+		      int x, int y, struct input *input,
+		      enum wl_pointer_button_state state)
+{
+	const struct layout *layout;
+	struct rectangle allocation;
+	int old_pressed = keyboard->pressed_key;
+	int index;
+
+	layout = get_current_layout(keyboard->keyboard);
+	widget_get_allocation(keyboard->widget, &allocation);
+
+	index = layout_get_key_at(layout, x - allocation.x, y - allocation.y);
+	if (index >= 0)
+		keyboard_handle_key(keyboard, time, &layout->keys[index],
+				    input, state);
+
+	if (state == WL_POINTER_BUTTON_STATE_PRESSED)
+		keyboard->pressed_key = index;
+	else
+		keyboard->pressed_key = -1;
+
+	/* Shift, symbols and style keys change the labels of other keys */
+	if (keyboard_atlas_is_stale(keyboard)) {
+		widget_schedule_redraw(keyboard->widget);
+	} else if (keyboard->pressed_key != old_pressed) {
+		keyboard_schedule_key_redraw(keyboard, old_pressed);
+		keyboard_schedule_key_redraw(keyboard, keyboard->pressed_key);
+	}
+}
+
 static void
 button_handler(struct widget *widget,
 	       struct input *input, uint32_t time,
@@ -670,13 +851,7 @@ button_handler(struct widget *widget,
 	       enum wl_pointer_button_state state, void *data)
 {
 	struct keyboard *keyboard = data;
-	struct rectangle allocation;
 	int32_t x, y;
-	int row, col;
-	unsigned int i;
-	const struct layout *layout;
-
-	layout = get_current_layout(keyboard->keyboard);
 
 	if (button != BTN_LEFT) {
 		return;
@@ -684,21 +859,7 @@ button_handler(struct widget *widget,
 
 	input_get_position(input, &x, &y);
 
-	widget_get_allocation(keyboard->widget, &allocation);
-	x -= allocation.x;
-	y -= allocation.y;
-
-	row = y / key_height;
-	col = x / key_width + row * layout->columns;
-	for (i = 0; i < layout->count; ++i) {
-		col -= layout->keys[i].width;
-		if (col < 0) {
-			keyboard_handle_key(keyboard, time, &layout->keys[i], input, state);
-			break;
-		}
-	}
-
-	widget_schedule_redraw(widget);
+	keyboard_handle_press(keyboard, time, x, y, input, state);
 }
 
 static void
@@ -706,30 +867,8 @@ touch_handler(struct input *input, uint32_t time,
 	      float x, float y, uint32_t state, void *data)
 {
 	struct keyboard *keyboard = data;
-	struct rectangle allocation;
-	int row, col;
-	unsigned int i;
-	const struct layout *layout;
-
-	layout = get_current_layout(keyboard->keyboard);
-
-	widget_get_allocation(keyboard->widget, &allocation);
-
-	x -= allocation.x;
-	y -= allocation.y;
-
-	row = (int)y / key_height;
-	col = (int)x / key_width + row * layout->columns;
-	for (i = 0; i < layout->count; ++i) {
-		col -= layout->keys[i].width;
-		if (col < 0) {
-			keyboard_handle_key(keyboard, time,
-					    &layout->keys[i], input, state);
-			break;
-		}
-	}
 
-	widget_schedule_redraw(keyboard->widget);
+	keyboard_handle_press(keyboard, time, x, y, input, state);
 }
 
 static void
@@ -1001,6 +1140,7 @@ keyboard_create(struct virtual_keyboard *virtual_keyboard)
 	keyboard->keyboard = virtual_keyboard;
 	keyboard->window = window_create_custom(virtual_keyboard->display);
 	keyboard->widget = window_add_widget(keyboard->window, keyboard);
+	keyboard->pressed_key = -1;
 
 	virtual_keyboard->ips =
 		zwp_input_panel_v1_get_input_panel_surface(virtual_keyboard->input_panel,
@@ -1038,6 +1178,8 @@ keyboard_destroy(struct virtual_keyboard *virtual_keyboard)
 	if (virtual_keyboard->input_method)
 		zwp_input_method_v1_destroy(virtual_keyboard->input_method);
 
+	if (virtual_keyboard->keyboard->atlas)
+		cairo_surface_destroy(virtual_keyboard->keyboard->atlas);
 	widget_destroy(virtual_keyboard->keyboard->widget);
 	window_destroy(virtual_keyboard->keyboard->window);
 	free(virtual_keyboard->keyboard);
@@ -42,6 +42,7 @@
 #include <libweston/zalloc.h>
 #include "shared/timespec-util.h"
 #include "shared/os-compatibility.h"
+#include "frame-bench.h"
 #include "presentation-time-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 
@@ -76,6 +77,8 @@ struct display {
 	clockid_t clk_id;
 
 	struct wl_list output_list; /* struct output::link */
+
+	struct frame_bench *bench;
 };
 
 struct feedback {
@@ -308,7 +311,8 @@ destroy_window(struct window *window)
 		struct feedback *f;
 
 		f = wl_container_of(window->feedback_list.next, f, link);
-		printf("clean up feedback %u\n", f->frame_no);
+		if (!window->display->bench)
+			printf("clean up feedback %u\n", f->frame_no);
 		destroy_feedback(f);
 	}
 
@@ -468,6 +472,10 @@ feedback_presented(void *data,
 	p2p = timespec_diff_to_usec(&feedback->present, prevpresent);
 	t2p = timespec_diff_to_usec(&feedback->present, &feedback->target);
 
+	/* Keep stdout for the benchmark report */
+	if (window->display->bench)
+		goto out;
+
 	switch (window->mode) {
 	case RUN_MODE_PRESENT:
 		printf("%6u: c2p %4u ms, p2p %5d us, t2p %6d us, [%s] "
@@ -483,6 +491,7 @@ feedback_presented(void *data,
 			pflags_to_str(flags, flagstr, sizeof(flagstr)), seq);
 	}
 
+out:
 	if (window->received_feedback)
 		destroy_feedback(window->received_feedback);
 	window->received_feedback = feedback;
@@ -494,7 +503,8 @@ feedback_discarded(void *data,
 {
 	struct feedback *feedback = data;
 
-	printf("discarded %u\n", feedback->frame_no);
+	if (!feedback->window->display->bench)
+		printf("discarded %u\n", feedback->frame_no);
 
 	destroy_feedback(feedback);
 }
@@ -568,6 +578,7 @@ window_commit_next(struct window *window)
 
 	wl_surface_attach(window->surface, buffer->buffer, 0, 0);
 	wl_surface_damage(window->surface, 0, 0, window->width, window->height);
+	frame_bench_frame(window->display->bench, window->surface);
 	wl_surface_commit(window->surface);
 	buffer->busy = 1;
 }
@@ -779,6 +790,8 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		wp_presentation_add_listener(d->presentation,
 					     &presentation_listener, d);
 	}
+
+	frame_bench_handle_global(d->bench, registry, name, interface, version);
 }
 
 static void
@@ -802,7 +815,7 @@ static const struct wl_registry_listener registry_listener = {
 };
 
 static struct display *
-create_display(void)
+create_display(struct frame_bench *bench)
 {
 	struct display *display;
 
@@ -816,6 +829,7 @@ create_display(void)
 
 	display->formats = 0;
 	display->clk_id = -1;
+	display->bench = bench;
 	wl_list_init(&display->output_list);
 	display->registry = wl_display_get_registry(display->display);
 	wl_registry_add_listener(display->registry,
@@ -857,6 +871,8 @@ destroy_display(struct display *display)
 	if (display->compositor)
 		wl_compositor_destroy(display->compositor);
 
+	frame_bench_destroy(display->bench);
+
 	wl_registry_destroy(display->registry);
 	wl_display_flush(display->display);
 	wl_display_disconnect(display->display);
@@ -881,7 +897,8 @@ usage(const char *prog, int exit_code)
 		"  -p\t\trun in low-latency presentation mode\n"
 		"and 'options' may include\n"
 		"  -d msecs\temulate the time used for rendering by a delay \n"
-		"\t\tof the given milliseconds before commit\n\n",
+		"\t\tof the given milliseconds before commit\n"
+		FRAME_BENCH_USAGE "\n",
 		prog);
 
 	fprintf(stderr, "Printed timing statistics, depending on mode:\n"
@@ -907,6 +924,7 @@ main(int argc, char **argv)
 	enum run_mode mode = RUN_MODE_FEEDBACK;
 	int i;
 	int commit_delay_msecs = 0;
+	struct frame_bench *bench = NULL;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-f", argv[i]) == 0)
@@ -919,11 +937,17 @@ main(int argc, char **argv)
 			i++;
 			commit_delay_msecs = atoi(argv[i]);
 		}
+		else if (strncmp("--benchmark", argv[i], 11) == 0) {
+			frame_bench_destroy(bench);
+			bench = frame_bench_create(argv[i] + 11);
+			if (!bench)
+				usage(argv[0], EXIT_FAILURE);
+		}
 		else
 			usage(argv[0], EXIT_FAILURE);
 	}
 
-	display = create_display();
+	display = create_display(bench);
 	window = create_window(display, 250, 250, mode, commit_delay_msecs);
 	if (!window)
 		return 1;
@@ -945,10 +969,11 @@ main(int argc, char **argv)
 		break;
 	}
 
-	while (running && ret != -1)
+	while (running && ret != -1 && !frame_bench_done(bench))
 		ret = wl_display_dispatch(display->display);
 
 	fprintf(stderr, "presentation-shm exiting\n");
+	frame_bench_report(bench, "presentation-shm");
 	destroy_window(window);
 	destroy_display(display);
 
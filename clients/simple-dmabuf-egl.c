@@ -45,8 +45,10 @@
 #include <wayland-client.h>
 #include "shared/helpers.h"
 #include "shared/platform.h"
+#include "shared/string-helpers.h"
 #include "shared/weston-drm-fourcc.h"
 #include <libweston/zalloc.h>
+#include "frame-bench.h"
 #include "xdg-shell-client-protocol.h"
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "weston-direct-display-client-protocol.h"
@@ -82,6 +84,7 @@ struct display {
 	int modifiers_count;
 	int req_dmabuf_immediate;
 	bool use_explicit_sync;
+	struct frame_bench *bench;
 	struct {
 		EGLDisplay display;
 		EGLContext context;
@@ -1002,6 +1005,7 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 
 	window->callback = wl_surface_frame(window->surface);
 	wl_callback_add_listener(window->callback, &frame_listener, window);
+	frame_bench_frame(window->display->bench, window->surface);
 	wl_surface_commit(window->surface);
 	buffer->busy = 1;
 }
@@ -1079,6 +1083,9 @@ registry_handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, "weston_direct_display_v1") == 0) {
 		d->direct_display = wl_registry_bind(registry,
 						     id, &weston_direct_display_v1_interface, 1);
+	} else {
+		frame_bench_handle_global(d->bench, registry, id,
+					  interface, version);
 	}
 }
 
@@ -1119,6 +1126,8 @@ destroy_display(struct display *display)
 	if (display->compositor)
 		wl_compositor_destroy(display->compositor);
 
+	frame_bench_destroy(display->bench);
+
 	if (display->registry)
 		wl_registry_destroy(display->registry);
 
@@ -1369,7 +1378,8 @@ display_set_up_gbm(struct display *display, char const* drm_render_node)
 }
 
 static struct display *
-create_display(char const *drm_render_node, uint32_t format, int opts)
+create_display(char const *drm_render_node, uint32_t format, int opts,
+	       struct frame_bench *bench)
 {
 	struct display *display = NULL;
 
@@ -1386,6 +1396,7 @@ create_display(char const *drm_render_node, uint32_t format, int opts)
 
 	display->format = format;
 	display->req_dmabuf_immediate = opts & OPT_IMMEDIATE;
+	display->bench = bench;
 
 	display->registry = wl_display_get_registry(display->display);
 	wl_registry_add_listener(display->registry,
@@ -1474,7 +1485,10 @@ print_usage_and_exit(void)
 		"\n\t\tenables weston-direct-display extension to attempt "
 		"direct scan-out;\n\t\tnote this will cause the image to be "
 		"displayed inverted as GL uses a\n\t\tdifferent texture "
-		"coordinate system\n");
+		"coordinate system\n"
+		"\t'--benchmark[=<n>|=<n>s]'"
+		"\n\t\trun for n frames (default 1000) or n seconds, then "
+		"print\n\t\tframe timing statistics as JSON\n");
 	exit(0);
 }
 
@@ -1502,6 +1516,8 @@ main(int argc, char **argv)
 	char const *drm_render_node = "/dev/dri/renderD128";
 	int c, option_index, ret = 0;
 	int window_size = 256;
+	struct frame_bench *bench = NULL;
+	char *bench_arg;
 
 	static struct option long_options[] = {
 		{"import-immediate", required_argument, 0,  'i' },
@@ -1511,6 +1527,7 @@ main(int argc, char **argv)
 		{"format",           required_argument, 0,  'f' },
 		{"mandelbrot",       no_argument,	0,  'm' },
 		{"direct-display",   no_argument,	0,  'g' },
+		{"benchmark",        optional_argument, 0,  'b' },
 		{"help",             no_argument      , 0,  'h' },
 		{0, 0, 0, 0}
 	};
@@ -1541,12 +1558,21 @@ main(int argc, char **argv)
 		case 'f':
 			format = strtoul(optarg, NULL, 0);
 			break;
+		case 'b':
+			frame_bench_destroy(bench);
+			str_printf(&bench_arg, "%s%s", optarg ? "=" : "",
+				   optarg ? optarg : "");
+			bench = bench_arg ? frame_bench_create(bench_arg) : NULL;
+			free(bench_arg);
+			if (!bench)
+				print_usage_and_exit();
+			break;
 		default:
 			print_usage_and_exit();
 		}
 	}
 
-	display = create_display(drm_render_node, format, opts);
+	display = create_display(drm_render_node, format, opts, bench);
 	if (!display)
 		return 1;
 	window = create_window(display, window_size, window_size, opts);
@@ -1570,10 +1596,11 @@ main(int argc, char **argv)
 	if (!window->wait_for_configure)
 		redraw(window, NULL, 0);
 
-	while (running && ret != -1)
+	while (running && ret != -1 && !frame_bench_done(bench))
 		ret = wl_display_dispatch(display->display);
 
 	fprintf(stderr, "simple-dmabuf-egl exiting\n");
+	frame_bench_report(bench, "simple-dmabuf-egl");
 	destroy_window(window);
 	destroy_display(display);
 
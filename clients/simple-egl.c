@@ -55,6 +55,7 @@
 #include "shared/platform.h"
 #include "shared/weston-egl-ext.h"
 #include "shared/xalloc.h"
+#include "frame-bench.h"
 
 struct window;
 struct seat;
@@ -84,6 +85,8 @@ struct display {
 
 	struct wl_list output_list; /* struct output::link */
 
+	struct frame_bench *bench;
+
 	PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 	PFNEGLQUERYSUPPORTEDCOMPRESSIONRATESEXTPROC query_compression_rates;
 };
@@ -923,10 +926,12 @@ redraw(struct window *window)
 		window->benchmark_time = time;
 	}
 	if (time - window->benchmark_time > (benchmark_interval * 1000)) {
-		printf("%d frames in %d seconds: %f fps\n",
-		       window->frames,
-		       benchmark_interval,
-		       (float) window->frames / benchmark_interval);
+		/* --benchmark prints its own report */
+		if (!display->bench)
+			printf("%d frames in %d seconds: %f fps\n",
+			       window->frames,
+			       benchmark_interval,
+			       (float) window->frames / benchmark_interval);
 		window->benchmark_time = time;
 		window->frames = 0;
 		if (window->toggled_tearing)
@@ -990,6 +995,8 @@ redraw(struct window *window)
 		glClearColor(0.0, 0.0, 0.0, 0.5);
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	frame_bench_frame(display->bench, window->surface);
+
 	if (window->vertical_bar)
 		draw_bar(window, buffer_age, &rotation);
 	else
@@ -1346,6 +1353,9 @@ registry_handle_global(void *data, struct wl_registry *registry,
 			wl_registry_bind(registry, name,
 					 &wp_fractional_scale_manager_v1_interface,
 					 1);
+	} else {
+		frame_bench_handle_global(d->bench, registry, name,
+					  interface, version);
 	}
 }
 
@@ -1393,6 +1403,7 @@ usage(int error_code)
 		"  -p\tPresent surface opaquely, regardless of alpha\n"
 		"  -c <bpc>\tCompress the texture to given bitrate;\n"
 		"          \tDefault fixed-rate value is used if -1 is specified.\n"
+		FRAME_BENCH_USAGE
 		"  -h\tThis help text\n\n");
 
 	exit(error_code);
@@ -1450,7 +1461,11 @@ main(int argc, char **argv)
 			window.present_opaque = 1;
 		else if (strcmp("-c", argv[i]) == 0 && i+1 < argc)
 			window.compression_rate = atoi(argv[++i]);
-		else if (strcmp("-h", argv[i]) == 0)
+		else if (strncmp("--benchmark", argv[i], 11) == 0) {
+			display.bench = frame_bench_create(argv[i] + 11);
+			if (!display.bench)
+				usage(EXIT_FAILURE);
+		} else if (strcmp("-h", argv[i]) == 0)
 			usage(EXIT_SUCCESS);
 		else
 			usage(EXIT_FAILURE);
@@ -1487,12 +1502,13 @@ main(int argc, char **argv)
 	sigint.sa_flags = SA_RESETHAND;
 	sigaction(SIGINT, &sigint, NULL);
 
-	while (running && ret != -1) {
+	while (running && ret != -1 && !frame_bench_done(display.bench)) {
 		ret = wl_display_dispatch_pending(display.display);
 		redraw(&window);
 	}
 
 	fprintf(stderr, "simple-egl exiting\n");
+	frame_bench_report(display.bench, "simple-egl");
 
 	destroy_surface(&window);
 	fini_egl(&display);
@@ -1531,6 +1547,8 @@ out_no_xdg_shell:
 	if (display.fractional_scale_manager)
 		wp_fractional_scale_manager_v1_destroy(display.fractional_scale_manager);
 
+	frame_bench_destroy(display.bench);
+
 	wl_registry_destroy(display.registry);
 	wl_display_flush(display.display);
 	wl_display_disconnect(display.display);
@@ -0,0 +1,1196 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * weston-simple-load: a synthetic load generator
+ *
+ * Maps a number of toplevels, each with a number of desynchronized
+ * subsurfaces, and keeps committing new content to all of them, either
+ * driven by frame callbacks or at a fixed rate. Every commit asks for
+ * presentation feedback; on exit the achieved presentation rate and the
+ * commit-to-present latency percentiles are printed, and optionally
+ * written as JSON.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+#include <wayland-client.h>
+
+#ifdef HAVE_GBM
+#include <gbm.h>
+#endif
+
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include <libweston/zalloc.h>
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+#define NUM_BUFFERS 3
+#define SCATTER_RECTS 8
+
+enum buffer_type {
+	BUFFER_SHM,
+	BUFFER_SINGLE_PIXEL,
+	BUFFER_DMABUF,
+};
+
+static const char * const buffer_type_name[] = {
+	[BUFFER_SHM] = "shm",
+	[BUFFER_SINGLE_PIXEL] = "single-pixel",
+	[BUFFER_DMABUF] = "dmabuf",
+};
+
+enum damage_pattern {
+	DAMAGE_FULL,
+	DAMAGE_PARTIAL,
+	DAMAGE_SCATTER,
+};
+
+static const char * const damage_pattern_name[] = {
+	[DAMAGE_FULL] = "full",
+	[DAMAGE_PARTIAL] = "partial",
+	[DAMAGE_SCATTER] = "scatter",
+};
+
+struct options {
+	int toplevels;
+	int subsurfaces;
+	int rate;
+	int width;
+	int height;
+	int duration;
+	enum buffer_type buffer_type;
+	enum damage_pattern damage;
+	const char *drm_render_node;
+	const char *json_path;
+};
+
+struct display {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct xdg_wm_base *wm_base;
+	struct wl_shm *shm;
+	struct wp_viewporter *viewporter;
+	struct wp_single_pixel_buffer_manager_v1 *single_pixel_manager;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	struct wp_presentation *presentation;
+	clockid_t clk_id;
+#ifdef HAVE_GBM
+	int drm_fd;
+	struct gbm_device *gbm_device;
+#endif
+};
+
+struct buffer {
+	struct load_surface *surface;
+	struct wl_buffer *wl_buffer;
+	bool busy;
+	void *data;
+	size_t size;
+	int stride;
+#ifdef HAVE_GBM
+	struct gbm_bo *bo;
+#endif
+};
+
+struct load_surface {
+	struct load *load;
+	struct wl_surface *wl_surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct wl_subsurface *subsurface;
+	struct wp_viewport *viewport;
+	uint32_t configure_serial;
+	bool mapped;
+	int width, height;
+
+	struct buffer buffers[NUM_BUFFERS];
+	struct wl_callback *frame;
+	uint32_t frame_no;
+	/* a frame-driven commit found every buffer busy */
+	bool stalled;
+
+	struct wl_list link; /* struct load::surface_list */
+};
+
+struct frame_feedback {
+	struct load *load;
+	struct wp_presentation_feedback *feedback;
+	struct timespec commit;
+	struct wl_list link; /* struct load::feedback_list */
+};
+
+struct load {
+	struct display *display;
+	struct options opts;
+
+	struct wl_list surface_list;
+	struct wl_list feedback_list;
+
+	/* commit-to-present latency of every presented frame, in us */
+	struct wl_array latencies;
+
+	uint64_t commits;
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t skipped_busy;
+	struct timespec begin;
+	struct timespec end;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void
+load_surface_commit(struct load_surface *surface);
+
+static void
+buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct buffer *buffer = data;
+	struct load_surface *surface = buffer->surface;
+
+	buffer->busy = false;
+
+	/* Without a commit no frame callback will come, so resume here. */
+	if (surface->stalled && running) {
+		surface->stalled = false;
+		load_surface_commit(surface);
+	}
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static void
+single_pixel_release(void *data, struct wl_buffer *wl_buffer)
+{
+	wl_buffer_destroy(wl_buffer);
+}
+
+static const struct wl_buffer_listener single_pixel_listener = {
+	single_pixel_release
+};
+
+static int
+create_shm_buffer(struct display *display, struct buffer *buffer,
+		  int width, int height)
+{
+	struct wl_shm_pool *pool;
+	int fd;
+
+	buffer->stride = width * 4;
+	buffer->size = buffer->stride * height;
+
+	fd = os_create_anonymous_file(buffer->size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %s\n",
+			buffer->size, strerror(errno));
+		return -1;
+	}
+
+	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		buffer->data = NULL;
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, buffer->size);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+						      buffer->stride,
+						      WL_SHM_FORMAT_XRGB8888);
+	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return 0;
+}
+
+#ifdef HAVE_GBM
+static int
+create_dmabuf_buffer(struct display *display, struct buffer *buffer,
+		     int width, int height)
+{
+	struct zwp_linux_buffer_params_v1 *params;
+	uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+	int fd;
+
+	/* Linear, so that the CPU can fill it through gbm_bo_map(). */
+	buffer->bo = gbm_bo_create(display->gbm_device, width, height,
+				   DRM_FORMAT_XRGB8888,
+				   GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+	if (!buffer->bo) {
+		fprintf(stderr, "could not create a %dx%d GBM bo\n",
+			width, height);
+		return -1;
+	}
+
+	fd = gbm_bo_get_fd(buffer->bo);
+	if (fd < 0) {
+		fprintf(stderr, "could not export the GBM bo\n");
+		return -1;
+	}
+
+	params = zwp_linux_dmabuf_v1_create_params(display->dmabuf);
+	zwp_linux_buffer_params_v1_add(params, fd, 0, 0,
+				       gbm_bo_get_stride(buffer->bo),
+				       modifier >> 32, modifier & 0xffffffff);
+	buffer->wl_buffer =
+		zwp_linux_buffer_params_v1_create_immed(params, width, height,
+							DRM_FORMAT_XRGB8888, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	close(fd);
+
+	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+
+	return 0;
+}
+#endif
+
+static void
+buffer_fini(struct buffer *buffer)
+{
+	if (buffer->wl_buffer)
+		wl_buffer_destroy(buffer->wl_buffer);
+	if (buffer->data)
+		munmap(buffer->data, buffer->size);
+#ifdef HAVE_GBM
+	if (buffer->bo)
+		gbm_bo_destroy(buffer->bo);
+#endif
+}
+
+static void
+fill_rect(uint32_t *pixels, int stride, int x, int y, int width, int height,
+	  uint32_t color)
+{
+	int i, j;
+
+	for (j = y; j < y + height; j++) {
+		uint32_t *row = (uint32_t *)((char *)pixels + j * stride);
+
+		for (i = x; i < x + width; i++)
+			row[i] = color;
+	}
+}
+
+static void
+buffer_fill(struct buffer *buffer, int x, int y, int width, int height,
+	    uint32_t color)
+{
+#ifdef HAVE_GBM
+	if (buffer->bo) {
+		uint32_t stride;
+		void *map_data = NULL;
+		void *pixels;
+
+		pixels = gbm_bo_map(buffer->bo, x, y, width, height,
+				    GBM_BO_TRANSFER_WRITE, &stride, &map_data);
+		if (!pixels)
+			return;
+		fill_rect(pixels, stride, 0, 0, width, height, color);
+		gbm_bo_unmap(buffer->bo, map_data);
+		return;
+	}
+#endif
+
+	fill_rect(buffer->data, buffer->stride, x, y, width, height, color);
+}
+
+static struct buffer *
+load_surface_next_buffer(struct load_surface *surface)
+{
+	int i;
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		if (!surface->buffers[i].busy)
+			return &surface->buffers[i];
+
+	return NULL;
+}
+
+static void
+feedback_destroy(struct frame_feedback *feedback)
+{
+	wp_presentation_feedback_destroy(feedback->feedback);
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh_nsec, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct frame_feedback *feedback = data;
+	struct load *load = feedback->load;
+	struct timespec present;
+	uint32_t *latency;
+	int64_t nsec;
+
+	timespec_from_proto(&present, tv_sec_hi, tv_sec_lo, tv_nsec);
+	nsec = timespec_sub_to_nsec(&present, &feedback->commit);
+
+	latency = wl_array_add(&load->latencies, sizeof(*latency));
+	if (latency)
+		*latency = nsec > 0 ? nsec / 1000 : 0;
+	load->presented++;
+
+	feedback_destroy(feedback);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct frame_feedback *feedback = data;
+
+	feedback->load->discarded++;
+	feedback_destroy(feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static void
+load_surface_damage(struct load_surface *surface, struct buffer *buffer,
+		    uint32_t color)
+{
+	enum damage_pattern pattern = surface->load->opts.damage;
+	int w = surface->width, h = surface->height;
+	int x, y, i;
+
+	if (surface->load->opts.buffer_type == BUFFER_SINGLE_PIXEL)
+		pattern = DAMAGE_FULL;
+
+	switch (pattern) {
+	case DAMAGE_FULL:
+		if (buffer)
+			buffer_fill(buffer, 0, 0, w, h, color);
+		wl_surface_damage_buffer(surface->wl_surface, 0, 0, w, h);
+		break;
+	case DAMAGE_PARTIAL:
+		/* A quarter-size rectangle moving along the diagonal. */
+		x = (surface->frame_no * 4) % (w - w / 4 + 1);
+		y = (surface->frame_no * 4) % (h - h / 4 + 1);
+		if (buffer)
+			buffer_fill(buffer, x, y, w / 4, h / 4, color);
+		wl_surface_damage_buffer(surface->wl_surface, x, y, w / 4, h / 4);
+		break;
+	case DAMAGE_SCATTER:
+		/* Small rectangles spread over the surface. */
+		for (i = 0; i < SCATTER_RECTS; i++) {
+			x = ((surface->frame_no + i * 7) * 13) % (w - w / 16 + 1);
+			y = ((surface->frame_no + i * 3) * 11) % (h - h / 16 + 1);
+			if (buffer)
+				buffer_fill(buffer, x, y, w / 16, h / 16, color);
+			wl_surface_damage_buffer(surface->wl_surface, x, y,
+						 w / 16, h / 16);
+		}
+		break;
+	}
+}
+
+static const struct wl_callback_listener frame_listener;
+
+static void
+load_surface_commit(struct load_surface *surface)
+{
+	struct load *load = surface->load;
+	struct display *display = load->display;
+	struct frame_feedback *feedback;
+	struct buffer *buffer = NULL;
+	struct wl_buffer *wl_buffer;
+	uint32_t color;
+
+	if (!surface->mapped)
+		return;
+
+	surface->frame_no++;
+	color = 0xff000000 | (surface->frame_no * 0x010305);
+
+	if (load->opts.buffer_type == BUFFER_SINGLE_PIXEL) {
+		wl_buffer = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+			display->single_pixel_manager,
+			((color >> 16) & 0xff) * 0x01010101u,
+			((color >> 8) & 0xff) * 0x01010101u,
+			(color & 0xff) * 0x01010101u, UINT32_MAX);
+		wl_buffer_add_listener(wl_buffer, &single_pixel_listener, NULL);
+	} else {
+		buffer = load_surface_next_buffer(surface);
+		if (!buffer) {
+			load->skipped_busy++;
+			surface->stalled = load->opts.rate == 0;
+			return;
+		}
+		wl_buffer = buffer->wl_buffer;
+		buffer->busy = true;
+	}
+
+	if (surface->configure_serial) {
+		xdg_surface_ack_configure(surface->xdg_surface,
+					  surface->configure_serial);
+		surface->configure_serial = 0;
+	}
+
+	wl_surface_attach(surface->wl_surface, wl_buffer, 0, 0);
+	load_surface_damage(surface, buffer, color);
+
+	if (load->opts.rate == 0) {
+		surface->frame = wl_surface_frame(surface->wl_surface);
+		wl_callback_add_listener(surface->frame, &frame_listener,
+					 surface);
+	}
+
+	if (display->presentation) {
+		feedback = xzalloc(sizeof(*feedback));
+		feedback->load = load;
+		feedback->feedback = wp_presentation_feedback(display->presentation,
+							      surface->wl_surface);
+		wp_presentation_feedback_add_listener(feedback->feedback,
+						      &feedback_listener,
+						      feedback);
+		clock_gettime(display->clk_id, &feedback->commit);
+		wl_list_insert(&load->feedback_list, &feedback->link);
+	}
+
+	wl_surface_commit(surface->wl_surface);
+	load->commits++;
+}
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct load_surface *surface = data;
+
+	wl_callback_destroy(callback);
+	surface->frame = NULL;
+
+	if (running)
+		load_surface_commit(surface);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame_done
+};
+
+static void
+xdg_wm_base_handle_ping(void *data, struct xdg_wm_base *xdg_wm_base,
+			uint32_t serial)
+{
+	xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+	.ping = xdg_wm_base_handle_ping,
+};
+
+static void
+xdg_surface_handle_configure(void *data, struct xdg_surface *xdg_surface,
+			     uint32_t serial)
+{
+	struct load_surface *surface = data;
+
+	surface->configure_serial = serial;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_handle_configure,
+};
+
+static void
+xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+			      int32_t width, int32_t height,
+			      struct wl_array *states)
+{
+	/* The size is fixed; ignore the suggestion. */
+}
+
+static void
+xdg_toplevel_handle_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+	running = 0;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	.configure = xdg_toplevel_handle_configure,
+	.close = xdg_toplevel_handle_close,
+};
+
+static struct load_surface *
+load_surface_create(struct load *load, struct load_surface *parent,
+		    int x, int y, int width, int height)
+{
+	struct display *display = load->display;
+	struct load_surface *surface;
+	int i, ret = 0;
+
+	surface = xzalloc(sizeof(*surface));
+	surface->load = load;
+	surface->width = width;
+	surface->height = height;
+	surface->wl_surface = wl_compositor_create_surface(display->compositor);
+
+	if (parent) {
+		surface->subsurface =
+			wl_subcompositor_get_subsurface(display->subcompositor,
+							surface->wl_surface,
+							parent->wl_surface);
+		wl_subsurface_set_position(surface->subsurface, x, y);
+		wl_subsurface_set_desync(surface->subsurface);
+		surface->mapped = true;
+	} else {
+		surface->xdg_surface =
+			xdg_wm_base_get_xdg_surface(display->wm_base,
+						    surface->wl_surface);
+		xdg_surface_add_listener(surface->xdg_surface,
+					 &xdg_surface_listener, surface);
+		surface->xdg_toplevel =
+			xdg_surface_get_toplevel(surface->xdg_surface);
+		xdg_toplevel_add_listener(surface->xdg_toplevel,
+					  &xdg_toplevel_listener, surface);
+		xdg_toplevel_set_title(surface->xdg_toplevel,
+				       "simple-load");
+		xdg_toplevel_set_min_size(surface->xdg_toplevel, width, height);
+		xdg_toplevel_set_max_size(surface->xdg_toplevel, width, height);
+		wl_surface_commit(surface->wl_surface);
+	}
+
+	if (load->opts.buffer_type == BUFFER_SINGLE_PIXEL) {
+		surface->viewport = wp_viewporter_get_viewport(display->viewporter,
+							       surface->wl_surface);
+		wp_viewport_set_destination(surface->viewport, width, height);
+	}
+
+	for (i = 0; i < NUM_BUFFERS && ret == 0; i++) {
+		surface->buffers[i].surface = surface;
+		switch (load->opts.buffer_type) {
+		case BUFFER_SHM:
+			ret = create_shm_buffer(display, &surface->buffers[i],
+						width, height);
+			break;
+		case BUFFER_DMABUF:
+#ifdef HAVE_GBM
+			ret = create_dmabuf_buffer(display, &surface->buffers[i],
+						   width, height);
+#endif
+			break;
+		case BUFFER_SINGLE_PIXEL:
+			break;
+		}
+	}
+	if (ret < 0)
+		exit(EXIT_FAILURE);
+
+	wl_list_insert(load->surface_list.prev, &surface->link);
+
+	return surface;
+}
+
+static void
+load_surface_destroy(struct load_surface *surface)
+{
+	int i;
+
+	if (surface->frame)
+		wl_callback_destroy(surface->frame);
+	if (surface->viewport)
+		wp_viewport_destroy(surface->viewport);
+	if (surface->subsurface)
+		wl_subsurface_destroy(surface->subsurface);
+	if (surface->xdg_toplevel)
+		xdg_toplevel_destroy(surface->xdg_toplevel);
+	if (surface->xdg_surface)
+		xdg_surface_destroy(surface->xdg_surface);
+	wl_surface_destroy(surface->wl_surface);
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		buffer_fini(&surface->buffers[i]);
+
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+/* Create the toplevels, each with its subsurfaces laid out in a grid. */
+static void
+load_create_surfaces(struct load *load)
+{
+	const struct options *opts = &load->opts;
+	struct load_surface *toplevel, *surface;
+	int columns, cell_w, cell_h;
+	int t, s;
+
+	columns = ceil(sqrt(opts->subsurfaces));
+	if (columns < 1)
+		columns = 1;
+	cell_w = opts->width / columns;
+	cell_h = opts->height / columns;
+
+	for (t = 0; t < opts->toplevels; t++) {
+		toplevel = load_surface_create(load, NULL, 0, 0,
+					       opts->width, opts->height);
+		for (s = 0; s < opts->subsurfaces; s++)
+			load_surface_create(load, toplevel,
+					    (s % columns) * cell_w,
+					    (s / columns) * cell_h,
+					    MAX(cell_w - 4, 4), MAX(cell_h - 4, 4));
+	}
+
+	/* Wait for the initial configure events of the toplevels. */
+	wl_display_roundtrip(load->display->display);
+
+	wl_list_for_each(surface, &load->surface_list, link)
+		if (surface->xdg_surface)
+			surface->mapped = true;
+}
+
+static void
+load_commit_all(struct load *load)
+{
+	struct load_surface *surface;
+
+	/* Subsurfaces first, so a toplevel commit maps them on its first
+	 * round; they are in desync mode afterwards anyway. */
+	wl_list_for_each_reverse(surface, &load->surface_list, link)
+		load_surface_commit(surface);
+}
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t *)a;
+	uint32_t vb = *(const uint32_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+static uint32_t
+percentile(const uint32_t *sorted, size_t count, unsigned int pct)
+{
+	if (count == 0)
+		return 0;
+
+	return sorted[MIN(count - 1, count * pct / 100)];
+}
+
+static void
+load_report(struct load *load)
+{
+	const struct options *opts = &load->opts;
+	uint32_t *lat = load->latencies.data;
+	size_t count = load->latencies.size / sizeof(*lat);
+	unsigned int surfaces = opts->toplevels * (1 + opts->subsurfaces);
+	double secs;
+	double fps;
+	FILE *fp;
+
+	qsort(lat, count, sizeof(*lat), compare_uint32);
+	secs = timespec_sub_to_nsec(&load->end, &load->begin) / 1e9;
+	fps = secs > 0 ? load->presented / secs : 0.0;
+
+	printf("surfaces: %u (%d toplevels, %d subsurfaces each), "
+	       "buffers: %s, damage: %s, rate: %s\n",
+	       surfaces, opts->toplevels, opts->subsurfaces,
+	       buffer_type_name[opts->buffer_type],
+	       damage_pattern_name[opts->damage],
+	       opts->rate ? "fixed" : "frame callbacks");
+	printf("duration %.2f s: %" PRIu64 " commits, %" PRIu64 " presented, "
+	       "%" PRIu64 " discarded, %" PRIu64 " skipped (buffers busy)\n",
+	       secs, load->commits, load->presented, load->discarded,
+	       load->skipped_busy);
+	printf("achieved %.1f presents/s, %.1f per surface\n",
+	       fps, fps / surfaces);
+	printf("commit to present latency (us): p50 %u, p90 %u, p99 %u, "
+	       "max %u\n", percentile(lat, count, 50),
+	       percentile(lat, count, 90), percentile(lat, count, 99),
+	       count ? lat[count - 1] : 0);
+
+	if (!opts->json_path)
+		return;
+
+	fp = fopen(opts->json_path, "w");
+	if (!fp) {
+		fprintf(stderr, "failed to open '%s': %s\n",
+			opts->json_path, strerror(errno));
+		return;
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"toplevels\": %d,\n", opts->toplevels);
+	fprintf(fp, "\t\"subsurfaces\": %d,\n", opts->subsurfaces);
+	fprintf(fp, "\t\"size\": [%d, %d],\n", opts->width, opts->height);
+	fprintf(fp, "\t\"buffer_type\": \"%s\",\n",
+		buffer_type_name[opts->buffer_type]);
+	fprintf(fp, "\t\"damage\": \"%s\",\n", damage_pattern_name[opts->damage]);
+	fprintf(fp, "\t\"rate\": %d,\n", opts->rate);
+	fprintf(fp, "\t\"duration_s\": %.3f,\n", secs);
+	fprintf(fp, "\t\"commits\": %" PRIu64 ",\n", load->commits);
+	fprintf(fp, "\t\"presented\": %" PRIu64 ",\n", load->presented);
+	fprintf(fp, "\t\"discarded\": %" PRIu64 ",\n", load->discarded);
+	fprintf(fp, "\t\"skipped_busy\": %" PRIu64 ",\n", load->skipped_busy);
+	fprintf(fp, "\t\"presents_per_s\": %.2f,\n", fps);
+	fprintf(fp, "\t\"latency_us\": { \"p50\": %u, \"p90\": %u, "
+		"\"p99\": %u, \"max\": %u }\n",
+		percentile(lat, count, 50), percentile(lat, count, 90),
+		percentile(lat, count, 99), count ? lat[count - 1] : 0);
+	fprintf(fp, "}\n");
+	fclose(fp);
+}
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *d = data;
+
+	d->clk_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct display *d = data;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		d->compositor = wl_registry_bind(registry, name,
+						 &wl_compositor_interface, 1);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		d->subcompositor = wl_registry_bind(registry, name,
+						    &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		d->wm_base = wl_registry_bind(registry, name,
+					      &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(d->wm_base, &xdg_wm_base_listener, d);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		d->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+		d->viewporter = wl_registry_bind(registry, name,
+						 &wp_viewporter_interface, 1);
+	} else if (strcmp(interface,
+			  wp_single_pixel_buffer_manager_v1_interface.name) == 0) {
+		d->single_pixel_manager =
+			wl_registry_bind(registry, name,
+					 &wp_single_pixel_buffer_manager_v1_interface, 1);
+	} else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 &&
+		   version >= 2) {
+		d->dmabuf = wl_registry_bind(registry, name,
+					     &zwp_linux_dmabuf_v1_interface, 2);
+	} else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+		d->presentation = wl_registry_bind(registry, name,
+						   &wp_presentation_interface, 1);
+		wp_presentation_add_listener(d->presentation,
+					     &presentation_listener, d);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static struct display *
+create_display(const struct options *opts)
+{
+	struct display *display;
+
+	display = xzalloc(sizeof(*display));
+	display->clk_id = CLOCK_MONOTONIC;
+	display->display = wl_display_connect(NULL);
+	if (!display->display) {
+		fprintf(stderr, "failed to connect to the compositor\n");
+		exit(EXIT_FAILURE);
+	}
+
+	display->registry = wl_display_get_registry(display->display);
+	wl_registry_add_listener(display->registry, &registry_listener, display);
+	wl_display_roundtrip(display->display);
+
+	if (!display->compositor || !display->wm_base || !display->shm ||
+	    (opts->subsurfaces > 0 && !display->subcompositor)) {
+		fprintf(stderr, "required globals are missing\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!display->presentation)
+		fprintf(stderr, "no wp_presentation global, latency "
+			"will not be reported\n");
+
+	switch (opts->buffer_type) {
+	case BUFFER_SHM:
+		break;
+	case BUFFER_SINGLE_PIXEL:
+		if (!display->single_pixel_manager || !display->viewporter) {
+			fprintf(stderr, "single-pixel buffers need "
+				"wp_single_pixel_buffer_manager_v1 and "
+				"wp_viewporter\n");
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case BUFFER_DMABUF:
+#ifdef HAVE_GBM
+		if (!display->dmabuf) {
+			fprintf(stderr, "no zwp_linux_dmabuf_v1 global\n");
+			exit(EXIT_FAILURE);
+		}
+		display->drm_fd = open(opts->drm_render_node, O_RDWR | O_CLOEXEC);
+		if (display->drm_fd < 0) {
+			fprintf(stderr, "failed to open %s: %s\n",
+				opts->drm_render_node, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		display->gbm_device = gbm_create_device(display->drm_fd);
+		if (!display->gbm_device) {
+			fprintf(stderr, "failed to create a GBM device\n");
+			exit(EXIT_FAILURE);
+		}
+#else
+		fprintf(stderr, "dmabuf buffers need GBM support, which was "
+			"not available at build time\n");
+		exit(EXIT_FAILURE);
+#endif
+		break;
+	}
+
+	/* Get the presentation clock id. */
+	wl_display_roundtrip(display->display);
+
+	return display;
+}
+
+static void
+destroy_display(struct display *display)
+{
+#ifdef HAVE_GBM
+	if (display->gbm_device) {
+		gbm_device_destroy(display->gbm_device);
+		close(display->drm_fd);
+	}
+#endif
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
+	if (display->dmabuf)
+		zwp_linux_dmabuf_v1_destroy(display->dmabuf);
+	if (display->single_pixel_manager)
+		wp_single_pixel_buffer_manager_v1_destroy(display->single_pixel_manager);
+	if (display->viewporter)
+		wp_viewporter_destroy(display->viewporter);
+	if (display->shm)
+		wl_shm_destroy(display->shm);
+	if (display->wm_base)
+		xdg_wm_base_destroy(display->wm_base);
+	if (display->subcompositor)
+		wl_subcompositor_destroy(display->subcompositor);
+	if (display->compositor)
+		wl_compositor_destroy(display->compositor);
+	wl_registry_destroy(display->registry);
+	wl_display_flush(display->display);
+	wl_display_disconnect(display->display);
+	free(display);
+}
+
+static int
+create_rate_timer(int rate)
+{
+	struct itimerspec its = { 0 };
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "timerfd_create failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	its.it_interval.tv_nsec = 1000000000L / rate;
+	its.it_value = its.it_interval;
+	timerfd_settime(fd, 0, &its, NULL);
+
+	return fd;
+}
+
+static void
+run(struct load *load)
+{
+	struct wl_display *wl_display = load->display->display;
+	struct pollfd fds[2];
+	struct timespec now;
+	uint64_t expirations;
+	int nfds = 1;
+	int ret;
+
+	fds[0].fd = wl_display_get_fd(wl_display);
+	fds[0].events = POLLIN;
+	if (load->opts.rate > 0) {
+		fds[1].fd = create_rate_timer(load->opts.rate);
+		fds[1].events = POLLIN;
+		nfds = 2;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &load->begin);
+	load_commit_all(load);
+
+	while (running) {
+		while (wl_display_prepare_read(wl_display) != 0)
+			wl_display_dispatch_pending(wl_display);
+
+		if (wl_display_flush(wl_display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(wl_display);
+			break;
+		}
+
+		ret = poll(fds, nfds, 100);
+		if (ret < 0 && errno != EINTR) {
+			wl_display_cancel_read(wl_display);
+			break;
+		}
+
+		if (ret > 0 && (fds[0].revents & POLLIN)) {
+			if (wl_display_read_events(wl_display) < 0)
+				break;
+		} else {
+			wl_display_cancel_read(wl_display);
+		}
+		if (wl_display_dispatch_pending(wl_display) < 0)
+			break;
+
+		if (nfds > 1 && ret > 0 && (fds[1].revents & POLLIN) &&
+		    read(fds[1].fd, &expirations, sizeof(expirations)) > 0)
+			load_commit_all(load);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (load->opts.duration > 0 &&
+		    timespec_sub_to_msec(&now, &load->begin) >=
+		    load->opts.duration * 1000)
+			running = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &load->end);
+
+	/* Collect the feedback of the frames still in flight. */
+	wl_display_roundtrip(wl_display);
+
+	if (nfds > 1)
+		close(fds[1].fd);
+}
+
+static void
+signal_int(int signum)
+{
+	running = 0;
+}
+
+static void
+print_usage_and_exit(int exit_code)
+{
+	fprintf(stderr, "usage: weston-simple-load [options]\n"
+		"\t'-n,--toplevels=<>'\n\t\tnumber of toplevels (default: 1)\n"
+		"\t'-s,--subsurfaces=<>'\n\t\tnumber of subsurfaces per "
+		"toplevel (default: 0)\n"
+		"\t'-r,--rate=<>'\n\t\tcommits per second for every surface; "
+		"0 to follow frame callbacks (default: 0)\n"
+		"\t'-b,--buffer=shm|single-pixel|dmabuf'\n\t\tbuffer type "
+		"(default: shm)\n"
+		"\t'-d,--damage=full|partial|scatter'\n\t\tdamage pattern "
+		"(default: full)\n"
+		"\t'-w,--width=<>', '-h,--height=<>'\n\t\ttoplevel size "
+		"(default: 256x256)\n"
+		"\t'-t,--duration=<>'\n\t\tseconds to run, 0 until "
+		"interrupted (default: 10)\n"
+		"\t'-D,--drm-render-node=<>'\n\t\trender node for dmabuf "
+		"buffers (default: /dev/dri/renderD128)\n"
+		"\t'-j,--json=<>'\n\t\talso write the report as JSON to "
+		"this file\n");
+	exit(exit_code);
+}
+
+static int
+parse_name(const char *value, const char * const *names, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (strcmp(value, names[i]) == 0)
+			return i;
+
+	print_usage_and_exit(EXIT_FAILURE);
+	return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sigint;
+	struct load load = { 0 };
+	struct load_surface *surface, *tmp;
+	struct frame_feedback *feedback, *ftmp;
+	int c, option_index;
+
+	static struct option long_options[] = {
+		{"toplevels",       required_argument, 0, 'n' },
+		{"subsurfaces",     required_argument, 0, 's' },
+		{"rate",            required_argument, 0, 'r' },
+		{"buffer",          required_argument, 0, 'b' },
+		{"damage",          required_argument, 0, 'd' },
+		{"width",           required_argument, 0, 'w' },
+		{"height",          required_argument, 0, 'h' },
+		{"duration",        required_argument, 0, 't' },
+		{"drm-render-node", required_argument, 0, 'D' },
+		{"json",            required_argument, 0, 'j' },
+		{"help",            no_argument,       0, 'H' },
+		{0, 0, 0, 0}
+	};
+
+	load.opts.toplevels = 1;
+	load.opts.width = 256;
+	load.opts.height = 256;
+	load.opts.duration = 10;
+	load.opts.drm_render_node = "/dev/dri/renderD128";
+
+	while ((c = getopt_long(argc, argv, "n:s:r:b:d:w:h:t:D:j:",
+				long_options, &option_index)) != -1) {
+		switch (c) {
+		case 'n':
+			load.opts.toplevels = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			load.opts.subsurfaces = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			load.opts.rate = strtol(optarg, NULL, 10);
+			break;
+		case 'b':
+			load.opts.buffer_type =
+				parse_name(optarg, buffer_type_name,
+					   ARRAY_LENGTH(buffer_type_name));
+			break;
+		case 'd':
+			load.opts.damage =
+				parse_name(optarg, damage_pattern_name,
+					   ARRAY_LENGTH(damage_pattern_name));
+			break;
+		case 'w':
+			load.opts.width = strtol(optarg, NULL, 10);
+			break;
+		case 'h':
+			load.opts.height = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			load.opts.duration = strtol(optarg, NULL, 10);
+			break;
+		case 'D':
+			load.opts.drm_render_node = optarg;
+			break;
+		case 'j':
+			load.opts.json_path = optarg;
+			break;
+		case 'H':
+			print_usage_and_exit(EXIT_SUCCESS);
+		default:
+			print_usage_and_exit(EXIT_FAILURE);
+		}
+	}
+
+	if (load.opts.toplevels < 1 || load.opts.subsurfaces < 0 ||
+	    load.opts.rate < 0 || load.opts.width < 16 ||
+	    load.opts.height < 16 || load.opts.duration < 0)
+		print_usage_and_exit(EXIT_FAILURE);
+
+	wl_list_init(&load.surface_list);
+	wl_list_init(&load.feedback_list);
+	wl_array_init(&load.latencies);
+
+	load.display = create_display(&load.opts);
+	load_create_surfaces(&load);
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	run(&load);
+	load_report(&load);
+
+	wl_list_for_each_safe(feedback, ftmp, &load.feedback_list, link)
+		feedback_destroy(feedback);
+	/* Subsurfaces were added after their parents; destroy them first. */
+	wl_list_for_each_reverse_safe(surface, tmp, &load.surface_list, link)
+		load_surface_destroy(surface);
+	wl_array_release(&load.latencies);
+	destroy_display(load.display);
+
+	return 0;
+}
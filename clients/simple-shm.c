@@ -40,6 +40,7 @@
 #include <wayland-client.h>
 #include "shared/os-compatibility.h"
 #include <libweston/zalloc.h>
+#include "frame-bench.h"
 #include "xdg-shell-client-protocol.h"
 
 #define MAX_BUFFER_ALLOC	2
@@ -53,6 +54,7 @@ struct display {
 	struct wl_keyboard *keyboard;
 	struct wl_shm *shm;
 	bool has_xrgb;
+	struct frame_bench *bench;
 };
 
 struct buffer {
@@ -504,6 +506,7 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 
 	window->callback = wl_surface_frame(window->surface);
 	wl_callback_add_listener(window->callback, &frame_listener, window);
+	frame_bench_frame(window->display->bench, window->surface);
 	wl_surface_commit(window->surface);
 	buffer->busy = 1;
 }
@@ -557,6 +560,9 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		d->shm = wl_registry_bind(registry,
 					  id, &wl_shm_interface, 1);
 		wl_shm_add_listener(d->shm, &shm_listener, d);
+	} else {
+		frame_bench_handle_global(d->bench, registry, id,
+					  interface, version);
 	}
 }
 
@@ -572,7 +578,7 @@ static const struct wl_registry_listener registry_listener = {
 };
 
 static struct display *
-create_display(void)
+create_display(struct frame_bench *bench)
 {
 	struct display *display;
 
@@ -585,6 +591,7 @@ create_display(void)
 	assert(display->display);
 
 	display->has_xrgb = false;
+	display->bench = bench;
 	display->registry = wl_display_get_registry(display->display);
 	wl_registry_add_listener(display->registry,
 				 &registry_listener, display);
@@ -647,6 +654,8 @@ create_display(void)
 static void
 destroy_display(struct display *display)
 {
+	frame_bench_destroy(display->bench);
+
 	if (display->shm)
 		wl_shm_destroy(display->shm);
 
@@ -668,15 +677,38 @@ signal_int(int signum)
 	running = 0;
 }
 
+static void
+usage(int error_code)
+{
+	fprintf(stderr, "Usage: simple-shm [OPTIONS]\n\n"
+		FRAME_BENCH_USAGE
+		"  -h\tThis help text\n\n");
+
+	exit(error_code);
+}
+
 int
 main(int argc, char **argv)
 {
 	struct sigaction sigint;
 	struct display *display;
 	struct window *window;
-	int ret = 0;
+	struct frame_bench *bench = NULL;
+	int i, ret = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (strncmp("--benchmark", argv[i], 11) == 0) {
+			bench = frame_bench_create(argv[i] + 11);
+			if (!bench)
+				usage(EXIT_FAILURE);
+		} else if (strcmp("-h", argv[i]) == 0) {
+			usage(EXIT_SUCCESS);
+		} else {
+			usage(EXIT_FAILURE);
+		}
+	}
 
-	display = create_display();
+	display = create_display(bench);
 	window = create_window(display, 250, 250);
 	if (!window)
 		return 1;
@@ -693,10 +725,11 @@ main(int argc, char **argv)
 	if (!window->wait_for_configure)
 		redraw(window, NULL, 0);
 
-	while (running && ret != -1)
+	while (running && ret != -1 && !frame_bench_done(bench))
 		ret = wl_display_dispatch(display->display);
 
 	fprintf(stderr, "simple-shm exiting\n");
+	frame_bench_report(bench, "simple-shm");
 
 	destroy_window(window);
 	destroy_display(display);
@@ -472,6 +472,7 @@ struct terminal {
 	cairo_font_extents_t extents;
 	double average_width;
 	cairo_scaled_font_t *font_normal, *font_bold;
+	struct glyph_cache *glyph_cache_normal, *glyph_cache_bold;
 	uint32_t hide_cursor_serial;
 	int size_in_title;
 
@@ -484,6 +485,14 @@ struct terminal {
 	int selection_end_row, selection_end_col;
 	struct wl_list link;
 	int pace_pipe;
+
+	/* The cell grid as last rendered, see redraw_handler() */
+	cairo_surface_t *grid_cache;
+	struct drawn_cell *drawn;
+	int drawn_width, drawn_height;
+	int32_t drawn_scale;
+	uint32_t drawn_start;
+	int drawn_outline_row, drawn_outline_col;
 };
 
 /* Create default tab stops, every 8 characters */
@@ -973,6 +982,20 @@ terminal_send_selection(struct terminal *terminal, int fd)
 	fclose(fp);
 }
 
+/* Glyph indices of the ASCII range, looked up once per font instead of
+ * going through cairo_scaled_font_text_to_glyphs() for every cell on
+ * every frame. The rasterized glyphs themselves are cached by cairo. */
+struct glyph_cache {
+	unsigned long index[128];
+	bool valid[128];
+};
+
+/* What one cell of the grid cache was last rendered as. */
+struct drawn_cell {
+	union utf8_char ch;
+	union decoded_attr attr;
+};
+
 struct glyph_run {
 	struct terminal *terminal;
 	cairo_t *cr;
@@ -1014,18 +1037,65 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 	run->attr = attr;
 }
 
+static bool
+glyph_cache_lookup(struct glyph_cache *cache, cairo_scaled_font_t *font,
+		   unsigned char c, unsigned long *index)
+{
+	cairo_glyph_t glyph, *glyphs = &glyph;
+	int num_glyphs = 1;
+	cairo_status_t status;
+
+	if (!cache->valid[c]) {
+		status = cairo_scaled_font_text_to_glyphs(font, 0, 0,
+							  (char *) &c, 1,
+							  &glyphs, &num_glyphs,
+							  NULL, NULL, NULL);
+		if (status != CAIRO_STATUS_SUCCESS)
+			return false;
+		if (glyphs != &glyph) {
+			cairo_glyph_free(glyphs);
+			return false;
+		}
+		cache->index[c] = glyph.index;
+		cache->valid[c] = true;
+	}
+
+	*index = cache->index[c];
+
+	return true;
+}
+
 static void
 glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 {
 	int num_glyphs;
 	cairo_scaled_font_t *font;
+	struct glyph_cache *cache;
+	unsigned long index;
 
-	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
+	/* Empty cells have nothing to show. */
+	if (c->ch == 0)
+		return;
 
-	if (run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK))
+	if (run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK)) {
 		font = run->terminal->font_bold;
-	else
+		cache = run->terminal->glyph_cache_bold;
+	} else {
 		font = run->terminal->font_normal;
+		cache = run->terminal->glyph_cache_normal;
+	}
+
+	if (c->byte[0] < 0x80 && c->byte[1] == 0 &&
+	    glyph_cache_lookup(cache, font, c->byte[0], &index)) {
+		run->g->index = index;
+		run->g->x = x;
+		run->g->y = y;
+		run->g++;
+		run->count++;
+		return;
+	}
+
+	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
 
 	cairo_move_to(run->cr, x, y);
 	cairo_scaled_font_text_to_glyphs (font, x, y,
@@ -1036,123 +1106,286 @@ glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 	run->count += num_glyphs;
 }
 
+static void
+terminal_invalidate_drawn_row(struct terminal *terminal, int row)
+{
+	struct drawn_cell *cells;
+	int col;
+
+	if (row < 0 || row >= terminal->drawn_height)
+		return;
+
+	/* No decoded attribute has every bit set, so these never match. */
+	cells = &terminal->drawn[row * terminal->drawn_width];
+	for (col = 0; col < terminal->drawn_width; col++)
+		cells[col].attr.key = ~0;
+}
+
+/* (Re)create the grid cache when the cell grid or the buffer scale
+ * changed. Returns true if the cache content is still usable. */
+static bool
+terminal_update_grid_cache(struct terminal *terminal, int32_t scale)
+{
+	int width, height, row;
+
+	if (terminal->grid_cache &&
+	    terminal->drawn_width == terminal->width &&
+	    terminal->drawn_height == terminal->height &&
+	    terminal->drawn_scale == scale)
+		return true;
+
+	if (terminal->grid_cache)
+		cairo_surface_destroy(terminal->grid_cache);
+	free(terminal->drawn);
+
+	width = terminal->width * terminal->average_width * scale;
+	height = terminal->height * terminal->extents.height * scale;
+	terminal->grid_cache =
+		cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cairo_surface_set_device_scale(terminal->grid_cache, scale, scale);
+
+	terminal->drawn_width = terminal->width;
+	terminal->drawn_height = terminal->height;
+	terminal->drawn_scale = scale;
+	terminal->drawn_start = terminal->start;
+	terminal->drawn = xzalloc(terminal->width * terminal->height *
+				  sizeof *terminal->drawn);
+	for (row = 0; row < terminal->height; row++)
+		terminal_invalidate_drawn_row(terminal, row);
 
+	return false;
+}
+
+/* Move the rendered rows along with the buffer after it scrolled by
+ * 'd' rows, so that only the rows scrolled in need to be drawn. */
 static void
-redraw_handler(struct widget *widget, void *data)
+terminal_scroll_grid_cache(struct terminal *terminal, int d)
 {
-	struct terminal *terminal = data;
-	struct rectangle allocation;
-	cairo_t *cr;
-	int top_margin, side_margin;
-	int row, col, cursor_x, cursor_y;
+	cairo_surface_t *cache = terminal->grid_cache;
+	unsigned char *pixels;
+	int stride, row_pitch, rows, row;
+
+	rows = terminal->drawn_height - abs(d);
+	if (rows <= 0) {
+		for (row = 0; row < terminal->drawn_height; row++)
+			terminal_invalidate_drawn_row(terminal, row);
+		return;
+	}
+
+	/* The unfocused cursor outline moves along with the pixels. */
+	terminal_invalidate_drawn_row(terminal,
+				      terminal->drawn_outline_row - d);
+
+	cairo_surface_flush(cache);
+	pixels = cairo_image_surface_get_data(cache);
+	stride = cairo_image_surface_get_stride(cache);
+	row_pitch = stride * terminal->extents.height * terminal->drawn_scale;
+
+	if (d > 0) {
+		memmove(pixels, pixels + d * row_pitch, rows * row_pitch);
+		memmove(terminal->drawn,
+			&terminal->drawn[d * terminal->drawn_width],
+			rows * terminal->drawn_width * sizeof *terminal->drawn);
+		for (row = rows; row < terminal->drawn_height; row++)
+			terminal_invalidate_drawn_row(terminal, row);
+	} else {
+		d = -d;
+		memmove(pixels + d * row_pitch, pixels, rows * row_pitch);
+		memmove(&terminal->drawn[d * terminal->drawn_width],
+			terminal->drawn,
+			rows * terminal->drawn_width * sizeof *terminal->drawn);
+		for (row = 0; row < d; row++)
+			terminal_invalidate_drawn_row(terminal, row);
+	}
+
+	cairo_surface_mark_dirty(cache);
+}
+
+/* Decode a row into the drawn cells, returns true if anything differs
+ * from what the grid cache shows for it. */
+static bool
+terminal_update_drawn_row(struct terminal *terminal, int row)
+{
+	struct drawn_cell *cells;
 	union utf8_char *p_row;
 	union decoded_attr attr;
-	int text_x, text_y;
-	cairo_surface_t *surface;
-	double d;
+	bool dirty = false;
+	int col;
+
+	cells = &terminal->drawn[row * terminal->width];
+	p_row = terminal_get_row(terminal, row);
+	for (col = 0; col < terminal->width; col++) {
+		terminal_decode_attr(terminal, row, col, &attr);
+		if (cells[col].ch.ch != p_row[col].ch ||
+		    cells[col].attr.key != attr.key) {
+			cells[col].ch = p_row[col];
+			cells[col].attr = attr;
+			dirty = true;
+		}
+	}
+
+	return dirty;
+}
+
+static void
+terminal_draw_row(struct terminal *terminal, cairo_t *cr, int row)
+{
+	struct drawn_cell *cells;
 	struct glyph_run run;
-	cairo_font_extents_t extents;
-	double average_width;
-	double unichar_width;
+	union decoded_attr attr;
+	double average_width = terminal->average_width;
+	double height = terminal->extents.height;
+	double unichar_width, d;
+	int col, text_x, text_y;
 
-	surface = window_get_surface(terminal->window);
-	widget_get_allocation(terminal->widget, &allocation);
-	cr = widget_cairo_create(terminal->widget);
-	cairo_rectangle(cr, allocation.x, allocation.y,
-			allocation.width, allocation.height);
+	cells = &terminal->drawn[row * terminal->width];
+
+	cairo_save(cr);
+	cairo_rectangle(cr, 0, row * height,
+			terminal->width * average_width, height);
 	cairo_clip(cr);
-	cairo_push_group(cr);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	terminal_set_color(terminal, cr, terminal->color_scheme->border);
 	cairo_paint(cr);
 
-	cairo_set_scaled_font(cr, terminal->font_normal);
-
-	extents = terminal->extents;
-	average_width = terminal->average_width;
-	side_margin = (allocation.width - terminal->width * average_width) / 2;
-	top_margin = (allocation.height - terminal->height * extents.height) / 2;
-
-	cairo_set_line_width(cr, 1.0);
-	cairo_translate(cr, allocation.x + side_margin,
-			allocation.y + top_margin);
 	/* paint the background */
-	for (row = 0; row < terminal->height; row++) {
-		p_row = terminal_get_row(terminal, row);
-		for (col = 0; col < terminal->width; col++) {
-			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
+	for (col = 0; col < terminal->width; col++) {
+		attr = cells[col].attr;
 
-			if (attr.attr.bg == terminal->color_scheme->border)
-				continue;
+		if (attr.attr.bg == terminal->color_scheme->border)
+			continue;
 
-			if (is_wide(p_row[col]))
-				unichar_width = 2 * average_width;
-			else
-				unichar_width = average_width;
+		if (is_wide(cells[col].ch))
+			unichar_width = 2 * average_width;
+		else
+			unichar_width = average_width;
 
-			terminal_set_color(terminal, cr, attr.attr.bg);
-			cairo_move_to(cr, col * average_width,
-				      row * extents.height);
-			cairo_rel_line_to(cr, unichar_width, 0);
-			cairo_rel_line_to(cr, 0, extents.height);
-			cairo_rel_line_to(cr, -unichar_width, 0);
-			cairo_close_path(cr);
-			cairo_fill(cr);
-		}
+		terminal_set_color(terminal, cr, attr.attr.bg);
+		cairo_move_to(cr, col * average_width, row * height);
+		cairo_rel_line_to(cr, unichar_width, 0);
+		cairo_rel_line_to(cr, 0, height);
+		cairo_rel_line_to(cr, -unichar_width, 0);
+		cairo_close_path(cr);
+		cairo_fill(cr);
 	}
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
 	/* paint the foreground */
 	glyph_run_init(&run, terminal, cr);
-	for (row = 0; row < terminal->height; row++) {
-		p_row = terminal_get_row(terminal, row);
-		for (col = 0; col < terminal->width; col++) {
-			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
-
-			glyph_run_flush(&run, attr);
-
-			text_x = col * average_width;
-			text_y = extents.ascent + row * extents.height;
-			if (attr.attr.a & ATTRMASK_UNDERLINE) {
-				terminal_set_color(terminal, cr, attr.attr.fg);
-				cairo_move_to(cr, text_x, (double)text_y + 1.5);
-				cairo_line_to(cr, text_x + average_width, (double) text_y + 1.5);
-				cairo_stroke(cr);
-			}
+	for (col = 0; col < terminal->width; col++) {
+		attr = cells[col].attr;
+
+		glyph_run_flush(&run, attr);
+
+		text_x = col * average_width;
+		text_y = terminal->extents.ascent + row * height;
+		if (attr.attr.a & ATTRMASK_UNDERLINE) {
+			terminal_set_color(terminal, cr, attr.attr.fg);
+			cairo_move_to(cr, text_x, (double)text_y + 1.5);
+			cairo_line_to(cr, text_x + average_width, (double) text_y + 1.5);
+			cairo_stroke(cr);
+		}
 
-			/* skip space glyph (RLE) we use as a placeholder of
-			   the right half of a double-width character,
-			   because RLE is not available in every font. */
-			if (p_row[col].ch == 0x200B)
-				continue;
+		/* skip space glyph (RLE) we use as a placeholder of
+		   the right half of a double-width character,
+		   because RLE is not available in every font. */
+		if (cells[col].ch.ch == 0x200B)
+			continue;
 
-			glyph_run_add(&run, text_x, text_y, &p_row[col]);
-		}
+		glyph_run_add(&run, text_x, text_y, &cells[col].ch);
 	}
 
 	attr.key = ~0;
 	glyph_run_flush(&run, attr);
 
-	if ((terminal->mode & MODE_SHOW_CURSOR) &&
-	    !window_has_focus(terminal->window)) {
+	if (row == terminal->drawn_outline_row) {
 		d = 0.5;
 
-		cairo_set_line_width(cr, 1);
-		cairo_move_to(cr, terminal->column * average_width + d,
-			      terminal->row * extents.height + d);
+		cairo_move_to(cr, terminal->drawn_outline_col * average_width + d,
+			      row * height + d);
 		cairo_rel_line_to(cr, average_width - 2 * d, 0);
-		cairo_rel_line_to(cr, 0, extents.height - 2 * d);
+		cairo_rel_line_to(cr, 0, height - 2 * d);
 		cairo_rel_line_to(cr, -average_width + 2 * d, 0);
 		cairo_close_path(cr);
 
 		cairo_stroke(cr);
 	}
 
-	cairo_pop_group_to_source(cr);
+	cairo_restore(cr);
+}
+
+/* The cell grid is rendered into an offscreen cache that persists across
+ * frames. Each frame only the rows whose characters or decoded attributes
+ * (cursor, selection and inverse mode included) changed are drawn again,
+ * and scrolling moves the existing rows instead of drawing them anew. */
+static void
+redraw_handler(struct widget *widget, void *data)
+{
+	struct terminal *terminal = data;
+	struct rectangle allocation;
+	cairo_t *cr, *grid_cr;
+	int top_margin, side_margin;
+	int row, cursor_x, cursor_y;
+	int outline_row, outline_col;
+	int32_t d;
+	cairo_surface_t *surface;
+	cairo_font_extents_t extents;
+	double average_width;
+
+	extents = terminal->extents;
+	average_width = terminal->average_width;
+
+	if (terminal_update_grid_cache(terminal,
+				       window_get_buffer_scale(terminal->window))) {
+		d = terminal->start - terminal->drawn_start;
+		if (d != 0)
+			terminal_scroll_grid_cache(terminal, d);
+	}
+	terminal->drawn_start = terminal->start;
+
+	outline_row = -1;
+	outline_col = -1;
+	if ((terminal->mode & MODE_SHOW_CURSOR) &&
+	    !window_has_focus(terminal->window)) {
+		outline_row = terminal->row;
+		outline_col = terminal->column;
+	}
+	if (outline_row != terminal->drawn_outline_row ||
+	    outline_col != terminal->drawn_outline_col) {
+		terminal_invalidate_drawn_row(terminal,
+					      terminal->drawn_outline_row);
+		terminal_invalidate_drawn_row(terminal, outline_row);
+		terminal->drawn_outline_row = outline_row;
+		terminal->drawn_outline_col = outline_col;
+	}
+
+	grid_cr = cairo_create(terminal->grid_cache);
+	cairo_set_line_width(grid_cr, 1.0);
+	for (row = 0; row < terminal->height; row++) {
+		if (terminal_update_drawn_row(terminal, row))
+			terminal_draw_row(terminal, grid_cr, row);
+	}
+	cairo_destroy(grid_cr);
+
+	surface = window_get_surface(terminal->window);
+	widget_get_allocation(terminal->widget, &allocation);
+	cr = widget_cairo_create(terminal->widget);
+	cairo_rectangle(cr, allocation.x, allocation.y,
+			allocation.width, allocation.height);
+	cairo_clip(cr);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	terminal_set_color(terminal, cr, terminal->color_scheme->border);
+	cairo_paint(cr);
+
+	side_margin = (allocation.width - terminal->width * average_width) / 2;
+	top_margin = (allocation.height - terminal->height * extents.height) / 2;
+
+	cairo_set_source_surface(cr, terminal->grid_cache,
+				 allocation.x + side_margin,
+				 allocation.y + top_margin);
 	cairo_paint(cr);
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
@@ -2999,6 +3232,8 @@ terminal_create(struct display *display)
 	cairo_scaled_font_reference(terminal->font_normal);
 
 	cairo_font_extents(cr, &terminal->extents);
+	/* Whole pixel rows let the grid cache be scrolled by copying. */
+	terminal->extents.height = ceil(terminal->extents.height);
 
 	/* Compute the average ascii glyph width */
 	cairo_text_extents(cr, TERMINAL_DRAW_SINGLE_WIDE_CHARACTERS,
@@ -3008,6 +3243,11 @@ terminal_create(struct display *display)
 		 strlen(TERMINAL_DRAW_SINGLE_WIDE_CHARACTERS));
 	terminal->average_width = ceil(terminal->average_width);
 
+	terminal->glyph_cache_normal = xzalloc(sizeof *terminal->glyph_cache_normal);
+	terminal->glyph_cache_bold = xzalloc(sizeof *terminal->glyph_cache_bold);
+	terminal->drawn_outline_row = -1;
+	terminal->drawn_outline_col = -1;
+
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
 
@@ -3027,6 +3267,11 @@ terminal_destroy(struct terminal *terminal)
 
 	cairo_scaled_font_destroy(terminal->font_bold);
 	cairo_scaled_font_destroy(terminal->font_normal);
+	free(terminal->glyph_cache_bold);
+	free(terminal->glyph_cache_normal);
+	if (terminal->grid_cache)
+		cairo_surface_destroy(terminal->grid_cache);
+	free(terminal->drawn);
 
 	widget_destroy(terminal->widget);
 	window_destroy(terminal->window);
@@ -35,16 +35,75 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <assert.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include <wayland-client.h>
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
 #include "shared/helpers.h"
+#include "shared/string-helpers.h"
 #include <libweston/zalloc.h>
 #include "weston-debug-client-protocol.h"
 
+/* How much is read from the compositor at once */
+#define DEBUG_CHUNK_SIZE (64 * 1024)
+
+/* Leave the compositor room to write while we compress */
+#define DEBUG_PIPE_SIZE (1024 * 1024)
+
+/* Compressed data is flushed after the stream was idle this long */
+#define DEBUG_FLUSH_TIMEOUT_MS 1000
+
+#define DEBUG_RING_FILES_DEFAULT 4
+
+enum debug_compress {
+	DEBUG_COMPRESS_NONE = 0,
+	DEBUG_COMPRESS_ZSTD,
+	DEBUG_COMPRESS_LZ4,
+};
+
+enum sink_op {
+	SINK_CONTINUE,
+	SINK_FLUSH,
+	SINK_END,
+};
+
+/**
+ * Where the debug output goes when it does not go straight from the
+ * compositor to the output file: it is compressed if asked to, and
+ * written into a ring of files if a ring size was given.
+ */
+struct debug_sink {
+	enum debug_compress compress;
+	int fd;			/* current output file */
+
+	const char *path;	/* ring base file name, NULL if not a ring */
+	unsigned int n_files;
+	uint64_t file_limit;	/* rotate after this many bytes */
+	uint64_t file_size;	/* bytes in the current file */
+
+	bool in_frame;		/* a compressed frame is open */
+	bool dirty;		/* compressor holds data not yet written */
+	void *buf;
+	size_t buf_size;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd;
+#endif
+#ifdef HAVE_LZ4
+	LZ4F_cctx *lz4;
+#endif
+};
+
 struct debug_app {
 	struct {
 		bool help;
@@ -52,13 +111,22 @@ struct debug_app {
 		bool bind_all;
 		char *output;
 		char *outfd;
+		enum debug_compress compress;
+		uint64_t ring_size;
+		int32_t ring_files;
 	} opt;
 
 	int out_fd;
 	struct wl_display *dpy;
 	struct wl_registry *registry;
 	struct weston_debug_v1 *debug_iface;
+	uint32_t debug_version;
 	struct wl_list stream_list;
+
+	/* Read end of the pipe the compositor writes into, when piping */
+	int pipe_fd;
+	char *pipe_buf;
+	struct debug_sink sink;
 };
 
 struct debug_stream {
@@ -66,9 +134,12 @@ struct debug_stream {
 	bool should_bind;
 	char *name;
 	char *desc;
+	char *filter;
 	struct weston_debug_stream_v1 *obj;
 };
 
+static volatile sig_atomic_t running = 1;
+
 /**
  * Called either through stream_find in response to an advertisement
  * event (see comment on stream_find) when we have all the information,
@@ -135,6 +206,7 @@ stream_destroy(struct debug_stream *stream)
 		weston_debug_stream_v1_destroy(stream->obj);
 
 	wl_list_remove(&stream->link);
+	free(stream->filter);
 	free(stream->desc);
 	free(stream->name);
 	free(stream);
@@ -175,7 +247,8 @@ global_handler(void *data, struct wl_registry *registry, uint32_t id,
 		if (app->debug_iface)
 			return;
 
-		myver = MIN(1, version);
+		myver = MIN(2, version);
+		app->debug_version = myver;
 		app->debug_iface =
 			wl_registry_bind(registry, id,
 					 &weston_debug_v1_interface, myver);
@@ -231,9 +304,15 @@ start_streams(struct debug_app *app)
 		if (!stream->should_bind)
 			continue;
 
-		stream->obj = weston_debug_v1_subscribe(app->debug_iface,
-							stream->name,
-							app->out_fd);
+		if (stream->filter) {
+			stream->obj = weston_debug_v1_subscribe_filtered(
+				app->debug_iface, stream->name,
+				stream->filter, app->out_fd);
+		} else {
+			stream->obj = weston_debug_v1_subscribe(app->debug_iface,
+								stream->name,
+								app->out_fd);
+		}
 		weston_debug_stream_v1_add_listener(stream->obj,
 						    &stream_listener, stream);
 	}
@@ -247,7 +326,11 @@ list_streams(struct debug_app *app)
 	fprintf(stderr, "Available debug streams:\n");
 
 	wl_list_for_each(stream, &app->stream_list, link) {
-		if (stream->should_bind && stream->desc) {
+		if (stream->should_bind && stream->desc && stream->filter) {
+			fprintf(stderr, "    %s [will bind lines with '%s']\n",
+				stream->name, stream->filter);
+			fprintf(stderr, "        %s\n", stream->desc);
+		} else if (stream->should_bind && stream->desc) {
 			fprintf(stderr, "    %s [will bind]\n", stream->name);
 			fprintf(stderr, "        %s\n", stream->desc);
 		} else if (stream->should_bind) {
@@ -306,6 +389,469 @@ setup_out_fd(const char *output, const char *outfd)
 	return fd;
 }
 
+static bool
+streams_active(struct debug_app *app)
+{
+	struct debug_stream *stream;
+
+	wl_list_for_each(stream, &app->stream_list, link) {
+		if (stream->obj)
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+streams_filtered(struct debug_app *app)
+{
+	struct debug_stream *stream;
+
+	wl_list_for_each(stream, &app->stream_list, link) {
+		if (stream->filter)
+			return true;
+	}
+
+	return false;
+}
+
+static int
+sink_write_out(struct debug_sink *sink, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(sink->fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "Error: writing output failed: %s\n",
+				strerror(errno));
+			return -1;
+		}
+
+		p += ret;
+		len -= ret;
+		sink->file_size += ret;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_ZSTD
+static int
+sink_zstd(struct debug_sink *sink, const void *data, size_t len,
+	  enum sink_op op)
+{
+	static const ZSTD_EndDirective mode[] = {
+		[SINK_CONTINUE] = ZSTD_e_continue,
+		[SINK_FLUSH] = ZSTD_e_flush,
+		[SINK_END] = ZSTD_e_end,
+	};
+	ZSTD_inBuffer in = { data, len, 0 };
+	ZSTD_outBuffer out;
+	size_t remaining;
+
+	do {
+		out.dst = sink->buf;
+		out.size = sink->buf_size;
+		out.pos = 0;
+
+		remaining = ZSTD_compressStream2(sink->zstd, &out, &in, mode[op]);
+		if (ZSTD_isError(remaining)) {
+			fprintf(stderr, "Error: zstd: %s\n",
+				ZSTD_getErrorName(remaining));
+			return -1;
+		}
+
+		if (sink_write_out(sink, sink->buf, out.pos) < 0)
+			return -1;
+	} while (op == SINK_CONTINUE ? in.pos < in.size : remaining != 0);
+
+	return 0;
+}
+#endif
+
+#ifdef HAVE_LZ4
+static int
+sink_lz4(struct debug_sink *sink, const void *data, size_t len,
+	 enum sink_op op)
+{
+	size_t n;
+
+	if (!sink->in_frame) {
+		n = LZ4F_compressBegin(sink->lz4, sink->buf, sink->buf_size,
+				       NULL);
+		if (!LZ4F_isError(n) && sink_write_out(sink, sink->buf, n) < 0)
+			return -1;
+	} else {
+		n = 0;
+	}
+
+	if (!LZ4F_isError(n)) {
+		switch (op) {
+		case SINK_CONTINUE:
+			n = LZ4F_compressUpdate(sink->lz4, sink->buf,
+						sink->buf_size, data, len, NULL);
+			break;
+		case SINK_FLUSH:
+			n = LZ4F_flush(sink->lz4, sink->buf, sink->buf_size,
+				       NULL);
+			break;
+		case SINK_END:
+			n = LZ4F_compressEnd(sink->lz4, sink->buf,
+					     sink->buf_size, NULL);
+			break;
+		}
+	}
+
+	if (LZ4F_isError(n)) {
+		fprintf(stderr, "Error: lz4: %s\n", LZ4F_getErrorName(n));
+		return -1;
+	}
+
+	return sink_write_out(sink, sink->buf, n);
+}
+#endif
+
+/** Compress and write data, or flush or finish the compressed frame
+ *
+ * Every compressed frame is complete on its own, so that each file of
+ * a ring can be decompressed without the others.
+ */
+static int
+sink_process(struct debug_sink *sink, const void *data, size_t len,
+	     enum sink_op op)
+{
+	int ret = 0;
+
+	if (op != SINK_CONTINUE && !sink->in_frame)
+		return 0;
+
+	switch (sink->compress) {
+	case DEBUG_COMPRESS_NONE:
+		if (op == SINK_CONTINUE)
+			return sink_write_out(sink, data, len);
+		return 0;
+	case DEBUG_COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+		ret = sink_zstd(sink, data, len, op);
+#endif
+		break;
+	case DEBUG_COMPRESS_LZ4:
+#ifdef HAVE_LZ4
+		ret = sink_lz4(sink, data, len, op);
+#endif
+		break;
+	}
+
+	sink->in_frame = op != SINK_END;
+	sink->dirty = op == SINK_CONTINUE;
+
+	return ret;
+}
+
+static char *
+ring_file_name(struct debug_sink *sink, unsigned int index)
+{
+	char *name;
+
+	if (index == 0)
+		return strdup(sink->path);
+
+	str_printf(&name, "%s.%u", sink->path, index);
+	return name;
+}
+
+/** Start a new file, shifting the old ones and dropping the oldest */
+static int
+sink_rotate(struct debug_sink *sink)
+{
+	char *from, *to;
+	unsigned int i;
+
+	if (sink_process(sink, NULL, 0, SINK_END) < 0)
+		return -1;
+
+	close(sink->fd);
+	sink->fd = -1;
+
+	for (i = sink->n_files - 1; i > 0; i--) {
+		from = ring_file_name(sink, i - 1);
+		to = ring_file_name(sink, i);
+		if (from && to && rename(from, to) < 0 && errno != ENOENT) {
+			fprintf(stderr, "Error: renaming '%s' failed: %s\n",
+				from, strerror(errno));
+		}
+		free(from);
+		free(to);
+	}
+
+	sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+	if (sink->fd < 0) {
+		fprintf(stderr, "Error: opening file '%s' failed: %s\n",
+			sink->path, strerror(errno));
+		return -1;
+	}
+	sink->file_size = 0;
+
+	return 0;
+}
+
+static int
+sink_write(struct debug_sink *sink, const void *data, size_t len)
+{
+	if (sink_process(sink, data, len, SINK_CONTINUE) < 0)
+		return -1;
+
+	if (sink->file_limit && sink->file_size >= sink->file_limit)
+		return sink_rotate(sink);
+
+	return 0;
+}
+
+static int
+sink_init(struct debug_sink *sink, struct debug_app *app, int fd)
+{
+	struct stat st;
+
+	sink->fd = fd;
+	sink->compress = app->opt.compress;
+
+	if (app->opt.ring_size > 0) {
+		sink->path = app->opt.output;
+		sink->n_files = app->opt.ring_files;
+		sink->file_limit = app->opt.ring_size / sink->n_files;
+		if (fstat(fd, &st) == 0)
+			sink->file_size = st.st_size;
+	}
+
+	switch (sink->compress) {
+	case DEBUG_COMPRESS_NONE:
+		break;
+	case DEBUG_COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+		sink->zstd = ZSTD_createCCtx();
+		if (!sink->zstd)
+			return -1;
+		sink->buf_size = ZSTD_CStreamOutSize();
+#endif
+		break;
+	case DEBUG_COMPRESS_LZ4:
+#ifdef HAVE_LZ4
+		if (LZ4F_isError(LZ4F_createCompressionContext(&sink->lz4,
+							       LZ4F_VERSION)))
+			return -1;
+		sink->buf_size = LZ4F_compressBound(DEBUG_CHUNK_SIZE, NULL);
+#endif
+		break;
+	}
+
+	if (sink->buf_size) {
+		sink->buf = malloc(sink->buf_size);
+		if (!sink->buf)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void
+sink_fini(struct debug_sink *sink)
+{
+	if (sink->fd != -1)
+		sink_process(sink, NULL, 0, SINK_END);
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(sink->zstd);
+#endif
+#ifdef HAVE_LZ4
+	if (sink->lz4)
+		LZ4F_freeCompressionContext(sink->lz4);
+#endif
+	free(sink->buf);
+
+	if (sink->fd != -1)
+		close(sink->fd);
+	sink->fd = -1;
+}
+
+/** Have the compositor write into a pipe, and the sink write the files */
+static int
+setup_pipe(struct debug_app *app)
+{
+	int fds[2];
+	int ret;
+
+	/* The sink owns the output file from now on. */
+	ret = sink_init(&app->sink, app, app->out_fd);
+	app->out_fd = -1;
+	if (ret < 0) {
+		fprintf(stderr, "Error: cannot set up compression.\n");
+		return -1;
+	}
+
+	app->pipe_buf = malloc(DEBUG_CHUNK_SIZE);
+	if (!app->pipe_buf || pipe2(fds, O_CLOEXEC) < 0) {
+		fprintf(stderr, "Error: cannot create a pipe: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	/* Best effort, the compositor blocks while the pipe is full. */
+	fcntl(fds[0], F_SETPIPE_SZ, DEBUG_PIPE_SIZE);
+
+	app->pipe_fd = fds[0];
+	app->out_fd = fds[1];
+
+	return 0;
+}
+
+static int
+pump_pipe(struct debug_app *app)
+{
+	ssize_t len;
+
+	len = read(app->pipe_fd, app->pipe_buf, DEBUG_CHUNK_SIZE);
+	if (len < 0 && errno == EINTR)
+		return 0;
+
+	if (len < 0) {
+		fprintf(stderr, "Error: reading from the compositor failed: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	if (len == 0) {
+		/* The compositor closed all streams. */
+		close(app->pipe_fd);
+		app->pipe_fd = -1;
+		return 0;
+	}
+
+	/* Once the output failed, keep draining so the server can go on. */
+	if (app->sink.fd == -1)
+		return 0;
+
+	if (sink_write(&app->sink, app->pipe_buf, len) < 0) {
+		close(app->sink.fd);
+		app->sink.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Dispatch Wayland events and move piped data to the sink */
+static int
+wait_for_events(struct debug_app *app)
+{
+	struct pollfd fds[2];
+	int nfds = 1;
+	int timeout = -1;
+	int ret;
+
+	while (wl_display_prepare_read(app->dpy) != 0) {
+		if (wl_display_dispatch_pending(app->dpy) < 0)
+			return -1;
+	}
+	wl_display_flush(app->dpy);
+
+	fds[0].fd = wl_display_get_fd(app->dpy);
+	fds[0].events = POLLIN;
+	if (app->pipe_fd != -1) {
+		fds[1].fd = app->pipe_fd;
+		fds[1].events = POLLIN;
+		nfds = 2;
+		if (app->sink.dirty)
+			timeout = DEBUG_FLUSH_TIMEOUT_MS;
+	}
+
+	ret = poll(fds, nfds, timeout);
+	if (ret < 0) {
+		wl_display_cancel_read(app->dpy);
+		return errno == EINTR ? 0 : -1;
+	}
+
+	if (fds[0].revents) {
+		if (wl_display_read_events(app->dpy) < 0)
+			return -1;
+	} else {
+		wl_display_cancel_read(app->dpy);
+	}
+
+	if (wl_display_dispatch_pending(app->dpy) < 0)
+		return -1;
+
+	if (nfds == 2 && fds[1].revents)
+		return pump_pipe(app);
+
+	if (nfds == 2 && ret == 0)
+		return sink_process(&app->sink, NULL, 0, SINK_FLUSH);
+
+	return 0;
+}
+
+static bool
+parse_size(const char *str, uint64_t *size)
+{
+	unsigned long long value;
+	char *end;
+
+	errno = 0;
+	value = strtoull(str, &end, 10);
+	if (errno != 0 || end == str)
+		return false;
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		value <<= 10;
+		end++;
+		break;
+	case 'M':
+		value <<= 20;
+		end++;
+		break;
+	case 'G':
+		value <<= 30;
+		end++;
+		break;
+	}
+
+	if (*end != '\0' || value == 0)
+		return false;
+
+	*size = value;
+	return true;
+}
+
+static bool
+parse_compress(const char *str, enum debug_compress *compress)
+{
+	if (strcmp(str, "zstd") == 0) {
+#ifdef HAVE_ZSTD
+		*compress = DEBUG_COMPRESS_ZSTD;
+		return true;
+#endif
+	} else if (strcmp(str, "lz4") == 0) {
+#ifdef HAVE_LZ4
+		*compress = DEBUG_COMPRESS_LZ4;
+		return true;
+#endif
+	} else {
+		fprintf(stderr, "Error: unknown compression '%s'.\n", str);
+		return false;
+	}
+
+	fprintf(stderr, "Error: weston-debug was built without %s support.\n",
+		str);
+	return false;
+}
+
 static void
 print_help(void)
 {
@@ -324,7 +870,16 @@ print_help(void)
 		"  -f FD, --outfd FD\n"
 		"     Direct output to the file descriptor FD.\n"
 		"     Stdout (1) is the default. Mutually exclusive with -o.\n"
+		"  -z ALGO, --compress ALGO\n"
+		"     Compress the output with zstd or lz4.\n"
+		"  -r SIZE, --ring-size SIZE\n"
+		"     Keep at most SIZE bytes (suffixes k, M, G) of the latest\n"
+		"     output, in FILE and FILE.1 to FILE.N-1. Needs -o FILE.\n"
+		"  -n N, --ring-files N\n"
+		"     Split the ring into N files (default 4).\n"
 		"Names are whatever debug stream names the compositor supports.\n"
+		"A name may be followed by :KEYWORD to only get the lines of\n"
+		"that stream which contain KEYWORD, for example an output name.\n"
 		);
 }
 
@@ -337,9 +892,12 @@ parse_cmdline(struct debug_app *app, int argc, char **argv)
 		{ "all-streams", no_argument, NULL, 'a' },
 		{ "output", required_argument, NULL, 'o' },
 		{ "outfd", required_argument, NULL, 'f' },
+		{ "compress", required_argument, NULL, 'z' },
+		{ "ring-size", required_argument, NULL, 'r' },
+		{ "ring-files", required_argument, NULL, 'n' },
 		{ 0 }
 	};
-	static const char optstr[] = "hlao:f:";
+	static const char optstr[] = "hlao:f:z:r:n:";
 	int c;
 	bool failed = false;
 
@@ -366,6 +924,24 @@ parse_cmdline(struct debug_app *app, int argc, char **argv)
 			free(app->opt.outfd);
 			app->opt.outfd = strdup(optarg);
 			break;
+		case 'z':
+			if (!parse_compress(optarg, &app->opt.compress))
+				failed = true;
+			break;
+		case 'r':
+			if (!parse_size(optarg, &app->opt.ring_size)) {
+				fprintf(stderr, "Error: bad ring size '%s'.\n",
+					optarg);
+				failed = true;
+			}
+			break;
+		case 'n':
+			if (!safe_strtoint(optarg, &app->opt.ring_files) ||
+			    app->opt.ring_files < 2) {
+				fprintf(stderr, "Error: a ring needs at least 2 files.\n");
+				failed = true;
+			}
+			break;
 		case '?':
 			failed = true;
 			break;
@@ -379,22 +955,41 @@ parse_cmdline(struct debug_app *app, int argc, char **argv)
 		return -1;
 
 	while (optind < argc) {
-		struct debug_stream *stream =
-			stream_alloc(app, argv[optind++], NULL);
+		const char *arg = argv[optind++];
+		const char *colon = strchr(arg, ':');
+		struct debug_stream *stream;
+		char *name;
+
+		name = colon ? strndup(arg, colon - arg) : strdup(arg);
+		stream = stream_alloc(app, name, NULL);
+		free(name);
 		stream->should_bind = true;
+		if (colon && colon[1] != '\0')
+			stream->filter = strdup(colon + 1);
 	}
 
 	return 0;
 }
 
+static void
+signal_handler(int signum)
+{
+	running = 0;
+}
+
 int
 main(int argc, char **argv)
 {
 	struct debug_app app = {};
+	struct sigaction sigint;
+	bool piped = false;
 	int ret = 0;
 
 	wl_list_init(&app.stream_list);
 	app.out_fd = -1;
+	app.pipe_fd = -1;
+	app.sink.fd = -1;
+	app.opt.ring_files = DEBUG_RING_FILES_DEFAULT;
 
 	if (parse_cmdline(&app, argc, argv) < 0) {
 		ret = 1;
@@ -426,12 +1021,27 @@ main(int argc, char **argv)
 		goto out_parse;
 	}
 
+	if (app.opt.ring_size > 0 &&
+	    (!app.opt.output || strcmp(app.opt.output, "-") == 0)) {
+		fprintf(stderr, "Error: option --ring-size needs --output FILE.\n");
+		ret = 1;
+		goto out_parse;
+	}
+
 	app.out_fd = setup_out_fd(app.opt.output, app.opt.outfd);
 	if (app.out_fd < 0) {
 		ret = 1;
 		goto out_parse;
 	}
 
+	if (app.opt.compress != DEBUG_COMPRESS_NONE || app.opt.ring_size > 0) {
+		if (setup_pipe(&app) < 0) {
+			ret = 1;
+			goto out_parse;
+		}
+		piped = true;
+	}
+
 	app.dpy = wl_display_connect(NULL);
 	if (!app.dpy) {
 		fprintf(stderr, "Error: Could not connect to Wayland display: %s\n",
@@ -452,6 +1062,13 @@ main(int argc, char **argv)
 		goto out_conn;
 	}
 
+	if (streams_filtered(&app) && app.debug_version < 2) {
+		ret = 1;
+		fprintf(stderr,
+			"The Wayland server does not support filtering.\n");
+		goto out_conn;
+	}
+
 	wl_display_roundtrip(app.dpy); /* for weston_debug_v1::advertise */
 
 	if (app.opt.list)
@@ -461,21 +1078,23 @@ main(int argc, char **argv)
 
 	weston_debug_v1_destroy(app.debug_iface);
 
-	while (1) {
-		struct debug_stream *stream;
-		bool empty = true;
+	/* The server has its own copies, so we see EOF once it is done. */
+	if (app.pipe_fd != -1) {
+		close(app.out_fd);
+		app.out_fd = -1;
+	}
 
-		wl_list_for_each(stream, &app.stream_list, link) {
-			if (stream->obj) {
-				empty = false;
-				break;
-			}
-		}
+	sigint.sa_handler = signal_handler;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+	sigaction(SIGTERM, &sigint, NULL);
 
-		if (empty)
+	while (running) {
+		if (piped ? app.pipe_fd == -1 : !streams_active(&app))
 			break;
 
-		if (wl_display_dispatch(app.dpy) < 0) {
+		if (wait_for_events(&app) < 0) {
 			ret = 1;
 			break;
 		}
@@ -484,7 +1103,16 @@ main(int argc, char **argv)
 out_conn:
 	destroy_streams(&app);
 
-	/* Wait for server to close all files */
+	/*
+	 * Wait for server to close all files. When piping, the server may be
+	 * blocked writing into the pipe, so keep reading it until EOF.
+	 */
+	if (app.pipe_fd != -1 && app.out_fd != -1) {
+		close(app.out_fd);
+		app.out_fd = -1;
+	}
+	while (app.pipe_fd != -1 && wait_for_events(&app) >= 0)
+		;
 	wl_display_roundtrip(app.dpy);
 
 	wl_registry_destroy(app.registry);
@@ -493,6 +1121,10 @@ out_conn:
 out_parse:
 	if (app.out_fd != -1)
 		close(app.out_fd);
+	if (app.pipe_fd != -1)
+		close(app.pipe_fd);
+	sink_fini(&app.sink);
+	free(app.pipe_buf);
 
 	destroy_streams(&app);
 	free(app.opt.output);
@@ -182,19 +182,30 @@ struct toysurface {
 	 * width,height are the new buffer size.
 	 * If flags has SURFACE_HINT_RESIZE set, the user is
 	 * doing continuous resizing.
+	 * If flags has SURFACE_HINT_PRESERVE set, the caller intends to
+	 * only redraw parts of the surface, and the content of the
+	 * previously posted buffer should be carried over if possible.
 	 * Returns the Cairo surface to draw to.
 	 */
 	cairo_surface_t *(*prepare)(struct toysurface *base, int dx, int dy,
 				    int32_t width, int32_t height, uint32_t flags,
 				    enum wl_output_transform buffer_transform, int32_t buffer_scale);
 
+	/*
+	 * Returns true if the Cairo surface from the last prepare() holds
+	 * the content of the previously posted buffer.
+	 */
+	bool (*has_previous_content)(struct toysurface *base);
+
 	/*
 	 * Post the surface to the server, returning the server allocation
-	 * rectangle. The Cairo surface from prepare() must be destroyed
+	 * rectangle. 'damage' is in surface coordinates, NULL damages the
+	 * whole surface. The Cairo surface from prepare() must be destroyed
 	 * after calling this.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		     const struct rectangle *damage,
 		     struct rectangle *server_allocation);
 
 	/*
@@ -214,6 +225,10 @@ struct surface {
 	struct toysurface *toysurface;
 	struct widget *widget;
 	int redraw_needed;
+	/* Only the widgets within 'damage' need to be redrawn, see
+	 * widget_schedule_partial_redraw() */
+	bool partial_redraw;
+	struct rectangle damage;
 	struct wl_callback *frame_cb;
 	uint32_t last_time;
 
@@ -1013,6 +1028,9 @@ struct shm_surface {
 
 	struct shm_surface_leaf leaf[MAX_LEAVES];
 	struct shm_surface_leaf *current;
+	/* The leaf posted last, and whether 'current' holds its content */
+	struct shm_surface_leaf *last;
+	bool current_preserved;
 };
 
 static struct shm_surface *
@@ -1064,12 +1082,14 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 	}
 	assert(i < MAX_LEAVES && "unknown buffer released");
 
-	/* Leave one free leaf with storage, release others */
+	/* Leave one free leaf with storage, release others, but keep the
+	 * last posted one for carrying its content over */
 	free_found = 0;
 	for (i = 0; i < MAX_LEAVES; i++) {
 		leaf = &surface->leaf[i];
 
-		if (!leaf->cairo_surface || leaf->busy)
+		if (!leaf->cairo_surface || leaf->busy ||
+		    leaf == surface->last)
 			continue;
 
 		if (!free_found)
@@ -1085,6 +1105,42 @@ static const struct wl_buffer_listener shm_surface_buffer_listener = {
 	shm_surface_buffer_release
 };
 
+/* Make 'leaf' hold the content of the last posted buffer, which the
+ * server only reads from, so it can be copied even while busy. */
+static void
+shm_surface_leaf_preserve(struct shm_surface *surface,
+			  struct shm_surface_leaf *leaf)
+{
+	struct shm_surface_leaf *last = surface->last;
+	cairo_surface_t *src, *dst = leaf->cairo_surface;
+
+	if (leaf == last) {
+		surface->current_preserved = true;
+		return;
+	}
+
+	if (!last || !last->cairo_surface)
+		return;
+
+	src = last->cairo_surface;
+	if (cairo_image_surface_get_width(src) !=
+	    cairo_image_surface_get_width(dst) ||
+	    cairo_image_surface_get_height(src) !=
+	    cairo_image_surface_get_height(dst) ||
+	    cairo_image_surface_get_stride(src) !=
+	    cairo_image_surface_get_stride(dst))
+		return;
+
+	cairo_surface_flush(dst);
+	memcpy(cairo_image_surface_get_data(dst),
+	       cairo_image_surface_get_data(src),
+	       cairo_image_surface_get_stride(src) *
+	       cairo_image_surface_get_height(src));
+	cairo_surface_mark_dirty(dst);
+
+	surface->current_preserved = true;
+}
+
 static cairo_surface_t *
 shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		    int32_t width, int32_t height, uint32_t flags,
@@ -1098,12 +1154,19 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 
 	surface->dx = dx;
 	surface->dy = dy;
+	surface->current_preserved = false;
 
-	/* pick a free buffer, preferably one that already has storage */
+	/* pick a free buffer, preferably the last posted one, or else one
+	 * that already has storage */
 	for (i = 0; i < MAX_LEAVES; i++) {
 		if (surface->leaf[i].busy)
 			continue;
 
+		if (&surface->leaf[i] == surface->last) {
+			leaf = &surface->leaf[i];
+			break;
+		}
+
 		if (!leaf || surface->leaf[i].cairo_surface)
 			leaf = &surface->leaf[i];
 	}
@@ -1128,11 +1191,16 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 
 	if (leaf->cairo_surface &&
 	    cairo_image_surface_get_width(leaf->cairo_surface) == width &&
-	    cairo_image_surface_get_height(leaf->cairo_surface) == height)
+	    cairo_image_surface_get_height(leaf->cairo_surface) == height) {
+		if (flags & SURFACE_HINT_PRESERVE)
+			shm_surface_leaf_preserve(surface, leaf);
 		goto out;
+	}
 
 	if (leaf->cairo_surface)
 		cairo_surface_destroy(leaf->cairo_surface);
+	if (leaf == surface->last)
+		surface->last = NULL;
 
 #ifdef USE_RESIZE_POOL
 	if (resize_hint && !leaf->resize_pool) {
@@ -1167,9 +1235,18 @@ out:
 	return cairo_surface_reference(leaf->cairo_surface);
 }
 
+static bool
+shm_surface_has_previous_content(struct toysurface *base)
+{
+	struct shm_surface *surface = to_shm_surface(base);
+
+	return surface->current_preserved;
+}
+
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		 const struct rectangle *damage,
 		 struct rectangle *server_allocation)
 {
 	struct shm_surface *surface = to_shm_surface(base);
@@ -1186,15 +1263,22 @@ shm_surface_swap(struct toysurface *base,
 
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+	if (damage)
+		wl_surface_damage(surface->surface, damage->x, damage->y,
+				  damage->width, damage->height);
+	else
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
 	wl_surface_commit(surface->surface);
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
 
 	leaf->busy = 1;
+	surface->last = leaf;
 	surface->current = NULL;
+	surface->current_preserved = false;
 }
 
 static void
@@ -1218,6 +1302,7 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 
 	surface = xzalloc(sizeof *surface);
 	surface->base.prepare = shm_surface_prepare;
+	surface->base.has_previous_content = shm_surface_has_previous_content;
 	surface->base.swap = shm_surface_swap;
 	surface->base.destroy = shm_surface_destroy;
 
@@ -1420,6 +1505,8 @@ static void
 surface_flush(struct surface *surface)
 {
 	struct widget *widget = surface->widget;
+	struct rectangle damage;
+
 	if (!surface->cairo_surface)
 		return;
 
@@ -1443,9 +1530,17 @@ surface_flush(struct surface *surface)
 					    widget->viewport_dest_height);
 	}
 
+	if (surface->partial_redraw) {
+		damage = surface->damage;
+		damage.x -= surface->allocation.x;
+		damage.y -= surface->allocation.y;
+	}
+
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
+				  surface->partial_redraw ? &damage : NULL,
 				  &surface->server_allocation);
+	surface->partial_redraw = false;
 
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
@@ -1493,6 +1588,9 @@ surface_create_surface(struct surface *surface, uint32_t flags)
 							 surface->surface,
 							 flags, &allocation);
 
+	if (surface->partial_redraw)
+		flags |= SURFACE_HINT_PRESERVE;
+
 	surface->cairo_surface = surface->toysurface->prepare(
 		surface->toysurface, 0, 0,
 		allocation.width, allocation.height, flags,
@@ -1865,6 +1963,12 @@ widget_cairo_create(struct widget *widget)
 
 	cairo_translate(cr, -surface->allocation.x, -surface->allocation.y);
 
+	if (surface->partial_redraw) {
+		cairo_rectangle(cr, surface->damage.x, surface->damage.y,
+				surface->damage.width, surface->damage.height);
+		cairo_clip(cr);
+	}
+
 	return cr;
 }
 
@@ -2067,6 +2171,85 @@ widget_schedule_redraw(struct widget *widget)
 {
 	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
 	widget->surface->redraw_needed = 1;
+	widget->surface->partial_redraw = false;
+	window_schedule_redraw_task(widget->window);
+}
+
+static void
+rectangle_union(struct rectangle *dst, const struct rectangle *src)
+{
+	int32_t x1, y1, x2, y2;
+
+	x1 = MIN(dst->x, src->x);
+	y1 = MIN(dst->y, src->y);
+	x2 = MAX(dst->x + dst->width, src->x + src->width);
+	y2 = MAX(dst->y + dst->height, src->y + src->height);
+
+	dst->x = x1;
+	dst->y = y1;
+	dst->width = x2 - x1;
+	dst->height = y2 - y1;
+}
+
+static bool
+rectangle_intersects(const struct rectangle *a, const struct rectangle *b)
+{
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+	       a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+/*
+ * Like widget_schedule_redraw(), but only the widget's allocation is
+ * redrawn and damaged, provided the surface's previous content can be
+ * kept. Drawing is clipped to that area, and the redraw handlers of
+ * widgets outside of it are not called. Any full redraw requested
+ * before the next frame takes precedence.
+ */
+void
+widget_schedule_partial_redraw(struct widget *widget)
+{
+	widget_schedule_redraw_area(widget, &widget->allocation);
+}
+
+/*
+ * Like widget_schedule_partial_redraw(), for a part of the widget only.
+ * 'area' is in the same coordinates as the widget allocation, and is
+ * clipped to it.
+ */
+void
+widget_schedule_redraw_area(struct widget *widget,
+			    const struct rectangle *area)
+{
+	struct surface *surface = widget->surface;
+	struct rectangle clipped;
+	int32_t x2, y2;
+
+	DBG_OBJ(surface->surface, "widget %p\n", widget);
+
+	if (!surface->widget->use_cairo) {
+		widget_schedule_redraw(widget);
+		return;
+	}
+
+	clipped.x = MAX(area->x, widget->allocation.x);
+	clipped.y = MAX(area->y, widget->allocation.y);
+	x2 = MIN(area->x + area->width,
+		 widget->allocation.x + widget->allocation.width);
+	y2 = MIN(area->y + area->height,
+		 widget->allocation.y + widget->allocation.height);
+	if (x2 <= clipped.x || y2 <= clipped.y)
+		return;
+	clipped.width = x2 - clipped.x;
+	clipped.height = y2 - clipped.y;
+
+	if (!surface->redraw_needed) {
+		surface->partial_redraw = true;
+		surface->damage = clipped;
+	} else if (surface->partial_redraw) {
+		rectangle_union(&surface->damage, &clipped);
+	}
+
+	surface->redraw_needed = 1;
 	window_schedule_redraw_task(widget->window);
 }
 
@@ -4651,9 +4834,12 @@ window_get_allocation(struct window *window,
 static void
 widget_redraw(struct widget *widget)
 {
+	struct surface *surface = widget->surface;
 	struct widget *child;
 
-	if (widget->redraw_handler)
+	if (widget->redraw_handler &&
+	    (!surface->partial_redraw ||
+	     rectangle_intersects(&widget->allocation, &surface->damage)))
 		widget->redraw_handler(widget, widget->user_data);
 	wl_list_for_each(child, &widget->child_list, link)
 		widget_redraw(child);
@@ -4700,12 +4886,20 @@ surface_redraw(struct surface *surface)
 		wl_callback_destroy(surface->frame_cb);
 	}
 
+	if (surface->window->redraw_needed)
+		surface->partial_redraw = false;
+
 	if (surface->widget->use_cairo &&
 	    !widget_get_cairo_surface(surface->widget)) {
 		DBG_OBJ(surface->surface, "cancelled due to buffer failure\n");
 		return -1;
 	}
 
+	/* Fall back to a full redraw when the old content is gone */
+	if (surface->partial_redraw &&
+	    !surface->toysurface->has_previous_content(surface->toysurface))
+		surface->partial_redraw = false;
+
 	surface->frame_cb = wl_surface_frame(surface->surface);
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
@@ -4789,8 +4983,10 @@ window_schedule_redraw(struct window *window)
 
 	DBG_OBJ(window->main_surface->surface, "window %p\n", window);
 
-	wl_list_for_each(surface, &window->subsurface_list, link)
+	wl_list_for_each(surface, &window->subsurface_list, link) {
 		surface->redraw_needed = 1;
+		surface->partial_redraw = false;
+	}
 
 	window_schedule_redraw_task(window);
 }
@@ -117,6 +117,7 @@ display_create_data_source(struct display *display);
 #define SURFACE_SHM    0x02
 
 #define SURFACE_HINT_RESIZE 0x10
+#define SURFACE_HINT_PRESERVE 0x20
 
 cairo_surface_t *
 display_create_surface(struct display *display,
@@ -694,6 +695,11 @@ window_uninhibit_redraw(struct window *window);
 void
 widget_schedule_redraw(struct widget *widget);
 void
+widget_schedule_partial_redraw(struct widget *widget);
+void
+widget_schedule_redraw_area(struct widget *widget,
+			    const struct rectangle *area);
+void
 widget_set_use_cairo(struct widget *widget, int use_cairo);
 
 /*
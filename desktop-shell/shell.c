@@ -48,6 +48,11 @@
 #define DEFAULT_NUM_WORKSPACES 1
 #define DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH 200
 
+/* Touch move prediction: the longest horizon that still looks sane, and the
+ * pause after which the finger is considered to have stopped. */
+#define TOUCH_MOVE_PREDICTION_MAX_MS 50
+#define TOUCH_MOVE_PREDICTION_MAX_GAP_MS 50.0
+
 struct focus_state {
 	struct desktop_shell *shell;
 	struct weston_seat *seat;
@@ -177,6 +182,13 @@ struct weston_touch_move_grab {
 	struct shell_touch_grab base;
 	int active;
 	struct weston_coord_global delta;
+
+	/* Smoothed finger velocity in pixels per millisecond, see
+	 * touch_move_grab_predict() */
+	struct weston_coord_global velocity;
+	struct weston_coord_global last_pos;
+	struct timespec last_time;
+	bool have_last;
 };
 
 struct weston_tablet_tool_move_grab {
@@ -523,6 +535,7 @@ shell_configuration(struct desktop_shell *shell)
 	struct weston_config *config;
 	char *s, *client;
 	bool allow_zap;
+	uint32_t occluded_frame_interval;
 
 	config = wet_get_config(shell->compositor);
 	section = weston_config_get_section(config, "shell", NULL, NULL);
@@ -537,6 +550,21 @@ shell_configuration(struct desktop_shell *shell)
 
 	shell->binding_modifier = weston_config_get_binding_modifier(config, MODIFIER_SUPER);
 
+	/* Hidden and covered windows keep their frame callbacks held unless
+	 * a throttling interval is configured. */
+	weston_config_section_get_uint(section, "touch-move-prediction",
+				       &shell->touch_move_prediction, 0);
+	if (shell->touch_move_prediction > TOUCH_MOVE_PREDICTION_MAX_MS)
+		shell->touch_move_prediction = TOUCH_MOVE_PREDICTION_MAX_MS;
+
+	weston_config_section_get_uint(section, "occluded-frame-interval",
+				       &occluded_frame_interval, 0);
+	weston_compositor_set_occluded_frame_policy(shell->compositor,
+						    occluded_frame_interval ?
+						    WESTON_OCCLUDED_FRAME_THROTTLE :
+						    WESTON_OCCLUDED_FRAME_HOLD,
+						    occluded_frame_interval);
+
 	weston_config_section_get_string(section, "animation", &s, "none");
 	shell->win_animation_type = get_animation_type(s);
 	free(s);
@@ -937,6 +965,60 @@ touch_move_grab_down(struct weston_touch_grab *grab,
 {
 }
 
+static void
+touch_move_grab_set_position(struct weston_touch_move_grab *move,
+			     struct weston_coord_global finger)
+{
+	struct shell_surface *shsurf = move->base.shsurf;
+	struct weston_coord_global pos;
+
+	pos = weston_coord_global_add(finger, move->delta);
+	pos.c = weston_coord_truncate(pos.c);
+	weston_view_set_position(shsurf->view, pos);
+}
+
+/* Extrapolate the finger position a few milliseconds ahead, so that the
+ * window does not trail behind the finger by the input to display latency.
+ * The velocity is smoothed over the last events, to not amplify the
+ * touchscreen noise. */
+static struct weston_coord_global
+touch_move_grab_predict(struct weston_touch_move_grab *move,
+			const struct timespec *time,
+			struct weston_coord_global pos,
+			uint32_t horizon_ms)
+{
+	struct weston_coord_global step;
+	struct weston_coord_global predicted;
+	double dt_ms;
+
+	if (move->have_last) {
+		dt_ms = timespec_sub_to_nsec(time, &move->last_time) / 1e6;
+		if (dt_ms <= 0.0)
+			goto out;
+
+		if (dt_ms > TOUCH_MOVE_PREDICTION_MAX_GAP_MS) {
+			move->velocity.c = weston_coord(0, 0);
+		} else {
+			step = weston_coord_global_sub(pos, move->last_pos);
+			move->velocity.c.x +=
+				(step.c.x / dt_ms - move->velocity.c.x) * 0.5;
+			move->velocity.c.y +=
+				(step.c.y / dt_ms - move->velocity.c.y) * 0.5;
+		}
+	}
+
+	move->last_pos = pos;
+	move->last_time = *time;
+	move->have_last = true;
+
+out:
+	predicted = pos;
+	predicted.c.x += move->velocity.c.x * horizon_ms;
+	predicted.c.y += move->velocity.c.y * horizon_ms;
+
+	return predicted;
+}
+
 static void
 touch_move_grab_up(struct weston_touch_grab *grab, const struct timespec *time,
 		   int touch_id)
@@ -944,6 +1026,12 @@ touch_move_grab_up(struct weston_touch_grab *grab, const struct timespec *time,
 	struct weston_touch_move_grab *move =
 		(struct weston_touch_move_grab *) container_of(
 			grab, struct shell_touch_grab, grab);
+	struct shell_surface *shsurf = move->base.shsurf;
+
+	/* Land where the finger was lifted, not where it was predicted. */
+	if (move->active && move->have_last && touch_id == 0 &&
+	    shsurf && shsurf->desktop_surface)
+		touch_move_grab_set_position(move, grab->touch->grab_pos);
 
 	if (touch_id == 0)
 		move->active = 0;
@@ -961,14 +1049,22 @@ touch_move_grab_motion(struct weston_touch_grab *grab,
 {
 	struct weston_touch_move_grab *move = (struct weston_touch_move_grab *) grab;
 	struct shell_surface *shsurf = move->base.shsurf;
-	struct weston_coord_global pos;
+	struct weston_coord_global pos = grab->touch->grab_pos;
+	uint32_t horizon;
 
 	if (!shsurf || !shsurf->desktop_surface || !move->active)
 		return;
 
-	pos = weston_coord_global_add(grab->touch->grab_pos, move->delta);
-	pos.c = weston_coord_truncate(pos.c);
-	weston_view_set_position(shsurf->view, pos);
+	horizon = shsurf->shell->touch_move_prediction;
+	if (horizon > 0) {
+		/* Other touch points do not move the window. */
+		if (touch_id != grab->touch->grab_touch_id)
+			return;
+
+		pos = touch_move_grab_predict(move, time, pos, horizon);
+	}
+
+	touch_move_grab_set_position(move, pos);
 }
 
 static void
@@ -1006,7 +1102,7 @@ surface_touch_move(struct shell_surface *shsurf, struct weston_touch *touch)
 	if (shsurf_is_max_or_fullscreen(shsurf))
 		return 0;
 
-	move = malloc(sizeof *move);
+	move = zalloc(sizeof *move);
 	if (!move)
 		return -1;
 
@@ -1166,6 +1262,8 @@ struct weston_resize_grab {
 	struct shell_grab base;
 	uint32_t edges;
 	int32_t width, height;
+	/* Last size asked of the client */
+	int32_t last_width, last_height;
 };
 
 static void
@@ -1364,6 +1462,12 @@ resize_grab_motion(struct weston_pointer_grab *grab,
 		height = min_size.height;
 	else if (max_size.height > 0 && height > max_size.height)
 		height = max_size.height;
+
+	if (width == resize->last_width && height == resize->last_height)
+		return;
+
+	resize->last_width = width;
+	resize->last_height = height;
 	weston_desktop_surface_set_size(shsurf->desktop_surface, width, height);
 }
 
@@ -1448,6 +1552,8 @@ surface_resize(struct shell_surface *shsurf,
 	geometry = weston_desktop_surface_get_geometry(shsurf->desktop_surface);
 	resize->width = geometry.width;
 	resize->height = geometry.height;
+	resize->last_width = geometry.width;
+	resize->last_height = geometry.height;
 
 	shsurf->resize_edges = edges;
 	weston_desktop_surface_set_resizing(shsurf->desktop_surface, true);
@@ -3820,11 +3926,8 @@ unlock(struct desktop_shell *shell)
 }
 
 static void
-shell_fade_done(struct weston_view_animation *animation, void *data)
+shell_fade_finish(struct desktop_shell *shell)
 {
-	struct desktop_shell *shell = data;
-
-	shell->fade.animation = NULL;
 	switch (shell->fade.type) {
 	case FADE_IN:
 		weston_shell_utils_curtain_destroy(shell->fade.curtain);
@@ -3838,6 +3941,15 @@ shell_fade_done(struct weston_view_animation *animation, void *data)
 	}
 }
 
+static void
+shell_fade_done(struct weston_view_animation *animation, void *data)
+{
+	struct desktop_shell *shell = data;
+
+	shell->fade.animation = NULL;
+	shell_fade_finish(shell);
+}
+
 static int
 fade_surface_get_label(struct weston_surface *surface,
 		       char *buf, size_t len)
@@ -3890,6 +4002,28 @@ shell_fade_create_view(struct desktop_shell *shell)
 	return curtain;
 }
 
+static void
+shell_output_fade_done(struct weston_output_fade *fade, void *data)
+{
+	struct desktop_shell *shell = data;
+	struct weston_compositor *compositor = shell->compositor;
+
+	shell->fade.output_fade = NULL;
+
+	/* The outputs light up again, so the curtain takes over the black
+	 * in the same repaint. */
+	if (shell->fade.type == FADE_OUT) {
+		if (!shell->fade.curtain)
+			shell->fade.curtain = shell_fade_create_view(shell);
+		else
+			weston_view_move_to_layer(shell->fade.curtain->view,
+						  &compositor->fade_layer.view_list);
+		weston_view_set_alpha(shell->fade.curtain->view, 1.0);
+	}
+
+	shell_fade_finish(shell);
+}
+
 static void
 shell_fade(struct desktop_shell *shell, enum fade_type type)
 {
@@ -3909,6 +4043,28 @@ shell_fade(struct desktop_shell *shell, enum fade_type type)
 
 	shell->fade.type = type;
 
+	if (shell->fade.output_fade) {
+		weston_output_fade_update(shell->fade.output_fade, 1.0 - tint);
+		return;
+	}
+
+	/* Prefer dimming the outputs on their way to the monitor over
+	 * compositing the curtain on top of everything every frame. A curtain
+	 * that exists while not animating is fully black. */
+	if (!shell->fade.animation) {
+		shell->fade.output_fade =
+			weston_output_fade_run(shell->compositor,
+					       shell->fade.curtain ? 0.0 : 1.0,
+					       1.0 - tint,
+					       shell_output_fade_done, shell);
+		if (shell->fade.output_fade) {
+			if (shell->fade.curtain)
+				weston_view_move_to_layer(shell->fade.curtain->view,
+							  NULL);
+			return;
+		}
+	}
+
 	if (shell->fade.curtain == NULL) {
 		shell->fade.curtain = shell_fade_create_view(shell);
 		if (!shell->fade.curtain)
@@ -4791,6 +4947,11 @@ shell_destroy(struct wl_listener *listener, void *data)
 		shell->fade.animation = NULL;
 	}
 
+	if (shell->fade.output_fade) {
+		weston_output_fade_destroy(shell->fade.output_fade);
+		shell->fade.output_fade = NULL;
+	}
+
 	if (shell->fade.curtain)
 		weston_shell_utils_curtain_destroy(shell->fade.curtain);
 
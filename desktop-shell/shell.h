@@ -135,12 +135,14 @@ struct desktop_shell {
 	struct {
 		struct weston_curtain *curtain;
 		struct weston_view_animation *animation;
+		struct weston_output_fade *output_fade;
 		enum fade_type type;
 		struct wl_event_source *startup_timer;
 	} fade;
 
 	bool allow_zap;
 	uint32_t binding_modifier;
+	uint32_t touch_move_prediction; /* ms, 0 disables */
 	enum animation_type win_animation_type;
 	enum animation_type win_close_animation_type;
 	enum animation_type startup_animation_type;
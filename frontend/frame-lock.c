@@ -0,0 +1,532 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Frame lock for compositors driving the parts of a video wall.
+ *
+ * The nodes are expected to keep CLOCK_REALTIME in sync, with PTP or NTP.
+ * Wall clock time cut into refresh periods numbers the frames the same
+ * way on every node: each output aims its repaints at the local vblank
+ * closest to the start of a frame, and never shows two frames in the same
+ * period. With frame lock on, a node also announces every frame it is
+ * about to repaint on a multicast group and holds the repaint until all
+ * other live nodes got to it too, so that the wall flips together.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston.h"
+
+#define FRAME_LOCK_MAGIC 0x57464c4b /* "WFLK" */
+#define FRAME_LOCK_DEFAULT_GROUP "239.255.87.70"
+#define FRAME_LOCK_DEFAULT_PORT 7687
+#define FRAME_LOCK_DEFAULT_TIMEOUT_MS 50
+#define FRAME_LOCK_DEFAULT_MAX_NODES 16
+/* A node that sent nothing for this many frames is idle or gone */
+#define FRAME_LOCK_PEER_FRAMES 4
+/* ... and after this long, it is forgotten */
+#define FRAME_LOCK_PEER_EXPIRE_MS 1000
+
+struct frame_lock_msg {
+	uint32_t magic;
+	uint32_t node;
+	uint64_t frame;
+} __attribute__((packed));
+
+struct frame_lock_peer {
+	struct wl_list link; /* frame_lock::peers */
+	uint32_t node;
+	uint64_t frame;
+	struct timespec seen;
+};
+
+struct frame_lock {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+	struct wl_listener output_created_listener;
+	struct wl_listener output_destroyed_listener;
+
+	bool barrier;
+	int timeout_ms;
+	uint32_t node;
+	int fd;
+	struct sockaddr_in group;
+	struct wl_event_source *fd_source;
+
+	/* Anything on the network segment can send to the group, so the
+	 * number of other nodes tracked at once is bounded. */
+	struct wl_list peers; /* frame_lock_peer::link */
+	int peer_count;
+	int max_peers;
+	struct weston_log_pacer peers_full_pacer;
+
+	struct wl_list outputs; /* frame_lock_output::link */
+};
+
+struct frame_lock_output {
+	struct weston_frame_clock base;
+	struct frame_lock *fl;
+	struct weston_output *output;
+	struct wl_list link; /* frame_lock::outputs */
+
+	uint64_t frame; /* last frame aimed at */
+	uint64_t announced;
+	uint64_t waiting; /* held repaint for this frame, or 0 */
+	int32_t refresh_nsec;
+	struct wl_event_source *timeout_source;
+	struct weston_log_pacer timeout_pacer;
+};
+
+/* The wall clock time a presentation clock time stands for */
+static int64_t
+frame_lock_realtime_nsec(struct frame_lock *fl, const struct timespec *ts)
+{
+	struct timespec now, now_real;
+
+	weston_compositor_read_presentation_clock(fl->compositor, &now);
+	clock_gettime(CLOCK_REALTIME, &now_real);
+
+	return timespec_to_nsec(&now_real) + timespec_sub_to_nsec(ts, &now);
+}
+
+/* Number of the frame period starting closest to ts */
+static uint64_t
+frame_lock_frame(struct frame_lock *fl, const struct timespec *ts,
+		 int32_t refresh_nsec)
+{
+	int64_t real = frame_lock_realtime_nsec(fl, ts);
+
+	return (real + refresh_nsec / 2) / refresh_nsec;
+}
+
+static void
+frame_lock_align(struct weston_frame_clock *clock,
+		 struct weston_output *output,
+		 struct timespec *target, int32_t refresh_nsec)
+{
+	struct frame_lock_output *flo =
+		container_of(clock, struct frame_lock_output, base);
+	uint64_t frame;
+
+	if (refresh_nsec <= 0)
+		return;
+
+	flo->refresh_nsec = refresh_nsec;
+	frame = frame_lock_frame(flo->fl, target, refresh_nsec);
+
+	/* A display running a bit fast sees two vblanks in one period
+	 * every now and then: skip one, to stay on the same frame as the
+	 * rest of the wall. */
+	if (frame <= flo->frame && flo->frame - frame < 2) {
+		timespec_add_nsec(target, target, refresh_nsec);
+		frame = flo->frame + 1;
+	}
+
+	flo->frame = frame;
+}
+
+static bool
+frame_lock_peers_ready(struct frame_lock *fl, uint64_t frame,
+		       int32_t refresh_nsec)
+{
+	struct frame_lock_peer *peer;
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(fl->compositor, &now);
+
+	wl_list_for_each(peer, &fl->peers, link) {
+		if (timespec_sub_to_nsec(&now, &peer->seen) >
+		    (int64_t)FRAME_LOCK_PEER_FRAMES * refresh_nsec)
+			continue;
+
+		if (peer->frame < frame)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+frame_lock_announce(struct frame_lock *fl, uint64_t frame)
+{
+	struct frame_lock_msg msg = {
+		.magic = htonl(FRAME_LOCK_MAGIC),
+		.node = htonl(fl->node),
+		.frame = htobe64(frame),
+	};
+
+	if (sendto(fl->fd, &msg, sizeof msg, 0,
+		   (struct sockaddr *)&fl->group, sizeof fl->group) < 0)
+		weston_log("frame-lock: failed to send: %s\n", strerror(errno));
+}
+
+static bool
+frame_lock_ready(struct weston_frame_clock *clock,
+		 struct weston_output *output,
+		 const struct timespec *target)
+{
+	struct frame_lock_output *flo =
+		container_of(clock, struct frame_lock_output, base);
+	struct frame_lock *fl = flo->fl;
+	uint64_t frame;
+
+	if (flo->refresh_nsec <= 0)
+		return true;
+
+	/* A restarted repaint aims a period later than aligned */
+	frame = frame_lock_frame(fl, target, flo->refresh_nsec);
+
+	if (frame > flo->announced) {
+		frame_lock_announce(fl, frame);
+		flo->announced = frame;
+	}
+
+	if (frame_lock_peers_ready(fl, frame, flo->refresh_nsec))
+		return true;
+
+	flo->waiting = frame;
+	wl_event_source_timer_update(flo->timeout_source, fl->timeout_ms);
+
+	return false;
+}
+
+static void
+frame_lock_output_release(struct frame_lock_output *flo)
+{
+	flo->waiting = 0;
+	wl_event_source_timer_update(flo->timeout_source, 0);
+	weston_output_frame_clock_release(flo->output);
+}
+
+static int
+frame_lock_timeout(void *data)
+{
+	struct frame_lock_output *flo = data;
+
+	weston_log_paced(&flo->timeout_pacer, 5, 60 * 1000,
+			 "frame-lock: output %s gave up waiting for "
+			 "frame %" PRIu64 "\n", flo->output->name,
+			 flo->waiting);
+	frame_lock_output_release(flo);
+
+	return 0;
+}
+
+static void
+frame_lock_peer_destroy(struct frame_lock *fl, struct frame_lock_peer *peer)
+{
+	wl_list_remove(&peer->link);
+	fl->peer_count--;
+	free(peer);
+}
+
+static void
+frame_lock_expire_peers(struct frame_lock *fl)
+{
+	struct frame_lock_peer *peer, *tmp;
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(fl->compositor, &now);
+
+	wl_list_for_each_safe(peer, tmp, &fl->peers, link) {
+		if (timespec_sub_to_msec(&now, &peer->seen) <
+		    FRAME_LOCK_PEER_EXPIRE_MS)
+			continue;
+
+		weston_log("frame-lock: node %08x left\n", peer->node);
+		frame_lock_peer_destroy(fl, peer);
+	}
+}
+
+/* The peer for a node id, or NULL if there is no room for another one */
+static struct frame_lock_peer *
+frame_lock_get_peer(struct frame_lock *fl, uint32_t node)
+{
+	struct frame_lock_peer *peer;
+
+	wl_list_for_each(peer, &fl->peers, link) {
+		if (peer->node == node)
+			return peer;
+	}
+
+	if (fl->peer_count >= fl->max_peers) {
+		weston_log_paced(&fl->peers_full_pacer, 5, 60 * 1000,
+				 "frame-lock: ignoring node %08x, already "
+				 "tracking %d nodes\n", node, fl->peer_count);
+		return NULL;
+	}
+
+	peer = xzalloc(sizeof *peer);
+	peer->node = node;
+	wl_list_insert(&fl->peers, &peer->link);
+	fl->peer_count++;
+	weston_log("frame-lock: node %08x joined\n", node);
+
+	return peer;
+}
+
+static int
+frame_lock_handle_msg(int fd, uint32_t mask, void *data)
+{
+	struct frame_lock *fl = data;
+	struct frame_lock_output *flo;
+	struct frame_lock_peer *peer;
+	struct frame_lock_msg msg;
+	ssize_t len;
+
+	frame_lock_expire_peers(fl);
+
+	while ((len = recv(fd, &msg, sizeof msg, MSG_DONTWAIT)) >= 0) {
+		if (len != sizeof msg || ntohl(msg.magic) != FRAME_LOCK_MAGIC ||
+		    ntohl(msg.node) == fl->node)
+			continue;
+
+		peer = frame_lock_get_peer(fl, ntohl(msg.node));
+		if (!peer)
+			continue;
+
+		peer->frame = MAX(peer->frame, be64toh(msg.frame));
+		weston_compositor_read_presentation_clock(fl->compositor,
+							  &peer->seen);
+	}
+
+	wl_list_for_each(flo, &fl->outputs, link) {
+		if (flo->waiting &&
+		    frame_lock_peers_ready(fl, flo->waiting, flo->refresh_nsec))
+			frame_lock_output_release(flo);
+	}
+
+	return 0;
+}
+
+static void
+frame_lock_output_create(struct frame_lock *fl, struct weston_output *output)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(fl->compositor->wl_display);
+	struct frame_lock_output *flo;
+
+	flo = xzalloc(sizeof *flo);
+	flo->fl = fl;
+	flo->output = output;
+	flo->base.align = frame_lock_align;
+	if (fl->barrier) {
+		flo->base.ready = frame_lock_ready;
+		flo->timeout_source =
+			wl_event_loop_add_timer(loop, frame_lock_timeout, flo);
+	}
+	wl_list_insert(&fl->outputs, &flo->link);
+
+	weston_output_set_frame_clock(output, &flo->base);
+}
+
+static void
+frame_lock_output_destroy(struct frame_lock_output *flo)
+{
+	weston_output_set_frame_clock(flo->output, NULL);
+	if (flo->timeout_source)
+		wl_event_source_remove(flo->timeout_source);
+	wl_list_remove(&flo->link);
+	free(flo);
+}
+
+static void
+handle_output_created(struct wl_listener *listener, void *data)
+{
+	struct frame_lock *fl =
+		container_of(listener, struct frame_lock,
+			     output_created_listener);
+
+	frame_lock_output_create(fl, data);
+}
+
+static void
+handle_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct frame_lock *fl =
+		container_of(listener, struct frame_lock,
+			     output_destroyed_listener);
+	struct weston_output *output = data;
+	struct frame_lock_output *flo;
+
+	wl_list_for_each(flo, &fl->outputs, link) {
+		if (flo->output == output) {
+			frame_lock_output_destroy(flo);
+			return;
+		}
+	}
+}
+
+static void
+handle_compositor_destroy(struct wl_listener *listener, void *data)
+{
+	struct frame_lock *fl =
+		container_of(listener, struct frame_lock, destroy_listener);
+	struct frame_lock_output *flo, *flo_tmp;
+	struct frame_lock_peer *peer, *peer_tmp;
+
+	wl_list_for_each_safe(flo, flo_tmp, &fl->outputs, link)
+		frame_lock_output_destroy(flo);
+	wl_list_for_each_safe(peer, peer_tmp, &fl->peers, link)
+		frame_lock_peer_destroy(fl, peer);
+
+	wl_list_remove(&fl->destroy_listener.link);
+	wl_list_remove(&fl->output_created_listener.link);
+	wl_list_remove(&fl->output_destroyed_listener.link);
+	if (fl->fd_source)
+		wl_event_source_remove(fl->fd_source);
+	if (fl->fd >= 0)
+		close(fl->fd);
+	free(fl);
+}
+
+static int
+frame_lock_open_socket(struct frame_lock *fl, const char *group, int port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	struct ip_mreq mreq = { 0 };
+	int one = 1;
+	unsigned char loop = 1;
+
+	fl->group.sin_family = AF_INET;
+	fl->group.sin_port = htons(port);
+	if (inet_pton(AF_INET, group, &fl->group.sin_addr) != 1) {
+		weston_log("frame-lock: invalid group address %s\n", group);
+		return -1;
+	}
+
+	fl->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fl->fd < 0)
+		goto err;
+
+	/* Several nodes may share a host while testing */
+	mreq.imr_multiaddr = fl->group.sin_addr;
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	if (setsockopt(fl->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0 ||
+	    bind(fl->fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+	    setsockopt(fl->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+		       &mreq, sizeof mreq) < 0 ||
+	    setsockopt(fl->fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+		       &loop, sizeof loop) < 0)
+		goto err;
+
+	return 0;
+
+err:
+	weston_log("frame-lock: failed to join %s:%d: %s\n",
+		   group, port, strerror(errno));
+	return -1;
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+	struct weston_output *output;
+	struct frame_lock *fl;
+	struct timespec now;
+	char *group;
+	int32_t port;
+
+	fl = xzalloc(sizeof *fl);
+	fl->compositor = compositor;
+	fl->fd = -1;
+	wl_list_init(&fl->peers);
+	wl_list_init(&fl->outputs);
+
+	if (!weston_compositor_add_destroy_listener_once(compositor,
+							 &fl->destroy_listener,
+							 handle_compositor_destroy)) {
+		free(fl);
+		return 0;
+	}
+
+	section = weston_config_get_section(wet_get_config(compositor),
+					    "frame-lock", NULL, NULL);
+	weston_config_section_get_bool(section, "barrier", &fl->barrier, true);
+	weston_config_section_get_int(section, "timeout", &fl->timeout_ms,
+				      FRAME_LOCK_DEFAULT_TIMEOUT_MS);
+	weston_config_section_get_string(section, "group", &group,
+					 FRAME_LOCK_DEFAULT_GROUP);
+	weston_config_section_get_int(section, "port", &port,
+				      FRAME_LOCK_DEFAULT_PORT);
+	weston_config_section_get_int(section, "max-nodes", &fl->max_peers,
+				      FRAME_LOCK_DEFAULT_MAX_NODES);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	fl->node = (uint32_t)getpid() ^ (uint32_t)now.tv_nsec;
+
+	if (fl->barrier && frame_lock_open_socket(fl, group, port) < 0) {
+		weston_log("frame-lock: running without barrier\n");
+		fl->barrier = false;
+	}
+	free(group);
+
+	if (fl->barrier) {
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		fl->fd_source = wl_event_loop_add_fd(loop, fl->fd,
+						     WL_EVENT_READABLE,
+						     frame_lock_handle_msg, fl);
+	}
+
+	fl->output_created_listener.notify = handle_output_created;
+	wl_signal_add(&compositor->output_created_signal,
+		      &fl->output_created_listener);
+	fl->output_destroyed_listener.notify = handle_output_destroyed;
+	wl_signal_add(&compositor->output_destroyed_signal,
+		      &fl->output_destroyed_listener);
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		frame_lock_output_create(fl, output);
+
+	weston_log("frame-lock: node %08x, barrier %s\n", fl->node,
+		   fl->barrier ? "on" : "off");
+
+	return 0;
+}
@@ -34,9 +34,11 @@
 #include <signal.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
+#include <sched.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -53,6 +55,7 @@
 #include "shared/helpers.h"
 #include "shared/process-util.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include "git-version.h"
 #include <libweston/version.h>
@@ -155,6 +158,13 @@ struct wet_compositor {
 	struct wl_listener screenshot_auth;
 	struct wl_listener output_created_listener;
 	enum require_outputs require_outputs;
+
+	struct weston_log_scope *startup_scope;
+	struct timespec startup_begin;
+	struct timespec startup_last;
+	struct wl_list startup_frame_list;	/**< wet_startup_frame::link */
+	char *deferred_modules;
+	struct wl_event_source *deferred_modules_timer;
 };
 
 static FILE *weston_logfile = NULL;
@@ -731,6 +741,8 @@ usage(int error_code)
 		"  -f, --flight-rec-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
+		"  --flight-rec-file=FILE\n\t\t\tKeep the flight recorder in "
+			"a memory-mapped file\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 #if defined(BUILD_DRM_COMPOSITOR)
@@ -757,6 +769,8 @@ usage(int error_code)
 		"  --use-gl\t\tUse the GL renderer (deprecated alias for --renderer=gl)\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
 		"  --refresh-rate=RATE\tThe output refresh rate (in mHz)\n"
+		"  --max-throughput\tRepaint as fast as possible, ignoring the refresh rate\n"
+		"  --gpu-fence\t\tWith --max-throughput, wait for the GPU to finish each frame\n"
 		"\n");
 #endif
 
@@ -806,6 +820,7 @@ usage(int error_code)
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (deprecated alias for --renderer=pixman)\n"
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --sprawl\t\tCreate one fullscreen output for every parent output\n"
+		"  --dmabuf\t\tPresent GL outputs through the parent's linux-dmabuf\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 #endif
 
@@ -1152,6 +1167,50 @@ weston_parse_require_outputs(const char *name, enum require_outputs *mode)
 	return -1;
 }
 
+/* Run the main thread, which handles both input and repaint, under a
+ * realtime scheduling policy when [core] realtime-priority asks for it.
+ * SCHED_RESET_ON_FORK keeps clients and Xwayland launched by weston from
+ * inheriting it. Failing is not fatal: weston keeps the normal policy. */
+static void
+wet_set_realtime_priority(struct weston_compositor *ec,
+			  struct weston_config_section *section)
+{
+	struct sched_param param = { 0 };
+	char *policy_name = NULL;
+	int policy = SCHED_RR;
+	int priority;
+
+	weston_config_section_get_int(section, "realtime-priority",
+				      &priority, 0);
+	if (priority <= 0)
+		return;
+
+	weston_config_section_get_string(section, "realtime-policy",
+					 &policy_name, "rr");
+	if (strcmp(policy_name, "fifo") == 0) {
+		policy = SCHED_FIFO;
+	} else if (strcmp(policy_name, "rr") != 0) {
+		weston_log("warning: unknown realtime-policy \"%s\", "
+			   "using \"rr\"\n", policy_name);
+	}
+	free(policy_name);
+
+	param.sched_priority = MIN(priority, sched_get_priority_max(policy));
+	if (sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param) < 0) {
+		weston_log("Failed to set realtime priority %d: %s%s\n",
+			   param.sched_priority, strerror(errno),
+			   errno == EPERM ? " (needs CAP_SYS_NICE or "
+			   "a large enough RLIMIT_RTPRIO)" : "");
+		return;
+	}
+
+	ec->realtime_policy = policy;
+	ec->realtime_priority = param.sched_priority;
+	weston_log("Running with realtime priority %d (%s)\n",
+		   param.sched_priority,
+		   policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR");
+}
+
 static int
 weston_compositor_init_config(struct weston_compositor *ec,
 			      struct weston_config *config)
@@ -1160,6 +1219,9 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	uint32_t client_surface_budget;
+	uint32_t client_buffer_budget_mb;
+	uint32_t idle_trim_delay;
 	bool color_management;
 	bool cal;
 
@@ -1200,6 +1262,50 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_bool(s, "adaptive-repaint-window",
+				       &ec->repaint_adaptive, false);
+	weston_config_section_get_int(s, "repaint-margin",
+				      &ec->repaint_margin_usec,
+				      ec->repaint_margin_usec);
+	if (ec->repaint_margin_usec < 0)
+		ec->repaint_margin_usec = 0;
+	if (ec->repaint_adaptive)
+		weston_log("Output repaint window adapts to repaint time, "
+			   "plus %d us margin.\n", ec->repaint_margin_usec);
+
+	weston_config_section_get_bool(s, "gl-program-cache",
+				       &ec->gl_program_cache_enabled, false);
+	weston_config_section_get_bool(s, "gl-program-prewarm",
+				       &ec->gl_program_cache_prewarm, false);
+	weston_config_section_get_bool(s, "gl-shm-pbo-upload",
+				       &ec->gl_shm_pbo_upload, false);
+	weston_config_section_get_bool(s, "gl-shm-atlas",
+				       &ec->gl_shm_atlas, false);
+	weston_config_section_get_bool(s, "shm-early-release",
+				       &ec->shm_early_release, false);
+	weston_config_section_get_uint(s, "gl-color-lut-bake",
+				       &ec->gl_color_lut_bake_size, 0);
+	weston_config_section_get_bool(s, "color-transform-async",
+				       &ec->color_transform_async, false);
+	weston_config_section_get_bool(s, "color-eotf-cache",
+				       &ec->color_eotf_cache, false);
+	weston_config_section_get_int(s, "pixman-render-threads",
+				      &ec->pixman_render_threads, 0);
+	weston_config_section_get_bool(s, "full-view-list-rebuild",
+				       &ec->view_list_full_rebuild, false);
+
+	weston_config_section_get_uint(s, "client-surface-budget",
+				       &client_surface_budget, 0);
+	weston_config_section_get_uint(s, "client-buffer-budget-mb",
+				       &client_buffer_budget_mb, 0);
+	weston_compositor_set_client_budget(ec, client_surface_budget,
+					    (uint64_t)client_buffer_budget_mb *
+					    1024 * 1024);
+
+	weston_config_section_get_uint(s, "idle-trim-delay",
+				       &idle_trim_delay, 0);
+	weston_compositor_set_idle_task_delay(ec, idle_trim_delay * 1000);
+
 	weston_config_section_get_bool(s, "color-management",
 				       &color_management, false);
 	if (color_management) {
@@ -3419,6 +3525,15 @@ load_drm_backend(struct weston_compositor *c, int *argc, char **argv,
 	                               &config.pageflip_timeout, 0);
 	weston_config_section_get_bool(section, "pixman-shadow",
 				       &config.use_pixman_shadow, true);
+	weston_config_section_get_bool(section, "kms-color-pipeline",
+				       &config.offload_color_pipeline, false);
+
+	section = weston_config_get_section(wc, "libinput", NULL, NULL);
+	weston_config_section_get_bool(section, "input-thread",
+				       &config.input_thread, false);
+	weston_config_section_get_string(section, "shard-seats",
+					 &config.input_shard_seats, NULL);
+
 	if (without_input)
 		c->require_input = !without_input;
 
@@ -3440,6 +3555,7 @@ load_drm_backend(struct weston_compositor *c, int *argc, char **argv,
 	free(config.gbm_format);
 	free(config.seat_id);
 	free(config.specific_device);
+	free(config.input_shard_seats);
 
 	return 0;
 }
@@ -3505,6 +3621,8 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
 		{ WESTON_OPTION_INTEGER, "refresh-rate", 0, &config.refresh },
+		{ WESTON_OPTION_BOOLEAN, "max-throughput", 0, &config.max_throughput },
+		{ WESTON_OPTION_BOOLEAN, "gpu-fence", 0, &config.gpu_fence },
 	};
 	config.refresh = -1;
 
@@ -3640,10 +3758,15 @@ load_pipewire_backend(struct weston_compositor *c,
 	section = weston_config_get_section(wc, "pipewire", NULL, NULL);
 	weston_config_section_get_int(section, "num-outputs",
 				      &config.num_outputs, 1);
+	weston_config_section_get_string(section, "h264-device",
+					 &config.h264_device, NULL);
+	weston_config_section_get_uint(section, "h264-bitrate",
+				       &config.h264_bitrate, 0);
 
 	wb = wet_compositor_load_backend(c, WESTON_BACKEND_PIPEWIRE,
 					 &config.base, simple_heads_changed,
 					 pipewire_backend_output_configure);
+	free(config.h264_device);
 	if (!wb)
 		return -1;
 
@@ -3777,6 +3900,10 @@ load_rdp_backend(struct weston_compositor *c,
 					 config.server_cert);
 	weston_config_section_get_string(section, "tls-key",
 					 &config.server_key, config.server_key);
+	weston_config_section_get_int(section, "encoder-threads",
+				      &config.encoder_threads, 0);
+	weston_config_section_get_bool(section, "graphics-pipeline",
+				       &config.gfx_pipeline, false);
 
 	wb = wet_compositor_load_backend(c, WESTON_BACKEND_RDP, &config.base,
 					 simple_heads_changed,
@@ -3893,6 +4020,8 @@ load_vnc_backend(struct weston_compositor *c,
 					 config.server_cert);
 	weston_config_section_get_string(section, "tls-key",
 					 &config.server_key, config.server_key);
+	weston_config_section_get_bool(section, "zero-copy",
+				       &config.zero_copy, false);
 
 	wb = wet_compositor_load_backend(c, WESTON_BACKEND_VNC, &config.base,
 					 simple_heads_changed,
@@ -4078,6 +4207,7 @@ load_wayland_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "output-count", 0, &count },
 		{ WESTON_OPTION_BOOLEAN, "fullscreen", 0, &config.fullscreen },
 		{ WESTON_OPTION_BOOLEAN, "sprawl", 0, &config.sprawl },
+		{ WESTON_OPTION_BOOLEAN, "dmabuf", 0, &config.use_dmabuf },
 	};
 
 	parse_options(wayland_options, ARRAY_LENGTH(wayland_options), argc, argv);
@@ -4405,6 +4535,168 @@ screenshot_allow_all(struct wl_listener *l,
 	att->authorized = true;
 }
 
+/* If no output gets a frame rendered, e.g. because every view ended up on
+ * a plane, the deferred modules are loaded after this many milliseconds.
+ */
+#define DEFERRED_MODULES_TIMEOUT_MS 1000
+
+struct wet_startup_frame {
+	struct wet_compositor *wet;
+	struct weston_output *output;
+	struct wl_listener frame_listener;
+	struct wl_listener destroy_listener;
+	struct wl_list link;	/**< wet_compositor::startup_frame_list */
+};
+
+static void __attribute__ ((format (printf, 2, 3)))
+wet_startup_mark(struct wet_compositor *wet, const char *fmt, ...)
+{
+	struct timespec now;
+	char *phase;
+	va_list ap;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (weston_log_scope_is_enabled(wet->startup_scope)) {
+		va_start(ap, fmt);
+		ret = vasprintf(&phase, fmt, ap);
+		va_end(ap);
+
+		if (ret >= 0) {
+			weston_log_scope_printf(wet->startup_scope,
+						"%9.3f ms (+%8.3f ms) %s\n",
+						timespec_sub_to_nsec(&now, &wet->startup_begin) / 1e6,
+						timespec_sub_to_nsec(&now, &wet->startup_last) / 1e6,
+						phase);
+			free(phase);
+		}
+	}
+
+	wet->startup_last = now;
+}
+
+static void
+wet_startup_frame_destroy(struct wet_startup_frame *sf)
+{
+	wl_list_remove(&sf->frame_listener.link);
+	wl_list_remove(&sf->destroy_listener.link);
+	wl_list_remove(&sf->link);
+	free(sf);
+}
+
+static void
+wet_startup_frames_release(struct wet_compositor *wet)
+{
+	struct wet_startup_frame *sf, *tmp;
+
+	wl_list_for_each_safe(sf, tmp, &wet->startup_frame_list, link)
+		wet_startup_frame_destroy(sf);
+}
+
+static void
+wet_load_deferred_modules(struct wet_compositor *wet)
+{
+	char *args[] = { "weston", NULL };
+	int argc = 1;
+
+	if (wet->deferred_modules_timer) {
+		wl_event_source_remove(wet->deferred_modules_timer);
+		wet->deferred_modules_timer = NULL;
+	}
+
+	if (!wet->deferred_modules)
+		return;
+
+	/* Deferred modules get an empty command line, anything they need
+	 * has to come from weston.ini.
+	 */
+	if (load_modules(wet->compositor, wet->deferred_modules,
+			 &argc, args) < 0)
+		weston_log("Failed to load deferred modules \"%s\".\n",
+			   wet->deferred_modules);
+	else
+		wet_startup_mark(wet, "deferred modules loaded");
+
+	free(wet->deferred_modules);
+	wet->deferred_modules = NULL;
+}
+
+static int
+deferred_modules_timer_handler(void *data)
+{
+	struct wet_compositor *wet = data;
+
+	wet_startup_mark(wet, "no frame rendered after %d ms",
+			 DEFERRED_MODULES_TIMEOUT_MS);
+	wet_startup_frames_release(wet);
+	wet_load_deferred_modules(wet);
+
+	return 0;
+}
+
+static void
+startup_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct wet_startup_frame *sf =
+		container_of(listener, struct wet_startup_frame,
+			     frame_listener);
+	struct wet_compositor *wet = sf->wet;
+
+	wet_startup_mark(wet, "first frame rendered on %s", sf->output->name);
+
+	/* Only the first frame of the first output matters. */
+	wet_startup_frames_release(wet);
+	wet_load_deferred_modules(wet);
+}
+
+static void
+startup_frame_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct wet_startup_frame *sf =
+		container_of(listener, struct wet_startup_frame,
+			     destroy_listener);
+
+	wet_startup_frame_destroy(sf);
+}
+
+/* Watch every enabled output for its first rendered frame, which marks the
+ * end of startup and triggers loading the deferred modules.
+ */
+static void
+wet_startup_watch_first_frame(struct wet_compositor *wet)
+{
+	struct wl_event_loop *loop;
+	struct weston_output *output;
+	struct wet_startup_frame *sf;
+
+	wl_list_for_each(output, &wet->compositor->output_list, link) {
+		sf = xzalloc(sizeof *sf);
+		sf->wet = wet;
+		sf->output = output;
+		sf->frame_listener.notify = startup_frame_notify;
+		wl_signal_add(&output->frame_signal, &sf->frame_listener);
+		sf->destroy_listener.notify = startup_frame_output_destroyed;
+		wl_signal_add(&output->destroy_signal, &sf->destroy_listener);
+		wl_list_insert(&wet->startup_frame_list, &sf->link);
+	}
+
+	if (!wet->deferred_modules)
+		return;
+
+	loop = wl_display_get_event_loop(wet->compositor->wl_display);
+	wet->deferred_modules_timer =
+		wl_event_loop_add_timer(loop, deferred_modules_timer_handler,
+					wet);
+	if (!wet->deferred_modules_timer) {
+		wet_load_deferred_modules(wet);
+		return;
+	}
+
+	wl_event_source_timer_update(wet->deferred_modules_timer,
+				     DEFERRED_MODULES_TIMEOUT_MS);
+}
+
 static void
 sigint_helper(int sig)
 {
@@ -4425,10 +4717,12 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	char *shell = NULL;
 	bool xwayland = false;
 	char *modules = NULL;
+	char *deferred_modules = NULL;
 	char *option_modules = NULL;
 	char *log = NULL;
 	char *log_scopes = NULL;
 	char *flight_rec_scopes = NULL;
+	char *flight_rec_file = NULL;
 	char *server_socket = NULL;
 	char *require_outputs = NULL;
 	int32_t idle_time = -1;
@@ -4476,10 +4770,15 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		{ WESTON_OPTION_BOOLEAN, "debug", 0, &debug_protocol },
 		{ WESTON_OPTION_STRING, "logger-scopes", 'l', &log_scopes },
 		{ WESTON_OPTION_STRING, "flight-rec-scopes", 'f', &flight_rec_scopes },
+		{ WESTON_OPTION_STRING, "flight-rec-file", 0, &flight_rec_file },
 	};
 
+	clock_gettime(CLOCK_MONOTONIC, &wet.startup_begin);
+	wet.startup_last = wet.startup_begin;
+
 	wl_list_init(&wet.layoutput_list);
 	wl_list_init(&wet.backend_list);
+	wl_list_init(&wet.startup_frame_list);
 
 	os_fd_set_cloexec(fileno(stdin));
 
@@ -4506,6 +4805,10 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	log_scope = weston_log_ctx_add_log_scope(log_ctx, "log",
 			"Weston and Wayland log\n", NULL, NULL, NULL);
+	wet.startup_scope =
+		weston_log_ctx_add_log_scope(log_ctx, "startup",
+			"Time spent in each phase of the frontend startup\n",
+			NULL, NULL, NULL);
 
 	if (!weston_log_file_open(log))
 		return EXIT_FAILURE;
@@ -4517,7 +4820,19 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	if (!flight_rec_scopes)
 		flight_rec_scopes = DEFAULT_FLIGHT_REC_SCOPES;
 
-	if (flight_rec_scopes && strlen(flight_rec_scopes) > 0)
+	if (flight_rec_scopes && strlen(flight_rec_scopes) > 0 &&
+	    flight_rec_file) {
+		flight_rec = weston_log_subscriber_create_flight_rec_file(flight_rec_file,
+									  DEFAULT_FLIGHT_REC_SIZE);
+		if (!flight_rec) {
+			weston_log("Failed to map flight recorder file '%s': %s\n",
+				   flight_rec_file, strerror(errno));
+			free(flight_rec_file);
+			flight_rec_file = NULL;
+		}
+	}
+
+	if (flight_rec_scopes && strlen(flight_rec_scopes) > 0 && !flight_rec)
 		flight_rec = weston_log_subscriber_create_flight_rec(DEFAULT_FLIGHT_REC_SIZE);
 
 	weston_log_subscribe_to_scopes(log_ctx, logger, flight_rec,
@@ -4533,7 +4848,9 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	free(cmdline);
 	log_uname();
 
-	weston_log("Flight recorder: %s\n", flight_rec ? "enabled" : "disabled");
+	weston_log("Flight recorder: %s%s%s\n", flight_rec ? "enabled" : "disabled",
+		   flight_rec && flight_rec_file ? ", in " : "",
+		   flight_rec && flight_rec_file ? flight_rec_file : "");
 	verify_xdg_runtime_dir();
 
 	display = wl_display_create();
@@ -4581,6 +4898,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		goto out_signals;
 	wet.config = config;
 	wet.parsed_options = NULL;
+	wet_startup_mark(&wet, "configuration loaded");
 
 	section = weston_config_get_section(config, "core", NULL, NULL);
 
@@ -4616,6 +4934,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		weston_log("fatal: failed to create compositor\n");
 		goto out;
 	}
+	wet_startup_mark(&wet, "compositor created");
 
 	protocol_scope =
 		weston_log_ctx_add_log_scope(log_ctx, "proto",
@@ -4642,6 +4961,15 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	weston_config_section_get_bool(section, "require-input",
 				       &wet.compositor->require_input, true);
+	weston_config_section_get_bool(section, "coalesce-pointer-motion",
+				       &wet.compositor->coalesce_pointer_motion,
+				       false);
+	weston_config_section_get_bool(section, "coalesce-touch-motion",
+				       &wet.compositor->coalesce_touch_motion,
+				       false);
+	weston_config_section_get_bool(section, "coalesce-tablet-motion",
+				       &wet.compositor->coalesce_tablet_motion,
+				       false);
 
 	wet.require_outputs = REQUIRE_OUTPUTS_ANY;
 	weston_config_section_get_string(section, "require-outputs",
@@ -4652,6 +4980,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		free(require_outputs);
 	}
 
+	wet_set_realtime_priority(wet.compositor, section);
+
 	wet.compositor->multi_backend = backends && strchr(backends, ',');
 	if (load_backends(wet.compositor, backends, &argc, argv, config,
 			  renderer) < 0) {
@@ -4661,6 +4991,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	if (weston_compositor_backends_loaded(wet.compositor) < 0)
 		goto out;
+	wet_startup_mark(&wet, "backends loaded (%s)", backends);
 
 	wet_handle_mirror_outputs(&wet);
 
@@ -4673,6 +5004,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	weston_compositor_flush_heads_changed(wet.compositor);
 	if (wet.init_failed)
 		goto out;
+	wet_startup_mark(&wet, "outputs enabled");
 
 	if (idle_time < 0)
 		weston_config_section_get_int(section, "idle-time", &idle_time, -1);
@@ -4708,6 +5040,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	} else if (weston_create_listening_socket(display, socket_name)) {
 		goto out;
 	}
+	wet_startup_mark(&wet, "listening socket created");
 
 	if (!shell)
 		weston_config_section_get_string(section, "shell", &shell,
@@ -4715,6 +5048,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	if (wet_load_shell(wet.compositor, shell, &argc, argv) < 0)
 		goto out;
+	wet_startup_mark(&wet, "shell loaded (%s)", shell);
 
 	/* Load xwayland before other modules - this way if we're using
 	 * the systemd-notify module it will notify after we're ready
@@ -4728,6 +5062,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		wet_xwl = wet_load_xwayland(wet.compositor);
 		if (!wet_xwl)
 			goto out;
+		wet_startup_mark(&wet, "xwayland loaded");
 	}
 
 	weston_config_section_get_string(section, "modules", &modules, "");
@@ -4738,6 +5073,15 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		goto out;
 
 	load_additional_modules(wet);
+	wet_startup_mark(&wet, "modules loaded");
+
+	weston_config_section_get_string(section, "deferred-modules",
+					 &deferred_modules, NULL);
+	if (deferred_modules && strlen(deferred_modules) > 0) {
+		wet.deferred_modules = deferred_modules;
+		deferred_modules = NULL;
+	}
+	free(deferred_modules);
 
 	section = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_bool(section, "numlock-on", &numlock_on, false);
@@ -4767,6 +5111,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	}
 
 	weston_compositor_wake(wet.compositor);
+	wet_startup_watch_first_frame(&wet);
 
 	if (argc > 1) {
 		if (execute_command(&wet, argc, argv) < 0)
@@ -4775,6 +5120,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		if (execute_autolaunch(&wet, config) < 0)
 			goto out;
 	}
+	wet_startup_mark(&wet, "clients launched");
 
 	wl_display_run(display);
 
@@ -4787,6 +5133,11 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	ret = wet.compositor->exit_code;
 
 out:
+	wet_startup_frames_release(&wet);
+	if (wet.deferred_modules_timer)
+		wl_event_source_remove(wet.deferred_modules_timer);
+	free(wet.deferred_modules);
+
 	wet_compositor_destroy_backend_callbacks(&wet);
 
 	/* free(NULL) is valid, and it won't be NULL if it's used */
@@ -4816,6 +5167,7 @@ out_signals:
 	wl_display_destroy(display);
 
 out_display:
+	weston_log_scope_destroy(wet.startup_scope);
 	weston_log_scope_destroy(log_scope);
 	log_scope = NULL;
 	weston_log_subscriber_destroy(logger);
@@ -4834,6 +5186,7 @@ out_display:
 	free(option_modules);
 	free(log);
 	free(log_scopes);
+	free(flight_rec_file);
 	free(modules);
 
 	return ret;
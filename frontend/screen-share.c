@@ -615,6 +615,35 @@ shared_output_ensure_tmp_data(struct shared_output *so,
 	return 0;
 }
 
+/* With the GL renderer, every read_pixels() call stalls on the GPU. Damage
+ * split into many bands, like that of a window moving diagonally, is read
+ * back in one go as its extents, unless that reads a lot more pixels. */
+#define SHARED_OUTPUT_READ_MAX_RECTS 4
+
+static void
+shared_output_coalesce_damage(pixman_region32_t *damage)
+{
+	pixman_box32_t *r;
+	pixman_box32_t ext;
+	int64_t area = 0;
+	int i, nrects;
+
+	r = pixman_region32_rectangles(damage, &nrects);
+	if (nrects <= SHARED_OUTPUT_READ_MAX_RECTS)
+		return;
+
+	for (i = 0; i < nrects; i++)
+		area += (int64_t) (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	ext = *pixman_region32_extents(damage);
+	if ((int64_t) (ext.x2 - ext.x1) * (ext.y2 - ext.y1) > 2 * area)
+		return;
+
+	pixman_region32_fini(damage);
+	pixman_region32_init_rect(damage, ext.x1, ext.y1,
+				  ext.x2 - ext.x1, ext.y2 - ext.y1);
+}
+
 static void
 shared_output_update(struct shared_output *so);
 
@@ -888,6 +917,8 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	if (shared_output_ensure_tmp_data(so, &output_damage) < 0)
 		goto err_pixman_init;
 
+	shared_output_coalesce_damage(&output_damage);
+
 	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
 	/* Create our cache image - a 1:1 copy of the output of interest's
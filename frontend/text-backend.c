@@ -57,6 +57,23 @@ struct text_input {
 
 	pixman_box32_t cursor_rectangle;
 
+	/* Coalesced until commit_state, see text_input_flush_state() */
+	struct {
+		char *surrounding_text;
+		uint32_t cursor;
+		uint32_t anchor;
+		pixman_box32_t cursor_rectangle;
+		bool cursor_rectangle_set;
+	} pending;
+
+	/* Surrounding text as the input methods last got it, to drop
+	 * repeats; NULL forces the next one out */
+	struct {
+		char *surrounding_text;
+		uint32_t cursor;
+		uint32_t anchor;
+	} sent;
+
 	bool input_panel_visible;
 
 	struct text_input_manager *manager;
@@ -161,6 +178,13 @@ deactivate_input_method(struct input_method *input_method)
 	zwp_text_input_v1_send_leave(text_input->resource);
 }
 
+static void
+text_input_forget_sent_state(struct text_input *text_input)
+{
+	free(text_input->sent.surrounding_text);
+	text_input->sent.surrounding_text = NULL;
+}
+
 static void
 destroy_text_input(struct wl_resource *resource)
 {
@@ -171,9 +195,65 @@ destroy_text_input(struct wl_resource *resource)
 			      &text_input->input_methods, link)
 		deactivate_input_method(input_method);
 
+	free(text_input->pending.surrounding_text);
+	text_input_forget_sent_state(text_input);
 	free(text_input);
 }
 
+/*
+ * Toolkits tend to send the surrounding text and the cursor rectangle on
+ * every keystroke, whether they changed or not. Only the latest values
+ * before commit_state matter, and those only when they differ from what
+ * went out last time.
+ */
+static void
+text_input_flush_state(struct text_input *text_input)
+{
+	struct weston_compositor *ec = text_input->ec;
+	struct input_method *input_method, *next;
+	char *text = text_input->pending.surrounding_text;
+	uint32_t cursor = text_input->pending.cursor;
+	uint32_t anchor = text_input->pending.anchor;
+
+	if (text) {
+		text_input->pending.surrounding_text = NULL;
+
+		if (text_input->sent.surrounding_text &&
+		    text_input->sent.cursor == cursor &&
+		    text_input->sent.anchor == anchor &&
+		    strcmp(text_input->sent.surrounding_text, text) == 0) {
+			free(text);
+		} else {
+			wl_list_for_each_safe(input_method, next,
+					      &text_input->input_methods, link) {
+				if (!input_method->context)
+					continue;
+				zwp_input_method_context_v1_send_surrounding_text(
+					input_method->context->resource,
+					text, cursor, anchor);
+			}
+
+			free(text_input->sent.surrounding_text);
+			text_input->sent.surrounding_text = text;
+			text_input->sent.cursor = cursor;
+			text_input->sent.anchor = anchor;
+		}
+	}
+
+	if (text_input->pending.cursor_rectangle_set) {
+		text_input->pending.cursor_rectangle_set = false;
+
+		if (memcmp(&text_input->cursor_rectangle,
+			   &text_input->pending.cursor_rectangle,
+			   sizeof text_input->cursor_rectangle) != 0) {
+			text_input->cursor_rectangle =
+				text_input->pending.cursor_rectangle;
+			wl_signal_emit(&ec->update_input_panel_signal,
+				       &text_input->cursor_rectangle);
+		}
+	}
+}
+
 static void
 text_input_set_surrounding_text(struct wl_client *client,
 				struct wl_resource *resource,
@@ -182,15 +262,11 @@ text_input_set_surrounding_text(struct wl_client *client,
 				uint32_t anchor)
 {
 	struct text_input *text_input = wl_resource_get_user_data(resource);
-	struct input_method *input_method, *next;
 
-	wl_list_for_each_safe(input_method, next,
-			      &text_input->input_methods, link) {
-		if (!input_method->context)
-			continue;
-		zwp_input_method_context_v1_send_surrounding_text(
-			input_method->context->resource, text, cursor, anchor);
-	}
+	free(text_input->pending.surrounding_text);
+	text_input->pending.surrounding_text = xstrdup(text);
+	text_input->pending.cursor = cursor;
+	text_input->pending.anchor = anchor;
 }
 
 static void
@@ -222,6 +298,8 @@ text_input_activate(struct wl_client *client,
 	text_input->surface = wl_resource_get_user_data(surface);
 
 	input_method_context_create(text_input, input_method);
+	/* The new context has not seen anything yet. */
+	text_input_forget_sent_state(text_input);
 
 	current = text_input->manager->current_text_input;
 
@@ -260,6 +338,8 @@ text_input_reset(struct wl_client *client,
 	struct text_input *text_input = wl_resource_get_user_data(resource);
 	struct input_method *input_method, *next;
 
+	text_input_forget_sent_state(text_input);
+
 	wl_list_for_each_safe(input_method, next,
 			      &text_input->input_methods, link) {
 		if (!input_method->context)
@@ -278,15 +358,12 @@ text_input_set_cursor_rectangle(struct wl_client *client,
 				int32_t height)
 {
 	struct text_input *text_input = wl_resource_get_user_data(resource);
-	struct weston_compositor *ec = text_input->ec;
-
-	text_input->cursor_rectangle.x1 = x;
-	text_input->cursor_rectangle.y1 = y;
-	text_input->cursor_rectangle.x2 = x + width;
-	text_input->cursor_rectangle.y2 = y + height;
 
-	wl_signal_emit(&ec->update_input_panel_signal,
-		       &text_input->cursor_rectangle);
+	text_input->pending.cursor_rectangle.x1 = x;
+	text_input->pending.cursor_rectangle.y1 = y;
+	text_input->pending.cursor_rectangle.x2 = x + width;
+	text_input->pending.cursor_rectangle.y2 = y + height;
+	text_input->pending.cursor_rectangle_set = true;
 }
 
 static void
@@ -333,6 +410,8 @@ text_input_commit_state(struct wl_client *client,
 	struct text_input *text_input = wl_resource_get_user_data(resource);
 	struct input_method *input_method, *next;
 
+	text_input_flush_state(text_input);
+
 	wl_list_for_each_safe(input_method, next,
 			      &text_input->input_methods, link) {
 		if (!input_method->context)
@@ -53,6 +53,8 @@ struct wet_xwayland {
 	struct wl_event_source *display_fd_source;
 	int wm_fd;
 	struct wet_process *process;
+	bool warm_start;
+	struct wl_event_source *warm_start_source;
 };
 
 static int
@@ -167,7 +169,9 @@ spawn_xserver(void *user_data, const char *display, int abstract_fd, int unix_fd
 	custom_env_add_arg(&child_env, display_pipe.str1);
 	custom_env_add_arg(&child_env, "-wm");
 	custom_env_add_arg(&child_env, x11_wm_socket.str1);
-	custom_env_add_arg(&child_env, "-terminate");
+	/* A warm server is kept around for the next X client */
+	if (!wxw->warm_start)
+		custom_env_add_arg(&child_env, "-terminate");
 
 	wxw->process =
 		wet_client_launch(wxw->compositor, &child_env,
@@ -218,11 +222,26 @@ err:
 	return NULL;
 }
 
+static void
+warm_start_xserver(void *data)
+{
+	struct wet_xwayland *wxw = data;
+
+	wxw->warm_start_source = NULL;
+
+	if (wxw->api->spawn(wxw->xwayland) < 0)
+		weston_log("Couldn't pre-start Xwayland, "
+			   "it will start on demand\n");
+}
+
 void
 wet_xwayland_destroy(struct weston_compositor *comp, void *data)
 {
 	struct wet_xwayland *wxw = data;
 
+	if (wxw->warm_start_source)
+		wl_event_source_remove(wxw->warm_start_source);
+
 	/* Calling this will call the process cleanup, in turn cleaning up the
 	 * client and the core Xwayland state */
 	if (wxw->process)
@@ -237,6 +256,8 @@ wet_load_xwayland(struct weston_compositor *comp)
 	const struct weston_xwayland_api *api;
 	struct weston_xwayland *xwayland;
 	struct wet_xwayland *wxw;
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
 
 	if (weston_compositor_load_xwayland(comp) < 0)
 		return NULL;
@@ -263,5 +284,18 @@ wet_load_xwayland(struct weston_compositor *comp)
 	if (api->listen(xwayland, wxw, spawn_xserver) < 0)
 		return NULL;
 
+	section = weston_config_get_section(wet_get_config(comp),
+					    "xwayland", NULL, NULL);
+	weston_config_section_get_bool(section, "warm-start",
+				       &wxw->warm_start, false);
+
+	/* Start the server once the event loop has nothing better to do,
+	 * which is after the desktop has come up. */
+	if (wxw->warm_start) {
+		loop = wl_display_get_event_loop(comp->wl_display);
+		wxw->warm_start_source =
+			wl_event_loop_add_idle(loop, warm_start_xserver, wxw);
+	}
+
 	return wxw;
 }
@@ -53,6 +53,10 @@ struct fullscreen_shell {
 
 	struct wl_listener seat_created_listener;
 
+	/* Fit surfaces presented for a mode into the current mode instead
+	 * of switching modes, unless their refresh rate needs a switch */
+	bool scale_for_mode;
+
 	/* List of one surface per client, presented for the NULL output
 	 *
 	 * This is implemented as a list in case someone fixes the shell
@@ -421,8 +425,18 @@ fs_output_configure_simple(struct fs_output *fsout,
 	int32_t surf_x, surf_y, surf_width, surf_height;
 	struct weston_coord_global pos;
 
-	if (fsout->pending.surface == configured_surface)
+	if (fsout->pending.surface == configured_surface) {
+		/* Presented for a mode, but scaled instead of switching modes,
+		 * see fs_output_scales_for_mode() */
+		if (fsout->pending.mode_feedback) {
+			zwp_fullscreen_shell_mode_feedback_v1_send_mode_successful(
+				fsout->pending.mode_feedback);
+			wl_resource_destroy(fsout->pending.mode_feedback);
+			fsout->pending.mode_feedback = NULL;
+		}
+
 		fs_output_apply_pending(fsout);
+	}
 
 	assert(fsout->view);
 
@@ -559,17 +573,41 @@ fs_output_configure_for_mode(struct fs_output *fsout,
 	weston_view_set_position(fsout->view, pos);
 }
 
+/* A mode switch blanks many displays for a long time. With scale-for-mode,
+ * a surface presented for a mode is zoomed to the current mode instead,
+ * which the DRM backend puts on a scaling plane when it has one and
+ * composites otherwise. Only a refresh rate the current mode does not
+ * have still takes a mode switch. */
+static bool
+fs_output_scales_for_mode(struct fs_output *fsout, int32_t framerate)
+{
+	struct weston_mode *mode = fsout->output->current_mode;
+	int64_t diff;
+
+	if (!fsout->shell->scale_for_mode)
+		return false;
+
+	if (framerate <= 0)
+		return true;
+
+	/* Refresh rates are in mHz, tolerate 0.1 % */
+	diff = (int64_t)mode->refresh - framerate;
+	return llabs(diff) * 1000 <= framerate;
+}
+
 static void
 fs_output_configure(struct fs_output *fsout,
 		    struct weston_surface *surface)
 {
 	if (fsout->pending.surface == surface) {
-		if (fsout->pending.presented_for_mode)
+		if (fsout->pending.presented_for_mode &&
+		    !fs_output_scales_for_mode(fsout, fsout->pending.framerate))
 			fs_output_configure_for_mode(fsout, surface);
 		else
 			fs_output_configure_simple(fsout, surface);
 	} else {
-		if (fsout->presented_for_mode)
+		if (fsout->presented_for_mode &&
+		    !fs_output_scales_for_mode(fsout, fsout->framerate))
 			fs_output_configure_for_mode(fsout, surface);
 		else
 			fs_output_configure_simple(fsout, surface);
@@ -804,7 +842,10 @@ fullscreen_shell_present_surface_for_mode(struct wl_client *client,
 	}
 
 	surface = wl_resource_get_user_data(surface_res);
-	fs_output_set_surface(fsout, surface, 0, framerate, 1);
+	/* The method only matters when scaling instead of switching modes */
+	fs_output_set_surface(fsout, surface,
+			      ZWP_FULLSCREEN_SHELL_V1_PRESENT_METHOD_ZOOM,
+			      framerate, 1);
 
 	fsout->pending.mode_feedback =
 		wl_resource_create(client,
@@ -921,6 +962,7 @@ wet_shell_init(struct weston_compositor *compositor,
 	struct fullscreen_shell *shell;
 	struct weston_seat *seat;
 	struct weston_output *output;
+	struct weston_config_section *section;
 
 	shell = zalloc(sizeof *shell);
 	if (shell == NULL)
@@ -929,6 +971,11 @@ wet_shell_init(struct weston_compositor *compositor,
 
 	shell->compositor = compositor;
 
+	section = weston_config_get_section(wet_get_config(compositor),
+					    "shell", NULL, NULL);
+	weston_config_section_get_bool(section, "scale-for-mode",
+				       &shell->scale_for_mode, false);
+
 	if (!weston_compositor_add_destroy_listener_once(compositor,
 							 &shell->destroy_listener,
 							 fullscreen_shell_destroy)) {
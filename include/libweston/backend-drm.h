@@ -35,7 +35,7 @@
 extern "C" {
 #endif
 
-#define WESTON_DRM_BACKEND_CONFIG_VERSION 6
+#define WESTON_DRM_BACKEND_CONFIG_VERSION 7
 
 struct libinput_device;
 
@@ -181,6 +181,13 @@ struct weston_drm_virtual_output_api {
 	void (*finish_frame)(struct weston_output *output,
 			     struct timespec *stamp,
 			     uint32_t presented_flags);
+
+	/** Get the damage of the frame being submitted
+	 * Only valid during the submit_frame_cb callback. The region is in
+	 * buffer coordinates and only covers what changed since the previous
+	 * frame, so it can be passed on to encoders as a hint.
+	 */
+	const pixman_region32_t *(*get_frame_damage)(struct weston_output *output);
 };
 
 static inline const struct weston_drm_virtual_output_api *
@@ -258,6 +265,29 @@ struct weston_drm_backend_config {
 	 * rendering device.
 	 */
 	char *additional_devices;
+
+	/** Read libinput devices on a dedicated thread
+	 *
+	 * Keeps input from queueing up in the kernel while the compositor
+	 * is busy; events are still delivered from the main loop.
+	 */
+	bool input_thread;
+
+	/** Logical seats to read through their own libinput context
+	 *
+	 * Comma-separated WL_SEAT names. Each of these seats gets its own
+	 * libinput context and event source (and thread, with
+	 * input_thread), so that a busy device on one seat does not delay
+	 * the input of the others. NULL keeps all seats in one context.
+	 */
+	char *input_shard_seats;
+
+	/** Apply the blending to output color transformation with the CRTC
+	 *
+	 * Uses the DEGAMMA_LUT, CTM and GAMMA_LUT properties when the
+	 * transformation fits them, instead of a renderer shadow pass.
+	 */
+	bool offload_color_pipeline;
 };
 
 #ifdef  __cplusplus
@@ -33,8 +33,9 @@ extern "C" {
 #include <stdint.h>
 
 #include <libweston/libweston.h>
+#include <libweston/plugin-registry.h>
 
-#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 3
+#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 4
 
 struct weston_headless_backend_config {
 	struct weston_backend_config base;
@@ -49,8 +50,89 @@ struct weston_headless_backend_config {
 	 * mHz to 1,000,000 mHz. 0 is a special value that triggers repaints
 	 * only on capture requests, not on damages. */
 	int refresh;
+
+	/** Complete each frame as soon as it has been rendered instead of
+	 * emulating the refresh rate, to measure raw compositing throughput. */
+	bool max_throughput;
+
+	/** With max_throughput and the GL renderer, complete each frame only
+	 * when the GPU has finished rendering it. */
+	bool gpu_fence;
+};
+
+#define WESTON_HEADLESS_OUTPUT_API_NAME "weston_headless_output_api_v1"
+
+/** A DMABUF a headless output renders into, owned by the backend */
+struct weston_headless_buffer;
+
+/** A frame rendered by a headless output, see set_dmabuf_export() */
+struct weston_headless_frame {
+	/** To be given back with buffer_released() */
+	struct weston_headless_buffer *buffer;
+
+	int32_t width;
+	int32_t height;
+	/** DRM fourcc */
+	uint32_t format;
+	uint64_t modifier;
+	int n_planes;
+	/** Owned by the backend, dup() them to keep them around */
+	int fd[4];
+	uint32_t offset[4];
+	uint32_t stride[4];
+
+	/** Sync file that signals when the GPU has finished rendering the
+	 * frame, or -1 if the renderer has none and the frame is complete
+	 * already. Owned by the callback if it returns success. */
+	int fence_fd;
+
+	/** What changed since the previous frame, in buffer coordinates */
+	const pixman_region32_t *damage;
+};
+
+typedef int (*weston_headless_submit_frame_cb)(struct weston_output *output,
+					       const struct weston_headless_frame *frame,
+					       void *data);
+
+struct weston_headless_output_api {
+	/** Render the output into DMABUFs handed out to the caller.
+	 *
+	 * Must be called before the output is enabled. The output then
+	 * renders into a ring of num_buffers DMABUFs allocated by the GL
+	 * renderer instead of an internal FBO, and calls submit_frame for
+	 * every repaint that changed something. Frames are still paced by
+	 * the backend according to its refresh rate.
+	 *
+	 * The buffer of a frame is reserved for the caller if and only if
+	 * submit_frame returns 0, until buffer_released() is called. While
+	 * the caller holds all buffers, damage accumulates and the next
+	 * frame covers it.
+	 *
+	 * Returns 0 on success, -1 if the renderer cannot allocate DMABUFs.
+	 */
+	int (*set_dmabuf_export)(struct weston_output *output,
+				 unsigned int num_buffers,
+				 weston_headless_submit_frame_cb submit_frame,
+				 void *data);
+
+	/** Give a buffer back to the output for rendering.
+	 *
+	 * All buffers are destroyed when the output is disabled, which
+	 * makes them invalid to release.
+	 */
+	void (*buffer_released)(struct weston_headless_buffer *buffer);
 };
 
+static inline const struct weston_headless_output_api *
+weston_headless_output_get_api(struct weston_compositor *compositor)
+{
+	const void *api;
+	api = weston_plugin_api_get(compositor, WESTON_HEADLESS_OUTPUT_API_NAME,
+				    sizeof(struct weston_headless_output_api));
+
+	return (const struct weston_headless_output_api *)api;
+}
+
 #ifdef  __cplusplus
 }
 #endif
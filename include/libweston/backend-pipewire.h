@@ -99,6 +99,19 @@ struct weston_pipewire_backend_config {
 	enum weston_renderer_type renderer;
 	char *gbm_format;
 	int32_t num_outputs;
+
+	/** Path of the DRM render node used for VA-API H.264 encoding
+	 *
+	 * When set, outputs additionally offer an H.264 stream encoded from
+	 * the rendered dmabuf. NULL disables encoded streams.
+	 */
+	char *h264_device;
+
+	/** Target bit rate of H.264 streams in bits per second
+	 *
+	 * 0 encodes with constant QP instead of constant bit rate.
+	 */
+	uint32_t h264_bitrate;
 };
 
 #ifdef  __cplusplus
@@ -55,7 +55,7 @@ weston_vnc_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_vnc_output_api *)api;
 }
 
-#define WESTON_VNC_BACKEND_CONFIG_VERSION 2
+#define WESTON_VNC_BACKEND_CONFIG_VERSION 3
 
 struct weston_vnc_backend_config {
 	struct weston_backend_config base;
@@ -66,6 +66,9 @@ struct weston_vnc_backend_config {
 	char *server_cert;
 	char *server_key;
 	bool disable_tls;
+	/** With the GL renderer, render into mapped dmabufs instead of
+	 * reading pixels back into client memory. */
+	bool zero_copy;
 };
 
 #ifdef  __cplusplus
@@ -34,7 +34,7 @@ extern "C" {
 
 #include <stdint.h>
 
-#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 3
+#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 4
 
 struct weston_wayland_backend_config {
 	struct weston_backend_config base;
@@ -44,6 +44,13 @@ struct weston_wayland_backend_config {
 	bool fullscreen;
 	char *cursor_theme;
 	int cursor_size;
+
+	/** Present GL outputs with dmabufs allocated by the renderer
+	 * through the parent's zwp_linux_dmabuf_v1, following its dmabuf
+	 * feedback, instead of through wl_egl_window. Falls back to
+	 * wl_egl_window when that is not possible.
+	 */
+	bool use_dmabuf;
 };
 
 #ifdef  __cplusplus
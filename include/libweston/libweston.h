@@ -92,6 +92,10 @@ struct pixel_format_info;
 struct weston_output_capture_info;
 struct weston_output_color_outcome;
 struct weston_tearing_control;
+struct weston_drm_syncobj_surface;
+struct weston_drm_syncobj_timeline;
+struct weston_drm_syncobj_acquire;
+struct weston_frame_clock;
 struct di_info;
 
 enum weston_keyboard_modifier {
@@ -190,6 +194,18 @@ enum weston_hdcp_protection {
 	WESTON_HDCP_ENABLE_TYPE_1
 };
 
+/* Content type hint of a surface
+ *
+ * The values match those of the 'type' enum of the content-type-v1
+ * protocol.
+ */
+enum weston_content_type {
+	WESTON_CONTENT_TYPE_NONE = 0,
+	WESTON_CONTENT_TYPE_PHOTO,
+	WESTON_CONTENT_TYPE_VIDEO,
+	WESTON_CONTENT_TYPE_GAME,
+};
+
 /** Weston test suite quirks
  *
  * There are some things that need a specific behavior when we run Weston in the
@@ -531,6 +547,9 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+/** Number of repaints whose damage an output remembers */
+#define WESTON_OUTPUT_DAMAGE_HISTORY 16
+
 /** Content producer for heads
  *
  * \rst
@@ -570,6 +589,16 @@ struct weston_output {
 	 *  struct weston_paint_node::z_order_link
 	 */
 	struct wl_list paint_node_z_order_list;
+	/** paint_node_z_order_list as an array, see
+	 *  weston_output_get_paint_nodes() */
+	struct wl_array paint_node_z_order; /* struct weston_paint_node * */
+	bool paint_node_z_order_dirty;
+
+	/** Spatial index of views for input picking, see pick-index.c */
+	struct weston_pick_index *pick_index;
+
+	/** Histograms for the frame-stats debug scope, see frame-stats.c */
+	struct weston_frame_stats *frame_stats;
 
 	/** Output area in global coordinates, simple rect */
 	pixman_region32_t region;
@@ -581,6 +610,17 @@ struct weston_output {
 	/** True if the entire contents of the output should be redrawn */
 	bool full_repaint_needed;
 
+	/** Set by backends that use weston_output_get_moves() */
+	bool track_moves;
+	struct wl_array moves; /* struct weston_output_move */
+
+	/** Primary plane damage of the last repaints, in global coordinates,
+	 *  see weston_output_get_damage_since() */
+	struct {
+		uint64_t frame_seq;
+		pixman_region32_t damage[WESTON_OUTPUT_DAMAGE_HISTORY];
+	} damage_history;
+
 	/** True if the output will be repainted in the currently active
 	 *  repaint handler. */
 	bool will_repaint;
@@ -588,6 +628,10 @@ struct weston_output {
 	/** Used only between repaint_begin and repaint_cancel. */
 	bool repainted;
 
+	/** Committed by the backend ahead of repaint_flush, see
+	 *  weston_output_repaint_flushed(). */
+	bool repaint_flushed;
+
 	/** Repaints are triggered only on capture requests, not on damages. */
 	bool repaint_only_on_capture;
 
@@ -603,14 +647,45 @@ struct weston_output {
 	 *  next repaint should be run */
 	struct timespec next_repaint;
 
+	/** Measured repaint cost, used for the adaptive repaint window */
+	struct {
+		int64_t duration_nsec; /**< smoothed repaint-to-commit time */
+		int64_t deviation_nsec; /**< smoothed absolute deviation */
+		int64_t slack_nsec; /**< extra time added by missed vblanks */
+		struct timespec target_vblank; /**< vblank next_repaint aims at */
+		bool target_valid; /**< target_vblank follows a real vblank */
+		bool pending; /**< repainted towards target_vblank */
+		uint64_t frames;
+		uint64_t misses;
+	} repaint_timing;
+
 	/** For cancelling the idle_repaint callback on output destruction. */
 	struct wl_event_source *idle_repaint_source;
 
+	/** A throttled surface on this output still waits for its frame
+	 *  callbacks, see weston_compositor_set_occluded_frame_policy(). */
+	bool occluded_frames_held;
+
+	/** The last frame was a tearing flip, so repaint as soon as damage
+	 *  arrives instead of following the vblank cadence. */
+	bool repaint_immediate;
+
+	/** External frame clock, see weston_output_set_frame_clock() */
+	struct weston_frame_clock *frame_clock;
+	bool frame_clock_held; /**< due repaint waits for the frame clock */
+	bool frame_clock_released; /**< frame clock let the held repaint go */
+
 	struct wl_signal frame_signal;
 	struct wl_signal destroy_signal;	/**< sent when disabled */
 	struct weston_coord_global move;
 	struct timespec frame_time; /* presentation timestamp */
 	uint64_t msc;        /* media stream counter */
+
+	/* When the frame awaiting presentation was repainted and handed to
+	 * the backend, in presentation clock, for commit to present
+	 * tracing */
+	struct timespec repaint_start_time;
+	struct timespec repaint_posted_time;
 	int disable_planes;
 	int destroying;
 	struct wl_list feedback_list;
@@ -641,6 +716,9 @@ struct weston_output {
 	enum weston_hdcp_protection current_protection;
 	bool allow_protection;
 
+	/** Content type of the surface covering most of the output */
+	enum weston_content_type content_type;
+
 	enum weston_output_power_state power_state;
 
 	struct weston_log_pacer repaint_delay_pacer;
@@ -665,6 +743,11 @@ struct weston_output {
 			  uint16_t *g,
 			  uint16_t *b);
 
+	/** Dim the picture towards black in the display pipeline, from the
+	 *  next repaint on; 1.0 leaves it alone. Returns false, or is NULL,
+	 *  when the output cannot do that. See weston_output_fade_run(). */
+	bool (*set_fade_level)(struct weston_output *output, float level);
+
 	bool enabled; /**< is in the output_list, not pending list */
 
 	struct weston_color_profile *color_profile;
@@ -901,6 +984,13 @@ struct weston_pointer {
 	struct wl_listener output_destroy_listener;
 
 	struct wl_list timestamps_list;
+
+	/* wl_pointer.motion held back until the next repaint, see
+	 * weston_pointer_set_motion_coalescing() */
+	bool coalesce_motion;
+	bool motion_pending;
+	wl_fixed_t pending_sx, pending_sy;
+	struct timespec pending_time;
 };
 
 /** libinput style calibration matrix
@@ -999,6 +1089,12 @@ struct weston_touch {
 	struct timespec grab_time;
 
 	struct wl_list timestamps_list;
+
+	/* wl_touch.motion held back until the next repaint, see
+	 * weston_touch_set_motion_coalescing() */
+	bool coalesce_motion;
+	struct wl_array pending_motion;	/* struct weston_touch_pending_motion */
+	bool frame_pending;
 };
 
 struct weston_tablet_tool {
@@ -1037,6 +1133,16 @@ struct weston_tablet_tool {
 
 	struct wl_signal focus_signal;
 	struct wl_signal removed_signal;
+
+	/* Axis events and the frame ending them held back until the next
+	 * repaint, see weston_tablet_tool_set_motion_coalescing() */
+	bool coalesce_motion;
+	uint32_t pending_axes;
+	bool frame_pending;
+	struct timespec pending_time;
+	wl_fixed_t pending_sx, pending_sy;
+	uint32_t pending_pressure, pending_distance;
+	wl_fixed_t pending_tilt_x, pending_tilt_y;
 };
 
 struct weston_tablet {
@@ -1077,6 +1183,9 @@ weston_pointer_send_axis_source(struct weston_pointer *pointer,
 				enum wl_pointer_axis_source source);
 void
 weston_pointer_send_frame(struct weston_pointer *pointer);
+void
+weston_pointer_set_motion_coalescing(struct weston_pointer *pointer,
+				     bool enable);
 
 void
 weston_pointer_set_focus(struct weston_pointer *pointer,
@@ -1139,6 +1248,8 @@ weston_touch_send_motion(struct weston_touch *touch,
 			 struct weston_coord_global pos);
 void
 weston_touch_send_frame(struct weston_touch *touch);
+void
+weston_touch_set_motion_coalescing(struct weston_touch *touch, bool enable);
 
 
 void
@@ -1194,6 +1305,10 @@ void
 weston_tablet_tool_send_frame(struct weston_tablet_tool *tool,
 			       const struct timespec *time);
 
+void
+weston_tablet_tool_set_motion_coalescing(struct weston_tablet_tool *tool,
+					 bool enable);
+
 void
 weston_tablet_tool_cursor_move(struct weston_tablet_tool *tool,
 			       struct weston_coord_global pos);
@@ -1223,6 +1338,11 @@ struct weston_xkb_info {
 	xkb_led_index_t num_led;
 	xkb_led_index_t caps_led;
 	xkb_led_index_t scroll_led;
+
+	/* Identical keymaps share one xkb_info, and so one keymap file */
+	struct weston_compositor *compositor;
+	uint32_t keymap_hash;
+	struct wl_list link; /**< weston_compositor::xkb_info_list */
 };
 
 struct weston_keyboard {
@@ -1381,10 +1501,27 @@ struct weston_layer {
 	enum weston_layer_position position;
 	pixman_box32_t mask;
 	struct weston_layer_entry view_list;
+
+	/* The views of this layer in weston_compositor::view_list need
+	 * to be put together again */
+	bool view_list_dirty;
 };
 
 struct weston_drm_format_array;
 
+/** What to do with frame callbacks of surfaces that are not visible
+ *
+ * A surface counts as occluded on its main output when no part of any of
+ * its views is visible there, e.g. when it is completely covered by
+ * opaque views.
+ */
+enum weston_occluded_frame_policy {
+	/** Hold frame callbacks until the surface becomes visible again */
+	WESTON_OCCLUDED_FRAME_HOLD = 0,
+	/** Send frame callbacks at most once per interval */
+	WESTON_OCCLUDED_FRAME_THROTTLE,
+};
+
 enum weston_capability {
 	/* backend/renderer supports arbitrary rotation */
 	WESTON_CAP_ROTATION_ANY			= 0x0001,
@@ -1529,14 +1666,50 @@ struct weston_compositor {
 	struct wl_list tablet_tool_binding_list;
 	struct wl_list axis_binding_list;
 	struct wl_list debug_binding_list;
+	/** key, button and axis bindings by code and modifiers */
+	struct weston_binding_index *binding_index;
 
 	bool view_list_needs_rebuild;
+	/* Some layers have view_list_dirty set */
+	bool view_list_needs_update;
+	/* Debug: always rebuild view_list and z-order lists from scratch */
+	bool view_list_full_rebuild;
+	bool pick_index_dirty;
+
+	/* Bumped whenever any surface's sub-surface tree changes, which
+	 * invalidates every weston_surface::subsurface_flat */
+	uint64_t subsurface_tree_generation;
+	struct wl_array subsurface_flat_views; /* scratch for view_list_add() */
+
+	/* Last weston_view::serial and weston_buffer::serial handed out */
+	uint64_t object_serial;
 
 	uint32_t state;
 	struct wl_event_source *idle_source;
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
 	struct wl_event_source *repaint_timer;
+	/* Runs output_repaint_timer_handler() without the timer delay */
+	struct wl_event_source *repaint_idle_source;
+
+	/* Frame callbacks of fully occluded surfaces */
+	enum weston_occluded_frame_policy occluded_frame_policy;
+	uint32_t occluded_frame_interval_ms;
+	struct wl_event_source *occluded_frame_timer;
+	bool occluded_frame_timer_armed;
+
+	/* Surfaces with held commits, weston_surface::commit_queue_link */
+	struct wl_list commit_queue_list;
+	struct wl_event_source *commit_queue_timer;
+	bool commit_queue_timer_armed;
+	struct timespec commit_queue_timer_deadline;
+
+	/* weston_idle_task::link, run after idle_task_delay_msec of no
+	 * repaints */
+	struct wl_list idle_task_list;
+	uint32_t idle_task_delay_msec;	/* 0 disables the idle tasks */
+	struct wl_event_source *idle_task_timer;
+	bool idle_task_timer_armed;
 
 	const struct weston_pointer_grab_interface *default_pointer_grab;
 
@@ -1567,14 +1740,43 @@ struct weston_compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	struct wl_list xkb_info_list; /**< weston_xkb_info::link */
+	struct wl_list keymap_cache; /**< compiled keymaps by rule names */
 
 	int32_t kb_repeat_rate;
 	int32_t kb_repeat_delay;
 
 	bool vt_switching;
 
+	/* GL-renderer: keep linked shader programs in an on-disk cache */
+	bool gl_program_cache_enabled;
+	/* GL-renderer: create the most common shader programs on start-up */
+	bool gl_program_cache_prewarm;
+	/* GL-renderer: upload wl_shm damage through a pixel buffer object */
+	bool gl_shm_pbo_upload;
+	/* GL-renderer: pack small wl_shm buffers into shared textures */
+	bool gl_shm_atlas;
+	/* Release wl_shm buffers once the renderer has its own copy of them,
+	 * instead of holding them until the next attach */
+	bool shm_early_release;
+	/* GL-renderer: size of the 3D LUT that multi-step color transforms
+	 * are baked into, 0 to evaluate them step by step */
+	uint32_t gl_color_lut_bake_size;
+	/* Color manager: create surface color transformations in the
+	 * background, showing a stand-in meanwhile */
+	bool color_transform_async;
+	/* Color manager: keep the EOTFs estimated from cLUT ICC profiles in
+	 * an on-disk cache */
+	bool color_eotf_cache;
+	/* Pixman-renderer: threads to composite with, 0 or 1 for none */
+	int32_t pixman_render_threads;
+
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
+	/* Size each output's repaint window from its measured repaint time */
+	bool repaint_adaptive;
+	/* Safety margin added to the adaptive repaint window */
+	int32_t repaint_margin_usec;
 	struct timespec last_repaint_start;
 
 	unsigned int activate_serial;
@@ -1592,6 +1794,28 @@ struct weston_compositor {
 	/* Whether to let the compositor run without any input device. */
 	bool require_input;
 
+	/* Default for weston_pointer_set_motion_coalescing() on new pointers. */
+	bool coalesce_pointer_motion;
+
+	/* Default for weston_touch_set_motion_coalescing() on new touch. */
+	bool coalesce_touch_motion;
+
+	/* Default for weston_tablet_tool_set_motion_coalescing() on new
+	 * tablet tools. */
+	bool coalesce_tablet_motion;
+
+	/* Realtime scheduling policy (SCHED_RR or SCHED_FIFO) and priority
+	 * the frontend put the main thread under, priority 0 if none.
+	 * Helper threads and the GL context follow it. */
+	int realtime_policy;
+	int realtime_priority;
+
+	/* Scratch regions for the surface commit path. Results are built
+	 * here and swapped in, so that region storage gets reused from one
+	 * commit to the next instead of being reallocated by pixman.
+	 */
+	pixman_region32_t commit_scratch[2];
+
 	/* Whether to load multiple backends. */
 	bool multi_backend;
 
@@ -1614,7 +1838,17 @@ struct weston_compositor {
 	struct weston_log_context *weston_log_ctx;
 	struct weston_log_scope *debug_scene;
 	struct weston_log_scope *timeline;
+	struct weston_log_scope *timeline_perfetto;
 	struct weston_log_scope *libseat_debug;
+	struct weston_log_scope *repaint_debug;
+	struct weston_log_scope *frame_stats_scope;
+	struct weston_log_scope *metrics_scope;
+	struct weston_metrics *metrics;
+	/* Storage of struct weston_view and struct weston_paint_node */
+	struct weston_object_pool *view_pool;
+	struct weston_object_pool *paint_node_pool;
+	struct weston_log_scope *client_accounting_scope;
+	struct weston_client_accounting *client_accounting;
 
 	struct content_protection *content_protection;
 
@@ -1666,6 +1900,9 @@ struct weston_buffer {
 
 	const struct pixel_format_info *pixel_format;
 	uint64_t format_modifier;
+
+	/* Unique for the compositor's lifetime, unlike the address */
+	uint64_t serial;
 };
 
 enum weston_buffer_reference_type {
@@ -1704,7 +1941,8 @@ struct weston_buffer_viewport {
 };
 
 struct weston_buffer_release {
-	/* The associated zwp_linux_buffer_release_v1 resource. */
+	/* The associated zwp_linux_buffer_release_v1 resource, or NULL for
+	 * a wp_linux_drm_syncobj_surface_v1 release point. */
 	struct wl_resource *resource;
 	/* How many weston_buffer_release_reference objects point to this
 	 * object. */
@@ -1712,6 +1950,9 @@ struct weston_buffer_release {
 	/* The fence fd, if any, associated with this release. If the fence fd
 	 * is -1 then this is considered an immediate release. */
 	int fence_fd;
+	/* The timeline point to signal when there is no resource. */
+	struct weston_drm_syncobj_timeline *release_timeline;
+	uint64_t release_point;
 };
 
 struct weston_buffer_release_reference {
@@ -1767,11 +2008,17 @@ struct weston_view {
 	struct wl_list paint_node_list;
 
 	struct wl_list link;             /* weston_compositor::view_list */
+	/* Layer the view was listed for in view_list, NULL if not listed */
+	struct weston_layer *view_list_layer;
 	struct weston_layer_entry layer_link; /* part of geometry */
 
 	/* For weston_layer inheritance from another view */
 	struct weston_view *parent_view;
 
+	/* Unique for the compositor's lifetime, unlike the address, which
+	 * the view pool hands out again */
+	uint64_t serial;
+
 	unsigned int click_to_activate_serial;
 
 	pixman_region32_t visible;       /* Unoccluded region in global space */
@@ -1844,6 +2091,8 @@ struct weston_view {
 	uint32_t output_mask;
 
 	bool is_mapped;
+	/** See weston_view_set_suspended() */
+	bool is_suspended;
 	struct weston_log_pacer subsurface_parent_log_pacer;
 };
 
@@ -1901,6 +2150,10 @@ struct weston_surface_state {
 	/* zwp_surface_synchronization_v1.set_acquire_fence */
 	int acquire_fence_fd;
 
+	/* wp_linux_drm_syncobj_surface_v1.set_acquire_point, while the
+	 * point has no fence yet */
+	struct weston_drm_syncobj_acquire *drm_syncobj_acquire;
+
 	/* zwp_surface_synchronization_v1.get_release */
 	struct weston_buffer_release_reference buffer_release_ref;
 
@@ -1910,10 +2163,22 @@ struct weston_surface_state {
 	/* weston_protected_surface.enforced/relaxed */
 	enum weston_surface_protection_mode protection_mode;
 
+	/* wp_content_type_v1.set_content_type */
+	enum weston_content_type content_type;
+
 	/* color_management_surface_v1_interface.set_image_description or
 	 * color_management_surface_v1_interface.unset_image_description */
 	struct weston_color_profile *color_profile;
 	const struct weston_render_intent_info *render_intent;
+
+	/* wp_fifo_v1.set_barrier */
+	bool fifo_barrier;
+	/* wp_fifo_v1.wait_barrier */
+	bool fifo_wait;
+
+	/* wp_commit_timer_v1.set_timestamp */
+	bool has_commit_target;
+	struct timespec commit_target;
 };
 
 struct weston_surface_activation_data {
@@ -1988,6 +2253,15 @@ struct weston_surface {
 
 	struct wl_list frame_callback_list;
 	struct wl_list feedback_list;
+	/* when frame callbacks were last sent, in presentation clock */
+	struct timespec frame_callback_time;
+
+	/* Content commits, for commit to present tracing: how many so far,
+	 * when the last one was applied in presentation clock, and the
+	 * last one a repaint of the primary output took */
+	uint64_t commit_seq;
+	struct timespec commit_time;
+	uint64_t repainted_commit_seq;
 
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
@@ -2032,6 +2306,12 @@ struct weston_surface {
 	struct wl_list subsurface_list; /* weston_subsurface::parent_link */
 	struct wl_list subsurface_list_pending; /* ...::parent_link_pending */
 
+	/* The sub-surface tree flattened in stacking order, rebuilt when
+	 * subsurface_flat_generation is behind the compositor's */
+	struct wl_array subsurface_flat;
+	uint32_t subsurface_flat_nodes;
+	uint64_t subsurface_flat_generation;
+
 	/*
 	 * For tracking protocol role assignments. Different roles may
 	 * have the same configure hook, e.g. in shell.c. Configure hook
@@ -2049,6 +2329,8 @@ struct weston_surface {
 
 	/* zwp_surface_synchronization_v1 resource for this surface */
 	struct wl_resource *synchronization_resource;
+	/* wp_linux_drm_syncobj_surface_v1 for this surface */
+	struct weston_drm_syncobj_surface *drm_syncobj;
 	int acquire_fence_fd;
 	struct weston_buffer_release_reference buffer_release_ref;
 
@@ -2060,6 +2342,35 @@ struct weston_surface {
 
 	struct weston_tearing_control *tear_control;
 
+	/* wp_content_type_v1 */
+	enum weston_content_type content_type;
+	struct wl_resource *content_type_resource;
+
+	/* wp_fractional_scale_v1, the last sent scale in 1/120ths */
+	struct wl_resource *fractional_scale_resource;
+	uint32_t preferred_fractional_scale;
+
+	/* wp_fifo_v1 and wp_commit_timer_v1 resources for this surface */
+	struct wl_resource *fifo_resource;
+	struct wl_resource *commit_timer_resource;
+
+	/* Set when content committed with wp_fifo_v1.set_barrier is applied,
+	 * cleared once an output has presented it. */
+	bool fifo_barrier;
+	bool fifo_barrier_latched;
+
+	/* Commits held back by a FIFO barrier or a target time, oldest
+	 * first; weston_commit_queue_entry::link */
+	struct wl_list commit_queue;
+	/* weston_compositor::commit_queue_list */
+	struct wl_list commit_queue_link;
+
+	/* weston_surface_frame_timing_v1 resources */
+	struct wl_list frame_timing_resource_list;
+
+	/* Set by the shell, see weston_surface_set_scanout_preferred() */
+	bool scanout_preferred;
+
 	struct weston_color_profile *color_profile;
 	struct weston_color_profile *preferred_color_profile;
 	const struct weston_render_intent_info *render_intent;
@@ -2217,6 +2528,40 @@ void
 weston_output_schedule_repaint_reset(struct weston_output *output);
 void
 weston_output_schedule_repaint_restart(struct weston_output *output);
+
+/** An external clock pacing the repaints of an output
+ *
+ * Lets an output follow a timeline shared with other compositors, for
+ * instance the nodes of a video wall, instead of only its own vblanks.
+ * All times are in the presentation clock of the compositor.
+ *
+ * \sa weston_output_set_frame_clock
+ */
+struct weston_frame_clock {
+	/** Pick the vblank the next repaint aims at
+	 *
+	 * Called once per presented frame. \c target holds the next vblank
+	 * of the output and may be moved later by whole refresh periods.
+	 */
+	void (*align)(struct weston_frame_clock *clock,
+		      struct weston_output *output,
+		      struct timespec *target, int32_t refresh_nsec);
+
+	/** Whether a due repaint aiming at \c target may start
+	 *
+	 * Optional. Returning false holds the repaint until
+	 * weston_output_frame_clock_release() is called.
+	 */
+	bool (*ready)(struct weston_frame_clock *clock,
+		      struct weston_output *output,
+		      const struct timespec *target);
+};
+
+void
+weston_output_set_frame_clock(struct weston_output *output,
+			      struct weston_frame_clock *clock);
+void
+weston_output_frame_clock_release(struct weston_output *output);
 void
 weston_compositor_schedule_repaint(struct weston_compositor *compositor);
 void
@@ -2307,6 +2652,31 @@ void
 weston_compositor_set_default_pointer_grab(struct weston_compositor *compositor,
 			const struct weston_pointer_grab_interface *interface);
 
+void
+weston_compositor_set_occluded_frame_policy(struct weston_compositor *compositor,
+					    enum weston_occluded_frame_policy policy,
+					    uint32_t interval_ms);
+
+typedef void (*weston_idle_task_func_t)(struct weston_compositor *compositor,
+					void *data);
+
+struct weston_idle_task *
+weston_compositor_add_idle_task(struct weston_compositor *compositor,
+				const char *name,
+				weston_idle_task_func_t func, void *data);
+
+void
+weston_idle_task_destroy(struct weston_idle_task *task);
+
+void
+weston_compositor_set_idle_task_delay(struct weston_compositor *compositor,
+				      uint32_t delay_msec);
+
+void
+weston_compositor_set_client_budget(struct weston_compositor *compositor,
+				    uint32_t max_surfaces,
+				    uint64_t max_buffer_bytes);
+
 struct weston_surface *
 weston_surface_create(struct weston_compositor *compositor);
 
@@ -2369,6 +2739,9 @@ weston_view_set_mask_infinite(struct weston_view *view);
 bool
 weston_view_is_mapped(struct weston_view *view);
 
+void
+weston_view_set_suspended(struct weston_view *view, bool suspended);
+
 void
 weston_view_schedule_repaint(struct weston_view *view);
 
@@ -2416,6 +2789,10 @@ weston_surface_set_label_func(struct weston_surface *surface,
 			      int (*desc)(struct weston_surface *,
 					  char *, size_t));
 
+void
+weston_surface_set_scanout_preferred(struct weston_surface *surface,
+				     bool preferred);
+
 void
 weston_surface_get_content_size(struct weston_surface *surface,
 				int *width, int *height);
@@ -2491,6 +2868,9 @@ weston_output_get_destroy_listener(struct weston_output *output,
 int
 weston_compositor_set_xkb_rule_names(struct weston_compositor *ec,
 				     struct xkb_rule_names *names);
+struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names);
 
 /* String literal of spaces, the same width as the timestamp. */
 #define STAMP_SPACE "               "
@@ -2565,6 +2945,20 @@ struct weston_view_animation *
 weston_slide_run(struct weston_view *view, float start, float stop,
 		 weston_view_animation_done_func_t done, void *data);
 
+struct weston_output_fade;
+typedef void (*weston_output_fade_done_func_t)(struct weston_output_fade *fade, void *data);
+
+struct weston_output_fade *
+weston_output_fade_run(struct weston_compositor *compositor,
+		       float start, float end,
+		       weston_output_fade_done_func_t done, void *data);
+
+void
+weston_output_fade_update(struct weston_output_fade *fade, float target);
+
+void
+weston_output_fade_destroy(struct weston_output_fade *fade);
+
 struct weston_surface *
 weston_surface_ref(struct weston_surface *surface);
 
@@ -29,6 +29,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <wayland-server-protocol.h>
 
@@ -93,6 +94,10 @@ struct weston_coord
 weston_matrix_transform_coord(const struct weston_matrix *matrix,
 			      struct weston_coord coord);
 
+void
+weston_matrix_transform_coords(const struct weston_matrix *matrix,
+			       struct weston_coord *coords, size_t count);
+
 int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix);
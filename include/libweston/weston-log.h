@@ -51,6 +51,22 @@ weston_compositor_is_debug_protocol_enabled(struct weston_compositor *);
 struct weston_log_scope;
 struct weston_debug_stream;
 
+#define WESTON_FLIGHT_REC_FILE_MAGIC "WFLTREC1"
+
+/** Start of a file backing a flight recorder
+ *
+ * The header is followed by \c size bytes of ring data. The oldest data
+ * starts at \c append_pos if \c overlap is set, else at zero; the newest
+ * ends right before \c append_pos. All fields are in host byte order.
+ */
+struct weston_flight_rec_file_header {
+	char magic[8];		/**< WESTON_FLIGHT_REC_FILE_MAGIC, no NUL */
+	uint32_t size;		/**< bytes of ring data */
+	uint32_t append_pos;	/**< where the next write goes */
+	uint32_t overlap;	/**< non-zero once the ring wrapped around */
+	uint32_t reserved;
+};
+
 /** weston_log_scope callback
  *
  * @param sub The subscription.
@@ -112,6 +128,11 @@ weston_log_scope_timestamp(struct weston_log_scope *scope,
 char *
 weston_log_timestamp(char *buf, size_t len, int *cached_tm_mday);
 
+struct timespec;
+
+void
+weston_log_timespec(struct timespec *ts);
+
 void
 weston_log_subscriber_destroy(struct weston_log_subscriber *subscriber);
 
@@ -126,6 +147,9 @@ weston_log_subscriber_create_log(FILE *dump_to);
 struct weston_log_subscriber *
 weston_log_subscriber_create_flight_rec(size_t size);
 
+struct weston_log_subscriber *
+weston_log_subscriber_create_flight_rec_file(const char *path, size_t size);
+
 void
 weston_log_subscriber_display_flight_rec(struct weston_log_subscriber *sub);
 
@@ -37,7 +37,7 @@ extern "C" {
 struct weston_compositor;
 struct weston_xwayland;
 
-#define WESTON_XWAYLAND_API_NAME "weston_xwayland_v3"
+#define WESTON_XWAYLAND_API_NAME "weston_xwayland_v4"
 #define WESTON_XWAYLAND_SURFACE_API_NAME "weston_xwayland_surface_v2"
 
 enum window_atom_type {
@@ -110,6 +110,19 @@ struct weston_xwayland_api {
 	 */
 	void
 	(*xserver_exited)(struct weston_xwayland *xwayland);
+
+	/** Start the Xwayland server without waiting for an X connection.
+	 *
+	 * This calls the \a spawn_func given to \a listen right away, so the
+	 * server and the window manager are ready by the time the first X
+	 * client connects. Does nothing if the server is already running.
+	 *
+	 * \param xwayland The Xwayland context object.
+	 *
+	 * \return 0 on success, a negative number otherwise.
+	 */
+	int
+	(*spawn)(struct weston_xwayland *xwayland);
 };
 
 /** Retrieve the API object for the libweston Xwayland module.
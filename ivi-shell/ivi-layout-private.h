@@ -31,6 +31,7 @@
 #include <libweston/libweston.h>
 #include "ivi-layout-export.h"
 #include <libweston/desktop.h>
+#include "shared/hash.h"
 
 struct ivi_layout_view {
 	struct wl_list link;	/* ivi_layout::view_list */
@@ -63,6 +64,8 @@ struct ivi_layout_surface {
 
 	struct {
 		struct ivi_layout_surface_properties prop;
+		/* prop may differ from the current one */
+		bool dirty;
 	} pending;
 
 	struct wl_list view_list;	/* ivi_layout_view::surf_link */
@@ -80,6 +83,8 @@ struct ivi_layout_layer {
 
 	struct {
 		struct ivi_layout_layer_properties prop;
+		/* prop may differ from the current one */
+		bool dirty;
 		struct wl_list view_list;	/* ivi_layout_view::pending_link */
 		struct wl_list link;	/* ivi_layout_screen::pending.layer_list */
 	} pending;
@@ -93,11 +98,17 @@ struct ivi_layout_layer {
 	int32_t ref_count;
 };
 
+HASH_MAP_DECLARE(ivi_surface_id_map, uint32_t, struct ivi_layout_surface *);
+HASH_MAP_DECLARE(ivi_layer_id_map, uint32_t, struct ivi_layout_layer *);
+
 struct ivi_layout {
 	struct ivi_shell *shell;
 
 	struct wl_list surface_list;	/* ivi_layout_surface::link */
 	struct wl_list layer_list;	/* ivi_layout_layer::link */
+	/* Surfaces with an id other than IVI_INVALID_ID, and layers */
+	struct ivi_surface_id_map surface_ids;
+	struct ivi_layer_id_map layer_ids;
 	struct wl_list screen_list;	/* ivi_layout_screen::link */
 	struct wl_list view_list;	/* ivi_layout_view::link */
 
@@ -143,7 +154,12 @@ struct ivi_layout *get_instance(void);
 struct ivi_layout_transition;
 
 struct ivi_layout_transition_set {
-	struct wl_event_source  *event_source;
+	struct weston_compositor *compositor;
+	/* Transitions are stepped by the animations of this output, in
+	 * weston_output::animation_list while transition_list is not empty */
+	struct weston_output *output;
+	struct weston_animation animation;
+	struct wl_listener output_destroy_listener;
 	struct wl_list          transition_list;
 };
 
@@ -152,6 +168,9 @@ typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
 struct ivi_layout_transition_set *
 ivi_layout_transition_set_create(struct weston_compositor *ec);
 
+void
+ivi_layout_transition_set_start(struct ivi_layout_transition_set *transitions);
+
 void
 ivi_layout_transition_move_resize_view(struct ivi_layout_surface *surface,
 				       int32_t dest_x, int32_t dest_y,
@@ -35,6 +35,8 @@
 #include "ivi-shell.h"
 #include "ivi-layout-export.h"
 #include "ivi-layout-private.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
 
 struct ivi_layout_transition;
 
@@ -156,52 +158,101 @@ do_transition_frame(struct ivi_layout_transition *transition,
 		layout_transition_destroy(transition);
 }
 
-static int32_t
-layout_transition_frame(void *data)
+static void
+layout_transition_set_stop(struct ivi_layout_transition_set *transitions)
 {
-	struct ivi_layout_transition_set *transitions = data;
-	uint32_t fps = 30;
-	struct timespec timestamp = {};
-	uint32_t msec = 0;
-	struct transition_node *node = NULL;
-	struct transition_node *next = NULL;
+	if (!transitions->output)
+		return;
 
-	if (wl_list_empty(&transitions->transition_list)) {
-		wl_event_source_timer_update(transitions->event_source, 0);
-		return 1;
-	}
+	wl_list_remove(&transitions->animation.link);
+	wl_list_init(&transitions->animation.link);
+	wl_list_remove(&transitions->output_destroy_listener.link);
+	transitions->output = NULL;
+}
 
-	wl_event_source_timer_update(transitions->event_source, 1000 / fps);
+/* Runs in the animation pass of the output repaint, with the predicted
+ * presentation time of the frame showing the result. */
+static void
+layout_transition_frame(struct weston_animation *animation,
+			struct weston_output *output,
+			const struct timespec *time)
+{
+	struct ivi_layout_transition_set *transitions =
+		container_of(animation, struct ivi_layout_transition_set,
+			     animation);
+	struct transition_node *node = NULL;
+	struct transition_node *next = NULL;
+	uint32_t msec;
 
-	clock_gettime(CLOCK_MONOTONIC, &timestamp);/* FIXME */
-	msec = (1e+3 * timestamp.tv_sec + 1e-6 * timestamp.tv_nsec);
+	msec = timespec_to_msec(time);
 
 	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
 		do_transition_frame(node->transition, msec);
 	}
 
+	if (wl_list_empty(&transitions->transition_list))
+		layout_transition_set_stop(transitions);
+
 	ivi_layout_commit_changes();
-	return 1;
+}
+
+static void
+layout_transition_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct ivi_layout_transition_set *transitions =
+		container_of(listener, struct ivi_layout_transition_set,
+			     output_destroy_listener);
+
+	layout_transition_set_stop(transitions);
+	ivi_layout_transition_set_start(transitions);
+}
+
+/** Step the pending transitions with the repaints of an output
+ *
+ * Any enabled output will do: the transitions only need a clock that
+ * follows the display, and the output repaints for as long as they run.
+ */
+void
+ivi_layout_transition_set_start(struct ivi_layout_transition_set *transitions)
+{
+	struct weston_output *output;
+
+	if (transitions->output ||
+	    wl_list_empty(&transitions->transition_list))
+		return;
+
+	wl_list_for_each(output, &transitions->compositor->output_list, link) {
+		if (output->destroying)
+			continue;
+
+		transitions->output = output;
+		transitions->animation.frame_counter = 0;
+		wl_list_insert(&output->animation_list,
+			       &transitions->animation.link);
+		wl_signal_add(&output->destroy_signal,
+			      &transitions->output_destroy_listener);
+		weston_output_schedule_repaint(output);
+		return;
+	}
 }
 
 struct ivi_layout_transition_set *
 ivi_layout_transition_set_create(struct weston_compositor *ec)
 {
 	struct ivi_layout_transition_set *transitions;
-	struct wl_event_loop *loop;
 
-	transitions = malloc(sizeof(*transitions));
+	transitions = zalloc(sizeof(*transitions));
 	if (transitions == NULL) {
 		weston_log("%s: memory allocation fails\n", __func__);
 		return NULL;
 	}
 
+	transitions->compositor = ec;
 	wl_list_init(&transitions->transition_list);
-
-	loop = wl_display_get_event_loop(ec->wl_display);
-	transitions->event_source =
-		wl_event_loop_add_timer(loop, layout_transition_frame,
-					transitions);
+	wl_list_init(&transitions->animation.link);
+	transitions->animation.frame = layout_transition_frame;
+	transitions->output_destroy_listener.notify =
+		layout_transition_output_destroyed;
 
 	return transitions;
 }
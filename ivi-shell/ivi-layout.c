@@ -102,6 +102,17 @@ struct ivi_rectangle
 
 static struct ivi_layout ivilayout = {0};
 
+static inline bool
+equal_u32(uint32_t a, uint32_t b)
+{
+	return a == b;
+}
+
+HASH_MAP_DEFINE(static, ivi_surface_id_map, uint32_t,
+		struct ivi_layout_surface *, hash_u32, equal_u32)
+HASH_MAP_DEFINE(static, ivi_layer_id_map, uint32_t,
+		struct ivi_layout_layer *, hash_u32, equal_u32)
+
 struct ivi_layout *
 get_instance(void)
 {
@@ -112,31 +123,45 @@ get_instance(void)
  * Internal API to add/remove an ivi_layer to/from ivi_screen.
  */
 static struct ivi_layout_surface *
-get_surface(struct wl_list *surf_list, uint32_t id_surface)
+get_surface(struct ivi_layout *layout, uint32_t id_surface)
 {
-	struct ivi_layout_surface *ivisurf;
+	struct ivi_layout_surface *ivisurf, **entry;
 
-	wl_list_for_each(ivisurf, surf_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
+	/* Any number of surfaces may be without an id, those are not in
+	 * the index */
+	if (id_surface == IVI_INVALID_ID) {
+		wl_list_for_each(ivisurf, &layout->surface_list, link) {
+			if (ivisurf->id_surface == id_surface)
+				return ivisurf;
 		}
+
+		return NULL;
 	}
 
-	return NULL;
+	entry = ivi_surface_id_map_lookup(&layout->surface_ids, id_surface);
+
+	return entry ? *entry : NULL;
 }
 
 static struct ivi_layout_layer *
-get_layer(struct wl_list *layer_list, uint32_t id_layer)
+get_layer(struct ivi_layout *layout, uint32_t id_layer)
 {
-	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_layer **entry;
 
-	wl_list_for_each(ivilayer, layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
+	entry = ivi_layer_id_map_lookup(&layout->layer_ids, id_layer);
 
-	return NULL;
+	return entry ? *entry : NULL;
+}
+
+static void
+index_surface(struct ivi_layout *layout, struct ivi_layout_surface *ivisurf)
+{
+	if (ivisurf->id_surface == IVI_INVALID_ID)
+		return;
+
+	abort_oom_if_null(ivi_surface_id_map_insert(&layout->surface_ids,
+						    ivisurf->id_surface,
+						    ivisurf));
 }
 
 static bool
@@ -245,6 +270,9 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	}
 
 	wl_list_remove(&ivisurf->link);
+	if (ivisurf->id_surface != IVI_INVALID_ID)
+		ivi_surface_id_map_remove(&layout->surface_ids,
+					  ivisurf->id_surface, NULL);
 
 	wl_list_for_each_safe(ivi_view, next, &ivisurf->view_list, surf_link) {
 		ivi_view_destroy(ivi_view);
@@ -368,8 +396,11 @@ update_opacity(struct ivi_layout_layer *ivilayer,
 {
 	double layer_alpha = wl_fixed_to_double(ivilayer->prop.opacity);
 	double surf_alpha  = wl_fixed_to_double(ivisurf->prop.opacity);
+	float alpha = layer_alpha * surf_alpha;
 
-	weston_view_set_alpha(view, layer_alpha * surf_alpha);
+	/* Setting the alpha damages the view, even if it stays the same */
+	if (view->alpha != alpha)
+		weston_view_set_alpha(view, alpha);
 }
 
 static void
@@ -584,12 +615,24 @@ calc_surface_to_global_matrix_and_mask_to_weston_surface(
 				      result);
 }
 
+static bool
+view_mask_equals(struct weston_view *view, const struct ivi_rectangle *r)
+{
+	pixman_box32_t *box = pixman_region32_extents(&view->geometry.scissor);
+
+	return view->geometry.scissor_enabled &&
+	       pixman_region32_n_rects(&view->geometry.scissor) == 1 &&
+	       box->x1 == r->x && box->y1 == r->y &&
+	       box->x2 == r->x + r->width && box->y2 == r->y + r->height;
+}
+
 static void
 update_prop(struct ivi_layout_view *ivi_view)
 {
 	struct ivi_layout_surface *ivisurf = ivi_view->ivisurf;
 	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
 	struct ivi_layout_screen *iviscrn = ivilayer->on_screen;
+	struct weston_matrix m;
 	struct ivi_rectangle r;
 	bool can_calc = true;
 
@@ -610,10 +653,20 @@ update_prop(struct ivi_layout_view *ivi_view)
 	}
 
 	if (can_calc) {
-		weston_matrix_init(&ivi_view->transform.matrix);
+		weston_matrix_init(&m);
 
 		calc_surface_to_global_matrix_and_mask_to_weston_surface(
-			iviscrn, ivilayer, ivisurf, &ivi_view->transform.matrix, &r);
+			iviscrn, ivilayer, ivisurf, &m, &r);
+
+		/* Other properties changed, e.g. only the opacity during a
+		 * fade. Re-applying the same geometry would damage the whole
+		 * view, so static content would be repainted needlessly. */
+		if (!wl_list_empty(&ivi_view->transform.link) &&
+		    memcmp(&m, &ivi_view->transform.matrix, sizeof m) == 0 &&
+		    view_mask_equals(ivi_view->view, &r))
+			goto out;
+
+		ivi_view->transform.matrix = m;
 
 		weston_view_set_mask(ivi_view->view, r.x, r.y, r.width, r.height);
 		weston_view_add_transform(ivi_view->view,
@@ -622,6 +675,7 @@ update_prop(struct ivi_layout_view *ivi_view)
 		weston_view_set_transform_parent(ivi_view->view, NULL);
 	}
 
+out:
 	ivisurf->update_count++;
 }
 
@@ -662,6 +716,15 @@ commit_surface_list(struct ivi_layout *layout)
 	int32_t configured = 0;
 
 	wl_list_for_each(ivisurf, &layout->surface_list, link) {
+		/* Nothing was set since the last commit: pending equals the
+		 * current properties, except for the events already sent. */
+		if (!ivisurf->pending.dirty) {
+			ivisurf->prop.event_mask = ivisurf->pending.prop.event_mask;
+			continue;
+		}
+
+		/* The transitions below keep the old destination until they
+		 * get there, so they leave pending dirty. */
 		if (ivisurf->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_VIEW_DEFAULT) {
 			dest_x = ivisurf->prop.dest_x;
 			dest_y = ivisurf->prop.dest_y;
@@ -727,6 +790,7 @@ commit_surface_list(struct ivi_layout *layout)
 			ivisurf->prop = ivisurf->pending.prop;
 			ivisurf->prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
 			ivisurf->pending.prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
+			ivisurf->pending.dirty = false;
 
 			if (configured && !is_surface_transition(ivisurf)) {
 				ivi_layout_surface_set_size(ivisurf,
@@ -743,6 +807,7 @@ commit_surface_list(struct ivi_layout *layout)
 			ivisurf->prop = ivisurf->pending.prop;
 			ivisurf->prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
 			ivisurf->pending.prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
+			ivisurf->pending.dirty = false;
 
 			if (configured && !is_surface_transition(ivisurf)) {
 				ivi_layout_surface_set_size(ivisurf,
@@ -771,7 +836,13 @@ commit_layer_list(struct ivi_layout *layout)
 		}
 		ivilayer->pending.prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
 
-		ivilayer->prop = ivilayer->pending.prop;
+		if (ivilayer->pending.dirty) {
+			ivilayer->prop = ivilayer->pending.prop;
+			ivilayer->pending.dirty = false;
+		} else {
+			/* Only drop the events already sent */
+			ivilayer->prop.event_mask = ivilayer->pending.prop.event_mask;
+		}
 
 		if (!ivilayer->order.dirty) {
 			continue;
@@ -832,6 +903,48 @@ commit_screen_list(struct ivi_layout *layout)
 	}
 }
 
+/** Check whether the weston_layer already shows the views in order
+ *
+ * Every view that goes on the layer is inserted at the top, so the layer
+ * list read from the bottom must match the screen, layer and view order.
+ */
+static bool
+view_list_is_current(struct ivi_layout *layout)
+{
+	struct wl_list *bottom = &layout->layout_layer.view_list.link;
+	struct wl_list *next = bottom->prev;
+	struct ivi_layout_screen  *iviscrn;
+	struct ivi_layout_layer   *ivilayer;
+	struct ivi_layout_view   *ivi_view;
+
+	wl_list_for_each(ivi_view, &layout->view_list, link) {
+		if (!ivi_view_is_mapped(ivi_view) &&
+		    ivi_view->view->layer_link.layer)
+			return false;
+	}
+
+	wl_list_for_each(iviscrn, &layout->screen_list, link) {
+		wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
+			wl_list_for_each(ivi_view, &ivilayer->order.view_list, order_link) {
+				if (ivilayer->prop.visibility == false ||
+				    ivi_view->ivisurf->prop.visibility == false) {
+					if (ivi_view->view->layer_link.layer)
+						return false;
+					continue;
+				}
+
+				if (next != &ivi_view->view->layer_link.link ||
+				    !weston_view_is_mapped(ivi_view->view) ||
+				    !weston_surface_is_mapped(ivi_view->ivisurf->surface))
+					return false;
+				next = next->prev;
+			}
+		}
+	}
+
+	return next == bottom;
+}
+
 static void
 build_view_list(struct ivi_layout *layout)
 {
@@ -839,6 +952,11 @@ build_view_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer;
 	struct ivi_layout_view   *ivi_view;
 
+	/* Re-stacking damages every view, which would make layers with
+	 * static content get repainted on every commit of a transition. */
+	if (view_list_is_current(layout))
+		return;
+
 	/* If ivi_view is not part of the scenegrapgh, we have to unmap
 	 * weston_views
 	 */
@@ -877,7 +995,7 @@ commit_transition(struct ivi_layout* layout)
 
 	wl_list_init(&layout->pending_transition_list);
 
-	wl_event_source_timer_update(layout->transitions->event_source, 1);
+	ivi_layout_transition_set_start(layout->transitions);
 }
 
 static void
@@ -1019,31 +1137,13 @@ ivi_layout_get_id_of_layer(struct ivi_layout_layer *ivilayer)
 static struct ivi_layout_layer *
 ivi_layout_get_layer_from_id(uint32_t id_layer)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_layer *ivilayer = NULL;
-
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
-
-	return NULL;
+	return get_layer(get_instance(), id_layer);
 }
 
 struct ivi_layout_surface *
 ivi_layout_get_surface_from_id(uint32_t id_surface)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_surface *ivisurf = NULL;
-
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
-	}
-
-	return NULL;
+	return get_surface(get_instance(), id_surface);
 }
 
 static void
@@ -1235,7 +1335,7 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_layer *ivilayer = NULL;
 
-	ivilayer = get_layer(&layout->layer_list, id_layer);
+	ivilayer = get_layer(layout, id_layer);
 	if (ivilayer != NULL) {
 		weston_log("id_layer is already created\n");
 		++ivilayer->ref_count;
@@ -1259,6 +1359,8 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	wl_list_init(&ivilayer->order.link);
 
 	wl_list_insert(&layout->layer_list, &ivilayer->link);
+	abort_oom_if_null(ivi_layer_id_map_insert(&layout->layer_ids,
+						  id_layer, ivilayer));
 
 	wl_signal_emit(&layout->layer_notification.created, ivilayer);
 
@@ -1287,6 +1389,7 @@ ivi_layout_layer_destroy(struct ivi_layout_layer *ivilayer)
 	wl_list_remove(&ivilayer->pending.link);
 	wl_list_remove(&ivilayer->order.link);
 	wl_list_remove(&ivilayer->link);
+	ivi_layer_id_map_remove(&layout->layer_ids, ivilayer->id_layer, NULL);
 
 	free(ivilayer);
 }
@@ -1300,6 +1403,7 @@ ivi_layout_layer_set_visibility(struct ivi_layout_layer *ivilayer,
 	assert(ivilayer);
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = true;
 	prop->visibility = newVisibility;
 
 	if (ivilayer->prop.visibility != newVisibility)
@@ -1323,6 +1427,7 @@ ivi_layout_layer_set_opacity(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = true;
 	prop->opacity = opacity;
 
 	if (ivilayer->prop.opacity != opacity)
@@ -1343,6 +1448,7 @@ ivi_layout_layer_set_source_rectangle(struct ivi_layout_layer *ivilayer,
 	assert(ivilayer);
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = true;
 	prop->source_x = x;
 	prop->source_y = y;
 	prop->source_width = width;
@@ -1366,6 +1472,7 @@ ivi_layout_layer_set_destination_rectangle(struct ivi_layout_layer *ivilayer,
 	assert(ivilayer);
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = true;
 	prop->dest_x = x;
 	prop->dest_y = y;
 	prop->dest_width = width;
@@ -1414,6 +1521,7 @@ ivi_layout_surface_set_visibility(struct ivi_layout_surface *ivisurf,
 	assert(ivisurf);
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = true;
 	prop->visibility = newVisibility;
 
 	if (ivisurf->prop.visibility != newVisibility)
@@ -1437,6 +1545,7 @@ ivi_layout_surface_set_opacity(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = true;
 	prop->opacity = opacity;
 
 	if (ivisurf->prop.opacity != opacity)
@@ -1457,6 +1566,7 @@ ivi_layout_surface_set_destination_rectangle(struct ivi_layout_surface *ivisurf,
 	assert(ivisurf);
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = true;
 	prop->start_x = prop->dest_x;
 	prop->start_y = prop->dest_y;
 	prop->dest_x = x;
@@ -1665,6 +1775,7 @@ ivi_layout_surface_set_source_rectangle(struct ivi_layout_surface *ivisurf,
 	assert(ivisurf);
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = true;
 	prop->source_x = x;
 	prop->source_y = y;
 	prop->source_width = width;
@@ -1715,6 +1826,7 @@ ivi_layout_layer_set_transition(struct ivi_layout_layer *ivilayer,
 
 	ivilayer->pending.prop.transition_type = type;
 	ivilayer->pending.prop.transition_duration = duration;
+	ivilayer->pending.dirty = true;
 }
 
 static void
@@ -1727,6 +1839,7 @@ ivi_layout_layer_set_fade_info(struct ivi_layout_layer* ivilayer,
 	ivilayer->pending.prop.is_fade_in = is_fade_in;
 	ivilayer->pending.prop.start_alpha = start_alpha;
 	ivilayer->pending.prop.end_alpha = end_alpha;
+	ivilayer->pending.dirty = true;
 }
 
 static void
@@ -1738,6 +1851,7 @@ ivi_layout_surface_set_transition_duration(struct ivi_layout_surface *ivisurf,
 	assert(ivisurf);
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = true;
 	prop->transition_duration = duration*10;
 }
 
@@ -1761,13 +1875,14 @@ ivi_layout_surface_set_id(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
-	search_ivisurf = get_surface(&layout->surface_list, id_surface);
+	search_ivisurf = get_surface(layout, id_surface);
 	if (search_ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return IVI_FAILED;
 	}
 
 	ivisurf->id_surface = id_surface;
+	index_surface(layout, ivisurf);
 
 	wl_signal_emit(&layout->surface_notification.configure_changed,
 		       ivisurf);
@@ -1846,6 +1961,7 @@ ivi_layout_surface_set_transition(struct ivi_layout_surface *ivisurf,
 	assert(ivisurf);
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = true;
 	prop->transition_type = type;
 	prop->transition_duration = duration;
 }
@@ -1896,6 +2012,7 @@ surface_create(struct weston_surface *wl_surface, uint32_t id_surface,
 	wl_list_init(&ivisurf->view_list);
 
 	wl_list_insert(&layout->surface_list, &ivisurf->link);
+	index_surface(layout, ivisurf);
 
 	return ivisurf;
 }
@@ -2068,7 +2185,7 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_surface *ivisurf = NULL;
 
-	ivisurf = get_surface(&layout->surface_list, id_surface);
+	ivisurf = get_surface(layout, id_surface);
 	if (ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return NULL;
@@ -2103,6 +2220,8 @@ ivi_layout_init(struct weston_compositor *ec, struct ivi_shell *shell)
 
 	wl_list_init(&layout->surface_list);
 	wl_list_init(&layout->layer_list);
+	ivi_surface_id_map_init(&layout->surface_ids);
+	ivi_layer_id_map_init(&layout->layer_ids);
 	wl_list_init(&layout->screen_list);
 	wl_list_init(&layout->view_list);
 
@@ -2149,6 +2268,9 @@ ivi_layout_fini(void)
 
 	weston_layer_fini(&layout->layout_layer);
 
+	ivi_surface_id_map_release(&layout->surface_ids);
+	ivi_layer_id_map_release(&layout->layer_ids);
+
 	/* XXX: tear down everything else */
 	wl_list_remove(&layout->output_created.link);
 	wl_list_remove(&layout->output_destroyed.link);
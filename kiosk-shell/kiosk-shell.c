@@ -150,6 +150,8 @@ kiosk_shell_output_raise_surface_subtree(struct kiosk_shell_output *shoutput,
 static struct kiosk_shell_output *
 kiosk_shell_find_shell_output(struct kiosk_shell *shell,
 			      struct weston_output *output);
+static void
+kiosk_shell_output_update_background(struct kiosk_shell_output *shoutput);
 
 static void
 kiosk_shell_surface_notify_parent_destroy(struct wl_listener *listener, void *data)
@@ -310,6 +312,9 @@ kiosk_shell_surface_set_fullscreen(struct kiosk_shell_surface *shsurf,
 	kiosk_shell_surface_set_output(shsurf, output);
 
 	weston_desktop_surface_set_fullscreen(shsurf->desktop_surface, true);
+	weston_surface_set_scanout_preferred(
+		weston_desktop_surface_get_surface(shsurf->desktop_surface),
+		shsurf->shell->scanout_first);
 	if (shsurf->output)
 		weston_desktop_surface_set_size(shsurf->desktop_surface,
 						shsurf->output->width,
@@ -325,6 +330,9 @@ kiosk_shell_surface_set_maximized(struct kiosk_shell_surface *shsurf)
 	kiosk_shell_surface_set_output(shsurf, output);
 
 	weston_desktop_surface_set_maximized(shsurf->desktop_surface, true);
+	weston_surface_set_scanout_preferred(
+		weston_desktop_surface_get_surface(shsurf->desktop_surface),
+		false);
 	if (shsurf->output)
 		weston_desktop_surface_set_size(shsurf->desktop_surface,
 						shsurf->output->width,
@@ -340,6 +348,9 @@ kiosk_shell_surface_set_normal(struct kiosk_shell_surface *shsurf)
 
 	weston_desktop_surface_set_fullscreen(shsurf->desktop_surface, false);
 	weston_desktop_surface_set_maximized(shsurf->desktop_surface, false);
+	weston_surface_set_scanout_preferred(
+		weston_desktop_surface_get_surface(shsurf->desktop_surface),
+		false);
 	weston_desktop_surface_set_size(shsurf->desktop_surface, 0, 0);
 }
 
@@ -624,6 +635,8 @@ kiosk_shell_output_set_active_surface_tree(struct kiosk_shell_output *shoutput,
 		wl_list_for_each_reverse(s, shoutput->active_surface_tree, surface_tree_link) {
 			weston_view_move_to_layer(s->view,
 						  &shell->inactive_layer.view_list);
+			weston_view_set_suspended(s->view,
+						  shell->suspend_inactive);
 		}
 	}
 
@@ -631,12 +644,15 @@ kiosk_shell_output_set_active_surface_tree(struct kiosk_shell_output *shoutput,
 		wl_list_for_each_reverse(s, &shroot->surface_tree_list, surface_tree_link) {
 			weston_view_move_to_layer(s->view,
 						  &shell->normal_layer.view_list);
+			weston_view_set_suspended(s->view, false);
 		}
 	}
 
 	shoutput->active_surface_tree = shroot ?
 					&shroot->surface_tree_list :
 					NULL;
+
+	kiosk_shell_output_update_background(shoutput);
 }
 
 /* Raises the subtree originating at the specified 'shroot' of the output's
@@ -670,6 +686,7 @@ kiosk_shell_output_raise_surface_subtree(struct kiosk_shell_output *shoutput,
 	 * of the output's active surface tree. */
 	wl_list_for_each_reverse_safe(s, tmp_s, &tmp_list, surface_tree_link) {
 		weston_view_move_to_layer(s->view, &shell->normal_layer.view_list);
+		weston_view_set_suspended(s->view, false);
 
 		active_surface_tree_move_element_to_top(shoutput->active_surface_tree,
 							&s->surface_tree_link);
@@ -730,6 +747,50 @@ kiosk_shell_output_recreate_background(struct kiosk_shell_output *shoutput)
 	weston_view_move_to_layer(shoutput->curtain->view,
 				  &shell->background_layer.view_list);
 	weston_view_set_output(shoutput->curtain->view, output);
+
+	kiosk_shell_output_update_background(shoutput);
+}
+
+/* In scanout-first mode, drop the background curtain while the active
+ * application covers the whole output. A solid-colour curtain can't go on a
+ * plane, so as soon as the application has any translucency the curtain
+ * would drag the whole output into GL composition. Translucent areas blend
+ * against black instead of the background colour then. */
+static void
+kiosk_shell_output_update_background(struct kiosk_shell_output *shoutput)
+{
+	struct kiosk_shell *shell = shoutput->shell;
+	struct weston_output *output = shoutput->output;
+	struct kiosk_shell_surface *s;
+	bool covered = false;
+
+	if (!shoutput->curtain)
+		return;
+
+	if (shell->scanout_first && shoutput->active_surface_tree) {
+		wl_list_for_each(s, shoutput->active_surface_tree,
+				 surface_tree_link) {
+			struct weston_surface *surface =
+				weston_desktop_surface_get_surface(s->desktop_surface);
+
+			if (!surface->scanout_preferred ||
+			    !weston_view_is_mapped(s->view))
+				continue;
+
+			if (pixman_region32_contains_rectangle(&s->view->transform.boundingbox,
+							       pixman_region32_extents(&output->region)) ==
+			    PIXMAN_REGION_IN) {
+				covered = true;
+				break;
+			}
+		}
+	}
+
+	if (covered)
+		weston_view_move_to_layer(shoutput->curtain->view, NULL);
+	else
+		weston_view_move_to_layer(shoutput->curtain->view,
+					  &shell->background_layer.view_list);
 }
 
 static void
@@ -1070,6 +1131,15 @@ desktop_surface_committed(struct weston_desktop_surface *desktop_surface,
 		weston_view_update_transform(shsurf->view);
 	}
 
+	if (shsurf->shell->scanout_first && shsurf->output) {
+		struct kiosk_shell_output *shoutput =
+			kiosk_shell_find_shell_output(shsurf->shell,
+						      shsurf->output);
+
+		if (shoutput)
+			kiosk_shell_output_update_background(shoutput);
+	}
+
 	shsurf->last_width = surface->width;
 	shsurf->last_height = surface->height;
 }
@@ -1478,7 +1548,9 @@ wet_shell_init(struct weston_compositor *ec,
 	struct kiosk_shell *shell;
 	struct weston_seat *seat;
 	struct weston_output *output;
+	struct weston_config_section *section;
 	const char *config_file;
+	uint32_t occluded_frame_interval;
 
 	shell = zalloc(sizeof *shell);
 	if (shell == NULL)
@@ -1499,6 +1571,24 @@ wet_shell_init(struct weston_compositor *ec,
 	config_file = weston_config_get_name_from_env();
 	shell->config = weston_config_parse(config_file);
 
+	/* Inactive applications sit behind the background, their frame
+	 * callbacks are held unless a throttling interval is configured. */
+	section = weston_config_get_section(shell->config, "shell", NULL, NULL);
+	weston_config_section_get_uint(section, "occluded-frame-interval",
+				       &occluded_frame_interval, 0);
+	weston_compositor_set_occluded_frame_policy(ec,
+						    occluded_frame_interval ?
+						    WESTON_OCCLUDED_FRAME_THROTTLE :
+						    WESTON_OCCLUDED_FRAME_HOLD,
+						    occluded_frame_interval);
+	weston_config_section_get_bool(section, "scanout-first",
+				       &shell->scanout_first, false);
+	/* Suspended applications get no frame callbacks at all, so only
+	 * suspend them by default if those are not to be throttled. */
+	weston_config_section_get_bool(section, "suspend-inactive-apps",
+				       &shell->suspend_inactive,
+				       occluded_frame_interval == 0);
+
 	weston_layer_init(&shell->background_layer, ec);
 	weston_layer_init(&shell->normal_layer, ec);
 	weston_layer_init(&shell->inactive_layer, ec);
@@ -49,6 +49,12 @@ struct kiosk_shell {
 	const struct weston_xwayland_surface_api *xwayland_surface_api;
 	struct weston_config *config;
 	struct wl_listener session_listener;
+
+	/* Fullscreen applications are flagged for direct scanout */
+	bool scanout_first;
+
+	/* Views of the inactive layer are suspended */
+	bool suspend_inactive;
 };
 
 struct kiosk_shell_surface {
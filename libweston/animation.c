@@ -39,6 +39,7 @@
 #include "libweston-internal.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
+#include "shared/xalloc.h"
 
 WL_EXPORT void
 weston_spring_init(struct weston_spring *spring,
@@ -196,8 +197,6 @@ weston_view_animation_frame(struct weston_animation *base,
 	struct weston_view_animation *animation =
 		container_of(base,
 			     struct weston_view_animation, animation);
-	struct weston_compositor *compositor =
-		animation->view->surface->compositor;
 
 	if (base->frame_counter <= 1)
 		animation->spring.timestamp = *time;
@@ -212,19 +211,12 @@ weston_view_animation_frame(struct weston_animation *base,
 	if (animation->frame)
 		animation->frame(animation);
 
+	/* This updates the transform too. The output keeps repainting
+	 * while the animation runs, even when the view is offscreen and
+	 * causes no damage. */
 	weston_view_add_transform(animation->view,
 				  &animation->view->geometry.transformation_list,
 				  &animation->transform);
-	weston_view_update_transform(animation->view);
-
-	/* The view's output_mask will be zero if its position is
-	 * offscreen. Animations should always run but as they are also
-	 * run off the repaint cycle, if there's nothing to repaint
-	 * the animation stops running. Therefore if we catch this situation
-	 * and schedule a repaint on all outputs it will be avoided.
-	 */
-	if (animation->view->output_mask == 0)
-		weston_compositor_schedule_repaint(compositor);
 }
 
 static struct weston_view_animation *
@@ -277,6 +269,10 @@ weston_view_animation_run(struct weston_view_animation *animation)
 
 	animation->animation.frame_counter = 0;
 	weston_view_animation_frame(&animation->animation, NULL, &zero_time);
+
+	/* Start the repaint loop that steps it */
+	if (animation->view->output)
+		weston_output_schedule_repaint(animation->view->output);
 }
 
 static void
@@ -550,3 +546,198 @@ weston_move_run(struct weston_view *view, int dx, int dy,
 	return weston_move_scale_run_internal(view, dx, dy, start, end, reverse,
 					      false, done, data);
 }
+
+struct weston_output_fade_output {
+	struct weston_output_fade *fade;
+	struct weston_output *output;
+	struct weston_animation animation;
+	struct wl_listener output_destroy_listener;
+	struct wl_list link; /* weston_output_fade::output_list */
+};
+
+struct weston_output_fade {
+	struct weston_compositor *compositor;
+	struct weston_spring spring;
+	bool started;
+	struct wl_list output_list;
+	struct wl_event_source *idle_done_source;
+	weston_output_fade_done_func_t done;
+	void *data;
+};
+
+static void
+output_fade_output_destroy(struct weston_output_fade_output *fo)
+{
+	wl_list_remove(&fo->animation.link);
+	wl_list_remove(&fo->output_destroy_listener.link);
+	wl_list_remove(&fo->link);
+	free(fo);
+}
+
+static void
+handle_output_fade_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_output_fade_output *fo =
+		container_of(listener, struct weston_output_fade_output,
+			     output_destroy_listener);
+
+	output_fade_output_destroy(fo);
+}
+
+static void
+output_fade_set_level(struct weston_output_fade *fade, float level)
+{
+	struct weston_output_fade_output *fo;
+
+	wl_list_for_each(fo, &fade->output_list, link) {
+		fo->output->set_fade_level(fo->output, level);
+		weston_output_schedule_repaint(fo->output);
+	}
+}
+
+/** Stop a fade without calling its done callback
+ *
+ * The outputs go back to full level with their next repaint.
+ */
+WL_EXPORT void
+weston_output_fade_destroy(struct weston_output_fade *fade)
+{
+	struct weston_output_fade_output *fo, *tmp;
+
+	if (fade->idle_done_source)
+		wl_event_source_remove(fade->idle_done_source);
+
+	output_fade_set_level(fade, 1.0f);
+
+	wl_list_for_each_safe(fo, tmp, &fade->output_list, link)
+		output_fade_output_destroy(fo);
+
+	free(fade);
+}
+
+static void
+idle_output_fade_done(void *data)
+{
+	struct weston_output_fade *fade = data;
+
+	fade->idle_done_source = NULL;
+
+	/* Let the callback cover the outputs before they light up again,
+	 * the repaint then takes both. */
+	if (fade->done)
+		fade->done(fade, fade->data);
+
+	weston_output_fade_destroy(fade);
+}
+
+static void
+output_fade_frame(struct weston_animation *base,
+		  struct weston_output *output,
+		  const struct timespec *time)
+{
+	struct weston_output_fade_output *fo =
+		container_of(base, struct weston_output_fade_output, animation);
+	struct weston_output_fade *fade = fo->fade;
+	struct wl_event_loop *loop;
+	float level;
+
+	if (fade->idle_done_source)
+		return;
+
+	/* All outputs step the same spring, whichever repaints first. */
+	if (!fade->started) {
+		fade->spring.timestamp = *time;
+		fade->started = true;
+	}
+
+	weston_spring_update(&fade->spring, time);
+
+	if (weston_spring_done(&fade->spring)) {
+		output_fade_set_level(fade, fade->spring.target);
+		loop = wl_display_get_event_loop(fade->compositor->wl_display);
+		fade->idle_done_source =
+			wl_event_loop_add_idle(loop, idle_output_fade_done,
+					       fade);
+		return;
+	}
+
+	if (fade->spring.current > 0.999)
+		level = 1.0f;
+	else if (fade->spring.current < 0.001)
+		level = 0.0f;
+	else
+		level = fade->spring.current;
+
+	output->set_fade_level(output, level);
+}
+
+/** Fade all outputs in the display pipeline
+ *
+ * Like weston_fade_run() on a black curtain covering all outputs, but
+ * the backend dims the outputs on the way to the monitor, so nothing needs
+ * to be composited. Levels go from 0.0 for black to 1.0 for the plain
+ * picture.
+ *
+ * When the fade is done, \c done is called and the outputs then go back to
+ * full level; a fade to black must cover the outputs by other means in
+ * the callback.
+ *
+ * \return NULL if some enabled output cannot fade this way, in which
+ * case no output is touched.
+ */
+WL_EXPORT struct weston_output_fade *
+weston_output_fade_run(struct weston_compositor *compositor,
+		       float start, float end,
+		       weston_output_fade_done_func_t done, void *data)
+{
+	struct weston_output_fade *fade;
+	struct weston_output_fade_output *fo;
+	struct weston_output *output;
+
+	if (wl_list_empty(&compositor->output_list))
+		return NULL;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (!output->set_fade_level ||
+		    !output->set_fade_level(output, start)) {
+			wl_list_for_each(output, &compositor->output_list, link) {
+				if (output->set_fade_level)
+					output->set_fade_level(output, 1.0f);
+			}
+			return NULL;
+		}
+	}
+
+	fade = xzalloc(sizeof *fade);
+	fade->compositor = compositor;
+	fade->done = done;
+	fade->data = data;
+	wl_list_init(&fade->output_list);
+
+	weston_spring_init(&fade->spring, 1000.0, start, end);
+	fade->spring.friction = 4000;
+	fade->spring.previous = start - (end - start) * 0.1;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		fo = xzalloc(sizeof *fo);
+		fo->fade = fade;
+		fo->output = output;
+		fo->animation.frame = output_fade_frame;
+		wl_list_insert(&output->animation_list, &fo->animation.link);
+		fo->output_destroy_listener.notify =
+			handle_output_fade_output_destroy;
+		wl_signal_add(&output->destroy_signal,
+			      &fo->output_destroy_listener);
+		wl_list_insert(&fade->output_list, &fo->link);
+
+		weston_output_schedule_repaint(output);
+	}
+
+	return fade;
+}
+
+WL_EXPORT void
+weston_output_fade_update(struct weston_output_fade *fade, float target)
+{
+	fade->spring.target = target;
+}
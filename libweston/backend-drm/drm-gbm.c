@@ -117,7 +117,22 @@ init_egl(struct drm_backend *b)
 	return 0;
 }
 
-static void drm_output_fini_cursor_egl(struct drm_output *output)
+/** Open a GBM device next to the Pixman renderer
+ *
+ * The renderer does not need it, but importing client buffers and
+ * allocating cursor buffers does, so without it all views would be
+ * composited.
+ */
+void
+init_pixman_gbm(struct drm_backend *b)
+{
+	b->gbm = create_gbm_device(b->drm->drm.fd);
+	if (!b->gbm)
+		weston_log("GBM unavailable, not using planes with Pixman\n");
+}
+
+void
+drm_output_fini_cursor_gbm(struct drm_output *output)
 {
 	unsigned int i;
 
@@ -127,11 +142,14 @@ static void drm_output_fini_cursor_egl(struct drm_output *output)
 			output->gbm_cursor_fb[i]->type = BUFFER_PIXMAN_DUMB;
 		drm_fb_unref(output->gbm_cursor_fb[i]);
 		output->gbm_cursor_fb[i] = NULL;
+		free(output->gbm_cursor_content[i]);
+		output->gbm_cursor_content[i] = NULL;
+		output->gbm_cursor_last_used[i] = 0;
 	}
 }
 
-static int
-drm_output_init_cursor_egl(struct drm_output *output, struct drm_backend *b)
+int
+drm_output_init_cursor_gbm(struct drm_output *output, struct drm_backend *b)
 {
 	struct drm_device *device = output->device;
 	unsigned int i;
@@ -173,12 +191,45 @@ drm_output_init_cursor_egl(struct drm_output *output, struct drm_backend *b)
 	return 0;
 
 err:
-	weston_log("cursor buffers unavailable, using gl cursors\n");
+	weston_log("cursor buffers unavailable, using renderer cursors\n");
 	device->cursors_are_broken = true;
-	drm_output_fini_cursor_egl(output);
+	drm_output_fini_cursor_gbm(output);
 	return -1;
 }
 
+/*
+ * When rendering on a different GPU than the one driving the output, the
+ * render device may pick a modifier from the scanout plane's list that the
+ * KMS device advertises but cannot actually import from that GPU. Probe
+ * with a throwaway buffer before committing the GBM surface to it.
+ */
+static bool
+drm_output_can_import_modifiers(struct gbm_device *gbm,
+				struct drm_output *output,
+				const uint64_t *modifiers,
+				unsigned int num_modifiers)
+{
+	struct weston_mode *mode = output->base.current_mode;
+	struct gbm_bo *bo;
+	struct drm_fb *fb;
+
+	bo = gbm_bo_create_with_modifiers(gbm, mode->width, mode->height,
+					  output->format->format,
+					  modifiers, num_modifiers);
+	if (!bo)
+		return false;
+
+	fb = drm_fb_get_from_bo(bo, output->device, false, BUFFER_CLIENT);
+	if (!fb) {
+		gbm_bo_destroy(bo);
+		return false;
+	}
+
+	drm_fb_unref(fb);
+
+	return true;
+}
+
 static void
 create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 {
@@ -187,6 +238,7 @@ create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 	struct weston_drm_format *fmt;
 	const uint64_t *modifiers;
 	unsigned int num_modifiers;
+	bool cross_device = gbm_device_get_fd(gbm) != output->device->drm.fd;
 
 	fmt = weston_drm_format_array_find_format(&plane->formats,
 						  output->format->format);
@@ -199,20 +251,32 @@ create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 
 	if (!weston_drm_format_has_modifier(fmt, DRM_FORMAT_MOD_INVALID)) {
 		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
-		output->gbm_surface =
-			gbm_surface_create_with_modifiers(gbm,
-							  mode->width, mode->height,
-							  output->format->format,
-							  modifiers, num_modifiers);
+		if (!cross_device ||
+		    drm_output_can_import_modifiers(gbm, output, modifiers,
+						    num_modifiers))
+			output->gbm_surface =
+				gbm_surface_create_with_modifiers(gbm,
+								  mode->width,
+								  mode->height,
+								  output->format->format,
+								  modifiers,
+								  num_modifiers);
 	}
 
+	if (!cross_device)
+		output->render_path = DRM_OUTPUT_RENDER_PATH_LOCAL;
+	else if (output->gbm_surface)
+		output->render_path = DRM_OUTPUT_RENDER_PATH_IMPORT;
+	else
+		output->render_path = DRM_OUTPUT_RENDER_PATH_IMPORT_LINEAR;
+
 	/*
 	 * If we cannot use modifiers to allocate the GBM surface and the GBM
 	 * device differs from the KMS display device (because we are rendering
 	 * on a different GPU), we have to use linear buffers to make sure that
 	 * the allocated GBM surface is correctly displayed on the KMS device.
 	 */
-	if (gbm_device_get_fd(gbm) != output->device->drm.fd)
+	if (cross_device)
 		output->gbm_bo_flags |= GBM_BO_USE_LINEAR;
 
 	/* We may allocate with no modifiers in the following situations:
@@ -268,7 +332,23 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 		return -1;
 	}
 
-	drm_output_init_cursor_egl(output, b);
+	drm_output_init_cursor_gbm(output, b);
+
+	switch (output->render_path) {
+	case DRM_OUTPUT_RENDER_PATH_LOCAL:
+		weston_log("Output %s: rendering directly on %s\n",
+			   output->base.name, output->device->drm.filename);
+		break;
+	case DRM_OUTPUT_RENDER_PATH_IMPORT:
+	case DRM_OUTPUT_RENDER_PATH_IMPORT_LINEAR:
+		weston_log("Output %s: rendering on %s, scanning out on %s "
+			   "through a %s dmabuf import\n",
+			   output->base.name, b->drm->drm.filename,
+			   output->device->drm.filename,
+			   output->render_path == DRM_OUTPUT_RENDER_PATH_IMPORT ?
+				"modifier" : "linear");
+		break;
+	}
 
 	return 0;
 }
@@ -290,7 +370,7 @@ drm_output_fini_egl(struct drm_output *output)
 	renderer->gl->output_destroy(&output->base);
 	gbm_surface_destroy(output->gbm_surface);
 	output->gbm_surface = NULL;
-	drm_output_fini_cursor_egl(output);
+	drm_output_fini_cursor_gbm(output);
 }
 
 struct drm_fb *
@@ -116,6 +116,9 @@
 
 #define MAX_CLONED_CONNECTORS 4
 
+/* Cursor fbs per output: one on screen, the others cache recent images */
+#define DRM_OUTPUT_CURSOR_FBS 4
+
 
 /**
  * Represents the values of an enum-type KMS property
@@ -147,6 +150,11 @@ struct drm_property_info {
 	struct drm_property_enum_info *enum_values; /**< array of enum values */
 	unsigned int num_range_values;
 	uint64_t range_values[2];
+
+	/** What the kernel has from our last real atomic commit, valid
+	 *  while committed_generation is drm_device::prop_generation */
+	uint64_t committed_value;
+	uint32_t committed_generation;
 };
 
 /**
@@ -168,6 +176,7 @@ enum try_view_on_plane_failure_reasons {
 	FAILURE_REASONS_NO_GBM = 1 << 11,
 	FAILURE_REASONS_GBM_BO_IMPORT_FAILED = 1 << 12,
 	FAILURE_REASONS_GBM_BO_GET_HANDLE_FAILED = 1 << 13,
+	FAILURE_REASONS_BUFFER_RELEASED = 1 << 14,
 };
 
 /**
@@ -207,6 +216,13 @@ struct drm_device {
 
 	bool state_invalid;
 
+	/* Unchanged properties are left out of atomic requests, see
+	 * drm_prop_unchanged(). Bumped to forget all committed values. */
+	uint32_t prop_generation;
+	/* struct drm_prop_record for the request being built */
+	struct wl_array atomic_props;
+	unsigned atomic_props_skipped;
+
 	bool atomic_modeset;
 
 	bool tearing_supported;
@@ -230,6 +246,14 @@ struct drm_device {
 	int min_width, max_width;
 	int min_height, max_height;
 
+	/* drm_fb_cache_entry::link, see drm_fb_get_from_paint_node() */
+	struct wl_list fb_cache_list;
+	struct wl_list fb_cache_idle_list;
+	unsigned int fb_cache_idle_count;
+
+	/* Latest hotplug uevent, until drm_backend::hotplug_timer fires */
+	struct udev_device *hotplug_event;
+
 	/* drm_backend::kms_list */
 	struct wl_list link;
 };
@@ -243,6 +267,7 @@ struct drm_backend {
 
 	struct udev_monitor *udev_monitor;
 	struct wl_event_source *udev_drm_source;
+	struct wl_event_source *hotplug_timer;
 
 	struct drm_device *drm;
 	/* drm_device::link */
@@ -252,6 +277,7 @@ struct drm_backend {
 	const struct pixel_format_info *format;
 
 	bool use_pixman_shadow;
+	bool offload_color_pipeline;
 
 	struct udev_input input;
 
@@ -306,10 +332,38 @@ struct drm_fb {
 	void *map;
 };
 
+/**
+ * KMS import of a dma-buf, shared by all wl_buffers wrapping the same
+ * dma-bufs. The key is everything up to fb.
+ */
+struct drm_fb_cache_entry {
+	uint32_t format;
+	uint64_t modifier;
+	uint32_t flags;
+	int32_t width, height;
+	int n_planes;
+	bool is_opaque;
+	struct {
+		dev_t dev;
+		ino_t ino;
+		uint32_t offset;
+		uint32_t stride;
+		int fd; /* dup, keeps the inode from being reused */
+	} planes[4];
+
+	struct drm_fb *fb; /* NULL if the import failed */
+	uint32_t failure_reasons;
+
+	struct drm_device *device; /* NULL once the cache was flushed */
+	int users; /* drm_buffer_fb using this entry */
+	struct wl_list link; /* drm_device::fb_cache_list or _idle_list */
+};
+
 struct drm_buffer_fb {
 	struct drm_fb *fb;
 	enum try_view_on_plane_failure_reasons failure_reasons;
 	struct drm_device *device;
+	struct drm_fb_cache_entry *cache_entry;
 	struct wl_list link;
 };
 
@@ -379,6 +433,9 @@ struct drm_plane_state {
 	uint64_t zpos;
 	uint16_t alpha;
 
+	enum wdrm_plane_color_encoding color_encoding;
+	enum wdrm_plane_color_range color_range;
+
 	bool complete;
 
 	/* We don't own the fd, so we shouldn't close it */
@@ -507,6 +564,7 @@ struct drm_head {
 
 	void *display_data;             /**< EDID or DisplayID blob */
 	size_t display_data_len;        /**< bytes */
+	uint32_t display_data_blob_id;  /**< KMS blob display_data came from */
 };
 
 struct drm_crtc {
@@ -522,6 +580,20 @@ struct drm_crtc {
 
 	/* Holds the properties for the CRTC */
 	struct drm_property_info props_crtc[WDRM_CRTC__COUNT];
+
+	/* Entries in DEGAMMA_LUT and GAMMA_LUT, 0 without the property */
+	uint32_t degamma_lut_size;
+	uint32_t gamma_lut_size;
+};
+
+/* How the GL renderer's output buffers reach the output's KMS device */
+enum drm_output_render_path {
+	/* The render device is the KMS device */
+	DRM_OUTPUT_RENDER_PATH_LOCAL = 0,
+	/* Cross-device dmabuf import with a modifier both devices support */
+	DRM_OUTPUT_RENDER_PATH_IMPORT,
+	/* Cross-device dmabuf import of linear buffers */
+	DRM_OUTPUT_RENDER_PATH_IMPORT_LINEAR,
 };
 
 struct drm_output {
@@ -540,8 +612,12 @@ struct drm_output {
 	bool dpms_off_pending;
 	bool mode_switch_pending;
 
-	uint32_t gbm_cursor_handle[2];
-	struct drm_fb *gbm_cursor_fb[2];
+	uint32_t gbm_cursor_handle[DRM_OUTPUT_CURSOR_FBS];
+	struct drm_fb *gbm_cursor_fb[DRM_OUTPUT_CURSOR_FBS];
+	/* copy of the image last uploaded to each fb, NULL if none yet */
+	uint32_t *gbm_cursor_content[DRM_OUTPUT_CURSOR_FBS];
+	uint64_t gbm_cursor_last_used[DRM_OUTPUT_CURSOR_FBS];
+	uint64_t cursor_use_seq;
 	struct drm_plane *cursor_plane;
 	struct weston_view *cursor_view;
 	struct wl_listener cursor_view_destroy_listener;
@@ -550,10 +626,25 @@ struct drm_output {
 	struct gbm_surface *gbm_surface;
 	const struct pixel_format_info *format;
 	uint32_t gbm_bo_flags;
+	enum drm_output_render_path render_path;
 
 	uint32_t hdr_output_metadata_blob_id;
 	uint64_t ackd_color_outcome_serial;
 
+	/* from_blend_to_output on the CRTC, see
+	 * drm_output_ensure_color_pipeline() */
+	uint32_t degamma_lut_blob_id;
+	uint32_t ctm_blob_id;
+	uint32_t gamma_lut_blob_id;
+	float *gamma_lut_values;
+	uint64_t color_pipeline_serial;
+
+	/* GAMMA_LUT scaled down for weston_output::set_fade_level, see
+	 * drm_output_ensure_fade_lut() */
+	float fade_level;
+	float fade_lut_level;
+	uint32_t fade_lut_blob_id;
+
 	unsigned max_bpc;
 	enum wdrm_colorspace connector_colorspace;
 
@@ -571,6 +662,8 @@ struct drm_output {
 
 	/* only set when a writeback screenshot is ongoing */
 	struct drm_writeback_state *wb_state;
+	/* writeback destination, kept for repeated captures */
+	struct drm_fb *wb_fb;
 
 	struct drm_fb *dumb[2];
 	struct weston_renderbuffer *renderbuffer[2];
@@ -580,13 +673,29 @@ struct drm_output {
 	struct wl_listener recorder_frame_listener;
 
 	struct wl_event_source *pageflip_timer;
+	/* Start of the repaint awaiting its flip, for the metrics */
+	struct timespec repaint_start;
 
 	bool is_virtual;
 	void (*virtual_destroy)(struct weston_output *base);
 
 	submit_frame_cb virtual_submit_frame;
+	/* Damage of the frame being submitted, in buffer coordinates */
+	pixman_region32_t virtual_damage;
 
 	enum wdrm_content_type content_type;
+	/* Follow weston_output::content_type, when not configured */
+	bool content_type_auto;
+
+	/* Last winning plane assignment, see drm_assign_planes() */
+	struct drm_plane_cache *plane_cache;
+
+	/* last composition fallback logged for a scanout-preferred view */
+	bool scanout_fallback_reported;
+	uint32_t scanout_fallback_reasons;
+
+	/* Acquire fence of a buffer held back from a plane */
+	struct wl_event_source *fence_source;
 };
 
 void
@@ -690,6 +799,18 @@ drm_paint_node_transform_supported(struct weston_paint_node *node, struct drm_pl
 	return true;
 }
 
+/* Whether the view must not be shown on this output: its content asks for
+ * more protection than the connectors currently provide. The core paints a
+ * solid placeholder in its place, the content itself is never sampled. */
+static inline bool
+drm_paint_node_is_censored(struct weston_paint_node *node)
+{
+	struct weston_surface *surface = node->view->surface;
+
+	return surface->protection_mode == WESTON_SURFACE_PROTECTION_MODE_ENFORCED &&
+	       surface->desired_protection > node->output->current_protection;
+}
+
 int
 drm_mode_ensure_blob(struct drm_device *device, struct drm_mode *mode);
 
@@ -778,6 +899,18 @@ drm_output_set_cursor_view(struct drm_output *output, struct weston_view *ev);
 int
 drm_output_ensure_hdr_output_metadata_blob(struct drm_output *output);
 
+void
+drm_output_ensure_color_pipeline(struct drm_output *output);
+
+void
+drm_output_destroy_color_pipeline(struct drm_output *output);
+
+bool
+drm_output_set_fade_level(struct weston_output *output_base, float level);
+
+void
+drm_output_ensure_fade_lut(struct drm_output *output);
+
 enum wdrm_colorspace
 wdrm_colorspace_from_output(struct weston_output *output);
 
@@ -789,6 +922,9 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 extern bool
 drm_can_scanout_dmabuf(struct weston_backend *backend,
 		       struct linux_dmabuf_buffer *dmabuf);
+
+void
+drm_fb_cache_flush(struct drm_device *device);
 #else
 static inline struct drm_fb *
 drm_fb_get_from_paint_node(struct drm_output_state *state,
@@ -802,6 +938,11 @@ drm_can_scanout_dmabuf(struct weston_backend *backend,
 {
 	return false;
 }
+
+static inline void
+drm_fb_cache_flush(struct drm_device *device)
+{
+}
 #endif
 
 struct drm_pending_state *
@@ -859,6 +1000,15 @@ drm_plane_reset_state(struct drm_plane *plane);
 void
 drm_assign_planes(struct weston_output *output_base);
 
+void
+drm_output_plane_cache_invalidate(struct drm_output *output);
+
+void
+drm_output_plane_cache_destroy(struct drm_output *output);
+
+void
+drm_output_fence_watch_fini(struct drm_output *output);
+
 bool
 drm_plane_is_available(struct drm_plane *plane, struct drm_output *output);
 
@@ -884,6 +1034,15 @@ drm_backend_init_virtual_output_api(struct weston_compositor *compositor)
 int
 init_egl(struct drm_backend *b);
 
+void
+init_pixman_gbm(struct drm_backend *b);
+
+int
+drm_output_init_cursor_gbm(struct drm_output *output, struct drm_backend *b);
+
+void
+drm_output_fini_cursor_gbm(struct drm_output *output);
+
 int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b);
 
@@ -901,6 +1060,22 @@ init_egl(struct drm_backend *b)
 	return -1;
 }
 
+inline static void
+init_pixman_gbm(struct drm_backend *b)
+{
+}
+
+inline static int
+drm_output_init_cursor_gbm(struct drm_output *output, struct drm_backend *b)
+{
+	return -1;
+}
+
+inline static void
+drm_output_fini_cursor_gbm(struct drm_output *output)
+{
+}
+
 inline static int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 {
@@ -56,6 +56,8 @@ enum wdrm_plane_property {
 	WDRM_PLANE_ZPOS,
 	WDRM_PLANE_ROTATION,
 	WDRM_PLANE_ALPHA,
+	WDRM_PLANE_COLOR_ENCODING,
+	WDRM_PLANE_COLOR_RANGE,
 	WDRM_PLANE__COUNT
 };
 
@@ -82,6 +84,25 @@ enum wdrm_plane_rotation {
 	WDRM_PLANE_ROTATION__COUNT,
 };
 
+/**
+ * Possible values for the WDRM_PLANE_COLOR_ENCODING property.
+ */
+enum wdrm_plane_color_encoding {
+	WDRM_PLANE_COLOR_ENCODING_BT601 = 0,
+	WDRM_PLANE_COLOR_ENCODING_BT709,
+	WDRM_PLANE_COLOR_ENCODING_BT2020,
+	WDRM_PLANE_COLOR_ENCODING__COUNT
+};
+
+/**
+ * Possible values for the WDRM_PLANE_COLOR_RANGE property.
+ */
+enum wdrm_plane_color_range {
+	WDRM_PLANE_COLOR_RANGE_LIMITED = 0,
+	WDRM_PLANE_COLOR_RANGE_FULL,
+	WDRM_PLANE_COLOR_RANGE__COUNT
+};
+
 /**
  * List of properties attached to a DRM connector
  */
@@ -279,6 +279,7 @@ drm_virtual_output_destroy(struct weston_output *base)
 	if (output->virtual_destroy)
 		output->virtual_destroy(base);
 
+	pixman_region32_fini(&output->virtual_damage);
 	free(output);
 }
 
@@ -372,6 +373,7 @@ drm_virtual_output_create(struct weston_compositor *c, char *name,
 
 	output->is_virtual = true;
 	output->virtual_destroy = destroy_func;
+	pixman_region32_init(&output->virtual_damage);
 	output->gbm_bo_flags = GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING;
 
 	weston_output_init(&output->base, c, name);
@@ -429,6 +431,14 @@ drm_virtual_output_buffer_released(struct drm_fb *fb)
 	drm_fb_unref(fb);
 }
 
+static const pixman_region32_t *
+drm_virtual_output_get_frame_damage(struct weston_output *output_base)
+{
+	struct drm_output *output = to_drm_output(output_base);
+
+	return &output->virtual_damage;
+}
+
 static void
 drm_virtual_output_finish_frame(struct weston_output *output_base,
 				struct timespec *stamp,
@@ -457,7 +467,8 @@ static const struct weston_drm_virtual_output_api virt_api = {
 	drm_virtual_output_set_submit_frame_cb,
 	drm_virtual_output_get_fence_fd,
 	drm_virtual_output_buffer_released,
-	drm_virtual_output_finish_frame
+	drm_virtual_output_finish_frame,
+	drm_virtual_output_get_frame_damage,
 };
 
 int drm_backend_init_virtual_output_api(struct weston_compositor *compositor)
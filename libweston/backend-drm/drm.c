@@ -39,6 +39,7 @@
 #include <linux/input.h>
 #include <linux/vt.h>
 #include <assert.h>
+#include <math.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <poll.h>
@@ -57,17 +58,20 @@
 #include "shared/timespec-util.h"
 #include "shared/string-helpers.h"
 #include "shared/weston-drm-fourcc.h"
+#include "shared/xalloc.h"
 #include "output-capture.h"
 #include "pixman-renderer.h"
 #include "pixel-formats.h"
 #include "libbacklight.h"
 #include "libinput-seat.h"
 #include "launcher-util.h"
+#include "metrics.h"
 #include "vaapi-recorder.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
+#include "linux-drm-syncobj.h"
 
 static const char default_seat[] = "seat0";
 
@@ -310,6 +314,16 @@ drm_output_update_complete(struct drm_output *output, uint32_t flags,
 	if (output->pageflip_timer)
 		wl_event_source_timer_update(output->pageflip_timer, 0);
 
+	if (!timespec_is_zero(&output->repaint_start) && (sec || usec)) {
+		ts.tv_sec = sec;
+		ts.tv_nsec = usec * 1000;
+		weston_metric_observe(device->backend->compositor,
+				      WESTON_METRIC_HIST_DRM_REPAINT_TO_FLIP_USEC,
+				      timespec_sub_to_nsec(&ts,
+							   &output->repaint_start));
+	}
+	output->repaint_start = (struct timespec) { 0 };
+
 	wl_list_for_each(ps, &output->state_cur->plane_list, link)
 		ps->complete = true;
 
@@ -407,6 +421,10 @@ drm_output_render(struct drm_output_state *state)
 
 	weston_output_flush_damage_for_primary_plane(&output->base, &damage);
 
+	if (output->is_virtual)
+		weston_region_global_to_output(&output->virtual_damage,
+					       &output->base, &damage);
+
 	/*
 	 * If we don't have any damage on the primary plane, and we already
 	 * have a renderer buffer active, we can reuse it; else we pass
@@ -615,11 +633,21 @@ drm_output_pick_writeback_capture_task(struct drm_output *output)
 		goto err;
 	}
 
-	output->wb_state->fb = drm_fb_create_dumb(output->device, width, height, format);
-	if (!output->wb_state->fb) {
+	/* Screencasts capture every frame; reuse the destination. */
+	if (output->wb_fb &&
+	    (output->wb_fb->width != width || output->wb_fb->height != height ||
+	     output->wb_fb->format->format != format)) {
+		drm_fb_unref(output->wb_fb);
+		output->wb_fb = NULL;
+	}
+	if (!output->wb_fb)
+		output->wb_fb = drm_fb_create_dumb(output->device, width,
+						   height, format);
+	if (!output->wb_fb) {
 		msg = "drm: failed to create dumb buffer for writeback state";
 		goto err_fb;
 	}
+	output->wb_state->fb = drm_fb_ref(output->wb_fb);
 
 	output->wb_state->output = output;
 	output->wb_state->wb = wb;
@@ -639,16 +667,23 @@ err:
 /**
  * Update the image for the current cursor surface
  *
- * @param plane_state DRM cursor plane state
+ * Picks the cursor fb to show next and makes it output->current_cursor.
+ * Cursors tend to cycle through a few shapes, so if one of the fbs still
+ * holds the new image it is scanned out again without an upload.
+ * Otherwise the least recently shown fb, which is never the one on
+ * screen, gets overwritten.
+ *
+ * @param output DRM output
  * @param ev Source view for cursor
  */
 static void
 cursor_bo_update(struct drm_output *output, struct weston_view *ev)
 {
 	struct drm_device *device = output->device;
-	struct gbm_bo *bo = output->gbm_cursor_fb[output->current_cursor]->bo;
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 	uint32_t buf[device->cursor_width * device->cursor_height];
+	unsigned int slot, j;
+	struct gbm_bo *bo;
 	uint8_t *s;
 	int i;
 
@@ -667,13 +702,44 @@ cursor_bo_update(struct drm_output *output, struct weston_view *ev)
 		       buffer->width * 4);
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 
+	for (j = 0; j < ARRAY_LENGTH(output->gbm_cursor_fb); j++) {
+		if (output->gbm_cursor_content[j] &&
+		    memcmp(output->gbm_cursor_content[j], buf, sizeof buf) == 0) {
+			output->current_cursor = j;
+			output->gbm_cursor_last_used[j] = ++output->cursor_use_seq;
+			return;
+		}
+	}
+
+	slot = (output->current_cursor + 1) % ARRAY_LENGTH(output->gbm_cursor_fb);
+	for (j = 0; j < ARRAY_LENGTH(output->gbm_cursor_fb); j++) {
+		if ((int) j == output->current_cursor)
+			continue;
+		if (output->gbm_cursor_last_used[j] <
+		    output->gbm_cursor_last_used[slot])
+			slot = j;
+	}
+
+	output->current_cursor = slot;
+	output->gbm_cursor_last_used[slot] = ++output->cursor_use_seq;
+
+	bo = output->gbm_cursor_fb[slot]->bo;
 	if (bo) {
-		if (gbm_bo_write(bo, buf, sizeof buf) < 0)
+		if (gbm_bo_write(bo, buf, sizeof buf) < 0) {
 			weston_log("failed update cursor: %s\n", strerror(errno));
+			free(output->gbm_cursor_content[slot]);
+			output->gbm_cursor_content[slot] = NULL;
+			return;
+		}
 	} else {
-		memcpy(output->gbm_cursor_fb[output->current_cursor]->map,
-		       buf, sizeof buf);
+		memcpy(output->gbm_cursor_fb[slot]->map, buf, sizeof buf);
 	}
+	weston_metric_inc(device->backend->compositor,
+			  WESTON_METRIC_DRM_CURSOR_UPLOADS);
+
+	if (!output->gbm_cursor_content[slot])
+		output->gbm_cursor_content[slot] = xmalloc(sizeof buf);
+	memcpy(output->gbm_cursor_content[slot], buf, sizeof buf);
 }
 #else
 static void
@@ -682,6 +748,80 @@ cursor_bo_update(struct drm_output *output, struct weston_view *ev)
 }
 #endif
 
+/*
+ * Damage on a plane showing a client buffer is what the client damaged.
+ * FB_DAMAGE_CLIPS are in framebuffer co-ordinates, so the paint node damage
+ * goes from global through output to buffer space. Without a blob the
+ * kernel takes the whole plane as damaged, which is what we leave it with
+ * whenever we are not sure.
+ */
+static void
+drm_plane_state_set_client_damage(struct drm_plane_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_device *device = output->device;
+	struct drm_plane *plane = state->plane;
+	struct weston_paint_node *pnode;
+	pixman_region32_t damage;
+	pixman_box32_t *boxes, *rects;
+	int32_t sx1, sy1, sx2, sy2;
+	int n_boxes, n_rects = 0;
+	int i;
+
+	assert(state->damage_blob_id == 0);
+
+	if (plane->props[WDRM_PLANE_FB_DAMAGE_CLIPS].prop_id == 0)
+		return;
+
+	/* A buffer kept while its fence is pending has nothing new yet;
+	 * keep its damage for the frame that shows the next one. */
+	if (!state->fb || state->fb == plane->state_cur->fb ||
+	    state->ev != plane->state_cur->ev)
+		return;
+
+	pnode = weston_view_find_paint_node(state->ev, &output->base);
+	if (!pnode)
+		return;
+
+	pixman_region32_init(&damage);
+	weston_output_flush_damage_for_plane(&output->base, &plane->base,
+					     &damage);
+	weston_region_global_to_output(&damage, &output->base, &damage);
+
+	sx1 = state->src_x >> 16;
+	sy1 = state->src_y >> 16;
+	sx2 = (state->src_x + state->src_w + 0xffff) >> 16;
+	sy2 = (state->src_y + state->src_h + 0xffff) >> 16;
+
+	boxes = pixman_region32_rectangles(&damage, &n_boxes);
+	rects = xcalloc(MAX(n_boxes, 1), sizeof *rects);
+	for (i = 0; i < n_boxes; i++) {
+		struct weston_coord c1, c2;
+		pixman_box32_t *r = &rects[n_rects];
+
+		c1 = weston_matrix_transform_coord(&pnode->output_to_buffer_matrix,
+						   weston_coord(boxes[i].x1, boxes[i].y1));
+		c2 = weston_matrix_transform_coord(&pnode->output_to_buffer_matrix,
+						   weston_coord(boxes[i].x2, boxes[i].y2));
+
+		r->x1 = MAX((int32_t) floor(MIN(c1.x, c2.x)), sx1);
+		r->y1 = MAX((int32_t) floor(MIN(c1.y, c2.y)), sy1);
+		r->x2 = MIN((int32_t) ceil(MAX(c1.x, c2.x)), sx2);
+		r->y2 = MIN((int32_t) ceil(MAX(c1.y, c2.y)), sy2);
+		if (r->x1 < r->x2 && r->y1 < r->y2)
+			n_rects++;
+	}
+
+	/* A new buffer without damage is odd, better redo it all. */
+	if (n_rects > 0)
+		drmModeCreatePropertyBlob(device->drm.fd, rects,
+					  sizeof(*rects) * n_rects,
+					  &state->damage_blob_id);
+
+	free(rects);
+	pixman_region32_fini(&damage);
+}
+
 static void
 drm_output_prepare_repaint(struct weston_output *output_base)
 {
@@ -697,6 +837,7 @@ drm_output_repaint(struct weston_output *output_base)
 	struct drm_output_state *state = NULL;
 	struct drm_plane_state *scanout_state;
 	struct drm_plane_state *cursor_state;
+	struct drm_plane_state *plane_state;
 	struct drm_pending_state *pending_state;
 	struct drm_device *device;
 
@@ -707,6 +848,9 @@ drm_output_repaint(struct weston_output *output_base)
 	pending_state = device->repaint_data;
 	assert(pending_state);
 
+	weston_compositor_read_presentation_clock(output_base->compositor,
+						  &output->repaint_start);
+
 	if (output->disable_pending || output->destroy_pending)
 		goto err;
 
@@ -735,11 +879,18 @@ drm_output_repaint(struct weston_output *output_base)
 						     &output->cursor_plane->base,
 						     &damage);
 		if (pixman_region32_not_empty(&damage)) {
-			output->current_cursor++;
-			output->current_cursor =
-				output->current_cursor %
-					ARRAY_LENGTH(output->gbm_cursor_fb);
+			struct weston_compositor *compositor =
+				output_base->compositor;
+			struct timespec start, end;
+
+			weston_compositor_read_presentation_clock(compositor,
+								  &start);
 			cursor_bo_update(output, output->cursor_view);
+			weston_compositor_read_presentation_clock(compositor,
+								  &end);
+			weston_metric_observe(compositor,
+					      WESTON_METRIC_HIST_DRM_CURSOR_UPDATE_USEC,
+					      timespec_sub_to_nsec(&end, &start));
 		}
 		pixman_region32_fini(&damage);
 
@@ -756,6 +907,10 @@ drm_output_repaint(struct weston_output *output_base)
 	if (drm_output_ensure_hdr_output_metadata_blob(output) < 0)
 		goto err;
 
+	drm_output_ensure_color_pipeline(output);
+	if (output->base.set_fade_level)
+		drm_output_ensure_fade_lut(output);
+
 	if (device->atomic_modeset)
 		drm_output_pick_writeback_capture_task(output);
 
@@ -765,6 +920,12 @@ drm_output_repaint(struct weston_output *output_base)
 	if (!scanout_state || !scanout_state->fb)
 		goto err;
 
+	/* Planes fed directly by clients, the renderer did its own above */
+	wl_list_for_each(plane_state, &state->plane_list, link) {
+		if (plane_state->ev && plane_state->plane != output->cursor_plane)
+			drm_plane_state_set_client_damage(plane_state);
+	}
+
 	return 0;
 
 err:
@@ -995,6 +1156,49 @@ drm_repaint_flush(struct weston_backend *backend)
 		drm_repaint_flush_device(device);
 }
 
+/**
+ * Commit a KMS device as soon as all of its outputs are repainted
+ *
+ * With several KMS devices, the outputs of each are committed separately
+ * anyway. Flushing a device right after its last output has been repainted
+ * lets its page flips get queued while outputs of the other devices are
+ * still being rendered, rather than after all of them.
+ */
+static void
+drm_repaint_output_done(struct weston_backend *backend,
+			struct weston_output *output_base)
+{
+	struct drm_backend *b = container_of(backend, struct drm_backend, base);
+	struct drm_output *output = to_drm_output(output_base);
+	struct drm_device *device;
+	struct weston_output *base;
+
+	/* A single device is flushed by drm_repaint_flush() right away. */
+	if (!output || wl_list_empty(&b->kms_list))
+		return;
+
+	device = output->device;
+	if (!device->repaint_data)
+		return;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		struct drm_output *tmp = to_drm_output(base);
+
+		if (tmp && tmp->device == device &&
+		    base->will_repaint && !base->repainted)
+			return;
+	}
+
+	drm_repaint_flush_device(device);
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		struct drm_output *tmp = to_drm_output(base);
+
+		if (tmp && tmp->device == device && base->repainted)
+			weston_output_repaint_flushed(base);
+	}
+}
+
 static void
 drm_repaint_cancel_device(struct drm_device *device)
 {
@@ -1025,7 +1229,7 @@ drm_repaint_cancel(struct weston_backend *backend)
 	drm_repaint_cancel_device(b->drm);
 
 	wl_list_for_each(device, &b->kms_list, link)
-		drm_repaint_cancel_device(b->drm);
+		drm_repaint_cancel_device(device);
 }
 
 static int
@@ -1079,6 +1283,7 @@ drm_output_apply_mode(struct drm_output *output)
 	 *      content.
 	 */
 	device->state_invalid = true;
+	drm_output_plane_cache_invalidate(output);
 
 	fb_size.width = output->base.current_mode->width;
 	fb_size.height = output->base.current_mode->height;
@@ -1114,8 +1319,13 @@ drm_output_apply_mode(struct drm_output *output)
 static int
 init_pixman(struct drm_backend *b)
 {
-	return weston_compositor_init_renderer(b->compositor,
-					       WESTON_RENDERER_PIXMAN, NULL);
+	if (weston_compositor_init_renderer(b->compositor,
+					    WESTON_RENDERER_PIXMAN, NULL) < 0)
+		return -1;
+
+	init_pixman_gbm(b);
+
+	return 0;
 }
 
 /**
@@ -1628,6 +1838,9 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 					  output->base.height);
 	}
 
+	if (b->gbm)
+		drm_output_init_cursor_gbm(output, b);
+
 	weston_log("DRM: output %s %s shadow framebuffer.\n", output->base.name,
 		   b->use_pixman_shadow ? "uses" : "does not use");
 
@@ -1671,6 +1884,7 @@ drm_output_fini_pixman(struct drm_output *output)
 	}
 
 	renderer->pixman->output_destroy(&output->base);
+	drm_output_fini_cursor_gbm(output);
 }
 
 static void
@@ -1845,8 +2059,11 @@ drm_output_set_content_type(struct weston_output *base,
 	unsigned int i;
 	struct drm_output *output = to_drm_output(base);
 
+	output->content_type_auto = false;
+
 	if (content_type == NULL) {
 		output->content_type = WDRM_CONTENT_TYPE_NO_DATA;
+		output->content_type_auto = true;
 		return 0;
 	}
 
@@ -2024,6 +2241,14 @@ drm_crtc_create(struct drm_device *device, uint32_t crtc_id, uint32_t pipe)
 
 	drm_property_info_populate(device, crtc_props, crtc->props_crtc,
 				   WDRM_CRTC__COUNT, props);
+	if (crtc->props_crtc[WDRM_CRTC_DEGAMMA_LUT].prop_id)
+		crtc->degamma_lut_size =
+			drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_DEGAMMA_LUT_SIZE],
+					       props, 0);
+	if (crtc->props_crtc[WDRM_CRTC_GAMMA_LUT].prop_id)
+		crtc->gamma_lut_size =
+			drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_GAMMA_LUT_SIZE],
+					       props, 0);
 	crtc->device = device;
 	crtc->crtc_id = crtc_id;
 	crtc->pipe = pipe;
@@ -2331,6 +2556,9 @@ drm_output_enable(struct weston_output *base)
 	if (b->pageflip_timeout)
 		drm_output_pageflip_timer_create(output);
 
+	/* Before the renderer decides whether it needs a shadow buffer */
+	drm_output_ensure_color_pipeline(output);
+
 	if (b->compositor->renderer->type == WESTON_RENDERER_PIXMAN) {
 		if (drm_output_init_pixman(output, b) < 0) {
 			weston_log("Failed to init output pixman state\n");
@@ -2350,12 +2578,17 @@ drm_output_enable(struct weston_output *base)
 	output->base.set_dpms = drm_set_dpms;
 	output->base.switch_mode = drm_output_switch_mode;
 	output->base.set_gamma = drm_output_set_gamma;
+	output->base.set_fade_level = drm_output_set_fade_level;
+	output->fade_level = 1.0f;
 
-	if (device->atomic_modeset)
+	if (device->atomic_modeset) {
 		weston_output_update_capture_info(base, WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK,
 						  base->current_mode->width,
 						  base->current_mode->height,
 						  pixel_format_get_info(output->format->format));
+		weston_output_capture_framebuffer_via_writeback(base,
+			drm_output_find_compatible_writeback(output) != NULL);
+	}
 
 	weston_log("Output %s (crtc %d) video modes:\n",
 		   output->base.name, output->crtc->crtc_id);
@@ -2364,6 +2597,7 @@ drm_output_enable(struct weston_output *base)
 	return 0;
 
 err_planes:
+	drm_output_destroy_color_pipeline(output);
 	drm_output_deinit_planes(output);
 err_crtc:
 	drm_output_detach_crtc(output);
@@ -2389,14 +2623,20 @@ drm_output_deinit(struct weston_output *base)
 	else
 		drm_output_fini_egl(output);
 
+	drm_output_fence_watch_fini(output);
 	drm_output_deinit_planes(output);
 	drm_output_detach_crtc(output);
 
+	drm_fb_unref(output->wb_fb);
+	output->wb_fb = NULL;
+
 	if (output->hdr_output_metadata_blob_id) {
 		drmModeDestroyPropertyBlob(device->drm.fd,
 					   output->hdr_output_metadata_blob_id);
 		output->hdr_output_metadata_blob_id = 0;
 	}
+
+	drm_output_destroy_color_pipeline(output);
 }
 
 void
@@ -2438,6 +2678,7 @@ drm_output_destroy(struct weston_output *base)
 
 	assert(!output->state_last);
 	drm_output_state_free(output->state_cur);
+	drm_output_plane_cache_destroy(output);
 
 	assert(output->hdr_output_metadata_blob_id == 0);
 
@@ -3367,6 +3608,56 @@ udev_event_is_conn_prop_change(struct drm_backend *b,
 	return 1;
 }
 
+/* Docks and KVMs tend to send bursts of hotplug uevents; re-probe the
+ * connectors only once things have been quiet for this long. */
+#define DRM_HOTPLUG_SETTLE_MS 50
+
+static void
+drm_device_queue_hotplug(struct drm_device *device, struct udev_device *event)
+{
+	struct drm_backend *b = device->backend;
+
+	if (device->hotplug_event)
+		udev_device_unref(device->hotplug_event);
+	device->hotplug_event = udev_device_ref(event);
+
+	wl_event_source_timer_update(b->hotplug_timer, DRM_HOTPLUG_SETTLE_MS);
+}
+
+static void
+drm_device_handle_hotplug(struct drm_device *device)
+{
+	if (!device->hotplug_event)
+		return;
+
+	drm_backend_update_connectors(device, device->hotplug_event);
+	udev_device_unref(device->hotplug_event);
+	device->hotplug_event = NULL;
+}
+
+static void
+drm_device_drop_hotplug(struct drm_device *device)
+{
+	if (!device->hotplug_event)
+		return;
+
+	udev_device_unref(device->hotplug_event);
+	device->hotplug_event = NULL;
+}
+
+static int
+drm_backend_hotplug_timeout(void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_device *device;
+
+	drm_device_handle_hotplug(b->drm);
+	wl_list_for_each(device, &b->kms_list, link)
+		drm_device_handle_hotplug(device);
+
+	return 0;
+}
+
 static int
 udev_drm_event(int fd, uint32_t mask, void *data)
 {
@@ -3381,7 +3672,7 @@ udev_drm_event(int fd, uint32_t mask, void *data)
 		if (udev_event_is_conn_prop_change(b, event, &conn_id, &prop_id))
 			drm_backend_update_conn_props(b, b->drm, conn_id, prop_id);
 		else
-			drm_backend_update_connectors(b->drm, event);
+			drm_device_queue_hotplug(b->drm, event);
 	}
 
 	wl_list_for_each(device, &b->kms_list, link) {
@@ -3389,7 +3680,7 @@ udev_drm_event(int fd, uint32_t mask, void *data)
 			if (udev_event_is_conn_prop_change(b, event, &conn_id, &prop_id))
 				drm_backend_update_conn_props(b, device, conn_id, prop_id);
 			else
-				drm_backend_update_connectors(device, event);
+				drm_device_queue_hotplug(device, event);
 		}
 	}
 
@@ -3405,12 +3696,18 @@ drm_shutdown(struct weston_backend *backend)
 	struct weston_compositor *ec = b->compositor;
 	struct weston_output *output_base;
 	struct drm_output *output;
+	struct drm_device *device;
 
 	udev_input_destroy(&b->input);
 
+	wl_event_source_remove(b->hotplug_timer);
 	wl_event_source_remove(b->udev_drm_source);
 	wl_event_source_remove(b->drm_source);
 
+	drm_device_drop_hotplug(b->drm);
+	wl_list_for_each(device, &b->kms_list, link)
+		drm_device_drop_hotplug(device);
+
 	/* We are shutting down. This function destroy the planes with
 	 * destroy_sprites() and then calls weston_compositor_shutdown(), which
 	 * will lead to calls to drm_output_destroy(). We are destroying the
@@ -3451,6 +3748,7 @@ drm_destroy(struct weston_backend *backend)
 	struct drm_backend *b = container_of(backend, struct drm_backend, base);
 	struct weston_compositor *ec = b->compositor;
 	struct drm_device *device = b->drm;
+	struct drm_device *kms_device;
 	struct weston_head *base, *next;
 	struct drm_crtc *crtc, *crtc_tmp;
 	struct drm_writeback *writeback, *writeback_tmp;
@@ -3469,6 +3767,12 @@ drm_destroy(struct weston_backend *backend)
 			      &b->drm->writeback_connector_list, link)
 		drm_writeback_destroy(writeback);
 
+	drm_fb_cache_flush(b->drm);
+	wl_list_for_each(kms_device, &b->kms_list, link) {
+		drm_fb_cache_flush(kms_device);
+		wl_array_release(&kms_device->atomic_props);
+	}
+
 #ifdef BUILD_DRM_GBM
 	if (b->gbm)
 		gbm_device_destroy(b->gbm);
@@ -3482,6 +3786,7 @@ drm_destroy(struct weston_backend *backend)
 
 	hash_table_destroy(device->gem_handle_refcnt);
 
+	wl_array_release(&device->atomic_props);
 	free(device->drm.filename);
 	free(device);
 	free(b);
@@ -3875,6 +4180,8 @@ drm_device_create(struct drm_backend *backend, const char *name)
 	device->drm.fd = -1;
 	device->backend = backend;
 	device->gem_handle_refcnt = hash_table_create();
+	wl_list_init(&device->fb_cache_list);
+	wl_list_init(&device->fb_cache_idle_list);
 
 	udev_device = open_specific_drm_device(backend, device, name);
 	if (!udev_device) {
@@ -3989,6 +4296,8 @@ drm_backend_create(struct weston_compositor *compositor,
 	device->gem_handle_refcnt = hash_table_create();
 	if (!device->gem_handle_refcnt)
 		goto err_device;
+	wl_list_init(&device->fb_cache_list);
+	wl_list_init(&device->fb_cache_idle_list);
 
 	b->drm = device;
 	wl_list_init(&b->kms_list);
@@ -3996,6 +4305,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	b->compositor = compositor;
 	b->pageflip_timeout = config->pageflip_timeout;
 	b->use_pixman_shadow = config->use_pixman_shadow;
+	b->offload_color_pipeline = config->offload_color_pipeline;
 	b->has_underlay = false;
 
 	b->debug = weston_compositor_add_log_scope(compositor, "drm-backend",
@@ -4074,6 +4384,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	b->base.destroy = drm_destroy;
 	b->base.repaint_begin = drm_repaint_begin;
 	b->base.repaint_flush = drm_repaint_flush;
+	b->base.repaint_output_done = drm_repaint_output_done;
 	b->base.repaint_cancel = drm_repaint_cancel;
 	b->base.create_output = drm_output_create;
 	b->base.device_changed = drm_device_changed;
@@ -4098,7 +4409,9 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	if (udev_input_init(&b->input,
 			    compositor, b->udev, seat_id,
-			    config->configure_device) < 0) {
+			    config->configure_device,
+			    config->input_thread,
+			    config->input_shard_seats) < 0) {
 		weston_log("failed to create input devices\n");
 		goto err_sprite;
 	}
@@ -4135,6 +4448,8 @@ drm_backend_create(struct weston_compositor *compositor,
 		wl_event_loop_add_fd(loop,
 				     udev_monitor_get_fd(b->udev_monitor),
 				     WL_EVENT_READABLE, udev_drm_event, b);
+	b->hotplug_timer =
+		wl_event_loop_add_timer(loop, drm_backend_hotplug_timeout, b);
 
 	if (udev_monitor_enable_receiving(b->udev_monitor) < 0) {
 		weston_log("failed to enable udev-monitor receiving\n");
@@ -4178,6 +4493,9 @@ drm_backend_create(struct weston_compositor *compositor,
 		if (linux_explicit_synchronization_setup(compositor) < 0)
 			weston_log("Error: initializing explicit "
 				   " synchronization support failed.\n");
+		if (linux_drm_syncobj_setup(compositor, b->drm->drm.fd) < 0)
+			weston_log("Error: initializing DRM syncobj "
+				   "synchronization support failed.\n");
 	}
 
 	if (device->atomic_modeset)
@@ -4202,6 +4520,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	return b;
 
 err_udev_monitor:
+	wl_event_source_remove(b->hotplug_timer);
 	wl_event_source_remove(b->udev_drm_source);
 	udev_monitor_unref(b->udev_monitor);
 err_drm_source:
@@ -29,7 +29,11 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -344,9 +348,16 @@ static void
 drm_fb_destroy_gbm(struct gbm_bo *bo, void *data)
 {
 	struct drm_fb *fb = data;
+	int i;
 
 	assert(fb->type == BUFFER_GBM_SURFACE || fb->type == BUFFER_CLIENT ||
 	       fb->type == BUFFER_CURSOR);
+
+	/* Handles imported into a secondary scanout device are ours. */
+	for (i = 0; i < 4; i++)
+		if (fb->scanout_device && fb->handles[i] != 0)
+			gem_handle_put(fb->scanout_device, fb->handles[i]);
+
 	drm_fb_destroy(fb);
 }
 
@@ -612,6 +623,193 @@ drm_can_scanout_dmabuf(struct weston_backend *backend,
 	return ret;
 }
 
+/* Idle cache entries kept around for clients which re-create wl_buffers
+ * from the same dma-bufs. Each one pins its dma-buf. */
+#define DRM_FB_CACHE_IDLE_MAX 8
+
+static void
+drm_fb_cache_entry_destroy(struct drm_fb_cache_entry *entry)
+{
+	int i;
+
+	wl_list_remove(&entry->link);
+	drm_fb_unref(entry->fb);
+	for (i = 0; i < entry->n_planes; i++)
+		close(entry->planes[i].fd);
+	free(entry);
+}
+
+static bool
+drm_fb_cache_entry_matches(const struct drm_fb_cache_entry *entry,
+			   const struct drm_fb_cache_entry *key)
+{
+	int i;
+
+	if (entry->format != key->format ||
+	    entry->modifier != key->modifier ||
+	    entry->flags != key->flags ||
+	    entry->width != key->width ||
+	    entry->height != key->height ||
+	    entry->n_planes != key->n_planes ||
+	    entry->is_opaque != key->is_opaque)
+		return false;
+
+	for (i = 0; i < key->n_planes; i++) {
+		if (entry->planes[i].dev != key->planes[i].dev ||
+		    entry->planes[i].ino != key->planes[i].ino ||
+		    entry->planes[i].offset != key->planes[i].offset ||
+		    entry->planes[i].stride != key->planes[i].stride)
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+drm_fb_cache_key_from_dmabuf(struct drm_fb_cache_entry *key,
+			     struct linux_dmabuf_buffer *dmabuf, bool is_opaque)
+{
+	const struct dmabuf_attributes *attr = &dmabuf->attributes;
+	struct stat st;
+	int i;
+
+	memset(key, 0, sizeof(*key));
+	key->format = attr->format;
+	key->modifier = attr->modifier;
+	key->flags = attr->flags;
+	key->width = attr->width;
+	key->height = attr->height;
+	key->n_planes = attr->n_planes;
+	key->is_opaque = is_opaque;
+
+	for (i = 0; i < attr->n_planes; i++) {
+		if (fstat(attr->fd[i], &st) < 0)
+			return false;
+		key->planes[i].dev = st.st_dev;
+		key->planes[i].ino = st.st_ino;
+		key->planes[i].offset = attr->offset[i];
+		key->planes[i].stride = attr->stride[i];
+		key->planes[i].fd = -1;
+	}
+
+	return true;
+}
+
+/** Look up the KMS import of a dma-buf, by identity of its file descriptions
+ *
+ * Clients may wrap the same dma-bufs into new wl_buffers, which would
+ * otherwise repeat the GBM import and AddFB2 each time, and forget that the
+ * buffer cannot be scanned out. The returned entry is in use until
+ * drm_fb_cache_entry_release(); on a miss the caller fills it in.
+ */
+static struct drm_fb_cache_entry *
+drm_fb_cache_lookup(struct drm_device *device,
+		    struct linux_dmabuf_buffer *dmabuf, bool is_opaque,
+		    bool *hit)
+{
+	struct drm_backend *b = device->backend;
+	struct drm_fb_cache_entry key, *entry;
+	int i;
+
+	*hit = false;
+	if (!drm_fb_cache_key_from_dmabuf(&key, dmabuf, is_opaque))
+		return NULL;
+
+	wl_list_for_each(entry, &device->fb_cache_list, link) {
+		if (drm_fb_cache_entry_matches(entry, &key)) {
+			entry->users++;
+			*hit = true;
+			return entry;
+		}
+	}
+
+	wl_list_for_each(entry, &device->fb_cache_idle_list, link) {
+		if (drm_fb_cache_entry_matches(entry, &key)) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&device->fb_cache_list, &entry->link);
+			device->fb_cache_idle_count--;
+			entry->users = 1;
+			*hit = true;
+			drm_debug(b, "\t\t\t[view] reusing KMS import of "
+				     "dmabuf %p\n", dmabuf);
+			return entry;
+		}
+	}
+
+	entry = xmalloc(sizeof(*entry));
+	*entry = key;
+	wl_list_init(&entry->link);
+
+	/* Hold on to the dma-bufs, so that their inodes can't be recycled
+	 * for another buffer while the entry exists. */
+	for (i = 0; i < entry->n_planes; i++) {
+		entry->planes[i].fd = fcntl(dmabuf->attributes.fd[i],
+					    F_DUPFD_CLOEXEC, 0);
+		if (entry->planes[i].fd < 0) {
+			entry->n_planes = i;
+			drm_fb_cache_entry_destroy(entry);
+			return NULL;
+		}
+	}
+
+	entry->device = device;
+	entry->users = 1;
+	wl_list_insert(&device->fb_cache_list, &entry->link);
+
+	return entry;
+}
+
+static void
+drm_fb_cache_entry_release(struct drm_fb_cache_entry *entry)
+{
+	struct drm_device *device = entry->device;
+	struct drm_fb_cache_entry *oldest;
+
+	assert(entry->users > 0);
+	if (--entry->users > 0)
+		return;
+
+	/* The cache was flushed while the buffer was alive. */
+	if (!device) {
+		drm_fb_cache_entry_destroy(entry);
+		return;
+	}
+
+	wl_list_remove(&entry->link);
+	wl_list_insert(&device->fb_cache_idle_list, &entry->link);
+	device->fb_cache_idle_count++;
+
+	if (device->fb_cache_idle_count > DRM_FB_CACHE_IDLE_MAX) {
+		oldest = wl_container_of(device->fb_cache_idle_list.prev,
+					 oldest, link);
+		drm_fb_cache_entry_destroy(oldest);
+		device->fb_cache_idle_count--;
+	}
+}
+
+/** Drop all cached dma-buf imports of a device
+ *
+ * Must be called before the GBM device goes away. Entries still used by a
+ * live buffer only lose their FB, and are freed along with the buffer.
+ */
+void
+drm_fb_cache_flush(struct drm_device *device)
+{
+	struct drm_fb_cache_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &device->fb_cache_idle_list, link)
+		drm_fb_cache_entry_destroy(entry);
+	device->fb_cache_idle_count = 0;
+
+	wl_list_for_each_safe(entry, tmp, &device->fb_cache_list, link) {
+		drm_fb_unref(entry->fb);
+		entry->fb = NULL;
+		entry->device = NULL;
+		wl_list_remove(&entry->link);
+		wl_list_init(&entry->link);
+	}
+}
+
 static bool
 drm_fb_compatible_with_plane(struct drm_fb *fb, struct drm_plane *plane,
 			     struct weston_view *view)
@@ -665,6 +863,8 @@ drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 			       buf_fb->fb->type == BUFFER_DMABUF);
 			drm_fb_unref(buf_fb->fb);
 		}
+		if (buf_fb->cache_entry)
+			drm_fb_cache_entry_release(buf_fb->cache_entry);
 		wl_list_remove(&buf_fb->link);
 		free(buf_fb);
 	}
@@ -687,8 +887,7 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 	struct drm_fb *fb;
 	struct drm_plane *plane;
 
-	if (ev->surface->protection_mode == WESTON_SURFACE_PROTECTION_MODE_ENFORCED &&
-	    ev->surface->desired_protection > output->base.current_protection) {
+	if (drm_paint_node_is_censored(pnode)) {
 		pnode->try_view_on_plane_failure_reasons |=
 			FAILURE_REASONS_INADEQUATE_CONTENT_PROTECTION;
 		return NULL;
@@ -727,10 +926,27 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 	}
 
 	if (buffer->type == WESTON_BUFFER_DMABUF) {
+		struct drm_fb_cache_entry *entry;
+		bool hit;
+
+		entry = drm_fb_cache_lookup(device, buffer->dmabuf, is_opaque,
+					    &hit);
+		buf_fb->cache_entry = entry;
+		if (entry && hit) {
+			buf_fb->failure_reasons = entry->failure_reasons;
+			if (!entry->fb)
+				goto unsuitable;
+			buf_fb->fb = drm_fb_ref(entry->fb);
+			return drm_fb_ref(entry->fb);
+		}
+
 		fb = drm_fb_get_from_dmabuf(buffer->dmabuf, device, is_opaque,
 					    &buf_fb->failure_reasons);
-		if (!fb)
+		if (!fb) {
+			if (entry)
+				entry->failure_reasons = buf_fb->failure_reasons;
 			goto unsuitable;
+		}
 	} else if (buffer->type == WESTON_BUFFER_RENDERER_OPAQUE) {
 		struct gbm_bo *bo;
 
@@ -764,12 +980,18 @@ drm_fb_get_from_paint_node(struct drm_output_state *state,
 	if (fb->plane_mask == 0) {
 		drm_fb_unref(fb);
 		buf_fb->failure_reasons |= FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
+		if (buf_fb->cache_entry)
+			buf_fb->cache_entry->failure_reasons =
+				buf_fb->failure_reasons;
 		goto unsuitable;
 	}
 
 	/* The caller holds its own ref to the drm_fb, so when creating a new
-	 * drm_fb we take an additional ref for the weston_buffer's cache. */
+	 * drm_fb we take an additional ref for the weston_buffer's cache,
+	 * and one for the device's dma-buf cache. */
 	buf_fb->fb = drm_fb_ref(fb);
+	if (buf_fb->cache_entry)
+		buf_fb->cache_entry->fb = drm_fb_ref(fb);
 
 	drm_debug(b, "\t\t\t[view] view %p format: %s\n",
 		  ev, fb->format->drm_format_name);
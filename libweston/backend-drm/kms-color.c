@@ -32,6 +32,8 @@
 #include <math.h>
 
 #include "drm-internal.h"
+#include "color.h"
+#include "shared/xalloc.h"
 
 static inline uint16_t
 color_xy_to_u16(float v)
@@ -193,3 +195,304 @@ wdrm_colorspace_from_output(struct weston_output *output)
 
 	return cm->wdrm;
 }
+
+static uint16_t
+lut_value_to_u16(float v)
+{
+	return lroundf(fminf(fmaxf(v, 0.0f), 1.0f) * 0xffff);
+}
+
+/* KMS CTM entries are S31.32 sign-magnitude */
+static uint64_t
+ctm_value_from_float(float v)
+{
+	uint64_t mag = llroundf(fabsf(v) * (float)(1ull << 32));
+
+	return v < 0.0f ? mag | (1ull << 63) : mag;
+}
+
+static int
+create_lut_blob(struct drm_device *device, const float *values, uint32_t len,
+		uint32_t *blob_id)
+{
+	struct drm_color_lut *lut;
+	uint32_t i;
+	int ret;
+
+	lut = xcalloc(len, sizeof *lut);
+	for (i = 0; i < len; i++) {
+		lut[i].red = lut_value_to_u16(values[i]);
+		lut[i].green = lut_value_to_u16(values[len + i]);
+		lut[i].blue = lut_value_to_u16(values[2 * len + i]);
+	}
+
+	ret = drmModeCreatePropertyBlob(device->drm.fd, lut,
+					len * sizeof *lut, blob_id);
+	free(lut);
+
+	return ret;
+}
+
+/* The LUT values are handed back in keep_values if that is not NULL. */
+static int
+create_curve_blob(struct drm_device *device,
+		  struct weston_color_transform *xform,
+		  const struct weston_color_curve *curve, uint32_t len,
+		  uint32_t *blob_id, float **keep_values)
+{
+	float *values;
+	int ret = -ENOMEM;
+
+	values = xcalloc(3 * len, sizeof *values);
+	if (weston_color_curve_to_3x1d(xform, curve, values, len))
+		ret = create_lut_blob(device, values, len, blob_id);
+
+	if (ret == 0 && keep_values)
+		*keep_values = values;
+	else
+		free(values);
+
+	return ret;
+}
+
+static int
+create_separable_blob(struct drm_device *device,
+		      struct weston_color_transform *xform, uint32_t len,
+		      uint32_t *blob_id, float **keep_values)
+{
+	float *values;
+	int ret = -ENOMEM;
+
+	values = xcalloc(3 * len, sizeof *values);
+	if (weston_color_transform_to_3x1d(xform, values, len))
+		ret = create_lut_blob(device, values, len, blob_id);
+
+	if (ret == 0 && keep_values)
+		*keep_values = values;
+	else
+		free(values);
+
+	return ret;
+}
+
+static int
+create_ctm_blob(struct drm_device *device,
+		const struct weston_color_mapping_matrix *mat,
+		uint32_t *blob_id)
+{
+	struct drm_color_ctm ctm;
+	int row, col;
+
+	/* weston matrices are column major, the CTM is row major */
+	for (row = 0; row < 3; row++) {
+		for (col = 0; col < 3; col++)
+			ctm.matrix[row * 3 + col] =
+				ctm_value_from_float(mat->matrix[col * 3 + row]);
+	}
+
+	return drmModeCreatePropertyBlob(device->drm.fd, &ctm, sizeof ctm,
+					 blob_id);
+}
+
+void
+drm_output_destroy_color_pipeline(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+
+	if (output->degamma_lut_blob_id)
+		drmModeDestroyPropertyBlob(device->drm.fd,
+					   output->degamma_lut_blob_id);
+	if (output->ctm_blob_id)
+		drmModeDestroyPropertyBlob(device->drm.fd, output->ctm_blob_id);
+	if (output->gamma_lut_blob_id)
+		drmModeDestroyPropertyBlob(device->drm.fd,
+					   output->gamma_lut_blob_id);
+	/* Derived from GAMMA_LUT */
+	if (output->fade_lut_blob_id)
+		drmModeDestroyPropertyBlob(device->drm.fd,
+					   output->fade_lut_blob_id);
+	free(output->gamma_lut_values);
+
+	output->degamma_lut_blob_id = 0;
+	output->ctm_blob_id = 0;
+	output->gamma_lut_blob_id = 0;
+	output->gamma_lut_values = NULL;
+	output->fade_lut_blob_id = 0;
+	output->color_pipeline_serial = 0;
+}
+
+static bool
+color_curve_is_identity(const struct weston_color_curve *curve)
+{
+	return curve->type == WESTON_COLOR_CURVE_TYPE_IDENTITY;
+}
+
+/* The CRTC applies DEGAMMA_LUT, then CTM, then GAMMA_LUT. A transformation
+ * without a color mapping step needs only GAMMA_LUT, as both of its curves
+ * fold into one. */
+static int
+drm_output_create_color_pipeline(struct drm_output *output,
+				 struct weston_color_transform *xform)
+{
+	struct drm_device *device = output->device;
+	struct drm_crtc *crtc = output->crtc;
+	int ret = 0;
+
+	switch (xform->mapping.type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		if (crtc->gamma_lut_size < 2)
+			return -ENOTSUP;
+
+		return create_separable_blob(device, xform,
+					     crtc->gamma_lut_size,
+					     &output->gamma_lut_blob_id,
+					     &output->gamma_lut_values);
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		return -ENOTSUP;
+	}
+
+	if (!crtc->props_crtc[WDRM_CRTC_CTM].prop_id ||
+	    (!color_curve_is_identity(&xform->pre_curve) &&
+	     crtc->degamma_lut_size < 2) ||
+	    (!color_curve_is_identity(&xform->post_curve) &&
+	     crtc->gamma_lut_size < 2))
+		return -ENOTSUP;
+
+	if (!color_curve_is_identity(&xform->pre_curve))
+		ret = create_curve_blob(device, xform, &xform->pre_curve,
+					crtc->degamma_lut_size,
+					&output->degamma_lut_blob_id, NULL);
+	if (ret == 0)
+		ret = create_ctm_blob(device, &xform->mapping.u.mat,
+				      &output->ctm_blob_id);
+	if (ret == 0 && !color_curve_is_identity(&xform->post_curve))
+		ret = create_curve_blob(device, xform, &xform->post_curve,
+					crtc->gamma_lut_size,
+					&output->gamma_lut_blob_id,
+					&output->gamma_lut_values);
+
+	return ret;
+}
+
+/** Put the output's blending to output color transformation on the CRTC
+ *
+ * Called whenever the color outcome of the output may have changed, and
+ * before the renderer state of the output is created, as the renderer
+ * then skips its own blending to output pass.
+ */
+void
+drm_output_ensure_color_pipeline(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	struct drm_backend *b = device->backend;
+	struct weston_color_transform *xform;
+	int ret;
+
+	if (output->color_pipeline_serial == output->base.color_outcome_serial)
+		return;
+
+	drm_output_destroy_color_pipeline(output);
+	drm_output_plane_cache_invalidate(output);
+	output->color_pipeline_serial = output->base.color_outcome_serial;
+	output->base.from_blend_to_output_by_backend = false;
+
+	xform = output->base.color_outcome->from_blend_to_output;
+	if (!b->offload_color_pipeline || !xform ||
+	    !device->atomic_modeset || output->deprecated_gamma_is_set)
+		return;
+
+	ret = drm_output_create_color_pipeline(output, xform);
+	if (ret != 0) {
+		drm_debug(b, "\t[CRTC:%u] color transformation t%u stays in "
+			  "the renderer: %s\n", output->crtc->crtc_id,
+			  xform->id, strerror(-ret));
+		drm_output_destroy_color_pipeline(output);
+		output->color_pipeline_serial =
+			output->base.color_outcome_serial;
+		return;
+	}
+
+	drm_debug(b, "\t[CRTC:%u] color transformation t%u on the CRTC\n",
+		  output->crtc->crtc_id, xform->id);
+	output->base.from_blend_to_output_by_backend = true;
+}
+
+/** Fade the output in the display pipeline
+ *
+ * Implements weston_output::set_fade_level by scaling GAMMA_LUT, so a fade
+ * costs one LUT per frame instead of compositing a curtain over the whole
+ * output. The level rides along with the next atomic commit.
+ */
+bool
+drm_output_set_fade_level(struct weston_output *output_base, float level)
+{
+	struct drm_output *output = to_drm_output(output_base);
+	struct drm_device *device = output->device;
+	struct drm_crtc *crtc = output->crtc;
+
+	if (!device->atomic_modeset || output->deprecated_gamma_is_set ||
+	    !crtc->props_crtc[WDRM_CRTC_GAMMA_LUT].prop_id ||
+	    crtc->gamma_lut_size < 2)
+		return false;
+
+	output->fade_level = fminf(fmaxf(level, 0.0f), 1.0f);
+
+	return true;
+}
+
+/** Create the faded GAMMA_LUT for the current fade level
+ *
+ * The fade is applied on top of what drm_output_ensure_color_pipeline()
+ * put in GAMMA_LUT, or on top of identity. Must be called after that.
+ */
+void
+drm_output_ensure_fade_lut(struct drm_output *output)
+{
+	struct drm_device *device = output->device;
+	uint32_t len = output->crtc->gamma_lut_size;
+	uint32_t blob_id = 0;
+	float *values;
+	uint32_t i;
+	int ch;
+	int ret;
+
+	if (output->fade_level >= 1.0f) {
+		if (output->fade_lut_blob_id)
+			drmModeDestroyPropertyBlob(device->drm.fd,
+						   output->fade_lut_blob_id);
+		output->fade_lut_blob_id = 0;
+		return;
+	}
+
+	if (output->fade_lut_blob_id &&
+	    output->fade_lut_level == output->fade_level)
+		return;
+
+	values = xcalloc(3 * len, sizeof *values);
+	for (ch = 0; ch < 3; ch++) {
+		for (i = 0; i < len; i++) {
+			float v = output->gamma_lut_values ?
+				  output->gamma_lut_values[ch * len + i] :
+				  (float)i / (len - 1);
+
+			values[ch * len + i] = v * output->fade_level;
+		}
+	}
+	ret = create_lut_blob(device, values, len, &blob_id);
+	free(values);
+
+	if (ret != 0) {
+		weston_log("Error: failed to create KMS blob for fading output '%s': %s\n",
+			   output->base.name, strerror(-ret));
+		return;
+	}
+
+	if (output->fade_lut_blob_id)
+		drmModeDestroyPropertyBlob(device->drm.fd,
+					   output->fade_lut_blob_id);
+
+	output->fade_lut_blob_id = blob_id;
+	output->fade_lut_level = output->fade_level;
+}
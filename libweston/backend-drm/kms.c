@@ -37,8 +37,11 @@
 #include <libweston/libweston.h>
 #include <libweston/backend-drm.h>
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/weston-drm-fourcc.h"
+#include "shared/xalloc.h"
 #include "drm-internal.h"
+#include "metrics.h"
 #include "pixel-formats.h"
 #include "presentation-time-server-protocol.h"
 
@@ -79,6 +82,27 @@ struct drm_property_enum_info plane_rotation_enums[] = {
 	},
 };
 
+struct drm_property_enum_info plane_color_encoding_enums[] = {
+	[WDRM_PLANE_COLOR_ENCODING_BT601] = {
+		.name = "ITU-R BT.601 YCbCr",
+	},
+	[WDRM_PLANE_COLOR_ENCODING_BT709] = {
+		.name = "ITU-R BT.709 YCbCr",
+	},
+	[WDRM_PLANE_COLOR_ENCODING_BT2020] = {
+		.name = "ITU-R BT.2020 YCbCr",
+	},
+};
+
+struct drm_property_enum_info plane_color_range_enums[] = {
+	[WDRM_PLANE_COLOR_RANGE_LIMITED] = {
+		.name = "YCbCr limited range",
+	},
+	[WDRM_PLANE_COLOR_RANGE_FULL] = {
+		.name = "YCbCr full range",
+	},
+};
+
 const struct drm_property_info plane_props[] = {
 	[WDRM_PLANE_TYPE] = {
 		.name = "type",
@@ -105,6 +129,16 @@ const struct drm_property_info plane_props[] = {
 		.num_enum_values = WDRM_PLANE_ROTATION__COUNT,
 	 },
 	[WDRM_PLANE_ALPHA] = { .name = "alpha" },
+	[WDRM_PLANE_COLOR_ENCODING] = {
+		.name = "COLOR_ENCODING",
+		.enum_values = plane_color_encoding_enums,
+		.num_enum_values = WDRM_PLANE_COLOR_ENCODING__COUNT,
+	},
+	[WDRM_PLANE_COLOR_RANGE] = {
+		.name = "COLOR_RANGE",
+		.enum_values = plane_color_range_enums,
+		.num_enum_values = WDRM_PLANE_COLOR_RANGE__COUNT,
+	},
 };
 
 struct drm_property_enum_info dpms_state_enums[] = {
@@ -442,6 +476,7 @@ drm_property_info_populate(struct drm_device *device,
 		info[i].name = src[i].name;
 		info[i].prop_id = 0;
 		info[i].num_enum_values = src[i].num_enum_values;
+		info[i].committed_generation = 0;
 
 		if (src[i].num_enum_values == 0)
 			continue;
@@ -941,6 +976,56 @@ err:
 	return -1;
 }
 
+struct drm_prop_record {
+	struct drm_property_info *info;
+	uint64_t value;
+};
+
+/*
+ * The kernel keeps every property an atomic request leaves out, so on a
+ * steady-state flip most of them need not be sent at all. A value counts
+ * as committed once a real commit carrying it has succeeded; when our idea
+ * of the KMS state is invalid, all of them are forgotten.
+ *
+ * Properties that act once per commit (fences, damage, writeback) are
+ * always sent, and so is CRTC ACTIVE, which keeps every CRTC in the
+ * request for its page flip event.
+ */
+static bool
+drm_prop_unchanged(struct drm_device *device,
+		   const struct drm_property_info *info, uint64_t val)
+{
+	if (info->committed_generation != device->prop_generation ||
+	    info->committed_value != val)
+		return false;
+
+	device->atomic_props_skipped++;
+	return true;
+}
+
+static void
+drm_prop_record(struct drm_device *device, struct drm_property_info *info,
+		uint64_t val)
+{
+	struct drm_prop_record *rec;
+
+	rec = wl_array_add(&device->atomic_props, sizeof *rec);
+	abort_oom_if_null(rec);
+	rec->info = info;
+	rec->value = val;
+}
+
+static void
+drm_device_commit_props(struct drm_device *device)
+{
+	struct drm_prop_record *rec;
+
+	wl_array_for_each(rec, &device->atomic_props) {
+		rec->info->committed_value = rec->value;
+		rec->info->committed_generation = device->prop_generation;
+	}
+}
+
 static int
 crtc_add_prop(drmModeAtomicReq *req, struct drm_crtc *crtc,
 	      enum wdrm_crtc_property prop, uint64_t val)
@@ -958,9 +1043,16 @@ crtc_add_prop(drmModeAtomicReq *req, struct drm_crtc *crtc,
 	if (info->prop_id == 0)
 		return -1;
 
+	if (prop != WDRM_CRTC_ACTIVE && drm_prop_unchanged(device, info, val))
+		return 0;
+
 	ret = drmModeAtomicAddProperty(req, crtc->crtc_id, info->prop_id,
 				       val);
-	return (ret <= 0) ? -1 : 0;
+	if (ret <= 0)
+		return -1;
+
+	drm_prop_record(device, info, val);
+	return 0;
 }
 
 /** Set a CRTC property, allowing zero value for non-existing property
@@ -1011,8 +1103,18 @@ connector_add_prop(drmModeAtomicReq *req, struct drm_connector *connector,
 	if (info->prop_id == 0)
 		return -1;
 
+	if (prop != WDRM_CONNECTOR_WRITEBACK_FB_ID &&
+	    prop != WDRM_CONNECTOR_WRITEBACK_OUT_FENCE_PTR &&
+	    prop != WDRM_CONNECTOR_CONTENT_PROTECTION &&
+	    drm_prop_unchanged(device, info, val))
+		return 0;
+
 	ret = drmModeAtomicAddProperty(req, connector_id, info->prop_id, val);
-	return (ret <= 0) ? -1 : 0;
+	if (ret <= 0)
+		return -1;
+
+	drm_prop_record(device, info, val);
+	return 0;
 }
 
 static int
@@ -1032,9 +1134,18 @@ plane_add_prop(drmModeAtomicReq *req, struct drm_plane *plane,
 	if (info->prop_id == 0)
 		return -1;
 
+	if (prop != WDRM_PLANE_IN_FENCE_FD &&
+	    prop != WDRM_PLANE_FB_DAMAGE_CLIPS &&
+	    drm_prop_unchanged(device, info, val))
+		return 0;
+
 	ret = drmModeAtomicAddProperty(req, plane->plane_id, info->prop_id,
 				       val);
-	return (ret <= 0) ? -1 : 0;
+	if (ret <= 0)
+		return -1;
+
+	drm_prop_record(device, info, val);
+	return 0;
 }
 
 static bool
@@ -1171,6 +1282,28 @@ drm_connector_set_content_type(struct drm_connector *connector,
 				  WDRM_CONNECTOR_CONTENT_TYPE, prop_val);
 }
 
+/* The content type signalled to the sink, the configured one if any, else
+ * that of the surface covering most of the output */
+static enum wdrm_content_type
+drm_output_get_content_type(struct drm_output *output)
+{
+	if (!output->content_type_auto)
+		return output->content_type;
+
+	switch (output->base.content_type) {
+	case WESTON_CONTENT_TYPE_PHOTO:
+		return WDRM_CONTENT_TYPE_PHOTO;
+	case WESTON_CONTENT_TYPE_VIDEO:
+		return WDRM_CONTENT_TYPE_CINEMA;
+	case WESTON_CONTENT_TYPE_GAME:
+		return WDRM_CONTENT_TYPE_GAME;
+	case WESTON_CONTENT_TYPE_NONE:
+		break;
+	}
+
+	return WDRM_CONTENT_TYPE_NO_DATA;
+}
+
 static int
 drm_connector_set_colorspace(struct drm_connector *connector,
 			     enum wdrm_colorspace colorspace,
@@ -1240,11 +1373,16 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 
 		if (!output->deprecated_gamma_is_set) {
 			ret |= crtc_add_prop_zero_ok(req, crtc,
-						     WDRM_CRTC_GAMMA_LUT, 0);
+						     WDRM_CRTC_GAMMA_LUT,
+						     output->fade_lut_blob_id ?
+						     output->fade_lut_blob_id :
+						     output->gamma_lut_blob_id);
 			ret |= crtc_add_prop_zero_ok(req, crtc,
-						     WDRM_CRTC_DEGAMMA_LUT, 0);
+						     WDRM_CRTC_DEGAMMA_LUT,
+						     output->degamma_lut_blob_id);
 		}
-		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_CTM, 0);
+		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_CTM,
+					     output->ctm_blob_id);
 		ret |= crtc_add_prop_zero_ok(req, crtc, WDRM_CRTC_VRR_ENABLED, 0);
 
 		/* No need for the DPMS property, since it is implicit in
@@ -1296,7 +1434,8 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		drm_connector_set_hdcp_property(&head->connector,
 						state->protection, req);
 		ret |= drm_connector_set_content_type(&head->connector,
-						      output->content_type, req);
+						      drm_output_get_content_type(output),
+						      req);
 
 		if (drm_connector_has_prop(&head->connector,
 					   WDRM_CONNECTOR_HDR_OUTPUT_METADATA)) {
@@ -1318,6 +1457,7 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 	wl_list_for_each(plane_state, &state->plane_list, link) {
 		struct drm_plane *plane = plane_state->plane;
 		const struct pixel_format_info *pinfo = NULL;
+		struct drm_property_info *encoding, *range;
 
 		ret |= plane_add_prop(req, plane, WDRM_PLANE_FB_ID,
 				      plane_state->fb ? plane_state->fb->fb_id : 0);
@@ -1373,6 +1513,22 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 					      WDRM_PLANE_ALPHA,
 					      plane_state->alpha);
 
+		/* YCbCr to RGB conversion on the plane, ignored for RGB FBs.
+		 * drm_output_try_paint_node_on_plane() made sure the values
+		 * exist. */
+		encoding = &plane->props[WDRM_PLANE_COLOR_ENCODING];
+		if (encoding->prop_id != 0 &&
+		    encoding->enum_values[plane_state->color_encoding].valid)
+			ret |= plane_add_prop(req, plane,
+					      WDRM_PLANE_COLOR_ENCODING,
+					      encoding->enum_values[plane_state->color_encoding].value);
+		range = &plane->props[WDRM_PLANE_COLOR_RANGE];
+		if (range->prop_id != 0 &&
+		    range->enum_values[plane_state->color_range].valid)
+			ret |= plane_add_prop(req, plane,
+					      WDRM_PLANE_COLOR_RANGE,
+					      range->enum_values[plane_state->color_range].value);
+
 		if (ret != 0) {
 			weston_log("couldn't set plane state\n");
 			return ret;
@@ -1394,6 +1550,68 @@ drm_pending_state_clear_tearing(struct drm_pending_state *pending_state)
 	}
 }
 
+static uint64_t
+drm_object_read_prop(struct drm_device *device, uint32_t object_id,
+		     uint32_t object_type, struct drm_property_info *info)
+{
+	drmModeObjectProperties *props;
+	uint64_t value;
+
+	props = drmModeObjectGetProperties(device->drm.fd, object_id,
+					   object_type);
+	if (!props)
+		return 0;
+
+	value = drm_property_get_value(info, props, 0);
+	drmModeFreeObjectProperties(props);
+
+	return value;
+}
+
+/**
+ * Check whether the kernel still drives an output the way we left it
+ *
+ * After getting the session back, our idea of the KMS state may be stale.
+ * If the CRTC is still active with our mode and our connectors still feed
+ * from it, re-applying our state does not need a modeset.
+ */
+static bool
+drm_output_kms_state_matches(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_device *device = output->device;
+	struct drm_mode *mode = to_drm_mode(output->base.current_mode);
+	struct drm_head *head;
+	drmModeCrtc *crtc;
+	bool match;
+
+	if (state->dpms != WESTON_DPMS_ON || !output->crtc)
+		return false;
+
+	crtc = drmModeGetCrtc(device->drm.fd, output->crtc->crtc_id);
+	if (!crtc)
+		return false;
+
+	match = crtc->mode_valid &&
+		memcmp(&crtc->mode, &mode->mode_info, sizeof(crtc->mode)) == 0;
+	drmModeFreeCrtc(crtc);
+	if (!match)
+		return false;
+
+	wl_list_for_each(head, &output->base.head_list, base.output_link) {
+		struct drm_connector *connector = &head->connector;
+		uint64_t crtc_id;
+
+		crtc_id = drm_object_read_prop(device, connector->connector_id,
+					       DRM_MODE_OBJECT_CONNECTOR,
+					       &connector->props[WDRM_CONNECTOR_CRTC_ID]);
+		if (crtc_id != output->crtc->crtc_id)
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * Helper function used only by drm_pending_state_apply, with the same
  * guarantees and constraints as that function.
@@ -1409,6 +1627,8 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 	drmModeAtomicReq *req = drmModeAtomicAlloc();
 	uint32_t flags, tear_flag = 0;
 	bool may_tear = true;
+	bool modeset_skipped = false;
+	struct timespec commit_start, commit_end;
 	int ret = 0;
 
 	if (!req)
@@ -1426,11 +1646,17 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 		break;
 	}
 
+	device->atomic_props.size = 0;
+	device->atomic_props_skipped = 0;
+	if (device->state_invalid)
+		device->prop_generation++;
+
 	if (device->state_invalid) {
 		struct weston_head *head_base;
 		struct drm_head *head;
 		struct drm_crtc *crtc;
 		uint32_t connector_id;
+		bool need_modeset = false;
 		int err;
 
 		drm_debug(b, "\t\t[atomic] previous state invalid; "
@@ -1457,6 +1683,10 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 				  head_base->name);
 
 			info = &head->connector.props[WDRM_CONNECTOR_CRTC_ID];
+			if (drm_object_read_prop(device, connector_id,
+						 DRM_MODE_OBJECT_CONNECTOR,
+						 info) != 0)
+				need_modeset = true;
 			err = drmModeAtomicAddProperty(req, connector_id,
 						       info->prop_id, 0);
 			drm_debug(b, "\t\t\t[CONN:%lu] %lu (%s) -> 0\n",
@@ -1499,6 +1729,7 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 
 			ret |= crtc_add_prop(req, crtc, WDRM_CRTC_ACTIVE, 0);
 			ret |= crtc_add_prop(req, crtc, WDRM_CRTC_MODE_ID, 0);
+			need_modeset = true;
 		}
 
 		/* Disable all the planes; planes which are being used will
@@ -1510,7 +1741,24 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 			plane_add_prop(req, plane, WDRM_PLANE_FB_ID, 0);
 		}
 
-		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		/* Coming back from a VT switch, the kernel usually still
+		 * has our modes and routing. Then only swap the planes
+		 * over, instead of allowing a modeset (and the blanking
+		 * that comes with it on some drivers). */
+		wl_list_for_each(output_state, &pending_state->output_list,
+				 link) {
+			if (output_state->output->is_virtual)
+				continue;
+			if (!drm_output_kms_state_matches(output_state)) {
+				need_modeset = true;
+				break;
+			}
+		}
+
+		if (need_modeset)
+			flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		else
+			modeset_skipped = true;
 	}
 
 	wl_list_for_each(output_state, &pending_state->output_list, link) {
@@ -1529,6 +1777,7 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 	if (may_tear)
 		tear_flag = DRM_MODE_PAGE_FLIP_ASYNC;
 
+	weston_compositor_read_presentation_clock(b->compositor, &commit_start);
 	ret = drmModeAtomicCommit(device->drm.fd, req, flags | tear_flag,
 				  device);
 	drm_debug(b, "[atomic] drmModeAtomicCommit\n");
@@ -1542,18 +1791,46 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 		if (ret == 0)
 			drm_pending_state_clear_tearing(pending_state);
 	}
+	if (ret != 0 && modeset_skipped &&
+	    !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		/* Something we did not read back needs a modeset after all */
+		drm_debug(b, "[atomic] drmModeAtomicCommit (modeset fallback)\n");
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		ret = drmModeAtomicCommit(device->drm.fd, req,
+					  flags | tear_flag, device);
+	}
 	/* Test commits do not take ownership of the state; return
 	 * without freeing here. */
 	if (mode == DRM_STATE_TEST_ONLY) {
+		weston_metric_inc(b->compositor, WESTON_METRIC_DRM_ATOMIC_TESTS);
+		if (ret != 0)
+			weston_metric_inc(b->compositor,
+					  WESTON_METRIC_DRM_ATOMIC_TEST_FAILURES);
 		drmModeAtomicFree(req);
 		return ret;
 	}
 
+	weston_compositor_read_presentation_clock(b->compositor, &commit_end);
+	weston_metric_inc(b->compositor, WESTON_METRIC_DRM_ATOMIC_COMMITS);
+	weston_metric_add(b->compositor, WESTON_METRIC_DRM_ATOMIC_PROPS,
+			  device->atomic_props.size /
+			  sizeof(struct drm_prop_record));
+	weston_metric_add(b->compositor, WESTON_METRIC_DRM_ATOMIC_PROPS_SKIPPED,
+			  device->atomic_props_skipped);
+	weston_metric_observe(b->compositor,
+			      WESTON_METRIC_HIST_DRM_ATOMIC_COMMIT_USEC,
+			      timespec_sub_to_nsec(&commit_end, &commit_start));
+
 	if (ret != 0) {
-		wl_list_for_each(output_state, &pending_state->output_list, link)
+		weston_metric_inc(b->compositor,
+				  WESTON_METRIC_DRM_ATOMIC_COMMIT_FAILURES);
+		wl_list_for_each(output_state, &pending_state->output_list, link) {
+			/* The cached planes skipped the test, redo it. */
+			drm_output_plane_cache_invalidate(output_state->output);
 			if (drm_output_get_writeback_state(output_state->output) != DRM_OUTPUT_WB_SCREENSHOT_OFF)
 				drm_writeback_fail_screenshot(output_state->output->wb_state,
 							      "drm: atomic commit failed");
+		}
 		weston_log("atomic: couldn't commit new state: %s\n",
 			   strerror(errno));
 		goto out;
@@ -1563,6 +1840,7 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 			      link)
 		drm_output_assign_state(output_state, mode);
 
+	drm_device_commit_props(device);
 	device->state_invalid = false;
 
 	assert(wl_list_empty(&pending_state->output_list));
@@ -1793,10 +2071,15 @@ atomic_flip_handler(int fd, unsigned int frame, unsigned int sec,
 		 * the driver, so just use whatever time it is now.
 		 * Note: This could actually be after a vblank that occured
 		 * after entering this function.
+		 * The flip was not synchronized to the vblank and the time
+		 * did not come from the hardware, so don't claim either in
+		 * the presentation feedback.
 		 */
 		weston_compositor_read_presentation_clock(ec, &now);
 		sec = now.tv_sec;
 		usec = now.tv_nsec / 1000;
+		flags &= ~(WP_PRESENTATION_FEEDBACK_KIND_VSYNC |
+			   WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK);
 	}
 
 	drm_debug(b, "[atomic][CRTC:%u] flip processing started\n", crtc_id);
@@ -368,6 +368,13 @@ drm_head_maybe_update_display_data(struct drm_head *head,
 		drm_property_get_value(
 			&head->connector.props[WDRM_CONNECTOR_EDID],
 			props, 0);
+
+	/* Blobs are immutable, and the kernel creates the new EDID blob
+	 * before it drops the old one, so the same id means the same data. */
+	if (blob_id && blob_id == head->display_data_blob_id)
+		return false;
+	head->display_data_blob_id = blob_id;
+
 	if (blob_id)
 		edid_blob = drmModeGetPropertyBlob(device->drm.fd, blob_id);
 
@@ -812,12 +819,34 @@ drm_mode_pick_equivalent(const drmModeModeInfo *a, const drmModeModeInfo *b)
 	return a;
 }
 
+/* Moves a mode identical to info from the stale list back to the output's
+ * mode list, so that it keeps its property blob. */
+static struct drm_mode *
+drm_output_reuse_mode(struct drm_output *output, struct wl_list *stale,
+		      const drmModeModeInfo *info)
+{
+	struct drm_mode *mode;
+
+	wl_list_for_each(mode, stale, base.link) {
+		if (memcmp(&mode->mode_info, info, sizeof(*info)) != 0)
+			continue;
+
+		mode->base.flags &= ~WL_OUTPUT_MODE_CURRENT;
+		wl_list_remove(&mode->base.link);
+		wl_list_insert(output->base.mode_list.prev, &mode->base.link);
+		return mode;
+	}
+
+	return NULL;
+}
+
 /* If the given mode info is not already in the list, add it.
  * If it is in the list, either keep the existing or replace it,
  * depending on which one is "better".
  */
 static int
-drm_output_try_add_mode(struct drm_output *output, const drmModeModeInfo *info)
+drm_output_try_add_mode(struct drm_output *output, struct wl_list *stale,
+			const drmModeModeInfo *info)
 {
 	struct weston_mode *base;
 	struct drm_mode *mode = NULL;
@@ -840,7 +869,9 @@ drm_output_try_add_mode(struct drm_output *output, const drmModeModeInfo *info)
 	}
 
 	if (!chosen) {
-		mode = drm_output_add_mode(output, info);
+		mode = drm_output_reuse_mode(output, stale, info);
+		if (!mode)
+			mode = drm_output_add_mode(output, info);
 		if (!mode)
 			return -1;
 	}
@@ -854,8 +885,9 @@ drm_output_try_add_mode(struct drm_output *output, const drmModeModeInfo *info)
  * @param output The output.
  * @return 0 on success, -1 on failure.
  *
- * Destroy all existing modes in the list, and reconstruct a new list from
- * scratch, based on the currently attached heads.
+ * Reconstruct the list from the currently attached heads. Modes which are
+ * still offered keep their drm_mode and property blob, so re-enabling an
+ * output after a hotplug does not rebuild them, the others are destroyed.
  *
  * On failure the output's mode list may contain some modes.
  */
@@ -866,24 +898,31 @@ drm_output_update_modelist_from_heads(struct drm_output *output)
 	struct weston_head *head_base;
 	struct drm_head *head;
 	drmModeConnector *conn;
+	struct wl_list stale;
 	int i;
-	int ret;
+	int ret = 0;
 
 	assert(!output->base.enabled);
 
-	drm_mode_list_destroy(device, &output->base.mode_list);
+	wl_list_init(&stale);
+	wl_list_insert_list(&stale, &output->base.mode_list);
+	wl_list_init(&output->base.mode_list);
 
 	wl_list_for_each(head_base, &output->base.head_list, output_link) {
 		head = to_drm_head(head_base);
 		conn = head->connector.conn;
 		for (i = 0; i < conn->count_modes; i++) {
-			ret = drm_output_try_add_mode(output, &conn->modes[i]);
+			ret = drm_output_try_add_mode(output, &stale,
+						      &conn->modes[i]);
 			if (ret < 0)
-				return -1;
+				goto out;
 		}
 	}
 
-	return 0;
+out:
+	drm_mode_list_destroy(device, &stale);
+
+	return ret;
 }
 
 int
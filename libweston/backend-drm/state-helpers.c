@@ -29,6 +29,7 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
@@ -284,6 +285,16 @@ drm_plane_state_coords_for_paint_node(struct drm_plane_state *state,
 		syf2 = temp;
 	}
 
+	/* A buffer that maps 1:1 onto output pixels, like one drawn at the
+	 * preferred fractional scale and sized with wp_viewport, must not
+	 * need the plane to scale because of rounding errors. */
+	if (!node->needs_filtering) {
+		sxf1 = roundf(sxf1);
+		syf1 = roundf(syf1);
+		sxf2 = roundf(sxf2);
+		syf2 = roundf(syf2);
+	}
+
 	/* Shift from S23.8 wl_fixed to U16.16 KMS fixed-point encoding. */
 	state->src_x = wl_fixed_from_double(sxf1) << 8;
 	state->src_y = wl_fixed_from_double(syf1) << 8;
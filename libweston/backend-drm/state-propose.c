@@ -29,6 +29,8 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
@@ -37,8 +39,10 @@
 #include <libweston/pixel-formats.h>
 
 #include "drm-internal.h"
+#include "shared/xalloc.h"
 
 #include "color.h"
+#include "metrics.h"
 #include "linux-dmabuf.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
@@ -64,6 +68,475 @@ drm_propose_state_mode_to_string(enum drm_output_propose_state_mode mode)
 	return drm_output_propose_state_mode_as_string[mode];
 }
 
+static const struct {
+	enum try_view_on_plane_failure_reasons reason;
+	const char *name;
+} drm_failure_reasons_names[] = {
+	{ FAILURE_REASONS_FORCE_RENDERER, "forced to renderer" },
+	{ FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE, "incompatible format" },
+	{ FAILURE_REASONS_DMABUF_MODIFIER_INVALID, "invalid modifier" },
+	{ FAILURE_REASONS_ADD_FB_FAILED, "adding FB failed" },
+	{ FAILURE_REASONS_NO_PLANES_AVAILABLE, "no planes available" },
+	{ FAILURE_REASONS_PLANES_REJECTED, "planes rejected" },
+	{ FAILURE_REASONS_INADEQUATE_CONTENT_PROTECTION, "content protection" },
+	{ FAILURE_REASONS_INCOMPATIBLE_TRANSFORM, "incompatible transform" },
+	{ FAILURE_REASONS_NO_BUFFER, "no buffer" },
+	{ FAILURE_REASONS_BUFFER_TYPE, "unsupported buffer type" },
+	{ FAILURE_REASONS_GLOBAL_ALPHA, "global alpha" },
+	{ FAILURE_REASONS_NO_GBM, "no GBM" },
+	{ FAILURE_REASONS_GBM_BO_IMPORT_FAILED, "GBM import failed" },
+	{ FAILURE_REASONS_GBM_BO_GET_HANDLE_FAILED, "GBM handle failed" },
+	{ FAILURE_REASONS_BUFFER_RELEASED, "buffer released" },
+};
+
+static void
+drm_failure_reasons_to_str(uint32_t reasons, char *buf, size_t len)
+{
+	size_t pos = 0;
+	unsigned i;
+
+	buf[0] = '\0';
+	if (reasons == FAILURE_REASONS_NONE) {
+		snprintf(buf, len, "no plane failure recorded");
+		return;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(drm_failure_reasons_names); i++) {
+		if (!(reasons & drm_failure_reasons_names[i].reason))
+			continue;
+		if (pos >= len)
+			break;
+		pos += snprintf(buf + pos, len - pos, "%s%s",
+				pos ? ", " : "",
+				drm_failure_reasons_names[i].name);
+	}
+}
+
+/* Buffers of a swapchain remembered per cache entry, see buffer_serials */
+#define DRM_PLANE_CACHE_BUFFERS 4
+
+/** Plane assignment of one paint node in the cached state
+ *
+ * Everything up to plane_id forms the cache key: whatever can make the
+ * kernel accept or reject a plane configuration. Views are told apart by
+ * serial, since the view pool hands out freed addresses again. The rest is
+ * what drm_output_propose_state() decided for the node.
+ *
+ * The buffer is part of the key as well: two buffers of the same format
+ * and size can still differ in pitches, offsets, planes or placement. As
+ * clients cycle through a few buffers, an entry remembers the last ones
+ * that passed an atomic test with the same assignment.
+ */
+struct drm_plane_cache_entry {
+	struct weston_view *view;
+	uint64_t view_serial;
+	enum weston_buffer_type buffer_type;
+	uint32_t format;
+	uint64_t modifier;
+	int32_t width, height;
+	struct weston_buffer_viewport viewport;
+	struct weston_matrix matrix;
+	pixman_box32_t bbox;
+	float alpha;
+	bool has_fence;
+	bool censored;
+
+	uint32_t plane_id; /**< 0 when composited by the renderer */
+	uint64_t zpos;
+	uint32_t failure_reasons;
+
+	/* Serials of the buffers this was tested with, 0 for none; in a
+	 * key, only the first one is set, to the buffer being shown */
+	uint64_t buffer_serials[DRM_PLANE_CACHE_BUFFERS];
+};
+
+/** Last plane assignment which passed its atomic test
+ *
+ * While the scene keeps the same key, drm_assign_planes() proposes the
+ * same state again right away, without the trial-and-error of the
+ * different modes and without atomic test commits.
+ */
+struct drm_plane_cache {
+	bool valid;
+	struct weston_mode *mode;
+	enum drm_output_propose_state_mode state_mode;
+	bool tear;
+
+	struct drm_plane_cache_entry *entries;
+	unsigned int count;
+	unsigned int alloc;
+
+	/* Key of the scene being repainted, becomes entries on update */
+	struct drm_plane_cache_entry *key;
+	unsigned int key_alloc;
+};
+
+static void
+drm_plane_cache_entry_init(struct drm_plane_cache_entry *entry,
+			   struct weston_paint_node *pnode)
+{
+	struct weston_view *ev = pnode->view;
+
+	/* Zero the padding as well, entries get compared with memcmp(). */
+	memset(entry, 0, sizeof(*entry));
+
+	entry->view = ev;
+	entry->view_serial = ev->serial;
+	if (weston_view_has_valid_buffer(ev)) {
+		struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+
+		entry->buffer_serials[0] = buffer->serial;
+		entry->buffer_type = buffer->type;
+		if (buffer->pixel_format)
+			entry->format = buffer->pixel_format->format;
+		entry->modifier = buffer->format_modifier;
+		entry->width = buffer->width;
+		entry->height = buffer->height;
+	}
+	entry->viewport = ev->surface->buffer_viewport;
+	entry->matrix = ev->transform.matrix;
+	entry->bbox = *pixman_region32_extents(&ev->transform.boundingbox);
+	entry->alpha = ev->alpha;
+	entry->has_fence = ev->surface->acquire_fence_fd >= 0;
+	/* HDCP coming up on the output lets a protected view go back to
+	 * a plane, losing it must take the view off its plane. */
+	entry->censored = drm_paint_node_is_censored(pnode);
+}
+
+static bool
+drm_plane_cache_entry_has_buffer(const struct drm_plane_cache_entry *entry,
+				 uint64_t serial)
+{
+	int i;
+
+	for (i = 0; i < DRM_PLANE_CACHE_BUFFERS; i++) {
+		if (entry->buffer_serials[i] == serial)
+			return true;
+	}
+
+	return false;
+}
+
+/* A view on the cursor plane may have moved since it was cached: the cursor
+ * plane takes any position, so a pure translation of the same buffer is
+ * accepted. This keeps plain pointer motion on the cached path, without any
+ * atomic test commit. */
+static bool
+drm_plane_cache_cursor_entry_matches(const struct drm_plane_cache_entry *key,
+				     const struct drm_plane_cache_entry *entry)
+{
+	struct drm_plane_cache_entry moved = *key;
+	int i;
+
+	if (key->bbox.x2 - key->bbox.x1 != entry->bbox.x2 - entry->bbox.x1 ||
+	    key->bbox.y2 - key->bbox.y1 != entry->bbox.y2 - entry->bbox.y1)
+		return false;
+
+	for (i = 12; i < 15; i++)
+		moved.matrix.d[i] = entry->matrix.d[i];
+	moved.bbox = entry->bbox;
+
+	return memcmp(&moved, entry,
+		      offsetof(struct drm_plane_cache_entry, plane_id)) == 0;
+}
+
+/* Fills in the key for the current scene, and tells if it hits the cache */
+static bool
+drm_plane_cache_lookup(struct drm_output *output)
+{
+	struct drm_plane_cache *cache = output->plane_cache;
+	struct drm_device *device = output->device;
+	struct weston_paint_node **nodes;
+	unsigned int count;
+	unsigned int i;
+
+	nodes = weston_output_get_paint_nodes(&output->base, &count);
+
+	if (count > cache->key_alloc) {
+		cache->key = xrealloc(cache->key, count * sizeof(*cache->key));
+		cache->key_alloc = count;
+	}
+
+	for (i = 0; i < count; i++)
+		drm_plane_cache_entry_init(&cache->key[i], nodes[i]);
+
+	if (!cache->valid || cache->count != count ||
+	    cache->mode != output->base.current_mode ||
+	    !device->atomic_modeset || device->state_invalid ||
+	    drm_output_get_writeback_state(output) != DRM_OUTPUT_WB_SCREENSHOT_OFF)
+		return false;
+
+	for (i = 0; i < count; i++) {
+		uint64_t buffer_serial = cache->key[i].buffer_serials[0];
+
+		if (!drm_plane_cache_entry_has_buffer(&cache->entries[i],
+						      buffer_serial))
+			return false;
+
+		if (memcmp(&cache->key[i], &cache->entries[i],
+			   offsetof(struct drm_plane_cache_entry, plane_id)) == 0)
+			continue;
+
+		if (output->cursor_plane &&
+		    cache->entries[i].plane_id ==
+		    output->cursor_plane->plane_id &&
+		    drm_plane_cache_cursor_entry_matches(&cache->key[i],
+							 &cache->entries[i]))
+			continue;
+
+		return false;
+	}
+
+	return true;
+}
+
+static struct drm_plane_state *
+drm_output_state_find_view(struct drm_output_state *state,
+			   struct weston_view *ev)
+{
+	struct drm_plane_state *ps;
+
+	wl_list_for_each(ps, &state->plane_list, link) {
+		if (ps->ev == ev)
+			return ps;
+	}
+
+	return NULL;
+}
+
+/* Checks that a state proposed from the cache came out the same again */
+static bool
+drm_plane_cache_matches(struct drm_plane_cache *cache,
+			struct drm_output_state *state)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->count; i++) {
+		const struct drm_plane_cache_entry *entry = &cache->entries[i];
+		struct drm_plane_state *ps;
+
+		ps = drm_output_state_find_view(state, entry->view);
+		if (!ps) {
+			if (entry->plane_id != 0)
+				return false;
+			continue;
+		}
+
+		if (ps->plane->plane_id != entry->plane_id ||
+		    ps->zpos != entry->zpos)
+			return false;
+	}
+
+	return true;
+}
+
+/* Keeps the buffers the cached entry was tested with, if the new one is the
+ * same but for the buffer */
+static void
+drm_plane_cache_entry_merge_buffers(struct drm_plane_cache_entry *entry,
+				    const struct drm_plane_cache_entry *old)
+{
+	int i, n = 1;
+
+	if (memcmp(entry, old,
+		   offsetof(struct drm_plane_cache_entry, plane_id)) != 0 ||
+	    entry->plane_id != old->plane_id || entry->zpos != old->zpos)
+		return;
+
+	for (i = 0; i < DRM_PLANE_CACHE_BUFFERS && n < DRM_PLANE_CACHE_BUFFERS;
+	     i++) {
+		if (old->buffer_serials[i] != 0 &&
+		    old->buffer_serials[i] != entry->buffer_serials[0])
+			entry->buffer_serials[n++] = old->buffer_serials[i];
+	}
+}
+
+/* Makes the key of the current scene the cached entries for this state */
+static void
+drm_plane_cache_update(struct drm_output *output,
+		       struct drm_output_state *state,
+		       enum drm_output_propose_state_mode mode)
+{
+	struct drm_plane_cache *cache = output->plane_cache;
+	struct drm_plane_cache_entry *tmp;
+	struct weston_paint_node **nodes;
+	unsigned int n_nodes, i;
+	bool merge;
+
+	nodes = weston_output_get_paint_nodes(&output->base, &n_nodes);
+	merge = cache->valid && cache->count == n_nodes &&
+		cache->mode == output->base.current_mode &&
+		cache->state_mode == mode && cache->tear == state->tear;
+
+	for (i = 0; i < n_nodes; i++) {
+		struct drm_plane_cache_entry *entry = &cache->key[i];
+		struct drm_plane_state *ps;
+
+		ps = drm_output_state_find_view(state, nodes[i]->view);
+		entry->plane_id = ps ? ps->plane->plane_id : 0;
+		entry->zpos = ps ? ps->zpos : 0;
+		entry->failure_reasons =
+			nodes[i]->try_view_on_plane_failure_reasons;
+
+		if (merge)
+			drm_plane_cache_entry_merge_buffers(entry,
+							    &cache->entries[i]);
+	}
+
+	tmp = cache->entries;
+	cache->entries = cache->key;
+	cache->key = tmp;
+	i = cache->alloc;
+	cache->alloc = cache->key_alloc;
+	cache->key_alloc = i;
+
+	cache->count = n_nodes;
+	cache->mode = output->base.current_mode;
+	cache->state_mode = mode;
+	cache->tear = state->tear;
+	cache->valid = true;
+}
+
+/** Forget the cached plane assignment, for example after a failed commit */
+void
+drm_output_plane_cache_invalidate(struct drm_output *output)
+{
+	if (output->plane_cache)
+		output->plane_cache->valid = false;
+}
+
+void
+drm_output_plane_cache_destroy(struct drm_output *output)
+{
+	struct drm_plane_cache *cache = output->plane_cache;
+
+	if (!cache)
+		return;
+
+	free(cache->entries);
+	free(cache->key);
+	free(cache);
+	output->plane_cache = NULL;
+}
+
+/** Check whether a client acquire fence has already signalled
+ *
+ * Errors are reported as signalled, so that the fence is handed to the
+ * kernel as usual.
+ */
+static bool
+drm_fence_is_signalled(int fence_fd)
+{
+	struct pollfd pollfd = {
+		.fd = fence_fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	while ((ret = poll(&pollfd, 1, 0)) == -1 && errno == EINTR)
+		continue;
+
+	return ret != 0;
+}
+
+static int
+drm_output_fence_signalled(int fd, uint32_t mask, void *data)
+{
+	struct drm_output *output = data;
+
+	wl_event_source_remove(output->fence_source);
+	output->fence_source = NULL;
+	weston_output_schedule_repaint(&output->base);
+
+	return 0;
+}
+
+/** Repaint the output once the given acquire fence signals
+ *
+ * Only one fence is watched at a time; any other one still pending is
+ * looked at again in the repaint this triggers.
+ */
+static void
+drm_output_watch_fence(struct drm_output *output, int fence_fd)
+{
+	struct wl_event_loop *loop;
+
+	if (output->fence_source)
+		return;
+
+	loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+	output->fence_source = wl_event_loop_add_fd(loop, fence_fd,
+						    WL_EVENT_READABLE,
+						    drm_output_fence_signalled,
+						    output);
+}
+
+void
+drm_output_fence_watch_fini(struct drm_output *output)
+{
+	if (output->fence_source)
+		wl_event_source_remove(output->fence_source);
+	output->fence_source = NULL;
+}
+
+/** Keep showing the previous buffer of a view whose new one is not ready
+ *
+ * If the acquire fence of the new buffer has not signalled by the time we
+ * build the state, passing it as IN_FENCE_FD would make the kernel hold
+ * back the whole commit, and with it every other plane of the CRTC, until
+ * the client's GPU work finishes. When the view already sits on the same
+ * plane with the same geometry, put its current framebuffer in the state
+ * instead and repaint again once the fence signals.
+ */
+static bool
+drm_plane_state_keep_previous_fb(struct drm_plane_state *state,
+				 struct weston_view *ev)
+{
+	struct drm_plane_state *cur = state->plane->state_cur;
+	struct weston_buffer *buffer = NULL;
+	int fence_fd = ev->surface->acquire_fence_fd;
+
+	if (fence_fd < 0 || !cur->fb || cur->ev != ev ||
+	    cur->output != state->output)
+		return false;
+
+	if (cur->src_x != state->src_x || cur->src_y != state->src_y ||
+	    cur->src_w != state->src_w || cur->src_h != state->src_h ||
+	    cur->dest_x != state->dest_x || cur->dest_y != state->dest_y ||
+	    cur->dest_w != state->dest_w || cur->dest_h != state->dest_h ||
+	    cur->rotation != state->rotation)
+		return false;
+
+	if (drm_fence_is_signalled(fence_fd))
+		return false;
+
+	state->fb = drm_fb_ref(cur->fb);
+	state->in_fence_fd = -1;
+
+	if (cur->fb->type == BUFFER_CLIENT || cur->fb->type == BUFFER_DMABUF)
+		buffer = cur->fb_ref.buffer.buffer;
+	weston_buffer_reference(&state->fb_ref.buffer, buffer,
+				buffer ? BUFFER_MAY_BE_ACCESSED :
+					 BUFFER_WILL_NOT_BE_ACCESSED);
+	weston_buffer_release_reference(&state->fb_ref.release,
+					cur->fb_ref.release.buffer_release);
+
+	drm_output_watch_fence(state->output, fence_fd);
+
+	return true;
+}
+
+/* Tearing-control asks explicitly; short of that, games would rather tear
+ * than wait for the vblank. */
+static bool
+drm_surface_may_tear(struct weston_surface *surface)
+{
+	if (surface->tear_control)
+		return surface->tear_control->may_tear;
+
+	return surface->content_type == WESTON_CONTENT_TYPE_GAME;
+}
+
 static bool
 drm_mixed_mode_check_underlay(enum drm_output_propose_state_mode mode,
                               struct drm_plane_state *scanout_state,
@@ -90,12 +563,42 @@ drm_output_check_plane_has_view_assigned(struct drm_plane *plane,
 	return false;
 }
 
+/* Pick the YCbCr to RGB conversion for a plane. The GL renderer's YUV shader
+ * decodes BT.601 limited range, so use the same on planes: a view moving
+ * between a plane and the renderer must not change colour. Planes without
+ * the properties convert however the driver does and are trusted as before. */
+static bool
+drm_plane_state_set_color_representation(struct drm_plane_state *state,
+					 struct drm_fb *fb)
+{
+	struct drm_plane *plane = state->plane;
+	struct drm_property_info *encoding =
+		&plane->props[WDRM_PLANE_COLOR_ENCODING];
+	struct drm_property_info *range = &plane->props[WDRM_PLANE_COLOR_RANGE];
+
+	state->color_encoding = WDRM_PLANE_COLOR_ENCODING_BT601;
+	state->color_range = WDRM_PLANE_COLOR_RANGE_LIMITED;
+
+	if (!fb->format || !pixel_format_is_yuv(fb->format))
+		return true;
+
+	if (encoding->prop_id != 0 &&
+	    !encoding->enum_values[state->color_encoding].valid)
+		return false;
+
+	if (range->prop_id != 0 &&
+	    !range->enum_values[state->color_range].valid)
+		return false;
+
+	return true;
+}
+
 static struct drm_plane_state *
 drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 				   struct drm_output_state *output_state,
 				   struct weston_paint_node *node,
 				   enum drm_output_propose_state_mode mode,
-				   struct drm_fb *fb, uint64_t zpos)
+				   struct drm_fb *fb, uint64_t zpos, bool test)
 {
 	struct drm_output *output = output_state->output;
 	struct weston_view *ev = node->view;
@@ -122,6 +625,15 @@ drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 		goto out;
 	}
 
+	if (!drm_plane_state_set_color_representation(state, fb)) {
+		drm_debug(b, "\t\t\t\t[view] not placing view %p on plane "
+			     "%lu: no BT.601 limited range YCbCr conversion\n",
+			  ev, (unsigned long) plane->plane_id);
+		node->try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_PLANES_REJECTED;
+		goto out;
+	}
+
 	/* Should've been ensured by weston_view_matches_entire_output. */
 	if (plane->type == WDRM_PLANE_TYPE_PRIMARY) {
 		assert(state->dest_x == 0 && state->dest_y == 0 &&
@@ -134,12 +646,18 @@ drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 	 * drm_output_prepare_plane_view(), so, we take another reference
 	 * here to live within the state. */
 	state->ev = ev;
-	state->fb = drm_fb_ref(fb);
-	state->in_fence_fd = ev->surface->acquire_fence_fd;
+	if (drm_plane_state_keep_previous_fb(state, ev)) {
+		drm_debug(b, "\t\t\t[view] acquire fence of view %p not "
+			     "signalled, keeping previous buffer on plane %lu\n",
+			  ev, (unsigned long) plane->plane_id);
+	} else {
+		state->fb = drm_fb_ref(fb);
+		state->in_fence_fd = ev->surface->acquire_fence_fd;
+	}
 
 	/* In planes-only mode, we don't have an incremental state to
 	 * test against, so we just hope it'll work. */
-	if (mode != DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY &&
+	if (test && mode != DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY &&
 	    drm_pending_state_test(output_state->pending_state) != 0) {
 		drm_debug(b, "\t\t\t[view] not placing view %p on plane %lu: "
 		             "atomic test failed\n",
@@ -152,14 +670,17 @@ drm_output_try_paint_node_on_plane(struct drm_plane *plane,
 
 	/* Take a reference on the buffer so that we don't release it
 	 * back to the client until we're done with it; cursor buffers
-	 * don't require a reference since we copy them. */
-	assert(state->fb_ref.buffer.buffer == NULL);
-	assert(state->fb_ref.release.buffer_release == NULL);
-	weston_buffer_reference(&state->fb_ref.buffer,
-				surface->buffer_ref.buffer,
-				BUFFER_MAY_BE_ACCESSED);
-	weston_buffer_release_reference(&state->fb_ref.release,
-					surface->buffer_release_ref.buffer_release);
+	 * don't require a reference since we copy them. A previous buffer
+	 * kept above already holds its references. */
+	if (state->fb == fb) {
+		assert(state->fb_ref.buffer.buffer == NULL);
+		assert(state->fb_ref.release.buffer_release == NULL);
+		weston_buffer_reference(&state->fb_ref.buffer,
+					surface->buffer_ref.buffer,
+					BUFFER_MAY_BE_ACCESSED);
+		weston_buffer_release_reference(&state->fb_ref.release,
+						surface->buffer_release_ref.buffer_release);
+	}
 
 	return state;
 
@@ -215,8 +736,8 @@ drm_output_prepare_cursor_paint_node(struct drm_output_state *output_state,
 
 	drm_output_set_cursor_view(output, ev);
 	plane_state->ev = ev;
-	/* We always test with cursor fb 0. There are two potential fbs, and
-	 * they are identically allocated for cursor use specifically, so if
+	/* We always test with cursor fb 0. There are several potential fbs,
+	 * and they are identically allocated for cursor use specifically, so if
 	 * one works the other almost certainly should as well.
 	 *
 	 * Later when we determine if the cursor needs an update, we'll
@@ -303,6 +824,7 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 	enum actions_needed_dmabuf_feedback action_needed = ACTION_NEEDED_NONE;
 	struct timespec current_time, delta_time;
 	const time_t MAX_TIME_SECONDS = 2;
+	const unsigned int MIN_STABLE_FRAMES = 10;
 
 	/* Look for scanout tranche. If not found, add it but in disabled mode
 	 * (we still don't know if we'll have to send it to clients). This
@@ -336,11 +858,19 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 		action_needed = ACTION_NEEDED_ADD_SCANOUT_TRANCHE;
 	}
 
+	/* The shell told us this surface is meant to be scanned out, so keep
+	 * advertising the scanout tranche even while something temporarily
+	 * forces composition. */
+	if (ev->surface->scanout_preferred &&
+	    action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE)
+		action_needed = ACTION_NEEDED_NONE;
+
 	/* No actions needed, so disarm timer and return */
 	if (action_needed == ACTION_NEEDED_NONE ||
 	    (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE && scanout_tranche->active) ||
 	    (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE && !scanout_tranche->active)) {
 		dmabuf_feedback->action_needed = ACTION_NEEDED_NONE;
+		dmabuf_feedback->stable_frames = 0;
 		return;
 	}
 
@@ -352,20 +882,28 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 	 *
 	 * So we reset the timestamp, set the timer to on it with the most
 	 * recent needed action, return and leave the timer running. */
-	if (dmabuf_feedback->action_needed == ACTION_NEEDED_NONE ||
-	    dmabuf_feedback->action_needed != action_needed) {
+	if (ev->surface->scanout_preferred) {
+		/* No hysteresis: the shell vouches that the scene is stable. */
+	} else if (dmabuf_feedback->action_needed == ACTION_NEEDED_NONE ||
+		   dmabuf_feedback->action_needed != action_needed) {
 		clock_gettime(CLOCK_MONOTONIC, &dmabuf_feedback->timer);
 		dmabuf_feedback->action_needed = action_needed;
+		dmabuf_feedback->stable_frames = 1;
 		return;
 	/* Timer is already on and the action needed when it was set to on does
 	 * not conflict with the most recent needed action we've detected. If
-	 * more than MAX_TIME_SECONDS has passed, we need to resend the dma-buf
-	 * feedback. Otherwise, return and leave the timer running. */
+	 * more than MAX_TIME_SECONDS has passed and the action has been seen
+	 * on at least MIN_STABLE_FRAMES repaints in a row, we need to resend
+	 * the dma-buf feedback. A view dragged across planes flips between
+	 * actions and keeps resetting this. Otherwise, return and leave the
+	 * timer running. */
 	} else {
+		dmabuf_feedback->stable_frames++;
 		clock_gettime(CLOCK_MONOTONIC, &current_time);
 		delta_time.tv_sec = current_time.tv_sec -
 				    dmabuf_feedback->timer.tv_sec;
-		if (delta_time.tv_sec < MAX_TIME_SECONDS)
+		if (delta_time.tv_sec < MAX_TIME_SECONDS ||
+		    dmabuf_feedback->stable_frames < MIN_STABLE_FRAMES)
 			return;
 	}
 
@@ -379,13 +917,19 @@ dmabuf_feedback_maybe_update(struct drm_device *device, struct weston_view *ev,
 	else
 		assert(0);
 
-	drm_debug(b, "\t[repaint] Need to update and resend the "
-		     "dma-buf feedback for surface of view %p\n", ev);
-	weston_dmabuf_feedback_send_all(b->compositor, dmabuf_feedback,
-					b->compositor->dmabuf_feedback_format_table);
+	if (weston_dmabuf_feedback_send_all(b->compositor, dmabuf_feedback,
+					    b->compositor->dmabuf_feedback_format_table))
+		drm_debug(b, "\t[repaint] Updated and resent the dma-buf "
+			     "feedback for surface of view %p (%u resends, "
+			     "%u unchanged)\n", ev, dmabuf_feedback->resend_count,
+			     dmabuf_feedback->skipped_count);
+	else
+		drm_debug(b, "\t[repaint] dma-buf feedback for surface of "
+			     "view %p unchanged, not resending it\n", ev);
 
 	/* Set the timer to off */
 	dmabuf_feedback->action_needed = ACTION_NEEDED_NONE;
+	dmabuf_feedback->stable_frames = 0;
 }
 
 static struct drm_plane_state *
@@ -395,7 +939,8 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			       struct drm_plane_state *scanout_state,
 			       uint64_t current_lowest_zpos_overlay,
 			       uint64_t current_lowest_zpos_underlay,
-			       bool need_underlay)
+			       bool need_underlay,
+			       uint32_t cached_plane_id)
 {
 	struct drm_output *output = state->output;
 	struct drm_device *device = output->device;
@@ -440,6 +985,13 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			return NULL;
 		}
 
+		/* Released early, only the renderer has the contents now */
+		if (ev->surface->buffer_ref.type != BUFFER_MAY_BE_ACCESSED) {
+			pnode->try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_BUFFER_RELEASED;
+			return NULL;
+		}
+
 		/* Even though this is a SHM buffer, pixel_format stores the
 		 * format code as DRM FourCC */
 		if (buffer->pixel_format->format != DRM_FORMAT_ARGB8888) {
@@ -512,6 +1064,10 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			continue;
 
 		possible_plane_mask &= ~(1 << plane->plane_idx);
+
+		/* The cached assignment already passed the atomic test. */
+		if (cached_plane_id && plane->plane_id != cached_plane_id)
+			continue;
 		mm_has_underlay =
 			drm_mixed_mode_check_underlay(mode, scanout_state, plane->zpos_max);
 
@@ -622,7 +1178,8 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 		} else {
 			ps = drm_output_try_paint_node_on_plane(plane, state,
 								pnode, mode,
-								fb, zpos);
+								fb, zpos,
+								!cached_plane_id);
 		}
 
 		if (ps) {
@@ -653,15 +1210,45 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 	return ps;
 }
 
+static bool
+color_transform_is_identity(const struct weston_color_transform *xform)
+{
+	return !xform ||
+	       (xform->pre_curve.type == WESTON_COLOR_CURVE_TYPE_IDENTITY &&
+		xform->mapping.type == WESTON_COLOR_MAPPING_TYPE_IDENTITY &&
+		xform->post_curve.type == WESTON_COLOR_CURVE_TYPE_IDENTITY);
+}
+
+/* Whether the paint node's content can reach the screen without the
+ * renderer. Planes are blended in the blending space, so when the CRTC
+ * applies the blending to output transformation, content already in the
+ * blending space needs nothing else. Otherwise the content must already be
+ * what the monitor wants; the transformation to the blending space only
+ * matters to the renderer then. */
+static bool
+drm_paint_node_color_ok(struct drm_output *output,
+			struct weston_paint_node *pnode)
+{
+	if (output->base.from_blend_to_output_by_backend)
+		return color_transform_is_identity(pnode->surf_xform.transform);
+
+	return pnode->surf_xform.identity_pipeline;
+}
+
+/*
+ * With cached entries, every view goes to the plane it got last time, and
+ * nothing is tested against the kernel.
+ */
 static struct drm_output_state *
 drm_output_propose_state(struct weston_output *output_base,
 			 struct drm_pending_state *pending_state,
-			 enum drm_output_propose_state_mode mode)
+			 enum drm_output_propose_state_mode mode,
+			 const struct drm_plane_cache_entry *cached)
 {
 	struct drm_output *output = to_drm_output(output_base);
 	struct drm_device *device = output->device;
 	struct drm_backend *b = device->backend;
-	struct weston_paint_node *pnode;
+	struct weston_paint_node *pnode, **nodes;
 	struct drm_output_state *state;
 	struct drm_plane_state *scanout_state = NULL;
 
@@ -675,6 +1262,7 @@ drm_output_propose_state(struct weston_output *output_base,
 	uint64_t current_lowest_zpos_overlay = DRM_PLANE_ZPOS_INVALID_PLANE;
 	/* Record the current lowest zpos of the underlay plane */
 	uint64_t current_lowest_zpos_underlay = DRM_PLANE_ZPOS_INVALID_PLANE;
+	unsigned int n_nodes, n_node;
 
 	assert(!output->state_last);
 	state = drm_output_state_duplicate(output->state_cur,
@@ -754,14 +1342,21 @@ drm_output_propose_state(struct weston_output *output_base,
 	pixman_region32_init(&renderer_region);
 	pixman_region32_init(&occluded_region);
 
-	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
-			 z_order_link) {
-		struct weston_view *ev = pnode->view;
+	nodes = weston_output_get_paint_nodes(&output->base, &n_nodes);
+	for (n_node = 0; n_node < n_nodes; n_node++) {
+		struct weston_view *ev;
 		struct drm_plane_state *ps = NULL;
+		const struct drm_plane_cache_entry *entry = NULL;
 		bool force_renderer = false;
 		pixman_region32_t clipped_view;
 		pixman_region32_t surface_overlap;
 		bool totally_occluded = false;
+		bool censored;
+
+		pnode = nodes[n_node];
+		ev = pnode->view;
+		if (cached)
+			entry = &cached[n_node];
 
 		drm_debug(b, "\t\t\t[view] evaluating view %p for "
 		             "output %s (%lu)\n",
@@ -821,8 +1416,7 @@ drm_output_propose_state(struct weston_output *output_base,
 			force_renderer = true;
 		}
 
-		if (pnode->surf_xform.transform != NULL ||
-		    !pnode->surf_xform.identity_pipeline) {
+		if (!drm_paint_node_color_ok(output, pnode)) {
 			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
 			             "(requires color transform)\n", ev);
 			force_renderer = true;
@@ -850,20 +1444,20 @@ drm_output_propose_state(struct weston_output *output_base,
 		/* In case of enforced mode of content-protection do not
 		 * assign planes for a protected surface on an unsecured output.
 		 */
-		if (ev->surface->protection_mode == WESTON_SURFACE_PROTECTION_MODE_ENFORCED &&
-		    ev->surface->desired_protection > output_base->current_protection) {
+		censored = drm_paint_node_is_censored(pnode);
+		if (censored) {
 			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
 				     "(enforced protection mode on unsecured output)\n", ev);
 			force_renderer = true;
 		}
 
-		if (pnode->view->surface->tear_control)
-			state->tear &= pnode->view->surface->tear_control->may_tear;
-		else
-			state->tear = 0;
+		state->tear &= drm_surface_may_tear(pnode->view->surface);
 
 		/* Now try to place it on a plane if we can. */
-		if (!force_renderer) {
+		if (!force_renderer && entry && entry->plane_id == 0) {
+			pnode->try_view_on_plane_failure_reasons =
+				entry->failure_reasons;
+		} else if (!force_renderer) {
 			drm_debug(b, "\t\t\t[plane] started with zpos %"PRIu64"\n",
 				      need_underlay ? current_lowest_zpos_underlay :
 				      current_lowest_zpos_overlay);
@@ -871,7 +1465,8 @@ drm_output_propose_state(struct weston_output *output_base,
 							    scanout_state,
 							    current_lowest_zpos_overlay,
 							    current_lowest_zpos_underlay,
-							    need_underlay);
+							    need_underlay,
+							    entry ? entry->plane_id : 0);
 		} else {
 			/* We are forced to place the view in the renderer, set
 			 * the failure reason accordingly. */
@@ -911,8 +1506,12 @@ drm_output_propose_state(struct weston_output *output_base,
 		 * however, anything not in the opaque region (which is the
 		 * entire clipped area if the whole view is known to be
 		 * opaque) does not necessarily occlude what's behind it, as
-		 * it could be alpha-blended. */
-		if (!weston_view_is_opaque(ev, &clipped_view))
+		 * it could be alpha-blended. A censored view is replaced
+		 * by an opaque placeholder, so nothing behind it needs to
+		 * be composited for it, as long as it fills its bounding
+		 * box. */
+		if (!(censored && pnode->valid_transform) &&
+		    !weston_view_is_opaque(ev, &clipped_view))
 			pixman_region32_intersect(&clipped_view,
 						  &clipped_view,
 						  &ev->transform.opaque);
@@ -935,7 +1534,7 @@ drm_output_propose_state(struct weston_output *output_base,
 	drm_output_check_zpos_plane_states(state);
 
 	/* Check to see if this state will actually work. */
-	ret = drm_pending_state_test(state->pending_state);
+	ret = cached ? 0 : drm_pending_state_test(state->pending_state);
 	if (ret != 0) {
 		drm_debug(b, "\t\t[view] failing state generation: "
 			     "atomic test not OK\n");
@@ -961,6 +1560,40 @@ err:
 	return NULL;
 }
 
+/* Log, once per change, why a view the shell wants scanned out ended up
+ * being composited, and when it makes it back onto a plane. */
+static void
+drm_output_report_scanout_fallback(struct drm_output *output,
+				   struct weston_view *ev,
+				   enum drm_output_propose_state_mode mode,
+				   struct drm_plane *target_plane,
+				   uint32_t failure_reasons)
+{
+	char reasons[256];
+
+	if (target_plane) {
+		if (output->scanout_fallback_reported)
+			weston_log("Output '%s': surface of view %p is back on "
+				   "%s plane %lu\n", output->base.name, ev,
+				   drm_output_get_plane_type_name(target_plane),
+				   (unsigned long) target_plane->plane_id);
+		output->scanout_fallback_reported = false;
+		output->scanout_fallback_reasons = FAILURE_REASONS_NONE;
+		return;
+	}
+
+	if (output->scanout_fallback_reported &&
+	    output->scanout_fallback_reasons == failure_reasons)
+		return;
+
+	drm_failure_reasons_to_str(failure_reasons, reasons, sizeof(reasons));
+	weston_log("Output '%s': surface of view %p falls back to %s "
+		   "composition (%s)\n", output->base.name, ev,
+		   drm_propose_state_mode_to_string(mode), reasons);
+	output->scanout_fallback_reported = true;
+	output->scanout_fallback_reasons = failure_reasons;
+}
+
 void
 drm_assign_planes(struct weston_output *output_base)
 {
@@ -971,25 +1604,60 @@ drm_assign_planes(struct weston_output *output_base)
 	struct drm_output_state *state = NULL;
 	struct drm_plane_state *plane_state;
 	struct drm_writeback_state *wb_state = output->wb_state;
-	struct weston_paint_node *pnode;
+	struct weston_paint_node *pnode, **nodes;
 	struct weston_plane *primary = &output_base->primary_plane;
 	enum drm_output_propose_state_mode mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+	unsigned int n_nodes, i;
+	bool cache_hit;
 
 	assert(output);
 
+	/* Which views may go on planes depends on where the blending to
+	 * output color transformation happens */
+	drm_output_ensure_color_pipeline(output);
+
 	drm_debug(b, "\t[repaint] preparing state for output %s (%lu)\n",
 		  output_base->name, (unsigned long) output_base->id);
 
-	if (!device->sprites_are_broken && !output->is_virtual && b->gbm) {
+	if (!output->plane_cache)
+		output->plane_cache = xzalloc(sizeof(*output->plane_cache));
+
+	cache_hit = drm_plane_cache_lookup(output);
+	if (cache_hit) {
+		struct drm_plane_cache *cache = output->plane_cache;
+
+		drm_debug(b, "\t[repaint] scene unchanged, reusing %s\n",
+			  drm_propose_state_mode_to_string(cache->state_mode));
+		mode = cache->state_mode;
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode, cache->entries);
+		if (state && !drm_plane_cache_matches(cache, state)) {
+			drm_output_state_free(state);
+			state = NULL;
+		}
+		if (state) {
+			state->tear &= cache->tear;
+		} else {
+			drm_debug(b, "\t[repaint] cached plane assignment "
+				     "does not apply anymore\n");
+			cache_hit = false;
+			mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+		}
+	}
+
+	if (state) {
+		/* reused from the cache, nothing to try */
+	} else if (!device->sprites_are_broken && !output->is_virtual && b->gbm) {
 		drm_debug(b, "\t[repaint] trying planes-only build state\n");
-		state = drm_output_propose_state(output_base, pending_state, mode);
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode, NULL);
 		if (!state) {
 			drm_debug(b, "\t[repaint] could not build planes-only "
 				     "state, trying mixed\n");
 			mode = DRM_OUTPUT_PROPOSE_STATE_MIXED;
 			state = drm_output_propose_state(output_base,
 							 pending_state,
-							 mode);
+							 mode, NULL);
 		}
 	} else {
 		drm_debug(b, "\t[state] no overlay plane support\n");
@@ -1003,7 +1671,7 @@ drm_assign_planes(struct weston_output *output_base)
 			     "trying renderer-only\n");
 		mode = DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY;
 		state = drm_output_propose_state(output_base, pending_state,
-						 mode);
+						 mode, NULL);
 		/* If renderer only mode failed and we are in a writeback
 		 * screenshot, let's abort the writeback screenshot and try
 		 * again. */
@@ -1012,18 +1680,26 @@ drm_assign_planes(struct weston_output *output_base)
 				     "state, trying without writeback setup\n");
 			drm_writeback_fail_screenshot(wb_state, "drm: failed to propose state");
 			state = drm_output_propose_state(output_base, pending_state,
-							 mode);
+							 mode, NULL);
 		}
 	}
 
 	assert(state);
-	drm_debug(b, "\t[repaint] Using %s composition\n",
-		  drm_propose_state_mode_to_string(mode));
+	drm_debug(b, "\t[repaint] Using %s composition%s\n",
+		  drm_propose_state_mode_to_string(mode),
+		  cache_hit ? " (cached)" : "");
 
-	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
-			 z_order_link) {
-		struct weston_view *ev = pnode->view;
+	if (!cache_hit)
+		drm_plane_cache_update(output, state, mode);
+
+	nodes = weston_output_get_paint_nodes(output_base, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		struct weston_view *ev;
 		struct drm_plane *target_plane = NULL;
+		uint32_t failure_reasons;
+
+		pnode = nodes[i];
+		ev = pnode->view;
 
 		assert(ev->output_mask & (1u << output->base.id));
 
@@ -1031,6 +1707,7 @@ drm_assign_planes(struct weston_output *output_base)
 		if (ev->surface->dmabuf_feedback)
 			dmabuf_feedback_maybe_update(device, ev,
 						     pnode->try_view_on_plane_failure_reasons);
+		failure_reasons = pnode->try_view_on_plane_failure_reasons;
 		pnode->try_view_on_plane_failure_reasons = FAILURE_REASONS_NONE;
 
 		/* Test whether this buffer can ever go into a plane:
@@ -1061,15 +1738,27 @@ drm_assign_planes(struct weston_output *output_base)
 			}
 		}
 
+		if (ev->surface->scanout_preferred)
+			drm_output_report_scanout_fallback(output, ev, mode,
+							   target_plane,
+							   failure_reasons);
+
 		if (target_plane) {
 			drm_debug(b, "\t[repaint] view %p on %s plane %lu\n",
 				  ev, drm_output_get_plane_type_name(target_plane),
 				  (unsigned long) target_plane->plane_id);
 			weston_paint_node_move_to_plane(pnode, &target_plane->base);
+			weston_metric_inc(b->compositor,
+					  WESTON_METRIC_DRM_VIEWS_ON_PLANES);
+			if (target_plane->type == WDRM_PLANE_TYPE_CURSOR)
+				weston_metric_inc(b->compositor,
+						  WESTON_METRIC_DRM_VIEWS_ON_CURSOR);
 		} else {
 			drm_debug(b, "\t[repaint] view %p using renderer "
 				     "composition\n", ev);
 			weston_paint_node_move_to_plane(pnode, primary);
+			weston_metric_inc(b->compositor,
+					  WESTON_METRIC_DRM_VIEWS_ON_RENDERER);
 			pnode->need_hole = false;
 		}
 
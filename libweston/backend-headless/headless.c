@@ -29,14 +29,17 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <stdbool.h>
+#include <unistd.h>
 
 #include <libweston/libweston.h>
 #include <libweston/backend-headless.h>
+#include <libweston/weston-log.h>
 #include "shared/helpers.h"
 #include "linux-explicit-synchronization.h"
 #include "pixel-formats.h"
@@ -69,24 +72,53 @@ struct headless_backend {
 
 	int refresh;
 	bool repaint_only_on_capture;
+	bool max_throughput;
+	bool gpu_fence;
+
+	struct weston_log_scope *debug;
 };
 
 struct headless_head {
 	struct weston_head base;
 };
 
+struct weston_headless_buffer {
+	struct headless_output *output;
+	struct weston_renderbuffer *renderbuffer;
+	/* Owned by the renderbuffer */
+	struct dmabuf_attributes *attributes;
+	bool busy;
+};
+
 struct headless_output {
 	struct weston_output base;
 	struct headless_backend *backend;
 
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	struct wl_event_source *finish_frame_idle;
+	struct wl_event_source *fence_source;
+	int fence_fd;
 	struct weston_renderbuffer *renderbuffer;
 
+	uint64_t frame_count;
+	struct timespec repaint_start;
+	struct timespec repaint_end;
+	struct timespec last_finish;
+
 	struct frame *frame;
 	struct {
 		struct weston_gl_borders borders;
 	} gl;
+
+	struct {
+		weston_headless_submit_frame_cb submit_frame;
+		void *data;
+		unsigned int num_buffers;
+		struct weston_headless_buffer *buffers;
+		/* Damage not rendered while the embedder held all buffers */
+		pixman_region32_t held_damage;
+	} dmabuf_export;
 };
 
 static const uint32_t headless_formats[] = {
@@ -133,16 +165,126 @@ headless_output_start_repaint_loop(struct weston_output *output)
 	return 0;
 }
 
+static void
+headless_output_log_frame(struct headless_output *output,
+			  const struct timespec *now)
+{
+	struct weston_log_scope *scope = output->backend->debug;
+	int64_t interval = 0;
+
+	output->frame_count++;
+
+	if (weston_log_scope_is_enabled(scope)) {
+		if (output->last_finish.tv_sec || output->last_finish.tv_nsec)
+			interval = timespec_sub_to_nsec(now,
+							&output->last_finish);
+
+		weston_log_scope_printf(scope,
+			"%s: frame %" PRIu64 " render %.3f ms wait %.3f ms "
+			"interval %.3f ms\n",
+			output->base.name, output->frame_count,
+			timespec_sub_to_nsec(&output->repaint_end,
+					     &output->repaint_start) / 1e6,
+			timespec_sub_to_nsec(now, &output->repaint_end) / 1e6,
+			interval / 1e6);
+	}
+
+	output->last_finish = *now;
+}
+
 static int
 finish_frame_handler(void *data)
 {
 	struct headless_output *output = data;
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(output->base.compositor,
+						  &now);
+	headless_output_log_frame(output, &now);
 
 	weston_output_finish_frame_from_timer(&output->base);
 
 	return 1;
 }
 
+/* In max-throughput mode the frame completes as soon as it has been
+ * rendered. Tearing mode makes the core repaint again right away instead
+ * of waiting for the next emulated vblank. */
+static void
+headless_output_finish_frame_now(struct headless_output *output)
+{
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(output->base.compositor,
+						  &now);
+	headless_output_log_frame(output, &now);
+
+	weston_output_finish_frame(&output->base, &now,
+				   WESTON_FINISH_FRAME_TEARING);
+}
+
+static void
+finish_frame_idle_handler(void *data)
+{
+	struct headless_output *output = data;
+
+	output->finish_frame_idle = NULL;
+	headless_output_finish_frame_now(output);
+}
+
+static void
+headless_output_cancel_fence(struct headless_output *output)
+{
+	if (!output->fence_source)
+		return;
+
+	wl_event_source_remove(output->fence_source);
+	output->fence_source = NULL;
+	close(output->fence_fd);
+	output->fence_fd = -1;
+}
+
+static int
+headless_output_fence_handler(int fd, uint32_t mask, void *data)
+{
+	struct headless_output *output = data;
+
+	headless_output_cancel_fence(output);
+	headless_output_finish_frame_now(output);
+
+	return 0;
+}
+
+/* Complete the frame once the GPU is done with it rather than when the
+ * commands have been submitted, so that the reported throughput is the
+ * one the GPU actually sustains. */
+static bool
+headless_output_wait_fence(struct headless_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct wl_event_loop *loop;
+	int fence_fd;
+
+	if (renderer->type != WESTON_RENDERER_GL)
+		return false;
+
+	fence_fd = renderer->gl->create_fence_fd(&output->base);
+	if (fence_fd == -1)
+		return false;
+
+	loop = wl_display_get_event_loop(output->backend->compositor->wl_display);
+	output->fence_source =
+		wl_event_loop_add_fd(loop, fence_fd, WL_EVENT_READABLE,
+				     headless_output_fence_handler, output);
+	if (!output->fence_source) {
+		close(fence_fd);
+		return false;
+	}
+	output->fence_fd = fence_fd;
+
+	return true;
+}
+
 static void
 headless_output_update_gl_border(struct headless_output *output)
 {
@@ -155,35 +297,208 @@ headless_output_update_gl_border(struct headless_output *output)
 				 &output->base);
 }
 
+static struct weston_headless_buffer *
+headless_output_get_free_buffer(struct headless_output *output)
+{
+	unsigned int i;
+
+	for (i = 0; i < output->dmabuf_export.num_buffers; i++) {
+		if (!output->dmabuf_export.buffers[i].busy)
+			return &output->dmabuf_export.buffers[i];
+	}
+
+	return NULL;
+}
+
+/* Render into a free DMABUF and hand it to the embedder, with the damage
+ * in buffer coordinates and a fence for the GPU work. */
+static void
+headless_output_repaint_dmabuf_export(struct headless_output *output,
+				      pixman_region32_t *damage)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct weston_headless_frame frame = { 0 };
+	struct weston_headless_buffer *buffer;
+	struct dmabuf_attributes *attributes;
+	pixman_region32_t buffer_damage;
+	int32_t x, y;
+	int i;
+
+	pixman_region32_union(damage, damage,
+			      &output->dmabuf_export.held_damage);
+	pixman_region32_clear(&output->dmabuf_export.held_damage);
+
+	buffer = headless_output_get_free_buffer(output);
+	if (!buffer) {
+		weston_log_scope_printf(output->backend->debug,
+					"%s: no free buffer, holding damage\n",
+					output->base.name);
+		pixman_region32_copy(&output->dmabuf_export.held_damage,
+				     damage);
+		return;
+	}
+
+	renderer->repaint_output(&output->base, damage, buffer->renderbuffer);
+
+	/* Nothing changed, nothing for the embedder */
+	if (!pixman_region32_not_empty(damage))
+		return;
+
+	pixman_region32_init(&buffer_damage);
+	weston_region_global_to_output(&buffer_damage, &output->base, damage);
+	if (output->frame) {
+		frame_interior(output->frame, &x, &y, NULL, NULL);
+		pixman_region32_translate(&buffer_damage, x, y);
+	}
+
+	attributes = buffer->attributes;
+	frame.buffer = buffer;
+	frame.width = attributes->width;
+	frame.height = attributes->height;
+	frame.format = attributes->format;
+	frame.modifier = attributes->modifier;
+	frame.n_planes = attributes->n_planes;
+	for (i = 0; i < attributes->n_planes; i++) {
+		frame.fd[i] = attributes->fd[i];
+		frame.offset[i] = attributes->offset[i];
+		frame.stride[i] = attributes->stride[i];
+	}
+	frame.fence_fd = renderer->gl->create_fence_fd(&output->base);
+	frame.damage = &buffer_damage;
+
+	if (output->dmabuf_export.submit_frame(&output->base, &frame,
+					       output->dmabuf_export.data) == 0)
+		buffer->busy = true;
+	else if (frame.fence_fd >= 0)
+		close(frame.fence_fd);
+
+	pixman_region32_fini(&buffer_damage);
+}
+
 static int
 headless_output_repaint(struct weston_output *output_base)
 {
 	struct headless_output *output = to_headless_output(output_base);
+	struct headless_backend *b;
 	struct weston_compositor *ec;
+	struct wl_event_loop *loop;
 	pixman_region32_t damage;
 	int delay_msec;
 
 	assert(output);
 
+	b = output->backend;
 	ec = output->base.compositor;
 
+	weston_compositor_read_presentation_clock(ec, &output->repaint_start);
+
 	headless_output_update_gl_border(output);
 
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(&output->base, &damage,
-				     output->renderbuffer);
+	if (output->dmabuf_export.submit_frame)
+		headless_output_repaint_dmabuf_export(output, &damage);
+	else
+		ec->renderer->repaint_output(&output->base, &damage,
+					     output->renderbuffer);
 
 	pixman_region32_fini(&damage);
 
-	delay_msec = millihz_to_nsec(output->mode.refresh) / 1000000;
-	wl_event_source_timer_update(output->finish_frame_timer, delay_msec);
+	weston_compositor_read_presentation_clock(ec, &output->repaint_end);
+
+	if (!b->max_throughput) {
+		delay_msec = millihz_to_nsec(output->mode.refresh) / 1000000;
+		wl_event_source_timer_update(output->finish_frame_timer,
+					     delay_msec);
+		return 0;
+	}
+
+	if (b->gpu_fence && headless_output_wait_fence(output))
+		return 0;
+
+	/* The core only expects the frame to finish after we return. */
+	loop = wl_display_get_event_loop(ec->wl_display);
+	output->finish_frame_idle =
+		wl_event_loop_add_idle(loop, finish_frame_idle_handler, output);
+	if (!output->finish_frame_idle)
+		wl_event_source_timer_update(output->finish_frame_timer, 1);
 
 	return 0;
 }
 
+static void
+headless_output_destroy_buffers(struct headless_output *output)
+{
+	const struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct weston_headless_buffer *buffer;
+	unsigned int i;
+
+	if (!output->dmabuf_export.buffers)
+		return;
+
+	for (i = 0; i < output->dmabuf_export.num_buffers; i++) {
+		buffer = &output->dmabuf_export.buffers[i];
+		if (!buffer->renderbuffer)
+			continue;
+
+		renderer->remove_renderbuffer_dmabuf(&output->base,
+						     buffer->renderbuffer);
+		weston_renderbuffer_unref(buffer->renderbuffer);
+	}
+
+	free(output->dmabuf_export.buffers);
+	output->dmabuf_export.buffers = NULL;
+	pixman_region32_clear(&output->dmabuf_export.held_damage);
+}
+
+static int
+headless_output_create_buffers(struct headless_output *output,
+			       int width, int height)
+{
+	const struct weston_renderer *renderer = output->base.compositor->renderer;
+	uint32_t format = output->backend->formats[0]->format;
+	uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
+	struct linux_dmabuf_memory *dmabuf;
+	struct weston_headless_buffer *buffer;
+	unsigned int i;
+
+	output->dmabuf_export.buffers =
+		xcalloc(output->dmabuf_export.num_buffers,
+			sizeof *output->dmabuf_export.buffers);
+
+	for (i = 0; i < output->dmabuf_export.num_buffers; i++) {
+		buffer = &output->dmabuf_export.buffers[i];
+		buffer->output = output;
+
+		dmabuf = renderer->dmabuf_alloc(output->base.compositor->renderer,
+						width, height, format,
+						modifier, ARRAY_LENGTH(modifier));
+		if (!dmabuf) {
+			weston_log("Failed to allocate DMABUF (%dx%d)\n",
+				   width, height);
+			goto err;
+		}
+
+		/* On success, the renderbuffer takes ownership of the dmabuf. */
+		buffer->attributes = dmabuf->attributes;
+		buffer->renderbuffer =
+			renderer->create_renderbuffer_dmabuf(&output->base,
+							     dmabuf);
+		if (!buffer->renderbuffer) {
+			dmabuf->destroy(dmabuf);
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	headless_output_destroy_buffers(output);
+	return -1;
+}
+
 static void
 headless_output_disable_gl(struct headless_output *output)
 {
@@ -192,6 +507,7 @@ headless_output_disable_gl(struct headless_output *output)
 
 	weston_gl_borders_fini(&output->gl.borders, &output->base);
 
+	headless_output_destroy_buffers(output);
 	weston_renderbuffer_unref(output->renderbuffer);
 	output->renderbuffer = NULL;
 	renderer->gl->output_destroy(&output->base);
@@ -226,6 +542,11 @@ headless_output_disable(struct weston_output *base)
 	b = output->backend;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->finish_frame_idle) {
+		wl_event_source_remove(output->finish_frame_idle);
+		output->finish_frame_idle = NULL;
+	}
+	headless_output_cancel_fence(output);
 
 	switch (b->compositor->renderer->type) {
 	case WESTON_RENDERER_GL:
@@ -254,6 +575,7 @@ headless_output_destroy(struct weston_output *base)
 	weston_output_release(&output->base);
 
 	assert(!output->frame);
+	pixman_region32_fini(&output->dmabuf_export.held_damage);
 	free(output);
 }
 
@@ -300,6 +622,15 @@ headless_output_enable_gl(struct headless_output *output)
 		return -1;
 	}
 
+	if (output->dmabuf_export.submit_frame) {
+		if (headless_output_create_buffers(output,
+						   options.fb_size.width,
+						   options.fb_size.height) < 0)
+			goto err_renderbuffer;
+
+		return 0;
+	}
+
 	output->renderbuffer =
 		renderer->gl->create_fbo(&output->base, b->formats[0],
 					 options.fb_size.width,
@@ -311,6 +642,10 @@ headless_output_enable_gl(struct headless_output *output)
 
 err_renderbuffer:
 	renderer->gl->output_destroy(&output->base);
+	if (output->frame) {
+		frame_destroy(output->frame);
+		output->frame = NULL;
+	}
 
 	return -1;
 }
@@ -460,6 +795,8 @@ headless_output_create(struct weston_backend *backend, const char *name)
 	output->base.repaint_only_on_capture = b->repaint_only_on_capture;
 
 	output->backend = b;
+	output->fence_fd = -1;
+	pixman_region32_init(&output->dmabuf_export.held_damage);
 
 	weston_compositor_add_pending_output(&output->base, compositor);
 
@@ -528,6 +865,7 @@ headless_destroy(struct weston_backend *backend)
 	if (b->theme)
 		theme_destroy(b->theme);
 
+	weston_log_scope_destroy(b->debug);
 	free(b->formats);
 	free(b);
 
@@ -542,6 +880,50 @@ static const struct weston_windowed_output_api api = {
 	headless_head_create,
 };
 
+static int
+headless_output_set_dmabuf_export(struct weston_output *base,
+				  unsigned int num_buffers,
+				  weston_headless_submit_frame_cb submit_frame,
+				  void *data)
+{
+	struct headless_output *output = to_headless_output(base);
+	const struct weston_renderer *renderer;
+
+	if (!output || output->base.enabled || num_buffers == 0)
+		return -1;
+
+	renderer = output->base.compositor->renderer;
+	if (renderer->type != WESTON_RENDERER_GL ||
+	    !renderer->dmabuf_alloc || !renderer->create_renderbuffer_dmabuf) {
+		weston_log("Error: DMABUF export of headless outputs "
+			   "needs a GL renderer that allocates DMABUFs.\n");
+		return -1;
+	}
+
+	output->dmabuf_export.submit_frame = submit_frame;
+	output->dmabuf_export.data = data;
+	output->dmabuf_export.num_buffers = num_buffers;
+
+	return 0;
+}
+
+static void
+headless_output_buffer_released(struct weston_headless_buffer *buffer)
+{
+	struct headless_output *output = buffer->output;
+
+	assert(buffer->busy);
+	buffer->busy = false;
+
+	if (pixman_region32_not_empty(&output->dmabuf_export.held_damage))
+		weston_output_schedule_repaint(&output->base);
+}
+
+static const struct weston_headless_output_api headless_output_api = {
+	headless_output_set_dmabuf_export,
+	headless_output_buffer_released,
+};
+
 static struct headless_backend *
 headless_backend_create(struct weston_compositor *compositor,
 			struct weston_headless_backend_config *config)
@@ -586,6 +968,13 @@ headless_backend_create(struct weston_compositor *compositor,
 		b->refresh = DEFAULT_OUTPUT_REPAINT_REFRESH;
 	}
 
+	b->max_throughput = config->max_throughput;
+	b->gpu_fence = config->gpu_fence;
+
+	b->debug = weston_compositor_add_log_scope(compositor, "headless",
+						   "Per-frame timing of the headless backend\n",
+						   NULL, NULL, NULL);
+
 	if (!compositor->renderer) {
 		switch (config->renderer) {
 		case WESTON_RENDERER_GL: {
@@ -641,9 +1030,19 @@ headless_backend_create(struct weston_compositor *compositor,
 		goto err_input;
 	}
 
+	ret = weston_plugin_api_register(compositor,
+					 WESTON_HEADLESS_OUTPUT_API_NAME,
+					 &headless_output_api,
+					 sizeof(headless_output_api));
+	if (ret < 0) {
+		weston_log("Failed to register headless output API.\n");
+		goto err_input;
+	}
+
 	return b;
 
 err_input:
+	weston_log_scope_destroy(b->debug);
 	if (b->theme)
 		theme_destroy(b->theme);
 err_free:
@@ -41,6 +41,11 @@
 #include <drm_fourcc.h>
 #include <fcntl.h>
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+#include <pthread.h>
+#include <sys/eventfd.h>
+#endif
+
 #include <pipewire/pipewire.h>
 #include <spa/buffer/meta.h>
 #include <spa/debug/types.h>
@@ -61,6 +66,10 @@
 #include "renderer-gl/gl-renderer.h"
 #include "shared/weston-egl-ext.h"
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+#include "vaapi-recorder.h"
+#endif
+
 struct pipewire_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
@@ -78,7 +87,23 @@ struct pipewire_backend {
 
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
+
+	char *h264_device;
+	uint32_t h264_bitrate;
+
+	/* Idle DMABUFs of destroyed streams, pipewire_dmabuf::link */
+	struct wl_list dmabuf_pool;
+	unsigned int dmabuf_pool_count;
+};
+
+#ifdef BUILD_PIPEWIRE_VAAPI
+struct pipewire_h264_packet {
+	struct wl_list link;
+	bool keyframe;
+	size_t size;
+	uint8_t data[];
 };
+#endif
 
 struct pipewire_output {
 	struct weston_output base;
@@ -93,6 +118,31 @@ struct pipewire_output {
 
 	struct wl_event_source *finish_frame_timer;
 	struct wl_list link;
+
+	/* Consumer demand, see pipewire_output_stream_trigger_done() */
+	unsigned int n_buffers;
+	unsigned int frames_in_flight;
+	bool frame_due;
+	pixman_region32_t held_damage; /* while no buffer is free */
+
+#ifdef BUILD_PIPEWIRE_VAAPI
+	/* Set while the stream negotiated an H.264 format */
+	struct {
+		struct vaapi_recorder *recorder;
+		struct weston_renderbuffer *renderbuffer;
+		struct linux_dmabuf_memory *dmabuf;
+		size_t max_size;
+
+		int fence_fd;
+		struct wl_event_source *fence_source;
+
+		/* Encoded frames handed over by the encoder thread */
+		pthread_mutex_t mutex;
+		struct wl_list packets;
+		int wakeup_fd;
+		struct wl_event_source *wakeup_source;
+	} h264;
+#endif
 };
 
 struct pipewire_head {
@@ -252,13 +302,64 @@ spa_pod_build_format(struct spa_pod_builder *builder,
 	return spa_pod_builder_pop(builder, &f);
 }
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+static struct spa_pod *
+spa_pod_build_format_h264(struct spa_pod_builder *builder,
+			  int width, int height, int framerate)
+{
+	struct spa_pod_frame f;
+
+	spa_pod_builder_push_object(builder, &f,
+				    SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_h264), 0);
+
+	spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_size, 0);
+	spa_pod_builder_rectangle(builder, width, height);
+
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_framerate,
+			    SPA_POD_Fraction(&SPA_FRACTION(0, 1)), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_maxFramerate,
+			    SPA_POD_CHOICE_RANGE_Fraction(
+				    &SPA_FRACTION(framerate,1),
+				    &SPA_FRACTION(1,1),
+				    &SPA_FRACTION(framerate,1)), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_H264_streamFormat,
+			    SPA_POD_Id(SPA_H264_STREAM_FORMAT_BYTESTREAM), 0);
+	spa_pod_builder_add(builder,
+			    SPA_FORMAT_VIDEO_H264_alignment,
+			    SPA_POD_Id(SPA_H264_ALIGNMENT_AU), 0);
+
+	return spa_pod_builder_pop(builder, &f);
+}
+
+/* The encoder imports the rendered dmabuf directly, so encoded streams need
+ * the GL renderer with a dmabuf allocator, and the VA-API post processing
+ * only takes BGRX input. */
+static bool
+pipewire_output_can_encode(struct pipewire_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+
+	return output->backend->h264_device &&
+	       renderer->type == WESTON_RENDERER_GL &&
+	       pipewire_backend_has_dmabuf_allocator(output->backend) &&
+	       output->pixel_format->format == DRM_FORMAT_XRGB8888;
+}
+#endif
+
 static int
 pipewire_output_connect(struct pipewire_output *output)
 {
 	uint8_t buffer[1024];
 	struct spa_pod_builder builder =
 		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-	const struct spa_pod *params[2];
+	const struct spa_pod *params[3];
 	int i = 0;
 	int ret;
 
@@ -277,6 +378,14 @@ pipewire_output_connect(struct pipewire_output *output)
 					   output->base.current_mode->refresh / 1000,
 					   output->pixel_format->format, NULL);
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	if (pipewire_output_can_encode(output))
+		params[i++] = spa_pod_build_format_h264(&builder,
+							output->base.width,
+							output->base.height,
+							output->base.current_mode->refresh / 1000);
+#endif
+
 	ret = pw_stream_connect(output->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
 				PW_STREAM_FLAG_DRIVER |
 				PW_STREAM_FLAG_ALLOC_BUFFERS,
@@ -290,12 +399,40 @@ pipewire_output_connect(struct pipewire_output *output)
 	return 0;
 }
 
+/* With triple buffering, one buffer can be with the consumer and one
+ * queued while the next frame is drawn into the last one. */
+static unsigned int
+pipewire_output_max_frames_in_flight(struct pipewire_output *output)
+{
+	return MAX(output->n_buffers, 3) - 2;
+}
+
+static void
+pipewire_output_finish_frame(struct pipewire_output *output)
+{
+	output->frame_due = false;
+	weston_output_finish_frame_from_timer(&output->base);
+
+	/* Retry the damage that found no free buffer */
+	if (pixman_region32_not_empty(&output->held_damage))
+		weston_output_schedule_repaint(&output->base);
+}
+
 static int
 finish_frame_handler(void *data)
 {
 	struct pipewire_output *output = data;
 
-	weston_output_finish_frame_from_timer(&output->base);
+	/* The frame finishes once the consumer took enough of the queued
+	 * ones, so that the compositor paces itself to the consumer
+	 * instead of rendering frames that would not find a buffer. */
+	if (output->frames_in_flight >=
+	    pipewire_output_max_frames_in_flight(output)) {
+		output->frame_due = true;
+		return 1;
+	}
+
+	pipewire_output_finish_frame(output);
 
 	return 1;
 }
@@ -419,6 +556,10 @@ pipewire_output_disable(struct weston_output *base)
 
 	pw_stream_disconnect(output->stream);
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	pipewire_output_h264_stop(output);
+#endif
+
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
 		pipewire_output_disable_pixman(output);
@@ -446,6 +587,7 @@ pipewire_output_destroy(struct weston_output *base)
 	weston_output_release(&output->base);
 
 	pw_stream_destroy(output->stream);
+	pixman_region32_fini(&output->held_damage);
 
 	free(output);
 }
@@ -463,20 +605,125 @@ pipewire_output_stream_state_changed(void *data, enum pw_stream_state old,
 
 	switch (state) {
 	case PW_STREAM_STATE_STREAMING:
+#ifdef BUILD_PIPEWIRE_VAAPI
+		/* A new consumer can only start decoding at an IDR picture. */
+		if (output->h264.recorder)
+			vaapi_recorder_force_keyframe(output->h264.recorder);
+#endif
 		/* Repaint required to push the frame to the new consumer. */
 		weston_output_damage(&output->base);
 		weston_output_schedule_repaint(&output->base);
 		break;
 	default:
+		/* No cycle is going to complete for what is in flight. */
+		output->frames_in_flight = 0;
+		if (output->frame_due)
+			pipewire_output_finish_frame(output);
 		break;
 	}
 }
 
+/* Emitted on the main loop when a graph cycle, started by queueing a
+ * buffer, has completed: the consumer has taken the frame. */
+static void
+pipewire_output_stream_trigger_done(void *data)
+{
+	struct pipewire_output *output = data;
+
+	if (output->frames_in_flight > 0)
+		output->frames_in_flight--;
+
+	if (output->frame_due &&
+	    output->frames_in_flight <
+	    pipewire_output_max_frames_in_flight(output))
+		pipewire_output_finish_frame(output);
+}
+
+/* Streams come and go with screen sharing sessions, and every new stream
+ * would allocate and import its buffers again. DMABUFs are instead returned
+ * to a small pool on the backend, and reused by the next stream asking for
+ * the same size and format. */
+#define PIPEWIRE_DMABUF_POOL_SIZE 8
+
+/* The renderer owns the DMABUF given to create_renderbuffer_dmabuf(), and
+ * destroys it along with the renderbuffer. What it gets is the base of this
+ * wrapper, which goes back to the pool instead. */
 struct pipewire_dmabuf {
+	struct linux_dmabuf_memory base;
+	struct pipewire_backend *backend;
 	struct linux_dmabuf_memory *linux_dmabuf_memory;
 	unsigned int size;
+	struct wl_list link; /* pipewire_backend::dmabuf_pool */
 };
 
+static void
+pipewire_dmabuf_free(struct pipewire_dmabuf *dmabuf)
+{
+	dmabuf->linux_dmabuf_memory->destroy(dmabuf->linux_dmabuf_memory);
+	free(dmabuf);
+}
+
+static void
+pipewire_dmabuf_release(struct linux_dmabuf_memory *base)
+{
+	struct pipewire_dmabuf *dmabuf =
+		container_of(base, struct pipewire_dmabuf, base);
+	struct pipewire_backend *b = dmabuf->backend;
+	struct pipewire_dmabuf *oldest;
+
+	/* The renderer, and the allocator with it, is going away. */
+	if (b->compositor->shutting_down) {
+		pipewire_dmabuf_free(dmabuf);
+		return;
+	}
+
+	wl_list_insert(&b->dmabuf_pool, &dmabuf->link);
+	if (++b->dmabuf_pool_count <= PIPEWIRE_DMABUF_POOL_SIZE)
+		return;
+
+	oldest = container_of(b->dmabuf_pool.prev, struct pipewire_dmabuf, link);
+	wl_list_remove(&oldest->link);
+	b->dmabuf_pool_count--;
+	pipewire_dmabuf_free(oldest);
+}
+
+static void
+pipewire_backend_flush_dmabuf_pool(struct pipewire_backend *b)
+{
+	struct pipewire_dmabuf *dmabuf, *tmp;
+
+	wl_list_for_each_safe(dmabuf, tmp, &b->dmabuf_pool, link) {
+		wl_list_remove(&dmabuf->link);
+		pipewire_dmabuf_free(dmabuf);
+	}
+	b->dmabuf_pool_count = 0;
+}
+
+static struct pipewire_dmabuf *
+pipewire_backend_take_dmabuf(struct pipewire_backend *b,
+			     unsigned int width, unsigned int height,
+			     uint32_t format)
+{
+	struct pipewire_dmabuf *dmabuf;
+
+	wl_list_for_each(dmabuf, &b->dmabuf_pool, link) {
+		struct dmabuf_attributes *attributes =
+			dmabuf->linux_dmabuf_memory->attributes;
+
+		if (attributes->width != (int32_t) width ||
+		    attributes->height != (int32_t) height ||
+		    attributes->format != format)
+			continue;
+
+		wl_list_remove(&dmabuf->link);
+		wl_list_init(&dmabuf->link);
+		b->dmabuf_pool_count--;
+		return dmabuf;
+	}
+
+	return NULL;
+}
+
 static struct pipewire_dmabuf *
 pipewire_output_create_dmabuf(struct pipewire_output *output)
 {
@@ -493,6 +740,12 @@ pipewire_output_create_dmabuf(struct pipewire_output *output)
 	width = output->base.width;
 	height = output->base.height;
 
+	dmabuf = pipewire_backend_take_dmabuf(b, width, height, format->format);
+	if (dmabuf) {
+		pipewire_output_debug(output, "reusing pooled DMABUF %p", dmabuf);
+		return dmabuf;
+	}
+
 	linux_dmabuf_memory = renderer->dmabuf_alloc(renderer, width, height,
 						     format->format,
 						     modifier,
@@ -504,19 +757,360 @@ pipewire_output_create_dmabuf(struct pipewire_output *output)
 	}
 
 	dmabuf = xzalloc(sizeof(*dmabuf));
+	dmabuf->base.attributes = linux_dmabuf_memory->attributes;
+	dmabuf->base.destroy = pipewire_dmabuf_release;
+	dmabuf->backend = b;
 	dmabuf->linux_dmabuf_memory = linux_dmabuf_memory;
 	dmabuf->size = linux_dmabuf_memory->attributes->stride[0] * height;
+	wl_list_init(&dmabuf->link);
 
 	return dmabuf;
 }
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+/* Called on the encoder thread for every encoded access unit */
 static void
-pipewire_destroy_dmabuf(struct pipewire_output *output,
-			struct pipewire_dmabuf *dmabuf)
+pipewire_output_h264_output(void *data, const void *bitstream, size_t size,
+			    bool keyframe)
 {
-	free(dmabuf);
+	struct pipewire_output *output = data;
+	struct pipewire_h264_packet *packet;
+	uint64_t one = 1;
+
+	packet = malloc(sizeof *packet + size);
+	if (!packet)
+		return;
+
+	packet->keyframe = keyframe;
+	packet->size = size;
+	memcpy(packet->data, bitstream, size);
+
+	pthread_mutex_lock(&output->h264.mutex);
+	wl_list_insert(output->h264.packets.prev, &packet->link);
+	pthread_mutex_unlock(&output->h264.mutex);
+
+	if (write(output->h264.wakeup_fd, &one, sizeof one) != sizeof one)
+		weston_log("Failed to wake up PipeWire output: %s\n",
+			   strerror(errno));
 }
 
+static void
+pipewire_submit_h264_packet(struct pipewire_output *output,
+			    struct pipewire_h264_packet *packet)
+{
+	struct pw_buffer *buffer;
+	struct spa_buffer *spa_buffer;
+	struct spa_meta_header *h;
+	struct spa_data *d;
+
+	/* Dropping a frame breaks the prediction chain, so make the consumer
+	 * resynchronize on the next IDR picture. */
+	if (packet->size > output->h264.max_size) {
+		weston_log("Encoded frame (%zu bytes) exceeds PipeWire buffer size\n",
+			   packet->size);
+		vaapi_recorder_force_keyframe(output->h264.recorder);
+		return;
+	}
+
+	buffer = pw_stream_dequeue_buffer(output->stream);
+	if (!buffer) {
+		pipewire_output_debug(output, "no buffer for encoded frame");
+		vaapi_recorder_force_keyframe(output->h264.recorder);
+		return;
+	}
+
+	spa_buffer = buffer->buffer;
+	d = &spa_buffer->datas[0];
+
+	memcpy(d->data, packet->data, packet->size);
+
+	if ((h = spa_buffer_find_meta_data(spa_buffer, SPA_META_Header,
+				     sizeof(struct spa_meta_header)))) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		h->pts = SPA_TIMESPEC_TO_NSEC(&ts);
+		h->flags = packet->keyframe ? 0 : SPA_META_HEADER_FLAG_DELTA_UNIT;
+		h->seq = output->seq;
+		h->dts_offset = 0;
+	}
+
+	d->chunk->offset = 0;
+	d->chunk->stride = 0;
+	d->chunk->size = packet->size;
+
+	pipewire_output_debug(output, "queue encoded buffer: %p (seq %d, %zu bytes%s)",
+			      buffer, output->seq, packet->size,
+			      packet->keyframe ? ", keyframe" : "");
+	pw_stream_queue_buffer(output->stream, buffer);
+
+	output->seq++;
+	output->frames_in_flight++;
+}
+
+static int
+pipewire_output_h264_wakeup_handler(int fd, uint32_t mask, void *data)
+{
+	struct pipewire_output *output = data;
+	struct pipewire_h264_packet *packet, *tmp;
+	struct wl_list packets;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 0;
+
+	wl_list_init(&packets);
+
+	pthread_mutex_lock(&output->h264.mutex);
+	wl_list_insert_list(&packets, &output->h264.packets);
+	wl_list_init(&output->h264.packets);
+	pthread_mutex_unlock(&output->h264.mutex);
+
+	wl_list_for_each_safe(packet, tmp, &packets, link) {
+		if (pw_stream_get_state(output->stream, NULL) ==
+		    PW_STREAM_STATE_STREAMING)
+			pipewire_submit_h264_packet(output, packet);
+		wl_list_remove(&packet->link);
+		free(packet);
+	}
+
+	return 0;
+}
+
+static void
+pipewire_output_h264_encode(struct pipewire_output *output)
+{
+	struct dmabuf_attributes *attributes = output->h264.dmabuf->attributes;
+	int fd;
+
+	/* The encoder takes ownership of the fd */
+	fd = fcntl(attributes->fd[0], F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+
+	if (vaapi_recorder_frame(output->h264.recorder, fd,
+				 attributes->stride[0]) < 0) {
+		weston_log("PipeWire H.264 encoder failed: %s\n",
+			   strerror(errno));
+		close(fd);
+		pw_stream_set_error(output->stream, -EIO,
+				    "H.264 encoding failed");
+	}
+}
+
+static void
+pipewire_output_h264_cancel_fence(struct pipewire_output *output)
+{
+	if (!output->h264.fence_source)
+		return;
+
+	wl_event_source_remove(output->h264.fence_source);
+	output->h264.fence_source = NULL;
+	close(output->h264.fence_fd);
+	output->h264.fence_fd = -1;
+}
+
+static int
+pipewire_output_h264_fence_handler(int fd, uint32_t mask, void *data)
+{
+	struct pipewire_output *output = data;
+
+	pipewire_output_h264_cancel_fence(output);
+	pipewire_output_h264_encode(output);
+
+	return 0;
+}
+
+static int
+pipewire_output_h264_start(struct pipewire_output *output)
+{
+	struct pipewire_backend *b = output->backend;
+	struct weston_renderer *renderer = b->compositor->renderer;
+	uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
+	const struct vaapi_recorder_options options = {
+		.width = output->base.width,
+		.height = output->base.height,
+		.framerate = output->base.current_mode->refresh / 1000,
+		.bitrate = b->h264_bitrate,
+		.output_func = pipewire_output_h264_output,
+		.output_data = output,
+	};
+	struct wl_event_loop *loop;
+	int width = output->base.width;
+	int height = output->base.height;
+	int drm_fd;
+
+	if (output->h264.recorder)
+		return 0;
+
+	output->h264.dmabuf = renderer->dmabuf_alloc(renderer, width, height,
+						     output->pixel_format->format,
+						     modifier,
+						     ARRAY_LENGTH(modifier));
+	if (!output->h264.dmabuf) {
+		weston_log("Failed to allocate DMABUF for H.264 encoding\n");
+		return -1;
+	}
+
+	output->h264.renderbuffer =
+		renderer->create_renderbuffer_dmabuf(&output->base,
+						     output->h264.dmabuf);
+	if (!output->h264.renderbuffer) {
+		output->h264.dmabuf->destroy(output->h264.dmabuf);
+		output->h264.dmabuf = NULL;
+		return -1;
+	}
+
+	drm_fd = open(b->h264_device, O_RDWR | O_CLOEXEC);
+	if (drm_fd < 0) {
+		weston_log("Failed to open H.264 encoder device %s: %s\n",
+			   b->h264_device, strerror(errno));
+		goto err_renderbuffer;
+	}
+
+	output->h264.wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (output->h264.wakeup_fd < 0) {
+		close(drm_fd);
+		goto err_renderbuffer;
+	}
+
+	pthread_mutex_init(&output->h264.mutex, NULL);
+	wl_list_init(&output->h264.packets);
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	output->h264.wakeup_source =
+		wl_event_loop_add_fd(loop, output->h264.wakeup_fd,
+				     WL_EVENT_READABLE,
+				     pipewire_output_h264_wakeup_handler,
+				     output);
+
+	/* On success the recorder owns drm_fd */
+	output->h264.recorder =
+		vaapi_recorder_create_with_options(drm_fd, &options);
+	if (!output->h264.recorder) {
+		weston_log("Failed to create VA-API H.264 encoder\n");
+		close(drm_fd);
+		goto err_wakeup;
+	}
+
+	/* Same bound the encoder starts with for its coded buffer */
+	output->h264.max_size = width * height;
+
+	return 0;
+
+err_wakeup:
+	wl_event_source_remove(output->h264.wakeup_source);
+	close(output->h264.wakeup_fd);
+	pthread_mutex_destroy(&output->h264.mutex);
+err_renderbuffer:
+	renderer->remove_renderbuffer_dmabuf(&output->base,
+					     output->h264.renderbuffer);
+	weston_renderbuffer_unref(output->h264.renderbuffer);
+	output->h264.renderbuffer = NULL;
+	output->h264.dmabuf = NULL;
+
+	return -1;
+}
+
+static void
+pipewire_output_h264_stop(struct pipewire_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct pipewire_h264_packet *packet, *tmp;
+
+	if (!output->h264.recorder)
+		return;
+
+	pipewire_output_h264_cancel_fence(output);
+
+	/* Joins the encoder thread, so no packets arrive after this */
+	vaapi_recorder_destroy(output->h264.recorder);
+	output->h264.recorder = NULL;
+
+	wl_list_for_each_safe(packet, tmp, &output->h264.packets, link) {
+		wl_list_remove(&packet->link);
+		free(packet);
+	}
+	pthread_mutex_destroy(&output->h264.mutex);
+
+	wl_event_source_remove(output->h264.wakeup_source);
+	close(output->h264.wakeup_fd);
+
+	renderer->remove_renderbuffer_dmabuf(&output->base,
+					     output->h264.renderbuffer);
+	weston_renderbuffer_unref(output->h264.renderbuffer);
+	output->h264.renderbuffer = NULL;
+	output->h264.dmabuf = NULL;
+}
+
+static void
+pipewire_output_repaint_h264(struct pipewire_output *output,
+			     pixman_region32_t *damage)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct wl_event_loop *loop;
+	int fence_fd;
+
+	renderer->repaint_output(&output->base, damage,
+				 output->h264.renderbuffer);
+
+	/* A frame still waiting for the GPU is superseded by this one */
+	pipewire_output_h264_cancel_fence(output);
+
+	fence_fd = renderer->gl->create_fence_fd(&output->base);
+	if (fence_fd == -1) {
+		pipewire_output_h264_encode(output);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(output->backend->compositor->wl_display);
+
+	output->h264.fence_fd = fence_fd;
+	output->h264.fence_source =
+		wl_event_loop_add_fd(loop, fence_fd, WL_EVENT_READABLE,
+				     pipewire_output_h264_fence_handler,
+				     output);
+}
+
+static void
+pipewire_output_stream_param_changed_h264(struct pipewire_output *output,
+					  const struct spa_pod *format)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder builder =
+		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[2];
+	struct spa_video_info_h264 info;
+
+	spa_format_video_h264_parse(format, &info);
+
+	if (pipewire_output_h264_start(output) < 0) {
+		pw_stream_set_error(output->stream, -EIO,
+				    "failed to set up H.264 encoder");
+		return;
+	}
+
+	pipewire_output_debug(output, "param changed: %dx%d@(%d/%d) (H.264) (%s)",
+			      info.size.width, info.size.height,
+			      info.max_framerate.num, info.max_framerate.denom,
+			      spa_debug_type_find_short_name(spa_type_data_type,
+				      SPA_DATA_MemFd));
+
+	params[0] = spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+		SPA_PARAM_BUFFERS_size, SPA_POD_Int(output->h264.max_size),
+		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
+		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1u << SPA_DATA_MemFd));
+
+	params[1] = spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+		SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+
+	pw_stream_update_params(output->stream, params, 2);
+}
+#endif
+
 static void
 pipewire_output_stream_param_changed(void *data, uint32_t id,
 				     const struct spa_pod *format)
@@ -539,8 +1133,18 @@ pipewire_output_stream_param_changed(void *data, uint32_t id,
 	if (spa_format_parse(format, &video_info.media_type,
 			     &video_info.media_subtype) < 0)
 		return;
-	if (video_info.media_type != SPA_MEDIA_TYPE_video ||
-	    video_info.media_subtype != SPA_MEDIA_SUBTYPE_raw)
+	if (video_info.media_type != SPA_MEDIA_TYPE_video)
+		return;
+
+#ifdef BUILD_PIPEWIRE_VAAPI
+	if (video_info.media_subtype == SPA_MEDIA_SUBTYPE_h264) {
+		pipewire_output_stream_param_changed_h264(output, format);
+		return;
+	}
+	pipewire_output_h264_stop(output);
+#endif
+
+	if (video_info.media_subtype != SPA_MEDIA_SUBTYPE_raw)
 		return;
 
 	spa_format_video_raw_parse(format, &video_info.info.raw);
@@ -563,8 +1167,8 @@ pipewire_output_stream_param_changed(void *data, uint32_t id,
 			stride = dmabuf->linux_dmabuf_memory->attributes->stride[0];
 			size = dmabuf->size;
 
-			dmabuf->linux_dmabuf_memory->destroy(dmabuf->linux_dmabuf_memory);
-			pipewire_destroy_dmabuf(output, dmabuf);
+			/* Probed for its stride, add_buffer picks it up. */
+			pipewire_dmabuf_release(&dmabuf->base);
 		}
 	}
 
@@ -582,7 +1186,7 @@ pipewire_output_stream_param_changed(void *data, uint32_t id,
 		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
 		SPA_PARAM_BUFFERS_size, SPA_POD_Int(size),
 		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride),
-		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
+		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(3, 2, 8),
 		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1u << buffertype));
 
 	params[1] = spa_pod_builder_add_object(&builder,
@@ -635,7 +1239,7 @@ pipewire_output_stream_add_buffer_gl(struct pipewire_output *output,
 
 	if (dmabuf)
 		return renderer->create_renderbuffer_dmabuf(&output->base,
-							    dmabuf->linux_dmabuf_memory);
+							    &dmabuf->base);
 
 	format = output->pixel_format;
 	width = output->base.width;
@@ -652,24 +1256,13 @@ struct pipewire_memfd {
 };
 
 static struct pipewire_memfd *
-pipewire_output_create_memfd(struct pipewire_output *output)
+pipewire_output_create_memfd(struct pipewire_output *output, size_t size)
 {
 	struct pipewire_memfd *memfd;
-	const struct pixel_format_info *format;
-	unsigned int width;
-	unsigned int height;
-	unsigned int stride;
-	size_t size;
 	int fd;
 
 	memfd = xzalloc(sizeof *memfd);
 
-	format = output->pixel_format;
-	width = output->base.width;
-	height = output->base.height;
-	stride = width * format->bpp / 8;
-	size = height * stride;
-
 	fd = memfd_create("weston-pipewire", MFD_CLOEXEC);
 	if (fd == -1)
 		return NULL;
@@ -742,6 +1335,7 @@ pipewire_output_stream_add_buffer(void *data, struct pw_buffer *buffer)
 
 	pipewire_output_debug(output, "add buffer: %p", buffer);
 
+	output->n_buffers++;
 	frame_data = xzalloc(sizeof *frame_data);
 	buffer->user_data = frame_data;
 
@@ -758,8 +1352,16 @@ pipewire_output_stream_add_buffer(void *data, struct pw_buffer *buffer)
 		frame_data->dmabuf = dmabuf;
 	} else if (buffertype & (1u << SPA_DATA_MemFd)) {
 		struct pipewire_memfd *memfd;
+		size_t size;
 
-		memfd = pipewire_output_create_memfd(output);
+		size = output->base.height *
+		       output->base.width * output->pixel_format->bpp / 8;
+#ifdef BUILD_PIPEWIRE_VAAPI
+		if (output->h264.recorder)
+			size = output->h264.max_size;
+#endif
+
+		memfd = pipewire_output_create_memfd(output, size);
 		if (!memfd) {
 			pw_stream_set_error(output->stream, -ENOMEM,
 					    "failed to allocate MemFd buffer");
@@ -769,6 +1371,12 @@ pipewire_output_stream_add_buffer(void *data, struct pw_buffer *buffer)
 		frame_data->memfd = memfd;
 	}
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	/* Encoded frames are copied in, nothing renders into these */
+	if (output->h264.recorder)
+		return;
+#endif
+
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
 		frame_data->renderbuffer = pipewire_output_stream_add_buffer_pixman(output, buffer);
@@ -800,13 +1408,18 @@ pipewire_output_stream_remove_buffer(void *data, struct pw_buffer *buffer)
 
 	pipewire_output_debug(output, "remove buffer: %p", buffer);
 
+	output->n_buffers--;
+
 	if (frame_data->dmabuf) {
 		struct weston_compositor *ec = output->base.compositor;
 		const struct weston_renderer *renderer = ec->renderer;
 
-		renderer->remove_renderbuffer_dmabuf(&output->base,
-						     frame_data->renderbuffer);
-		pipewire_destroy_dmabuf(output, frame_data->dmabuf);
+		/* The DMABUF goes back to the pool with the renderbuffer. */
+		if (frame_data->renderbuffer)
+			renderer->remove_renderbuffer_dmabuf(&output->base,
+							     frame_data->renderbuffer);
+		else
+			pipewire_dmabuf_release(&frame_data->dmabuf->base);
 	}
 	if (frame_data->memfd) {
 		munmap(d[0].data, d[0].maxsize);
@@ -828,6 +1441,7 @@ static const struct pw_stream_events stream_events = {
 	.param_changed = pipewire_output_stream_param_changed,
 	.add_buffer = pipewire_output_stream_add_buffer,
 	.remove_buffer = pipewire_output_stream_remove_buffer,
+	.trigger_done = pipewire_output_stream_trigger_done,
 };
 
 static struct weston_output *
@@ -854,6 +1468,10 @@ pipewire_create_output(struct weston_backend *backend, const char *name)
 	output->pixel_format = b->pixel_format;
 
 	wl_list_init(&output->fence_list);
+	pixman_region32_init(&output->held_damage);
+#ifdef BUILD_PIPEWIRE_VAAPI
+	output->h264.fence_fd = -1;
+#endif
 
 	props = pw_properties_new(NULL, NULL);
 	pw_properties_setf(props, PW_KEY_NODE_NAME, "weston.%s", name);
@@ -871,6 +1489,15 @@ pipewire_create_output(struct weston_backend *backend, const char *name)
 	return &output->base;
 }
 
+static void
+pipewire_shutdown(struct weston_backend *base)
+{
+	struct pipewire_backend *b = container_of(base, struct pipewire_backend, base);
+
+	/* Pooled DMABUFs come from the renderer's allocator. */
+	pipewire_backend_flush_dmabuf_pool(b);
+}
+
 static void
 pipewire_destroy(struct weston_backend *base)
 {
@@ -890,6 +1517,7 @@ pipewire_destroy(struct weston_backend *base)
 	wl_list_for_each_safe(head, next, &ec->head_list, compositor_link)
 		pipewire_head_destroy(head);
 
+	free(b->h264_device);
 	free(b);
 }
 
@@ -980,6 +1608,7 @@ pipewire_submit_buffer(struct pipewire_output *output,
 	pw_stream_queue_buffer(output->stream, buffer);
 
 	output->seq++;
+	output->frames_in_flight++;
 }
 
 static int
@@ -1051,13 +1680,26 @@ pipewire_output_repaint(struct weston_output *base)
 		goto out;
 
 	weston_output_flush_damage_for_primary_plane(base, &damage);
+	pixman_region32_union(&damage, &damage, &output->held_damage);
+	pixman_region32_clear(&output->held_damage);
 
+	/* Nothing changed, nothing for the consumer */
 	if (!pixman_region32_not_empty(&damage))
 		goto out;
 
+#ifdef BUILD_PIPEWIRE_VAAPI
+	if (output->h264.recorder) {
+		pipewire_output_repaint_h264(output, &damage);
+		goto out;
+	}
+#endif
+
+	/* The consumer still holds all buffers: keep the damage for a
+	 * complete frame later rather than dropping it. */
 	buffer = pw_stream_dequeue_buffer(output->stream);
 	if (!buffer) {
-		weston_log("Failed to dequeue PipeWire buffer\n");
+		pipewire_output_debug(output, "no free buffer, holding damage");
+		pixman_region32_copy(&output->held_damage, &damage);
 		goto out;
 	}
 	pipewire_output_debug(output, "dequeued buffer: %p", buffer);
@@ -1321,8 +1963,10 @@ pipewire_backend_create(struct weston_compositor *compositor,
 		return NULL;
 
 	backend->compositor = compositor;
+	backend->base.shutdown = pipewire_shutdown;
 	backend->base.destroy = pipewire_destroy;
 	backend->base.create_output = pipewire_create_output;
+	wl_list_init(&backend->dmabuf_pool);
 
 	wl_list_insert(&compositor->backend_list, &backend->base.link);
 
@@ -1380,6 +2024,16 @@ pipewire_backend_create(struct weston_compositor *compositor,
 			 pixel_format_get_info(DRM_FORMAT_XRGB8888),
 			 &backend->pixel_format);
 
+	if (config->h264_device) {
+#ifdef BUILD_PIPEWIRE_VAAPI
+		backend->h264_device = xstrdup(config->h264_device);
+		backend->h264_bitrate = config->h264_bitrate;
+#else
+		weston_log("PipeWire backend built without VA-API, "
+			   "not offering H.264 streams\n");
+#endif
+	}
+
 	pipewire_backend_create_outputs(backend, config->num_outputs);
 
 	return backend;
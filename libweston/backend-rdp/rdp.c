@@ -61,7 +61,7 @@ extern PWtsApiFunctionTable FreeRDP_InitWtsApi(void);
 static BOOL
 xf_peer_adjust_monitor_layout(freerdp_peer *client);
 
-static struct rdp_output *
+struct rdp_output *
 rdp_get_first_output(struct rdp_backend *b)
 {
 	struct weston_output *output;
@@ -76,43 +76,27 @@ rdp_get_first_output(struct rdp_backend *b)
 	return NULL;
 }
 
-static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+RFX_MESSAGE *
+rdp_rfx_encode(RFX_CONTEXT *rfx_context, RFX_RECT **rfx_rects,
+	       pixman_region32_t *damage, pixman_image_t *image)
 {
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->context->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
 
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.skipCompression = TRUE;
-	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
-	cmd.destLeft = damage->extents.x1;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_RemoteFxCodecId);
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
-
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
 
 	rects = pixman_region32_rectangles(damage, &nrects);
-	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
+	*rfx_rects = realloc(*rfx_rects, nrects * sizeof *rfxRect);
 
 	for (i = 0; i < nrects; i++) {
 		region = &rects[i];
-		rfxRect = &context->rfx_rects[i];
+		rfxRect = &(*rfx_rects)[i];
 
 		rfxRect->x = (region->x1 - damage->extents.x1);
 		rfxRect->y = (region->y1 - damage->extents.y1);
@@ -120,10 +104,36 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 		rfxRect->height = (region->y2 - region->y1);
 	}
 
-	rfx_compose_message(context->rfx_context, context->encode_stream, context->rfx_rects, nrects,
-			(BYTE *)ptr, width, height,
-			pixman_image_get_stride(image)
-	);
+	return rfx_encode_message(rfx_context, *rfx_rects, nrects,
+				  (BYTE *)ptr, width, height,
+				  pixman_image_get_stride(image));
+}
+
+/* The message may have been encoded by the context of another peer, only
+ * the message headers come from this peer's context. */
+static void
+rdp_peer_send_rfx(freerdp_peer *peer, pixman_region32_t *damage,
+		  RFX_MESSAGE *message)
+{
+	rdpUpdate *update = peer->context->update;
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+
+	Stream_Clear(context->encode_stream);
+	Stream_SetPosition(context->encode_stream, 0);
+
+	cmd.skipCompression = TRUE;
+	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd.destLeft = damage->extents.x1;
+	cmd.destTop = damage->extents.y1;
+	cmd.destRight = damage->extents.x2;
+	cmd.destBottom = damage->extents.y2;
+	cmd.bmp.bpp = 32;
+	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_RemoteFxCodecId);
+	cmd.bmp.width = (damage->extents.x2 - damage->extents.x1);
+	cmd.bmp.height = (damage->extents.y2 - damage->extents.y1);
+
+	rfx_write_message(context->rfx_context, context->encode_stream, message);
 
 	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
 	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
@@ -131,51 +141,86 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	update->SurfaceBits(update->context, &cmd);
 }
 
-
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
 {
-	int width, height;
-	int32_t left;
-	uint32_t *ptr;
-	rdpUpdate *update = peer->context->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
 	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	RFX_MESSAGE *message;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	message = rdp_rfx_encode(context->rfx_context, &context->rfx_rects,
+				 damage, image);
+	if (!message)
+		return;
 
+	rdp_peer_send_rfx(peer, damage, message);
+	rfx_message_free(context->rfx_context, message);
+}
+
+static void
+rdp_nsc_get_box(pixman_region32_t *damage, pixman_box32_t *box)
+{
 	/* nsc_compose_message() appears to require a 16 byte alignment,
 	 * otherwise it will read off the end of the region while doing
 	 * SIMD optimizations. Align our left edge and post a little
 	 * extra damage to hit this constraint.
 	 */
-	left = damage->extents.x1 - (damage->extents.x1 % 16);
-	width = (damage->extents.x2 - left);
-	height = (damage->extents.y2 - damage->extents.y1);
+	box->x1 = damage->extents.x1 - (damage->extents.x1 % 16);
+	box->y1 = damage->extents.y1;
+	box->x2 = damage->extents.x2;
+	box->y2 = damage->extents.y2;
+}
+
+static BOOL
+rdp_nsc_encode(NSC_CONTEXT *nsc_context, wStream *stream,
+	       const pixman_box32_t *box, pixman_image_t *image)
+{
+	uint32_t *ptr;
+
+	Stream_Clear(stream);
+	Stream_SetPosition(stream, 0);
+
+	ptr = pixman_image_get_data(image) + box->x1 +
+				box->y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+
+	return nsc_compose_message(nsc_context, stream, (BYTE *)ptr,
+				   box->x2 - box->x1, box->y2 - box->y1,
+				   pixman_image_get_stride(image));
+}
+
+static void
+rdp_peer_send_nsc(freerdp_peer *peer, const pixman_box32_t *box,
+		  wStream *stream)
+{
+	rdpUpdate *update = peer->context->update;
+	SURFACE_BITS_COMMAND cmd = { 0 };
 
 	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
 	cmd.skipCompression = TRUE;
-	cmd.destLeft = left;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
+	cmd.destLeft = box->x1;
+	cmd.destTop = box->y1;
+	cmd.destRight = box->x2;
+	cmd.destBottom = box->y2;
 	cmd.bmp.bpp = 32;
 	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_NSCodecId);
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	cmd.bmp.width = box->x2 - box->x1;
+	cmd.bmp.height = box->y2 - box->y1;
 
-	ptr = pixman_image_get_data(image) + left +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+	cmd.bmp.bitmapDataLength = Stream_GetPosition(stream);
+	cmd.bmp.bitmapData = Stream_Buffer(stream);
 
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
-			width, height,
-			pixman_image_get_stride(image));
+	update->SurfaceBits(update->context, &cmd);
+}
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
+static void
+rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	pixman_box32_t box;
 
-	update->SurfaceBits(update->context, &cmd);
+	rdp_nsc_get_box(damage, &box);
+	rdp_nsc_encode(context->nsc_context, context->encode_stream,
+		       &box, image);
+	rdp_peer_send_nsc(peer, &box, context->encode_stream);
 }
 
 static void
@@ -197,7 +242,6 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 {
 	rdpUpdate *update = peer->context->update;
 	SURFACE_BITS_COMMAND cmd = { 0 };
-	SURFACE_FRAME_MARKER marker;
 	pixman_box32_t *rect, subrect;
 	int nrects, i;
 	int heightIncrement, remainingHeight, top;
@@ -206,10 +250,6 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	if (!nrects)
 		return;
 
-	marker.frameId++;
-	marker.frameAction = SURFACECMD_FRAMEACTION_BEGIN;
-	update->SurfaceFrameMarker(peer->context, &marker);
-
 	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
 	cmd.bmp.bpp = 32;
 	cmd.bmp.codecID = 0;
@@ -248,24 +288,316 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	}
 
 	free(cmd.bmp.bitmapData);
-
-	marker.frameAction = SURFACECMD_FRAMEACTION_END;
-	update->SurfaceFrameMarker(peer->context, &marker);
 }
 
-static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+static enum rdp_codec
+rdp_peer_get_codec(freerdp_peer *peer)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-	struct rdp_output *output = rdp_get_first_output(context->rdpBackend);
 	rdpSettings *settings = peer->context->settings;
 
 	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec))
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
+		return RDP_CODEC_RFX;
 	else if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
+		return RDP_CODEC_NSC;
 	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+		return RDP_CODEC_RAW;
+}
+
+/* Clients that send frame acknowledgements get at most this many surface
+ * bits frames ahead of them, see rdp_peer_can_send(). */
+#define RDP_MAX_FRAMES_IN_FLIGHT 2
+
+static bool
+rdp_peer_can_send(RdpPeerContext *context)
+{
+	rdpSettings *settings = context->_p.settings;
+	uint32_t max_frames;
+
+	if (!freerdp_settings_get_bool(settings, FreeRDP_SurfaceFrameMarkerEnabled))
+		return true;
+
+	/* 0 when the client doesn't acknowledge frames */
+	max_frames = freerdp_settings_get_uint32(settings, FreeRDP_FrameAcknowledge);
+	if (max_frames == 0)
+		return true;
+
+	max_frames = MIN(max_frames, RDP_MAX_FRAMES_IN_FLIGHT);
+
+	return context->frame_id - context->frame_acked < max_frames;
+}
+
+static void
+rdp_peer_frame_marker(freerdp_peer *peer, uint16_t action)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	SURFACE_FRAME_MARKER marker = { 0 };
+
+	if (!freerdp_settings_get_bool(peer->context->settings,
+				       FreeRDP_SurfaceFrameMarkerEnabled))
+		return;
+
+	if (action == SURFACECMD_FRAMEACTION_BEGIN)
+		context->frame_id++;
+
+	marker.frameAction = action;
+	marker.frameId = context->frame_id;
+	peer->context->update->SurfaceFrameMarker(peer->context, &marker);
+}
+
+/* Send the pending damage as one frame, unless the peer is too far behind
+ * or has its output suppressed. */
+static void
+rdp_peer_flush(freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_output *output = rdp_get_first_output(context->rdpBackend);
+	pixman_region32_t *pending = &context->pending_damage;
+	pixman_image_t *image;
+
+	if (!output || !(context->item.flags & RDP_PEER_OUTPUT_ENABLED) ||
+	    !rdp_peer_can_send(context))
+		return;
+
+	image = output->shadow_surface;
+	pixman_region32_intersect_rect(pending, pending, 0, 0,
+				       pixman_image_get_width(image),
+				       pixman_image_get_height(image));
+	if (!pixman_region32_not_empty(pending))
+		return;
+
+	rdp_peer_frame_marker(peer, SURFACECMD_FRAMEACTION_BEGIN);
+
+	switch (rdp_peer_get_codec(peer)) {
+	case RDP_CODEC_RFX:
+		rdp_peer_refresh_rfx(pending, image, peer);
+		break;
+	case RDP_CODEC_NSC:
+		rdp_peer_refresh_nsc(pending, image, peer);
+		break;
+	case RDP_CODEC_RAW:
+		rdp_peer_refresh_raw(pending, image, peer);
+		break;
+	}
+
+	rdp_peer_frame_marker(peer, SURFACECMD_FRAMEACTION_END);
+
+	pixman_region32_clear(pending);
+}
+
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+
+	if (rdp_gfx_refresh(context, region, NULL, 0))
+		return;
+
+	pixman_region32_union(&context->pending_damage,
+			      &context->pending_damage, region);
+	rdp_peer_flush(peer);
+}
+
+/** One encode of the output damage, sent to every peer that can use it */
+struct rdp_encode_job {
+	enum rdp_codec codec;
+	pixman_region32_t *damage;
+	pixman_image_t *image;
+
+	/* RemoteFX: the peer whose context encodes the message */
+	RdpPeerContext *encoder;
+	RFX_MESSAGE *rfx_message;
+
+	/* NSCodec: one band of the damage extents */
+	struct rdp_nsc_encoder *nsc;
+	pixman_box32_t box;
+	BOOL encoded;
+};
+
+static void
+rdp_encode_job_run(void *data, unsigned int index)
+{
+	struct rdp_encode_job *job = &((struct rdp_encode_job *)data)[index];
+
+	switch (job->codec) {
+	case RDP_CODEC_RFX:
+		job->rfx_message = rdp_rfx_encode(job->encoder->rfx_context,
+						  &job->encoder->rfx_rects,
+						  job->damage, job->image);
+		break;
+	case RDP_CODEC_NSC:
+		job->encoded = rdp_nsc_encode(job->nsc->context,
+					      job->nsc->stream,
+					      &job->box, job->image);
+		break;
+	case RDP_CODEC_RAW:
+		break;
+	}
+}
+
+static bool
+rdp_peers_share_rfx(RdpPeerContext *a, RdpPeerContext *b)
+{
+	rdpSettings *sa = a->_p.settings;
+	rdpSettings *sb = b->_p.settings;
+
+	return freerdp_settings_get_uint32(sa, FreeRDP_DesktopWidth) ==
+	       freerdp_settings_get_uint32(sb, FreeRDP_DesktopWidth) &&
+	       freerdp_settings_get_uint32(sa, FreeRDP_DesktopHeight) ==
+	       freerdp_settings_get_uint32(sb, FreeRDP_DesktopHeight);
+}
+
+/** Send the output damage to all active peers
+ *
+ * RemoteFX messages are encoded once for all peers with the same desktop
+ * size, and NSCodec bitmaps once for all NSCodec peers, so that extra
+ * viewers cost little more than writing the update to their socket. With
+ * encoder threads, the NSCodec damage is split into horizontal bands, and
+ * the bands and the RemoteFX messages are encoded in parallel. Peer I/O
+ * stays on the main loop. Peers using the graphics pipeline queue the
+ * damage and pace their own frames, see rdpgfx.c. Peers that acknowledge
+ * surface bits frames are paced the same way: while one is too far
+ * behind, or has its output suppressed, the damage is accumulated and
+ * sent as one frame once it catches up, encoded for that peer alone.
+ * The repaint never waits on a peer.
+ */
+static void
+rdp_output_refresh_peers(struct rdp_output *output, pixman_region32_t *damage)
+{
+	struct rdp_backend *b = output->backend;
+	pixman_image_t *image = output->shadow_surface;
+	struct rdp_peers_item *item;
+	RdpPeerContext **peers;
+	struct rdp_encode_job *jobs;
+	const struct weston_output_move *moves;
+	unsigned int n_moves;
+	int *peer_job;
+	int n_peers = 0, n_jobs = 0, nsc_job = -1, n_nsc_bands = 0;
+	int i, j;
+
+	moves = weston_output_get_moves(&output->base, &n_moves);
+
+	peers = xcalloc(wl_list_length(&b->peers) + 1, sizeof *peers);
+
+	wl_list_for_each(item, &b->peers, link) {
+		RdpPeerContext *peer = (RdpPeerContext *)item->peer->context;
+
+		if (!(item->flags & RDP_PEER_ACTIVATED))
+			continue;
+
+		/* Kept for when the client allows output again */
+		if (!(item->flags & RDP_PEER_OUTPUT_ENABLED)) {
+			pixman_region32_union(&peer->pending_damage,
+					      &peer->pending_damage, damage);
+			continue;
+		}
+
+		if (rdp_gfx_refresh(peer, damage, moves, n_moves))
+			continue;
+
+		/* Peers that are behind, or catching up, get their own
+		 * frame once their acknowledgements come in. */
+		if (!rdp_peer_can_send(peer) ||
+		    pixman_region32_not_empty(&peer->pending_damage)) {
+			rdp_peer_refresh_region(damage, item->peer);
+			continue;
+		}
+
+		peers[n_peers++] = peer;
+	}
+	if (n_peers == 0) {
+		free(peers);
+		return;
+	}
+
+	peer_job = xcalloc(n_peers, sizeof *peer_job);
+	jobs = xcalloc(n_peers + b->nsc_encoders_count, sizeof *jobs);
+
+	for (i = 0; i < n_peers; i++) {
+		RdpPeerContext *peer = peers[i];
+
+		peer_job[i] = -1;
+
+		switch (rdp_peer_get_codec(peer->item.peer)) {
+		case RDP_CODEC_RFX:
+			for (j = 0; j < n_jobs; j++) {
+				if (jobs[j].codec == RDP_CODEC_RFX &&
+				    rdp_peers_share_rfx(jobs[j].encoder, peer))
+					break;
+			}
+			if (j == n_jobs) {
+				jobs[j].codec = RDP_CODEC_RFX;
+				jobs[j].damage = damage;
+				jobs[j].image = image;
+				jobs[j].encoder = peer;
+				n_jobs++;
+			}
+			peer_job[i] = j;
+			break;
+		case RDP_CODEC_NSC:
+			if (nsc_job < 0) {
+				pixman_box32_t box;
+				int height;
+
+				rdp_nsc_get_box(damage, &box);
+				height = box.y2 - box.y1;
+				n_nsc_bands = MAX(1, MIN(b->nsc_encoders_count,
+							 height / RDP_NSC_BAND_MIN_HEIGHT));
+				nsc_job = n_jobs;
+				for (j = 0; j < n_nsc_bands; j++) {
+					struct rdp_encode_job *job = &jobs[n_jobs++];
+
+					job->codec = RDP_CODEC_NSC;
+					job->image = image;
+					job->nsc = &b->nsc_encoders[j];
+					job->box = box;
+					job->box.y1 = box.y1 + height * j / n_nsc_bands;
+					job->box.y2 = box.y1 + height * (j + 1) / n_nsc_bands;
+				}
+			}
+			peer_job[i] = nsc_job;
+			break;
+		case RDP_CODEC_RAW:
+			break;
+		}
+	}
+
+	weston_worker_pool_run(b->encoder_pool, rdp_encode_job_run,
+			       jobs, n_jobs);
+
+	for (i = 0; i < n_peers; i++) {
+		freerdp_peer *peer = peers[i]->item.peer;
+		struct rdp_encode_job *job;
+
+		rdp_peer_frame_marker(peer, SURFACECMD_FRAMEACTION_BEGIN);
+
+		if (peer_job[i] < 0) {
+			rdp_peer_refresh_raw(damage, image, peer);
+		} else if (jobs[peer_job[i]].codec == RDP_CODEC_RFX) {
+			job = &jobs[peer_job[i]];
+			if (job->rfx_message)
+				rdp_peer_send_rfx(peer, damage,
+						  job->rfx_message);
+		} else {
+			job = &jobs[peer_job[i]];
+			for (j = 0; j < n_nsc_bands; j++, job++) {
+				if (job->encoded)
+					rdp_peer_send_nsc(peer, &job->box,
+							  job->nsc->stream);
+			}
+		}
+
+		rdp_peer_frame_marker(peer, SURFACECMD_FRAMEACTION_END);
+	}
+
+	for (j = 0; j < n_jobs; j++) {
+		if (jobs[j].rfx_message)
+			rfx_message_free(jobs[j].encoder->rfx_context,
+					 jobs[j].rfx_message);
+	}
+
+	free(jobs);
+	free(peer_job);
+	free(peers);
 }
 
 static int
@@ -284,8 +616,6 @@ rdp_output_repaint(struct weston_output *output_base)
 {
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
 	struct weston_compositor *ec = output->base.compositor;
-	struct rdp_backend *b = output->backend;
-	struct rdp_peers_item *peer;
 	pixman_region32_t damage;
 
 	assert(output);
@@ -303,12 +633,7 @@ rdp_output_repaint(struct weston_output *output_base)
 		weston_region_global_to_output(&transformed_damage,
 					       output_base,
 					       &damage);
-		wl_list_for_each(peer, &b->peers, link) {
-			if ((peer->flags & RDP_PEER_ACTIVATED) &&
-			    (peer->flags & RDP_PEER_OUTPUT_ENABLED)) {
-				rdp_peer_refresh_region(&transformed_damage, peer->peer);
-			}
-		}
+		rdp_output_refresh_peers(output, &transformed_damage);
 		pixman_region32_fini(&transformed_damage);
 	}
 
@@ -398,12 +723,19 @@ rdp_output_set_mode(struct weston_output *base, struct weston_mode *mode)
 	 * check that we're primary here.
 	 */
 	wl_list_for_each(rdpPeer, &b->peers, link) {
+		RdpPeerContext *peerCtx = (RdpPeerContext *)rdpPeer->peer->context;
+
 		settings = rdpPeer->peer->context->settings;
 		if (freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth) == (uint32_t)mode->width &&
 		    freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight) == (uint32_t)mode->height)
 			continue;
 
-		if (!freerdp_settings_get_bool(settings, FreeRDP_DesktopResize)) {
+		if (peerCtx->gfx_ready) {
+			/* the graphics pipeline resizes with ResetGraphics */
+			freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, mode->width);
+			freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, mode->height);
+			rdp_gfx_reset(peerCtx);
+		} else if (!freerdp_settings_get_bool(settings, FreeRDP_DesktopResize)) {
 			/* too bad this peer does not support desktop resize */
 			weston_log("desktop resize is not allowed\n");
 			rdpPeer->peer->Close(rdpPeer->peer);
@@ -517,6 +849,9 @@ rdp_output_enable(struct weston_output *base)
 		unreachable("cannot have auto renderer at runtime");
 	}
 
+	/* graphics pipeline peers can copy the views that only moved */
+	output->base.track_moves = b->gfx_pipeline;
+
 	loop = wl_display_get_event_loop(b->compositor->wl_display);
 	output->finish_frame_timer = wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
@@ -641,6 +976,59 @@ rdp_head_destroy(struct weston_head *base)
 	free(head);
 }
 
+static bool
+rdp_encoders_init(struct rdp_backend *b, int threads)
+{
+	int i;
+
+	if (threads > 1) {
+		b->encoder_pool = weston_worker_pool_create(threads - 1);
+		if (!b->encoder_pool)
+			weston_log("RDP: failed to start encoder threads, "
+				   "encoding on the main loop\n");
+	}
+
+	b->nsc_encoders_count =
+		weston_worker_pool_get_thread_count(b->encoder_pool);
+	b->nsc_encoders = xcalloc(b->nsc_encoders_count,
+				  sizeof *b->nsc_encoders);
+
+	for (i = 0; i < b->nsc_encoders_count; i++) {
+		struct rdp_nsc_encoder *enc = &b->nsc_encoders[i];
+
+		enc->context = nsc_context_new();
+		if (!enc->context)
+			return false;
+		nsc_context_set_parameters(enc->context, NSC_COLOR_FORMAT,
+					   DEFAULT_PIXEL_FORMAT);
+
+		enc->stream = Stream_New(NULL, 65536);
+		if (!enc->stream)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+rdp_encoders_fini(struct rdp_backend *b)
+{
+	int i;
+
+	weston_worker_pool_destroy(b->encoder_pool);
+	b->encoder_pool = NULL;
+
+	for (i = 0; i < b->nsc_encoders_count; i++) {
+		if (b->nsc_encoders[i].stream)
+			Stream_Free(b->nsc_encoders[i].stream, TRUE);
+		if (b->nsc_encoders[i].context)
+			nsc_context_free(b->nsc_encoders[i].context);
+	}
+	free(b->nsc_encoders);
+	b->nsc_encoders = NULL;
+	b->nsc_encoders_count = 0;
+}
+
 static void
 rdp_shutdown(struct weston_backend *backend)
 {
@@ -698,6 +1086,8 @@ rdp_destroy(struct weston_backend *backend)
 
 	freerdp_listener_free(b->listener);
 
+	rdp_encoders_fini(b);
+
 	free(b->server_cert);
 	free(b->server_key);
 	free(b->rdp_key);
@@ -754,6 +1144,8 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	context->loop_task_event_source_fd = -1;
 	context->loop_task_event_source = NULL;
 	wl_list_init(&context->loop_task_list);
+	pixman_region32_init(&context->gfx_pending_damage);
+	pixman_region32_init(&context->pending_damage);
 
 	context->rfx_context = rfx_context_new(TRUE);
 	if (!context->rfx_context)
@@ -814,6 +1206,7 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		b->audio_out_teardown(context->audio_out_private);
 
 	rdp_clipboard_destroy(context);
+	rdp_gfx_destroy(context);
 
 	if (context->vcm)
 		WTSCloseServer(context->vcm);
@@ -831,6 +1224,8 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 	nsc_context_free(context->nsc_context);
 	rfx_context_free(context->rfx_context);
 	free(context->rfx_rects);
+	pixman_region32_fini(&context->gfx_pending_damage);
+	pixman_region32_fini(&context->pending_damage);
 }
 
 
@@ -851,6 +1246,8 @@ rdp_client_activity(int fd, uint32_t mask, void *data)
 			weston_log("failed to check FreeRDP WTS VC file descriptor for %p\n", client);
 			goto out_clean;
 		}
+
+		rdp_gfx_check_channel(peerCtx);
 	}
 
 	return 0;
@@ -1136,8 +1533,10 @@ xf_peer_activate(freerdp_peer* client)
 	rfx_context_reset(peerCtx->rfx_context, width, height);
 	nsc_context_reset(peerCtx->nsc_context, width, height);
 
-	if (peersItem->flags & RDP_PEER_ACTIVATED)
+	if (peersItem->flags & RDP_PEER_ACTIVATED) {
+		rdp_gfx_reset(peerCtx);
 		return TRUE;
+	}
 
 	/* when here it's the first reactivation, we need to setup a little more */
 	rdp_debug(b, "kbd_layout:0x%x kbd_type:0x%x kbd_subType:0x%x kbd_functionKeys:0x%x\n",
@@ -1153,8 +1552,8 @@ xf_peer_activate(freerdp_peer* client)
 
 	keymap = NULL;
 	if (xkbRuleNames.layout) {
-		keymap = xkb_keymap_new_from_names(b->compositor->xkb_context,
-						   &xkbRuleNames, 0);
+		keymap = weston_compositor_get_keymap(b->compositor,
+						      &xkbRuleNames);
 	}
 
 	cl_hostname = freerdp_settings_get_string(settings, FreeRDP_ClientHostname);
@@ -1182,6 +1581,9 @@ xf_peer_activate(freerdp_peer* client)
 			goto error_exit;
 
 	peersItem->flags |= RDP_PEER_ACTIVATED;
+	peerCtx->frame_id = 0;
+	peerCtx->frame_acked = 0;
+	pixman_region32_clear(&peerCtx->pending_damage);
 
 	/* disable pointer on the client side */
 	pointer = client->context->update->pointer;
@@ -1621,11 +2023,33 @@ static BOOL
 xf_suppress_output(rdpContext *context, BYTE allow, const RECTANGLE_16 *area)
 {
 	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+	pixman_region32_t damage;
 
-	if (allow)
-		peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
-	else
+	if (!allow) {
 		peerContext->item.flags &= (~RDP_PEER_OUTPUT_ENABLED);
+		return TRUE;
+	}
+
+	peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
+
+	/* Send what changed while the output was suppressed */
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &peerContext->pending_damage);
+	pixman_region32_clear(&peerContext->pending_damage);
+	if (pixman_region32_not_empty(&damage))
+		rdp_peer_refresh_region(&damage, peerContext->item.peer);
+	pixman_region32_fini(&damage);
+
+	return TRUE;
+}
+
+static BOOL
+xf_surface_frame_acknowledge(rdpContext *context, UINT32 frameId)
+{
+	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+
+	peerContext->frame_acked = frameId;
+	rdp_peer_flush(peerContext->item.peer);
 
 	return TRUE;
 }
@@ -1788,8 +2212,10 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	freerdp_settings_set_bool(settings, FreeRDP_RefreshRect, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, b->remotefx_codec);
 	freerdp_settings_set_bool(settings, FreeRDP_NSCodec, TRUE);
+	freerdp_settings_set_bool(settings, FreeRDP_SupportGraphicsPipeline, b->gfx_pipeline);
 	freerdp_settings_set_bool(settings, FreeRDP_FrameMarkerCommandEnabled, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_SurfaceFrameMarkerEnabled, TRUE);
+	freerdp_settings_set_uint32(settings, FreeRDP_FrameAcknowledge, RDP_MAX_FRAMES_IN_FLIGHT);
 	freerdp_settings_set_bool(settings, FreeRDP_RedirectClipboard, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_HasExtendedMouseEvent, TRUE);
 	freerdp_settings_set_bool(settings, FreeRDP_HasHorizontalWheel, TRUE);
@@ -1804,6 +2230,7 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	}
 
 	client->context->update->SuppressOutput = (pSuppressOutput)xf_suppress_output;
+	client->context->update->SurfaceFrameAcknowledge = xf_surface_frame_acknowledge;
 
 	input = client->context->input;
 	input->SynchronizeEvent = xf_input_synchronize_event;
@@ -1907,6 +2334,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	b->resizeable = config->resizeable;
 	b->force_no_compression = config->force_no_compression;
 	b->remotefx_codec = config->remotefx_codec;
+	b->gfx_pipeline = config->gfx_pipeline;
 	b->audio_in_setup = config->audio_in_setup;
 	b->audio_in_teardown = config->audio_in_teardown;
 	b->audio_out_setup = config->audio_out_setup;
@@ -1962,6 +2390,11 @@ rdp_backend_create(struct weston_compositor *compositor,
 
 	wl_list_init(&b->peers);
 
+	if (!rdp_encoders_init(b, config->encoder_threads)) {
+		weston_log("RDP: failed to create encoders\n");
+		goto err_free_strings;
+	}
+
 	b->base.supported_presentation_clocks =
 			WESTON_PRESENTATION_CLOCKS_SOFTWARE;
 
@@ -2051,6 +2484,7 @@ err_compositor:
 			rdp_head_destroy(base);
 	}
 err_free_strings:
+	rdp_encoders_fini(b);
 	wl_list_remove(&b->base.link);
 	if (b->clipboard_debug)
 		weston_log_scope_destroy(b->clipboard_debug);
@@ -2080,12 +2514,14 @@ config_init_to_defaults(struct weston_rdp_backend_config *config)
 	config->resizeable = true;
 	config->force_no_compression = 0;
 	config->remotefx_codec = true;
+	config->gfx_pipeline = false;
 	config->external_listener_fd = -1;
 	config->refresh_rate = RDP_DEFAULT_FREQ;
 	config->audio_in_setup = NULL;
 	config->audio_in_teardown = NULL;
 	config->audio_out_setup = NULL;
 	config->audio_out_teardown = NULL;
+	config->encoder_threads = 0;
 }
 
 WL_EXPORT int
@@ -44,9 +44,11 @@
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/rfx.h>
 #include <freerdp/codec/nsc.h>
+#include <freerdp/codec/h264.h>
 #include <freerdp/locale/keyboard.h>
 #include <freerdp/channels/wtsvc.h>
 #include <freerdp/server/cliprdr.h>
+#include <freerdp/server/rdpgfx.h>
 
 #include <libweston/libweston.h>
 #include <libweston/backend-rdp.h>
@@ -55,6 +57,7 @@
 #include <winpr/string.h>
 
 #include "backend.h"
+#include "worker-pool.h"
 
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
@@ -63,6 +66,8 @@
 #define RDP_MAX_MONITOR 16
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 #define DEFAULT_PIXEL_FORMAT PIXEL_FORMAT_BGRA32
+/* NSCodec bands thinner than this are not worth encoding separately */
+#define RDP_NSC_BAND_MIN_HEIGHT 64
 
 /* https://docs.microsoft.com/en-us/windows/win32/api/winuser/nf-winuser-getkeyboardtype
  * defines a keyboard type that isn't currently defined in FreeRDP, but is
@@ -89,6 +94,18 @@
 #define XF_KEV_CODE_TYPE		UINT16
 #endif
 
+enum rdp_codec {
+	RDP_CODEC_RAW,
+	RDP_CODEC_NSC,
+	RDP_CODEC_RFX,
+};
+
+/* NSCodec state for encoding one band of the output, shared by all peers */
+struct rdp_nsc_encoder {
+	NSC_CONTEXT *context;
+	wStream *stream;
+};
+
 struct rdp_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
@@ -110,6 +127,7 @@ struct rdp_backend {
 	int resizeable;
 	int force_no_compression;
 	bool remotefx_codec;
+	bool gfx_pipeline;
 	int external_listener_fd;
 	int rdp_monitor_refresh_rate;
 	pid_t compositor_tid;
@@ -123,6 +141,11 @@ struct rdp_backend {
 
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
+
+	/* NULL when encoding on the main loop only */
+	struct weston_worker_pool *encoder_pool;
+	struct rdp_nsc_encoder *nsc_encoders;
+	int nsc_encoders_count;
 };
 
 enum peer_item_flags {
@@ -183,6 +206,25 @@ struct rdp_peer_context {
 	/* Clipboard support */
 	CliprdrServerContext *clipboard_server_context;
 
+	/* Graphics pipeline, see rdpgfx.c */
+	RdpgfxServerContext *gfx_context;
+	struct wl_event_source *gfx_event_source;
+	RFX_CONTEXT *gfx_rfx_context;
+	H264_CONTEXT *h264_context;
+	bool gfx_tried;
+	bool gfx_caps_confirmed;
+	bool gfx_ready; /* surface created and mapped */
+	bool gfx_avc420;
+	bool gfx_acks_suspended;
+	uint32_t gfx_frame_id; /* last frame sent */
+	uint32_t gfx_frame_acked; /* last frame acknowledged */
+	pixman_region32_t gfx_pending_damage;
+
+	/* Surface bits frames, paced like the graphics pipeline ones */
+	uint32_t frame_id; /* last frame sent */
+	uint32_t frame_acked; /* last frame acknowledged */
+	pixman_region32_t pending_damage; /* while behind or suppressed */
+
 	void *audio_in_private;
 	void *audio_out_private;
 
@@ -274,7 +316,28 @@ rdp_clipboard_init(freerdp_peer *client);
 void
 rdp_clipboard_destroy(RdpPeerContext *peerCtx);
 
+/* rdpgfx.c */
+void
+rdp_gfx_check_channel(RdpPeerContext *peerCtx);
+
+void
+rdp_gfx_reset(RdpPeerContext *peerCtx);
+
+bool
+rdp_gfx_refresh(RdpPeerContext *peerCtx, pixman_region32_t *damage,
+		const struct weston_output_move *moves, unsigned int n_moves);
+
+void
+rdp_gfx_destroy(RdpPeerContext *peerCtx);
+
 /* rdp.c */
+struct rdp_output *
+rdp_get_first_output(struct rdp_backend *b);
+
+RFX_MESSAGE *
+rdp_rfx_encode(RFX_CONTEXT *rfx_context, RFX_RECT **rfx_rects,
+	       pixman_region32_t *damage, pixman_image_t *image);
+
 void
 rdp_head_create(struct rdp_backend *backend, rdpMonitor *config);
 
@@ -46,6 +46,14 @@
 #define CF_PRIVATE_RTF  49309 /* fake format ID for "Rich Text Format". */
 #define CF_PRIVATE_HTML 49405 /* fake format ID for "HTML Format".*/
 
+/* Client data is converted and written to the server side application
+ * in chunks of at most this size. */
+#define RDP_CLIPBOARD_CHUNK_SIZE (64 * 1024)
+
+/* The whole data sent to the client goes in a single format data
+ * response, so it has to be held in memory; refuse anything larger. */
+#define RDP_CLIPBOARD_MAX_DATA_SIZE (64 * 1024 * 1024)
+
 					       /*          1           2           3           4         5         6           7         8      */
 					       /*01234567890 1 2345678901234 5 67890123456 7 89012345678901234567890 1 234567890123456789012 3 4*/
 static const char rdp_clipboard_html_header[] = "Version:0.9\r\nStartHTML:-1\r\nEndHTML:-1\r\nStartFragment:00000000\r\nEndFragment:00000000\r\n";
@@ -129,6 +137,13 @@ struct rdp_clipboard_data_source {
 	void *processed_data_start;
 	uint32_t processed_data_size;
 	bool processed_data_is_send;
+	/* what is written ahead of the processed data, and whether it is
+	 * UTF-16 to convert, see clipboard_data_source_next_chunk() */
+	BITMAPFILEHEADER processed_header;
+	uint32_t processed_header_size;
+	bool processed_data_is_unicode;
+	size_t write_offset;
+	struct wl_array write_chunk;
 	bool is_canceled;
 	uint32_t client_format_id_table[RDP_NUM_CLIPBOARD_FORMATS];
 };
@@ -227,7 +242,6 @@ clipboard_process_text_utf8(struct rdp_clipboard_data_source *source, bool is_se
 		assert(data_contents.size == (data_size_in_char * 2));
 	} else {
 		/* Windows to Linux (UNICODE to utf-8) */
-		size_t data_size;
 		LPWSTR data = source->data_contents.data;
 		size_t data_size_in_char = source->data_contents.size / 2;
 
@@ -238,39 +252,17 @@ clipboard_process_text_utf8(struct rdp_clipboard_data_source *source, bool is_se
 		if (!data_size_in_char)
 			goto error_return;
 
-		/* obtain size in utf-8 */
-#if USE_FREERDP_VERSION >= 3
-		data_size = ConvertWCharNToUtf8(source->data_contents.data,
-						data_size_in_char,
-						NULL, 0);
-#else
-		data_size = WideCharToMultiByte(CP_UTF8, 0,
-						source->data_contents.data,
-						data_size_in_char,
-						NULL, 0,
-						NULL, NULL);
-#endif
-		if (data_size < 1)
-			goto error_return;
-
-		if (!wl_array_add(&data_contents, data_size))
-			goto error_return;
+		/* converted while it is written */
+		source->is_data_processed = true;
+		source->processed_data_start = data;
+		source->processed_data_size = data_size_in_char * 2;
+		source->processed_data_is_unicode = true;
+		rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s): receive (%u bytes)\n",
+					    __func__, source,
+					    clipboard_data_source_state_to_string(source),
+					    source->processed_data_size);
 
-		/* convert to utf-8 */
-#if USE_FREERDP_VERSION >= 3
-		data_size = ConvertWCharNToUtf8(source->data_contents.data,
-						data_size_in_char,
-						data_contents.data,
-						data_size);
-#else
-		data_size = WideCharToMultiByte(CP_UTF8, 0,
-						source->data_contents.data,
-						data_size_in_char,
-						data_contents.data,
-						data_size,
-						NULL, NULL);
-#endif
-		assert(data_contents.size == data_size);
+		return true;
 	}
 
 	/* swap the data_contents with new one */
@@ -375,12 +367,15 @@ clipboard_process_html(struct rdp_clipboard_data_source *source, bool is_send)
 		if (!data_size)
 			goto error_return;
 
-		if (!wl_array_add(&data_contents, data_size+1)) /* +1 for null */
-			goto error_return;
+		source->is_data_processed = true;
+		source->processed_data_start = cur;
+		source->processed_data_size = data_size;
+		rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s): receive (%u bytes)\n",
+					    __func__, source,
+					    clipboard_data_source_state_to_string(source),
+					    source->processed_data_size);
 
-		memcpy(data_contents.data, cur, data_size);
-		((char *)(data_contents.data))[data_size] = '\0';
-		data_contents.size = data_size;
+		return true;
 	} else {
 		/* Linux to Windows */
 		char *last, *buf;
@@ -458,12 +453,9 @@ clipboard_process_bmp(struct rdp_clipboard_data_source *source, bool is_send)
 	BITMAPFILEHEADER *bmfh = NULL;
 	BITMAPINFOHEADER *bmih = NULL;
 	uint32_t color_table_size = 0;
-	struct wl_array data_contents;
 
 	assert(!source->is_data_processed);
 
-	wl_array_init(&data_contents);
-
 	if (is_send) {
 		/* Linux to Windows (remove BITMAPFILEHEADER) */
 		if (source->data_contents.size <= sizeof(*bmfh))
@@ -477,13 +469,12 @@ clipboard_process_bmp(struct rdp_clipboard_data_source *source, bool is_send)
 		source->processed_data_size = source->data_contents.size - sizeof(*bmfh);
 	} else {
 		/* Windows to Linux (insert BITMAPFILEHEADER) */
-		BITMAPFILEHEADER _bmfh = {};
-
 		if (source->data_contents.size <= sizeof(*bmih))
 			goto error_return;
 
 		bmih = source->data_contents.data;
-		bmfh = &_bmfh;
+		bmfh = &source->processed_header;
+		memset(bmfh, 0, sizeof(*bmfh));
 		if (bmih->biCompression == BI_BITFIELDS)
 			color_table_size = sizeof(RGBQUAD) * 3;
 		else
@@ -503,22 +494,11 @@ clipboard_process_bmp(struct rdp_clipboard_data_source *source, bool is_send)
 		if (source->data_contents.size < (bmfh->bfSize - sizeof(*bmfh)))
 			goto error_return;
 
-		if (!wl_array_add(&data_contents, bmfh->bfSize))
-			goto error_return;
-		assert(data_contents.size == bmfh->bfSize);
-
-		/* copy generated BITMAPFILEHEADER */
-		memcpy(data_contents.data, bmfh, sizeof(*bmfh));
-		/* copy rest of bitmap data from source */
-		memcpy((char *)data_contents.data + sizeof(*bmfh),
-		       source->data_contents.data, bmfh->bfSize - sizeof(*bmfh));
-
-		/* swap the data_contents with new one */
-		wl_array_release(&source->data_contents);
-		source->data_contents = data_contents;
+		/* the generated BITMAPFILEHEADER is written ahead of the data */
 		source->is_data_processed = true;
+		source->processed_header_size = sizeof(*bmfh);
 		source->processed_data_start = source->data_contents.data;
-		source->processed_data_size = source->data_contents.size;
+		source->processed_data_size = bmfh->bfSize - sizeof(*bmfh);
 	}
 
 	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s): %s (%d bytes)\n",
@@ -535,8 +515,6 @@ error_return:
 		   __func__, source, clipboard_data_source_state_to_string(source),
 		   is_send ? "send" : "receive", (uint32_t)source->data_contents.size);
 
-	wl_array_release(&data_contents);
-
 	return false;
 }
 
@@ -675,6 +653,8 @@ clipboard_process_source(struct rdp_clipboard_data_source *source, bool is_send)
 
 	source->processed_data_start = NULL;
 	source->processed_data_size = 0;
+	source->processed_header_size = 0;
+	source->processed_data_is_unicode = false;
 
 	if (clipboard_supported_formats[source->format_index].pfn)
 		return clipboard_supported_formats[source->format_index].pfn(source, is_send);
@@ -719,6 +699,7 @@ clipboard_data_source_unref(struct rdp_clipboard_data_source *source)
 			       &source->base);
 
 	wl_array_release(&source->data_contents);
+	wl_array_release(&source->write_chunk);
 
 	wl_array_for_each(p, &source->base.mime_types)
 		free(*p);
@@ -820,6 +801,15 @@ clipboard_data_source_read(int fd, uint32_t mask, void *arg)
 		goto error_exit;
 	}
 
+	if (source->data_contents.size > RDP_CLIPBOARD_MAX_DATA_SIZE) {
+		source->state = RDP_CLIPBOARD_SOURCE_FAILED;
+		weston_log("RDP %s (%p:%s) data is larger than %d bytes\n",
+			   __func__, source,
+			   clipboard_data_source_state_to_string(source),
+			   RDP_CLIPBOARD_MAX_DATA_SIZE);
+		goto error_exit;
+	}
+
 	if (len > 0) {
 		rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) read (%zu bytes)\n",
 					    __func__, source,
@@ -903,6 +893,79 @@ clipboard_data_source_fail(int fd, uint32_t mask, void *arg)
 	return 0;
 }
 
+/* Get the next chunk of processed client data to write, converting it
+ * from UTF-16 if needed. Converted chunks are at most
+ * RDP_CLIPBOARD_CHUNK_SIZE bytes, so that memory use doesn't depend on
+ * the size of the data, and the next chunk is only converted once the
+ * application has read the previous one. */
+static bool
+clipboard_data_source_next_chunk(struct rdp_clipboard_data_source *source,
+				 void **data, size_t *size)
+{
+	size_t offset, remaining, n_chars;
+	LPWSTR unicode;
+	int len;
+
+	*data = NULL;
+	*size = 0;
+
+	if (source->write_offset < source->processed_header_size) {
+		*data = (char *)&source->processed_header + source->write_offset;
+		*size = source->processed_header_size - source->write_offset;
+		source->write_offset = source->processed_header_size;
+		return true;
+	}
+
+	offset = source->write_offset - source->processed_header_size;
+	remaining = source->processed_data_size - offset;
+	if (!source->processed_data_start || !remaining)
+		return false;
+
+	if (!source->processed_data_is_unicode) {
+		*data = (char *)source->processed_data_start + offset;
+		*size = MIN(remaining, RDP_CLIPBOARD_CHUNK_SIZE);
+		source->write_offset += *size;
+		return true;
+	}
+
+	/* at most 3 bytes of utf-8 per UTF-16 code unit, and surrogate
+	 * pairs are not split */
+	unicode = (LPWSTR)((char *)source->processed_data_start + offset);
+	n_chars = remaining / 2;
+	if (n_chars > RDP_CLIPBOARD_CHUNK_SIZE / 3) {
+		n_chars = RDP_CLIPBOARD_CHUNK_SIZE / 3;
+		if (unicode[n_chars - 1] >= 0xd800 && unicode[n_chars - 1] <= 0xdbff)
+			n_chars--;
+	}
+
+	if (!source->write_chunk.data &&
+	    !wl_array_add(&source->write_chunk, RDP_CLIPBOARD_CHUNK_SIZE + 1))
+		goto error_return;
+
+#if USE_FREERDP_VERSION >= 3
+	len = ConvertWCharNToUtf8(unicode, n_chars, source->write_chunk.data,
+				  source->write_chunk.alloc);
+#else
+	len = WideCharToMultiByte(CP_UTF8, 0, unicode, n_chars,
+				  source->write_chunk.data,
+				  source->write_chunk.alloc, NULL, NULL);
+#endif
+	if (len < 1)
+		goto error_return;
+
+	*data = source->write_chunk.data;
+	*size = len;
+	source->write_offset += n_chars * 2;
+	return true;
+
+error_return:
+	source->state = RDP_CLIPBOARD_SOURCE_FAILED;
+	weston_log("RDP %s FAILED (%p:%s): utf-8 conversion\n",
+		   __func__, source,
+		   clipboard_data_source_state_to_string(source));
+	return false;
+}
+
 /* Send client's clipboard data to the requesting application at server side */
 static int
 clipboard_data_source_write(int fd, uint32_t mask, void *arg)
@@ -956,8 +1019,8 @@ clipboard_data_source_write(int fd, uint32_t mask, void *arg)
 	} else {
 		fcntl(source->data_source_fd, F_SETFL, O_WRONLY | O_NONBLOCK);
 		clipboard_process_source(source, false);
-		data_to_write = source->processed_data_start;
-		data_size = source->processed_data_size;
+		source->write_offset = 0;
+		clipboard_data_source_next_chunk(source, &data_to_write, &data_size);
 	}
 	while (data_to_write && data_size) {
 		source->state = RDP_CLIPBOARD_SOURCE_TRANSFERING;
@@ -987,7 +1050,9 @@ clipboard_data_source_write(int fd, uint32_t mask, void *arg)
 						    __func__, source,
 						    clipboard_data_source_state_to_string(source),
 						    size, data_size);
-			if (!data_size) {
+			if (!data_size &&
+			    !clipboard_data_source_next_chunk(source, &data_to_write, &data_size) &&
+			    source->state != RDP_CLIPBOARD_SOURCE_FAILED) {
 				source->state = RDP_CLIPBOARD_SOURCE_TRANSFERRED;
 				rdp_debug_clipboard(b, "RDP %s (%p:%s) write completed (%ld bytes)\n",
 						    __func__, source,
@@ -1008,6 +1073,9 @@ fail:
 	source->inflight_write_count = 0;
 	source->inflight_data_to_write = NULL;
 	source->inflight_data_size = 0;
+	source->write_offset = 0;
+	wl_array_release(&source->write_chunk);
+	wl_array_init(&source->write_chunk);
 	ctx->clipboard_inflight_client_data_source = NULL;
 	clipboard_data_source_unref(source);
 
@@ -1302,6 +1370,7 @@ clipboard_data_source_request(bool freeOnly, void *arg)
 	wl_signal_init(&source->base.destroy_signal);
 	wl_array_init(&source->base.mime_types);
 	wl_array_init(&source->data_contents);
+	wl_array_init(&source->write_chunk);
 	source->is_data_processed = false;
 	source->context = ctx->item.peer;
 	source->refcount = 1; /* decremented when data sent to client. */
@@ -1507,6 +1576,7 @@ clipboard_client_format_list(CliprdrServerContext *context, const CLIPRDR_FORMAT
 	wl_signal_init(&source->base.destroy_signal);
 	wl_array_init(&source->base.mime_types);
 	wl_array_init(&source->data_contents);
+	wl_array_init(&source->write_chunk);
 	source->context = client;
 	source->refcount = 1; /* decremented when another source is selected. */
 	source->data_source_fd = -1;
@@ -0,0 +1,568 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Graphics pipeline (MS-RDPEGFX) support.
+ *
+ * Once the client has joined the dynamic virtual channel, the output is
+ * mapped to a single GFX surface and its damage is sent as AVC420 (H.264)
+ * frames when the client and FreeRDP both can do it, and as RemoteFX
+ * otherwise. The client acknowledges every frame; while it is more than
+ * RDP_GFX_MAX_FRAMES_IN_FLIGHT frames behind, damage is accumulated and
+ * sent as a single frame once an acknowledgement arrives, so that a slow
+ * client gets fewer frames instead of a growing backlog. With RemoteFX,
+ * the parts of the output that only moved, see weston_output_get_moves(),
+ * are copied by the client with SurfaceToSurface instead of being encoded.
+ *
+ * The channel runs in external thread mode: its messages are dispatched
+ * from the display loop, so everything here runs on the compositor thread.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rdp.h"
+
+#define RDP_GFX_SURFACE_ID 1
+#define RDP_GFX_MAX_FRAMES_IN_FLIGHT 2
+
+/* Capability sets we can confirm, in order of preference */
+static const UINT32 rdp_gfx_cap_versions[] = {
+	RDPGFX_CAPVERSION_106,
+	RDPGFX_CAPVERSION_105,
+	RDPGFX_CAPVERSION_104,
+	RDPGFX_CAPVERSION_103,
+	RDPGFX_CAPVERSION_102,
+	RDPGFX_CAPVERSION_101,
+	RDPGFX_CAPVERSION_10,
+	RDPGFX_CAPVERSION_81,
+	RDPGFX_CAPVERSION_8,
+};
+
+static bool
+rdp_gfx_caps_have_avc420(const RDPGFX_CAPSET *caps)
+{
+	switch (caps->version) {
+	case RDPGFX_CAPVERSION_8:
+		return false;
+	case RDPGFX_CAPVERSION_81:
+		return caps->flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED;
+	default:
+		return !(caps->flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
+	}
+}
+
+static UINT32
+rdp_gfx_timestamp(void)
+{
+	struct timespec now;
+	struct tm tm;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	gmtime_r(&now.tv_sec, &tm);
+
+	/* MS-RDPEGFX 2.2.2.11: hours, minutes, seconds and milliseconds */
+	return (tm.tm_hour << 22) | (tm.tm_min << 16) | (tm.tm_sec << 10) |
+	       (now.tv_nsec / 1000000);
+}
+
+static void
+rdp_gfx_send_rfx(RdpPeerContext *peerCtx, pixman_region32_t *damage,
+		 pixman_image_t *image)
+{
+	RdpgfxServerContext *gfx = peerCtx->gfx_context;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	RFX_MESSAGE *message;
+
+	message = rdp_rfx_encode(peerCtx->gfx_rfx_context, &peerCtx->rfx_rects,
+				 damage, image);
+	if (!message)
+		return;
+
+	Stream_Clear(peerCtx->encode_stream);
+	Stream_SetPosition(peerCtx->encode_stream, 0);
+	rfx_write_message(peerCtx->gfx_rfx_context, peerCtx->encode_stream,
+			  message);
+	rfx_message_free(peerCtx->gfx_rfx_context, message);
+
+	cmd.surfaceId = RDP_GFX_SURFACE_ID;
+	cmd.codecId = RDPGFX_CODECID_CAVIDEO;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = damage->extents.x1;
+	cmd.top = damage->extents.y1;
+	cmd.right = damage->extents.x2;
+	cmd.bottom = damage->extents.y2;
+	cmd.width = cmd.right - cmd.left;
+	cmd.height = cmd.bottom - cmd.top;
+	cmd.length = Stream_GetPosition(peerCtx->encode_stream);
+	cmd.data = Stream_Buffer(peerCtx->encode_stream);
+
+	gfx->SurfaceCommand(gfx, &cmd);
+}
+
+static bool
+rdp_gfx_send_avc420(RdpPeerContext *peerCtx, pixman_region32_t *damage,
+		    pixman_image_t *image)
+{
+	RdpgfxServerContext *gfx = peerCtx->gfx_context;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	RDPGFX_AVC420_BITMAP_STREAM avc420 = { 0 };
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	BYTE *data = NULL;
+	UINT32 size = 0;
+	INT32 ret;
+#if USE_FREERDP_VERSION >= 3
+	RECTANGLE_16 rect = {
+		.left = damage->extents.x1,
+		.top = damage->extents.y1,
+		.right = damage->extents.x2,
+		.bottom = damage->extents.y2,
+	};
+#endif
+
+	ret = avc420_compress(peerCtx->h264_context,
+			      (BYTE *)pixman_image_get_data(image),
+			      DEFAULT_PIXEL_FORMAT,
+			      pixman_image_get_stride(image), width, height,
+#if USE_FREERDP_VERSION >= 3
+			      &rect,
+#endif
+			      &data, &size, &avc420.meta);
+	if (ret < 0) {
+		free_h264_metablock(&avc420.meta);
+		return false;
+	}
+
+	avc420.data = data;
+	avc420.length = size;
+
+	cmd.surfaceId = RDP_GFX_SURFACE_ID;
+	cmd.codecId = RDPGFX_CODECID_AVC420;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.right = width;
+	cmd.bottom = height;
+	cmd.width = width;
+	cmd.height = height;
+	cmd.extra = &avc420;
+
+	gfx->SurfaceCommand(gfx, &cmd);
+	free_h264_metablock(&avc420.meta);
+
+	return true;
+}
+
+static bool
+rdp_gfx_can_send(RdpPeerContext *peerCtx)
+{
+	return peerCtx->gfx_frame_id - peerCtx->gfx_frame_acked <
+	       RDP_GFX_MAX_FRAMES_IN_FLIGHT;
+}
+
+/* Have the client copy the parts of the surface that only moved, and
+ * add the damage to the pending damage. What a copy overwrites around
+ * the moved pixels is sent again, and a move whose source the client
+ * doesn't have yet is left to the damage.
+ */
+static void
+rdp_gfx_send_moves(RdpPeerContext *peerCtx, pixman_region32_t *damage,
+		   const struct weston_output_move *moves,
+		   unsigned int n_moves)
+{
+	RdpgfxServerContext *gfx = peerCtx->gfx_context;
+	pixman_region32_t *pending = &peerCtx->gfx_pending_damage;
+	pixman_region32_t copied;
+	unsigned int i;
+
+	pixman_region32_init(&copied);
+
+	for (i = 0; i < n_moves; i++) {
+		pixman_region32_t *region = (pixman_region32_t *)&moves[i].region;
+		pixman_box32_t *dst = pixman_region32_extents(region);
+		pixman_box32_t src = {
+			.x1 = dst->x1 - moves[i].dx,
+			.y1 = dst->y1 - moves[i].dy,
+			.x2 = dst->x2 - moves[i].dx,
+			.y2 = dst->y2 - moves[i].dy,
+		};
+		RDPGFX_SURFACE_TO_SURFACE_PDU pdu = { 0 };
+		RDPGFX_POINT16 point = { .x = dst->x1, .y = dst->y1 };
+
+		if (pixman_region32_contains_rectangle(pending, &src) !=
+		    PIXMAN_REGION_OUT)
+			continue;
+
+		pdu.surfaceIdSrc = RDP_GFX_SURFACE_ID;
+		pdu.surfaceIdDest = RDP_GFX_SURFACE_ID;
+		pdu.rectSrc.left = src.x1;
+		pdu.rectSrc.top = src.y1;
+		pdu.rectSrc.right = src.x2;
+		pdu.rectSrc.bottom = src.y2;
+		pdu.destPtsCount = 1;
+		pdu.destPts = &point;
+		gfx->SurfaceToSurface(gfx, &pdu);
+
+		pixman_region32_union_rect(pending, pending, dst->x1, dst->y1,
+					   dst->x2 - dst->x1, dst->y2 - dst->y1);
+		pixman_region32_union(&copied, &copied, region);
+	}
+
+	pixman_region32_union(pending, pending, damage);
+	pixman_region32_subtract(pending, pending, &copied);
+	pixman_region32_fini(&copied);
+}
+
+/* Send the pending damage, and the given damage and moves, as one frame
+ * unless the client is too far behind. */
+static void
+rdp_gfx_flush(RdpPeerContext *peerCtx, pixman_region32_t *damage,
+	      const struct weston_output_move *moves, unsigned int n_moves)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	RdpgfxServerContext *gfx = peerCtx->gfx_context;
+	pixman_region32_t *pending = &peerCtx->gfx_pending_damage;
+	RDPGFX_START_FRAME_PDU start = { 0 };
+	RDPGFX_END_FRAME_PDU end = { 0 };
+	struct rdp_output *output;
+	pixman_image_t *image;
+
+	output = rdp_get_first_output(b);
+
+	/* H.264 frames are encoded whole, with their own motion search */
+	if (!output || peerCtx->gfx_avc420 || !rdp_gfx_can_send(peerCtx))
+		n_moves = 0;
+
+	if (damage && n_moves == 0)
+		pixman_region32_union(pending, pending, damage);
+
+	if (!peerCtx->gfx_ready || !output || !rdp_gfx_can_send(peerCtx) ||
+	    (n_moves == 0 && !pixman_region32_not_empty(pending)))
+		return;
+
+	start.frameId = end.frameId = ++peerCtx->gfx_frame_id;
+	start.timestamp = rdp_gfx_timestamp();
+	gfx->StartFrame(gfx, &start);
+
+	if (n_moves > 0)
+		rdp_gfx_send_moves(peerCtx, damage, moves, n_moves);
+
+	image = output->shadow_surface;
+	pixman_region32_intersect_rect(pending, pending, 0, 0,
+				       pixman_image_get_width(image),
+				       pixman_image_get_height(image));
+	if (pixman_region32_not_empty(pending)) {
+		if (peerCtx->gfx_avc420 &&
+		    !rdp_gfx_send_avc420(peerCtx, pending, image)) {
+			rdp_debug(b, "RDP gfx: H.264 encoding failed, using RemoteFX\n");
+			peerCtx->gfx_avc420 = false;
+		}
+		if (!peerCtx->gfx_avc420)
+			rdp_gfx_send_rfx(peerCtx, pending, image);
+	}
+
+	gfx->EndFrame(gfx, &end);
+	pixman_region32_clear(pending);
+
+	if (peerCtx->gfx_acks_suspended)
+		peerCtx->gfx_frame_acked = peerCtx->gfx_frame_id;
+}
+
+/** Recreate the GFX surface at the current output size
+ *
+ * Used when the capabilities are confirmed, when the peer is reactivated
+ * and when the output mode changes. The whole surface is sent again.
+ */
+void
+rdp_gfx_reset(RdpPeerContext *peerCtx)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	RdpgfxServerContext *gfx = peerCtx->gfx_context;
+	struct rdp_output *output = rdp_get_first_output(b);
+	RDPGFX_RESET_GRAPHICS_PDU reset = { 0 };
+	RDPGFX_CREATE_SURFACE_PDU create = { 0 };
+	RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU map = { 0 };
+	MONITOR_DEF monitor = { 0 };
+	int width, height;
+
+	assert_compositor_thread(b);
+
+	if (!gfx || !peerCtx->gfx_caps_confirmed || !output)
+		return;
+
+	width = pixman_image_get_width(output->shadow_surface);
+	height = pixman_image_get_height(output->shadow_surface);
+
+	if (peerCtx->gfx_ready) {
+		RDPGFX_DELETE_SURFACE_PDU delete = {
+			.surfaceId = RDP_GFX_SURFACE_ID,
+		};
+
+		gfx->DeleteSurface(gfx, &delete);
+		peerCtx->gfx_ready = false;
+	}
+
+	monitor.right = width - 1;
+	monitor.bottom = height - 1;
+	monitor.flags = MONITOR_PRIMARY;
+	reset.width = width;
+	reset.height = height;
+	reset.monitorCount = 1;
+	reset.monitorDefArray = &monitor;
+	if (gfx->ResetGraphics(gfx, &reset) != CHANNEL_RC_OK)
+		return;
+
+	create.surfaceId = RDP_GFX_SURFACE_ID;
+	create.width = width;
+	create.height = height;
+	create.pixelFormat = GFX_PIXEL_FORMAT_XRGB_8888;
+	if (gfx->CreateSurface(gfx, &create) != CHANNEL_RC_OK)
+		return;
+
+	map.surfaceId = RDP_GFX_SURFACE_ID;
+	if (gfx->MapSurfaceToOutput(gfx, &map) != CHANNEL_RC_OK)
+		return;
+
+	rfx_context_reset(peerCtx->gfx_rfx_context, width, height);
+	if (peerCtx->gfx_avc420 &&
+	    !h264_context_reset(peerCtx->h264_context, width, height))
+		peerCtx->gfx_avc420 = false;
+
+	rdp_debug(b, "RDP gfx: %dx%d surface, %s\n", width, height,
+		  peerCtx->gfx_avc420 ? "AVC420" : "RemoteFX");
+
+	peerCtx->gfx_ready = true;
+	peerCtx->gfx_frame_acked = peerCtx->gfx_frame_id;
+	pixman_region32_fini(&peerCtx->gfx_pending_damage);
+	pixman_region32_init_rect(&peerCtx->gfx_pending_damage,
+				  0, 0, width, height);
+	rdp_gfx_flush(peerCtx, NULL, NULL, 0);
+}
+
+/** Send damage to a peer using the graphics pipeline
+ *
+ * \param moves The moves of the repaint the damage comes from, see
+ * weston_output_get_moves(), or NULL.
+ * \return false when the pipeline isn't ready for this peer, and the
+ * damage must be sent with surface bits instead.
+ */
+bool
+rdp_gfx_refresh(RdpPeerContext *peerCtx, pixman_region32_t *damage,
+		const struct weston_output_move *moves, unsigned int n_moves)
+{
+	if (!peerCtx->gfx_ready)
+		return false;
+
+	rdp_gfx_flush(peerCtx, damage, moves, n_moves);
+
+	return true;
+}
+
+static UINT
+rdp_gfx_caps_advertise(RdpgfxServerContext *gfx,
+		       const RDPGFX_CAPS_ADVERTISE_PDU *advertise)
+{
+	RdpPeerContext *peerCtx = gfx->custom;
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	RDPGFX_CAPS_CONFIRM_PDU confirm = { 0 };
+	RDPGFX_CAPSET caps = { 0 };
+	bool found = false;
+	unsigned int i;
+	UINT16 j;
+	UINT ret;
+
+	for (i = 0; i < ARRAY_LENGTH(rdp_gfx_cap_versions) && !found; i++) {
+		for (j = 0; j < advertise->capsSetCount; j++) {
+			if (advertise->capsSets[j].version ==
+			    rdp_gfx_cap_versions[i]) {
+				caps = advertise->capsSets[j];
+				found = true;
+				break;
+			}
+		}
+	}
+	if (!found) {
+		weston_log("RDP gfx: no supported capability set\n");
+		return CHANNEL_RC_UNSUPPORTED_VERSION;
+	}
+
+	if (rdp_gfx_caps_have_avc420(&caps) && !peerCtx->h264_context)
+		peerCtx->h264_context = h264_context_new(TRUE);
+
+	peerCtx->gfx_avc420 = rdp_gfx_caps_have_avc420(&caps) &&
+			      peerCtx->h264_context;
+	if (!peerCtx->gfx_avc420) {
+		if (caps.version == RDPGFX_CAPVERSION_81)
+			caps.flags &= ~RDPGFX_CAPS_FLAG_AVC420_ENABLED;
+		else if (caps.version != RDPGFX_CAPVERSION_8)
+			caps.flags |= RDPGFX_CAPS_FLAG_AVC_DISABLED;
+	}
+
+	confirm.capsSet = &caps;
+	ret = gfx->CapsConfirm(gfx, &confirm);
+	if (ret != CHANNEL_RC_OK)
+		return ret;
+
+	rdp_debug(b, "RDP gfx: confirmed capability set 0x%08x\n",
+		  (unsigned int)caps.version);
+
+	peerCtx->gfx_caps_confirmed = true;
+	rdp_gfx_reset(peerCtx);
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT
+rdp_gfx_frame_acknowledge(RdpgfxServerContext *gfx,
+			  const RDPGFX_FRAME_ACKNOWLEDGE_PDU *ack)
+{
+	RdpPeerContext *peerCtx = gfx->custom;
+
+	if (ack->queueDepth == SUSPEND_FRAME_ACKNOWLEDGEMENT) {
+		peerCtx->gfx_acks_suspended = true;
+		peerCtx->gfx_frame_acked = peerCtx->gfx_frame_id;
+	} else {
+		peerCtx->gfx_acks_suspended = false;
+		peerCtx->gfx_frame_acked = ack->frameId;
+	}
+
+	rdp_gfx_flush(peerCtx, NULL, NULL, 0);
+
+	return CHANNEL_RC_OK;
+}
+
+static int
+rdp_gfx_activity(int fd, uint32_t mask, void *data)
+{
+	RdpPeerContext *peerCtx = data;
+
+	if (rdpgfx_server_handle_messages(peerCtx->gfx_context) !=
+	    CHANNEL_RC_OK) {
+		weston_log("RDP gfx: channel error, using surface bits\n");
+		rdp_gfx_destroy(peerCtx);
+	}
+
+	return 0;
+}
+
+static bool
+rdp_gfx_open(RdpPeerContext *peerCtx)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	struct wl_event_loop *loop;
+	RdpgfxServerContext *gfx;
+	int fd;
+
+	peerCtx->gfx_rfx_context = rfx_context_new(TRUE);
+	if (!peerCtx->gfx_rfx_context)
+		return false;
+#if USE_FREERDP_VERSION >= 3
+	rfx_context_set_mode(peerCtx->gfx_rfx_context, RLGR3);
+#else
+	peerCtx->gfx_rfx_context->mode = RLGR3;
+#endif
+	rfx_context_set_pixel_format(peerCtx->gfx_rfx_context,
+				     DEFAULT_PIXEL_FORMAT);
+
+	gfx = rdpgfx_server_context_new(peerCtx->vcm);
+	if (!gfx)
+		return false;
+	peerCtx->gfx_context = gfx;
+
+	gfx->rdpcontext = &peerCtx->_p;
+	gfx->custom = peerCtx;
+	gfx->CapsAdvertise = rdp_gfx_caps_advertise;
+	gfx->FrameAcknowledge = rdp_gfx_frame_acknowledge;
+
+	if (!gfx->Initialize(gfx, TRUE) || !gfx->Open(gfx))
+		return false;
+
+	fd = GetEventFileDescriptor(rdpgfx_server_get_event_handle(gfx));
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	return rdp_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     rdp_gfx_activity, peerCtx,
+				     &peerCtx->gfx_event_source);
+}
+
+/** Open the graphics pipeline once the client can use it
+ *
+ * Called on every peer activity until the dynamic virtual channel is
+ * ready; only one attempt is made per peer.
+ */
+void
+rdp_gfx_check_channel(RdpPeerContext *peerCtx)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	rdpSettings *settings = peerCtx->_p.settings;
+
+	if (!b->gfx_pipeline || peerCtx->gfx_tried || !peerCtx->vcm ||
+	    !(peerCtx->item.flags & RDP_PEER_ACTIVATED))
+		return;
+
+	if (!freerdp_settings_get_bool(settings, FreeRDP_SupportGraphicsPipeline)) {
+		peerCtx->gfx_tried = true;
+		return;
+	}
+
+	if (!WTSVirtualChannelManagerIsChannelJoined(peerCtx->vcm, "drdynvc") ||
+	    WTSVirtualChannelManagerGetDrdynvcState(peerCtx->vcm) !=
+	    DRDYNVC_STATE_READY)
+		return;
+
+	peerCtx->gfx_tried = true;
+	if (!rdp_gfx_open(peerCtx)) {
+		weston_log("RDP gfx: failed to open the graphics pipeline\n");
+		rdp_gfx_destroy(peerCtx);
+	}
+}
+
+void
+rdp_gfx_destroy(RdpPeerContext *peerCtx)
+{
+	if (peerCtx->gfx_event_source) {
+		wl_event_source_remove(peerCtx->gfx_event_source);
+		peerCtx->gfx_event_source = NULL;
+	}
+
+	if (peerCtx->gfx_context) {
+		peerCtx->gfx_context->Close(peerCtx->gfx_context);
+		rdpgfx_server_context_free(peerCtx->gfx_context);
+		peerCtx->gfx_context = NULL;
+	}
+
+	h264_context_free(peerCtx->h264_context);
+	peerCtx->h264_context = NULL;
+	rfx_context_free(peerCtx->gfx_rfx_context);
+	peerCtx->gfx_rfx_context = NULL;
+
+	peerCtx->gfx_caps_confirmed = false;
+	peerCtx->gfx_ready = false;
+	peerCtx->gfx_avc420 = false;
+	pixman_region32_clear(&peerCtx->gfx_pending_damage);
+}
@@ -30,13 +30,17 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <linux/dma-buf.h>
 #include <linux/input.h>
 #include <netinet/in.h>
 #include <pwd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -53,6 +57,7 @@
 #include <libweston/libweston.h>
 #include <libweston/backend-vnc.h>
 #include <libweston/weston-log.h>
+#include "linux-dmabuf.h"
 #include "pixel-formats.h"
 #include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
@@ -60,12 +65,17 @@
 
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 
+/* neatvnc holds on to the last fed buffer and to any buffer still being
+ * encoded, so a few buffers are needed to keep rendering unblocked. */
+#define VNC_MAX_FBS 4
+
 struct vnc_output;
 
 struct vnc_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
 	struct weston_log_scope *debug;
+	struct weston_log_scope *stats_scope;
 	struct vnc_output *output;
 
 	struct xkb_rule_names xkb_rule_name;
@@ -78,6 +88,8 @@ struct vnc_backend {
 
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
+
+	bool zero_copy;
 };
 
 struct vnc_output {
@@ -88,13 +100,43 @@ struct vnc_output {
 	struct wl_event_source *finish_frame_timer;
 	struct nvnc_display *display;
 
-	struct nvnc_fb_pool *fb_pool;
+	/* GL renderer only: dmabufs mapped straight into nvnc_fbs */
+	bool use_dmabuf_fbs;
+	struct wl_list fb_list; /* vnc_fb::link */
+	int fb_count;
+	struct vnc_fb *last_fed;
+
+	/* Damage of the frames held back while clients catch up, see
+	 * vnc_output_clients_behind() */
+	pixman_region32_t held_damage;
+	struct wl_event_source *resume_source;
+	bool holding;
+
+	struct {
+		uint64_t frames_fed;
+		uint64_t frames_held;
+		int64_t hold_nsec_avg; /* feed to release, moving average */
+	} stats;
 
 	struct wl_list peers;
 
 	bool resizeable;
 };
 
+/* A frame buffer fed to neatvnc: either a dmabuf mapped into an
+ * nvnc_fb, or plain memory that the renderer reads back into. */
+struct vnc_fb {
+	struct nvnc_fb *fb;
+	struct weston_renderbuffer *renderbuffer;
+	int fd; /* -1 unless a dmabuf */
+	void *map;
+	size_t map_size;
+	bool busy;
+	struct timespec fed;
+	struct vnc_output *output; /* NULL once dropped from the list */
+	struct wl_list link;
+};
+
 struct vnc_peer {
 	struct vnc_backend *backend;
 	struct weston_seat *seat;
@@ -102,6 +144,10 @@ struct vnc_peer {
 
 	enum nvnc_button_mask last_button_mask;
 	struct wl_list link;
+
+	struct timespec connected;
+	uint64_t key_events;
+	uint64_t pointer_events;
 };
 
 struct vnc_head {
@@ -295,6 +341,7 @@ vnc_handle_key_event(struct nvnc_client *client, uint32_t keysym,
 	int i;
 
 	weston_compositor_get_time(&time);
+	peer->key_events++;
 
 	if (is_pressed)
 		state = WL_KEYBOARD_KEY_STATE_PRESSED;
@@ -351,6 +398,7 @@ vnc_handle_key_code_event(struct nvnc_client *client, uint32_t key,
 	struct timespec time;
 
 	weston_compositor_get_time(&time);
+	peer->key_events++;
 
 	if (is_pressed)
 		state = WL_KEYBOARD_KEY_STATE_PRESSED;
@@ -423,6 +471,7 @@ vnc_pointer_event(struct nvnc_client *client, uint16_t x, uint16_t y,
 	enum nvnc_button_mask changed_button_mask;
 
 	weston_compositor_get_time(&time);
+	peer->pointer_events++;
 
 	if (x < output->base.width && y < output->base.height) {
 		struct weston_coord_global pos;
@@ -594,6 +643,10 @@ vnc_output_assign_cursor_plane(struct vnc_output *output)
 	if (buffer->type != WESTON_BUFFER_SHM)
 		return;
 
+	/* Released early, only the renderer has the contents now */
+	if (view->surface->buffer_ref.type != BUFFER_MAY_BE_ACCESSED)
+		return;
+
 	format = wl_shm_buffer_get_format(buffer->shm_buffer);
 	if (format != WL_SHM_FORMAT_ARGB8888)
 		return;
@@ -673,63 +726,318 @@ vnc_log_damage(struct vnc_backend *backend, pixman_region32_t *buffer_damage,
 }
 
 static void
-vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
+vnc_log_holding(struct vnc_output *output, bool hold)
+{
+	struct weston_log_scope *scope = output->backend->stats_scope;
+	char timestr[128];
+
+	if (!weston_log_scope_is_enabled(scope))
+		return;
+
+	weston_log_scope_timestamp(scope, timestr, sizeof timestr);
+	weston_log_scope_printf(scope,
+				"%s %s frames, clients take %.1f ms a frame\n",
+				timestr, hold ? "holding back" : "resuming",
+				output->stats.hold_nsec_avg / 1e6);
+}
+
+static void
+vnc_fb_destroy(void *data)
+{
+	struct vnc_fb *vfb = data;
+
+	if (vfb->fd >= 0)
+		munmap(vfb->map, vfb->map_size);
+	weston_renderbuffer_unref(vfb->renderbuffer);
+	free(vfb);
+}
+
+static void
+vnc_output_resume_handler(void *data)
+{
+	struct vnc_output *output = data;
+
+	output->resume_source = NULL;
+	weston_output_schedule_repaint(&output->base);
+}
+
+/* Called once neatvnc is done with a frame buffer: every client that
+ * asked for an update has had it encoded, and a newer frame was fed. */
+static void
+vnc_fb_release(struct nvnc_fb *fb, void *context)
+{
+	struct vnc_fb *vfb = context;
+	struct vnc_output *output = vfb->output;
+	struct wl_event_loop *loop;
+	struct timespec now;
+	int64_t hold_nsec;
+
+	if (vfb->fd >= 0) {
+		struct dma_buf_sync sync = {
+			.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ,
+		};
+
+		ioctl(vfb->fd, DMA_BUF_IOCTL_SYNC, &sync);
+	}
+	vfb->busy = false;
+
+	/* Already dropped from the output */
+	if (!output)
+		return;
+
+	weston_compositor_read_presentation_clock(output->base.compositor,
+						  &now);
+	hold_nsec = timespec_sub_to_nsec(&now, &vfb->fed);
+	if (output->stats.hold_nsec_avg == 0)
+		output->stats.hold_nsec_avg = hold_nsec;
+	else
+		output->stats.hold_nsec_avg +=
+			(hold_nsec - output->stats.hold_nsec_avg) / 8;
+
+	/* The repaint that held back damage did not ask for another one,
+	 * since that would not have stuck from within the repaint. */
+	if (pixman_region32_not_empty(&output->held_damage) &&
+	    !output->resume_source) {
+		loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+		output->resume_source =
+			wl_event_loop_add_idle(loop, vnc_output_resume_handler,
+					       output);
+	}
+}
+
+static void
+vnc_fb_add(struct vnc_output *output, struct vnc_fb *vfb)
+{
+	vfb->output = output;
+	nvnc_set_userdata(vfb->fb, vfb, vnc_fb_destroy);
+	nvnc_fb_set_release_fn(vfb->fb, vnc_fb_release, vfb);
+
+	/* This is a new buffer, so the whole surface is damaged. */
+	pixman_region32_copy(&vfb->renderbuffer->damage,
+			     &output->base.region);
+
+	wl_list_insert(&output->fb_list, &vfb->link);
+	output->fb_count++;
+}
+
+static struct vnc_fb *
+vnc_dmabuf_fb_create(struct vnc_output *output)
+{
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	uint64_t modifier[] = { DRM_FORMAT_MOD_LINEAR };
+	struct linux_dmabuf_memory *dmabuf;
+	struct dmabuf_attributes *attributes;
+	struct vnc_fb *vfb;
+	int width = output->base.width;
+	int height = output->base.height;
+
+	dmabuf = renderer->dmabuf_alloc(renderer, width, height,
+					DRM_FORMAT_XRGB8888,
+					modifier, ARRAY_LENGTH(modifier));
+	if (!dmabuf) {
+		weston_log("Failed to allocate DMABUF (%dx%d)\n",
+			   width, height);
+		return NULL;
+	}
+
+	attributes = dmabuf->attributes;
+	if (attributes->n_planes != 1 || attributes->stride[0] % 4 != 0) {
+		dmabuf->destroy(dmabuf);
+		return NULL;
+	}
+
+	vfb = xzalloc(sizeof(*vfb));
+	vfb->fd = attributes->fd[0];
+	vfb->map_size = attributes->offset[0] +
+			(size_t)attributes->stride[0] * height;
+	vfb->map = mmap(NULL, vfb->map_size, PROT_READ, MAP_SHARED,
+			vfb->fd, 0);
+	if (vfb->map == MAP_FAILED) {
+		weston_log("Failed to map DMABUF: %s\n", strerror(errno));
+		dmabuf->destroy(dmabuf);
+		free(vfb);
+		return NULL;
+	}
+
+	/* On success, the renderbuffer takes ownership of the dmabuf. */
+	vfb->renderbuffer =
+		renderer->create_renderbuffer_dmabuf(&output->base, dmabuf);
+	if (!vfb->renderbuffer) {
+		munmap(vfb->map, vfb->map_size);
+		dmabuf->destroy(dmabuf);
+		free(vfb);
+		return NULL;
+	}
+
+	vfb->fb = nvnc_fb_from_buffer((uint8_t *)vfb->map +
+				      attributes->offset[0],
+				      width, height, DRM_FORMAT_XRGB8888,
+				      attributes->stride[0] / 4);
+	if (!vfb->fb) {
+		renderer->remove_renderbuffer_dmabuf(&output->base,
+						     vfb->renderbuffer);
+		weston_renderbuffer_unref(vfb->renderbuffer);
+		munmap(vfb->map, vfb->map_size);
+		free(vfb);
+		return NULL;
+	}
+
+	vnc_fb_add(output, vfb);
+
+	return vfb;
+}
+
+/* A frame buffer in plain memory, that the renderer reads back into */
+static struct vnc_fb *
+vnc_readback_fb_create(struct vnc_output *output)
 {
-	struct nvnc *server = nvnc_display_get_server(display);
-	struct vnc_backend *backend = nvnc_get_userdata(server);
-	struct vnc_output *output = backend->output;
 	struct weston_compositor *ec = output->base.compositor;
-	struct weston_renderbuffer *renderbuffer;
-	pixman_region32_t local_damage;
-	pixman_region16_t nvnc_damage;
-	struct nvnc_fb *fb;
+	const struct pixel_format_info *pfmt;
+	struct vnc_fb *vfb;
+	int width = output->base.width;
+	int height = output->base.height;
+
+	vfb = xzalloc(sizeof(*vfb));
+	vfb->fd = -1;
+	vfb->fb = nvnc_fb_new(width, height, DRM_FORMAT_XRGB8888, width);
+	if (!vfb->fb) {
+		free(vfb);
+		return NULL;
+	}
 
-	fb = nvnc_fb_pool_acquire(output->fb_pool);
-	assert(fb);
+	pfmt = pixel_format_get_info(DRM_FORMAT_XRGB8888);
+
+	switch (ec->renderer->type) {
+	case WESTON_RENDERER_PIXMAN: {
+		const struct pixman_renderer_interface *pixman;
 
-	renderbuffer = nvnc_get_userdata(fb);
-	if (!renderbuffer) {
-		const struct pixel_format_info *pfmt;
+		pixman = ec->renderer->pixman;
 
-		pfmt = pixel_format_get_info(DRM_FORMAT_XRGB8888);
+		vfb->renderbuffer =
+			pixman->create_image_from_ptr(&output->base, pfmt,
+						      width, height,
+						      nvnc_fb_get_addr(vfb->fb),
+						      width * 4);
+		break;
+	}
+	case WESTON_RENDERER_GL: {
+		vfb->renderbuffer =
+			ec->renderer->gl->create_fbo(&output->base, pfmt,
+						     width, height,
+						     nvnc_fb_get_addr(vfb->fb));
+		break;
+	}
+	default:
+		unreachable("cannot have auto renderer at runtime");
+	}
 
-		switch (ec->renderer->type) {
-		case WESTON_RENDERER_PIXMAN: {
-			const struct pixman_renderer_interface *pixman;
+	if (!vfb->renderbuffer) {
+		nvnc_fb_unref(vfb->fb);
+		free(vfb);
+		return NULL;
+	}
 
-			pixman = ec->renderer->pixman;
+	vnc_fb_add(output, vfb);
 
-			renderbuffer =
-				pixman->create_image_from_ptr(&output->base, pfmt,
-							      output->base.width,
-							      output->base.height,
-							      nvnc_fb_get_addr(fb),
-							      output->base.width * 4);
-			break;
-		}
-		case WESTON_RENDERER_GL: {
-			renderbuffer =
-				ec->renderer->gl->create_fbo(&output->base, pfmt,
-							     output->base.width,
-							     output->base.height,
-							     nvnc_fb_get_addr(fb));
-			break;
-		}
-		default:
-			unreachable("cannot have auto renderer at runtime");
+	return vfb;
+}
+
+static struct vnc_fb *
+vnc_output_acquire_fb(struct vnc_output *output)
+{
+	struct vnc_fb *vfb;
+
+	wl_list_for_each(vfb, &output->fb_list, link) {
+		if (!vfb->busy)
+			return vfb;
+	}
+
+	if (output->fb_count >= VNC_MAX_FBS)
+		return NULL;
+
+	if (output->use_dmabuf_fbs) {
+		vfb = vnc_dmabuf_fb_create(output);
+		if (vfb)
+			return vfb;
+
+		if (output->fb_count == 0) {
+			weston_log("Cannot map DMABUFs for VNC, "
+				   "falling back to reading back pixels\n");
+			output->use_dmabuf_fbs = false;
 		}
+	}
+
+	return vnc_readback_fb_create(output);
+}
+
+/*
+ * Drop all framebuffers, once the renderer has released its own
+ * references to their renderbuffers. The ones neatvnc still holds are
+ * destroyed when it lets go of them.
+ */
+static void
+vnc_output_clear_fbs(struct vnc_output *output)
+{
+	struct vnc_fb *vfb, *tmp;
+
+	wl_list_for_each_safe(vfb, tmp, &output->fb_list, link) {
+		wl_list_remove(&vfb->link);
+		vfb->output = NULL;
+		nvnc_fb_unref(vfb->fb);
+	}
+	output->fb_count = 0;
+	output->last_fed = NULL;
+}
 
-		/* This is a new buffer, so the whole surface is damaged. */
-		pixman_region32_copy(&renderbuffer->damage,
-				     &output->base.region);
+/*
+ * Whether the clients are still busy with frames older than the last one
+ * fed. neatvnc only encodes for clients that asked for an update, and
+ * merges the damage of the frames a client missed, so holding frames
+ * back until the slowest client has caught up costs nothing but the frame
+ * rate, and keeps slow links from piling up latency. Clients on fast
+ * links keep up and get every frame.
+ */
+static bool
+vnc_output_clients_behind(struct vnc_output *output)
+{
+	struct vnc_fb *vfb;
+
+	wl_list_for_each(vfb, &output->fb_list, link) {
+		if (vfb->busy && vfb != output->last_fed)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+vnc_update_buffer(struct vnc_output *output, pixman_region32_t *damage)
+{
+	struct vnc_backend *backend = output->backend;
+	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t local_damage;
+	pixman_region16_t nvnc_damage;
+	struct vnc_fb *vfb;
 
-		nvnc_set_userdata(fb, renderbuffer,
-				  (nvnc_cleanup_fn)weston_renderbuffer_unref);
+	vfb = vnc_output_acquire_fb(output);
+	if (!vfb) {
+		weston_log("VNC: cannot allocate a frame buffer\n");
+		return;
 	}
 
-	vnc_log_damage(backend, &renderbuffer->damage, damage);
+	vnc_log_damage(backend, &vfb->renderbuffer->damage, damage);
+
+	ec->renderer->repaint_output(&output->base, damage, vfb->renderbuffer);
 
-	ec->renderer->repaint_output(&output->base, damage, renderbuffer);
+	if (vfb->fd >= 0) {
+		struct dma_buf_sync sync = {
+			.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ,
+		};
+
+		/* Waits for rendering to finish before neatvnc reads the
+		 * mapping; released again in vnc_fb_release(). */
+		ioctl(vfb->fd, DMA_BUF_IOCTL_SYNC, &sync);
+	}
 
 	/* Convert to local coordinates */
 	pixman_region32_init(&local_damage);
@@ -739,12 +1047,48 @@ vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 	pixman_region_init(&nvnc_damage);
 	vnc_region32_to_region16(&nvnc_damage, &local_damage);
 
-	nvnc_display_feed_buffer(output->display, fb, &nvnc_damage);
-	nvnc_fb_unref(fb);
+	weston_compositor_read_presentation_clock(ec, &vfb->fed);
+	vfb->busy = true;
+	output->last_fed = vfb;
+	output->stats.frames_fed++;
+
+	nvnc_display_feed_buffer(output->display, vfb->fb, &nvnc_damage);
 	pixman_region32_fini(&local_damage);
 	pixman_region_fini(&nvnc_damage);
 }
 
+static void
+vnc_stats_scope_new_subscription(struct weston_log_subscription *subs,
+				 void *data)
+{
+	struct vnc_backend *backend = data;
+	struct vnc_output *output = backend->output;
+	struct vnc_peer *peer;
+	struct timespec now;
+
+	if (!output) {
+		weston_log_subscription_printf(subs, "No VNC output.\n");
+		return;
+	}
+
+	weston_log_subscription_printf(subs,
+		"Frames fed: %" PRIu64 ", held back: %" PRIu64 "%s\n"
+		"Clients take %.1f ms a frame on average\n",
+		output->stats.frames_fed, output->stats.frames_held,
+		output->holding ? " (holding now)" : "",
+		output->stats.hold_nsec_avg / 1e6);
+
+	weston_compositor_read_presentation_clock(backend->compositor, &now);
+	wl_list_for_each(peer, &output->peers, link) {
+		weston_log_subscription_printf(subs,
+			"Client %p: connected %" PRId64 " s, "
+			"%" PRIu64 " key events, %" PRIu64 " pointer events\n",
+			peer->client,
+			timespec_sub_to_msec(&now, &peer->connected) / 1000,
+			peer->key_events, peer->pointer_events);
+	}
+}
+
 static void
 vnc_new_client(struct nvnc_client *client)
 {
@@ -760,6 +1104,8 @@ vnc_new_client(struct nvnc_client *client)
 	peer->client = client;
 	peer->backend = backend;
 	peer->seat = xzalloc(sizeof(*peer->seat));
+	weston_compositor_read_presentation_clock(backend->compositor,
+						  &peer->connected);
 
 	weston_seat_init(peer->seat, backend->compositor, seat_name);
 	weston_seat_init_pointer(peer->seat);
@@ -842,10 +1188,10 @@ vnc_output_enable(struct weston_output *base)
 							     finish_frame_handler,
 							     output);
 
-	output->fb_pool = nvnc_fb_pool_new(output->base.width,
-					   output->base.height,
-					   backend->formats[0]->format,
-					   output->base.width);
+	output->use_dmabuf_fbs = backend->zero_copy &&
+				 renderer->type == WESTON_RENDERER_GL &&
+				 renderer->dmabuf_alloc &&
+				 renderer->create_renderbuffer_dmabuf;
 
 	output->display = nvnc_display_new(0, 0);
 
@@ -870,7 +1216,6 @@ vnc_output_disable(struct weston_output *base)
 
 	nvnc_remove_display(backend->server, output->display);
 	nvnc_display_unref(output->display);
-	nvnc_fb_pool_unref(output->fb_pool);
 
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
@@ -883,6 +1228,13 @@ vnc_output_disable(struct weston_output *base)
 		unreachable("cannot have auto renderer at runtime");
 	}
 
+	vnc_output_clear_fbs(output);
+	pixman_region32_clear(&output->held_damage);
+	if (output->resume_source) {
+		wl_event_source_remove(output->resume_source);
+		output->resume_source = NULL;
+	}
+
 	wl_event_source_remove(output->finish_frame_timer);
 	backend->output = NULL;
 
@@ -901,6 +1253,7 @@ vnc_output_destroy(struct weston_output *base)
 
 	vnc_output_disable(&output->base);
 	weston_output_release(&output->base);
+	pixman_region32_fini(&output->held_damage);
 
 	free(output);
 }
@@ -923,6 +1276,8 @@ vnc_create_output(struct weston_backend *backend, const char *name)
 	output->base.attach_head = NULL;
 
 	output->backend = b;
+	wl_list_init(&output->fb_list);
+	pixman_region32_init(&output->held_damage);
 
 	weston_compositor_add_pending_output(&output->base, b->compositor);
 
@@ -951,6 +1306,8 @@ vnc_destroy(struct weston_backend *base)
 
 	if (backend->debug)
 		weston_log_scope_destroy(backend->debug);
+	if (backend->stats_scope)
+		weston_log_scope_destroy(backend->stats_scope);
 
 	free(backend);
 }
@@ -1012,9 +1369,23 @@ vnc_output_repaint(struct weston_output *base)
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(base, &damage);
+	pixman_region32_union(&damage, &damage, &output->held_damage);
 
 	if (pixman_region32_not_empty(&damage)) {
-		vnc_update_buffer(output->display, &damage);
+		bool hold = vnc_output_clients_behind(output);
+
+		if (hold != output->holding)
+			vnc_log_holding(output, hold);
+		output->holding = hold;
+
+		if (hold) {
+			/* vnc_fb_release() gets the repaint going again. */
+			pixman_region32_copy(&output->held_damage, &damage);
+			output->stats.frames_held++;
+		} else {
+			pixman_region32_clear(&output->held_damage);
+			vnc_update_buffer(output, &damage);
+		}
 	}
 
 	pixman_region32_fini(&damage);
@@ -1075,9 +1446,8 @@ vnc_switch_mode(struct weston_output *base, struct weston_mode *target_mode)
 
 	weston_renderer_resize_output(base, &fb_size, NULL);
 
-	nvnc_fb_pool_resize(output->fb_pool, target_mode->width,
-			    target_mode->height, DRM_FORMAT_XRGB8888,
-			    target_mode->width);
+	vnc_output_clear_fbs(output);
+	pixman_region32_clear(&output->held_damage);
 
 	return 0;
 }
@@ -1148,11 +1518,17 @@ vnc_backend_create(struct weston_compositor *compositor,
 	backend->base.destroy = vnc_destroy;
 	backend->base.create_output = vnc_create_output;
 	backend->vnc_monitor_refresh_rate = config->refresh_rate * 1000;
+	backend->zero_copy = config->zero_copy;
 
 	backend->debug = weston_compositor_add_log_scope(compositor,
 							 "vnc-backend",
 							 "Debug messages from VNC backend\n",
 							 NULL, NULL, NULL);
+	backend->stats_scope =
+		weston_compositor_add_log_scope(compositor, "vnc-stats",
+						"VNC frame pacing and clients\n",
+						vnc_stats_scope_new_subscription,
+						NULL, backend);
 
 	wl_list_insert(&compositor->backend_list, &backend->base.link);
 
@@ -1208,6 +1584,13 @@ vnc_backend_create(struct weston_compositor *compositor,
 		goto err_output;
 	aml_set_default(backend->aml);
 
+	/* neatvnc encodes every client's updates as aml work, which without
+	 * workers runs on the compositor loop. A thread pool with one worker
+	 * per CPU keeps slow or many viewers from stalling repaints. */
+	if (aml_require_workers(backend->aml, -1) < 0)
+		weston_log("Failed to start VNC encoder threads, "
+			   "encoding on the main loop.\n");
+
 	fd = aml_get_fd(backend->aml);
 
 	backend->aml_event = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
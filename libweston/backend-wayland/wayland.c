@@ -59,6 +59,7 @@
 #include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
@@ -88,6 +89,8 @@ struct wayland_backend {
 		struct xdg_wm_base *xdg_wm_base;
 		struct zwp_fullscreen_shell_v1 *fshell;
 		struct wl_shm *shm;
+		struct zwp_linux_dmabuf_v1 *linux_dmabuf;
+		uint32_t linux_dmabuf_version;
 
 		struct wl_list output_list;
 
@@ -110,6 +113,13 @@ struct wayland_backend {
 
 	const struct pixel_format_info **formats;
 	unsigned int formats_count;
+
+	/* Present GL outputs with renderer allocated dmabufs instead of
+	 * through wl_egl_window. */
+	bool use_dmabuf;
+	/** Formats and modifiers the parent accepts for any surface */
+	struct weston_drm_format_array dmabuf_formats;
+	struct wayland_dmabuf_feedback *default_feedback;
 };
 
 struct wayland_output {
@@ -143,6 +153,12 @@ struct wayland_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	struct {
+		struct wl_list buffers;	/**< wayland_dmabuf_buffer::link */
+		/** Parent feedback for this surface, NULL before version 4 */
+		struct wayland_dmabuf_feedback *feedback;
+	} dmabuf;
+
 	struct weston_mode mode;
 	struct weston_mode native_mode;
 
@@ -196,6 +212,38 @@ struct wayland_shm_buffer {
 	cairo_surface_t *c_surface;
 };
 
+struct wayland_dmabuf_buffer {
+	struct wayland_output *output;	/**< NULL once orphaned */
+	struct wl_list link;		/**< wayland_output::dmabuf::buffers */
+
+	struct wl_buffer *buffer;
+	struct weston_renderbuffer *renderbuffer;
+	bool busy;
+};
+
+/* Layout of the format table shared by zwp_linux_dmabuf_feedback_v1 */
+struct wayland_dmabuf_format_table_entry {
+	uint32_t format;
+	uint32_t padding;
+	uint64_t modifier;
+};
+
+struct wayland_dmabuf_feedback {
+	struct zwp_linux_dmabuf_feedback_v1 *proxy;
+
+	const struct wayland_dmabuf_format_table_entry *table;
+	size_t table_size;
+
+	/* Tranches come in decreasing order of preference. A format keeps
+	 * the modifiers of the first tranche listing it. */
+	struct weston_drm_format_array tranche;
+	struct weston_drm_format_array pending;
+	struct weston_drm_format_array formats;
+
+	void (*changed)(struct wayland_dmabuf_feedback *feedback, void *data);
+	void *data;
+};
+
 struct wayland_input {
 	struct weston_seat base;
 	struct wayland_backend *backend;
@@ -408,6 +456,345 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	return sb;
 }
 
+static void
+dmabuf_feedback_format_table(void *data,
+			     struct zwp_linux_dmabuf_feedback_v1 *proxy,
+			     int32_t fd, uint32_t size)
+{
+	struct wayland_dmabuf_feedback *feedback = data;
+	void *table;
+
+	if (feedback->table)
+		munmap((void *)feedback->table, feedback->table_size);
+	feedback->table = NULL;
+	feedback->table_size = 0;
+
+	table = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (table == MAP_FAILED) {
+		weston_log("could not map the parent dmabuf format table: %s\n",
+			   strerror(errno));
+		return;
+	}
+
+	feedback->table = table;
+	feedback->table_size = size;
+}
+
+static void
+dmabuf_feedback_main_device(void *data,
+			    struct zwp_linux_dmabuf_feedback_v1 *proxy,
+			    struct wl_array *device)
+{
+	/* Buffers are always allocated on the renderer device. */
+}
+
+static void
+dmabuf_feedback_tranche_target_device(void *data,
+				      struct zwp_linux_dmabuf_feedback_v1 *proxy,
+				      struct wl_array *device)
+{
+}
+
+static void
+dmabuf_feedback_tranche_flags(void *data,
+			      struct zwp_linux_dmabuf_feedback_v1 *proxy,
+			      uint32_t flags)
+{
+}
+
+static void
+dmabuf_feedback_tranche_formats(void *data,
+				struct zwp_linux_dmabuf_feedback_v1 *proxy,
+				struct wl_array *indices)
+{
+	struct wayland_dmabuf_feedback *feedback = data;
+	const struct wayland_dmabuf_format_table_entry *entry;
+	struct weston_drm_format *fmt;
+	size_t count = feedback->table_size / sizeof(*entry);
+	uint16_t *index;
+
+	if (!feedback->table)
+		return;
+
+	wl_array_for_each(index, indices) {
+		if (*index >= count)
+			continue;
+		entry = &feedback->table[*index];
+
+		fmt = weston_drm_format_array_find_format(&feedback->tranche,
+							  entry->format);
+		if (!fmt)
+			fmt = weston_drm_format_array_add_format(&feedback->tranche,
+								 entry->format);
+		if (!fmt)
+			continue;
+
+		if (!weston_drm_format_has_modifier(fmt, entry->modifier))
+			weston_drm_format_add_modifier(fmt, entry->modifier);
+	}
+}
+
+static void
+dmabuf_feedback_tranche_done(void *data,
+			     struct zwp_linux_dmabuf_feedback_v1 *proxy)
+{
+	struct wayland_dmabuf_feedback *feedback = data;
+	const struct weston_drm_format *src;
+	struct weston_drm_format *dst;
+	const uint64_t *modifiers;
+	unsigned int count, i;
+
+	wl_array_for_each(src, &feedback->tranche.arr) {
+		if (weston_drm_format_array_find_format(&feedback->pending,
+							src->format))
+			continue;
+
+		dst = weston_drm_format_array_add_format(&feedback->pending,
+							 src->format);
+		if (!dst)
+			continue;
+
+		modifiers = weston_drm_format_get_modifiers(src, &count);
+		for (i = 0; i < count; i++)
+			weston_drm_format_add_modifier(dst, modifiers[i]);
+	}
+
+	weston_drm_format_array_fini(&feedback->tranche);
+	weston_drm_format_array_init(&feedback->tranche);
+}
+
+static void
+dmabuf_feedback_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *proxy)
+{
+	struct wayland_dmabuf_feedback *feedback = data;
+	bool changed;
+
+	changed = !weston_drm_format_array_equal(&feedback->formats,
+						 &feedback->pending);
+	if (changed)
+		weston_drm_format_array_replace(&feedback->formats,
+						&feedback->pending);
+
+	weston_drm_format_array_fini(&feedback->pending);
+	weston_drm_format_array_init(&feedback->pending);
+
+	if (changed && feedback->changed)
+		feedback->changed(feedback, feedback->data);
+}
+
+static const struct zwp_linux_dmabuf_feedback_v1_listener dmabuf_feedback_listener = {
+	.done = dmabuf_feedback_done,
+	.format_table = dmabuf_feedback_format_table,
+	.main_device = dmabuf_feedback_main_device,
+	.tranche_done = dmabuf_feedback_tranche_done,
+	.tranche_target_device = dmabuf_feedback_tranche_target_device,
+	.tranche_formats = dmabuf_feedback_tranche_formats,
+	.tranche_flags = dmabuf_feedback_tranche_flags,
+};
+
+/* With a surface, follow the feedback for that surface; without one, the
+ * default feedback of the parent. */
+static struct wayland_dmabuf_feedback *
+wayland_dmabuf_feedback_create(struct wayland_backend *b,
+			       struct wl_surface *surface,
+			       void (*changed)(struct wayland_dmabuf_feedback *,
+					       void *),
+			       void *data)
+{
+	struct wayland_dmabuf_feedback *feedback;
+
+	feedback = xzalloc(sizeof *feedback);
+	weston_drm_format_array_init(&feedback->tranche);
+	weston_drm_format_array_init(&feedback->pending);
+	weston_drm_format_array_init(&feedback->formats);
+	feedback->changed = changed;
+	feedback->data = data;
+
+	if (surface)
+		feedback->proxy =
+			zwp_linux_dmabuf_v1_get_surface_feedback(b->parent.linux_dmabuf,
+								 surface);
+	else
+		feedback->proxy =
+			zwp_linux_dmabuf_v1_get_default_feedback(b->parent.linux_dmabuf);
+	zwp_linux_dmabuf_feedback_v1_add_listener(feedback->proxy,
+						  &dmabuf_feedback_listener,
+						  feedback);
+
+	return feedback;
+}
+
+static void
+wayland_dmabuf_feedback_destroy(struct wayland_dmabuf_feedback *feedback)
+{
+	zwp_linux_dmabuf_feedback_v1_destroy(feedback->proxy);
+	if (feedback->table)
+		munmap((void *)feedback->table, feedback->table_size);
+	weston_drm_format_array_fini(&feedback->tranche);
+	weston_drm_format_array_fini(&feedback->pending);
+	weston_drm_format_array_fini(&feedback->formats);
+	free(feedback);
+}
+
+#ifdef ENABLE_EGL
+static void
+wayland_dmabuf_buffer_destroy(struct wayland_dmabuf_buffer *db)
+{
+	wl_buffer_destroy(db->buffer);
+	wl_list_remove(&db->link);
+	free(db);
+}
+
+static void
+dmabuf_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct wayland_dmabuf_buffer *db = data;
+
+	db->busy = false;
+
+	if (!db->output)
+		wayland_dmabuf_buffer_destroy(db);
+}
+
+static const struct wl_buffer_listener dmabuf_buffer_listener = {
+	dmabuf_buffer_release
+};
+
+/* Drop all dmabuf buffers of the output, so that the next repaint allocates
+ * new ones. Buffers still held by the parent are destroyed on release. */
+static void
+wayland_output_destroy_dmabuf_buffers(struct wayland_output *output)
+{
+	const struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct wayland_dmabuf_buffer *db, *next;
+
+	wl_list_for_each_safe(db, next, &output->dmabuf.buffers, link) {
+		renderer->remove_renderbuffer_dmabuf(&output->base,
+						     db->renderbuffer);
+		weston_renderbuffer_unref(db->renderbuffer);
+		db->renderbuffer = NULL;
+
+		if (db->busy) {
+			db->output = NULL;
+			wl_list_remove(&db->link);
+			wl_list_init(&db->link);
+		} else {
+			wayland_dmabuf_buffer_destroy(db);
+		}
+	}
+}
+
+static const struct weston_drm_format_array *
+wayland_output_get_dmabuf_formats(struct wayland_output *output)
+{
+	struct wayland_dmabuf_feedback *feedback = output->dmabuf.feedback;
+
+	if (feedback && feedback->formats.arr.size > 0)
+		return &feedback->formats;
+
+	feedback = output->backend->default_feedback;
+	if (feedback && feedback->formats.arr.size > 0)
+		return &feedback->formats;
+
+	return &output->backend->dmabuf_formats;
+}
+
+static struct wayland_dmabuf_buffer *
+wayland_output_get_dmabuf_buffer(struct wayland_output *output)
+{
+	struct wayland_backend *b = output->backend;
+	struct weston_renderer *renderer = b->compositor->renderer;
+	const struct weston_drm_format_array *formats;
+	const struct weston_drm_format *fmt = NULL;
+	struct linux_dmabuf_memory *dmabuf;
+	struct dmabuf_attributes *attributes;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct weston_renderbuffer *renderbuffer;
+	struct wayland_dmabuf_buffer *db;
+	const uint64_t *modifiers;
+	unsigned int count, i;
+	int width, height;
+
+	wl_list_for_each(db, &output->dmabuf.buffers, link) {
+		if (!db->busy)
+			return db;
+	}
+
+	if (output->frame) {
+		width = frame_width(output->frame);
+		height = frame_height(output->frame);
+	} else {
+		width = output->base.current_mode->width;
+		height = output->base.current_mode->height;
+	}
+
+	formats = wayland_output_get_dmabuf_formats(output);
+	for (i = 0; i < b->formats_count && !fmt; i++)
+		fmt = weston_drm_format_array_find_format(formats,
+							  b->formats[i]->format);
+	if (!fmt) {
+		weston_log("the parent compositor accepts none of our "
+			   "pixel formats as dmabuf\n");
+		return NULL;
+	}
+
+	modifiers = weston_drm_format_get_modifiers(fmt, &count);
+	dmabuf = renderer->dmabuf_alloc(renderer, width, height, fmt->format,
+					modifiers, count);
+	if (!dmabuf) {
+		weston_log("could not allocate a %dx%d dmabuf\n",
+			   width, height);
+		return NULL;
+	}
+	attributes = dmabuf->attributes;
+
+	/* On success, the renderbuffer takes ownership of the dmabuf. */
+	renderbuffer = renderer->create_renderbuffer_dmabuf(&output->base,
+							    dmabuf);
+	if (!renderbuffer) {
+		dmabuf->destroy(dmabuf);
+		return NULL;
+	}
+
+	params = zwp_linux_dmabuf_v1_create_params(b->parent.linux_dmabuf);
+	for (i = 0; i < (unsigned int)attributes->n_planes; i++)
+		zwp_linux_buffer_params_v1_add(params, attributes->fd[i], i,
+					       attributes->offset[i],
+					       attributes->stride[i],
+					       attributes->modifier >> 32,
+					       attributes->modifier & 0xffffffff);
+
+	db = xzalloc(sizeof *db);
+	db->output = output;
+	db->renderbuffer = renderbuffer;
+	db->buffer = zwp_linux_buffer_params_v1_create_immed(params,
+							     width, height,
+							     attributes->format,
+							     0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(db->buffer, &dmabuf_buffer_listener, db);
+	wl_list_insert(&output->dmabuf.buffers, &db->link);
+
+	/* This is a new buffer, so the whole output is damaged. */
+	pixman_region32_copy(&renderbuffer->damage, &output->base.region);
+
+	return db;
+}
+
+static void
+wayland_output_dmabuf_feedback_changed(struct wayland_dmabuf_feedback *feedback,
+				       void *data)
+{
+	struct wayland_output *output = data;
+
+	/* The parent may now prefer other modifiers, e.g. to put the
+	 * surface on a plane, so reallocate. */
+	wayland_output_destroy_dmabuf_buffers(output);
+	weston_output_schedule_repaint(&output->base);
+}
+#endif
+
 static void
 frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -444,7 +831,7 @@ draw_initial_frame(struct wayland_output *output)
 
 	/* If we are rendering with GL, then orphan it so that it gets
 	 * destroyed immediately */
-	if (output->gl.egl_window)
+	if (output->gl.egl_window || output->backend->use_dmabuf)
 		sb->output = NULL;
 
 	wl_surface_attach(output->parent.surface, sb->buffer, 0, 0);
@@ -553,8 +940,10 @@ wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
 }
 
 static void
-wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
-			  pixman_region32_t *repaint_damage)
+wayland_output_attach_buffer(struct wayland_output *output,
+			     struct wl_buffer *buffer,
+			     pixman_region32_t *repaint_damage,
+			     bool frame_damaged)
 {
 	pixman_region32_t damage;
 	pixman_box32_t *rects;
@@ -562,17 +951,17 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
 	int i, n;
 
 	pixman_region32_init(&damage);
-	weston_region_global_to_output(&damage, &sb->output->base,
+	weston_region_global_to_output(&damage, &output->base,
 				       repaint_damage);
 
-	if (sb->output->frame) {
-		frame_interior(sb->output->frame, &ix, &iy, &iwidth, &iheight);
-		fwidth = frame_width(sb->output->frame);
-		fheight = frame_height(sb->output->frame);
+	if (output->frame) {
+		frame_interior(output->frame, &ix, &iy, &iwidth, &iheight);
+		fwidth = frame_width(output->frame);
+		fheight = frame_height(output->frame);
 
 		pixman_region32_translate(&damage, ix, iy);
 
-		if (sb->frame_damaged) {
+		if (frame_damaged) {
 			pixman_region32_union_rect(&damage, &damage,
 						   0, 0, fwidth, iy);
 			pixman_region32_union_rect(&damage, &damage,
@@ -587,15 +976,59 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
 	}
 
 	rects = pixman_region32_rectangles(&damage, &n);
-	wl_surface_attach(sb->output->parent.surface, sb->buffer, 0, 0);
+	wl_surface_attach(output->parent.surface, buffer, 0, 0);
 	for (i = 0; i < n; ++i)
-		wl_surface_damage(sb->output->parent.surface, rects[i].x1,
+		wl_surface_damage(output->parent.surface, rects[i].x1,
 				  rects[i].y1, rects[i].x2 - rects[i].x1,
 				  rects[i].y2 - rects[i].y1);
 
 	pixman_region32_fini(&damage);
 }
 
+#ifdef ENABLE_EGL
+static int
+wayland_output_repaint_gl_dmabuf(struct weston_output *output_base)
+{
+	struct wayland_output *output = to_wayland_output(output_base);
+	struct wayland_backend *b;
+	struct wayland_dmabuf_buffer *db;
+	pixman_region32_t damage;
+	bool frame_damaged;
+
+	assert(output);
+
+	b = output->backend;
+
+	db = wayland_output_get_dmabuf_buffer(output);
+	if (!db)
+		return -1;
+
+	pixman_region32_init(&damage);
+
+	weston_output_flush_damage_for_primary_plane(output_base, &damage);
+
+	frame_damaged = output->frame &&
+			(frame_status(output->frame) & FRAME_STATUS_REPAINT);
+	wayland_output_update_gl_border(output);
+
+	b->compositor->renderer->repaint_output(output_base, &damage,
+						db->renderbuffer);
+
+	wayland_output_attach_buffer(output, db->buffer, &damage,
+				     frame_damaged);
+	db->busy = true;
+
+	pixman_region32_fini(&damage);
+
+	output->frame_cb = wl_surface_frame(output->parent.surface);
+	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
+	wl_surface_commit(output->parent.surface);
+	wl_display_flush(b->parent.wl_display);
+
+	return 0;
+}
+#endif
+
 static int
 wayland_output_repaint_pixman(struct weston_output *output_base)
 {
@@ -624,7 +1057,8 @@ wayland_output_repaint_pixman(struct weston_output *output_base)
 	b->compositor->renderer->repaint_output(output_base, &damage,
 						sb->renderbuffer);
 
-	wayland_shm_buffer_attach(sb, &damage);
+	wayland_output_attach_buffer(output, sb->buffer, &damage,
+				     sb->frame_damaged);
 
 	pixman_region32_fini(&damage);
 
@@ -696,8 +1130,17 @@ wayland_output_disable(struct weston_output *base)
 	case WESTON_RENDERER_GL:
 		weston_gl_borders_fini(&output->gl.borders, &output->base);
 
+		wayland_output_destroy_dmabuf_buffers(output);
+		if (output->dmabuf.feedback) {
+			wayland_dmabuf_feedback_destroy(output->dmabuf.feedback);
+			output->dmabuf.feedback = NULL;
+		}
+
 		renderer->gl->output_destroy(&output->base);
-		wl_egl_window_destroy(output->gl.egl_window);
+		if (output->gl.egl_window) {
+			wl_egl_window_destroy(output->gl.egl_window);
+			output->gl.egl_window = NULL;
+		}
 		break;
 #endif
 	default:
@@ -756,6 +1199,18 @@ wayland_output_init_gl_renderer(struct wayland_output *output)
 		options.fb_size.height = mode->height;
 	}
 
+	renderer = output->base.compositor->renderer;
+
+	if (b->use_dmabuf) {
+		const struct gl_renderer_fbo_options fbo_options = {
+			.fb_size = options.fb_size,
+			.area = options.area,
+		};
+
+		return renderer->gl->output_fbo_create(&output->base,
+						       &fbo_options);
+	}
+
 	output->gl.egl_window =
 		wl_egl_window_create(output->parent.surface,
 				     options.fb_size.width,
@@ -767,8 +1222,6 @@ wayland_output_init_gl_renderer(struct wayland_output *output)
 	options.window_for_legacy = output->gl.egl_window;
 	options.window_for_platform = output->gl.egl_window;
 
-	renderer = output->base.compositor->renderer;
-
 	if (renderer->gl->output_window_create(&output->base, &options) < 0)
 		goto cleanup_window;
 
@@ -776,6 +1229,7 @@ wayland_output_init_gl_renderer(struct wayland_output *output)
 
 cleanup_window:
 	wl_egl_window_destroy(output->gl.egl_window);
+	output->gl.egl_window = NULL;
 	return -1;
 }
 #endif
@@ -843,9 +1297,13 @@ wayland_output_resize_surface(struct wayland_output *output)
 	wl_region_destroy(region);
 
 #ifdef ENABLE_EGL
-	if (output->gl.egl_window) {
-		wl_egl_window_resize(output->gl.egl_window,
-				     fb_size.width, fb_size.height, 0, 0);
+	if (output->gl.egl_window || b->use_dmabuf) {
+		if (output->gl.egl_window)
+			wl_egl_window_resize(output->gl.egl_window,
+					     fb_size.width, fb_size.height,
+					     0, 0);
+		else
+			wayland_output_destroy_dmabuf_buffers(output);
 		weston_renderer_resize_output(&output->base, &fb_size, &area);
 
 		/* These will need to be re-created due to the resize */
@@ -1028,8 +1486,12 @@ wayland_output_switch_mode_finish(struct wayland_output *output)
 		break;
 #ifdef ENABLE_EGL
 	case WESTON_RENDERER_GL:
+		wayland_output_destroy_dmabuf_buffers(output);
 		renderer->gl->output_destroy(&output->base);
-		wl_egl_window_destroy(output->gl.egl_window);
+		if (output->gl.egl_window) {
+			wl_egl_window_destroy(output->gl.egl_window);
+			output->gl.egl_window = NULL;
+		}
 		if (wayland_output_init_gl_renderer(output) < 0)
 			return -1;
 		break;
@@ -1266,6 +1728,7 @@ wayland_output_enable(struct weston_output *base)
 
 	wl_list_init(&output->shm.buffers);
 	wl_list_init(&output->shm.free_buffers);
+	wl_list_init(&output->dmabuf.buffers);
 
 	weston_log("Creating %dx%d wayland output at (%d, %d)\n",
 		   output->base.current_mode->width,
@@ -1291,7 +1754,18 @@ wayland_output_enable(struct weston_output *base)
 		if (wayland_output_init_gl_renderer(output) < 0)
 			goto err_output;
 
-		output->base.repaint = wayland_output_repaint_gl;
+		if (b->use_dmabuf) {
+			if (b->parent.linux_dmabuf_version >=
+			    ZWP_LINUX_DMABUF_V1_GET_SURFACE_FEEDBACK_SINCE_VERSION)
+				output->dmabuf.feedback =
+					wayland_dmabuf_feedback_create(b,
+						output->parent.surface,
+						wayland_output_dmabuf_feedback_changed,
+						output);
+			output->base.repaint = wayland_output_repaint_gl_dmabuf;
+		} else {
+			output->base.repaint = wayland_output_repaint_gl;
+		}
 		break;
 #endif
 	default:
@@ -2673,6 +3147,38 @@ static const struct xdg_wm_base_listener wm_base_listener = {
 	xdg_wm_base_ping,
 };
 
+static void
+linux_dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *linux_dmabuf,
+		    uint32_t format)
+{
+	/* Superseded by the modifier event. */
+}
+
+static void
+linux_dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *linux_dmabuf,
+		      uint32_t format, uint32_t modifier_hi,
+		      uint32_t modifier_lo)
+{
+	struct wayland_backend *b = data;
+	uint64_t modifier = ((uint64_t)modifier_hi << 32) | modifier_lo;
+	struct weston_drm_format *fmt;
+
+	fmt = weston_drm_format_array_find_format(&b->dmabuf_formats, format);
+	if (!fmt)
+		fmt = weston_drm_format_array_add_format(&b->dmabuf_formats,
+							 format);
+	if (!fmt)
+		return;
+
+	if (!weston_drm_format_has_modifier(fmt, modifier))
+		weston_drm_format_add_modifier(fmt, modifier);
+}
+
+static const struct zwp_linux_dmabuf_v1_listener linux_dmabuf_listener = {
+	linux_dmabuf_format,
+	linux_dmabuf_modifier
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		       const char *interface, uint32_t version)
@@ -2701,6 +3207,15 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		b->parent.shm =
 			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION) {
+		b->parent.linux_dmabuf_version = MIN(version, 4);
+		b->parent.linux_dmabuf =
+			wl_registry_bind(registry, name,
+					 &zwp_linux_dmabuf_v1_interface,
+					 b->parent.linux_dmabuf_version);
+		zwp_linux_dmabuf_v1_add_listener(b->parent.linux_dmabuf,
+						 &linux_dmabuf_listener, b);
 	}
 }
 
@@ -2788,6 +3303,13 @@ wayland_destroy(struct weston_backend *backend)
 	if (b->parent.shm)
 		wl_shm_destroy(b->parent.shm);
 
+	if (b->default_feedback)
+		wayland_dmabuf_feedback_destroy(b->default_feedback);
+	weston_drm_format_array_fini(&b->dmabuf_formats);
+
+	if (b->parent.linux_dmabuf)
+		zwp_linux_dmabuf_v1_destroy(b->parent.linux_dmabuf);
+
 	if (b->parent.xdg_wm_base)
 		xdg_wm_base_destroy(b->parent.xdg_wm_base);
 
@@ -2901,10 +3423,24 @@ wayland_backend_create(struct weston_compositor *compositor,
 	wl_list_init(&b->parent.output_list);
 	wl_list_init(&b->input_list);
 	wl_list_init(&b->pending_input_list);
+	weston_drm_format_array_init(&b->dmabuf_formats);
 	b->parent.registry = wl_display_get_registry(b->parent.wl_display);
 	wl_registry_add_listener(b->parent.registry, &registry_listener, b);
 	wl_display_roundtrip(b->parent.wl_display);
 
+	if (new_config->use_dmabuf && b->parent.linux_dmabuf) {
+		if (b->parent.linux_dmabuf_version >=
+		    ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION)
+			b->default_feedback =
+				wayland_dmabuf_feedback_create(b, NULL, NULL,
+							       NULL);
+		wl_display_roundtrip(b->parent.wl_display);
+
+		if (b->default_feedback)
+			weston_drm_format_array_replace(&b->dmabuf_formats,
+							&b->default_feedback->formats);
+	}
+
 	if (b->parent.shm == NULL) {
 		weston_log("Error: Failed to retrieve wl_shm from parent Wayland compositor\n");
 		goto err_display;
@@ -2956,6 +3492,22 @@ wayland_backend_create(struct weston_compositor *compositor,
 		goto err_display;
 	}
 
+	if (new_config->use_dmabuf) {
+		const struct weston_renderer *r = compositor->renderer;
+
+		if (r->type != WESTON_RENDERER_GL)
+			weston_log("dmabuf presentation needs the GL renderer, "
+				   "using wl_shm\n");
+		else if (!r->dmabuf_alloc || !r->create_renderbuffer_dmabuf)
+			weston_log("the renderer cannot allocate dmabufs, "
+				   "using wl_egl_window\n");
+		else if (b->dmabuf_formats.arr.size == 0)
+			weston_log("the parent compositor does not support "
+				   "dmabuf with modifiers, using wl_egl_window\n");
+		else
+			b->use_dmabuf = true;
+	}
+
 	b->base.shutdown = wayland_shutdown;
 	b->base.destroy = wayland_destroy;
 	b->base.create_output = wayland_output_create;
@@ -2975,6 +3527,9 @@ wayland_backend_create(struct weston_compositor *compositor,
 err_renderer:
 	compositor->renderer->destroy(compositor);
 err_display:
+	if (b->default_feedback)
+		wayland_dmabuf_feedback_destroy(b->default_feedback);
+	weston_drm_format_array_fini(&b->dmabuf_formats);
 	wl_display_disconnect(b->parent.wl_display);
 err_compositor:
 	wl_list_remove(&b->base.link);
@@ -75,6 +75,12 @@
 #define WINDOW_MAX_WIDTH 8192
 #define WINDOW_MAX_HEIGHT 8192
 
+/* SHM segments cycled per output, released by XShm completion events */
+#define X11_SHM_BUFFER_COUNT 2
+
+/* Above this many damage rectangles, put their bounding box instead */
+#define X11_SHM_MAX_PUT_RECTS 16
+
 static const uint32_t x11_formats[] = {
 	DRM_FORMAT_XRGB8888,
 };
@@ -92,6 +98,8 @@ struct x11_backend {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	uint8_t			 shm_event_base;
+	bool			 has_shm;
 	int			 fullscreen;
 	int			 no_input;
 
@@ -129,6 +137,16 @@ struct x11_head {
 	struct weston_head	base;
 };
 
+struct x11_shm_buffer {
+	xcb_shm_seg_t		segment;
+	int			shm_id;
+	void		       *buf;
+	struct weston_renderbuffer *renderbuffer;
+	/* Puts not yet acknowledged by a completion event */
+	unsigned int		pending;
+	uint64_t		last_put;
+};
+
 struct x11_output {
 	struct weston_output	base;
 	struct x11_backend	*backend;
@@ -139,10 +157,9 @@ struct x11_output {
 	struct wl_event_source *finish_frame_timer;
 
 	xcb_gc_t		gc;
-	xcb_shm_seg_t		segment;
-	struct weston_renderbuffer *renderbuffer;
-	int			shm_id;
-	void		       *buf;
+	struct x11_shm_buffer	shm[X11_SHM_BUFFER_COUNT];
+	int			shm_count;
+	uint64_t		shm_put_count;
 	uint8_t			depth;
 	int32_t                 scale;
 	bool			resize_pending;
@@ -232,7 +249,7 @@ x11_backend_get_keymap(struct x11_backend *b)
 	copy_prop_value(options);
 #undef copy_prop_value
 
-	ret = xkb_keymap_new_from_names(b->compositor->xkb_context, &names, 0);
+	ret = weston_compositor_get_keymap(b->compositor, &names);
 
 	free(reply);
 	return ret;
@@ -451,106 +468,132 @@ x11_output_repaint_gl(struct weston_output *output_base)
 	return 0;
 }
 
-static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+/* All buffers are normally released by completion events well within a
+ * frame. If the X server is lagging behind, wait for it to process the
+ * outstanding puts with a round trip, and reuse the oldest buffer. Its
+ * completion events are still counted when they come in.
+ */
+static struct x11_shm_buffer *
+x11_output_get_shm_buffer(struct x11_output *output)
 {
-	struct x11_output *output = to_x11_output(output_base);
-	struct x11_backend *b;
-	pixman_region32_t transformed_region;
-	pixman_box32_t *rects;
-	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
-	int nrects, i;
-	xcb_generic_error_t *err;
+	struct x11_backend *b = output->backend;
+	struct x11_shm_buffer *oldest = NULL;
+	int i;
+
+	for (i = 0; i < output->shm_count; i++) {
+		if (output->shm[i].pending == 0)
+			return &output->shm[i];
+		if (!oldest || output->shm[i].last_put < oldest->last_put)
+			oldest = &output->shm[i];
+	}
 
-	if (!output)
-		return;
+	free(xcb_get_input_focus_reply(b->conn,
+				       xcb_get_input_focus(b->conn), NULL));
 
-	b = output->backend;
+	return oldest;
+}
 
-	pixman_region32_init(&transformed_region);
-	weston_region_global_to_output(&transformed_region,
-				       output_base,
-				       region);
+static void
+x11_output_put_shm_buffer(struct x11_output *output,
+			  struct x11_shm_buffer *sb,
+			  pixman_image_t *image,
+			  pixman_region32_t *damage)
+{
+	struct x11_backend *b = output->backend;
+	pixman_region32_t region;
+	pixman_box32_t *rects;
+	int nrects, i;
 
-	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
+	pixman_region32_init(&region);
+	weston_region_global_to_output(&region, &output->base, damage);
 
-	if (output_rects == NULL) {
-		pixman_region32_fini(&transformed_region);
-		return;
+	rects = pixman_region32_rectangles(&region, &nrects);
+	if (nrects > X11_SHM_MAX_PUT_RECTS) {
+		rects = pixman_region32_extents(&region);
+		nrects = 1;
 	}
 
+	/* Only the last put asks for a completion event: they are
+	 * processed in order, so it releases the buffer. */
 	for (i = 0; i < nrects; i++) {
-		output_rects[i].x = rects[i].x1;
-		output_rects[i].y = rects[i].y1;
-		output_rects[i].width = rects[i].x2 - rects[i].x1;
-		output_rects[i].height = rects[i].y2 - rects[i].y1;
+		xcb_shm_put_image(b->conn, output->window, output->gc,
+				  pixman_image_get_width(image),
+				  pixman_image_get_height(image),
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1,
+				  rects[i].x1, rects[i].y1,
+				  output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  i == nrects - 1, sb->segment, 0);
 	}
 
-	pixman_region32_fini(&transformed_region);
-
-	cookie = xcb_set_clip_rectangles_checked(b->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
+	if (nrects > 0) {
+		sb->pending++;
+		sb->last_put = ++output->shm_put_count;
 	}
-	free(output_rects);
-}
 
+	pixman_region32_fini(&region);
+}
 
 static int
 x11_output_repaint_shm(struct weston_output *output_base)
 {
 	struct x11_output *output = to_x11_output(output_base);
 	const struct weston_renderer *renderer;
+	struct x11_shm_buffer *sb;
 	pixman_image_t *image;
 	struct weston_compositor *ec;
-	struct x11_backend *b;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
 	pixman_region32_t damage;
 
 	assert(output);
 
 	ec = output->base.compositor;
 	renderer = ec->renderer;
-	b = output->backend;
 
-	image = renderer->pixman->renderbuffer_get_image(output->renderbuffer);
+	sb = x11_output_get_shm_buffer(output);
+	image = renderer->pixman->renderbuffer_get_image(sb->renderbuffer);
 
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(output_base, &damage, output->renderbuffer);
+	ec->renderer->repaint_output(output_base, &damage, sb->renderbuffer);
 
-	set_clip_for_output(output_base, &damage);
+	x11_output_put_shm_buffer(output, sb, image, &damage);
+	xcb_flush(output->backend->conn);
 
 	pixman_region32_fini(&damage);
 
-	cookie = xcb_shm_put_image_checked(b->conn, output->window, output->gc,
-					pixman_image_get_width(image),
-					pixman_image_get_height(image),
-					0, 0,
-					pixman_image_get_width(image),
-					pixman_image_get_height(image),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
-	}
-
 	weston_output_arm_frame_timer(output_base, output->finish_frame_timer);
 	return 0;
 }
 
+static void
+x11_backend_handle_shm_completion(struct x11_backend *b,
+				  xcb_shm_completion_event_t *completion)
+{
+	struct weston_output *base;
+	int i;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		struct x11_output *output = to_x11_output(base);
+
+		if (!output)
+			continue;
+
+		for (i = 0; i < output->shm_count; i++) {
+			struct x11_shm_buffer *sb = &output->shm[i];
+
+			if (sb->segment != completion->shmseg)
+				continue;
+
+			if (sb->pending > 0)
+				sb->pending--;
+			return;
+		}
+	}
+}
+
 static int
 finish_frame_handler(void *data)
 {
@@ -562,21 +605,32 @@ finish_frame_handler(void *data)
 }
 
 static void
-x11_output_deinit_shm(struct x11_backend *b, struct x11_output *output)
+x11_shm_buffer_fini(struct x11_backend *b, struct x11_shm_buffer *sb)
 {
 	xcb_void_cookie_t cookie;
 	xcb_generic_error_t *err;
-	xcb_free_gc(b->conn, output->gc);
 
-	weston_renderbuffer_unref(output->renderbuffer);
-	output->renderbuffer = NULL;
-	cookie = xcb_shm_detach_checked(b->conn, output->segment);
+	weston_renderbuffer_unref(sb->renderbuffer);
+	sb->renderbuffer = NULL;
+	cookie = xcb_shm_detach_checked(b->conn, sb->segment);
 	err = xcb_request_check(b->conn, cookie);
 	if (err) {
 		weston_log("xcb_shm_detach failed, error %d\n", err->error_code);
 		free(err);
 	}
-	shmdt(output->buf);
+	shmdt(sb->buf);
+}
+
+static void
+x11_output_deinit_shm(struct x11_backend *b, struct x11_output *output)
+{
+	int i;
+
+	xcb_free_gc(b->conn, output->gc);
+
+	for (i = 0; i < output->shm_count; i++)
+		x11_shm_buffer_fini(b, &output->shm[i]);
+	output->shm_count = 0;
 }
 
 static void
@@ -794,7 +848,8 @@ x11_output_get_shm_pixel_format(struct x11_output *output)
 }
 
 static int
-x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
+x11_shm_buffer_init(struct x11_backend *b, struct x11_output *output,
+		    struct x11_shm_buffer *sb,
 		    const struct pixel_format_info *pfmt, int width, int height)
 {
 	struct weston_renderer *renderer = output->base.compositor->renderer;
@@ -803,34 +858,68 @@ x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 	xcb_generic_error_t *err;
 
 	/* Create SHM segment and attach it */
-	output->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
-	if (output->shm_id == -1) {
+	sb->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
+	if (sb->shm_id == -1) {
 		weston_log("x11shm: failed to allocate SHM segment\n");
 		return -1;
 	}
-	output->buf = shmat(output->shm_id, NULL, 0 /* read/write */);
-	if (-1 == (long)output->buf) {
+	sb->buf = shmat(sb->shm_id, NULL, 0 /* read/write */);
+	if (-1 == (long)sb->buf) {
 		weston_log("x11shm: failed to attach SHM segment\n");
+		shmctl(sb->shm_id, IPC_RMID, NULL);
 		return -1;
 	}
-	output->segment = xcb_generate_id(b->conn);
-	cookie = xcb_shm_attach_checked(b->conn, output->segment, output->shm_id, 1);
+	sb->segment = xcb_generate_id(b->conn);
+	cookie = xcb_shm_attach_checked(b->conn, sb->segment, sb->shm_id, 1);
 	err = xcb_request_check(b->conn, cookie);
 	if (err) {
 		weston_log("x11shm: xcb_shm_attach error %d, op code %d, resource id %d\n",
 			   err->error_code, err->major_code, err->minor_code);
 		free(err);
+		shmdt(sb->buf);
+		shmctl(sb->shm_id, IPC_RMID, NULL);
 		return -1;
 	}
 
-	shmctl(output->shm_id, IPC_RMID, NULL);
+	shmctl(sb->shm_id, IPC_RMID, NULL);
 
 	/* Now create pixman image */
-	output->renderbuffer =
+	sb->renderbuffer =
 		renderer->pixman->create_image_from_ptr(&output->base,
 							pfmt, width, height,
-							output->buf,
+							sb->buf,
 							width * (bitsperpixel / 8));
+	sb->pending = 0;
+	sb->last_put = 0;
+
+	return 0;
+}
+
+static int
+x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
+		    const struct pixel_format_info *pfmt, int width, int height)
+{
+	const xcb_query_extension_reply_t *ext;
+	int i;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_shm_id);
+	if (ext == NULL || !ext->present) {
+		weston_log("x11shm: SHM extension is not available\n");
+		return -1;
+	}
+	b->shm_event_base = ext->first_event;
+	b->has_shm = true;
+
+	output->shm_count = 0;
+	for (i = 0; i < X11_SHM_BUFFER_COUNT; i++) {
+		if (x11_shm_buffer_init(b, output, &output->shm[i], pfmt,
+					width, height) < 0)
+			break;
+		output->shm_count++;
+	}
+
+	if (output->shm_count == 0)
+		return -1;
 
 	output->gc = xcb_generate_id(b->conn);
 	xcb_create_gc(b->conn, output->gc, output->window, 0, NULL);
@@ -1743,6 +1832,11 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 		}
 #endif
 
+		if (b->has_shm &&
+		    response_type == b->shm_event_base + XCB_SHM_COMPLETION)
+			x11_backend_handle_shm_completion(b,
+				(xcb_shm_completion_event_t *) event);
+
 		count++;
 		if (b->prev_event != event)
 			free(event);
@@ -91,6 +91,18 @@ struct weston_backend {
 	 */
 	void (*repaint_flush)(struct weston_backend *backend);
 
+	/** Notify that an output of the sequence was repainted (optional)
+	 *
+	 * Called after each successful output repaint of a repaint
+	 * sequence. A backend whose outputs are committed in independent
+	 * groups may commit a group here as soon as its last output has
+	 * been repainted, instead of waiting for repaint_flush(), and must
+	 * then call weston_output_repaint_flushed() on each of the outputs
+	 * it committed.
+	 */
+	void (*repaint_output_done)(struct weston_backend *backend,
+				    struct weston_output *output);
+
 	/** Allocate a new output
 	 *
 	 * @param backend The backend.
@@ -197,6 +209,9 @@ weston_output_finish_frame(struct weston_output *output,
 void
 weston_output_repaint_failed(struct weston_output *output);
 
+void
+weston_output_repaint_flushed(struct weston_output *output);
+
 int
 weston_output_mode_set_native(struct weston_output *output,
 			      struct weston_mode *mode,
@@ -349,4 +364,28 @@ void
 weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 					     pixman_region32_t *damage);
 
+/** A part of the output that the repaint only moved
+ *
+ * The pixels of \c region, in output framebuffer coordinates, are the
+ * pixels of the previous frame at \c region translated by (-dx, -dy).
+ * The extents of the region of a move overlap neither the extents of
+ * another move of the same repaint nor the area those are copied from,
+ * so the moves can be applied in any order.
+ */
+struct weston_output_move {
+	pixman_region32_t region;
+	int32_t dx, dy;
+};
+
+const struct weston_output_move *
+weston_output_get_moves(struct weston_output *output, unsigned int *count);
+
+uint64_t
+weston_output_get_frame_seq(struct weston_output *output);
+
+bool
+weston_output_get_damage_since(struct weston_output *output,
+			       uint64_t frame_seq,
+			       pixman_region32_t *damage);
+
 #endif
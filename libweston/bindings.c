@@ -25,16 +25,62 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <linux/input.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 #include "tablet-unstable-v2-server-protocol.h"
 
+enum binding_kind {
+	BINDING_KIND_KEY = 1,
+	BINDING_KIND_BUTTON,
+	BINDING_KIND_AXIS,
+};
+
+/* All bindings of one kind for one (code, modifier) pair, in the order
+ * they were added. Buckets are kept until the compositor goes away, so a
+ * handler destroying the last binding of the bucket being run is fine. */
+struct weston_binding_bucket {
+	struct wl_list binding_list; /* weston_binding::bucket_link */
+};
+
+static inline uint64_t
+binding_index_key(enum binding_kind kind, uint32_t code, uint32_t modifier)
+{
+	return ((uint64_t)kind << 56) | ((uint64_t)modifier << 32) | code;
+}
+
+static inline uint32_t
+binding_index_hash(uint64_t key)
+{
+	return hash_u32((uint32_t)key ^ hash_u32(key >> 32));
+}
+
+static inline bool
+binding_index_equal(uint64_t a, uint64_t b)
+{
+	return a == b;
+}
+
+HASH_MAP_DECLARE(binding_bucket_map, uint64_t,
+		 struct weston_binding_bucket *);
+HASH_MAP_DEFINE(static inline, binding_bucket_map, uint64_t,
+		struct weston_binding_bucket *, binding_index_hash,
+		binding_index_equal)
+
+/* Key, button and axis bindings are looked up by (code, modifier) for
+ * every input event, instead of walking the binding lists. The lists on
+ * weston_compositor still own the bindings. */
+struct weston_binding_index {
+	struct binding_bucket_map buckets;
+};
+
 struct weston_binding {
 	uint32_t key;
 	uint32_t button;
@@ -43,8 +89,83 @@ struct weston_binding {
 	void *handler;
 	void *data;
 	struct wl_list link;
+	struct wl_list bucket_link; /* empty if not indexed */
 };
 
+static struct weston_binding_bucket *
+weston_binding_index_find(struct weston_compositor *compositor,
+			  enum binding_kind kind, uint32_t code,
+			  uint32_t modifier)
+{
+	struct weston_binding_bucket **bucket;
+
+	if (!compositor->binding_index)
+		return NULL;
+
+	bucket = binding_bucket_map_lookup(&compositor->binding_index->buckets,
+					   binding_index_key(kind, code,
+							     modifier));
+
+	return bucket ? *bucket : NULL;
+}
+
+static bool
+weston_binding_index_add(struct weston_compositor *compositor,
+			 struct weston_binding *binding,
+			 enum binding_kind kind, uint32_t code)
+{
+	struct weston_binding_index *index = compositor->binding_index;
+	struct weston_binding_bucket *bucket;
+
+	if (!index) {
+		index = zalloc(sizeof *index);
+		if (!index)
+			return false;
+		binding_bucket_map_init(&index->buckets);
+		compositor->binding_index = index;
+	}
+
+	bucket = weston_binding_index_find(compositor, kind, code,
+					   binding->modifier);
+	if (!bucket) {
+		bucket = zalloc(sizeof *bucket);
+		if (!bucket)
+			return false;
+		wl_list_init(&bucket->binding_list);
+
+		if (!binding_bucket_map_insert(&index->buckets,
+					       binding_index_key(kind, code,
+								 binding->modifier),
+					       bucket)) {
+			free(bucket);
+			return false;
+		}
+	}
+
+	wl_list_insert(bucket->binding_list.prev, &binding->bucket_link);
+
+	return true;
+}
+
+void
+weston_binding_index_destroy(struct weston_compositor *compositor)
+{
+	struct weston_binding_index *index = compositor->binding_index;
+	struct binding_bucket_map_entry *entry;
+	uint32_t i;
+
+	if (!index)
+		return;
+
+	hash_map_for_each(i, entry, &index->buckets) {
+		assert(wl_list_empty(&entry->value->binding_list));
+		free(entry->value);
+	}
+	binding_bucket_map_release(&index->buckets);
+	free(index);
+	compositor->binding_index = NULL;
+}
+
 static struct weston_binding *
 weston_compositor_add_binding(struct weston_compositor *compositor,
 			      uint32_t key, uint32_t button, uint32_t axis,
@@ -62,6 +183,7 @@ weston_compositor_add_binding(struct weston_compositor *compositor,
 	binding->modifier = modifier;
 	binding->handler = handler;
 	binding->data = data;
+	wl_list_init(&binding->bucket_link);
 
 	return binding;
 }
@@ -80,6 +202,12 @@ weston_compositor_add_key_binding(struct weston_compositor *compositor,
 	if (binding == NULL)
 		return NULL;
 
+	if (!weston_binding_index_add(compositor, binding,
+				      BINDING_KIND_KEY, key)) {
+		free(binding);
+		return NULL;
+	}
+
 	wl_list_insert(compositor->key_binding_list.prev, &binding->link);
 
 	return binding;
@@ -117,6 +245,12 @@ weston_compositor_add_button_binding(struct weston_compositor *compositor,
 	if (binding == NULL)
 		return NULL;
 
+	if (!weston_binding_index_add(compositor, binding,
+				      BINDING_KIND_BUTTON, button)) {
+		free(binding);
+		return NULL;
+	}
+
 	wl_list_insert(compositor->button_binding_list.prev, &binding->link);
 
 	return binding;
@@ -173,6 +307,12 @@ weston_compositor_add_axis_binding(struct weston_compositor *compositor,
 	if (binding == NULL)
 		return NULL;
 
+	if (!weston_binding_index_add(compositor, binding,
+				      BINDING_KIND_AXIS, axis)) {
+		free(binding);
+		return NULL;
+	}
+
 	wl_list_insert(compositor->axis_binding_list.prev, &binding->link);
 
 	return binding;
@@ -198,6 +338,7 @@ WL_EXPORT void
 weston_binding_destroy(struct weston_binding *binding)
 {
 	wl_list_remove(&binding->link);
+	wl_list_remove(&binding->bucket_link);
 	free(binding);
 }
 
@@ -314,6 +455,7 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  enum wl_keyboard_key_state state)
 {
 	struct weston_binding *b, *tmp;
+	struct weston_binding_bucket *bucket;
 	struct weston_surface *focus;
 	struct weston_seat *seat = keyboard->seat;
 
@@ -324,22 +466,26 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = key;
 
-	wl_list_for_each_safe(b, tmp, &compositor->key_binding_list, link) {
-		if (b->key == key && b->modifier == seat->modifier_state) {
-			weston_key_binding_handler_t handler = b->handler;
-			focus = keyboard->focus;
-			handler(keyboard, time, key, b->data);
-
-			/* If this was a key binding and it didn't
-			 * install a keyboard grab, install one now to
-			 * swallow the key press. */
-			if (keyboard->grab == &keyboard->default_grab ||
-			    keyboard->grab == &keyboard->input_method_grab)
-				install_binding_grab(keyboard,
-						     time,
-						     key,
-						     focus);
-		}
+	bucket = weston_binding_index_find(compositor, BINDING_KIND_KEY, key,
+					   seat->modifier_state);
+	if (!bucket)
+		return;
+
+	wl_list_for_each_safe(b, tmp, &bucket->binding_list, bucket_link) {
+		weston_key_binding_handler_t handler = b->handler;
+
+		focus = keyboard->focus;
+		handler(keyboard, time, key, b->data);
+
+		/* If this was a key binding and it didn't
+		 * install a keyboard grab, install one now to
+		 * swallow the key press. */
+		if (keyboard->grab == &keyboard->default_grab ||
+		    keyboard->grab == &keyboard->input_method_grab)
+			install_binding_grab(keyboard,
+					     time,
+					     key,
+					     focus);
 	}
 }
 
@@ -382,6 +528,7 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 				     enum wl_pointer_button_state state)
 {
 	struct weston_binding *b, *tmp;
+	struct weston_binding_bucket *bucket;
 
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		return;
@@ -390,12 +537,15 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = button;
 
-	wl_list_for_each_safe(b, tmp, &compositor->button_binding_list, link) {
-		if (b->button == button &&
-		    b->modifier == pointer->seat->modifier_state) {
-			weston_button_binding_handler_t handler = b->handler;
-			handler(pointer, time, button, b->data);
-		}
+	bucket = weston_binding_index_find(compositor, BINDING_KIND_BUTTON,
+					   button,
+					   pointer->seat->modifier_state);
+	if (!bucket)
+		return;
+
+	wl_list_for_each_safe(b, tmp, &bucket->binding_list, bucket_link) {
+		weston_button_binding_handler_t handler = b->handler;
+		handler(pointer, time, button, b->data);
 	}
 }
 
@@ -443,22 +593,25 @@ weston_compositor_run_axis_binding(struct weston_compositor *compositor,
 				   const struct timespec *time,
 				   struct weston_pointer_axis_event *event)
 {
-	struct weston_binding *b, *tmp;
+	struct weston_binding *b;
+	struct weston_binding_bucket *bucket;
+	weston_axis_binding_handler_t handler;
 
 	/* Invalidate all active modifier bindings. */
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = event->axis;
 
-	wl_list_for_each_safe(b, tmp, &compositor->axis_binding_list, link) {
-		if (b->axis == event->axis &&
-		    b->modifier == pointer->seat->modifier_state) {
-			weston_axis_binding_handler_t handler = b->handler;
-			handler(pointer, time, event, b->data);
-			return 1;
-		}
-	}
+	bucket = weston_binding_index_find(compositor, BINDING_KIND_AXIS,
+					   event->axis,
+					   pointer->seat->modifier_state);
+	if (!bucket || wl_list_empty(&bucket->binding_list))
+		return 0;
+
+	b = wl_container_of(bucket->binding_list.next, b, bucket_link);
+	handler = b->handler;
+	handler(pointer, time, event, b->data);
 
-	return 0;
+	return 1;
 }
 
 int
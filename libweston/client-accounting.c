@@ -0,0 +1,455 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "client-accounting.h"
+#include "linux-dmabuf.h"
+#include "pixel-formats.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+struct weston_client_account {
+	struct wl_client *client;
+	struct wl_listener client_destroy_listener;
+	struct wl_list link; /* weston_client_accounting::account_list */
+	pid_t pid;
+
+	uint32_t surfaces;
+	uint32_t buffers;
+	uint64_t buffer_bytes;
+	uint32_t frame_callbacks;
+
+	uint64_t commits_total;
+	uint64_t buffers_total;
+	uint64_t dmabuf_imports_total;
+	uint32_t rejected;
+
+	/* Presented commits, and their commit to present time summed up */
+	uint64_t presents_total;
+	uint64_t present_latency_usec;
+
+	/* Totals at the previous snapshot, for the rates */
+	struct timespec snapshot_time;
+	uint64_t snapshot_commits;
+	uint64_t snapshot_buffers;
+	uint64_t snapshot_presents;
+	uint64_t snapshot_present_latency_usec;
+};
+
+struct weston_client_accounting {
+	struct weston_compositor *compositor;
+	struct wl_list account_list;
+
+	uint32_t max_surfaces;		/* 0 for no limit */
+	uint64_t max_buffer_bytes;	/* 0 for no limit */
+};
+
+static void
+client_account_destroy(struct weston_client_account *account)
+{
+	wl_list_remove(&account->client_destroy_listener.link);
+	wl_list_remove(&account->link);
+	free(account);
+}
+
+static void
+client_account_handle_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_account *account =
+		container_of(listener, struct weston_client_account,
+			     client_destroy_listener);
+
+	client_account_destroy(account);
+}
+
+/* Resources are torn down after the client destroy signal, so a client
+ * that is going away has no account, and its releases are not counted. */
+static struct weston_client_account *
+client_account_find(struct wl_client *client)
+{
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+				client_account_handle_client_destroy);
+	if (!listener)
+		return NULL;
+
+	return container_of(listener, struct weston_client_account,
+			    client_destroy_listener);
+}
+
+static struct weston_client_account *
+client_account_get(struct weston_compositor *compositor,
+		   struct wl_client *client)
+{
+	struct weston_client_accounting *acc = compositor->client_accounting;
+	struct weston_client_account *account;
+
+	if (!acc)
+		return NULL;
+
+	account = client_account_find(client);
+	if (account)
+		return account;
+
+	account = xzalloc(sizeof *account);
+	account->client = client;
+	wl_client_get_credentials(client, &account->pid, NULL, NULL);
+	weston_compositor_read_presentation_clock(compositor,
+						  &account->snapshot_time);
+	account->client_destroy_listener.notify =
+		client_account_handle_client_destroy;
+	wl_client_add_destroy_listener(client,
+				       &account->client_destroy_listener);
+	wl_list_insert(acc->account_list.prev, &account->link);
+
+	return account;
+}
+
+/* The memory a buffer pins, as far as the compositor can tell */
+static uint64_t
+buffer_size_estimate(const struct weston_buffer *buffer)
+{
+	const struct dmabuf_attributes *attr;
+	uint64_t size = 0;
+	int i;
+
+	switch (buffer->type) {
+	case WESTON_BUFFER_SHM:
+		return (uint64_t)buffer->stride * buffer->height;
+	case WESTON_BUFFER_DMABUF:
+		attr = &buffer->dmabuf->attributes;
+		for (i = 0; i < attr->n_planes; i++) {
+			size += (uint64_t)attr->stride[i] * buffer->height /
+				pixel_format_vsub(buffer->pixel_format, i);
+		}
+		return size;
+	case WESTON_BUFFER_SOLID:
+		return 0;
+	case WESTON_BUFFER_RENDERER_OPAQUE:
+		return (uint64_t)buffer->width * buffer->height * 4;
+	}
+
+	return 0;
+}
+
+static struct wl_client *
+buffer_get_client(const struct weston_buffer *buffer)
+{
+	if (!buffer->resource)
+		return NULL;
+
+	return wl_resource_get_client(buffer->resource);
+}
+
+struct weston_client_accounting *
+weston_client_accounting_create(struct weston_compositor *compositor)
+{
+	struct weston_client_accounting *acc;
+
+	acc = xzalloc(sizeof *acc);
+	acc->compositor = compositor;
+	wl_list_init(&acc->account_list);
+
+	return acc;
+}
+
+void
+weston_client_accounting_destroy(struct weston_client_accounting *acc)
+{
+	struct weston_client_account *account, *tmp;
+
+	if (!acc)
+		return;
+
+	wl_list_for_each_safe(account, tmp, &acc->account_list, link)
+		client_account_destroy(account);
+
+	free(acc);
+}
+
+/** Set per-client resource budgets
+ *
+ * \param compositor The compositor.
+ * \param max_surfaces The most wl_surfaces a client may have at once, or 0
+ * for no limit.
+ * \param max_buffer_bytes The most buffer memory a client may have
+ * attached or created at once, as estimated from the buffer sizes, or 0
+ * for no limit.
+ *
+ * A client that would go over a budget has the creation of the surface or
+ * buffer fail, which disconnects it with an out-of-memory error.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_set_client_budget(struct weston_compositor *compositor,
+				    uint32_t max_surfaces,
+				    uint64_t max_buffer_bytes)
+{
+	struct weston_client_accounting *acc = compositor->client_accounting;
+
+	if (!acc)
+		return;
+
+	acc->max_surfaces = max_surfaces;
+	acc->max_buffer_bytes = max_buffer_bytes;
+}
+
+bool
+weston_client_account_surface_created(struct weston_compositor *compositor,
+				      struct wl_client *client)
+{
+	struct weston_client_accounting *acc = compositor->client_accounting;
+	struct weston_client_account *account;
+
+	account = client_account_get(compositor, client);
+	if (!account)
+		return true;
+
+	if (acc->max_surfaces && account->surfaces >= acc->max_surfaces) {
+		weston_log("Client (pid %d) is over its budget of %" PRIu32
+			   " surfaces, refusing a new one.\n",
+			   (int)account->pid, acc->max_surfaces);
+		account->rejected++;
+		return false;
+	}
+
+	account->surfaces++;
+
+	return true;
+}
+
+void
+weston_client_account_surface_destroyed(struct wl_client *client)
+{
+	struct weston_client_account *account = client_account_find(client);
+
+	if (account) {
+		assert(account->surfaces > 0);
+		account->surfaces--;
+	}
+}
+
+bool
+weston_client_account_buffer_created(struct weston_compositor *compositor,
+				     struct weston_buffer *buffer)
+{
+	struct weston_client_accounting *acc = compositor->client_accounting;
+	struct wl_client *client = buffer_get_client(buffer);
+	struct weston_client_account *account;
+	uint64_t size;
+
+	if (!client)
+		return true;
+
+	account = client_account_get(compositor, client);
+	if (!account)
+		return true;
+
+	size = buffer_size_estimate(buffer);
+	if (acc->max_buffer_bytes &&
+	    account->buffer_bytes + size > acc->max_buffer_bytes) {
+		weston_log("Client (pid %d) is over its buffer budget of "
+			   "%" PRIu64 " KiB, refusing a %" PRIu64 " KiB "
+			   "buffer.\n", (int)account->pid,
+			   acc->max_buffer_bytes / 1024, size / 1024);
+		account->rejected++;
+		return false;
+	}
+
+	account->buffers++;
+	account->buffers_total++;
+	account->buffer_bytes += size;
+
+	return true;
+}
+
+void
+weston_client_account_buffer_destroyed(struct weston_buffer *buffer)
+{
+	struct wl_client *client = buffer_get_client(buffer);
+	struct weston_client_account *account;
+
+	if (!client)
+		return;
+
+	account = client_account_find(client);
+	if (!account)
+		return;
+
+	assert(account->buffers > 0);
+	account->buffers--;
+	account->buffer_bytes -= MIN(account->buffer_bytes,
+				     buffer_size_estimate(buffer));
+}
+
+void
+weston_client_account_frame_callback_added(struct weston_compositor *compositor,
+					   struct wl_client *client)
+{
+	struct weston_client_account *account;
+
+	account = client_account_get(compositor, client);
+	if (account)
+		account->frame_callbacks++;
+}
+
+void
+weston_client_account_frame_callback_gone(struct wl_client *client)
+{
+	struct weston_client_account *account = client_account_find(client);
+
+	if (account && account->frame_callbacks > 0)
+		account->frame_callbacks--;
+}
+
+void
+weston_client_account_commit(struct weston_compositor *compositor,
+			     struct wl_client *client)
+{
+	struct weston_client_account *account;
+
+	account = client_account_get(compositor, client);
+	if (account)
+		account->commits_total++;
+}
+
+void
+weston_client_account_dmabuf_import(struct weston_compositor *compositor,
+				    struct wl_client *client)
+{
+	struct weston_client_account *account;
+
+	account = client_account_get(compositor, client);
+	if (account)
+		account->dmabuf_imports_total++;
+}
+
+/** Note the presentation of a surface commit of the client
+ *
+ * \param latency_nsec Time from the commit to its presentation.
+ */
+void
+weston_client_account_present(struct weston_compositor *compositor,
+			      struct wl_client *client, int64_t latency_nsec)
+{
+	struct weston_client_account *account;
+
+	account = client_account_get(compositor, client);
+	if (!account)
+		return;
+
+	account->presents_total++;
+	account->present_latency_usec += MAX(latency_nsec, 0) / 1000;
+}
+
+static double
+rate_per_sec(uint64_t now_total, uint64_t then_total, int64_t msecs)
+{
+	if (msecs <= 0)
+		return 0.0;
+
+	return (now_total - then_total) * 1000.0 / msecs;
+}
+
+/** Print the per-client totals and end the stream
+ *
+ * Called when the one-shot "client-accounting" debug scope is
+ * subscribed. Rates are averaged over the time since the previous
+ * snapshot, or since the client connected, and so is the mean commit to
+ * present time of the client's surfaces.
+ */
+void
+weston_client_accounting_snapshot(struct weston_log_subscription *sub,
+				  void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_client_accounting *acc = compositor->client_accounting;
+	struct weston_client_account *account;
+	struct timespec now;
+	int64_t msecs;
+
+	if (!acc) {
+		weston_log_subscription_complete(sub);
+		return;
+	}
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+
+	if (acc->max_surfaces || acc->max_buffer_bytes) {
+		weston_log_subscription_printf(sub,
+			"Budget per client: %" PRIu32 " surfaces, "
+			"%" PRIu64 " KiB buffers (0 is no limit)\n",
+			acc->max_surfaces, acc->max_buffer_bytes / 1024);
+	}
+
+	weston_log_subscription_printf(sub,
+		"%8s %8s %8s %10s %9s %10s %10s %10s %8s %10s\n",
+		"pid", "surfaces", "buffers", "buf KiB", "frame cb",
+		"commits/s", "buffers/s", "dmabufs", "refused", "present ms");
+
+	wl_list_for_each(account, &acc->account_list, link) {
+		uint64_t presents = account->presents_total -
+				    account->snapshot_presents;
+		uint64_t latency = account->present_latency_usec -
+				   account->snapshot_present_latency_usec;
+
+		msecs = timespec_sub_to_msec(&now, &account->snapshot_time);
+
+		weston_log_subscription_printf(sub,
+			"%8d %8" PRIu32 " %8" PRIu32 " %10" PRIu64
+			" %9" PRIu32 " %10.1f %10.1f %10" PRIu64 " %8" PRIu32
+			" %10.2f\n",
+			(int)account->pid, account->surfaces,
+			account->buffers, account->buffer_bytes / 1024,
+			account->frame_callbacks,
+			rate_per_sec(account->commits_total,
+				     account->snapshot_commits, msecs),
+			rate_per_sec(account->buffers_total,
+				     account->snapshot_buffers, msecs),
+			account->dmabuf_imports_total, account->rejected,
+			presents ? latency / 1000.0 / presents : 0.0);
+
+		account->snapshot_time = now;
+		account->snapshot_commits = account->commits_total;
+		account->snapshot_buffers = account->buffers_total;
+		account->snapshot_presents = account->presents_total;
+		account->snapshot_present_latency_usec =
+			account->present_latency_usec;
+	}
+
+	weston_log_subscription_complete(sub);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_CLIENT_ACCOUNTING_H
+#define WESTON_CLIENT_ACCOUNTING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libweston/libweston.h>
+
+/*
+ * Per-client resource accounting: how many surfaces, buffers and pending
+ * frame callbacks each client holds, and an estimate of its buffer
+ * memory. The "client-accounting" debug scope prints a snapshot.
+ *
+ * With budgets set, see weston_compositor_set_client_budget(), the
+ * surface and buffer hooks return false for a client that would go over
+ * them, and the caller fails the request.
+ */
+
+struct weston_client_accounting;
+
+struct weston_client_accounting *
+weston_client_accounting_create(struct weston_compositor *compositor);
+
+void
+weston_client_accounting_destroy(struct weston_client_accounting *acc);
+
+bool
+weston_client_account_surface_created(struct weston_compositor *compositor,
+				      struct wl_client *client);
+
+void
+weston_client_account_surface_destroyed(struct wl_client *client);
+
+bool
+weston_client_account_buffer_created(struct weston_compositor *compositor,
+				     struct weston_buffer *buffer);
+
+void
+weston_client_account_buffer_destroyed(struct weston_buffer *buffer);
+
+void
+weston_client_account_frame_callback_added(struct weston_compositor *compositor,
+					   struct wl_client *client);
+
+void
+weston_client_account_frame_callback_gone(struct wl_client *client);
+
+void
+weston_client_account_commit(struct weston_compositor *compositor,
+			     struct wl_client *client);
+
+void
+weston_client_account_dmabuf_import(struct weston_compositor *compositor,
+				    struct wl_client *client);
+
+void
+weston_client_account_present(struct weston_compositor *compositor,
+			      struct wl_client *client, int64_t latency_nsec);
+
+void
+weston_client_accounting_snapshot(struct weston_log_subscription *sub,
+				  void *data);
+
+#endif /* WESTON_CLIENT_ACCOUNTING_H */
@@ -25,21 +25,35 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
 #include <sys/uio.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+
+/* Selections up to this size are kept on the heap; anything larger is
+ * spilled into an anonymous file, which is sealed once complete and
+ * served to pasting clients with sendfile(). */
+#define CLIPBOARD_HEAP_MAX (64 * 1024)
+
+/* Upper bound on the amount of data moved per event loop dispatch, so a
+ * multi-megabyte transfer cannot monopolize the compositor. */
+#define CLIPBOARD_CHUNK_SIZE (64 * 1024)
 
 struct clipboard_source {
 	struct weston_data_source base;
 	struct wl_array contents;
+	int memfd;
+	size_t size;
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
 	uint32_t serial;
@@ -75,34 +89,132 @@ clipboard_source_unref(struct clipboard_source *source)
 	free(*s);
 	wl_array_release(&source->base.mime_types);
 	wl_array_release(&source->contents);
+	if (source->memfd >= 0)
+		close(source->memfd);
 	free(source);
 }
 
+/* Move the contents gathered so far on the heap into an anonymous file,
+ * which then receives the rest of the selection. */
+static int
+clipboard_source_spill(struct clipboard_source *source)
+{
+	size_t offset = 0;
+	ssize_t len;
+	int fd;
+
+	fd = os_create_anonymous_file(source->contents.size);
+	if (fd < 0)
+		return -1;
+
+	while (offset < source->contents.size) {
+		len = pwrite(fd, (char *) source->contents.data + offset,
+			     source->contents.size - offset, offset);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			close(fd);
+			return -1;
+		}
+		offset += len;
+	}
+
+	if (lseek(fd, source->contents.size, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	source->memfd = fd;
+	wl_array_release(&source->contents);
+	wl_array_init(&source->contents);
+
+	return 0;
+}
+
+static ssize_t
+clipboard_source_read_to_memfd(struct clipboard_source *source, int fd)
+{
+	char buffer[4096];
+	ssize_t len, ret;
+	size_t offset = 0;
+
+	len = splice(fd, NULL, source->memfd, NULL, CLIPBOARD_CHUNK_SIZE,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len >= 0 || errno != EINVAL)
+		return len;
+
+	/* Splicing into this file is not supported, bounce through a
+	 * buffer instead. */
+	len = read(fd, buffer, sizeof buffer);
+	if (len <= 0)
+		return len;
+
+	while (offset < (size_t) len) {
+		ret = write(source->memfd, buffer + offset, len - offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		offset += ret;
+	}
+
+	return len;
+}
+
+static void
+clipboard_source_finish(struct clipboard_source *source)
+{
+	wl_event_source_remove(source->event_source);
+	close(source->fd);
+	source->event_source = NULL;
+
+#ifdef HAVE_MEMFD_CREATE
+	/* The selection is complete, make sure it stays unchanged for
+	 * as long as we serve it. */
+	if (source->memfd >= 0)
+		fcntl(source->memfd, F_ADD_SEALS,
+		      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE);
+#endif
+}
+
 static int
 clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
 	char *p;
-	int len, size;
+	ssize_t len;
+	size_t size;
+
+	if (source->memfd < 0 && source->size >= CLIPBOARD_HEAP_MAX &&
+	    clipboard_source_spill(source) < 0)
+		weston_log("clipboard: failed to spill selection to a file, "
+			   "keeping it in memory: %s\n", strerror(errno));
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
+	if (source->memfd >= 0) {
+		len = clipboard_source_read_to_memfd(source, fd);
+	} else {
+		if (source->contents.alloc - source->contents.size < 1024) {
+			wl_array_add(&source->contents, 1024);
+			source->contents.size -= 1024;
+		}
+
+		p = (char *) source->contents.data + source->contents.size;
+		size = source->contents.alloc - source->contents.size;
+		len = read(fd, p, size);
+		if (len > 0)
+			source->contents.size += len;
 	}
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
 	if (len == 0) {
-		wl_event_source_remove(source->event_source);
-		close(fd);
-		source->event_source = NULL;
+		clipboard_source_finish(source);
 	} else if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 1;
 		clipboard_source_unref(source);
 		clipboard->source = NULL;
 	} else {
-		source->contents.size += len;
+		source->size += len;
 	}
 
 	return 1;
@@ -148,6 +260,7 @@ clipboard_source_create(struct clipboard *clipboard,
 		return NULL;
 
 	wl_array_init(&source->contents);
+	source->memfd = -1;
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -189,17 +302,49 @@ struct clipboard_client {
 	struct clipboard_source *source;
 };
 
+static ssize_t
+clipboard_client_write_from_memfd(struct clipboard_client *client, int fd,
+				  size_t count)
+{
+	char buffer[4096];
+	off_t offset = client->offset;
+	ssize_t len;
+
+	len = sendfile(fd, client->source->memfd, &offset, count);
+	if (len >= 0 || (errno != EINVAL && errno != ENOSYS))
+		return len;
+
+	/* The destination does not support sendfile(), bounce through a
+	 * buffer instead. */
+	len = pread(client->source->memfd, buffer,
+		    MIN(count, sizeof buffer), client->offset);
+	if (len <= 0)
+		return len < 0 ? len : -1;
+
+	return write(fd, buffer, len);
+}
+
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
+	struct clipboard_source *source = client->source;
 	char *p;
-	size_t size;
-	int len;
+	size_t size, count;
+	ssize_t len;
+
+	size = source->size;
+	count = MIN(size - client->offset, CLIPBOARD_CHUNK_SIZE);
+	if (source->memfd >= 0) {
+		len = clipboard_client_write_from_memfd(client, fd, count);
+	} else {
+		p = source->contents.data;
+		len = write(fd, p + client->offset, count);
+	}
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
 
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
 	if (len > 0)
 		client->offset += len;
 
@@ -220,11 +365,18 @@ clipboard_client_create(struct clipboard_source *source, int fd)
 	struct clipboard_client *client;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(seat->compositor->wl_display);
+	int flags;
 
 	client = zalloc(sizeof *client);
 	if (client == NULL)
 		return;
 
+	/* Never block the compositor on a slow reader; partial writes are
+	 * resumed when the fd becomes writable again. */
+	flags = fcntl(fd, F_GETFL);
+	if (flags != -1)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
 	client->source = source;
 	source->refcount++;
 	client->event_source =
@@ -27,13 +27,18 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <libweston/libweston.h>
 
 #include "color.h"
 #include "color-lcms.h"
 #include "color-properties.h"
 #include "shared/helpers.h"
+#include "shared/string-helpers.h"
 #include "shared/xalloc.h"
 #include "shared/weston-assert.h"
 
@@ -101,23 +106,24 @@ cmlcms_get_surface_color_transform(struct weston_color_manager *cm_base,
 		.render_intent = render_intent_from_surface_or_default(cm, surface),
 	};
 
-	xform = cmlcms_color_transform_get(cm, &param);
+	struct weston_color_transform *stand_in;
+	bool pending;
+
+	xform = cmlcms_color_transform_get_async(cm, &param, &pending);
+	if (pending) {
+		/* Blend it as if it was sRGB until the real one is ready. */
+		stand_in = output->color_outcome ?
+			   output->color_outcome->from_sRGB_to_blend : NULL;
+		surf_xform->transform = weston_color_transform_ref(stand_in);
+		surf_xform->identity_pipeline = false;
+		surf_xform->provisional = true;
+		return true;
+	}
 	if (!xform)
 		return false;
 
 	surf_xform->transform = &xform->base;
-	/*
-	 * TODO: Instead of this, we should create the INPUT_TO_OUTPUT color
-	 * transformation and check if that is identity. Comparing just the
-	 * profiles will miss image adjustments if we add some.
-	 * OTOH, that will only be useful if DRM-backend learns to do
-	 * opportunistic direct scanout without KMS blending space
-	 * transformations.
-	 */
-	if (xform->search_key.input_profile == xform->search_key.output_profile)
-		surf_xform->identity_pipeline = true;
-	else
-		surf_xform->identity_pipeline = false;
+	surf_xform->identity_pipeline = xform->identity_pipeline;
 
 	return true;
 }
@@ -318,6 +324,23 @@ out_fail:
 	return NULL;
 }
 
+static void
+cmlcms_print_cache_stats(struct weston_log_subscription *subs,
+			 const char *what,
+			 const struct cmlcms_cache_stats *stats)
+{
+	double hit_rate = 0.0;
+
+	if (stats->lookups > 0)
+		hit_rate = 100.0 * stats->hits / stats->lookups;
+
+	weston_log_subscription_printf(subs,
+				       "%s cache: %u entries, %" PRIu64 " lookups, "
+				       "%" PRIu64 " hits (%.1f%%)\n",
+				       what, stats->entries, stats->lookups,
+				       stats->hits, hit_rate);
+}
+
 static void
 transforms_scope_new_sub(struct weston_log_subscription *subs, void *data)
 {
@@ -325,6 +348,9 @@ transforms_scope_new_sub(struct weston_log_subscription *subs, void *data)
 	struct cmlcms_color_transform *xform;
 	char *str;
 
+	cmlcms_print_cache_stats(subs, "Transformation",
+				 &cm->color_transform_stats);
+
 	if (wl_list_empty(&cm->color_transform_list))
 		return;
 
@@ -349,6 +375,8 @@ profiles_scope_new_sub(struct weston_log_subscription *subs, void *data)
 	struct cmlcms_color_profile *cprof;
 	char *str;
 
+	cmlcms_print_cache_stats(subs, "Profile", &cm->color_profile_stats);
+
 	if (wl_list_empty(&cm->color_profile_list))
 		return;
 
@@ -370,6 +398,70 @@ lcms_error_logger(cmsContext context_id,
 	weston_log("LittleCMS error: %s\n", text);
 }
 
+static int
+mkdir_recursive(char *path, mode_t mode)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(path, mode) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	if (mkdir(path, mode) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static char *
+cmlcms_get_eotf_cache_dir(void)
+{
+	const char *base;
+	char *dir = NULL;
+
+	base = getenv("XDG_CACHE_HOME");
+	if (base && base[0] == '/') {
+		str_printf(&dir, "%s/weston/color-eotf", base);
+		return dir;
+	}
+
+	base = getenv("HOME");
+	if (base && base[0] == '/')
+		str_printf(&dir, "%s/.cache/weston/color-eotf", base);
+
+	return dir;
+}
+
+static void
+cmlcms_eotf_cache_init(struct weston_color_manager_lcms *cm)
+{
+	cm->eotf_cache_dir = cmlcms_get_eotf_cache_dir();
+	if (!cm->eotf_cache_dir) {
+		weston_log("color-lcms: EOTF cache: neither XDG_CACHE_HOME nor "
+			   "HOME is set.\n");
+		return;
+	}
+
+	if (mkdir_recursive(cm->eotf_cache_dir, 0700) < 0) {
+		weston_log("color-lcms: EOTF cache: cannot create '%s': %s\n",
+			   cm->eotf_cache_dir, strerror(errno));
+		free(cm->eotf_cache_dir);
+		cm->eotf_cache_dir = NULL;
+		return;
+	}
+
+	weston_log("color-lcms: EOTF cache: using '%s'.\n",
+		   cm->eotf_cache_dir);
+}
+
 static bool
 cmlcms_init(struct weston_color_manager *cm_base)
 {
@@ -408,12 +500,18 @@ cmlcms_init(struct weston_color_manager *cm_base)
 
 	cmsSetLogErrorHandlerTHR(cm->lcms_ctx, lcms_error_logger);
 
+	if (compositor->color_eotf_cache)
+		cmlcms_eotf_cache_init(cm);
+
 	if (!cmlcms_create_stock_profile(cm)) {
 		weston_log("color-lcms: error: cmlcms_create_stock_profile failed\n");
 		goto out_err;
 	}
 	weston_log("LittleCMS %d initialized.\n", cmsGetEncodedCMMversion());
 
+	if (compositor->color_transform_async && !cmlcms_async_init(cm))
+		weston_log("color-lcms: creating color transformations synchronously.\n");
+
 	return true;
 
 out_err:
@@ -436,6 +534,8 @@ cmlcms_destroy(struct weston_color_manager *cm_base)
 {
 	struct weston_color_manager_lcms *cm = to_cmlcms(cm_base);
 
+	cmlcms_async_fini(cm);
+
 	if (cm->sRGB_profile) {
 		/* TODO: when we fix the ugly bug described below, we should
 		 * change this assert to == 1. */
@@ -471,6 +571,7 @@ cmlcms_destroy(struct weston_color_manager *cm_base)
 	weston_log_scope_destroy(cm->optimizer_scope);
 	weston_log_scope_destroy(cm->profiles_scope);
 
+	free(cm->eotf_cache_dir);
 	free(cm);
 }
 
@@ -478,6 +579,7 @@ WL_EXPORT struct weston_color_manager *
 weston_color_manager_create(struct weston_compositor *compositor)
 {
 	struct weston_color_manager_lcms *cm;
+	unsigned i;
 
 	cm = zalloc(sizeof *cm);
 	if (!cm)
@@ -524,6 +626,11 @@ weston_color_manager_create(struct weston_compositor *compositor)
 
 	wl_list_init(&cm->color_transform_list);
 	wl_list_init(&cm->color_profile_list);
+	for (i = 0; i < CMLCMS_HASH_BUCKETS; i++) {
+		wl_list_init(&cm->color_transform_hash[i]);
+		wl_list_init(&cm->color_profile_hash[i]);
+		wl_list_init(&cm->icc_content_hash[i]);
+	}
 
 	return &cm->base;
 }
@@ -28,6 +28,7 @@
 #define WESTON_COLOR_LCMS_H
 
 #include <lcms2.h>
+#include <pthread.h>
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
 
@@ -54,6 +55,15 @@ from_lcmsProfilePtr_array(struct lcmsProfilePtr *arr)
 	return &arr[0].p;
 }
 
+/* Number of hash chains indexing the profile and transform lists */
+#define CMLCMS_HASH_BUCKETS 64
+
+struct cmlcms_cache_stats {
+	unsigned entries;
+	uint64_t lookups;
+	uint64_t hits;
+};
+
 struct weston_color_manager_lcms {
 	struct weston_color_manager base;
 	struct weston_log_scope *profiles_scope;
@@ -64,8 +74,64 @@ struct weston_color_manager_lcms {
 	struct wl_list color_transform_list; /* cmlcms_color_transform::link */
 	struct wl_list color_profile_list; /* cmlcms_color_profile::link */
 	struct cmlcms_color_profile *sRGB_profile; /* stock profile */
+
+	/* cmlcms_color_transform::hash_link, see cmlcms_color_transform_get() */
+	struct wl_list color_transform_hash[CMLCMS_HASH_BUCKETS];
+	struct cmlcms_cache_stats color_transform_stats;
+
+	/* cmlcms_color_profile::hash_link, see cmlcms_color_profile_hash */
+	struct wl_list color_profile_hash[CMLCMS_HASH_BUCKETS];
+	struct cmlcms_cache_stats color_profile_stats;
+
+	/* cmlcms_color_profile::icc.content_link, by the ICC bytes, so that
+	 * identical blobs skip parsing, see cmlcms_get_color_profile_from_icc() */
+	struct wl_list icc_content_hash[CMLCMS_HASH_BUCKETS];
+
+	/* Where EOTFs estimated from cLUT profiles are kept, or NULL */
+	char *eotf_cache_dir;
+
+	/* Surface transformations realized on a worker thread, see
+	 * cmlcms_color_transform_get_async() */
+	struct {
+		bool running;
+		pthread_t thread;
+		/* protects queue, done, stop and async_done of transforms */
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		/* held around xform_realize_chain(), as the LittleCMS
+		 * profiles are shared and not safe to read concurrently */
+		pthread_mutex_t realize_mutex;
+		bool stop;
+		struct wl_list queue; /* cmlcms_color_transform::async_link */
+		struct wl_list done; /* cmlcms_color_transform::async_link */
+		int wakeup_fd;
+		struct wl_event_source *wakeup_source;
+	} async;
 };
 
+/** 32-bit FNV-1a, for indexing the hash chains */
+static inline uint32_t
+cmlcms_hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+#define CMLCMS_HASH_INIT 2166136261u
+
+static inline struct wl_list *
+cmlcms_hash_bucket(struct wl_list *table, uint32_t hash)
+{
+	return &table[hash % CMLCMS_HASH_BUCKETS];
+}
+
 static inline struct weston_color_manager_lcms *
 to_cmlcms(struct weston_color_manager *cm_base)
 {
@@ -108,11 +174,19 @@ struct cmlcms_color_profile {
 	/* struct weston_color_manager_lcms::color_profile_list */
 	struct wl_list link;
 
+	/* struct weston_color_manager_lcms::color_profile_hash */
+	struct wl_list hash_link;
+	uint32_t hash;
+
 	/* Only for CMLCMS_PROFILE_TYPE_ICC */
 	struct {
 		struct lcmsProfilePtr profile;
 		struct cmlcms_md5_sum md5sum;
 		struct ro_anonymous_file *prof_rofile;
+
+		/* weston_color_manager_lcms::icc_content_hash */
+		struct wl_list content_link;
+		uint64_t content_hash;
 	} icc;
 
 	/* Only for CMLCMS_PROFILE_TYPE_PARAMS */
@@ -194,8 +268,22 @@ struct cmlcms_color_transform {
 	/* weston_color_manager_lcms::color_transform_list */
 	struct wl_list link;
 
+	/* weston_color_manager_lcms::color_transform_hash */
+	struct wl_list hash_link;
+
 	struct cmlcms_color_transform_search_param search_key;
 
+	/* weston_color_manager_lcms::async queue or done */
+	struct wl_list async_link;
+	/* Queued for or being realized on the worker thread. Such
+	 * transformations are already in the hash but not in the list. */
+	bool async_pending;
+	/* The worker has finished, protected by the async mutex */
+	bool async_done;
+	bool async_ok;
+	/* Nobody has claimed the creation reference yet */
+	bool async_unclaimed;
+
 	/**
 	 * Cached data used when we can't translate the curves into parametric
 	 * ones that we implement in the renderer. So when we need to fallback
@@ -238,6 +326,13 @@ struct cmlcms_color_transform {
 		/** The transformation uses 3D LUT. */
 		CMLCMS_TRANSFORM_3DLUT,
 	} status;
+
+	/**
+	 * For CMLCMS_CATEGORY_INPUT_TO_BLEND, whether input to output
+	 * (monitor) is identity within tolerance, see
+	 * weston_surface_color_transform::identity_pipeline.
+	 */
+	bool identity_pipeline;
 };
 
 static inline struct cmlcms_color_transform *
@@ -250,6 +345,17 @@ struct cmlcms_color_transform *
 cmlcms_color_transform_get(struct weston_color_manager_lcms *cm,
 			   const struct cmlcms_color_transform_search_param *param);
 
+struct cmlcms_color_transform *
+cmlcms_color_transform_get_async(struct weston_color_manager_lcms *cm,
+				 const struct cmlcms_color_transform_search_param *param,
+				 bool *pending);
+
+bool
+cmlcms_async_init(struct weston_color_manager_lcms *cm);
+
+void
+cmlcms_async_fini(struct weston_color_manager_lcms *cm);
+
 void
 cmlcms_color_transform_destroy(struct cmlcms_color_transform *xform);
 
@@ -27,7 +27,10 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <libweston/libweston.h>
 
 #include "color.h"
@@ -55,26 +58,21 @@ xyz_dot_prod(const struct xyz_arr_flt a, const struct xyz_arr_flt b)
  * https://lists.freedesktop.org/archives/wayland-devel/2019-March/040171.html
  */
 static bool
-build_eotf_from_clut_profile(cmsContext lcms_ctx,
-			     struct lcmsProfilePtr profile,
-			     cmsToneCurve *output_eotf[3],
-			     int num_points)
+sample_eotf_from_clut_profile(cmsContext lcms_ctx,
+			      struct lcmsProfilePtr profile,
+			      float *samples,
+			      int num_points)
 {
 	int ch, point;
 	float *curve_array[3];
-	float *red = NULL;
 	struct lcmsProfilePtr xyz_profile = { NULL };
 	cmsHTRANSFORM transform_rgb_to_xyz = NULL;
 	bool ret = false;
 	const float div = num_points - 1;
 
-	red = malloc(sizeof(float) * num_points * 3);
-	if (!red)
-		goto release;
-
-	curve_array[0] = red;
-	curve_array[1] = red + num_points;
-	curve_array[2] = red + 2 * num_points;
+	curve_array[0] = samples;
+	curve_array[1] = samples + num_points;
+	curve_array[2] = samples + 2 * num_points;
 
 	xyz_profile.p = cmsCreateXYZProfileTHR(lcms_ctx);
 	if (!xyz_profile.p)
@@ -112,35 +110,194 @@ build_eotf_from_clut_profile(cmsContext lcms_ctx,
 							      prim_xyz_max) /
 						 xyz_square_magnitude;
 		}
+	}
+	ret = true;
+
+release:
+	if (transform_rgb_to_xyz)
+		cmsDeleteTransform(transform_rgb_to_xyz);
+	if (xyz_profile.p)
+		cmsCloseProfile(xyz_profile.p);
+
+	return ret;
+}
+
+static bool
+build_eotf_from_samples(cmsContext lcms_ctx,
+			const float *samples,
+			cmsToneCurve *output_eotf[3],
+			int num_points)
+{
+	int ch;
 
+	for (ch = 0; ch < 3; ch++) {
 		/**
 		 * Create LCMS object of rgb tone curves and validate whether
 		 * monotonic
 		 */
 		output_eotf[ch] = cmsBuildTabulatedToneCurveFloat(lcms_ctx,
 								  num_points,
-								  curve_array[ch]);
+								  samples + ch * num_points);
 		if (!output_eotf[ch])
-			goto release;
+			goto fail;
 		if (!cmsIsToneCurveMonotonic(output_eotf[ch])) {
 			/**
 			 * It is interesting to see how this profile was created.
 			 * We assume that such a curve could not be used for linearization
 			 * of arbitrary profile.
 			 */
-			goto release;
+			goto fail;
 		}
 	}
+
+	return true;
+
+fail:
+	cmsFreeToneCurveTriple(output_eotf);
+	return false;
+}
+
+/*
+ * On-disk cache of the EOTF sampled from cLUT profiles, which takes a full
+ * LittleCMS transformation to compute. Each file holds the samples of one
+ * profile, named after its MD5 profile ID and the number of points, which
+ * are also stored in the file and compared on load.
+ */
+
+#define EOTF_CACHE_MAGIC "WSTNEOT1"
+
+struct eotf_cache_header {
+	char magic[8];
+	struct cmlcms_md5_sum md5sum;
+	uint32_t num_points;
+	uint32_t reserved;
+};
+
+static char *
+eotf_cache_path(const char *dir, const struct cmlcms_md5_sum *md5sum,
+		int num_points)
+{
+	char md5sum_str[sizeof(md5sum->bytes) * 2 + 1];
+	char *path = NULL;
+	unsigned i;
+
+	for (i = 0; i < sizeof(md5sum->bytes); i++) {
+		snprintf(md5sum_str + 2 * i, sizeof(md5sum_str) - 2 * i,
+			 "%02x", md5sum->bytes[i]);
+	}
+
+	str_printf(&path, "%s/%s-%d.eotf", dir, md5sum_str, num_points);
+
+	return path;
+}
+
+static bool
+eotf_cache_load(const char *dir, const struct cmlcms_md5_sum *md5sum,
+		float *samples, int num_points)
+{
+	struct eotf_cache_header header;
+	size_t len = sizeof(float) * num_points * 3;
+	bool ret = false;
+	char *path;
+	FILE *fp;
+
+	if (!dir)
+		return false;
+
+	path = eotf_cache_path(dir, md5sum, num_points);
+	if (!path)
+		return false;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		goto out;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    memcmp(header.magic, EOTF_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    memcmp(&header.md5sum, md5sum, sizeof(*md5sum)) != 0 ||
+	    header.num_points != (uint32_t) num_points ||
+	    fread(samples, len, 1, fp) != 1)
+		goto out_close;
+
 	ret = true;
 
+out_close:
+	fclose(fp);
+out:
+	free(path);
+	return ret;
+}
+
+static void
+eotf_cache_store(const char *dir, const struct cmlcms_md5_sum *md5sum,
+		 const float *samples, int num_points)
+{
+	struct eotf_cache_header header = {
+		.md5sum = *md5sum,
+		.num_points = num_points,
+	};
+	size_t len = sizeof(float) * num_points * 3;
+	char *path, *tmp_path = NULL;
+	FILE *fp;
+	bool ok;
+
+	if (!dir)
+		return;
+
+	path = eotf_cache_path(dir, md5sum, num_points);
+	if (path)
+		str_printf(&tmp_path, "%s.tmp", path);
+	if (!tmp_path)
+		goto out;
+
+	memcpy(header.magic, EOTF_CACHE_MAGIC, sizeof(header.magic));
+
+	/* Written aside and renamed, so readers never see a partial file. */
+	fp = fopen(tmp_path, "we");
+	if (!fp)
+		goto out;
+
+	ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+	     fwrite(samples, len, 1, fp) == 1;
+	ok = fclose(fp) == 0 && ok;
+
+	if (!ok || rename(tmp_path, path) < 0)
+		unlink(tmp_path);
+
+out:
+	free(tmp_path);
+	free(path);
+}
+
+static bool
+build_eotf_from_clut_profile(cmsContext lcms_ctx,
+			     struct lcmsProfilePtr profile,
+			     const char *cache_dir,
+			     const struct cmlcms_md5_sum *md5sum,
+			     cmsToneCurve *output_eotf[3],
+			     int num_points)
+{
+	float *samples;
+	bool cached;
+	bool ret = false;
+
+	samples = malloc(sizeof(float) * num_points * 3);
+	if (!samples)
+		return false;
+
+	cached = eotf_cache_load(cache_dir, md5sum, samples, num_points);
+	if (!cached &&
+	    !sample_eotf_from_clut_profile(lcms_ctx, profile,
+					   samples, num_points))
+		goto release;
+
+	ret = build_eotf_from_samples(lcms_ctx, samples, output_eotf,
+				      num_points);
+	if (ret && !cached)
+		eotf_cache_store(cache_dir, md5sum, samples, num_points);
+
 release:
-	if (transform_rgb_to_xyz)
-		cmsDeleteTransform(transform_rgb_to_xyz);
-	if (xyz_profile.p)
-		cmsCloseProfile(xyz_profile.p);
-	free(red);
-	if (ret == false)
-		cmsFreeToneCurveTriple(output_eotf);
+	free(samples);
 
 	return ret;
 }
@@ -186,6 +343,8 @@ static bool
 ensure_output_profile_extract_icc(struct cmlcms_output_profile_extract *extract,
 				  cmsContext lcms_ctx,
 				  struct lcmsProfilePtr hProfile,
+				  const char *cache_dir,
+				  const struct cmlcms_md5_sum *md5sum,
 				  unsigned int num_points,
 				  const char **err_msg)
 {
@@ -223,6 +382,7 @@ ensure_output_profile_extract_icc(struct cmlcms_output_profile_extract *extract,
 		 * linearization that produces sampled curves.
 		 */
 		if (!build_eotf_from_clut_profile(lcms_ctx, hProfile,
+						  cache_dir, md5sum,
 						  eotf_curves, num_points)) {
 			*err_msg = "estimating EOTF failed";
 			goto fail;
@@ -286,6 +446,7 @@ ensure_output_profile_extract(struct cmlcms_color_profile *cprof,
 			      const char **err_msg)
 {
 	struct weston_compositor *compositor = cprof->base.cm->compositor;
+	struct weston_color_manager_lcms *cm = to_cmlcms(cprof->base.cm);
 	bool ret;
 
 	/* Everything already computed */
@@ -295,8 +456,10 @@ ensure_output_profile_extract(struct cmlcms_color_profile *cprof,
 	switch (cprof->type) {
 	case CMLCMS_PROFILE_TYPE_ICC:
 		ret = ensure_output_profile_extract_icc(&cprof->extract, lcms_ctx,
-							cprof->icc.profile, num_points,
-							err_msg);
+							cprof->icc.profile,
+							cm->eotf_cache_dir,
+							&cprof->icc.md5sum,
+							num_points, err_msg);
 		if (ret)
 			weston_assert_ptr(compositor, cprof->extract.eotf.p);
 		break;
@@ -359,29 +522,138 @@ validate_icc_profile(struct lcmsProfilePtr profile, char **errmsg)
 	return true;
 }
 
+static uint32_t
+cmlcms_md5_hash(const struct cmlcms_md5_sum *md5sum)
+{
+	return cmlcms_hash_bytes(CMLCMS_HASH_INIT, md5sum->bytes,
+				 sizeof(md5sum->bytes));
+}
+
+static uint32_t
+cmlcms_params_hash(const struct weston_color_profile_params *params)
+{
+	return cmlcms_hash_bytes(CMLCMS_HASH_INIT, params, sizeof(*params));
+}
+
+/** Add a profile to the lookup hash, once its search key is final */
+static void
+cmlcms_color_profile_hash_insert(struct weston_color_manager_lcms *cm,
+				 struct cmlcms_color_profile *cprof)
+{
+	switch (cprof->type) {
+	case CMLCMS_PROFILE_TYPE_ICC:
+		cprof->hash = cmlcms_md5_hash(&cprof->icc.md5sum);
+		break;
+	case CMLCMS_PROFILE_TYPE_PARAMS:
+		cprof->hash = cmlcms_params_hash(cprof->params);
+		break;
+	}
+
+	wl_list_insert(cmlcms_hash_bucket(cm->color_profile_hash, cprof->hash),
+		       &cprof->hash_link);
+	cm->color_profile_stats.entries++;
+}
+
 static struct cmlcms_color_profile *
-cmlcms_find_color_profile_by_md5(const struct weston_color_manager_lcms *cm,
+cmlcms_find_color_profile_by_md5(struct weston_color_manager_lcms *cm,
 				 const struct cmlcms_md5_sum *md5sum)
 {
 	struct cmlcms_color_profile *cprof;
+	uint32_t hash = cmlcms_md5_hash(md5sum);
+
+	cm->color_profile_stats.lookups++;
 
-	wl_list_for_each(cprof, &cm->color_profile_list, link) {
-		if (cprof->type != CMLCMS_PROFILE_TYPE_ICC)
+	wl_list_for_each(cprof, cmlcms_hash_bucket(cm->color_profile_hash, hash),
+			 hash_link) {
+		if (cprof->hash != hash ||
+		    cprof->type != CMLCMS_PROFILE_TYPE_ICC)
 			continue;
 
 		if (memcmp(cprof->icc.md5sum.bytes,
-			   md5sum->bytes, sizeof(md5sum->bytes)) == 0)
+			   md5sum->bytes, sizeof(md5sum->bytes)) == 0) {
+			cm->color_profile_stats.hits++;
 			return cprof;
+		}
 	}
 
 	return NULL;
 }
 
+/** 64-bit FNV-1a of the ICC bytes, collisions are resolved by comparing */
+static uint64_t
+cmlcms_icc_content_hash(const void *icc_data, size_t icc_len)
+{
+	const uint8_t *bytes = icc_data;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i;
+
+	for (i = 0; i < icc_len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static bool
+cmlcms_icc_content_equal(struct ro_anonymous_file *rofile,
+			 const void *icc_data, size_t icc_len)
+{
+	void *map;
+	bool equal;
+	int fd;
+
+	if (os_ro_anonymous_file_size(rofile) != icc_len)
+		return false;
+
+	fd = os_ro_anonymous_file_get_fd(rofile,
+					 RO_ANONYMOUS_FILE_MAPMODE_PRIVATE);
+	if (fd < 0)
+		return false;
+
+	map = mmap(NULL, icc_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	os_ro_anonymous_file_put_fd(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	equal = memcmp(map, icc_data, icc_len) == 0;
+	munmap(map, icc_len);
+
+	return equal;
+}
+
+/** Find the profile made from exactly these ICC bytes, without parsing */
 static struct cmlcms_color_profile *
-cmlcms_find_color_profile_by_params(const struct weston_color_manager_lcms *cm,
+cmlcms_find_color_profile_by_icc(struct weston_color_manager_lcms *cm,
+				 const void *icc_data, size_t icc_len,
+				 uint64_t content_hash)
+{
+	struct cmlcms_color_profile *cprof;
+	struct wl_list *bucket;
+
+	bucket = cmlcms_hash_bucket(cm->icc_content_hash, content_hash);
+	cm->color_profile_stats.lookups++;
+
+	wl_list_for_each(cprof, bucket, icc.content_link) {
+		if (cprof->icc.content_hash != content_hash)
+			continue;
+
+		if (cmlcms_icc_content_equal(cprof->icc.prof_rofile,
+					     icc_data, icc_len)) {
+			cm->color_profile_stats.hits++;
+			return cprof;
+		}
+	}
+
+	return NULL;
+}
+
+static struct cmlcms_color_profile *
+cmlcms_find_color_profile_by_params(struct weston_color_manager_lcms *cm,
 				    const struct weston_color_profile_params *params)
 {
 	struct cmlcms_color_profile *cprof;
+	uint32_t hash;
 
 	/* Ensure no uninitialized data inside struct to make memcmp work. */
 	static_assert(sizeof(*params) ==
@@ -395,12 +667,19 @@ cmlcms_find_color_profile_by_params(const struct weston_color_manager_lcms *cm,
 			sizeof(params->maxFALL),
 		"struct weston_color_profile_params must not contain implicit padding");
 
-	wl_list_for_each(cprof, &cm->color_profile_list, link) {
-		if (cprof->type != CMLCMS_PROFILE_TYPE_PARAMS)
+	hash = cmlcms_params_hash(params);
+	cm->color_profile_stats.lookups++;
+
+	wl_list_for_each(cprof, cmlcms_hash_bucket(cm->color_profile_hash, hash),
+			 hash_link) {
+		if (cprof->hash != hash ||
+		    cprof->type != CMLCMS_PROFILE_TYPE_PARAMS)
 			continue;
 
-		if (memcmp(cprof->params, params, sizeof(*params)) == 0)
+		if (memcmp(cprof->params, params, sizeof(*params)) == 0) {
+			cm->color_profile_stats.hits++;
 			return cprof;
+		}
 	}
 
 	return NULL;
@@ -436,7 +715,9 @@ cmlcms_color_profile_create(struct weston_color_manager_lcms *cm,
 	cprof->base.description = desc;
 	cprof->icc.profile = profile;
 	cmsGetHeaderProfileID(profile.p, cprof->icc.md5sum.bytes);
+	wl_list_init(&cprof->icc.content_link);
 	wl_list_insert(&cm->color_profile_list, &cprof->link);
+	cmlcms_color_profile_hash_insert(cm, cprof);
 
 	weston_log_scope_printf(cm->profiles_scope,
 				"New color profile: p%u\n", cprof->base.id);
@@ -454,12 +735,15 @@ cmlcms_color_profile_destroy(struct cmlcms_color_profile *cprof)
 	struct weston_color_manager_lcms *cm = to_cmlcms(cprof->base.cm);
 
 	wl_list_remove(&cprof->link);
+	wl_list_remove(&cprof->hash_link);
+	cm->color_profile_stats.entries--;
 	cmsCloseProfile(cprof->extract.vcgt.p);
 	cmsCloseProfile(cprof->extract.inv_eotf.p);
 	cmsCloseProfile(cprof->extract.eotf.p);
 
 	switch (cprof->type) {
 	case CMLCMS_PROFILE_TYPE_ICC:
+		wl_list_remove(&cprof->icc.content_link);
 		cmsCloseProfile(cprof->icc.profile.p);
 		/**
 		 * TODO: drop this if when we convert the stock sRGB profile to
@@ -595,6 +879,7 @@ cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
 	struct cmlcms_md5_sum md5sum;
 	struct ro_anonymous_file *prof_rofile = NULL;
 	struct cmlcms_color_profile *cprof = NULL;
+	uint64_t content_hash;
 	char *desc = NULL;
 
 	if (!icc_data || icc_len < 1) {
@@ -606,6 +891,15 @@ cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
 		return false;
 	}
 
+	/* Clients tend to send the very same profile over and over again. */
+	content_hash = cmlcms_icc_content_hash(icc_data, icc_len);
+	cprof = cmlcms_find_color_profile_by_icc(cm, icc_data, icc_len,
+						 content_hash);
+	if (cprof) {
+		*cprof_out = weston_color_profile_ref(&cprof->base);
+		return true;
+	}
+
 	profile.p = cmsOpenProfileFromMemTHR(cm->lcms_ctx, icc_data, icc_len);
 	if (!profile.p) {
 		str_printf(errmsg, "ICC data not understood.");
@@ -642,6 +936,9 @@ cmlcms_get_color_profile_from_icc(struct weston_color_manager *cm_base,
 
 	cprof->type = CMLCMS_PROFILE_TYPE_ICC;
 	cprof->icc.prof_rofile = prof_rofile;
+	cprof->icc.content_hash = content_hash;
+	wl_list_insert(cmlcms_hash_bucket(cm->icc_content_hash, content_hash),
+		       &cprof->icc.content_link);
 
 	*cprof_out = &cprof->base;
 	return true;
@@ -697,6 +994,7 @@ cmlcms_get_color_profile_from_params(struct weston_color_manager *cm_base,
 	weston_color_profile_init(&cprof->base, &cm->base);
 	cprof->base.description = desc;
 	wl_list_insert(&cm->color_profile_list, &cprof->link);
+	cmlcms_color_profile_hash_insert(cm, cprof);
 
 	weston_log_scope_printf(cm->profiles_scope,
 				"New color profile: p%u. WARNING: this is a " \
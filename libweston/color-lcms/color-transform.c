@@ -27,6 +27,12 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <libweston/libweston.h>
 #include <lcms2_plugin.h>
 
@@ -34,6 +40,7 @@
 #include "color-curve-segments.h"
 #include "color-lcms.h"
 #include "color-properties.h"
+#include "libweston-internal.h"
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
 #include "shared/weston-assert.h"
@@ -50,6 +57,16 @@
 /** Precision for detecting identity matrix */
 #define MATRIX_PRECISION_BITS 12
 
+/**
+ * How far from its input a channel value may land for an input to output
+ * transformation to still count as identity: half a code value at 10 bits
+ * per channel, the deepest format we scan out.
+ */
+#define IDENTITY_PIPELINE_TOLERANCE (0.5f / 1023.0f)
+
+/** Grid points per channel when sampling for IDENTITY_PIPELINE_TOLERANCE */
+#define IDENTITY_PIPELINE_GRID_LEN 17
+
 /**
  * The method is used in linearization of an arbitrary color profile
  * when EOTF is retrieved we want to know a generic way to decide the number
@@ -156,6 +173,9 @@ cmlcms_color_transform_destroy(struct cmlcms_color_transform *xform)
 	struct weston_color_manager_lcms *cm = to_cmlcms(xform->base.cm);
 
 	wl_list_remove(&xform->link);
+	if (!wl_list_empty(&xform->hash_link))
+		cm->color_transform_stats.entries--;
+	wl_list_remove(&xform->hash_link);
 
 	cmsFreeToneCurveTriple(xform->pre_curve);
 
@@ -1214,6 +1234,79 @@ lcms_xform_error_logger(cmsContext context_id,
 		   text);
 }
 
+/*
+ * Check whether the whole path from the input profile to the monitor,
+ * VCGT included, is identity for all practical purposes. Profiles that are
+ * different objects may still describe the same color space, e.g. an sRGB
+ * ICC file from the client against our stock sRGB.
+ *
+ * The transformation is sampled on a grid in a context of its own, so that
+ * our plug-in stays out of it.
+ */
+static bool
+input_to_output_is_identity(struct cmlcms_color_transform *xform,
+			    const struct weston_render_intent_info *render_intent)
+{
+	struct cmlcms_color_profile *output_profile = xform->search_key.output_profile;
+	const unsigned len = IDENTITY_PIPELINE_GRID_LEN;
+	const unsigned count = len * len * len;
+	struct lcmsProfilePtr chain[3];
+	unsigned chain_len = 0;
+	cmsContext ctx;
+	cmsHTRANSFORM cmap;
+	cmsUInt32Number dwFlags;
+	float *in, *out;
+	bool identity = true;
+	unsigned i;
+
+	chain[chain_len++] = xform->search_key.input_profile->icc.profile;
+	chain[chain_len++] = output_profile->icc.profile;
+	if (output_profile->extract.vcgt.p)
+		chain[chain_len++] = output_profile->extract.vcgt;
+
+	ctx = cmsCreateContext(NULL, xform);
+	abort_oom_if_null(ctx);
+	cmsSetLogErrorHandlerTHR(ctx, lcms_xform_error_logger);
+
+	dwFlags = render_intent->bps ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0;
+	cmap = cmsCreateMultiprofileTransformTHR(ctx,
+						 from_lcmsProfilePtr_array(chain),
+						 chain_len,
+						 TYPE_RGB_FLT,
+						 TYPE_RGB_FLT,
+						 render_intent->lcms_intent,
+						 dwFlags);
+	if (!cmap) {
+		cmsDeleteContext(ctx);
+		return false;
+	}
+
+	in = xcalloc(3 * count, sizeof *in);
+	out = xcalloc(3 * count, sizeof *out);
+
+	for (i = 0; i < count; i++) {
+		in[3 * i + 0] = (float)(i % len) / (len - 1);
+		in[3 * i + 1] = (float)(i / len % len) / (len - 1);
+		in[3 * i + 2] = (float)(i / len / len) / (len - 1);
+	}
+
+	cmsDoTransform(cmap, in, out, count);
+
+	for (i = 0; i < 3 * count; i++) {
+		if (fabsf(out[i] - in[i]) > IDENTITY_PIPELINE_TOLERANCE) {
+			identity = false;
+			break;
+		}
+	}
+
+	free(in);
+	free(out);
+	cmsDeleteTransform(cmap);
+	cmsDeleteContext(ctx);
+
+	return identity;
+}
+
 static bool
 xform_realize_chain(struct cmlcms_color_transform *xform)
 {
@@ -1314,6 +1407,12 @@ xform_realize_chain(struct cmlcms_color_transform *xform)
 		break;
 	}
 
+	if (xform->search_key.category == CMLCMS_CATEGORY_INPUT_TO_BLEND) {
+		xform->identity_pipeline =
+			xform->search_key.input_profile == output_profile ||
+			input_to_output_is_identity(xform, render_intent);
+	}
+
 	return true;
 
 failed:
@@ -1360,9 +1459,29 @@ cmlcms_color_transform_search_param_string(const struct cmlcms_color_transform_s
 	return str;
 }
 
+static uint32_t
+search_param_hash(const struct cmlcms_color_transform_search_param *param)
+{
+	uint32_t hash = CMLCMS_HASH_INIT;
+
+	/* Hash member by member, the struct may have padding. */
+	hash = cmlcms_hash_bytes(hash, &param->category,
+				 sizeof(param->category));
+	hash = cmlcms_hash_bytes(hash, &param->input_profile,
+				 sizeof(param->input_profile));
+	hash = cmlcms_hash_bytes(hash, &param->output_profile,
+				 sizeof(param->output_profile));
+	hash = cmlcms_hash_bytes(hash, &param->render_intent,
+				 sizeof(param->render_intent));
+
+	return hash;
+}
+
+/* Allocate a transformation and prepare everything that must happen on
+ * the compositor thread before xform_realize_chain() can run. */
 static struct cmlcms_color_transform *
-cmlcms_color_transform_create(struct weston_color_manager_lcms *cm,
-			      const struct cmlcms_color_transform_search_param *search_param)
+cmlcms_color_transform_new(struct weston_color_manager_lcms *cm,
+			   const struct cmlcms_color_transform_search_param *search_param)
 {
 	struct cmlcms_color_transform *xform;
 	const char *err_msg = NULL;
@@ -1371,6 +1490,8 @@ cmlcms_color_transform_create(struct weston_color_manager_lcms *cm,
 	xform = xzalloc(sizeof *xform);
 	weston_color_transform_init(&xform->base, &cm->base);
 	wl_list_init(&xform->link);
+	wl_list_init(&xform->hash_link);
+	wl_list_init(&xform->async_link);
 	xform->search_key = *search_param;
 	xform->search_key.input_profile = ref_cprof(search_param->input_profile);
 	xform->search_key.output_profile = ref_cprof(search_param->output_profile);
@@ -1382,28 +1503,68 @@ cmlcms_color_transform_create(struct weston_color_manager_lcms *cm,
 	free(str);
 
 	if (!ensure_output_profile_extract(search_param->output_profile, cm->lcms_ctx,
-					   cmlcms_reasonable_1D_points(), &err_msg))
-		goto error;
-
-	if (!xform_realize_chain(xform)) {
-		err_msg = "xform_realize_chain failed";
-		goto error;
+					   cmlcms_reasonable_1D_points(), &err_msg)) {
+		weston_log_scope_printf(cm->transforms_scope,
+					"	%s\n", err_msg);
+		cmlcms_color_transform_destroy(xform);
+		return NULL;
 	}
 
+	return xform;
+}
+
+static void
+cmlcms_color_transform_add_to_hash(struct weston_color_manager_lcms *cm,
+				   struct cmlcms_color_transform *xform)
+{
+	wl_list_insert(cmlcms_hash_bucket(cm->color_transform_hash,
+					  search_param_hash(&xform->search_key)),
+		       &xform->hash_link);
+	cm->color_transform_stats.entries++;
+}
+
+static void
+cmlcms_color_transform_publish(struct weston_color_manager_lcms *cm,
+			       struct cmlcms_color_transform *xform)
+{
+	char *str;
+
 	wl_list_insert(&cm->color_transform_list, &xform->link);
 	assert(xform->status != CMLCMS_TRANSFORM_FAILED);
 
 	str = weston_color_transform_string(&xform->base);
 	weston_log_scope_printf(cm->transforms_scope, "  %s", str);
 	free(str);
+}
 
-	return xform;
+static struct cmlcms_color_transform *
+cmlcms_color_transform_create(struct weston_color_manager_lcms *cm,
+			      const struct cmlcms_color_transform_search_param *search_param)
+{
+	struct cmlcms_color_transform *xform;
+	bool ok;
 
-error:
-	weston_log_scope_printf(cm->transforms_scope,
-				"	%s\n", err_msg);
-	cmlcms_color_transform_destroy(xform);
-	return NULL;
+	xform = cmlcms_color_transform_new(cm, search_param);
+	if (!xform)
+		return NULL;
+
+	if (cm->async.running)
+		pthread_mutex_lock(&cm->async.realize_mutex);
+	ok = xform_realize_chain(xform);
+	if (cm->async.running)
+		pthread_mutex_unlock(&cm->async.realize_mutex);
+
+	if (!ok) {
+		weston_log_scope_printf(cm->transforms_scope,
+					"	xform_realize_chain failed\n");
+		cmlcms_color_transform_destroy(xform);
+		return NULL;
+	}
+
+	cmlcms_color_transform_add_to_hash(cm, xform);
+	cmlcms_color_transform_publish(cm, xform);
+
+	return xform;
 }
 
 static bool
@@ -1421,17 +1582,69 @@ transform_matches_params(const struct cmlcms_color_transform *xform,
 	return true;
 }
 
+static void
+cmlcms_async_collect(struct weston_color_manager_lcms *cm);
+
+static void
+cmlcms_async_wait(struct weston_color_manager_lcms *cm,
+		  struct cmlcms_color_transform *xform)
+{
+	pthread_mutex_lock(&cm->async.mutex);
+	while (!xform->async_done)
+		pthread_cond_wait(&cm->async.cond, &cm->async.mutex);
+	pthread_mutex_unlock(&cm->async.mutex);
+
+	cmlcms_async_collect(cm);
+}
+
+static struct cmlcms_color_transform *
+cmlcms_color_transform_find(struct weston_color_manager_lcms *cm,
+			    const struct cmlcms_color_transform_search_param *param)
+{
+	struct cmlcms_color_transform *xform;
+	struct wl_list *bucket;
+
+	bucket = cmlcms_hash_bucket(cm->color_transform_hash,
+				    search_param_hash(param));
+	wl_list_for_each(xform, bucket, hash_link) {
+		if (transform_matches_params(xform, param))
+			return xform;
+	}
+
+	return NULL;
+}
+
+/* Take a reference for the caller, adopting the creation reference of an
+ * asynchronously created transformation if nobody has done that yet. */
+static struct cmlcms_color_transform *
+cmlcms_color_transform_claim(struct cmlcms_color_transform *xform)
+{
+	if (xform->async_unclaimed)
+		xform->async_unclaimed = false;
+	else
+		weston_color_transform_ref(&xform->base);
+
+	return xform;
+}
+
 struct cmlcms_color_transform *
 cmlcms_color_transform_get(struct weston_color_manager_lcms *cm,
 			   const struct cmlcms_color_transform_search_param *param)
 {
 	struct cmlcms_color_transform *xform;
 
-	wl_list_for_each(xform, &cm->color_transform_list, link) {
-		if (transform_matches_params(xform, param)) {
-			weston_color_transform_ref(&xform->base);
-			return xform;
-		}
+	cm->color_transform_stats.lookups++;
+
+	xform = cmlcms_color_transform_find(cm, param);
+	if (xform && xform->async_pending) {
+		/* Needed right now: wait for the worker, which may also drop
+		 * the transformation if it failed. */
+		cmlcms_async_wait(cm, xform);
+		xform = cmlcms_color_transform_find(cm, param);
+	}
+	if (xform) {
+		cm->color_transform_stats.hits++;
+		return cmlcms_color_transform_claim(xform);
 	}
 
 	xform = cmlcms_color_transform_create(cm, param);
@@ -1440,3 +1653,265 @@ cmlcms_color_transform_get(struct weston_color_manager_lcms *cm,
 
 	return xform;
 }
+
+/** Get a color transformation without blocking on its creation
+ *
+ * Like cmlcms_color_transform_get(), but a transformation that does not
+ * exist yet is realized on the worker thread. Then NULL is returned and
+ * \c pending is set; once the transformation is ready, provisional paint
+ * node transformations are invalidated and the outputs repainted, and
+ * the next call returns it.
+ *
+ * Falls back to cmlcms_color_transform_get() when there is no worker
+ * thread, or while the transformation or optimizer scopes are subscribed,
+ * as those print from the middle of the creation.
+ */
+struct cmlcms_color_transform *
+cmlcms_color_transform_get_async(struct weston_color_manager_lcms *cm,
+				 const struct cmlcms_color_transform_search_param *param,
+				 bool *pending)
+{
+	struct cmlcms_color_transform *xform;
+
+	*pending = false;
+
+	if (!cm->async.running ||
+	    weston_log_scope_is_enabled(cm->transforms_scope) ||
+	    weston_log_scope_is_enabled(cm->optimizer_scope))
+		return cmlcms_color_transform_get(cm, param);
+
+	cm->color_transform_stats.lookups++;
+
+	xform = cmlcms_color_transform_find(cm, param);
+	if (xform) {
+		if (xform->async_pending) {
+			*pending = true;
+			return NULL;
+		}
+		cm->color_transform_stats.hits++;
+		return cmlcms_color_transform_claim(xform);
+	}
+
+	xform = cmlcms_color_transform_new(cm, param);
+	if (!xform) {
+		weston_log("color-lcms error: failed to create a color transformation.\n");
+		return NULL;
+	}
+
+	/* In the hash already, so the same request is not queued twice. */
+	xform->async_pending = true;
+	cmlcms_color_transform_add_to_hash(cm, xform);
+
+	pthread_mutex_lock(&cm->async.mutex);
+	wl_list_insert(&cm->async.queue, &xform->async_link);
+	pthread_cond_broadcast(&cm->async.cond);
+	pthread_mutex_unlock(&cm->async.mutex);
+
+	*pending = true;
+	return NULL;
+}
+
+/* Hand finished transformations over to the compositor thread. */
+static void
+cmlcms_async_collect(struct weston_color_manager_lcms *cm)
+{
+	struct weston_compositor *compositor = cm->base.compositor;
+	struct cmlcms_color_transform *xform, *tmp;
+	struct weston_output *output;
+	struct weston_paint_node *pnode;
+	struct wl_list done;
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&cm->async.mutex);
+	wl_list_insert_list(&done, &cm->async.done);
+	wl_list_init(&cm->async.done);
+	pthread_mutex_unlock(&cm->async.mutex);
+
+	if (wl_list_empty(&done))
+		return;
+
+	wl_list_for_each_safe(xform, tmp, &done, async_link) {
+		wl_list_remove(&xform->async_link);
+		wl_list_init(&xform->async_link);
+		xform->async_pending = false;
+
+		if (!xform->async_ok) {
+			weston_log("color-lcms error: failed to create a color transformation.\n");
+			cmlcms_color_transform_destroy(xform);
+			continue;
+		}
+
+		/* Keep it alive until a surface comes to pick it up. */
+		xform->async_unclaimed = true;
+		cmlcms_color_transform_publish(cm, xform);
+	}
+
+	/* Paint nodes that got a stand-in ask again on the next repaint,
+	 * getting the real thing or, if it failed, an error. */
+	wl_list_for_each(output, &compositor->output_list, link) {
+		bool invalidated = false;
+
+		wl_list_for_each(pnode, &output->paint_node_list, output_link) {
+			if (!pnode->surf_xform_valid ||
+			    !pnode->surf_xform.provisional)
+				continue;
+
+			weston_surface_color_transform_fini(&pnode->surf_xform);
+			pnode->surf_xform_valid = false;
+			invalidated = true;
+		}
+
+		if (invalidated)
+			weston_output_damage(output);
+	}
+}
+
+static void *
+cmlcms_async_thread_func(void *data)
+{
+	struct weston_color_manager_lcms *cm = data;
+	struct cmlcms_color_transform *xform;
+	uint64_t one = 1;
+	bool ok;
+
+	pthread_mutex_lock(&cm->async.mutex);
+	while (true) {
+		while (!cm->async.stop && wl_list_empty(&cm->async.queue))
+			pthread_cond_wait(&cm->async.cond, &cm->async.mutex);
+
+		if (cm->async.stop)
+			break;
+
+		/* Oldest first */
+		xform = container_of(cm->async.queue.prev,
+				     struct cmlcms_color_transform, async_link);
+		wl_list_remove(&xform->async_link);
+		pthread_mutex_unlock(&cm->async.mutex);
+
+		/* Only touches this transformation, its own LittleCMS
+		 * context and the profiles it holds references to. */
+		pthread_mutex_lock(&cm->async.realize_mutex);
+		ok = xform_realize_chain(xform);
+		pthread_mutex_unlock(&cm->async.realize_mutex);
+
+		pthread_mutex_lock(&cm->async.mutex);
+		xform->async_ok = ok;
+		xform->async_done = true;
+		wl_list_insert(&cm->async.done, &xform->async_link);
+		pthread_cond_broadcast(&cm->async.cond);
+
+		if (write(cm->async.wakeup_fd, &one, sizeof one) < 0 &&
+		    errno != EAGAIN)
+			break;
+	}
+	pthread_mutex_unlock(&cm->async.mutex);
+
+	return NULL;
+}
+
+static int
+cmlcms_async_wakeup(int fd, uint32_t mask, void *data)
+{
+	struct weston_color_manager_lcms *cm = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("color-lcms: failed to read worker wakeup: %s\n",
+			   strerror(errno));
+
+	cmlcms_async_collect(cm);
+
+	return 0;
+}
+
+/** Start the worker thread for surface color transformations
+ *
+ * Creating a transformation from an ICC profile can take tens of
+ * milliseconds in LittleCMS, which would drop a frame whenever a client
+ * with a new profile maps. With the worker, the surface is shown with a
+ * stand-in transformation for a few frames instead.
+ */
+bool
+cmlcms_async_init(struct weston_color_manager_lcms *cm)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(cm->base.compositor->wl_display);
+
+	wl_list_init(&cm->async.queue);
+	wl_list_init(&cm->async.done);
+
+	cm->async.wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (cm->async.wakeup_fd < 0)
+		return false;
+
+	cm->async.wakeup_source =
+		wl_event_loop_add_fd(loop, cm->async.wakeup_fd,
+				     WL_EVENT_READABLE,
+				     cmlcms_async_wakeup, cm);
+	if (!cm->async.wakeup_source)
+		goto err_fd;
+
+	pthread_mutex_init(&cm->async.mutex, NULL);
+	pthread_mutex_init(&cm->async.realize_mutex, NULL);
+	pthread_cond_init(&cm->async.cond, NULL);
+
+	if (pthread_create(&cm->async.thread, NULL,
+			   cmlcms_async_thread_func, cm) != 0)
+		goto err_source;
+
+	cm->async.running = true;
+
+	return true;
+
+err_source:
+	pthread_cond_destroy(&cm->async.cond);
+	pthread_mutex_destroy(&cm->async.realize_mutex);
+	pthread_mutex_destroy(&cm->async.mutex);
+	wl_event_source_remove(cm->async.wakeup_source);
+	cm->async.wakeup_source = NULL;
+err_fd:
+	close(cm->async.wakeup_fd);
+	cm->async.wakeup_fd = -1;
+	weston_log("color-lcms: failed to start the transformation worker\n");
+
+	return false;
+}
+
+void
+cmlcms_async_fini(struct weston_color_manager_lcms *cm)
+{
+	struct cmlcms_color_transform *xform, *tmp;
+
+	if (!cm->async.running)
+		return;
+
+	pthread_mutex_lock(&cm->async.mutex);
+	cm->async.stop = true;
+	pthread_cond_broadcast(&cm->async.cond);
+	pthread_mutex_unlock(&cm->async.mutex);
+	pthread_join(cm->async.thread, NULL);
+	cm->async.running = false;
+
+	/* Never started */
+	wl_list_for_each_safe(xform, tmp, &cm->async.queue, async_link) {
+		wl_list_remove(&xform->async_link);
+		wl_list_init(&xform->async_link);
+		cmlcms_color_transform_destroy(xform);
+	}
+
+	cmlcms_async_collect(cm);
+
+	/* Finished, but never picked up */
+	wl_list_for_each_safe(xform, tmp, &cm->color_transform_list, link) {
+		if (xform->async_unclaimed) {
+			xform->async_unclaimed = false;
+			weston_color_transform_unref(&xform->base);
+		}
+	}
+
+	wl_event_source_remove(cm->async.wakeup_source);
+	close(cm->async.wakeup_fd);
+	pthread_cond_destroy(&cm->async.cond);
+	pthread_mutex_destroy(&cm->async.realize_mutex);
+	pthread_mutex_destroy(&cm->async.mutex);
+}
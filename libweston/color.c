@@ -34,6 +34,8 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "color.h"
@@ -260,6 +262,296 @@ weston_color_transform_string(const struct weston_color_transform *xform)
 	return str;
 }
 
+/* A color curve sampled for evaluation on the CPU */
+struct baked_curve {
+	const struct weston_color_curve *curve;
+	float *lut; /* 3 x lut_len for LUT_3x1D */
+	unsigned lut_len;
+};
+
+static bool
+baked_curve_init(struct baked_curve *bc, const struct weston_color_curve *curve,
+		 struct weston_color_transform *xform)
+{
+	bc->curve = curve;
+	bc->lut = NULL;
+	bc->lut_len = 0;
+
+	if (curve->type != WESTON_COLOR_CURVE_TYPE_LUT_3x1D)
+		return true;
+
+	bc->lut_len = curve->u.lut_3x1d.optimal_len;
+	bc->lut = calloc(3 * bc->lut_len, sizeof *bc->lut);
+	if (!bc->lut)
+		return false;
+
+	curve->u.lut_3x1d.fill_in(xform, bc->lut, bc->lut_len);
+
+	return true;
+}
+
+static float
+sample_1d(const float *lut, unsigned len, float x)
+{
+	float pos, t;
+	unsigned i;
+
+	pos = fminf(fmaxf(x, 0.0f), 1.0f) * (len - 1);
+	i = MIN((unsigned)pos, len - 2);
+	t = pos - i;
+
+	return lut[i] * (1.0f - t) + lut[i + 1] * t;
+}
+
+/* Same formulas as GL-renderer fragment.glsl sample_linpow() and
+ * sample_powlin(). */
+static float
+baked_curve_eval(const struct baked_curve *bc, float x, int ch)
+{
+	const struct weston_color_curve_parametric *p = &bc->curve->u.parametric;
+	float g, a, b, c, d, sign = 1.0f;
+
+	switch (bc->curve->type) {
+	case WESTON_COLOR_CURVE_TYPE_IDENTITY:
+		return x;
+	case WESTON_COLOR_CURVE_TYPE_LUT_3x1D:
+		return sample_1d(&bc->lut[ch * bc->lut_len], bc->lut_len, x);
+	case WESTON_COLOR_CURVE_TYPE_LINPOW:
+	case WESTON_COLOR_CURVE_TYPE_POWLIN:
+		break;
+	}
+
+	g = p->params[ch][0];
+	a = p->params[ch][1];
+	b = p->params[ch][2];
+	c = p->params[ch][3];
+	d = p->params[ch][4];
+
+	if (p->clamped_input)
+		x = fminf(fmaxf(x, 0.0f), 1.0f);
+	if (x < 0.0f) {
+		x = -x;
+		sign = -1.0f;
+	}
+
+	if (x < d)
+		return sign * c * x;
+
+	if (bc->curve->type == WESTON_COLOR_CURVE_TYPE_LINPOW)
+		return sign * powf(a * x + b, g);
+
+	return sign * (a * powf(x, g) + b);
+}
+
+static void
+sample_3d(const float *lut, unsigned len, const float in[3], float out[3])
+{
+	unsigned i0[3], i1[3];
+	float t[3];
+	int ch, k;
+
+	for (k = 0; k < 3; k++) {
+		float pos = fminf(fmaxf(in[k], 0.0f), 1.0f) * (len - 1);
+
+		i0[k] = MIN((unsigned)pos, len - 2);
+		i1[k] = i0[k] + 1;
+		t[k] = pos - i0[k];
+	}
+
+#define LUT3D(r, g, b, c) lut[3 * (len * len * (b) + len * (g) + (r)) + (c)]
+	for (ch = 0; ch < 3; ch++) {
+		float c00 = LUT3D(i0[0], i0[1], i0[2], ch) * (1.0f - t[0]) +
+			    LUT3D(i1[0], i0[1], i0[2], ch) * t[0];
+		float c10 = LUT3D(i0[0], i1[1], i0[2], ch) * (1.0f - t[0]) +
+			    LUT3D(i1[0], i1[1], i0[2], ch) * t[0];
+		float c01 = LUT3D(i0[0], i0[1], i1[2], ch) * (1.0f - t[0]) +
+			    LUT3D(i1[0], i0[1], i1[2], ch) * t[0];
+		float c11 = LUT3D(i0[0], i1[1], i1[2], ch) * (1.0f - t[0]) +
+			    LUT3D(i1[0], i1[1], i1[2], ch) * t[0];
+		float c0 = c00 * (1.0f - t[1]) + c10 * t[1];
+		float c1 = c01 * (1.0f - t[1]) + c11 * t[1];
+
+		out[ch] = c0 * (1.0f - t[2]) + c1 * t[2];
+	}
+#undef LUT3D
+}
+
+static void
+sampled_mapping_eval(const struct weston_color_mapping *mapping,
+		     const float *map_lut, unsigned map_len,
+		     const float in[3], float out[3])
+{
+	int ch, k;
+
+	switch (mapping->type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		for (ch = 0; ch < 3; ch++)
+			out[ch] = in[ch];
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		sample_3d(map_lut, map_len, in, out);
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		/* column major */
+		for (ch = 0; ch < 3; ch++) {
+			out[ch] = 0.0f;
+			for (k = 0; k < 3; k++)
+				out[ch] += mapping->u.mat.matrix[k * 3 + ch] * in[k];
+		}
+		break;
+	}
+}
+
+/**
+ * Evaluate a whole color transformation into a 3D LUT on the CPU
+ *
+ * \param xform The color transformation.
+ * \param lut Array of 3 * len * len * len elements, laid out like
+ * weston_color_mapping_3dlut::fill_in() results.
+ * \param len The number of elements in each dimension, at least 2.
+ * \return False on allocation failure.
+ *
+ * Input outside of [0, 1] cannot be represented, so this is exact only for
+ * transformations that clamp their input.
+ */
+WL_EXPORT bool
+weston_color_transform_to_3dlut(struct weston_color_transform *xform,
+				float *lut, unsigned len)
+{
+	const struct weston_color_mapping *mapping = &xform->mapping;
+	struct baked_curve pre, post;
+	float *map_lut = NULL;
+	unsigned map_len = 0;
+	unsigned ri, gi, bi;
+	bool ok = false;
+	int ch;
+
+	assert(len >= 2);
+
+	if (!baked_curve_init(&pre, &xform->pre_curve, xform))
+		return false;
+	if (!baked_curve_init(&post, &xform->post_curve, xform))
+		goto out_pre;
+
+	if (mapping->type == WESTON_COLOR_MAPPING_TYPE_3D_LUT) {
+		map_len = mapping->u.lut3d.optimal_len;
+		map_lut = calloc(3 * map_len * map_len * map_len,
+				 sizeof *map_lut);
+		if (!map_lut)
+			goto out_post;
+		mapping->u.lut3d.fill_in(xform, map_lut, map_len);
+	}
+
+	for (bi = 0; bi < len; bi++) {
+		for (gi = 0; gi < len; gi++) {
+			for (ri = 0; ri < len; ri++) {
+				float *dst = &lut[3 * (len * len * bi + len * gi + ri)];
+				float in[3] = {
+					(float)ri / (len - 1),
+					(float)gi / (len - 1),
+					(float)bi / (len - 1),
+				};
+				float mapped[3];
+
+				for (ch = 0; ch < 3; ch++)
+					in[ch] = baked_curve_eval(&pre, in[ch], ch);
+
+				sampled_mapping_eval(mapping, map_lut, map_len,
+						     in, mapped);
+
+				for (ch = 0; ch < 3; ch++)
+					dst[ch] = baked_curve_eval(&post, mapped[ch], ch);
+			}
+		}
+	}
+	ok = true;
+
+	free(map_lut);
+out_post:
+	free(post.lut);
+out_pre:
+	free(pre.lut);
+
+	return ok;
+}
+
+/**
+ * Evaluate a separable color transformation into three 1D LUTs
+ *
+ * \param xform The color transformation, whose mapping must be identity.
+ * \param lut Array of 3 x len elements, laid out like
+ * weston_color_curve_lut_3x1d::fill_in() results.
+ * \param len The number of elements in each 1D LUT, at least 2.
+ * \return False on allocation failure.
+ */
+WL_EXPORT bool
+weston_color_transform_to_3x1d(struct weston_color_transform *xform,
+			       float *lut, unsigned len)
+{
+	struct baked_curve pre, post;
+	unsigned i;
+	int ch;
+
+	assert(len >= 2);
+	assert(xform->mapping.type == WESTON_COLOR_MAPPING_TYPE_IDENTITY);
+
+	if (!baked_curve_init(&pre, &xform->pre_curve, xform))
+		return false;
+	if (!baked_curve_init(&post, &xform->post_curve, xform)) {
+		free(pre.lut);
+		return false;
+	}
+
+	for (ch = 0; ch < 3; ch++) {
+		for (i = 0; i < len; i++) {
+			float x = (float)i / (len - 1);
+
+			x = baked_curve_eval(&pre, x, ch);
+			lut[ch * len + i] = baked_curve_eval(&post, x, ch);
+		}
+	}
+
+	free(post.lut);
+	free(pre.lut);
+
+	return true;
+}
+
+/**
+ * Evaluate one curve of a color transformation into three 1D LUTs
+ *
+ * \param xform The color transformation the curve belongs to.
+ * \param curve Either the pre_curve or the post_curve of \c xform.
+ * \param lut Array of 3 x len elements, laid out like
+ * weston_color_curve_lut_3x1d::fill_in() results.
+ * \param len The number of elements in each 1D LUT, at least 2.
+ * \return False on allocation failure.
+ */
+WL_EXPORT bool
+weston_color_curve_to_3x1d(struct weston_color_transform *xform,
+			   const struct weston_color_curve *curve,
+			   float *lut, unsigned len)
+{
+	struct baked_curve bc;
+	unsigned i;
+	int ch;
+
+	assert(len >= 2);
+
+	if (!baked_curve_init(&bc, curve, xform))
+		return false;
+
+	for (ch = 0; ch < 3; ch++) {
+		for (i = 0; i < len; i++)
+			lut[ch * len + i] =
+				baked_curve_eval(&bc, (float)i / (len - 1), ch);
+	}
+
+	free(bc.lut);
+
+	return true;
+}
+
 /** Deep copy */
 void
 weston_surface_color_transform_copy(struct weston_surface_color_transform *dst,
@@ -276,6 +568,7 @@ weston_surface_color_transform_fini(struct weston_surface_color_transform *surf_
 	weston_color_transform_unref(surf_xform->transform);
 	surf_xform->transform = NULL;
 	surf_xform->identity_pipeline = false;
+	surf_xform->provisional = false;
 }
 
 /**
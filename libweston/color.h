@@ -402,8 +402,13 @@ struct weston_surface_color_transform {
 	/** Transformation from source to blending space */
 	struct weston_color_transform *transform;
 
-	/** True, if source colorspace is identical to monitor color space */
+	/** True, if source colorspace is identical to monitor color space,
+	 *  or numerically close enough that nobody could tell */
 	bool identity_pipeline;
+
+	/** True, if this is a stand-in while the color manager creates the
+	 *  real transformation; it invalidates the paint nodes when done */
+	bool provisional;
 };
 
 struct cm_image_desc_info;
@@ -588,6 +593,19 @@ weston_color_transform_init(struct weston_color_transform *xform,
 char *
 weston_color_transform_string(const struct weston_color_transform *xform);
 
+bool
+weston_color_transform_to_3dlut(struct weston_color_transform *xform,
+				float *lut, unsigned len);
+
+bool
+weston_color_transform_to_3x1d(struct weston_color_transform *xform,
+			       float *lut, unsigned len);
+
+bool
+weston_color_curve_to_3x1d(struct weston_color_transform *xform,
+			   const struct weston_color_curve *curve,
+			   float *lut, unsigned len);
+
 void
 weston_surface_color_transform_copy(struct weston_surface_color_transform *dst,
 				    const struct weston_surface_color_transform *src);
@@ -65,6 +65,7 @@
 #include "xdg-output-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
+#include "linux-drm-syncobj.h"
 #include "single-pixel-buffer-v1-server-protocol.h"
 #include "shared/fd-util.h"
 #include "shared/helpers.h"
@@ -74,6 +75,11 @@
 #include "shared/xalloc.h"
 #include "shared/weston-assert.h"
 #include "tearing-control-v1-server-protocol.h"
+#include "content-type-v1-server-protocol.h"
+#include "fractional-scale-v1-server-protocol.h"
+#include "fifo-v1-server-protocol.h"
+#include "commit-timing-v1-server-protocol.h"
+#include "weston-frame-timing-server-protocol.h"
 #include "git-version.h"
 #include <libweston/version.h>
 #include <libweston/plugin-registry.h>
@@ -84,6 +90,11 @@
 #include "color-management.h"
 #include "id-number-allocator.h"
 #include "output-capture.h"
+#include "pick-index.h"
+#include "frame-stats.h"
+#include "metrics.h"
+#include "object-pool.h"
+#include "client-accounting.h"
 #include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
 
@@ -96,6 +107,7 @@
  */
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
+#define DEFAULT_REPAINT_MARGIN 1000 /* microseconds */
 
 static void
 weston_output_transform_scale_init(struct weston_output *output,
@@ -104,6 +116,9 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+weston_view_dirty_view_list(struct weston_view *view);
+
 static char *
 weston_output_create_heads_string(struct weston_output *output);
 
@@ -246,6 +261,167 @@ maybe_replace_paint_node(struct weston_paint_node *pnode)
 	}
 }
 
+/* Whether \c to is \c from followed by a translation by whole pixels */
+static bool
+weston_matrix_is_moved(const struct weston_matrix *from,
+		       const struct weston_matrix *to,
+		       int32_t *dx, int32_t *dy)
+{
+	float tx = to->d[12] - from->d[12];
+	float ty = to->d[13] - from->d[13];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (i != 12 && i != 13 && from->d[i] != to->d[i])
+			return false;
+	}
+
+	if (tx != roundf(tx) || ty != roundf(ty) || (tx == 0 && ty == 0))
+		return false;
+
+	*dx = tx;
+	*dy = ty;
+
+	return true;
+}
+
+static void
+output_clear_moves(struct weston_output *output)
+{
+	struct weston_output_move *move;
+
+	wl_array_for_each(move, &output->moves)
+		pixman_region32_fini(&move->region);
+	output->moves.size = 0;
+}
+
+/* Whether a overlaps b translated by (dx, dy) */
+static bool
+boxes_overlap(const pixman_box32_t *a, const pixman_box32_t *b,
+	      int32_t dx, int32_t dy)
+{
+	return a->x1 < b->x2 + dx && b->x1 + dx < a->x2 &&
+	       a->y1 < b->y2 + dy && b->y1 + dy < a->y2;
+}
+
+/* Two moves conflict when one writes where the other reads or writes */
+static bool
+moves_conflict(const pixman_box32_t *a, int32_t adx, int32_t ady,
+	       const pixman_box32_t *b, int32_t bdx, int32_t bdy)
+{
+	return boxes_overlap(a, b, 0, 0) ||
+	       boxes_overlap(a, b, -bdx, -bdy) ||
+	       boxes_overlap(b, a, -adx, -ady);
+}
+
+/* Where a view that only moved is visible now and was visible before,
+ * the output shows the pixels of the previous frame, moved. Remote
+ * backends can have their clients copy those instead of encoding them.
+ *
+ * Moves by the same offset, like a window and its subsurfaces, are
+ * merged. A move that conflicts with another one is dropped, as its
+ * pixels are in the output damage anyway.
+ */
+static void
+output_add_move(struct weston_output *output, struct weston_paint_node *pnode,
+		pixman_region32_t *old_visible)
+{
+	struct weston_output_move *move, *same = NULL;
+	pixman_region32_t region, visible;
+	pixman_box32_t *box;
+
+	pixman_region32_init(&region);
+	pixman_region32_init(&visible);
+	weston_region_global_to_output(&region, output, old_visible);
+	pixman_region32_translate(&region, pnode->move_dx, pnode->move_dy);
+	weston_region_global_to_output(&visible, output, &pnode->visible);
+	pixman_region32_intersect(&region, &region, &visible);
+	pixman_region32_fini(&visible);
+
+	if (!pixman_region32_not_empty(&region))
+		goto out;
+
+	wl_array_for_each(move, &output->moves) {
+		if (move->dx == pnode->move_dx && move->dy == pnode->move_dy) {
+			same = move;
+			pixman_region32_union(&region, &region, &move->region);
+			break;
+		}
+	}
+
+	box = pixman_region32_extents(&region);
+	wl_array_for_each(move, &output->moves) {
+		if (move != same &&
+		    moves_conflict(box, pnode->move_dx, pnode->move_dy,
+				   pixman_region32_extents(&move->region),
+				   move->dx, move->dy))
+			goto out;
+	}
+
+	if (!same) {
+		same = wl_array_add(&output->moves, sizeof *same);
+		if (!same)
+			goto out;
+		pixman_region32_init(&same->region);
+		same->dx = pnode->move_dx;
+		same->dy = pnode->move_dy;
+	}
+	pixman_region32_copy(&same->region, &region);
+
+out:
+	pixman_region32_fini(&region);
+}
+
+/** Get the parts of the output that the current repaint only moved
+ *
+ * \param output The output being repainted.
+ * \param count Set to the number of moves returned.
+ * \return An array of moves, valid until the next repaint.
+ *
+ * Moves are only tracked on outputs with \c track_moves set, for views
+ * on the primary plane.
+ */
+WL_EXPORT const struct weston_output_move *
+weston_output_get_moves(struct weston_output *output, unsigned int *count)
+{
+	*count = output->moves.size / sizeof(struct weston_output_move);
+
+	return output->moves.data;
+}
+
+/** Get the paint nodes of an output in z-order, from top to bottom
+ *
+ * \param output The output.
+ * \param count Set to the number of paint nodes returned.
+ * \return The nodes of weston_output::paint_node_z_order_list, valid
+ * until the z-order list next changes.
+ *
+ * The array is only rebuilt when the z-order list changed, so walking it
+ * in the many passes of a repaint costs no list pointer chasing.
+ */
+WL_EXPORT struct weston_paint_node **
+weston_output_get_paint_nodes(struct weston_output *output,
+			      unsigned int *count)
+{
+	struct weston_paint_node *pnode, **slot;
+
+	if (output->paint_node_z_order_dirty) {
+		output->paint_node_z_order.size = 0;
+		wl_list_for_each(pnode, &output->paint_node_z_order_list,
+				 z_order_link) {
+			slot = wl_array_add(&output->paint_node_z_order,
+					    sizeof *slot);
+			abort_oom_if_null(slot);
+			*slot = pnode;
+		}
+		output->paint_node_z_order_dirty = false;
+	}
+
+	*count = output->paint_node_z_order.size / sizeof(pnode);
+
+	return output->paint_node_z_order.data;
+}
+
 /* Paint nodes contain filter and transform information that needs to be
  * up to date before assign_planes() is called. But there are also
  * damage related bits that must be updated after assign_planes()
@@ -259,7 +435,12 @@ paint_node_update_early(struct weston_paint_node *pnode)
 	bool view_dirty = pnode->status & PAINT_NODE_VIEW_DIRTY;
 	bool output_dirty = pnode->status & PAINT_NODE_OUTPUT_DIRTY;
 
+	pnode->moved = false;
+
 	if (view_dirty || output_dirty) {
+		struct weston_matrix old_mat = *mat;
+		bool was_opaque = pnode->is_fully_opaque;
+
 		weston_view_buffer_to_output_matrix(pnode->view,
 						    pnode->output, mat);
 		weston_matrix_invert(&pnode->output_to_buffer_matrix, mat);
@@ -271,6 +452,14 @@ paint_node_update_early(struct weston_paint_node *pnode)
 							       &pnode->view->transform.boundingbox);
 		pnode->is_fully_blended = weston_view_is_fully_blended(pnode->view,
 								       &pnode->view->transform.boundingbox);
+		pnode->occlusion_dirty = true;
+
+		pnode->moved = pnode->output->track_moves && !output_dirty &&
+			       was_opaque && pnode->is_fully_opaque &&
+			       pnode->valid_transform && !pnode->needs_filtering &&
+			       weston_matrix_is_moved(&old_mat, mat,
+						      &pnode->move_dx,
+						      &pnode->move_dy);
 	}
 
 	pnode->status &= ~(PAINT_NODE_VIEW_DIRTY | PAINT_NODE_OUTPUT_DIRTY);
@@ -287,6 +476,19 @@ paint_node_update_late(struct weston_paint_node *pnode)
 	bool plane_dirty = pnode->status & PAINT_NODE_PLANE_DIRTY;
 	bool content_dirty = pnode->status & PAINT_NODE_CONTENT_DIRTY;
 	bool buffer_dirty = pnode->status & PAINT_NODE_BUFFER_DIRTY;
+	bool moved = pnode->moved && !content_dirty && !buffer_dirty &&
+		     !plane_dirty && !pnode->draw_solid &&
+		     pnode->plane == &pnode->output->primary_plane &&
+		     !pixman_region32_not_empty(&surf->damage) &&
+		     !pnode->output->full_repaint_needed;
+	pixman_region32_t old_visible;
+
+	/* What was visible of a view that only moved is still on screen
+	 * at its old place, see output_add_move(). */
+	if (moved) {
+		pixman_region32_init(&old_visible);
+		pixman_region32_copy(&old_visible, &pnode->visible);
+	}
 
 	/* The geoemtry may be shrinking, so we shouldn't just
 	 * add the old visible region to our damage region, because
@@ -303,9 +505,12 @@ paint_node_update_late(struct weston_paint_node *pnode)
 	 * have been updated by some other node changing. Keep the
 	 * visible region up to date.
 	 */
-	pixman_region32_intersect(&pnode->visible,
-				  &pnode->view->visible,
-				  &pnode->output->region);
+	if (pnode->occlusion_dirty) {
+		pixman_region32_intersect(&pnode->visible,
+					  &pnode->view->visible,
+					  &pnode->output->region);
+		pnode->occlusion_dirty = false;
+	}
 
 	/* If our visible region was dirty, we should damage the entire
 	 * new visible region to ensure a redraw of our content.
@@ -331,6 +536,12 @@ paint_node_update_late(struct weston_paint_node *pnode)
 	if (buffer_dirty)
 		surf->compositor->renderer->attach(pnode);
 
+	if (moved) {
+		if (!pnode->draw_solid)
+			output_add_move(pnode->output, pnode, &old_visible);
+		pixman_region32_fini(&old_visible);
+	}
+
 	pnode->status &= ~(PAINT_NODE_VISIBILITY_DIRTY |
 			   PAINT_NODE_PLANE_DIRTY |
 			   PAINT_NODE_CONTENT_DIRTY |
@@ -352,7 +563,7 @@ weston_paint_node_create(struct weston_surface *surface,
 
 	assert(view->surface == surface);
 
-	pnode = zalloc(sizeof *pnode);
+	pnode = weston_object_pool_zalloc(surface->compositor->paint_node_pool);
 	if (!pnode)
 		return NULL;
 
@@ -385,6 +596,8 @@ weston_paint_node_create(struct weston_surface *surface,
 	pixman_region32_init(&pnode->damage);
 	pixman_region32_init(&pnode->visible);
 	pixman_region32_copy(&pnode->visible, &view->visible);
+	pixman_region32_init(&pnode->occlusion);
+	pnode->occlusion_dirty = true;
 
 	pnode->plane = &pnode->output->primary_plane;
 	pnode->plane_next = NULL;
@@ -406,11 +619,14 @@ weston_paint_node_destroy(struct weston_paint_node *pnode)
 	wl_list_remove(&pnode->view_link);
 	wl_list_remove(&pnode->output_link);
 	wl_list_remove(&pnode->z_order_link);
+	pnode->output->paint_node_z_order_dirty = true;
 	assert(pnode->surf_xform_valid || !pnode->surf_xform.transform);
 	weston_surface_color_transform_fini(&pnode->surf_xform);
 	pixman_region32_fini(&pnode->damage);
 	pixman_region32_fini(&pnode->visible);
-	free(pnode);
+	pixman_region32_fini(&pnode->occlusion);
+	weston_object_pool_free(pnode->surface->compositor->paint_node_pool,
+				pnode);
 }
 
 /** Send wl_output events for mode and scale changes
@@ -468,6 +684,38 @@ weston_output_contains_coord(struct weston_output *output,
 					      pos.c.x, pos.c.y, NULL);
 }
 
+static void
+weston_output_reassign_views(struct weston_output *output);
+
+/* Tell fractional-scale aware clients the scale of the primary output, so
+ * that a buffer of that many pixels per surface unit, scaled down with
+ * wp_viewport, maps 1:1 onto output pixels. */
+static void
+weston_surface_update_preferred_scale(struct weston_surface *surface)
+{
+	struct weston_output *output = surface->output;
+	uint32_t scale = 120;
+
+	if (!surface->fractional_scale_resource)
+		return;
+
+	/* Same guess as weston_surface_update_preferred_color_profile()
+	 * for surfaces that are not mapped yet. */
+	if (!output && !wl_list_empty(&surface->compositor->output_list))
+		output = wl_container_of(surface->compositor->output_list.next,
+					 output, link);
+
+	if (output && output->current_scale > 0)
+		scale = output->current_scale * 120;
+
+	if (scale == surface->preferred_fractional_scale)
+		return;
+
+	surface->preferred_fractional_scale = scale;
+	wp_fractional_scale_v1_send_preferred_scale(surface->fractional_scale_resource,
+						    scale);
+}
+
 static void
 weston_mode_switch_finish(struct weston_output *output,
 			  int mode_changed, int scale_changed)
@@ -485,6 +733,7 @@ weston_mode_switch_finish(struct weston_output *output,
 	pixman_region32_init_rect(&output->region,
 				  output->pos.c.x, output->pos.c.y,
 				  output->width, output->height);
+	output->compositor->pick_index_dirty = true;
 
 	weston_output_update_matrix(output);
 
@@ -508,11 +757,21 @@ weston_mode_switch_finish(struct weston_output *output,
 								    output);
 	}
 
+	if (!pixman_region32_equal(&old_output_region, &output->region))
+		weston_output_reassign_views(output);
+
 	pixman_region32_fini(&old_output_region);
 
 	if (!mode_changed && !scale_changed)
 		return;
 
+	if (scale_changed) {
+		struct weston_view *view;
+
+		wl_list_for_each(view, &output->compositor->view_list, link)
+			weston_surface_update_preferred_scale(view->surface);
+	}
+
 	weston_output_damage(output);
 
 	/* notify clients of the changes */
@@ -670,6 +929,159 @@ region_init_infinite(pixman_region32_t *region)
 				  UINT32_MAX, UINT32_MAX);
 }
 
+static void
+region_swap(pixman_region32_t *a, pixman_region32_t *b)
+{
+	pixman_region32_t tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/* pixman allocates new storage when an operation writes into one of its
+ * operands. These build the result in a compositor scratch region and swap
+ * it in, so the two storages get recycled between calls.
+ */
+static void
+region_union_into(struct weston_compositor *ec, pixman_region32_t *dest,
+		  pixman_region32_t *src)
+{
+	pixman_region32_t *scratch = &ec->commit_scratch[0];
+
+	if (!pixman_region32_not_empty(src))
+		return;
+
+	pixman_region32_union(scratch, dest, src);
+	region_swap(dest, scratch);
+}
+
+/* Accumulate src into dest and leave src empty. While dest holds nothing
+ * yet, this is a plain exchange of the two regions.
+ */
+static void
+region_move_into(struct weston_compositor *ec, pixman_region32_t *dest,
+		 pixman_region32_t *src)
+{
+	if (!pixman_region32_not_empty(dest)) {
+		region_swap(dest, src);
+		return;
+	}
+
+	region_union_into(ec, dest, src);
+	pixman_region32_clear(src);
+}
+
+static void
+region_union_rect_into(struct weston_compositor *ec, pixman_region32_t *dest,
+		       int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+	pixman_region32_t *scratch = &ec->commit_scratch[0];
+
+	pixman_region32_union_rect(scratch, dest, x, y, width, height);
+	region_swap(dest, scratch);
+}
+
+static void
+region_intersect_rect_into(struct weston_compositor *ec,
+			   pixman_region32_t *dest,
+			   int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+	pixman_region32_t *scratch = &ec->commit_scratch[0];
+
+	pixman_region32_intersect_rect(scratch, dest, x, y, width, height);
+	region_swap(dest, scratch);
+}
+
+/* Damage of more rectangles than this gets snapped to a tile grid */
+#define DAMAGE_TILE_MAX_RECTS 64
+/* Tiles along each axis of the damage extents, one bit each in a row mask */
+#define DAMAGE_TILE_GRID 32
+#define DAMAGE_TILE_MIN_SIZE 16
+
+/* Scattered damage, like a client updating cells all over a huge surface,
+ * fragments a region into many small rectangles. Every further union
+ * walks all of them, and so do the texture uploads at repaint. Past
+ * DAMAGE_TILE_MAX_RECTS, the region is replaced by the tiles it touches
+ * of a grid laid over its extents, which is a superset of it. The grid
+ * is a bitmap, so this costs one pass over the rectangles, and the result
+ * never has more than one rectangle per tile. Only damage already clipped
+ * to the surface is coarsened: raw client damage can be arbitrarily large,
+ * and snapping it to a grid over its extents would lose all precision. */
+static int
+damage_tile_index(int32_t v, int32_t origin, int64_t tile_size)
+{
+	int64_t index = ((int64_t)v - origin) / tile_size;
+
+	return MIN(MAX(index, 0), DAMAGE_TILE_GRID - 1);
+}
+
+static void
+region_coarsen_into(struct weston_compositor *ec, pixman_region32_t *dest)
+{
+	pixman_region32_t *scratch = &ec->commit_scratch[0];
+	pixman_box32_t boxes[DAMAGE_TILE_GRID * DAMAGE_TILE_GRID / 2];
+	uint32_t rows[DAMAGE_TILE_GRID] = { 0 };
+	pixman_box32_t *extents, *rects;
+	int64_t tile_w, tile_h;
+	int n_rects, n_boxes = 0;
+	int i, row, col;
+
+	n_rects = pixman_region32_n_rects(dest);
+	if (n_rects <= DAMAGE_TILE_MAX_RECTS)
+		return;
+
+	/* Extents may span the whole int32 range, so the tile arithmetic
+	 * is done in 64 bits and the tile indices are clamped to the grid. */
+	extents = pixman_region32_extents(dest);
+	tile_w = MAX(((int64_t)extents->x2 - extents->x1 +
+		      DAMAGE_TILE_GRID - 1) / DAMAGE_TILE_GRID,
+		     DAMAGE_TILE_MIN_SIZE);
+	tile_h = MAX(((int64_t)extents->y2 - extents->y1 +
+		      DAMAGE_TILE_GRID - 1) / DAMAGE_TILE_GRID,
+		     DAMAGE_TILE_MIN_SIZE);
+
+	rects = pixman_region32_rectangles(dest, &n_rects);
+	for (i = 0; i < n_rects; i++) {
+		int c1 = damage_tile_index(rects[i].x1, extents->x1, tile_w);
+		int c2 = damage_tile_index(rects[i].x2 - 1, extents->x1, tile_w);
+		int r1 = damage_tile_index(rects[i].y1, extents->y1, tile_h);
+		int r2 = damage_tile_index(rects[i].y2 - 1, extents->y1, tile_h);
+		uint32_t mask;
+
+		mask = (UINT32_MAX >> (31 - c2)) & (UINT32_MAX << c1);
+		for (row = r1; row <= r2; row++)
+			rows[row] |= mask;
+	}
+
+	/* One box per run of tiles in a row; pixman merges equal rows. */
+	for (row = 0; row < DAMAGE_TILE_GRID; row++) {
+		int64_t y1 = extents->y1 + row * tile_h;
+		int64_t y2 = MIN(y1 + tile_h, (int64_t)extents->y2);
+		uint32_t bits = rows[row];
+
+		while (bits) {
+			int end;
+
+			col = ffs(bits) - 1;
+			end = col;
+			while (end < DAMAGE_TILE_GRID && (bits & (1u << end)))
+				end++;
+			bits &= end < DAMAGE_TILE_GRID ? UINT32_MAX << end : 0;
+
+			boxes[n_boxes].x1 = extents->x1 + col * tile_w;
+			boxes[n_boxes].x2 = MIN(extents->x1 + end * tile_w,
+						(int64_t)extents->x2);
+			boxes[n_boxes].y1 = y1;
+			boxes[n_boxes].y2 = y2;
+			n_boxes++;
+		}
+	}
+
+	pixman_region32_fini(scratch);
+	pixman_region32_init_rects(scratch, boxes, n_boxes);
+	region_swap(dest, scratch);
+}
+
 static struct weston_subsurface *
 weston_surface_to_subsurface(struct weston_surface *surface);
 
@@ -678,11 +1090,12 @@ weston_view_create_internal(struct weston_surface *surface)
 {
 	struct weston_view *view;
 
-	view = zalloc(sizeof *view);
+	view = weston_object_pool_zalloc(surface->compositor->view_pool);
 	if (view == NULL)
 		return NULL;
 
 	view->surface = surface;
+	view->serial = ++surface->compositor->object_serial;
 
 	/* Assign to surface */
 	wl_list_insert(&surface->views, &view->surface_link);
@@ -728,7 +1141,7 @@ weston_view_create_subsurfaces(struct weston_view *parent_view,
 	weston_view_set_rel_position(child_view, sub->position.offset);
 	child_view->parent_view = parent_view;
 	weston_view_update_transform(child_view);
-	child_surface->compositor->view_list_needs_rebuild = true;
+	weston_view_dirty_view_list(child_view);
 
 	wl_list_for_each(sub_sub, &child_surface->subsurface_list, parent_link) {
 		if (sub_sub->surface == sub->surface)
@@ -885,9 +1298,11 @@ weston_surface_state_init(struct weston_surface *surface,
 	state->buffer_viewport.surface.width = -1;
 
 	state->acquire_fence_fd = -1;
+	state->drm_syncobj_acquire = NULL;
 
 	state->desired_protection = WESTON_HDCP_DISABLE;
 	state->protection_mode = WESTON_SURFACE_PROTECTION_MODE_RELAXED;
+	state->content_type = WESTON_CONTENT_TYPE_NONE;
 
 	state->color_profile = NULL;
 	state->render_intent = NULL;
@@ -913,6 +1328,8 @@ weston_surface_state_fini(struct weston_surface_state *state)
 	state->buffer = NULL;
 
 	fd_clear(&state->acquire_fence_fd);
+	weston_drm_syncobj_acquire_destroy(state->drm_syncobj_acquire);
+	state->drm_syncobj_acquire = NULL;
 	weston_buffer_release_reference(&state->buffer_release_ref, NULL);
 
 	weston_color_profile_unref(state->color_profile);
@@ -1017,9 +1434,14 @@ weston_surface_create(struct weston_compositor *compositor)
 
 	wl_list_init(&surface->frame_callback_list);
 	wl_list_init(&surface->feedback_list);
+	wl_list_init(&surface->frame_timing_resource_list);
+
+	wl_list_init(&surface->commit_queue);
+	wl_list_init(&surface->commit_queue_link);
 
 	wl_list_init(&surface->subsurface_list);
 	wl_list_init(&surface->subsurface_list_pending);
+	wl_array_init(&surface->subsurface_flat);
 
 	weston_matrix_init(&surface->buffer_to_surface_matrix);
 	weston_matrix_init(&surface->surface_to_buffer_matrix);
@@ -1128,8 +1550,7 @@ weston_matrix_transform_rect(struct weston_matrix *matrix,
 		weston_coord(rect.x2, rect.y2),
 	};
 
-	for (i = 0; i < 4; i++)
-		corners[i] = weston_matrix_transform_coord(matrix, corners[i]);
+	weston_matrix_transform_coords(matrix, corners, 4);
 
 	out.x1 = floor(corners[0].x);
 	out.y1 = floor(corners[0].y);
@@ -1149,6 +1570,52 @@ weston_matrix_transform_rect(struct weston_matrix *matrix,
 	return out;
 }
 
+/** Transform an array of boxes by a matrix
+ *
+ * \param matrix The matrix to apply.
+ * \param src The boxes to transform.
+ * \param[out] dest The transformed boxes, may be the same as src.
+ * \param count The number of boxes.
+ *
+ * Gives the same result as weston_matrix_transform_rect() on each box. For
+ * matrices that only translate and scale, the two x and the two y
+ * coordinates of a box are transformed directly instead of its four
+ * corners.
+ */
+WL_EXPORT void
+weston_matrix_transform_boxes(struct weston_matrix *matrix,
+			      const pixman_box32_t *src,
+			      pixman_box32_t *dest, int count)
+{
+	const unsigned int translate_scale = WESTON_MATRIX_TRANSFORM_TRANSLATE |
+					     WESTON_MATRIX_TRANSFORM_SCALE;
+	float sx, sy, tx, ty;
+	int i;
+
+	if (matrix->type & ~translate_scale) {
+		for (i = 0; i < count; i++)
+			dest[i] = weston_matrix_transform_rect(matrix, src[i]);
+		return;
+	}
+
+	sx = matrix->d[0];
+	sy = matrix->d[5];
+	tx = matrix->d[12];
+	ty = matrix->d[13];
+
+	for (i = 0; i < count; i++) {
+		float x1 = (float)src[i].x1 * sx + tx;
+		float x2 = (float)src[i].x2 * sx + tx;
+		float y1 = (float)src[i].y1 * sy + ty;
+		float y2 = (float)src[i].y2 * sy + ty;
+
+		dest[i].x1 = floor(MIN(x1, x2));
+		dest[i].x2 = ceil(MAX(x1, x2));
+		dest[i].y1 = floor(MIN(y1, y2));
+		dest[i].y2 = ceil(MAX(y1, y2));
+	}
+}
+
 /** Transform a region by a matrix
  *
  * Warning: This function does not work perfectly for projective,
@@ -1162,20 +1629,35 @@ weston_matrix_transform_region(pixman_region32_t *dest,
 			       struct weston_matrix *matrix,
 			       pixman_region32_t *src)
 {
+	pixman_box32_t stack_rects[16];
 	pixman_box32_t *src_rects, *dest_rects;
-	int nrects, i;
+	int nrects;
+
+	/* An integer translation moves every box by whole pixels, which
+	 * pixman can do without rebuilding the region. */
+	if (matrix->type <= WESTON_MATRIX_TRANSFORM_TRANSLATE &&
+	    matrix->d[12] == (int32_t)matrix->d[12] &&
+	    matrix->d[13] == (int32_t)matrix->d[13]) {
+		if (dest != src)
+			pixman_region32_copy(dest, src);
+		pixman_region32_translate(dest, matrix->d[12], matrix->d[13]);
+		return;
+	}
 
 	src_rects = pixman_region32_rectangles(src, &nrects);
-	dest_rects = malloc(nrects * sizeof(*dest_rects));
+	if (nrects <= (int)ARRAY_LENGTH(stack_rects))
+		dest_rects = stack_rects;
+	else
+		dest_rects = malloc(nrects * sizeof(*dest_rects));
 	if (!dest_rects)
 		return;
 
-	for (i = 0; i < nrects; i++)
-		dest_rects[i] = weston_matrix_transform_rect(matrix, src_rects[i]);
+	weston_matrix_transform_boxes(matrix, src_rects, dest_rects, nrects);
 
 	pixman_region32_clear(dest);
 	pixman_region32_init_rects(dest, dest_rects, nrects);
-	free(dest_rects);
+	if (dest_rects != stack_rects)
+		free(dest_rects);
 }
 
 /** Transform a rectangle from surface coordinates to buffer coordinates
@@ -1276,6 +1758,7 @@ weston_view_damage_below(struct weston_view *view)
 /** Send wl_surface.enter/leave events
  *
  * \param surface The surface.
+ * \param client The client owning the surface.
  * \param head A head of the entered/left output.
  * \param enter True if entered.
  * \param leave True if left.
@@ -1285,16 +1768,15 @@ weston_view_damage_below(struct weston_view *view)
  */
 static void
 weston_surface_send_enter_leave(struct weston_surface *surface,
+				struct wl_client *client,
 				struct weston_head *head,
 				bool enter,
 				bool leave)
 {
 	struct wl_resource *wloutput;
-	struct wl_client *client;
 
 	assert(enter != leave);
 
-	client = wl_resource_get_client(surface->resource);
 	wl_resource_for_each(wloutput, &head->resource_list) {
 		if (wl_resource_get_client(wloutput) != client)
 			continue;
@@ -1444,6 +1926,7 @@ weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
 	uint32_t output_bit;
 	struct weston_output *output;
 	struct weston_head *head;
+	struct wl_client *client;
 
 	es->output_mask = mask;
 	if (es->resource == NULL)
@@ -1451,16 +1934,21 @@ weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
 	if (different == 0)
 		return;
 
+	client = wl_resource_get_client(es->resource);
 	wl_list_for_each(output, &es->compositor->output_list, link) {
 		output_bit = 1u << output->id;
 		if (!(output_bit & different))
 			continue;
 
 		wl_list_for_each(head, &output->head_list, output_link) {
-			weston_surface_send_enter_leave(es, head,
+			weston_surface_send_enter_leave(es, client, head,
 							output_bit & entered,
 							output_bit & left);
 		}
+
+		different &= ~output_bit;
+		if (different == 0)
+			break;
 	}
 	/*
 	 * Change in surfaces' output mask might trigger a change in its
@@ -1516,6 +2004,75 @@ get_view_layer(struct weston_view *view)
 	return view->layer_link.layer;
 }
 
+static void
+weston_layer_dirty_view_list(struct weston_layer *layer)
+{
+	layer->view_list_dirty = true;
+	layer->compositor->view_list_needs_update = true;
+}
+
+/* Makes the next repaint update the part of the view list, and of the
+ * z-order lists, that belong to the layer of this view. That is both the
+ * layer it is on now and the one it was listed for, if it moved. */
+static void
+weston_view_dirty_view_list(struct weston_view *view)
+{
+	struct weston_layer *layer;
+
+	/* Everything is redone anyway, and layers may be gone already. */
+	if (view->surface->compositor->view_list_needs_rebuild)
+		return;
+
+	layer = get_view_layer(view);
+	if (layer)
+		weston_layer_dirty_view_list(layer);
+	if (view->view_list_layer && view->view_list_layer != layer)
+		weston_layer_dirty_view_list(view->view_list_layer);
+}
+
+static void
+weston_surface_dirty_view_list(struct weston_surface *surface)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &surface->views, surface_link)
+		weston_view_dirty_view_list(view);
+}
+
+/* Area of the extents of the part of the view on the output. Both are
+ * mostly single rectangles, which takes no region arithmetic. */
+static uint32_t
+view_output_overlap_area(struct weston_view *view,
+			 struct weston_output *output,
+			 pixman_region32_t *scratch)
+{
+	pixman_box32_t *bb = pixman_region32_extents(&view->transform.boundingbox);
+	pixman_box32_t *ob = pixman_region32_extents(&output->region);
+	int32_t x1 = MAX(bb->x1, ob->x1);
+	int32_t y1 = MAX(bb->y1, ob->y1);
+	int32_t x2 = MIN(bb->x2, ob->x2);
+	int32_t y2 = MIN(bb->y2, ob->y2);
+	pixman_box32_t *e;
+
+	if (x1 >= x2 || y1 >= y2)
+		return 0;
+
+	/* A clipped bounding box can be several rectangles, and the extents
+	 * of their overlap can be smaller than the overlap of the extents. */
+	if (pixman_region32_n_rects(&view->transform.boundingbox) > 1) {
+		pixman_region32_intersect(scratch,
+					  &view->transform.boundingbox,
+					  &output->region);
+		e = pixman_region32_extents(scratch);
+		x1 = e->x1;
+		y1 = e->y1;
+		x2 = e->x2;
+		y2 = e->y2;
+	}
+
+	return (x2 - x1) * (y2 - y1);
+}
+
 /** Recalculate which output(s) the surface has views displayed on
  *
  * \param es  The surface to remap to outputs
@@ -1538,7 +2095,6 @@ weston_surface_assign_output(struct weston_surface *es)
 	struct weston_view *view;
 	pixman_region32_t region;
 	uint32_t max, area, mask;
-	pixman_box32_t *e;
 
 	new_output = NULL;
 	max = 0;
@@ -1550,11 +2106,7 @@ weston_surface_assign_output(struct weston_surface *es)
 		if (!view->output || !get_view_layer(view))
 			continue;
 
-		pixman_region32_intersect(&region, &view->transform.boundingbox,
-					  &view->output->region);
-
-		e = pixman_region32_extents(&region);
-		area = (e->x2 - e->x1) * (e->y2 - e->y1);
+		area = view_output_overlap_area(view, view->output, &region);
 
 		mask |= view->output_mask;
 
@@ -1600,6 +2152,7 @@ weston_surface_assign_output(struct weston_surface *es)
 	 * surface preferred color profile. Part of the CM&HDR protocol
 	 * extension implementation. */
 	weston_surface_update_preferred_color_profile(es);
+	weston_surface_update_preferred_scale(es);
 }
 
 /** Recalculate which output(s) the view is displayed on
@@ -1621,7 +2174,6 @@ weston_view_assign_output(struct weston_view *ev)
 	struct weston_paint_node *pnode, *pntmp;
 	pixman_region32_t region;
 	uint32_t new_output_area, area, mask;
-	pixman_box32_t *e;
 
 	new_output = NULL;
 	new_output_area = 0;
@@ -1631,12 +2183,7 @@ weston_view_assign_output(struct weston_view *ev)
 		if (output->destroying)
 			continue;
 
-		pixman_region32_intersect(&region, &ev->transform.boundingbox,
-					  &output->region);
-
-		e = pixman_region32_extents(&region);
-		area = (e->x2 - e->x1) * (e->y2 - e->y1);
-
+		area = view_output_overlap_area(ev, output, &region);
 		if (area == 0)
 			continue;
 
@@ -1666,6 +2213,10 @@ weston_view_assign_output(struct weston_view *ev)
 	pixman_region32_fini(&region);
 
 	weston_view_set_output(ev, new_output);
+
+	/* New outputs need a paint node placed in their z-order list */
+	if (mask & ~ev->output_mask)
+		weston_view_dirty_view_list(ev);
 	ev->output_mask = mask;
 
 	weston_surface_assign_output(ev->surface);
@@ -1828,6 +2379,7 @@ weston_view_update_transform_enable(struct weston_view *view)
 	struct weston_transform *tform;
 	pixman_region32_t surfregion;
 	const pixman_box32_t *surfbox;
+	enum wl_output_transform axis_aligned;
 
 	view->transform.enabled = 1;
 
@@ -1876,14 +2428,16 @@ weston_view_update_transform_enable(struct weston_view *view)
 						  matrix->d[13]);
 		}
 	} else if (view->alpha == 1.0 &&
-		 matrix->type < WESTON_MATRIX_TRANSFORM_ROTATE &&
+		 (matrix->type < WESTON_MATRIX_TRANSFORM_ROTATE ||
+		  weston_matrix_to_transform(matrix, &axis_aligned)) &&
 		 pixman_region32_n_rects(&surfregion) == 1 &&
 		 (pixman_region32_equal(&surfregion, &view->surface->opaque) ||
 		  view->surface->is_opaque)) {
-		/* The whole surface is opaque and it is only translated and
-		 * scaled and after applying the scissor, the result is still
-		 * a single rectangle. In this case the boundingbox matches the
-		 * view exactly and can be used as opaque area. */
+		/* The whole surface is opaque and it is only translated,
+		 * scaled, flipped or rotated by a multiple of 90 degrees, and
+		 * after applying the scissor, the result is still a single
+		 * rectangle. In this case the boundingbox matches the view
+		 * exactly and can be used as opaque area. */
 		pixman_region32_copy(&view->transform.opaque,
 				     &view->transform.boundingbox);
 	}
@@ -1954,6 +2508,8 @@ weston_view_geometry_dirty_internal(struct weston_view *view)
 {
 	struct weston_view *child;
 
+	view->surface->compositor->pick_index_dirty = true;
+
 	/*
 	 * The invariant: if view->geometry.dirty, then all views
 	 * in view->geometry.child_list have geometry.dirty too.
@@ -1979,7 +2535,7 @@ WL_EXPORT void
 weston_view_geometry_dirty(struct weston_view *view)
 {
 	weston_view_geometry_dirty_internal(view);
-	view->surface->compositor->view_list_needs_rebuild = true;
+	weston_view_dirty_view_list(view);
 }
 
 WL_EXPORT void
@@ -2286,6 +2842,44 @@ weston_view_is_mapped(struct weston_view *view)
 	return view->is_mapped;
 }
 
+static bool
+weston_view_is_suspended(struct weston_view *view)
+{
+	for (; view; view = view->parent_view) {
+		if (view->is_suspended)
+			return true;
+	}
+
+	return false;
+}
+
+/** Suspend or resume a view
+ *
+ * \param view The view, along with its child views.
+ * \param suspended Whether the view is suspended.
+ *
+ * A suspended view keeps its place in its layer, but is left out of the
+ * paint node z-order lists: it is not composited, its surface gets no frame
+ * callbacks and it does not take input. Resuming it shows the last
+ * committed buffer right away.
+ *
+ * Meant for shells to stop applications that are not shown from rendering,
+ * unlike occluded surfaces whose frame callbacks can be throttled.
+ *
+ * \ingroup views
+ */
+WL_EXPORT void
+weston_view_set_suspended(struct weston_view *view, bool suspended)
+{
+	if (view->is_suspended == suspended)
+		return;
+
+	view->is_suspended = suspended;
+	weston_view_dirty_view_list(view);
+	view->surface->compositor->pick_index_dirty = true;
+	weston_view_schedule_repaint(view);
+}
+
 /* Check if view is opaque in specified region
  *
  * \param view The view to check for opacity.
@@ -2559,47 +3153,117 @@ weston_view_takes_input_at_point(struct weston_view *view,
 	return true;
 }
 
-/** weston_compositor_pick_view
- * \ingroup compositor
- */
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    struct weston_coord_global pos)
+static bool
+weston_view_is_picked(struct weston_view *view,
+		      struct weston_coord_global pos)
 {
-	struct weston_view *view;
+	struct weston_coord_surface surf_pos;
 
-	/* Can't use paint node list: occlusion by input regions, not opaque. */
-	wl_list_for_each(view, &compositor->view_list, link) {
-		struct weston_coord_surface surf_pos;
+	weston_view_update_transform(view);
 
-		weston_view_update_transform(view);
+	if (weston_view_is_suspended(view))
+		return false;
 
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, pos.c.x, pos.c.y, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    pos.c.x, pos.c.y, NULL))
+		return false;
 
-		surf_pos = weston_coord_global_to_surface(view, pos);
-		if (!weston_view_takes_input_at_point(view, surf_pos))
-			continue;
+	surf_pos = weston_coord_global_to_surface(view, pos);
 
-		return view;
-	}
-	return NULL;
+	return weston_view_takes_input_at_point(view, surf_pos);
 }
 
 static void
-weston_compositor_repick(struct weston_compositor *compositor)
+weston_compositor_update_pick_index(struct weston_compositor *compositor)
 {
-	struct weston_seat *seat;
+	struct weston_output *output;
+	struct weston_view *view;
 
-	if (!compositor->session_active)
-		return;
+	/* Cleared first, so that anything dirtying geometry while we are
+	 * rebuilding causes another rebuild on the next pick. */
+	compositor->pick_index_dirty = false;
 
-	wl_list_for_each(seat, &compositor->seat_list, link)
-		weston_seat_repick(seat);
-}
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (!output->pick_index)
+			output->pick_index = weston_pick_index_create();
 
-static void
+		weston_pick_index_reset(output->pick_index,
+					pixman_region32_extents(&output->region));
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		weston_view_update_transform(view);
+
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (!output->pick_index)
+				continue;
+
+			if (weston_pick_index_add_view(output->pick_index, view))
+				continue;
+
+			/* Fall back to walking the view list on this output. */
+			weston_pick_index_destroy(output->pick_index);
+			output->pick_index = NULL;
+		}
+	}
+}
+
+/** weston_compositor_pick_view
+ * \ingroup compositor
+ */
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    struct weston_coord_global pos)
+{
+	struct weston_output *output;
+	struct weston_view *view;
+
+	weston_metric_inc(compositor, WESTON_METRIC_VIEW_PICKS);
+
+	if (compositor->pick_index_dirty)
+		weston_compositor_update_pick_index(compositor);
+
+	/* The pick index is sorted in z-order and contains every view of
+	 * view_list that could possibly be under the point. */
+	wl_list_for_each(output, &compositor->output_list, link) {
+		struct weston_view **views;
+		size_t count, i;
+
+		if (!output->pick_index ||
+		    !weston_pick_index_lookup(output->pick_index,
+					      pos.c.x, pos.c.y,
+					      &views, &count))
+			continue;
+
+		for (i = 0; i < count; i++) {
+			if (weston_view_is_picked(views[i], pos))
+				return views[i];
+		}
+
+		return NULL;
+	}
+
+	/* Can't use paint node list: occlusion by input regions, not opaque. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (weston_view_is_picked(view, pos))
+			return view;
+	}
+	return NULL;
+}
+
+static void
+weston_compositor_repick(struct weston_compositor *compositor)
+{
+	struct weston_seat *seat;
+
+	if (!compositor->session_active)
+		return;
+
+	wl_list_for_each(seat, &compositor->seat_list, link)
+		weston_seat_repick(seat);
+}
+
+static void
 weston_view_destroy_paint_nodes(struct weston_view *view)
 {
 	struct weston_paint_node *pnode, *pntmp;
@@ -2617,6 +3281,8 @@ weston_view_unmap(struct weston_view *view)
 	if (!weston_view_is_mapped(view))
 		return;
 
+	weston_view_dirty_view_list(view);
+
 	/* Recursively unmap any child views, e.g. subsurfaces */
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link) {
@@ -2632,6 +3298,8 @@ weston_view_unmap(struct weston_view *view)
 	view->layer_link.layer = NULL;
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	view->view_list_layer = NULL;
+	view->surface->compositor->pick_index_dirty = true;
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -2660,7 +3328,6 @@ weston_view_unmap(struct weston_view *view)
 	weston_view_destroy_paint_nodes(view);
 
 	wl_signal_emit_mutable(&view->unmap_signal, view);
-	view->surface->compositor->view_list_needs_rebuild = true;
 }
 
 static void weston_surface_start_mapping(struct weston_surface *surface)
@@ -2669,7 +3336,7 @@ static void weston_surface_start_mapping(struct weston_surface *surface)
 
 	surface->is_mapping = true;
 	surface->is_mapped = true;
-	surface->compositor->view_list_needs_rebuild = true;
+	weston_surface_dirty_view_list(surface);
 	wl_signal_emit_mutable(&surface->map_signal, surface);
 }
 
@@ -2708,8 +3375,10 @@ weston_view_destroy(struct weston_view *view)
 
 	assert(wl_list_empty(&view->paint_node_list));
 
-	if (!wl_list_empty(&view->link))
-		view->surface->compositor->view_list_needs_rebuild = true;
+	if (!wl_list_empty(&view->link)) {
+		weston_view_dirty_view_list(view);
+		view->surface->compositor->pick_index_dirty = true;
+	}
 	wl_list_remove(&view->link);
 
 	wl_list_remove(&view->layer_link.link);
@@ -2726,7 +3395,7 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->surface_link);
 
-	free(view);
+	weston_object_pool_free(view->surface->compositor->view_pool, view);
 }
 
 WL_EXPORT struct weston_surface *
@@ -2761,6 +3430,7 @@ weston_surface_unref(struct weston_surface *surface)
 
 	assert(wl_list_empty(&surface->subsurface_list_pending));
 	assert(wl_list_empty(&surface->subsurface_list));
+	wl_array_release(&surface->subsurface_flat);
 
 	if (surface->dmabuf_feedback)
 		weston_dmabuf_feedback_destroy(surface->dmabuf_feedback);
@@ -2798,6 +3468,20 @@ weston_surface_unref(struct weston_surface *surface)
 	if (surface->tear_control)
 		surface->tear_control->surface = NULL;
 
+	if (surface->content_type_resource)
+		wl_resource_set_user_data(surface->content_type_resource, NULL);
+
+	if (surface->fractional_scale_resource)
+		wl_resource_set_user_data(surface->fractional_scale_resource,
+					  NULL);
+
+	wl_resource_for_each_safe(cb, next,
+				  &surface->frame_timing_resource_list) {
+		wl_list_remove(wl_resource_get_link(cb));
+		wl_list_init(wl_resource_get_link(cb));
+		wl_resource_set_user_data(cb, NULL);
+	}
+
 	weston_color_profile_unref(surface->color_profile);
 	weston_color_profile_unref(surface->preferred_color_profile);
 
@@ -2814,6 +3498,9 @@ weston_surface_unref(struct weston_surface *surface)
 	free(surface);
 }
 
+static void
+weston_surface_discard_commit_queue(struct weston_surface *surface);
+
 static void
 destroy_surface(struct wl_resource *resource)
 {
@@ -2834,6 +3521,19 @@ destroy_surface(struct wl_resource *resource)
 					  NULL);
 	}
 
+	if (surface->drm_syncobj)
+		surface->drm_syncobj->surface = NULL;
+
+	if (surface->fifo_resource)
+		wl_resource_set_user_data(surface->fifo_resource, NULL);
+
+	if (surface->commit_timer_resource)
+		wl_resource_set_user_data(surface->commit_timer_resource, NULL);
+
+	weston_surface_discard_commit_queue(surface);
+
+	weston_client_account_surface_destroyed(wl_resource_get_client(resource));
+
 	weston_surface_unref(surface);
 }
 
@@ -2846,6 +3546,8 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 	struct weston_buffer *buffer =
 		container_of(listener, struct weston_buffer, destroy_listener);
 
+	weston_client_account_buffer_destroyed(buffer);
+
 	buffer->resource = NULL;
 	/* wayland-server will destroy the SHM/dmabuf/legacy wl_buffer after we
 	 * return. */
@@ -2891,6 +3593,7 @@ weston_buffer_from_resource(struct weston_compositor *ec,
 	if (buffer == NULL)
 		return NULL;
 
+	buffer->serial = ++ec->object_serial;
 	buffer->resource = resource;
 	wl_signal_init(&buffer->destroy_signal);
 	buffer->destroy_listener.notify = weston_buffer_destroy_handler;
@@ -2949,6 +3652,9 @@ weston_buffer_from_resource(struct weston_compositor *ec,
 		buffer->type = WESTON_BUFFER_RENDERER_OPAQUE;
 	}
 
+	if (!weston_client_account_buffer_created(ec, buffer))
+		goto fail;
+
 	if (ec->renderer->buffer_init)
 		ec->renderer->buffer_init(ec, buffer);
 
@@ -2956,6 +3662,21 @@ weston_buffer_from_resource(struct weston_compositor *ec,
 	 * make sure this never happens */
 	assert(buffer->pixel_format);
 
+	switch (buffer->type) {
+	case WESTON_BUFFER_SHM:
+		weston_metric_inc(ec, WESTON_METRIC_BUFFER_IMPORTS_SHM);
+		break;
+	case WESTON_BUFFER_DMABUF:
+		weston_metric_inc(ec, WESTON_METRIC_BUFFER_IMPORTS_DMABUF);
+		break;
+	case WESTON_BUFFER_SOLID:
+		weston_metric_inc(ec, WESTON_METRIC_BUFFER_IMPORTS_SOLID);
+		break;
+	case WESTON_BUFFER_RENDERER_OPAQUE:
+		weston_metric_inc(ec, WESTON_METRIC_BUFFER_IMPORTS_OPAQUE);
+		break;
+	}
+
 	return buffer;
 
 fail:
@@ -3039,6 +3760,11 @@ weston_buffer_release_destroy(struct weston_buffer_release *buffer_release)
 	struct wl_resource *resource = buffer_release->resource;
 	int release_fence_fd = buffer_release->fence_fd;
 
+	if (!resource) {
+		weston_drm_syncobj_release(buffer_release);
+		return;
+	}
+
 	if (release_fence_fd >= 0) {
 		zwp_linux_buffer_release_v1_send_fenced_release(
 			resource, release_fence_fd);
@@ -3066,8 +3792,11 @@ weston_buffer_release_reference(struct weston_buffer_release_reference *ref,
 
 	if (buffer_release) {
 		buffer_release->ref_count++;
-		wl_resource_add_destroy_listener(buffer_release->resource,
-						 &ref->destroy_listener);
+		if (buffer_release->resource)
+			wl_resource_add_destroy_listener(buffer_release->resource,
+							 &ref->destroy_listener);
+		else
+			wl_list_init(&ref->destroy_listener.link);
 	}
 
 	ref->buffer_release = buffer_release;
@@ -3083,6 +3812,21 @@ weston_buffer_release_move(struct weston_buffer_release_reference *dest,
 	weston_buffer_release_reference(src, NULL);
 }
 
+/** The resource to blame for an explicit synchronization failure
+ *
+ * \param surface The surface using explicit synchronization.
+ * \return Its zwp_linux_surface_synchronization_v1 or
+ * wp_linux_drm_syncobj_surface_v1 resource.
+ */
+WL_EXPORT struct wl_resource *
+weston_surface_get_explicit_sync_resource(struct weston_surface *surface)
+{
+	if (surface->drm_syncobj)
+		return surface->drm_syncobj->resource;
+
+	return surface->synchronization_resource;
+}
+
 WL_EXPORT struct weston_buffer_reference *
 weston_buffer_create_solid_rgba(struct weston_compositor *compositor,
 				float r, float g, float b, float a)
@@ -3100,6 +3844,7 @@ weston_buffer_create_solid_rgba(struct weston_compositor *compositor,
 	}
 
 	wl_signal_init(&buffer->destroy_signal);
+	buffer->serial = ++compositor->object_serial;
 	buffer->type = WESTON_BUFFER_SOLID;
 	buffer->width = 1;
 	buffer->height = 1;
@@ -3376,10 +4121,21 @@ paint_node_flush_surface_damage(struct weston_paint_node *pnode)
 	struct weston_paint_node *walk_node;
 
 	if (buffer->type == WESTON_BUFFER_SHM) {
+		struct weston_renderer *renderer = surface->compositor->renderer;
+
 		if (pnode->draw_solid)
 			return;
 
-		surface->compositor->renderer->flush_damage(pnode);
+		renderer->flush_damage(pnode);
+
+		/* Let the client have the buffer back as soon as the renderer
+		 * does not need it anymore, rather than on the next attach. */
+		if (surface->compositor->shm_early_release &&
+		    surface->buffer_ref.type == BUFFER_MAY_BE_ACCESSED &&
+		    renderer->shm_buffer_is_copied &&
+		    renderer->shm_buffer_is_copied(surface))
+			weston_buffer_reference(&surface->buffer_ref, buffer,
+						BUFFER_WILL_NOT_BE_ACCESSED);
 	}
 
 	if (!pixman_region32_not_empty(&surface->damage))
@@ -3397,50 +4153,71 @@ paint_node_flush_surface_damage(struct weston_paint_node *pnode)
 }
 
 static void
-view_update_visible(struct weston_view *view,
-                             pixman_region32_t *opaque)
+paint_node_update_visible(struct weston_paint_node *pnode,
+			  pixman_region32_t *opaque)
 {
+	struct weston_view *view = pnode->view;
+
 	assert(!view->transform.dirty);
 
 	pixman_region32_subtract(&view->visible, &view->transform.boundingbox,
 				 opaque);
-	pixman_region32_union(opaque, opaque, &view->transform.opaque);
+	pixman_region32_union(&pnode->occlusion, opaque,
+			      &view->transform.opaque);
 }
 
-
+/* The visible region of a node only depends on its own geometry and on
+ * the opaque regions of the nodes above it. So the nodes above the
+ * topmost one whose geometry changed, or which has a different node above
+ * it than last time, keep the visible region they have. Everything from
+ * there on down is computed again, starting from the occlusion cached in
+ * the last node kept.
+ */
 static void
 output_update_visibility(struct weston_output *output)
 {
-	struct weston_paint_node *pnode;
-	pixman_region32_t opaque, clip;
-
-	pixman_region32_init(&clip);
-
-	pixman_region32_init(&opaque);
-
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
-		view_update_visible(pnode->view, &opaque);
+	struct weston_paint_node *pnode, *above = NULL;
+	struct weston_paint_node **nodes;
+	unsigned int n_nodes, i;
+	pixman_region32_t empty;
+	bool dirty = false;
+
+	pixman_region32_init(&empty);
+
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
+		if (pnode->occlusion_dirty || pnode->occlusion_above != above)
+			dirty = true;
+
+		if (dirty) {
+			paint_node_update_visible(pnode, above ?
+						  &above->occlusion : &empty);
+			pnode->occlusion_above = above;
+			pnode->occlusion_dirty = true;
+		}
 
-		pixman_region32_union(&clip, &clip, &opaque);
+		above = pnode;
 	}
 
-	pixman_region32_fini(&opaque);
-	pixman_region32_fini(&clip);
+	pixman_region32_fini(&empty);
 }
 
 static void
 output_accumulate_damage(struct weston_output *output)
 {
 	struct weston_paint_node *pnode;
+	struct weston_paint_node **nodes;
+	unsigned int n_nodes, i;
 
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
 		pnode->surface->touched = false;
 	}
 
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
 		if (pnode->surface->touched)
 			continue;
 		pnode->surface->touched = true;
@@ -3484,124 +4261,246 @@ view_ensure_paint_node(struct weston_view *view, struct weston_output *output)
 	return weston_paint_node_create(view->surface, view, output);
 }
 
-static void
-add_to_z_order_list(struct weston_output *output,
-		    struct weston_paint_node *pnode)
+static struct wl_list *
+view_list_insert(struct wl_list *pos, struct weston_view *view,
+		 struct weston_layer *layer)
 {
-	if (!pnode)
-		return;
+	wl_list_insert(pos, &view->link);
+	view->view_list_layer = layer;
 
-	wl_list_remove(&pnode->z_order_link);
-	wl_list_insert(output->paint_node_z_order_list.prev,
-		       &pnode->z_order_link);
+	return &view->link;
+}
 
-	/*
-	 * Building weston_output::paint_node_z_order_list ensures all
-	 * necessary color transform objects are installed.
-	 */
-	weston_paint_node_ensure_color_transform(pnode);
+/** One step of a flattened sub-surface tree
+ *
+ * The tree of a surface is flattened into the sequence of steps the
+ * recursive walk over the sub-surface lists would take. Every surface in
+ * the tree is a node, numbered in the order the walk enters it, the root
+ * being node 0. A step either enters the sub-surface @c sub as node
+ * @c node under node @c parent, or, with a NULL @c sub, places the view
+ * of node @c node. @c skip is the index of the first step after the
+ * sub-tree of an entered node, to skip it when it is not mapped.
+ */
+struct subsurface_flat_step {
+	struct weston_subsurface *sub;
+	uint32_t node;
+	uint32_t parent;
+	uint32_t skip;
+};
+
+static void
+subsurface_flat_add_step(struct weston_surface *root,
+			 struct weston_subsurface *sub,
+			 uint32_t node, uint32_t parent)
+{
+	struct subsurface_flat_step *step;
+
+	step = wl_array_add(&root->subsurface_flat, sizeof *step);
+	abort_oom_if_null(step);
+	step->sub = sub;
+	step->node = node;
+	step->parent = parent;
+	step->skip = 0;
 }
 
 static void
-view_list_add_subsurface_view(struct weston_compositor *compositor,
-			      struct weston_subsurface *sub,
-			      struct weston_view *parent)
+subsurface_flat_build(struct weston_surface *root,
+		      struct weston_surface *surface, uint32_t node)
 {
-	struct weston_subsurface *child;
-	struct weston_view *view = NULL, *iv;
+	struct subsurface_flat_step *steps;
+	struct weston_subsurface *sub;
+	uint32_t child, index;
 
-	if (!weston_surface_is_mapped(sub->surface))
+	if (wl_list_empty(&surface->subsurface_list)) {
+		subsurface_flat_add_step(root, NULL, node, 0);
 		return;
-
-	wl_list_for_each(iv, &sub->surface->views, surface_link) {
-		if (iv->parent_view == parent) {
-			view = iv;
-			break;
-		}
 	}
 
-	assert(view);
+	wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
+		if (sub->surface == surface) {
+			subsurface_flat_add_step(root, NULL, node, 0);
+			continue;
+		}
 
-	weston_view_update_transform(view);
-	view->is_mapped = true;
+		index = root->subsurface_flat.size / sizeof *steps;
+		child = root->subsurface_flat_nodes++;
+		subsurface_flat_add_step(root, sub, child, node);
+		subsurface_flat_build(root, sub->surface, child);
 
-	if (wl_list_empty(&sub->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
-		return;
+		steps = root->subsurface_flat.data;
+		steps[index].skip = root->subsurface_flat.size / sizeof *steps;
 	}
+}
 
-	wl_list_for_each(child, &sub->surface->subsurface_list, parent_link) {
-		if (child->surface == sub->surface) {
-			wl_list_insert(compositor->view_list.prev, &view->link);
-		} else {
-			view_list_add_subsurface_view(compositor, child, view);
-		}
+/* The flattened sub-surface tree of a surface, rebuilt only after some
+ * sub-surface tree was restacked, linked or unlinked. */
+static const struct subsurface_flat_step *
+weston_surface_get_subsurface_flat(struct weston_surface *surface,
+				   size_t *count)
+{
+	struct weston_compositor *compositor = surface->compositor;
+
+	if (surface->subsurface_flat_generation !=
+	    compositor->subsurface_tree_generation) {
+		surface->subsurface_flat.size = 0;
+		surface->subsurface_flat_nodes = 1;
+		subsurface_flat_build(surface, surface, 0);
+		surface->subsurface_flat_generation =
+			compositor->subsurface_tree_generation;
 	}
+
+	*count = surface->subsurface_flat.size /
+		 sizeof(struct subsurface_flat_step);
+
+	return surface->subsurface_flat.data;
 }
 
-/* This recursively adds the sub-surfaces for a view, relying on the
- * sub-surface order. Thus, if a client restacks the sub-surfaces, that
- * change first happens to the sub-surface list, and then automatically
- * propagates here. See weston_surface_damage_subsurfaces() for how the
- * sub-surfaces receive damage when the client changes the state.
- */
 static void
-view_list_add(struct weston_compositor *compositor,
+weston_compositor_subsurface_tree_changed(struct weston_compositor *compositor)
+{
+	compositor->subsurface_tree_generation++;
+}
+
+/* This adds the sub-surfaces for a view, relying on the sub-surface
+ * order. Thus, if a client restacks the sub-surfaces, that change first
+ * happens to the sub-surface list, and then automatically propagates
+ * here through the flattened tree. See weston_surface_damage_subsurfaces()
+ * for how the sub-surfaces receive damage when the client changes the
+ * state.
+ *
+ * The views are inserted after pos, and the link of the last one added
+ * is returned.
+ */
+static struct wl_list *
+view_list_add(struct wl_list *pos, struct weston_layer *layer,
 	      struct weston_view *view)
 {
-	struct weston_subsurface *sub;
+	struct weston_compositor *compositor = view->surface->compositor;
+	const struct subsurface_flat_step *steps;
+	struct weston_view **views;
+	size_t count, i, size;
 
 	weston_view_update_transform(view);
 
-	if (wl_list_empty(&view->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
-		return;
+	if (wl_list_empty(&view->surface->subsurface_list))
+		return view_list_insert(pos, view, layer);
+
+	steps = weston_surface_get_subsurface_flat(view->surface, &count);
+
+	/* The view of each node, for looking up the views of its children */
+	size = view->surface->subsurface_flat_nodes * sizeof *views;
+	if (compositor->subsurface_flat_views.alloc < size) {
+		compositor->subsurface_flat_views.size = 0;
+		abort_oom_if_null(wl_array_add(&compositor->subsurface_flat_views,
+					       size));
 	}
+	views = compositor->subsurface_flat_views.data;
+	views[0] = view;
 
-	wl_list_for_each(sub, &view->surface->subsurface_list, parent_link) {
-		if (sub->surface == view->surface) {
-			wl_list_insert(compositor->view_list.prev, &view->link);
-		} else {
-			view_list_add_subsurface_view(compositor, sub, view);
+	for (i = 0; i < count; ) {
+		const struct subsurface_flat_step *step = &steps[i];
+		struct weston_view *iv, *child = NULL;
+
+		if (!step->sub) {
+			pos = view_list_insert(pos, views[step->node], layer);
+			i++;
+			continue;
+		}
+
+		if (!weston_surface_is_mapped(step->sub->surface)) {
+			i = step->skip;
+			continue;
+		}
+
+		wl_list_for_each(iv, &step->sub->surface->views, surface_link) {
+			if (iv->parent_view == views[step->parent]) {
+				child = iv;
+				break;
+			}
 		}
+
+		assert(child);
+
+		weston_view_update_transform(child);
+		child->is_mapped = true;
+		views[step->node] = child;
+		i++;
+	}
+
+	return pos;
+}
+
+/* Adds the paint node of the view after pos in the z-order list of the
+ * output, if the view shows there, and returns the new position. */
+static struct wl_list *
+z_order_list_add_view(struct weston_compositor *compositor,
+		      struct weston_output *output,
+		      struct wl_list *pos,
+		      struct weston_view *view)
+{
+	struct weston_paint_node *pnode;
+
+	/* It is possible for a view to appear in the layer list even though
+	 * the view or the surface is unmapped. This is erroneous but difficult
+	 * to fix. */
+	if (!weston_surface_is_mapped(view->surface) ||
+	    !weston_view_is_mapped(view) ||
+	    !weston_surface_has_content(view->surface)) {
+		weston_log_paced(&compositor->unmapped_surface_or_view_pacer,
+				 1, 0,
+				 "Detected an unmapped surface or view in "
+				 "the layer list, which should not occur.\n");
+
+		pnode = weston_view_find_paint_node(view, output);
+		if (pnode)
+			weston_paint_node_destroy(pnode);
+
+		return pos;
 	}
+
+	if (!(view->output_mask & (1u << output->id)))
+		return pos;
+
+	/* Its damage goes with the paint node, a new one repaints it all
+	 * once the view is resumed. */
+	if (weston_view_is_suspended(view)) {
+		pnode = weston_view_find_paint_node(view, output);
+		if (pnode)
+			weston_paint_node_destroy(pnode);
+
+		return pos;
+	}
+
+	pnode = view_ensure_paint_node(view, output);
+	if (!pnode)
+		return pos;
+
+	wl_list_remove(&pnode->z_order_link);
+	wl_list_insert(pos, &pnode->z_order_link);
+	output->paint_node_z_order_dirty = true;
+
+	/*
+	 * Building weston_output::paint_node_z_order_list ensures all
+	 * necessary color transform objects are installed.
+	 */
+	weston_paint_node_ensure_color_transform(pnode);
+
+	return &pnode->z_order_link;
 }
 
 static void
 weston_output_build_z_order_list(struct weston_compositor *compositor,
 				 struct weston_output *output)
 {
-	struct weston_paint_node *pnode;
+	struct wl_list *pos = &output->paint_node_z_order_list;
 	struct weston_view *view;
 
 	wl_list_remove(&output->paint_node_z_order_list);
 	wl_list_init(&output->paint_node_z_order_list);
+	output->paint_node_z_order_dirty = true;
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		/* It is possible for a view to appear in the layer list even though
-		 * the view or the surface is unmapped. This is erroneous but difficult
-		 * to fix. */
-		if (!weston_surface_is_mapped(view->surface) ||
-		    !weston_view_is_mapped(view) ||
-		    !weston_surface_has_content(view->surface)) {
-			weston_log_paced(&compositor->unmapped_surface_or_view_pacer,
-					 1, 0,
-					 "Detected an unmapped surface or view in "
-					 "the layer list, which should not occur.\n");
-
-			pnode = weston_view_find_paint_node(view, output);
-			if (pnode)
-				weston_paint_node_destroy(pnode);
-
-			continue;
-		}
-
-		if (!(view->output_mask & (1u << output->id)))
-			continue;
-
-		pnode = view_ensure_paint_node(view, output);
-		add_to_z_order_list(output, pnode);
-	}
+	wl_list_for_each(view, &compositor->view_list, link)
+		pos = z_order_list_add_view(compositor, output, pos, view);
 }
 
 static void
@@ -3610,59 +4509,252 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	struct weston_output *output;
 	struct weston_view *view, *tmp;
 	struct weston_layer *layer;
+	struct wl_list *pos = &compositor->view_list;
 
-	wl_list_for_each_safe(view, tmp, &compositor->view_list, link)
+	wl_list_for_each_safe(view, tmp, &compositor->view_list, link) {
 		wl_list_init(&view->link);
+		view->view_list_layer = NULL;
+	}
 	wl_list_init(&compositor->view_list);
 
 	wl_list_for_each(layer, &compositor->layer_list, link) {
-		wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
-			view_list_add(compositor, view);
-		}
+		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
+			pos = view_list_add(pos, layer, view);
+		layer->view_list_dirty = false;
 	}
 
 	wl_list_for_each(output, &compositor->output_list, link)
 		weston_output_build_z_order_list(compositor, output);
 
 	compositor->view_list_needs_rebuild = false;
+	compositor->view_list_needs_update = false;
+	compositor->pick_index_dirty = true;
+}
+
+static bool
+view_in_dirty_layer(struct weston_view *view)
+{
+	return view->view_list_layer && view->view_list_layer->view_list_dirty;
 }
 
+/* Puts the paint nodes of the views of the dirty layers, which were taken
+ * out of the z-order list, back in between those of the clean layers. */
 static void
-weston_output_take_feedback_list(struct weston_output *output,
-				 struct weston_surface *surface)
+weston_output_update_z_order_list(struct weston_compositor *compositor,
+				  struct weston_output *output)
 {
-	struct weston_presentation_feedback *feedback;
-	struct weston_paint_node *pnode;
-	uint32_t flags = 0xffffffff;
+	struct wl_list *zpos = &output->paint_node_z_order_list;
+	struct wl_list *vpos = &compositor->view_list;
+	struct weston_layer *layer;
+	struct weston_view *view;
 
-	if (wl_list_empty(&surface->feedback_list))
-		return;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		while (vpos->next != &compositor->view_list) {
+			view = container_of(vpos->next, struct weston_view, link);
+			if (view->view_list_layer != layer)
+				break;
+			vpos = vpos->next;
 
-	/* All views must have the flag for the flag to survive. */
-	wl_list_for_each(pnode, &surface->paint_node_list, surface_link) {
-		/* ignore views that are not on this output at all */
-		if (pnode->output != output)
+			if (layer->view_list_dirty)
+				zpos = z_order_list_add_view(compositor, output,
+							     zpos, view);
+		}
+
+		if (layer->view_list_dirty)
 			continue;
-		flags &= pnode->psf_flags;
-	}
 
-	wl_list_for_each(feedback, &surface->feedback_list, link)
-		feedback->psf_flags = flags;
+		while (zpos->next != &output->paint_node_z_order_list) {
+			struct weston_paint_node *pnode;
 
-	wl_list_insert_list(&output->feedback_list, &surface->feedback_list);
-	wl_list_init(&surface->feedback_list);
+			pnode = container_of(zpos->next,
+					     struct weston_paint_node,
+					     z_order_link);
+			if (pnode->view->view_list_layer != layer)
+				break;
+			zpos = zpos->next;
+
+			weston_paint_node_ensure_color_transform(pnode);
+		}
+	}
 }
 
+/* Only the layers marked with view_list_dirty get their views listed
+ * again, the views of all other layers keep their place in the view list
+ * and the z-order lists, which are patched in place. This relies on a
+ * clean layer keeping its views, and its position in the layer list.
+ */
 static void
-weston_output_put_back_feedback_list(struct weston_output *output)
+weston_compositor_update_view_list(struct weston_compositor *compositor)
 {
-	struct weston_presentation_feedback *feedback, *tmp;
+	struct weston_output *output;
+	struct weston_paint_node *pnode, *pntmp;
+	struct weston_view *view, *tmp;
+	struct weston_layer *layer;
+	struct wl_list *pos = &compositor->view_list;
 
-	if (wl_list_empty(&output->feedback_list))
-		return;
+	/* A view can move between two dirty layers, so take all of them
+	 * out first. */
+	wl_list_for_each(output, &compositor->output_list, link) {
+		wl_list_for_each_safe(pnode, pntmp,
+				      &output->paint_node_z_order_list,
+				      z_order_link) {
+			if (!view_in_dirty_layer(pnode->view))
+				continue;
 
-	wl_list_for_each_safe(feedback, tmp, &output->feedback_list, link) {
-		wl_list_remove(&feedback->link);
+			wl_list_remove(&pnode->z_order_link);
+			wl_list_init(&pnode->z_order_link);
+			output->paint_node_z_order_dirty = true;
+		}
+	}
+
+	wl_list_for_each_safe(view, tmp, &compositor->view_list, link) {
+		if (!view_in_dirty_layer(view))
+			continue;
+
+		wl_list_remove(&view->link);
+		wl_list_init(&view->link);
+		view->view_list_layer = NULL;
+	}
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if (layer->view_list_dirty) {
+			wl_list_for_each(view, &layer->view_list.link,
+					 layer_link.link)
+				pos = view_list_add(pos, layer, view);
+			continue;
+		}
+
+		while (pos->next != &compositor->view_list) {
+			view = container_of(pos->next, struct weston_view, link);
+			if (view->view_list_layer != layer)
+				break;
+			pos = pos->next;
+		}
+	}
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		weston_output_update_z_order_list(compositor, output);
+
+	wl_list_for_each(layer, &compositor->layer_list, link)
+		layer->view_list_dirty = false;
+
+	compositor->view_list_needs_update = false;
+	compositor->pick_index_dirty = true;
+}
+
+/* Note the last content commit of the surface as part of the frame being
+ * repainted, unless an earlier repaint took it already. The surface commit
+ * and frame callback times are kept, to tell client delays apart from
+ * compositor ones in weston_output_trace_commits(). */
+static void
+paint_node_latch_commit(struct weston_paint_node *pnode)
+{
+	struct weston_surface *surface = pnode->surface;
+
+	if (surface->commit_seq == surface->repainted_commit_seq)
+		return;
+
+	surface->repainted_commit_seq = surface->commit_seq;
+	pnode->commit_pending = true;
+	pnode->commit_seq = surface->commit_seq;
+	pnode->commit_time = surface->commit_time;
+	pnode->commit_client_nsec = 0;
+	if (!timespec_is_zero(&surface->frame_callback_time))
+		pnode->commit_client_nsec =
+			MAX(timespec_sub_to_nsec(&surface->commit_time,
+						 &surface->frame_callback_time),
+			    0);
+}
+
+/* Account for the surface commits that went into a presented frame, per
+ * surface on the timeline and per client in the client accounting */
+static void
+weston_output_trace_commits(struct weston_output *output,
+			    const struct timespec *stamp)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_paint_node *pnode;
+
+	wl_list_for_each(pnode, &output->paint_node_list, output_link) {
+		struct weston_timeline_commit commit = {};
+		struct wl_client *client = NULL;
+		int64_t latency;
+		pid_t pid;
+
+		if (!pnode->commit_pending)
+			continue;
+
+		pnode->commit_pending = false;
+		if (!stamp)
+			continue;
+
+		latency = timespec_sub_to_nsec(stamp, &pnode->commit_time);
+		weston_metric_observe(compositor,
+				      WESTON_METRIC_HIST_COMMIT_TO_PRESENT_USEC,
+				      latency);
+
+		if (pnode->surface->resource)
+			client = wl_resource_get_client(pnode->surface->resource);
+		if (client) {
+			weston_client_account_present(compositor, client,
+						      latency);
+			wl_client_get_credentials(client, &pid, NULL, NULL);
+			commit.pid = pid;
+		}
+
+		commit.seq = pnode->commit_seq;
+		commit.client_nsec = pnode->commit_client_nsec;
+		commit.queue_nsec =
+			timespec_sub_to_nsec(&output->repaint_start_time,
+					     &pnode->commit_time);
+		commit.repaint_nsec =
+			timespec_sub_to_nsec(&output->repaint_posted_time,
+					     &output->repaint_start_time);
+		commit.present_nsec =
+			timespec_sub_to_nsec(stamp,
+					     &output->repaint_posted_time);
+		TL_POINT(compositor, "core_commit_presented",
+			 TLP_SURFACE(pnode->surface), TLP_OUTPUT(output),
+			 TLP_COMMIT(&commit), TLP_END);
+	}
+}
+
+static void
+weston_output_take_feedback_list(struct weston_output *output,
+				 struct weston_surface *surface)
+{
+	struct weston_presentation_feedback *feedback;
+	struct weston_paint_node *pnode;
+	uint32_t flags = 0xffffffff;
+
+	if (wl_list_empty(&surface->feedback_list))
+		return;
+
+	/* All views must have the flag for the flag to survive. */
+	wl_list_for_each(pnode, &surface->paint_node_list, surface_link) {
+		/* ignore views that are not on this output at all */
+		if (pnode->output != output)
+			continue;
+		flags &= pnode->psf_flags;
+	}
+
+	wl_list_for_each(feedback, &surface->feedback_list, link)
+		feedback->psf_flags = flags;
+
+	wl_list_insert_list(&output->feedback_list, &surface->feedback_list);
+	wl_list_init(&surface->feedback_list);
+}
+
+static void
+weston_output_put_back_feedback_list(struct weston_output *output)
+{
+	struct weston_presentation_feedback *feedback, *tmp;
+
+	if (wl_list_empty(&output->feedback_list))
+		return;
+
+	wl_list_for_each_safe(feedback, tmp, &output->feedback_list, link) {
+		wl_list_remove(&feedback->link);
 		wl_list_insert(&feedback->surface->feedback_list,
 			       &feedback->link);
 	}
@@ -3676,10 +4768,13 @@ weston_output_flush_damage_for_plane(struct weston_output *output,
 				     pixman_region32_t *damage)
 {
 	struct weston_paint_node *pnode;
+	struct weston_paint_node **nodes;
+	unsigned int n_nodes, i;
 	bool changed = false;
 
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
 		if (pnode->plane != plane) {
 			if (plane != &output->primary_plane)
 				continue;
@@ -3702,6 +4797,13 @@ weston_output_flush_damage_for_plane(struct weston_output *output,
 	return changed;
 }
 
+static pixman_region32_t *
+output_damage_history_slot(struct weston_output *output, uint64_t frame_seq)
+{
+	return &output->damage_history.damage[frame_seq %
+					      WESTON_OUTPUT_DAMAGE_HISTORY];
+}
+
 WL_EXPORT void
 weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 					     pixman_region32_t *damage)
@@ -3714,44 +4816,324 @@ weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 		pixman_region32_copy(damage, &output->region);
 		output->full_repaint_needed = false;
 	}
+
+	output->damage_history.frame_seq++;
+	pixman_region32_copy(output_damage_history_slot(output,
+				output->damage_history.frame_seq), damage);
+}
+
+/** Get the sequence number of the last repaint of an output
+ *
+ * \param output The output.
+ * \return The number of times the primary plane damage was flushed.
+ *
+ * Pass this to weston_output_get_damage_since() later to get what the
+ * repaints in between changed.
+ */
+WL_EXPORT uint64_t
+weston_output_get_frame_seq(struct weston_output *output)
+{
+	return output->damage_history.frame_seq;
+}
+
+/** Get the damage of an output since a given repaint
+ *
+ * \param output The output.
+ * \param frame_seq A value weston_output_get_frame_seq() returned.
+ * \param damage Set to the damage, in global coordinates.
+ * \return False if the repaint is too old to be remembered, in which case
+ * \c damage is the whole output.
+ *
+ * The damage of the last WESTON_OUTPUT_DAMAGE_HISTORY repaints is kept,
+ * so that any number of consumers can each ask for what changed since
+ * they last looked, without accumulating damage of their own.
+ */
+WL_EXPORT bool
+weston_output_get_damage_since(struct weston_output *output,
+			       uint64_t frame_seq,
+			       pixman_region32_t *damage)
+{
+	uint64_t seq = output->damage_history.frame_seq;
+
+	if (seq - frame_seq > WESTON_OUTPUT_DAMAGE_HISTORY) {
+		pixman_region32_copy(damage, &output->region);
+		return false;
+	}
+
+	pixman_region32_clear(damage);
+	for (frame_seq++; frame_seq <= seq; frame_seq++) {
+		pixman_region32_union(damage, damage,
+				      output_damage_history_slot(output,
+								 frame_seq));
+	}
+
+	return true;
 }
 
 WL_EXPORT void
 weston_output_schedule_repaint_reset(struct weston_output *output)
 {
+	output->repaint_timing.target_valid = false;
+	output->repaint_timing.pending = false;
+	output->frame_clock_held = false;
+	output->frame_clock_released = false;
 	weston_output_put_back_feedback_list(output);
 	output->repaint_status = REPAINT_NOT_SCHEDULED;
 	TL_POINT(output->compositor, "core_repaint_exit_loop",
 		 TLP_OUTPUT(output), TLP_END);
 }
 
+static int
+occluded_frame_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+
+	ec->occluded_frame_timer_armed = false;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!output->occluded_frames_held)
+			continue;
+
+		output->occluded_frames_held = false;
+		weston_output_schedule_repaint(output);
+	}
+
+	return 0;
+}
+
+/* Whether an occluded surface is due its frame callbacks in this repaint.
+ * If it waits for some but is not due yet, make sure there is a repaint
+ * when it is, even if nothing visible changes until then.
+ */
+static bool
+occluded_frame_is_due(struct weston_output *output,
+		      struct weston_surface *surface,
+		      const struct timespec *now)
+{
+	struct weston_compositor *ec = output->compositor;
+	int64_t interval_nsec, elapsed_nsec, delay_msec;
+
+	if (ec->occluded_frame_policy != WESTON_OCCLUDED_FRAME_THROTTLE ||
+	    wl_list_empty(&surface->frame_callback_list))
+		return false;
+
+	interval_nsec = (int64_t)ec->occluded_frame_interval_ms * 1000000;
+	elapsed_nsec = timespec_sub_to_nsec(now, &surface->frame_callback_time);
+	if (elapsed_nsec >= interval_nsec)
+		return true;
+
+	output->occluded_frames_held = true;
+	if (!ec->occluded_frame_timer_armed) {
+		delay_msec = (interval_nsec - elapsed_nsec) / 1000000;
+		wl_event_source_timer_update(ec->occluded_frame_timer,
+					     MAX(delay_msec, 1));
+		ec->occluded_frame_timer_armed = true;
+	}
+
+	return false;
+}
+
+/** Predict when the animation state set up after a repaint gets shown
+ *
+ * Animations step once the repaint has been submitted, so the frame that
+ * shows their new state is the one after the frame just submitted.
+ */
+static void
+weston_output_animation_time(struct weston_output *output,
+			     struct timespec *time)
+{
+	int64_t refresh_nsec = 0;
+
+	if (output->current_mode)
+		refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+
+	if (refresh_nsec <= 0 || output->repaint_immediate) {
+		*time = output->frame_time;
+		return;
+	}
+
+	if (output->repaint_timing.target_valid)
+		*time = output->repaint_timing.target_vblank;
+	else
+		timespec_add_nsec(time, &output->frame_time, refresh_nsec);
+
+	timespec_add_nsec(time, time, refresh_nsec);
+}
+
+/** Step all animations of an output in one pass
+ *
+ * All of them see the same timestamp, the predicted presentation time of
+ * the frame that shows the result, which keeps the pacing stable however
+ * late the repaint ran. The output keeps repainting while any animation
+ * is left, whether or not their steps caused damage on it.
+ */
+static void
+weston_output_run_animations(struct weston_output *output)
+{
+	struct weston_animation *animation, *next;
+	struct timespec time;
+
+	if (wl_list_empty(&output->animation_list))
+		return;
+
+	weston_output_animation_time(output, &time);
+
+	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
+		animation->frame_counter++;
+		animation->frame(animation, output, &time);
+	}
+
+	if (!wl_list_empty(&output->animation_list))
+		weston_output_schedule_repaint(output);
+}
+
+/* How long before the next vblank the repaint of an output should start */
+static int64_t
+output_repaint_window_nsec(struct weston_output *output, int32_t refresh_nsec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t window;
+
+	if (!compositor->repaint_adaptive || output->repaint_timing.frames == 0)
+		return (int64_t)compositor->repaint_msec * 1000000;
+
+	window = output->repaint_timing.duration_nsec +
+		 4 * output->repaint_timing.deviation_nsec +
+		 output->repaint_timing.slack_nsec +
+		 (int64_t)compositor->repaint_margin_usec * 1000;
+
+	return MIN(window, refresh_nsec);
+}
+
+/* The latest time a commit can arrive and still make it into the repaint
+ * after the one that is starting now */
+static bool
+output_predict_commit_deadline(struct weston_output *output,
+			       struct timespec *deadline,
+			       int32_t *refresh_nsec)
+{
+	if (!output->repaint_timing.target_valid || output->repaint_immediate)
+		return false;
+
+	*refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	timespec_add_nsec(deadline, &output->repaint_timing.target_vblank,
+			  *refresh_nsec -
+			  output_repaint_window_nsec(output, *refresh_nsec));
+
+	return true;
+}
+
+static void
+weston_surface_send_frame_deadline(struct weston_surface *surface,
+				   const struct timespec *deadline,
+				   int32_t refresh_nsec)
+{
+	struct wl_resource *resource;
+	uint32_t tv_sec_hi;
+	uint32_t tv_sec_lo;
+	uint32_t tv_nsec;
+
+	timespec_to_proto(deadline, &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+	wl_resource_for_each(resource, &surface->frame_timing_resource_list)
+		weston_surface_frame_timing_v1_send_deadline(resource,
+							     tv_sec_hi,
+							     tv_sec_lo,
+							     tv_nsec,
+							     refresh_nsec);
+}
+
+/* The content type of the surface with the largest visible area. Visible
+ * regions are those of the previous repaint, which is close enough for a
+ * hint that rarely changes. */
+static void
+weston_output_update_content_type(struct weston_output *output,
+				  struct weston_paint_node **nodes,
+				  unsigned int n_nodes)
+{
+	enum weston_content_type type = WESTON_CONTENT_TYPE_NONE;
+	int64_t largest = 0;
+	unsigned int i;
+
+	for (i = 0; i < n_nodes; i++) {
+		pixman_box32_t *boxes;
+		int64_t area = 0;
+		int n_boxes, j;
+
+		boxes = pixman_region32_rectangles(&nodes[i]->visible, &n_boxes);
+		for (j = 0; j < n_boxes; j++)
+			area += (int64_t)(boxes[j].x2 - boxes[j].x1) *
+				(boxes[j].y2 - boxes[j].y1);
+
+		if (area > largest) {
+			largest = area;
+			type = nodes[i]->surface->content_type;
+		}
+	}
+
+	output->content_type = type;
+}
+
 static int
 weston_output_repaint(struct weston_output *output, struct timespec *now)
 {
 	struct weston_compositor *ec = output->compositor;
 	struct weston_paint_node *pnode;
-	struct weston_animation *animation, *next;
+	struct weston_paint_node **nodes;
+	unsigned int n_nodes, i;
+	struct weston_seat *seat;
 	struct wl_resource *cb, *cnext;
 	struct wl_list frame_callback_list;
 	int r;
 	uint32_t frame_time_msec;
+	struct timespec deadline;
+	int32_t refresh_nsec = 0;
+	bool have_deadline;
 	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
+	struct timespec repaint_start = *now;
 
 	TL_POINT(ec, "core_repaint_begin", TLP_OUTPUT(output), TLP_END);
+	weston_frame_stats_repaint_begin(output, now);
+
+	/* Coalesced pointer, touch and tablet motion goes out once per
+	 * refresh. */
+	wl_list_for_each(seat, &ec->seat_list, link) {
+		struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+		struct weston_touch *touch = weston_seat_get_touch(seat);
+		struct weston_tablet_tool *tool;
+		struct weston_tablet *tablet;
+
+		if (pointer)
+			weston_pointer_flush_motion(pointer);
+		if (touch)
+			weston_touch_flush_motion(touch);
+
+		wl_list_for_each(tool, &seat->tablet_tool_list, link)
+			weston_tablet_tool_flush_motion(tool);
+		wl_list_for_each(tablet, &seat->tablet_list, link) {
+			wl_list_for_each(tool, &tablet->tool_list, link)
+				weston_tablet_tool_flush_motion(tool);
+		}
+	}
 
 	/* Rebuild the surface list and update surface transforms up front. */
-	if (ec->view_list_needs_rebuild)
+	if (ec->view_list_needs_rebuild ||
+	    (ec->view_list_needs_update && ec->view_list_full_rebuild))
 		weston_compositor_build_view_list(ec);
+	else if (ec->view_list_needs_update)
+		weston_compositor_update_view_list(ec);
 
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
 		assert(pnode->view->output_mask & (1u << pnode->output->id));
 		assert(pnode->output == output);
 	}
 
 	/* Find the highest protection desired for an output */
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
+
 		/*
 		 * The desired_protection of the output should be the
 		 * maximum of the desired_protection of the surfaces,
@@ -3764,15 +5146,16 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 
 	output->desired_protection = highest_requested;
 
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link)
-		paint_node_update_early(pnode);
+	weston_output_update_content_type(output, nodes, n_nodes);
+
+	for (i = 0; i < n_nodes; i++)
+		paint_node_update_early(nodes[i]);
 
 	if (output->assign_planes && !output->disable_planes) {
 		output->assign_planes(output);
 	} else {
-		wl_list_for_each(pnode, &output->paint_node_z_order_list,
-				 z_order_link) {
+		for (i = 0; i < n_nodes; i++) {
+			pnode = nodes[i];
 			weston_paint_node_move_to_plane(pnode, &output->primary_plane);
 			pnode->psf_flags = 0;
 		}
@@ -3780,9 +5163,9 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 
 	output_update_visibility(output);
 
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link)
-		paint_node_update_late(pnode);
+	output_clear_moves(output);
+	for (i = 0; i < n_nodes; i++)
+		paint_node_update_late(nodes[i]);
 
 	output_accumulate_damage(output);
 
@@ -3797,29 +5180,55 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 	weston_compositor_repick(ec);
 
 	frame_time_msec = timespec_to_msec(&output->frame_time);
+	have_deadline = output_predict_commit_deadline(output, &deadline,
+						       &refresh_nsec);
 
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(pnode, &output->paint_node_z_order_list,
-			 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		bool visible;
+
+		pnode = nodes[i];
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
 		if (pnode->surface->output != output)
 			continue;
 
+		/* Once shown, even occluded, the FIFO barrier clears with
+		 * the presentation of this frame. */
+		if (pnode->surface->fifo_barrier)
+			pnode->surface->fifo_barrier_latched = true;
+
 		/*
 		 * avoid adding pnode's frame callbacks/presented
 		 * feedback to the respective lists if pnode/surface is
-		 * occluded
+		 * occluded, unless the shell asked for occluded surfaces
+		 * to be throttled rather than held
 		 */
-		if (!pixman_region32_not_empty(&pnode->visible))
+		visible = pixman_region32_not_empty(&pnode->visible);
+		if (visible)
+			paint_node_latch_commit(pnode);
+		if (!visible && !occluded_frame_is_due(output, pnode->surface,
+						       now))
 			continue;
 
+		if (have_deadline &&
+		    !wl_list_empty(&pnode->surface->frame_callback_list))
+			weston_surface_send_frame_deadline(pnode->surface,
+							   &deadline,
+							   refresh_nsec);
+
 		wl_list_insert_list(&frame_callback_list,
 				    &pnode->surface->frame_callback_list);
 		wl_list_init(&pnode->surface->frame_callback_list);
+		pnode->surface->frame_callback_time = *now;
 
-		weston_output_take_feedback_list(output, pnode->surface);
+		/* Nothing of an occluded surface gets presented; its
+		 * feedback is discarded by the commit that follows. */
+		if (visible)
+			weston_output_take_feedback_list(output, pnode->surface);
 	}
 
 
@@ -3828,10 +5237,7 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 		wl_resource_destroy(cb);
 	}
 
-	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
-		animation->frame_counter++;
-		animation->frame(animation, output, &output->frame_time);
-	}
+	weston_output_run_animations(output);
 
 	weston_output_capture_info_repaint_done(output->capture_info);
 
@@ -3843,12 +5249,38 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 	 * take some time, re-read our clock as a courtesy to the next
 	 * output. */
 	weston_compositor_read_presentation_clock(ec, now);
-	if (r != 0)
+	output->repaint_start_time = repaint_start;
+	output->repaint_posted_time = *now;
+	weston_metric_inc(ec, WESTON_METRIC_OUTPUT_REPAINTS);
+	weston_metric_observe(ec, WESTON_METRIC_HIST_REPAINT_USEC,
+			      timespec_sub_to_nsec(now, &repaint_start));
+	if (r != 0) {
+		weston_metric_inc(ec, WESTON_METRIC_OUTPUT_REPAINT_FAILURES);
 		weston_output_schedule_repaint_reset(output);
+	}
 
 	return r;
 }
 
+/* A frame clock may hold a due repaint until the other nodes are ready */
+static bool
+output_frame_clock_ready(struct weston_output *output)
+{
+	struct weston_frame_clock *clock = output->frame_clock;
+
+	if (output->frame_clock_released) {
+		output->frame_clock_released = false;
+		return true;
+	}
+
+	if (!clock || !clock->ready || !output->repaint_timing.target_valid ||
+	    clock->ready(clock, output, &output->repaint_timing.target_vblank))
+		return true;
+
+	output->frame_clock_held = true;
+	return false;
+}
+
 static bool
 weston_output_check_repaint(struct weston_output *output, struct timespec *now)
 {
@@ -3856,7 +5288,8 @@ weston_output_check_repaint(struct weston_output *output, struct timespec *now)
 	int64_t msec_to_repaint;
 
 	/* We're not ready yet; come back to make a decision later. */
-	if (output->repaint_status != REPAINT_SCHEDULED)
+	if (output->repaint_status != REPAINT_SCHEDULED ||
+	    output->frame_clock_held)
 		return false;
 
 	msec_to_repaint = timespec_sub_to_msec(&output->next_repaint, now);
@@ -3884,7 +5317,7 @@ weston_output_check_repaint(struct weston_output *output, struct timespec *now)
 	if (output->destroying)
 		goto out;
 
-	return true;
+	return output_frame_clock_ready(output);
 
 out:
 	weston_output_schedule_repaint_reset(output);
@@ -3904,7 +5337,8 @@ output_repaint_timer_arm(struct weston_compositor *compositor)
 	wl_list_for_each(output, &compositor->output_list, link) {
 		int64_t msec_to_this;
 
-		if (output->repaint_status != REPAINT_SCHEDULED)
+		if (output->repaint_status != REPAINT_SCHEDULED ||
+		    output->frame_clock_held)
 			continue;
 
 		msec_to_this = timespec_sub_to_msec(&output->next_repaint,
@@ -3930,18 +5364,185 @@ output_repaint_timer_arm(struct weston_compositor *compositor)
 	wl_event_source_timer_update(compositor->repaint_timer, msec_to_next);
 }
 
-WL_EXPORT void
-weston_output_schedule_repaint_restart(struct weston_output *output)
+static int
+output_repaint_timer_handler(void *data);
+
+static void
+output_repaint_idle(void *data)
 {
-	assert(output->repaint_status == REPAINT_AWAITING_COMPLETION);
-	/* The device was busy so try again one frame later */
-	timespec_add_nsec(&output->next_repaint, &output->next_repaint,
-			  millihz_to_nsec(output->current_mode->refresh));
-	output->repaint_status = REPAINT_SCHEDULED;
-	TL_POINT(output->compositor, "core_repaint_restart",
-		 TLP_OUTPUT(output), TLP_END);
-	output_repaint_timer_arm(output->compositor);
-	weston_output_damage(output);
+	struct weston_compositor *compositor = data;
+
+	compositor->repaint_idle_source = NULL;
+	output_repaint_timer_handler(compositor);
+}
+
+/* Run the repaint handler for outputs which are due, without the minimum
+ * timer delay. It still runs from an idle callback, so the commits handled
+ * in the current dispatch all make it into the repaint. */
+static void
+output_repaint_now(struct weston_compositor *compositor)
+{
+	struct wl_event_loop *loop;
+
+	if (compositor->repaint_idle_source)
+		return;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	compositor->repaint_idle_source =
+		wl_event_loop_add_idle(loop, output_repaint_idle, compositor);
+}
+
+WL_EXPORT void
+weston_output_schedule_repaint_restart(struct weston_output *output)
+{
+	assert(output->repaint_status == REPAINT_AWAITING_COMPLETION);
+	/* The device was busy so try again one frame later */
+	timespec_add_nsec(&output->next_repaint, &output->next_repaint,
+			  millihz_to_nsec(output->current_mode->refresh));
+	timespec_add_nsec(&output->repaint_timing.target_vblank,
+			  &output->repaint_timing.target_vblank,
+			  millihz_to_nsec(output->current_mode->refresh));
+	output->repaint_timing.pending = false;
+	output->repaint_status = REPAINT_SCHEDULED;
+	TL_POINT(output->compositor, "core_repaint_restart",
+		 TLP_OUTPUT(output), TLP_END);
+	output_repaint_timer_arm(output->compositor);
+	weston_output_damage(output);
+}
+
+/** Pace the repaints of an output with an external frame clock
+ *
+ * \param output The output.
+ * \param clock The frame clock, or NULL to follow the vblanks alone again.
+ *
+ * The caller keeps ownership of the clock and must unset it before
+ * destroying it. A repaint held by the previous clock is let go.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_set_frame_clock(struct weston_output *output,
+			      struct weston_frame_clock *clock)
+{
+	output->frame_clock = clock;
+	weston_output_frame_clock_release(output);
+}
+
+/** Let a repaint held by weston_frame_clock::ready go
+ *
+ * \param output The output.
+ *
+ * Does nothing if the output is not waiting for its frame clock.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_frame_clock_release(struct weston_output *output)
+{
+	if (!output->frame_clock_held)
+		return;
+
+	output->frame_clock_held = false;
+	output->frame_clock_released = true;
+	output_repaint_now(output->compositor);
+}
+
+/* Weights of the newest sample in the smoothed repaint duration and its
+ * deviation, as powers of two. */
+#define REPAINT_DURATION_SHIFT 3
+#define REPAINT_DEVIATION_SHIFT 2
+
+static void
+output_repaint_timing_add_sample(struct weston_output *output,
+				 int64_t duration_nsec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t err;
+
+	if (output->repaint_timing.frames == 0) {
+		output->repaint_timing.duration_nsec = duration_nsec;
+		output->repaint_timing.deviation_nsec = duration_nsec / 2;
+	} else {
+		err = duration_nsec - output->repaint_timing.duration_nsec;
+		output->repaint_timing.duration_nsec +=
+			err >> REPAINT_DURATION_SHIFT;
+		if (err < 0)
+			err = -err;
+		output->repaint_timing.deviation_nsec +=
+			(err - output->repaint_timing.deviation_nsec) >>
+			REPAINT_DEVIATION_SHIFT;
+	}
+	output->repaint_timing.frames++;
+
+	if (output->repaint_timing.target_valid)
+		output->repaint_timing.pending = true;
+
+	if (weston_log_scope_is_enabled(compositor->repaint_debug)) {
+		weston_log_scope_printf(compositor->repaint_debug,
+					"[%s] repaint took %" PRId64 " us, "
+					"estimate %" PRId64 " +- %" PRId64 " us\n",
+					output->name, duration_nsec / 1000,
+					output->repaint_timing.duration_nsec / 1000,
+					output->repaint_timing.deviation_nsec / 1000);
+	}
+}
+
+/** Mark a repainted output as committed by its backend
+ *
+ * \param output The output, repainted in the current repaint sequence.
+ *
+ * Backends call this for outputs they commit before repaint_flush(), see
+ * weston_backend::repaint_output_done. The output no longer depends on the
+ * rest of the sequence: it is not reset should a later output fail, and
+ * its repaint duration ends here rather than at the final flush.
+ */
+WL_EXPORT void
+weston_output_repaint_flushed(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct timespec flushed;
+
+	assert(output->repainted);
+
+	if (output->repaint_flushed)
+		return;
+
+	output->repaint_flushed = true;
+	weston_compositor_read_presentation_clock(compositor, &flushed);
+	output_repaint_timing_add_sample(output,
+		timespec_sub_to_nsec(&flushed,
+				     &compositor->last_repaint_start));
+}
+
+struct weston_idle_task {
+	struct wl_list link; /* weston_compositor::idle_task_list */
+	char *name;
+	weston_idle_task_func_t func;
+	void *data;
+};
+
+static void
+idle_task_timer_arm(struct weston_compositor *compositor, uint32_t msec)
+{
+	if (!compositor->idle_task_timer)
+		return;
+
+	wl_event_source_timer_update(compositor->idle_task_timer, msec);
+	compositor->idle_task_timer_armed = msec != 0;
+}
+
+/* Start counting down to the idle tasks again, after they ran or after
+ * the compositor was woken up. Costs nothing while the timer is armed,
+ * so it is fine to call on every repaint. */
+static void
+idle_task_timer_rearm(struct weston_compositor *compositor)
+{
+	if (compositor->idle_task_timer_armed ||
+	    compositor->idle_task_delay_msec == 0 ||
+	    wl_list_empty(&compositor->idle_task_list))
+		return;
+
+	idle_task_timer_arm(compositor, compositor->idle_task_delay_msec);
 }
 
 static int
@@ -3955,6 +5556,7 @@ output_repaint_timer_handler(void *data)
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 	compositor->last_repaint_start = now;
+	idle_task_timer_rearm(compositor);
 
 	wl_list_for_each(output, &compositor->output_list, link) {
 		if (!weston_output_check_repaint(output, &now)) {
@@ -3988,10 +5590,24 @@ output_repaint_timer_handler(void *data)
 			ret = weston_output_repaint(output, &now);
 			if (ret)
 				break;
+
+			if (backend->repaint_output_done)
+				backend->repaint_output_done(backend, output);
 		}
 		if (ret == 0) {
 			if (backend->repaint_flush)
 				backend->repaint_flush(backend);
+
+			/* Unless committed early, outputs of a backend are
+			 * committed together, so each of them had to wait for
+			 * all of the repaints. */
+			wl_list_for_each(output, &compositor->output_list, link) {
+				if (output->backend != backend ||
+				    !output->repainted)
+					continue;
+
+				weston_output_repaint_flushed(output);
+			}
 		} else {
 			if (backend->repaint_cancel)
 				backend->repaint_cancel(backend);
@@ -4000,14 +5616,16 @@ output_repaint_timer_handler(void *data)
 				if (output->backend != backend)
 					continue;
 
-				if (output->repainted)
+				if (output->repainted && !output->repaint_flushed)
 					weston_output_schedule_repaint_reset(output);
 			}
 		}
 	}
 
-	wl_list_for_each(output, &compositor->output_list, link)
+	wl_list_for_each(output, &compositor->output_list, link) {
 		output->repainted = false;
+		output->repaint_flushed = false;
+	}
 
 	output_repaint_timer_arm(compositor);
 
@@ -4047,6 +5665,57 @@ convert_presentation_time_now(struct weston_compositor *compositor,
 	return target_stamp;
 }
 
+/* Extra repaint time granted per missed vblank, and how fast it decays
+ * again with frames that hit their vblank, as fractions of the refresh period
+ * and of the slack, in powers of two. */
+#define REPAINT_MISS_SLACK_SHIFT 4
+#define REPAINT_SLACK_DECAY_SHIFT 6
+
+static void
+output_repaint_timing_check_vblank(struct weston_output *output,
+				   const struct timespec *stamp,
+				   int32_t refresh_nsec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t late_nsec;
+
+	if (!output->repaint_timing.pending)
+		return;
+
+	output->repaint_timing.pending = false;
+
+	late_nsec = timespec_sub_to_nsec(stamp,
+					 &output->repaint_timing.target_vblank);
+	if (late_nsec < refresh_nsec / 2) {
+		output->repaint_timing.slack_nsec -=
+			output->repaint_timing.slack_nsec >>
+			REPAINT_SLACK_DECAY_SHIFT;
+		return;
+	}
+
+	output->repaint_timing.misses++;
+	weston_frame_stats_missed_vblank(output);
+	weston_metric_inc(output->compositor, WESTON_METRIC_MISSED_VBLANKS);
+	output->repaint_timing.slack_nsec += refresh_nsec >>
+					     REPAINT_MISS_SLACK_SHIFT;
+	if (output->repaint_timing.slack_nsec > refresh_nsec)
+		output->repaint_timing.slack_nsec = refresh_nsec;
+
+	if (weston_log_scope_is_enabled(compositor->repaint_debug)) {
+		weston_log_scope_printf(compositor->repaint_debug,
+					"[%s] missed vblank by %" PRId64 " us, "
+					"%" PRIu64 " of %" PRIu64 " frames "
+					"missed, slack now %" PRId64 " us\n",
+					output->name, late_nsec / 1000,
+					output->repaint_timing.misses,
+					output->repaint_timing.frames,
+					output->repaint_timing.slack_nsec / 1000);
+	}
+}
+
+static void
+weston_output_flush_commit_queues(struct weston_output *output);
+
 /**
  * \ingroup output
  */
@@ -4074,10 +5743,14 @@ weston_output_finish_frame(struct weston_output *output,
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 
+	weston_output_trace_commits(output, stamp);
+
 	/* If we haven't been supplied any timestamp at all, we don't have a
 	 * timebase to work against, so any delay just wastes time. Push a
 	 * repaint as soon as possible so we can get on with it. */
 	if (!stamp) {
+		weston_frame_stats_frame_done(output, NULL);
+		output->repaint_timing.target_valid = false;
 		output->next_repaint = now;
 		goto out;
 	}
@@ -4095,16 +5768,38 @@ weston_output_finish_frame(struct weston_output *output,
 						  presented_flags);
 
 	output->frame_time = *stamp;
-
-	/* If we're tearing just repaint right away */
-	if (presented_flags & WESTON_FINISH_FRAME_TEARING) {
+	weston_frame_stats_frame_done(output, stamp);
+
+	if (!(presented_flags & WP_PRESENTATION_FEEDBACK_INVALID))
+		output_repaint_timing_check_vblank(output, stamp, refresh_nsec);
+	output->repaint_timing.pending = false;
+
+	/* If we're tearing just repaint right away, and keep doing so
+	 * whenever new damage arrives until we stop tearing. */
+	output->repaint_immediate =
+		!!(presented_flags & WESTON_FINISH_FRAME_TEARING);
+	if (output->repaint_immediate) {
+		output->repaint_timing.target_valid = false;
 		output->next_repaint = now;
-		goto out;
+		weston_output_flush_commit_queues(output);
+		output->repaint_status = REPAINT_SCHEDULED;
+		if (output->repaint_needed)
+			output_repaint_now(compositor);
+		else
+			output_repaint_timer_arm(compositor);
+		return;
 	}
 
-	timespec_add_nsec(&output->next_repaint, stamp, refresh_nsec);
-	timespec_add_msec(&output->next_repaint, &output->next_repaint,
-			  -compositor->repaint_msec);
+	timespec_add_nsec(&output->repaint_timing.target_vblank, stamp,
+			  refresh_nsec);
+	if (output->frame_clock)
+		output->frame_clock->align(output->frame_clock, output,
+					   &output->repaint_timing.target_vblank,
+					   refresh_nsec);
+	output->repaint_timing.target_valid = true;
+	timespec_add_nsec(&output->next_repaint,
+			  &output->repaint_timing.target_vblank,
+			  -output_repaint_window_nsec(output, refresh_nsec));
 	msec_rel = timespec_sub_to_msec(&output->next_repaint, &now);
 
 	if (msec_rel < -1000 || msec_rel > 1000) {
@@ -4114,6 +5809,7 @@ weston_output_finish_frame(struct weston_output *output,
 				 "[%s] is abnormal: %lld msec\n",
 				 output->name, (long long) msec_rel);
 
+		output->repaint_timing.target_valid = false;
 		output->next_repaint = now;
 	}
 
@@ -4127,10 +5823,14 @@ weston_output_finish_frame(struct weston_output *output,
 			timespec_add_nsec(&output->next_repaint,
 					  &output->next_repaint,
 					  refresh_nsec);
+			timespec_add_nsec(&output->repaint_timing.target_vblank,
+					  &output->repaint_timing.target_vblank,
+					  refresh_nsec);
 		}
 	}
 
 out:
+	weston_output_flush_commit_queues(output);
 	output->repaint_status = REPAINT_SCHEDULED;
 	output_repaint_timer_arm(compositor);
 }
@@ -4141,6 +5841,8 @@ weston_output_repaint_failed(struct weston_output *output)
 {
 	weston_log("Clearing repaint status.\n");
 	assert(output->repaint_status == REPAINT_AWAITING_COMPLETION);
+	weston_metric_inc(output->compositor,
+			  WESTON_METRIC_OUTPUT_REPAINT_FAILURES);
 	output->repaint_status = REPAINT_NOT_SCHEDULED;
 }
 
@@ -4205,7 +5907,7 @@ weston_view_move_to_layer(struct weston_view *view,
 	if (layer == &view->layer_link)
 		return;
 
-	view->surface->compositor->view_list_needs_rebuild = true;
+	weston_view_dirty_view_list(view);
 
 	/* Damage the view's old region, and remove it from the layer. */
 	if (weston_view_is_mapped(view))
@@ -4224,6 +5926,7 @@ weston_view_move_to_layer(struct weston_view *view,
 	/* Add the view to the new layer and damage its new region. */
 	wl_list_insert(&layer->link, &view->layer_link.link);
 	view->layer_link.layer = layer->layer;
+	weston_view_dirty_view_list(view);
 
 	if (!visible)
 		return;
@@ -4262,6 +5965,10 @@ weston_layer_fini(struct weston_layer *layer)
 {
 	wl_list_remove(&layer->link);
 
+	/* Views may still point at the layer as the one they are listed
+	 * for, make sure nothing looks there anymore. */
+	layer->compositor->view_list_needs_rebuild = true;
+
 	if (!wl_list_empty(&layer->view_list.link))
 		weston_log("BUG: finalizing a layer with views still on it.\n");
 
@@ -4283,6 +5990,7 @@ weston_layer_set_position(struct weston_layer *layer,
 	struct weston_layer *below;
 
 	wl_list_remove(&layer->link);
+	weston_layer_dirty_view_list(layer);
 
 	/* layer_list is ordered from top to bottom, the last layer being the
 	 * background with the smallest position value */
@@ -4307,6 +6015,7 @@ weston_layer_unset_position(struct weston_layer *layer)
 {
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
+	weston_layer_dirty_view_list(layer);
 }
 
 WL_EXPORT void
@@ -4324,7 +6033,7 @@ weston_layer_set_mask(struct weston_layer *layer,
 		weston_view_geometry_dirty_internal(view);
 	}
 
-	layer->compositor->view_list_needs_rebuild = true;
+	weston_layer_dirty_view_list(layer);
 }
 
 WL_EXPORT void
@@ -4341,7 +6050,7 @@ weston_layer_set_mask_infinite(struct weston_layer *layer)
 		weston_view_geometry_dirty_internal(view);
 	}
 
-	layer->compositor->view_list_needs_rebuild = true;
+	weston_layer_dirty_view_list(layer);
 }
 
 WL_EXPORT bool
@@ -4375,6 +6084,20 @@ weston_output_schedule_repaint(struct weston_output *output)
 	loop = wl_display_get_event_loop(compositor->wl_display);
 	output->repaint_needed = true;
 
+	/* A tearing output does not wait for the next vblank, so there is
+	 * no need to restart the repaint loop to find it. */
+	if (output->repaint_immediate &&
+	    (output->repaint_status == REPAINT_NOT_SCHEDULED ||
+	     output->repaint_status == REPAINT_SCHEDULED)) {
+		if (output->repaint_status == REPAINT_NOT_SCHEDULED) {
+			weston_compositor_read_presentation_clock(compositor,
+								  &output->next_repaint);
+			output->repaint_status = REPAINT_SCHEDULED;
+		}
+		output_repaint_now(compositor);
+		return;
+	}
+
 	/* If we already have a repaint scheduled for our idle handler,
 	 * no need to set it again. If the repaint has been called but
 	 * not finished, then weston_output_finish_frame() will notice
@@ -4464,9 +6187,9 @@ surface_damage(struct wl_client *client,
 	if (width <= 0 || height <= 0)
 		return;
 
-	pixman_region32_union_rect(&surface->pending.damage_surface,
-				   &surface->pending.damage_surface,
-				   x, y, width, height);
+	region_union_rect_into(surface->compositor,
+			       &surface->pending.damage_surface,
+			       x, y, width, height);
 }
 
 static void
@@ -4479,14 +6202,15 @@ surface_damage_buffer(struct wl_client *client,
 	if (width <= 0 || height <= 0)
 		return;
 
-	pixman_region32_union_rect(&surface->pending.damage_buffer,
-				   &surface->pending.damage_buffer,
-				   x, y, width, height);
+	region_union_rect_into(surface->compositor,
+			       &surface->pending.damage_buffer,
+			       x, y, width, height);
 }
 
 static void
 destroy_frame_callback(struct wl_resource *resource)
 {
+	weston_client_account_frame_callback_gone(wl_resource_get_client(resource));
 	wl_list_remove(wl_resource_get_link(resource));
 }
 
@@ -4508,6 +6232,7 @@ surface_frame(struct wl_client *client,
 
 	wl_list_insert(surface->pending.frame_callback_list.prev,
 		       wl_resource_get_link(cb));
+	weston_client_account_frame_callback_added(surface->compositor, client);
 }
 
 static void
@@ -4567,11 +6292,30 @@ weston_surface_damage_subsurfaces(struct weston_subsurface *sub)
 			weston_surface_damage_subsurfaces(child);
 }
 
+static bool
+weston_surface_subsurface_order_changed(struct weston_surface *surface)
+{
+	struct wl_list *cur = surface->subsurface_list.next;
+	struct weston_subsurface *sub;
+
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (cur != &sub->parent_link)
+			return true;
+		cur = cur->next;
+	}
+
+	return false;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (weston_surface_subsurface_order_changed(surface))
+		weston_compositor_subsurface_tree_changed(surface->compositor);
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
@@ -4726,7 +6470,8 @@ apply_damage_buffer(pixman_region32_t *dest,
 		    struct weston_surface_state *state)
 {
 	struct weston_buffer *buffer = surface->buffer_ref.buffer;
-	pixman_region32_t buffer_damage;
+	struct weston_compositor *ec = surface->compositor;
+	pixman_region32_t *buffer_damage = &ec->commit_scratch[1];
 
 	/* wl_surface.damage_buffer needs to be clipped to the buffer,
 	 * translated into surface co-ordinates and unioned with
@@ -4737,16 +6482,12 @@ apply_damage_buffer(pixman_region32_t *dest,
 		return;
 
 
-	pixman_region32_intersect_rect(&state->damage_buffer,
-				       &state->damage_buffer,
-				       0, 0,
-				       buffer->width, buffer->height);
-	pixman_region32_init(&buffer_damage);
-	weston_matrix_transform_region(&buffer_damage,
+	region_intersect_rect_into(ec, &state->damage_buffer,
+				   0, 0, buffer->width, buffer->height);
+	weston_matrix_transform_region(buffer_damage,
 				       &surface->buffer_to_surface_matrix,
 				       &state->damage_buffer);
-	pixman_region32_union(dest, dest, &buffer_damage);
-	pixman_region32_fini(&buffer_damage);
+	region_union_into(ec, dest, buffer_damage);
 }
 
 static void
@@ -4779,10 +6520,13 @@ static enum weston_surface_status
 weston_surface_commit_state(struct weston_surface *surface,
 			    struct weston_surface_state *state)
 {
+	struct weston_compositor *ec = surface->compositor;
 	struct weston_view *view;
-	pixman_region32_t opaque;
+	pixman_region32_t *opaque = &ec->commit_scratch[1];
 	enum weston_surface_status status = state->status;
 
+	weston_metric_inc(ec, WESTON_METRIC_SURFACE_COMMITS);
+
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
 	/* wp_viewport.set_source */
@@ -4791,6 +6535,18 @@ weston_surface_commit_state(struct weston_surface *surface,
 
 	/* wl_surface.attach */
 	if (status & WESTON_SURFACE_DIRTY_BUFFER) {
+		/* wp_linux_drm_syncobj_surface_v1.set_acquire_point, held in
+		 * the commit queue until it materialized */
+		if (state->drm_syncobj_acquire) {
+			fd_update(&state->acquire_fence_fd,
+				  weston_drm_syncobj_acquire_export(
+					state->drm_syncobj_acquire));
+			if (state->acquire_fence_fd < 0)
+				weston_log("failed to export acquire point\n");
+			weston_drm_syncobj_acquire_destroy(
+				state->drm_syncobj_acquire);
+			state->drm_syncobj_acquire = NULL;
+		}
 		/* zwp_surface_synchronization_v1.set_acquire_fence */
 		fd_move(&surface->acquire_fence_fd,
 			&state->acquire_fence_fd);
@@ -4805,6 +6561,7 @@ weston_surface_commit_state(struct weston_surface *surface,
 	}
 	weston_surface_state_set_buffer(state, NULL);
 	assert(state->acquire_fence_fd == -1);
+	assert(state->drm_syncobj_acquire == NULL);
 	assert(state->buffer_release_ref.buffer_release == NULL);
 
 	if (status & WESTON_SURFACE_DIRTY_SIZE) {
@@ -4829,16 +6586,20 @@ weston_surface_commit_state(struct weston_surface *surface,
 	if (status & WESTON_SURFACE_DIRTY_BUFFER) {
 		TL_POINT(surface->compositor, "core_commit_damage",
 			TLP_SURFACE(surface), TLP_END);
+		weston_frame_stats_surface_commit(surface);
+		surface->commit_seq++;
+		weston_compositor_read_presentation_clock(ec,
+							  &surface->commit_time);
 
-		pixman_region32_union(&surface->damage, &surface->damage,
-				      &state->damage_surface);
+		region_move_into(ec, &surface->damage,
+				 &state->damage_surface);
 
 		apply_damage_buffer(&surface->damage, surface, state);
 
-		pixman_region32_intersect_rect(&surface->damage,
-					       &surface->damage,
-					       0, 0,
-					       surface->width, surface->height);
+		region_intersect_rect_into(ec, &surface->damage,
+					   0, 0,
+					   surface->width, surface->height);
+		region_coarsen_into(ec, &surface->damage);
 	}
 	pixman_region32_clear(&state->damage_buffer);
 	pixman_region32_clear(&state->damage_surface);
@@ -4846,18 +6607,15 @@ weston_surface_commit_state(struct weston_surface *surface,
 	/* wl_surface.set_opaque_region */
 	if (status & (WESTON_SURFACE_DIRTY_SIZE |
 		      WESTON_SURFACE_DIRTY_BUFFER_PARAMS)) {
-		pixman_region32_init(&opaque);
-		pixman_region32_intersect_rect(&opaque, &state->opaque,
+		pixman_region32_intersect_rect(opaque, &state->opaque,
 					       0, 0,
 					       surface->width, surface->height);
 
-		if (!pixman_region32_equal(&opaque, &surface->opaque)) {
-			pixman_region32_copy(&surface->opaque, &opaque);
+		if (!pixman_region32_equal(opaque, &surface->opaque)) {
+			region_swap(&surface->opaque, opaque);
 			wl_list_for_each(view, &surface->views, surface_link)
 				weston_view_geometry_dirty(view);
 		}
-
-		pixman_region32_fini(&opaque);
 	}
 
 	/* wl_surface.set_input_region */
@@ -4890,11 +6648,24 @@ weston_surface_commit_state(struct weston_surface *surface,
 	/* weston_protected_surface.set_type */
 	weston_surface_set_desired_protection(surface, state->desired_protection);
 
+	/* wp_content_type_v1.set_content_type */
+	surface->content_type = state->content_type;
+
 	/* color_management_surface_v1_interface.set_image_description or
 	 * color_management_surface_v1_interface.unset_image_description */
 	weston_surface_set_color_profile(surface, state->color_profile,
 					 state->render_intent);
 
+	/* wp_fifo_v1.set_barrier; nothing will present a surface that is
+	 * on no output, so it would never be cleared there */
+	if (state->fifo_barrier && surface->output) {
+		surface->fifo_barrier = true;
+		surface->fifo_barrier_latched = false;
+	}
+	state->fifo_barrier = false;
+	state->fifo_wait = false;
+	state->has_commit_target = false;
+
 	wl_signal_emit(&surface->commit_signal, surface);
 
 	/* Surface is now quiescent */
@@ -4923,112 +6694,451 @@ weston_surface_commit(struct weston_surface *surface)
 static enum weston_surface_status
 weston_subsurface_commit(struct weston_subsurface *sub);
 
+static enum weston_surface_status
+weston_subsurface_commit_from_cache(struct weston_subsurface *sub);
+
 static enum weston_surface_status
 weston_subsurface_parent_commit(struct weston_subsurface *sub,
 				int parent_is_synchronized);
 
+static bool
+weston_subsurface_is_synchronized(struct weston_subsurface *sub);
+
 static void
-surface_commit(struct wl_client *client, struct wl_resource *resource)
+weston_surface_state_merge(struct weston_surface *surface,
+			   struct weston_surface_state *src,
+			   struct weston_surface_state *dst,
+			   struct weston_buffer_reference *buffer_ref);
+
+/** A commit held back by wp_fifo_v1 or wp_commit_timer_v1 */
+struct weston_commit_queue_entry {
+	struct wl_list link; /* weston_surface::commit_queue */
+	struct weston_surface_state state;
+	struct weston_buffer_reference buffer_ref;
+};
+
+static void
+weston_commit_queue_entry_destroy(struct weston_commit_queue_entry *entry)
 {
-	struct weston_surface *surface = wl_resource_get_user_data(resource);
-	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
-	enum weston_surface_status status;
+	weston_buffer_reference(&entry->buffer_ref, NULL,
+				BUFFER_WILL_NOT_BE_ACCESSED);
+	weston_surface_state_fini(&entry->state);
+	wl_list_remove(&entry->link);
+	free(entry);
+}
 
-	if (!weston_surface_is_pending_viewport_source_valid(surface)) {
-		assert(surface->viewport_resource);
+static void
+weston_surface_discard_commit_queue(struct weston_surface *surface)
+{
+	struct weston_commit_queue_entry *entry, *tmp;
 
-		wl_resource_post_error(surface->viewport_resource,
-			WP_VIEWPORT_ERROR_OUT_OF_BUFFER,
-			"wl_surface@%d has viewport source outside buffer",
-			wl_resource_get_id(resource));
-		return;
-	}
+	wl_list_for_each_safe(entry, tmp, &surface->commit_queue, link)
+		weston_commit_queue_entry_destroy(entry);
 
-	if (!weston_surface_is_pending_viewport_dst_size_int(surface)) {
-		assert(surface->viewport_resource);
+	wl_list_remove(&surface->commit_queue_link);
+	wl_list_init(&surface->commit_queue_link);
+}
 
-		wl_resource_post_error(surface->viewport_resource,
-			WP_VIEWPORT_ERROR_BAD_SIZE,
-			"wl_surface@%d viewport dst size not integer",
-			wl_resource_get_id(resource));
+static void
+commit_queue_timer_arm(struct weston_compositor *ec,
+		       const struct timespec *when)
+{
+	struct timespec now;
+	int64_t msec;
+
+	if (ec->commit_queue_timer_armed &&
+	    timespec_sub_to_nsec(when, &ec->commit_queue_timer_deadline) >= 0)
 		return;
-	}
 
-	if (surface->pending.acquire_fence_fd >= 0) {
-		assert(surface->synchronization_resource);
+	weston_compositor_read_presentation_clock(ec, &now);
+	msec = timespec_sub_to_msec(when, &now);
+	wl_event_source_timer_update(ec->commit_queue_timer, MAX(msec, 1));
+	ec->commit_queue_timer_deadline = *when;
+	ec->commit_queue_timer_armed = true;
+}
 
-		if (!surface->pending.buffer) {
-			fd_clear(&surface->pending.acquire_fence_fd);
-			wl_resource_post_error(surface->synchronization_resource,
-				ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
-				"wl_surface@%"PRIu32" no buffer for synchronization",
-				wl_resource_get_id(resource));
-			return;
-		}
+/* Whether a held commit still waits for its acquire point to materialize */
+static bool
+weston_surface_state_awaits_acquire(struct weston_surface_state *state)
+{
+	return state->drm_syncobj_acquire &&
+	       !weston_drm_syncobj_acquire_is_ready(state->drm_syncobj_acquire);
+}
 
-		if (surface->pending.buffer->type == WESTON_BUFFER_SHM) {
-			fd_clear(&surface->pending.acquire_fence_fd);
-			wl_resource_post_error(surface->synchronization_resource,
-				ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_UNSUPPORTED_BUFFER,
-				"wl_surface@%"PRIu32" unsupported buffer for synchronization",
-				wl_resource_get_id(resource));
-			return;
-		}
-	}
+/* Whether the commit that is pending on the surface has to wait, either
+ * for earlier held commits, for its acquire point, for the FIFO barrier or
+ * for its target time. Synchronized sub-surfaces are paced by their
+ * parent's commits instead, but not before their content is ready.
+ */
+static bool
+weston_surface_commit_is_held(struct weston_surface *surface,
+			      struct weston_subsurface *sub)
+{
+	struct weston_surface_state *state = &surface->pending;
+	struct timespec now;
 
-	if (surface->pending.buffer_release_ref.buffer_release &&
-	    !surface->pending.buffer) {
-		assert(surface->synchronization_resource);
+	if (!wl_list_empty(&surface->commit_queue))
+		return true;
 
-		wl_resource_post_error(surface->synchronization_resource,
-			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
-			"wl_surface@%"PRIu32" no buffer for synchronization",
-			wl_resource_get_id(resource));
-		return;
-	}
+	if (weston_surface_state_awaits_acquire(state))
+		return true;
 
-	if (sub) {
-		status = weston_subsurface_commit(sub);
-	} else {
-		status = WESTON_SURFACE_CLEAN;
-		wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
-			if (sub->surface != surface)
-				status |= weston_subsurface_parent_commit(sub, 0);
-		}
-		status |= weston_surface_commit(surface);
+	if (sub && (sub->has_cached_data ||
+		    weston_subsurface_is_synchronized(sub)))
+		return false;
+
+	if (state->fifo_wait && surface->fifo_barrier)
+		return true;
+
+	if (state->has_commit_target) {
+		weston_compositor_read_presentation_clock(surface->compositor,
+							  &now);
+		return timespec_sub_to_nsec(&state->commit_target, &now) > 0;
 	}
 
-	if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
-		surface->compositor->view_list_needs_rebuild = true;
+	return false;
 }
 
 static void
-surface_set_buffer_transform(struct wl_client *client,
-			     struct wl_resource *resource, int transform)
+weston_surface_queue_commit(struct weston_surface *surface)
 {
-	struct weston_surface *surface = wl_resource_get_user_data(resource);
+	struct weston_compositor *ec = surface->compositor;
+	struct weston_commit_queue_entry *entry;
+	struct timespec now;
 
-	/* if wl_output.transform grows more members this will need to be updated. */
-	if (transform < 0 ||
-	    transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
-		wl_resource_post_error(resource,
-			WL_SURFACE_ERROR_INVALID_TRANSFORM,
-			"buffer transform must be a valid transform "
-			"('%d' specified)", transform);
+	entry = xzalloc(sizeof *entry);
+	weston_surface_state_init(surface, &entry->state);
+	entry->state.fifo_barrier = surface->pending.fifo_barrier;
+	entry->state.fifo_wait = surface->pending.fifo_wait;
+	entry->state.has_commit_target = surface->pending.has_commit_target;
+	entry->state.commit_target = surface->pending.commit_target;
+	weston_surface_state_merge(surface, &surface->pending, &entry->state,
+				   &entry->buffer_ref);
+
+	if (wl_list_empty(&surface->commit_queue))
+		wl_list_insert(&ec->commit_queue_list,
+			       &surface->commit_queue_link);
+	wl_list_insert(surface->commit_queue.prev, &entry->link);
+
+	/* The acquire point wakes the queue once it materializes. Otherwise
+	 * the repaint loop of the surface's output decides when the commit
+	 * is due; without an output only the target time matters. */
+	if (weston_surface_state_awaits_acquire(&entry->state)) {
 		return;
+	} else if (surface->output) {
+		weston_output_schedule_repaint(surface->output);
+	} else if (entry->state.has_commit_target) {
+		commit_queue_timer_arm(ec, &entry->state.commit_target);
+	} else {
+		weston_compositor_read_presentation_clock(ec, &now);
+		commit_queue_timer_arm(ec, &now);
 	}
-
-	surface->pending.buffer_viewport.buffer.transform = transform;
-	surface->pending.status |= WESTON_SURFACE_DIRTY_SIZE;
 }
 
 static void
-surface_set_buffer_scale(struct wl_client *client,
-			 struct wl_resource *resource,
-			 int32_t scale)
+weston_surface_apply_queued_commit(struct weston_surface *surface,
+				   struct weston_commit_queue_entry *entry)
 {
-	struct weston_surface *surface = wl_resource_get_user_data(resource);
-
+	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
+	struct weston_subsurface *child;
+	enum weston_surface_status status = WESTON_SURFACE_CLEAN;
+
+	/* Only held for its acquire point; it goes where the commit would
+	 * have gone, see weston_subsurface_commit(). */
+	if (sub && weston_subsurface_is_synchronized(sub)) {
+		weston_surface_state_merge(surface, &entry->state,
+					   &sub->cached,
+					   &sub->cached_buffer_ref);
+		sub->has_cached_data = 1;
+		weston_commit_queue_entry_destroy(entry);
+		return;
+	}
+
+	wl_list_for_each(child, &surface->subsurface_list, parent_link) {
+		if (child->surface != surface)
+			status |= weston_subsurface_parent_commit(child, 0);
+	}
+
+	if (sub && sub->has_cached_data) {
+		weston_surface_state_merge(surface, &entry->state,
+					   &sub->cached,
+					   &sub->cached_buffer_ref);
+		weston_commit_queue_entry_destroy(entry);
+		status |= weston_subsurface_commit_from_cache(sub);
+	} else {
+		status |= weston_surface_commit_state(surface, &entry->state);
+		weston_commit_queue_entry_destroy(entry);
+
+		if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
+			weston_surface_commit_subsurface_order(surface);
+
+		weston_surface_schedule_repaint(surface);
+	}
+
+	if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
+		weston_surface_dirty_view_list(surface);
+}
+
+/* Apply the held commits of a surface that are due for a frame presented
+ * at the given time, in order. A target time counts as reached by the
+ * vblank nearest to it.
+ */
+static void
+weston_surface_flush_commit_queue(struct weston_surface *surface,
+				  const struct timespec *present,
+				  int32_t refresh_nsec)
+{
+	struct weston_commit_queue_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &surface->commit_queue, link) {
+		if (weston_surface_state_awaits_acquire(&entry->state))
+			break;
+
+		if (entry->state.fifo_wait && surface->fifo_barrier)
+			break;
+
+		if (entry->state.has_commit_target &&
+		    timespec_sub_to_nsec(&entry->state.commit_target,
+					 present) > refresh_nsec / 2)
+			break;
+
+		weston_surface_apply_queued_commit(surface, entry);
+	}
+
+	if (wl_list_empty(&surface->commit_queue)) {
+		wl_list_remove(&surface->commit_queue_link);
+		wl_list_init(&surface->commit_queue_link);
+	}
+}
+
+/* Called when an output has finished a frame and knows the target vblank
+ * of the next one: clear the FIFO barriers it has just presented, apply
+ * the held commits that are due for the next frame and make sure the
+ * repaint loop comes back for the remaining ones.
+ */
+static void
+weston_output_flush_commit_queues(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_paint_node *pnode;
+	struct weston_surface *surface, *tmp;
+	struct weston_commit_queue_entry *entry;
+	struct timespec present, wake;
+	int32_t refresh_nsec;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		if (!pnode->surface->fifo_barrier_latched)
+			continue;
+
+		pnode->surface->fifo_barrier = false;
+		pnode->surface->fifo_barrier_latched = false;
+	}
+
+	if (wl_list_empty(&ec->commit_queue_list))
+		return;
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	if (output->repaint_timing.target_valid)
+		present = output->repaint_timing.target_vblank;
+	else
+		weston_compositor_read_presentation_clock(ec, &present);
+
+	wl_list_for_each_safe(surface, tmp, &ec->commit_queue_list,
+			      commit_queue_link) {
+		if (surface->output != output)
+			continue;
+
+		weston_surface_flush_commit_queue(surface, &present,
+						  refresh_nsec);
+		if (wl_list_empty(&surface->commit_queue))
+			continue;
+
+		/* A barrier gets cleared by presenting a frame, and a
+		 * target one frame out is due in the next one. Anything
+		 * further out does not need the output to keep going, nor
+		 * does an acquire point, which wakes the queues itself. */
+		entry = container_of(surface->commit_queue.next,
+				     struct weston_commit_queue_entry, link);
+		if (weston_surface_state_awaits_acquire(&entry->state))
+			continue;
+
+		if (!entry->state.has_commit_target ||
+		    (entry->state.fifo_wait && surface->fifo_barrier) ||
+		    timespec_sub_to_nsec(&entry->state.commit_target,
+					 &present) <= refresh_nsec * 3 / 2) {
+			weston_output_schedule_repaint(output);
+			continue;
+		}
+
+		timespec_add_nsec(&wake, &entry->state.commit_target,
+				  -2 * (int64_t)refresh_nsec);
+		commit_queue_timer_arm(ec, &wake);
+	}
+}
+
+static int
+commit_queue_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_surface *surface, *tmp;
+	struct weston_commit_queue_entry *entry;
+	struct timespec now;
+
+	ec->commit_queue_timer_armed = false;
+	weston_compositor_read_presentation_clock(ec, &now);
+
+	wl_list_for_each_safe(surface, tmp, &ec->commit_queue_list,
+			      commit_queue_link) {
+		if (surface->output) {
+			weston_output_schedule_repaint(surface->output);
+			continue;
+		}
+
+		/* Nothing presents a surface without an output, so nothing
+		 * would ever clear its barrier. */
+		surface->fifo_barrier = false;
+		weston_surface_flush_commit_queue(surface, &now, 0);
+		if (wl_list_empty(&surface->commit_queue))
+			continue;
+
+		entry = container_of(surface->commit_queue.next,
+				     struct weston_commit_queue_entry, link);
+		if (weston_surface_state_awaits_acquire(&entry->state))
+			continue;
+
+		commit_queue_timer_arm(ec, &entry->state.commit_target);
+	}
+
+	return 0;
+}
+
+/** Have the held commits looked at again as soon as possible
+ *
+ * Called when the acquire point of a held commit has materialized.
+ */
+void
+weston_compositor_wake_commit_queues(struct weston_compositor *ec)
+{
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	commit_queue_timer_arm(ec, &now);
+}
+
+static void
+surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
+	enum weston_surface_status status;
+
+	weston_client_account_commit(surface->compositor, client);
+
+	if (!weston_surface_is_pending_viewport_source_valid(surface)) {
+		assert(surface->viewport_resource);
+
+		wl_resource_post_error(surface->viewport_resource,
+			WP_VIEWPORT_ERROR_OUT_OF_BUFFER,
+			"wl_surface@%d has viewport source outside buffer",
+			wl_resource_get_id(resource));
+		return;
+	}
+
+	if (!weston_surface_is_pending_viewport_dst_size_int(surface)) {
+		assert(surface->viewport_resource);
+
+		wl_resource_post_error(surface->viewport_resource,
+			WP_VIEWPORT_ERROR_BAD_SIZE,
+			"wl_surface@%d viewport dst size not integer",
+			wl_resource_get_id(resource));
+		return;
+	}
+
+	if (surface->pending.acquire_fence_fd >= 0) {
+		assert(surface->synchronization_resource);
+
+		if (!surface->pending.buffer) {
+			fd_clear(&surface->pending.acquire_fence_fd);
+			wl_resource_post_error(surface->synchronization_resource,
+				ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
+				"wl_surface@%"PRIu32" no buffer for synchronization",
+				wl_resource_get_id(resource));
+			return;
+		}
+
+		if (surface->pending.buffer->type == WESTON_BUFFER_SHM) {
+			fd_clear(&surface->pending.acquire_fence_fd);
+			wl_resource_post_error(surface->synchronization_resource,
+				ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_UNSUPPORTED_BUFFER,
+				"wl_surface@%"PRIu32" unsupported buffer for synchronization",
+				wl_resource_get_id(resource));
+			return;
+		}
+	}
+
+	if (surface->pending.buffer_release_ref.buffer_release &&
+	    !surface->pending.buffer) {
+		assert(surface->synchronization_resource);
+
+		wl_resource_post_error(surface->synchronization_resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
+			"wl_surface@%"PRIu32" no buffer for synchronization",
+			wl_resource_get_id(resource));
+		return;
+	}
+
+	if (surface->drm_syncobj &&
+	    !weston_drm_syncobj_surface_commit(surface->drm_syncobj))
+		return;
+
+	if (weston_surface_commit_is_held(surface, sub)) {
+		weston_surface_queue_commit(surface);
+		return;
+	}
+
+	if (sub) {
+		status = weston_subsurface_commit(sub);
+	} else {
+		status = WESTON_SURFACE_CLEAN;
+		wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
+			if (sub->surface != surface)
+				status |= weston_subsurface_parent_commit(sub, 0);
+		}
+		status |= weston_surface_commit(surface);
+	}
+
+	if (status & WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG)
+		weston_surface_dirty_view_list(surface);
+}
+
+static void
+surface_set_buffer_transform(struct wl_client *client,
+			     struct wl_resource *resource, int transform)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	/* if wl_output.transform grows more members this will need to be updated. */
+	if (transform < 0 ||
+	    transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+		wl_resource_post_error(resource,
+			WL_SURFACE_ERROR_INVALID_TRANSFORM,
+			"buffer transform must be a valid transform "
+			"('%d' specified)", transform);
+		return;
+	}
+
+	surface->pending.buffer_viewport.buffer.transform = transform;
+	surface->pending.status |= WESTON_SURFACE_DIRTY_SIZE;
+}
+
+static void
+surface_set_buffer_scale(struct wl_client *client,
+			 struct wl_resource *resource,
+			 int32_t scale)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
 	if (scale < 1) {
 		wl_resource_post_error(resource,
 			WL_SURFACE_ERROR_INVALID_SCALE,
@@ -5084,9 +7194,12 @@ compositor_create_surface(struct wl_client *client,
 	struct weston_compositor *ec = wl_resource_get_user_data(resource);
 	struct weston_surface *surface;
 
+	if (!weston_client_account_surface_created(ec, client))
+		goto err;
+
 	surface = weston_surface_create(ec);
 	if (surface == NULL)
-		goto err;
+		goto err_surface;
 
 	surface->resource =
 		wl_resource_create(client, &wl_surface_interface,
@@ -5102,6 +7215,8 @@ compositor_create_surface(struct wl_client *client,
 
 err_res:
 	weston_surface_unref(surface);
+err_surface:
+	weston_client_account_surface_destroyed(client);
 err:
 	wl_resource_post_no_memory(resource);
 }
@@ -5198,84 +7313,97 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	return status;
 }
 
+/* Accumulate a state of a surface into another state, which holds a
+ * reference to its buffer in buffer_ref, and leave the source empty. This
+ * is how sub-surface commits get cached and how commits get held back in
+ * the commit queue.
+ */
 static void
-weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
+weston_surface_state_merge(struct weston_surface *surface,
+			   struct weston_surface_state *src,
+			   struct weston_surface_state *dst,
+			   struct weston_buffer_reference *buffer_ref)
 {
-	struct weston_surface *surface = sub->surface;
-
 	/*
 	 * If this commit would cause the surface to move by the
 	 * attach(dx, dy) parameters, the old damage region must be
 	 * translated to correspond to the new surface coordinate system
 	 * origin.
 	 */
-	if (surface->pending.status & WESTON_SURFACE_DIRTY_POS) {
-		pixman_region32_translate(&sub->cached.damage_surface,
-					  -surface->pending.buf_offset.c.x,
-					  -surface->pending.buf_offset.c.y);
-	}
-	pixman_region32_union(&sub->cached.damage_surface,
-			      &sub->cached.damage_surface,
-			      &surface->pending.damage_surface);
-	pixman_region32_clear(&surface->pending.damage_surface);
-
-	pixman_region32_union(&sub->cached.damage_buffer,
-			      &sub->cached.damage_buffer,
-			      &surface->pending.damage_buffer);
-	pixman_region32_clear(&surface->pending.damage_buffer);
-
-	sub->cached.render_intent = surface->pending.render_intent;
-	weston_color_profile_unref(sub->cached.color_profile);
-	sub->cached.color_profile =
-		weston_color_profile_ref(surface->pending.color_profile);
-
-	if (surface->pending.status & WESTON_SURFACE_DIRTY_BUFFER) {
-		weston_surface_state_set_buffer(&sub->cached,
-						surface->pending.buffer);
-		weston_buffer_reference(&sub->cached_buffer_ref,
-					surface->pending.buffer,
-					surface->pending.buffer ?
+	if (src->status & WESTON_SURFACE_DIRTY_POS) {
+		pixman_region32_translate(&dst->damage_surface,
+					  -src->buf_offset.c.x,
+					  -src->buf_offset.c.y);
+	}
+	region_move_into(surface->compositor, &dst->damage_surface,
+			 &src->damage_surface);
+	region_move_into(surface->compositor, &dst->damage_buffer,
+			 &src->damage_buffer);
+
+	dst->render_intent = src->render_intent;
+	weston_color_profile_unref(dst->color_profile);
+	dst->color_profile = weston_color_profile_ref(src->color_profile);
+
+	if (src->status & WESTON_SURFACE_DIRTY_BUFFER) {
+		weston_surface_state_set_buffer(dst, src->buffer);
+		weston_buffer_reference(buffer_ref,
+					src->buffer,
+					src->buffer ?
 						BUFFER_MAY_BE_ACCESSED :
 						BUFFER_WILL_NOT_BE_ACCESSED);
-		weston_presentation_feedback_discard_list(
-					&sub->cached.feedback_list);
+		weston_presentation_feedback_discard_list(&dst->feedback_list);
 		/* zwp_surface_synchronization_v1.set_acquire_fence */
-		fd_move(&sub->cached.acquire_fence_fd,
-			&surface->pending.acquire_fence_fd);
+		fd_move(&dst->acquire_fence_fd, &src->acquire_fence_fd);
+		/* wp_linux_drm_syncobj_surface_v1.set_acquire_point */
+		weston_drm_syncobj_acquire_destroy(dst->drm_syncobj_acquire);
+		dst->drm_syncobj_acquire = src->drm_syncobj_acquire;
+		src->drm_syncobj_acquire = NULL;
 		/* zwp_surface_synchronization_v1.get_release */
-		weston_buffer_release_move(&sub->cached.buffer_release_ref,
-					   &surface->pending.buffer_release_ref);
+		weston_buffer_release_move(&dst->buffer_release_ref,
+					   &src->buffer_release_ref);
 	}
-	sub->cached.desired_protection = surface->pending.desired_protection;
-	sub->cached.protection_mode = surface->pending.protection_mode;
-	assert(surface->pending.acquire_fence_fd == -1);
-	assert(surface->pending.buffer_release_ref.buffer_release == NULL);
-	sub->cached.buf_offset = weston_coord_surface_add(sub->cached.buf_offset,
-							  surface->pending.buf_offset);
+	dst->desired_protection = src->desired_protection;
+	dst->protection_mode = src->protection_mode;
+	dst->content_type = src->content_type;
+	assert(src->acquire_fence_fd == -1);
+	assert(src->drm_syncobj_acquire == NULL);
+	assert(src->buffer_release_ref.buffer_release == NULL);
+	dst->buf_offset = weston_coord_surface_add(dst->buf_offset,
+						   src->buf_offset);
+
+	dst->buffer_viewport.buffer = src->buffer_viewport.buffer;
+	dst->buffer_viewport.surface = src->buffer_viewport.surface;
+
+	weston_surface_state_set_buffer(src, NULL);
 
-	sub->cached.buffer_viewport.buffer =
-		surface->pending.buffer_viewport.buffer;
-	sub->cached.buffer_viewport.surface =
-		surface->pending.buffer_viewport.surface;
+	src->buf_offset = weston_coord_surface(0, 0, surface);
 
-	weston_surface_state_set_buffer(&surface->pending, NULL);
+	pixman_region32_copy(&dst->opaque, &src->opaque);
 
-	surface->pending.buf_offset = weston_coord_surface(0, 0, surface);
+	pixman_region32_copy(&dst->input, &src->input);
 
-	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
+	wl_list_insert_list(&dst->frame_callback_list,
+			    &src->frame_callback_list);
+	wl_list_init(&src->frame_callback_list);
 
-	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
+	wl_list_insert_list(&dst->feedback_list, &src->feedback_list);
+	wl_list_init(&src->feedback_list);
 
-	wl_list_insert_list(&sub->cached.frame_callback_list,
-			    &surface->pending.frame_callback_list);
-	wl_list_init(&surface->pending.frame_callback_list);
+	/* wp_fifo_v1 and wp_commit_timer_v1 only pace commits that get
+	 * applied on their own, see weston_surface_commit_is_held() */
+	src->fifo_barrier = false;
+	src->fifo_wait = false;
+	src->has_commit_target = false;
 
-	wl_list_insert_list(&sub->cached.feedback_list,
-			    &surface->pending.feedback_list);
-	wl_list_init(&surface->pending.feedback_list);
+	dst->status |= src->status;
+	src->status = WESTON_SURFACE_CLEAN;
+}
 
-	sub->cached.status |= surface->pending.status;
-	surface->pending.status = WESTON_SURFACE_CLEAN;
+static void
+weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
+{
+	weston_surface_state_merge(sub->surface, &sub->surface->pending,
+				   &sub->cached, &sub->cached_buffer_ref);
 	sub->has_cached_data = 1;
 }
 
@@ -5481,6 +7609,23 @@ weston_surface_set_label_func(struct weston_surface *surface,
 						     surface);
 }
 
+/** Ask the backend to favour direct scanout for a surface
+ *
+ * \param surface The surface to flag.
+ * \param preferred True if the shell expects this surface to be scanned out.
+ *
+ * Shells call this for surfaces they know cover an output on their own,
+ * like a kiosk application. Backends may then advertise scanout tranches
+ * in the dma-buf feedback without waiting for the scene to settle, and
+ * report why the surface had to be composited instead.
+ */
+WL_EXPORT void
+weston_surface_set_scanout_preferred(struct weston_surface *surface,
+				     bool preferred)
+{
+	surface->scanout_preferred = preferred;
+}
+
 /** Get the size of surface contents
  *
  * \param surface The surface to query.
@@ -5753,6 +7898,7 @@ weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
 	sub->parent->pending.status |= WESTON_SURFACE_DIRTY_SUBSURFACE_CONFIG;
+	weston_compositor_subsurface_tree_changed(sub->parent->compositor);
 	sub->parent = NULL;
 }
 
@@ -5817,6 +7963,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_compositor_subsurface_tree_changed(parent->compositor);
 
 	assert(wl_list_empty(&sub->surface->views));
 
@@ -5870,6 +8017,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 		assert(sub->parent_destroy_listener.notify == NULL);
 		wl_list_remove(&sub->parent_link);
 		wl_list_remove(&sub->parent_link_pending);
+		weston_compositor_subsurface_tree_changed(sub->surface->compositor);
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
@@ -5934,6 +8082,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_compositor_subsurface_tree_changed(parent->compositor);
 
 	return sub;
 }
@@ -6079,6 +8228,8 @@ weston_compositor_wake(struct weston_compositor *compositor)
 		wl_event_source_timer_update(compositor->idle_source,
 					     compositor->idle_time * 1000);
 	}
+
+	idle_task_timer_rearm(compositor);
 }
 
 /** Turns off rendering and frame events for the compositor.
@@ -6154,41 +8305,143 @@ idle_handler(void *data)
 	return 1;
 }
 
-WL_EXPORT void
-weston_plane_init(struct weston_plane *plane, struct weston_compositor *ec)
-{
-	plane->x = 0;
-	plane->y = 0;
-	plane->compositor = ec;
-
-	/* Init the link so that the call to wl_list_remove() when releasing
-	 * the plane without ever stacking doesn't lead to a crash */
-	wl_list_init(&plane->link);
-}
-
-WL_EXPORT void
-weston_plane_release(struct weston_plane *plane)
+static int
+idle_task_timer_handler(void *data)
 {
-	struct weston_output *output;
+	struct weston_compositor *compositor = data;
+	struct weston_idle_task *task, *tmp;
+	struct timespec now;
+	int64_t since_repaint;
 
-	/* We might be releasing a primary plane, so we can't just casually
-	 * reassign paint nodes to another plane here - delete them and
-	 * force a rebuild.
-	 */
-	wl_list_for_each(output, &plane->compositor->output_list, link) {
-		struct weston_paint_node *node, *pntmp;
+	compositor->idle_task_timer_armed = false;
 
-		wl_list_for_each_safe(node, pntmp,
-				      &output->paint_node_list, output_link) {
-			if (node->plane != plane)
-				continue;
+	/* Repaints do not push the timer out, check how long it has
+	 * really been quiet for. */
+	weston_compositor_read_presentation_clock(compositor, &now);
+	since_repaint = timespec_sub_to_msec(&now,
+					     &compositor->last_repaint_start);
+	if (since_repaint >= 0 &&
+	    since_repaint < compositor->idle_task_delay_msec) {
+		idle_task_timer_arm(compositor,
+				    compositor->idle_task_delay_msec -
+				    since_repaint);
+		return 0;
+	}
 
-			output->compositor->view_list_needs_rebuild = true;
-			weston_paint_node_destroy(node);
-		}
+	wl_list_for_each_safe(task, tmp, &compositor->idle_task_list, link) {
+		weston_log_scope_printf(compositor->repaint_debug,
+					"running idle task %s\n", task->name);
+		task->func(compositor, task->data);
 	}
 
-	wl_list_remove(&plane->link);
+	return 0;
+}
+
+/** Run a function once the compositor has been idle for a while
+ *
+ * \param compositor The compositor.
+ * \param name Shown in the repaint debug scope when the task runs.
+ * \param func The function to run.
+ * \param data User data passed to \c func.
+ * \return The task, to be destroyed with weston_idle_task_destroy().
+ *
+ * Idle tasks run in the order they were added, after
+ * weston_compositor_set_idle_task_delay() has passed without any output
+ * repaint, and then again after each later burst of activity. They are
+ * meant for trimming caches and freeing memory that a busy compositor
+ * would rather keep, so they must leave everything in a state the next
+ * repaint can recover from.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT struct weston_idle_task *
+weston_compositor_add_idle_task(struct weston_compositor *compositor,
+				const char *name,
+				weston_idle_task_func_t func, void *data)
+{
+	struct weston_idle_task *task;
+
+	task = xzalloc(sizeof *task);
+	task->name = xstrdup(name);
+	task->func = func;
+	task->data = data;
+	wl_list_insert(compositor->idle_task_list.prev, &task->link);
+
+	idle_task_timer_rearm(compositor);
+
+	return task;
+}
+
+/** Remove an idle task
+ *
+ * \param task The task from weston_compositor_add_idle_task(), or NULL.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_idle_task_destroy(struct weston_idle_task *task)
+{
+	if (!task)
+		return;
+
+	wl_list_remove(&task->link);
+	free(task->name);
+	free(task);
+}
+
+/** Set how long the compositor must be idle before idle tasks run
+ *
+ * \param compositor The compositor.
+ * \param delay_msec Time without output repaints, in milliseconds. 0
+ * disables the idle tasks, which is the default.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_set_idle_task_delay(struct weston_compositor *compositor,
+				      uint32_t delay_msec)
+{
+	compositor->idle_task_delay_msec = delay_msec;
+
+	idle_task_timer_arm(compositor, 0);
+	idle_task_timer_rearm(compositor);
+}
+
+WL_EXPORT void
+weston_plane_init(struct weston_plane *plane, struct weston_compositor *ec)
+{
+	plane->x = 0;
+	plane->y = 0;
+	plane->compositor = ec;
+
+	/* Init the link so that the call to wl_list_remove() when releasing
+	 * the plane without ever stacking doesn't lead to a crash */
+	wl_list_init(&plane->link);
+}
+
+WL_EXPORT void
+weston_plane_release(struct weston_plane *plane)
+{
+	struct weston_output *output;
+
+	/* We might be releasing a primary plane, so we can't just casually
+	 * reassign paint nodes to another plane here - delete them and
+	 * force a rebuild.
+	 */
+	wl_list_for_each(output, &plane->compositor->output_list, link) {
+		struct weston_paint_node *node, *pntmp;
+
+		wl_list_for_each_safe(node, pntmp,
+				      &output->paint_node_list, output_link) {
+			if (node->plane != plane)
+				continue;
+
+			output->compositor->view_list_needs_rebuild = true;
+			weston_paint_node_destroy(node);
+		}
+	}
+
+	wl_list_remove(&plane->link);
 }
 
 /** weston_compositor_stack_plane
@@ -7271,6 +9524,29 @@ weston_head_get_destroy_listener(struct weston_head *head,
 	return wl_signal_get(&head->destroy_signal, notify);
 }
 
+/* After the area of an output changed, finds the outputs again of the views
+ * that were on it or are on it now. The other views are not affected, and
+ * views with dirty geometry, like those the shell moved along with the
+ * output, get theirs with the transform update anyway. */
+static void
+weston_output_reassign_views(struct weston_output *output)
+{
+	pixman_box32_t *extents = pixman_region32_extents(&output->region);
+	struct weston_view *view;
+
+	wl_list_for_each(view, &output->compositor->view_list, link) {
+		if (view->transform.dirty)
+			continue;
+
+		if (!(view->output_mask & (1u << output->id)) &&
+		    !boxes_overlap(pixman_region32_extents(&view->transform.boundingbox),
+				   extents, 0, 0))
+			continue;
+
+		weston_view_assign_output(view);
+	}
+}
+
 /* Move other outputs when one is resized so the space remains contiguous. */
 static void
 weston_compositor_reflow_outputs(struct weston_compositor *compositor,
@@ -7360,6 +9636,8 @@ weston_output_init_geometry(struct weston_output *output,
 				  output->pos.c.x, output->pos.c.y,
 				  output->width,
 				  output->height);
+
+	output->compositor->pick_index_dirty = true;
 }
 
 /**
@@ -7394,6 +9672,8 @@ weston_output_set_position(struct weston_output *output,
 	/* Move views on this output. */
 	wl_signal_emit(&output->compositor->output_moved_signal, output);
 
+	weston_output_reassign_views(output);
+
 	/* Notify clients of the change for output position. */
 	wl_list_for_each(head, &output->head_list, output_link) {
 		wl_resource_for_each(resource, &head->resource_list) {
@@ -7480,6 +9760,7 @@ weston_compositor_add_output(struct weston_compositor *compositor,
 	wl_list_remove(&output->link);
 	wl_list_insert(compositor->output_list.prev, &output->link);
 	output->enabled = true;
+	weston_metric_add(compositor, WESTON_METRIC_OUTPUTS, 1);
 
 	wl_list_for_each(head, &output->head_list, output_link)
 		weston_head_add_global(head);
@@ -7700,6 +9981,7 @@ weston_compositor_remove_output(struct weston_output *output)
 	wl_list_remove(&output->link);
 	wl_list_insert(compositor->pending_output_list.prev, &output->link);
 	output->enabled = false;
+	weston_metric_add(compositor, WESTON_METRIC_OUTPUTS, -1);
 
 	wl_signal_emit_mutable(&compositor->output_destroyed_signal, output);
 	wl_signal_emit_mutable(&output->destroy_signal, output);
@@ -7709,6 +9991,13 @@ weston_compositor_remove_output(struct weston_output *output)
 
 	weston_output_capture_info_destroy(&output->capture_info);
 
+	weston_pick_index_destroy(output->pick_index);
+	output->pick_index = NULL;
+	compositor->pick_index_dirty = true;
+
+	weston_frame_stats_destroy(output->frame_stats);
+	output->frame_stats = NULL;
+
 	compositor->output_id_pool &= ~(1u << output->id);
 	output->id = 0xffffffff; /* invalid */
 }
@@ -8107,6 +10396,7 @@ weston_output_init(struct weston_output *output,
 		   const char *name)
 {
 	struct weston_color_manager *cm;
+	int i;
 
 	output->pos.c = weston_coord(0, 0);
 	output->compositor = compositor;
@@ -8132,6 +10422,10 @@ weston_output_init(struct weston_output *output,
 	output->transform = UINT32_MAX;
 
 	pixman_region32_init(&output->region);
+	wl_array_init(&output->moves);
+	wl_array_init(&output->paint_node_z_order);
+	for (i = 0; i < WESTON_OUTPUT_DAMAGE_HISTORY; i++)
+		pixman_region32_init(&output->damage_history.damage[i]);
 	wl_list_init(&output->mode_list);
 
 	weston_plane_init(&output->primary_plane, compositor);
@@ -8455,6 +10749,7 @@ WL_EXPORT void
 weston_output_release(struct weston_output *output)
 {
 	struct weston_head *head, *tmp;
+	int i;
 
 	output->destroying = 1;
 
@@ -8472,6 +10767,11 @@ weston_output_release(struct weston_output *output)
 	assert(output->color_outcome == NULL);
 
 	pixman_region32_fini(&output->region);
+	output_clear_moves(output);
+	wl_array_release(&output->moves);
+	wl_array_release(&output->paint_node_z_order);
+	for (i = 0; i < WESTON_OUTPUT_DAMAGE_HISTORY; i++)
+		pixman_region32_fini(&output->damage_history.damage[i]);
 	wl_list_remove(&output->link);
 
 	wl_list_for_each_safe(head, tmp, &output->head_list, output_link)
@@ -8958,237 +11258,739 @@ viewporter_get_viewport(struct wl_client *client,
 		return;
 	}
 
-	wl_resource_set_implementation(resource, &viewport_interface,
-				       surface, destroy_viewport);
+	wl_resource_set_implementation(resource, &viewport_interface,
+				       surface, destroy_viewport);
+
+	surface->viewport_resource = resource;
+}
+
+static const struct wp_viewporter_interface viewporter_interface = {
+	viewporter_destroy,
+	viewporter_get_viewport
+};
+
+static void
+bind_viewporter(struct wl_client *client,
+		void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wp_viewporter_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &viewporter_interface,
+				       NULL, NULL);
+}
+
+static void
+destroy_presentation_feedback(struct wl_resource *feedback_resource)
+{
+	struct weston_presentation_feedback *feedback;
+
+	feedback = wl_resource_get_user_data(feedback_resource);
+
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+presentation_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+presentation_feedback(struct wl_client *client,
+		      struct wl_resource *presentation_resource,
+		      struct wl_resource *surface_resource,
+		      uint32_t callback)
+{
+	struct weston_surface *surface;
+	struct weston_presentation_feedback *feedback;
+
+	surface = wl_resource_get_user_data(surface_resource);
+
+	feedback = zalloc(sizeof *feedback);
+	if (feedback == NULL)
+		goto err_calloc;
+
+	feedback->surface = surface;
+
+	feedback->resource = wl_resource_create(client,
+					&wp_presentation_feedback_interface,
+					1, callback);
+	if (!feedback->resource)
+		goto err_create;
+
+	wl_resource_set_implementation(feedback->resource, NULL, feedback,
+				       destroy_presentation_feedback);
+
+	wl_list_insert(&surface->pending.feedback_list, &feedback->link);
+
+	return;
+
+err_create:
+	free(feedback);
+
+err_calloc:
+	wl_client_post_no_memory(client);
+}
+
+static const struct wp_presentation_interface presentation_implementation = {
+	presentation_destroy,
+	presentation_feedback
+};
+
+static void
+bind_presentation(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wp_presentation_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &presentation_implementation,
+				       compositor, NULL);
+	wp_presentation_send_clock_id(resource, compositor->presentation_clock);
+}
+
+static void
+compositor_bind(struct wl_client *client,
+		void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_compositor_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &compositor_interface,
+				       compositor, NULL);
+}
+
+static void
+set_presentation_hint(struct wl_client *client, struct wl_resource *resource, uint32_t hint)
+{
+	struct weston_tearing_control *tc = wl_resource_get_user_data(resource);
+	struct weston_surface *surf = tc->surface;
+
+	if (hint == WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC)
+		surf->tear_control->may_tear = true;
+	else
+		surf->tear_control->may_tear = false;
+}
+
+static void
+destroy_tearing_control(struct wl_client *client, struct wl_resource *res)
+{
+	struct weston_tearing_control *tc = wl_resource_get_user_data(res);
+	struct weston_surface *surf = tc->surface;
+
+	if (surf)
+		surf->tear_control = NULL;
+
+	wl_resource_destroy(res);
+}
+
+static const struct wp_tearing_control_v1_interface tearing_interface = {
+	set_presentation_hint,
+	destroy_tearing_control,
+};
+
+static void
+destroy_tearing_controller(struct wl_client *client,
+			   struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+free_tearing_control(struct wl_resource *res)
+{
+	struct weston_tearing_control *tc = wl_resource_get_user_data(res);
+	struct weston_surface *surf = tc->surface;
+
+	if (surf)
+		surf->tear_control = NULL;
+
+	free(tc);
+}
+
+static void
+get_tearing_control(struct wl_client *client,
+		    struct wl_resource *resource,
+		    uint32_t id,
+		    struct wl_resource *surface_resource)
+{
+	struct wl_resource *ctl_res;
+	struct weston_tearing_control *control;
+	struct weston_surface *surface;
+	uint32_t version;
+
+	surface = wl_resource_get_user_data(surface_resource);
+	if (surface->tear_control) {
+		wl_resource_post_error(resource,
+				       WP_TEARING_CONTROL_MANAGER_V1_ERROR_TEARING_CONTROL_EXISTS,
+				       "Surface already has a tearing controller");
+		return;
+	}
+
+	version = wl_resource_get_version(resource);
+	ctl_res = wl_resource_create(client,
+				     &wp_tearing_control_v1_interface,
+				     version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	control = xzalloc(sizeof *control);
+	control->may_tear = false;
+	control->surface = surface;
+	surface->tear_control = control;
+	wl_resource_set_implementation(ctl_res, &tearing_interface,
+				       control, free_tearing_control);
+}
+
+static const struct wp_tearing_control_manager_v1_interface
+tearing_control_manager_implementation = {
+	destroy_tearing_controller,
+	get_tearing_control,
+};
+
+static void
+bind_tearing_controller(struct wl_client *client, void *data,
+			uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_tearing_control_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &tearing_control_manager_implementation,
+				       compositor, NULL);
+}
+
+static void
+content_type_set_content_type(struct wl_client *client,
+			      struct wl_resource *resource,
+			      uint32_t content_type)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	switch (content_type) {
+	case WP_CONTENT_TYPE_V1_TYPE_NONE:
+	case WP_CONTENT_TYPE_V1_TYPE_PHOTO:
+	case WP_CONTENT_TYPE_V1_TYPE_VIDEO:
+	case WP_CONTENT_TYPE_V1_TYPE_GAME:
+		surface->pending.content_type = content_type;
+		break;
+	default:
+		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_METHOD,
+				       "invalid content type %u", content_type);
+	}
+}
+
+static void
+content_type_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_content_type_v1_interface content_type_implementation = {
+	content_type_destroy,
+	content_type_set_content_type,
+};
+
+static void
+free_content_type(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	/* The hint goes away with the next commit */
+	if (surface) {
+		surface->content_type_resource = NULL;
+		surface->pending.content_type = WESTON_CONTENT_TYPE_NONE;
+	}
+}
+
+static void
+content_type_manager_destroy(struct wl_client *client,
+			     struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+content_type_manager_get_surface_content_type(struct wl_client *client,
+					      struct wl_resource *resource,
+					      uint32_t id,
+					      struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *ct_res;
+
+	if (surface->content_type_resource) {
+		wl_resource_post_error(resource,
+				       WP_CONTENT_TYPE_MANAGER_V1_ERROR_ALREADY_CONSTRUCTED,
+				       "Surface already has a content type object");
+		return;
+	}
+
+	ct_res = wl_resource_create(client, &wp_content_type_v1_interface,
+				    wl_resource_get_version(resource), id);
+	if (ct_res == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	surface->content_type_resource = ct_res;
+	wl_resource_set_implementation(ct_res, &content_type_implementation,
+				       surface, free_content_type);
+}
+
+static const struct wp_content_type_manager_v1_interface
+content_type_manager_implementation = {
+	content_type_manager_destroy,
+	content_type_manager_get_surface_content_type,
+};
+
+static void
+bind_content_type_manager(struct wl_client *client, void *data,
+			  uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_content_type_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &content_type_manager_implementation,
+				       compositor, NULL);
+}
+
+static void
+fractional_scale_destroy(struct wl_client *client,
+			 struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_fractional_scale_v1_interface
+fractional_scale_implementation = {
+	fractional_scale_destroy,
+};
+
+static void
+free_fractional_scale(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (surface) {
+		surface->fractional_scale_resource = NULL;
+		surface->preferred_fractional_scale = 0;
+	}
+}
+
+static void
+fractional_scale_manager_destroy(struct wl_client *client,
+				 struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+fractional_scale_manager_get_fractional_scale(struct wl_client *client,
+					      struct wl_resource *resource,
+					      uint32_t id,
+					      struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *fs_res;
+
+	if (surface->fractional_scale_resource) {
+		wl_resource_post_error(resource,
+				       WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS,
+				       "Surface already has a fractional scale object");
+		return;
+	}
+
+	fs_res = wl_resource_create(client, &wp_fractional_scale_v1_interface,
+				    wl_resource_get_version(resource), id);
+	if (fs_res == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	surface->fractional_scale_resource = fs_res;
+	wl_resource_set_implementation(fs_res, &fractional_scale_implementation,
+				       surface, free_fractional_scale);
 
-	surface->viewport_resource = resource;
+	weston_surface_update_preferred_scale(surface);
 }
 
-static const struct wp_viewporter_interface viewporter_interface = {
-	viewporter_destroy,
-	viewporter_get_viewport
+static const struct wp_fractional_scale_manager_v1_interface
+fractional_scale_manager_implementation = {
+	fractional_scale_manager_destroy,
+	fractional_scale_manager_get_fractional_scale,
 };
 
 static void
-bind_viewporter(struct wl_client *client,
-		void *data, uint32_t version, uint32_t id)
+bind_fractional_scale_manager(struct wl_client *client, void *data,
+			      uint32_t version, uint32_t id)
 {
+	struct weston_compositor *compositor = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client, &wp_viewporter_interface,
+	resource = wl_resource_create(client,
+				      &wp_fractional_scale_manager_v1_interface,
 				      version, id);
 	if (resource == NULL) {
 		wl_client_post_no_memory(client);
 		return;
 	}
 
-	wl_resource_set_implementation(resource, &viewporter_interface,
-				       NULL, NULL);
+	wl_resource_set_implementation(resource,
+				       &fractional_scale_manager_implementation,
+				       compositor, NULL);
 }
 
 static void
-destroy_presentation_feedback(struct wl_resource *feedback_resource)
+fifo_set_barrier(struct wl_client *client, struct wl_resource *resource)
 {
-	struct weston_presentation_feedback *feedback;
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	feedback = wl_resource_get_user_data(feedback_resource);
+	if (!surface) {
+		wl_resource_post_error(resource,
+				       WP_FIFO_V1_ERROR_SURFACE_DESTROYED,
+				       "the wl_surface of this wp_fifo_v1 "
+				       "was destroyed");
+		return;
+	}
 
-	wl_list_remove(&feedback->link);
-	free(feedback);
+	surface->pending.fifo_barrier = true;
 }
 
 static void
-presentation_destroy(struct wl_client *client, struct wl_resource *resource)
+fifo_wait_barrier(struct wl_client *client, struct wl_resource *resource)
 {
-	wl_resource_destroy(resource);
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface) {
+		wl_resource_post_error(resource,
+				       WP_FIFO_V1_ERROR_SURFACE_DESTROYED,
+				       "the wl_surface of this wp_fifo_v1 "
+				       "was destroyed");
+		return;
+	}
+
+	surface->pending.fifo_wait = true;
 }
 
 static void
-presentation_feedback(struct wl_client *client,
-		      struct wl_resource *presentation_resource,
-		      struct wl_resource *surface_resource,
-		      uint32_t callback)
+fifo_destroy(struct wl_client *client, struct wl_resource *resource)
 {
-	struct weston_surface *surface;
-	struct weston_presentation_feedback *feedback;
-
-	surface = wl_resource_get_user_data(surface_resource);
+	wl_resource_destroy(resource);
+}
 
-	feedback = zalloc(sizeof *feedback);
-	if (feedback == NULL)
-		goto err_calloc;
+static const struct wp_fifo_v1_interface fifo_implementation = {
+	fifo_set_barrier,
+	fifo_wait_barrier,
+	fifo_destroy,
+};
 
-	feedback->surface = surface;
+static void
+destroy_fifo(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	feedback->resource = wl_resource_create(client,
-					&wp_presentation_feedback_interface,
-					1, callback);
-	if (!feedback->resource)
-		goto err_create;
+	if (surface)
+		surface->fifo_resource = NULL;
+}
 
-	wl_resource_set_implementation(feedback->resource, NULL, feedback,
-				       destroy_presentation_feedback);
+static void
+fifo_manager_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
 
-	wl_list_insert(&surface->pending.feedback_list, &feedback->link);
+static void
+fifo_manager_get_fifo(struct wl_client *client,
+		      struct wl_resource *resource,
+		      uint32_t id,
+		      struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *fifo_resource;
 
-	return;
+	if (surface->fifo_resource) {
+		wl_resource_post_error(resource,
+				       WP_FIFO_MANAGER_V1_ERROR_ALREADY_EXISTS,
+				       "wl_surface@%"PRIu32" already has a "
+				       "wp_fifo_v1",
+				       wl_resource_get_id(surface_resource));
+		return;
+	}
 
-err_create:
-	free(feedback);
+	fifo_resource = wl_resource_create(client, &wp_fifo_v1_interface,
+					   wl_resource_get_version(resource),
+					   id);
+	if (fifo_resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
 
-err_calloc:
-	wl_client_post_no_memory(client);
+	wl_resource_set_implementation(fifo_resource, &fifo_implementation,
+				       surface, destroy_fifo);
+	surface->fifo_resource = fifo_resource;
 }
 
-static const struct wp_presentation_interface presentation_implementation = {
-	presentation_destroy,
-	presentation_feedback
+static const struct wp_fifo_manager_v1_interface fifo_manager_implementation = {
+	fifo_manager_destroy,
+	fifo_manager_get_fifo,
 };
 
 static void
-bind_presentation(struct wl_client *client,
-		  void *data, uint32_t version, uint32_t id)
+bind_fifo_manager(struct wl_client *client, void *data,
+		  uint32_t version, uint32_t id)
 {
 	struct weston_compositor *compositor = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client, &wp_presentation_interface,
+	resource = wl_resource_create(client, &wp_fifo_manager_v1_interface,
 				      version, id);
 	if (resource == NULL) {
 		wl_client_post_no_memory(client);
 		return;
 	}
 
-	wl_resource_set_implementation(resource, &presentation_implementation,
+	wl_resource_set_implementation(resource, &fifo_manager_implementation,
 				       compositor, NULL);
-	wp_presentation_send_clock_id(resource, compositor->presentation_clock);
 }
 
 static void
-compositor_bind(struct wl_client *client,
-		void *data, uint32_t version, uint32_t id)
+commit_timer_set_timestamp(struct wl_client *client,
+			   struct wl_resource *resource,
+			   uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+			   uint32_t tv_nsec)
 {
-	struct weston_compositor *compositor = data;
-	struct wl_resource *resource;
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	resource = wl_resource_create(client, &wl_compositor_interface,
-				      version, id);
-	if (resource == NULL) {
-		wl_client_post_no_memory(client);
+	if (!surface) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMER_V1_ERROR_SURFACE_DESTROYED,
+				       "the wl_surface of this "
+				       "wp_commit_timer_v1 was destroyed");
 		return;
 	}
 
-	wl_resource_set_implementation(resource, &compositor_interface,
-				       compositor, NULL);
+	if (tv_nsec >= 1000000000) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMER_V1_ERROR_INVALID_TIMESTAMP,
+				       "tv_nsec %"PRIu32" out of range",
+				       tv_nsec);
+		return;
+	}
+
+	if (surface->pending.has_commit_target) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS,
+				       "wl_surface@%"PRIu32" already has a "
+				       "timestamp for this commit",
+				       wl_resource_get_id(surface->resource));
+		return;
+	}
+
+	timespec_from_proto(&surface->pending.commit_target,
+			    tv_sec_hi, tv_sec_lo, tv_nsec);
+	surface->pending.has_commit_target = true;
 }
 
 static void
-set_presentation_hint(struct wl_client *client, struct wl_resource *resource, uint32_t hint)
+commit_timer_destroy(struct wl_client *client, struct wl_resource *resource)
 {
-	struct weston_tearing_control *tc = wl_resource_get_user_data(resource);
-	struct weston_surface *surf = tc->surface;
-
-	if (hint == WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC)
-		surf->tear_control->may_tear = true;
-	else
-		surf->tear_control->may_tear = false;
+	wl_resource_destroy(resource);
 }
 
+static const struct wp_commit_timer_v1_interface commit_timer_implementation = {
+	commit_timer_set_timestamp,
+	commit_timer_destroy,
+};
+
 static void
-destroy_tearing_control(struct wl_client *client, struct wl_resource *res)
+destroy_commit_timer(struct wl_resource *resource)
 {
-	struct weston_tearing_control *tc = wl_resource_get_user_data(res);
-	struct weston_surface *surf = tc->surface;
-
-	if (surf)
-		surf->tear_control = NULL;
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	wl_resource_destroy(res);
+	if (surface)
+		surface->commit_timer_resource = NULL;
 }
 
-static const struct wp_tearing_control_v1_interface tearing_interface = {
-	set_presentation_hint,
-	destroy_tearing_control,
-};
-
 static void
-destroy_tearing_controller(struct wl_client *client,
-			   struct wl_resource *resource)
+commit_timing_manager_destroy(struct wl_client *client,
+			      struct wl_resource *resource)
 {
 	wl_resource_destroy(resource);
 }
 
 static void
-free_tearing_control(struct wl_resource *res)
+commit_timing_manager_get_timer(struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id,
+				struct wl_resource *surface_resource)
 {
-	struct weston_tearing_control *tc = wl_resource_get_user_data(res);
-	struct weston_surface *surf = tc->surface;
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *timer_resource;
 
-	if (surf)
-		surf->tear_control = NULL;
+	if (surface->commit_timer_resource) {
+		wl_resource_post_error(resource,
+				       WP_COMMIT_TIMING_MANAGER_V1_ERROR_COMMIT_TIMER_EXISTS,
+				       "wl_surface@%"PRIu32" already has a "
+				       "wp_commit_timer_v1",
+				       wl_resource_get_id(surface_resource));
+		return;
+	}
 
-	free(tc);
+	timer_resource = wl_resource_create(client,
+					    &wp_commit_timer_v1_interface,
+					    wl_resource_get_version(resource),
+					    id);
+	if (timer_resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(timer_resource,
+				       &commit_timer_implementation,
+				       surface, destroy_commit_timer);
+	surface->commit_timer_resource = timer_resource;
 }
 
+static const struct wp_commit_timing_manager_v1_interface
+commit_timing_manager_implementation = {
+	commit_timing_manager_destroy,
+	commit_timing_manager_get_timer,
+};
+
 static void
-get_tearing_control(struct wl_client *client,
-		    struct wl_resource *resource,
-		    uint32_t id,
-		    struct wl_resource *surface_resource)
+bind_commit_timing_manager(struct wl_client *client, void *data,
+			   uint32_t version, uint32_t id)
 {
-	struct wl_resource *ctl_res;
-	struct weston_tearing_control *control;
-	struct weston_surface *surface;
-	uint32_t version;
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
 
-	surface = wl_resource_get_user_data(surface_resource);
-	if (surface->tear_control) {
-		wl_resource_post_error(resource,
-				       WP_TEARING_CONTROL_MANAGER_V1_ERROR_TEARING_CONTROL_EXISTS,
-				       "Surface already has a tearing controller");
+	resource = wl_resource_create(client,
+				      &wp_commit_timing_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
 		return;
 	}
 
-	version = wl_resource_get_version(resource);
-	ctl_res = wl_resource_create(client,
-				     &wp_tearing_control_v1_interface,
-				     version, id);
-	if (resource == NULL) {
+	wl_resource_set_implementation(resource,
+				       &commit_timing_manager_implementation,
+				       compositor, NULL);
+}
+
+static void
+frame_timing_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct weston_surface_frame_timing_v1_interface
+surface_frame_timing_implementation = {
+	frame_timing_destroy,
+};
+
+static void
+destroy_surface_frame_timing(struct wl_resource *resource)
+{
+	/* Unlinked already if the surface went away first */
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void
+frame_timing_get_surface_timing(struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id,
+				struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *timing_resource;
+
+	timing_resource =
+		wl_resource_create(client,
+				   &weston_surface_frame_timing_v1_interface,
+				   wl_resource_get_version(resource), id);
+	if (timing_resource == NULL) {
 		wl_client_post_no_memory(client);
 		return;
 	}
 
-	control = xzalloc(sizeof *control);
-	control->may_tear = false;
-	control->surface = surface;
-	surface->tear_control = control;
-	wl_resource_set_implementation(ctl_res, &tearing_interface,
-				       control, free_tearing_control);
+	wl_resource_set_implementation(timing_resource,
+				       &surface_frame_timing_implementation,
+				       surface, destroy_surface_frame_timing);
+	wl_list_insert(&surface->frame_timing_resource_list,
+		       wl_resource_get_link(timing_resource));
 }
 
-static const struct wp_tearing_control_manager_v1_interface
-tearing_control_manager_implementation = {
-	destroy_tearing_controller,
-	get_tearing_control,
+static const struct weston_frame_timing_v1_interface
+frame_timing_implementation = {
+	frame_timing_destroy,
+	frame_timing_get_surface_timing,
 };
 
 static void
-bind_tearing_controller(struct wl_client *client, void *data,
-			uint32_t version, uint32_t id)
+bind_frame_timing(struct wl_client *client, void *data,
+		  uint32_t version, uint32_t id)
 {
-	struct weston_compositor *compositor = data;
 	struct wl_resource *resource;
 
 	resource = wl_resource_create(client,
-				      &wp_tearing_control_manager_v1_interface,
+				      &weston_frame_timing_v1_interface,
 				      version, id);
 	if (resource == NULL) {
 		wl_client_post_no_memory(client);
 		return;
 	}
 
-	wl_resource_set_implementation(resource, &tearing_control_manager_implementation,
-				       compositor, NULL);
+	wl_resource_set_implementation(resource, &frame_timing_implementation,
+				       data, NULL);
 }
 
 static const char *
@@ -9532,6 +12334,8 @@ weston_compositor_create(struct wl_display *display,
 	ec->presentation_clock = CLOCK_REALTIME;
 
 	ec->weston_log_ctx = log_ctx;
+	weston_log_ctx_set_event_loop(log_ctx,
+				      wl_display_get_event_loop(display));
 	ec->wl_display = display;
 	ec->user_data = user_data;
 	wl_signal_init(&ec->destroy_signal);
@@ -9557,6 +12361,7 @@ weston_compositor_create(struct wl_display *display,
 
 	ec->output_id_pool = 0;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
+	ec->repaint_margin_usec = DEFAULT_REPAINT_MARGIN;
 
 	ec->activate_serial = 1;
 
@@ -9594,6 +12399,31 @@ weston_compositor_create(struct wl_display *display,
 			      ec, bind_tearing_controller))
 		goto fail;
 
+	if (!wl_global_create(ec->wl_display,
+			      &wp_content_type_manager_v1_interface, 1,
+			      ec, bind_content_type_manager))
+		goto fail;
+
+	if (!wl_global_create(ec->wl_display,
+			      &wp_fractional_scale_manager_v1_interface, 1,
+			      ec, bind_fractional_scale_manager))
+		goto fail;
+
+	if (!wl_global_create(ec->wl_display,
+			      &wp_fifo_manager_v1_interface, 1,
+			      ec, bind_fifo_manager))
+		goto fail;
+
+	if (!wl_global_create(ec->wl_display,
+			      &wp_commit_timing_manager_v1_interface, 1,
+			      ec, bind_commit_timing_manager))
+		goto fail;
+
+	if (!wl_global_create(ec->wl_display,
+			      &weston_frame_timing_v1_interface, 1,
+			      ec, bind_frame_timing))
+		goto fail;
+
 	if (weston_input_init(ec) != 0)
 		goto fail;
 
@@ -9602,10 +12432,17 @@ weston_compositor_create(struct wl_display *display,
 	ec->color_profile_id_generator = weston_idalloc_create(ec);
 	ec->color_transform_id_generator = weston_idalloc_create(ec);
 
+	pixman_region32_init(&ec->commit_scratch[0]);
+	pixman_region32_init(&ec->commit_scratch[1]);
+
 	wl_list_init(&ec->view_list);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
+	ec->subsurface_tree_generation = 1;
+	wl_array_init(&ec->subsurface_flat_views);
+	wl_list_init(&ec->xkb_info_list);
+	wl_list_init(&ec->keymap_cache);
 	wl_list_init(&ec->pending_output_list);
 	wl_list_init(&ec->output_list);
 	wl_list_init(&ec->head_list);
@@ -9628,9 +12465,18 @@ weston_compositor_create(struct wl_display *display,
 
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
+	wl_list_init(&ec->idle_task_list);
+	ec->idle_task_timer =
+		wl_event_loop_add_timer(loop, idle_task_timer_handler, ec);
 	ec->repaint_timer =
 		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
 					ec);
+	ec->occluded_frame_timer =
+		wl_event_loop_add_timer(loop, occluded_frame_timer_handler,
+					ec);
+	wl_list_init(&ec->commit_queue_list);
+	ec->commit_queue_timer =
+		wl_event_loop_add_timer(loop, commit_queue_timer_handler, ec);
 
 	weston_layer_init(&ec->fade_layer, ec);
 	weston_layer_init(&ec->cursor_layer, ec);
@@ -9651,13 +12497,49 @@ weston_compositor_create(struct wl_display *display,
 						weston_timeline_create_subscription,
 						weston_timeline_destroy_subscription,
 						ec);
+	ec->timeline_perfetto =
+		weston_compositor_add_log_scope(ec, "timeline-perfetto",
+						"Timeline event points as a Perfetto trace\n",
+						weston_timeline_create_perfetto_subscription,
+						weston_timeline_destroy_subscription,
+						ec);
 	ec->libseat_debug =
 		weston_compositor_add_log_scope(ec, "libseat-debug",
 						"libseat debug messages\n",
 						NULL, NULL, NULL);
+	ec->repaint_debug =
+		weston_compositor_add_log_scope(ec, "repaint-timing",
+						"Repaint duration estimates and "
+						"missed vblanks\n",
+						NULL, NULL, NULL);
+	ec->frame_stats_scope =
+		weston_compositor_add_log_scope(ec, "frame-stats",
+						"Periodic per-output latency and "
+						"repaint histograms\n",
+						weston_frame_stats_subscribe,
+						NULL, ec);
+	ec->metrics = weston_metrics_create();
+	ec->view_pool = weston_object_pool_create(sizeof(struct weston_view));
+	ec->paint_node_pool =
+		weston_object_pool_create(sizeof(struct weston_paint_node));
+	ec->metrics_scope =
+		weston_compositor_add_log_scope(ec, "metrics",
+						"Snapshot of the compositor "
+						"counters and histograms\n",
+						weston_metrics_snapshot,
+						NULL, ec);
+	ec->client_accounting = weston_client_accounting_create(ec);
+	ec->client_accounting_scope =
+		weston_compositor_add_log_scope(ec, "client-accounting",
+						"Snapshot of the surfaces, "
+						"buffers and frame callbacks "
+						"each client holds\n",
+						weston_client_accounting_snapshot,
+						NULL, ec);
 	return ec;
 
 fail:
+	weston_log_ctx_set_event_loop(log_ctx, NULL);
 	free(ec);
 	return NULL;
 }
@@ -9673,7 +12555,13 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	ec->shutting_down = true;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->idle_task_timer);
+	ec->idle_task_timer = NULL;
 	wl_event_source_remove(ec->repaint_timer);
+	wl_event_source_remove(ec->occluded_frame_timer);
+	wl_event_source_remove(ec->commit_queue_timer);
+	if (ec->repaint_idle_source)
+		wl_event_source_remove(ec->repaint_idle_source);
 
 	if (ec->touch_calibration)
 		weston_compositor_destroy_touch_calibrator(ec);
@@ -9702,6 +12590,7 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_binding_list_destroy_all(&ec->axis_binding_list);
 	weston_binding_list_destroy_all(&ec->debug_binding_list);
 	weston_binding_list_destroy_all(&ec->tablet_tool_binding_list);
+	weston_binding_index_destroy(ec);
 
 	weston_layer_fini(&ec->fade_layer);
 	weston_layer_fini(&ec->cursor_layer);
@@ -9723,6 +12612,34 @@ weston_compositor_exit_with_code(struct weston_compositor *compositor,
 	weston_compositor_exit(compositor);
 }
 
+/** Choose what happens to frame callbacks of occluded surfaces
+ *
+ * \param compositor The compositor.
+ * \param policy Hold the callbacks until the surface is visible again,
+ * or throttle them.
+ * \param interval_ms With WESTON_OCCLUDED_FRAME_THROTTLE, the minimum time
+ * between two frame callback rounds of an occluded surface.
+ *
+ * Shells decide this, as they know whether clients they hide should keep
+ * making progress. The default is WESTON_OCCLUDED_FRAME_HOLD.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_set_occluded_frame_policy(struct weston_compositor *compositor,
+					    enum weston_occluded_frame_policy policy,
+					    uint32_t interval_ms)
+{
+	compositor->occluded_frame_policy = policy;
+	compositor->occluded_frame_interval_ms = interval_ms;
+
+	if (policy == WESTON_OCCLUDED_FRAME_HOLD &&
+	    compositor->occluded_frame_timer_armed) {
+		wl_event_source_timer_update(compositor->occluded_frame_timer, 0);
+		compositor->occluded_frame_timer_armed = false;
+	}
+}
+
 /** weston_compositor_set_default_pointer_grab
  * \ingroup compositor
  */
@@ -10126,17 +13043,46 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_log_scope_destroy(compositor->timeline);
 	compositor->timeline = NULL;
 
+	weston_log_scope_destroy(compositor->timeline_perfetto);
+	compositor->timeline_perfetto = NULL;
+
 	weston_log_scope_destroy(compositor->libseat_debug);
 	compositor->libseat_debug = NULL;
 
+	weston_log_scope_destroy(compositor->repaint_debug);
+	weston_log_scope_destroy(compositor->frame_stats_scope);
+	compositor->repaint_debug = NULL;
+
+	weston_log_scope_destroy(compositor->metrics_scope);
+	compositor->metrics_scope = NULL;
+	weston_metrics_destroy(compositor->metrics);
+	compositor->metrics = NULL;
+
+	weston_object_pool_destroy(compositor->paint_node_pool);
+	compositor->paint_node_pool = NULL;
+	weston_object_pool_destroy(compositor->view_pool);
+	compositor->view_pool = NULL;
+
+	weston_log_scope_destroy(compositor->client_accounting_scope);
+	compositor->client_accounting_scope = NULL;
+	weston_client_accounting_destroy(compositor->client_accounting);
+	compositor->client_accounting = NULL;
+
+	wl_array_release(&compositor->subsurface_flat_views);
+
 	weston_idalloc_destroy(compositor->color_transform_id_generator);
 	weston_idalloc_destroy(compositor->color_profile_id_generator);
 
+	pixman_region32_fini(&compositor->commit_scratch[0]);
+	pixman_region32_fini(&compositor->commit_scratch[1]);
+
 	if (compositor->default_dmabuf_feedback) {
 		weston_dmabuf_feedback_destroy(compositor->default_dmabuf_feedback);
 		weston_dmabuf_feedback_format_table_destroy(compositor->dmabuf_feedback_format_table);
 	}
 
+	weston_log_ctx_set_event_loop(compositor->weston_log_ctx, NULL);
+
 	free(compositor);
 }
 
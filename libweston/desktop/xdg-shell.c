@@ -121,6 +121,11 @@ struct weston_desktop_xdg_toplevel {
 		struct weston_desktop_xdg_toplevel_state state;
 		struct weston_size min_size, max_size;
 	} current;
+
+	/* A configure was acked, but not yet followed by a commit */
+	bool ack_uncommitted;
+	/* A size change held back while interactively resizing */
+	bool size_throttled;
 };
 
 struct weston_desktop_xdg_popup {
@@ -499,6 +504,7 @@ weston_desktop_xdg_toplevel_ack_configure(struct weston_desktop_xdg_toplevel *to
 {
 	toplevel->next.state = configure->state;
 	toplevel->next.size = configure->size;
+	toplevel->ack_uncommitted = true;
 }
 
 static void
@@ -614,6 +620,7 @@ weston_desktop_xdg_toplevel_send_configure(struct weston_desktop_xdg_toplevel *t
 
 	configure->state = toplevel->pending.state;
 	configure->size = toplevel->pending.size;
+	toplevel->size_throttled = false;
 
 	wl_array_init(&states);
 	if (toplevel->pending.state.maximized) {
@@ -715,6 +722,17 @@ weston_desktop_xdg_toplevel_set_size(struct weston_desktop_surface *dsurface,
 	toplevel->pending.size.width = width;
 	toplevel->pending.size.height = height;
 
+	/* An interactive resize changes the size on every pointer motion,
+	 * faster than clients redraw. Only send a new size once the client
+	 * has acked and committed the previous one, the latest size then
+	 * wins; see weston_desktop_xdg_toplevel_committed(). */
+	if (toplevel->pending.state.resizing &&
+	    (!wl_list_empty(&toplevel->base.configure_list) ||
+	     toplevel->ack_uncommitted)) {
+		toplevel->size_throttled = true;
+		return;
+	}
+
 	weston_desktop_xdg_surface_schedule_configure(&toplevel->base);
 }
 
@@ -735,6 +753,13 @@ weston_desktop_xdg_toplevel_committed(struct weston_desktop_xdg_toplevel *toplev
 	struct weston_surface *wsurface =
 		weston_desktop_surface_get_surface(toplevel->base.desktop_surface);
 
+	if (toplevel->ack_uncommitted) {
+		toplevel->ack_uncommitted = false;
+		if (toplevel->size_throttled &&
+		    wl_list_empty(&toplevel->base.configure_list))
+			weston_desktop_xdg_surface_schedule_configure(&toplevel->base);
+	}
+
 	if (!weston_surface_has_content(wsurface) && !toplevel->added) {
 		weston_desktop_xdg_toplevel_ensure_added(toplevel);
 		return;
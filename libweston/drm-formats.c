@@ -26,11 +26,98 @@
 #include "config.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/weston-drm-fourcc.h"
 
+/*
+ * Both the formats of a weston_drm_format_array and the modifiers of each
+ * weston_drm_format are kept sorted in ascending order. Lookups are binary
+ * searches and the set operations below are linear merges, which matters
+ * as GPUs may expose hundreds of format/modifier pairs and these arrays are
+ * recomputed on every dmabuf feedback update.
+ */
+
+static unsigned int
+format_lower_bound(const struct weston_drm_format_array *formats,
+		   uint32_t format)
+{
+	const struct weston_drm_format *fmts = formats->arr.data;
+	unsigned int lo = 0;
+	unsigned int hi = formats->arr.size / sizeof(*fmts);
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (fmts[mid].format < format)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static unsigned int
+modifier_lower_bound(const struct weston_drm_format *format,
+		     uint64_t modifier)
+{
+	const uint64_t *mods = format->modifiers.data;
+	unsigned int lo = 0;
+	unsigned int hi = format->modifiers.size / sizeof(*mods);
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (mods[mid] < modifier)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Append a format that sorts after every format already in the array. */
+static struct weston_drm_format *
+append_format(struct weston_drm_format_array *formats, uint32_t format)
+{
+	struct weston_drm_format *fmt;
+
+	assert(formats->arr.size == 0 ||
+	       ((struct weston_drm_format *)formats->arr.data)
+	       [formats->arr.size / sizeof(*fmt) - 1].format < format);
+
+	fmt = wl_array_add(&formats->arr, sizeof(*fmt));
+	if (!fmt) {
+		weston_log("%s: out of memory\n", __func__);
+		return NULL;
+	}
+
+	fmt->format = format;
+	wl_array_init(&fmt->modifiers);
+	formats->latest = formats->arr.size / sizeof(*fmt) - 1;
+
+	return fmt;
+}
+
+static int
+append_modifier(struct wl_array *modifiers, uint64_t modifier)
+{
+	uint64_t *mod;
+
+	mod = wl_array_add(modifiers, sizeof(*mod));
+	if (!mod) {
+		weston_log("%s: out of memory\n", __func__);
+		return -1;
+	}
+	*mod = modifier;
+
+	return 0;
+}
+
 /**
  * Initialize a weston_drm_format_array
  *
@@ -40,6 +127,7 @@ WL_EXPORT void
 weston_drm_format_array_init(struct weston_drm_format_array *formats)
 {
 	wl_array_init(&formats->arr);
+	formats->latest = -1;
 }
 
 /**
@@ -61,6 +149,16 @@ weston_drm_format_array_fini(struct weston_drm_format_array *formats)
 	wl_array_release(&formats->arr);
 }
 
+/* Move the content of src into formats, leaving src empty. */
+static void
+format_array_move(struct weston_drm_format_array *formats,
+		  struct weston_drm_format_array *src)
+{
+	weston_drm_format_array_fini(formats);
+	*formats = *src;
+	weston_drm_format_array_init(src);
+}
+
 static int
 add_format_and_modifiers(struct weston_drm_format_array *formats,
 			 uint32_t format, struct wl_array *modifiers)
@@ -68,7 +166,7 @@ add_format_and_modifiers(struct weston_drm_format_array *formats,
 	struct weston_drm_format *fmt;
 	int ret;
 
-	fmt = weston_drm_format_array_add_format(formats, format);
+	fmt = append_format(formats, format);
 	if (!fmt)
 		return -1;
 
@@ -115,7 +213,9 @@ weston_drm_format_array_replace(struct weston_drm_format_array *formats,
 /**
  * Add format to weston_drm_format_array
  *
- * Adding repeated formats is considered an error.
+ * Adding repeated formats is considered an error. The format is inserted at
+ * its sorted position, so pointers to other formats of the array are
+ * invalidated.
  *
  * @param formats The weston_drm_format_array that receives the format
  * @param format The format to add to the array
@@ -125,28 +225,35 @@ WL_EXPORT struct weston_drm_format *
 weston_drm_format_array_add_format(struct weston_drm_format_array *formats,
 				   uint32_t format)
 {
-	struct weston_drm_format *fmt;
+	struct weston_drm_format *fmts;
+	unsigned int count = formats->arr.size / sizeof(*fmts);
+	unsigned int index = format_lower_bound(formats, format);
 
 	/* We should not try to add repeated formats to an array. */
-	assert(!weston_drm_format_array_find_format(formats, format));
+	assert(index == count ||
+	       ((struct weston_drm_format *)formats->arr.data)[index].format != format);
 
-	fmt = wl_array_add(&formats->arr, sizeof(*fmt));
-	if (!fmt) {
+	if (!wl_array_add(&formats->arr, sizeof(*fmts))) {
 		weston_log("%s: out of memory\n", __func__);
 		return NULL;
 	}
 
-	fmt->format = format;
-	wl_array_init(&fmt->modifiers);
+	fmts = formats->arr.data;
+	memmove(&fmts[index + 1], &fmts[index],
+		(count - index) * sizeof(*fmts));
 
-	return fmt;
+	fmts[index].format = format;
+	wl_array_init(&fmts[index].modifiers);
+	formats->latest = index;
+
+	return &fmts[index];
 }
 
 /**
  * Remove latest format added to a weston_drm_format_array
  *
  * Calling this function for an empty array is an error, at least one element
- * must be in the array.
+ * must be in the array, and it must not be called twice in a row.
  *
  * @param formats The weston_drm_format_array from which the format is removed
  */
@@ -154,14 +261,16 @@ WL_EXPORT void
 weston_drm_format_array_remove_latest_format(struct weston_drm_format_array *formats)
 {
 	struct wl_array *array = &formats->arr;
-	struct weston_drm_format *fmt;
+	struct weston_drm_format *fmts = array->data;
+	unsigned int count = array->size / sizeof(*fmts);
 
-	assert(array->size >= sizeof(*fmt));
+	assert(formats->latest >= 0 && (unsigned int)formats->latest < count);
 
-	array->size -= sizeof(*fmt);
-
-	fmt = array->data + array->size;
-	wl_array_release(&fmt->modifiers);
+	wl_array_release(&fmts[formats->latest].modifiers);
+	memmove(&fmts[formats->latest], &fmts[formats->latest + 1],
+		(count - formats->latest - 1) * sizeof(*fmts));
+	array->size -= sizeof(*fmts);
+	formats->latest = -1;
 }
 
 /**
@@ -175,11 +284,12 @@ WL_EXPORT struct weston_drm_format *
 weston_drm_format_array_find_format(const struct weston_drm_format_array *formats,
 				    uint32_t format)
 {
-	struct weston_drm_format *fmt;
+	struct weston_drm_format *fmts = formats->arr.data;
+	unsigned int count = formats->arr.size / sizeof(*fmts);
+	unsigned int index = format_lower_bound(formats, format);
 
-	wl_array_for_each(fmt, &formats->arr)
-		if (fmt->format == format)
-			return fmt;
+	if (index < count && fmts[index].format == format)
+		return &fmts[index];
 
 	return NULL;
 }
@@ -213,138 +323,125 @@ WL_EXPORT bool
 weston_drm_format_array_equal(const struct weston_drm_format_array *formats_A,
 			      const struct weston_drm_format_array *formats_B)
 {
-	struct weston_drm_format *fmt_A, *fmt_B;
-	const uint64_t *modifiers_A;
-	unsigned num_modifiers_A, num_modifiers_B;
+	const struct weston_drm_format *fmts_A = formats_A->arr.data;
+	const struct weston_drm_format *fmts_B = formats_B->arr.data;
+	unsigned int count = formats_A->arr.size / sizeof(*fmts_A);
 	unsigned int i;
 
 	if (formats_A->arr.size != formats_B->arr.size)
 		return false;
 
-	wl_array_for_each(fmt_A, &formats_A->arr) {
-		fmt_B = weston_drm_format_array_find_format(formats_B,
-							    fmt_A->format);
-		if (!fmt_B)
+	/* Both arrays are sorted, so equal sets are equal element-wise. */
+	for (i = 0; i < count; i++) {
+		if (fmts_A[i].format != fmts_B[i].format)
 			return false;
-
-		modifiers_A = weston_drm_format_get_modifiers(fmt_A, &num_modifiers_A);
-		weston_drm_format_get_modifiers(fmt_B, &num_modifiers_B);
-		if (num_modifiers_A != num_modifiers_B)
+		if (fmts_A[i].modifiers.size != fmts_B[i].modifiers.size)
+			return false;
+		if (fmts_A[i].modifiers.size != 0 &&
+		    memcmp(fmts_A[i].modifiers.data, fmts_B[i].modifiers.data,
+			   fmts_A[i].modifiers.size) != 0)
 			return false;
-		for (i = 0; i < num_modifiers_A; i++)
-			if (!weston_drm_format_has_modifier(fmt_B, modifiers_A[i]))
-				return false;
 	}
 
 	return true;
 }
 
-/**
- * Joins two weston_drm_format_array, keeping the result in A
- *
- * @param formats_A The weston_drm_format_array that receives the formats from B
- * @param formats_B The weston_drm_format_array whose formats are added to A
- * @return 0 on success, -1 on failure
- */
-WL_EXPORT int
-weston_drm_format_array_join(struct weston_drm_format_array *formats_A,
-			     const struct weston_drm_format_array *formats_B)
-{
-	struct weston_drm_format *fmt_A, *fmt_B;
-	const uint64_t *modifiers;
-	unsigned int num_modifiers;
-	unsigned int i;
-	int ret;
-
-	wl_array_for_each(fmt_B, &formats_B->arr) {
-		fmt_A = weston_drm_format_array_find_format(formats_A,
-							    fmt_B->format);
-		if (!fmt_A) {
-			fmt_A = weston_drm_format_array_add_format(formats_A,
-								   fmt_B->format);
-			if (!fmt_A)
-				return -1;
-		}
-
-		modifiers = weston_drm_format_get_modifiers(fmt_B, &num_modifiers);
-		for (i = 0; i < num_modifiers; i++) {
-			if (weston_drm_format_has_modifier(fmt_A, modifiers[i]))
-				continue;
-			ret = weston_drm_format_add_modifier(fmt_A, modifiers[i]);
-			if (ret < 0)
-				return -1;
-		}
-	}
-
-	return 0;
-}
+enum modifiers_op {
+	MODIFIERS_UNION,
+	MODIFIERS_INTERSECT,
+	MODIFIERS_SUBTRACT,
+};
 
+/* Merge the sorted modifier sets of A and B into modifiers_result. */
 static int
-modifiers_intersect(const struct weston_drm_format *fmt_A,
-		    const struct weston_drm_format *fmt_B,
-		    struct wl_array *modifiers_result)
+modifiers_merge(const struct weston_drm_format *fmt_A,
+		const struct weston_drm_format *fmt_B,
+		enum modifiers_op op, struct wl_array *modifiers_result)
 {
-	const uint64_t *modifiers;
-	unsigned int num_modifiers;
-	uint64_t *mod;
-	unsigned int i;
-
-	modifiers = weston_drm_format_get_modifiers(fmt_A, &num_modifiers);
-	for (i = 0; i < num_modifiers; i++) {
-		if (!weston_drm_format_has_modifier(fmt_B, modifiers[i]))
-			continue;
-		mod = wl_array_add(modifiers_result, sizeof(modifiers[i]));
-		if (!mod) {
-			weston_log("%s: out of memory\n", __func__);
-			return -1;
+	const uint64_t *mods_A, *mods_B;
+	unsigned int num_A, num_B;
+	unsigned int i = 0, j = 0;
+	int ret = 0;
+
+	mods_A = weston_drm_format_get_modifiers(fmt_A, &num_A);
+	mods_B = weston_drm_format_get_modifiers(fmt_B, &num_B);
+
+	while ((i < num_A || j < num_B) && ret == 0) {
+		if (j == num_B || (i < num_A && mods_A[i] < mods_B[j])) {
+			if (op != MODIFIERS_INTERSECT)
+				ret = append_modifier(modifiers_result, mods_A[i]);
+			i++;
+		} else if (i == num_A || mods_B[j] < mods_A[i]) {
+			if (op == MODIFIERS_UNION)
+				ret = append_modifier(modifiers_result, mods_B[j]);
+			j++;
+		} else {
+			if (op != MODIFIERS_SUBTRACT)
+				ret = append_modifier(modifiers_result, mods_A[i]);
+			i++;
+			j++;
 		}
-		*mod = modifiers[i];
 	}
 
-	return 0;
+	return ret;
 }
 
-/**
- * Compute the intersection between two DRM-format arrays, keeping the result in A
- *
- * @param formats_A The weston_drm_format_array that keeps the result
- * @param formats_B The other weston_drm_format_array
- * @return 0 on success, -1 on failure
- */
-WL_EXPORT int
-weston_drm_format_array_intersect(struct weston_drm_format_array *formats_A,
-				  const struct weston_drm_format_array *formats_B)
+/* Walk both sorted format arrays at once and keep the result in A. */
+static int
+format_array_merge(struct weston_drm_format_array *formats_A,
+		   const struct weston_drm_format_array *formats_B,
+		   enum modifiers_op op)
 {
 	struct weston_drm_format_array formats_result;
-	struct weston_drm_format *fmt_result, *fmt_A, *fmt_B;
+	struct weston_drm_format *fmts_A = formats_A->arr.data;
+	struct weston_drm_format *fmts_B = formats_B->arr.data;
+	struct weston_drm_format *fmt_result;
+	unsigned int num_A = formats_A->arr.size / sizeof(*fmts_A);
+	unsigned int num_B = formats_B->arr.size / sizeof(*fmts_B);
+	unsigned int i = 0, j = 0;
 	int ret;
 
 	weston_drm_format_array_init(&formats_result);
 
-	wl_array_for_each(fmt_A, &formats_A->arr) {
-		fmt_B = weston_drm_format_array_find_format(formats_B,
-							    fmt_A->format);
-		if (!fmt_B)
-			continue;
-
-		fmt_result = weston_drm_format_array_add_format(&formats_result,
-								fmt_A->format);
-		if (!fmt_result)
-			goto err;
+	while (i < num_A || j < num_B) {
+		if (j == num_B ||
+		    (i < num_A && fmts_A[i].format < fmts_B[j].format)) {
+			if (op != MODIFIERS_INTERSECT) {
+				ret = add_format_and_modifiers(&formats_result,
+							       fmts_A[i].format,
+							       &fmts_A[i].modifiers);
+				if (ret < 0)
+					goto err;
+			}
+			i++;
+		} else if (i == num_A || fmts_B[j].format < fmts_A[i].format) {
+			if (op == MODIFIERS_UNION) {
+				ret = add_format_and_modifiers(&formats_result,
+							       fmts_B[j].format,
+							       &fmts_B[j].modifiers);
+				if (ret < 0)
+					goto err;
+			}
+			j++;
+		} else {
+			fmt_result = append_format(&formats_result,
+						   fmts_A[i].format);
+			if (!fmt_result)
+				goto err;
 
-		ret = modifiers_intersect(fmt_A, fmt_B, &fmt_result->modifiers);
-		if (ret < 0)
-			goto err;
+			ret = modifiers_merge(&fmts_A[i], &fmts_B[j], op,
+					      &fmt_result->modifiers);
+			if (ret < 0)
+				goto err;
 
-		if (fmt_result->modifiers.size == 0)
-			weston_drm_format_array_remove_latest_format(&formats_result);
+			if (fmt_result->modifiers.size == 0)
+				weston_drm_format_array_remove_latest_format(&formats_result);
+			i++;
+			j++;
+		}
 	}
 
-	ret = weston_drm_format_array_replace(formats_A, &formats_result);
-	if (ret < 0)
-		goto err;
-
-	weston_drm_format_array_fini(&formats_result);
+	format_array_move(formats_A, &formats_result);
 	return 0;
 
 err:
@@ -352,29 +449,32 @@ err:
 	return -1;
 }
 
-static int
-modifiers_subtract(const struct weston_drm_format *fmt_A,
-		   const struct weston_drm_format *fmt_B,
-		   struct wl_array *modifiers_result)
+/**
+ * Joins two weston_drm_format_array, keeping the result in A
+ *
+ * @param formats_A The weston_drm_format_array that receives the formats from B
+ * @param formats_B The weston_drm_format_array whose formats are added to A
+ * @return 0 on success, -1 on failure
+ */
+WL_EXPORT int
+weston_drm_format_array_join(struct weston_drm_format_array *formats_A,
+			     const struct weston_drm_format_array *formats_B)
 {
-	const uint64_t *modifiers;
-	unsigned int num_modifiers;
-	uint64_t *mod;
-	unsigned int i;
-
-	modifiers = weston_drm_format_get_modifiers(fmt_A, &num_modifiers);
-	for (i = 0; i < num_modifiers; i++) {
-		if (weston_drm_format_has_modifier(fmt_B, modifiers[i]))
-			continue;
-		mod = wl_array_add(modifiers_result, sizeof(modifiers[i]));
-		if (!mod) {
-			weston_log("%s: out of memory\n", __func__);
-			return -1;
-		}
-		*mod = modifiers[i];
-	}
+	return format_array_merge(formats_A, formats_B, MODIFIERS_UNION);
+}
 
-	return 0;
+/**
+ * Compute the intersection between two DRM-format arrays, keeping the result in A
+ *
+ * @param formats_A The weston_drm_format_array that keeps the result
+ * @param formats_B The other weston_drm_format_array
+ * @return 0 on success, -1 on failure
+ */
+WL_EXPORT int
+weston_drm_format_array_intersect(struct weston_drm_format_array *formats_A,
+				  const struct weston_drm_format_array *formats_B)
+{
+	return format_array_merge(formats_A, formats_B, MODIFIERS_INTERSECT);
 }
 
 /**
@@ -388,47 +488,7 @@ WL_EXPORT int
 weston_drm_format_array_subtract(struct weston_drm_format_array *formats_A,
 				 const struct weston_drm_format_array *formats_B)
 {
-	struct weston_drm_format_array formats_result;
-	struct weston_drm_format *fmt_result, *fmt_A, *fmt_B;
-	int ret;
-
-	weston_drm_format_array_init(&formats_result);
-
-	wl_array_for_each(fmt_A, &formats_A->arr) {
-		fmt_B = weston_drm_format_array_find_format(formats_B,
-							    fmt_A->format);
-		if (!fmt_B) {
-			ret = add_format_and_modifiers(&formats_result, fmt_A->format,
-						       &fmt_A->modifiers);
-			if (ret < 0)
-				goto err;
-
-			continue;
-		}
-
-		fmt_result = weston_drm_format_array_add_format(&formats_result,
-								fmt_A->format);
-		if (!fmt_result)
-			goto err;
-
-		ret = modifiers_subtract(fmt_A, fmt_B, &fmt_result->modifiers);
-		if (ret < 0)
-			goto err;
-
-		if (fmt_result->modifiers.size == 0)
-			weston_drm_format_array_remove_latest_format(&formats_result);
-	}
-
-	ret = weston_drm_format_array_replace(formats_A, &formats_result);
-	if (ret < 0)
-		goto err;
-
-	weston_drm_format_array_fini(&formats_result);
-	return 0;
-
-err:
-	weston_drm_format_array_fini(&formats_result);
-	return -1;
+	return format_array_merge(formats_A, formats_B, MODIFIERS_SUBTRACT);
 }
 
 /**
@@ -445,17 +505,23 @@ WL_EXPORT int
 weston_drm_format_add_modifier(struct weston_drm_format *format,
 			       uint64_t modifier)
 {
-	uint64_t *mod;
+	unsigned int count = format->modifiers.size / sizeof(uint64_t);
+	unsigned int index = modifier_lower_bound(format, modifier);
+	uint64_t *mods;
 
 	/* We should not try to add repeated modifiers to a set. */
-	assert(!weston_drm_format_has_modifier(format, modifier));
+	assert(index == count ||
+	       ((uint64_t *)format->modifiers.data)[index] != modifier);
 
-	mod = wl_array_add(&format->modifiers, sizeof(*mod));
-	if (!mod) {
+	if (!wl_array_add(&format->modifiers, sizeof(*mods))) {
 		weston_log("%s: out of memory\n", __func__);
 		return -1;
 	}
-	*mod = modifier;
+
+	mods = format->modifiers.data;
+	memmove(&mods[index + 1], &mods[index],
+		(count - index) * sizeof(*mods));
+	mods[index] = modifier;
 
 	return 0;
 }
@@ -474,19 +540,18 @@ weston_drm_format_has_modifier(const struct weston_drm_format *format,
 {
 	const uint64_t *modifiers;
 	unsigned int num_modifiers;
-	unsigned int i;
+	unsigned int index = modifier_lower_bound(format, modifier);
 
 	modifiers = weston_drm_format_get_modifiers(format, &num_modifiers);
-	for (i = 0; i < num_modifiers; i++)
-		if (modifiers[i] == modifier)
-			return true;
 
-	return false;
+	return index < num_modifiers && modifiers[index] == modifier;
 }
 
 /**
  * Get array of modifiers and modifiers count from a weston_drm_format
  *
+ * The modifiers are sorted in ascending order.
+ *
  * @param format The weston_drm_format that contains the modifiers
  * @param count_out Parameter that receives the modifiers count
  * @return The array of modifiers
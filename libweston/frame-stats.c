@@ -0,0 +1,338 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "frame-stats.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/*
+ * Per-output frame statistics for the "frame-stats" debug scope. Nothing
+ * is recorded while the scope has no subscribers. Samples go into
+ * log-linear histograms, with four buckets per power of two microseconds,
+ * and a one line summary per output is printed every period.
+ *
+ * The commit-to-present latency is measured from the oldest commit with
+ * damage on the output that is not yet repainted, to the presentation of
+ * the frame that repaint produced.
+ */
+
+#define FRAME_STATS_SUB_BITS 2
+#define FRAME_STATS_SUB_BUCKETS (1 << FRAME_STATS_SUB_BITS)
+#define FRAME_STATS_BUCKETS (64 * FRAME_STATS_SUB_BUCKETS)
+#define FRAME_STATS_PERIOD_NSEC 5000000000LL
+
+enum frame_stats_metric {
+	FRAME_STATS_LATENCY = 0,
+	FRAME_STATS_REPAINT,
+	FRAME_STATS_GPU,
+	FRAME_STATS__COUNT
+};
+
+static const char *const frame_stats_metric_name[] = {
+	[FRAME_STATS_LATENCY] = "latency",
+	[FRAME_STATS_REPAINT] = "repaint",
+	[FRAME_STATS_GPU] = "gpu",
+};
+
+struct frame_stats_histogram {
+	uint32_t count;
+	uint64_t max_usec;
+	uint32_t buckets[FRAME_STATS_BUCKETS];
+};
+
+struct weston_frame_stats {
+	struct frame_stats_histogram hist[FRAME_STATS__COUNT];
+	uint32_t frames;
+	uint32_t missed;
+	struct timespec period_start;
+	struct timespec first_commit;	/* oldest commit not yet repainted */
+	struct timespec frame_commit;	/* oldest commit in the pending frame */
+	struct timespec repaint_start;	/* start of the pending repaint */
+};
+
+static unsigned int
+frame_stats_bucket(uint64_t usec)
+{
+	unsigned int msb;
+
+	if (usec < FRAME_STATS_SUB_BUCKETS)
+		return usec;
+
+	msb = 63 - __builtin_clzll(usec);
+
+	return (msb - FRAME_STATS_SUB_BITS + 1) * FRAME_STATS_SUB_BUCKETS +
+	       ((usec >> (msb - FRAME_STATS_SUB_BITS)) &
+		(FRAME_STATS_SUB_BUCKETS - 1));
+}
+
+/* The largest value that falls into the given bucket */
+static uint64_t
+frame_stats_bucket_max(unsigned int bucket)
+{
+	unsigned int shift;
+	uint64_t base;
+
+	if (bucket < FRAME_STATS_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / FRAME_STATS_SUB_BUCKETS - 1;
+	base = (uint64_t)(FRAME_STATS_SUB_BUCKETS +
+			  bucket % FRAME_STATS_SUB_BUCKETS) << shift;
+
+	return base + (UINT64_C(1) << shift) - 1;
+}
+
+static void
+frame_stats_histogram_add(struct frame_stats_histogram *hist, int64_t nsec)
+{
+	uint64_t usec = nsec > 0 ? nsec / 1000 : 0;
+
+	hist->buckets[frame_stats_bucket(usec)]++;
+	hist->count++;
+	if (usec > hist->max_usec)
+		hist->max_usec = usec;
+}
+
+static uint64_t
+frame_stats_histogram_percentile(const struct frame_stats_histogram *hist,
+				 unsigned int percent)
+{
+	uint64_t rank = ((uint64_t)hist->count * percent + 99) / 100;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < FRAME_STATS_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			return MIN(frame_stats_bucket_max(i), hist->max_usec);
+	}
+
+	return hist->max_usec;
+}
+
+static void
+frame_stats_reset(struct weston_frame_stats *stats,
+		  const struct timespec *now)
+{
+	memset(stats->hist, 0, sizeof stats->hist);
+	stats->frames = 0;
+	stats->missed = 0;
+	stats->period_start = *now;
+}
+
+static struct weston_frame_stats *
+frame_stats_get(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+
+	if (!weston_log_scope_is_enabled(compositor->frame_stats_scope))
+		return NULL;
+
+	if (!output->frame_stats) {
+		struct timespec now;
+
+		output->frame_stats = xzalloc(sizeof *output->frame_stats);
+		weston_compositor_read_presentation_clock(compositor, &now);
+		frame_stats_reset(output->frame_stats, &now);
+	}
+
+	return output->frame_stats;
+}
+
+static void
+frame_stats_print(struct weston_output *output,
+		  struct weston_frame_stats *stats,
+		  const struct timespec *now)
+{
+	struct weston_log_scope *scope = output->compositor->frame_stats_scope;
+	char buf[512];
+	size_t len;
+	unsigned int i;
+
+	len = snprintf(buf, sizeof buf, "[%s] %.1f s: %" PRIu32 " frames, "
+		       "%" PRIu32 " missed",
+		       output->name,
+		       timespec_sub_to_nsec(now, &stats->period_start) / 1e9,
+		       stats->frames, stats->missed);
+
+	for (i = 0; i < FRAME_STATS__COUNT && len < sizeof buf; i++) {
+		const struct frame_stats_histogram *hist = &stats->hist[i];
+
+		if (hist->count == 0)
+			continue;
+
+		len += snprintf(buf + len, sizeof buf - len,
+				"; %s us p50 %" PRIu64 " p90 %" PRIu64
+				" p99 %" PRIu64 " max %" PRIu64,
+				frame_stats_metric_name[i],
+				frame_stats_histogram_percentile(hist, 50),
+				frame_stats_histogram_percentile(hist, 90),
+				frame_stats_histogram_percentile(hist, 99),
+				hist->max_usec);
+	}
+
+	weston_log_scope_printf(scope, "%s\n", buf);
+}
+
+/** Start a new period for every output when someone subscribes */
+void
+weston_frame_stats_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+	struct timespec now;
+
+	weston_log_subscription_printf(sub,
+		"frame-stats: per-output summary every %lld s; latency is "
+		"commit to present, repaint is repaint start to present, gpu "
+		"is renderer GPU time\n",
+		FRAME_STATS_PERIOD_NSEC / 1000000000LL);
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->frame_stats)
+			frame_stats_reset(output->frame_stats, &now);
+	}
+}
+
+void
+weston_frame_stats_destroy(struct weston_frame_stats *stats)
+{
+	free(stats);
+}
+
+/** Note damage committed on a surface, for the outputs it is shown on */
+void
+weston_frame_stats_surface_commit(struct weston_surface *surface)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	struct weston_output *output;
+	struct timespec now;
+	bool have_now = false;
+
+	if (!weston_log_scope_is_enabled(compositor->frame_stats_scope))
+		return;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		struct weston_frame_stats *stats;
+
+		if (!(surface->output_mask & (1u << output->id)))
+			continue;
+
+		stats = frame_stats_get(output);
+		if (!timespec_is_zero(&stats->first_commit))
+			continue;
+
+		if (!have_now) {
+			weston_compositor_read_presentation_clock(compositor,
+								  &now);
+			have_now = true;
+		}
+		stats->first_commit = now;
+	}
+}
+
+void
+weston_frame_stats_repaint_begin(struct weston_output *output,
+				 const struct timespec *now)
+{
+	struct weston_frame_stats *stats = frame_stats_get(output);
+
+	if (!stats)
+		return;
+
+	stats->frame_commit = stats->first_commit;
+	stats->first_commit = (struct timespec) { 0 };
+	stats->repaint_start = *now;
+}
+
+/** Account for a presented frame
+ *
+ * \param output The output the frame was presented on.
+ * \param stamp The presentation time, or NULL if unknown.
+ */
+void
+weston_frame_stats_frame_done(struct weston_output *output,
+			      const struct timespec *stamp)
+{
+	struct weston_frame_stats *stats = frame_stats_get(output);
+
+	if (!stats)
+		return;
+
+	/* Also called when a repaint loop starts, without a repaint */
+	if (timespec_is_zero(&stats->repaint_start))
+		return;
+
+	if (stamp) {
+		stats->frames++;
+		frame_stats_histogram_add(&stats->hist[FRAME_STATS_REPAINT],
+					  timespec_sub_to_nsec(stamp,
+							       &stats->repaint_start));
+		if (!timespec_is_zero(&stats->frame_commit))
+			frame_stats_histogram_add(&stats->hist[FRAME_STATS_LATENCY],
+						  timespec_sub_to_nsec(stamp,
+								       &stats->frame_commit));
+
+		if (timespec_sub_to_nsec(stamp, &stats->period_start) >=
+		    FRAME_STATS_PERIOD_NSEC) {
+			frame_stats_print(output, stats, stamp);
+			frame_stats_reset(stats, stamp);
+		}
+	}
+
+	stats->repaint_start = (struct timespec) { 0 };
+	stats->frame_commit = (struct timespec) { 0 };
+}
+
+void
+weston_frame_stats_missed_vblank(struct weston_output *output)
+{
+	struct weston_frame_stats *stats = frame_stats_get(output);
+
+	if (stats)
+		stats->missed++;
+}
+
+/** Record the GPU time the renderer spent on one repaint of an output */
+WL_EXPORT void
+weston_frame_stats_gpu_time(struct weston_output *output, int64_t nsec)
+{
+	struct weston_frame_stats *stats = frame_stats_get(output);
+
+	if (stats)
+		frame_stats_histogram_add(&stats->hist[FRAME_STATS_GPU], nsec);
+}
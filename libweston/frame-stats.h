@@ -0,0 +1,61 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_FRAME_STATS_H
+#define WESTON_FRAME_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+struct weston_compositor;
+struct weston_frame_stats;
+struct weston_log_subscription;
+struct weston_output;
+struct weston_surface;
+
+void
+weston_frame_stats_subscribe(struct weston_log_subscription *sub, void *data);
+
+void
+weston_frame_stats_destroy(struct weston_frame_stats *stats);
+
+void
+weston_frame_stats_surface_commit(struct weston_surface *surface);
+
+void
+weston_frame_stats_repaint_begin(struct weston_output *output,
+				 const struct timespec *now);
+
+void
+weston_frame_stats_frame_done(struct weston_output *output,
+			      const struct timespec *stamp);
+
+void
+weston_frame_stats_missed_vblank(struct weston_output *output);
+
+void
+weston_frame_stats_gpu_time(struct weston_output *output, int64_t nsec);
+
+#endif /* WESTON_FRAME_STATS_H */
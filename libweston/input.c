@@ -40,13 +40,16 @@
 #include <errno.h>
 #include <linux/input.h>
 
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "shared/timespec-util.h"
+#include "shared/xalloc.h"
 #include <libweston/libweston.h>
 #include <libweston/desktop.h>
 #include "backend.h"
 #include "libweston-internal.h"
+#include "metrics.h"
 #include "relative-pointer-unstable-v1-server-protocol.h"
 #include "pointer-constraints-unstable-v1-server-protocol.h"
 #include "input-timestamps-unstable-v1-server-protocol.h"
@@ -530,9 +533,18 @@ pointer_send_relative_motion(struct weston_pointer *pointer,
 }
 
 static void
-pointer_send_motion(struct weston_pointer *pointer,
-		    const struct timespec *time,
-		    wl_fixed_t sx, wl_fixed_t sy)
+pointer_send_frame(struct wl_resource *resource)
+{
+	if (wl_resource_get_version(resource) >=
+	    WL_POINTER_FRAME_SINCE_VERSION) {
+		wl_pointer_send_frame(resource);
+	}
+}
+
+static void
+pointer_send_motion_now(struct weston_pointer *pointer,
+			const struct timespec *time,
+			wl_fixed_t sx, wl_fixed_t sy, bool frame)
 {
 	struct wl_list *resource_list;
 	struct wl_resource *resource;
@@ -548,9 +560,102 @@ pointer_send_motion(struct weston_pointer *pointer,
 		                                   &pointer->timestamps_list,
 		                                   time);
 		wl_pointer_send_motion(resource, msecs, sx, sy);
+		if (frame)
+			pointer_send_frame(resource);
+	}
+}
+
+static void
+pointer_schedule_motion_flush(struct weston_pointer *pointer)
+{
+	struct weston_compositor *ec = pointer->seat->compositor;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!weston_output_contains_coord(output, pointer->pos))
+			continue;
+
+		weston_output_schedule_repaint(output);
+		if (output->repaint_needed)
+			return;
+		break;
+	}
+
+	/* Nothing will repaint on our behalf, e.g. the output is off. */
+	weston_pointer_flush_motion(pointer);
+}
+
+static void
+pointer_send_motion(struct weston_pointer *pointer,
+		    const struct timespec *time,
+		    wl_fixed_t sx, wl_fixed_t sy)
+{
+	if (!pointer->focus_client)
+		return;
+
+	if (!pointer->coalesce_motion) {
+		pointer_send_motion_now(pointer, time, sx, sy, false);
+		return;
+	}
+
+	/* Only the latest position is kept; it goes out together with its
+	 * own wl_pointer.frame once the output under the pointer repaints,
+	 * or earlier if any other pointer event needs to be ordered after
+	 * it. */
+	pointer->pending_sx = sx;
+	pointer->pending_sy = sy;
+	pointer->pending_time = *time;
+	if (!pointer->motion_pending) {
+		pointer->motion_pending = true;
+		pointer_schedule_motion_flush(pointer);
+	} else {
+		weston_metric_inc(pointer->seat->compositor,
+				  WESTON_METRIC_INPUT_FRAMES_COALESCED);
 	}
 }
 
+/** Send any wl_pointer.motion held back by motion coalescing.
+ *
+ * \param pointer The pointer to flush.
+ *
+ * Called before every repaint, and before any other event that must be
+ * ordered after the pending motion.
+ */
+void
+weston_pointer_flush_motion(struct weston_pointer *pointer)
+{
+	if (!pointer->motion_pending)
+		return;
+
+	pointer->motion_pending = false;
+	pointer_send_motion_now(pointer, &pointer->pending_time,
+				pointer->pending_sx, pointer->pending_sy, true);
+}
+
+/** Enable or disable wl_pointer.motion coalescing.
+ *
+ * \param pointer The pointer to configure.
+ * \param enable Whether to coalesce motion.
+ *
+ * When enabled, absolute motion sent to the focused client is collapsed to
+ * at most one wl_pointer.motion per repaint of the output under the pointer,
+ * always carrying the most recent position. Buttons, axis and focus changes
+ * flush any pending motion first, so event order is preserved. Relative
+ * motion is never coalesced.
+ *
+ * This reduces protocol traffic and wakeups for clients that cannot keep up
+ * with high report-rate mice.
+ */
+WL_EXPORT void
+weston_pointer_set_motion_coalescing(struct weston_pointer *pointer,
+				     bool enable)
+{
+	if (!enable)
+		weston_pointer_flush_motion(pointer);
+
+	pointer->coalesce_motion = enable;
+}
+
 WL_EXPORT void
 weston_pointer_send_motion(struct weston_pointer *pointer,
 			   const struct timespec *time,
@@ -635,6 +740,8 @@ weston_pointer_send_button(struct weston_pointer *pointer,
 	uint32_t serial;
 	uint32_t msecs;
 
+	weston_pointer_flush_motion(pointer);
+
 	if (!weston_pointer_has_focus_resource(pointer))
 		return;
 
@@ -688,6 +795,8 @@ weston_pointer_send_axis(struct weston_pointer *pointer,
 	struct wl_list *resource_list;
 	uint32_t msecs;
 
+	weston_pointer_flush_motion(pointer);
+
 	if (!weston_pointer_has_focus_resource(pointer))
 		return;
 
@@ -734,6 +843,8 @@ weston_pointer_send_axis_source(struct weston_pointer *pointer,
 	struct wl_resource *resource;
 	struct wl_list *resource_list;
 
+	weston_pointer_flush_motion(pointer);
+
 	if (!weston_pointer_has_focus_resource(pointer))
 		return;
 
@@ -746,15 +857,6 @@ weston_pointer_send_axis_source(struct weston_pointer *pointer,
 	}
 }
 
-static void
-pointer_send_frame(struct wl_resource *resource)
-{
-	if (wl_resource_get_version(resource) >=
-	    WL_POINTER_FRAME_SINCE_VERSION) {
-		wl_pointer_send_frame(resource);
-	}
-}
-
 /** Send wl_pointer.frame events to focused resources.
  *
  * \param pointer The pointer where the frame events originates from.
@@ -769,6 +871,10 @@ weston_pointer_send_frame(struct weston_pointer *pointer)
 	struct wl_resource *resource;
 	struct wl_list *resource_list;
 
+	/* The pending motion carries its own frame. */
+	if (pointer->motion_pending)
+		return;
+
 	if (!weston_pointer_has_focus_resource(pointer))
 		return;
 
@@ -853,6 +959,8 @@ weston_touch_send_down(struct weston_touch *touch, const struct timespec *time,
 	struct weston_coord_surface surf_pos;
 	uint32_t msecs;
 
+	weston_touch_flush_motion(touch);
+
 	if (!weston_touch_has_focus_resource(touch))
 		return;
 
@@ -903,6 +1011,8 @@ weston_touch_send_up(struct weston_touch *touch, const struct timespec *time,
 	struct wl_list *resource_list;
 	uint32_t msecs;
 
+	weston_touch_flush_motion(touch);
+
 	if (!weston_touch_has_focus_resource(touch))
 		return;
 
@@ -924,21 +1034,10 @@ default_grab_touch_up(struct weston_touch_grab *grab,
 	weston_touch_send_up(grab->touch, time, touch_id);
 }
 
-/** Send wl_touch.motion events to focused resources.
- *
- * \param touch The touch where the motion events originates from.
- * \param time The timestamp of the event
- * \param touch_id The touch_id value of the event
- * \param pos The global coordinate of the event
- *
- * For every resource that is currently in focus, send a wl_touch.motion event
- * with the passed parameters. The focused resources are the wl_touch
- * resources of the client which currently has the surface with touch focus.
- */
-WL_EXPORT void
-weston_touch_send_motion(struct weston_touch *touch,
-			 const struct timespec *time, int touch_id,
-			 struct weston_coord_global pos)
+static void
+touch_send_motion_now(struct weston_touch *touch,
+		      const struct timespec *time, int touch_id,
+		      struct weston_coord_global pos)
 {
 	struct wl_resource *resource;
 	struct wl_list *resource_list;
@@ -964,6 +1063,139 @@ weston_touch_send_motion(struct weston_touch *touch,
 	}
 }
 
+struct weston_touch_pending_motion {
+	int touch_id;
+	struct weston_coord_global pos;
+	struct timespec time;
+};
+
+static void
+touch_schedule_motion_flush(struct weston_touch *touch,
+			    struct weston_coord_global pos)
+{
+	struct weston_compositor *ec = touch->seat->compositor;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!weston_output_contains_coord(output, pos))
+			continue;
+
+		weston_output_schedule_repaint(output);
+		if (output->repaint_needed)
+			return;
+		break;
+	}
+
+	/* Nothing will repaint on our behalf, e.g. the output is off. */
+	weston_touch_flush_motion(touch);
+}
+
+/** Send wl_touch.motion events to focused resources.
+ *
+ * \param touch The touch where the motion events originates from.
+ * \param time The timestamp of the event
+ * \param touch_id The touch_id value of the event
+ * \param pos The global coordinate of the event
+ *
+ * For every resource that is currently in focus, send a wl_touch.motion event
+ * with the passed parameters. The focused resources are the wl_touch
+ * resources of the client which currently has the surface with touch focus.
+ *
+ * With motion coalescing, only the latest position of each touch point is
+ * kept until the next repaint, see weston_touch_set_motion_coalescing().
+ */
+WL_EXPORT void
+weston_touch_send_motion(struct weston_touch *touch,
+			 const struct timespec *time, int touch_id,
+			 struct weston_coord_global pos)
+{
+	struct weston_touch_pending_motion *motion;
+	bool was_pending;
+
+	if (!touch->coalesce_motion) {
+		touch_send_motion_now(touch, time, touch_id, pos);
+		return;
+	}
+
+	if (!weston_touch_has_focus_resource(touch))
+		return;
+
+	was_pending = touch->pending_motion.size > 0;
+
+	wl_array_for_each(motion, &touch->pending_motion) {
+		if (motion->touch_id == touch_id) {
+			motion->pos = pos;
+			motion->time = *time;
+			weston_metric_inc(touch->seat->compositor,
+					  WESTON_METRIC_INPUT_FRAMES_COALESCED);
+			return;
+		}
+	}
+
+	motion = wl_array_add(&touch->pending_motion, sizeof *motion);
+	abort_oom_if_null(motion);
+	motion->touch_id = touch_id;
+	motion->pos = pos;
+	motion->time = *time;
+
+	if (!was_pending)
+		touch_schedule_motion_flush(touch, pos);
+}
+
+/** Send any wl_touch.motion held back by motion coalescing.
+ *
+ * \param touch The touch to flush.
+ *
+ * Called before every repaint, and before any other event that must be
+ * ordered after the pending motion. The wl_touch.frame that followed the
+ * motion goes out with it.
+ */
+void
+weston_touch_flush_motion(struct weston_touch *touch)
+{
+	struct weston_touch_pending_motion *motion;
+	struct wl_resource *resource;
+	bool frame = touch->frame_pending;
+
+	if (touch->pending_motion.size == 0)
+		return;
+
+	wl_array_for_each(motion, &touch->pending_motion)
+		touch_send_motion_now(touch, &motion->time,
+				      motion->touch_id, motion->pos);
+	touch->pending_motion.size = 0;
+	touch->frame_pending = false;
+
+	if (!frame || !weston_touch_has_focus_resource(touch))
+		return;
+
+	wl_resource_for_each(resource, &touch->focus_resource_list)
+		wl_touch_send_frame(resource);
+}
+
+/** Enable or disable wl_touch.motion coalescing.
+ *
+ * \param touch The touch to configure.
+ * \param enable Whether to coalesce motion.
+ *
+ * When enabled, wl_touch.motion sent to the focused client is collapsed to
+ * at most one event per touch point and repaint of the output under the
+ * touch, always carrying the most recent position, followed by a single
+ * wl_touch.frame. Down and up events and focus changes flush any pending
+ * motion first, so event order is preserved.
+ *
+ * This reduces protocol traffic and wakeups for clients on high report-rate
+ * touchscreens with many touch points.
+ */
+WL_EXPORT void
+weston_touch_set_motion_coalescing(struct weston_touch *touch, bool enable)
+{
+	if (!enable)
+		weston_touch_flush_motion(touch);
+
+	touch->coalesce_motion = enable;
+}
+
 static void
 default_grab_touch_motion(struct weston_touch_grab *grab,
 			  const struct timespec *time, int touch_id,
@@ -986,6 +1218,12 @@ weston_touch_send_frame(struct weston_touch *touch)
 {
 	struct wl_resource *resource;
 
+	/* The pending motion carries its own frame. */
+	if (touch->pending_motion.size > 0) {
+		touch->frame_pending = true;
+		return;
+	}
+
 	if (!weston_touch_has_focus_resource(touch))
 		return;
 
@@ -1282,6 +1520,8 @@ weston_pointer_create(struct weston_seat *seat)
 	/* FIXME: Pick better co-ords. */
 	pointer->pos.c = weston_coord(100, 100);
 
+	pointer->coalesce_motion = seat->compositor->coalesce_pointer_motion;
+
 	pointer->output_destroy_listener.notify =
 		weston_pointer_handle_output_destroy;
 	wl_signal_add(&seat->compositor->output_destroyed_signal,
@@ -1404,6 +1644,7 @@ weston_touch_create(void)
 	touch->grab = &touch->default_grab;
 	wl_signal_init(&touch->focus_signal);
 	wl_list_init(&touch->timestamps_list);
+	wl_array_init(&touch->pending_motion);
 
 	return touch;
 }
@@ -1428,6 +1669,7 @@ weston_touch_destroy(struct weston_touch *touch)
 	wl_list_remove(&touch->focus_view_listener.link);
 	wl_list_remove(&touch->focus_resource_listener.link);
 	wl_list_remove(&touch->timestamps_list);
+	wl_array_release(&touch->pending_motion);
 	free(touch);
 }
 
@@ -1470,6 +1712,33 @@ weston_tablet_destroy(struct weston_tablet *tablet)
 	}
 }
 
+enum tablet_tool_pending_axis {
+	TABLET_TOOL_PENDING_MOTION = 1 << 0,
+	TABLET_TOOL_PENDING_PRESSURE = 1 << 1,
+	TABLET_TOOL_PENDING_DISTANCE = 1 << 2,
+	TABLET_TOOL_PENDING_TILT = 1 << 3,
+};
+
+static void
+tablet_tool_schedule_motion_flush(struct weston_tablet_tool *tool)
+{
+	struct weston_compositor *ec = tool->seat->compositor;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!weston_output_contains_coord(output, tool->pos))
+			continue;
+
+		weston_output_schedule_repaint(output);
+		if (output->repaint_needed)
+			return;
+		break;
+	}
+
+	/* Nothing will repaint on our behalf, e.g. the output is off. */
+	weston_tablet_tool_flush_motion(tool);
+}
+
 WL_EXPORT void
 weston_tablet_tool_set_focus(struct weston_tablet_tool *tool,
 			     struct weston_view *view,
@@ -1480,6 +1749,8 @@ weston_tablet_tool_set_focus(struct weston_tablet_tool *tool,
 	struct weston_seat *seat = tool->seat;
 	uint32_t msecs;
 
+	weston_tablet_tool_flush_motion(tool);
+
 	focus_resource_list = &tool->focus_resource_list;
 	/* FIXME: correct timestamp? */
 	msecs = time ? timespec_to_msec(time) : 0;
@@ -1592,6 +1863,13 @@ weston_tablet_tool_send_motion(struct weston_tablet_tool *tool,
 	weston_tablet_tool_cursor_move(tool, pos);
 	surf_pos = weston_coord_global_to_surface(tool->focus, pos);
 
+	if (tool->coalesce_motion) {
+		tool->pending_sx = wl_fixed_from_double(surf_pos.c.x);
+		tool->pending_sy = wl_fixed_from_double(surf_pos.c.y);
+		tool->pending_axes |= TABLET_TOOL_PENDING_MOTION;
+		return;
+	}
+
 	wl_resource_for_each(resource, &tool->focus_resource_list) {
 		zwp_tablet_tool_v2_send_motion(resource,
 					       wl_fixed_from_double(surf_pos.c.x),
@@ -1614,6 +1892,8 @@ weston_tablet_tool_send_down(struct weston_tablet_tool *tool,
 	struct wl_resource *resource;
 	struct wl_list *resource_list = &tool->focus_resource_list;
 
+	weston_tablet_tool_flush_motion(tool);
+
 	if (!wl_list_empty(resource_list)) {
 		wl_resource_for_each(resource, resource_list)
 			zwp_tablet_tool_v2_send_down(resource, tool->grab_serial);
@@ -1634,6 +1914,8 @@ weston_tablet_tool_send_up(struct weston_tablet_tool *tool,
 	struct wl_resource *resource;
 	struct wl_list *resource_list = &tool->focus_resource_list;
 
+	weston_tablet_tool_flush_motion(tool);
+
 	if (!wl_list_empty(resource_list)) {
 		wl_resource_for_each(resource, resource_list)
 			zwp_tablet_tool_v2_send_up(resource);
@@ -1655,6 +1937,12 @@ weston_tablet_tool_send_pressure(struct weston_tablet_tool *tool,
 	struct wl_resource *resource;
 	struct wl_list *resource_list = &tool->focus_resource_list;
 
+	if (tool->coalesce_motion) {
+		tool->pending_pressure = pressure;
+		tool->pending_axes |= TABLET_TOOL_PENDING_PRESSURE;
+		return;
+	}
+
 	if (!wl_list_empty(resource_list)) {
 		wl_resource_for_each(resource, resource_list)
 			zwp_tablet_tool_v2_send_pressure(resource, pressure);
@@ -1677,6 +1965,12 @@ weston_tablet_tool_send_distance(struct weston_tablet_tool *tool,
 	struct wl_resource *resource;
 	struct wl_list *resource_list = &tool->focus_resource_list;
 
+	if (tool->coalesce_motion) {
+		tool->pending_distance = distance;
+		tool->pending_axes |= TABLET_TOOL_PENDING_DISTANCE;
+		return;
+	}
+
 	if (!wl_list_empty(resource_list)) {
 		wl_resource_for_each(resource, resource_list)
 			zwp_tablet_tool_v2_send_distance(resource, distance);
@@ -1699,6 +1993,13 @@ weston_tablet_tool_send_tilt(struct weston_tablet_tool *tool,
 	struct wl_resource *resource;
 	struct wl_list *resource_list = &tool->focus_resource_list;
 
+	if (tool->coalesce_motion) {
+		tool->pending_tilt_x = tilt_x;
+		tool->pending_tilt_y = tilt_y;
+		tool->pending_axes |= TABLET_TOOL_PENDING_TILT;
+		return;
+	}
+
 	if (!wl_list_empty(resource_list)) {
 		wl_resource_for_each(resource, resource_list)
 			zwp_tablet_tool_v2_send_tilt(resource, tilt_x, tilt_y);
@@ -1720,6 +2021,8 @@ weston_tablet_tool_send_button(struct weston_tablet_tool *tool,
 {
 	struct wl_resource *resource;
 
+	weston_tablet_tool_flush_motion(tool);
+
 	wl_resource_for_each(resource, &tool->focus_resource_list) {
 		zwp_tablet_tool_v2_send_button(resource, tool->grab_serial,
 					   button, state);
@@ -1743,6 +2046,20 @@ weston_tablet_tool_send_frame(struct weston_tablet_tool *tool,
 	struct wl_list *resource_list = &tool->focus_resource_list;
 	uint32_t msecs;
 
+	/* A frame of nothing but axis changes waits for the repaint, and
+	 * gets replaced if another one comes first. */
+	if (tool->coalesce_motion && tool->pending_axes) {
+		tool->pending_time = *time;
+		if (!tool->frame_pending) {
+			tool->frame_pending = true;
+			tablet_tool_schedule_motion_flush(tool);
+		} else {
+			weston_metric_inc(tool->seat->compositor,
+					  WESTON_METRIC_INPUT_FRAMES_COALESCED);
+		}
+		return;
+	}
+
 	msecs = timespec_to_msec(time);
 	if (!wl_list_empty(resource_list)) {
 		wl_resource_for_each(resource, resource_list)
@@ -1750,6 +2067,69 @@ weston_tablet_tool_send_frame(struct weston_tablet_tool *tool,
 	}
 }
 
+/** Send any tablet tool axis events held back by motion coalescing.
+ *
+ * \param tool The tablet tool to flush.
+ *
+ * Called before every repaint, and before any other event that must be
+ * ordered after the pending axes. The frame goes along only if the one
+ * that was held back is complete.
+ */
+void
+weston_tablet_tool_flush_motion(struct weston_tablet_tool *tool)
+{
+	struct wl_resource *resource;
+	uint32_t axes = tool->pending_axes;
+	bool frame = tool->frame_pending;
+	uint32_t msecs;
+
+	if (!axes)
+		return;
+
+	tool->pending_axes = 0;
+	tool->frame_pending = false;
+
+	msecs = timespec_to_msec(&tool->pending_time);
+	wl_resource_for_each(resource, &tool->focus_resource_list) {
+		if (axes & TABLET_TOOL_PENDING_MOTION)
+			zwp_tablet_tool_v2_send_motion(resource,
+						       tool->pending_sx,
+						       tool->pending_sy);
+		if (axes & TABLET_TOOL_PENDING_PRESSURE)
+			zwp_tablet_tool_v2_send_pressure(resource,
+							 tool->pending_pressure);
+		if (axes & TABLET_TOOL_PENDING_DISTANCE)
+			zwp_tablet_tool_v2_send_distance(resource,
+							 tool->pending_distance);
+		if (axes & TABLET_TOOL_PENDING_TILT)
+			zwp_tablet_tool_v2_send_tilt(resource,
+						     tool->pending_tilt_x,
+						     tool->pending_tilt_y);
+		if (frame)
+			zwp_tablet_tool_v2_send_frame(resource, msecs);
+	}
+}
+
+/** Enable or disable tablet tool motion coalescing.
+ *
+ * \param tool The tablet tool to configure.
+ * \param enable Whether to coalesce motion.
+ *
+ * When enabled, frames that only carry motion, pressure, distance and tilt
+ * are collapsed to at most one per repaint of the output under the tool,
+ * with the latest value of each axis. Tip, button and proximity events
+ * flush the pending axes first, so event order is preserved.
+ */
+WL_EXPORT void
+weston_tablet_tool_set_motion_coalescing(struct weston_tablet_tool *tool,
+					 bool enable)
+{
+	if (!enable)
+		weston_tablet_tool_flush_motion(tool);
+
+	tool->coalesce_motion = enable;
+}
+
 static void
 default_grab_tablet_tool_frame(struct weston_tablet_tool_grab *grab,
 			       const struct timespec *time)
@@ -1919,6 +2299,8 @@ weston_pointer_set_focus(struct weston_pointer *pointer,
 	int refocus = 0;
 	wl_fixed_t sx, sy;
 
+	weston_pointer_flush_motion(pointer);
+
 	if (view) {
 		struct weston_coord_surface surf_pos;
 
@@ -2598,7 +2980,8 @@ send_modifiers(struct wl_resource *resource, uint32_t serial, struct weston_keyb
 }
 
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap);
+weston_xkb_info_create(struct weston_compositor *ec,
+		       struct xkb_keymap *keymap);
 
 static void
 update_keymap(struct weston_seat *seat)
@@ -2610,7 +2993,8 @@ update_keymap(struct weston_seat *seat)
 	xkb_mod_mask_t latched_mods;
 	xkb_mod_mask_t locked_mods;
 
-	xkb_info = weston_xkb_info_create(keyboard->pending_keymap);
+	xkb_info = weston_xkb_info_create(seat->compositor,
+					  keyboard->pending_keymap);
 
 	xkb_keymap_unref(keyboard->pending_keymap);
 	keyboard->pending_keymap = NULL;
@@ -2816,6 +3200,8 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 {
 	struct wl_list *focus_resource_list;
 
+	weston_touch_flush_motion(touch);
+
 	focus_resource_list = &touch->focus_resource_list;
 
 	if (view && touch->focus &&
@@ -3961,15 +4347,95 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	if (--xkb_info->ref_count > 0)
 		return;
 
+	wl_list_remove(&xkb_info->link);
 	xkb_keymap_unref(xkb_info->keymap);
 
 	os_ro_anonymous_file_destroy(xkb_info->keymap_rofile);
 	free(xkb_info);
 }
 
+/** A keymap compiled from rule names, kept for the compositor lifetime */
+struct keymap_cache_entry {
+	struct xkb_rule_names names;
+	struct xkb_keymap *keymap;
+	struct wl_list link; /**< weston_compositor::keymap_cache */
+};
+
+static void
+keymap_cache_entry_destroy(struct keymap_cache_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	xkb_keymap_unref(entry->keymap);
+	free((char *) entry->names.rules);
+	free((char *) entry->names.model);
+	free((char *) entry->names.layout);
+	free((char *) entry->names.variant);
+	free((char *) entry->names.options);
+	free(entry);
+}
+
+static bool
+xkb_name_eq(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return strcmp(a, b) == 0;
+}
+
+static char *
+xkb_name_dup(const char *name)
+{
+	return name ? xstrdup(name) : NULL;
+}
+
+/** Compile a keymap from rule names, or reuse an earlier compilation
+ *
+ * Seats created with the same layout, for example one per remote
+ * client, then share one compiled keymap, and so one weston_xkb_info
+ * and keymap file as well.
+ *
+ * \param ec The compositor, which must have an XKB context.
+ * \param names The rule names to compile.
+ * \return A new reference to the keymap, or NULL on failure.
+ */
+WL_EXPORT struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names)
+{
+	struct keymap_cache_entry *entry;
+	struct xkb_keymap *keymap;
+
+	wl_list_for_each(entry, &ec->keymap_cache, link) {
+		if (xkb_name_eq(entry->names.rules, names->rules) &&
+		    xkb_name_eq(entry->names.model, names->model) &&
+		    xkb_name_eq(entry->names.layout, names->layout) &&
+		    xkb_name_eq(entry->names.variant, names->variant) &&
+		    xkb_name_eq(entry->names.options, names->options))
+			return xkb_keymap_ref(entry->keymap);
+	}
+
+	keymap = xkb_keymap_new_from_names(ec->xkb_context, names, 0);
+	if (!keymap)
+		return NULL;
+
+	entry = xzalloc(sizeof *entry);
+	entry->names.rules = xkb_name_dup(names->rules);
+	entry->names.model = xkb_name_dup(names->model);
+	entry->names.layout = xkb_name_dup(names->layout);
+	entry->names.variant = xkb_name_dup(names->variant);
+	entry->names.options = xkb_name_dup(names->options);
+	entry->keymap = xkb_keymap_ref(keymap);
+	wl_list_insert(&ec->keymap_cache, &entry->link);
+
+	return keymap;
+}
+
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
+	struct keymap_cache_entry *entry, *tmp;
+
 	free((char *) ec->xkb_names.rules);
 	free((char *) ec->xkb_names.model);
 	free((char *) ec->xkb_names.layout);
@@ -3978,20 +4444,89 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 
 	if (ec->xkb_info)
 		weston_xkb_info_destroy(ec->xkb_info);
+
+	wl_list_for_each_safe(entry, tmp, &ec->keymap_cache, link)
+		keymap_cache_entry_destroy(entry);
+
 	xkb_context_unref(ec->xkb_context);
 }
 
+/* Whether the keymap file of xkb_info holds exactly the given string */
+static bool
+weston_xkb_info_matches(struct weston_xkb_info *xkb_info,
+			const char *keymap_string, size_t keymap_size)
+{
+	struct ro_anonymous_file *rofile = xkb_info->keymap_rofile;
+	void *map;
+	bool match;
+	int fd;
+
+	if (os_ro_anonymous_file_size(rofile) != keymap_size)
+		return false;
+
+	fd = os_ro_anonymous_file_get_fd(rofile,
+					 RO_ANONYMOUS_FILE_MAPMODE_PRIVATE);
+	if (fd < 0)
+		return false;
+
+	map = mmap(NULL, keymap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		os_ro_anonymous_file_put_fd(fd);
+		return false;
+	}
+
+	match = memcmp(map, keymap_string, keymap_size) == 0;
+
+	munmap(map, keymap_size);
+	os_ro_anonymous_file_put_fd(fd);
+
+	return match;
+}
+
+/** Get the xkb_info of a keymap
+ *
+ * An xkb_info with an identical keymap, compiled for another seat or
+ * from the same rule names, is shared instead of creating another
+ * keymap file.
+ */
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap)
+weston_xkb_info_create(struct weston_compositor *ec,
+		       struct xkb_keymap *keymap)
 {
 	char *keymap_string;
 	size_t keymap_size;
-	struct weston_xkb_info *xkb_info = zalloc(sizeof *xkb_info);
-	if (xkb_info == NULL)
+	uint32_t keymap_hash;
+	struct weston_xkb_info *xkb_info;
+
+	keymap_string = xkb_keymap_get_as_string(keymap,
+						 XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (keymap_string == NULL) {
+		weston_log("failed to get string version of keymap\n");
+		return NULL;
+	}
+	keymap_size = strlen(keymap_string) + 1;
+	keymap_hash = hash_string(keymap_string);
+
+	wl_list_for_each(xkb_info, &ec->xkb_info_list, link) {
+		if (xkb_info->keymap_hash == keymap_hash &&
+		    weston_xkb_info_matches(xkb_info, keymap_string,
+					    keymap_size)) {
+			free(keymap_string);
+			xkb_info->ref_count++;
+			return xkb_info;
+		}
+	}
+
+	xkb_info = zalloc(sizeof *xkb_info);
+	if (xkb_info == NULL) {
+		free(keymap_string);
 		return NULL;
+	}
 
 	xkb_info->keymap = xkb_keymap_ref(keymap);
 	xkb_info->ref_count = 1;
+	xkb_info->compositor = ec;
+	xkb_info->keymap_hash = keymap_hash;
 
 	xkb_info->shift_mod = xkb_keymap_mod_get_index(xkb_info->keymap,
 						       XKB_MOD_NAME_SHIFT);
@@ -4017,14 +4552,6 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 	xkb_info->scroll_led = xkb_keymap_led_get_index(xkb_info->keymap,
 							XKB_LED_NAME_SCROLL);
 
-	keymap_string = xkb_keymap_get_as_string(xkb_info->keymap,
-							   XKB_KEYMAP_FORMAT_TEXT_V1);
-	if (keymap_string == NULL) {
-		weston_log("failed to get string version of keymap\n");
-		goto err_keymap;
-	}
-	keymap_size = strlen(keymap_string) + 1;
-
 	xkb_info->keymap_rofile = os_ro_anonymous_file_create(keymap_size,
 							      keymap_string);
 	free(keymap_string);
@@ -4034,6 +4561,8 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 		goto err_keymap;
 	}
 
+	wl_list_insert(&ec->xkb_info_list, &xkb_info->link);
+
 	return xkb_info;
 
 err_keymap:
@@ -4050,9 +4579,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_keymap_new_from_names(ec->xkb_context,
-					   &ec->xkb_names,
-					   0);
+	keymap = weston_compositor_get_keymap(ec, &ec->xkb_names);
 	if (keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
@@ -4063,7 +4590,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 		return -1;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
+	ec->xkb_info = weston_xkb_info_create(ec, keymap);
 	xkb_keymap_unref(keymap);
 	if (ec->xkb_info == NULL)
 		return -1;
@@ -4105,7 +4632,8 @@ weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
 	}
 
 	if (keymap != NULL) {
-		keyboard->xkb_info = weston_xkb_info_create(keymap);
+		keyboard->xkb_info = weston_xkb_info_create(seat->compositor,
+							    keymap);
 		if (keyboard->xkb_info == NULL)
 			goto err;
 	} else {
@@ -4252,6 +4780,7 @@ weston_seat_init_touch(struct weston_seat *seat)
 	seat->touch_state = touch;
 	seat->touch_device_count = 1;
 	touch->seat = seat;
+	touch->coalesce_motion = seat->compositor->coalesce_touch_motion;
 
 	seat_send_updated_caps(seat);
 
@@ -4287,6 +4816,7 @@ weston_seat_add_tablet_tool(struct weston_seat *seat)
 
 	wl_list_init(&tool->resource_list);
 	tool->seat = seat;
+	tool->coalesce_motion = seat->compositor->coalesce_tablet_motion;
 
 	return tool;
 }
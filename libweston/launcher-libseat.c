@@ -27,6 +27,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -60,6 +61,13 @@ struct launcher_libseat {
 
 	struct wl_event_source *seat_ctx;
 	struct wl_list devices;
+
+	/* libseat is not thread-safe, and with the libinput input thread,
+	 * input devices are opened and closed off the main thread. Every
+	 * libseat call and the device list are serialised by this lock. It
+	 * is dropped while the session signal is emitted, so that handlers
+	 * can stop the input thread, which may be waiting for it. */
+	pthread_mutex_t mutex;
 };
 
 /* debug messages go into a dedicated libseat-debug scope, while info and err
@@ -88,8 +96,10 @@ handle_enable_seat(struct libseat *seat, void *data)
 
 	wl->compositor->session_active = true;
 
+	pthread_mutex_unlock(&wl->mutex);
 	wl_signal_emit(&wl->compositor->session_signal,
 		       wl->compositor);
+	pthread_mutex_lock(&wl->mutex);
 }
 
 static void
@@ -101,8 +111,10 @@ handle_disable_seat(struct libseat *seat, void *data)
 
 	wl->compositor->session_active = false;
 
+	pthread_mutex_unlock(&wl->mutex);
 	wl_signal_emit(&wl->compositor->session_signal,
 		       wl->compositor);
+	pthread_mutex_lock(&wl->mutex);
 	libseat_disable_seat(wl->seat);
 }
 
@@ -123,6 +135,7 @@ seat_open_device(struct weston_launcher *launcher, const char *path, int flags)
 		goto err_alloc;
 	}
 
+	pthread_mutex_lock(&wl->mutex);
 	dev->device_id = libseat_open_device(wl->seat, path, &dev->fd);
 	if (dev->device_id == -1) {
 		goto err_open;
@@ -134,12 +147,14 @@ seat_open_device(struct weston_launcher *launcher, const char *path, int flags)
 	dev->fsdev = st.st_rdev;
 
 	wl_list_insert(&wl->devices, &dev->link);
+	pthread_mutex_unlock(&wl->mutex);
 	return dev->fd;
 
 err_fd:
 	libseat_close_device(wl->seat, dev->device_id);
 	close(dev->fd);
 err_open:
+	pthread_mutex_unlock(&wl->mutex);
 	free(dev);
 err_alloc:
 	return -1;
@@ -151,8 +166,10 @@ seat_close_device(struct weston_launcher *launcher, int fd)
 	struct launcher_libseat *wl = wl_container_of(launcher, wl, base);
 	struct launcher_libseat_device *dev;
 
+	pthread_mutex_lock(&wl->mutex);
 	dev = find_device_by_fd(wl, fd);
 	if (dev == NULL) {
+		pthread_mutex_unlock(&wl->mutex);
 		weston_log("libseat: No device with fd %d found\n", fd);
 		close(fd);
 		return;
@@ -164,6 +181,7 @@ seat_close_device(struct weston_launcher *launcher, int fd)
 	}
 
 	wl_list_remove(&dev->link);
+	pthread_mutex_unlock(&wl->mutex);
 	free(dev);
 	close(fd);
 }
@@ -172,14 +190,32 @@ static int
 seat_switch_session(struct weston_launcher *launcher, int vt)
 {
 	struct launcher_libseat *wl = wl_container_of(launcher, wl, base);
-	return libseat_switch_session(wl->seat, vt);
+	int ret;
+
+	pthread_mutex_lock(&wl->mutex);
+	ret = libseat_switch_session(wl->seat, vt);
+	pthread_mutex_unlock(&wl->mutex);
+
+	return ret;
+}
+
+static int
+seat_dispatch(struct launcher_libseat *wl)
+{
+	int ret;
+
+	pthread_mutex_lock(&wl->mutex);
+	ret = libseat_dispatch(wl->seat, 0);
+	pthread_mutex_unlock(&wl->mutex);
+
+	return ret;
 }
 
 static int
 libseat_event(int fd, uint32_t mask, void *data)
 {
-	struct libseat *seat = data;
-	if (libseat_dispatch(seat, 0) == -1) {
+	struct launcher_libseat *wl = data;
+	if (seat_dispatch(wl) == -1) {
 		weston_log("libseat: dispatch failed: %s\n", strerror(errno));
 		exit(-1);
 	}
@@ -239,6 +275,7 @@ seat_open(struct weston_launcher **out, struct weston_compositor *compositor,
 	wl->base.iface = &launcher_libseat_iface;
 	wl->compositor = compositor;
 	wl_list_init(&wl->devices);
+	pthread_mutex_init(&wl->mutex, NULL);
 
 	libseat_debug_scope = compositor->libseat_debug;
 	assert(libseat_debug_scope);
@@ -256,12 +293,12 @@ seat_open(struct weston_launcher **out, struct weston_compositor *compositor,
 	event_loop = wl_display_get_event_loop(compositor->wl_display);
 	wl->seat_ctx = wl_event_loop_add_fd(event_loop,
 			libseat_get_fd(wl->seat), WL_EVENT_READABLE,
-			libseat_event, wl->seat);
+			libseat_event, wl);
 	if (wl->seat_ctx == NULL) {
 		weston_log("libseat: could not register connection to event loop\n");
 		goto err_session;
 	}
-	if (libseat_dispatch(wl->seat, 0) == -1) {
+	if (seat_dispatch(wl) == -1) {
 		weston_log("libseat: dispatch failed\n");
 		goto err_session;
 	}
@@ -273,6 +310,7 @@ seat_open(struct weston_launcher **out, struct weston_compositor *compositor,
 err_session:
 	libseat_close_seat(wl->seat);
 err_seat:
+	pthread_mutex_destroy(&wl->mutex);
 	free(wl);
 err_out:
 	return -1;
@@ -290,6 +328,7 @@ seat_close(struct weston_launcher *launcher)
 		libseat_close_seat(wl->seat);
 	}
 	wl_event_source_remove(wl->seat_ctx);
+	pthread_mutex_destroy(&wl->mutex);
 	free(wl);
 }
 
@@ -42,6 +42,7 @@
 #include "backend.h"
 #include "libweston-internal.h"
 #include "libinput-device.h"
+#include "libinput-seat.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
@@ -52,6 +53,15 @@ struct tablet_output_listener {
 	struct wl_list tablet_list;
 };
 
+/* The libinput context may be in use on the input thread. */
+static struct udev_input *
+evdev_device_get_input(struct evdev_device *device)
+{
+	struct libinput *libinput = libinput_device_get_context(device->device);
+
+	return libinput_get_user_data(libinput);
+}
+
 void
 evdev_led_update(struct evdev_device *device, enum weston_led weston_leds)
 {
@@ -64,7 +74,9 @@ evdev_led_update(struct evdev_device *device, enum weston_led weston_leds)
 	if (weston_leds & LED_SCROLL_LOCK)
 		leds |= LIBINPUT_LED_SCROLL_LOCK;
 
+	udev_input_lock(evdev_device_get_input(device));
 	libinput_device_led_update(device->device, leds);
+	udev_input_unlock(evdev_device_get_input(device));
 }
 
 static void
@@ -363,8 +375,10 @@ touch_get_calibration(struct weston_touch_device *device,
 {
 	struct evdev_device *evdev_device = device->backend_data;
 
+	udev_input_lock(evdev_device_get_input(evdev_device));
 	libinput_device_config_calibration_get_matrix(evdev_device->device,
 						      cal->m);
+	udev_input_unlock(evdev_device_get_input(evdev_device));
 }
 
 static void
@@ -380,8 +394,10 @@ do_set_calibration(struct evdev_device *evdev_device,
 	weston_log_continue(STAMP_SPACE "  %f %f %f\n",
 			    cal->m[3], cal->m[4], cal->m[5]);
 
+	udev_input_lock(evdev_device_get_input(evdev_device));
 	status = libinput_device_config_calibration_set_matrix(evdev_device->device,
 							       cal->m);
+	udev_input_unlock(evdev_device_get_input(evdev_device));
 	if (status != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		weston_log("Error: Failed to apply calibration.\n");
 }
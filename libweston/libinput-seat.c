@@ -26,15 +26,23 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
 #include <libinput.h>
 #include <libudev.h>
 
 #include <libweston/libweston.h>
+#include <libweston/weston-log.h>
 #include "backend.h"
 #include "libweston-internal.h"
 #include "weston-log-internal.h"
@@ -42,6 +50,16 @@
 #include "libinput-seat.h"
 #include "libinput-device.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/* A device the udev context handed over to a shard: disabled there and
+ * opened again through the shard's path context. */
+struct udev_shard_device {
+	struct libinput_device *udev_device;
+	struct libinput_device *device;
+	struct wl_list link;
+};
 
 static void
 process_events(struct udev_input *input);
@@ -56,6 +74,9 @@ get_udev_seat(struct udev_input *input, struct libinput_device *device)
 	struct libinput_seat *libinput_seat;
 	const char *seat_name;
 
+	if (input->parent)
+		return udev_seat_get_named(input, input->shard_seat);
+
 	libinput_seat = libinput_device_get_seat(device);
 	seat_name = libinput_seat_get_logical_name(libinput_seat);
 	return udev_seat_get_named(input, seat_name);
@@ -89,6 +110,101 @@ output_find_by_head_name(struct weston_compositor *compositor,
 	return NULL;
 }
 
+static struct udev_input *
+udev_input_find_shard(struct udev_input *input,
+		      struct libinput_device *libinput_device)
+{
+	struct libinput_seat *libinput_seat;
+	const char *seat_name;
+	struct udev_input *shard;
+
+	libinput_seat = libinput_device_get_seat(libinput_device);
+	seat_name = libinput_seat_get_logical_name(libinput_seat);
+
+	wl_list_for_each(shard, &input->shard_list, link) {
+		if (strcmp(shard->shard_seat, seat_name) == 0)
+			return shard;
+	}
+
+	return NULL;
+}
+
+/* Move a device of a sharded seat from the udev context to the shard.
+ * Disabling the device makes libinput close it, so that the shard can
+ * open the same device node again. */
+static bool
+udev_input_shard_take_device(struct udev_input *shard,
+			     struct libinput_device *udev_device)
+{
+	struct udev_shard_device *sdev;
+	struct udev_device *udev_dev;
+	struct libinput_device *device;
+	enum libinput_config_status status;
+
+	status = libinput_device_config_send_events_set_mode(udev_device,
+				LIBINPUT_CONFIG_SEND_EVENTS_DISABLED);
+	if (status != LIBINPUT_CONFIG_STATUS_SUCCESS)
+		return false;
+
+	udev_dev = libinput_device_get_udev_device(udev_device);
+	udev_input_lock(shard);
+	device = libinput_path_add_device(shard->libinput,
+					  udev_device_get_devnode(udev_dev));
+	udev_device_unref(udev_dev);
+	if (!device) {
+		udev_input_unlock(shard);
+		weston_log("libinput: failed to move %s to seat %s's context\n",
+			   libinput_device_get_sysname(udev_device),
+			   shard->shard_seat);
+		libinput_device_config_send_events_set_mode(udev_device,
+				LIBINPUT_CONFIG_SEND_EVENTS_ENABLED);
+		return false;
+	}
+
+	sdev = xzalloc(sizeof *sdev);
+	sdev->udev_device = libinput_device_ref(udev_device);
+	sdev->device = libinput_device_ref(device);
+	wl_list_insert(shard->shard_devices.prev, &sdev->link);
+
+	process_events(shard);
+	udev_input_unlock(shard);
+
+	return true;
+}
+
+static void
+udev_shard_device_destroy(struct udev_shard_device *sdev)
+{
+	wl_list_remove(&sdev->link);
+	libinput_device_unref(sdev->device);
+	libinput_device_unref(sdev->udev_device);
+	free(sdev);
+}
+
+static bool
+udev_input_shard_release_device(struct udev_input *input,
+				struct libinput_device *udev_device)
+{
+	struct udev_input *shard;
+	struct udev_shard_device *sdev;
+
+	wl_list_for_each(shard, &input->shard_list, link) {
+		wl_list_for_each(sdev, &shard->shard_devices, link) {
+			if (sdev->udev_device != udev_device)
+				continue;
+
+			udev_input_lock(shard);
+			libinput_path_remove_device(sdev->device);
+			process_events(shard);
+			udev_input_unlock(shard);
+			udev_shard_device_destroy(sdev);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static int
 device_added(struct udev_input *input, struct libinput_device *libinput_device)
 {
@@ -102,6 +218,14 @@ device_added(struct udev_input *input, struct libinput_device *libinput_device)
 
 	c = input->compositor;
 
+	if (!input->parent) {
+		struct udev_input *shard;
+
+		shard = udev_input_find_shard(input, libinput_device);
+		if (shard && udev_input_shard_take_device(shard, libinput_device))
+			return 0;
+	}
+
 	udev_seat = get_udev_seat(input, libinput_device);
 	if (!udev_seat) {
 		weston_log("Failed to get a seat\n");
@@ -153,6 +277,10 @@ device_removed(struct udev_input *input, struct libinput_device *libinput_device
 {
 	struct evdev_device *device;
 
+	if (!input->parent &&
+	    udev_input_shard_release_device(input, libinput_device))
+		return 0;
+
 	device = libinput_device_get_user_data(libinput_device);
 	if (!device) {
 		weston_log("Failed to retrieve device\n");
@@ -173,18 +301,6 @@ udev_seat_remove_devices(struct udev_seat *seat)
 	}
 }
 
-void
-udev_input_disable(struct udev_input *input)
-{
-	if (input->suspended)
-		return;
-
-	wl_event_source_remove(input->libinput_source);
-	input->libinput_source = NULL;
-	libinput_suspend(input->libinput);
-	process_events(input);
-	input->suspended = 1;
-}
 
 static int
 udev_input_process_event(struct libinput_event *event)
@@ -193,6 +309,8 @@ udev_input_process_event(struct libinput_event *event)
 	struct libinput_device *libinput_device =
 		libinput_event_get_device(event);
 	struct udev_input *input = libinput_get_user_data(libinput);
+	struct evdev_device *device;
+	struct udev_seat *seat;
 	int ret = 0;
 
 	switch (libinput_event_get_type(event)) {
@@ -203,6 +321,11 @@ udev_input_process_event(struct libinput_event *event)
 		ret = device_removed(input, libinput_device);
 		break;
 	default:
+		device = libinput_device_get_user_data(libinput_device);
+		if (device) {
+			seat = container_of(device->seat, struct udev_seat, base);
+			seat->event_count++;
+		}
 		evdev_device_process_event(event);
 		break;
 	}
@@ -228,13 +351,27 @@ process_events(struct udev_input *input)
 	}
 }
 
+void
+udev_input_lock(struct udev_input *input)
+{
+	pthread_mutex_lock(&input->mutex);
+}
+
+void
+udev_input_unlock(struct udev_input *input)
+{
+	pthread_mutex_unlock(&input->mutex);
+}
+
 static int
 udev_input_dispatch(struct udev_input *input)
 {
+	udev_input_lock(input);
 	if (libinput_dispatch(input->libinput) != 0)
 		weston_log("libinput: Failed to dispatch libinput\n");
 
 	process_events(input);
+	udev_input_unlock(input);
 
 	return 0;
 }
@@ -247,6 +384,217 @@ libinput_source_dispatch(int fd, uint32_t mask, void *data)
 	return udev_input_dispatch(input) != 0;
 }
 
+/* Runs on the input thread: keep draining the evdev devices and running
+ * libinput's timers while the main loop may be busy, and wake the main
+ * loop whenever events are queued. The event timestamps come from the
+ * kernel, so they stay accurate however late the main loop processes
+ * them. */
+static void *
+udev_input_thread_func(void *data)
+{
+	struct udev_input *input = data;
+	struct pollfd fds[2];
+	uint64_t one = 1;
+	sigset_t mask;
+	bool pending;
+
+	/* Signals are for the main loop. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	/* SCHED_RESET_ON_FORK dropped the main thread's realtime policy
+	 * for us; input should not wait behind it either. */
+	if (input->compositor->realtime_priority > 0) {
+		struct sched_param param = {
+			.sched_priority = input->compositor->realtime_priority,
+		};
+
+		if (sched_setscheduler(0, input->compositor->realtime_policy |
+					  SCHED_RESET_ON_FORK, &param) < 0)
+			weston_log("libinput: failed to set realtime priority "
+				   "on the input thread: %s\n",
+				   strerror(errno));
+	}
+
+	fds[0].fd = libinput_get_fd(input->libinput);
+	fds[0].events = POLLIN;
+	fds[1].fd = input->thread_stop_fd;
+	fds[1].events = POLLIN;
+
+	while (true) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		udev_input_lock(input);
+		libinput_dispatch(input->libinput);
+		pending = libinput_next_event_type(input->libinput) !=
+			  LIBINPUT_EVENT_NONE;
+		udev_input_unlock(input);
+
+		if (pending &&
+		    write(input->thread_wakeup_fd, &one, sizeof one) < 0 &&
+		    errno != EAGAIN)
+			break;
+	}
+
+	return NULL;
+}
+
+static int
+udev_input_thread_wakeup(int fd, uint32_t mask, void *data)
+{
+	struct udev_input *input = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("libinput: failed to read thread wakeup: %s\n",
+			   strerror(errno));
+
+	udev_input_lock(input);
+	process_events(input);
+	udev_input_unlock(input);
+
+	return 0;
+}
+
+/** Start reading libinput on a dedicated thread
+ *
+ * Instead of polling the libinput fd from the main loop, a thread calls
+ * libinput_dispatch() as soon as input arrives and the main loop is woken
+ * through an eventfd to process the queued events. A stalled main loop
+ * (long repaint, shader compilation, ...) then no longer lets the kernel
+ * evdev buffers overflow or libinput's timers fire late.
+ *
+ * libinput is not thread-safe, so every use of the context, on either
+ * thread, is serialised by input->mutex. Hotplug is handled inside
+ * libinput_dispatch(), so open_restricted() and close_restricted() also
+ * run on the thread. The launcher serialises those calls against its own
+ * use on the main loop. The lock order is input->mutex, then the
+ * launcher lock.
+ */
+static int
+udev_input_start_thread(struct udev_input *input)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(input->compositor->wl_display);
+
+	input->thread_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (input->thread_stop_fd < 0)
+		return -1;
+
+	input->thread_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (input->thread_wakeup_fd < 0)
+		goto err_stop_fd;
+
+	input->thread_wakeup_source =
+		wl_event_loop_add_fd(loop, input->thread_wakeup_fd,
+				     WL_EVENT_READABLE,
+				     udev_input_thread_wakeup, input);
+	if (!input->thread_wakeup_source)
+		goto err_wakeup_fd;
+
+	if (pthread_create(&input->thread, NULL,
+			   udev_input_thread_func, input) != 0)
+		goto err_source;
+
+	input->thread_running = true;
+
+	return 0;
+
+err_source:
+	wl_event_source_remove(input->thread_wakeup_source);
+	input->thread_wakeup_source = NULL;
+err_wakeup_fd:
+	close(input->thread_wakeup_fd);
+err_stop_fd:
+	close(input->thread_stop_fd);
+	weston_log("libinput: failed to start input thread\n");
+	return -1;
+}
+
+static void
+udev_input_stop_thread(struct udev_input *input)
+{
+	uint64_t one = 1;
+
+	if (!input->thread_running)
+		return;
+
+	if (write(input->thread_stop_fd, &one, sizeof one) < 0)
+		weston_log("libinput: failed to stop input thread: %s\n",
+			   strerror(errno));
+	pthread_join(input->thread, NULL);
+	input->thread_running = false;
+
+	wl_event_source_remove(input->thread_wakeup_source);
+	input->thread_wakeup_source = NULL;
+	close(input->thread_wakeup_fd);
+	close(input->thread_stop_fd);
+}
+
+static int
+udev_input_start_dispatch(struct udev_input *input)
+{
+	struct wl_event_loop *loop;
+	int fd;
+
+	if (input->use_thread)
+		return udev_input_start_thread(input);
+
+	loop = wl_display_get_event_loop(input->compositor->wl_display);
+	fd = libinput_get_fd(input->libinput);
+	input->libinput_source =
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     libinput_source_dispatch, input);
+	if (!input->libinput_source)
+		return -1;
+
+	return 0;
+}
+
+static void
+udev_input_stop_dispatch(struct udev_input *input)
+{
+	udev_input_stop_thread(input);
+
+	if (input->libinput_source)
+		wl_event_source_remove(input->libinput_source);
+	input->libinput_source = NULL;
+}
+
+void
+udev_input_disable(struct udev_input *input)
+{
+	struct udev_input *shard;
+
+	if (input->suspended)
+		return;
+
+	udev_input_stop_dispatch(input);
+	wl_list_for_each(shard, &input->shard_list, link)
+		udev_input_stop_dispatch(shard);
+
+	/* Removing the devices from the udev context also takes them back
+	 * from the shards, see device_removed(). */
+	udev_input_lock(input);
+	libinput_suspend(input->libinput);
+	process_events(input);
+	udev_input_unlock(input);
+
+	wl_list_for_each(shard, &input->shard_list, link)
+		shard->suspended = 1;
+	input->suspended = 1;
+}
+
 static int
 open_restricted(const char *path, int flags, void *user_data)
 {
@@ -273,29 +621,35 @@ const struct libinput_interface libinput_interface = {
 int
 udev_input_enable(struct udev_input *input)
 {
-	struct wl_event_loop *loop;
 	struct weston_compositor *c = input->compositor;
-	int fd;
+	struct udev_input *shard;
 	struct udev_seat *seat;
 	int devices_found = 0;
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	fd = libinput_get_fd(input->libinput);
-	input->libinput_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     libinput_source_dispatch, input);
-	if (!input->libinput_source) {
-		return -1;
-	}
-
 	if (input->suspended) {
+		wl_list_for_each(shard, &input->shard_list, link)
+			shard->suspended = 0;
+
+		udev_input_lock(input);
 		if (libinput_resume(input->libinput) != 0) {
-			wl_event_source_remove(input->libinput_source);
-			input->libinput_source = NULL;
+			udev_input_unlock(input);
 			return -1;
 		}
 		input->suspended = 0;
 		process_events(input);
+		udev_input_unlock(input);
+	}
+
+	if (udev_input_start_dispatch(input) < 0)
+		return -1;
+
+	wl_list_for_each(shard, &input->shard_list, link) {
+		if (udev_input_start_dispatch(shard) < 0) {
+			wl_list_for_each(shard, &input->shard_list, link)
+				udev_input_stop_dispatch(shard);
+			udev_input_stop_dispatch(input);
+			return -1;
+		}
 	}
 
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
@@ -333,29 +687,15 @@ libinput_log_func(struct libinput *libinput,
 	weston_vlog(format, args);
 }
 
-int
-udev_input_init(struct udev_input *input, struct weston_compositor *c,
-		struct udev *udev, const char *seat_id,
-		udev_configure_device_t configure_device)
+static void
+udev_input_set_log(struct libinput *libinput)
 {
 	enum libinput_log_priority priority = LIBINPUT_LOG_PRIORITY_INFO;
 	const char *log_priority = NULL;
 
-	memset(input, 0, sizeof *input);
-
-	input->compositor = c;
-	input->configure_device = configure_device;
+	libinput_log_set_handler(libinput, &libinput_log_func);
 
 	log_priority = getenv("WESTON_LIBINPUT_LOG_PRIORITY");
-
-	input->libinput = libinput_udev_create_context(&libinput_interface,
-						       input, udev);
-	if (!input->libinput) {
-		return -1;
-	}
-
-	libinput_log_set_handler(input->libinput, &libinput_log_func);
-
 	if (log_priority) {
 		if (strcmp(log_priority, "debug") == 0) {
 			priority = LIBINPUT_LOG_PRIORITY_DEBUG;
@@ -366,28 +706,217 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 		}
 	}
 
-	libinput_log_set_priority(input->libinput, priority);
+	libinput_log_set_priority(libinput, priority);
+}
+
+static void
+udev_input_init_mutex(struct udev_input *input)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&input->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
 
-	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0) {
-		libinput_unref(input->libinput);
+/** Give a logical seat its own libinput context
+ *
+ * libinput_udev_assign_seat() only takes a physical seat, so every
+ * logical seat (udev property WL_SEAT) of it shares one context and one
+ * event queue, and a busy device delays the events of all other seats.
+ * A shard is a libinput path context for one logical seat: the udev
+ * context still discovers the seat's devices, but hands them over in
+ * device_added(), and the shard is dispatched from its own event source,
+ * or its own thread with use_thread.
+ */
+static struct udev_input *
+udev_input_shard_create(struct udev_input *input, const char *seat_name)
+{
+	struct udev_input *shard;
+
+	shard = xzalloc(sizeof *shard);
+	shard->compositor = input->compositor;
+	shard->configure_device = input->configure_device;
+	shard->use_thread = input->use_thread;
+	shard->parent = input;
+	shard->shard_seat = xstrdup(seat_name);
+	wl_list_init(&shard->shard_list);
+	wl_list_init(&shard->shard_devices);
+	udev_input_init_mutex(shard);
+
+	shard->libinput = libinput_path_create_context(&libinput_interface,
+						       shard);
+	if (!shard->libinput) {
+		pthread_mutex_destroy(&shard->mutex);
+		free(shard->shard_seat);
+		free(shard);
+		return NULL;
+	}
+
+	udev_input_set_log(shard->libinput);
+	wl_list_insert(input->shard_list.prev, &shard->link);
+
+	weston_log("libinput: seat %s reads input through its own context\n",
+		   seat_name);
+
+	return shard;
+}
+
+static void
+udev_input_shard_destroy(struct udev_input *shard)
+{
+	struct udev_shard_device *sdev, *next;
+
+	udev_input_stop_dispatch(shard);
+	wl_list_for_each_safe(sdev, next, &shard->shard_devices, link)
+		udev_shard_device_destroy(sdev);
+	libinput_unref(shard->libinput);
+	pthread_mutex_destroy(&shard->mutex);
+	wl_list_remove(&shard->link);
+	free(shard->shard_seat);
+	free(shard);
+}
+
+static void
+udev_input_destroy_shards(struct udev_input *input)
+{
+	struct udev_input *shard, *next;
+
+	wl_list_for_each_safe(shard, next, &input->shard_list, link)
+		udev_input_shard_destroy(shard);
+}
+
+static int
+udev_input_create_shards(struct udev_input *input, const char *shard_seats)
+{
+	char *seats, *name, *saveptr;
+	int ret = 0;
+
+	seats = xstrdup(shard_seats);
+	for (name = strtok_r(seats, ", ", &saveptr); name;
+	     name = strtok_r(NULL, ", ", &saveptr)) {
+		if (!udev_input_shard_create(input, name)) {
+			weston_log("libinput: failed to create a context "
+				   "for seat %s\n", name);
+			ret = -1;
+			break;
+		}
+	}
+	free(seats);
+
+	return ret;
+}
+
+static void
+udev_input_stats_new_sub(struct weston_log_subscription *subs, void *data)
+{
+	struct udev_input *input = data;
+	struct udev_input *shard;
+	struct udev_seat *seat;
+	struct timespec now;
+	const char *context;
+	int64_t elapsed_ms;
+	uint64_t events;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ms = timespec_sub_to_msec(&now, &input->stats_reported);
+	input->stats_reported = now;
+
+	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
+		context = "shared";
+		wl_list_for_each(shard, &input->shard_list, link) {
+			if (strcmp(shard->shard_seat, seat->base.seat_name) == 0)
+				context = "own";
+		}
+
+		events = seat->event_count - seat->event_count_reported;
+		seat->event_count_reported = seat->event_count;
+
+		weston_log_subscription_printf(subs,
+			"seat %s (%s context): %" PRIu64 " events, "
+			"%.1f events/s\n", seat->base.seat_name, context,
+			seat->event_count,
+			elapsed_ms > 0 ? events * 1000.0 / elapsed_ms : 0.0);
+	}
+}
+
+int
+udev_input_init(struct udev_input *input, struct weston_compositor *c,
+		struct udev *udev, const char *seat_id,
+		udev_configure_device_t configure_device,
+		bool use_thread, const char *shard_seats)
+{
+	memset(input, 0, sizeof *input);
+
+	input->compositor = c;
+	input->configure_device = configure_device;
+	input->use_thread = use_thread;
+	wl_list_init(&input->shard_list);
+	wl_list_init(&input->shard_devices);
+	udev_input_init_mutex(input);
+
+	input->libinput = libinput_udev_create_context(&libinput_interface,
+						       input, udev);
+	if (!input->libinput) {
+		pthread_mutex_destroy(&input->mutex);
 		return -1;
 	}
 
+	udev_input_set_log(input->libinput);
+
+	/* The shards must exist before the udev context adds any device. */
+	if (shard_seats &&
+	    udev_input_create_shards(input, shard_seats) < 0)
+		goto err_shards;
+
+	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0)
+		goto err_shards;
+
 	process_events(input);
 
-	return udev_input_enable(input);
+	if (use_thread)
+		weston_log("libinput: reading input on a dedicated thread\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &input->stats_reported);
+	input->stats_scope =
+		weston_compositor_add_log_scope(c, "libinput-seats",
+						"Input events per seat, and their "
+						"rate since the previous "
+						"subscription.\n",
+						udev_input_stats_new_sub,
+						NULL, input);
+
+	if (udev_input_enable(input) < 0) {
+		udev_input_destroy(input);
+		return -1;
+	}
+
+	return 0;
+
+err_shards:
+	udev_input_destroy_shards(input);
+	libinput_unref(input->libinput);
+	pthread_mutex_destroy(&input->mutex);
+	return -1;
 }
 
 void
 udev_input_destroy(struct udev_input *input)
 {
+	struct udev_input *shard;
 	struct udev_seat *seat, *next;
 
-	if (input->libinput_source)
-		wl_event_source_remove(input->libinput_source);
+	udev_input_stop_dispatch(input);
+	wl_list_for_each(shard, &input->shard_list, link)
+		udev_input_stop_dispatch(shard);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
+	udev_input_destroy_shards(input);
+	weston_log_scope_destroy(input->stats_scope);
+	input->stats_scope = NULL;
 	libinput_unref(input->libinput);
+	pthread_mutex_destroy(&input->mutex);
 }
 
 static void
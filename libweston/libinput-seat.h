@@ -29,6 +29,10 @@
 
 #include "config.h"
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <libudev.h>
 
 #include <libweston/libweston.h>
@@ -40,6 +44,11 @@ struct udev_seat {
 	struct wl_list devices_list;
 	struct wl_listener output_create_listener;
 	struct wl_listener output_heads_listener;
+
+	/* Input events processed for this seat, for the libinput-seats
+	 * debug scope. */
+	uint64_t event_count;
+	uint64_t event_count_reported;
 };
 
 typedef void (*udev_configure_device_t)(struct weston_compositor *compositor,
@@ -51,6 +60,31 @@ struct udev_input {
 	struct weston_compositor *compositor;
 	int suspended;
 	udev_configure_device_t configure_device;
+
+	/* Serialises every use of the libinput context; recursive. */
+	pthread_mutex_t mutex;
+
+	/* Optional thread reading the libinput fd, see
+	 * udev_input_start_thread() */
+	bool use_thread;
+	bool thread_running;
+	pthread_t thread;
+	int thread_stop_fd;
+	int thread_wakeup_fd;
+	struct wl_event_source *thread_wakeup_source;
+
+	/* Logical seats read through their own libinput context, see
+	 * udev_input_shard_create(). Only used on the udev context. */
+	struct wl_list shard_list;
+	struct weston_log_scope *stats_scope;
+	struct timespec stats_reported;
+
+	/* Shards only: the udev context handing over the devices of
+	 * shard_seat, and the devices taken from it. */
+	struct udev_input *parent;
+	struct wl_list link;
+	char *shard_seat;
+	struct wl_list shard_devices;
 };
 
 int
@@ -62,10 +96,17 @@ udev_input_init(struct udev_input *input,
 		struct weston_compositor *c,
 		struct udev *udev,
 		const char *seat_id,
-		udev_configure_device_t configure_device);
+		udev_configure_device_t configure_device,
+		bool use_thread,
+		const char *shard_seats);
 void
 udev_input_destroy(struct udev_input *input);
 
+void
+udev_input_lock(struct udev_input *input);
+void
+udev_input_unlock(struct udev_input *input);
+
 struct udev_seat *
 udev_seat_get_named(struct udev_input *u,
 		    const char *seat_name);
@@ -86,6 +86,12 @@ struct weston_renderer {
 			      const struct weston_geometry *area);
 
 	void (*flush_damage)(struct weston_paint_node *pnode);
+
+	/** Whether everything in the SHM buffer attached to the surface has
+	 * been copied into the renderer's own storage, so that the buffer
+	 * is no longer needed; optional */
+	bool (*shm_buffer_is_copied)(struct weston_surface *surface);
+
 	void (*attach)(struct weston_paint_node *pnode);
 	void (*destroy)(struct weston_compositor *ec);
 
@@ -172,6 +178,21 @@ struct weston_tearing_control {
 	bool may_tear;
 };
 
+/* wp_linux_drm_syncobj_surface_v1, see linux-drm-syncobj.c */
+struct weston_drm_syncobj_surface {
+	struct weston_surface *surface;
+	struct wl_resource *resource;
+
+	/* Points set since the last commit */
+	struct weston_drm_syncobj_timeline *acquire_timeline;
+	uint64_t acquire_point;
+	struct weston_drm_syncobj_timeline *release_timeline;
+	uint64_t release_point;
+};
+
+struct wl_resource *
+weston_surface_get_explicit_sync_resource(struct weston_surface *surface);
+
 void
 weston_renderer_resize_output(struct weston_output *output,
 			      const struct weston_size *fb_size,
@@ -216,6 +237,9 @@ weston_buffer_release_reference(struct weston_buffer_release_reference *ref,
 void
 weston_binding_list_destroy_all(struct wl_list *list);
 
+void
+weston_binding_index_destroy(struct weston_compositor *compositor);
+
 /* weston_compositor */
 
 void
@@ -247,6 +271,9 @@ weston_compositor_read_presentation_clock(
 			struct weston_compositor *compositor,
 			struct timespec *ts);
 
+void
+weston_compositor_wake_commit_queues(struct weston_compositor *ec);
+
 int
 weston_compositor_init_renderer(struct weston_compositor *compositor,
 				enum weston_renderer_type renderer_type,
@@ -389,6 +416,15 @@ weston_pointer_set_default_grab(struct weston_pointer *pointer,
 void
 weston_pointer_constraint_destroy(struct weston_pointer_constraint *constraint);
 
+void
+weston_pointer_flush_motion(struct weston_pointer *pointer);
+
+void
+weston_touch_flush_motion(struct weston_touch *touch);
+
+void
+weston_tablet_tool_flush_motion(struct weston_tablet_tool *tool);
+
 /* weston_keyboard */
 bool
 weston_keyboard_has_focus_resource(struct weston_keyboard *keyboard);
@@ -488,6 +524,10 @@ pixman_box32_t
 weston_matrix_transform_rect(struct weston_matrix *matrix,
                             pixman_box32_t rect);
 void
+weston_matrix_transform_boxes(struct weston_matrix *matrix,
+			      const pixman_box32_t *src,
+			      pixman_box32_t *dest, int count);
+void
 weston_matrix_transform_region(pixman_region32_t *dest,
 			       struct weston_matrix *matrix,
 			       pixman_region32_t *src);
@@ -505,7 +545,8 @@ struct weston_drm_format {
 };
 
 struct weston_drm_format_array {
-	struct wl_array arr;
+	struct wl_array arr;	/* sorted by format */
+	int latest;		/* index of the latest added format, or -1 */
 };
 
 void
@@ -609,6 +650,13 @@ struct weston_paint_node {
 
 	pixman_region32_t visible;
 	pixman_region32_t damage; /* In global coordinates */
+
+	/* Opaque region of this node and all nodes above it, from the
+	 * last time visible was computed, see output_update_visibility() */
+	pixman_region32_t occlusion;
+	struct weston_paint_node *occlusion_above;
+	bool occlusion_dirty;
+
 	struct weston_plane *plane;
 	struct weston_plane *plane_next;
 
@@ -619,16 +667,33 @@ struct weston_paint_node {
 	bool is_fully_opaque;
 	bool is_fully_blended;
 	bool is_direct;
+
+	/* The view only moved by whole output pixels since the last
+	 * repaint, see output_add_move() */
+	bool moved;
+	int32_t move_dx, move_dy;
+
 	bool draw_solid;
 	struct weston_solid_buffer_values solid;
 	bool need_hole;
 	uint32_t psf_flags; /* presentation-feedback flags */
+
+	/* The surface commit in the frame awaiting presentation, see
+	 * paint_node_latch_commit() */
+	bool commit_pending;
+	uint64_t commit_seq;
+	struct timespec commit_time;
+	int64_t commit_client_nsec;
 };
 
 struct weston_paint_node *
 weston_view_find_paint_node(struct weston_view *view,
 			    struct weston_output *output);
 
+struct weston_paint_node **
+weston_output_get_paint_nodes(struct weston_output *output,
+			      unsigned int *count);
+
 /* others */
 int
 wl_data_device_manager_init(struct wl_display *display);
@@ -38,6 +38,7 @@
 #include "shared/os-compatibility.h"
 #include "shared/helpers.h"
 #include "libweston-internal.h"
+#include "client-accounting.h"
 #include "shared/weston-assert.h"
 #include "shared/weston-drm-fourcc.h"
 
@@ -298,6 +299,8 @@ avoid_gpu_import:
 				       &linux_dmabuf_buffer_implementation,
 				       buffer, destroy_linux_dmabuf_wl_buffer);
 
+	weston_client_account_dmabuf_import(buffer->compositor, client);
+
 	/* send 'created' event when the request is not for an immediate
 	 * import, ie buffer_id is zero */
 	if (buffer_id == 0)
@@ -698,6 +701,7 @@ weston_dmabuf_feedback_destroy(struct weston_dmabuf_feedback *dmabuf_feedback)
 		wl_resource_set_user_data(res, NULL);
 	}
 
+	wl_array_release(&dmabuf_feedback->sent_state);
 	free(dmabuf_feedback);
 }
 
@@ -724,6 +728,44 @@ weston_dmabuf_feedback_find_tranche(struct weston_dmabuf_feedback *dmabuf_feedba
 	return NULL;
 }
 
+/* Serialize what clients would receive for the active tranches: target
+ * device, flags and format indices of each, in order. */
+static int
+dmabuf_feedback_build_state(struct weston_dmabuf_feedback *dmabuf_feedback,
+			    struct wl_array *state)
+{
+	struct weston_dmabuf_feedback_tranche *tranche;
+	struct {
+		dev_t target_device;
+		uint32_t flags;
+		size_t formats_size;
+	} *header;
+	void *indices;
+
+	wl_list_for_each(tranche, &dmabuf_feedback->tranche_list, link) {
+		if (!tranche->active)
+			continue;
+
+		header = wl_array_add(state, sizeof(*header));
+		if (!header)
+			return -1;
+		memset(header, 0, sizeof(*header));
+		header->target_device = tranche->target_device;
+		header->flags = tranche->flags;
+		header->formats_size = tranche->formats_indices.size;
+
+		if (tranche->formats_indices.size == 0)
+			continue;
+		indices = wl_array_add(state, tranche->formats_indices.size);
+		if (!indices)
+			return -1;
+		memcpy(indices, tranche->formats_indices.data,
+		       tranche->formats_indices.size);
+	}
+
+	return 0;
+}
+
 static void
 weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
 			    struct weston_dmabuf_feedback_format_table *format_table,
@@ -789,21 +831,51 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
  * is dynamic and can change throughout compositor's life. These changes results
  * in the need to resend the feedback events to clients.
  *
+ * The protocol requires all the tranches to be sent again on every update,
+ * so the active tranches are compared with what was last sent as a whole:
+ * if nothing differs, nothing is sent and clients keep their buffers.
+ *
  * @param compositor The weston compositor
  * @param dmabuf_feedback The weston_dmabuf_feedback object
  * @param format_table The dma-buf feedback formats table
+ * @return True if the feedback was sent, false if it was unchanged
  */
-WL_EXPORT void
+WL_EXPORT bool
 weston_dmabuf_feedback_send_all(struct weston_compositor *compositor,
 				struct weston_dmabuf_feedback *dmabuf_feedback,
 				struct weston_dmabuf_feedback_format_table *format_table)
 {
 	struct wl_resource *res;
+	struct wl_array state;
 
 	weston_assert_true(compositor, !wl_list_empty(&dmabuf_feedback->resource_list));
+
+	wl_array_init(&state);
+	if (dmabuf_feedback_build_state(dmabuf_feedback, &state) == 0) {
+		if (state.size == dmabuf_feedback->sent_state.size &&
+		    (state.size == 0 ||
+		     memcmp(state.data, dmabuf_feedback->sent_state.data,
+			    state.size) == 0)) {
+			wl_array_release(&state);
+			dmabuf_feedback->skipped_count++;
+			return false;
+		}
+
+		wl_array_release(&dmabuf_feedback->sent_state);
+		dmabuf_feedback->sent_state = state;
+	} else {
+		/* Out of memory: send anyway and diff against nothing. */
+		wl_array_release(&state);
+		wl_array_release(&dmabuf_feedback->sent_state);
+		wl_array_init(&dmabuf_feedback->sent_state);
+	}
+
 	wl_resource_for_each(res, &dmabuf_feedback->resource_list)
 		weston_dmabuf_feedback_send(dmabuf_feedback,
 					    format_table, res, false);
+	dmabuf_feedback->resend_count++;
+
+	return true;
 }
 
 static void
@@ -930,6 +1002,17 @@ linux_dmabuf_get_per_surface_feedback(struct wl_client *client,
 			goto err_feedback;
 	}
 
+	/* The first subscriber sets the baseline later resends are diffed
+	 * against. Later subscribers get the current state, and the others
+	 * are brought up to date by the next weston_dmabuf_feedback_send_all()
+	 * if it differs. */
+	if (wl_list_empty(&surface->dmabuf_feedback->resource_list)) {
+		wl_array_release(&surface->dmabuf_feedback->sent_state);
+		wl_array_init(&surface->dmabuf_feedback->sent_state);
+		dmabuf_feedback_build_state(surface->dmabuf_feedback,
+					    &surface->dmabuf_feedback->sent_state);
+	}
+
 	/* Surface dma-buf feedback is dynamic and may need to be resent to
 	 * clients when they change. So we need to keep the resources list */
 	wl_list_insert(&surface->dmabuf_feedback->resource_list,
@@ -123,6 +123,23 @@ struct weston_dmabuf_feedback {
 	 * actions_needed_dmabuf_feedback. */
 	struct timespec timer;
 	uint32_t action_needed;
+
+	/* Number of consecutive repaints for which action_needed has been
+	 * detected. Together with the timer, a change must be stable for a
+	 * number of frames before it is sent. */
+	unsigned int stable_frames;
+
+	/* Serialized active tranches, as last sent to the subscribed clients.
+	 * Resending identical feedback would only make clients reallocate
+	 * their buffers for nothing, so weston_dmabuf_feedback_send_all()
+	 * skips it. */
+	struct wl_array sent_state;
+
+	/* Statistics: how many times the feedback was resent, each of which
+	 * likely makes clients reallocate, and how many resends were skipped
+	 * because nothing changed. */
+	uint32_t resend_count;
+	uint32_t skipped_count;
 };
 
 struct weston_dmabuf_feedback_tranche {
@@ -171,7 +188,7 @@ weston_dmabuf_feedback_create(dev_t main_device);
 void
 weston_dmabuf_feedback_destroy(struct weston_dmabuf_feedback *dmabuf_feedback);
 
-void
+bool
 weston_dmabuf_feedback_send_all(struct weston_compositor *compositor,
 				struct weston_dmabuf_feedback *dmabuf_feedback,
 				struct weston_dmabuf_feedback_format_table *format_table);
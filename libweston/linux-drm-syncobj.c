@@ -0,0 +1,714 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include <libweston/libweston.h>
+#include "linux-drm-syncobj.h"
+#include "linux-drm-syncobj-v1-server-protocol.h"
+#include "linux-explicit-synchronization.h"
+#include "shared/fd-util.h"
+#include "shared/xalloc.h"
+#include "libweston-internal.h"
+
+/* The DRM device the timelines are imported into. Kept alive by every
+ * timeline, since they may outlive the global. */
+struct weston_drm_syncobj_manager {
+	int drm_fd;
+	int ref_count;
+	struct wl_listener display_destroy_listener;
+};
+
+struct weston_drm_syncobj_timeline {
+	struct weston_drm_syncobj_manager *manager;
+	uint32_t handle;
+	int ref_count;
+};
+
+/* An acquire point that had no fence yet when its commit arrived, i.e. a
+ * client relying on wait-before-signal. The commit is held in the surface's
+ * commit queue until the point materializes, which the kernel reports
+ * through an eventfd. */
+struct weston_drm_syncobj_acquire {
+	struct weston_compositor *compositor;
+	struct weston_drm_syncobj_timeline *timeline;
+	uint64_t point;
+	int eventfd;
+	struct wl_event_source *source;
+};
+
+static struct weston_drm_syncobj_manager *
+manager_ref(struct weston_drm_syncobj_manager *manager)
+{
+	manager->ref_count++;
+	return manager;
+}
+
+static void
+manager_unref(struct weston_drm_syncobj_manager *manager)
+{
+	if (--manager->ref_count > 0)
+		return;
+
+	close(manager->drm_fd);
+	free(manager);
+}
+
+static struct weston_drm_syncobj_timeline *
+timeline_ref(struct weston_drm_syncobj_timeline *timeline)
+{
+	timeline->ref_count++;
+	return timeline;
+}
+
+static void
+timeline_unref(struct weston_drm_syncobj_timeline *timeline)
+{
+	if (!timeline || --timeline->ref_count > 0)
+		return;
+
+	drmSyncobjDestroy(timeline->manager->drm_fd, timeline->handle);
+	manager_unref(timeline->manager);
+	free(timeline);
+}
+
+static void
+timeline_set(struct weston_drm_syncobj_timeline **dst,
+	     struct weston_drm_syncobj_timeline *timeline)
+{
+	if (timeline)
+		timeline_ref(timeline);
+	timeline_unref(*dst);
+	*dst = timeline;
+}
+
+/* Whether a timeline point has a fence attached, i.e. whether the client's
+ * GPU work for it has been submitted. Does not block. */
+static bool
+timeline_point_available(struct weston_drm_syncobj_timeline *timeline,
+			 uint64_t point)
+{
+	return drmSyncobjTimelineWait(timeline->manager->drm_fd,
+				      &timeline->handle, &point, 1, 0,
+				      DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+				      NULL) == 0;
+}
+
+/* Have the kernel signal an eventfd once a syncobj point has a fence.
+ * Needs Linux 6.6 and libdrm headers that know the ioctl. */
+static int
+syncobj_point_eventfd(int drm_fd, uint32_t handle, uint64_t point)
+{
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+	struct drm_syncobj_eventfd args = {
+		.handle = handle,
+		.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+		.point = point,
+	};
+	int fd;
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0)
+		return -1;
+
+	args.fd = fd;
+	if (drmIoctl(drm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &args) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static bool
+drm_has_syncobj_eventfd(int drm_fd)
+{
+	uint32_t handle;
+	int fd;
+
+	if (drmSyncobjCreate(drm_fd, 0, &handle) < 0)
+		return false;
+
+	fd = syncobj_point_eventfd(drm_fd, handle, 1);
+	drmSyncobjDestroy(drm_fd, handle);
+	if (fd < 0)
+		return false;
+
+	close(fd);
+	return true;
+}
+
+/* Turn a timeline point into a sync_file, which the renderers and KMS
+ * already know how to wait for. The point must have a fence attached, i.e.
+ * the client's GPU work must have been submitted. */
+static int
+timeline_export_point(struct weston_drm_syncobj_timeline *timeline,
+		      uint64_t point)
+{
+	int drm_fd = timeline->manager->drm_fd;
+	uint32_t tmp;
+	int fd = -1;
+
+	if (drmSyncobjCreate(drm_fd, 0, &tmp) < 0)
+		return -1;
+
+	if (drmSyncobjTransfer(drm_fd, tmp, 0,
+			       timeline->handle, point, 0) == 0 &&
+	    drmSyncobjExportSyncFile(drm_fd, tmp, &fd) < 0)
+		fd = -1;
+
+	drmSyncobjDestroy(drm_fd, tmp);
+
+	return fd;
+}
+
+static int
+acquire_handle_available(int fd, uint32_t mask, void *data)
+{
+	struct weston_drm_syncobj_acquire *acquire = data;
+
+	wl_event_source_remove(acquire->source);
+	acquire->source = NULL;
+	fd_clear(&acquire->eventfd);
+
+	weston_compositor_wake_commit_queues(acquire->compositor);
+
+	return 0;
+}
+
+static struct weston_drm_syncobj_acquire *
+acquire_create(struct weston_compositor *compositor,
+	       struct weston_drm_syncobj_timeline *timeline, uint64_t point)
+{
+	struct weston_drm_syncobj_acquire *acquire;
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(compositor->wl_display);
+
+	acquire = xzalloc(sizeof *acquire);
+	acquire->compositor = compositor;
+	acquire->point = point;
+	acquire->eventfd = syncobj_point_eventfd(timeline->manager->drm_fd,
+						 timeline->handle, point);
+	if (acquire->eventfd < 0) {
+		free(acquire);
+		return NULL;
+	}
+
+	acquire->source = wl_event_loop_add_fd(loop, acquire->eventfd,
+					       WL_EVENT_READABLE,
+					       acquire_handle_available,
+					       acquire);
+	if (!acquire->source) {
+		close(acquire->eventfd);
+		free(acquire);
+		return NULL;
+	}
+
+	acquire->timeline = timeline_ref(timeline);
+
+	return acquire;
+}
+
+/** Whether the acquire point of a held commit has a fence by now */
+bool
+weston_drm_syncobj_acquire_is_ready(struct weston_drm_syncobj_acquire *acquire)
+{
+	return acquire->source == NULL;
+}
+
+/** Export the fence of a materialized acquire point as a sync_file
+ *
+ * \return The sync_file fd, or -1 on failure.
+ */
+int
+weston_drm_syncobj_acquire_export(struct weston_drm_syncobj_acquire *acquire)
+{
+	assert(weston_drm_syncobj_acquire_is_ready(acquire));
+
+	return timeline_export_point(acquire->timeline, acquire->point);
+}
+
+void
+weston_drm_syncobj_acquire_destroy(struct weston_drm_syncobj_acquire *acquire)
+{
+	if (!acquire)
+		return;
+
+	if (acquire->source)
+		wl_event_source_remove(acquire->source);
+	fd_clear(&acquire->eventfd);
+	timeline_unref(acquire->timeline);
+	free(acquire);
+}
+
+/** Signal the release point of a buffer
+ *
+ * Called instead of sending zwp_linux_buffer_release_v1 events when the
+ * buffer release belongs to a wp_linux_drm_syncobj_surface_v1. The point
+ * gets the release fence of the last renderer or KMS use of the buffer, or
+ * is signalled right away if there is none. Destroys the buffer release.
+ */
+void
+weston_drm_syncobj_release(struct weston_buffer_release *buffer_release)
+{
+	struct weston_drm_syncobj_timeline *timeline =
+		buffer_release->release_timeline;
+	uint64_t point = buffer_release->release_point;
+	int drm_fd = timeline->manager->drm_fd;
+	bool signalled = false;
+	uint32_t tmp;
+
+	if (buffer_release->fence_fd >= 0 &&
+	    drmSyncobjCreate(drm_fd, 0, &tmp) == 0) {
+		if (drmSyncobjImportSyncFile(drm_fd, tmp,
+					     buffer_release->fence_fd) == 0 &&
+		    drmSyncobjTransfer(drm_fd, timeline->handle, point,
+				       tmp, 0, 0) == 0)
+			signalled = true;
+		drmSyncobjDestroy(drm_fd, tmp);
+	}
+
+	if (!signalled &&
+	    drmSyncobjTimelineSignal(drm_fd, &timeline->handle,
+				     &point, 1) < 0)
+		weston_log("linux-drm-syncobj: failed to signal release "
+			   "point %" PRIu64 ": %s\n", point, strerror(errno));
+
+	fd_clear(&buffer_release->fence_fd);
+	timeline_unref(timeline);
+	free(buffer_release);
+}
+
+static void
+destroy_timeline(struct wl_resource *resource)
+{
+	struct weston_drm_syncobj_timeline *timeline =
+		wl_resource_get_user_data(resource);
+
+	timeline_unref(timeline);
+}
+
+static void
+timeline_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_linux_drm_syncobj_timeline_v1_interface
+timeline_implementation = {
+	timeline_destroy,
+};
+
+static void
+destroy_syncobj_surface(struct wl_resource *resource)
+{
+	struct weston_drm_syncobj_surface *syncobj =
+		wl_resource_get_user_data(resource);
+
+	if (syncobj->surface)
+		syncobj->surface->drm_syncobj = NULL;
+
+	timeline_unref(syncobj->acquire_timeline);
+	timeline_unref(syncobj->release_timeline);
+	free(syncobj);
+}
+
+static void
+syncobj_surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+syncobj_surface_set_point(struct wl_resource *resource,
+			  struct wl_resource *timeline_resource,
+			  uint32_t point_hi, uint32_t point_lo,
+			  struct weston_drm_syncobj_timeline **timeline,
+			  uint64_t *point)
+{
+	struct weston_drm_syncobj_surface *syncobj =
+		wl_resource_get_user_data(resource);
+
+	if (!syncobj->surface) {
+		wl_resource_post_error(resource,
+				       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE,
+				       "surface no longer exists");
+		return;
+	}
+
+	timeline_set(timeline, wl_resource_get_user_data(timeline_resource));
+	*point = (uint64_t) point_hi << 32 | point_lo;
+}
+
+static void
+syncobj_surface_set_acquire_point(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_resource *timeline,
+				  uint32_t point_hi, uint32_t point_lo)
+{
+	struct weston_drm_syncobj_surface *syncobj =
+		wl_resource_get_user_data(resource);
+
+	syncobj_surface_set_point(resource, timeline, point_hi, point_lo,
+				  &syncobj->acquire_timeline,
+				  &syncobj->acquire_point);
+}
+
+static void
+syncobj_surface_set_release_point(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_resource *timeline,
+				  uint32_t point_hi, uint32_t point_lo)
+{
+	struct weston_drm_syncobj_surface *syncobj =
+		wl_resource_get_user_data(resource);
+
+	syncobj_surface_set_point(resource, timeline, point_hi, point_lo,
+				  &syncobj->release_timeline,
+				  &syncobj->release_point);
+}
+
+static const struct wp_linux_drm_syncobj_surface_v1_interface
+syncobj_surface_implementation = {
+	syncobj_surface_destroy,
+	syncobj_surface_set_acquire_point,
+	syncobj_surface_set_release_point,
+};
+
+static bool
+syncobj_surface_check(struct weston_drm_syncobj_surface *syncobj)
+{
+	struct weston_surface *surface = syncobj->surface;
+	struct weston_buffer *buffer = surface->pending.buffer;
+	uint32_t id = wl_resource_get_id(surface->resource);
+
+	if (!buffer) {
+		if (!syncobj->acquire_timeline && !syncobj->release_timeline)
+			return true;
+
+		wl_resource_post_error(syncobj->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_BUFFER,
+			"wl_surface@%"PRIu32" no buffer for synchronization",
+			id);
+		return false;
+	}
+
+	if (!syncobj->acquire_timeline) {
+		wl_resource_post_error(syncobj->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT,
+			"wl_surface@%"PRIu32" buffer without acquire point",
+			id);
+		return false;
+	}
+
+	if (!syncobj->release_timeline) {
+		wl_resource_post_error(syncobj->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_RELEASE_POINT,
+			"wl_surface@%"PRIu32" buffer without release point",
+			id);
+		return false;
+	}
+
+	if (syncobj->acquire_timeline == syncobj->release_timeline &&
+	    syncobj->release_point <= syncobj->acquire_point) {
+		wl_resource_post_error(syncobj->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_CONFLICTING_POINTS,
+			"wl_surface@%"PRIu32" release point %"PRIu64" not "
+			"after acquire point %"PRIu64, id,
+			syncobj->release_point, syncobj->acquire_point);
+		return false;
+	}
+
+	if (buffer->type == WESTON_BUFFER_SHM ||
+	    buffer->type == WESTON_BUFFER_SOLID) {
+		wl_resource_post_error(syncobj->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_UNSUPPORTED_BUFFER,
+			"wl_surface@%"PRIu32" unsupported buffer for "
+			"synchronization", id);
+		return false;
+	}
+
+	return true;
+}
+
+/** Apply the syncobj points of a wl_surface.commit
+ *
+ * The acquire point becomes the pending acquire fence and the release point
+ * a pending buffer release, so that the rest of the compositor handles them
+ * exactly like zwp_linux_surface_synchronization_v1 fences: the GL renderer
+ * waits on the acquire fence on the GPU, KMS through IN_FENCE_FD, and the
+ * release point gets the fence of the last use of the buffer.
+ *
+ * An acquire point without a fence yet becomes the pending
+ * weston_drm_syncobj_acquire instead, which holds the commit in the
+ * surface's commit queue until the point materializes. This never blocks.
+ *
+ * \return false if the commit was rejected with a protocol error.
+ */
+bool
+weston_drm_syncobj_surface_commit(struct weston_drm_syncobj_surface *syncobj)
+{
+	struct weston_surface *surface = syncobj->surface;
+	struct weston_buffer_release *buffer_release;
+	struct weston_drm_syncobj_acquire *acquire;
+	int fd;
+
+	if (!syncobj_surface_check(syncobj))
+		return false;
+
+	if (!surface->pending.buffer)
+		return true;
+
+	if (timeline_point_available(syncobj->acquire_timeline,
+				     syncobj->acquire_point)) {
+		fd = timeline_export_point(syncobj->acquire_timeline,
+					   syncobj->acquire_point);
+		if (fd < 0) {
+			linux_explicit_synchronization_send_server_error(
+				syncobj->resource,
+				"failed to export acquire point");
+			return false;
+		}
+		fd_update(&surface->pending.acquire_fence_fd, fd);
+	} else {
+		acquire = acquire_create(surface->compositor,
+					 syncobj->acquire_timeline,
+					 syncobj->acquire_point);
+		if (!acquire) {
+			linux_explicit_synchronization_send_server_error(
+				syncobj->resource,
+				"failed to wait for acquire point");
+			return false;
+		}
+		weston_drm_syncobj_acquire_destroy(
+			surface->pending.drm_syncobj_acquire);
+		surface->pending.drm_syncobj_acquire = acquire;
+	}
+
+	buffer_release = xzalloc(sizeof *buffer_release);
+	buffer_release->fence_fd = -1;
+	buffer_release->release_timeline =
+		timeline_ref(syncobj->release_timeline);
+	buffer_release->release_point = syncobj->release_point;
+	weston_buffer_release_reference(&surface->pending.buffer_release_ref,
+					buffer_release);
+
+	timeline_set(&syncobj->acquire_timeline, NULL);
+	timeline_set(&syncobj->release_timeline, NULL);
+
+	return true;
+}
+
+static void
+syncobj_manager_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+syncobj_manager_get_surface(struct wl_client *client,
+			    struct wl_resource *resource,
+			    uint32_t id,
+			    struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct weston_drm_syncobj_surface *syncobj;
+
+	if (surface->drm_syncobj || surface->synchronization_resource) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_SURFACE_EXISTS,
+			"wl_surface@%"PRIu32" already has a synchronization "
+			"object", wl_resource_get_id(surface_resource));
+		return;
+	}
+
+	syncobj = xzalloc(sizeof *syncobj);
+	syncobj->surface = surface;
+	syncobj->resource =
+		wl_resource_create(client,
+				   &wp_linux_drm_syncobj_surface_v1_interface,
+				   wl_resource_get_version(resource), id);
+	if (!syncobj->resource) {
+		free(syncobj);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(syncobj->resource,
+				       &syncobj_surface_implementation,
+				       syncobj, destroy_syncobj_surface);
+	surface->drm_syncobj = syncobj;
+}
+
+static void
+syncobj_manager_import_timeline(struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id, int32_t fd)
+{
+	struct weston_drm_syncobj_manager *manager =
+		wl_resource_get_user_data(resource);
+	struct weston_drm_syncobj_timeline *timeline;
+	struct wl_resource *timeline_resource;
+	uint32_t handle;
+	int ret;
+
+	ret = drmSyncobjFDToHandle(manager->drm_fd, fd, &handle);
+	close(fd);
+	if (ret < 0) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_INVALID_TIMELINE,
+			"invalid timeline fd");
+		return;
+	}
+
+	timeline_resource =
+		wl_resource_create(client,
+				   &wp_linux_drm_syncobj_timeline_v1_interface,
+				   wl_resource_get_version(resource), id);
+	if (!timeline_resource) {
+		drmSyncobjDestroy(manager->drm_fd, handle);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	timeline = xzalloc(sizeof *timeline);
+	timeline->manager = manager_ref(manager);
+	timeline->handle = handle;
+	timeline->ref_count = 1;
+
+	wl_resource_set_implementation(timeline_resource,
+				       &timeline_implementation,
+				       timeline, destroy_timeline);
+}
+
+static const struct wp_linux_drm_syncobj_manager_v1_interface
+syncobj_manager_implementation = {
+	syncobj_manager_destroy,
+	syncobj_manager_get_surface,
+	syncobj_manager_import_timeline,
+};
+
+static void
+bind_linux_drm_syncobj(struct wl_client *client,
+		       void *data, uint32_t version, uint32_t id)
+{
+	struct weston_drm_syncobj_manager *manager = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &wp_linux_drm_syncobj_manager_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &syncobj_manager_implementation,
+				       manager, NULL);
+}
+
+static void
+syncobj_manager_display_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_drm_syncobj_manager *manager =
+		container_of(listener, struct weston_drm_syncobj_manager,
+			     display_destroy_listener);
+
+	manager_unref(manager);
+}
+
+/** Advertise linux_drm_syncobj support
+ *
+ * Initializes the wp_linux_drm_syncobj_manager_v1 protocol support, so that
+ * clients can synchronize their buffers with timeline DRM syncobjs. The
+ * timelines are imported into \p drm_fd, which must support
+ * DRM_CAP_SYNCOBJ_TIMELINE and DRM_IOCTL_SYNCOBJ_EVENTFD; the global is not
+ * created otherwise. Like
+ * linux_explicit_synchronization_setup(), this needs a renderer that can
+ * wait on fences (WESTON_CAP_EXPLICIT_SYNC). Do not call this function
+ * multiple times in the compositor's lifetime.
+ *
+ * \param compositor The compositor to init for.
+ * \param drm_fd The DRM device to use, duplicated.
+ * \return Zero on success or when unsupported, -1 on failure.
+ */
+WL_EXPORT int
+linux_drm_syncobj_setup(struct weston_compositor *compositor, int drm_fd)
+{
+	struct weston_drm_syncobj_manager *manager;
+	uint64_t cap = 0;
+
+	if (drmGetCap(drm_fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap) != 0 || !cap) {
+		weston_log("linux-drm-syncobj: no timeline syncobj support "
+			   "on the DRM device\n");
+		return 0;
+	}
+
+	/* Commits wait for their acquire point to materialize without
+	 * blocking the compositor, which needs the eventfd ioctl. */
+	if (!drm_has_syncobj_eventfd(drm_fd)) {
+		weston_log("linux-drm-syncobj: no syncobj eventfd support "
+			   "on the DRM device\n");
+		return 0;
+	}
+
+	manager = xzalloc(sizeof *manager);
+	manager->drm_fd = fcntl(drm_fd, F_DUPFD_CLOEXEC, 0);
+	if (manager->drm_fd < 0) {
+		free(manager);
+		return -1;
+	}
+	manager->ref_count = 1;
+
+	if (!wl_global_create(compositor->wl_display,
+			      &wp_linux_drm_syncobj_manager_v1_interface,
+			      1, manager, bind_linux_drm_syncobj)) {
+		close(manager->drm_fd);
+		free(manager);
+		return -1;
+	}
+
+	manager->display_destroy_listener.notify =
+		syncobj_manager_display_destroy;
+	wl_display_add_destroy_listener(compositor->wl_display,
+					&manager->display_destroy_listener);
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_LINUX_DRM_SYNCOBJ_H
+#define WESTON_LINUX_DRM_SYNCOBJ_H
+
+#include <stdbool.h>
+
+struct weston_compositor;
+struct weston_buffer_release;
+struct weston_drm_syncobj_surface;
+struct weston_drm_syncobj_acquire;
+
+int
+linux_drm_syncobj_setup(struct weston_compositor *compositor, int drm_fd);
+
+bool
+weston_drm_syncobj_surface_commit(struct weston_drm_syncobj_surface *syncobj);
+
+void
+weston_drm_syncobj_release(struct weston_buffer_release *buffer_release);
+
+bool
+weston_drm_syncobj_acquire_is_ready(struct weston_drm_syncobj_acquire *acquire);
+
+int
+weston_drm_syncobj_acquire_export(struct weston_drm_syncobj_acquire *acquire);
+
+void
+weston_drm_syncobj_acquire_destroy(struct weston_drm_syncobj_acquire *acquire);
+
+#endif /* WESTON_LINUX_DRM_SYNCOBJ_H */
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "metrics.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+};
+
+struct metric_desc {
+	const char *name;
+	enum metric_type type;
+	const char *help;
+};
+
+static const struct metric_desc metric_descs[] = {
+	[WESTON_METRIC_OUTPUT_REPAINTS] = {
+		"weston_output_repaints_total", METRIC_COUNTER,
+		"Output repaints" },
+	[WESTON_METRIC_OUTPUT_REPAINT_FAILURES] = {
+		"weston_output_repaint_failures_total", METRIC_COUNTER,
+		"Output repaints the backend failed to present" },
+	[WESTON_METRIC_MISSED_VBLANKS] = {
+		"weston_missed_vblanks_total", METRIC_COUNTER,
+		"Repaints that missed their target vblank" },
+	[WESTON_METRIC_SURFACE_COMMITS] = {
+		"weston_surface_commits_total", METRIC_COUNTER,
+		"Surface state applications" },
+	[WESTON_METRIC_VIEW_PICKS] = {
+		"weston_view_picks_total", METRIC_COUNTER,
+		"Input picking lookups" },
+	[WESTON_METRIC_BUFFER_IMPORTS_SHM] = {
+		"weston_buffer_imports_shm_total", METRIC_COUNTER,
+		"New wl_shm buffers" },
+	[WESTON_METRIC_BUFFER_IMPORTS_DMABUF] = {
+		"weston_buffer_imports_dmabuf_total", METRIC_COUNTER,
+		"New dma-buf buffers" },
+	[WESTON_METRIC_BUFFER_IMPORTS_SOLID] = {
+		"weston_buffer_imports_solid_total", METRIC_COUNTER,
+		"New single-pixel buffers" },
+	[WESTON_METRIC_BUFFER_IMPORTS_OPAQUE] = {
+		"weston_buffer_imports_opaque_total", METRIC_COUNTER,
+		"New renderer-specific buffers" },
+	[WESTON_METRIC_CAPTURES] = {
+		"weston_captures_total", METRIC_COUNTER,
+		"Completed output captures" },
+	[WESTON_METRIC_CAPTURE_FAILURES] = {
+		"weston_capture_failures_total", METRIC_COUNTER,
+		"Failed output captures" },
+	[WESTON_METRIC_DRM_ATOMIC_COMMITS] = {
+		"weston_drm_atomic_commits_total", METRIC_COUNTER,
+		"Atomic KMS commits" },
+	[WESTON_METRIC_DRM_ATOMIC_COMMIT_FAILURES] = {
+		"weston_drm_atomic_commit_failures_total", METRIC_COUNTER,
+		"Atomic KMS commits rejected by the kernel" },
+	[WESTON_METRIC_DRM_ATOMIC_TESTS] = {
+		"weston_drm_atomic_tests_total", METRIC_COUNTER,
+		"Atomic KMS test-only commits" },
+	[WESTON_METRIC_DRM_ATOMIC_TEST_FAILURES] = {
+		"weston_drm_atomic_test_failures_total", METRIC_COUNTER,
+		"Atomic KMS test-only commits that failed" },
+	[WESTON_METRIC_DRM_ATOMIC_PROPS] = {
+		"weston_drm_atomic_props_total", METRIC_COUNTER,
+		"Properties sent in atomic KMS commits" },
+	[WESTON_METRIC_DRM_ATOMIC_PROPS_SKIPPED] = {
+		"weston_drm_atomic_props_skipped_total", METRIC_COUNTER,
+		"Unchanged properties left out of atomic KMS commits" },
+	[WESTON_METRIC_DRM_VIEWS_ON_PLANES] = {
+		"weston_drm_views_on_planes_total", METRIC_COUNTER,
+		"Views assigned to a KMS plane, per repaint" },
+	[WESTON_METRIC_DRM_VIEWS_ON_RENDERER] = {
+		"weston_drm_views_on_renderer_total", METRIC_COUNTER,
+		"Views composited by the renderer, per repaint" },
+	[WESTON_METRIC_DRM_VIEWS_ON_CURSOR] = {
+		"weston_drm_views_on_cursor_total", METRIC_COUNTER,
+		"Views assigned to a KMS cursor plane, per repaint" },
+	[WESTON_METRIC_DRM_CURSOR_UPLOADS] = {
+		"weston_drm_cursor_uploads_total", METRIC_COUNTER,
+		"Cursor images copied into a cursor framebuffer" },
+	[WESTON_METRIC_OUTPUTS] = {
+		"weston_outputs", METRIC_GAUGE,
+		"Enabled outputs" },
+	[WESTON_METRIC_GL_DMABUF_IMAGE_HITS] = {
+		"weston_gl_dmabuf_image_cache_hits_total", METRIC_COUNTER,
+		"dma-buf imports served from cached EGLImages" },
+	[WESTON_METRIC_GL_DMABUF_IMAGE_MISSES] = {
+		"weston_gl_dmabuf_image_cache_misses_total", METRIC_COUNTER,
+		"dma-buf imports that created new EGLImages" },
+	[WESTON_METRIC_GL_DMABUF_IMAGE_EVICTIONS] = {
+		"weston_gl_dmabuf_image_cache_evictions_total", METRIC_COUNTER,
+		"Cached dma-buf EGLImages dropped to make room" },
+	[WESTON_METRIC_PIXMAN_DMABUF_MAP_HITS] = {
+		"weston_pixman_dmabuf_map_cache_hits_total", METRIC_COUNTER,
+		"dma-buf imports served from cached mappings" },
+	[WESTON_METRIC_PIXMAN_DMABUF_MAP_MISSES] = {
+		"weston_pixman_dmabuf_map_cache_misses_total", METRIC_COUNTER,
+		"dma-buf imports that mapped the dma-buf" },
+	[WESTON_METRIC_REPAINT_SCRATCH_ALLOCS] = {
+		"weston_repaint_scratch_allocs_total", METRIC_COUNTER,
+		"Heap allocations from growing repaint scratch arrays" },
+	[WESTON_METRIC_INPUT_FRAMES_COALESCED] = {
+		"weston_input_frames_coalesced_total", METRIC_COUNTER,
+		"Pointer, touch and tablet motion replaced before being sent" },
+};
+
+static const struct metric_desc metric_hist_descs[] = {
+	[WESTON_METRIC_HIST_REPAINT_USEC] = {
+		"weston_output_repaint_usec", METRIC_COUNTER,
+		"Time spent in weston_output_repaint()" },
+	[WESTON_METRIC_HIST_DRM_ATOMIC_COMMIT_USEC] = {
+		"weston_drm_atomic_commit_usec", METRIC_COUNTER,
+		"Time spent in drmModeAtomicCommit() for real commits" },
+	[WESTON_METRIC_HIST_DRM_REPAINT_TO_FLIP_USEC] = {
+		"weston_drm_repaint_to_flip_usec", METRIC_COUNTER,
+		"Time from the start of a KMS output repaint to its flip" },
+	[WESTON_METRIC_HIST_DRM_CURSOR_UPDATE_USEC] = {
+		"weston_drm_cursor_update_usec", METRIC_COUNTER,
+		"Time spent preparing the cursor plane framebuffer" },
+	[WESTON_METRIC_HIST_COMMIT_TO_PRESENT_USEC] = {
+		"weston_surface_commit_to_present_usec", METRIC_COUNTER,
+		"Time from a surface content commit to its presentation" },
+};
+
+static_assert(ARRAY_LENGTH(metric_descs) == WESTON_METRIC__COUNT,
+	      "metric_descs out of sync with enum weston_metric");
+static_assert(ARRAY_LENGTH(metric_hist_descs) == WESTON_METRIC_HIST__COUNT,
+	      "metric_hist_descs out of sync with enum "
+	      "weston_metric_histogram");
+
+struct weston_metrics *
+weston_metrics_create(void)
+{
+	return xzalloc(sizeof(struct weston_metrics));
+}
+
+void
+weston_metrics_destroy(struct weston_metrics *metrics)
+{
+	free(metrics);
+}
+
+/** Record a duration in a histogram
+ *
+ * \param compositor The compositor.
+ * \param hist Which histogram.
+ * \param nsec The duration in nanoseconds, stored in microseconds.
+ */
+WL_EXPORT void
+weston_metric_observe(struct weston_compositor *compositor,
+		      enum weston_metric_histogram hist, int64_t nsec)
+{
+	struct weston_metric_histogram_data *data;
+	uint64_t usec = nsec > 0 ? nsec / 1000 : 0;
+	unsigned int bucket;
+
+	if (!compositor->metrics)
+		return;
+
+	data = &compositor->metrics->hist[hist];
+	bucket = usec ? 64 - __builtin_clzll(usec) : 0;
+	data->buckets[MIN(bucket, WESTON_METRIC_HIST_BUCKETS - 1)]++;
+	data->count++;
+	data->sum += usec;
+}
+
+static void
+metrics_print_histogram(struct weston_log_subscription *sub,
+			const struct metric_desc *desc,
+			const struct weston_metric_histogram_data *data)
+{
+	uint64_t cumulative = 0;
+	unsigned int i;
+
+	weston_log_subscription_printf(sub, "# HELP %s %s\n"
+				       "# TYPE %s histogram\n",
+				       desc->name, desc->help, desc->name);
+
+	for (i = 0; i < WESTON_METRIC_HIST_BUCKETS - 1; i++) {
+		cumulative += data->buckets[i];
+		weston_log_subscription_printf(sub,
+			"%s_bucket{le=\"%" PRIu64 "\"} %" PRIu64 "\n",
+			desc->name, (UINT64_C(1) << i) - 1, cumulative);
+	}
+
+	weston_log_subscription_printf(sub,
+		"%s_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+		"%s_sum %" PRIu64 "\n"
+		"%s_count %" PRIu64 "\n",
+		desc->name, data->count,
+		desc->name, data->sum,
+		desc->name, data->count);
+}
+
+/** Print all metrics and end the stream
+ *
+ * Called when the one-shot "metrics" debug scope is subscribed. The
+ * output follows the Prometheus text exposition format, so it can be
+ * scraped with "weston-debug metrics" and fed to a collector as is.
+ */
+void
+weston_metrics_snapshot(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_metrics *metrics = compositor->metrics;
+	unsigned int i;
+
+	if (!metrics) {
+		weston_log_subscription_complete(sub);
+		return;
+	}
+
+	for (i = 0; i < WESTON_METRIC__COUNT; i++) {
+		const struct metric_desc *desc = &metric_descs[i];
+
+		weston_log_subscription_printf(sub, "# HELP %s %s\n"
+					       "# TYPE %s %s\n"
+					       "%s %" PRId64 "\n",
+					       desc->name, desc->help,
+					       desc->name,
+					       desc->type == METRIC_COUNTER ?
+					       "counter" : "gauge",
+					       desc->name, metrics->values[i]);
+	}
+
+	for (i = 0; i < WESTON_METRIC_HIST__COUNT; i++)
+		metrics_print_histogram(sub, &metric_hist_descs[i],
+					&metrics->hist[i]);
+
+	weston_log_subscription_complete(sub);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_METRICS_H
+#define WESTON_METRICS_H
+
+#include <stdint.h>
+
+#include <libweston/libweston.h>
+
+/*
+ * Always-on numeric metrics. Updating one is a single add on a plain
+ * integer, with no formatting and no locking: metrics are only touched
+ * from the compositor thread. The "metrics" debug scope prints a
+ * snapshot of all of them when subscribed, see weston_metrics_snapshot().
+ */
+
+/** Counters only go up, gauges are set to the current value */
+enum weston_metric {
+	WESTON_METRIC_OUTPUT_REPAINTS = 0,
+	WESTON_METRIC_OUTPUT_REPAINT_FAILURES,
+	WESTON_METRIC_MISSED_VBLANKS,
+	WESTON_METRIC_SURFACE_COMMITS,
+	WESTON_METRIC_VIEW_PICKS,
+	WESTON_METRIC_BUFFER_IMPORTS_SHM,
+	WESTON_METRIC_BUFFER_IMPORTS_DMABUF,
+	WESTON_METRIC_BUFFER_IMPORTS_SOLID,
+	WESTON_METRIC_BUFFER_IMPORTS_OPAQUE,
+	WESTON_METRIC_CAPTURES,
+	WESTON_METRIC_CAPTURE_FAILURES,
+	WESTON_METRIC_DRM_ATOMIC_COMMITS,
+	WESTON_METRIC_DRM_ATOMIC_COMMIT_FAILURES,
+	WESTON_METRIC_DRM_ATOMIC_TESTS,
+	WESTON_METRIC_DRM_ATOMIC_TEST_FAILURES,
+	WESTON_METRIC_DRM_ATOMIC_PROPS,
+	WESTON_METRIC_DRM_ATOMIC_PROPS_SKIPPED,
+	WESTON_METRIC_DRM_VIEWS_ON_PLANES,
+	WESTON_METRIC_DRM_VIEWS_ON_RENDERER,
+	WESTON_METRIC_DRM_VIEWS_ON_CURSOR,
+	WESTON_METRIC_DRM_CURSOR_UPLOADS,
+	WESTON_METRIC_OUTPUTS,
+	WESTON_METRIC_GL_DMABUF_IMAGE_HITS,
+	WESTON_METRIC_GL_DMABUF_IMAGE_MISSES,
+	WESTON_METRIC_GL_DMABUF_IMAGE_EVICTIONS,
+	WESTON_METRIC_PIXMAN_DMABUF_MAP_HITS,
+	WESTON_METRIC_PIXMAN_DMABUF_MAP_MISSES,
+	WESTON_METRIC_REPAINT_SCRATCH_ALLOCS,
+	WESTON_METRIC_INPUT_FRAMES_COALESCED,
+	WESTON_METRIC__COUNT
+};
+
+/** Histograms of durations, in microseconds */
+enum weston_metric_histogram {
+	WESTON_METRIC_HIST_REPAINT_USEC = 0,
+	WESTON_METRIC_HIST_DRM_ATOMIC_COMMIT_USEC,
+	WESTON_METRIC_HIST_DRM_REPAINT_TO_FLIP_USEC,
+	WESTON_METRIC_HIST_DRM_CURSOR_UPDATE_USEC,
+	WESTON_METRIC_HIST_COMMIT_TO_PRESENT_USEC,
+	WESTON_METRIC_HIST__COUNT
+};
+
+/* Bucket i counts values of i significant bits, up to 2^i - 1; the last
+ * one also counts everything larger */
+#define WESTON_METRIC_HIST_BUCKETS 32
+
+struct weston_metric_histogram_data {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t buckets[WESTON_METRIC_HIST_BUCKETS];
+};
+
+struct weston_metrics {
+	int64_t values[WESTON_METRIC__COUNT];
+	struct weston_metric_histogram_data hist[WESTON_METRIC_HIST__COUNT];
+};
+
+static inline void
+weston_metric_add(struct weston_compositor *compositor,
+		  enum weston_metric metric, int64_t delta)
+{
+	if (compositor->metrics)
+		compositor->metrics->values[metric] += delta;
+}
+
+static inline void
+weston_metric_inc(struct weston_compositor *compositor,
+		  enum weston_metric metric)
+{
+	weston_metric_add(compositor, metric, 1);
+}
+
+static inline void
+weston_metric_set(struct weston_compositor *compositor,
+		  enum weston_metric metric, int64_t value)
+{
+	if (compositor->metrics)
+		compositor->metrics->values[metric] = value;
+}
+
+void
+weston_metric_observe(struct weston_compositor *compositor,
+		      enum weston_metric_histogram hist, int64_t nsec);
+
+struct weston_metrics *
+weston_metrics_create(void);
+
+void
+weston_metrics_destroy(struct weston_metrics *metrics);
+
+void
+weston_metrics_snapshot(struct weston_log_subscription *sub, void *data);
+
+#endif /* WESTON_METRICS_H */
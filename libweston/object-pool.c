@@ -0,0 +1,151 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-util.h>
+
+#include "object-pool.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+/* Slabs hold about this many bytes of objects, and at least 8 of them */
+#define SLAB_BYTES 16384
+#define SLAB_MIN_OBJECTS 8
+
+struct object_pool_slab {
+	struct wl_list link; /* weston_object_pool::slabs */
+	max_align_t objects[];
+};
+
+struct weston_object_pool {
+	size_t object_size;
+	size_t slab_objects;
+	struct wl_list slabs;
+	/* Free objects, each starting with the pointer to the next one */
+	void *free_list;
+	size_t live;
+};
+
+struct weston_object_pool *
+weston_object_pool_create(size_t object_size)
+{
+	struct weston_object_pool *pool = xzalloc(sizeof *pool);
+	size_t align = sizeof(max_align_t);
+
+	assert(object_size > 0);
+
+	pool->object_size = (MAX(object_size, sizeof(void *)) + align - 1) &
+			    ~(align - 1);
+	pool->slab_objects = MAX(SLAB_BYTES / pool->object_size,
+				 (size_t) SLAB_MIN_OBJECTS);
+	wl_list_init(&pool->slabs);
+
+	return pool;
+}
+
+/** Destroy a pool
+ *
+ * Every object must have been returned to the pool by now; their memory
+ * goes away with the slabs.
+ */
+void
+weston_object_pool_destroy(struct weston_object_pool *pool)
+{
+	struct object_pool_slab *slab, *tmp;
+
+	if (!pool)
+		return;
+
+	assert(pool->live == 0);
+
+	wl_list_for_each_safe(slab, tmp, &pool->slabs, link)
+		free(slab);
+	free(pool);
+}
+
+static bool
+object_pool_add_slab(struct weston_object_pool *pool)
+{
+	struct object_pool_slab *slab;
+	char *objects;
+	size_t i;
+
+	slab = malloc(sizeof *slab + pool->slab_objects * pool->object_size);
+	if (!slab)
+		return false;
+
+	wl_list_insert(&pool->slabs, &slab->link);
+
+	/* Pushed in reverse, so that they get handed out in address order */
+	objects = (char *) slab->objects;
+	for (i = pool->slab_objects; i > 0; i--) {
+		void **object = (void **) (objects + (i - 1) * pool->object_size);
+
+		*object = pool->free_list;
+		pool->free_list = object;
+	}
+
+	return true;
+}
+
+/** Allocate a zeroed object, or return NULL when out of memory */
+void *
+weston_object_pool_zalloc(struct weston_object_pool *pool)
+{
+	void **object;
+
+	if (!pool->free_list && !object_pool_add_slab(pool))
+		return NULL;
+
+	object = pool->free_list;
+	pool->free_list = *object;
+	pool->live++;
+
+	memset(object, 0, pool->object_size);
+
+	return object;
+}
+
+void
+weston_object_pool_free(struct weston_object_pool *pool, void *object)
+{
+	void **link = object;
+
+	if (!object)
+		return;
+
+	assert(pool->live > 0);
+
+	*link = pool->free_list;
+	pool->free_list = link;
+	pool->live--;
+}
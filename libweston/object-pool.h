@@ -0,0 +1,52 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_OBJECT_POOL_H
+#define WESTON_OBJECT_POOL_H
+
+#include <stddef.h>
+
+/** Fixed-size objects carved out of larger slabs
+ *
+ * For objects that are created and destroyed often, like views and paint
+ * nodes. Objects of one pool sit next to each other in memory, and a
+ * freed object is the next one handed out, while it is still in cache.
+ * Slabs are kept until the pool is destroyed. Compositor thread only.
+ */
+struct weston_object_pool;
+
+struct weston_object_pool *
+weston_object_pool_create(size_t object_size);
+
+void
+weston_object_pool_destroy(struct weston_object_pool *pool);
+
+void *
+weston_object_pool_zalloc(struct weston_object_pool *pool);
+
+void
+weston_object_pool_free(struct weston_object_pool *pool, void *object);
+
+#endif /* WESTON_OBJECT_POOL_H */
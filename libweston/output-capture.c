@@ -29,7 +29,9 @@
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
+#include "backend.h"
 #include "libweston-internal.h"
+#include "metrics.h"
 #include "output-capture.h"
 #include "pixel-formats.h"
 #include "shared/helpers.h"
@@ -45,7 +47,8 @@
  *
  * Protocol request weston_capture_v1.create creates weston_capture_source
  * whose lifetime is equal to the weston_capture_source_v1 protocol object
- * (wl_resource) lifetime.
+ * (wl_resource) lifetime. weston_output_capture_oneshot() creates one
+ * without a wl_resource, for a single task; it is destroyed with its task.
  *
  * weston_capture_source is associated with a weston_output. When the
  * weston_output is disabled, weston_capture_source is removed from the list
@@ -87,7 +90,10 @@
 
 /** Implementation of weston_capture_source_v1 protocol object */
 struct weston_capture_source {
+	/* NULL for a one-shot source, see weston_output_capture_oneshot() */
 	struct wl_resource *resource;
+	weston_screenshooter_done_func_t done;
+	void *done_data;
 
 	/* struct weston_output_capture_info::capture_source_list */
 	struct wl_list link;
@@ -98,6 +104,15 @@ struct weston_capture_source {
 	struct weston_output *output;
 
 	struct weston_capture_task *pending;
+
+	/* weston_output_get_frame_seq() when the last capture task was
+	 * pulled, for the damage since, see weston_output_get_damage_since().
+	 * Used by version 2 framebuffer sources only. */
+	uint64_t frame_seq;
+
+	/* Buffer written by the last successful capture, if still alive. */
+	struct weston_buffer *last_buffer;
+	struct wl_listener last_buffer_destroy_listener;
 };
 
 /** A pending task to capture an output */
@@ -110,6 +125,15 @@ struct weston_capture_task {
 
 	struct weston_buffer *buffer;
 	struct wl_listener buffer_resource_destroy_listener;
+
+	/* Buffer area to write, in buffer coordinates */
+	pixman_region32_t damage;
+
+	/* A framebuffer capture the backend may serve with writeback */
+	bool via_writeback;
+
+	/* We hold a weston_output_disable_planes_incr() reference */
+	bool disabled_planes;
 };
 
 /** Buffer requirements broadcasting for a pixel source */
@@ -130,6 +154,9 @@ struct weston_output_capture_info {
 	struct wl_list capture_source_list;
 
 	struct weston_output_capture_source_info source_info[WESTON_OUTPUT_CAPTURE_SOURCE__COUNT];
+
+	/* The backend serves framebuffer captures with writeback */
+	bool framebuffer_via_writeback;
 };
 
 /** Create capture tracking information on weston_output enable */
@@ -180,17 +207,51 @@ weston_output_capture_info_destroy(struct weston_output_capture_info **cip)
 	*cip = NULL;
 }
 
+/* Which capture implementation services the task */
+static enum weston_output_capture_source
+capture_task_get_source(struct weston_capture_task *ct)
+{
+	/*
+	 * With planes in use the renderer image misses whatever is on the
+	 * other planes, so only writeback has the exact output image. Once
+	 * planes get disabled for some other reason the renderer has it all
+	 * and is the cheaper option again.
+	 */
+	if (ct->via_writeback && ct->owner->output->disable_planes == 0)
+		return WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK;
+
+	return ct->owner->pixel_source;
+}
+
 /** Assert that all capture tasks were taken
  *
  * This is called at the end of a weston_output repaint cycle when the renderer
  * and the backend have had their chance to service all pending capture tasks.
  * The remaining tasks would not be serviced by anything, so make sure none
  * linger.
+ *
+ * The writeback connector serves one task per frame, so writeback tasks
+ * may be left over; those get another repaint once this frame finishes.
  */
 void
 weston_output_capture_info_repaint_done(struct weston_output_capture_info *ci)
 {
-	assert(wl_list_empty(&ci->pending_capture_list));
+	struct weston_capture_task *ct;
+
+	wl_list_for_each(ct, &ci->pending_capture_list, link) {
+		assert(capture_task_get_source(ct) ==
+		       WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK);
+		ct->owner->output->repaint_needed = true;
+	}
+}
+
+static bool
+capture_source_tracks_damage(struct weston_capture_source *csrc)
+{
+	return csrc->resource &&
+	       csrc->pixel_source == WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER &&
+	       wl_resource_get_version(csrc->resource) >=
+	       WESTON_CAPTURE_SOURCE_V1_DAMAGE_SINCE_VERSION;
 }
 
 static bool
@@ -207,7 +268,7 @@ capture_info_send_source_info(struct weston_output_capture_info *ci,
 	struct weston_capture_source *csrc;
 
 	wl_list_for_each(csrc, &ci->capture_source_list, link) {
-		if (csrc->pixel_source != csi->pixel_source)
+		if (csrc->pixel_source != csi->pixel_source || !csrc->resource)
 			continue;
 
 		weston_capture_source_v1_send_format(csrc->resource,
@@ -296,18 +357,54 @@ buffer_is_compatible(struct weston_buffer *buffer,
 	       buffer->format_modifier == DRM_FORMAT_MOD_LINEAR;
 }
 
+static void
+capture_source_free(struct weston_capture_source *csrc)
+{
+	wl_list_remove(&csrc->last_buffer_destroy_listener.link);
+	wl_list_remove(&csrc->link);
+	free(csrc);
+}
+
 static void
 weston_capture_task_destroy(struct weston_capture_task *ct)
 {
-	if (ct->owner->pixel_source != WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK &&
-	    ct->owner->output)
-		weston_output_disable_planes_decr(ct->owner->output);
+	struct weston_capture_source *csrc = ct->owner;
+
+	if (ct->disabled_planes && csrc->output)
+		weston_output_disable_planes_decr(csrc->output);
 
-	assert(ct->owner->pending == ct);
-	ct->owner->pending = NULL;
+	assert(csrc->pending == ct);
+	csrc->pending = NULL;
 	wl_list_remove(&ct->link);
 	wl_list_remove(&ct->buffer_resource_destroy_listener.link);
+	pixman_region32_fini(&ct->damage);
 	free(ct);
+
+	/* A one-shot source only lives for its task */
+	if (!csrc->resource)
+		capture_source_free(csrc);
+}
+
+static void
+capture_source_set_last_buffer(struct weston_capture_source *csrc,
+			       struct weston_buffer *buffer)
+{
+	wl_list_remove(&csrc->last_buffer_destroy_listener.link);
+	wl_list_init(&csrc->last_buffer_destroy_listener.link);
+	csrc->last_buffer = buffer;
+
+	if (buffer)
+		wl_signal_add(&buffer->destroy_signal,
+			      &csrc->last_buffer_destroy_listener);
+}
+
+static void
+capture_source_last_buffer_destroy_handler(struct wl_listener *l, void *data)
+{
+	struct weston_capture_source *csrc =
+		wl_container_of(l, csrc, last_buffer_destroy_listener);
+
+	capture_source_set_last_buffer(csrc, NULL);
 }
 
 static void
@@ -327,6 +424,8 @@ static struct weston_capture_task *
 weston_capture_task_create(struct weston_capture_source *csrc,
 			   struct weston_buffer *buffer)
 {
+	struct weston_output_capture_info *ci = csrc->output->capture_info;
+	struct weston_output_capture_source_info *fb_csi, *wb_csi;
 	struct weston_capture_task *ct;
 
 	ct = xzalloc(sizeof *ct);
@@ -335,15 +434,33 @@ weston_capture_task_create(struct weston_capture_source *csrc,
 	/* Owner will explicitly destroy us if the owner gets destroyed. */
 
 	ct->buffer = buffer;
+	pixman_region32_init(&ct->damage);
 	ct->buffer_resource_destroy_listener.notify = weston_capture_task_buffer_destroy_handler;
 	wl_resource_add_destroy_listener(buffer->resource,
 					 &ct->buffer_resource_destroy_listener);
 
-	wl_list_insert(&csrc->output->capture_info->pending_capture_list,
-		       &ct->link);
+	wl_list_insert(&ci->pending_capture_list, &ct->link);
 
-	if (ct->owner->pixel_source != WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK)
+	/*
+	 * A framebuffer capture normally forces renderer-only composition.
+	 * If the backend can produce the same buffer with writeback, keep
+	 * the planes instead, so that captures do not add GPU work.
+	 */
+	if (csrc->pixel_source == WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER &&
+	    ci->framebuffer_via_writeback) {
+		fb_csi = capture_info_get_csi(ci, WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER);
+		wb_csi = capture_info_get_csi(ci, WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK);
+		ct->via_writeback = source_info_is_available(wb_csi) &&
+				    fb_csi->width == wb_csi->width &&
+				    fb_csi->height == wb_csi->height &&
+				    fb_csi->drm_format == wb_csi->drm_format;
+	}
+
+	if (ct->owner->pixel_source != WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK &&
+	    !ct->via_writeback) {
 		weston_output_disable_planes_incr(ct->owner->output);
+		ct->disabled_planes = true;
+	}
 
 	return ct;
 }
@@ -352,8 +469,7 @@ static bool
 capture_is_authorized(struct weston_capture_source *csrc)
 {
 	struct weston_compositor *compositor = csrc->output->compositor;
-	const struct weston_output_capture_client who = {
-		.client = wl_resource_get_client(csrc->resource),
+	struct weston_output_capture_client who = {
 		.output = csrc->output,
 	};
 	struct weston_output_capture_attempt att = {
@@ -362,6 +478,11 @@ capture_is_authorized(struct weston_capture_source *csrc)
 		.denied = false,
 	};
 
+	/* One-shot sources are asked for by the compositor itself. */
+	if (!csrc->resource)
+		return true;
+
+	who.client = wl_resource_get_client(csrc->resource);
 	wl_signal_emit(&compositor->output_capture.ask_auth, &att);
 
 	return att.authorized && !att.denied;
@@ -402,7 +523,7 @@ weston_output_pull_capture_task(struct weston_output *output,
 	wl_list_for_each_safe(ct, tmp, &ci->pending_capture_list, link) {
 		assert(ct->owner->output == output);
 
-		if (ct->owner->pixel_source != src)
+		if (capture_task_get_source(ct) != src)
 			continue;
 
 		if (!capture_is_authorized(ct->owner)) {
@@ -415,11 +536,40 @@ weston_output_pull_capture_task(struct weston_output *output,
 		 * the task was filed.
 		 */
 		if (!buffer_is_compatible(ct->buffer, csi)) {
+			if (!ct->owner->resource) {
+				weston_capture_task_retire_failed(ct, "retry");
+				continue;
+			}
 			weston_capture_source_v1_send_retry(ct->owner->resource);
 			weston_capture_task_destroy(ct);
 			continue;
 		}
 
+		/*
+		 * Only what changed since the previous capture needs to be
+		 * written, if the client passed the same buffer again.
+		 */
+		pixman_region32_init_rect(&ct->damage, 0, 0,
+					  csi->width, csi->height);
+		/* Damage is only tracked for the primary plane. */
+		if (capture_source_tracks_damage(ct->owner) &&
+		    src == WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER &&
+		    ct->owner->last_buffer == ct->buffer) {
+			pixman_region32_t damage;
+
+			pixman_region32_init(&damage);
+			weston_output_get_damage_since(output,
+						       ct->owner->frame_seq,
+						       &damage);
+			weston_region_global_to_output(&damage, output,
+						       &damage);
+			pixman_region32_intersect(&ct->damage, &ct->damage,
+						  &damage);
+			pixman_region32_fini(&damage);
+		}
+		ct->owner->frame_seq = weston_output_get_frame_seq(output);
+		capture_source_set_last_buffer(ct->owner, NULL);
+
 		/* pass ct ownership to the caller */
 		wl_list_remove(&ct->link);
 		wl_list_init(&ct->link);
@@ -438,11 +588,30 @@ weston_output_has_renderer_capture_tasks(struct weston_output *output)
 	struct weston_capture_task *ct;
 
 	wl_list_for_each(ct, &ci->pending_capture_list, link)
-		if (ct->owner->pixel_source != WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK)
+		if (capture_task_get_source(ct) != WESTON_OUTPUT_CAPTURE_SOURCE_WRITEBACK)
 			return true;
 	return false;
 }
 
+/** Let the backend serve framebuffer captures with writeback
+ *
+ * \param output The output.
+ * \param enable True if the DRM-backend can service framebuffer capture
+ * tasks through a writeback connector.
+ *
+ * When enabled, framebuffer capture tasks no longer force renderer-only
+ * composition while their buffer requirements equal those of the writeback
+ * source. Such tasks are then returned by weston_output_pull_capture_task()
+ * for the writeback source, with the whole buffer as damage. This only
+ * affects tasks filed after the call.
+ */
+WL_EXPORT void
+weston_output_capture_framebuffer_via_writeback(struct weston_output *output,
+						 bool enable)
+{
+	output->capture_info->framebuffer_via_writeback = enable;
+}
+
 /** Get the destination buffer */
 WL_EXPORT struct weston_buffer *
 weston_capture_task_get_buffer(struct weston_capture_task *ct)
@@ -450,14 +619,53 @@ weston_capture_task_get_buffer(struct weston_capture_task *ct)
 	return ct->buffer;
 }
 
+/** Get the area of the destination buffer to write
+ *
+ * \return The damage in buffer coordinates. Capture implementations may
+ * skip writing everything outside of it, or write the whole buffer anyway.
+ */
+WL_EXPORT const pixman_region32_t *
+weston_capture_task_get_damage(struct weston_capture_task *ct)
+{
+	return &ct->damage;
+}
+
 /** Signal completion of the capture task
  *
- * Sends 'complete' protocol event to the client, and destroys the task.
+ * Sends 'damage' and 'complete' protocol events to the client, and destroys
+ * the task.
  */
 WL_EXPORT void
 weston_capture_task_retire_complete(struct weston_capture_task *ct)
 {
-	weston_capture_source_v1_send_complete(ct->owner->resource);
+	struct weston_capture_source *csrc = ct->owner;
+
+	if (csrc->output)
+		weston_metric_inc(csrc->output->compositor,
+				  WESTON_METRIC_CAPTURES);
+
+	if (!csrc->resource) {
+		csrc->done(csrc->done_data, WESTON_SCREENSHOOTER_SUCCESS);
+		weston_capture_task_destroy(ct);
+		return;
+	}
+
+	if (wl_resource_get_version(csrc->resource) >=
+	    WESTON_CAPTURE_SOURCE_V1_DAMAGE_SINCE_VERSION) {
+		pixman_box32_t *rects;
+		int n_rects, i;
+
+		rects = pixman_region32_rectangles(&ct->damage, &n_rects);
+		for (i = 0; i < n_rects; i++)
+			weston_capture_source_v1_send_damage(csrc->resource,
+							     rects[i].x1,
+							     rects[i].y1,
+							     rects[i].x2 - rects[i].x1,
+							     rects[i].y2 - rects[i].y1);
+	}
+
+	weston_capture_source_v1_send_complete(csrc->resource);
+	capture_source_set_last_buffer(csrc, ct->buffer);
 	weston_capture_task_destroy(ct);
 }
 
@@ -469,7 +677,17 @@ WL_EXPORT void
 weston_capture_task_retire_failed(struct weston_capture_task *ct,
 				  const char *err_msg)
 {
-	weston_capture_source_v1_send_failed(ct->owner->resource, err_msg);
+	struct weston_capture_source *csrc = ct->owner;
+
+	if (csrc->output)
+		weston_metric_inc(csrc->output->compositor,
+				  WESTON_METRIC_CAPTURE_FAILURES);
+
+	if (csrc->resource)
+		weston_capture_source_v1_send_failed(csrc->resource, err_msg);
+	else
+		csrc->done(csrc->done_data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+
 	weston_capture_task_destroy(ct);
 }
 
@@ -484,8 +702,7 @@ destroy_capture_source(struct wl_resource *csrc_resource)
 	if (csrc->pending)
 		weston_capture_task_destroy(csrc->pending);
 
-	wl_list_remove(&csrc->link);
-	free(csrc);
+	capture_source_free(csrc);
 }
 
 static void
@@ -546,6 +763,52 @@ weston_capture_source_v1_capture(struct wl_client *client,
 	weston_output_schedule_repaint(csrc->output);
 }
 
+/** Capture an output into a buffer without a protocol object
+ *
+ * \param output The output to capture.
+ * \param src The pixel source.
+ * \param buffer The destination, must match the size and format of the
+ * pixel source.
+ * \param done Called once the capture completed or failed.
+ * \param data User data for done.
+ * \return 0 if the capture task was filed, or -1 if the pixel source is
+ * unavailable or the buffer does not fit it; done is not called then.
+ *
+ * The task is serviced like those of weston_capture_source_v1, so
+ * renderers that read back asynchronously do not stall the repaint.
+ */
+int
+weston_output_capture_oneshot(struct weston_output *output,
+			      enum weston_output_capture_source src,
+			      struct weston_buffer *buffer,
+			      weston_screenshooter_done_func_t done,
+			      void *data)
+{
+	struct weston_output_capture_info *ci = output->capture_info;
+	struct weston_output_capture_source_info *csi;
+	struct weston_capture_source *csrc;
+
+	csi = capture_info_get_csi(ci, src);
+	if (!source_info_is_available(csi) ||
+	    !buffer_is_compatible(buffer, csi) || !buffer->resource)
+		return -1;
+
+	csrc = xzalloc(sizeof *csrc);
+	csrc->pixel_source = src;
+	csrc->output = output;
+	csrc->done = done;
+	csrc->done_data = data;
+	csrc->last_buffer_destroy_listener.notify =
+		capture_source_last_buffer_destroy_handler;
+	wl_list_init(&csrc->last_buffer_destroy_listener.link);
+	wl_list_insert(&ci->capture_source_list, &csrc->link);
+
+	csrc->pending = weston_capture_task_create(csrc, buffer);
+	weston_output_schedule_repaint(output);
+
+	return 0;
+}
+
 static const struct weston_capture_source_v1_interface weston_capture_source_v1_impl = {
 	.destroy = weston_capture_source_v1_destroy,
 	.capture = weston_capture_source_v1_capture,
@@ -594,6 +857,9 @@ weston_capture_v1_create(struct wl_client *client,
 
 	csrc->pixel_source = isrc;
 	wl_list_init(&csrc->link);
+	csrc->last_buffer_destroy_listener.notify =
+		capture_source_last_buffer_destroy_handler;
+	wl_list_init(&csrc->last_buffer_destroy_listener.link);
 
 	csrc->resource = wl_resource_create(client,
 					    &weston_capture_source_v1_interface,
@@ -665,7 +931,7 @@ weston_compositor_install_capture_protocol(struct weston_compositor *compositor)
 	compositor->output_capture.weston_capture_v1 =
 		wl_global_create(compositor->wl_display,
 				 &weston_capture_v1_interface,
-				 1, NULL, bind_weston_capture);
+				 2, NULL, bind_weston_capture);
 	abort_oom_if_null(compositor->output_capture.weston_capture_v1);
 }
 
@@ -71,6 +71,10 @@ weston_output_update_capture_info(struct weston_output *output,
 bool
 weston_output_has_renderer_capture_tasks(struct weston_output *output);
 
+void
+weston_output_capture_framebuffer_via_writeback(struct weston_output *output,
+						 bool enable);
+
 struct weston_capture_task;
 
 struct weston_capture_task *
@@ -82,6 +86,9 @@ weston_output_pull_capture_task(struct weston_output *output,
 struct weston_buffer *
 weston_capture_task_get_buffer(struct weston_capture_task *ct);
 
+const pixman_region32_t *
+weston_capture_task_get_damage(struct weston_capture_task *ct);
+
 void
 weston_capture_task_retire_failed(struct weston_capture_task *ct,
 				  const char *err_msg);
@@ -89,6 +96,17 @@ weston_capture_task_retire_failed(struct weston_capture_task *ct,
 void
 weston_capture_task_retire_complete(struct weston_capture_task *ct);
 
+/*
+ * For compositor-internal captures:
+ */
+
+int
+weston_output_capture_oneshot(struct weston_output *output,
+			      enum weston_output_capture_source src,
+			      struct weston_buffer *buffer,
+			      weston_screenshooter_done_func_t done,
+			      void *data);
+
 
 /*
  * entry point for weston_compositor
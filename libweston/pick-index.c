@@ -0,0 +1,200 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-util.h>
+
+#include <libweston/libweston.h>
+#include "pick-index.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+/*
+ * A uniform grid over the area of one output, used to speed up
+ * weston_compositor_pick_view(). Every cell holds the views whose bounding
+ * box extents overlap the cell, in the order they were added. The
+ * compositor adds views in view_list order, so each cell is sorted in
+ * z-order, from top to bottom.
+ *
+ * The grid is conservative: a view listed in a cell may still miss the
+ * picked point, so the caller must do the precise tests itself.
+ */
+
+#define PICK_INDEX_CELL_SHIFT 8 /* 256x256 pixel cells */
+
+struct weston_pick_index {
+	pixman_box32_t extents;
+	int32_t cols;
+	int32_t rows;
+
+	/* cols * rows arrays of struct weston_view * */
+	struct wl_array *cells;
+};
+
+struct weston_pick_index *
+weston_pick_index_create(void)
+{
+	return xzalloc(sizeof(struct weston_pick_index));
+}
+
+static void
+weston_pick_index_release_cells(struct weston_pick_index *index)
+{
+	int32_t i;
+
+	for (i = 0; i < index->cols * index->rows; i++)
+		wl_array_release(&index->cells[i]);
+
+	free(index->cells);
+	index->cells = NULL;
+	index->cols = 0;
+	index->rows = 0;
+}
+
+void
+weston_pick_index_destroy(struct weston_pick_index *index)
+{
+	if (!index)
+		return;
+
+	weston_pick_index_release_cells(index);
+	free(index);
+}
+
+/** Empty the index and make it cover the given area
+ *
+ * Cell storage is kept when the area does not change, so that rebuilding
+ * the index after geometry changes does not reallocate.
+ */
+void
+weston_pick_index_reset(struct weston_pick_index *index,
+			const pixman_box32_t *extents)
+{
+	int32_t cell_size = 1 << PICK_INDEX_CELL_SHIFT;
+	int32_t i;
+
+	if (index->cells &&
+	    memcmp(&index->extents, extents, sizeof(*extents)) == 0) {
+		for (i = 0; i < index->cols * index->rows; i++)
+			index->cells[i].size = 0;
+		return;
+	}
+
+	weston_pick_index_release_cells(index);
+	index->extents = *extents;
+
+	if (extents->x2 <= extents->x1 || extents->y2 <= extents->y1)
+		return;
+
+	index->cols = (extents->x2 - extents->x1 + cell_size - 1) >>
+		      PICK_INDEX_CELL_SHIFT;
+	index->rows = (extents->y2 - extents->y1 + cell_size - 1) >>
+		      PICK_INDEX_CELL_SHIFT;
+	index->cells = xcalloc(index->cols * index->rows,
+			       sizeof(*index->cells));
+
+	for (i = 0; i < index->cols * index->rows; i++)
+		wl_array_init(&index->cells[i]);
+}
+
+/** Add a view, whose transform is up-to-date, to the index
+ *
+ * \return False on allocation failure, in which case the index is
+ * incomplete and must not be used until it is reset and rebuilt.
+ */
+bool
+weston_pick_index_add_view(struct weston_pick_index *index,
+			   struct weston_view *view)
+{
+	pixman_box32_t *box;
+	int32_t x1, y1, x2, y2;
+	int32_t col, row;
+
+	box = pixman_region32_extents(&view->transform.boundingbox);
+
+	x1 = MAX(box->x1, index->extents.x1);
+	y1 = MAX(box->y1, index->extents.y1);
+	x2 = MIN(box->x2, index->extents.x2);
+	y2 = MIN(box->y2, index->extents.y2);
+	if (x1 >= x2 || y1 >= y2 || !index->cells)
+		return true;
+
+	x1 = (x1 - index->extents.x1) >> PICK_INDEX_CELL_SHIFT;
+	y1 = (y1 - index->extents.y1) >> PICK_INDEX_CELL_SHIFT;
+	x2 = (x2 - 1 - index->extents.x1) >> PICK_INDEX_CELL_SHIFT;
+	y2 = (y2 - 1 - index->extents.y1) >> PICK_INDEX_CELL_SHIFT;
+
+	for (row = y1; row <= y2; row++) {
+		for (col = x1; col <= x2; col++) {
+			struct wl_array *cell;
+			struct weston_view **entry;
+
+			cell = &index->cells[row * index->cols + col];
+			entry = wl_array_add(cell, sizeof(*entry));
+			if (!entry)
+				return false;
+
+			*entry = view;
+		}
+	}
+
+	return true;
+}
+
+/** Find the candidate views for a point in global coordinates
+ *
+ * \param index The pick index.
+ * \param x The global x coordinate.
+ * \param y The global y coordinate.
+ * \param views Returns the array of candidate views, top-most first.
+ * \param count Returns the number of elements in views.
+ * \return False if the point is outside of the area covered by the index,
+ * in which case views and count are not set.
+ */
+bool
+weston_pick_index_lookup(struct weston_pick_index *index,
+			 int32_t x, int32_t y,
+			 struct weston_view ***views, size_t *count)
+{
+	struct wl_array *cell;
+	int32_t col, row;
+
+	if (!index->cells ||
+	    x < index->extents.x1 || x >= index->extents.x2 ||
+	    y < index->extents.y1 || y >= index->extents.y2)
+		return false;
+
+	col = (x - index->extents.x1) >> PICK_INDEX_CELL_SHIFT;
+	row = (y - index->extents.y1) >> PICK_INDEX_CELL_SHIFT;
+	cell = &index->cells[row * index->cols + col];
+
+	*views = cell->data;
+	*count = cell->size / sizeof(struct weston_view *);
+
+	return true;
+}
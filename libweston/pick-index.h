@@ -0,0 +1,56 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PICK_INDEX_H
+#define WESTON_PICK_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pixman.h>
+
+struct weston_pick_index;
+struct weston_view;
+
+struct weston_pick_index *
+weston_pick_index_create(void);
+
+void
+weston_pick_index_destroy(struct weston_pick_index *index);
+
+void
+weston_pick_index_reset(struct weston_pick_index *index,
+			const pixman_box32_t *extents);
+
+bool
+weston_pick_index_add_view(struct weston_pick_index *index,
+			   struct weston_view *view);
+
+bool
+weston_pick_index_lookup(struct weston_pick_index *index,
+			 int32_t x, int32_t y,
+			 struct weston_view ***views, size_t *count);
+
+#endif /* WESTON_PICK_INDEX_H */
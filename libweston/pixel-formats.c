@@ -28,6 +28,7 @@
 
 #include <endian.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -655,6 +656,88 @@ static const struct pixel_format_info pixel_format_table[] = {
 	},
 };
 
+/*
+ * Open-addressed hash indices over pixel_format_table, keyed on the DRM
+ * fourcc and on the pixman format code. Each slot holds a table index plus
+ * one, so zero marks an empty slot. Keeping the load factor under a third
+ * means a lookup is almost always a single probe, instead of a walk over
+ * the whole table on every buffer attach and every paint.
+ */
+#define PIXEL_FORMAT_LOOKUP_SIZE 256
+
+static_assert(ARRAY_LENGTH(pixel_format_table) * 3 < PIXEL_FORMAT_LOOKUP_SIZE,
+	      "pixel format lookup tables are too small");
+
+static uint8_t pixel_format_by_drm[PIXEL_FORMAT_LOOKUP_SIZE];
+static uint8_t pixel_format_by_pixman[PIXEL_FORMAT_LOOKUP_SIZE];
+static pthread_once_t pixel_format_lookup_once = PTHREAD_ONCE_INIT;
+
+static inline unsigned int
+pixel_format_lookup_hash(uint32_t key)
+{
+	/* Fibonacci hashing; fourccs differ mostly in their high bytes. */
+	return (key * 0x9e3779b1u) >> 24;
+}
+
+static uint32_t
+drm_format_of(const struct pixel_format_info *info)
+{
+	return info->format;
+}
+
+static uint32_t
+pixman_format_of(const struct pixel_format_info *info)
+{
+	return info->pixman_format;
+}
+
+static const struct pixel_format_info *
+pixel_format_lookup(const uint8_t *slots, uint32_t key,
+		    uint32_t (*key_of)(const struct pixel_format_info *))
+{
+	unsigned int h = pixel_format_lookup_hash(key);
+	const struct pixel_format_info *info;
+
+	for (; slots[h] != 0; h = (h + 1) % PIXEL_FORMAT_LOOKUP_SIZE) {
+		info = &pixel_format_table[slots[h] - 1];
+		if (key_of(info) == key)
+			return info;
+	}
+
+	return NULL;
+}
+
+static void
+pixel_format_lookup_insert(uint8_t *slots, unsigned int index,
+			   uint32_t (*key_of)(const struct pixel_format_info *))
+{
+	uint32_t key = key_of(&pixel_format_table[index]);
+	unsigned int h;
+
+	/* The first table entry for a key wins, as with a linear scan. */
+	if (pixel_format_lookup(slots, key, key_of))
+		return;
+
+	h = pixel_format_lookup_hash(key);
+	while (slots[h] != 0)
+		h = (h + 1) % PIXEL_FORMAT_LOOKUP_SIZE;
+
+	slots[h] = index + 1;
+}
+
+static void
+pixel_format_lookup_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
+		pixel_format_lookup_insert(pixel_format_by_drm, i,
+					   drm_format_of);
+		pixel_format_lookup_insert(pixel_format_by_pixman, i,
+					   pixman_format_of);
+	}
+}
+
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info_shm(uint32_t format)
 {
@@ -669,14 +752,9 @@ pixel_format_get_info_shm(uint32_t format)
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info(uint32_t format)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
-		if (pixel_format_table[i].format == format)
-			return &pixel_format_table[i];
-	}
+	pthread_once(&pixel_format_lookup_once, pixel_format_lookup_init);
 
-	return NULL;
+	return pixel_format_lookup(pixel_format_by_drm, format, drm_format_of);
 }
 
 WL_EXPORT const struct pixel_format_info *
@@ -713,14 +791,10 @@ pixel_format_get_info_by_drm_name(const char *drm_format_name)
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info_by_pixman(pixman_format_code_t pixman_format)
 {
-	unsigned int i;
+	pthread_once(&pixel_format_lookup_once, pixel_format_lookup_init);
 
-	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
-		if (pixel_format_table[i].pixman_format == pixman_format)
-			return &pixel_format_table[i];
-	}
-
-	return NULL;
+	return pixel_format_lookup(pixel_format_by_pixman, pixman_format,
+				   pixman_format_of);
 }
 
 WL_EXPORT unsigned int
@@ -735,6 +809,12 @@ pixel_format_is_opaque(const struct pixel_format_info *info)
 	return !info->opaque_substitute;
 }
 
+WL_EXPORT bool
+pixel_format_is_yuv(const struct pixel_format_info *info)
+{
+	return info->sampler_type != 0;
+}
+
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_opaque_substitute(const struct pixel_format_info *info)
 {
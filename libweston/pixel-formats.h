@@ -248,6 +248,18 @@ pixel_format_get_plane_count(const struct pixel_format_info *format);
 bool
 pixel_format_is_opaque(const struct pixel_format_info *format);
 
+/**
+ * Determine if a pixel format holds YCbCr data
+ *
+ * Returns whether the format stores luma and chroma, which need converting
+ * to RGB before composition, rather than RGB components directly.
+ *
+ * @param format Pixel format info structure
+ * @returns True if the format is YCbCr
+ */
+bool
+pixel_format_is_yuv(const struct pixel_format_info *format);
+
 /**
  * Get compatible opaque equivalent for a format
  *
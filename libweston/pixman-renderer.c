@@ -28,20 +28,38 @@
 #include "config.h"
 
 #include <errno.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/dma-buf.h>
 
 #include "pixman-renderer.h"
 #include "color.h"
 #include "pixel-formats.h"
+#include "linux-dmabuf.h"
+#include "metrics.h"
 #include "output-capture.h"
+#include "scratch-array.h"
+#include "worker-pool.h"
 #include "shared/helpers.h"
 #include "shared/weston-drm-fourcc.h"
 #include "shared/xalloc.h"
 
 #include <linux/input.h>
 
+/* Bands thinner than this are not worth handing to another thread */
+#define PIXMAN_BAND_MIN_HEIGHT 64
+
+/* Points along each axis of the 3D LUT color transformations with a
+ * color mapping step are sampled into */
+#define PIXMAN_COLOR_LUT_LEN 33
+
 struct pixman_output_state {
 	pixman_image_t *shadow_image;
 	const struct pixel_format_info *shadow_format;
@@ -49,20 +67,66 @@ struct pixman_output_state {
 	const struct pixel_format_info *hw_format;
 	struct weston_size fb_size;
 	struct wl_list renderbuffer_list;
+	bool color_format_warned;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
+	struct wl_list link; /* pixman_renderer::surface_state_list */
 
 	pixman_image_t *image;
+	/* image is a solid fill of this color */
+	bool is_solid;
+	pixman_color_t solid_color;
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_release_reference buffer_release_ref;
 
+	/* pixman_color_cache::link, one per color transformation */
+	struct wl_list color_caches;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/** A color transformation prepared for 8-bit pixels
+ *
+ * Attached to the weston_color_transform, and so shared by all surfaces
+ * and outputs using it.
+ */
+struct pixman_color_lut {
+	struct weston_color_transform *owner;
+	struct wl_listener destroy_listener;
+
+	/* Without a color mapping step, each channel is a plain table */
+	bool separable;
+	uint8_t curve[3][256];
+
+	/* Otherwise, 3 x PIXMAN_COLOR_LUT_LEN^3 samples in 8.8 fixed point,
+	 * and for each 8-bit input the lower LUT index and the weight of
+	 * the upper one out of 256 */
+	uint16_t *lut3d;
+	uint8_t index[256];
+	uint16_t weight[256];
+};
+
+/** A surface's buffer with a color transformation applied
+ *
+ * Only the damaged parts get transformed again, so static content costs
+ * nothing after the first repaint.
+ */
+struct pixman_color_cache {
+	struct wl_list link; /* pixman_surface_state::color_caches */
+	struct weston_color_transform *xform;
+	struct wl_listener xform_destroy_listener;
+
+	pixman_image_t *image;
+	/* image is a solid fill of this color */
+	pixman_color_t solid_color;
+	/* In buffer coordinates, still to be transformed */
+	pixman_region32_t damage;
+};
+
 struct pixman_renderbuffer {
 	struct weston_renderbuffer base;
 
@@ -77,9 +141,78 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	/* NULL unless compositing is split over several threads */
+	struct weston_worker_pool *worker_pool;
+	/* Scratch space of repaint_surfaces_parallel(), see scratch-array.h */
+	struct wl_array band_nodes;
+	struct wl_array bands;
+
+	/* pixman_surface_state::link */
+	struct wl_list surface_state_list;
+
+	/* Mappings of destroyed dmabufs, most recently used first */
+	struct wl_list dmabuf_maps;
+	unsigned int dmabuf_map_count;
+
+	struct weston_idle_task *idle_task;
+
+	/* Linear single-plane dmabufs of formats pixman can read */
+	struct weston_drm_format_array supported_formats;
+
 	struct wl_signal destroy_signal;
 };
 
+/* Clients that wrap the same dmabufs in new wl_buffers every frame would
+ * otherwise get them mapped again every frame. */
+#define PIXMAN_DMABUF_MAP_CACHE_SIZE 8
+
+/** A dmabuf mapped for reading, see pixman_renderer_import_dmabuf()
+ *
+ * The mapping keeps the dmabuf alive, so its inode cannot be reused while
+ * the mapping is cached.
+ */
+struct pixman_dmabuf {
+	void *map;
+	size_t size;
+	dev_t dev;
+	ino_t ino;
+	struct wl_list link; /* pixman_renderer::dmabuf_maps */
+};
+
+/** Where and how paint nodes get composited
+ *
+ * With a worker pool, every band of the output has its own target, which
+ * wraps the same pixels as the output image. Pixman images carry mutable
+ * state like the clip region and the source transform, so a thread must
+ * never touch an image that another thread may be using.
+ */
+struct pixman_paint_target {
+	pixman_image_t *image;
+	/* In output coordinates, NULL to paint all damage */
+	pixman_region32_t *band;
+	/* Wrap surface images instead of using them directly */
+	bool private_sources;
+	pixman_image_t *debug_color;
+	/* Largest source clip overdraw seen, logged by the caller */
+	int max_overdraw;
+};
+
+struct pixman_band {
+	struct pixman_paint_target target;
+	pixman_region32_t region;
+};
+
+struct pixman_band_job {
+	pixman_region32_t *damage; /* in global coordinates */
+	struct weston_paint_node **nodes; /* in paint order */
+	unsigned int n_nodes;
+	struct pixman_band *bands;
+};
+
+static const pixman_color_t repaint_debug_red = {
+	0x3fff, 0x0000, 0x0000, 0x3fff
+};
+
 static inline struct pixman_renderbuffer *
 to_pixman_renderbuffer(struct weston_renderbuffer *renderbuffer)
 {
@@ -235,7 +368,7 @@ composite_whole(pixman_op_t op,
 }
 
 static void
-composite_clipped(struct weston_output *output,
+composite_clipped(struct pixman_paint_target *target,
 		  pixman_image_t *src,
 		  pixman_image_t *mask,
 		  pixman_image_t *dest,
@@ -304,43 +437,508 @@ composite_clipped(struct weston_output *output,
 		pixman_image_unref(boximg);
 	}
 
-	if (n_box > 1) {
-		weston_log_paced(&output->pixman_overdraw_pacer, 1, 0,
-				 "Pixman-renderer warning: %dx overdraw\n",
-				 n_box);
+	target->max_overdraw = MAX(target->max_overdraw, n_box);
+}
+
+static void
+pixman_color_lut_destroy(struct pixman_color_lut *cl)
+{
+	wl_list_remove(&cl->destroy_listener.link);
+	free(cl->lut3d);
+	free(cl);
+}
+
+static void
+pixman_color_lut_handle_destroy(struct wl_listener *l, void *data)
+{
+	struct pixman_color_lut *cl =
+		container_of(l, struct pixman_color_lut, destroy_listener);
+
+	assert(cl->owner == data);
+
+	pixman_color_lut_destroy(cl);
+}
+
+static uint16_t
+color_lut_fixed(float v)
+{
+	return (uint16_t)(fminf(fmaxf(v, 0.0f), 1.0f) * 255.0f * 256.0f + 0.5f);
+}
+
+static struct pixman_color_lut *
+pixman_color_lut_create(struct weston_color_transform *xform)
+{
+	const unsigned len = PIXMAN_COLOR_LUT_LEN;
+	struct pixman_color_lut *cl;
+	float *values;
+	unsigned i;
+	int ch;
+
+	cl = zalloc(sizeof *cl);
+	if (!cl)
+		return NULL;
+
+	if (xform->mapping.type == WESTON_COLOR_MAPPING_TYPE_IDENTITY) {
+		/* Exact for 8-bit input */
+		values = calloc(3 * 256, sizeof *values);
+		if (!values ||
+		    !weston_color_transform_to_3x1d(xform, values, 256))
+			goto err;
+
+		cl->separable = true;
+		for (ch = 0; ch < 3; ch++)
+			for (i = 0; i < 256; i++)
+				cl->curve[ch][i] =
+					(color_lut_fixed(values[ch * 256 + i]) + 128) >> 8;
+	} else {
+		values = calloc(3 * len * len * len, sizeof *values);
+		cl->lut3d = calloc(3 * len * len * len, sizeof *cl->lut3d);
+		if (!values || !cl->lut3d ||
+		    !weston_color_transform_to_3dlut(xform, values, len))
+			goto err;
+
+		for (i = 0; i < 3 * len * len * len; i++)
+			cl->lut3d[i] = color_lut_fixed(values[i]);
+
+		for (i = 0; i < 256; i++) {
+			unsigned pos = i * (len - 1) * 256 / 255;
+
+			cl->index[i] = MIN(pos >> 8, len - 2);
+			cl->weight[i] = pos - cl->index[i] * 256;
+		}
+	}
+	free(values);
+
+	cl->owner = xform;
+	cl->destroy_listener.notify = pixman_color_lut_handle_destroy;
+	wl_signal_add(&xform->destroy_signal, &cl->destroy_listener);
+
+	return cl;
+
+err:
+	free(values);
+	free(cl->lut3d);
+	free(cl);
+
+	return NULL;
+}
+
+static struct pixman_color_lut *
+pixman_color_lut_get(struct weston_color_transform *xform)
+{
+	struct wl_listener *l;
+
+	l = wl_signal_get(&xform->destroy_signal,
+			  pixman_color_lut_handle_destroy);
+	if (l)
+		return container_of(l, struct pixman_color_lut,
+				    destroy_listener);
+
+	return pixman_color_lut_create(xform);
+}
+
+static inline int32_t
+lerp_fixed(int32_t a, int32_t b, int32_t w)
+{
+	return a + (((b - a) * w) >> 8);
+}
+
+static void
+color_lut_map_3d(const struct pixman_color_lut *cl, uint32_t rgb[3])
+{
+	const unsigned len = PIXMAN_COLOR_LUT_LEN;
+	const unsigned dr = 3, dg = 3 * len, db = 3 * len * len;
+	const int32_t wr = cl->weight[rgb[0]];
+	const int32_t wg = cl->weight[rgb[1]];
+	const int32_t wb = cl->weight[rgb[2]];
+	const uint16_t *c = &cl->lut3d[db * cl->index[rgb[2]] +
+				       dg * cl->index[rgb[1]] +
+				       dr * cl->index[rgb[0]]];
+	int ch;
+
+	for (ch = 0; ch < 3; ch++, c++) {
+		int32_t c00 = lerp_fixed(c[0], c[dr], wr);
+		int32_t c10 = lerp_fixed(c[dg], c[dg + dr], wr);
+		int32_t c01 = lerp_fixed(c[db], c[db + dr], wr);
+		int32_t c11 = lerp_fixed(c[db + dg], c[db + dg + dr], wr);
+		int32_t c0 = lerp_fixed(c00, c10, wg);
+		int32_t c1 = lerp_fixed(c01, c11, wg);
+
+		rgb[ch] = MIN((lerp_fixed(c0, c1, wb) + 128) >> 8, 255);
+	}
+}
+
+/** Apply a color transformation to a row of 32-bit pixels in place
+ *
+ * Pixels are [ax]8r8g8b8. With \c has_alpha, they are premultiplied and
+ * get unpremultiplied around the transformation; otherwise the top byte
+ * is left alone.
+ */
+static void
+color_lut_apply_row(const struct pixman_color_lut *cl,
+		    uint32_t *row, int width, bool has_alpha)
+{
+	uint32_t p, a, rgb[3];
+	int x, ch;
+
+	for (x = 0; x < width; x++) {
+		p = row[x];
+		a = p >> 24;
+		rgb[0] = (p >> 16) & 0xff;
+		rgb[1] = (p >> 8) & 0xff;
+		rgb[2] = p & 0xff;
+
+		if (has_alpha && a != 0xff) {
+			if (a == 0)
+				continue;
+			for (ch = 0; ch < 3; ch++)
+				rgb[ch] = MIN((rgb[ch] * 255 + a / 2) / a, 255u);
+		}
+
+		if (cl->separable) {
+			for (ch = 0; ch < 3; ch++)
+				rgb[ch] = cl->curve[ch][rgb[ch]];
+		} else {
+			color_lut_map_3d(cl, rgb);
+		}
+
+		if (has_alpha && a != 0xff) {
+			for (ch = 0; ch < 3; ch++)
+				rgb[ch] = (rgb[ch] * a + 127) / 255;
+		}
+
+		row[x] = (p & 0xff000000) | rgb[0] << 16 | rgb[1] << 8 | rgb[2];
 	}
 }
 
+static bool
+color_lut_format_supported(pixman_format_code_t format)
+{
+	return format == PIXMAN_a8r8g8b8 || format == PIXMAN_x8r8g8b8;
+}
+
+/** Apply a color transformation to a region of an image in place */
+static void
+color_lut_apply_region(const struct pixman_color_lut *cl,
+		       pixman_image_t *image, pixman_region32_t *region)
+{
+	uint8_t *data = (uint8_t *)pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image);
+	bool has_alpha = pixman_image_get_format(image) == PIXMAN_a8r8g8b8;
+	pixman_region32_t clipped;
+	pixman_box32_t *boxes;
+	int n_boxes, i, y;
+
+	assert(color_lut_format_supported(pixman_image_get_format(image)));
+
+	pixman_region32_init_rect(&clipped, 0, 0,
+				  pixman_image_get_width(image),
+				  pixman_image_get_height(image));
+	pixman_region32_intersect(&clipped, &clipped, region);
+
+	boxes = pixman_region32_rectangles(&clipped, &n_boxes);
+	for (i = 0; i < n_boxes; i++) {
+		for (y = boxes[i].y1; y < boxes[i].y2; y++) {
+			uint32_t *row = (uint32_t *)(data + y * stride);
+
+			color_lut_apply_row(cl, row + boxes[i].x1,
+					    boxes[i].x2 - boxes[i].x1,
+					    has_alpha);
+		}
+	}
+
+	pixman_region32_fini(&clipped);
+}
+
+static void
+pixman_color_cache_destroy(struct pixman_color_cache *cc)
+{
+	wl_list_remove(&cc->link);
+	wl_list_remove(&cc->xform_destroy_listener.link);
+	if (cc->image)
+		pixman_image_unref(cc->image);
+	pixman_region32_fini(&cc->damage);
+	free(cc);
+}
+
+static void
+pixman_color_cache_handle_xform_destroy(struct wl_listener *l, void *data)
+{
+	struct pixman_color_cache *cc =
+		container_of(l, struct pixman_color_cache,
+			     xform_destroy_listener);
+
+	pixman_color_cache_destroy(cc);
+}
+
+static void
+surface_state_drop_color_caches(struct pixman_surface_state *ps)
+{
+	struct pixman_color_cache *cc, *tmp;
+
+	wl_list_for_each_safe(cc, tmp, &ps->color_caches, link)
+		pixman_color_cache_destroy(cc);
+}
+
+/* Read-only, so safe from the compositing threads */
+static struct pixman_color_cache *
+surface_state_find_color_cache(struct pixman_surface_state *ps,
+			       struct weston_color_transform *xform)
+{
+	struct pixman_color_cache *cc;
+
+	if (!xform)
+		return NULL;
+
+	wl_list_for_each(cc, &ps->color_caches, link) {
+		if (cc->xform == xform)
+			return cc;
+	}
+
+	return NULL;
+}
+
+static pixman_color_t
+color_lut_apply_solid(const struct pixman_color_lut *cl,
+		      const pixman_color_t *color)
+{
+	pixman_color_t out = { .alpha = color->alpha };
+	uint32_t p;
+
+	p = (uint32_t)(color->alpha >> 8) << 24 |
+	    (uint32_t)(color->red >> 8) << 16 |
+	    (uint32_t)(color->green >> 8) << 8 |
+	    (uint32_t)(color->blue >> 8);
+	color_lut_apply_row(cl, &p, 1, true);
+
+	out.red = ((p >> 16) & 0xff) * 0x101;
+	out.green = ((p >> 8) & 0xff) * 0x101;
+	out.blue = (p & 0xff) * 0x101;
+
+	return out;
+}
+
+static struct pixman_color_cache *
+pixman_color_cache_create(struct pixman_surface_state *ps,
+			  struct weston_color_transform *xform)
+{
+	struct pixman_color_lut *cl;
+	struct pixman_color_cache *cc;
+	int width, height;
+
+	cl = pixman_color_lut_get(xform);
+	if (!cl)
+		return NULL;
+
+	cc = zalloc(sizeof *cc);
+	if (!cc)
+		return NULL;
+
+	if (ps->is_solid) {
+		cc->solid_color = color_lut_apply_solid(cl, &ps->solid_color);
+		cc->image = pixman_image_create_solid_fill(&cc->solid_color);
+		pixman_region32_init(&cc->damage);
+	} else {
+		width = pixman_image_get_width(ps->image);
+		height = pixman_image_get_height(ps->image);
+		cc->image = pixman_image_create_bits_no_clear(
+				PIXMAN_FORMAT_A(pixman_image_get_format(ps->image)) ?
+					PIXMAN_a8r8g8b8 : PIXMAN_x8r8g8b8,
+				width, height, NULL, 0);
+		pixman_region32_init_rect(&cc->damage, 0, 0, width, height);
+	}
+	if (!cc->image) {
+		pixman_region32_fini(&cc->damage);
+		free(cc);
+		return NULL;
+	}
+
+	cc->xform = xform;
+	cc->xform_destroy_listener.notify =
+		pixman_color_cache_handle_xform_destroy;
+	wl_signal_add(&xform->destroy_signal, &cc->xform_destroy_listener);
+	wl_list_insert(&ps->color_caches, &cc->link);
+
+	return cc;
+}
+
+/** Bring the transformed copy of a surface buffer up to date
+ *
+ * Converts the damaged parts of the buffer to 32 bits and applies the
+ * color transformation to them. Must run on the compositor thread.
+ */
+static bool
+surface_state_update_color_cache(struct pixman_surface_state *ps,
+				 struct weston_color_transform *xform)
+{
+	struct pixman_color_cache *cc;
+	struct pixman_color_lut *cl;
+
+	cc = surface_state_find_color_cache(ps, xform);
+	if (!cc)
+		cc = pixman_color_cache_create(ps, xform);
+	if (!cc) {
+		weston_log("Pixman renderer error: out of memory for color "
+			   "transformation t%u\n", xform->id);
+		return false;
+	}
+
+	if (!pixman_region32_not_empty(&cc->damage))
+		return true;
+
+	cl = pixman_color_lut_get(xform);
+	if (!cl)
+		return false;
+
+	if (ps->buffer_ref.buffer && ps->buffer_ref.buffer->shm_buffer)
+		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+
+	pixman_image_set_clip_region32(cc->image, &cc->damage);
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 ps->image, /* src */
+				 NULL /* mask */,
+				 cc->image, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 pixman_image_get_width(cc->image),
+				 pixman_image_get_height(cc->image));
+	pixman_image_set_clip_region32(cc->image, NULL);
+
+	if (ps->buffer_ref.buffer && ps->buffer_ref.buffer->shm_buffer)
+		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+
+	color_lut_apply_region(cl, cc->image, &cc->damage);
+	pixman_region32_clear(&cc->damage);
+
+	return true;
+}
+
+static pixman_image_t *
+copy_image(pixman_image_t *image, bool is_solid, const pixman_color_t *color)
+{
+	if (is_solid)
+		return pixman_image_create_solid_fill(color);
+
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
+
+/** Fill a region of a 32-bit target with a solid colour
+ *
+ * For an SRC or opaque OVER operation from a solid source this writes
+ * exactly what compositing would, without creating an image for the
+ * source or looking up a compositing path.
+ *
+ * \return false if the target format is not handled here.
+ */
+static bool
+fill_solid_region(pixman_image_t *dest, pixman_region32_t *region,
+		  const pixman_color_t *color)
+{
+	pixman_format_code_t format = pixman_image_get_format(dest);
+	int width = pixman_image_get_width(dest);
+	int height = pixman_image_get_height(dest);
+	pixman_box32_t *boxes;
+	uint32_t pixel;
+	int n_box, i;
+
+	/* pixman_fill() takes a raw pixel value; pack only the common
+	 * formats here and let compositing handle everything else. */
+	if (format != PIXMAN_a8r8g8b8 && format != PIXMAN_x8r8g8b8)
+		return false;
+
+	pixel = (uint32_t)(color->alpha >> 8) << 24 |
+		(uint32_t)(color->red >> 8) << 16 |
+		(uint32_t)(color->green >> 8) << 8 |
+		(uint32_t)(color->blue >> 8);
+
+	boxes = pixman_region32_rectangles(region, &n_box);
+	for (i = 0; i < n_box; i++) {
+		/* Unlike compositing, pixman_fill() does not clip. */
+		int x1 = MAX(boxes[i].x1, 0);
+		int y1 = MAX(boxes[i].y1, 0);
+		int x2 = MIN(boxes[i].x2, width);
+		int y2 = MIN(boxes[i].y2, height);
+
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		/* Filling again by compositing is harmless if this fails
+		 * half-way, the operation is idempotent. */
+		if (!pixman_fill(pixman_image_get_data(dest),
+				 pixman_image_get_stride(dest) / 4, 32,
+				 x1, y1, x2 - x1, y2 - y1, pixel))
+			return false;
+	}
+
+	return true;
+}
+
 /** Paint an intersected region
  *
  * \param pnode The paint node to be painted.
+ * \param target The image and band to paint into.
  * \param repaint_output The region to be painted in output coordinates.
+ *                       Clipped to the band in place.
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
  * \param pixman_op Compositing operator, either SRC or OVER.
  */
 static void
 repaint_region(struct weston_paint_node *pnode,
+	       struct pixman_paint_target *target,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
 {
 	struct weston_output *output = pnode->output;
 	struct weston_view *ev = pnode->view;
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
 	struct pixman_output_state *po = get_output_state(output);
-	pixman_image_t *target_image;
+	struct pixman_color_cache *cc;
+	pixman_image_t *target_image = target->image;
+	pixman_image_t *src_image, *image;
+	const pixman_color_t *solid_color;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
-	if (po->shadow_image)
-		target_image = po->shadow_image;
+	if (target->band) {
+		pixman_region32_intersect(repaint_output, repaint_output,
+					  target->band);
+		if (!pixman_region32_not_empty(repaint_output))
+			return;
+	}
+
+	/* Brought up to date by prepare_paint_node() */
+	cc = surface_state_find_color_cache(ps, pnode->surf_xform.transform);
+	if (cc) {
+		image = cc->image;
+		solid_color = &cc->solid_color;
+	} else {
+		image = ps->image;
+		solid_color = &ps->solid_color;
+	}
+
+	/* Solid colour views that replace what is below them are plain
+	 * fills, e.g. backgrounds and letterboxing. */
+	if (ps->is_solid && !source_clip && !(ev->alpha < 1.0) &&
+	    (pixman_op == PIXMAN_OP_SRC || solid_color->alpha == 0xffff) &&
+	    fill_solid_region(target_image, repaint_output, solid_color)) {
+		pixman_image_set_clip_region32(target_image, repaint_output);
+		goto debug;
+	}
+
+	if (target->private_sources)
+		src_image = copy_image(image, ps->is_solid, solid_color);
 	else
-		target_image = po->hw_buffer;
+		src_image = pixman_image_ref(image);
+	abort_oom_if_null(src_image);
 
  	/* Clip rendering to the damaged output region */
 	pixman_image_set_clip_region32(target_image, repaint_output);
@@ -353,7 +951,7 @@ repaint_region(struct weston_paint_node *pnode,
 	else
 		filter = PIXMAN_FILTER_NEAREST;
 
-	if (ps->buffer_ref.buffer)
+	if (ps->buffer_ref.buffer && ps->buffer_ref.buffer->shm_buffer)
 		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
 
 	if (ev->alpha < 1.0) {
@@ -364,21 +962,23 @@ repaint_region(struct weston_paint_node *pnode,
 	}
 
 	if (source_clip)
-		composite_clipped(output, ps->image, mask_image, target_image,
+		composite_clipped(target, src_image, mask_image, target_image,
 				  &transform, filter, source_clip);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
+		composite_whole(pixman_op, src_image, mask_image,
 				target_image, &transform, filter);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
+	pixman_image_unref(src_image);
 
-	if (ps->buffer_ref.buffer)
+	if (ps->buffer_ref.buffer && ps->buffer_ref.buffer->shm_buffer)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
 
-	if (pr->repaint_debug)
+debug:
+	if (target->debug_color)
 		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+					 target->debug_color, /* src */
 					 NULL /* mask */,
 					 target_image, /* dest */
 					 0, 0, /* src_x, src_y */
@@ -392,6 +992,7 @@ repaint_region(struct weston_paint_node *pnode,
 
 static void
 draw_node_translated(struct weston_paint_node *pnode,
+		     struct pixman_paint_target *target,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_output *output = pnode->output;
@@ -424,7 +1025,7 @@ draw_node_translated(struct weston_paint_node *pnode,
 						       output,
 						       &repaint_output);
 
-			repaint_region(pnode, &repaint_output, NULL,
+			repaint_region(pnode, target, &repaint_output, NULL,
 				       PIXMAN_OP_SRC);
 		}
 	}
@@ -437,7 +1038,8 @@ draw_node_translated(struct weston_paint_node *pnode,
 					       output,
 					       &repaint_output);
 
-		repaint_region(pnode, &repaint_output, NULL, PIXMAN_OP_OVER);
+		repaint_region(pnode, target, &repaint_output, NULL,
+			       PIXMAN_OP_OVER);
 	}
 
 	pixman_region32_fini(&surface_blend);
@@ -446,6 +1048,7 @@ draw_node_translated(struct weston_paint_node *pnode,
 
 static void
 draw_node_source_clipped(struct weston_paint_node *pnode,
+			 struct pixman_paint_target *target,
 			 pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = pnode->surface;
@@ -474,29 +1077,30 @@ draw_node_source_clipped(struct weston_paint_node *pnode,
 	weston_region_global_to_output(&repaint_output, output,
 				       &repaint_output);
 
-	repaint_region(pnode, &repaint_output, &buffer_region, PIXMAN_OP_OVER);
+	repaint_region(pnode, target, &repaint_output, &buffer_region,
+		       PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
 	pixman_region32_fini(&buffer_region);
 	pixman_region32_fini(&surf_region);
 }
 
-static void
-draw_paint_node(struct weston_paint_node *pnode,
-		pixman_region32_t *damage /* in global coordinates */)
+/** Check whether a paint node has anything to draw
+ *
+ * This may change the surface state, so unlike draw_paint_node() it must
+ * run on the compositor thread.
+ */
+static bool
+prepare_paint_node(struct weston_paint_node *pnode)
 {
 	struct pixman_surface_state *ps = get_surface_state(pnode->surface);
-	/* repaint bounding region in global coordinates: */
-	pixman_region32_t repaint;
 
 	if (!pnode->surf_xform_valid)
-		return;
-
-	assert(pnode->surf_xform.transform == NULL);
+		return false;
 
 	/* No buffer attached */
 	if (!ps->image)
-		return;
+		return false;
 
 	/* if we still have a reference, but the underlying buffer is no longer
 	 * available signal that we should unref image_t as well. This happens
@@ -505,12 +1109,28 @@ draw_paint_node(struct weston_paint_node *pnode,
 	 * terminated. This is a particular use-case and should probably be
 	 * refactored to provide some analogue with the GL-renderer (as in, to
 	 * still maintain the buffer and let the compositor dispose of it). */
-	if (ps->buffer_ref.buffer && !ps->buffer_ref.buffer->shm_buffer) {
+	if (ps->buffer_ref.buffer && !ps->buffer_ref.buffer->shm_buffer &&
+	    !ps->buffer_ref.buffer->dmabuf) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
-		return;
+		return false;
 	}
 
+	if (pnode->surf_xform.transform &&
+	    !surface_state_update_color_cache(ps, pnode->surf_xform.transform))
+		return false;
+
+	return true;
+}
+
+static void
+draw_paint_node(struct weston_paint_node *pnode,
+		struct pixman_paint_target *target,
+		pixman_region32_t *damage /* in global coordinates */)
+{
+	/* repaint bounding region in global coordinates: */
+	pixman_region32_t repaint;
+
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &pnode->visible, damage);
@@ -526,7 +1146,7 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_node_translated(pnode, &repaint);
+		draw_node_translated(pnode, target, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -535,21 +1155,142 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_node_source_clipped(pnode, &repaint);
+		draw_node_source_clipped(pnode, target, &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
+
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_band(void *data, unsigned int job)
+{
+	struct pixman_band_job *bj = data;
+	struct pixman_band *band = &bj->bands[job];
+	unsigned int i;
+
+	for (i = 0; i < bj->n_nodes; i++)
+		draw_paint_node(bj->nodes[i], &band->target, bj->damage);
+}
+
+/** Composite on the worker pool, one horizontal band per thread
+ *
+ * Every band clips to its own rows of the target, and compositing a pixel
+ * depends only on the sources, so the result is identical to painting
+ * everything on one thread.
+ *
+ * \return false if the damage is too small to be worth splitting, in
+ * which case nothing has been painted.
+ */
+static bool
+repaint_surfaces_parallel(struct weston_output *output,
+			  struct pixman_paint_target *target,
+			  pixman_region32_t *damage)
 {
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
 	struct weston_paint_node *pnode;
+	struct pixman_band_job bj = { .damage = damage };
+	pixman_region32_t damage_output;
+	pixman_box32_t *extents;
+	unsigned int n_bands, n_nodes, i;
+	int32_t y1, y2;
+
+	pixman_region32_init(&damage_output);
+	pixman_region32_copy(&damage_output, damage);
+	weston_region_global_to_output(&damage_output, output, &damage_output);
+	extents = pixman_region32_extents(&damage_output);
+	y1 = MAX(extents->y1, 0);
+	y2 = MIN(extents->y2, po->fb_size.height);
+	pixman_region32_fini(&damage_output);
+
+	if (y2 - y1 < 2 * PIXMAN_BAND_MIN_HEIGHT)
+		return false;
+
+	n_bands = MIN(weston_worker_pool_get_thread_count(pr->worker_pool),
+		      (unsigned int)(y2 - y1) / PIXMAN_BAND_MIN_HEIGHT);
+
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	bj.nodes = weston_scratch_array_reserve(output->compositor,
+						&pr->band_nodes,
+						n_nodes * sizeof *bj.nodes);
+	for (i = n_nodes; i > 0; i--) {
+		pnode = nodes[i - 1];
+		if (pnode->plane == &output->primary_plane &&
+		    prepare_paint_node(pnode))
+			bj.nodes[bj.n_nodes++] = pnode;
+	}
+
+	bj.bands = weston_scratch_array_reserve(output->compositor, &pr->bands,
+						n_bands * sizeof *bj.bands);
+	memset(bj.bands, 0, n_bands * sizeof *bj.bands);
+	for (i = 0; i < n_bands; i++) {
+		struct pixman_band *band = &bj.bands[i];
+		int32_t band_y1 = y1 + (y2 - y1) * i / n_bands;
+		int32_t band_y2 = y1 + (y2 - y1) * (i + 1) / n_bands;
+
+		pixman_region32_init_rect(&band->region,
+					  0, band_y1,
+					  po->fb_size.width, band_y2 - band_y1);
+		band->target.band = &band->region;
+		band->target.private_sources = true;
+		band->target.image =
+			pixman_image_create_bits_no_clear(pixman_image_get_format(target->image),
+							  pixman_image_get_width(target->image),
+							  pixman_image_get_height(target->image),
+							  pixman_image_get_data(target->image),
+							  pixman_image_get_stride(target->image));
+		abort_oom_if_null(band->target.image);
+		if (target->debug_color) {
+			band->target.debug_color =
+				pixman_image_create_solid_fill(&repaint_debug_red);
+			abort_oom_if_null(band->target.debug_color);
+		}
+	}
+
+	weston_worker_pool_run(pr->worker_pool, repaint_band, &bj, n_bands);
+
+	for (i = 0; i < n_bands; i++) {
+		struct pixman_band *band = &bj.bands[i];
+
+		target->max_overdraw = MAX(target->max_overdraw,
+					   band->target.max_overdraw);
+		if (band->target.debug_color)
+			pixman_image_unref(band->target.debug_color);
+		pixman_image_unref(band->target.image);
+		pixman_region32_fini(&band->region);
+	}
+
+	return true;
+}
+
+static void
+repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_paint_target target = {
+		.image = po->shadow_image ? po->shadow_image : po->hw_buffer,
+		.debug_color = pr->repaint_debug ? pr->debug_color : NULL,
+	};
+	struct weston_paint_node *pnode, **nodes;
+	unsigned int n_nodes, i;
+
+	if (!pr->worker_pool ||
+	    !repaint_surfaces_parallel(output, &target, damage)) {
+		nodes = weston_output_get_paint_nodes(output, &n_nodes);
+		for (i = n_nodes; i > 0; i--) {
+			pnode = nodes[i - 1];
+			if (pnode->plane == &output->primary_plane &&
+			    prepare_paint_node(pnode))
+				draw_paint_node(pnode, &target, damage);
+		}
+	}
 
-	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
-				 z_order_link) {
-		if (pnode->plane == &output->primary_plane)
-			draw_paint_node(pnode, damage);
+	if (target.max_overdraw > 1) {
+		weston_log_paced(&output->pixman_overdraw_pacer, 1, 0,
+				 "Pixman-renderer warning: %dx overdraw\n",
+				 target.max_overdraw);
 	}
 }
 
@@ -580,6 +1321,46 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
 }
 
+/** Transform the repainted part of the framebuffer to the output color space
+ *
+ * Without a shadow buffer this works in place, which is fine because the
+ * damaged area of the framebuffer has just been repainted completely.
+ */
+static void
+apply_blend_to_output(struct weston_output *output, pixman_region32_t *region)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_color_transform *xform;
+	struct pixman_color_lut *cl;
+	pixman_region32_t output_region;
+
+	if (output->from_blend_to_output_by_backend)
+		return;
+
+	xform = output->color_outcome->from_blend_to_output;
+	if (!xform)
+		return;
+
+	if (!color_lut_format_supported(po->hw_format->pixman_format)) {
+		if (!po->color_format_warned)
+			weston_log("Pixman-renderer error: cannot apply color "
+				   "transformations to output format %s\n",
+				   po->hw_format->drm_format_name);
+		po->color_format_warned = true;
+		return;
+	}
+
+	cl = pixman_color_lut_get(xform);
+	if (!cl)
+		return;
+
+	pixman_region32_init(&output_region);
+	pixman_region32_copy(&output_region, region);
+	weston_region_global_to_output(&output_region, output, &output_region);
+	color_lut_apply_region(cl, po->hw_buffer, &output_region);
+	pixman_region32_fini(&output_region);
+}
+
 static void
 pixman_renderer_do_capture(struct weston_buffer *into, pixman_image_t *from)
 {
@@ -637,6 +1418,32 @@ pixman_renderer_do_capture_tasks(struct weston_output *output,
 	}
 }
 
+/** Bracket CPU reads of the dmabufs composited on the primary plane */
+static void
+sync_dmabuf_access(struct weston_output *output, uint64_t flags)
+{
+	struct weston_paint_node *pnode, **nodes;
+	unsigned int n_nodes, i;
+
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		struct weston_buffer *buffer;
+		struct dma_buf_sync sync = {
+			.flags = flags | DMA_BUF_SYNC_READ,
+		};
+
+		pnode = nodes[i];
+		buffer = pnode->surface->buffer_ref.buffer;
+		if (pnode->plane != &output->primary_plane ||
+		    !buffer || buffer->type != WESTON_BUFFER_DMABUF ||
+		    !buffer->dmabuf)
+			continue;
+
+		ioctl(buffer->dmabuf->attributes.fd[0], DMA_BUF_IOCTL_SYNC,
+		      &sync);
+	}
+}
+
 static void
 pixman_renderer_output_set_buffer(struct weston_output *output,
 				  pixman_image_t *buffer);
@@ -655,9 +1462,6 @@ pixman_renderer_repaint_output(struct weston_output *output,
 
 	pixman_renderer_output_set_buffer(output, rb->image);
 
-	assert(output->from_blend_to_output_by_backend ||
-	       output->color_outcome->from_blend_to_output == NULL);
-
 	if (!po->hw_buffer)
  		return;
 
@@ -668,6 +1472,7 @@ pixman_renderer_repaint_output(struct weston_output *output,
 				      output_damage);
 	}
 
+	sync_dmabuf_access(output, DMA_BUF_SYNC_START);
 	if (po->shadow_image) {
 		repaint_surfaces(output, output_damage);
 		pixman_renderer_do_capture_tasks(output,
@@ -677,6 +1482,8 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	} else {
 		repaint_surfaces(output, &renderbuffer->damage);
 	}
+	sync_dmabuf_access(output, DMA_BUF_SYNC_END);
+	apply_blend_to_output(output, &renderbuffer->damage);
 	pixman_renderer_do_capture_tasks(output,
 					 WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER,
 					 po->hw_buffer, po->hw_format);
@@ -690,7 +1497,22 @@ pixman_renderer_repaint_output(struct weston_output *output,
 static void
 pixman_renderer_flush_damage(struct weston_paint_node *pnode)
 {
-	/* No-op for pixman renderer */
+	struct weston_surface *surface = pnode->surface;
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	struct pixman_color_cache *cc;
+	pixman_region32_t buffer_damage;
+
+	/* Buffers are used directly, only transformed copies need updating */
+	if (wl_list_empty(&ps->color_caches))
+		return;
+
+	pixman_region32_init(&buffer_damage);
+	weston_surface_to_buffer_region(surface, &surface->damage,
+					&buffer_damage);
+	wl_list_for_each(cc, &ps->color_caches, link)
+		pixman_region32_union(&cc->damage, &cc->damage,
+				      &buffer_damage);
+	pixman_region32_fini(&buffer_damage);
 }
 
 static void
@@ -727,6 +1549,34 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	}
 
 	ps->image = pixman_image_create_solid_fill(&color);
+	ps->is_solid = true;
+	ps->solid_color = color;
+}
+
+static void
+pixman_renderer_attach_dmabuf(struct weston_surface *es,
+			      struct weston_buffer *buffer)
+{
+	struct pixman_surface_state *ps = get_surface_state(es);
+	struct linux_dmabuf_buffer *dmabuf = buffer->dmabuf;
+	struct pixman_dmabuf *pd;
+
+	/* Gone already, like a destroyed wl_shm_buffer */
+	if (!dmabuf)
+		return;
+
+	pd = linux_dmabuf_buffer_get_user_data(dmabuf);
+	assert(pd);
+
+	ps->image = pixman_image_create_bits(buffer->pixel_format->pixman_format,
+		buffer->width, buffer->height,
+		(uint32_t *) ((uint8_t *) pd->map + dmabuf->attributes.offset[0]),
+		dmabuf->attributes.stride[0]);
+
+	ps->buffer_destroy_listener.notify =
+		buffer_state_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal,
+		      &ps->buffer_destroy_listener);
 }
 
 static void
@@ -749,10 +1599,22 @@ pixman_renderer_attach(struct weston_paint_node *pnode)
 		ps->buffer_destroy_listener.notify = NULL;
 	}
 
+	/* A buffer of the same size and format only needs its damage
+	 * transformed again, like a texture upload in GL-renderer. */
+	if (ps->is_solid || !ps->image || !buffer ||
+	    (buffer->type != WESTON_BUFFER_SHM &&
+	     buffer->type != WESTON_BUFFER_DMABUF) ||
+	    buffer->width != pixman_image_get_width(ps->image) ||
+	    buffer->height != pixman_image_get_height(ps->image) ||
+	    buffer->pixel_format->pixman_format !=
+	    pixman_image_get_format(ps->image))
+		surface_state_drop_color_caches(ps);
+
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->is_solid = false;
 
 	if (!buffer)
 		return;
@@ -769,8 +1631,13 @@ pixman_renderer_attach(struct weston_paint_node *pnode)
 		return;
 	}
 
+	if (buffer->type == WESTON_BUFFER_DMABUF) {
+		pixman_renderer_attach_dmabuf(es, buffer);
+		return;
+	}
+
 	if (buffer->type != WESTON_BUFFER_SHM) {
-		weston_log("Pixman renderer supports only SHM buffers\n");
+		weston_log("Pixman renderer supports only SHM and dmabuf buffers\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL,
 					BUFFER_WILL_NOT_BE_ACCESSED);
 		weston_buffer_release_reference(&ps->buffer_release_ref, NULL);
@@ -810,6 +1677,7 @@ pixman_renderer_attach(struct weston_paint_node *pnode)
 static void
 pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 {
+	wl_list_remove(&ps->link);
 	wl_list_remove(&ps->surface_destroy_listener.link);
 	wl_list_remove(&ps->renderer_destroy_listener.link);
 	if (ps->buffer_destroy_listener.notify) {
@@ -819,6 +1687,7 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 
 	ps->surface->renderer_state = NULL;
 
+	surface_state_drop_color_caches(ps);
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
@@ -864,6 +1733,8 @@ pixman_renderer_create_surface(struct weston_surface *surface)
 	surface->renderer_state = ps;
 
 	ps->surface = surface;
+	wl_list_init(&ps->color_caches);
+	wl_list_insert(&pr->surface_state_list, &ps->link);
 
 	ps->surface_destroy_listener.notify =
 		surface_state_handle_surface_destroy;
@@ -878,13 +1749,44 @@ pixman_renderer_create_surface(struct weston_surface *surface)
 	return 0;
 }
 
+/* The color transformed copies of surfaces shown nowhere are as big as
+ * the surfaces themselves, and are rebuilt when the surface is shown. */
+static void
+pixman_renderer_idle_trim(struct weston_compositor *ec, void *data)
+{
+	struct pixman_renderer *pr = data;
+	struct pixman_surface_state *ps;
+
+	wl_list_for_each(ps, &pr->surface_state_list, link) {
+		if (ps->surface->output_mask == 0)
+			surface_state_drop_color_caches(ps);
+	}
+}
+
+static void
+pixman_dmabuf_unmap(struct pixman_dmabuf *pd)
+{
+	munmap(pd->map, pd->size);
+	free(pd);
+}
+
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
 	struct pixman_renderer *pr = get_renderer(ec);
+	struct pixman_dmabuf *pd, *tmp;
 
+	weston_idle_task_destroy(pr->idle_task);
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	weston_worker_pool_destroy(pr->worker_pool);
+	weston_drm_format_array_fini(&pr->supported_formats);
+	wl_list_for_each_safe(pd, tmp, &pr->dmabuf_maps, link) {
+		wl_list_remove(&pd->link);
+		pixman_dmabuf_unmap(pd);
+	}
+	wl_array_release(&pr->band_nodes);
+	wl_array_release(&pr->bands);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -992,17 +1894,159 @@ debug_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 	pr->repaint_debug ^= 1;
 
 	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
+		pr->debug_color =
+			pixman_image_create_solid_fill(&repaint_debug_red);
 	} else {
 		pixman_image_unref(pr->debug_color);
 		weston_compositor_damage_all(ec);
 	}
 }
 
+/* Keep the mapping in case a client wraps the same dmabuf in a new
+ * wl_buffer, and unmap the least recently used one when the cache is
+ * full. */
+static void
+pixman_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
+{
+	struct pixman_dmabuf *pd = linux_dmabuf_buffer_get_user_data(dmabuf);
+	struct pixman_renderer *pr;
+
+	linux_dmabuf_buffer_set_user_data(dmabuf, NULL, NULL);
+
+	/* The renderer is gone already on shutdown. */
+	if (!dmabuf->compositor->renderer) {
+		pixman_dmabuf_unmap(pd);
+		return;
+	}
+
+	pr = get_renderer(dmabuf->compositor);
+	wl_list_insert(&pr->dmabuf_maps, &pd->link);
+	if (++pr->dmabuf_map_count <= PIXMAN_DMABUF_MAP_CACHE_SIZE)
+		return;
+
+	pd = container_of(pr->dmabuf_maps.prev, struct pixman_dmabuf, link);
+	wl_list_remove(&pd->link);
+	pr->dmabuf_map_count--;
+	pixman_dmabuf_unmap(pd);
+}
+
+/* Map a whole dmabuf, or take its mapping from the cache */
+static struct pixman_dmabuf *
+pixman_dmabuf_map(struct weston_compositor *ec, int fd)
+{
+	struct pixman_renderer *pr = get_renderer(ec);
+	struct pixman_dmabuf *pd;
+	struct stat st;
+	off_t size;
+	void *map;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	wl_list_for_each(pd, &pr->dmabuf_maps, link) {
+		if (pd->dev != st.st_dev || pd->ino != st.st_ino)
+			continue;
+
+		wl_list_remove(&pd->link);
+		wl_list_init(&pd->link);
+		pr->dmabuf_map_count--;
+		weston_metric_inc(ec, WESTON_METRIC_PIXMAN_DMABUF_MAP_HITS);
+		return pd;
+	}
+
+	weston_metric_inc(ec, WESTON_METRIC_PIXMAN_DMABUF_MAP_MISSES);
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0)
+		return NULL;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	pd = xzalloc(sizeof *pd);
+	pd->map = map;
+	pd->size = size;
+	pd->dev = st.st_dev;
+	pd->ino = st.st_ino;
+	wl_list_init(&pd->link);
+
+	return pd;
+}
+
+/** Map a dmabuf for compositing with pixman
+ *
+ * Only linear single-plane buffers in formats pixman can read are accepted,
+ * everything else would need a detiling or color conversion pass. The
+ * mapping lives as long as the dmabuf does.
+ */
+static bool
+pixman_renderer_import_dmabuf(struct weston_compositor *ec,
+			      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct dmabuf_attributes *attributes = &dmabuf->attributes;
+	const struct pixel_format_info *info;
+	struct pixman_dmabuf *pd;
+
+	info = pixel_format_get_info(attributes->format);
+	if (!info || !pixman_format_supported_source(info->pixman_format))
+		return false;
+
+	if (attributes->n_planes != 1 ||
+	    attributes->modifier != DRM_FORMAT_MOD_LINEAR ||
+	    attributes->flags != 0)
+		return false;
+
+	pd = pixman_dmabuf_map(ec, attributes->fd[0]);
+	if (!pd)
+		return false;
+
+	if ((uint64_t) attributes->offset[0] +
+	    (uint64_t) attributes->stride[0] * attributes->height >
+	    (uint64_t) pd->size) {
+		pixman_dmabuf_unmap(pd);
+		return false;
+	}
+
+	linux_dmabuf_buffer_set_user_data(dmabuf, pd,
+					  pixman_renderer_destroy_dmabuf);
+
+	return true;
+}
+
+static const struct weston_drm_format_array *
+pixman_renderer_get_supported_formats(struct weston_compositor *ec)
+{
+	struct pixman_renderer *pr = get_renderer(ec);
+
+	return &pr->supported_formats;
+}
+
+static int
+populate_supported_formats(struct weston_drm_format_array *formats)
+{
+	const struct pixel_format_info *pixel_info;
+	struct weston_drm_format *fmt;
+	unsigned int i, num_formats;
+
+	num_formats = pixel_format_get_info_count();
+	for (i = 0; i < num_formats; i++) {
+		pixel_info = pixel_format_get_info_by_index(i);
+		if (pixel_info->hide_from_clients ||
+		    !pixman_format_supported_source(pixel_info->pixman_format))
+			continue;
+
+		fmt = weston_drm_format_array_add_format(formats,
+							 pixel_info->format);
+		if (!fmt ||
+		    weston_drm_format_add_modifier(fmt,
+						   DRM_FORMAT_MOD_LINEAR) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 static struct pixman_renderer_interface pixman_renderer_interface;
 
 WL_EXPORT int
@@ -1016,6 +2060,13 @@ pixman_renderer_init(struct weston_compositor *ec)
 	if (renderer == NULL)
 		return -1;
 
+	weston_drm_format_array_init(&renderer->supported_formats);
+	if (populate_supported_formats(&renderer->supported_formats) < 0) {
+		weston_drm_format_array_fini(&renderer->supported_formats);
+		free(renderer);
+		return -1;
+	}
+
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
@@ -1026,16 +2077,27 @@ pixman_renderer_init(struct weston_compositor *ec)
 	renderer->base.destroy = pixman_renderer_destroy;
 	renderer->base.surface_copy_content =
 		pixman_renderer_surface_copy_content;
+	renderer->base.import_dmabuf = pixman_renderer_import_dmabuf;
+	renderer->base.get_supported_formats =
+		pixman_renderer_get_supported_formats;
 	renderer->base.type = WESTON_RENDERER_PIXMAN;
 	renderer->base.pixman = &pixman_renderer_interface;
 	ec->renderer = &renderer->base;
 	ec->capabilities |= WESTON_CAP_ROTATION_ANY;
 	ec->capabilities |= WESTON_CAP_VIEW_CLIP_MASK;
+	ec->capabilities |= WESTON_CAP_COLOR_OPS;
 
 	renderer->debug_binding =
 		weston_compositor_add_debug_binding(ec, KEY_R,
 						    debug_binding, ec);
 
+	wl_list_init(&renderer->surface_state_list);
+	wl_list_init(&renderer->dmabuf_maps);
+	renderer->idle_task =
+		weston_compositor_add_idle_task(ec, "pixman-renderer trim",
+						pixman_renderer_idle_trim,
+						renderer);
+
 	info_argb8888 = pixel_format_get_info_shm(WL_SHM_FORMAT_ARGB8888);
 	info_xrgb8888 = pixel_format_get_info_shm(WL_SHM_FORMAT_XRGB8888);
 
@@ -1052,6 +2114,17 @@ pixman_renderer_init(struct weston_compositor *ec)
 		wl_display_add_shm_format(ec->wl_display, pixel_info->format);
 	}
 
+	if (ec->pixman_render_threads > 1) {
+		renderer->worker_pool =
+			weston_worker_pool_create(ec->pixman_render_threads - 1);
+		if (renderer->worker_pool)
+			weston_log("Pixman renderer: compositing on %u threads\n",
+				   weston_worker_pool_get_thread_count(renderer->worker_pool));
+		else
+			weston_log("Pixman renderer: failed to start worker "
+				   "threads, compositing on one thread\n");
+	}
+
 	wl_signal_init(&renderer->destroy_signal);
 
 	return 0;
@@ -1177,7 +2250,11 @@ pixman_renderer_create_image_from_ptr(struct weston_output *output,
 		return NULL;
 	}
 
+	/* The content of a new buffer is undefined, so it is entirely
+	 * damaged, and from then on accumulates the damage of all frames
+	 * painted into other renderbuffers until it is painted again. */
 	pixman_region32_init(&renderbuffer->base.damage);
+	pixman_region32_copy(&renderbuffer->base.damage, &output->region);
 	renderbuffer->base.refcount = 2;
 	renderbuffer->base.destroy = pixman_renderer_renderbuffer_destroy;
 	wl_list_insert(&po->renderbuffer_list, &renderbuffer->link);
@@ -1206,6 +2283,7 @@ pixman_renderer_create_image(struct weston_output *output,
 	}
 
 	pixman_region32_init(&renderbuffer->base.damage);
+	pixman_region32_copy(&renderbuffer->base.damage, &output->region);
 	renderbuffer->base.refcount = 2;
 	renderbuffer->base.destroy = pixman_renderer_renderbuffer_destroy;
 	wl_list_insert(&po->renderbuffer_list, &renderbuffer->link);
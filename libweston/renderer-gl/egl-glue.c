@@ -273,6 +273,16 @@ egl_config_pixel_format_matches(struct gl_renderer *gr,
 			return false;
 	}
 
+	if (gr->has_pixel_format_float) {
+		bool is_float = pinfo->component_type == PIXEL_COMPONENT_TYPE_FLOAT;
+
+		if (!eglGetConfigAttrib(gr->egl_display, config,
+					EGL_COLOR_COMPONENT_TYPE_EXT, &value))
+			return false;
+		if ((value == EGL_COLOR_COMPONENT_TYPE_FLOAT_EXT) != is_float)
+			return false;
+	}
+
 	return true;
 }
 
@@ -404,12 +414,32 @@ gl_renderer_get_egl_config(struct gl_renderer *gr,
 		EGL_GREEN_SIZE,      1,
 		EGL_BLUE_SIZE,       1,
 		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE,            EGL_NONE,
 		EGL_NONE
 	};
 
 	for (i = 0; i < formats_count; i++)
 		assert(formats[i]);
 
+	/* eglChooseConfig() only returns fixed-point configs by default.
+	 * Asking for any component type lets the format matching below pick
+	 * a floating-point one for FP16 formats, and a fixed-point one for
+	 * the fallbacks. */
+	for (i = 0; i < formats_count; i++) {
+		if (formats[i]->component_type != PIXEL_COMPONENT_TYPE_FLOAT)
+			continue;
+
+		if (!gr->has_pixel_format_float) {
+			weston_log("%s needs EGL_EXT_pixel_format_float.\n",
+				   formats[i]->drm_format_name);
+			continue;
+		}
+
+		config_attribs[10] = EGL_COLOR_COMPONENT_TYPE_EXT;
+		config_attribs[11] = EGL_DONT_CARE;
+		break;
+	}
+
 	if (egl_config_is_compatible(gr, gr->egl_config, egl_surface_type,
 				     formats, formats_count))
 		return gr->egl_config;
@@ -653,6 +683,9 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 
 	if (weston_check_egl_extension(extensions, "EGL_IMG_context_priority"))
 		gr->has_context_priority = true;
+	if (weston_check_egl_extension(extensions,
+				       "EGL_NV_context_priority_realtime"))
+		gr->has_context_priority_realtime = true;
 
 	if (weston_check_egl_extension(extensions, "EGL_WL_bind_wayland_display"))
 		gr->has_bind_display = true;
@@ -691,6 +724,9 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 	if (weston_check_egl_extension(extensions, "EGL_KHR_surfaceless_context"))
 		gr->has_surfaceless_context = true;
 
+	if (weston_check_egl_extension(extensions, "EGL_EXT_pixel_format_float"))
+		gr->has_pixel_format_float = true;
+
 	if (weston_check_egl_extension(extensions, "EGL_EXT_image_dma_buf_import"))
 		gr->has_dmabuf_import = true;
 
@@ -737,6 +773,8 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 			    yesno(gr->has_bind_display));
 	weston_log_continue(STAMP_SPACE "context priority: %s\n",
 			    yesno(gr->has_context_priority));
+	weston_log_continue(STAMP_SPACE "realtime context priority: %s\n",
+			    yesno(gr->has_context_priority_realtime));
 	weston_log_continue(STAMP_SPACE "buffer age: %s\n",
 			    yesno(gr->has_egl_buffer_age));
 	weston_log_continue(STAMP_SPACE "partial update: %s\n",
@@ -89,6 +89,8 @@ compile_const int c_color_channel_order = DEF_COLOR_CHANNEL_ORDER;
 compile_const bool c_input_is_premult = DEF_INPUT_IS_PREMULT;
 compile_const bool c_tint = DEF_TINT;
 compile_const bool c_wireframe = DEF_WIREFRAME;
+compile_const bool c_color_pre_curve_clamped = DEF_COLOR_PRE_CURVE_CLAMPED;
+compile_const bool c_color_post_curve_clamped = DEF_COLOR_POST_CURVE_CLAMPED;
 compile_const bool c_need_color_pipeline =
 	c_color_pre_curve != SHADER_COLOR_CURVE_IDENTITY ||
 	c_color_mapping != SHADER_COLOR_MAPPING_IDENTITY ||
@@ -145,12 +147,10 @@ uniform vec4 tint;
 uniform HIGHPRECISION sampler2D color_pre_curve_lut_2d;
 uniform HIGHPRECISION vec2 color_pre_curve_lut_scale_offset;
 uniform HIGHPRECISION float color_pre_curve_params[MAX_CURVESET_PARAMS];
-uniform bool color_pre_curve_clamped_input;
 
 uniform HIGHPRECISION sampler2D color_post_curve_lut_2d;
 uniform HIGHPRECISION vec2 color_post_curve_lut_scale_offset;
 uniform HIGHPRECISION float color_post_curve_params[MAX_CURVESET_PARAMS];
-uniform bool color_post_curve_clamped_input;
 
 #if DEF_COLOR_MAPPING == SHADER_COLOR_MAPPING_3DLUT
 uniform HIGHPRECISION sampler3D color_mapping_lut_3d;
@@ -263,7 +263,8 @@ linpow(float x, float g, float a, float b, float c, float d)
 }
 
 float
-sample_linpow(float params[MAX_CURVESET_PARAMS], bool must_clamp,
+sample_linpow(float params[MAX_CURVESET_PARAMS],
+	      compile_const bool must_clamp,
 	      float x, compile_const int color_channel)
 {
 	float g, a, b, c, d;
@@ -289,7 +290,8 @@ sample_linpow(float params[MAX_CURVESET_PARAMS], bool must_clamp,
 }
 
 vec3
-sample_linpow_vec3(float params[MAX_CURVESET_PARAMS], bool must_clamp,
+sample_linpow_vec3(float params[MAX_CURVESET_PARAMS],
+		   compile_const bool must_clamp,
 		   vec3 color)
 {
 	return vec3(sample_linpow(params, must_clamp, color.r, 0),
@@ -309,7 +311,8 @@ powlin(float x, float g, float a, float b, float c, float d)
 }
 
 float
-sample_powlin(float params[MAX_CURVESET_PARAMS], bool must_clamp,
+sample_powlin(float params[MAX_CURVESET_PARAMS],
+	      compile_const bool must_clamp,
 	      float x, compile_const int color_channel)
 {
 	float g, a, b, c, d;
@@ -335,7 +338,8 @@ sample_powlin(float params[MAX_CURVESET_PARAMS], bool must_clamp,
 }
 
 vec3
-sample_powlin_vec3(float params[MAX_CURVESET_PARAMS], bool must_clamp,
+sample_powlin_vec3(float params[MAX_CURVESET_PARAMS],
+		   compile_const bool must_clamp,
 		   vec3 color)
 {
 	return vec3(sample_powlin(params, must_clamp, color.r, 0),
@@ -354,11 +358,11 @@ color_pre_curve(vec3 color)
 				       color);
 	} else if (c_color_pre_curve == SHADER_COLOR_CURVE_LINPOW) {
 		return sample_linpow_vec3(color_pre_curve_params,
-					  color_pre_curve_clamped_input,
+					  c_color_pre_curve_clamped,
 					  color);
 	} else if (c_color_pre_curve == SHADER_COLOR_CURVE_POWLIN) {
 		return sample_powlin_vec3(color_pre_curve_params,
-					  color_pre_curve_clamped_input,
+					  c_color_pre_curve_clamped,
 					  color);
 	} else {
 		/* Never reached, bad c_color_pre_curve. */
@@ -401,11 +405,11 @@ color_post_curve(vec3 color)
 				       color);
 	} else if (c_color_post_curve == SHADER_COLOR_CURVE_LINPOW) {
 		return sample_linpow_vec3(color_post_curve_params,
-					  color_post_curve_clamped_input,
+					  c_color_post_curve_clamped,
 					  color);
 	} else if (c_color_post_curve == SHADER_COLOR_CURVE_POWLIN) {
 		return sample_powlin_vec3(color_post_curve_params,
-					  color_post_curve_clamped_input,
+					  c_color_post_curve_clamped,
 					  color);
 	} else {
 		/* Never reached, bad c_color_post_curve. */
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <libweston/libweston.h>
+
+#include "gl-renderer.h"
+#include "gl-renderer-internal.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+
+/*
+ * Texture atlas for small wl_shm buffers.
+ *
+ * Each page is a GL_BGRA_EXT texture of GL_ATLAS_PAGE_SIZE texels square,
+ * cut into square cells of a single size. A buffer gets a cell of the
+ * smallest size it fits in, with a one texel gutter all around that
+ * repeats its edges, so that bilinear sampling never reads a neighbour.
+ * Pages are created on demand and deleted once their last cell is freed.
+ */
+
+#define GL_ATLAS_PAGE_SIZE 1024
+#define GL_ATLAS_GUTTER 1
+
+static const int cell_sizes[] = { 32, 64, 128 };
+
+#define GL_ATLAS_MAX_CELLS \
+	((GL_ATLAS_PAGE_SIZE / 32) * (GL_ATLAS_PAGE_SIZE / 32))
+
+struct gl_atlas_page {
+	struct wl_list link; /* gl_atlas::pages */
+	GLuint tex;
+	int cell_size;
+	int n_cells;
+	int n_used;
+	uint64_t used[GL_ATLAS_MAX_CELLS / 64];
+};
+
+struct gl_atlas {
+	struct wl_list pages;
+};
+
+struct gl_atlas *
+gl_atlas_create(void)
+{
+	struct gl_atlas *atlas;
+
+	atlas = xzalloc(sizeof *atlas);
+	wl_list_init(&atlas->pages);
+
+	return atlas;
+}
+
+static void
+gl_atlas_page_destroy(struct gl_atlas_page *page)
+{
+	glDeleteTextures(1, &page->tex);
+	wl_list_remove(&page->link);
+	free(page);
+}
+
+void
+gl_atlas_destroy(struct gl_atlas *atlas)
+{
+	struct gl_atlas_page *page, *tmp;
+
+	if (!atlas)
+		return;
+
+	/* Buffer states give their cells back before the renderer goes. */
+	wl_list_for_each_safe(page, tmp, &atlas->pages, link) {
+		assert(page->n_used == 0);
+		gl_atlas_page_destroy(page);
+	}
+
+	free(atlas);
+}
+
+static struct gl_atlas_page *
+gl_atlas_page_create(struct gl_atlas *atlas, int cell_size)
+{
+	struct gl_atlas_page *page;
+	int cells_per_row = GL_ATLAS_PAGE_SIZE / cell_size;
+
+	page = xzalloc(sizeof *page);
+	page->cell_size = cell_size;
+	page->n_cells = cells_per_row * cells_per_row;
+
+	glGenTextures(1, &page->tex);
+	glBindTexture(GL_TEXTURE_2D, page->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+		     GL_ATLAS_PAGE_SIZE, GL_ATLAS_PAGE_SIZE, 0,
+		     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	wl_list_insert(&atlas->pages, &page->link);
+
+	return page;
+}
+
+static int
+gl_atlas_page_find_cell(struct gl_atlas_page *page)
+{
+	int i;
+
+	if (page->n_used == page->n_cells)
+		return -1;
+
+	/* Pages hold a multiple of 64 cells. */
+	for (i = 0; i < page->n_cells / 64; i++) {
+		uint64_t free_cells = ~page->used[i];
+
+		if (free_cells)
+			return i * 64 + __builtin_ctzll(free_cells);
+	}
+
+	return -1;
+}
+
+/** Reserve room for a buffer of the given size in the atlas
+ *
+ * \return false if the buffer is too large for the atlas.
+ */
+bool
+gl_atlas_alloc(struct gl_atlas *atlas, int width, int height,
+	       struct gl_atlas_slot *slot)
+{
+	struct gl_atlas_page *page;
+	int size = MAX(width, height) + 2 * GL_ATLAS_GUTTER;
+	int cell_size = 0;
+	int cells_per_row;
+	int cell = -1;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(cell_sizes); i++) {
+		if (size <= cell_sizes[i]) {
+			cell_size = cell_sizes[i];
+			break;
+		}
+	}
+	if (cell_size == 0)
+		return false;
+
+	wl_list_for_each(page, &atlas->pages, link) {
+		if (page->cell_size != cell_size)
+			continue;
+
+		cell = gl_atlas_page_find_cell(page);
+		if (cell >= 0)
+			break;
+	}
+
+	if (cell < 0) {
+		page = gl_atlas_page_create(atlas, cell_size);
+		cell = 0;
+	}
+
+	page->used[cell / 64] |= UINT64_C(1) << (cell % 64);
+	page->n_used++;
+
+	cells_per_row = GL_ATLAS_PAGE_SIZE / cell_size;
+	slot->page = page;
+	slot->cell = cell;
+	slot->tex = page->tex;
+	slot->x = (cell % cells_per_row) * cell_size + GL_ATLAS_GUTTER;
+	slot->y = (cell / cells_per_row) * cell_size + GL_ATLAS_GUTTER;
+	slot->width = width;
+	slot->height = height;
+
+	return true;
+}
+
+void
+gl_atlas_free(struct gl_atlas_slot *slot)
+{
+	struct gl_atlas_page *page = slot->page;
+
+	assert(page->used[slot->cell / 64] & (UINT64_C(1) << (slot->cell % 64)));
+	page->used[slot->cell / 64] &= ~(UINT64_C(1) << (slot->cell % 64));
+
+	if (--page->n_used == 0)
+		gl_atlas_page_destroy(page);
+
+	slot->page = NULL;
+	slot->tex = 0;
+}
+
+/** Map surface to buffer texture coordinates onto the atlas page
+ *
+ * \param matrix Maps to buffer texels, gets to map to normalized
+ * coordinates of the page.
+ */
+void
+gl_atlas_slot_transform(const struct gl_atlas_slot *slot,
+			struct weston_matrix *matrix)
+{
+	weston_matrix_translate(matrix, slot->x, slot->y, 0);
+	weston_matrix_scale(matrix, 1.0f / GL_ATLAS_PAGE_SIZE,
+			    1.0f / GL_ATLAS_PAGE_SIZE, 1);
+}
+
+static void
+upload_texels(int x, int y, int width, int height, const uint8_t *src)
+{
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height,
+			GL_BGRA_EXT, GL_UNSIGNED_BYTE, src);
+}
+
+/** Upload a part of a 32 bpp buffer into its slot
+ *
+ * \param data Buffer pixels.
+ * \param pitch Buffer pitch in pixels.
+ * \param box Part to upload, in buffer coordinates.
+ *
+ * Edges of the buffer are also copied into the gutter. Leaves
+ * GL_UNPACK_ROW_LENGTH_EXT set to the pitch.
+ */
+void
+gl_atlas_upload(const struct gl_atlas_slot *slot, const void *data,
+		int pitch, pixman_box32_t box)
+{
+	const uint8_t *pixels = data;
+	int x = slot->x, y = slot->y;
+	int w = slot->width, h = slot->height;
+	int bw, bh;
+
+#define TEXEL(tx, ty) (pixels + ((ty) * pitch + (tx)) * 4)
+
+	box.x1 = MAX(box.x1, 0);
+	box.y1 = MAX(box.y1, 0);
+	box.x2 = MIN(box.x2, w);
+	box.y2 = MIN(box.y2, h);
+	bw = box.x2 - box.x1;
+	bh = box.y2 - box.y1;
+	if (bw <= 0 || bh <= 0)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, slot->tex);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+
+	upload_texels(x + box.x1, y + box.y1, bw, bh, TEXEL(box.x1, box.y1));
+
+	if (box.x1 == 0)
+		upload_texels(x - 1, y + box.y1, 1, bh, TEXEL(0, box.y1));
+	if (box.x2 == w)
+		upload_texels(x + w, y + box.y1, 1, bh, TEXEL(w - 1, box.y1));
+	if (box.y1 == 0)
+		upload_texels(x + box.x1, y - 1, bw, 1, TEXEL(box.x1, 0));
+	if (box.y2 == h)
+		upload_texels(x + box.x1, y + h, bw, 1, TEXEL(box.x1, h - 1));
+
+	if (box.x1 == 0 && box.y1 == 0)
+		upload_texels(x - 1, y - 1, 1, 1, TEXEL(0, 0));
+	if (box.x2 == w && box.y1 == 0)
+		upload_texels(x + w, y - 1, 1, 1, TEXEL(w - 1, 0));
+	if (box.x1 == 0 && box.y2 == h)
+		upload_texels(x - 1, y + h, 1, 1, TEXEL(0, h - 1));
+	if (box.x2 == w && box.y2 == h)
+		upload_texels(x + w, y + h, 1, 1, TEXEL(w - 1, h - 1));
+
+#undef TEXEL
+}
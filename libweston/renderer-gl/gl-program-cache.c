@@ -0,0 +1,410 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libweston/libweston.h>
+#include <EGL/egl.h>
+
+#include "gl-renderer.h"
+#include "gl-renderer-internal.h"
+#include "shared/helpers.h"
+#include "shared/string-helpers.h"
+#include "shared/xalloc.h"
+
+/*
+ * On-disk cache of linked GL programs, using GL_OES_get_program_binary.
+ *
+ * Each program is stored in its own file, named after a hash of the
+ * identity and the program key. The identity is itself a hash of the
+ * driver strings and the shader sources. Identity and key are stored in
+ * the file as well and compared on load, so that file name collisions and
+ * driver updates only ever cause a cache miss. Drivers may
+ * also reject a binary they produced themselves, which again is just a
+ * miss and the stale file gets removed.
+ */
+
+#define PROGRAM_CACHE_MAGIC "WSTNPRG1"
+
+struct gl_program_cache_header {
+	char magic[8];
+	uint32_t binary_format;
+	uint32_t binary_length;
+	uint32_t key_length;
+};
+
+struct gl_program_cache {
+	char *dir;
+	char *identity;
+
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+};
+
+static uint64_t
+fnv1a_hash(uint64_t hash, const char *str)
+{
+	for (; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static int
+mkdir_recursive(char *path, mode_t mode)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(path, mode) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	if (mkdir(path, mode) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static char *
+program_cache_get_dir(void)
+{
+	const char *base;
+	char *dir = NULL;
+
+	base = getenv("XDG_CACHE_HOME");
+	if (base && base[0] == '/') {
+		str_printf(&dir, "%s/weston/gl-programs", base);
+		return dir;
+	}
+
+	base = getenv("HOME");
+	if (base && base[0] == '/')
+		str_printf(&dir, "%s/.cache/weston/gl-programs", base);
+
+	return dir;
+}
+
+/** Create the program binary cache
+ *
+ * \param identity An array of strings that changes whenever previously
+ * stored binaries must not be used anymore, e.g. on driver or shader source
+ * updates.
+ * \param count The number of strings in identity.
+ * \return The cache, or NULL if the cache cannot be used.
+ */
+struct gl_program_cache *
+gl_program_cache_create(const char *const *identity, unsigned count)
+{
+	struct gl_program_cache *cache;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	GLint num_formats = 0;
+	unsigned i;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+	if (num_formats < 1) {
+		weston_log("GL program cache: no program binary formats "
+			   "supported by the driver.\n");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		hash = fnv1a_hash(hash, identity[i]);
+		hash = fnv1a_hash(hash, "\n");
+	}
+
+	cache = xzalloc(sizeof *cache);
+	str_printf(&cache->identity, "%016" PRIx64, hash);
+	if (!cache->identity)
+		goto fail;
+
+	cache->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	cache->program_binary =
+		(void *) eglGetProcAddress("glProgramBinaryOES");
+	if (!cache->get_program_binary || !cache->program_binary)
+		goto fail;
+
+	cache->dir = program_cache_get_dir();
+	if (!cache->dir) {
+		weston_log("GL program cache: neither XDG_CACHE_HOME nor "
+			   "HOME is set.\n");
+		goto fail;
+	}
+
+	if (mkdir_recursive(cache->dir, 0700) < 0) {
+		weston_log("GL program cache: cannot create '%s': %s\n",
+			   cache->dir, strerror(errno));
+		goto fail;
+	}
+
+	weston_log("GL program cache: using '%s'.\n", cache->dir);
+
+	return cache;
+
+fail:
+	gl_program_cache_destroy(cache);
+	return NULL;
+}
+
+void
+gl_program_cache_destroy(struct gl_program_cache *cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->dir);
+	free(cache->identity);
+	free(cache);
+}
+
+static char *
+program_cache_get_path(struct gl_program_cache *cache, const char *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	char *path = NULL;
+
+	hash = fnv1a_hash(hash, cache->identity);
+	hash = fnv1a_hash(hash, "\n");
+	hash = fnv1a_hash(hash, key);
+
+	str_printf(&path, "%s/%016" PRIx64 ".bin", cache->dir, hash);
+
+	return path;
+}
+
+static char *
+program_cache_get_full_key(struct gl_program_cache *cache, const char *key)
+{
+	char *full_key = NULL;
+
+	str_printf(&full_key, "%s\n%s", cache->identity, key);
+
+	return full_key;
+}
+
+static bool
+read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = read(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		p += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static bool
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		p += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+/** Look up a linked program from the cache
+ *
+ * \param cache The program cache.
+ * \param key A string uniquely identifying the program.
+ * \return A linked GL program, or GL_NONE on cache miss.
+ */
+GLuint
+gl_program_cache_load(struct gl_program_cache *cache, const char *key)
+{
+	struct gl_program_cache_header header;
+	char *path = NULL;
+	char *full_key = NULL;
+	char *stored_key = NULL;
+	void *binary = NULL;
+	GLuint program = GL_NONE;
+	GLint status;
+	struct stat st;
+	bool stale = false;
+	int fd = -1;
+
+	path = program_cache_get_path(cache, key);
+	full_key = program_cache_get_full_key(cache, key);
+	if (!path || !full_key)
+		goto out;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+
+	stale = true;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(header) ||
+	    !read_all(fd, &header, sizeof(header)) ||
+	    memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.key_length != strlen(full_key) ||
+	    st.st_size != (off_t)(sizeof(header) + header.key_length +
+				  header.binary_length))
+		goto out;
+
+	stored_key = xzalloc(header.key_length + 1);
+	if (!read_all(fd, stored_key, header.key_length))
+		goto out;
+
+	/* A hash collision, leave the other program alone. */
+	if (strcmp(stored_key, full_key) != 0) {
+		stale = false;
+		goto out;
+	}
+
+	binary = xmalloc(header.binary_length);
+	if (!read_all(fd, binary, header.binary_length))
+		goto out;
+
+	program = glCreateProgram();
+	cache->program_binary(program, header.binary_format,
+			      binary, header.binary_length);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		program = GL_NONE;
+		goto out;
+	}
+
+	stale = false;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	if (stale)
+		unlink(path);
+	free(binary);
+	free(stored_key);
+	free(full_key);
+	free(path);
+
+	return program;
+}
+
+/** Store a linked program in the cache
+ *
+ * \param cache The program cache.
+ * \param key A string uniquely identifying the program.
+ * \param program A successfully linked GL program.
+ *
+ * Failures are not fatal, the program is simply not cached.
+ */
+void
+gl_program_cache_store(struct gl_program_cache *cache, const char *key,
+		       GLuint program)
+{
+	struct gl_program_cache_header header = { 0 };
+	char *path = NULL;
+	char *tmp_path = NULL;
+	char *full_key = NULL;
+	void *binary = NULL;
+	GLint length = 0;
+	GLsizei written = 0;
+	GLenum format;
+	bool ok;
+	int fd;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	path = program_cache_get_path(cache, key);
+	full_key = program_cache_get_full_key(cache, key);
+	if (!path || !full_key)
+		goto out;
+
+	binary = xmalloc(length);
+	cache->get_program_binary(program, length, &written, &format, binary);
+	if (written <= 0)
+		goto out;
+
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.binary_format = format;
+	header.binary_length = written;
+	header.key_length = strlen(full_key);
+
+	/* Write into a temporary file first, so that concurrent compositor
+	 * instances never see a partially written program. */
+	str_printf(&tmp_path, "%s.XXXXXX", path);
+	if (!tmp_path)
+		goto out;
+
+	fd = mkostemp(tmp_path, O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+
+	ok = write_all(fd, &header, sizeof(header)) &&
+	     write_all(fd, full_key, header.key_length) &&
+	     write_all(fd, binary, header.binary_length);
+	close(fd);
+
+	if (!ok || rename(tmp_path, path) < 0) {
+		weston_log("GL program cache: failed to write '%s'.\n", path);
+		unlink(tmp_path);
+	}
+
+out:
+	free(tmp_path);
+	free(binary);
+	free(full_key);
+	free(path);
+}
@@ -130,11 +130,19 @@ struct gl_shader_requirements
 	unsigned color_post_curve:2; /* enum gl_shader_color_curve */
 	unsigned color_channel_order:2; /* enum gl_channel_order */
 
+	/*
+	 * Whether the parametric curves clamp their input. These are
+	 * per-transform constants, but folding them into the program lets
+	 * the compiler drop the clamp or the mirroring branch entirely.
+	 */
+	bool color_pre_curve_clamped:1;
+	bool color_post_curve_clamped:1;
+
 	/*
 	 * The total size of all bitfields plus pad_bits_ must fill up exactly
 	 * how many bytes the compiler allocates for them together.
 	 */
-	unsigned pad_bits_:16;
+	unsigned pad_bits_:14;
 };
 static_assert(sizeof(struct gl_shader_requirements) ==
 	      4 /* total bitfield size in bytes */,
@@ -163,7 +171,6 @@ struct gl_shader_config {
 		} lut_3x1d;
 		struct {
 			GLfloat params[3][10];
-			GLboolean clamped_input;
 		} parametric;
 	} color_pre_curve;
 
@@ -182,7 +189,6 @@ struct gl_shader_config {
 		} lut_3x1d;
 		struct {
 			GLfloat params[3][10];
-			GLboolean clamped_input;
 		} parametric;
 	} color_post_curve;
 };
@@ -195,6 +201,9 @@ struct gl_renderer {
 	/* Debug modes. */
 	struct weston_binding *debug_mode_binding;
 	int debug_mode;
+
+	/* Frees caches once the compositor has been idle for a while */
+	struct weston_idle_task *idle_task;
 	bool debug_clear;
 	bool wireframe_dirty;
 	GLuint wireframe_tex;
@@ -213,6 +222,30 @@ struct gl_renderer {
 	struct wl_array barycentric_stream;
 	struct wl_array indices;
 
+	/* Scratch space of compress_bands(), transform_damage() and
+	 * pixman_region_to_egl(), see scratch-array.h */
+	struct wl_array band_rects;
+	struct wl_array band_open;
+	struct wl_array damage_quads;
+	struct wl_array egl_rects;
+
+	/* Ring buffers the vertex streams are uploaded to for drawing */
+	GLuint stream_vbo;
+	GLuint stream_ibo;
+	size_t stream_vbo_offset;
+	size_t stream_ibo_offset;
+
+	/* Meshes waiting in the vertex streams for one draw call, as long as
+	 * the following ones use the same shader config and blending */
+	struct {
+		struct weston_paint_node *pnode;
+		struct gl_shader_config sconf;
+		bool opaque;
+		bool blend;
+		int nvtx;
+		int nidx;
+	} batch;
+
 	EGLDeviceEXT egl_device;
 	const char *drm_device;
 
@@ -235,6 +268,7 @@ struct gl_renderer {
 	bool has_bind_display;
 
 	bool has_context_priority;
+	bool has_context_priority_realtime;
 
 	bool has_egl_image_external;
 
@@ -246,22 +280,37 @@ struct gl_renderer {
 
 	bool has_surfaceless_context;
 
+	/* Floating-point EGLConfigs, for FP16 outputs */
+	bool has_pixel_format_float;
+
 	bool has_dmabuf_import;
-	struct wl_list dmabuf_images;
+	struct wl_list dmabuf_images; /* dmabuf_image::link, newest first */
+	int dmabuf_image_count;
 	struct wl_list dmabuf_formats;
 
 	bool has_texture_type_2_10_10_10_rev;
 	bool has_gl_texture_rg;
 	bool has_texture_norm16;
 	bool has_texture_storage;
+	PFNGLTEXSTORAGE2DEXTPROC tex_storage_2d;
 	bool has_pack_reverse;
 	bool has_rgb8_rgba8;
+	bool has_program_binary;
+	bool has_parallel_shader_compile;
 
 	bool has_pbo;
 	GLenum pbo_usage;
 	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
 	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
 
+	/* Staging buffer for wl_shm texture uploads */
+	bool has_pbo_upload;
+	GLuint upload_pbo;
+	size_t upload_pbo_size;
+
+	/* Shared textures for small wl_shm buffers, or NULL */
+	struct gl_atlas *shm_atlas;
+
 	struct wl_list pending_capture_list;
 
 	struct gl_shader *current_shader;
@@ -290,18 +339,29 @@ struct gl_renderer {
 	PFNGLDELETEQUERIESEXTPROC delete_queries;
 	PFNGLBEGINQUERYEXTPROC begin_query;
 	PFNGLENDQUERYEXTPROC end_query;
-#if !defined(NDEBUG)
 	PFNGLGETQUERYOBJECTIVEXTPROC get_query_object_iv;
-#endif
 	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_object_ui64v;
 
+	/* Timestamp counters place GPU timings on the timeline */
+	bool has_timestamp_query;
+	PFNGLQUERYCOUNTEREXTPROC query_counter;
+	PFNGLGETINTEGER64VEXTPROC get_integer64v;
+
 	bool gl_supports_color_transforms;
+	/** LUT textures shared by color transformations, gl_color_lut::link */
+	struct wl_list color_lut_list;
 
 	/** Shader program cache in most recently used order
 	 *
 	 * Uses struct gl_shader::link.
 	 */
 	struct wl_list shader_list;
+	/** Shader program cache indexed by packed gl_shader_requirements */
+	struct hash_table *shader_table;
+	/** On-disk program binary cache, NULL if disabled */
+	struct gl_program_cache *program_cache;
+	uint64_t shader_cache_hits;
+	uint64_t shader_cache_misses;
 	struct weston_log_scope *shader_scope;
 
 	struct dmabuf_allocator *allocator;
@@ -356,6 +416,13 @@ gl_renderer_create_fallback_shader(struct gl_renderer *gr);
 void
 gl_renderer_garbage_collect_programs(struct gl_renderer *gr);
 
+void
+gl_renderer_trim_programs(struct gl_renderer *gr);
+
+bool
+gl_renderer_program_pending(struct gl_renderer *gr,
+			    const struct gl_shader_requirements *requirements);
+
 bool
 gl_renderer_use_program(struct gl_renderer *gr,
 			const struct gl_shader_config *sconf);
@@ -363,9 +430,61 @@ gl_renderer_use_program(struct gl_renderer *gr,
 struct weston_log_scope *
 gl_shader_scope_create(struct gl_renderer *gr);
 
+void
+gl_renderer_program_cache_init(struct gl_renderer *gr);
+
+void
+gl_renderer_prewarm_programs(struct gl_renderer *gr);
+
+struct gl_program_cache *
+gl_program_cache_create(const char *const *identity, unsigned count);
+
+void
+gl_program_cache_destroy(struct gl_program_cache *cache);
+
+GLuint
+gl_program_cache_load(struct gl_program_cache *cache, const char *key);
+
+void
+gl_program_cache_store(struct gl_program_cache *cache, const char *key,
+		       GLuint program);
+
+/* Where a buffer lives in a texture of the atlas */
+struct gl_atlas_slot {
+	struct gl_atlas_page *page;
+	int cell;
+	GLuint tex;
+	int x, y; /* of the buffer origin, in texels of tex */
+	int width, height;
+};
+
+struct gl_atlas *
+gl_atlas_create(void);
+
+void
+gl_atlas_destroy(struct gl_atlas *atlas);
+
+bool
+gl_atlas_alloc(struct gl_atlas *atlas, int width, int height,
+	       struct gl_atlas_slot *slot);
+
+void
+gl_atlas_free(struct gl_atlas_slot *slot);
+
+void
+gl_atlas_slot_transform(const struct gl_atlas_slot *slot,
+			struct weston_matrix *matrix);
+
+void
+gl_atlas_upload(const struct gl_atlas_slot *slot, const void *data,
+		int pitch, pixman_box32_t box);
+
 bool
 gl_shader_config_set_color_transform(struct gl_renderer *gr,
 				     struct gl_shader_config *sconf,
 				     struct weston_color_transform *xform);
 
+void
+gl_color_lut_list_release(struct gl_renderer *gr);
+
 #endif /* GL_RENDERER_INTERNAL_H */
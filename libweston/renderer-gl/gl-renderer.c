@@ -42,23 +42,27 @@
 #include <assert.h>
 #include <linux/input.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <gbm.h>
 
-#include "linux-sync-file.h"
 #include "timeline.h"
 
 #include "color.h"
+#include "frame-stats.h"
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
 #include "vertex-clipping.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
+#include "metrics.h"
 #include "output-capture.h"
 #include "pixel-formats.h"
+#include "scratch-array.h"
 
 #include "shared/fd-util.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/platform.h"
 #include "shared/string-helpers.h"
@@ -111,6 +115,14 @@ struct gl_renderbuffer {
 	int age;
 };
 
+/* Repaints whose GPU timings can be in flight at once, per output */
+#define GL_RENDER_QUERY_RING 8
+
+struct gl_render_query {
+	GLuint elapsed;
+	GLuint timestamp; /* end of the repaint, if has_timestamp_query */
+};
+
 struct gl_output_state {
 	struct weston_size fb_size; /**< in pixels, including borders */
 	struct weston_geometry area; /**< composited area in pixels inside fb */
@@ -124,13 +136,25 @@ struct gl_output_state {
 	struct weston_matrix output_matrix;
 
 	EGLSyncKHR render_sync;
-	GLuint render_query;
 
-	/* struct timeline_render_point::link */
-	struct wl_list timeline_render_point_list;
+	/* Ring of GPU timer queries, issued by timeline_end_render_query()
+	 * and read back by timeline_resolve_render_queries() once the GPU
+	 * is done with them. Entries in [tail, head) are in flight. */
+	struct gl_render_query render_queries[GL_RENDER_QUERY_RING];
+	uint32_t render_query_head;
+	uint32_t render_query_tail;
+	bool render_query_active;
+
+	/* Repaints the output once the programs that were still linking
+	 * in the background during the last repaint are ready. */
+	struct wl_event_source *program_retry_source;
 
 	const struct pixel_format_info *shadow_format;
 	struct gl_fbo_texture shadow;
+	/* Set while a repaint bypasses the shadow, see can_bypass_shadow() */
+	bool shadow_bypass;
+	/* Global region the shadow missed while it was bypassed */
+	pixman_region32_t shadow_stale;
 
 	/* struct gl_renderbuffer::link */
 	struct wl_list renderbuffer_list;
@@ -138,14 +162,21 @@ struct gl_output_state {
 
 struct gl_renderer;
 
+struct gl_capture_rect {
+	pixman_box32_t box; /* in destination buffer coordinates */
+	size_t offset; /* into the PBO */
+};
+
+/* One read back, shared by all the capture tasks it completes */
 struct gl_capture_task {
-	struct weston_capture_task *task;
+	struct wl_array tasks; /* struct weston_capture_task * */
 	struct wl_event_source *source;
 	struct gl_renderer *gr;
 	struct wl_list link;
 	GLuint pbo;
-	int stride;
-	int height;
+	struct gl_capture_rect *rects;
+	int n_rects;
+	size_t size;
 	bool reverse;
 	EGLSyncKHR sync;
 	int fd;
@@ -179,6 +210,38 @@ struct dmabuf_format {
 	int num_modifiers;
 };
 
+/* Identifies the memory a dma-buf buffer is made of. A dma-buf has a
+ * unique inode for as long as it exists, and an EGLImage keeps its
+ * dma-buf alive, so the inode cannot be reused while an image is cached.
+ */
+struct dmabuf_image_key {
+	uint32_t format;
+	uint32_t flags;
+	int32_t width;
+	int32_t height;
+	uint64_t modifier;
+	int n_planes;
+	struct {
+		dev_t dev;
+		ino_t ino;
+		uint32_t offset;
+		uint32_t stride;
+	} plane[MAX_DMABUF_PLANES];
+};
+
+/* EGLImages of a destroyed dma-buf wl_buffer, kept in case a client
+ * creates a new wl_buffer for the same memory */
+struct dmabuf_image {
+	struct wl_list link; /* gl_renderer::dmabuf_images */
+	struct dmabuf_image_key key;
+
+	EGLImageKHR images[3];
+	int num_images;
+	enum gl_shader_texture_variant shader_variant;
+};
+
+#define DMABUF_IMAGE_CACHE_SIZE 8
+
 /*
  * yuv_format_descriptor and yuv_plane_descriptor describe the translation
  * between YUV and RGB formats. When native YUV sampling is not available, we
@@ -209,12 +272,17 @@ struct gl_buffer_state {
 	bool needs_full_upload;
 	pixman_region32_t texture_damage;
 
+	/* Texture storage was allocated once with glTexStorage2D(); full
+	 * uploads then only update the texels. */
+	bool immutable_storage;
+
 	/* Only needed between attach() and flush_damage() */
 	int pitch; /* plane 0 pitch in pixels */
 	GLenum gl_pixel_type;
 	GLenum gl_format[3];
 	enum gl_channel_order gl_channel_order;
 	int offset[3]; /* per-plane pitch in bytes */
+	int texel_size[3]; /* per-texture bytes per texel */
 
 	EGLImageKHR images[3];
 	int num_images;
@@ -223,6 +291,10 @@ struct gl_buffer_state {
 	GLuint textures[3];
 	int num_textures;
 
+	/* textures[0] is a page of gl_renderer::shm_atlas */
+	bool in_atlas;
+	struct gl_atlas_slot atlas_slot;
+
 	struct wl_listener destroy_listener;
 };
 
@@ -244,15 +316,6 @@ struct gl_surface_state {
 	struct wl_listener renderer_destroy_listener;
 };
 
-struct timeline_render_point {
-	struct wl_list link; /* gl_output_state::timeline_render_point_list */
-
-	int fd;
-	GLuint query;
-	struct weston_output *output;
-	struct wl_event_source *event_source;
-};
-
 static uint32_t
 gr_gl_version(uint16_t major, uint16_t minor)
 {
@@ -311,6 +374,12 @@ shadow_exists(const struct gl_output_state *go)
 	return go->shadow.fbo != 0;
 }
 
+static bool
+drawing_to_shadow(const struct gl_output_state *go)
+{
+	return shadow_exists(go) && !go->shadow_bypass;
+}
+
 static bool
 is_y_flipped(const struct gl_output_state *go)
 {
@@ -434,122 +503,146 @@ struct yuv_format_descriptor yuv_formats[] = {
 	}
 };
 
-static void
-timeline_begin_render_query(struct gl_renderer *gr, GLuint query)
+/* GPU render times go to the timeline and to the frame-stats scope */
+static bool
+timeline_gpu_timing_enabled(struct gl_renderer *gr)
 {
-	if (weston_log_scope_is_enabled(gr->compositor->timeline) &&
-	    gr->has_native_fence_sync &&
-	    gr->has_disjoint_timer_query)
-		gr->begin_query(GL_TIME_ELAPSED_EXT, query);
+	return (weston_log_scope_is_enabled(gr->compositor->timeline) ||
+		weston_log_scope_is_enabled(gr->compositor->frame_stats_scope)) &&
+	       gr->has_disjoint_timer_query;
 }
 
 static void
-timeline_end_render_query(struct gl_renderer *gr)
+timeline_report_render_query(struct gl_renderer *gr,
+			     struct weston_output *output,
+			     struct gl_render_query *query,
+			     const struct timespec *now, GLint64 gpu_now)
 {
-	if (weston_log_scope_is_enabled(gr->compositor->timeline) &&
-	    gr->has_native_fence_sync &&
-	    gr->has_disjoint_timer_query)
-		gr->end_query(GL_TIME_ELAPSED_EXT);
+	struct timespec begin, end;
+	GLuint64 elapsed, timestamp;
+
+	gr->get_query_object_ui64v(query->elapsed, GL_QUERY_RESULT_EXT,
+				   &elapsed);
+	weston_frame_stats_gpu_time(output, elapsed);
+
+	if (!gr->has_timestamp_query)
+		return;
+
+	/* Map the GPU clock onto the CPU one through the pair of clock
+	 * readings taken by the caller. */
+	gr->get_query_object_ui64v(query->timestamp, GL_QUERY_RESULT_EXT,
+				   &timestamp);
+	timespec_add_nsec(&end, now, (int64_t) timestamp - gpu_now);
+	timespec_add_nsec(&begin, &end, -(int64_t) elapsed);
+
+	TL_POINT(output->compositor, "renderer_gpu_begin",
+		 TLP_GPU(&begin), TLP_OUTPUT(output), TLP_END);
+	TL_POINT(output->compositor, "renderer_gpu_end",
+		 TLP_GPU(&end), TLP_OUTPUT(output), TLP_END);
 }
 
+/* Read back the timer queries the GPU has finished with. This never
+ * blocks: queries complete in submission order, so the walk stops at the
+ * first one whose result is not there yet, and picks it up again on a
+ * later repaint. */
 static void
-timeline_render_point_destroy(struct timeline_render_point *trp)
+timeline_resolve_render_queries(struct gl_renderer *gr,
+				struct weston_output *output)
 {
-	wl_list_remove(&trp->link);
-	wl_event_source_remove(trp->event_source);
-	close(trp->fd);
-	free(trp);
-}
+	struct gl_output_state *go = get_output_state(output);
+	struct timespec now = { 0 };
+	GLint64 gpu_now = 0;
+	GLint disjoint = 0;
 
-static int
-timeline_render_point_handler(int fd, uint32_t mask, void *data)
-{
-	struct timeline_render_point *trp = data;
-	struct timespec end;
-
-	if ((mask & WL_EVENT_READABLE) &&
-	    (weston_linux_sync_file_read_timestamp(trp->fd, &end) == 0)) {
-		struct gl_renderer *gr = get_renderer(trp->output->compositor);
-		struct timespec begin;
-		GLuint64 elapsed;
-#if !defined(NDEBUG)
-		GLint result_available;
-
-		/* The elapsed time result must now be available since the
-		 * begin/end queries are meant to be queued prior to fence sync
-		 * creation. */
-		gr->get_query_object_iv(trp->query,
-					GL_QUERY_RESULT_AVAILABLE_EXT,
-					&result_available);
-		assert(result_available == GL_TRUE);
-#endif
+	if (go->render_query_tail == go->render_query_head)
+		return;
 
-		gr->get_query_object_ui64v(trp->query, GL_QUERY_RESULT_EXT,
-					   &elapsed);
-		timespec_add_nsec(&begin, &end, -elapsed);
+	/* A disjoint operation (GPU reset, frequency change...) makes every
+	 * result in flight meaningless, drop them all. */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint) {
+		go->render_query_tail = go->render_query_head;
+		return;
+	}
 
-		TL_POINT(trp->output->compositor, "renderer_gpu_begin",
-			 TLP_GPU(&begin), TLP_OUTPUT(trp->output), TLP_END);
-		TL_POINT(trp->output->compositor, "renderer_gpu_end",
-			 TLP_GPU(&end), TLP_OUTPUT(trp->output), TLP_END);
+	if (gr->has_timestamp_query) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		gr->get_integer64v(GL_TIMESTAMP_EXT, &gpu_now);
 	}
 
-	timeline_render_point_destroy(trp);
+	while (go->render_query_tail != go->render_query_head) {
+		struct gl_render_query *query =
+			&go->render_queries[go->render_query_tail %
+					    GL_RENDER_QUERY_RING];
+		GLint available;
 
-	return 0;
+		gr->get_query_object_iv(gr->has_timestamp_query ?
+					query->timestamp : query->elapsed,
+					GL_QUERY_RESULT_AVAILABLE_EXT,
+					&available);
+		if (!available)
+			break;
+
+		timeline_report_render_query(gr, output, query, &now, gpu_now);
+		go->render_query_tail++;
+	}
 }
 
-static EGLSyncKHR
-create_render_sync(struct gl_renderer *gr)
+static void
+timeline_begin_render_query(struct gl_renderer *gr,
+			    struct weston_output *output)
 {
-	static const EGLint attribs[] = { EGL_NONE };
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_render_query *query;
 
-	if (!gr->has_native_fence_sync)
-		return EGL_NO_SYNC_KHR;
+	if (!gr->has_disjoint_timer_query)
+		return;
 
-	return gr->create_sync(gr->egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID,
-			       attribs);
+	timeline_resolve_render_queries(gr, output);
+
+	/* Skip timing this frame rather than wait when the GPU lags so far
+	 * behind that the whole ring is still in flight. */
+	if (!timeline_gpu_timing_enabled(gr) ||
+	    go->render_query_head - go->render_query_tail ==
+	    GL_RENDER_QUERY_RING)
+		return;
+
+	query = &go->render_queries[go->render_query_head %
+				    GL_RENDER_QUERY_RING];
+	gr->begin_query(GL_TIME_ELAPSED_EXT, query->elapsed);
+	go->render_query_active = true;
 }
 
 static void
-timeline_submit_render_sync(struct gl_renderer *gr,
-			    struct weston_output *output,
-			    EGLSyncKHR sync,
-			    GLuint query)
+timeline_end_render_query(struct gl_renderer *gr,
+			  struct weston_output *output)
 {
-	struct gl_output_state *go;
-	struct wl_event_loop *loop;
-	int fd;
-	struct timeline_render_point *trp;
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_render_query *query;
 
-	if (!weston_log_scope_is_enabled(gr->compositor->timeline) ||
-	    !gr->has_native_fence_sync ||
-	    !gr->has_disjoint_timer_query ||
-	    sync == EGL_NO_SYNC_KHR)
+	if (!go->render_query_active)
 		return;
 
-	go = get_output_state(output);
-	loop = wl_display_get_event_loop(gr->compositor->wl_display);
+	query = &go->render_queries[go->render_query_head %
+				    GL_RENDER_QUERY_RING];
+	gr->end_query(GL_TIME_ELAPSED_EXT);
+	if (gr->has_timestamp_query)
+		gr->query_counter(query->timestamp, GL_TIMESTAMP_EXT);
 
-	fd = gr->dup_native_fence_fd(gr->egl_display, sync);
-	if (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
-		return;
+	go->render_query_head++;
+	go->render_query_active = false;
+}
 
-	trp = zalloc(sizeof *trp);
-	if (trp == NULL) {
-		close(fd);
-		return;
-	}
+static EGLSyncKHR
+create_render_sync(struct gl_renderer *gr)
+{
+	static const EGLint attribs[] = { EGL_NONE };
 
-	trp->fd = fd;
-	trp->query = query;
-	trp->output = output;
-	trp->event_source = wl_event_loop_add_fd(loop, fd,
-						 WL_EVENT_READABLE,
-						 timeline_render_point_handler,
-						 trp);
+	if (!gr->has_native_fence_sync)
+		return EGL_NO_SYNC_KHR;
 
-	wl_list_insert(&go->timeline_render_point_list, &trp->link);
+	return gr->create_sync(gr->egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID,
+			       attribs);
 }
 
 /** Create a texture and a framebuffer object
@@ -721,6 +814,10 @@ gl_renderer_create_fbo(struct weston_output *output,
 	return &renderbuffer->base;
 }
 
+/* Damage made of more rectangles than this is read back as its extents, one
+ * glReadPixels() call per rectangle costing more than the extra pixels. */
+#define READBACK_MAX_RECTS 16
+
 static bool
 gl_renderer_do_read_pixels(struct gl_renderer *gr,
 			   struct gl_output_state *go,
@@ -819,19 +916,31 @@ gl_renderer_do_capture(struct gl_renderer *gr, struct gl_output_state *go,
 	return ret;
 }
 
+/* Takes over the tasks array */
 static struct gl_capture_task*
-create_capture_task(struct weston_capture_task *task,
+create_capture_task(struct wl_array *tasks,
 		    struct gl_renderer *gr,
-		    const struct weston_geometry *rect)
+		    struct gl_output_state *go,
+		    const pixman_box32_t *boxes, int n_boxes)
 {
 	struct gl_capture_task *gl_task = xzalloc(sizeof *gl_task);
+	int bpp = gr->compositor->read_format->bpp / 8;
+	int i;
 
-	gl_task->task = task;
+	gl_task->tasks = *tasks;
+	wl_array_init(tasks);
 	gl_task->gr = gr;
 	glGenBuffers(1, &gl_task->pbo);
-	gl_task->stride = (gr->compositor->read_format->bpp / 8) * rect->width;
-	gl_task->height = rect->height;
-	gl_task->reverse = !gr->has_pack_reverse;
+	gl_task->rects = xcalloc(n_boxes, sizeof *gl_task->rects);
+	gl_task->n_rects = n_boxes;
+	for (i = 0; i < n_boxes; i++) {
+		gl_task->rects[i].box = boxes[i];
+		gl_task->rects[i].offset = gl_task->size;
+		gl_task->size += (size_t)bpp *
+				 (boxes[i].x2 - boxes[i].x1) *
+				 (boxes[i].y2 - boxes[i].y1);
+	}
+	gl_task->reverse = is_y_flipped(go) && !gr->has_pack_reverse;
 	gl_task->sync = EGL_NO_SYNC_KHR;
 	gl_task->fd = EGL_NO_NATIVE_FENCE_FD_ANDROID;
 
@@ -853,40 +962,80 @@ destroy_capture_task(struct gl_capture_task *gl_task)
 	if (gl_task->fd != EGL_NO_NATIVE_FENCE_FD_ANDROID)
 		close(gl_task->fd);
 
+	wl_array_release(&gl_task->tasks);
+	free(gl_task->rects);
 	free(gl_task);
 }
 
 static void
-copy_capture(struct gl_capture_task *gl_task)
+retire_capture_tasks(struct wl_array *tasks, const char *err_msg)
+{
+	struct weston_capture_task **ct;
+
+	wl_array_for_each(ct, tasks) {
+		if (err_msg)
+			weston_capture_task_retire_failed(*ct, err_msg);
+		else
+			weston_capture_task_retire_complete(*ct);
+	}
+}
+
+static void
+copy_capture_into(struct gl_capture_task *gl_task, const uint8_t *map,
+		  struct weston_buffer *buffer)
 {
-	struct weston_buffer *buffer =
-		weston_capture_task_get_buffer(gl_task->task);
 	struct wl_shm_buffer *shm = buffer->shm_buffer;
-	struct gl_renderer *gr = gl_task->gr;
-	uint8_t *src, *dst;
-	int i;
+	int bpp = buffer->pixel_format->bpp / 8;
+	uint8_t *data;
+	int i, j;
 
 	assert(shm);
 
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
-	src = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0,
-				   gl_task->stride * gl_task->height,
-				   GL_MAP_READ_BIT);
-	dst = wl_shm_buffer_get_data(shm);
+	data = wl_shm_buffer_get_data(shm);
 	wl_shm_buffer_begin_access(shm);
 
-	if (!gl_task->reverse) {
-		memcpy(dst, src, gl_task->stride * gl_task->height);
-	} else {
-		src += (gl_task->height - 1) * gl_task->stride;
-		for (i = 0; i < gl_task->height; i++) {
-			memcpy(dst, src, gl_task->stride);
-			dst += gl_task->stride;
-			src -= gl_task->stride;
+	for (i = 0; i < gl_task->n_rects; i++) {
+		const struct gl_capture_rect *rect = &gl_task->rects[i];
+		int row = bpp * (rect->box.x2 - rect->box.x1);
+		int height = rect->box.y2 - rect->box.y1;
+		const uint8_t *src = map + rect->offset;
+		uint8_t *dst = data + rect->box.y1 * buffer->stride +
+			       rect->box.x1 * bpp;
+		int src_step = row;
+
+		if (gl_task->reverse) {
+			src += (height - 1) * row;
+			src_step = -row;
+		}
+
+		for (j = 0; j < height; j++) {
+			memcpy(dst, src, row);
+			dst += buffer->stride;
+			src += src_step;
 		}
 	}
 
 	wl_shm_buffer_end_access(shm);
+}
+
+/* The read back covers the damage of all the tasks; the pixels outside of
+ * a task's own damage are current as well, so every buffer gets all of it.
+ */
+static void
+copy_capture(struct gl_capture_task *gl_task)
+{
+	struct gl_renderer *gr = gl_task->gr;
+	struct weston_capture_task **ct;
+	const uint8_t *map;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
+	map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, gl_task->size,
+				   GL_MAP_READ_BIT);
+
+	wl_array_for_each(ct, &gl_task->tasks)
+		copy_capture_into(gl_task, map,
+				  weston_capture_task_get_buffer(*ct));
+
 	gr->unmap_buffer(GL_PIXEL_PACK_BUFFER);
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 }
@@ -899,7 +1048,7 @@ async_capture_handler(void *data)
 	assert(gl_task);
 
 	copy_capture(gl_task);
-	weston_capture_task_retire_complete(gl_task->task);
+	retire_capture_tasks(&gl_task->tasks, NULL);
 	destroy_capture_task(gl_task);
 
 	return 0;
@@ -915,45 +1064,93 @@ async_capture_handler_fd(int fd, uint32_t mask, void *data)
 
 	if (mask & WL_EVENT_READABLE) {
 		copy_capture(gl_task);
-		weston_capture_task_retire_complete(gl_task->task);
+		retire_capture_tasks(&gl_task->tasks, NULL);
 	} else {
-		weston_capture_task_retire_failed(gl_task->task,
-						  "GL: capture failed");
+		retire_capture_tasks(&gl_task->tasks, "GL: capture failed");
 	}
 	destroy_capture_task(gl_task);
 
 	return 0;
 }
 
+/* All the tasks have the same size and format, see
+ * gl_renderer_do_capture_tasks(). One asynchronous read back of the union
+ * of their damage serves all of them. */
 static void
 gl_renderer_do_read_pixels_async(struct gl_renderer *gr,
 				 struct gl_output_state *go,
 				 struct weston_output *output,
-				 struct weston_capture_task *task,
+				 struct wl_array *tasks,
 				 const struct weston_geometry *rect)
 {
-	struct weston_buffer *buffer = weston_capture_task_get_buffer(task);
-	const struct pixel_format_info *fmt = buffer->pixel_format;
+	const struct pixel_format_info *fmt = NULL;
+	struct weston_capture_task **ct, **shared_ct;
 	struct gl_capture_task *gl_task;
 	struct wl_event_loop *loop;
+	struct wl_array shared;
+	pixman_region32_t damage;
 	int refresh_mhz, refresh_msec;
+	const pixman_box32_t *boxes;
+	int n_boxes, i;
 
 	assert(gr->has_pbo);
 	assert(output->current_mode->refresh > 0);
-	assert(buffer->type == WESTON_BUFFER_SHM);
+
+	wl_array_init(&shared);
+	pixman_region32_init(&damage);
+	wl_array_for_each(ct, tasks) {
+		const pixman_region32_t *task_damage =
+			weston_capture_task_get_damage(*ct);
+
+		/* Nothing changed since the previous capture into this
+		 * buffer. */
+		if (!pixman_region32_not_empty(task_damage)) {
+			weston_capture_task_retire_complete(*ct);
+			continue;
+		}
+
+		fmt = weston_capture_task_get_buffer(*ct)->pixel_format;
+		pixman_region32_union(&damage, &damage, task_damage);
+		shared_ct = abort_oom_if_null(wl_array_add(&shared,
+							   sizeof *ct));
+		*shared_ct = *ct;
+	}
+
+	if (shared.size == 0)
+		goto out;
+
 	assert(fmt->gl_type != 0);
 	assert(fmt->gl_format != 0);
 
+	boxes = pixman_region32_rectangles(&damage, &n_boxes);
+	if (n_boxes > READBACK_MAX_RECTS) {
+		boxes = &damage.extents;
+		n_boxes = 1;
+	}
+
 	if (gr->has_pack_reverse && is_y_flipped(go))
 		glPixelStorei(GL_PACK_REVERSE_ROW_ORDER_ANGLE, GL_TRUE);
 
-	gl_task = create_capture_task(task, gr, rect);
+	gl_task = create_capture_task(&shared, gr, go, boxes, n_boxes);
 
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_task->pbo);
-	glBufferData(GL_PIXEL_PACK_BUFFER, gl_task->stride * gl_task->height,
-		     NULL, gr->pbo_usage);
-	glReadPixels(rect->x, rect->y, rect->width, rect->height,
-		     fmt->gl_format, fmt->gl_type, 0);
+	glBufferData(GL_PIXEL_PACK_BUFFER, gl_task->size, NULL, gr->pbo_usage);
+	for (i = 0; i < gl_task->n_rects; i++) {
+		const pixman_box32_t *box = &gl_task->rects[i].box;
+		int width = box->x2 - box->x1;
+		int height = box->y2 - box->y1;
+		int y;
+
+		/* glReadPixels() has bottom-left origin. */
+		if (is_y_flipped(go))
+			y = rect->y + rect->height - box->y2;
+		else
+			y = rect->y + box->y1;
+
+		glReadPixels(rect->x + box->x1, y, width, height,
+			     fmt->gl_format, fmt->gl_type,
+			     (void *)(uintptr_t)gl_task->rects[i].offset);
+	}
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
 	loop = wl_display_get_event_loop(gr->compositor->wl_display);
@@ -990,6 +1187,66 @@ gl_renderer_do_read_pixels_async(struct gl_renderer *gr,
 
 	if (gr->has_pack_reverse && is_y_flipped(go))
 		glPixelStorei(GL_PACK_REVERSE_ROW_ORDER_ANGLE, GL_FALSE);
+
+out:
+	pixman_region32_fini(&damage);
+	wl_array_release(&shared);
+}
+
+/* Synchronous variant of gl_renderer_do_read_pixels_async(): a single
+ * task is read into directly, several share one read back into a
+ * temporary copy. */
+static void
+gl_renderer_do_capture_shared(struct gl_renderer *gr,
+			      struct gl_output_state *go,
+			      struct wl_array *tasks,
+			      const struct weston_geometry *rect)
+{
+	struct weston_capture_task **ct = tasks->data;
+	const struct pixel_format_info *fmt;
+	struct weston_buffer *buffer;
+	int bpp, stride, y;
+	uint8_t *pixels;
+
+	if (tasks->size == sizeof *ct) {
+		buffer = weston_capture_task_get_buffer(*ct);
+		if (gl_renderer_do_capture(gr, go, buffer, rect))
+			weston_capture_task_retire_complete(*ct);
+		else
+			weston_capture_task_retire_failed(*ct,
+							  "GL: capture failed");
+		return;
+	}
+
+	fmt = weston_capture_task_get_buffer(*ct)->pixel_format;
+	bpp = fmt->bpp / 8;
+	/* GL_PACK_ALIGNMENT */
+	stride = (rect->width * bpp + 3) & ~3;
+	pixels = malloc((size_t)stride * rect->height);
+	if (!pixels ||
+	    !gl_renderer_do_read_pixels(gr, go, fmt, pixels, stride, rect)) {
+		free(pixels);
+		retire_capture_tasks(tasks, "GL: capture failed");
+		return;
+	}
+
+	wl_array_for_each(ct, tasks) {
+		struct wl_shm_buffer *shm;
+		uint8_t *data;
+
+		buffer = weston_capture_task_get_buffer(*ct);
+		shm = buffer->shm_buffer;
+		data = wl_shm_buffer_get_data(shm);
+
+		wl_shm_buffer_begin_access(shm);
+		for (y = 0; y < rect->height; y++)
+			memcpy(data + y * buffer->stride, pixels + y * stride,
+			       rect->width * bpp);
+		wl_shm_buffer_end_access(shm);
+	}
+
+	free(pixels);
+	retire_capture_tasks(tasks, NULL);
 }
 
 static void
@@ -999,8 +1256,9 @@ gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 {
 	struct gl_output_state *go = get_output_state(output);
 	const struct pixel_format_info *format;
-	struct weston_capture_task *ct;
+	struct weston_capture_task *ct, **pulled_ct;
 	struct weston_geometry rect;
+	struct wl_array tasks;
 
 	switch (source) {
 	case WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER:
@@ -1022,6 +1280,9 @@ gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 		return;
 	}
 
+	/* Every task pulled for this source has the same size and format,
+	 * so they all get served from the same read back. */
+	wl_array_init(&tasks);
 	while ((ct = weston_output_pull_capture_task(output, source, rect.width,
 						     rect.height, format))) {
 		struct weston_buffer *buffer = weston_capture_task_get_buffer(ct);
@@ -1041,16 +1302,19 @@ gl_renderer_do_capture_tasks(struct gl_renderer *gr,
 			continue;
 		}
 
-		if (gr->has_pbo) {
-			gl_renderer_do_read_pixels_async(gr, go, output, ct, &rect);
-			continue;
-		}
+		pulled_ct = abort_oom_if_null(wl_array_add(&tasks, sizeof ct));
+		*pulled_ct = ct;
+	}
 
-		if (gl_renderer_do_capture(gr, go, buffer, &rect))
-			weston_capture_task_retire_complete(ct);
+	if (tasks.size > 0) {
+		if (gr->has_pbo)
+			gl_renderer_do_read_pixels_async(gr, go, output,
+							 &tasks, &rect);
 		else
-			weston_capture_task_retire_failed(ct, "GL: capture failed");
+			gl_renderer_do_capture_shared(gr, go, &tasks, &rect);
 	}
+
+	wl_array_release(&tasks);
 }
 
 static void
@@ -1066,6 +1330,32 @@ gl_renderer_send_shader_error(struct weston_paint_node *pnode)
 		wl_resource_get_id(resource));
 }
 
+static void
+program_retry_handler(void *data)
+{
+	struct weston_output *output = data;
+	struct gl_output_state *go = get_output_state(output);
+
+	go->program_retry_source = NULL;
+	weston_output_damage(output);
+}
+
+static void
+gl_renderer_schedule_program_retry(struct gl_renderer *gr,
+				   struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct wl_event_loop *loop;
+
+	if (go->program_retry_source)
+		return;
+
+	loop = wl_display_get_event_loop(gr->compositor->wl_display);
+	go->program_retry_source = wl_event_loop_add_idle(loop,
+							  program_retry_handler,
+							  output);
+}
+
 static int
 use_output(struct weston_output *output)
 {
@@ -1120,7 +1410,7 @@ ensure_surface_buffer_is_ready(struct gl_renderer *gr,
 	attribs[1] = dup(surface->acquire_fence_fd);
 	if (attribs[1] == -1) {
 		linux_explicit_synchronization_send_server_error(
-			gs->surface->synchronization_resource,
+			weston_surface_get_explicit_sync_resource(gs->surface),
 			"Failed to dup acquire fence");
 		return -1;
 	}
@@ -1130,7 +1420,7 @@ ensure_surface_buffer_is_ready(struct gl_renderer *gr,
 			       attribs);
 	if (sync == EGL_NO_SYNC_KHR) {
 		linux_explicit_synchronization_send_server_error(
-			gs->surface->synchronization_resource,
+			weston_surface_get_explicit_sync_resource(gs->surface),
 			"Failed to create EGLSyncKHR object");
 		close(attribs[1]);
 		return -1;
@@ -1139,7 +1429,7 @@ ensure_surface_buffer_is_ready(struct gl_renderer *gr,
 	wait_ret = gr->wait_sync(gr->egl_display, sync, 0);
 	if (wait_ret == EGL_FALSE) {
 		linux_explicit_synchronization_send_server_error(
-			gs->surface->synchronization_resource,
+			weston_surface_get_explicit_sync_resource(gs->surface),
 			"Failed to wait on EGLSyncKHR object");
 		/* Continue to try to destroy the sync object. */
 	}
@@ -1148,7 +1438,7 @@ ensure_surface_buffer_is_ready(struct gl_renderer *gr,
 	destroy_ret = gr->destroy_sync(gr->egl_display, sync);
 	if (destroy_ret == EGL_FALSE) {
 		linux_explicit_synchronization_send_server_error(
-			gs->surface->synchronization_resource,
+			weston_surface_get_explicit_sync_resource(gs->surface),
 			"Failed to destroy on EGLSyncKHR object");
 	}
 
@@ -1217,18 +1507,22 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 	if (!pnode->surf_xform_valid)
 		return false;
 
-	*sconf = (struct gl_shader_config) {
-		.req.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
-		.projection = pnode->view->transform.matrix,
-		.surface_to_buffer =
-			pnode->view->surface->surface_to_buffer_matrix,
-		.view_alpha = pnode->view->alpha,
-		.input_tex_filter = filter,
-	};
+	/* Clear the padding too, draw batching compares configs with
+	 * memcmp(). */
+	memset(sconf, 0, sizeof *sconf);
+	sconf->req.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE;
+	sconf->projection = pnode->view->transform.matrix;
+	sconf->surface_to_buffer =
+		pnode->view->surface->surface_to_buffer_matrix;
+	sconf->view_alpha = pnode->view->alpha;
+	sconf->input_tex_filter = filter;
 
 	weston_matrix_multiply(&sconf->projection, &go->output_matrix);
 
-	if (buffer->buffer_origin == ORIGIN_TOP_LEFT) {
+	if (gs->buffer->in_atlas) {
+		gl_atlas_slot_transform(&gs->buffer->atlas_slot,
+					&sconf->surface_to_buffer);
+	} else if (buffer->buffer_origin == ORIGIN_TOP_LEFT) {
 		weston_matrix_scale(&sconf->surface_to_buffer,
 				    1.0f / buffer->width,
 				    1.0f / buffer->height, 1);
@@ -1241,6 +1535,12 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 
 	gl_shader_config_set_input_textures(sconf, gs);
 
+	/* Content and output color spaces match, see can_bypass_shadow(). */
+	if (go->shadow_bypass) {
+		assert(pnode->surf_xform.identity_pipeline);
+		return true;
+	}
+
 	if (!gl_shader_config_set_color_transform(gr, sconf, pnode->surf_xform.transform)) {
 		weston_log("GL-renderer: failed to generate a color transformation.\n");
 		return false;
@@ -1255,38 +1555,101 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
  * split into 2 more rectangles with sharing edges. While Pixman coalesces
  * rectangles in horizontal bands whenever possible, this function merges
  * vertical bands.
+ *
+ * Only rectangles of the band right above can be extended by a rectangle,
+ * and both bands are sorted by x, so a single walk over the previous band
+ * finds them. The output lives in the renderer's scratch arrays, valid
+ * until the next call.
  */
 static int
-compress_bands(pixman_box32_t *inrects, int nrects, pixman_box32_t **outrects)
+compress_bands(struct gl_renderer *gr, pixman_box32_t *inrects, int nrects,
+	       pixman_box32_t **outrects)
 {
 	pixman_box32_t *out;
-	int i, j, nout;
+	int *open, *next, *tmp;
+	int i, j, nout, nopen, nnext;
+	int32_t band_y1;
 
 	assert(nrects > 0);
 
 	/* nrects is an upper bound - we're not too worried about
 	 * allocating a little extra
 	 */
-	out = malloc(sizeof(pixman_box32_t) * nrects);
-	out[0] = inrects[0];
-	nout = 1;
-	for (i = 1; i < nrects; i++) {
-		for (j = 0; j < nout; j++) {
-			if (inrects[i].x1 == out[j].x1 &&
-			    inrects[i].x2 == out[j].x2 &&
-			    inrects[i].y1 == out[j].y2) {
-				out[j].y2 = inrects[i].y2;
-				goto merged;
+	out = weston_scratch_array_reserve(gr->compositor, &gr->band_rects,
+					   nrects * sizeof *out);
+	open = weston_scratch_array_reserve(gr->compositor, &gr->band_open,
+					    2 * nrects * sizeof *open);
+	next = open + nrects;
+
+	nout = 0;
+	nopen = 0;
+	i = 0;
+	while (i < nrects) {
+		band_y1 = inrects[i].y1;
+		nnext = 0;
+		j = 0;
+		for (; i < nrects && inrects[i].y1 == band_y1; i++) {
+			while (j < nopen && out[open[j]].x1 < inrects[i].x1)
+				j++;
+
+			if (j < nopen &&
+			    out[open[j]].x1 == inrects[i].x1 &&
+			    out[open[j]].x2 == inrects[i].x2 &&
+			    out[open[j]].y2 == inrects[i].y1) {
+				out[open[j]].y2 = inrects[i].y2;
+				next[nnext++] = open[j++];
+			} else {
+				out[nout] = inrects[i];
+				next[nnext++] = nout++;
 			}
 		}
-		out[nout] = inrects[i];
-		nout++;
-	merged: ;
+
+		tmp = open;
+		open = next;
+		next = tmp;
+		nopen = nnext;
 	}
 	*outrects = out;
 	return nout;
 }
 
+/* Damage made of many small rectangles, from terminals, spreadsheets or
+ * many small subsurfaces, costs a sub-mesh per rectangle for every paint
+ * node. Past a point, repainting its bounding box is cheaper, and redrawing
+ * pixels which did not change is harmless.
+ */
+#define DAMAGE_COLLAPSE_MAX_RECTS 64
+
+static void
+simplify_damage(pixman_region32_t *damage)
+{
+	pixman_box32_t *rects;
+	pixman_box32_t ext;
+	int64_t area = 0;
+	int64_t ext_area;
+	int i, nrects;
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	if (nrects <= 1)
+		return;
+
+	for (i = 0; i < nrects; i++)
+		area += (int64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	ext = *pixman_region32_extents(damage);
+	ext_area = (int64_t) (ext.x2 - ext.x1) * (ext.y2 - ext.y1);
+
+	/* Collapse when there are too many rectangles, or when they already
+	 * fill three quarters of their bounding box. */
+	if (nrects <= DAMAGE_COLLAPSE_MAX_RECTS && area * 4 < ext_area * 3)
+		return;
+
+	pixman_region32_fini(damage);
+	pixman_region32_init_rect(damage, ext.x1, ext.y1,
+				  ext.x2 - ext.x1, ext.y2 - ext.y1);
+}
+
 static void
 global_to_surface(pixman_box32_t *rect, struct weston_view *ev,
 		  struct clipper_vertex polygon[4])
@@ -1309,8 +1672,9 @@ global_to_surface(pixman_box32_t *rect, struct weston_view *ev,
 
 /* Transform damage 'region' in global coordinates to damage 'quads' in surface
  * coordinates. 'quads' and 'nquads' are output arguments set if 'quads' is
- * NULL, no transformation happens otherwise. Caller must free 'quads' if
- * set. Caller must ensure 'region' is not empty.
+ * NULL, no transformation happens otherwise. 'quads' lives in the renderer's
+ * scratch space, valid until the next paint node. Caller must ensure
+ * 'region' is not empty.
  */
 static void
 transform_damage(const struct weston_paint_node *pnode,
@@ -1318,9 +1682,10 @@ transform_damage(const struct weston_paint_node *pnode,
 		 struct clipper_quad **quads,
 		 int *nquads)
 {
+	struct gl_renderer *gr = get_renderer(pnode->surface->compositor);
 	pixman_box32_t *rects;
 	int nrects, i;
-	bool compress, axis_aligned;
+	bool axis_aligned;
 	struct clipper_quad *quads_alloc;
 	struct clipper_vertex polygon[4];
 	struct weston_view *view;
@@ -1329,12 +1694,13 @@ transform_damage(const struct weston_paint_node *pnode,
 		return;
 
 	rects = pixman_region32_rectangles(region, &nrects);
-	compress = nrects >= 4;
-	if (compress)
-		nrects = compress_bands(rects, nrects, &rects);
+	if (nrects >= 4)
+		nrects = compress_bands(gr, rects, nrects, &rects);
 
 	assert(nrects > 0);
-	*quads = quads_alloc = malloc(nrects * sizeof *quads_alloc);
+	*quads = quads_alloc =
+		weston_scratch_array_reserve(gr->compositor, &gr->damage_quads,
+					     nrects * sizeof *quads_alloc);
 	*nquads = nrects;
 
 	/* All the damage rects are axis-aligned in global space. This implies
@@ -1350,9 +1716,6 @@ transform_damage(const struct weston_paint_node *pnode,
 		global_to_surface(&rects[i], view, polygon);
 		clipper_quad_init(&quads_alloc[i], polygon, axis_aligned);
 	}
-
-	if (compress)
-		free(rects);
 }
 
 /* Set barycentric coordinates of a sub-mesh of 'count' vertices. 8 barycentric
@@ -1474,30 +1837,163 @@ set_debug_mode(struct gl_renderer *gr,
 	}
 }
 
+/* Size of each of the vertex and index ring buffers */
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+/* Copies 'size' bytes to the ring buffer bound to 'target', and returns
+ * their offset in it. Once the ring buffer is full, it is orphaned and
+ * refilled from the start, so that the driver never has to wait for draws
+ * still reading from it.
+ */
+static size_t
+stream_buffer_upload(GLenum target, size_t *offset,
+		     const void *data, size_t size)
+{
+	size_t start;
+
+	assert(size <= STREAM_BUFFER_SIZE);
+
+	if (*offset + size > STREAM_BUFFER_SIZE) {
+		glBufferData(target, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+		*offset = 0;
+	}
+
+	start = *offset;
+	glBufferSubData(target, start, size, data);
+	*offset = ROUND_UP_N(start + size, 32);
+
+	return start;
+}
+
+static void
+ensure_stream_buffers(struct gl_renderer *gr)
+{
+	if (gr->stream_vbo)
+		return;
+
+	glGenBuffers(1, &gr->stream_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gr->stream_vbo);
+	glBufferData(GL_ARRAY_BUFFER, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &gr->stream_ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gr->stream_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, STREAM_BUFFER_SIZE, NULL,
+		     GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 static void
 draw_mesh(struct gl_renderer *gr,
 	  struct weston_paint_node *pnode,
 	  struct gl_shader_config *sconf,
 	  const struct clipper_vertex *positions,
 	  const uint32_t *barycentrics,
+	  int nvtx,
 	  const uint16_t *indices,
 	  int nidx,
 	  bool opaque)
 {
+	size_t positions_offset, barycentrics_offset = 0, indices_offset;
+
 	assert(nidx > 0);
 
+	/* Rather than stall on the link, leave the region alone this frame,
+	 * so it keeps what the framebuffer held, and repaint the output
+	 * once the program is ready. The fallback shader is only for
+	 * programs that failed to build. */
+	if (gl_renderer_program_pending(gr, &sconf->req)) {
+		gl_renderer_schedule_program_retry(gr, pnode->output);
+		return;
+	}
+
+	ensure_stream_buffers(gr);
+
+	glBindBuffer(GL_ARRAY_BUFFER, gr->stream_vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gr->stream_ibo);
+
+	positions_offset = stream_buffer_upload(GL_ARRAY_BUFFER,
+						&gr->stream_vbo_offset,
+						positions,
+						nvtx * sizeof *positions);
+	if (gr->debug_mode == DEBUG_MODE_WIREFRAME)
+		barycentrics_offset =
+			stream_buffer_upload(GL_ARRAY_BUFFER,
+					     &gr->stream_vbo_offset,
+					     barycentrics,
+					     nvtx * sizeof *barycentrics);
+	indices_offset = stream_buffer_upload(GL_ELEMENT_ARRAY_BUFFER,
+					      &gr->stream_ibo_offset,
+					      indices, nidx * sizeof *indices);
+
 	if (gr->debug_mode)
-		set_debug_mode(gr, sconf, barycentrics, opaque);
+		set_debug_mode(gr, sconf,
+			       (const void *) (uintptr_t) barycentrics_offset,
+			       opaque);
 
 	if (!gl_renderer_use_program(gr, sconf))
 		gl_renderer_send_shader_error(pnode); /* Use fallback shader. */
 
 	glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT, GL_FALSE,
-			      0, positions);
-	glDrawElements(GL_TRIANGLE_STRIP, nidx, GL_UNSIGNED_SHORT, indices);
+			      0, (const void *) (uintptr_t) positions_offset);
+	glDrawElements(GL_TRIANGLE_STRIP, nidx, GL_UNSIGNED_SHORT,
+		       (const void *) (uintptr_t) indices_offset);
 
 	if (gr->debug_mode == DEBUG_MODE_WIREFRAME)
 		glDisableVertexAttribArray(SHADER_ATTRIB_LOC_BARYCENTRIC);
+
+	/* The other draws of the renderer use client-side arrays. */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/* Draws the meshes collected in the vertex streams with a single call. */
+static void
+batch_flush(struct gl_renderer *gr)
+{
+	if (gr->batch.nvtx == 0)
+		return;
+
+	if (gr->batch.blend)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+
+	/* Subtracting 2 removes the last chaining indices. */
+	draw_mesh(gr, gr->batch.pnode, &gr->batch.sconf,
+		  gr->position_stream.data, gr->barycentric_stream.data,
+		  gr->batch.nvtx, gr->indices.data, gr->batch.nidx - 2,
+		  gr->batch.opaque);
+
+	gr->batch.nvtx = 0;
+	gr->batch.nidx = 0;
+	gr->position_stream.size = 0;
+	gr->indices.size = 0;
+	gr->barycentric_stream.size = 0;
+}
+
+/* Meshes can only share a draw call if nothing about the GL state they
+ * need differs: the same shader, uniforms and textures, and blending. In
+ * practice that means views of the same surface, or consecutive sub-meshes
+ * of one view. */
+static void
+batch_begin(struct gl_renderer *gr,
+	    struct weston_paint_node *pnode,
+	    const struct gl_shader_config *sconf,
+	    bool opaque,
+	    bool blend)
+{
+	if (gr->batch.nvtx > 0 &&
+	    gr->batch.opaque == opaque && gr->batch.blend == blend &&
+	    memcmp(&gr->batch.sconf, sconf, sizeof *sconf) == 0)
+		return;
+
+	batch_flush(gr);
+
+	gr->batch.pnode = pnode;
+	gr->batch.sconf = *sconf;
+	gr->batch.opaque = opaque;
+	gr->batch.blend = blend;
 }
 
 static void
@@ -1507,35 +2003,43 @@ repaint_region(struct gl_renderer *gr,
 	       int nquads,
 	       pixman_region32_t *region,
 	       struct gl_shader_config *sconf,
-	       bool opaque)
+	       bool opaque,
+	       bool blend)
 {
 	pixman_box32_t *rects;
 	struct clipper_vertex *positions;
 	uint32_t *barycentrics = NULL;
 	uint16_t *indices;
-	int i, j, n, nrects, positions_size, barycentrics_size, indices_size;
-	int nvtx = 0, nidx = 0;
+	int counts[64];
+	int i, j, k, n, nclip, nrects;
+	int positions_size, barycentrics_size, indices_size;
 	bool wireframe = gr->debug_mode == DEBUG_MODE_WIREFRAME;
 
 	/* Build-time sub-mesh constants. Clipping emits 8 vertices max.
-	 * store_indices() store at most 10 indices. */
+	 * store_indices() store at most 10 indices, but writes 16. */
 	const int nvtx_max = 8;
 	const int nidx_max = 10;
 
 	rects = pixman_region32_rectangles(region, &nrects);
 	assert((nrects > 0) && (nquads > 0));
 
-	/* Worst case allocation sizes per sub-mesh. */
+	batch_begin(gr, pnode, sconf, opaque, blend);
+
+	/* Worst case allocation sizes per sub-mesh, on top of what the batch
+	 * already holds. */
 	n = nquads * nrects;
 	positions_size = n * nvtx_max * sizeof *positions;
 	barycentrics_size = ROUND_UP_N(n * nvtx_max * sizeof *barycentrics, 32);
-	indices_size = ROUND_UP_N(n * nidx_max * sizeof *indices, 32);
+	indices_size = ROUND_UP_N((n * nidx_max + 6) * sizeof *indices, 32);
 
-	positions = wl_array_add(&gr->position_stream, positions_size);
-	indices = wl_array_add(&gr->indices, indices_size);
-	if (wireframe)
-		barycentrics = wl_array_add(&gr->barycentric_stream,
-					    barycentrics_size);
+	wl_array_add(&gr->position_stream, positions_size);
+	wl_array_add(&gr->indices, indices_size);
+	positions = gr->position_stream.data;
+	indices = gr->indices.data;
+	if (wireframe) {
+		wl_array_add(&gr->barycentric_stream, barycentrics_size);
+		barycentrics = gr->barycentric_stream.data;
+	}
 
 	/* A node's damage mesh is created by clipping damage quads to surface
 	 * rects and by chaining the resulting sub-meshes into an indexed
@@ -1554,35 +2058,123 @@ repaint_region(struct gl_renderer *gr,
 	 *    '.    /    _.-'!   counter-clockwise winding order.
 	 *      '. / _.-'    !
 	 *        4 -------- 3   Triangle strip: 0, 5, 1, 4, 2, 3.
+	 *
+	 * Meshes of consecutive calls with the same state are chained the
+	 * same way, and drawn together by batch_flush().
 	 */
 	for (i = 0; i < nquads; i++) {
-		for (j = 0; j < nrects; j++) {
-			n = clipper_quad_clip_box32(&quads[i], &rects[j],
-						    &positions[nvtx]);
-			nidx += store_indices(n, nvtx, &indices[nidx]);
-			if (wireframe)
-				store_wireframes(n, &barycentrics[nvtx]);
-			nvtx += n;
+		for (j = 0; j < nrects; j += nclip) {
+			nclip = MIN(nrects - j, (int) ARRAY_LENGTH(counts));
 
 			/* Highly unlikely flush to prevent index wraparound.
-			 * Subtracting 2 removes the last chaining indices. */
-			if ((nvtx + nvtx_max) > UINT16_MAX) {
-				draw_mesh(gr, pnode, sconf, positions,
-					  barycentrics, indices, nidx - 2,
-					  opaque);
-				nvtx = nidx = 0;
+			 * The streams keep their allocation for the rest of
+			 * the loop. */
+			if ((gr->batch.nvtx + nclip * nvtx_max) > UINT16_MAX) {
+				batch_flush(gr);
+				batch_begin(gr, pnode, sconf, opaque, blend);
+			}
+
+			clipper_quad_clip_boxes32(&quads[i], &rects[j], nclip,
+						  &positions[gr->batch.nvtx],
+						  counts);
+
+			for (k = 0; k < nclip; k++) {
+				int nvtx = gr->batch.nvtx;
+
+				n = counts[k];
+				gr->batch.nidx += store_indices(n, nvtx,
+								&indices[gr->batch.nidx]);
+				if (wireframe)
+					store_wireframes(n, &barycentrics[nvtx]);
+				gr->batch.nvtx += n;
 			}
 		}
 	}
 
-	if (nvtx)
-		draw_mesh(gr, pnode, sconf, positions, barycentrics, indices,
-			  nidx - 2, opaque);
-
-	gr->position_stream.size = 0;
-	gr->indices.size = 0;
+	gr->position_stream.size = gr->batch.nvtx * sizeof *positions;
+	gr->indices.size = gr->batch.nidx * sizeof *indices;
 	if (wireframe)
-		gr->barycentric_stream.size = 0;
+		gr->barycentric_stream.size =
+			gr->batch.nvtx * sizeof *barycentrics;
+}
+
+/* An opaque solid colour view covering whole pixels writes the same
+ * values whether drawn without blending or cleared, so clear its damage
+ * with scissored glClear() instead of feeding it through the shaders.
+ * Backgrounds and letterboxing are the common case. */
+static bool
+clear_solid_paint_node(struct gl_renderer *gr,
+		       struct weston_paint_node *pnode,
+		       pixman_region32_t *repaint,
+		       const struct gl_shader_config *sconf)
+{
+	struct gl_output_state *go = get_output_state(pnode->output);
+	struct weston_view *view = pnode->view;
+	struct weston_surface *surface = pnode->surface;
+	struct weston_coord_global tl, br;
+	pixman_region32_t region;
+	pixman_box32_t *rects;
+	int i, nrects, x0, y0;
+
+	if (sconf->req.variant != SHADER_VARIANT_SOLID ||
+	    gr->debug_mode != DEBUG_MODE_NONE ||
+	    !pnode->is_fully_opaque || view->alpha < 1.0f ||
+	    view->geometry.scissor_enabled || !pnode->valid_transform)
+		return false;
+
+	if (sconf->req.color_pre_curve != SHADER_COLOR_CURVE_IDENTITY ||
+	    sconf->req.color_mapping != SHADER_COLOR_MAPPING_IDENTITY ||
+	    sconf->req.color_post_curve != SHADER_COLOR_CURVE_IDENTITY)
+		return false;
+
+	/* Rasterisation decides about partially covered edge pixels, a
+	 * scissor would cover them whole. */
+	tl = weston_coord_surface_to_global(view,
+					    weston_coord_surface(0, 0, surface));
+	br = weston_coord_surface_to_global(view,
+					    weston_coord_surface(surface->width,
+								 surface->height,
+								 surface));
+	if (tl.c.x != (int) tl.c.x || tl.c.y != (int) tl.c.y ||
+	    br.c.x != (int) br.c.x || br.c.y != (int) br.c.y)
+		return false;
+
+	/* Scissor boxes are in window coordinates, the viewport offset
+	 * does not apply to them. */
+	if (drawing_to_shadow(go)) {
+		x0 = 0;
+		y0 = 0;
+	} else {
+		x0 = go->area.x;
+		y0 = is_y_flipped(go) ?
+		     go->fb_size.height - go->area.height - go->area.y :
+		     go->area.y;
+	}
+
+	/* Whatever is batched lies below this view. */
+	batch_flush(gr);
+
+	pixman_region32_init(&region);
+	weston_region_global_to_output(&region, pnode->output, repaint);
+	rects = pixman_region32_rectangles(&region, &nrects);
+
+	glClearColor(sconf->unicolor[0], sconf->unicolor[1],
+		     sconf->unicolor[2], sconf->unicolor[3]);
+	glEnable(GL_SCISSOR_TEST);
+	for (i = 0; i < nrects; i++) {
+		int y = is_y_flipped(go) ? go->area.height - rects[i].y2 :
+					   rects[i].y1;
+
+		glScissor(x0 + rects[i].x1, y0 + y,
+			  rects[i].x2 - rects[i].x1,
+			  rects[i].y2 - rects[i].y1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	glDisable(GL_SCISSOR_TEST);
+
+	pixman_region32_fini(&region);
+
+	return true;
 }
 
 static void
@@ -1652,6 +2244,11 @@ draw_paint_node(struct weston_paint_node *pnode,
 	if (pnode->draw_solid)
 		prepare_placeholder(&sconf, pnode);
 
+	if (clear_solid_paint_node(gr, pnode, &repaint, &sconf)) {
+		gs->used_in_output_repaint = true;
+		goto out_regions;
+	}
+
 	if (pixman_region32_not_empty(&surface_opaque)) {
 		struct gl_shader_config alt = sconf;
 
@@ -1664,28 +2261,20 @@ draw_paint_node(struct weston_paint_node *pnode,
 			alt.req.variant = SHADER_VARIANT_RGBX;
 		}
 
-		if (pnode->view->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
 		transform_damage(pnode, &repaint, &quads, &nquads);
 		repaint_region(gr, pnode, quads, nquads, &surface_opaque, &alt,
-			       true);
+			       true, pnode->view->alpha < 1.0);
 		gs->used_in_output_repaint = true;
 	}
 
 	if (pixman_region32_not_empty(&surface_blend)) {
-		glEnable(GL_BLEND);
 		transform_damage(pnode, &repaint, &quads, &nquads);
 		repaint_region(gr, pnode, quads, nquads, &surface_blend, &sconf,
-			       false);
+			       false, true);
 		gs->used_in_output_repaint = true;
 	}
 
-	if (quads)
-		free(quads);
-
+out_regions:
 	pixman_region32_fini(&surface_blend);
 	pixman_region32_fini(&surface_opaque);
 
@@ -1697,23 +2286,70 @@ static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
-	struct weston_paint_node *pnode;
+	struct weston_paint_node *pnode, **nodes;
+	unsigned int n_nodes, i;
 
 	gr->nbatches = 0;
 
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
 
-	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
-				 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = n_nodes; i > 0; i--) {
+		pnode = nodes[i - 1];
 		if (pnode->plane == &output->primary_plane ||
 		    pnode->need_hole)
 			draw_paint_node(pnode, damage);
 	}
 
+	batch_flush(gr);
+
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
 }
 
+/* The shadow holds the image in the blending color space, which
+ * blit_shadow_to_output() turns into output pixels in a full-screen pass.
+ * When everything to repaint is opaque, nothing is blended, and when its
+ * color pipeline to the output is identity, the shadow would be a mere copy.
+ * Such repaints draw straight into the output buffer.
+ */
+static bool
+can_bypass_shadow(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct weston_paint_node *pnode, **nodes;
+	unsigned int n_nodes, i;
+	pixman_region32_t repaint;
+	bool bypass = true;
+
+	if (gr->debug_clear ||
+	    output->compositor->test_data.test_quirks.gl_force_full_redraw_of_shadow_fb)
+		return false;
+
+	pixman_region32_init(&repaint);
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = 0; i < n_nodes; i++) {
+		pnode = nodes[i];
+		if (pnode->plane != &output->primary_plane && !pnode->need_hole)
+			continue;
+
+		pixman_region32_intersect(&repaint, &pnode->visible, damage);
+		if (!pixman_region32_not_empty(&repaint))
+			continue;
+
+		if (!pnode->surf_xform_valid ||
+		    !pnode->surf_xform.identity_pipeline ||
+		    !pnode->is_fully_opaque || pnode->draw_solid ||
+		    pnode->view->alpha < 1.0f) {
+			bypass = false;
+			break;
+		}
+	}
+	pixman_region32_fini(&repaint);
+
+	return bypass;
+}
+
 static int
 gl_renderer_create_fence_fd(struct weston_output *output);
 
@@ -1725,14 +2361,17 @@ static void
 update_buffer_release_fences(struct weston_compositor *compositor,
 			     struct weston_output *output)
 {
-	struct weston_paint_node *pnode;
+	struct weston_paint_node *pnode, **nodes;
+	unsigned int n_nodes, i;
 
-	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
-				 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = n_nodes; i > 0; i--) {
 		struct gl_surface_state *gs;
 		struct weston_buffer_release *buffer_release;
 		int fence_fd;
 
+		pnode = nodes[i - 1];
+
 		if (pnode->plane != &output->primary_plane)
 			continue;
 
@@ -1754,7 +2393,8 @@ update_buffer_release_fences(struct weston_compositor *compositor,
 		 */
 		if (fence_fd == -1) {
 			linux_explicit_synchronization_send_server_error(
-				buffer_release->resource,
+				buffer_release->resource ?:
+				weston_surface_get_explicit_sync_resource(pnode->surface),
 				"Failed to create release fence");
 			fd_clear(&buffer_release->fence_fd);
 			continue;
@@ -2105,7 +2745,8 @@ output_get_dummy_renderbuffer(struct weston_output *output)
  *
  * @param output The output whose co-ordinate space we are after
  * @param global_region The affected region in global co-ordinate space
- * @param[out] rects quads in {x,y,w,h} order; caller must free
+ * @param[out] rects quads in {x,y,w,h} order, in the renderer's scratch
+ *                   space until the next call
  * @param[out] nrects Number of quads (4x number of co-ordinates)
  */
 static void
@@ -2115,6 +2756,7 @@ pixman_region_to_egl(struct weston_output *output,
 		     EGLint *nrects)
 {
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
 	pixman_region32_t transformed;
 	struct pixman_box32 *box;
 	EGLint *d;
@@ -2140,7 +2782,8 @@ pixman_region_to_egl(struct weston_output *output,
 	 * flipping in the Y axis to account for GL's lower-left-origin
 	 * coordinate space if the output uses the GL coordinate space. */
 	box = pixman_region32_rectangles(&transformed, nrects);
-	*rects = malloc(*nrects * 4 * sizeof(EGLint));
+	*rects = weston_scratch_array_reserve(gr->compositor, &gr->egl_rects,
+					      *nrects * 4 * sizeof(EGLint));
 
 	d = *rects;
 	for (i = 0; i < *nrects; ++i) {
@@ -2189,7 +2832,9 @@ blit_shadow_to_output(struct weston_output *output,
 	struct { GLfloat x, y; } position[4];
 	struct { GLfloat s, t; } texcoord[4];
 
-	ctransf = output->color_outcome->from_blend_to_output;
+	/* The backend may have taken over after the shadow was created */
+	ctransf = output->from_blend_to_output_by_backend ?
+		  NULL : output->color_outcome->from_blend_to_output;
 	if (!gl_shader_config_set_color_transform(gr, &sconf, ctransf)) {
 		weston_log("GL-renderer: %s failed to generate a color transformation.\n", __func__);
 		return;
@@ -2252,6 +2897,72 @@ blit_shadow_to_output(struct weston_output *output,
 	pixman_region32_fini(&translated_damage);
 }
 
+static void
+gl_renderer_read_back_damage(struct gl_renderer *gr,
+			     struct gl_output_state *go,
+			     struct weston_output *output,
+			     struct gl_renderbuffer *rb)
+{
+	const struct pixel_format_info *fmt = output->compositor->read_format;
+	int width = go->fb_size.width;
+	int stride = width * (fmt->bpp >> 3);
+	pixman_box32_t *rects;
+	pixman_box32_t extents;
+	int n_rects, i;
+
+	/* Without GL_PACK_ROW_LENGTH only full rows can be read back. */
+	if (gr->debug_clear || gr->gl_version < gr_gl_version(3, 0)) {
+		uint32_t *pixels = rb->pixels;
+		struct weston_geometry rect = {
+			.x = go->area.x,
+			.width = go->area.width,
+		};
+
+		extents = weston_matrix_transform_rect(&output->matrix,
+						       rb->base.damage.extents);
+
+		if (gr->debug_clear) {
+			rect.y = go->area.y;
+			rect.height = go->area.height;
+		} else {
+			rect.y = go->area.y + extents.y1;
+			rect.height = extents.y2 - extents.y1;
+			pixels += rect.width * extents.y1;
+		}
+
+		gl_renderer_do_read_pixels(gr, go, fmt, pixels, stride, &rect);
+		return;
+	}
+
+	rects = pixman_region32_rectangles(&rb->base.damage, &n_rects);
+	if (n_rects > READBACK_MAX_RECTS) {
+		rects = &rb->base.damage.extents;
+		n_rects = 1;
+	}
+
+	glPixelStorei(GL_PACK_ROW_LENGTH, width);
+
+	for (i = 0; i < n_rects; i++) {
+		uint32_t *pixels = rb->pixels;
+		struct weston_geometry rect;
+
+		extents = weston_matrix_transform_rect(&output->matrix,
+						       rects[i]);
+		if (extents.x1 >= extents.x2 || extents.y1 >= extents.y2)
+			continue;
+
+		rect.x = go->area.x + extents.x1;
+		rect.y = go->area.y + extents.y1;
+		rect.width = extents.x2 - extents.x1;
+		rect.height = extents.y2 - extents.y1;
+		pixels += width * extents.y1 + extents.x1;
+
+		gl_renderer_do_read_pixels(gr, go, fmt, pixels, stride, &rect);
+	}
+
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
 /* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
  * unavailable, so we're assuming the background has no transparency
  * and that everything with a blend, like drop shadows, will have something
@@ -2269,7 +2980,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	struct weston_compositor *compositor = output->compositor;
 	struct gl_renderer *gr = get_renderer(compositor);
 	static int errored;
-	struct weston_paint_node *pnode;
+	struct weston_paint_node *pnode, **nodes;
+	unsigned int n_nodes, i;
 	const int32_t area_y =
 		is_y_flipped(go) ? go->fb_size.height - go->area.height - go->area.y : go->area.y;
 	struct gl_renderbuffer *rb;
@@ -2294,10 +3006,16 @@ gl_renderer_repaint_output(struct weston_output *output,
 	else
 		rb = output_get_dummy_renderbuffer(output);
 
+	simplify_damage(&rb->base.damage);
+
+	go->shadow_bypass = shadow_exists(go) &&
+			    can_bypass_shadow(output, &rb->base.damage);
+
 	/* Clear the used_in_output_repaint flag, so that we can properly track
 	 * which surfaces were used in this output repaint. */
-	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
-				 z_order_link) {
+	nodes = weston_output_get_paint_nodes(output, &n_nodes);
+	for (i = n_nodes; i > 0; i--) {
+		pnode = nodes[i - 1];
 		if (pnode->plane == &output->primary_plane) {
 			struct gl_surface_state *gs =
 				get_surface_state(pnode->surface);
@@ -2305,7 +3023,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 		}
 	}
 
-	timeline_begin_render_query(gr, go->render_query);
+	timeline_begin_render_query(gr, output);
 
 	/* Calculate the global GL matrix */
 	go->output_matrix = output->matrix;
@@ -2317,7 +3035,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 			    go->y_flip * 2.0 / go->area.height, 1);
 
 	/* If using shadow, redirect all drawing to it first. */
-	if (shadow_exists(go)) {
+	if (drawing_to_shadow(go)) {
 		glBindFramebuffer(GL_FRAMEBUFFER, go->shadow.fbo);
 		glViewport(0, 0, go->area.width, go->area.height);
 	} else {
@@ -2361,15 +3079,18 @@ gl_renderer_repaint_output(struct weston_output *output,
 				     &egl_rects, &n_egl_rects);
 		gr->set_damage_region(gr->egl_display, go->egl_surface,
 				      egl_rects, n_egl_rects);
-		free(egl_rects);
 	}
 
-	if (shadow_exists(go)) {
-		/* Repaint into shadow. */
+	if (drawing_to_shadow(go)) {
+		/* Repaint into shadow, along with what it missed while it
+		 * was bypassed. */
+		pixman_region32_union(&go->shadow_stale, &go->shadow_stale,
+				      output_damage);
 		if (compositor->test_data.test_quirks.gl_force_full_redraw_of_shadow_fb)
 			repaint_views(output, &output->region);
 		else
-			repaint_views(output, output_damage);
+			repaint_views(output, &go->shadow_stale);
+		pixman_region32_clear(&go->shadow_stale);
 
 		glBindFramebuffer(GL_FRAMEBUFFER, rb->fbo);
 		glViewport(go->area.x, area_y,
@@ -2378,7 +3099,11 @@ gl_renderer_repaint_output(struct weston_output *output,
 				      &output->region : &rb->base.damage);
 	} else {
 		repaint_views(output, &rb->base.damage);
+		if (go->shadow_bypass)
+			pixman_region32_union(&go->shadow_stale,
+					      &go->shadow_stale, output_damage);
 	}
+	go->shadow_bypass = false;
 
 	draw_output_borders(output, rb->border_damage);
 
@@ -2388,7 +3113,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 				     WESTON_OUTPUT_CAPTURE_SOURCE_FULL_FRAMEBUFFER);
 	wl_signal_emit(&output->frame_signal, output_damage);
 
-	timeline_end_render_query(gr);
+	timeline_end_render_query(gr, output);
 
 	if (go->render_sync != EGL_NO_SYNC_KHR)
 		gr->destroy_sync(gr->egl_display, go->render_sync);
@@ -2409,7 +3134,6 @@ gl_renderer_repaint_output(struct weston_output *output,
 			ret = gr->swap_buffers_with_damage(gr->egl_display,
 							   go->egl_surface,
 							   egl_rects, n_egl_rects);
-			free(egl_rects);
 		} else {
 			ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
 		}
@@ -2426,49 +3150,10 @@ gl_renderer_repaint_output(struct weston_output *output,
 	rb->border_damage = BORDER_STATUS_CLEAN;
 	go->border_status = BORDER_STATUS_CLEAN;
 
-	/* We have to submit the render sync objects after swap buffers, since
-	 * the objects get assigned a valid sync file fd only after a gl flush.
-	 */
-	timeline_submit_render_sync(gr, output, go->render_sync,
-				    go->render_query);
-
 	update_buffer_release_fences(compositor, output);
 
-	if (rb->pixels) {
-		uint32_t *pixels = rb->pixels;
-		int width = go->fb_size.width;
-		int stride = width * (compositor->read_format->bpp >> 3);
-		pixman_box32_t extents;
-		struct weston_geometry rect = {
-			.x = go->area.x,
-			.width = go->area.width,
-		};
-
-		extents = weston_matrix_transform_rect(&output->matrix,
-						       rb->base.damage.extents);
-
-		if (gr->debug_clear) {
-			rect.y = go->area.y;
-			rect.height = go->area.height;
-		} else {
-			rect.y = go->area.y + extents.y1;
-			rect.height = extents.y2 - extents.y1;
-			pixels += rect.width * extents.y1;
-		}
-
-		if (gr->gl_version >= gr_gl_version(3, 0) && !gr->debug_clear) {
-			glPixelStorei(GL_PACK_ROW_LENGTH, width);
-			rect.width = extents.x2 - extents.x1;
-			rect.x += extents.x1;
-			pixels += extents.x1;
-		}
-
-		gl_renderer_do_read_pixels(gr, go, compositor->read_format,
-					   pixels, stride, &rect);
-
-		if (gr->gl_version >= gr_gl_version(3, 0))
-			glPixelStorei(GL_PACK_ROW_LENGTH, 0);
-	}
+	if (rb->pixels)
+		gl_renderer_read_back_damage(gr, go, output, rb);
 
 	pixman_region32_clear(&rb->base.damage);
 
@@ -2517,6 +3202,198 @@ gl_format_from_internal(GLenum internal_format)
 	}
 }
 
+struct gl_upload_chunk {
+	int texture;
+	pixman_box32_t box; /* in texels of the texture */
+	size_t offset; /* into the staging buffer */
+	size_t row_size;
+};
+
+/** Upload SHM buffer damage through a pixel unpack buffer
+ *
+ * The damaged texels are packed into a staging PBO and the textures are
+ * updated from it. Texture specification then no longer waits for the
+ * driver to copy and convert client memory: the transfer is done by the
+ * GPU, ordered before any draw sampling the textures. Mapping with
+ * GL_MAP_INVALIDATE_BUFFER_BIT lets the driver hand out fresh storage
+ * while the previous upload is still in flight.
+ *
+ * \return false if nothing was uploaded and the caller has to upload from
+ * client memory instead.
+ */
+static bool
+gl_renderer_upload_shm_pbo(struct gl_renderer *gr,
+			   struct gl_buffer_state *gb,
+			   struct weston_surface *surface,
+			   struct weston_buffer *buffer,
+			   bool full_upload)
+{
+	struct gl_upload_chunk *chunks, *c;
+	pixman_box32_t full_box = { 0, 0, buffer->width, buffer->height };
+	pixman_box32_t *rectangles;
+	uint8_t *data, *staging;
+	size_t size = 0;
+	int n_rects, n_chunks = 0;
+	int i, j, y;
+
+	if (full_upload) {
+		rectangles = &full_box;
+		n_rects = 1;
+	} else {
+		rectangles = pixman_region32_rectangles(&gb->texture_damage,
+							&n_rects);
+	}
+
+	chunks = xcalloc(MAX(n_rects * gb->num_textures, 1), sizeof *chunks);
+	for (i = 0; i < n_rects; i++) {
+		pixman_box32_t r = rectangles[i];
+
+		if (!full_upload)
+			r = weston_surface_to_buffer_rect(surface, r);
+
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+
+			c = &chunks[n_chunks];
+			c->texture = j;
+			c->box.x1 = r.x1 / hsub;
+			c->box.y1 = r.y1 / vsub;
+			c->box.x2 = r.x2 / hsub;
+			c->box.y2 = r.y2 / vsub;
+			if (c->box.x2 <= c->box.x1 || c->box.y2 <= c->box.y1)
+				continue;
+
+			/* Rows are padded to the default GL_UNPACK_ALIGNMENT
+			 * of 4, chunks to a multiple of any texel size. */
+			c->row_size = (c->box.x2 - c->box.x1) *
+				      gb->texel_size[j];
+			c->row_size = (c->row_size + 3) & ~(size_t) 3;
+			c->offset = size;
+			size += c->row_size * (c->box.y2 - c->box.y1);
+			size = (size + 15) & ~(size_t) 15;
+			n_chunks++;
+		}
+	}
+
+	if (n_chunks == 0) {
+		free(chunks);
+		return true;
+	}
+
+	if (!gr->upload_pbo)
+		glGenBuffers(1, &gr->upload_pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gr->upload_pbo);
+	if (size > gr->upload_pbo_size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL,
+			     GL_STREAM_DRAW);
+		gr->upload_pbo_size = size;
+	}
+
+	staging = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size,
+				       GL_MAP_WRITE_BIT |
+				       GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!staging) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		free(chunks);
+		return false;
+	}
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < n_chunks; i++) {
+		int hsub, src_stride, texel_size;
+		size_t width;
+		uint8_t *src;
+
+		c = &chunks[i];
+		hsub = pixel_format_hsub(buffer->pixel_format, c->texture);
+		texel_size = gb->texel_size[c->texture];
+		src_stride = gb->pitch / hsub * texel_size;
+		src = data + gb->offset[c->texture] +
+		      c->box.y1 * src_stride + c->box.x1 * texel_size;
+		width = (c->box.x2 - c->box.x1) * texel_size;
+
+		for (y = 0; y < c->box.y2 - c->box.y1; y++) {
+			memcpy(staging + c->offset + y * c->row_size,
+			       src + y * src_stride, width);
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	/* The store can get lost, e.g. on a mode switch; then start over
+	 * from client memory. */
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		free(chunks);
+		return false;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+
+	for (i = 0; i < n_chunks; i++) {
+		const void *offset;
+
+		c = &chunks[i];
+		offset = (const void *)(uintptr_t) c->offset;
+		glBindTexture(GL_TEXTURE_2D, gb->textures[c->texture]);
+		if (full_upload && !gb->immutable_storage) {
+			glTexImage2D(GL_TEXTURE_2D, 0,
+				     gb->gl_format[c->texture],
+				     c->box.x2, c->box.y2, 0,
+				     gl_format_from_internal(gb->gl_format[c->texture]),
+				     gb->gl_pixel_type, offset);
+		} else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0,
+					c->box.x1, c->box.y1,
+					c->box.x2 - c->box.x1,
+					c->box.y2 - c->box.y1,
+					gl_format_from_internal(gb->gl_format[c->texture]),
+					gb->gl_pixel_type, offset);
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	free(chunks);
+
+	return true;
+}
+
+/* Atlas slots are small, uploading them straight from client memory
+ * costs less than going through the staging buffer. */
+static void
+gl_renderer_upload_shm_atlas(struct gl_buffer_state *gb,
+			     struct weston_surface *surface,
+			     struct weston_buffer *buffer,
+			     bool full_upload)
+{
+	pixman_box32_t full_box = { 0, 0, buffer->width, buffer->height };
+	pixman_box32_t *rectangles;
+	void *data;
+	int i, n;
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	if (full_upload) {
+		gl_atlas_upload(&gb->atlas_slot, data, gb->pitch, full_box);
+	} else {
+		rectangles = pixman_region32_rectangles(&gb->texture_damage,
+							&n);
+		for (i = 0; i < n; i++) {
+			pixman_box32_t r;
+
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+			gl_atlas_upload(&gb->atlas_slot, data, gb->pitch, r);
+		}
+	}
+
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
+
 static void
 gl_renderer_flush_damage(struct weston_paint_node *pnode)
 {
@@ -2528,6 +3405,7 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 	struct gl_buffer_state *gb = gs->buffer;
 	pixman_box32_t *rectangles;
 	uint8_t *data;
+	bool full_upload;
 	int i, j, n;
 
 	assert(buffer && gb);
@@ -2548,9 +3426,22 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 	    !gb->needs_full_upload)
 		goto done;
 
+	full_upload = gb->needs_full_upload || quirks->gl_force_full_upload;
+
+	if (gb->in_atlas) {
+		gl_renderer_upload_shm_atlas(gb, surface, buffer, full_upload);
+		goto done;
+	}
+
+	if (gb->gr->has_pbo_upload &&
+	    surface->compositor->gl_shm_pbo_upload &&
+	    gl_renderer_upload_shm_pbo(gb->gr, gb, surface, buffer,
+				       full_upload))
+		goto done;
+
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
-	if (gb->needs_full_upload || quirks->gl_force_full_upload) {
+	if (full_upload) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
 
 		for (j = 0; j < gb->num_textures; j++) {
@@ -2560,6 +3451,15 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
 			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
 				      gb->pitch / hsub);
+			if (gb->immutable_storage) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+						buffer->width / hsub,
+						buffer->height / vsub,
+						gl_format_from_internal(gb->gl_format[j]),
+						gb->gl_pixel_type,
+						data + gb->offset[j]);
+				continue;
+			}
 			glTexImage2D(GL_TEXTURE_2D, 0,
 				     gb->gl_format[j],
 				     buffer->width / hsub,
@@ -2615,12 +3515,33 @@ done:
 	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
 }
 
+static bool
+gl_renderer_shm_buffer_is_copied(struct weston_surface *surface)
+{
+	struct gl_surface_state *gs = surface->renderer_state;
+	struct gl_buffer_state *gb;
+
+	if (!gs || !gs->buffer)
+		return false;
+
+	/* flush_damage() drops the reference to mark a finished upload;
+	 * damage stays pending while the surface is on another plane. */
+	gb = gs->buffer;
+	return gs->buffer_ref.buffer == surface->buffer_ref.buffer &&
+	       gs->buffer_ref.type == BUFFER_WILL_NOT_BE_ACCESSED &&
+	       !gb->needs_full_upload &&
+	       !pixman_region32_not_empty(&gb->texture_damage);
+}
+
 static void
 destroy_buffer_state(struct gl_buffer_state *gb)
 {
 	int i;
 
-	glDeleteTextures(gb->num_textures, gb->textures);
+	if (gb->in_atlas)
+		gl_atlas_free(&gb->atlas_slot);
+	else
+		glDeleteTextures(gb->num_textures, gb->textures);
 
 	for (i = 0; i < gb->num_images; i++)
 		gb->gr->destroy_image(gb->gr->egl_display, gb->images[i]);
@@ -2661,6 +3582,83 @@ ensure_textures(struct gl_buffer_state *gb, GLenum target, int num_textures)
 	glBindTexture(target, 0);
 }
 
+/* Sized internal format to allocate immutable storage for a wl_shm texture,
+ * or GL_NONE if the format can only be specified with glTexImage2D().
+ */
+static GLenum
+gl_texture_storage_format(GLenum gl_format, GLenum gl_pixel_type)
+{
+	switch (gl_format) {
+	case GL_R8_EXT:
+	case GL_RG8_EXT:
+	case GL_RGB10_A2:
+	case GL_RGBA16_EXT:
+	case GL_RGBA16F:
+		return gl_format;
+	case GL_BGRA_EXT:
+		return gl_pixel_type == GL_UNSIGNED_BYTE ?
+		       GL_BGRA8_EXT : GL_NONE;
+	case GL_RGB:
+		switch (gl_pixel_type) {
+		case GL_UNSIGNED_BYTE:
+			return GL_RGB8_OES;
+		case GL_UNSIGNED_SHORT_5_6_5:
+			return GL_RGB565;
+		}
+		return GL_NONE;
+	case GL_RGBA:
+		switch (gl_pixel_type) {
+		case GL_UNSIGNED_BYTE:
+			return GL_RGBA8_OES;
+		case GL_UNSIGNED_SHORT_4_4_4_4:
+			return GL_RGBA4;
+		case GL_UNSIGNED_SHORT_5_5_5_1:
+			return GL_RGB5_A1;
+		}
+		return GL_NONE;
+	default:
+		return GL_NONE;
+	}
+}
+
+/* Allocate the storage of all the textures of a wl_shm buffer state up
+ * front, so that uploads never re-specify it. The state is kept across
+ * attaches of same-sized buffers of the same format, so a client cycling
+ * through its buffers keeps sampling from the same allocation.
+ */
+static void
+gl_buffer_state_alloc_storage(struct gl_buffer_state *gb,
+			      struct weston_buffer *buffer)
+{
+	struct gl_renderer *gr = gb->gr;
+	GLenum storage_format[3];
+	int i;
+
+	if (!gr->tex_storage_2d)
+		return;
+
+	for (i = 0; i < gb->num_textures; i++) {
+		storage_format[i] =
+			gl_texture_storage_format(gb->gl_format[i],
+						  gb->gl_pixel_type);
+		if (storage_format[i] == GL_NONE)
+			return;
+	}
+
+	for (i = 0; i < gb->num_textures; i++) {
+		int hsub = pixel_format_hsub(buffer->pixel_format, i);
+		int vsub = pixel_format_vsub(buffer->pixel_format, i);
+
+		glBindTexture(GL_TEXTURE_2D, gb->textures[i]);
+		gr->tex_storage_2d(GL_TEXTURE_2D, 1, storage_format[i],
+				   buffer->width / hsub,
+				   buffer->height / vsub);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	gb->immutable_storage = true;
+}
+
 static void
 gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 {
@@ -2674,6 +3672,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	enum gl_shader_texture_variant shader_variant;
 	int pitch;
 	int offset[3] = { 0, 0, 0 };
+	int texel_size[3] = { 0, 0, 0 };
 	unsigned int num_planes;
 	unsigned int i;
 	bool using_glesv2 = gr->gl_version < gr_gl_version(3, 0);
@@ -2733,6 +3732,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 
 			gl_format[out] = sub_info->gl_format;
 			offset[out] = shm_offset[yuv->plane[out].plane_index];
+			texel_size[out] = sub_info->bpp / 8;
 		}
 	} else {
 		int bpp = buffer->pixel_format->bpp;
@@ -2750,6 +3750,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 
 		gl_format[0] = buffer->pixel_format->gl_format;
 		gl_pixel_type = buffer->pixel_format->gl_type;
+		texel_size[0] = bpp / 8;
 	}
 
 	for (i = 0; i < ARRAY_LENGTH(gb->gl_format); i++) {
@@ -2788,6 +3789,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	    buffer->pixel_format == old_buffer->pixel_format) {
 		gs->buffer->pitch = pitch;
 		memcpy(gs->buffer->offset, offset, sizeof(offset));
+		memcpy(gs->buffer->texel_size, texel_size, sizeof(texel_size));
 		return;
 	}
 
@@ -2804,6 +3806,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	gb->pitch = pitch;
 	gb->shader_variant = shader_variant;
 	ARRAY_COPY(gb->offset, offset);
+	ARRAY_COPY(gb->texel_size, texel_size);
 	ARRAY_COPY(gb->gl_format, gl_format);
 	gb->gl_channel_order = buffer->pixel_format->gl_channel_order;
 	gb->gl_pixel_type = gl_pixel_type;
@@ -2812,7 +3815,19 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	gs->buffer = gb;
 	gs->surface = es;
 
+	/* Small buffers of the most common formats share textures. */
+	if (gr->shm_atlas && !yuv &&
+	    gl_format[0] == GL_BGRA_EXT && gl_pixel_type == GL_UNSIGNED_BYTE &&
+	    gl_atlas_alloc(gr->shm_atlas, buffer->width, buffer->height,
+			   &gb->atlas_slot)) {
+		gb->in_atlas = true;
+		gb->textures[0] = gb->atlas_slot.tex;
+		gb->num_textures = 1;
+		return;
+	}
+
 	ensure_textures(gb, GL_TEXTURE_2D, num_planes);
+	gl_buffer_state_alloc_storage(gb, buffer);
 }
 
 static bool
@@ -2933,6 +3948,123 @@ err_free:
 	return false;
 }
 
+static bool
+dmabuf_image_key_init(struct dmabuf_image_key *key,
+		      const struct dmabuf_attributes *attributes)
+{
+	struct stat st;
+	int i;
+
+	/* Zeroed as a whole, keys are compared with memcmp() */
+	memset(key, 0, sizeof(*key));
+	key->format = attributes->format;
+	key->flags = attributes->flags;
+	key->width = attributes->width;
+	key->height = attributes->height;
+	key->modifier = attributes->modifier;
+	key->n_planes = attributes->n_planes;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		if (fstat(attributes->fd[i], &st) < 0)
+			return false;
+
+		key->plane[i].dev = st.st_dev;
+		key->plane[i].ino = st.st_ino;
+		key->plane[i].offset = attributes->offset[i];
+		key->plane[i].stride = attributes->stride[i];
+	}
+
+	return true;
+}
+
+static void
+dmabuf_image_destroy(struct gl_renderer *gr, struct dmabuf_image *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->num_images; i++)
+		gr->destroy_image(gr->egl_display, entry->images[i]);
+
+	wl_list_remove(&entry->link);
+	gr->dmabuf_image_count--;
+	free(entry);
+}
+
+/* Take the images of a dma-buf buffer state before it is destroyed, and
+ * evict the least recently cached entry when the cache is full. */
+static void
+dmabuf_image_cache_add(struct gl_renderer *gr, struct gl_buffer_state *gb,
+		       const struct dmabuf_attributes *attributes)
+{
+	struct dmabuf_image *entry;
+	int i;
+
+	if (gb->num_images == 0)
+		return;
+
+	entry = xzalloc(sizeof(*entry));
+	if (!dmabuf_image_key_init(&entry->key, attributes)) {
+		free(entry);
+		return;
+	}
+
+	for (i = 0; i < gb->num_images; i++) {
+		entry->images[i] = gb->images[i];
+		gb->images[i] = EGL_NO_IMAGE_KHR;
+	}
+	entry->num_images = gb->num_images;
+	entry->shader_variant = gb->shader_variant;
+	gb->num_images = 0;
+
+	wl_list_insert(&gr->dmabuf_images, &entry->link);
+	gr->dmabuf_image_count++;
+
+	if (gr->dmabuf_image_count > DMABUF_IMAGE_CACHE_SIZE) {
+		entry = wl_container_of(gr->dmabuf_images.prev, entry, link);
+		dmabuf_image_destroy(gr, entry);
+		weston_metric_inc(gr->compositor,
+				  WESTON_METRIC_GL_DMABUF_IMAGE_EVICTIONS);
+	}
+}
+
+/* Hand the cached images for the given dma-buf over to a new buffer
+ * state. */
+static bool
+dmabuf_image_cache_take(struct gl_renderer *gr, struct gl_buffer_state *gb,
+			const struct dmabuf_attributes *attributes)
+{
+	struct dmabuf_image_key key;
+	struct dmabuf_image *entry;
+	int i;
+
+	if (wl_list_empty(&gr->dmabuf_images) ||
+	    !dmabuf_image_key_init(&key, attributes))
+		goto miss;
+
+	wl_list_for_each(entry, &gr->dmabuf_images, link) {
+		if (memcmp(&entry->key, &key, sizeof(key)) != 0)
+			continue;
+
+		for (i = 0; i < entry->num_images; i++)
+			gb->images[i] = entry->images[i];
+		gb->num_images = entry->num_images;
+		gb->shader_variant = entry->shader_variant;
+		ensure_textures(gb,
+				gl_shader_texture_variant_get_target(gb->shader_variant),
+				gb->num_images);
+
+		entry->num_images = 0;
+		dmabuf_image_destroy(gr, entry);
+		weston_metric_inc(gr->compositor,
+				  WESTON_METRIC_GL_DMABUF_IMAGE_HITS);
+		return true;
+	}
+
+miss:
+	weston_metric_inc(gr->compositor, WESTON_METRIC_GL_DMABUF_IMAGE_MISSES);
+	return false;
+}
+
 static void
 gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
 {
@@ -2940,6 +4072,7 @@ gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
 		linux_dmabuf_buffer_get_user_data(dmabuf);
 
 	linux_dmabuf_buffer_set_user_data(dmabuf, NULL, NULL);
+	dmabuf_image_cache_add(gb->gr, gb, &dmabuf->attributes);
 	destroy_buffer_state(gb);
 }
 
@@ -3236,6 +4369,9 @@ import_dmabuf(struct gl_renderer *gr,
 	pixman_region32_init(&gb->texture_damage);
 	wl_list_init(&gb->destroy_listener.link);
 
+	if (dmabuf_image_cache_take(gr, gb, &dmabuf->attributes))
+		return gb;
+
 	egl_image = import_simple_dmabuf(gr, &dmabuf->attributes);
 	if (egl_image != EGL_NO_IMAGE_KHR) {
 		GLenum target = choose_texture_target(gr, &dmabuf->attributes);
@@ -3683,10 +4819,12 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	struct gl_buffer_state *gb;
 	struct weston_buffer *buffer;
 	int cw, ch;
+	GLfloat texcoords[4 * 2];
 	GLuint fbo;
 	GLuint tex;
 	GLenum status;
 	int ret = -1;
+	int i;
 
 	gs = get_surface_state(surface);
 	gb = gs->buffer;
@@ -3739,12 +4877,31 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	if (!gl_renderer_use_program(gr, &sconf))
 		goto out;
 
+	ARRAY_COPY(texcoords, verts);
+	if (gb->in_atlas) {
+		const struct gl_atlas_slot *slot = &gb->atlas_slot;
+		struct weston_matrix m;
+
+		weston_matrix_init(&m);
+		weston_matrix_scale(&m, slot->width, slot->height, 1);
+		gl_atlas_slot_transform(slot, &m);
+		for (i = 0; i < 4; i++) {
+			struct weston_vector v = {{
+				verts[i * 2], verts[i * 2 + 1], 0.0f, 1.0f
+			}};
+
+			weston_matrix_transform(&m, &v);
+			texcoords[i * 2] = v.f[0];
+			texcoords[i * 2 + 1] = v.f[1];
+		}
+	}
+
 	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
 	glEnableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
 	glVertexAttribPointer(SHADER_ATTRIB_LOC_POSITION, 2, GL_FLOAT, GL_FALSE,
 			      0, verts);
 	glVertexAttribPointer(SHADER_ATTRIB_LOC_TEXCOORD, 2, GL_FLOAT, GL_FALSE,
-			      0, verts);
+			      0, texcoords);
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_TEXCOORD);
 	glDisableVertexAttribArray(SHADER_ATTRIB_LOC_POSITION);
@@ -4030,6 +5187,7 @@ gl_renderer_output_create(struct weston_output *output,
 	struct gl_output_state *go;
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	const struct weston_testsuite_quirks *quirks;
+	int i;
 
 	quirks = &output->compositor->test_data.test_quirks;
 
@@ -4040,10 +5198,15 @@ gl_renderer_output_create(struct weston_output *output,
 	go->egl_surface = surface;
 	go->y_flip = surface == EGL_NO_SURFACE ? 1.0f : -1.0f;
 
-	if (gr->has_disjoint_timer_query)
-		gr->gen_queries(1, &go->render_query);
+	if (gr->has_disjoint_timer_query) {
+		for (i = 0; i < GL_RENDER_QUERY_RING; i++) {
+			struct gl_render_query *query = &go->render_queries[i];
 
-	wl_list_init(&go->timeline_render_point_list);
+			gr->gen_queries(1, &query->elapsed);
+			if (gr->has_timestamp_query)
+				gr->gen_queries(1, &query->timestamp);
+		}
+	}
 
 	go->render_sync = EGL_NO_SYNC_KHR;
 
@@ -4057,6 +5220,7 @@ gl_renderer_output_create(struct weston_output *output,
 	}
 
 	wl_list_init(&go->renderbuffer_list);
+	pixman_region32_init(&go->shadow_stale);
 
 	output->renderer_state = go;
 
@@ -4064,6 +5228,7 @@ gl_renderer_output_create(struct weston_output *output,
 		weston_log("Output %s failed to create 16F shadow.\n",
 			   output->name);
 		output->renderer_state = NULL;
+		pixman_region32_fini(&go->shadow_stale);
 		free(go);
 		return -1;
 	}
@@ -4287,7 +5452,7 @@ gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
-	struct timeline_render_point *trp, *tmp;
+	int i;
 
 	if (shadow_exists(go))
 		gl_fbo_texture_fini(&go->shadow);
@@ -4297,21 +5462,26 @@ gl_renderer_output_destroy(struct weston_output *output)
 
 	weston_platform_destroy_egl_surface(gr->egl_display, go->egl_surface);
 
-	if (!wl_list_empty(&go->timeline_render_point_list))
-		weston_log("warning: discarding pending timeline render"
-			   "objects at output destruction");
+	if (go->program_retry_source)
+		wl_event_source_remove(go->program_retry_source);
 
-	if (gr->has_disjoint_timer_query)
-		gr->delete_queries(1, &go->render_query);
+	/* Results still in flight are dropped along with their queries. */
+	if (gr->has_disjoint_timer_query) {
+		for (i = 0; i < GL_RENDER_QUERY_RING; i++) {
+			struct gl_render_query *query = &go->render_queries[i];
 
-	wl_list_for_each_safe(trp, tmp, &go->timeline_render_point_list, link)
-		timeline_render_point_destroy(trp);
+			gr->delete_queries(1, &query->elapsed);
+			if (gr->has_timestamp_query)
+				gr->delete_queries(1, &query->timestamp);
+		}
+	}
 
 	if (go->render_sync != EGL_NO_SYNC_KHR)
 		gr->destroy_sync(gr->egl_display, go->render_sync);
 
 	gl_renderer_remove_renderbuffers(go);
 
+	pixman_region32_fini(&go->shadow_stale);
 	free(go);
 }
 
@@ -4374,6 +5544,7 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	struct dmabuf_format *format, *next_format;
+	struct dmabuf_image *image, *next_image;
 	struct gl_capture_task *gl_task, *tmp;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
@@ -4384,13 +5555,27 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_list_for_each_safe(gl_task, tmp, &gr->pending_capture_list, link)
 		destroy_capture_task(gl_task);
 
+	weston_idle_task_destroy(gr->idle_task);
+
 	gl_renderer_shader_list_destroy(gr);
 	if (gr->fallback_shader)
 		gl_shader_destroy(gr, gr->fallback_shader);
+	hash_table_destroy(gr->shader_table);
+	gl_program_cache_destroy(gr->program_cache);
+	gl_atlas_destroy(gr->shm_atlas);
+	gl_color_lut_list_release(gr);
 
 	if (gr->wireframe_size)
 		glDeleteTextures(1, &gr->wireframe_tex);
 
+	if (gr->upload_pbo)
+		glDeleteBuffers(1, &gr->upload_pbo);
+
+	if (gr->stream_vbo) {
+		glDeleteBuffers(1, &gr->stream_vbo);
+		glDeleteBuffers(1, &gr->stream_ibo);
+	}
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -4399,6 +5584,9 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_list_for_each_safe(format, next_format, &gr->dmabuf_formats, link)
 		dmabuf_format_destroy(format);
 
+	wl_list_for_each_safe(image, next_image, &gr->dmabuf_images, link)
+		dmabuf_image_destroy(gr, image);
+
 	weston_drm_format_array_fini(&gr->supported_formats);
 
 	gl_renderer_allocator_destroy(gr->allocator);
@@ -4409,6 +5597,10 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_array_release(&gr->position_stream);
 	wl_array_release(&gr->barycentric_stream);
 	wl_array_release(&gr->indices);
+	wl_array_release(&gr->band_rects);
+	wl_array_release(&gr->band_open);
+	wl_array_release(&gr->damage_quads);
+	wl_array_release(&gr->egl_rects);
 
 	if (gr->debug_mode_binding)
 		weston_binding_destroy(gr->debug_mode_binding);
@@ -4466,6 +5658,10 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	wl_list_init(&gr->shader_list);
 	gr->platform = options->egl_platform;
 
+	gr->shader_table = hash_table_create();
+	if (!gr->shader_table)
+		goto fail;
+
 	gr->renderer_scope = weston_compositor_add_log_scope(ec, "gl-renderer",
 		"GL-renderer verbose messages\n", NULL, NULL, gr);
 	if (!gr->renderer_scope)
@@ -4482,6 +5678,7 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.resize_output = gl_renderer_resize_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
+	gr->base.shm_buffer_is_copied = gl_renderer_shm_buffer_is_copied;
 	gr->base.attach = gl_renderer_attach;
 	gr->base.destroy = gl_renderer_destroy;
 	gr->base.surface_copy_content = gl_renderer_surface_copy_content;
@@ -4555,6 +5752,7 @@ gl_renderer_display_create(struct weston_compositor *ec,
 		}
 	}
 	wl_list_init(&gr->dmabuf_formats);
+	wl_list_init(&gr->dmabuf_images);
 
 	wl_signal_init(&gr->destroy_signal);
 
@@ -4613,6 +5811,7 @@ fail_terminate:
 	weston_drm_format_array_fini(&gr->supported_formats);
 	eglTerminate(gr->egl_display);
 fail:
+	hash_table_destroy(gr->shader_table);
 	weston_log_scope_destroy(gr->shader_scope);
 	weston_log_scope_destroy(gr->renderer_scope);
 	free(gr);
@@ -4620,6 +5819,20 @@ fail:
 	return -1;
 }
 
+/* Nothing is being drawn, drop what only speeds up the next frames: the
+ * EGLImages of dma-bufs that are gone and the rarely used programs. */
+static void
+gl_renderer_idle_trim(struct weston_compositor *ec, void *data)
+{
+	struct gl_renderer *gr = data;
+	struct dmabuf_image *image, *next_image;
+
+	wl_list_for_each_safe(image, next_image, &gr->dmabuf_images, link)
+		dmabuf_image_destroy(gr, image);
+
+	gl_renderer_trim_programs(gr);
+}
+
 static void
 debug_mode_binding(struct weston_keyboard *keyboard,
 		   const struct timespec *time,
@@ -4658,6 +5871,40 @@ get_gl_version(void)
 	return gr_gl_version(2, 0);
 }
 
+/* Try an OpenGL ES 3 context first, then fall back to OpenGL ES 2 */
+static EGLContext
+gl_renderer_create_context(struct gl_renderer *gr, EGLint *context_attribs)
+{
+	EGLContext context;
+
+	context_attribs[1] = 3;
+	context = eglCreateContext(gr->egl_display, gr->egl_config,
+				   EGL_NO_CONTEXT, context_attribs);
+	if (context != NULL)
+		return context;
+
+	context_attribs[1] = 2;
+	return eglCreateContext(gr->egl_display, gr->egl_config,
+				EGL_NO_CONTEXT, context_attribs);
+}
+
+static const char *
+context_priority_name(EGLint priority)
+{
+	switch (priority) {
+	case EGL_CONTEXT_PRIORITY_REALTIME_NV:
+		return "realtime";
+	case EGL_CONTEXT_PRIORITY_HIGH_IMG:
+		return "high";
+	case EGL_CONTEXT_PRIORITY_MEDIUM_IMG:
+		return "medium";
+	case EGL_CONTEXT_PRIORITY_LOW_IMG:
+		return "low";
+	}
+
+	return "unknown";
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec)
 {
@@ -4669,6 +5916,7 @@ gl_renderer_setup(struct weston_compositor *ec)
 		EGL_CONTEXT_CLIENT_VERSION, 0,
 	};
 	unsigned int nattr = 2;
+	unsigned int priority_attr = 0;
 
 	if (!eglBindAPI(EGL_OPENGL_ES_API)) {
 		weston_log("failed to bind EGL_OPENGL_ES_API\n");
@@ -4682,31 +5930,33 @@ gl_renderer_setup(struct weston_compositor *ec)
 	 * reschedule all of our rendering and its dependencies to be completed
 	 * first. If the driver doesn't permit us to create a high priority
 	 * context, it will fallback to the default priority (MEDIUM).
+	 * When the compositor opted into realtime scheduling, ask for a
+	 * realtime context, which drivers may refuse outright.
 	 */
 	if (gr->has_context_priority) {
 		context_attribs[nattr++] = EGL_CONTEXT_PRIORITY_LEVEL_IMG;
-		context_attribs[nattr++] = EGL_CONTEXT_PRIORITY_HIGH_IMG;
+		priority_attr = nattr;
+		context_attribs[nattr++] =
+			gr->has_context_priority_realtime &&
+			ec->realtime_priority ?
+			EGL_CONTEXT_PRIORITY_REALTIME_NV :
+			EGL_CONTEXT_PRIORITY_HIGH_IMG;
 	}
 
 	assert(nattr < ARRAY_LENGTH(context_attribs));
 	context_attribs[nattr] = EGL_NONE;
 
-	/* try to create an OpenGLES 3 context first */
-	context_attribs[1] = 3;
-	gr->egl_context = eglCreateContext(gr->egl_display, gr->egl_config,
-					   EGL_NO_CONTEXT, context_attribs);
+	gr->egl_context = gl_renderer_create_context(gr, context_attribs);
+	if (gr->egl_context == NULL && priority_attr &&
+	    context_attribs[priority_attr] == EGL_CONTEXT_PRIORITY_REALTIME_NV) {
+		context_attribs[priority_attr] = EGL_CONTEXT_PRIORITY_HIGH_IMG;
+		gr->egl_context = gl_renderer_create_context(gr,
+							     context_attribs);
+	}
 	if (gr->egl_context == NULL) {
-		/* and then fallback to OpenGLES 2 */
-		context_attribs[1] = 2;
-		gr->egl_context = eglCreateContext(gr->egl_display,
-						   gr->egl_config,
-						   EGL_NO_CONTEXT,
-						   context_attribs);
-		if (gr->egl_context == NULL) {
-			weston_log("failed to create context\n");
-			gl_renderer_print_egl_error_state();
-			return -1;
-		}
+		weston_log("failed to create context\n");
+		gl_renderer_print_egl_error_state();
+		return -1;
 	}
 
 	if (gr->has_context_priority) {
@@ -4715,10 +5965,10 @@ gl_renderer_setup(struct weston_compositor *ec)
 		eglQueryContext(gr->egl_display, gr->egl_context,
 				EGL_CONTEXT_PRIORITY_LEVEL_IMG, &value);
 
-		if (value != EGL_CONTEXT_PRIORITY_HIGH_IMG) {
-			weston_log("Failed to obtain a high priority context.\n");
-			/* Not an error, continue on as normal */
-		}
+		/* Not an error if lower than asked, continue on as normal */
+		weston_log("GL context priority: %s (asked for %s)\n",
+			   context_priority_name(value),
+			   context_priority_name(context_attribs[priority_attr]));
 	}
 
 	ret = eglMakeCurrent(gr->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -4767,9 +6017,16 @@ gl_renderer_setup(struct weston_compositor *ec)
 	if (weston_check_egl_extension(extensions, "GL_EXT_texture_norm16"))
 		gr->has_texture_norm16 = true;
 
-	if (gr->gl_version >= gr_gl_version(3, 0) ||
-	    weston_check_egl_extension(extensions, "GL_EXT_texture_storage"))
+	if (gr->gl_version >= gr_gl_version(3, 0)) {
 		gr->has_texture_storage = true;
+		gr->tex_storage_2d =
+			(void *) eglGetProcAddress("glTexStorage2D");
+	} else if (weston_check_egl_extension(extensions,
+					      "GL_EXT_texture_storage")) {
+		gr->has_texture_storage = true;
+		gr->tex_storage_2d =
+			(void *) eglGetProcAddress("glTexStorage2DEXT");
+	}
 
 	if (weston_check_egl_extension(extensions, "GL_ANGLE_pack_reverse_row_order"))
 		gr->has_pack_reverse = true;
@@ -4792,6 +6049,7 @@ gl_renderer_setup(struct weston_compositor *ec)
 		assert(gr->unmap_buffer);
 		gr->pbo_usage = GL_STREAM_READ;
 		gr->has_pbo = true;
+		gr->has_pbo_upload = true;
 	} else if (gr->gl_version >= gr_gl_version(2, 0) &&
 		   weston_check_egl_extension(extensions, "GL_NV_pixel_buffer_object") &&
 		   weston_check_egl_extension(extensions, "GL_EXT_map_buffer_range") &&
@@ -4813,7 +6071,22 @@ gl_renderer_setup(struct weston_compositor *ec)
 		gr->has_pbo = true;
 	}
 
+	if (weston_check_egl_extension(extensions, "GL_OES_get_program_binary"))
+		gr->has_program_binary = true;
+
+	if (weston_check_egl_extension(extensions,
+				       "GL_KHR_parallel_shader_compile")) {
+		void (*max_compiler_threads)(GLuint count) =
+			(void *) eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+
+		/* Let the implementation pick the number of threads. */
+		if (max_compiler_threads)
+			max_compiler_threads(0xffffffff);
+		gr->has_parallel_shader_compile = true;
+	}
+
 	wl_list_init(&gr->pending_capture_list);
+	wl_list_init(&gr->color_lut_list);
 
 	if (gr->gl_version >= gr_gl_version(3, 0) &&
 	    weston_check_egl_extension(extensions, "GL_OES_texture_float_linear") &&
@@ -4828,6 +6101,7 @@ gl_renderer_setup(struct weston_compositor *ec)
 		PFNGLGETQUERYIVEXTPROC get_query_iv =
 			(void *) eglGetProcAddress("glGetQueryivEXT");
 		int elapsed_bits;
+		int timestamp_bits;
 
 		assert(get_query_iv);
 		get_query_iv(GL_TIME_ELAPSED_EXT, GL_QUERY_COUNTER_BITS_EXT,
@@ -4839,10 +6113,8 @@ gl_renderer_setup(struct weston_compositor *ec)
 				(void *) eglGetProcAddress("glDeleteQueriesEXT");
 			gr->begin_query = (void *) eglGetProcAddress("glBeginQueryEXT");
 			gr->end_query = (void *) eglGetProcAddress("glEndQueryEXT");
-#if !defined(NDEBUG)
 			gr->get_query_object_iv =
 				(void *) eglGetProcAddress("glGetQueryObjectivEXT");
-#endif
 			gr->get_query_object_ui64v =
 				(void *) eglGetProcAddress("glGetQueryObjectui64vEXT");
 			assert(gr->gen_queries);
@@ -4852,29 +6124,59 @@ gl_renderer_setup(struct weston_compositor *ec)
 			assert(gr->get_query_object_iv);
 			assert(gr->get_query_object_ui64v);
 			gr->has_disjoint_timer_query = true;
+
+			get_query_iv(GL_TIMESTAMP_EXT,
+				     GL_QUERY_COUNTER_BITS_EXT,
+				     &timestamp_bits);
+			if (timestamp_bits != 0) {
+				gr->query_counter = (void *)
+					eglGetProcAddress("glQueryCounterEXT");
+				gr->get_integer64v = (void *)
+					eglGetProcAddress("glGetInteger64vEXT");
+				assert(gr->query_counter);
+				assert(gr->get_integer64v);
+				gr->has_timestamp_query = true;
+			} else {
+				weston_log("warning: Disabling render GPU "
+					   "timeline due to lack of support "
+					   "for timestamp counters by the "
+					   "GL_EXT_disjoint_timer_query "
+					   "extension\n");
+			}
 		} else {
 			weston_log("warning: Disabling render GPU timeline due "
 				   "to lack of support for elapsed counters by "
 				   "the GL_EXT_disjoint_timer_query "
 				   "extension\n");
 		}
-	} else if (gr->has_native_fence_sync)  {
+	} else {
 		weston_log("warning: Disabling render GPU timeline due to "
 			   "missing GL_EXT_disjoint_timer_query extension\n");
 	}
 
 	glActiveTexture(GL_TEXTURE0);
 
+	gl_renderer_program_cache_init(gr);
+
+	if (ec->gl_shm_atlas)
+		gr->shm_atlas = gl_atlas_create();
+
 	gr->fallback_shader = gl_renderer_create_fallback_shader(gr);
 	if (!gr->fallback_shader) {
 		weston_log("Error: compiling fallback shader failed.\n");
 		return -1;
 	}
 
+	gl_renderer_prewarm_programs(gr);
+
 	gr->debug_mode_binding =
 		weston_compositor_add_debug_binding(ec, KEY_M,
 						    debug_mode_binding, ec);
 
+	gr->idle_task = weston_compositor_add_idle_task(ec, "gl-renderer trim",
+							gl_renderer_idle_trim,
+							gr);
+
 	weston_log("GL ES %d.%d - renderer features:\n",
 		   gr_gl_version_major(gr->gl_version),
 		   gr_gl_version_minor(gr->gl_version));
@@ -4884,6 +6186,11 @@ gl_renderer_setup(struct weston_compositor *ec)
 			    yesno(gr->has_pack_reverse));
 	weston_log_continue(STAMP_SPACE "glReadPixels supports PBO: %s\n",
 			    yesno(gr->has_pbo));
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBO: %s\n",
+			    yesno(gr->has_pbo_upload &&
+				  ec->gl_shm_pbo_upload));
+	weston_log_continue(STAMP_SPACE "wl_shm texture atlas: %s\n",
+			    yesno(gr->shm_atlas != NULL));
 	weston_log_continue(STAMP_SPACE "wl_shm 10 bpc formats: %s\n",
 			    yesno(gr->has_texture_type_2_10_10_10_rev));
 	weston_log_continue(STAMP_SPACE "wl_shm 16 bpc formats: %s\n",
@@ -30,6 +30,8 @@
 #include <GLES2/gl2ext.h>
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <libweston/libweston.h>
@@ -38,12 +40,40 @@
 #include "gl-renderer-internal.h"
 
 #include "shared/weston-egl-ext.h"
+#include "shared/xalloc.h"
+
+/*
+ * LUT textures are shared by content: color transformations that need the
+ * same curve or 3D LUT, like the inverse EOTF of several outputs with the
+ * same profile, reference one texture. Lookups compare a hash first and
+ * then the kept copy of the LUT, since uploads are rare and a false match
+ * would show wrong colors.
+ */
+struct gl_color_lut {
+	struct wl_list link; /* gl_renderer::color_lut_list */
+	int refcount;
+
+	GLenum target;
+	GLint internal_format;
+	unsigned len;
+
+	uint64_t hash;
+	float *data;
+	size_t size;
+
+	GLuint tex;
+};
+
+/* 3D LUTs are interpolated between their sample points anyway, so half
+ * floats lose nothing visible there and halve the texture size. 1D curves
+ * often decode to linear light or feed a 3D LUT and keep full floats. */
+#define GL_COLOR_3D_LUT_FORMAT GL_RGB16F
 
 struct gl_renderer_color_curve {
 	enum gl_shader_color_curve type;
 	union {
 		struct {
-			GLuint tex;
+			struct gl_color_lut *lut;
 			float scale;
 			float offset;
 		} lut_3x1d;
@@ -58,7 +88,7 @@ struct gl_renderer_color_mapping {
 	enum gl_shader_color_mapping type;
 	union {
 		struct {
-			GLuint tex3d;
+			struct gl_color_lut *lut;
 			float scale;
 			float offset;
 		} lut3d;
@@ -74,6 +104,119 @@ struct gl_renderer_color_transform {
 	struct gl_renderer_color_curve post_curve;
 };
 
+static uint64_t
+gl_color_lut_hash(const float *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static void
+gl_color_lut_upload(struct gl_renderer *gr, struct gl_color_lut *lut)
+{
+	glGenTextures(1, &lut->tex);
+	glBindTexture(lut->target, lut->tex);
+	glTexParameteri(lut->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(lut->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(lut->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(lut->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	if (lut->target == GL_TEXTURE_3D) {
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R,
+				GL_CLAMP_TO_EDGE);
+		gr->tex_image_3d(GL_TEXTURE_3D, 0, lut->internal_format,
+				 lut->len, lut->len, lut->len, 0,
+				 GL_RGB, GL_FLOAT, lut->data);
+	} else {
+		/*
+		 * Four rows, see fragment.glsl sample_color_pre_curve_lut_2d().
+		 * The fourth row is unused in fragment.glsl color_pre_curve().
+		 * Four rows, see fragment.glsl sample_color_post_curve_lut_2d().
+		 * The fourth row is unused in fragment.glsl color_post_curve().
+		 */
+		glTexImage2D(GL_TEXTURE_2D, 0, lut->internal_format,
+			     lut->len, 4, 0, GL_RED_EXT, GL_FLOAT, lut->data);
+	}
+
+	glBindTexture(lut->target, 0);
+}
+
+/** Get a texture holding the given LUT
+ *
+ * \param data The LUT, ownership is taken.
+ * \param size Size of data in bytes.
+ * \return A reference to release with gl_color_lut_unref().
+ */
+static struct gl_color_lut *
+gl_color_lut_get(struct gl_renderer *gr, GLenum target, GLint internal_format,
+		 unsigned len, float *data, size_t size)
+{
+	struct gl_color_lut *lut;
+	uint64_t hash = gl_color_lut_hash(data, size);
+
+	wl_list_for_each(lut, &gr->color_lut_list, link) {
+		if (lut->hash != hash || lut->target != target ||
+		    lut->internal_format != internal_format ||
+		    lut->len != len || lut->size != size ||
+		    memcmp(lut->data, data, size) != 0)
+			continue;
+
+		free(data);
+		lut->refcount++;
+		return lut;
+	}
+
+	lut = xzalloc(sizeof *lut);
+	lut->refcount = 1;
+	lut->target = target;
+	lut->internal_format = internal_format;
+	lut->len = len;
+	lut->hash = hash;
+	lut->data = data;
+	lut->size = size;
+	gl_color_lut_upload(gr, lut);
+	wl_list_insert(&gr->color_lut_list, &lut->link);
+
+	return lut;
+}
+
+static void
+gl_color_lut_unref(struct gl_color_lut *lut)
+{
+	if (!lut || --lut->refcount > 0)
+		return;
+
+	glDeleteTextures(1, &lut->tex);
+	wl_list_remove(&lut->link);
+	free(lut->data);
+	free(lut);
+}
+
+/** Forget the shared LUTs when the renderer goes away
+ *
+ * Color transformations still holding a LUT release it later without
+ * touching the renderer.
+ */
+void
+gl_color_lut_list_release(struct gl_renderer *gr)
+{
+	struct gl_color_lut *lut, *tmp;
+
+	wl_list_for_each_safe(lut, tmp, &gr->color_lut_list, link) {
+		wl_list_remove(&lut->link);
+		wl_list_init(&lut->link);
+	}
+}
+
 static void
 gl_renderer_color_curve_fini(struct gl_renderer_color_curve *gl_curve)
 {
@@ -83,7 +226,7 @@ gl_renderer_color_curve_fini(struct gl_renderer_color_curve *gl_curve)
 	case SHADER_COLOR_CURVE_POWLIN:
 		break;
 	case SHADER_COLOR_CURVE_LUT_3x1D:
-		glDeleteTextures(1, &gl_curve->u.lut_3x1d.tex);
+		gl_color_lut_unref(gl_curve->u.lut_3x1d.lut);
 		break;
 	};
 }
@@ -91,9 +234,8 @@ gl_renderer_color_curve_fini(struct gl_renderer_color_curve *gl_curve)
 static void
 gl_renderer_color_mapping_fini(struct gl_renderer_color_mapping *gl_mapping)
 {
-	if (gl_mapping->type == SHADER_COLOR_MAPPING_3DLUT &&
-	    gl_mapping->lut3d.tex3d)
-		glDeleteTextures(1, &gl_mapping->lut3d.tex3d);
+	if (gl_mapping->type == SHADER_COLOR_MAPPING_3DLUT)
+		gl_color_lut_unref(gl_mapping->lut3d.lut);
 }
 
 static void
@@ -186,35 +328,18 @@ gl_color_curve_lut_3x1d(struct gl_renderer *gr,
 {
 	const unsigned lut_len = curve->u.lut_3x1d.optimal_len;
 	const unsigned nr_rows = 4;
-	GLuint tex;
+	size_t size = lut_len * nr_rows * sizeof(float);
 	float *lut;
 
-	/*
-	 * Four rows, see fragment.glsl sample_color_pre_curve_lut_2d().
-	 * The fourth row is unused in fragment.glsl color_pre_curve().
-	 * Four rows, see fragment.glsl sample_color_post_curve_lut_2d().
-	 * The fourth row is unused in fragment.glsl color_post_curve().
-	 */
 	lut = calloc(lut_len * nr_rows, sizeof *lut);
 	if (!lut)
 		return false;
 
 	curve->u.lut_3x1d.fill_in(xform, lut, lut_len);
 
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, lut_len, nr_rows, 0,
-		     GL_RED_EXT, GL_FLOAT, lut);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	free(lut);
-
 	gl_curve->type = SHADER_COLOR_CURVE_LUT_3x1D;
-	gl_curve->u.lut_3x1d.tex = tex;
+	gl_curve->u.lut_3x1d.lut = gl_color_lut_get(gr, GL_TEXTURE_2D, GL_R32F,
+						    lut_len, lut, size);
 	gl_curve->u.lut_3x1d.scale = (float)(lut_len - 1) / lut_len;
 	gl_curve->u.lut_3x1d.offset = 0.5f / lut_len;
 
@@ -226,39 +351,100 @@ gl_3d_lut(struct gl_renderer *gr,
 	  struct gl_renderer_color_transform *gl_xform,
 	  struct weston_color_transform *xform)
 {
-
-	GLuint tex3d;
-	float *lut;
 	const unsigned dim_size = xform->mapping.u.lut3d.optimal_len;
+	size_t nmemb = 3 * dim_size * dim_size * dim_size;
+	float *lut;
 
-	lut = calloc(3 * dim_size * dim_size * dim_size, sizeof *lut);
+	lut = calloc(nmemb, sizeof *lut);
 	if (!lut)
 		return false;
 
 	xform->mapping.u.lut3d.fill_in(xform, lut, dim_size);
 
-	glGenTextures(1, &tex3d);
-	glBindTexture(GL_TEXTURE_3D, tex3d);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	gr->tex_image_3d(GL_TEXTURE_3D, 0, GL_RGB32F, dim_size, dim_size, dim_size, 0,
-			 GL_RGB, GL_FLOAT, lut);
-
-	glBindTexture(GL_TEXTURE_3D, 0);
 	gl_xform->mapping.type = SHADER_COLOR_MAPPING_3DLUT;
-	gl_xform->mapping.lut3d.tex3d = tex3d;
+	gl_xform->mapping.lut3d.lut =
+		gl_color_lut_get(gr, GL_TEXTURE_3D,
+				 GL_COLOR_3D_LUT_FORMAT, dim_size,
+				 lut, nmemb * sizeof *lut);
 	gl_xform->mapping.lut3d.scale = (float)(dim_size - 1) / dim_size;
 	gl_xform->mapping.lut3d.offset = 0.5f / dim_size;
 
-	free(lut);
-
 	return true;
 }
 
 
+static bool
+color_curve_is_parametric(const struct weston_color_curve *curve)
+{
+	return curve->type == WESTON_COLOR_CURVE_TYPE_LINPOW ||
+	       curve->type == WESTON_COLOR_CURVE_TYPE_POWLIN;
+}
+
+/* Baking pays off when the shader would evaluate more than a single
+ * step, or a parametric curve with its pow() per channel. A LUT cannot
+ * represent input outside of [0, 1], so curves that extend the range by
+ * mirroring are left to the shader. */
+static bool
+color_transform_should_bake(struct gl_renderer *gr,
+			    const struct weston_color_transform *xform)
+{
+	unsigned len = gr->compositor->gl_color_lut_bake_size;
+	int steps = 0;
+
+	if (len < 2 || len > 256)
+		return false;
+
+	if (color_curve_is_parametric(&xform->pre_curve) &&
+	    !xform->pre_curve.u.parametric.clamped_input)
+		return false;
+
+	if (xform->pre_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY)
+		steps++;
+	if (xform->mapping.type != WESTON_COLOR_MAPPING_TYPE_IDENTITY)
+		steps++;
+	if (xform->post_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY)
+		steps++;
+
+	return steps > 1 ||
+	       color_curve_is_parametric(&xform->pre_curve) ||
+	       color_curve_is_parametric(&xform->post_curve);
+}
+
+/* Evaluate the whole transform on the CPU into one 3D LUT, so that the
+ * shader only does a single trilinear sample. The result is cached with
+ * the weston_color_transform like the step-by-step form, and therefore
+ * shared by every surface using the same transform. */
+static bool
+gl_baked_3d_lut(struct gl_renderer *gr,
+		struct gl_renderer_color_transform *gl_xform,
+		struct weston_color_transform *xform)
+{
+	const unsigned len = gr->compositor->gl_color_lut_bake_size;
+	size_t nmemb = 3 * len * len * len;
+	float *lut;
+
+	lut = calloc(nmemb, sizeof *lut);
+	if (!lut)
+		return false;
+
+	if (!weston_color_transform_to_3dlut(xform, lut, len)) {
+		free(lut);
+		return false;
+	}
+
+	gl_xform->pre_curve.type = SHADER_COLOR_CURVE_IDENTITY;
+	gl_xform->mapping.type = SHADER_COLOR_MAPPING_3DLUT;
+	gl_xform->mapping.lut3d.lut =
+		gl_color_lut_get(gr, GL_TEXTURE_3D,
+				 GL_COLOR_3D_LUT_FORMAT, len,
+				 lut, nmemb * sizeof *lut);
+	gl_xform->mapping.lut3d.scale = (float)(len - 1) / len;
+	gl_xform->mapping.lut3d.offset = 0.5f / len;
+	gl_xform->post_curve.type = SHADER_COLOR_CURVE_IDENTITY;
+
+	return true;
+}
+
 static const struct gl_renderer_color_transform *
 gl_renderer_color_transform_from(struct gl_renderer *gr,
 				 struct weston_color_transform *xform)
@@ -286,6 +472,11 @@ gl_renderer_color_transform_from(struct gl_renderer *gr,
 	if (!gl_xform)
 		return NULL;
 
+	/* Fall back to the step-by-step form if baking fails. */
+	if (color_transform_should_bake(gr, xform) &&
+	    gl_baked_3d_lut(gr, gl_xform, xform))
+		return gl_xform;
+
 	switch (xform->pre_curve.type) {
 	case WESTON_COLOR_CURVE_TYPE_IDENTITY:
 		gl_xform->pre_curve = no_op_gl_xform.pre_curve;
@@ -371,7 +562,7 @@ gl_shader_config_set_color_transform(struct gl_renderer *gr,
 	case SHADER_COLOR_CURVE_IDENTITY:
 		break;
 	case SHADER_COLOR_CURVE_LUT_3x1D:
-		sconf->color_pre_curve.lut_3x1d.tex = gl_xform->pre_curve.u.lut_3x1d.tex;
+		sconf->color_pre_curve.lut_3x1d.tex = gl_xform->pre_curve.u.lut_3x1d.lut->tex;
 		sconf->color_pre_curve.lut_3x1d.scale_offset[0] = gl_xform->pre_curve.u.lut_3x1d.scale;
 		sconf->color_pre_curve.lut_3x1d.scale_offset[1] = gl_xform->pre_curve.u.lut_3x1d.offset;
 		break;
@@ -380,7 +571,7 @@ gl_shader_config_set_color_transform(struct gl_renderer *gr,
 		memcpy(sconf->color_pre_curve.parametric.params,
 		       gl_xform->pre_curve.u.parametric.params,
 		       sizeof(sconf->color_pre_curve.parametric.params));
-		sconf->color_pre_curve.parametric.clamped_input =
+		sconf->req.color_pre_curve_clamped =
 			gl_xform->pre_curve.u.parametric.clamped_input;
 		break;
 	}
@@ -390,7 +581,7 @@ gl_shader_config_set_color_transform(struct gl_renderer *gr,
 	case SHADER_COLOR_CURVE_IDENTITY:
 		break;
 	case SHADER_COLOR_CURVE_LUT_3x1D:
-		sconf->color_post_curve.lut_3x1d.tex = gl_xform->post_curve.u.lut_3x1d.tex;
+		sconf->color_post_curve.lut_3x1d.tex = gl_xform->post_curve.u.lut_3x1d.lut->tex;
 		sconf->color_post_curve.lut_3x1d.scale_offset[0] = gl_xform->post_curve.u.lut_3x1d.scale;
 		sconf->color_post_curve.lut_3x1d.scale_offset[1] = gl_xform->post_curve.u.lut_3x1d.offset;
 		break;
@@ -399,7 +590,7 @@ gl_shader_config_set_color_transform(struct gl_renderer *gr,
 		memcpy(&sconf->color_post_curve.parametric.params,
 		       &gl_xform->post_curve.u.parametric.params,
 		       sizeof(sconf->color_post_curve.parametric.params));
-		sconf->color_post_curve.parametric.clamped_input =
+		sconf->req.color_post_curve_clamped =
 			gl_xform->post_curve.u.parametric.clamped_input;
 		break;
 	}
@@ -407,7 +598,7 @@ gl_shader_config_set_color_transform(struct gl_renderer *gr,
 	sconf->req.color_mapping = gl_xform->mapping.type;
 	switch (gl_xform->mapping.type) {
 	case SHADER_COLOR_MAPPING_3DLUT:
-		sconf->color_mapping.lut3d.tex = gl_xform->mapping.lut3d.tex3d;
+		sconf->color_mapping.lut3d.tex = gl_xform->mapping.lut3d.lut->tex;
 		sconf->color_mapping.lut3d.scale_offset[0] =
 				gl_xform->mapping.lut3d.scale;
 		sconf->color_mapping.lut3d.scale_offset[1] =
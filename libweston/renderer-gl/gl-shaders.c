@@ -30,6 +30,7 @@
 
 #include "config.h"
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -43,7 +44,9 @@
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
 #include "pixel-formats.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
+#include "shared/string-helpers.h"
 #include "shared/timespec-util.h"
 
 /* static const char vertex_shader[]; vertex.glsl */
@@ -54,6 +57,8 @@
 
 struct gl_shader {
 	struct wl_list link; /* gl_renderer::shader_list */
+	bool in_shader_table; /* gl_renderer::shader_table */
+	bool linking; /* link in flight, see gl_renderer_program_pending() */
 	struct timespec last_used;
 	struct gl_shader_requirements key;
 	GLuint program;
@@ -72,7 +77,6 @@ struct gl_shader {
 		} lut_3x1d;
 		struct {
 			GLint params_uniform;
-			GLint clamped_input_uniform;
 		} parametric;
 	} color_pre_curve;
 	union {
@@ -89,7 +93,6 @@ struct gl_shader {
 		} lut_3x1d;
 		struct {
 			GLint params_uniform;
-			GLint clamped_input_uniform;
 		} parametric;
 	} color_post_curve;
 };
@@ -209,7 +212,7 @@ dump_program_with_line_numbers(int count, const char **sources)
 }
 
 static GLuint
-compile_shader(GLenum type, int count, const char **sources)
+compile_shader(GLenum type, int count, const char **sources, bool wait)
 {
 	GLuint s;
 	char msg[512];
@@ -218,6 +221,9 @@ compile_shader(GLenum type, int count, const char **sources)
 	s = glCreateShader(type);
 	glShaderSource(s, count, sources, NULL);
 	glCompileShader(s);
+	if (!wait)
+		return s;
+
 	glGetShaderiv(s, GL_COMPILE_STATUS, &status);
 	if (!status) {
 		glGetShaderInfoLog(s, sizeof msg, NULL, msg);
@@ -236,12 +242,14 @@ create_shader_description_string(const struct gl_shader_requirements *req)
 	int size;
 	char *str;
 
-	size = asprintf(&str, "%s %s %s %s %s %s %cinput_is_premult %ctint",
+	size = asprintf(&str, "%s %s %s%s %s %s%s %s %cinput_is_premult %ctint",
 			gl_shader_texcoord_input_to_string(req->texcoord_input),
 			gl_shader_texture_variant_to_string(req->variant),
 			gl_shader_color_curve_to_string(req->color_pre_curve),
+			req->color_pre_curve_clamped ? "(clamped)" : "",
 			gl_shader_color_mapping_to_string(req->color_mapping),
 			gl_shader_color_curve_to_string(req->color_post_curve),
+			req->color_post_curve_clamped ? "(clamped)" : "",
 			gl_shader_color_order_to_string(req->color_channel_order),
 			req->input_is_premult ? '+' : '-',
 			req->tint ? '+' : '-');
@@ -284,6 +292,8 @@ create_fragment_shader_config_string(const struct gl_shader_requirements *req)
 			"#define DEF_COLOR_PRE_CURVE %s\n"
 			"#define DEF_COLOR_MAPPING %s\n"
 			"#define DEF_COLOR_POST_CURVE %s\n"
+			"#define DEF_COLOR_PRE_CURVE_CLAMPED %s\n"
+			"#define DEF_COLOR_POST_CURVE_CLAMPED %s\n"
 			"#define DEF_COLOR_CHANNEL_ORDER %s\n"
 			"#define DEF_VARIANT %s\n",
 			req->tint ? "true" : "false",
@@ -292,6 +302,8 @@ create_fragment_shader_config_string(const struct gl_shader_requirements *req)
 			gl_shader_color_curve_to_string(req->color_pre_curve),
 			gl_shader_color_mapping_to_string(req->color_mapping),
 			gl_shader_color_curve_to_string(req->color_post_curve),
+			req->color_pre_curve_clamped ? "true" : "false",
+			req->color_post_curve_clamped ? "true" : "false",
 			gl_shader_color_order_to_string(req->color_channel_order),
 			gl_shader_texture_variant_to_string(req->variant));
 	if (size < 0)
@@ -299,48 +311,51 @@ create_fragment_shader_config_string(const struct gl_shader_requirements *req)
 	return str;
 }
 
-static struct gl_shader *
-gl_shader_create(struct gl_renderer *gr,
-		 const struct gl_shader_requirements *requirements)
+static int
+gl_shader_requirements_cmp(const struct gl_shader_requirements *a,
+			   const struct gl_shader_requirements *b)
 {
-	bool verbose = weston_log_scope_is_enabled(gr->shader_scope);
-	struct gl_shader *shader = NULL;
-	char msg[512];
-	GLint status;
-	const char *sources[3];
-	char *conf = NULL;
+	return memcmp(a, b, sizeof(*a));
+}
 
-	shader = zalloc(sizeof *shader);
-	if (!shader) {
-		weston_log("could not create shader\n");
-		goto error_vertex;
-	}
+/* The requirements are a packed bitfield, so they are their own hash. */
+static uint32_t
+gl_shader_requirements_hash(const struct gl_shader_requirements *req)
+{
+	uint32_t hash;
 
-	wl_list_init(&shader->link);
-	shader->key = *requirements;
+	static_assert(sizeof(*req) == sizeof(hash),
+		      "struct gl_shader_requirements must fit in a hash key");
+	memcpy(&hash, req, sizeof(hash));
 
-	if (verbose) {
-		char *desc;
+	return hash;
+}
 
-		desc = create_shader_description_string(requirements);
-		weston_log_scope_printf(gr->shader_scope,
-					"Compiling shader program for: %s\n",
-					desc);
-		free(desc);
-	}
+/* Compiles and links the program for shader->key. Without wait, the
+ * compile and link are only issued: the shaders are kept around and
+ * gl_shader_finish_link() checks the outcome once the driver is done. */
+static bool
+gl_shader_build_program(struct gl_shader *shader, bool wait)
+{
+	const struct gl_shader_requirements *requirements = &shader->key;
+	char msg[512];
+	GLint status;
+	const char *sources[3];
+	char *conf = NULL;
 
-	conf = create_vertex_shader_config_string(&shader->key);
+	conf = create_vertex_shader_config_string(requirements);
 	if (!conf)
-		goto error_vertex;
+		return false;
 
 	sources[0] = conf;
 	sources[1] = vertex_shader;
-	shader->vertex_shader = compile_shader(GL_VERTEX_SHADER, 2, sources);
+	shader->vertex_shader = compile_shader(GL_VERTEX_SHADER, 2, sources,
+					       wait);
 	if (shader->vertex_shader == GL_NONE)
 		goto error_vertex;
 
 	free(conf);
-	conf = create_fragment_shader_config_string(&shader->key);
+	conf = create_fragment_shader_config_string(requirements);
 	if (!conf)
 		goto error_fragment;
 
@@ -348,7 +363,7 @@ gl_shader_create(struct gl_renderer *gr,
 	sources[1] = conf;
 	sources[2] = fragment_shader;
 	shader->fragment_shader = compile_shader(GL_FRAGMENT_SHADER,
-						 3, sources);
+						 3, sources, wait);
 	if (shader->fragment_shader == GL_NONE)
 		goto error_fragment;
 
@@ -367,6 +382,11 @@ gl_shader_create(struct gl_renderer *gr,
 				     "barycentric");
 
 	glLinkProgram(shader->program);
+	if (!wait) {
+		free(conf);
+		return true;
+	}
+
 	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
 	if (!status) {
 		glGetProgramInfoLog(shader->program, sizeof msg, NULL, msg);
@@ -376,25 +396,63 @@ gl_shader_create(struct gl_renderer *gr,
 
 	glDeleteShader(shader->vertex_shader);
 	glDeleteShader(shader->fragment_shader);
+	free(conf);
+
+	return true;
+
+error_link:
+	glDeleteProgram(shader->program);
+	shader->program = GL_NONE;
+	glDeleteShader(shader->fragment_shader);
+
+error_fragment:
+	glDeleteShader(shader->vertex_shader);
+
+error_vertex:
+	free(conf);
+	return false;
+}
+
+/* Identifies the program in the on-disk program cache. The description
+ * string does not cover all requirement bits, hence the packed key. */
+static char *
+create_program_cache_key(const struct gl_shader_requirements *req)
+{
+	char *desc;
+	char *key = NULL;
 
+	desc = create_shader_description_string(req);
+	if (!desc)
+		return NULL;
+
+	str_printf(&key, "%08" PRIx32 " %s",
+		   gl_shader_requirements_hash(req), desc);
+	free(desc);
+
+	return key;
+}
+
+static void
+gl_shader_get_uniforms(struct gl_shader *shader)
+{
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->surface_to_buffer_uniform =
 		glGetUniformLocation(shader->program, "surface_to_buffer");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
 	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
-	if (requirements->wireframe)
+	if (shader->key.wireframe)
 		shader->tex_uniform_wireframe =
 			glGetUniformLocation(shader->program, "tex_wireframe");
 	shader->view_alpha_uniform = glGetUniformLocation(shader->program, "view_alpha");
-	if (requirements->variant == SHADER_VARIANT_SOLID) {
+	if (shader->key.variant == SHADER_VARIANT_SOLID) {
 		shader->color_uniform = glGetUniformLocation(shader->program,
 							     "unicolor");
 		assert(shader->color_uniform != -1);
 	} else {
 		shader->color_uniform = -1;
 	}
-	if (requirements->tint) {
+	if (shader->key.tint) {
 		shader->tint_uniform = glGetUniformLocation(shader->program,
 							    "tint");
 		assert(shader->tint_uniform != -1);
@@ -402,15 +460,13 @@ gl_shader_create(struct gl_renderer *gr,
 		shader->tint_uniform = -1;
 	}
 
-	switch(requirements->color_pre_curve) {
+	switch(shader->key.color_pre_curve) {
 	case SHADER_COLOR_CURVE_IDENTITY:
 		break;
 	case SHADER_COLOR_CURVE_LINPOW:
 	case SHADER_COLOR_CURVE_POWLIN:
 		shader->color_pre_curve.parametric.params_uniform =
 			glGetUniformLocation(shader->program, "color_pre_curve_params");
-		shader->color_pre_curve.parametric.clamped_input_uniform =
-			glGetUniformLocation(shader->program, "color_pre_curve_clamped_input");
 		break;
 	case SHADER_COLOR_CURVE_LUT_3x1D:
 		shader->color_pre_curve.lut_3x1d.tex_2d_uniform =
@@ -420,15 +476,13 @@ gl_shader_create(struct gl_renderer *gr,
 		break;
 	}
 
-	switch(requirements->color_post_curve) {
+	switch(shader->key.color_post_curve) {
 	case SHADER_COLOR_CURVE_IDENTITY:
 		break;
 	case SHADER_COLOR_CURVE_LINPOW:
 	case SHADER_COLOR_CURVE_POWLIN:
 		shader->color_post_curve.parametric.params_uniform =
 			glGetUniformLocation(shader->program, "color_post_curve_params");
-		shader->color_post_curve.parametric.clamped_input_uniform =
-			glGetUniformLocation(shader->program, "color_post_curve_clamped_input");
 		break;
 	case SHADER_COLOR_CURVE_LUT_3x1D:
 		shader->color_post_curve.lut_3x1d.tex_2d_uniform =
@@ -438,7 +492,7 @@ gl_shader_create(struct gl_renderer *gr,
 		break;
 	}
 
-	switch(requirements->color_mapping) {
+	switch(shader->key.color_mapping) {
 	case SHADER_COLOR_MAPPING_3DLUT:
 		shader->color_mapping.lut3d.tex_uniform =
 			glGetUniformLocation(shader->program,
@@ -455,25 +509,140 @@ gl_shader_create(struct gl_renderer *gr,
 	case SHADER_COLOR_MAPPING_IDENTITY:
 		break;
 	}
-	free(conf);
+}
+
+/* Stores the linked program in the on-disk program cache, if any. */
+static void
+gl_shader_store_program(struct gl_renderer *gr, struct gl_shader *shader)
+{
+	char *cache_key;
+
+	if (!gr->program_cache)
+		return;
+
+	cache_key = create_program_cache_key(&shader->key);
+	if (!cache_key)
+		return;
+
+	gl_program_cache_store(gr->program_cache, cache_key, shader->program);
+	free(cache_key);
+}
+
+/* Creates the program for requirements. With async, and if the driver
+ * supports GL_KHR_parallel_shader_compile, the program is returned still
+ * linking; it must go through gl_shader_finish_link() before use. */
+static struct gl_shader *
+gl_shader_create(struct gl_renderer *gr,
+		 const struct gl_shader_requirements *requirements,
+		 bool async)
+{
+	bool verbose = weston_log_scope_is_enabled(gr->shader_scope);
+	struct gl_shader *shader = NULL;
+	char *cache_key = NULL;
+
+	shader = zalloc(sizeof *shader);
+	if (!shader) {
+		weston_log("could not create shader\n");
+		return NULL;
+	}
+
+	wl_list_init(&shader->link);
+	shader->key = *requirements;
+
+	if (gr->program_cache) {
+		cache_key = create_program_cache_key(requirements);
+		if (cache_key)
+			shader->program =
+				gl_program_cache_load(gr->program_cache,
+						      cache_key);
+	}
+
+	if (verbose) {
+		char *desc;
+
+		desc = create_shader_description_string(requirements);
+		weston_log_scope_printf(gr->shader_scope,
+					"%s shader program for: %s\n",
+					shader->program != GL_NONE ?
+					"Loaded cached" : "Compiling",
+					desc);
+		free(desc);
+	}
+
+	if (shader->program == GL_NONE) {
+		async = async && gr->has_parallel_shader_compile;
+		if (!gl_shader_build_program(shader, !async))
+			goto error;
+
+		shader->linking = async;
+		if (!async)
+			gl_shader_store_program(gr, shader);
+	}
+
+	if (!shader->linking)
+		gl_shader_get_uniforms(shader);
+
+	if (hash_table_insert(gr->shader_table,
+			      gl_shader_requirements_hash(&shader->key),
+			      shader) < 0) {
+		weston_log("could not add shader to the program cache\n");
+		goto error_program;
+	}
+	shader->in_shader_table = true;
 
 	wl_list_insert(&gr->shader_list, &shader->link);
+	free(cache_key);
 
 	return shader;
 
-error_link:
+error_program:
+	if (shader->linking) {
+		glDeleteShader(shader->vertex_shader);
+		glDeleteShader(shader->fragment_shader);
+	}
 	glDeleteProgram(shader->program);
-	glDeleteShader(shader->fragment_shader);
 
-error_fragment:
-	glDeleteShader(shader->vertex_shader);
-
-error_vertex:
-	free(conf);
+error:
+	free(cache_key);
 	free(shader);
 	return NULL;
 }
 
+/* Checks the outcome of an asynchronous build, waiting for it if the
+ * driver is not done yet. On failure, the shader is destroyed. */
+static bool
+gl_shader_finish_link(struct gl_renderer *gr, struct gl_shader *shader)
+{
+	char msg[512];
+	GLint status;
+
+	assert(shader->linking);
+	shader->linking = false;
+
+	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glGetShaderInfoLog(shader->vertex_shader, sizeof msg, NULL, msg);
+		weston_log("vertex shader info: %s\n", msg);
+		glGetShaderInfoLog(shader->fragment_shader, sizeof msg, NULL, msg);
+		weston_log("fragment shader info: %s\n", msg);
+		glGetProgramInfoLog(shader->program, sizeof msg, NULL, msg);
+		weston_log("link info: %s\n", msg);
+	}
+
+	glDeleteShader(shader->vertex_shader);
+	glDeleteShader(shader->fragment_shader);
+
+	if (!status) {
+		gl_shader_destroy(gr, shader);
+		return false;
+	}
+
+	gl_shader_get_uniforms(shader);
+	gl_shader_store_program(gr, shader);
+
+	return true;
+}
+
 void
 gl_shader_destroy(struct gl_renderer *gr, struct gl_shader *shader)
 {
@@ -487,6 +656,14 @@ gl_shader_destroy(struct gl_renderer *gr, struct gl_shader *shader)
 		free(desc);
 	}
 
+	if (shader->in_shader_table)
+		hash_table_remove(gr->shader_table,
+				  gl_shader_requirements_hash(&shader->key));
+
+	if (shader->linking) {
+		glDeleteShader(shader->vertex_shader);
+		glDeleteShader(shader->fragment_shader);
+	}
 	glDeleteProgram(shader->program);
 	wl_list_remove(&shader->link);
 	free(shader);
@@ -501,13 +678,6 @@ gl_renderer_shader_list_destroy(struct gl_renderer *gr)
 		gl_shader_destroy(gr, shader);
 }
 
-static int
-gl_shader_requirements_cmp(const struct gl_shader_requirements *a,
-			   const struct gl_shader_requirements *b)
-{
-	return memcmp(a, b, sizeof(*a));
-}
-
 static void
 gl_shader_scope_new_subscription(struct weston_log_subscription *subs,
 				 void *data)
@@ -543,6 +713,11 @@ gl_shader_scope_new_subscription(struct weston_log_subscription *subs,
 					       msecs / 1000.0, desc);
 	}
 	weston_log_subscription_printf(subs, "Total: %d programs.\n", count);
+	weston_log_subscription_printf(subs,
+				       "Program lookups: %" PRIu64 " hits, "
+				       "%" PRIu64 " misses.\n",
+				       gr->shader_cache_hits,
+				       gr->shader_cache_misses);
 }
 
 struct weston_log_scope *
@@ -569,20 +744,106 @@ gl_renderer_create_fallback_shader(struct gl_renderer *gr)
 	};
 	struct gl_shader *shader;
 
-	shader = gl_shader_create(gr, &fallback_requirements);
+	shader = gl_shader_create(gr, &fallback_requirements, false);
 	if (!shader)
 		return NULL;
 
 	/*
-	 * This shader must be exempt from any automatic garbage collection.
-	 * It is destroyed explicitly.
+	 * This shader must be exempt from any automatic garbage collection
+	 * and lookups. It is destroyed explicitly.
 	 */
 	wl_list_remove(&shader->link);
 	wl_list_init(&shader->link);
+	hash_table_remove(gr->shader_table,
+			  gl_shader_requirements_hash(&shader->key));
+	shader->in_shader_table = false;
 
 	return shader;
 }
 
+/** Set up the on-disk program binary cache, if enabled and supported */
+void
+gl_renderer_program_cache_init(struct gl_renderer *gr)
+{
+	const char *identity[5];
+
+	if (!gr->compositor->gl_program_cache_enabled)
+		return;
+
+	if (!gr->has_program_binary) {
+		weston_log("GL program cache requested, but "
+			   "GL_OES_get_program_binary is not supported.\n");
+		return;
+	}
+
+	identity[0] = (const char *) glGetString(GL_VENDOR);
+	identity[1] = (const char *) glGetString(GL_RENDERER);
+	identity[2] = (const char *) glGetString(GL_VERSION);
+	identity[3] = vertex_shader;
+	identity[4] = fragment_shader;
+	if (!identity[0] || !identity[1] || !identity[2])
+		return;
+
+	gr->program_cache = gl_program_cache_create(identity,
+						    ARRAY_LENGTH(identity));
+}
+
+/** Create the shader programs most outputs will need for their first frame
+ *
+ * Without color management, almost every surface is drawn with one of
+ * these. Programs are then kept alive by the normal garbage collection
+ * rules.
+ */
+void
+gl_renderer_prewarm_programs(struct gl_renderer *gr)
+{
+	static const struct gl_shader_requirements common[] = {
+		{
+			.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
+			.variant = SHADER_VARIANT_RGBA,
+			.input_is_premult = true,
+		},
+		{
+			.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
+			.variant = SHADER_VARIANT_RGBX,
+		},
+		{
+			.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
+			.variant = SHADER_VARIANT_SOLID,
+			.input_is_premult = true,
+		},
+		{
+			.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
+			.variant = SHADER_VARIANT_Y_UV,
+		},
+		{
+			.texcoord_input = SHADER_TEXCOORD_INPUT_SURFACE,
+			.variant = SHADER_VARIANT_EXTERNAL,
+			.input_is_premult = true,
+		},
+	};
+	struct gl_shader *shader;
+	unsigned i;
+
+	if (!gr->compositor->gl_program_cache_prewarm)
+		return;
+
+	for (i = 0; i < ARRAY_LENGTH(common); i++) {
+		if (common[i].variant == SHADER_VARIANT_EXTERNAL &&
+		    !gr->has_egl_image_external)
+			continue;
+
+		if (hash_table_lookup(gr->shader_table,
+				      gl_shader_requirements_hash(&common[i])))
+			continue;
+
+		/* Let the driver build them all side by side. */
+		shader = gl_shader_create(gr, &common[i], true);
+		if (shader)
+			shader->last_used = gr->compositor->last_repaint_start;
+	}
+}
+
 static struct gl_shader *
 gl_renderer_get_program(struct gl_renderer *gr,
 			const struct gl_shader_requirements *requirements)
@@ -593,19 +854,64 @@ gl_renderer_get_program(struct gl_renderer *gr,
 	assert(reqs.pad_bits_ == 0);
 
 	if (gr->current_shader &&
-	    gl_shader_requirements_cmp(&reqs, &gr->current_shader->key) == 0)
+	    gl_shader_requirements_cmp(&reqs, &gr->current_shader->key) == 0) {
+		gr->shader_cache_hits++;
 		return gr->current_shader;
-
-	wl_list_for_each(shader, &gr->shader_list, link) {
-		if (gl_shader_requirements_cmp(&reqs, &shader->key) == 0)
-			return shader;
 	}
 
-	shader = gl_shader_create(gr, &reqs);
-	if (shader)
+	shader = hash_table_lookup(gr->shader_table,
+				   gl_shader_requirements_hash(&reqs));
+	if (shader) {
+		assert(gl_shader_requirements_cmp(&reqs, &shader->key) == 0);
+		gr->shader_cache_hits++;
+		if (shader->linking && !gl_shader_finish_link(gr, shader))
+			return NULL;
 		return shader;
+	}
 
-	return NULL;
+	gr->shader_cache_misses++;
+
+	return gl_shader_create(gr, &reqs, false);
+}
+
+/** Check whether the program for requirements is still being built
+ *
+ * Without GL_KHR_parallel_shader_compile this is always false. Otherwise
+ * a program not seen before starts building in the background, and this
+ * returns true until the driver reports it done, so that the caller can
+ * skip the draw meanwhile instead of stalling the repaint.
+ * gl_renderer_use_program() picks the program up once it is ready.
+ */
+bool
+gl_renderer_program_pending(struct gl_renderer *gr,
+			    const struct gl_shader_requirements *requirements)
+{
+	struct gl_shader *shader;
+	GLint done;
+
+	if (!gr->has_parallel_shader_compile)
+		return false;
+
+	if (gr->current_shader &&
+	    gl_shader_requirements_cmp(requirements,
+				       &gr->current_shader->key) == 0)
+		return false;
+
+	shader = hash_table_lookup(gr->shader_table,
+				   gl_shader_requirements_hash(requirements));
+	if (!shader) {
+		/* A failure is reported by gl_renderer_use_program(). */
+		shader = gl_shader_create(gr, requirements, true);
+		if (!shader)
+			return false;
+	}
+
+	if (!shader->linking)
+		return false;
+
+	glGetProgramiv(shader->program, GL_COMPLETION_STATUS_KHR, &done);
+
+	return !done;
 }
 
 void
@@ -629,6 +935,26 @@ gl_renderer_garbage_collect_programs(struct gl_renderer *gr)
 	}
 }
 
+/** Throw away all but the most recently used programs
+ *
+ * Unlike gl_renderer_garbage_collect_programs(), this ignores when the
+ * programs were last used. Meant for when the compositor has gone idle,
+ * the on-disk program cache makes bringing them back cheap.
+ */
+void
+gl_renderer_trim_programs(struct gl_renderer *gr)
+{
+	struct gl_shader *shader, *tmp;
+	unsigned count = 0;
+
+	wl_list_for_each_safe(shader, tmp, &gr->shader_list, link) {
+		if (count++ < 10)
+			continue;
+
+		gl_shader_destroy(gr, shader);
+	}
+}
+
 bool
 gl_shader_texture_variant_can_be_premult(enum gl_shader_texture_variant v)
 {
@@ -714,8 +1040,6 @@ gl_shader_load_config(struct gl_shader *shader,
 		n_params = sizeof(sconf->color_pre_curve.parametric.params) / sizeof(GLfloat);
 		glUniform1fv(shader->color_pre_curve.parametric.params_uniform, n_params,
 			     &sconf->color_pre_curve.parametric.params[0][0]);
-		glUniform1i(shader->color_pre_curve.parametric.clamped_input_uniform,
-			    sconf->color_pre_curve.parametric.clamped_input);
 		break;
 	}
 
@@ -760,8 +1084,6 @@ gl_shader_load_config(struct gl_shader *shader,
 		n_params = sizeof(sconf->color_post_curve.parametric.params) / sizeof(GLfloat);
 		glUniform1fv(shader->color_post_curve.parametric.params_uniform, n_params,
 			     &sconf->color_post_curve.parametric.params[0][0]);
-		glUniform1i(shader->color_post_curve.parametric.clamped_input_uniform,
-			    sconf->color_post_curve.parametric.clamped_input);
 		break;
 	}
 
@@ -771,30 +1093,37 @@ gl_shader_load_config(struct gl_shader *shader,
 	glActiveTexture(GL_TEXTURE0);
 }
 
+static void
+gl_renderer_use_fallback_program(struct gl_renderer *gr)
+{
+	static const GLfloat fallback_shader_color[4] = { 0.2, 0.1, 0.0, 1.0 };
+	struct gl_shader *shader = gr->fallback_shader;
+
+	gr->current_shader = NULL;
+
+	/*
+	 * We only have one fallback shader, so it cannot do correct
+	 * color on color managed outputs. Hence, what is painted
+	 * with this one will have undefined look. Therefore the
+	 * fallback is important to not be too bright as that might
+	 * be shocking on a monitor in HDR mode.
+	 */
+
+	glUseProgram(shader->program);
+	glUniform4fv(shader->color_uniform, 1, fallback_shader_color);
+	glUniform1f(shader->view_alpha_uniform, 1.0f);
+}
+
 bool
 gl_renderer_use_program(struct gl_renderer *gr,
 			const struct gl_shader_config *sconf)
 {
-	static const GLfloat fallback_shader_color[4] = { 0.2, 0.1, 0.0, 1.0 };
 	struct gl_shader *shader;
 
 	shader = gl_renderer_get_program(gr, &sconf->req);
 	if (!shader) {
 		weston_log("Error: failed to generate shader program.\n");
-		gr->current_shader = NULL;
-
-		/*
-		 * We only have one fallback shader, so it cannot do correct
-		 * color on color managed outputs. Hence, what is painted
-		 * with this one will have undefined look. Therefore the
-		 * fallback is important to not be too bright as that might
-		 * be shocking on a monitor in HDR mode.
-		 */
-
-		shader = gr->fallback_shader;
-		glUseProgram(shader->program);
-		glUniform4fv(shader->color_uniform, 1, fallback_shader_color);
-		glUniform1f(shader->view_alpha_uniform, 1.0f);
+		gl_renderer_use_fallback_program(gr);
 		return false;
 	}
 
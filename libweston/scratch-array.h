@@ -0,0 +1,62 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SCRATCH_ARRAY_H
+#define WESTON_SCRATCH_ARRAY_H
+
+#include <wayland-util.h>
+
+#include "metrics.h"
+#include "shared/xalloc.h"
+
+/*
+ * Scratch arrays hold per-call temporaries of the repaint path, like rect
+ * and quad lists. They are kept by their owner and only ever grow, so once
+ * they are large enough for the scene, repainting does not allocate from
+ * them any more. Each growth is counted in the repaint_scratch_allocs
+ * metric; compared to output_repaints, it should stay flat.
+ */
+
+/** Empty a scratch array and return room for size bytes
+ *
+ * The contents are undefined. Valid until the next reserve on the same
+ * array. Returns the array data, possibly NULL, if size is 0.
+ */
+static inline void *
+weston_scratch_array_reserve(struct weston_compositor *compositor,
+			     struct wl_array *array, size_t size)
+{
+	array->size = 0;
+	if (size == 0)
+		return array->data;
+
+	if (size > array->alloc)
+		weston_metric_inc(compositor,
+				  WESTON_METRIC_REPAINT_SCRATCH_ALLOCS);
+
+	return abort_oom_if_null(wl_array_add(array, size));
+}
+
+#endif /* WESTON_SCRATCH_ARRAY_H */
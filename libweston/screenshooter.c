@@ -25,6 +25,9 @@
 
 #include "config.h"
 
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -37,9 +40,11 @@
 
 #include <libweston/libweston.h>
 #include "shared/helpers.h"
+#include "shared/pixel-row.h"
 #include "shared/timespec-util.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "output-capture.h"
 #include "pixel-formats.h"
 
 #include "wcap/wcap-decode.h"
@@ -73,23 +78,6 @@ copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
 	memcpy(dst, src, height * stride);
 }
 
-static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
-{
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
-
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
-	}
-}
-
 static void
 copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
 {
@@ -97,7 +85,8 @@ copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
 
 	end = dst + height * stride;
 	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
+		pixel_row_copy_swap_rb((uint32_t *) dst, (uint32_t *) src,
+				       stride / 4);
 		dst += stride;
 		src -= stride;
 	}
@@ -110,7 +99,8 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 
 	end = dst + height * stride;
 	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
+		pixel_row_copy_swap_rb((uint32_t *) dst, (uint32_t *) src,
+				       stride / 4);
 		dst += stride;
 		src += stride;
 	}
@@ -215,6 +205,14 @@ weston_screenshooter_shoot(struct weston_output *output,
 		return -1;
 	}
 
+	/* A buffer in the framebuffer capture size and format is filled by
+	 * a capture task, which the GL renderer reads back asynchronously.
+	 * Others need the synchronous read and conversion below. */
+	if (weston_output_capture_oneshot(output,
+					  WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER,
+					  buffer, done, data) == 0)
+		return 0;
+
 	l = malloc(sizeof *l);
 	if (l == NULL) {
 		done(data, WESTON_SCREENSHOOTER_NO_MEMORY);
@@ -238,14 +236,46 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+/* Interval between frames that can be decoded on their own */
+#define WESTON_RECORDER_KEYFRAME_MSEC 5000
+
+/* Frames waiting for the encoder thread before readbacks are deferred */
+#define WESTON_RECORDER_MAX_QUEUED 4
+
+struct weston_recorder_frame {
+	struct wl_list link;
+	uint32_t number;
+	uint32_t msecs;
+	uint32_t flags;
+	int nrects;
+	pixman_box32_t *rects;
+	/* Readbacks of all rects, in the renderer's row order */
+	uint32_t *pixels;
+};
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
+	int width, height;
+	bool yflip;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	uint32_t keyframe_msecs;
+	pixman_region32_t deferred_damage;
+
+	/* Owned by the encoder thread until it has been joined */
+	uint32_t *frame;
+	uint32_t *outbuf;
+	uint32_t *delta; /* one row */
+	uint64_t total;
+	struct wl_array index;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct wl_list queue;
+	int queued;
+	bool done;
 };
 
 static uint32_t *
@@ -274,16 +304,140 @@ output_run(uint32_t *p, uint32_t delta, int run)
 	return p;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static void
+weston_recorder_write(struct weston_recorder *recorder,
+		      const struct iovec *iov, int iovcnt)
+{
+	ssize_t ret;
+
+	ret = writev(recorder->fd, iov, iovcnt);
+	if (ret > 0)
+		recorder->total += ret;
+}
+
+static void
+weston_recorder_encode(struct weston_recorder *recorder,
+		       struct weston_recorder_frame *job)
+{
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	pixman_box32_t *r = job->rects;
+	int i, j, k, width, height, run, stride;
+	uint32_t prev, *d, *s, *p, *pixels;
+	struct iovec v[2];
+
+	stride = recorder->width;
+
+	if (job->flags & WCAP_FRAME_KEYFRAME) {
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+
+		entry = wl_array_add(&recorder->index, sizeof *entry);
+		if (entry) {
+			entry->msecs = job->msecs;
+			entry->frame = job->number;
+			entry->offset = recorder->total;
+		}
+	}
+
+	header.msecs = job->msecs;
+	header.nrects = job->nrects;
+	header.flags = job->flags;
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+	v[1].iov_base = r;
+	v[1].iov_len = job->nrects * sizeof *r;
+	weston_recorder_write(recorder, v, 2);
+
+	pixels = job->pixels;
+	for (i = 0; i < job->nrects; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		p = recorder->outbuf;
+		run = prev = 0; /* quiet gcc */
+		for (j = 0; j < height; j++) {
+			if (recorder->yflip)
+				s = pixels + width * j;
+			else
+				s = pixels + width * (height - j - 1);
+			d = recorder->frame + stride * (r[i].y2 - j - 1) + r[i].x1;
+
+			pixel_row_delta_rgb(recorder->delta, s, d, width);
+			memcpy(d, s, width * 4);
+
+			for (k = 0; k < width; k++) {
+				if (run == 0 || recorder->delta[k] == prev) {
+					run++;
+				} else {
+					p = output_run(p, prev, run);
+					run = 1;
+				}
+				prev = recorder->delta[k];
+			}
+		}
+
+		p = output_run(p, prev, run);
+
+		v[0].iov_base = recorder->outbuf;
+		v[0].iov_len = (p - recorder->outbuf) * 4;
+		weston_recorder_write(recorder, v, 1);
+
+		pixels += width * height;
+	}
+}
+
+static void *
+weston_recorder_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_frame *job;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (wl_list_empty(&recorder->queue) && !recorder->done)
+			pthread_cond_wait(&recorder->cond, &recorder->mutex);
+
+		if (wl_list_empty(&recorder->queue))
+			break;
+
+		job = container_of(recorder->queue.next,
+				   struct weston_recorder_frame, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		weston_recorder_encode(recorder, job);
+		free(job);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->queued--;
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return NULL;
+}
+
+static bool
+weston_recorder_queue_is_full(struct weston_recorder *recorder)
 {
-	unsigned char dr, dg, db;
+	bool full;
+
+	pthread_mutex_lock(&recorder->mutex);
+	full = recorder->queued >= WESTON_RECORDER_MAX_QUEUED;
+	pthread_mutex_unlock(&recorder->mutex);
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	return full;
+}
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+static void
+weston_recorder_queue_frame(struct weston_recorder *recorder,
+			    struct weston_recorder_frame *job)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	wl_list_insert(recorder->queue.prev, &job->link);
+	recorder->queued++;
+	pthread_cond_signal(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
 }
 
 static void
@@ -297,103 +451,93 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	struct weston_output *output = recorder->output;
 	struct weston_compositor *compositor = output->compositor;
 	uint32_t msecs = timespec_to_msec(&output->frame_time);
-	pixman_box32_t *r;
+	struct weston_recorder_frame *job;
+	pixman_box32_t *r, full;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	size_t npixels;
+	uint32_t *pixels;
+	int i, n, width, height, y_orig;
+	bool keyframe;
 
 	pixman_region32_init(&damage);
-	pixman_region32_init(&transformed_damage);
 	pixman_region32_intersect(&damage, &output->region, data);
-	weston_region_global_to_output(&transformed_damage,
-				       output,
-				       &damage);
+	pixman_region32_union(&recorder->deferred_damage,
+			      &recorder->deferred_damage, &damage);
 	pixman_region32_fini(&damage);
 
-	r = pixman_region32_rectangles(&transformed_damage, &n);
+	/* Let the damage pile up until the encoder has caught up. */
+	if (weston_recorder_queue_is_full(recorder))
+		goto out;
+
+	keyframe = recorder->count == 0 ||
+		   msecs - recorder->keyframe_msecs >=
+		   WESTON_RECORDER_KEYFRAME_MSEC;
+
+	pixman_region32_init(&transformed_damage);
+	if (keyframe) {
+		full.x1 = 0;
+		full.y1 = 0;
+		full.x2 = recorder->width;
+		full.y2 = recorder->height;
+		r = &full;
+		n = 1;
+	} else {
+		weston_region_global_to_output(&transformed_damage, output,
+					       &recorder->deferred_damage);
+		r = pixman_region32_rectangles(&transformed_damage, &n);
+	}
+
 	if (n == 0) {
 		pixman_region32_fini(&transformed_damage);
-		return;
+		goto out;
 	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	npixels = 0;
+	for (i = 0; i < n; i++)
+		npixels += (size_t) (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	job = malloc(sizeof *job + n * sizeof *r + npixels * 4);
+	if (!job) {
+		weston_log("%s: out of memory\n", __func__);
+		pixman_region32_fini(&transformed_damage);
+		goto out;
+	}
 
+	job->number = recorder->count;
+	job->msecs = msecs;
+	job->flags = keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	job->nrects = n;
+	job->rects = (pixman_box32_t *) (job + 1);
+	job->pixels = (uint32_t *) (job->rects + n);
+	memcpy(job->rects, r, n * sizeof *r);
+
+	/* The readback has to happen now; encoding can wait. */
+	pixels = job->pixels;
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
+		if (recorder->yflip)
+			y_orig = recorder->height - r[i].y2;
 		else
 			y_orig = r[i].y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
+				compositor->read_format, pixels,
 				r[i].x1, y_orig, width, height);
-
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				s = recorder->rect + width * j;
-			else
-				s = recorder->rect + width * (height - j - 1);
-			y_orig = r[i].y2 - j - 1;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
-
-		p = output_run(p, prev, run);
-
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
-
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+		pixels += width * height;
 	}
 
 	pixman_region32_fini(&transformed_damage);
+	pixman_region32_clear(&recorder->deferred_damage);
+
+	if (keyframe)
+		recorder->keyframe_msecs = msecs;
 	recorder->count++;
 
+	weston_recorder_queue_frame(recorder, job);
+
+out:
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
 }
@@ -404,8 +548,10 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
-	free(recorder->tmpbuf);
-	free(recorder->rect);
+	pixman_region32_fini(&recorder->deferred_damage);
+	wl_array_release(&recorder->index);
+	free(recorder->delta);
+	free(recorder->outbuf);
 	free(recorder->frame);
 	free(recorder);
 }
@@ -415,11 +561,8 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
-	int stride, size;
+	int size;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
@@ -427,26 +570,27 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
-	stride = output->current_mode->width;
-	size = stride * 4 * output->current_mode->height;
+	pixman_region32_init(&recorder->deferred_damage);
+	wl_array_init(&recorder->index);
+	wl_list_init(&recorder->queue);
+
+	recorder->yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	recorder->width = output->current_mode->width;
+	recorder->height = output->current_mode->height;
+	size = recorder->width * 4 * recorder->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
+	recorder->outbuf = malloc(size);
+	recorder->delta = malloc(recorder->width * 4);
 	recorder->output = output;
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) || (recorder->outbuf == NULL) ||
+	    (recorder->delta == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err_recorder;
-		}
-	}
-
-	header.magic = WCAP_HEADER_MAGIC;
+	header.magic = WCAP_HEADER_MAGIC_V2;
 
 	switch (compositor->read_format->pixman_format) {
 	case PIXMAN_x8r8g8b8:
@@ -470,10 +614,21 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		goto err_recorder;
 	}
 
-	header.width = output->current_mode->width;
-	header.height = output->current_mode->height;
+	header.width = recorder->width;
+	header.height = recorder->height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
 
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->cond, NULL);
+	if (pthread_create(&recorder->thread, NULL,
+			   weston_recorder_thread, recorder) != 0) {
+		weston_log("failed to start recorder thread\n");
+		pthread_cond_destroy(&recorder->cond);
+		pthread_mutex_destroy(&recorder->mutex);
+		close(recorder->fd);
+		goto err_recorder;
+	}
+
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	weston_output_disable_planes_incr(output);
@@ -486,12 +641,46 @@ err_recorder:
 	return NULL;
 }
 
+/* The index goes last so that an interrupted recording is still a valid,
+ * sequentially decodable file. */
+static void
+weston_recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_index_trailer trailer;
+	struct iovec v[2];
+
+	trailer.offset = recorder->total;
+	trailer.count = recorder->index.size / sizeof(struct wcap_index_entry);
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	v[0].iov_base = recorder->index.data;
+	v[0].iov_len = recorder->index.size;
+	v[1].iov_base = &trailer;
+	v[1].iov_len = sizeof trailer;
+	weston_recorder_write(recorder, v, 2);
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
-	close(recorder->fd);
 	weston_output_disable_planes_decr(recorder->output);
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->done = true;
+	pthread_cond_signal(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+	pthread_cond_destroy(&recorder->cond);
+	pthread_mutex_destroy(&recorder->mutex);
+
+	weston_recorder_write_index(recorder);
+	close(recorder->fd);
+
+	weston_log("stopped recorder, total file size %" PRIu64 "M, "
+		   "%d frames\n", recorder->total / (1024 * 1024),
+		   recorder->count);
+
 	weston_recorder_free(recorder);
 }
 
@@ -516,8 +705,8 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
-	weston_log("stopping recorder, total file size %dM, %d frames\n",
-		   recorder->total / (1024 * 1024), recorder->count);
+	weston_log("stopping recorder for output %s\n",
+		   recorder->output->name);
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
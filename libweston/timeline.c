@@ -31,6 +31,8 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -95,6 +97,31 @@ weston_timeline_create_subscription(struct weston_log_subscription *sub,
 	weston_log_subscription_set_data(sub, tl_sub);
 }
 
+/** Create a timeline subscription writing a Perfetto trace
+ *
+ * Called when a subscription to the timeline-perfetto scope is created.
+ * Every subscription is its own Perfetto packet sequence, so that track
+ * uuids and interned names from different subscribers never collide.
+ *
+ * @ingroup internal-log
+ */
+void
+weston_timeline_create_perfetto_subscription(struct weston_log_subscription *sub,
+					     void *user_data)
+{
+	static uint32_t next_sequence_id;
+	struct weston_timeline_subscription *tl_sub;
+
+	weston_timeline_create_subscription(sub, user_data);
+
+	tl_sub = weston_log_subscription_get_data(sub);
+	if (!tl_sub)
+		return;
+
+	tl_sub->format = WESTON_TIMELINE_FORMAT_PERFETTO;
+	tl_sub->sequence_id = ++next_sequence_id;
+}
+
 static void
 weston_timeline_destroy_subscription_object(struct weston_timeline_subscription_object *sub_obj)
 {
@@ -345,6 +372,21 @@ emit_gpu_timestamp(struct timeline_emit_context *ctx, void *obj)
 	return 1;
 }
 
+static int
+emit_commit(struct timeline_emit_context *ctx, void *obj)
+{
+	struct weston_timeline_commit *commit = obj;
+
+	fprintf(ctx->cur, "\"commit\":{ \"seq\":%" PRIu64 ", \"pid\":%d, "
+		"\"client_ns\":%" PRId64 ", \"queue_ns\":%" PRId64 ", "
+		"\"repaint_ns\":%" PRId64 ", \"present_ns\":%" PRId64 " }",
+		commit->seq, commit->pid, commit->client_nsec,
+		commit->queue_nsec, commit->repaint_nsec,
+		commit->present_nsec);
+
+	return 1;
+}
+
 static struct weston_timeline_subscription_object *
 weston_timeline_get_subscription_object(struct weston_log_subscription *sub,
 		void *object)
@@ -374,14 +416,23 @@ WL_EXPORT void
 weston_timeline_refresh_subscription_objects(struct weston_compositor *wc,
 					     void *object)
 {
-	struct weston_log_subscription *sub = NULL;
-
-	while ((sub = weston_log_subscription_iterate(wc->timeline, sub))) {
-		struct weston_timeline_subscription_object *sub_obj;
-
-		sub_obj = weston_timeline_get_subscription_object(sub, object);
-		if (sub_obj)
-			sub_obj->force_refresh = true;
+	struct weston_log_scope *scopes[] = { wc->timeline,
+					      wc->timeline_perfetto };
+	struct weston_log_subscription *sub;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(scopes); i++) {
+		if (!scopes[i])
+			continue;
+
+		sub = NULL;
+		while ((sub = weston_log_subscription_iterate(scopes[i], sub))) {
+			struct weston_timeline_subscription_object *sub_obj;
+
+			sub_obj = weston_timeline_get_subscription_object(sub, object);
+			if (sub_obj)
+				sub_obj->force_refresh = true;
+		}
 	}
 }
 
@@ -392,8 +443,402 @@ static const type_func type_dispatch[] = {
 	[TLT_SURFACE] = emit_weston_surface,
 	[TLT_VBLANK] = emit_vblank_timestamp,
 	[TLT_GPU] = emit_gpu_timestamp,
+	[TLT_COMMIT] = emit_commit,
+};
+
+/*
+ * Perfetto output
+ *
+ * Each timeline point becomes one TracePacket carrying an instant
+ * TrackEvent. Packets are written framed as the 'packet' field of the
+ * Trace message, so the concatenated stream is a valid Perfetto trace
+ * that ui.perfetto.dev and trace_processor load directly.
+ *
+ * Every output and surface gets its own track, announced with a
+ * TrackDescriptor packet the first time it is seen, and again whenever
+ * weston_timeline_refresh_subscription_objects() is called for it.
+ * Sub-surface tracks are nested under their main surface. Event names
+ * are interned per packet sequence. Timestamps are CLOCK_MONOTONIC
+ * nanoseconds.
+ */
+
+/* Field numbers from perfetto/trace/trace_packet.proto and friends */
+#define PF_TRACE_PACKET				1
+
+#define PF_PACKET_TIMESTAMP			8
+#define PF_PACKET_SEQUENCE_ID			10
+#define PF_PACKET_TRACK_EVENT			11
+#define PF_PACKET_INTERNED_DATA			12
+#define PF_PACKET_SEQUENCE_FLAGS		13
+#define PF_PACKET_TRACK_DESCRIPTOR		60
+
+#define PF_SEQ_INCREMENTAL_STATE_CLEARED	1
+#define PF_SEQ_NEEDS_INCREMENTAL_STATE		2
+
+#define PF_TRACK_DESCRIPTOR_UUID		1
+#define PF_TRACK_DESCRIPTOR_NAME		2
+#define PF_TRACK_DESCRIPTOR_PARENT_UUID		5
+
+#define PF_TRACK_EVENT_DEBUG_ANNOTATION		4
+#define PF_TRACK_EVENT_TYPE			9
+#define PF_TRACK_EVENT_NAME_IID			10
+#define PF_TRACK_EVENT_TRACK_UUID		11
+#define PF_TRACK_EVENT_NAME			23
+#define PF_TRACK_EVENT_TYPE_INSTANT		3
+
+#define PF_DEBUG_ANNOTATION_UINT_VALUE		3
+#define PF_DEBUG_ANNOTATION_NAME		10
+
+#define PF_INTERNED_DATA_EVENT_NAMES		2
+#define PF_EVENT_NAME_IID			1
+#define PF_EVENT_NAME_NAME			2
+
+#define PF_WIRE_VARINT				0
+#define PF_WIRE_LENGTH_DELIMITED		2
+
+/** A protobuf message being encoded into a fixed-size buffer
+ *
+ * Once the buffer overflows, further writes are dropped and the message
+ * must be discarded.
+ */
+struct pf_msg {
+	uint8_t data[1024];
+	size_t len;
+	bool overflow;
 };
 
+static void
+pf_put_raw(struct pf_msg *msg, const void *data, size_t len)
+{
+	if (msg->overflow || len > sizeof(msg->data) - msg->len) {
+		msg->overflow = true;
+		return;
+	}
+
+	memcpy(msg->data + msg->len, data, len);
+	msg->len += len;
+}
+
+static void
+pf_put_varint(struct pf_msg *msg, uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t n = 0;
+
+	do {
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		if (value)
+			bytes[n] |= 0x80;
+		n++;
+	} while (value);
+
+	pf_put_raw(msg, bytes, n);
+}
+
+static void
+pf_put_uint(struct pf_msg *msg, unsigned int field, uint64_t value)
+{
+	pf_put_varint(msg, (field << 3) | PF_WIRE_VARINT);
+	pf_put_varint(msg, value);
+}
+
+static void
+pf_put_bytes(struct pf_msg *msg, unsigned int field,
+	     const void *data, size_t len)
+{
+	pf_put_varint(msg, (field << 3) | PF_WIRE_LENGTH_DELIMITED);
+	pf_put_varint(msg, len);
+	pf_put_raw(msg, data, len);
+}
+
+static void
+pf_put_string(struct pf_msg *msg, unsigned int field, const char *str)
+{
+	pf_put_bytes(msg, field, str, strlen(str));
+}
+
+static void
+pf_put_msg(struct pf_msg *msg, unsigned int field, const struct pf_msg *sub)
+{
+	if (sub->overflow) {
+		msg->overflow = true;
+		return;
+	}
+
+	pf_put_bytes(msg, field, sub->data, sub->len);
+}
+
+static uint64_t
+pf_timespec_to_nsec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+/* Track uuids only need to be unique within the trace */
+static uint64_t
+pf_track_uuid(struct weston_timeline_subscription *tl_sub, unsigned int id)
+{
+	return ((uint64_t)tl_sub->sequence_id << 32) | id;
+}
+
+/** Frame a TracePacket as a Trace.packet field and write it out */
+static void
+pf_write_packet(struct weston_log_subscription *sub,
+		struct weston_timeline_subscription *tl_sub,
+		struct pf_msg *packet)
+{
+	struct pf_msg framed = {};
+
+	pf_put_uint(packet, PF_PACKET_SEQUENCE_ID, tl_sub->sequence_id);
+	pf_put_msg(&framed, PF_TRACE_PACKET, packet);
+
+	if (framed.overflow) {
+		weston_log("Timeline error in constructing Perfetto packet, "
+			   "dropped.\n");
+		return;
+	}
+
+	weston_log_subscription_write(sub, (const char *)framed.data,
+				      framed.len);
+}
+
+static void
+pf_write_track_descriptor(struct weston_log_subscription *sub,
+			  struct weston_timeline_subscription *tl_sub,
+			  unsigned int id, unsigned int parent_id,
+			  const char *name)
+{
+	struct pf_msg packet = {};
+	struct pf_msg desc = {};
+
+	pf_put_uint(&desc, PF_TRACK_DESCRIPTOR_UUID, pf_track_uuid(tl_sub, id));
+	pf_put_string(&desc, PF_TRACK_DESCRIPTOR_NAME, name);
+	if (parent_id)
+		pf_put_uint(&desc, PF_TRACK_DESCRIPTOR_PARENT_UUID,
+			    pf_track_uuid(tl_sub, parent_id));
+
+	pf_put_msg(&packet, PF_PACKET_TRACK_DESCRIPTOR, &desc);
+	pf_write_packet(sub, tl_sub, &packet);
+}
+
+static unsigned int
+pf_output_track(struct weston_log_subscription *sub,
+		struct weston_timeline_subscription *tl_sub,
+		struct weston_output *output)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+	char name[64];
+
+	sub_obj = weston_timeline_subscription_output_ensure(tl_sub, output);
+	if (weston_timeline_check_object_refresh(sub_obj)) {
+		snprintf(name, sizeof(name), "output %s",
+			 output->name ? output->name : "(unnamed)");
+		pf_write_track_descriptor(sub, tl_sub, sub_obj->id, 0, name);
+	}
+
+	return sub_obj->id;
+}
+
+static unsigned int
+pf_surface_track(struct weston_log_subscription *sub,
+		 struct weston_timeline_subscription *tl_sub,
+		 struct weston_surface *surface)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+	struct weston_surface *mains;
+	unsigned int parent_id = 0;
+	char d[512];
+
+	mains = weston_surface_get_main_surface(surface);
+	if (mains != surface)
+		parent_id = pf_surface_track(sub, tl_sub, mains);
+
+	sub_obj = weston_timeline_subscription_surface_ensure(tl_sub, surface);
+	if (!weston_timeline_check_object_refresh(sub_obj))
+		return sub_obj->id;
+
+	if (!surface->get_label ||
+	    surface->get_label(surface, d, sizeof(d)) < 0 || !d[0])
+		snprintf(d, sizeof(d), "surface %u", sub_obj->id);
+
+	pf_write_track_descriptor(sub, tl_sub, sub_obj->id, parent_id, d);
+
+	return sub_obj->id;
+}
+
+static void
+pf_put_annotation(struct pf_msg *event, const char *name, uint64_t value)
+{
+	struct pf_msg annotation = {};
+
+	pf_put_string(&annotation, PF_DEBUG_ANNOTATION_NAME, name);
+	pf_put_uint(&annotation, PF_DEBUG_ANNOTATION_UINT_VALUE, value);
+	pf_put_msg(event, PF_TRACK_EVENT_DEBUG_ANNOTATION, &annotation);
+}
+
+/** Look up the interned id of an event name
+ *
+ * Timeline point names are string literals, so a new name is added to
+ * @c interned for the packet being built the first time it is seen.
+ *
+ * @return the interned id, or 0 if the table is full.
+ */
+static unsigned int
+pf_intern_name(struct weston_timeline_subscription *tl_sub,
+	       const char *name, struct pf_msg *interned)
+{
+	struct pf_msg event_name = {};
+	unsigned int i;
+
+	for (i = 0; i < tl_sub->interned_count; i++)
+		if (strcmp(tl_sub->interned_names[i], name) == 0)
+			return i + 1;
+
+	if (tl_sub->interned_count == ARRAY_LENGTH(tl_sub->interned_names))
+		return 0;
+
+	tl_sub->interned_names[tl_sub->interned_count++] = name;
+
+	pf_put_uint(&event_name, PF_EVENT_NAME_IID, tl_sub->interned_count);
+	pf_put_string(&event_name, PF_EVENT_NAME_NAME, name);
+	pf_put_msg(interned, PF_INTERNED_DATA_EVENT_NAMES, &event_name);
+
+	return tl_sub->interned_count;
+}
+
+static void
+timeline_emit_perfetto(struct weston_log_subscription *sub,
+		       struct weston_timeline_subscription *tl_sub,
+		       const struct timespec *ts, const char *name,
+		       va_list argp)
+{
+	struct pf_msg packet = {};
+	struct pf_msg event = {};
+	struct pf_msg interned = {};
+	enum timeline_type otype;
+	uint64_t timestamp = pf_timespec_to_nsec(ts);
+	unsigned int output_id = 0;
+	unsigned int surface_id = 0;
+	unsigned int track_id;
+	unsigned int name_iid;
+	uint32_t flags = PF_SEQ_NEEDS_INCREMENTAL_STATE;
+	void *obj;
+
+	if (!tl_sub->sequence_started) {
+		pf_write_track_descriptor(sub, tl_sub, 0, 0, "weston");
+		flags |= PF_SEQ_INCREMENTAL_STATE_CLEARED;
+		tl_sub->sequence_started = true;
+	}
+
+	while (1) {
+		otype = va_arg(argp, enum timeline_type);
+		if (otype == TLT_END)
+			break;
+
+		obj = va_arg(argp, void *);
+		switch (otype) {
+		case TLT_OUTPUT:
+			output_id = pf_output_track(sub, tl_sub, obj);
+			pf_put_annotation(&event, "output", output_id);
+			break;
+		case TLT_SURFACE:
+			surface_id = pf_surface_track(sub, tl_sub, obj);
+			pf_put_annotation(&event, "surface", surface_id);
+			break;
+		case TLT_VBLANK:
+			pf_put_annotation(&event, "vblank_monotonic_ns",
+					  pf_timespec_to_nsec(obj));
+			break;
+		case TLT_GPU:
+			/* the point happened at the GPU time, not now */
+			timestamp = pf_timespec_to_nsec(obj);
+			break;
+		case TLT_COMMIT: {
+			const struct weston_timeline_commit *commit = obj;
+
+			pf_put_annotation(&event, "commit_seq", commit->seq);
+			pf_put_annotation(&event, "pid", commit->pid);
+			pf_put_annotation(&event, "client_ns",
+					  MAX(commit->client_nsec, 0));
+			pf_put_annotation(&event, "queue_ns",
+					  MAX(commit->queue_nsec, 0));
+			pf_put_annotation(&event, "repaint_ns",
+					  MAX(commit->repaint_nsec, 0));
+			pf_put_annotation(&event, "present_ns",
+					  MAX(commit->present_nsec, 0));
+			break;
+		}
+		case TLT_END:
+			break;
+		}
+	}
+
+	track_id = surface_id ? surface_id : output_id;
+
+	pf_put_uint(&event, PF_TRACK_EVENT_TYPE, PF_TRACK_EVENT_TYPE_INSTANT);
+	pf_put_uint(&event, PF_TRACK_EVENT_TRACK_UUID,
+		    pf_track_uuid(tl_sub, track_id));
+
+	name_iid = pf_intern_name(tl_sub, name, &interned);
+	if (name_iid)
+		pf_put_uint(&event, PF_TRACK_EVENT_NAME_IID, name_iid);
+	else
+		pf_put_string(&event, PF_TRACK_EVENT_NAME, name);
+
+	pf_put_uint(&packet, PF_PACKET_TIMESTAMP, timestamp);
+	pf_put_uint(&packet, PF_PACKET_SEQUENCE_FLAGS, flags);
+	if (interned.len > 0 || interned.overflow)
+		pf_put_msg(&packet, PF_PACKET_INTERNED_DATA, &interned);
+	pf_put_msg(&packet, PF_PACKET_TRACK_EVENT, &event);
+
+	pf_write_packet(sub, tl_sub, &packet);
+}
+
+static void
+timeline_emit_json(struct weston_log_subscription *sub,
+		   const struct timespec *ts, const char *name, va_list argp)
+{
+	struct timeline_emit_context ctx = {};
+	enum timeline_type otype;
+	void *obj;
+	char buf[512];
+
+	memset(buf, 0, sizeof(buf));
+	ctx.cur = fmemopen(buf, sizeof(buf), "w");
+	ctx.subscription = sub;
+
+	if (!ctx.cur) {
+		weston_log("Timeline error in fmemopen, closing.\n");
+		return;
+	}
+
+	fprintf(ctx.cur, "{ \"T\":[%" PRId64 ", %ld], \"N\":\"%s\"",
+			(int64_t)ts->tv_sec, ts->tv_nsec, name);
+
+	while (1) {
+		otype = va_arg(argp, enum timeline_type);
+		if (otype == TLT_END)
+			break;
+
+		obj = va_arg(argp, void *);
+		if (type_dispatch[otype]) {
+			fprintf(ctx.cur, ", ");
+			type_dispatch[otype](&ctx, obj);
+		}
+	}
+
+	fprintf(ctx.cur, " }\n");
+	fflush(ctx.cur);
+	if (ferror(ctx.cur)) {
+		weston_log("Timeline error in constructing entry, closing.\n");
+	} else {
+		weston_log_subscription_printf(ctx.subscription, "%s", buf);
+	}
+
+	fclose(ctx.cur);
+}
+
 /** Disseminates the message to all subscriptions of the scope \c
  * timeline_scope
  *
@@ -402,7 +847,7 @@ static const type_func type_dispatch[] = {
  *
  * @param timeline_scope the timeline scope
  * @param name the name of the timeline point. Interpretable by the tool reading
- * the output (wesgr).
+ * the output (wesgr), or the Perfetto track event name.
  *
  * @ingroup log
  */
@@ -411,9 +856,6 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 		      const char *name, ...)
 {
 	struct timespec ts;
-	enum timeline_type otype;
-	void *obj;
-	char buf[512];
 	struct weston_log_subscription *sub = NULL;
 
 	if (!weston_log_scope_is_enabled(timeline_scope))
@@ -422,44 +864,18 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 
 	while ((sub = weston_log_subscription_iterate(timeline_scope, sub))) {
+		struct weston_timeline_subscription *tl_sub;
 		va_list argp;
-		struct timeline_emit_context ctx = {};
-
-		memset(buf, 0, sizeof(buf));
-		ctx.cur = fmemopen(buf, sizeof(buf), "w");
-		ctx.subscription = sub;
-
-		if (!ctx.cur) {
-			weston_log("Timeline error in fmemopen, closing.\n");
-			return;
-		}
 
-		fprintf(ctx.cur, "{ \"T\":[%" PRId64 ", %ld], \"N\":\"%s\"",
-				(int64_t)ts.tv_sec, ts.tv_nsec, name);
+		tl_sub = weston_log_subscription_get_data(sub);
+		if (!tl_sub)
+			continue;
 
 		va_start(argp, name);
-		while (1) {
-			otype = va_arg(argp, enum timeline_type);
-			if (otype == TLT_END)
-				break;
-
-			obj = va_arg(argp, void *);
-			if (type_dispatch[otype]) {
-				fprintf(ctx.cur, ", ");
-				type_dispatch[otype](&ctx, obj);
-			}
-		}
+		if (tl_sub->format == WESTON_TIMELINE_FORMAT_PERFETTO)
+			timeline_emit_perfetto(sub, tl_sub, &ts, name, argp);
+		else
+			timeline_emit_json(sub, &ts, name, argp);
 		va_end(argp);
-
-		fprintf(ctx.cur, " }\n");
-		fflush(ctx.cur);
-		if (ferror(ctx.cur)) {
-			weston_log("Timeline error in constructing entry, closing.\n");
-		} else {
-			weston_log_subscription_printf(ctx.subscription, "%s", buf);
-		}
-
-		fclose(ctx.cur);
-
 	}
 }
@@ -29,6 +29,7 @@
 
 #include <wayland-util.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <libweston/weston-log.h>
 #include <wayland-server-core.h>
@@ -41,8 +42,37 @@ enum timeline_type {
 	TLT_SURFACE,
 	TLT_VBLANK,
 	TLT_GPU,
+	TLT_COMMIT,
 };
 
+/** Where the time went between a surface commit and its presentation
+ *
+ * Argument of the core_commit_presented timeline point.
+ *
+ * @ingroup internal-log
+ */
+struct weston_timeline_commit {
+	uint64_t seq;		/**< content commits on the surface so far */
+	int32_t pid;		/**< of the client, 0 if unknown */
+	int64_t client_nsec;	/**< frame callback to commit */
+	int64_t queue_nsec;	/**< commit to repaint start */
+	int64_t repaint_nsec;	/**< repaint start to backend submission */
+	int64_t present_nsec;	/**< backend submission to presentation */
+};
+
+/** Encoding written to a timeline subscription
+ *
+ * @ingroup internal-log
+ */
+enum weston_timeline_format {
+	/** One JSON object per line, for wesgr. */
+	WESTON_TIMELINE_FORMAT_JSON = 0,
+	/** Perfetto TracePacket protobuf records. */
+	WESTON_TIMELINE_FORMAT_PERFETTO,
+};
+
+#define WESTON_TIMELINE_MAX_INTERNED_NAMES 32
+
 /** Timeline subscription created for each subscription
  *
  * Created automatically by weston_log_scope::new_subscription and
@@ -53,6 +83,14 @@ enum timeline_type {
 struct weston_timeline_subscription {
 	unsigned int next_id;
 	struct wl_list objects; /**< weston_timeline_subscription_object::subscription_link */
+
+	enum weston_timeline_format format;
+
+	/* WESTON_TIMELINE_FORMAT_PERFETTO only */
+	uint32_t sequence_id;
+	bool sequence_started;
+	const char *interned_names[WESTON_TIMELINE_MAX_INTERNED_NAMES];
+	unsigned int interned_count;
 };
 
 /**
@@ -80,6 +118,8 @@ struct weston_timeline_subscription_object {
 #define TLP_SURFACE(s) TLT_SURFACE, TYPEVERIFY(struct weston_surface *, (s))
 #define TLP_VBLANK(t) TLT_VBLANK, TYPEVERIFY(const struct timespec *, (t))
 #define TLP_GPU(t) TLT_GPU, TYPEVERIFY(const struct timespec *, (t))
+#define TLP_COMMIT(c) TLT_COMMIT, \
+	TYPEVERIFY(const struct weston_timeline_commit *, (c))
 
 /** This macro is used to add timeline points.
  *
@@ -91,6 +131,7 @@ struct weston_timeline_subscription_object {
  */
 #define TL_POINT(ec, ...) do { \
 	weston_timeline_point(ec->timeline, __VA_ARGS__); \
+	weston_timeline_point(ec->timeline_perfetto, __VA_ARGS__); \
 } while (0)
 
 void
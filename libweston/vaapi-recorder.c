@@ -70,21 +70,57 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
+#define DEFAULT_QUEUE_DEPTH	3
+#define DEFAULT_FRAMERATE	60
+
+/* A frame moving through the pipeline: the imported RGB surface stays alive
+ * until the encoder is done with the converted YUV copy. */
+struct vaapi_frame {
+	VASurfaceID rgb;
+	VASurfaceID yuv;
+};
+
+/* Fixed-size FIFO of indices, capacity is the queue depth */
+struct frame_ring {
+	int *entries;
+	int head, count;
+};
+
 struct vaapi_recorder {
 	int drm_fd, output_fd;
 	int width, height;
 	int frame_count;
+	uint32_t framerate;
+	uint32_t bitrate;
+
+	vaapi_recorder_output_func_t output_func;
+	void *output_data;
 
+	/* Everything below up to va_dpy is protected by mutex. The convert
+	 * thread imports and color converts queued buffers while the encode
+	 * thread works on earlier frames, so up to queue_depth frames are in
+	 * flight at once. */
 	int error;
 	int destroying;
-	pthread_t worker_thread;
+	int force_keyframe;
+	pthread_t convert_thread;
+	pthread_t encode_thread;
 	pthread_mutex_t mutex;
-	pthread_cond_t input_cond;
+	pthread_cond_t cond;
 
+	int queue_depth;
+	struct vaapi_frame *frames;
+
+	/* dmabufs waiting for conversion */
 	struct {
-		int valid;
 		int prime_fd, stride;
-	} input;
+	} *input;
+	int input_head, input_count;
+
+	/* frames waiting for the encoder, in submission order */
+	struct frame_ring encode;
+	/* frames that can take a new conversion */
+	struct frame_ring free;
 
 	VADisplay va_dpy;
 
@@ -93,7 +129,6 @@ struct vaapi_recorder {
 		VAConfigID cfg;
 		VAContextID ctx;
 		VABufferID pipeline_buf;
-		VASurfaceID output;
 	} vpp;
 
 	struct {
@@ -104,6 +139,7 @@ struct vaapi_recorder {
 		int intra_period;
 		int output_size;
 		int constraint_set_flag;
+		uint32_t rate_control;
 
 		struct {
 			VAEncSequenceParameterBufferH264 seq;
@@ -114,7 +150,32 @@ struct vaapi_recorder {
 };
 
 static void *
-worker_thread_function(void *);
+convert_thread_function(void *);
+static void *
+encode_thread_function(void *);
+
+static void
+frame_ring_push(struct frame_ring *ring, int depth, int index)
+{
+	assert(ring->count < depth);
+
+	ring->entries[(ring->head + ring->count) % depth] = index;
+	ring->count++;
+}
+
+static int
+frame_ring_pop(struct frame_ring *ring, int depth)
+{
+	int index;
+
+	assert(ring->count > 0);
+
+	index = ring->entries[ring->head];
+	ring->head = (ring->head + 1) % depth;
+	ring->count--;
+
+	return index;
+}
 
 /* bitstream code used for writing the packed headers */
 
@@ -235,6 +296,29 @@ bitstream_byte_aligning(struct bitstream *bs, int bit)
 	bitstream_put_ui(bs, new_val, bit_left);
 }
 
+static uint32_t
+encoder_pick_rate_control(struct vaapi_recorder *r)
+{
+	VAConfigAttrib attrib;
+	VAStatus status;
+
+	if (r->bitrate == 0)
+		return VA_RC_CQP;
+
+	attrib.type = VAConfigAttribRateControl;
+	status = vaGetConfigAttributes(r->va_dpy, VAProfileH264Main,
+				       VAEntrypointEncSlice, &attrib, 1);
+	if (status == VA_STATUS_SUCCESS &&
+	    attrib.value != VA_ATTRIB_NOT_SUPPORTED &&
+	    (attrib.value & VA_RC_CBR))
+		return VA_RC_CBR;
+
+	weston_log("vaapi: CBR rate control not supported, using CQP\n");
+	r->bitrate = 0;
+
+	return VA_RC_CQP;
+}
+
 static VAStatus
 encoder_create_config(struct vaapi_recorder *r)
 {
@@ -243,13 +327,13 @@ encoder_create_config(struct vaapi_recorder *r)
 
 	/* FIXME: should check if VAEntrypointEncSlice is supported */
 
-	/* FIXME: should check if specified attributes are supported */
+	r->encoder.rate_control = encoder_pick_rate_control(r);
 
 	attrib[0].type = VAConfigAttribRTFormat;
 	attrib[0].value = VA_RT_FORMAT_YUV420;
 
 	attrib[1].type = VAConfigAttribRateControl;
-	attrib[1].value = VA_RC_CQP;
+	attrib[1].value = r->encoder.rate_control;
 
 	status = vaCreateConfig(r->va_dpy, VAProfileH264Main,
 				VAEntrypointEncSlice, attrib, 2,
@@ -292,9 +376,10 @@ encoder_init_seq_parameters(struct vaapi_recorder *r)
 	r->encoder.param.seq.picture_height_in_mbs = height_in_mbs;
 	r->encoder.param.seq.seq_fields.bits.frame_mbs_only_flag = 1;
 
-	/* Tc = num_units_in_tick / time_scale */
-	r->encoder.param.seq.time_scale = 1800;
-	r->encoder.param.seq.num_units_in_tick = 15;
+	/* Tc = num_units_in_tick / time_scale, one tick per field */
+	r->encoder.param.seq.time_scale = r->framerate * 2;
+	r->encoder.param.seq.num_units_in_tick = 1;
+	r->encoder.param.seq.bits_per_second = r->bitrate;
 
 	if (height_in_mbs * 16 - r->height > 0) {
 		frame_cropping_flag = 1;
@@ -403,16 +488,15 @@ encoder_update_slice_parameter(struct vaapi_recorder *r, int slice_type)
 }
 
 static VABufferID
-encoder_update_misc_hdr_parameter(struct vaapi_recorder *r)
+encoder_create_misc_parameter(struct vaapi_recorder *r,
+			      VAEncMiscParameterType type,
+			      const void *data, size_t size)
 {
 	VAEncMiscParameterBuffer *misc_param;
-	VAEncMiscParameterHRD *hrd;
 	VABufferID buffer;
 	VAStatus status;
 
-	int total_size =
-		sizeof(VAEncMiscParameterBuffer) +
-		sizeof(VAEncMiscParameterRateControl);
+	int total_size = sizeof(VAEncMiscParameterBuffer) + size;
 
 	status = vaCreateBuffer(r->va_dpy, r->encoder.ctx,
 				VAEncMiscParameterBufferType, total_size,
@@ -426,17 +510,61 @@ encoder_update_misc_hdr_parameter(struct vaapi_recorder *r)
 		return VA_INVALID_ID;
 	}
 
-	misc_param->type = VAEncMiscParameterTypeHRD;
-	hrd = (VAEncMiscParameterHRD *) misc_param->data;
-
-	hrd->initial_buffer_fullness = 0;
-	hrd->buffer_size = 0;
+	misc_param->type = type;
+	memcpy(misc_param->data, data, size);
 
 	vaUnmapBuffer(r->va_dpy, buffer);
 
 	return buffer;
 }
 
+/* With a bit rate set, keep the HRD buffer at a quarter second so single
+ * frames cannot burst far above the target: a consumer never has to buffer
+ * more than that before it can present a frame. */
+static int
+encoder_hrd_buffer_size(struct vaapi_recorder *r)
+{
+	return r->bitrate / 4;
+}
+
+static VABufferID
+encoder_update_misc_hdr_parameter(struct vaapi_recorder *r)
+{
+	VAEncMiscParameterHRD hrd = { 0 };
+
+	hrd.buffer_size = encoder_hrd_buffer_size(r);
+	hrd.initial_buffer_fullness = hrd.buffer_size / 2;
+
+	return encoder_create_misc_parameter(r, VAEncMiscParameterTypeHRD,
+					     &hrd, sizeof hrd);
+}
+
+static VABufferID
+encoder_update_misc_rate_control_parameter(struct vaapi_recorder *r)
+{
+	VAEncMiscParameterRateControl rc = { 0 };
+
+	rc.bits_per_second = r->bitrate;
+	rc.target_percentage = 100;
+	rc.window_size = 250;
+	/* Static desktop content should not be padded up to the target */
+	rc.rc_flags.bits.disable_bit_stuffing = 1;
+
+	return encoder_create_misc_parameter(r, VAEncMiscParameterTypeRateControl,
+					     &rc, sizeof rc);
+}
+
+static VABufferID
+encoder_update_misc_framerate_parameter(struct vaapi_recorder *r)
+{
+	VAEncMiscParameterFrameRate fr = { 0 };
+
+	fr.framerate = r->framerate;
+
+	return encoder_create_misc_parameter(r, VAEncMiscParameterTypeFrameRate,
+					     &fr, sizeof fr);
+}
+
 static int
 setup_encoder(struct vaapi_recorder *r)
 {
@@ -750,10 +878,46 @@ enum output_write_status {
 	OUTPUT_WRITE_FATAL
 };
 
+/* Hand a complete access unit to the output callback. The driver can split
+ * the coded buffer into several segments, so gather them first. */
 static enum output_write_status
-encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
+encoder_send_output(struct vaapi_recorder *r, VACodedBufferSegment *segment,
+		    bool keyframe)
+{
+	VACodedBufferSegment *s;
+	uint8_t *data, *p;
+	size_t size = 0;
+
+	if (!segment->next) {
+		r->output_func(r->output_data, segment->buf, segment->size,
+			       keyframe);
+		return OUTPUT_WRITE_SUCCESS;
+	}
+
+	for (s = segment; s; s = s->next)
+		size += s->size;
+
+	data = malloc(size);
+	if (!data)
+		return OUTPUT_WRITE_FATAL;
+
+	for (s = segment, p = data; s; s = s->next) {
+		memcpy(p, s->buf, s->size);
+		p += s->size;
+	}
+
+	r->output_func(r->output_data, data, size, keyframe);
+	free(data);
+
+	return OUTPUT_WRITE_SUCCESS;
+}
+
+static enum output_write_status
+encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf,
+		     bool keyframe)
 {
 	VACodedBufferSegment *segment;
+	enum output_write_status ret;
 	VAStatus status;
 	int count;
 
@@ -767,6 +931,12 @@ encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 		return OUTPUT_WRITE_OVERFLOW;
 	}
 
+	if (r->output_func) {
+		ret = encoder_send_output(r, segment, keyframe);
+		vaUnmapBuffer(r->va_dpy, output_buf);
+		return ret;
+	}
+
 	count = write(r->output_fd, segment->buf, segment->size);
 
 	vaUnmapBuffer(r->va_dpy, output_buf);
@@ -777,16 +947,24 @@ encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 	return OUTPUT_WRITE_SUCCESS;
 }
 
-static void
+/* Returns 0, or an errno value if the output could not be written */
+static int
 encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 {
 	VABufferID output_buf = VA_INVALID_ID;
 
-	VABufferID buffers[8];
+	VABufferID buffers[12];
 	int count = 0;
 	int i, slice_type;
+	int err;
 	enum output_write_status ret;
 
+	/* A stream consumer may join at any point, so restart with an IDR
+	 * picture and fresh headers on every intra period instead of only
+	 * at the start of the file. */
+	if (r->output_func && r->frame_count == r->encoder.intra_period)
+		r->frame_count = 0;
+
 	if ((r->frame_count % r->encoder.intra_period) == 0)
 		slice_type = SLICE_TYPE_I;
 	else
@@ -794,6 +972,10 @@ encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 
 	buffers[count++] = encoder_update_seq_parameters(r);
 	buffers[count++] = encoder_update_misc_hdr_parameter(r);
+	if (r->encoder.rate_control == VA_RC_CBR) {
+		buffers[count++] = encoder_update_misc_rate_control_parameter(r);
+		buffers[count++] = encoder_update_misc_framerate_parameter(r);
+	}
 	buffers[count++] = encoder_update_slice_parameter(r, slice_type);
 
 	for (i = 0; i < count; i++)
@@ -814,7 +996,9 @@ encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 			goto bail;
 
 		encoder_render_picture(r, input, buffers, count);
-		ret = encoder_write_output(r, output_buf);
+		ret = encoder_write_output(r, output_buf,
+					   slice_type == SLICE_TYPE_I &&
+					   r->frame_count == 0);
 
 		vaDestroyBuffer(r->va_dpy, output_buf);
 		output_buf = VA_INVALID_ID;
@@ -822,20 +1006,21 @@ encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 		vaDestroyBuffer(r->va_dpy, buffers[--count]);
 	} while (ret == OUTPUT_WRITE_OVERFLOW);
 
-	if (ret == OUTPUT_WRITE_FATAL)
-		r->error = errno;
+	err = ret == OUTPUT_WRITE_FATAL ? errno : 0;
 
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
 
 	r->frame_count++;
-	return;
+	return err;
 
 bail:
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
 	if (output_buf != VA_INVALID_ID)
 		vaDestroyBuffer(r->va_dpy, output_buf);
+
+	return 0;
 }
 
 
@@ -843,6 +1028,7 @@ static int
 setup_vpp(struct vaapi_recorder *r)
 {
 	VAStatus status;
+	int i;
 
 	status = vaCreateConfig(r->va_dpy, VAProfileNone,
 				VAEntrypointVideoProc, NULL, 0,
@@ -868,17 +1054,23 @@ setup_vpp(struct vaapi_recorder *r)
 		goto err_ctx;
 	}
 
-	status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_YUV420,
-				  r->width, r->height, &r->vpp.output, 1,
-				  NULL, 0);
-	if (status != VA_STATUS_SUCCESS) {
-		weston_log("vaapi: failed to create YUV surface\n");
-		goto err_buf;
+	/* One conversion target per frame that can be in flight */
+	for (i = 0; i < r->queue_depth; i++) {
+		r->frames[i].rgb = VA_INVALID_SURFACE;
+		status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_YUV420,
+					  r->width, r->height,
+					  &r->frames[i].yuv, 1, NULL, 0);
+		if (status != VA_STATUS_SUCCESS) {
+			weston_log("vaapi: failed to create YUV surface\n");
+			goto err_surfaces;
+		}
 	}
 
 	return 0;
 
-err_buf:
+err_surfaces:
+	while (i--)
+		vaDestroySurfaces(r->va_dpy, &r->frames[i].yuv, 1);
 	vaDestroyBuffer(r->va_dpy, r->vpp.pipeline_buf);
 err_ctx:
 	vaDestroyConfig(r->va_dpy, r->vpp.ctx);
@@ -891,62 +1083,125 @@ err_cfg:
 static void
 vpp_destroy(struct vaapi_recorder *r)
 {
-	vaDestroySurfaces(r->va_dpy, &r->vpp.output, 1);
+	int i;
+
+	for (i = 0; i < r->queue_depth; i++) {
+		if (r->frames[i].rgb != VA_INVALID_SURFACE)
+			vaDestroySurfaces(r->va_dpy, &r->frames[i].rgb, 1);
+		vaDestroySurfaces(r->va_dpy, &r->frames[i].yuv, 1);
+	}
 	vaDestroyBuffer(r->va_dpy, r->vpp.pipeline_buf);
 	vaDestroyConfig(r->va_dpy, r->vpp.ctx);
 	vaDestroyConfig(r->va_dpy, r->vpp.cfg);
 }
 
 static int
-setup_worker_thread(struct vaapi_recorder *r)
+setup_queues(struct vaapi_recorder *r)
 {
-	pthread_mutex_init(&r->mutex, NULL);
-	pthread_cond_init(&r->input_cond, NULL);
-	pthread_create(&r->worker_thread, NULL, worker_thread_function, r);
+	int i;
+
+	r->frames = zalloc(r->queue_depth * sizeof *r->frames);
+	r->input = zalloc(r->queue_depth * sizeof *r->input);
+	r->encode.entries = zalloc(r->queue_depth * sizeof(int));
+	r->free.entries = zalloc(r->queue_depth * sizeof(int));
+	if (!r->frames || !r->input || !r->encode.entries ||
+	    !r->free.entries)
+		return -1;
+
+	for (i = 0; i < r->queue_depth; i++)
+		frame_ring_push(&r->free, r->queue_depth, i);
 
-	return 1;
+	return 0;
 }
 
 static void
-destroy_worker_thread(struct vaapi_recorder *r)
+destroy_queues(struct vaapi_recorder *r)
+{
+	/* Buffers that were queued but never converted */
+	while (r->input_count > 0) {
+		close(r->input[r->input_head].prime_fd);
+		r->input_head = (r->input_head + 1) % r->queue_depth;
+		r->input_count--;
+	}
+
+	free(r->frames);
+	free(r->input);
+	free(r->encode.entries);
+	free(r->free.entries);
+}
+
+static void
+setup_worker_threads(struct vaapi_recorder *r)
+{
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	pthread_create(&r->convert_thread, NULL, convert_thread_function, r);
+	pthread_create(&r->encode_thread, NULL, encode_thread_function, r);
+}
+
+static void
+destroy_worker_threads(struct vaapi_recorder *r)
 {
 	pthread_mutex_lock(&r->mutex);
 
-	/* Make sure the worker thread finishes */
+	/* Make sure the worker threads finish */
 	r->destroying = 1;
-	pthread_cond_signal(&r->input_cond);
+	pthread_cond_broadcast(&r->cond);
 
 	pthread_mutex_unlock(&r->mutex);
 
-	pthread_join(r->worker_thread, NULL);
+	pthread_join(r->convert_thread, NULL);
+	pthread_join(r->encode_thread, NULL);
 
 	pthread_mutex_destroy(&r->mutex);
-	pthread_cond_destroy(&r->input_cond);
+	pthread_cond_destroy(&r->cond);
 }
 
+/** Create an encoder
+ *
+ * The encoder converts and encodes frames on its own threads, so it can be
+ * fed from any backend that has the output contents in a dmabuf. The
+ * encoded stream is either written to \p options->filename or, if that is
+ * NULL, handed to \p options->output_func one access unit at a time. The
+ * callback runs on an encoder thread; the data is only valid for the
+ * duration of the call.
+ *
+ * The recorder takes ownership of \p drm_fd on success.
+ */
 struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+vaapi_recorder_create_with_options(int drm_fd,
+				   const struct vaapi_recorder_options *options)
 {
 	struct vaapi_recorder *r;
 	VAStatus status;
 	int major, minor;
 	int flags;
 
+	assert(options->filename || options->output_func);
+
 	r = zalloc(sizeof *r);
 	if (r == NULL)
 		return NULL;
 
-	r->width = width;
-	r->height = height;
+	r->width = options->width;
+	r->height = options->height;
+	r->framerate = options->framerate ?: DEFAULT_FRAMERATE;
+	r->bitrate = options->bitrate;
+	r->queue_depth = options->queue_depth ?: DEFAULT_QUEUE_DEPTH;
 	r->drm_fd = drm_fd;
+	r->output_fd = -1;
+	r->output_func = options->output_func;
+	r->output_data = options->output_data;
 
-	if (setup_worker_thread(r) < 0)
+	if (setup_queues(r) < 0)
 		goto err_free;
 
-	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
-	r->output_fd = open(filename, flags, 0644);
-	if (r->output_fd < 0)
-		goto err_thread;
+	if (options->filename) {
+		flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+		r->output_fd = open(options->filename, flags, 0644);
+		if (r->output_fd < 0)
+			goto err_free;
+	}
 
 	r->va_dpy = vaGetDisplayDRM(drm_fd);
 	if (!r->va_dpy) {
@@ -969,6 +1224,8 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 		goto err_vpp;
 	}
 
+	setup_worker_threads(r);
+
 	return r;
 
 err_vpp:
@@ -976,28 +1233,42 @@ err_vpp:
 err_va_dpy:
 	vaTerminate(r->va_dpy);
 err_fd:
-	close(r->output_fd);
-err_thread:
-	destroy_worker_thread(r);
+	if (r->output_fd >= 0)
+		close(r->output_fd);
 err_free:
+	destroy_queues(r);
 	free(r);
 
 	return NULL;
 }
 
+struct vaapi_recorder *
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+{
+	const struct vaapi_recorder_options options = {
+		.width = width,
+		.height = height,
+		.filename = filename,
+	};
+
+	return vaapi_recorder_create_with_options(drm_fd, &options);
+}
+
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r)
 {
-	destroy_worker_thread(r);
+	destroy_worker_threads(r);
 
 	encoder_destroy(r);
 	vpp_destroy(r);
 
 	vaTerminate(r->va_dpy);
 
-	close(r->output_fd);
+	if (r->output_fd >= 0)
+		close(r->output_fd);
 	close(r->drm_fd);
 
+	destroy_queues(r);
 	free(r);
 }
 
@@ -1040,8 +1311,11 @@ create_surface_from_fd(struct vaapi_recorder *r, int prime_fd,
 	return status;
 }
 
+/* Only submits the conversion; the encoder waits for it implicitly when it
+ * starts reading the YUV surface. */
 static VAStatus
-convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
+convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface,
+		   VASurfaceID yuv_surface)
 {
 	VAProcPipelineParameterBuffer *pipeline_param;
 	VAStatus status;
@@ -1063,7 +1337,7 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, r->vpp.output);
+	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, yuv_surface);
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
@@ -1079,52 +1353,110 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	return status;
 }
 
-static void
-recorder_frame(struct vaapi_recorder *r)
+static int
+recorder_convert(struct vaapi_recorder *r, struct vaapi_frame *frame,
+		 int prime_fd, int stride)
 {
-	VASurfaceID rgb_surface;
 	VAStatus status;
 
-	status = create_surface_from_fd(r, r->input.prime_fd,
-					r->input.stride, &rgb_surface);
+	status = create_surface_from_fd(r, prime_fd, stride, &frame->rgb);
+	close(prime_fd);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "failed to create surface from bo\n");
-		return;
+		frame->rgb = VA_INVALID_SURFACE;
+		return -1;
 	}
 
-	close(r->input.prime_fd);
-
-	status = convert_rgb_to_yuv(r, rgb_surface);
+	status = convert_rgb_to_yuv(r, frame->rgb, frame->yuv);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "color space conversion failed\n");
-		return;
+		vaDestroySurfaces(r->va_dpy, &frame->rgb, 1);
+		frame->rgb = VA_INVALID_SURFACE;
+		return -1;
 	}
 
-	encoder_encode(r, r->vpp.output);
-
-	vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
+	return 0;
 }
 
 static void *
-worker_thread_function(void *data)
+convert_thread_function(void *data)
 {
 	struct vaapi_recorder *r = data;
+	int index, prime_fd, stride;
 
 	pthread_mutex_lock(&r->mutex);
 
 	while (!r->destroying) {
-		if (!r->input.valid)
-			pthread_cond_wait(&r->input_cond, &r->mutex);
-
-		/* If the thread is awaken by destroy_worker_thread(),
-		 * there might not be valid input */
-		if (!r->input.valid)
+		if (r->input_count == 0 || r->free.count == 0) {
+			pthread_cond_wait(&r->cond, &r->mutex);
 			continue;
+		}
+
+		prime_fd = r->input[r->input_head].prime_fd;
+		stride = r->input[r->input_head].stride;
+		r->input_head = (r->input_head + 1) % r->queue_depth;
+		r->input_count--;
+
+		index = frame_ring_pop(&r->free, r->queue_depth);
+
+		/* Wake up a producer waiting for a queue slot */
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+
+		if (recorder_convert(r, &r->frames[index],
+				     prime_fd, stride) == 0) {
+			pthread_mutex_lock(&r->mutex);
+			frame_ring_push(&r->encode, r->queue_depth, index);
+		} else {
+			pthread_mutex_lock(&r->mutex);
+			frame_ring_push(&r->free, r->queue_depth, index);
+		}
+		pthread_cond_broadcast(&r->cond);
+	}
+
+	pthread_mutex_unlock(&r->mutex);
+
+	return NULL;
+}
+
+static void *
+encode_thread_function(void *data)
+{
+	struct vaapi_recorder *r = data;
+	struct vaapi_frame *frame;
+	int index, err;
 
-		recorder_frame(r);
-		r->input.valid = 0;
+	pthread_mutex_lock(&r->mutex);
+
+	/* Frames that were already converted still get encoded on destroy */
+	for (;;) {
+		if (r->encode.count == 0) {
+			if (r->destroying)
+				break;
+			pthread_cond_wait(&r->cond, &r->mutex);
+			continue;
+		}
+
+		index = frame_ring_pop(&r->encode, r->queue_depth);
+		if (r->force_keyframe) {
+			r->frame_count = 0;
+			r->force_keyframe = 0;
+		}
+
+		pthread_mutex_unlock(&r->mutex);
+
+		frame = &r->frames[index];
+		err = encoder_encode(r, frame->yuv);
+		vaDestroySurfaces(r->va_dpy, &frame->rgb, 1);
+		frame->rgb = VA_INVALID_SURFACE;
+
+		pthread_mutex_lock(&r->mutex);
+		if (err)
+			r->error = err;
+		frame_ring_push(&r->free, r->queue_depth, index);
+		pthread_cond_broadcast(&r->cond);
 	}
 
 	pthread_mutex_unlock(&r->mutex);
@@ -1132,6 +1464,11 @@ worker_thread_function(void *data)
 	return NULL;
 }
 
+/** Queue a dmabuf for encoding
+ *
+ * Takes ownership of \p prime_fd. Only blocks when queue_depth buffers are
+ * already waiting for conversion.
+ */
 int
 vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
 {
@@ -1139,23 +1476,33 @@ vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
 
 	pthread_mutex_lock(&r->mutex);
 
+	while (!r->error && r->input_count == r->queue_depth)
+		pthread_cond_wait(&r->cond, &r->mutex);
+
 	if (r->error) {
 		errno = r->error;
 		ret = -1;
 		goto unlock;
 	}
 
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if input.valid is true. */
-	assert(!r->input.valid);
-
-	r->input.prime_fd = prime_fd;
-	r->input.stride = stride;
-	r->input.valid = 1;
-	pthread_cond_signal(&r->input_cond);
+	r->input[(r->input_head + r->input_count) % r->queue_depth].prime_fd =
+		prime_fd;
+	r->input[(r->input_head + r->input_count) % r->queue_depth].stride =
+		stride;
+	r->input_count++;
+	pthread_cond_broadcast(&r->cond);
 
 unlock:
 	pthread_mutex_unlock(&r->mutex);
 
 	return ret;
 }
+
+/** Make the next encoded frame an IDR picture carrying SPS and PPS */
+void
+vaapi_recorder_force_keyframe(struct vaapi_recorder *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	r->force_keyframe = 1;
+	pthread_mutex_unlock(&r->mutex);
+}
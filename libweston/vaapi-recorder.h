@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _VAAPI_RECORDER_H_
+#define _VAAPI_RECORDER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct vaapi_recorder;
+
+typedef void (*vaapi_recorder_output_func_t)(void *data, const void *bitstream,
+					     size_t size, bool keyframe);
+
+struct vaapi_recorder_options {
+	int width;
+	int height;
+
+	/** Frames that can be queued or in flight, 0 for the default of 3 */
+	int queue_depth;
+	/** Nominal frames per second, 0 for the default of 60 */
+	uint32_t framerate;
+	/** Target bits per second for constant bit rate control, 0 uses
+	 * constant QP. The stream only has I and P frames either way. */
+	uint32_t bitrate;
+
+	/** File to write the stream to, or NULL to use output_func */
+	const char *filename;
+	vaapi_recorder_output_func_t output_func;
+	void *output_data;
+};
+
+struct vaapi_recorder *
+vaapi_recorder_create_with_options(int drm_fd,
+				   const struct vaapi_recorder_options *options);
+struct vaapi_recorder *
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
+void
+vaapi_recorder_destroy(struct vaapi_recorder *r);
+int
+vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+void
+vaapi_recorder_force_keyframe(struct vaapi_recorder *r);
+
+#endif /* _VAAPI_RECORDER_H_ */
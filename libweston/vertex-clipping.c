@@ -27,6 +27,12 @@
 #include <math.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "shared/helpers.h"
 #include "vertex-clipping.h"
 
@@ -414,3 +420,228 @@ clipper_quad_clip_box32(struct clipper_quad *quad,
 
 	return clipper_quad_clip(quad, box_vertices, vertices);
 }
+
+static int
+clip_boxes32_generic(struct clipper_quad *quad,
+		     const struct pixman_box32 *boxes,
+		     int nboxes,
+		     struct clipper_vertex *restrict vertices,
+		     int *counts)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nboxes; i++) {
+		counts[i] = clipper_quad_clip_box32(quad, &boxes[i],
+						    &vertices[n]);
+		n += counts[i];
+	}
+
+	return n;
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+
+/* The SIMD variants keep the quad as one vector of x and one of y
+ * coordinates. Aligned quads get clamped to a box in one go, which has
+ * to give the very same floats as CLIP(): max and min return their second
+ * operand unless the first one is strictly greater, resp. smaller.
+ * Unaligned quads get their bounding box tested against four boxes at a
+ * time, and only the boxes it touches go through clip().
+ */
+
+#if defined(__SSE2__)
+
+typedef __m128 clipper_vec;
+
+static inline clipper_vec
+vec_load(const float *f)
+{
+	return _mm_loadu_ps(f);
+}
+
+static inline clipper_vec
+vec_clamp(clipper_vec v, float lo, float hi)
+{
+	/* _mm_max_ps(a, b) is a > b ? a : b, so this is exactly CLIP(). */
+	return _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+}
+
+static inline void
+vec_store_xy(struct clipper_vertex *vertices, clipper_vec x, clipper_vec y)
+{
+	float *f = &vertices[0].x;
+
+	_mm_storeu_ps(f, _mm_unpacklo_ps(x, y));
+	_mm_storeu_ps(f + 4, _mm_unpackhi_ps(x, y));
+}
+
+/* Returns a bit mask of which of the 4 boxes the bounding box misses. */
+static inline int
+vec_reject4(const struct clipper_vertex bbox[2],
+	    const struct pixman_box32 *boxes)
+{
+	__m128 x1 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &boxes[0]));
+	__m128 y1 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &boxes[1]));
+	__m128 x2 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &boxes[2]));
+	__m128 y2 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &boxes[3]));
+	__m128 reject;
+
+	/* Rows are boxes, make the rows x1, y1, x2 and y2 of all boxes. */
+	_MM_TRANSPOSE4_PS(x1, y1, x2, y2);
+
+	reject = _mm_or_ps(_mm_cmpge_ps(_mm_set1_ps(bbox[0].x), x2),
+			   _mm_cmple_ps(_mm_set1_ps(bbox[1].x), x1));
+	reject = _mm_or_ps(reject,
+			   _mm_cmpge_ps(_mm_set1_ps(bbox[0].y), y2));
+	reject = _mm_or_ps(reject,
+			   _mm_cmple_ps(_mm_set1_ps(bbox[1].y), y1));
+
+	return _mm_movemask_ps(reject);
+}
+
+#elif defined(__ARM_NEON)
+
+typedef float32x4_t clipper_vec;
+
+static inline clipper_vec
+vec_load(const float *f)
+{
+	return vld1q_f32(f);
+}
+
+static inline clipper_vec
+vec_clamp(clipper_vec v, float lo, float hi)
+{
+	float32x4_t vlo = vdupq_n_f32(lo);
+	float32x4_t vhi = vdupq_n_f32(hi);
+
+	/* vmaxq_f32() and vminq_f32() treat signed zeros differently from
+	 * CLIP(), select explicitly instead. */
+	v = vbslq_f32(vcgtq_f32(v, vlo), v, vlo);
+	return vbslq_f32(vcltq_f32(v, vhi), v, vhi);
+}
+
+static inline void
+vec_store_xy(struct clipper_vertex *vertices, clipper_vec x, clipper_vec y)
+{
+	float32x4x2_t xy = { { x, y } };
+
+	vst2q_f32(&vertices[0].x, xy);
+}
+
+static inline int
+vec_reject4(const struct clipper_vertex bbox[2],
+	    const struct pixman_box32 *boxes)
+{
+	/* De-interleaves into x1, y1, x2 and y2 of all boxes. */
+	int32x4x4_t b = vld4q_s32((const int32_t *) boxes);
+	uint32x4_t reject;
+
+	reject = vorrq_u32(vcgeq_f32(vdupq_n_f32(bbox[0].x),
+				     vcvtq_f32_s32(b.val[2])),
+			   vcleq_f32(vdupq_n_f32(bbox[1].x),
+				     vcvtq_f32_s32(b.val[0])));
+	reject = vorrq_u32(reject,
+			   vcgeq_f32(vdupq_n_f32(bbox[0].y),
+				     vcvtq_f32_s32(b.val[3])));
+	reject = vorrq_u32(reject,
+			   vcleq_f32(vdupq_n_f32(bbox[1].y),
+				     vcvtq_f32_s32(b.val[1])));
+
+	return (vgetq_lane_u32(reject, 0) & 1) |
+	       (vgetq_lane_u32(reject, 1) & 2) |
+	       (vgetq_lane_u32(reject, 2) & 4) |
+	       (vgetq_lane_u32(reject, 3) & 8);
+}
+
+#endif
+
+static int
+clip_boxes32_aligned(struct clipper_quad *quad,
+		     const struct pixman_box32 *boxes,
+		     int nboxes,
+		     struct clipper_vertex *restrict vertices,
+		     int *counts)
+{
+	float px[4], py[4];
+	clipper_vec x, y;
+	int i, n = 0;
+
+	for (i = 0; i < 4; i++) {
+		px[i] = quad->polygon[i].x;
+		py[i] = quad->polygon[i].y;
+	}
+	x = vec_load(px);
+	y = vec_load(py);
+
+	for (i = 0; i < nboxes; i++) {
+		struct clipper_vertex *v = &vertices[n];
+
+		vec_store_xy(v,
+			     vec_clamp(x, boxes[i].x1, boxes[i].x2),
+			     vec_clamp(y, boxes[i].y1, boxes[i].y2));
+
+		if (v[0].x != v[2].x && v[0].y != v[2].y)
+			counts[i] = 4;
+		else
+			counts[i] = 0;
+		n += counts[i];
+	}
+
+	return n;
+}
+
+static int
+clip_boxes32_unaligned(struct clipper_quad *quad,
+		       const struct pixman_box32 *boxes,
+		       int nboxes,
+		       struct clipper_vertex *restrict vertices,
+		       int *counts)
+{
+	int i, j, reject, n = 0;
+
+	for (i = 0; i + 4 <= nboxes; i += 4) {
+		reject = vec_reject4(quad->bbox, &boxes[i]);
+
+		for (j = 0; j < 4; j++) {
+			struct clipper_vertex box[2] = {
+				{ boxes[i + j].x1, boxes[i + j].y1 },
+				{ boxes[i + j].x2, boxes[i + j].y2 },
+			};
+			int count = 0;
+
+			if (!(reject & (1 << j))) {
+				count = clip(quad->polygon, box, &vertices[n]);
+				if (count < 3)
+					count = 0;
+			}
+
+			counts[i + j] = count;
+			n += count;
+		}
+	}
+
+	return n + clip_boxes32_generic(quad, &boxes[i], nboxes - i,
+					&vertices[n], &counts[i]);
+}
+
+#endif
+
+WESTON_EXPORT_FOR_TESTS int
+clipper_quad_clip_boxes32(struct clipper_quad *quad,
+			  const struct pixman_box32 *boxes,
+			  int nboxes,
+			  struct clipper_vertex *restrict vertices,
+			  int *counts)
+{
+#if defined(__SSE2__) || defined(__ARM_NEON)
+	if (quad->axis_aligned)
+		return clip_boxes32_aligned(quad, boxes, nboxes,
+					    vertices, counts);
+	else
+		return clip_boxes32_unaligned(quad, boxes, nboxes,
+					      vertices, counts);
+#else
+	return clip_boxes32_generic(quad, boxes, nboxes, vertices, counts);
+#endif
+}
@@ -75,6 +75,22 @@ clipper_quad_clip_box32(struct clipper_quad *quad,
 			const struct pixman_box32 *box,
 			struct clipper_vertex *restrict vertices);
 
+/*
+ * Clip a 'quad' to each of the 'nboxes' clipping boxes pointed to by 'boxes',
+ * with the same results as calling 'clipper_quad_clip_box32()' for each of
+ * them, but using SIMD instructions where available. The vertices of each
+ * intersection are written to 'vertices' right after those of the previous
+ * box, and their count to the box's entry in 'counts'. 'vertices' must have
+ * room for 8 vertices per box. The return value is the total number of
+ * vertices created.
+ */
+int
+clipper_quad_clip_boxes32(struct clipper_quad *quad,
+			  const struct pixman_box32 *boxes,
+			  int nboxes,
+			  struct clipper_vertex *restrict vertices,
+			  int *counts);
+
 float
 clipper_float_difference(float a, float b);
 
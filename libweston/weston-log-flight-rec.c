@@ -27,6 +27,7 @@
 
 #include <libweston/weston-log.h>
 #include "shared/helpers.h"
+#include "shared/string-helpers.h"
 #include <libweston/libweston.h>
 
 #include "weston-log-internal.h"
@@ -36,6 +37,9 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 struct weston_ring_buffer {
@@ -44,6 +48,8 @@ struct weston_ring_buffer {
 	char *buf;		/**< the buffer itself */
 	FILE *file;		/**< where to write in case we need to dump the buf */
 	bool overlap;		/**< in case buff overlaps, hint from where to print buf contents */
+	struct weston_flight_rec_file_header *header; /**< mapped file, or NULL */
+	size_t map_size;	/**< size of the mapping at header */
 };
 
 /** allows easy access to the ring buffer in case of a core dump
@@ -68,6 +74,17 @@ weston_ring_buffer_init(struct weston_ring_buffer *rb, size_t size, char *buf)
 	rb->file = stderr;
 }
 
+/** Mirror the ring state into the file header, if there is a file */
+static void
+weston_ring_buffer_sync_header(struct weston_ring_buffer *rb)
+{
+	if (!rb->header)
+		return;
+
+	rb->header->append_pos = rb->append_pos;
+	rb->header->overlap = rb->overlap;
+}
+
 static struct weston_debug_log_flight_recorder *
 to_flight_recorder(struct weston_log_subscriber *sub)
 {
@@ -175,6 +192,7 @@ weston_log_flight_recorder_write(struct weston_log_subscriber *sub,
 		}
 	}
 
+	weston_ring_buffer_sync_header(rb);
 }
 
 static void
@@ -220,10 +238,45 @@ weston_log_subscriber_destroy_flight_rec(struct weston_log_subscriber *sub)
 		weston_primary_flight_recorder_ring_buffer = NULL;
 
 	weston_log_subscriber_release(sub);
-	free(flight_rec->rb.buf);
+	if (flight_rec->rb.header)
+		munmap(flight_rec->rb.header, flight_rec->rb.map_size);
+	else
+		free(flight_rec->rb.buf);
 	free(flight_rec);
 }
 
+static struct weston_debug_log_flight_recorder *
+flight_rec_create(void)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+
+	assert("Can't create more than one flight recorder." &&
+			!weston_primary_flight_recorder_ring_buffer);
+
+	flight_rec = zalloc(sizeof(*flight_rec));
+	if (!flight_rec)
+		return NULL;
+
+	flight_rec->base.write = weston_log_flight_recorder_write;
+	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
+	flight_rec->base.destroy_subscription = NULL;
+	flight_rec->base.complete = NULL;
+	wl_list_init(&flight_rec->base.subscription_list);
+
+	return flight_rec;
+}
+
+static void
+flight_rec_set_buffer(struct weston_debug_log_flight_recorder *flight_rec,
+		      size_t size, char *buf)
+{
+	weston_ring_buffer_init(&flight_rec->rb, size, buf);
+	weston_primary_flight_recorder_ring_buffer = &flight_rec->rb;
+
+	/* write some data to the rb such that the memory gets mapped */
+	memset(flight_rec->rb.buf, 0xff, flight_rec->rb.size);
+}
+
 /** Create a flight recorder type of subscriber
  *
  * Allocates both the flight recorder and the underlying ring buffer. Use
@@ -239,30 +292,89 @@ weston_log_subscriber_create_flight_rec(size_t size)
 	struct weston_debug_log_flight_recorder *flight_rec;
 	char *weston_rb;
 
-	assert("Can't create more than one flight recorder." &&
-			!weston_primary_flight_recorder_ring_buffer);
-
-	flight_rec = zalloc(sizeof(*flight_rec));
+	flight_rec = flight_rec_create();
 	if (!flight_rec)
 		return NULL;
 
-	flight_rec->base.write = weston_log_flight_recorder_write;
-	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
-	flight_rec->base.destroy_subscription = NULL;
-	flight_rec->base.complete = NULL;
-	wl_list_init(&flight_rec->base.subscription_list);
-
 	weston_rb = zalloc(sizeof(char) * size);
 	if (!weston_rb) {
 		free(flight_rec);
 		return NULL;
 	}
 
-	weston_ring_buffer_init(&flight_rec->rb, size, weston_rb);
-	weston_primary_flight_recorder_ring_buffer = &flight_rec->rb;
+	flight_rec_set_buffer(flight_rec, size, weston_rb);
 
-	/* write some data to the rb such that the memory gets mapped */
-	memset(flight_rec->rb.buf, 0xff, flight_rec->rb.size);
+	return &flight_rec->base;
+}
+
+/** Create a flight recorder backed by a memory-mapped file
+ *
+ * Like weston_log_subscriber_create_flight_rec(), but the ring lives in a
+ * shared mapping of \c path, laid out as described by
+ * struct weston_flight_rec_file_header. The kernel keeps the contents when
+ * the compositor gets killed or hangs, so that they can be read post-mortem
+ * without logging to disk.
+ *
+ * A regular file is created or resized as needed; a previous one is first
+ * renamed to \c path with ".prev" appended, to keep the last run around
+ * across a restart. Anything else, like a device node giving access to
+ * reserved memory, is mapped as is and must be large enough.
+ *
+ * @param path the file to map
+ * @param size specify the maximum size (in bytes) of the ring data
+ * @returns a weston_log_subscriber object or NULL in case of failure
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_flight_rec_file(const char *path, size_t size)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+	struct weston_flight_rec_file_header *header;
+	size_t map_size = sizeof(*header) + size;
+	struct stat st;
+	char *prev;
+	int fd;
+
+	if (size < 2 || size > UINT32_MAX)
+		return NULL;
+
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+		str_printf(&prev, "%s.prev", path);
+		if (prev)
+			rename(path, prev);
+		free(prev);
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 ||
+	    (S_ISREG(st.st_mode) && ftruncate(fd, map_size) < 0)) {
+		close(fd);
+		return NULL;
+	}
+
+	header = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+		return NULL;
+
+	flight_rec = flight_rec_create();
+	if (!flight_rec) {
+		munmap(header, map_size);
+		return NULL;
+	}
+
+	flight_rec_set_buffer(flight_rec, size, (char *) (header + 1));
+	flight_rec->rb.header = header;
+	flight_rec->rb.map_size = map_size;
+
+	memcpy(header->magic, WESTON_FLIGHT_REC_FILE_MAGIC,
+	       sizeof(header->magic));
+	header->size = flight_rec->rb.size;
+	header->reserved = 0;
+	weston_ring_buffer_sync_header(&flight_rec->rb);
 
 	return &flight_rec->base;
 }
@@ -25,9 +25,14 @@
 #ifndef WESTON_LOG_INTERNAL_H
 #define WESTON_LOG_INTERNAL_H
 
+#include <stdarg.h>
+#include <stdbool.h>
+
 #include "wayland-util.h"
 
 struct weston_log_subscription;
+struct weston_log_rings;
+struct wl_event_loop;
 
 /** Subscriber allows each type of stream to customize or to provide its own
  * methods to manipulate the underlying storage. It follows also an
@@ -103,6 +108,10 @@ weston_vlog_continue(const char *fmt, va_list ap);
 void *
 weston_log_subscription_get_data(struct weston_log_subscription *sub);
 
+void
+weston_log_subscription_write(struct weston_log_subscription *sub,
+			      const char *data, size_t len);
+
 void
 weston_log_subscription_set_data(struct weston_log_subscription *sub, void *data);
 
@@ -110,8 +119,46 @@ void
 weston_timeline_create_subscription(struct weston_log_subscription *sub,
 				    void *user_data);
 
+void
+weston_timeline_create_perfetto_subscription(struct weston_log_subscription *sub,
+					     void *user_data);
+
 void
 weston_timeline_destroy_subscription(struct weston_log_subscription *sub,
 				     void *user_data);
 
+void
+weston_log_ctx_set_event_loop(struct weston_log_context *log_ctx,
+			      struct wl_event_loop *loop);
+
+void
+weston_log_scope_deliver(struct weston_log_scope *scope,
+			 const char *data, size_t len);
+
+struct weston_log_rings *
+weston_log_rings_create(void);
+
+void
+weston_log_rings_destroy(struct weston_log_rings *rings);
+
+bool
+weston_log_rings_is_main_thread(struct weston_log_rings *rings);
+
+void
+weston_log_rings_set_event_loop(struct weston_log_rings *rings,
+				struct wl_event_loop *loop);
+
+void
+weston_log_rings_push_vprintf(struct weston_log_rings *rings,
+			      struct weston_log_scope *scope,
+			      const char *fmt, va_list ap);
+
+void
+weston_log_rings_push_write(struct weston_log_rings *rings,
+			    struct weston_log_scope *scope,
+			    const char *data, size_t len);
+
+void
+weston_log_rings_drain(struct weston_log_rings *rings);
+
 #endif /* WESTON_LOG_INTERNAL_H */
@@ -0,0 +1,640 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <wayland-server-core.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "weston-log-internal.h"
+
+/** Per-thread log rings
+ *
+ * Logging from threads other than the one running the compositor event loop
+ * must not touch the subscriptions, which belong to the main thread. Instead,
+ * each such thread gets a single-producer single-consumer ring of fixed-size
+ * records. The producer only stores the format string pointer and the raw
+ * arguments (strings are copied); the main loop is woken through an eventfd,
+ * formats the records and hands them to the subscriptions.
+ *
+ * Formats used from other threads must outlive the drain, which string
+ * literals do. Anything the record can't hold in binary form, like '*'
+ * widths or %m, is formatted by the producer instead.
+ *
+ * @ingroup internal-log
+ */
+
+#define WESTON_LOG_RING_SLOTS 256
+#define WESTON_LOG_RECORD_ARGS 12
+#define WESTON_LOG_RECORD_TEXT 192
+
+enum weston_log_arg_length {
+	LOG_ARG_LEN_NONE = 0,
+	LOG_ARG_LEN_HH,
+	LOG_ARG_LEN_H,
+	LOG_ARG_LEN_L,
+	LOG_ARG_LEN_LL,
+	LOG_ARG_LEN_Z,
+	LOG_ARG_LEN_J,
+	LOG_ARG_LEN_T,
+};
+
+union weston_log_arg {
+	int64_t i;
+	uint64_t u;
+	double d;
+	const void *p;
+	uint32_t text_offset;
+};
+
+struct weston_log_record {
+	struct weston_log_scope *scope;
+	/* NULL if text holds the final message of text_len bytes */
+	const char *fmt;
+	uint32_t text_len;
+	uint32_t n_args;
+	union weston_log_arg args[WESTON_LOG_RECORD_ARGS];
+	char text[WESTON_LOG_RECORD_TEXT];
+};
+
+struct weston_log_ring {
+	struct weston_log_rings *rings;
+	struct weston_log_ring *next;
+
+	/* written by the producer, read by the consumer */
+	uint32_t tail;
+	/* written by the consumer, read by the producer */
+	uint32_t head;
+	uint32_t dropped;
+
+	struct weston_log_record slots[WESTON_LOG_RING_SLOTS];
+};
+
+struct weston_log_rings {
+	pthread_t main_thread;
+	struct weston_log_ring *list;
+	int wake_fd;
+	/* set by producers when they wrote to wake_fd, cleared by drain */
+	int wake_pending;
+	struct wl_event_source *wake_source;
+};
+
+static __thread struct weston_log_ring *thread_ring;
+
+struct weston_log_rings *
+weston_log_rings_create(void)
+{
+	struct weston_log_rings *rings = xzalloc(sizeof(*rings));
+
+	rings->main_thread = pthread_self();
+	rings->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	return rings;
+}
+
+void
+weston_log_rings_destroy(struct weston_log_rings *rings)
+{
+	struct weston_log_ring *ring, *next;
+
+	weston_log_rings_drain(rings);
+	weston_log_rings_set_event_loop(rings, NULL);
+
+	/* Threads still alive at this point are a user error; their next
+	 * log call would register with a dangling context. */
+	for (ring = rings->list; ring; ring = next) {
+		next = ring->next;
+		free(ring);
+	}
+
+	if (rings->wake_fd >= 0)
+		close(rings->wake_fd);
+	free(rings);
+}
+
+bool
+weston_log_rings_is_main_thread(struct weston_log_rings *rings)
+{
+	return pthread_equal(pthread_self(), rings->main_thread);
+}
+
+static int
+weston_log_rings_wake_cb(int fd, uint32_t mask, void *data)
+{
+	struct weston_log_rings *rings = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return 0;
+
+	weston_log_rings_drain(rings);
+
+	return 0;
+}
+
+/** Start or stop draining the rings from an event loop
+ *
+ * Before an event loop is set, records accumulate (and are dropped once a
+ * ring is full) until the next explicit drain.
+ */
+void
+weston_log_rings_set_event_loop(struct weston_log_rings *rings,
+				struct wl_event_loop *loop)
+{
+	if (rings->wake_source) {
+		wl_event_source_remove(rings->wake_source);
+		rings->wake_source = NULL;
+	}
+
+	if (loop && rings->wake_fd >= 0)
+		rings->wake_source =
+			wl_event_loop_add_fd(loop, rings->wake_fd,
+					     WL_EVENT_READABLE,
+					     weston_log_rings_wake_cb, rings);
+}
+
+static struct weston_log_ring *
+weston_log_rings_get_thread_ring(struct weston_log_rings *rings)
+{
+	struct weston_log_ring *ring = thread_ring;
+
+	if (ring && ring->rings == rings)
+		return ring;
+
+	ring = zalloc(sizeof(*ring));
+	if (!ring)
+		return NULL;
+	ring->rings = rings;
+
+	/* Lock-free push; the consumer only ever walks the list. */
+	ring->next = __atomic_load_n(&rings->list, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&rings->list, &ring->next, ring,
+					    true, __ATOMIC_RELEASE,
+					    __ATOMIC_ACQUIRE))
+		;
+
+	thread_ring = ring;
+
+	return ring;
+}
+
+static struct weston_log_record *
+weston_log_ring_reserve(struct weston_log_ring *ring)
+{
+	uint32_t tail = ring->tail;
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head >= WESTON_LOG_RING_SLOTS) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	return &ring->slots[tail % WESTON_LOG_RING_SLOTS];
+}
+
+static void
+weston_log_ring_commit(struct weston_log_ring *ring)
+{
+	struct weston_log_rings *rings = ring->rings;
+	uint64_t one = 1;
+
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+
+	/* Only the first record since the last drain started needs a
+	 * wake-up; later ones are picked up by the same drain. */
+	if (__atomic_exchange_n(&rings->wake_pending, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	if (rings->wake_fd >= 0 &&
+	    write(rings->wake_fd, &one, sizeof(one)) < 0) {
+		/* counter saturated, a wake-up is pending anyway */
+	}
+}
+
+/* Walk a printf conversion specification starting after the '%'. Returns a
+ * pointer past the conversion character, or NULL if the spec can't be
+ * captured in binary form. */
+static const char *
+weston_log_parse_spec(const char *p, enum weston_log_arg_length *length,
+		      char *conv)
+{
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	if (*p == '*')
+		return NULL;
+
+	*length = LOG_ARG_LEN_NONE;
+	switch (*p) {
+	case 'h':
+		p++;
+		*length = LOG_ARG_LEN_H;
+		if (*p == 'h') {
+			p++;
+			*length = LOG_ARG_LEN_HH;
+		}
+		break;
+	case 'l':
+		p++;
+		*length = LOG_ARG_LEN_L;
+		if (*p == 'l') {
+			p++;
+			*length = LOG_ARG_LEN_LL;
+		}
+		break;
+	case 'z':
+		p++;
+		*length = LOG_ARG_LEN_Z;
+		break;
+	case 'j':
+		p++;
+		*length = LOG_ARG_LEN_J;
+		break;
+	case 't':
+		p++;
+		*length = LOG_ARG_LEN_T;
+		break;
+	}
+
+	if (!*p || !strchr("diouxXcpsfFeEgGaA", *p))
+		return NULL;
+	if (strchr("csp", *p) && *length != LOG_ARG_LEN_NONE)
+		return NULL;
+
+	*conv = *p;
+
+	return p + 1;
+}
+
+static int64_t
+weston_log_va_arg_signed(va_list *ap, enum weston_log_arg_length length)
+{
+	switch (length) {
+	case LOG_ARG_LEN_L:
+		return va_arg(*ap, long);
+	case LOG_ARG_LEN_LL:
+		return va_arg(*ap, long long);
+	case LOG_ARG_LEN_Z:
+		return va_arg(*ap, ssize_t);
+	case LOG_ARG_LEN_J:
+		return va_arg(*ap, intmax_t);
+	case LOG_ARG_LEN_T:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, int);
+	}
+}
+
+static uint64_t
+weston_log_va_arg_unsigned(va_list *ap, enum weston_log_arg_length length)
+{
+	switch (length) {
+	case LOG_ARG_LEN_L:
+		return va_arg(*ap, unsigned long);
+	case LOG_ARG_LEN_LL:
+		return va_arg(*ap, unsigned long long);
+	case LOG_ARG_LEN_Z:
+		return va_arg(*ap, size_t);
+	case LOG_ARG_LEN_J:
+		return va_arg(*ap, uintmax_t);
+	case LOG_ARG_LEN_T:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, unsigned int);
+	}
+}
+
+/* Store the arguments of fmt into the record. Returns false if the format
+ * has anything the record can't represent. */
+static bool
+weston_log_record_capture(struct weston_log_record *rec, const char *fmt,
+			  va_list ap)
+{
+	enum weston_log_arg_length length;
+	union weston_log_arg *arg;
+	const char *p = fmt;
+	const char *s;
+	size_t n;
+	char conv;
+	va_list aq;
+
+	va_copy(aq, ap);
+	rec->n_args = 0;
+	rec->text_len = 0;
+
+	while ((p = strchr(p, '%'))) {
+		p++;
+		if (*p == '%') {
+			p++;
+			continue;
+		}
+
+		p = weston_log_parse_spec(p, &length, &conv);
+		if (!p || rec->n_args == WESTON_LOG_RECORD_ARGS)
+			goto fail;
+
+		arg = &rec->args[rec->n_args++];
+		switch (conv) {
+		case 'd':
+		case 'i':
+		case 'c':
+			arg->i = weston_log_va_arg_signed(&aq, length);
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			arg->u = weston_log_va_arg_unsigned(&aq, length);
+			break;
+		case 'p':
+			arg->p = va_arg(aq, void *);
+			break;
+		case 's':
+			s = va_arg(aq, const char *);
+			if (!s)
+				s = "(null)";
+			if (rec->text_len >= sizeof(rec->text))
+				goto fail;
+			n = strnlen(s, sizeof(rec->text) - rec->text_len - 1);
+			arg->text_offset = rec->text_len;
+			memcpy(&rec->text[rec->text_len], s, n);
+			rec->text_len += n;
+			rec->text[rec->text_len++] = '\0';
+			break;
+		default:
+			arg->d = va_arg(aq, double);
+			break;
+		}
+	}
+
+	va_end(aq);
+	rec->fmt = fmt;
+	return true;
+
+fail:
+	va_end(aq);
+	return false;
+}
+
+static void
+weston_log_format_one(char *out, size_t len, const char *spec,
+		      enum weston_log_arg_length length, char conv,
+		      const struct weston_log_record *rec,
+		      const union weston_log_arg *arg)
+{
+	switch (conv) {
+	case 'd':
+	case 'i':
+	case 'c':
+		switch (length) {
+		case LOG_ARG_LEN_L:
+			snprintf(out, len, spec, (long) arg->i);
+			break;
+		case LOG_ARG_LEN_LL:
+			snprintf(out, len, spec, (long long) arg->i);
+			break;
+		case LOG_ARG_LEN_Z:
+			snprintf(out, len, spec, (ssize_t) arg->i);
+			break;
+		case LOG_ARG_LEN_J:
+			snprintf(out, len, spec, (intmax_t) arg->i);
+			break;
+		case LOG_ARG_LEN_T:
+			snprintf(out, len, spec, (ptrdiff_t) arg->i);
+			break;
+		default:
+			snprintf(out, len, spec, (int) arg->i);
+			break;
+		}
+		break;
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		switch (length) {
+		case LOG_ARG_LEN_L:
+			snprintf(out, len, spec, (unsigned long) arg->u);
+			break;
+		case LOG_ARG_LEN_LL:
+			snprintf(out, len, spec, (unsigned long long) arg->u);
+			break;
+		case LOG_ARG_LEN_Z:
+			snprintf(out, len, spec, (size_t) arg->u);
+			break;
+		case LOG_ARG_LEN_J:
+			snprintf(out, len, spec, (uintmax_t) arg->u);
+			break;
+		case LOG_ARG_LEN_T:
+			snprintf(out, len, spec, (ptrdiff_t) arg->u);
+			break;
+		default:
+			snprintf(out, len, spec, (unsigned int) arg->u);
+			break;
+		}
+		break;
+	case 'p':
+		snprintf(out, len, spec, arg->p);
+		break;
+	case 's':
+		snprintf(out, len, spec, &rec->text[arg->text_offset]);
+		break;
+	default:
+		snprintf(out, len, spec, arg->d);
+		break;
+	}
+}
+
+/* Format a captured record, the counterpart of weston_log_record_capture().
+ * Returns the message length, truncated to fit out. */
+static size_t
+weston_log_record_format(const struct weston_log_record *rec,
+			 char *out, size_t len)
+{
+	enum weston_log_arg_length length;
+	const char *p = rec->fmt;
+	const char *start, *end;
+	size_t pos = 0;
+	uint32_t n = 0;
+	char spec[32];
+	char conv;
+
+	while (*p && pos < len - 1) {
+		if (*p != '%') {
+			out[pos++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			out[pos++] = '%';
+			p += 2;
+			continue;
+		}
+
+		start = p;
+		end = weston_log_parse_spec(p + 1, &length, &conv);
+		/* capture accepted this format, so this can't fail */
+		assert(end && n < rec->n_args);
+		if ((size_t) (end - start) >= sizeof(spec))
+			break;
+		memcpy(spec, start, end - start);
+		spec[end - start] = '\0';
+
+		weston_log_format_one(out + pos, len - pos, spec, length, conv,
+				      rec, &rec->args[n++]);
+		pos += strlen(out + pos);
+		p = end;
+	}
+
+	out[pos] = '\0';
+
+	return pos;
+}
+
+void
+weston_log_rings_push_vprintf(struct weston_log_rings *rings,
+			      struct weston_log_scope *scope,
+			      const char *fmt, va_list ap)
+{
+	struct weston_log_ring *ring;
+	struct weston_log_record *rec;
+	int len;
+
+	ring = weston_log_rings_get_thread_ring(rings);
+	if (!ring)
+		return;
+
+	rec = weston_log_ring_reserve(ring);
+	if (!rec)
+		return;
+
+	rec->scope = scope;
+	if (!weston_log_record_capture(rec, fmt, ap)) {
+		len = vsnprintf(rec->text, sizeof(rec->text), fmt, ap);
+		if (len < 0)
+			len = 0;
+		rec->fmt = NULL;
+		rec->text_len = MIN((size_t) len, sizeof(rec->text) - 1);
+	}
+
+	weston_log_ring_commit(ring);
+}
+
+void
+weston_log_rings_push_write(struct weston_log_rings *rings,
+			    struct weston_log_scope *scope,
+			    const char *data, size_t len)
+{
+	struct weston_log_ring *ring;
+	struct weston_log_record *rec;
+	size_t chunk;
+
+	ring = weston_log_rings_get_thread_ring(rings);
+	if (!ring)
+		return;
+
+	while (len > 0) {
+		rec = weston_log_ring_reserve(ring);
+		if (!rec)
+			return;
+
+		chunk = MIN(len, sizeof(rec->text));
+		rec->scope = scope;
+		rec->fmt = NULL;
+		rec->text_len = chunk;
+		memcpy(rec->text, data, chunk);
+		weston_log_ring_commit(ring);
+
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+/** Deliver everything the other threads logged so far
+ *
+ * Must be called on the main thread. Scopes must be drained this way before
+ * they are destroyed, as records point to them.
+ */
+void
+weston_log_rings_drain(struct weston_log_rings *rings)
+{
+	struct weston_log_ring *ring;
+	struct weston_log_record *rec;
+	uint32_t head, tail, dropped;
+	char buf[1024];
+	size_t len;
+
+	assert(weston_log_rings_is_main_thread(rings));
+
+	/* Clear before looking at the rings: whatever gets committed after
+	 * this point wakes us up again. */
+	__atomic_store_n(&rings->wake_pending, 0, __ATOMIC_SEQ_CST);
+
+	for (ring = __atomic_load_n(&rings->list, __ATOMIC_ACQUIRE);
+	     ring; ring = ring->next) {
+		head = ring->head;
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+		for (; head != tail; head++) {
+			rec = &ring->slots[head % WESTON_LOG_RING_SLOTS];
+			if (rec->fmt) {
+				len = weston_log_record_format(rec, buf,
+							       sizeof(buf));
+				weston_log_scope_deliver(rec->scope, buf, len);
+			} else {
+				weston_log_scope_deliver(rec->scope, rec->text,
+							 rec->text_len);
+			}
+		}
+
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+		dropped = __atomic_exchange_n(&ring->dropped, 0,
+					      __ATOMIC_RELAXED);
+		if (dropped)
+			weston_log("weston-log: a thread dropped %u messages, "
+				   "its log ring was full\n", dropped);
+	}
+}
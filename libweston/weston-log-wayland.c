@@ -27,6 +27,7 @@
 
 #include <libweston/weston-log.h>
 #include "shared/helpers.h"
+#include "shared/xalloc.h"
 #include <libweston/libweston.h>
 
 #include "weston-log-internal.h"
@@ -39,6 +40,9 @@
 #include <errno.h>
 #include <sys/time.h>
 
+/* Longest partial line a filtered stream holds back */
+#define STREAM_FILTER_LINE_MAX 4096
+
 /** A debug stream created by a client
  *
  * A client provides a file descriptor for the server to write debug messages
@@ -54,6 +58,8 @@ struct weston_log_debug_wayland {
 	struct weston_log_subscriber base;
 	int fd;				/**< client provided fd */
 	struct wl_resource *resource;	/**< weston_debug_stream_v1 object */
+	char *filter;			/**< keyword lines must contain, or NULL */
+	struct wl_array line;		/**< partial line held back by the filter */
 };
 
 static struct weston_log_debug_wayland *
@@ -93,9 +99,9 @@ stream_close_on_failure(struct weston_log_debug_wayland *stream,
 	}
 }
 
-/** Write data into a specific debug stream
+/** Write data into the file descriptor of a debug stream
  *
- * \param sub The subscriber's stream to write into; must not be NULL.
+ * \param stream The stream to write into; must not be NULL.
  * \param[in] data Pointer to the data to write.
  * \param len Number of bytes to write.
  *
@@ -110,13 +116,12 @@ stream_close_on_failure(struct weston_log_debug_wayland *stream,
  * \memberof weston_log_debug_wayland
  */
 static void
-weston_log_debug_wayland_write(struct weston_log_subscriber *sub,
-			       const char *data, size_t len)
+stream_write(struct weston_log_debug_wayland *stream,
+	     const char *data, size_t len)
 {
 	ssize_t len_ = len;
 	ssize_t ret;
 	int e;
-	struct weston_log_debug_wayland *stream = to_weston_log_debug_wayland(sub);
 
 	if (stream->fd == -1)
 		return;
@@ -139,6 +144,69 @@ weston_log_debug_wayland_write(struct weston_log_subscriber *sub,
 	}
 }
 
+static void
+stream_filter_line(struct weston_log_debug_wayland *stream,
+		   const char *line, size_t len)
+{
+	if (memmem(line, len, stream->filter, strlen(stream->filter)))
+		stream_write(stream, line, len);
+}
+
+static void
+stream_filter_flush(struct weston_log_debug_wayland *stream)
+{
+	if (stream->line.size == 0)
+		return;
+
+	stream_filter_line(stream, stream->line.data, stream->line.size);
+	stream->line.size = 0;
+}
+
+/** Write data into a specific debug stream
+ *
+ * \param sub The subscriber's stream to write into; must not be NULL.
+ * \param[in] data Pointer to the data to write.
+ * \param len Number of bytes to write.
+ *
+ * Filtered streams only pass on whole lines that contain the filter; a
+ * partial line is held back until its end arrives, or it grows longer
+ * than STREAM_FILTER_LINE_MAX.
+ *
+ * \memberof weston_log_debug_wayland
+ */
+static void
+weston_log_debug_wayland_write(struct weston_log_subscriber *sub,
+			       const char *data, size_t len)
+{
+	struct weston_log_debug_wayland *stream = to_weston_log_debug_wayland(sub);
+	const char *nl;
+	size_t n;
+	void *p;
+
+	if (!stream->filter) {
+		stream_write(stream, data, len);
+		return;
+	}
+
+	while (len > 0 && stream->fd != -1) {
+		nl = memchr(data, '\n', len);
+		n = nl ? (size_t)(nl - data) + 1 : len;
+
+		if (nl && stream->line.size == 0) {
+			stream_filter_line(stream, data, n);
+		} else {
+			p = wl_array_add(&stream->line, n);
+			if (p)
+				memcpy(p, data, n);
+			if (nl || stream->line.size >= STREAM_FILTER_LINE_MAX)
+				stream_filter_flush(stream);
+		}
+
+		data += n;
+		len -= n;
+	}
+}
+
 /** Close the debug stream and send success event
  *
  * \param sub Subscriber's stream to close.
@@ -154,6 +222,9 @@ weston_log_debug_wayland_complete(struct weston_log_subscriber *sub)
 {
 	struct weston_log_debug_wayland *stream = to_weston_log_debug_wayland(sub);
 
+	if (stream->filter)
+		stream_filter_flush(stream);
+
 	stream_close_unlink(stream);
 	weston_debug_stream_v1_send_complete(stream->resource);
 }
@@ -169,7 +240,8 @@ weston_log_debug_wayland_to_destroy(struct weston_log_subscriber *sub)
 
 static struct weston_log_debug_wayland *
 stream_create(struct weston_log_context *log_ctx, const char *name,
-	      int32_t streamfd, struct wl_resource *stream_resource)
+	      const char *filter, int32_t streamfd,
+	      struct wl_resource *stream_resource)
 {
 	struct weston_log_debug_wayland *stream;
 	struct weston_log_scope *scope;
@@ -180,6 +252,9 @@ stream_create(struct weston_log_context *log_ctx, const char *name,
 
 	stream->fd = streamfd;
 	stream->resource = stream_resource;
+	if (filter && filter[0] != '\0')
+		stream->filter = xstrdup(filter);
+	wl_array_init(&stream->line);
 
 	stream->base.write = weston_log_debug_wayland_write;
 	stream->base.destroy = NULL;
@@ -207,6 +282,8 @@ stream_destroy(struct wl_resource *stream_resource)
 
 	stream_close_unlink(stream);
 	weston_log_subscriber_release(&stream->base);
+	wl_array_release(&stream->line);
+	free(stream->filter);
 	free(stream);
 }
 
@@ -230,11 +307,10 @@ weston_debug_destroy(struct wl_client *client,
 }
 
 static void
-weston_debug_subscribe(struct wl_client *client,
-		       struct wl_resource *global_resource,
-		       const char *name,
-		       int32_t streamfd,
-		       uint32_t new_stream_id)
+debug_subscribe(struct wl_client *client,
+		struct wl_resource *global_resource,
+		const char *name, const char *filter,
+		int32_t streamfd, uint32_t new_stream_id)
 {
 	struct weston_log_context *log_ctx;
 	struct wl_resource *stream_resource;
@@ -250,7 +326,8 @@ weston_debug_subscribe(struct wl_client *client,
 	if (!stream_resource)
 		goto fail;
 
-	stream = stream_create(log_ctx, name, streamfd, stream_resource);
+	stream = stream_create(log_ctx, name, filter, streamfd,
+			       stream_resource);
 	if (!stream)
 		goto fail;
 
@@ -264,9 +341,33 @@ fail:
 	wl_client_post_no_memory(client);
 }
 
+static void
+weston_debug_subscribe(struct wl_client *client,
+		       struct wl_resource *global_resource,
+		       const char *name,
+		       int32_t streamfd,
+		       uint32_t new_stream_id)
+{
+	debug_subscribe(client, global_resource, name, NULL,
+			streamfd, new_stream_id);
+}
+
+static void
+weston_debug_subscribe_filtered(struct wl_client *client,
+				struct wl_resource *global_resource,
+				const char *name,
+				const char *filter,
+				int32_t streamfd,
+				uint32_t new_stream_id)
+{
+	debug_subscribe(client, global_resource, name, filter,
+			streamfd, new_stream_id);
+}
+
 static const struct weston_debug_v1_interface weston_debug_impl = {
 	weston_debug_destroy,
-	weston_debug_subscribe
+	weston_debug_subscribe,
+	weston_debug_subscribe_filtered
 };
 
 void
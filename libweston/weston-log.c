@@ -38,6 +38,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/time.h>
 
 /**
@@ -69,6 +70,7 @@ struct weston_log_context {
 	struct wl_listener compositor_destroy_listener;
 	struct wl_list scope_list; /**< weston_log_scope::compositor_link */
 	struct wl_list pending_subscription_list; /**< weston_log_subscription::source_link */
+	struct weston_log_rings *rings; /**< messages from other threads */
 };
 
 /** weston-log message scope
@@ -85,6 +87,7 @@ struct weston_log_scope {
 	weston_log_scope_cb new_subscription;
 	weston_log_scope_cb destroy_subscription;
 	void *user_data;
+	struct weston_log_context *log_ctx;
 	struct wl_list compositor_link;
 	struct wl_list subscription_list;  /**< weston_log_subscription::source_link */
 };
@@ -179,7 +182,7 @@ weston_log_subscription_destroy_pending(struct weston_log_subscription *sub)
  *
  * @memberof weston_log_subscription
  */
-static void
+void
 weston_log_subscription_write(struct weston_log_subscription *sub,
 			      const char *data, size_t len)
 {
@@ -413,10 +416,26 @@ weston_log_ctx_create(void)
 	wl_list_init(&log_ctx->scope_list);
 	wl_list_init(&log_ctx->pending_subscription_list);
 	wl_list_init(&log_ctx->compositor_destroy_listener.link);
+	log_ctx->rings = weston_log_rings_create();
 
 	return log_ctx;
 }
 
+/** Drain messages logged from other threads in an event loop
+ *
+ * \param log_ctx The log context.
+ * \param loop The event loop of the thread that created \c log_ctx, or NULL
+ * to stop.
+ *
+ * @ingroup internal-log
+ */
+void
+weston_log_ctx_set_event_loop(struct weston_log_context *log_ctx,
+			      struct wl_event_loop *loop)
+{
+	weston_log_rings_set_event_loop(log_ctx->rings, loop);
+}
+
 /** Destroy weston_log_context structure
  *
  * \param log_ctx The log context to destroy.
@@ -451,6 +470,7 @@ weston_log_ctx_destroy(struct weston_log_context *log_ctx)
 
 	/* pending_subscription_list should be empty at this point */
 
+	weston_log_rings_destroy(log_ctx->rings);
 	free(log_ctx);
 }
 
@@ -496,7 +516,7 @@ weston_compositor_enable_debug_protocol(struct weston_compositor *compositor)
 		return;
 
 	log_ctx->global = wl_global_create(compositor->wl_display,
-				       &weston_debug_v1_interface, 1,
+				       &weston_debug_v1_interface, 2,
 				       log_ctx, weston_log_bind_weston_debug);
 	if (!log_ctx->global)
 		return;
@@ -609,6 +629,7 @@ weston_log_ctx_add_log_scope(struct weston_log_context *log_ctx,
 	scope->new_subscription = new_subscription;
 	scope->destroy_subscription = destroy_subscription;
 	scope->user_data = user_data;
+	scope->log_ctx = log_ctx;
 	wl_list_init(&scope->subscription_list);
 
 	if (!scope->name || !scope->desc) {
@@ -687,6 +708,10 @@ weston_log_scope_destroy(struct weston_log_scope *scope)
 	if (!scope)
 		return;
 
+	/* Queued messages point to the scope. Threads logging to it must
+	 * have stopped by now. */
+	weston_log_rings_drain(scope->log_ctx->rings);
+
 	wl_list_for_each_safe(sub, sub_tmp, &scope->subscription_list, source_link)
 		weston_log_subscription_destroy(sub);
 
@@ -771,17 +796,39 @@ weston_log_scope_complete(struct weston_log_scope *scope)
  *
  * Writes the given data to all subscribed clients' streams.
  *
+ * This may be called from any thread. Data written from threads other than
+ * the one that created the log context is queued, and delivered by that
+ * thread's event loop.
+ *
  * \memberof weston_log_scope
  */
 WL_EXPORT void
 weston_log_scope_write(struct weston_log_scope *scope,
 		       const char *data, size_t len)
 {
-	struct weston_log_subscription *sub;
-
 	if (!scope)
 		return;
 
+	if (!weston_log_rings_is_main_thread(scope->log_ctx->rings)) {
+		if (weston_log_scope_is_enabled(scope))
+			weston_log_rings_push_write(scope->log_ctx->rings,
+						    scope, data, len);
+		return;
+	}
+
+	weston_log_scope_deliver(scope, data, len);
+}
+
+/** Hand data to the subscriptions of a scope, on the main thread
+ *
+ * @ingroup internal-log
+ */
+void
+weston_log_scope_deliver(struct weston_log_scope *scope,
+			 const char *data, size_t len)
+{
+	struct weston_log_subscription *sub;
+
 	wl_list_for_each(sub, &scope->subscription_list, source_link)
 		weston_log_subscription_write(sub, data, len);
 }
@@ -798,6 +845,10 @@ weston_log_scope_write(struct weston_log_scope *scope,
  * The behavioral details for each stream are the same as for
  * weston_debug_stream_write().
  *
+ * From threads other than the one that created the log context, only the
+ * format pointer and the arguments are queued, and 0 is returned; such
+ * format strings must stay valid, as string literals do.
+ *
  * \memberof weston_log_scope
  */
 WL_EXPORT int
@@ -811,6 +862,12 @@ weston_log_scope_vprintf(struct weston_log_scope *scope,
 	if (!weston_log_scope_is_enabled(scope))
 		return len;
 
+	if (!weston_log_rings_is_main_thread(scope->log_ctx->rings)) {
+		weston_log_rings_push_vprintf(scope->log_ctx->rings, scope,
+					      fmt, ap);
+		return len;
+	}
+
 	len = vasprintf(&str, fmt, ap);
 	if (len >= 0) {
 		weston_log_scope_write(scope, str, len);
@@ -870,6 +927,65 @@ weston_log_subscription_printf(struct weston_log_subscription *sub,
 	va_end(ap);
 }
 
+/** Wall-clock time of the current second, formatted once per second
+ *
+ * Formatting through localtime_r() and strftime() is the expensive part of
+ * a timestamp, so it is only done when the second changes; each log line
+ * then only appends its milliseconds. Per thread, as any thread may log.
+ */
+struct log_time_cache {
+	bool valid;
+	time_t sec;
+	int tm_mday;
+	char datetime[32];	/**< "%Y-%m-%d %H:%M:%S" */
+	char time[16];		/**< "%H:%M:%S" */
+	char date[64];		/**< "Date: %Y-%m-%d %Z\n" */
+};
+
+static __thread struct log_time_cache log_time_cache;
+
+static const struct log_time_cache *
+log_time_cache_get(struct timespec *ts)
+{
+	struct log_time_cache *cache = &log_time_cache;
+	struct tm bdt;
+
+	clock_gettime(CLOCK_REALTIME, ts);
+
+	if (cache->valid && cache->sec == ts->tv_sec)
+		return cache;
+
+	cache->valid = false;
+	if (!localtime_r(&ts->tv_sec, &bdt))
+		return NULL;
+
+	if (strftime(cache->datetime, sizeof cache->datetime,
+		     "%Y-%m-%d %H:%M:%S", &bdt) == 0)
+		return NULL;
+	strftime(cache->time, sizeof cache->time, "%H:%M:%S", &bdt);
+	strftime(cache->date, sizeof cache->date, "Date: %Y-%m-%d %Z\n", &bdt);
+	cache->tm_mday = bdt.tm_mday;
+	cache->sec = ts->tv_sec;
+	cache->valid = true;
+
+	return cache;
+}
+
+/** Read the wall-clock time that log timestamps are made of
+ *
+ * \param[out] ts The current CLOCK_REALTIME time.
+ *
+ * For binary sinks, which should store the time as it is and leave the
+ * formatting to whatever decodes them.
+ *
+ * @ingroup log
+ */
+WL_EXPORT void
+weston_log_timespec(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
 /** Write debug scope name and current time into string
  *
  * \param[in] scope debug scope; may be NULL
@@ -887,21 +1003,13 @@ WL_EXPORT char *
 weston_log_scope_timestamp(struct weston_log_scope *scope,
 			   char *buf, size_t len)
 {
-	struct timeval tv;
-	struct tm *bdt;
-	char string[128];
-	size_t ret = 0;
-
-	gettimeofday(&tv, NULL);
+	const struct log_time_cache *cache;
+	struct timespec ts;
 
-	bdt = localtime(&tv.tv_sec);
-	if (bdt)
-		ret = strftime(string, sizeof string,
-			       "%Y-%m-%d %H:%M:%S", bdt);
-
-	if (ret > 0) {
-		snprintf(buf, len, "[%s.%03ld][%s]", string,
-			 tv.tv_usec / 1000,
+	cache = log_time_cache_get(&ts);
+	if (cache) {
+		snprintf(buf, len, "[%s.%03ld][%s]", cache->datetime,
+			 ts.tv_nsec / 1000000,
 			 (scope) ? scope->name : "no scope");
 	} else {
 		snprintf(buf, len, "[?][%s]",
@@ -932,32 +1040,26 @@ weston_log_scope_timestamp(struct weston_log_scope *scope,
 WL_EXPORT char *
 weston_log_timestamp(char *buf, size_t len, int *cached_tm_mday)
 {
-       struct timeval tv;
-       struct tm *brokendown_time;
-       char datestr[128];
-       char timestr[128];
-
-       gettimeofday(&tv, NULL);
-
-       brokendown_time = localtime(&tv.tv_sec);
-       if (brokendown_time == NULL) {
-               snprintf(buf, len, "%s", "[(NULL)localtime] ");
-               return buf;
-       }
-
-       memset(datestr, 0, sizeof(datestr));
-       if (cached_tm_mday && brokendown_time->tm_mday != *cached_tm_mday) {
-               strftime(datestr, sizeof(datestr), "Date: %Y-%m-%d %Z\n",
-                        brokendown_time);
-               *cached_tm_mday = brokendown_time->tm_mday;
-       }
-
-       strftime(timestr, sizeof(timestr), "%H:%M:%S", brokendown_time);
-       /* if datestr is empty it prints only timestr*/
-       snprintf(buf, len, "%s[%s.%03li]", datestr,
-                timestr, (tv.tv_usec / 1000));
-
-       return buf;
+	const struct log_time_cache *cache;
+	const char *datestr = "";
+	struct timespec ts;
+
+	cache = log_time_cache_get(&ts);
+	if (!cache) {
+		snprintf(buf, len, "%s", "[(NULL)localtime] ");
+		return buf;
+	}
+
+	if (cached_tm_mday && cache->tm_mday != *cached_tm_mday) {
+		datestr = cache->date;
+		*cached_tm_mday = cache->tm_mday;
+	}
+
+	/* if datestr is empty it prints only the time */
+	snprintf(buf, len, "%s[%s.%03li]", datestr,
+		 cache->time, ts.tv_nsec / 1000000);
+
+	return buf;
 }
 
 
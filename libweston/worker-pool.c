@@ -0,0 +1,241 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <wayland-util.h>
+
+#include "worker-pool.h"
+#include "shared/xalloc.h"
+
+struct weston_worker_pool {
+	pthread_mutex_t mutex;
+	/* Signalled when a new batch is posted, or on destruction */
+	pthread_cond_t work_cond;
+	/* Signalled when the last job of a batch has finished */
+	pthread_cond_t done_cond;
+
+	pthread_t *threads;
+	unsigned int n_threads;
+
+	/* All below protected by mutex */
+	weston_worker_func_t func;
+	void *data;
+	unsigned int n_jobs;
+	unsigned int next_job;
+	unsigned int finished_jobs;
+	uint64_t batch;
+	bool destroying;
+};
+
+/* Takes the next job of the current batch and runs it with the mutex
+ * dropped. Returns false when nothing is left to hand out. */
+static bool
+worker_pool_run_one(struct weston_worker_pool *pool)
+{
+	weston_worker_func_t func;
+	void *data;
+	unsigned int job;
+
+	if (pool->next_job >= pool->n_jobs)
+		return false;
+
+	job = pool->next_job++;
+	func = pool->func;
+	data = pool->data;
+
+	pthread_mutex_unlock(&pool->mutex);
+	func(data, job);
+	pthread_mutex_lock(&pool->mutex);
+
+	if (++pool->finished_jobs == pool->n_jobs)
+		pthread_cond_signal(&pool->done_cond);
+
+	return true;
+}
+
+static void *
+worker_thread_function(void *data)
+{
+	struct weston_worker_pool *pool = data;
+	uint64_t seen_batch = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (!pool->destroying) {
+		if (pool->batch == seen_batch) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+			continue;
+		}
+
+		while (worker_pool_run_one(pool))
+			;
+
+		seen_batch = pool->batch;
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Create a pool of worker threads
+ *
+ * \param n_workers Number of threads to start, in addition to the thread
+ * that will call weston_worker_pool_run().
+ * \return The new pool, or NULL if no thread could be started.
+ *
+ * The workers block all asynchronous signals, so that signal handling
+ * stays on the compositor thread.
+ */
+WL_EXPORT struct weston_worker_pool *
+weston_worker_pool_create(unsigned int n_workers)
+{
+	struct weston_worker_pool *pool;
+	sigset_t mask, old_mask;
+	unsigned int i;
+
+	if (n_workers == 0)
+		return NULL;
+
+	pool = xzalloc(sizeof *pool);
+	pool->threads = xcalloc(n_workers, sizeof *pool->threads);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* Faults while reading client SHM buffers must still reach the
+	 * thread that caused them. */
+	sigfillset(&mask);
+	sigdelset(&mask, SIGBUS);
+	sigdelset(&mask, SIGSEGV);
+	sigdelset(&mask, SIGFPE);
+	sigdelset(&mask, SIGILL);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+	for (i = 0; i < n_workers; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   worker_thread_function, pool) != 0)
+			break;
+	}
+	pool->n_threads = i;
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	if (pool->n_threads == 0) {
+		weston_worker_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+WL_EXPORT void
+weston_worker_pool_destroy(struct weston_worker_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->destroying = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+/** Number of threads that take part in weston_worker_pool_run()
+ *
+ * This counts the calling thread as well, so it is a sensible number of
+ * pieces to split a job into.
+ */
+WL_EXPORT unsigned int
+weston_worker_pool_get_thread_count(struct weston_worker_pool *pool)
+{
+	if (!pool)
+		return 1;
+
+	return pool->n_threads + 1;
+}
+
+/** Run jobs on the pool and wait for all of them
+ *
+ * \param pool The pool, or NULL to run every job on the calling thread.
+ * \param func Called once for each job index from 0 to n_jobs - 1.
+ * \param data Passed to func unchanged.
+ * \param n_jobs Number of jobs in this batch.
+ *
+ * The calling thread processes jobs too. Every write made by func is
+ * visible to the caller when this returns.
+ */
+WL_EXPORT void
+weston_worker_pool_run(struct weston_worker_pool *pool,
+		       weston_worker_func_t func, void *data,
+		       unsigned int n_jobs)
+{
+	unsigned int i;
+
+	if (!pool || n_jobs <= 1) {
+		for (i = 0; i < n_jobs; i++)
+			func(data, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	assert(pool->finished_jobs == pool->n_jobs);
+
+	pool->func = func;
+	pool->data = data;
+	pool->n_jobs = n_jobs;
+	pool->next_job = 0;
+	pool->finished_jobs = 0;
+	pool->batch++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	while (worker_pool_run_one(pool))
+		;
+
+	while (pool->finished_jobs < pool->n_jobs)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -53,6 +53,13 @@
 
 #define MAX_RETRY_COUNT	3
 
+/* Frames owned by GStreamer or waiting for the renderer; anything beyond
+ * this is dropped so a slow sink cannot starve the repaint loop of buffers */
+#define MAX_QUEUED_FRAMES	2
+
+/* Past this many damage rectangles, a single bounding box is attached */
+#define MAX_DAMAGE_RECTS	16
+
 struct weston_remoting {
 	struct weston_compositor *compositor;
 	struct wl_list output_list;
@@ -102,16 +109,25 @@ struct remoted_output {
 	char *host;
 	int port;
 	char *gst_pipeline;
+	bool custom_pipeline;
 	const struct remoted_output_support_gbm_format *format;
 
+	/* Set while an identical output encodes for this one too, see
+	 * remoting_output_find_encoder() */
+	struct remoted_output *encoder;
+	struct wl_list sharer_list; /* remoted_output::sharer_link */
+	struct wl_list sharer_link;
+
 	struct weston_head *head;
 
 	struct weston_remoting *remoting;
 	struct wl_event_source *finish_frame_timer;
 	struct wl_list link;
 	bool submitted_frame;
-	int fence_sync_fd;
-	struct wl_event_source *fence_sync_event_source;
+	struct wl_list pending_frame_list; /* gst_frame_buffer_data::link */
+	int queued_frames;
+	/* accumulated since the last frame pushed to GStreamer */
+	pixman_region32_t damage;
 
 	GstElement *pipeline;
 	GstAppSrc *appsrc;
@@ -130,6 +146,9 @@ struct mem_free_cb_data {
 struct gst_frame_buffer_data {
 	struct remoted_output *output;
 	GstBuffer *buffer;
+	int fence_sync_fd;
+	struct wl_event_source *fence_sync_event_source;
+	struct wl_list link;
 };
 
 /* message type for pipe */
@@ -183,6 +202,32 @@ remoting_gst_bus_sync_handler(GstBus *bus, GstMessage *message,
 	return GST_BUS_PASS;
 }
 
+/* Add or remove the destination of an output sharing the encoder's
+ * pipeline. Only the default pipeline has the multiudpsinks for it. */
+static void
+remoting_gst_update_destination(struct remoted_output *encoder,
+				struct remoted_output *output,
+				const char *action)
+{
+	GstElement *sink;
+
+	if (!encoder->pipeline)
+		return;
+
+	sink = gst_bin_get_by_name(GST_BIN(encoder->pipeline), "sink");
+	if (sink) {
+		g_signal_emit_by_name(sink, action, output->host, output->port);
+		gst_object_unref(sink);
+	}
+
+	sink = gst_bin_get_by_name(GST_BIN(encoder->pipeline), "rtcpsink");
+	if (sink) {
+		g_signal_emit_by_name(sink, action, output->host,
+				      output->port + 1);
+		gst_object_unref(sink);
+	}
+}
+
 static int
 remoting_gst_pipeline_init(struct remoted_output *output)
 {
@@ -190,6 +235,7 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 	GError *err = NULL;
 	GstStateChangeReturn ret;
 	struct weston_mode *mode = output->output->current_mode;
+	struct remoted_output *sharer;
 
 	if (!output->gst_pipeline) {
 		char pipeline_str[1024];
@@ -200,9 +246,10 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 			 "video/x-raw,format=I420 ! jpegenc ! rtpjpegpay ! "
 			 "rtpbin.send_rtp_sink_0 "
 			 "rtpbin.send_rtp_src_0 ! "
-			 "udpsink name=sink host=%s port=%d "
+			 "multiudpsink name=sink clients=%s:%d "
 			 "rtpbin.send_rtcp_src_0 ! "
-			 "udpsink host=%s port=%d sync=false async=false "
+			 "multiudpsink name=rtcpsink clients=%s:%d "
+			 "sync=false async=false "
 			 "udpsrc port=%d ! rtpbin.recv_rtcp_sink_0",
 			 output->host, output->port, output->host,
 			 output->port + 1, output->port + 2);
@@ -268,6 +315,9 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 		goto err;
 	}
 
+	wl_list_for_each(sharer, &output->sharer_list, sharer_link)
+		remoting_gst_update_destination(output, sharer, "add");
+
 	return 0;
 
 err:
@@ -364,6 +414,7 @@ remoting_output_buffer_release(struct remoted_output *output, void *buffer)
 		= output->remoting->virtual_output_api;
 
 	api->buffer_released(buffer);
+	output->queued_frames--;
 }
 
 static int
@@ -557,6 +608,15 @@ remoting_output_gst_push_buffer(struct remoted_output *output,
 	output->submitted_frame = true;
 }
 
+static void
+remoting_gst_frame_buffer_data_destroy(struct gst_frame_buffer_data *frame_data)
+{
+	wl_event_source_remove(frame_data->fence_sync_event_source);
+	close(frame_data->fence_sync_fd);
+	wl_list_remove(&frame_data->link);
+	free(frame_data);
+}
+
 static int
 remoting_output_fence_sync_handler(int fd, uint32_t mask, void *data)
 {
@@ -564,14 +624,47 @@ remoting_output_fence_sync_handler(int fd, uint32_t mask, void *data)
 	struct remoted_output *output = frame_data->output;
 
 	remoting_output_gst_push_buffer(output, frame_data->buffer);
-
-	wl_event_source_remove(output->fence_sync_event_source);
-	close(output->fence_sync_fd);
-	free(frame_data);
+	remoting_gst_frame_buffer_data_destroy(frame_data);
 
 	return 0;
 }
 
+/* The buffers get released through remoting_gst_mem_free_cb() */
+static void
+remoting_output_drop_pending_frames(struct remoted_output *output)
+{
+	struct gst_frame_buffer_data *frame_data, *tmp;
+
+	wl_list_for_each_safe(frame_data, tmp, &output->pending_frame_list,
+			      link) {
+		gst_buffer_unref(frame_data->buffer);
+		remoting_gst_frame_buffer_data_destroy(frame_data);
+	}
+}
+
+/* Hint encoders at the regions that changed, so they can skip the rest */
+static void
+remoting_output_add_damage_meta(struct remoted_output *output, GstBuffer *buf)
+{
+	pixman_box32_t *rects;
+	int n_rects, i;
+
+	rects = pixman_region32_rectangles(&output->damage, &n_rects);
+	if (n_rects > MAX_DAMAGE_RECTS) {
+		rects = pixman_region32_extents(&output->damage);
+		n_rects = 1;
+	}
+
+	for (i = 0; i < n_rects; i++)
+		gst_buffer_add_video_region_of_interest_meta(buf, "damage",
+							     rects[i].x1,
+							     rects[i].y1,
+							     rects[i].x2 - rects[i].x1,
+							     rects[i].y2 - rects[i].y1);
+
+	pixman_region32_clear(&output->damage);
+}
+
 static int
 remoting_output_frame(struct weston_output *output_base, int fd, int stride,
 		      struct drm_fb *output_buffer)
@@ -586,12 +679,35 @@ remoting_output_frame(struct weston_output *output_base, int fd, int stride,
 	GstMemory *mem;
 	gsize offsets[4] = { 0, };
 	gint strides[4] = { stride, };
+	int fence_sync_fd;
 	struct mem_free_cb_data *cb_data;
 	struct gst_frame_buffer_data *frame_data;
+	const pixman_region32_t *damage;
 
 	if (!output)
 		return -1;
 
+	/* The encoder's frames are sent to this output's host too */
+	if (output->encoder) {
+		close(fd);
+		api->buffer_released(output_buffer);
+		output->submitted_frame = true;
+		return 0;
+	}
+
+	damage = api->get_frame_damage(output->output);
+	pixman_region32_union(&output->damage, &output->damage,
+			      (pixman_region32_t *) damage);
+
+	/* The sink is falling behind: drop this frame instead of stalling
+	 * repaint, its damage is carried over to the next one. */
+	if (output->queued_frames >= MAX_QUEUED_FRAMES) {
+		close(fd);
+		api->buffer_released(output_buffer);
+		output->submitted_frame = true;
+		return 0;
+	}
+
 	cb_data = zalloc(sizeof *cb_data);
 	if (!cb_data)
 		return -1;
@@ -609,39 +725,46 @@ remoting_output_frame(struct weston_output *output_base, int fd, int stride,
 				       1,
 				       offsets,
 				       strides);
+	remoting_output_add_damage_meta(output, buf);
 
 	cb_data->output = output;
 	cb_data->output_buffer = output_buffer;
 	gst_mini_object_weak_ref(GST_MINI_OBJECT(mem),
 				 (GstMiniObjectNotify)remoting_gst_mem_free_cb,
 				 cb_data);
+	output->queued_frames++;
 
-	output->fence_sync_fd = api->get_fence_sync_fd(output->output);
+	fence_sync_fd = api->get_fence_sync_fd(output->output);
 	/* Push buffer to gstreamer immediately on get_fence_sync_fd failure */
-	if (output->fence_sync_fd == -1) {
+	if (fence_sync_fd == -1) {
 		remoting_output_gst_push_buffer(output, buf);
 		return 0;
 	}
 
 	frame_data = zalloc(sizeof *frame_data);
 	if (!frame_data) {
-		close(output->fence_sync_fd);
+		close(fence_sync_fd);
 		remoting_output_gst_push_buffer(output, buf);
 		return 0;
 	}
 
 	frame_data->output = output;
 	frame_data->buffer = buf;
+	frame_data->fence_sync_fd = fence_sync_fd;
 	loop = wl_display_get_event_loop(remoting->compositor->wl_display);
-	output->fence_sync_event_source =
-		wl_event_loop_add_fd(loop, output->fence_sync_fd,
+	frame_data->fence_sync_event_source =
+		wl_event_loop_add_fd(loop, fence_sync_fd,
 				     WL_EVENT_READABLE,
 				     remoting_output_fence_sync_handler,
 				     frame_data);
+	wl_list_insert(output->pending_frame_list.prev, &frame_data->link);
 
 	return 0;
 }
 
+static void
+remoting_output_unshare(struct remoted_output *output);
+
 static void
 remoting_output_destroy(struct weston_output *output)
 {
@@ -658,8 +781,11 @@ remoting_output_destroy(struct weston_output *output)
 		free(mode);
 	}
 
+	remoting_output_unshare(remoted_output);
+	remoting_output_drop_pending_frames(remoted_output);
 	remoting_gst_pipeline_deinit(remoted_output);
 	remoting_gstpipe_release(&remoted_output->gstpipe);
+	pixman_region32_fini(&remoted_output->damage);
 
 	if (remoted_output->host)
 		free(remoted_output->host);
@@ -698,6 +824,75 @@ remoting_output_set_dpms(struct weston_output *base_output, enum dpms_enum level
 	remoting_output_finish_frame_handler(output);
 }
 
+static bool
+remoting_outputs_identical(struct remoted_output *a, struct remoted_output *b)
+{
+	struct weston_output *oa = a->output, *ob = b->output;
+
+	return !a->custom_pipeline && !b->custom_pipeline &&
+	       a->format == b->format &&
+	       oa->current_mode->width == ob->current_mode->width &&
+	       oa->current_mode->height == ob->current_mode->height &&
+	       oa->current_mode->refresh == ob->current_mode->refresh &&
+	       oa->transform == ob->transform &&
+	       oa->current_scale == ob->current_scale &&
+	       oa->pos.c.x == ob->pos.c.x &&
+	       oa->pos.c.y == ob->pos.c.y;
+}
+
+/* Outputs mirroring the same area, with the same mode and format, show
+ * the same pixels: instead of encoding them once per output, the first
+ * one to be enabled encodes and its multiudpsinks send to all of them. */
+static struct remoted_output *
+remoting_output_find_encoder(struct remoted_output *output)
+{
+	struct remoted_output *other;
+
+	wl_list_for_each(other, &output->remoting->output_list, link) {
+		if (other == output || !other->pipeline || other->encoder)
+			continue;
+
+		if (remoting_outputs_identical(other, output))
+			return other;
+	}
+
+	return NULL;
+}
+
+/* Stop sharing an encoder, or hand ours over to the first sharer */
+static void
+remoting_output_unshare(struct remoted_output *output)
+{
+	struct remoted_output *heir, *sharer, *tmp;
+
+	if (output->encoder) {
+		remoting_gst_update_destination(output->encoder, output,
+						"remove");
+		wl_list_remove(&output->sharer_link);
+		wl_list_init(&output->sharer_link);
+		output->encoder = NULL;
+		return;
+	}
+
+	if (wl_list_empty(&output->sharer_list))
+		return;
+
+	heir = wl_container_of(output->sharer_list.next, heir, sharer_link);
+	wl_list_remove(&heir->sharer_link);
+	wl_list_init(&heir->sharer_link);
+	heir->encoder = NULL;
+
+	wl_list_for_each_safe(sharer, tmp, &output->sharer_list, sharer_link) {
+		wl_list_remove(&sharer->sharer_link);
+		wl_list_insert(heir->sharer_list.prev, &sharer->sharer_link);
+		sharer->encoder = heir;
+	}
+
+	if (remoting_gst_pipeline_init(heir) < 0)
+		weston_log("remoting: Could not start encoder for %s\n",
+			   heir->output->name);
+}
+
 static int
 remoting_output_enable(struct weston_output *output)
 {
@@ -705,6 +900,7 @@ remoting_output_enable(struct weston_output *output)
 	struct weston_compositor *c = output->compositor;
 	const struct weston_drm_virtual_output_api *api
 		= remoted_output->remoting->virtual_output_api;
+	struct remoted_output *encoder;
 	struct wl_event_loop *loop;
 	int ret;
 
@@ -718,10 +914,20 @@ remoting_output_enable(struct weston_output *output)
 	output->start_repaint_loop = remoting_output_start_repaint_loop;
 	output->set_dpms = remoting_output_set_dpms;
 
-	ret = remoting_gst_pipeline_init(remoted_output);
-	if (ret < 0) {
-		remoted_output->saved_disable(output);
-		return ret;
+	encoder = remoting_output_find_encoder(remoted_output);
+	if (encoder) {
+		weston_log("remoting: %s shares the encoder of %s\n",
+			   output->name, encoder->output->name);
+		remoted_output->encoder = encoder;
+		wl_list_insert(encoder->sharer_list.prev,
+			       &remoted_output->sharer_link);
+		remoting_gst_update_destination(encoder, remoted_output, "add");
+	} else {
+		ret = remoting_gst_pipeline_init(remoted_output);
+		if (ret < 0) {
+			remoted_output->saved_disable(output);
+			return ret;
+		}
 	}
 
 	loop = wl_display_get_event_loop(c->wl_display);
@@ -740,7 +946,9 @@ remoting_output_disable(struct weston_output *output)
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
 
 	wl_event_source_remove(remoted_output->finish_frame_timer);
+	remoting_output_drop_pending_frames(remoted_output);
 	remoting_gst_pipeline_deinit(remoted_output);
+	remoting_output_unshare(remoted_output);
 
 	return remoted_output->saved_disable(output);
 }
@@ -766,6 +974,11 @@ remoting_output_create(struct weston_compositor *c, char *name)
 	if (!output)
 		return NULL;
 
+	wl_list_init(&output->pending_frame_list);
+	wl_list_init(&output->sharer_list);
+	wl_list_init(&output->sharer_link);
+	pixman_region32_init(&output->damage);
+
 	head = zalloc(sizeof *head);
 	if (!head)
 		goto err;
@@ -808,6 +1021,7 @@ err:
 		remoting_gstpipe_release(&output->gstpipe);
 	if (head)
 		free(head);
+	pixman_region32_fini(&output->damage);
 	free(output);
 	return NULL;
 }
@@ -919,6 +1133,7 @@ remoting_output_set_gst_pipeline(struct weston_output *output,
 	if (remoted_output->gst_pipeline)
 		free(remoted_output->gst_pipeline);
 	remoted_output->gst_pipeline = strdup(gst_pipeline);
+	remoted_output->custom_pipeline = true;
 }
 
 static const struct weston_remoting_api remoting_api = {
@@ -26,6 +26,7 @@
 
 #include "config.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +46,10 @@
 #include <pango/pangocairo.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 void
 surface_flush_device(cairo_surface_t *surface)
 {
@@ -55,13 +60,55 @@ surface_flush_device(cairo_surface_t *surface)
 		cairo_device_flush(device);
 }
 
+/** Weighted sum of count pixels step bytes apart, each channel divided by a
+ *
+ * Kernel weights are at most 10000, so a channel times a weight fits the
+ * 16-bit operands of _mm_madd_epi16() and the sums fit 32 bits.
+ */
+static uint32_t
+blur_pixel(const uint8_t *p, int step, const uint32_t *kernel, int count,
+	   uint32_t a)
+{
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero, v;
+	uint32_t sum[4];
+	int k;
+
+	for (k = 0; k < count; k++, p += step) {
+		v = _mm_cvtsi32_si128(*(const uint32_t *) p);
+		v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(v,
+						_mm_set1_epi32(kernel[k])));
+	}
+	_mm_storeu_si128((__m128i *) sum, acc);
+
+	return (sum[3] / a << 24) | (sum[2] / a << 16) |
+	       (sum[1] / a << 8) | sum[0] / a;
+#else
+	int32_t x = 0, y = 0, z = 0, w = 0;
+	uint32_t v;
+	int k;
+
+	for (k = 0; k < count; k++, p += step) {
+		v = *(const uint32_t *) p;
+		x += (v >> 24) * kernel[k];
+		y += ((v >> 16) & 0xff) * kernel[k];
+		z += ((v >> 8) & 0xff) * kernel[k];
+		w += (v & 0xff) * kernel[k];
+	}
+
+	return (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+#endif
+}
+
 static int
 blur_surface(cairo_surface_t *surface, int margin)
 {
-	int32_t width, height, stride, x, y, z, w;
+	int32_t width, height, stride;
 	uint8_t *src, *dst;
-	uint32_t *s, *d, a, p;
-	int i, j, k, size, half;
+	uint32_t *s, *d, a;
+	int i, j, k0, k1, size, half;
 	uint32_t kernel[71];
 	double f;
 
@@ -92,49 +139,27 @@ blur_surface(cairo_surface_t *surface, int margin)
 				continue;
 			}
 
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (j - half + k < 0 || j - half + k >= width)
-					continue;
-				p = s[j - half + k];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+			/* only the taps that fall inside the row */
+			k0 = MAX(0, half - j);
+			k1 = MIN(size, width + half - j);
+			d[j] = blur_pixel((const uint8_t *) &s[j - half + k0], 4,
+					  kernel + k0, k1 - k0, a);
 		}
 	}
 
 	for (i = 0; i < height; i++) {
 		s = (uint32_t *) (dst + i * stride);
 		d = (uint32_t *) (src + i * stride);
+		k0 = MAX(0, half - i);
+		k1 = MIN(size, height + half - i);
 		for (j = 0; j < width; j++) {
 			if (margin <= i && i < height - margin) {
 				d[j] = s[j];
 				continue;
 			}
 
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (i - half + k < 0 || i - half + k >= height)
-					continue;
-				s = (uint32_t *) (dst + (i - half + k) * stride);
-				p = s[j];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+			d[j] = blur_pixel(dst + (i - half + k0) * stride + j * 4,
+					  stride, kernel + k0, k1 - k0, a);
 		}
 	}
 
@@ -360,6 +385,20 @@ static const cairo_user_data_key_t weston_cairo_util_load_cairo_surface_key;
 
 cairo_surface_t *
 load_cairo_surface(const char *filename)
+{
+	return load_cairo_surface_with_flags(filename,
+					     WESTON_IMAGE_LOAD_IMAGE |
+					     WESTON_IMAGE_LOAD_ICC);
+}
+
+/** Load an image file as a cairo image surface
+ *
+ * \param filename The image file.
+ * \param image_load_flags Combination of enum weston_image_load_flags,
+ * WESTON_IMAGE_LOAD_IMAGE is always implied.
+ */
+cairo_surface_t *
+load_cairo_surface_with_flags(const char *filename, uint32_t image_load_flags)
 {
 	cairo_surface_t *surface;
 	cairo_status_t ret;
@@ -367,8 +406,8 @@ load_cairo_surface(const char *filename)
 	int width, height, stride;
 	void *data;
 
-	image = weston_image_load(filename, WESTON_IMAGE_LOAD_IMAGE |
-					    WESTON_IMAGE_LOAD_ICC);
+	image = weston_image_load(filename, image_load_flags |
+					    WESTON_IMAGE_LOAD_IMAGE);
 	if (image == NULL) {
 		return NULL;
 	}
@@ -422,6 +461,47 @@ theme_set_background_source(struct theme *t, cairo_t *cr, uint32_t flags)
 	}
 }
 
+/* The blurred shadow only depends on the frame radius, so all themes in a
+ * process share it. Released by cleanup_after_cairo(). */
+static struct {
+	cairo_surface_t *surface;
+	int frame_radius;
+} shadow_cache;
+
+static cairo_surface_t *
+theme_get_shadow(int frame_radius)
+{
+	cairo_surface_t *shadow;
+	cairo_t *cr;
+
+	if (shadow_cache.surface && shadow_cache.frame_radius == frame_radius)
+		return cairo_surface_reference(shadow_cache.surface);
+
+	shadow = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
+	cr = cairo_create(shadow);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_rgba(cr, 0, 0, 0, 1);
+	rounded_rect(cr, 32, 32, 96, 96, frame_radius);
+	cairo_fill(cr);
+	if (cairo_status (cr) != CAIRO_STATUS_SUCCESS) {
+		cairo_destroy(cr);
+		cairo_surface_destroy(shadow);
+		return NULL;
+	}
+	cairo_destroy(cr);
+	if (blur_surface(shadow, 64) == -1) {
+		cairo_surface_destroy(shadow);
+		return NULL;
+	}
+
+	if (shadow_cache.surface)
+		cairo_surface_destroy(shadow_cache.surface);
+	shadow_cache.surface = cairo_surface_reference(shadow);
+	shadow_cache.frame_radius = frame_radius;
+
+	return shadow;
+}
+
 struct theme *
 theme_create(void)
 {
@@ -434,17 +514,11 @@ theme_create(void)
 	t->width = 6;
 	t->titlebar_height = 27;
 	t->frame_radius = 3;
-	t->shadow = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
-	cr = cairo_create(t->shadow);
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_set_source_rgba(cr, 0, 0, 0, 1);
-	rounded_rect(cr, 32, 32, 96, 96, t->frame_radius);
-	cairo_fill(cr);
-	if (cairo_status (cr) != CAIRO_STATUS_SUCCESS)
-		goto err_shadow;
-	cairo_destroy(cr);
-	if (blur_surface(t->shadow, 64) == -1)
-		goto err_shadow;
+	t->shadow = theme_get_shadow(t->frame_radius);
+	if (!t->shadow) {
+		free(t);
+		return NULL;
+	}
 
 	t->active_frame =
 		cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
@@ -479,16 +553,21 @@ theme_create(void)
 	cairo_surface_destroy(t->inactive_frame);
  err_active_frame:
 	cairo_surface_destroy(t->active_frame);
- err_shadow:
 	cairo_surface_destroy(t->shadow);
 	free(t);
 	return NULL;
 }
 
+#ifdef HAVE_PANGO
+static void
+theme_title_cache_destroy(struct theme *t);
+#endif
+
 void
 theme_destroy(struct theme *t)
 {
 #ifdef HAVE_PANGO
+	theme_title_cache_destroy(t);
 	if (t->pango_context)
 		g_object_unref(t->pango_context);
 #endif
@@ -540,6 +619,140 @@ create_layout(struct theme *t, cairo_t *cr, const char *title)
 	cairo_show_text(cr, title)
 #endif
 
+#ifdef HAVE_PANGO
+#define THEME_TITLE_CACHE_SIZE 16
+/* Room around the logical text extents for ink overhang and the shadow */
+#define THEME_TITLE_PAD 2
+
+/** A title rendered once and blitted on every frame repaint
+ *
+ * Laying out and rasterising the title text is most of the cost of
+ * redrawing a frame, and it does not change while a window is resized or
+ * repainted for other reasons.
+ */
+struct theme_title {
+	char *title;
+	bool active;
+	int max_width; /**< width the text was ellipsized to, or 0 */
+	int width, height; /**< logical text extents */
+	cairo_surface_t *surface;
+	uint32_t last_used;
+};
+
+static void
+theme_title_fini(struct theme_title *entry)
+{
+	free(entry->title);
+	if (entry->surface)
+		cairo_surface_destroy(entry->surface);
+	memset(entry, 0, sizeof *entry);
+}
+
+static void
+theme_title_cache_destroy(struct theme *t)
+{
+	int i;
+
+	if (!t->title_cache)
+		return;
+
+	for (i = 0; i < THEME_TITLE_CACHE_SIZE; i++)
+		theme_title_fini(&t->title_cache[i]);
+	free(t->title_cache);
+	t->title_cache = NULL;
+}
+
+static bool
+theme_title_matches(const struct theme_title *entry, const char *title,
+		    int max_width, bool active)
+{
+	if (!entry->surface || entry->active != active ||
+	    strcmp(entry->title, title) != 0)
+		return false;
+
+	/* A title which fit at its natural width fits any wider space. */
+	if (entry->max_width == 0)
+		return entry->width <= max_width;
+
+	return entry->max_width == max_width;
+}
+
+static struct theme_title *
+theme_get_title(struct theme *t, cairo_t *cr, const char *title,
+		int max_width, bool active)
+{
+	struct theme_title *entry = NULL;
+	PangoLayout *title_layout;
+	PangoRectangle logical;
+	cairo_t *title_cr;
+	int i;
+
+	if (!title)
+		title = "";
+
+	if (!t->title_cache)
+		t->title_cache = xzalloc(THEME_TITLE_CACHE_SIZE *
+					 sizeof(*t->title_cache));
+
+	t->title_cache_clock++;
+
+	for (i = 0; i < THEME_TITLE_CACHE_SIZE; i++) {
+		if (theme_title_matches(&t->title_cache[i], title,
+					max_width, active)) {
+			entry = &t->title_cache[i];
+			entry->last_used = t->title_cache_clock;
+			return entry;
+		}
+
+		if (!entry || t->title_cache[i].last_used < entry->last_used)
+			entry = &t->title_cache[i];
+	}
+
+	/* Not cached, replace the least recently used entry. */
+	theme_title_fini(entry);
+
+	title_layout = create_layout(t, cr, title);
+
+	pango_layout_get_pixel_extents(title_layout, NULL, &logical);
+	entry->width = MIN(max_width, logical.width);
+	entry->height = logical.height;
+	if (entry->width < logical.width) {
+		pango_layout_set_width(title_layout,
+				       entry->width * PANGO_SCALE);
+		entry->max_width = max_width;
+	}
+
+	entry->surface =
+		cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					   MAX(entry->width, 0) +
+					   THEME_TITLE_PAD * 2 + 1,
+					   entry->height +
+					   THEME_TITLE_PAD * 2 + 1);
+	title_cr = cairo_create(entry->surface);
+	if (active) {
+		cairo_move_to(title_cr, THEME_TITLE_PAD + 1,
+			      THEME_TITLE_PAD + 1);
+		cairo_set_source_rgb(title_cr, 1, 1, 1);
+		SHOW_TEXT(title_cr);
+		cairo_move_to(title_cr, THEME_TITLE_PAD, THEME_TITLE_PAD);
+		cairo_set_source_rgb(title_cr, 0, 0, 0);
+		SHOW_TEXT(title_cr);
+	} else {
+		cairo_move_to(title_cr, THEME_TITLE_PAD, THEME_TITLE_PAD);
+		cairo_set_source_rgb(title_cr, 0.4, 0.4, 0.4);
+		SHOW_TEXT(title_cr);
+	}
+	cairo_destroy(title_cr);
+	g_object_unref(title_layout);
+
+	entry->title = xstrdup(title);
+	entry->active = active;
+	entry->last_used = t->title_cache_clock;
+
+	return entry;
+}
+#endif
+
 void
 theme_render_frame(struct theme *t,
 		   cairo_t *cr, int width, int height,
@@ -588,17 +801,12 @@ theme_render_frame(struct theme *t,
 		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
 #ifdef HAVE_PANGO
-		PangoLayout *title_layout;
-		PangoRectangle logical;
-
-		title_layout = create_layout(t, cr, title);
-
-		pango_layout_get_pixel_extents (title_layout, NULL, &logical);
-		text_width = MIN(title_rect->width, logical.width);
-		text_height = logical.height;
-		if (text_width < logical.width)
-		  pango_layout_set_width (title_layout, text_width * PANGO_SCALE);
+		struct theme_title *rendered;
 
+		rendered = theme_get_title(t, cr, title, title_rect->width,
+					   flags & THEME_FRAME_ACTIVE);
+		text_width = rendered->width;
+		text_height = rendered->height;
 #else
 		cairo_text_extents_t extents;
 		cairo_font_extents_t font_extents;
@@ -620,6 +828,12 @@ theme_render_frame(struct theme *t,
 		else if (x + text_width > (title_rect->x + title_rect->width))
 			x = (title_rect->x + title_rect->width) - text_width;
 
+#ifdef HAVE_PANGO
+		cairo_set_source_surface(cr, rendered->surface,
+					 x - THEME_TITLE_PAD,
+					 y - THEME_TITLE_PAD);
+		cairo_paint(cr);
+#else
 		if (flags & THEME_FRAME_ACTIVE) {
 			cairo_move_to(cr, x + 1, y  + 1);
 			cairo_set_source_rgb(cr, 1, 1, 1);
@@ -632,9 +846,6 @@ theme_render_frame(struct theme *t,
 			cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
 			SHOW_TEXT(cr);
 		}
-
-#ifdef HAVE_PANGO
-		g_object_unref(title_layout);
 #endif
 	}
 }
@@ -707,6 +918,10 @@ cleanup_after_cairo(void)
 #ifdef HAVE_PANGO
 	pango_cairo_font_map_set_default(NULL);
 #endif
+	if (shadow_cache.surface) {
+		cairo_surface_destroy(shadow_cache.surface);
+		shadow_cache.surface = NULL;
+	}
 	cairo_debug_reset_static_data();
 #ifdef HAVE_PANGO
 	FcFini();
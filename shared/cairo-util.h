@@ -52,6 +52,9 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius);
 cairo_surface_t *
 load_cairo_surface(const char *filename);
 
+cairo_surface_t *
+load_cairo_surface_with_flags(const char *filename, uint32_t image_load_flags);
+
 struct weston_image *
 load_cairo_surface_get_user_data(cairo_surface_t *surface);
 
@@ -65,6 +68,10 @@ struct theme {
 	int titlebar_height;
 #ifdef HAVE_PANGO
 	PangoContext *pango_context;
+
+	/* Rendered titles, see theme_get_title() */
+	struct theme_title *title_cache;
+	uint32_t title_cache_clock;
 #endif
 };
 
@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -42,6 +43,7 @@
 #include <libweston/zalloc.h>
 #include <libweston/config-parser.h>
 #include <libweston/libweston.h>
+#include "hash.h"
 #include "helpers.h"
 #include "string-helpers.h"
 
@@ -51,6 +53,31 @@
  * Helper functions to read out ini configuration file.
  */
 
+/*
+ * Sections and entries keep their file order in lists, for iteration,
+ * and are also indexed by name: a section's entries by key, and the
+ * sections by name, each index pointing to the first section of that
+ * name with next_same_name chaining the others in file order.
+ */
+
+static bool
+config_streq(const char *a, const char *b)
+{
+	return strcmp(a, b) == 0;
+}
+
+struct weston_config_entry;
+struct weston_config_section;
+
+HASH_MAP_DECLARE(config_entry_map, const char *, struct weston_config_entry *);
+HASH_MAP_DEFINE(static inline, config_entry_map, const char *,
+		struct weston_config_entry *, hash_string, config_streq)
+
+HASH_MAP_DECLARE(config_section_map, const char *,
+		 struct weston_config_section *);
+HASH_MAP_DEFINE(static inline, config_section_map, const char *,
+		struct weston_config_section *, hash_string, config_streq)
+
 struct weston_config_entry {
 	char *key;
 	char *value;
@@ -60,11 +87,15 @@ struct weston_config_entry {
 struct weston_config_section {
 	char *name;
 	struct wl_list entry_list;
+	struct config_entry_map entries;
+	struct weston_config_section *next_same_name;
+	struct weston_config_section *last_same_name; /* valid on the first */
 	struct wl_list link;
 };
 
 struct weston_config {
 	struct wl_list section_list;
+	struct config_section_map sections;
 	char path[PATH_MAX];
 };
 
@@ -125,15 +156,14 @@ static struct weston_config_entry *
 config_section_get_entry(struct weston_config_section *section,
 			 const char *key)
 {
-	struct weston_config_entry *e;
+	struct weston_config_entry **e;
 
 	if (section == NULL)
 		return NULL;
-	wl_list_for_each(e, &section->entry_list, link)
-		if (strcmp(e->key, key) == 0)
-			return e;
 
-	return NULL;
+	e = config_entry_map_lookup(&section->entries, key);
+
+	return e ? *e : NULL;
 }
 
 /**
@@ -143,14 +173,17 @@ WL_EXPORT struct weston_config_section *
 weston_config_get_section(struct weston_config *config, const char *section,
 			  const char *key, const char *value)
 {
-	struct weston_config_section *s;
+	struct weston_config_section **first, *s;
 	struct weston_config_entry *e;
 
 	if (config == NULL)
 		return NULL;
-	wl_list_for_each(s, &config->section_list, link) {
-		if (strcmp(s->name, section) != 0)
-			continue;
+
+	first = config_section_map_lookup(&config->sections, section);
+	if (!first)
+		return NULL;
+
+	for (s = *first; s; s = s->next_same_name) {
 		if (key == NULL)
 			return s;
 		e = config_section_get_entry(s, key);
@@ -366,7 +399,7 @@ weston_config_get_name_from_env(void)
 static struct weston_config_section *
 config_add_section(struct weston_config *config, const char *name)
 {
-	struct weston_config_section *section;
+	struct weston_config_section *section, **first;
 
 	section = zalloc(sizeof *section);
 	if (section == NULL)
@@ -378,7 +411,21 @@ config_add_section(struct weston_config *config, const char *name)
 		return NULL;
 	}
 
+	first = config_section_map_lookup(&config->sections, section->name);
+	if (first) {
+		(*first)->last_same_name->next_same_name = section;
+		(*first)->last_same_name = section;
+	} else if (config_section_map_insert(&config->sections,
+					     section->name, section)) {
+		section->last_same_name = section;
+	} else {
+		free(section->name);
+		free(section);
+		return NULL;
+	}
+
 	wl_list_init(&section->entry_list);
+	config_entry_map_init(&section->entries);
 	wl_list_insert(config->section_list.prev, &section->link);
 
 	return section;
@@ -407,69 +454,135 @@ section_add_entry(struct weston_config_section *section,
 		return NULL;
 	}
 
+	/* Lookups find the first of duplicate keys */
+	if (!config_entry_map_lookup(&section->entries, entry->key) &&
+	    !config_entry_map_insert(&section->entries, entry->key, entry)) {
+		free(entry->value);
+		free(entry->key);
+		free(entry);
+		return NULL;
+	}
+
 	wl_list_insert(section->entry_list.prev, &entry->link);
 
 	return entry;
 }
 
 static bool
-weston_config_parse_internal(struct weston_config *config, FILE *fp)
+config_parse_line(struct weston_config *config,
+		  struct weston_config_section **section, char *line)
 {
-	struct weston_config_section *section = NULL;
-	char line[512], *p;
+	char *p;
 	int i;
 
-	wl_list_init(&config->section_list);
-
-	while (fgets(line, sizeof line, fp)) {
-		switch (line[0]) {
-		case '#':
-		case '\n':
-			continue;
-		case '[':
-			p = strchr(&line[1], ']');
-			if (!p || p[1] != '\n') {
-				fprintf(stderr, "malformed "
-					"section header: %s\n", line);
-				return false;
-			}
-			p[0] = '\0';
-			section = config_add_section(config, &line[1]);
-			continue;
-		default:
-			p = strchr(line, '=');
-			if (!p || p == line || !section) {
-				fprintf(stderr, "malformed "
-					"config line: %s\n", line);
-				return false;
-			}
+	switch (line[0]) {
+	case '#':
+	case '\n':
+		return true;
+	case '[':
+		p = strchr(&line[1], ']');
+		if (!p || p[1] != '\n') {
+			fprintf(stderr, "malformed "
+				"section header: %s\n", line);
+			return false;
+		}
+		p[0] = '\0';
+		*section = config_add_section(config, &line[1]);
+		return true;
+	default:
+		p = strchr(line, '=');
+		if (!p || p == line || !*section) {
+			fprintf(stderr, "malformed "
+				"config line: %s\n", line);
+			return false;
+		}
 
-			p[0] = '\0';
+		p[0] = '\0';
+		p++;
+		while (isspace(*p))
 			p++;
-			while (isspace(*p))
-				p++;
-			i = strlen(p);
-			while (i > 0 && isspace(p[i - 1])) {
-				p[i - 1] = '\0';
-				i--;
-			}
-			section_add_entry(section, line, p);
-			continue;
+		i = strlen(p);
+		while (i > 0 && isspace(p[i - 1])) {
+			p[i - 1] = '\0';
+			i--;
 		}
+		section_add_entry(*section, line, p);
+		return true;
 	}
+}
+
+/** Parse a whole ini file held in memory
+ *
+ * Each line, with its newline if any, is copied out to be split in
+ * place; the data itself is never written to, so it can be a read-only
+ * mapping of the file.
+ */
+static bool
+weston_config_parse_internal(struct weston_config *config,
+			     const char *data, size_t size)
+{
+	struct weston_config_section *section = NULL;
+	const char *cur = data, *end = data + size, *nl;
+	char line[512], *buf;
+	size_t len;
+	bool ret = true;
+
+	wl_list_init(&config->section_list);
+	config_section_map_init(&config->sections);
+
+	while (ret && cur < end) {
+		nl = memchr(cur, '\n', end - cur);
+		len = nl ? (size_t)(nl - cur + 1) : (size_t)(end - cur);
+
+		buf = len < sizeof line ? line : malloc(len + 1);
+		if (!buf)
+			return false;
+
+		memcpy(buf, cur, len);
+		buf[len] = '\0';
+		ret = config_parse_line(config, &section, buf);
 
-	return true;
+		if (buf != line)
+			free(buf);
+		cur += len;
+	}
+
+	return ret;
 }
 
 WESTON_EXPORT_FOR_TESTS struct weston_config *
 weston_config_parse_fp(FILE *file)
 {
 	struct weston_config *config = zalloc(sizeof(*config));
+	char *data = NULL;
+	size_t size = 0, alloc = 0, n;
+	bool ret;
 
 	if (config == NULL)
 		return NULL;
 
-	if (!weston_config_parse_internal(config, file)) {
+	do {
+		if (size == alloc) {
+			char *tmp;
+
+			alloc = alloc ? alloc * 2 : 4096;
+			tmp = realloc(data, alloc);
+			if (!tmp) {
+				free(data);
+				free(config);
+				return NULL;
+			}
+			data = tmp;
+		}
+
+		n = fread(data + size, 1, alloc - size, file);
+		size += n;
+	} while (n > 0);
+
+	ret = weston_config_parse_internal(config, data, size);
+	free(data);
+
+	if (!ret) {
 		weston_config_destroy(config);
 		return NULL;
 	}
@@ -483,9 +596,9 @@ weston_config_parse_fp(FILE *file)
 WL_EXPORT struct weston_config *
 weston_config_parse(const char *name)
 {
-	FILE *fp;
 	struct stat filestat;
 	struct weston_config *config;
+	void *data = NULL;
 	int fd;
 	bool ret;
 
@@ -506,16 +619,22 @@ weston_config_parse(const char *name)
 		return NULL;
 	}
 
-	fp = fdopen(fd, "r");
-	if (fp == NULL) {
-		close(fd);
-		free(config);
-		return NULL;
+	/* mmap() refuses empty files; those are just an empty config */
+	if (filestat.st_size > 0) {
+		data = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE,
+			    fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			free(config);
+			return NULL;
+		}
 	}
+	close(fd);
 
-	ret = weston_config_parse_internal(config, fp);
+	ret = weston_config_parse_internal(config, data, filestat.st_size);
 
-	fclose(fp);
+	if (data)
+		munmap(data, filestat.st_size);
 
 	if (!ret) {
 		weston_config_destroy(config);
@@ -575,10 +694,12 @@ weston_config_destroy(struct weston_config *config)
 			free(e->value);
 			free(e);
 		}
+		config_entry_map_release(&s->entries);
 		free(s->name);
 		free(s);
 	}
 
+	config_section_map_release(&config->sections);
 	free(config);
 }
 
@@ -39,84 +39,18 @@
 
 #include "hash.h"
 
-struct hash_entry {
-	uint32_t hash;
-	void *data;
-};
-
-struct hash_table {
-	struct hash_entry *table;
-	uint32_t size;
-	uint32_t rehash;
-	uint32_t max_entries;
-	uint32_t size_index;
-	uint32_t entries;
-	uint32_t deleted_entries;
-};
-
-#define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
-
-/*
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
- */
-
-static const uint32_t deleted_data;
-
-static const struct {
-   uint32_t max_entries, size, rehash;
-} hash_sizes[] = {
-    { 2,		5,		3	  },
-    { 4,		7,		5	  },
-    { 8,		13,		11	  },
-    { 16,		19,		17	  },
-    { 32,		43,		41        },
-    { 64,		73,		71        },
-    { 128,		151,		149       },
-    { 256,		283,		281       },
-    { 512,		571,		569       },
-    { 1024,		1153,		1151      },
-    { 2048,		2269,		2267      },
-    { 4096,		4519,		4517      },
-    { 8192,		9013,		9011      },
-    { 16384,		18043,		18041     },
-    { 32768,		36109,		36107     },
-    { 65536,		72091,		72089     },
-    { 131072,		144409,		144407    },
-    { 262144,		288361,		288359    },
-    { 524288,		576883,		576881    },
-    { 1048576,		1153459,	1153457   },
-    { 2097152,		2307163,	2307161   },
-    { 4194304,		4613893,	4613891   },
-    { 8388608,		9227641,	9227639   },
-    { 16777216,		18455029,	18455027  },
-    { 33554432,		36911011,	36911009  },
-    { 67108864,		73819861,	73819859  },
-    { 134217728,	147639589,	147639587 },
-    { 268435456,	295279081,	295279079 },
-    { 536870912,	590559793,	590559791 },
-    { 1073741824,	1181116273,	1181116271},
-    { 2147483648ul,	2362232233ul,	2362232231ul}
-};
-
-static int
-entry_is_free(struct hash_entry *entry)
+static inline bool
+equal_u32(uint32_t a, uint32_t b)
 {
-	return entry->data == NULL;
+	return a == b;
 }
 
-static int
-entry_is_deleted(struct hash_entry *entry)
-{
-	return entry->data == &deleted_data;
-}
+HASH_MAP_DECLARE(hash_table_map, uint32_t, void *);
+HASH_MAP_DEFINE(static, hash_table_map, uint32_t, void *, hash_u32, equal_u32)
 
-static int
-entry_is_present(struct hash_entry *entry)
-{
-	return entry->data != NULL && entry->data != &deleted_data;
-}
+struct hash_table {
+	struct hash_table_map map;
+};
 
 struct hash_table *
 hash_table_create(void)
@@ -127,18 +61,7 @@ hash_table_create(void)
 	if (ht == NULL)
 		return NULL;
 
-	ht->size_index = 0;
-	ht->size = hash_sizes[ht->size_index].size;
-	ht->rehash = hash_sizes[ht->size_index].rehash;
-	ht->max_entries = hash_sizes[ht->size_index].max_entries;
-	ht->table = calloc(ht->size, sizeof(*ht->table));
-	ht->entries = 0;
-	ht->deleted_entries = 0;
-
-	if (ht->table == NULL) {
-		free(ht);
-		return NULL;
-	}
+	hash_table_map_init(&ht->map);
 
 	return ht;
 }
@@ -152,158 +75,58 @@ hash_table_destroy(struct hash_table *ht)
 	if (!ht)
 		return;
 
-	free(ht->table);
+	hash_table_map_release(&ht->map);
 	free(ht);
 }
 
 /**
- * Finds a hash table entry with the given key and hash of that key.
+ * Calls func for the data of every entry.
  *
- * Returns NULL if no entry is found.  Note that the data pointer may be
- * modified by the user.
+ * func may remove the entry it is called for from the table.
  */
-static void *
-hash_table_search(struct hash_table *ht, uint32_t hash)
-{
-	uint32_t hash_address;
-
-	hash_address = hash % ht->size;
-	do {
-		uint32_t double_hash;
-
-		struct hash_entry *entry = ht->table + hash_address;
-
-		if (entry_is_free(entry)) {
-			return NULL;
-		} else if (entry_is_present(entry) && entry->hash == hash) {
-			return entry;
-		}
-
-		double_hash = 1 + hash % ht->rehash;
-
-		hash_address = (hash_address + double_hash) % ht->size;
-	} while (hash_address != hash % ht->size);
-
-	return NULL;
-}
-
 void
 hash_table_for_each(struct hash_table *ht,
 		    hash_table_iterator_func_t func, void *data)
 {
-	struct hash_entry *entry;
+	struct hash_table_map_entry *entry;
 	uint32_t i;
 
-	for (i = 0; i < ht->size; i++) {
-		entry = ht->table + i;
-		if (entry_is_present(entry))
-			func(entry->data, data);
-	}
+	hash_map_for_each(i, entry, &ht->map)
+		func(entry->value, data);
 }
 
 void *
 hash_table_lookup(struct hash_table *ht, uint32_t hash)
 {
-	struct hash_entry *entry;
+	void **data;
 
-	entry = hash_table_search(ht, hash);
-	if (entry != NULL)
-		return entry->data;
+	data = hash_table_map_lookup(&ht->map, hash);
+	if (data != NULL)
+		return *data;
 
 	return NULL;
 }
 
-static void
-hash_table_rehash(struct hash_table *ht, unsigned int new_size_index)
-{
-	struct hash_table old_ht;
-	struct hash_entry *table, *entry;
-
-	if (new_size_index >= ARRAY_SIZE(hash_sizes))
-		return;
-
-	table = calloc(hash_sizes[new_size_index].size, sizeof(*ht->table));
-	if (table == NULL)
-		return;
-
-	old_ht = *ht;
-
-	ht->table = table;
-	ht->size_index = new_size_index;
-	ht->size = hash_sizes[ht->size_index].size;
-	ht->rehash = hash_sizes[ht->size_index].rehash;
-	ht->max_entries = hash_sizes[ht->size_index].max_entries;
-	ht->entries = 0;
-	ht->deleted_entries = 0;
-
-	for (entry = old_ht.table;
-	     entry != old_ht.table + old_ht.size;
-	     entry++) {
-		if (entry_is_present(entry)) {
-			hash_table_insert(ht, entry->hash, entry->data);
-		}
-	}
-
-	free(old_ht.table);
-}
-
 /**
- * Inserts the data with the given hash into the table.
+ * Inserts the data with the given hash into the table, replacing the data
+ * already there for the hash, if any.
  *
- * Note that insertion may rearrange the table on a resize or rehash,
- * so previously found hash_entries are no longer valid after this function.
+ * Returns -1 if the table could not grow.
  */
 int
 hash_table_insert(struct hash_table *ht, uint32_t hash, void *data)
 {
-	uint32_t hash_address;
-
-	if (ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index + 1);
-	} else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index);
-	}
+	if (!hash_table_map_insert(&ht->map, hash, data))
+		return -1;
 
-	hash_address = hash % ht->size;
-	do {
-		struct hash_entry *entry = ht->table + hash_address;
-		uint32_t double_hash;
-
-		if (!entry_is_present(entry)) {
-			if (entry_is_deleted(entry))
-				ht->deleted_entries--;
-			entry->hash = hash;
-			entry->data = data;
-			ht->entries++;
-			return 0;
-		}
-
-		double_hash = 1 + hash % ht->rehash;
-
-		hash_address = (hash_address + double_hash) % ht->size;
-	} while (hash_address != hash % ht->size);
-
-	/* We could hit here if a required resize failed. An unchecked-malloc
-	 * application could ignore this result.
-	 */
-	return -1;
+	return 0;
 }
 
 /**
- * This function deletes the given hash table entry.
- *
- * Note that deletion doesn't otherwise modify the table, so an iteration over
- * the table deleting entries is safe.
+ * This function deletes the entry with the given hash from the table.
  */
 void
 hash_table_remove(struct hash_table *ht, uint32_t hash)
 {
-	struct hash_entry *entry;
-
-	entry = hash_table_search(ht, hash);
-	if (entry != NULL) {
-		entry->data = (void *) &deleted_data;
-		ht->entries--;
-		ht->deleted_entries++;
-	}
+	hash_table_map_remove(&ht->map, hash, NULL);
 }
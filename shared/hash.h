@@ -35,7 +35,282 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Typed hash maps.
+ *
+ * HASH_MAP_DECLARE(name, K, V) declares struct name, a map from keys of
+ * type K to values of type V, and HASH_MAP_DEFINE(scope, name, K, V, hash_fn,
+ * equal_fn) generates its functions with the given storage class, usually
+ * "static" or "static inline". 'hash_fn' returns a well mixed uint32_t for a
+ * key, see hash_u32(), and 'equal_fn' compares two keys.
+ *
+ *	void name_init(struct name *map);
+ *	void name_release(struct name *map);
+ *	V *name_lookup(struct name *map, K key);
+ *	V *name_insert(struct name *map, K key, V value);
+ *	bool name_remove(struct name *map, K key, V *value);
+ *
+ * Inserting an existing key replaces its value. name_insert() returns NULL
+ * only when it cannot allocate memory. Pointers returned by name_lookup()
+ * and name_insert() stay valid until the next insertion or removal.
+ *
+ * The map is open addressing over a power-of-two array of slots of 8
+ * bytes, 8 to a cache line, with robin-hood probing: a key moves entries
+ * that are closer to their home slot out of the way, so that probe
+ * sequences stay short and a lookup can stop as soon as it meets an entry
+ * closer to home than the key would be. Removal shifts the following
+ * entries back instead of leaving tombstones. The slots only hold the hash
+ * and the index of the entry, the entries themselves are kept packed in
+ * insertion order with removals filling holes from the end. So iterating,
+ * with hash_map_for_each(), only touches the entries:
+ *
+ *	uint32_t i;
+ *	struct name_entry *entry;
+ *
+ *	hash_map_for_each(i, entry, &map)
+ *		use(entry->key, entry->value);
+ *
+ * The iteration goes backwards, so removing the current entry is safe.
+ */
+
+#define HASH_MAP_EMPTY_SLOT UINT32_MAX
+
+struct hash_map_slot {
+	uint32_t hash;
+	uint32_t index; /* into entries, HASH_MAP_EMPTY_SLOT if unused */
+};
+
+#define hash_map_for_each(i, entry, map)				\
+	for ((i) = (map)->count;					\
+	     (i)-- > 0 && ((entry) = &(map)->entries[(i)]); )
+
+/* The murmur3 finalizer: every bit of the key affects the low bits that
+ * pick the slot. */
+static inline uint32_t
+hash_u32(uint32_t key)
+{
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35;
+	key ^= key >> 16;
+
+	return key;
+}
+
+/* FNV-1a over a NUL-terminated string, finalized like hash_u32() */
+static inline uint32_t
+hash_string(const char *str)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *str; str++) {
+		h ^= (uint8_t)*str;
+		h *= 16777619u;
+	}
+
+	return hash_u32(h);
+}
+
+#define HASH_MAP_DECLARE(name, K, V)					\
+struct name##_entry {							\
+	K key;								\
+	V value;							\
+};									\
+									\
+struct name {								\
+	struct hash_map_slot *slots;					\
+	uint32_t mask;			/* number of slots - 1 */	\
+	struct name##_entry *entries;					\
+	uint32_t count;							\
+	uint32_t alloc;			/* allocated entries */		\
+}
+
+#define HASH_MAP_DEFINE(scope, name, K, V, hash_fn, equal_fn)		\
+scope void								\
+name##_init(struct name *map)						\
+{									\
+	map->slots = NULL;						\
+	map->mask = 0;							\
+	map->entries = NULL;						\
+	map->count = 0;							\
+	map->alloc = 0;							\
+}									\
+									\
+scope void								\
+name##_release(struct name *map)					\
+{									\
+	free(map->slots);						\
+	free(map->entries);						\
+	name##_init(map);						\
+}									\
+									\
+/* Finds the slot of the key, or returns HASH_MAP_EMPTY_SLOT */		\
+static inline uint32_t							\
+name##_find_slot(struct name *map, K key, uint32_t h)			\
+{									\
+	uint32_t i, dist;						\
+									\
+	if (!map->slots)						\
+		return HASH_MAP_EMPTY_SLOT;				\
+									\
+	for (i = h & map->mask, dist = 0; ; i = (i + 1) & map->mask, dist++) { \
+		struct hash_map_slot *slot = &map->slots[i];		\
+									\
+		if (slot->index == HASH_MAP_EMPTY_SLOT ||		\
+		    ((i - slot->hash) & map->mask) < dist)		\
+			return HASH_MAP_EMPTY_SLOT;			\
+		if (slot->hash == h &&					\
+		    equal_fn(map->entries[slot->index].key, key))	\
+			return i;					\
+	}								\
+}									\
+									\
+static inline void							\
+name##_place(struct name *map, struct hash_map_slot slot)		\
+{									\
+	uint32_t i, dist;						\
+									\
+	for (i = slot.hash & map->mask, dist = 0; ;			\
+	     i = (i + 1) & map->mask, dist++) {				\
+		struct hash_map_slot *cur = &map->slots[i];		\
+		uint32_t cur_dist;					\
+									\
+		if (cur->index == HASH_MAP_EMPTY_SLOT) {		\
+			*cur = slot;					\
+			return;						\
+		}							\
+									\
+		/* Take the place of an entry closer to its home */	\
+		cur_dist = (i - cur->hash) & map->mask;			\
+		if (cur_dist < dist) {					\
+			struct hash_map_slot tmp = *cur;		\
+									\
+			*cur = slot;					\
+			slot = tmp;					\
+			dist = cur_dist;				\
+		}							\
+	}								\
+}									\
+									\
+static inline bool							\
+name##_grow(struct name *map)						\
+{									\
+	uint32_t nslots = map->slots ? (map->mask + 1) * 2 : 8;		\
+	struct hash_map_slot *slots, *old = map->slots;			\
+	struct name##_entry *entries;					\
+	uint32_t i;							\
+									\
+	/* Keep the load factor at 7/8 at most */			\
+	entries = realloc(map->entries,					\
+			  (nslots - nslots / 8) * sizeof *entries);	\
+	if (!entries)							\
+		return false;						\
+	map->entries = entries;						\
+									\
+	slots = malloc(nslots * sizeof *slots);				\
+	if (!slots)							\
+		return false;						\
+	for (i = 0; i < nslots; i++)					\
+		slots[i].index = HASH_MAP_EMPTY_SLOT;			\
+									\
+	map->slots = slots;						\
+	map->alloc = nslots - nslots / 8;				\
+	if (old) {							\
+		uint32_t n = map->mask + 1;				\
+									\
+		map->mask = nslots - 1;					\
+		for (i = 0; i < n; i++) {				\
+			if (old[i].index != HASH_MAP_EMPTY_SLOT)	\
+				name##_place(map, old[i]);		\
+		}							\
+		free(old);						\
+	} else {							\
+		map->mask = nslots - 1;					\
+	}								\
+									\
+	return true;							\
+}									\
+									\
+scope V *								\
+name##_lookup(struct name *map, K key)					\
+{									\
+	uint32_t i = name##_find_slot(map, key, hash_fn(key));		\
+									\
+	if (i == HASH_MAP_EMPTY_SLOT)					\
+		return NULL;						\
+									\
+	return &map->entries[map->slots[i].index].value;		\
+}									\
+									\
+scope V *								\
+name##_insert(struct name *map, K key, V value)				\
+{									\
+	uint32_t h = hash_fn(key);					\
+	uint32_t i = name##_find_slot(map, key, h);			\
+	struct hash_map_slot slot;					\
+	struct name##_entry *entry;					\
+									\
+	if (i != HASH_MAP_EMPTY_SLOT) {					\
+		entry = &map->entries[map->slots[i].index];		\
+		entry->value = value;					\
+		return &entry->value;					\
+	}								\
+									\
+	if (map->count == map->alloc && !name##_grow(map))		\
+		return NULL;						\
+									\
+	entry = &map->entries[map->count];				\
+	entry->key = key;						\
+	entry->value = value;						\
+									\
+	slot.hash = h;							\
+	slot.index = map->count++;					\
+	name##_place(map, slot);					\
+									\
+	return &entry->value;						\
+}									\
+									\
+scope bool								\
+name##_remove(struct name *map, K key, V *value)			\
+{									\
+	uint32_t h = hash_fn(key);					\
+	uint32_t i = name##_find_slot(map, key, h);			\
+	uint32_t index, last, next;					\
+									\
+	if (i == HASH_MAP_EMPTY_SLOT)					\
+		return false;						\
+									\
+	index = map->slots[i].index;					\
+	if (value)							\
+		*value = map->entries[index].value;			\
+									\
+	/* Shift the following entries back by one, up to one that is	\
+	 * in its home slot already */					\
+	for (next = (i + 1) & map->mask;				\
+	     map->slots[next].index != HASH_MAP_EMPTY_SLOT &&		\
+	     ((next - map->slots[next].hash) & map->mask) != 0;		\
+	     next = (next + 1) & map->mask) {				\
+		map->slots[i] = map->slots[next];			\
+		i = next;						\
+	}								\
+	map->slots[i].index = HASH_MAP_EMPTY_SLOT;			\
+									\
+	/* Fill the hole in the entries with the last one */		\
+	last = --map->count;						\
+	if (index != last) {						\
+		map->entries[index] = map->entries[last];		\
+		i = name##_find_slot(map, map->entries[index].key,	\
+				     hash_fn(map->entries[index].key));	\
+		map->slots[i].index = index;				\
+	}								\
+									\
+	return true;							\
+}
 
 struct hash_table;
 struct hash_table *hash_table_create(void);
@@ -27,17 +27,26 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <png.h>
 #include <pixman.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
+#include "shared/string-helpers.h"
 #include "shared/xalloc.h"
 #include "image-loader.h"
 
@@ -136,6 +145,8 @@ load_jpeg_image(struct jpeg_decompress_struct *cinfo,
 			rows[i] = jpeg_image_data->data + (first + i) * stride;
 
 		jpeg_read_scanlines(cinfo, rows, ARRAY_LENGTH(rows));
+		if (cinfo->out_color_space != JCS_RGB)
+			continue;
 		for (i = 0; first + i < cinfo->output_scanline; i++)
 			swizzle_row(rows[i], cinfo->output_width);
 	}
@@ -207,7 +218,16 @@ load_jpeg(FILE *fp, uint32_t image_load_flags)
 		jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xFFFF);
 
 	jpeg_read_header(&cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+	/* libjpeg-turbo writes a8r8g8b8 itself, no need to swizzle. */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	cinfo.out_color_space = JCS_EXT_ARGB;
+#else
+	cinfo.out_color_space = JCS_EXT_BGRA;
+#endif
+#else
 	cinfo.out_color_space = JCS_RGB;
+#endif
 	jpeg_start_decompress(&cinfo);
 
 	image = xzalloc(sizeof(*image));
@@ -262,15 +282,61 @@ multiply_alpha(int alpha, int color)
     return ((temp + (temp >> 8)) >> 8);
 }
 
+#ifdef __SSE2__
+/* Four pixels at a time, with the same rounding as multiply_alpha() */
+static unsigned int
+premultiply_data_sse2(png_bytep data, unsigned int rowbytes)
+{
+	const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i round = _mm_set1_epi16(0x80);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int i;
+
+	for (i = 0; i + 16 <= rowbytes; i += 16) {
+		__m128i px = _mm_loadu_si128((__m128i *) (data + i));
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+		__m128i alo, ahi, t;
+
+		/* r g b a → a a a a, per pixel */
+		alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+		ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+
+		t = _mm_add_epi16(_mm_mullo_epi16(lo, alo), round);
+		t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		lo = _mm_or_si128(_mm_andnot_si128(alpha_mask, t),
+				  _mm_and_si128(alpha_mask, lo));
+
+		t = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), round);
+		t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		hi = _mm_or_si128(_mm_andnot_si128(alpha_mask, t),
+				  _mm_and_si128(alpha_mask, hi));
+
+		/* r g b a → b g r a, which is a8r8g8b8 in memory */
+		lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xc6), 0xc6);
+		hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xc6), 0xc6);
+
+		_mm_storeu_si128((__m128i *) (data + i),
+				 _mm_packus_epi16(lo, hi));
+	}
+
+	return i;
+}
+#endif
+
 static void
 premultiply_data(png_structp   png,
 		 png_row_infop row_info,
 		 png_bytep     data)
 {
-    unsigned int i;
+    unsigned int i = 0;
     png_bytep p;
 
-    for (i = 0, p = data; i < row_info->rowbytes; i += 4, p += 4) {
+#if defined(__SSE2__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    i = premultiply_data_sse2(data, row_info->rowbytes);
+#endif
+
+    for (p = data + i; i < row_info->rowbytes; i += 4, p += 4) {
 	uint32_t alpha = p[3];
 	uint32_t w;
 
@@ -561,6 +627,291 @@ static const struct image_loader loaders[] = {
 	{ { 'R', 'I', 'F', 'F' }, 4, load_webp }
 };
 
+/*
+ * On-disk cache of decoded images
+ *
+ * Each entry holds the premultiplied a8r8g8b8 pixels of one image file, and
+ * its ICC profile if it was read too, tied to the file's path, size and
+ * modification time. Entries are mapped directly as the pixel storage, so a
+ * hit costs neither decoding nor copying.
+ */
+
+#define IMAGE_CACHE_MAGIC "WIMGC01"
+/* Pixels start at a multiple of this in the cache file */
+#define IMAGE_CACHE_ALIGN 64
+
+struct image_cache_header {
+	char magic[8];
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t file_size;
+	uint32_t load_flags;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t path_length;
+	uint32_t icc_length;
+	uint32_t data_offset;
+	uint32_t icc_offset;
+};
+
+struct image_cache_mapping {
+	void *map;
+	size_t size;
+};
+
+static uint64_t
+image_cache_hash(const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static int
+image_cache_mkdir(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static char *
+image_cache_get_path(const char *filename)
+{
+	const char *base;
+	char *dir = NULL;
+	char *path = NULL;
+
+	base = getenv("XDG_CACHE_HOME");
+	if (base && base[0] == '/') {
+		str_printf(&dir, "%s/weston/images", base);
+	} else {
+		base = getenv("HOME");
+		if (base && base[0] == '/')
+			str_printf(&dir, "%s/.cache/weston/images", base);
+	}
+
+	if (!dir)
+		return NULL;
+
+	if (image_cache_mkdir(dir) == 0)
+		str_printf(&path, "%s/%016" PRIx64 ".img", dir,
+			   image_cache_hash(filename));
+	free(dir);
+
+	return path;
+}
+
+static bool
+image_cache_header_matches(const struct image_cache_header *header,
+			   const struct stat *st, uint32_t load_flags,
+			   size_t file_size)
+{
+	uint64_t data_size;
+
+	if (memcmp(header->magic, IMAGE_CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->mtime_sec != (int64_t) st->st_mtim.tv_sec ||
+	    header->mtime_nsec != (int64_t) st->st_mtim.tv_nsec ||
+	    header->file_size != (int64_t) st->st_size)
+		return false;
+
+	/* An entry stored without the ICC profile cannot answer for it. */
+	if ((load_flags & WESTON_IMAGE_LOAD_ICC) &&
+	    !(header->load_flags & WESTON_IMAGE_LOAD_ICC))
+		return false;
+
+	data_size = (uint64_t) header->stride * header->height;
+	if (header->data_offset % IMAGE_CACHE_ALIGN != 0 ||
+	    header->stride < header->width * 4 ||
+	    header->data_offset + data_size > file_size ||
+	    (uint64_t) header->icc_offset + header->icc_length > file_size)
+		return false;
+
+	return true;
+}
+
+static void
+image_cache_unmap(pixman_image_t *image, void *data)
+{
+	struct image_cache_mapping *mapping = data;
+
+	munmap(mapping->map, mapping->size);
+	free(mapping);
+}
+
+static struct weston_image *
+image_cache_load(const char *path, const char *filename,
+		 const struct stat *st, uint32_t load_flags)
+{
+	struct image_cache_header header;
+	struct image_cache_mapping *mapping;
+	struct weston_image *image;
+	struct stat cache_st;
+	char *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &cache_st) < 0 ||
+	    cache_st.st_size < (off_t) sizeof(header) ||
+	    pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    !image_cache_header_matches(&header, st, load_flags,
+					cache_st.st_size)) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Private, so that users drawing into the pixels never write
+	 * through to the cache. */
+	map = mmap(NULL, cache_st.st_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	/* A hash collision, keep decoding the file itself. */
+	if (sizeof(header) + header.path_length > header.data_offset ||
+	    header.path_length != strlen(filename) ||
+	    memcmp(map + sizeof(header), filename, header.path_length) != 0) {
+		munmap(map, cache_st.st_size);
+		return NULL;
+	}
+
+	image = xzalloc(sizeof(*image));
+	if (header.icc_length > 0 && (load_flags & WESTON_IMAGE_LOAD_ICC)) {
+		image->icc_profile_data =
+			icc_profile_data_create(map + header.icc_offset,
+						header.icc_length);
+		if (!image->icc_profile_data) {
+			munmap(map, cache_st.st_size);
+			free(image);
+			return NULL;
+		}
+	}
+
+	image->pixman_image =
+		pixman_image_create_bits(PIXMAN_a8r8g8b8,
+					 header.width, header.height,
+					 (uint32_t *) (map + header.data_offset),
+					 header.stride);
+	mapping = xzalloc(sizeof(*mapping));
+	mapping->map = map;
+	mapping->size = cache_st.st_size;
+	pixman_image_set_destroy_function(image->pixman_image,
+					  image_cache_unmap, mapping);
+
+	return image;
+}
+
+static bool
+image_cache_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		p += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+/* Failures are not fatal, the image is simply not cached. */
+static void
+image_cache_store(const char *path, const char *filename,
+		  const struct stat *st, uint32_t load_flags,
+		  struct weston_image *image)
+{
+	static const char zeros[IMAGE_CACHE_ALIGN];
+	struct image_cache_header header = { 0 };
+	struct icc_profile_data *icc = image->icc_profile_data;
+	void *icc_data = NULL;
+	char *tmp_path = NULL;
+	size_t data_size;
+	size_t pad;
+	bool ok;
+	int fd;
+
+	memcpy(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic));
+	header.mtime_sec = st->st_mtim.tv_sec;
+	header.mtime_nsec = st->st_mtim.tv_nsec;
+	header.file_size = st->st_size;
+	header.load_flags = load_flags;
+	header.width = pixman_image_get_width(image->pixman_image);
+	header.height = pixman_image_get_height(image->pixman_image);
+	header.stride = pixman_image_get_stride(image->pixman_image);
+	header.path_length = strlen(filename);
+	header.data_offset = ROUND_UP_N(sizeof(header) + header.path_length,
+					IMAGE_CACHE_ALIGN);
+	data_size = (size_t) header.stride * header.height;
+	header.icc_offset = header.data_offset + data_size;
+
+	if (icc) {
+		icc_data = mmap(NULL, icc->length, PROT_READ, MAP_PRIVATE,
+				icc->fd, icc->offset);
+		if (icc_data == MAP_FAILED)
+			return;
+		header.icc_length = icc->length;
+	}
+
+	str_printf(&tmp_path, "%s.XXXXXX", path);
+	if (!tmp_path)
+		goto out;
+
+	fd = mkostemp(tmp_path, O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+
+	pad = header.data_offset - sizeof(header) - header.path_length;
+	ok = image_cache_write(fd, &header, sizeof(header)) &&
+	     image_cache_write(fd, filename, header.path_length) &&
+	     image_cache_write(fd, zeros, pad) &&
+	     image_cache_write(fd,
+			       pixman_image_get_data(image->pixman_image),
+			       data_size) &&
+	     (!icc_data ||
+	      image_cache_write(fd, icc_data, header.icc_length));
+	close(fd);
+
+	if (!ok || rename(tmp_path, path) < 0)
+		unlink(tmp_path);
+
+out:
+	free(tmp_path);
+	if (icc_data)
+		munmap(icc_data, icc->length);
+}
+
 /**
  * Given a filename, loads the associated image.
  *
@@ -576,27 +927,50 @@ static const struct image_loader loaders[] = {
  * WESTON_IMAGE_LOAD_ICC is one of the given flags, the returned
  * weston_image::icc_profile_data may be NULL. But if something fails, this
  * function returns NULL.
+ *
+ * With WESTON_IMAGE_LOAD_CACHE, decoded images are kept under
+ * $XDG_CACHE_HOME/weston/images, or ~/.cache/weston/images, and mapped from
+ * there on later loads of the unchanged file, skipping decoding. This is
+ * meant for large images loaded on every start, like backgrounds.
  */
 struct weston_image *
 weston_image_load(const char *filename, uint32_t image_load_flags)
 {
 	struct weston_image *image = NULL;
 	unsigned char header[4];
+	char *cache_path = NULL;
+	struct stat st;
 	FILE *fp;
 	unsigned int i;
 
 	if (!filename || !*filename)
 		return NULL;
 
+	if ((image_load_flags & WESTON_IMAGE_LOAD_CACHE) &&
+	    (image_load_flags & WESTON_IMAGE_LOAD_IMAGE) &&
+	    stat(filename, &st) == 0) {
+		cache_path = image_cache_get_path(filename);
+		if (cache_path) {
+			image = image_cache_load(cache_path, filename, &st,
+						 image_load_flags);
+			if (image) {
+				free(cache_path);
+				return image;
+			}
+		}
+	}
+
 	fp = fopen(filename, "rb");
 	if (!fp) {
 		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		free(cache_path);
 		return NULL;
 	}
 
 	if (fread(header, sizeof header, 1, fp) != 1) {
 		fclose(fp);
 		fprintf(stderr, "%s: unable to read file header\n", filename);
+		free(cache_path);
 		return NULL;
 	}
 
@@ -618,8 +992,14 @@ weston_image_load(const char *filename, uint32_t image_load_flags)
 	} else if (!image) {
 		/* load probably printed something, but just in case */
 		fprintf(stderr, "%s: error reading image\n", filename);
+	} else if (cache_path) {
+		image_cache_store(cache_path, filename, &st,
+				  image_load_flags & ~WESTON_IMAGE_LOAD_CACHE,
+				  image);
 	}
 
+	free(cache_path);
+
 	return image;
 }
 
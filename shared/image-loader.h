@@ -31,6 +31,8 @@
 enum weston_image_load_flags {
         WESTON_IMAGE_LOAD_IMAGE = 0x1,
         WESTON_IMAGE_LOAD_ICC = 0x2,
+        /* Use the on-disk cache of decoded images */
+        WESTON_IMAGE_LOAD_CACHE = 0x4,
 };
 
 struct icc_profile_data {
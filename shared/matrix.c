@@ -55,6 +55,20 @@ weston_matrix_init(struct weston_matrix *matrix)
 	memcpy(matrix, &identity, sizeof identity);
 }
 
+/* A matrix built only from translations and scales has no elements
+ * outside of the diagonal and the last column:
+ *  0  .  . 12
+ *  .  5  . 13
+ *  .  . 10 14
+ *  .  .  . 15
+ */
+static inline bool
+matrix_is_translate_scale(const struct weston_matrix *matrix)
+{
+	return !(matrix->type & ~(WESTON_MATRIX_TRANSFORM_TRANSLATE |
+				  WESTON_MATRIX_TRANSFORM_SCALE));
+}
+
 /* m <- n * m, that is, m is multiplied on the LEFT. */
 WL_EXPORT void
 weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
@@ -63,6 +77,22 @@ weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 	const float *row, *column;
 	int i, j, k;
 
+	/* Skipping the zero elements of n gives the same sums as the
+	 * full product below. */
+	if (matrix_is_translate_scale(n)) {
+		for (i = 0; i < 4; i++) {
+			float *col = m->d + i * 4;
+			float w = col[3];
+
+			col[0] = col[0] * n->d[0] + w * n->d[12];
+			col[1] = col[1] * n->d[5] + w * n->d[13];
+			col[2] = col[2] * n->d[10] + w * n->d[14];
+			col[3] = w * n->d[15];
+		}
+		m->type |= n->type;
+		return;
+	}
+
 	for (i = 0; i < 4; i++) {
 		row = m->d + i * 4;
 		for (j = 0; j < 4; j++) {
@@ -109,7 +139,11 @@ weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 	weston_matrix_multiply(matrix, &translate);
 }
 
-/* v <- m * v */
+/* v <- m * v
+ *
+ * This does not look at matrix->type, as some users fill in the elements
+ * by hand for non-geometric purposes.
+ */
 WL_EXPORT void
 weston_matrix_transform(const struct weston_matrix *matrix,
 			struct weston_vector *v)
@@ -126,9 +160,9 @@ weston_matrix_transform(const struct weston_matrix *matrix,
 	*v = t;
 }
 
-WL_EXPORT struct weston_coord
-weston_matrix_transform_coord(const struct weston_matrix *matrix,
-			      struct weston_coord c)
+static struct weston_coord
+matrix_transform_coord_full(const struct weston_matrix *matrix,
+			    struct weston_coord c)
 {
 	struct weston_coord out;
 	struct weston_vector t = { { c.x, c.y, 0.0, 1.0 } };
@@ -142,6 +176,57 @@ weston_matrix_transform_coord(const struct weston_matrix *matrix,
 	return out;
 }
 
+/* Same float arithmetic as matrix_transform_coord_full() for a matrix of
+ * only translations and scales, where w stays 1. */
+static inline struct weston_coord
+matrix_transform_coord_translate_scale(const struct weston_matrix *matrix,
+				       struct weston_coord c)
+{
+	struct weston_coord out;
+	float x = c.x;
+	float y = c.y;
+
+	out.x = x * matrix->d[0] + matrix->d[12];
+	out.y = y * matrix->d[5] + matrix->d[13];
+	return out;
+}
+
+WL_EXPORT struct weston_coord
+weston_matrix_transform_coord(const struct weston_matrix *matrix,
+			      struct weston_coord c)
+{
+	if (matrix_is_translate_scale(matrix))
+		return matrix_transform_coord_translate_scale(matrix, c);
+
+	return matrix_transform_coord_full(matrix, c);
+}
+
+/** Transform an array of coordinates in place
+ *
+ * \param matrix The matrix to apply.
+ * \param coords The coordinates to transform.
+ * \param count The number of elements in coords.
+ *
+ * Equivalent to calling weston_matrix_transform_coord() on each element,
+ * but picks the code path for the matrix type only once.
+ */
+WL_EXPORT void
+weston_matrix_transform_coords(const struct weston_matrix *matrix,
+			       struct weston_coord *coords, size_t count)
+{
+	size_t i;
+
+	if (matrix_is_translate_scale(matrix)) {
+		for (i = 0; i < count; i++)
+			coords[i] = matrix_transform_coord_translate_scale(matrix,
+									   coords[i]);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		coords[i] = matrix_transform_coord_full(matrix, coords[i]);
+}
+
 static inline void
 swap_rows(double *a, double *b)
 {
@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PIXEL_ROW_H
+#define WESTON_PIXEL_ROW_H
+
+/* Per-row conversions of 32 bpp pixels, vectorized where the target
+ * allows it at compile time, with a scalar tail. */
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PIXEL_ROW_NEON
+#include <arm_neon.h>
+#endif
+
+/** Copy n pixels, swapping the bytes 0 and 2 of each (ARGB <-> ABGR) */
+static inline void
+pixel_row_copy_swap_rb(uint32_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i lo = _mm_set1_epi32(0x000000ff);
+	const __m128i hi = _mm_set1_epi32(0x00ff0000);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i t = _mm_and_si128(v, ga);
+
+		t = _mm_or_si128(t, _mm_and_si128(_mm_srli_epi32(v, 16), lo));
+		t = _mm_or_si128(t, _mm_and_si128(_mm_slli_epi32(v, 16), hi));
+		_mm_storeu_si128((__m128i *) (dst + i), t);
+	}
+#elif defined(PIXEL_ROW_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x4_t v = vld4q_u8((const uint8_t *) (src + i));
+		uint8x16_t t = v.val[0];
+
+		v.val[0] = v.val[2];
+		v.val[2] = t;
+		vst4q_u8((uint8_t *) (dst + i), v);
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint32_t v = src[i];
+
+		dst[i] = (v & 0xff00ff00) |
+			 ((v >> 16) & 0x000000ff) |
+			 ((v << 16) & 0x00ff0000);
+	}
+}
+
+/** Per-channel difference of the low three bytes, modulo 256, top byte 0 */
+static inline void
+pixel_row_delta_rgb(uint32_t *delta, const uint32_t *next,
+		    const uint32_t *prev, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi32(0x00ffffff);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (next + i));
+		__m128i b = _mm_loadu_si128((const __m128i *) (prev + i));
+
+		_mm_storeu_si128((__m128i *) (delta + i),
+				 _mm_and_si128(_mm_sub_epi8(a, b), mask));
+	}
+#elif defined(PIXEL_ROW_NEON)
+	const uint32x4_t mask = vdupq_n_u32(0x00ffffff);
+
+	for (; i + 4 <= n; i += 4) {
+		uint8x16_t a = vld1q_u8((const uint8_t *) (next + i));
+		uint8x16_t b = vld1q_u8((const uint8_t *) (prev + i));
+		uint32x4_t d = vreinterpretq_u32_u8(vsubq_u8(a, b));
+
+		vst1q_u32(delta + i, vandq_u32(d, mask));
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint32_t a = next[i], b = prev[i];
+		uint8_t dr = (a >> 16) - (b >> 16);
+		uint8_t dg = (a >>  8) - (b >>  8);
+		uint8_t db = (a >>  0) - (b >>  0);
+
+		delta[i] = (dr << 16) | (dg << 8) | (db << 0);
+	}
+}
+
+#endif /* WESTON_PIXEL_ROW_H */
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_util.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+
+void
+bench_add_sample(struct bench *bench, int64_t value)
+{
+	assert(bench->n_samples < BENCH_SAMPLES);
+	bench->samples[bench->n_samples++] = value;
+}
+
+int64_t
+bench_now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_nsec(&ts);
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+	int64_t va = *(const int64_t *)a;
+	int64_t vb = *(const int64_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+/** Sort the samples and start writing them as a JSON object
+ *
+ * \param label Names the output file and the log line, e.g. the fixture.
+ * \return The file to add benchmark specific fields to, each ending with
+ * ",\n", or NULL if it could not be opened. Pass it to bench_report_close()
+ * in any case.
+ */
+FILE *
+bench_report_open(struct bench *bench, const char *label)
+{
+	int64_t *s = bench->samples;
+	int n = bench->n_samples;
+	char *fname;
+	FILE *fp;
+
+	assert(n > 0);
+	qsort(s, n, sizeof(*s), compare_int64);
+
+	testlog("%s (%s, N=%u): min %" PRId64 ", median %" PRId64
+		", max %" PRId64 " %s\n", bench->name, label,
+		bench->count, s[0], s[n / 2], s[n - 1], bench->unit);
+
+	fname = output_filename_for_test_case(label, 0, "json");
+	fp = fopen(fname, "w");
+	if (!fp) {
+		testlog("Error: failed to open '%s' for writing: %s\n",
+			fname, strerror(errno));
+		free(fname);
+		return NULL;
+	}
+	free(fname);
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"benchmark\": \"%s\",\n", bench->name);
+	fprintf(fp, "\t\"count\": %u,\n", bench->count);
+	fprintf(fp, "\t\"unit\": \"%s\",\n", bench->unit);
+	fprintf(fp, "\t\"min\": %" PRId64 ",\n", s[0]);
+	fprintf(fp, "\t\"median\": %" PRId64 ",\n", s[n / 2]);
+	fprintf(fp, "\t\"max\": %" PRId64 ",\n", s[n - 1]);
+
+	return fp;
+}
+
+/** Write the samples and finish the JSON object */
+void
+bench_report_close(struct bench *bench, FILE *fp)
+{
+	int i;
+
+	if (!fp)
+		return;
+
+	fprintf(fp, "\t\"samples\": [");
+	for (i = 0; i < bench->n_samples; i++)
+		fprintf(fp, "%s%" PRId64, i ? ", " : "", bench->samples[i]);
+	fprintf(fp, "]\n}\n");
+
+	fclose(fp);
+}
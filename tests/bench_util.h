@@ -1,5 +1,5 @@
 /*
- * Copyright © 2013 Intel Corporation
+ * Copyright 2026 Collabora, Ltd.
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -23,16 +23,31 @@
  * SOFTWARE.
  */
 
-#ifndef _VAAPI_RECORDER_H_
-#define _VAAPI_RECORDER_H_
+#pragma once
 
-struct vaapi_recorder;
+#include <stdint.h>
+#include <stdio.h>
+
+/* Samples kept per benchmark, after BENCH_WARMUP discarded iterations. */
+#define BENCH_WARMUP 5
+#define BENCH_SAMPLES 50
+
+struct bench {
+	const char *name;
+	const char *unit;
+	unsigned int count;
+	int64_t samples[BENCH_SAMPLES];
+	int n_samples;
+};
 
-struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
 void
-vaapi_recorder_destroy(struct vaapi_recorder *r);
-int
-vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+bench_add_sample(struct bench *bench, int64_t value);
+
+int64_t
+bench_now_nsec(void);
 
-#endif /* _VAAPI_RECORDER_H_ */
+FILE *
+bench_report_open(struct bench *bench, const char *label);
+
+void
+bench_report_close(struct bench *bench, FILE *fp);
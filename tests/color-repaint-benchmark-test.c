@@ -0,0 +1,234 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Color pipeline repaint micro-benchmark
+ *
+ * Run with 'meson test --benchmark' like compositor-benchmark. An sRGB
+ * surface covering the whole output is repainted by the GL renderer on the
+ * headless backend, with output ICC profiles that need different color
+ * pipelines, and without color management as the baseline. The difference
+ * to the baseline is what the pipelines cost per pixel. The pipelines
+ * themselves are listed by color-transform-benchmark.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <lcms2.h>
+
+#include "bench_util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "lcms_util.h"
+
+#define BENCH_OUTPUT_WIDTH 1280
+#define BENCH_OUTPUT_HEIGHT 720
+
+enum profile_type {
+	PTYPE_NONE,
+	PTYPE_MATRIX_SHAPER,
+	PTYPE_CLUT,
+};
+
+static const struct lcms_pipeline pipeline_sRGB = {
+	.color_space = "sRGB",
+	.prim_output = {
+		.Red =   { 0.640, 0.330, 1.0 },
+		.Green = { 0.300, 0.600, 1.0 },
+		.Blue =  { 0.150, 0.060, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3(1.0, 0.0, 0.0,
+			0.0, 1.0, 0.0,
+			0.0, 0.0, 1.0),
+	.post_fn = TRANSFER_FN_SRGB_EOTF_INVERSE
+};
+
+static const struct lcms_pipeline pipeline_adobeRGB = {
+	.color_space = "adobeRGB",
+	.prim_output = {
+		.Red =   { 0.640, 0.330, 1.0 },
+		.Green = { 0.210, 0.710, 1.0 },
+		.Blue =  { 0.150, 0.060, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3( 0.715127, 0.284868, 0.000005,
+			 0.000001, 0.999995, 0.000004,
+			-0.000003, 0.041155, 0.958848),
+	.post_fn = TRANSFER_FN_ADOBE_RGB_EOTF_INVERSE
+};
+
+static const struct lcms_pipeline pipeline_BT2020 = {
+	.color_space = "bt2020",
+	.prim_output = {
+		.Red =   { 0.708, 0.292, 1.0 },
+		.Green = { 0.170, 0.797, 1.0 },
+		.Blue =  { 0.131, 0.046, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3(0.627402, 0.329292, 0.043306,
+			0.069095, 0.919544, 0.011360,
+			0.016394, 0.088028, 0.895578),
+	.post_fn = TRANSFER_FN_POWER2_4_EOTF_INVERSE,
+};
+
+static const double no_vcgt[COLOR_CHAN_NUM] = { 0.0, 0.0, 0.0 };
+
+struct setup_args {
+	struct fixture_metadata meta;
+	/* For file names */
+	const char *tag;
+	bool color_management;
+	const struct lcms_pipeline *pipeline;
+	enum profile_type type;
+	int dim_size;
+	float clut_roundtrip_tolerance;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ { "no CM" },         "none",          false },
+	{ { "stock sRGB" },    "stock-srgb",    true },
+	{ { "sRGB MAT" },      "srgb-mat",      true, &pipeline_sRGB,     PTYPE_MATRIX_SHAPER },
+	{ { "adobeRGB MAT" },  "adobergb-mat",  true, &pipeline_adobeRGB, PTYPE_MATRIX_SHAPER },
+	{ { "BT2020 MAT" },    "bt2020-mat",    true, &pipeline_BT2020,   PTYPE_MATRIX_SHAPER },
+	{ { "sRGB CLUT" },     "srgb-clut",     true, &pipeline_sRGB,     PTYPE_CLUT, 17, 0.0005 },
+	{ { "adobeRGB CLUT" }, "adobergb-clut", true, &pipeline_adobeRGB, PTYPE_CLUT, 17, 0.0065 },
+};
+
+static cmsHPROFILE
+build_lcms_profile_output(const struct setup_args *arg)
+{
+	switch (arg->type) {
+	case PTYPE_NONE:
+		break;
+	case PTYPE_MATRIX_SHAPER:
+		return build_lcms_matrix_shaper_profile_output(NULL,
+							       arg->pipeline,
+							       no_vcgt);
+	case PTYPE_CLUT:
+		return build_lcms_clut_profile_output(NULL, arg->pipeline,
+						      no_vcgt, arg->dim_size,
+						      arg->clut_roundtrip_tolerance);
+	}
+
+	return NULL;
+}
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+	cmsHPROFILE profile;
+	char *file_name;
+	bool saved;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_GL;
+	setup.backend = WESTON_BACKEND_HEADLESS;
+	setup.width = BENCH_OUTPUT_WIDTH;
+	setup.height = BENCH_OUTPUT_HEIGHT;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	if (arg->type == PTYPE_NONE) {
+		weston_ini_setup(&setup,
+			cfgln("[core]"),
+			cfgln("color-management=%s",
+			      arg->color_management ? "true" : "false"));
+
+		return weston_test_harness_execute_as_client(harness, &setup);
+	}
+
+	file_name = output_filename_for_fixture(THIS_TEST_NAME, harness,
+						arg->meta.name, "icm");
+	profile = build_lcms_profile_output(arg);
+	assert(profile);
+	saved = cmsSaveProfileToFile(profile, file_name);
+	assert(saved);
+	cmsCloseProfile(profile);
+
+	weston_ini_setup(&setup,
+		cfgln("[core]"),
+		cfgln("color-management=true"),
+		cfgln("[output]"),
+		cfgln("name=headless"),
+		cfgln("icc_profile=%s", file_name));
+
+	free(file_name);
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+/* Repaint cost of the whole output, scaled to one million pixels. */
+TEST(bench_color_repaint)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	const int64_t pixels = BENCH_OUTPUT_WIDTH * BENCH_OUTPUT_HEIGHT;
+	struct bench bench = {
+		.name = "color_repaint",
+		.unit = "ns/Mpx",
+		.count = 1,
+	};
+	struct client *client;
+	struct surface *surface;
+	int64_t begin;
+	FILE *fp;
+	int iter;
+	int done;
+
+	client = create_client_and_test_surface(0, 0, BENCH_OUTPUT_WIDTH,
+						BENCH_OUTPUT_HEIGHT);
+	surface = client->surface;
+
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		begin = bench_now_nsec();
+		wl_surface_attach(surface->wl_surface, surface->buffer->proxy,
+				  0, 0);
+		wl_surface_damage_buffer(surface->wl_surface, 0, 0,
+					 BENCH_OUTPUT_WIDTH,
+					 BENCH_OUTPUT_HEIGHT);
+		frame_callback_set(surface->wl_surface, &done);
+		wl_surface_commit(surface->wl_surface);
+		frame_callback_wait(client, &done);
+
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench, (bench_now_nsec() - begin) *
+						 1000000 / pixels);
+	}
+
+	fp = bench_report_open(&bench, arg->tag);
+	if (fp) {
+		fprintf(fp, "\t\"output_profile\": \"%s\",\n", arg->meta.name);
+		fprintf(fp, "\t\"output\": [%d, %d],\n",
+			BENCH_OUTPUT_WIDTH, BENCH_OUTPUT_HEIGHT);
+	}
+	bench_report_close(&bench, fp);
+
+	client_destroy(client);
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Color transformation micro-benchmarks
+ *
+ * Run with 'meson test --benchmark' like compositor-benchmark. The fixtures
+ * are output ICC profiles; for each, transformations from a set of client
+ * ICC profiles are created through the color manager, as for a surface
+ * being mapped, and destroyed again. The creation time is sampled, and the
+ * resulting pipeline is recorded: its stage count and the steps, which
+ * select the GL renderer shader variant. The GPU cost of the pipelines is
+ * measured by color-repaint-benchmark.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lcms2.h>
+
+#include "bench_util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "lcms_util.h"
+#include "color.h"
+#include "color-properties.h"
+#include "shared/string-helpers.h"
+#include "shared/xalloc.h"
+
+enum profile_type {
+	PTYPE_MATRIX_SHAPER,
+	PTYPE_CLUT,
+};
+
+static const struct lcms_pipeline pipeline_sRGB = {
+	.color_space = "sRGB",
+	.prim_output = {
+		.Red =   { 0.640, 0.330, 1.0 },
+		.Green = { 0.300, 0.600, 1.0 },
+		.Blue =  { 0.150, 0.060, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3(1.0, 0.0, 0.0,
+			0.0, 1.0, 0.0,
+			0.0, 0.0, 1.0),
+	.post_fn = TRANSFER_FN_SRGB_EOTF_INVERSE
+};
+
+static const struct lcms_pipeline pipeline_adobeRGB = {
+	.color_space = "adobeRGB",
+	.prim_output = {
+		.Red =   { 0.640, 0.330, 1.0 },
+		.Green = { 0.210, 0.710, 1.0 },
+		.Blue =  { 0.150, 0.060, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3( 0.715127, 0.284868, 0.000005,
+			 0.000001, 0.999995, 0.000004,
+			-0.000003, 0.041155, 0.958848),
+	.post_fn = TRANSFER_FN_ADOBE_RGB_EOTF_INVERSE
+};
+
+static const struct lcms_pipeline pipeline_BT2020 = {
+	.color_space = "bt2020",
+	.prim_output = {
+		.Red =   { 0.708, 0.292, 1.0 },
+		.Green = { 0.170, 0.797, 1.0 },
+		.Blue =  { 0.131, 0.046, 1.0 }
+	},
+	.pre_fn = TRANSFER_FN_SRGB_EOTF,
+	.mat = LCMSMAT3(0.627402, 0.329292, 0.043306,
+			0.069095, 0.919544, 0.011360,
+			0.016394, 0.088028, 0.895578),
+	.post_fn = TRANSFER_FN_POWER2_4_EOTF_INVERSE,
+};
+
+/* Client profiles, all matrix-shaper like most real ones. */
+static const struct lcms_pipeline *source_pipelines[] = {
+	&pipeline_sRGB,
+	&pipeline_adobeRGB,
+	&pipeline_BT2020,
+};
+
+static const double no_vcgt[COLOR_CHAN_NUM] = { 0.0, 0.0, 0.0 };
+
+struct setup_args {
+	struct fixture_metadata meta;
+	/* For file names */
+	const char *tag;
+	const struct lcms_pipeline *pipeline;
+	enum profile_type type;
+	int dim_size;
+	float clut_roundtrip_tolerance;
+};
+
+/* BT.2020 does not fit a cLUT profile, see color-icc-output-test. */
+static const struct setup_args my_setup_args[] = {
+	{ { "sRGB MAT" },      "srgb-mat",      &pipeline_sRGB,     PTYPE_MATRIX_SHAPER },
+	{ { "adobeRGB MAT" },  "adobergb-mat",  &pipeline_adobeRGB, PTYPE_MATRIX_SHAPER },
+	{ { "BT2020 MAT" },    "bt2020-mat",    &pipeline_BT2020,   PTYPE_MATRIX_SHAPER },
+	{ { "sRGB CLUT" },     "srgb-clut",     &pipeline_sRGB,     PTYPE_CLUT, 17, 0.0005 },
+	{ { "adobeRGB CLUT" }, "adobergb-clut", &pipeline_adobeRGB, PTYPE_CLUT, 17, 0.0065 },
+};
+
+static cmsHPROFILE
+build_lcms_profile_output(const struct setup_args *arg)
+{
+	switch (arg->type) {
+	case PTYPE_MATRIX_SHAPER:
+		return build_lcms_matrix_shaper_profile_output(NULL,
+							       arg->pipeline,
+							       no_vcgt);
+	case PTYPE_CLUT:
+		return build_lcms_clut_profile_output(NULL, arg->pipeline,
+						      no_vcgt, arg->dim_size,
+						      arg->clut_roundtrip_tolerance);
+	}
+
+	return NULL;
+}
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+	cmsHPROFILE profile;
+	char *file_name;
+	bool saved;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_GL;
+	setup.backend = WESTON_BACKEND_HEADLESS;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	file_name = output_filename_for_fixture(THIS_TEST_NAME, harness,
+						arg->meta.name, "icm");
+	profile = build_lcms_profile_output(arg);
+	assert(profile);
+	saved = cmsSaveProfileToFile(profile, file_name);
+	assert(saved);
+	cmsCloseProfile(profile);
+
+	weston_ini_setup(&setup,
+		cfgln("[core]"),
+		cfgln("color-management=true"),
+		cfgln("[output]"),
+		cfgln("name=headless"),
+		cfgln("icc_profile=%s", file_name));
+
+	free(file_name);
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+static struct weston_color_profile *
+create_source_profile(struct weston_compositor *compositor,
+		      const struct lcms_pipeline *pipeline)
+{
+	struct weston_color_manager *cm = compositor->color_manager;
+	struct weston_color_profile *cprof = NULL;
+	cmsHPROFILE profile;
+	cmsUInt32Number len = 0;
+	char *errmsg = NULL;
+	void *data;
+	bool ok;
+
+	profile = build_lcms_matrix_shaper_profile_output(NULL, pipeline,
+							  no_vcgt);
+	assert(profile);
+	ok = cmsSaveProfileToMem(profile, NULL, &len);
+	assert(ok && len > 0);
+	data = xzalloc(len);
+	ok = cmsSaveProfileToMem(profile, data, &len);
+	assert(ok);
+	cmsCloseProfile(profile);
+
+	ok = cm->get_color_profile_from_icc(cm, data, len, pipeline->color_space,
+					    &cprof, &errmsg);
+	if (!ok)
+		testlog("Error: %s\n", errmsg);
+	assert(ok);
+	free(data);
+
+	return cprof;
+}
+
+static int
+count_stages(const struct weston_color_transform *xform)
+{
+	int n = 0;
+
+	if (!xform)
+		return 0;
+
+	if (xform->pre_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY)
+		n++;
+	if (xform->mapping.type != WESTON_COLOR_MAPPING_TYPE_IDENTITY)
+		n++;
+	if (xform->post_curve.type != WESTON_COLOR_CURVE_TYPE_IDENTITY)
+		n++;
+
+	return n;
+}
+
+/* Creation of the surface to blending space transformation, the one the
+ * renderer uses for every client surface. Nothing is cached in between,
+ * each sample creates a new transformation from scratch. */
+PLUGIN_TEST(bench_transform_create)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct weston_color_manager *cm = compositor->color_manager;
+	const struct weston_render_intent_info *intent;
+	struct weston_output *output;
+	unsigned int i;
+
+	intent = weston_render_intent_info_from(compositor,
+						WESTON_RENDER_INTENT_PERCEPTUAL);
+	output = wl_container_of(compositor->output_list.next, output, link);
+
+	for (i = 0; i < ARRAY_LENGTH(source_pipelines); i++) {
+		struct bench bench = {
+			.name = "transform_create",
+			.unit = "ns",
+			.count = 1,
+		};
+		struct weston_surface_color_transform surf_xform = {};
+		struct weston_color_profile *cprof;
+		struct weston_surface *surface;
+		char *pipeline = NULL;
+		char *label;
+		int stages = 0;
+		int64_t begin;
+		FILE *fp;
+		int iter;
+
+		cprof = create_source_profile(compositor, source_pipelines[i]);
+		surface = weston_surface_create(compositor);
+		assert(surface);
+		weston_surface_set_color_profile(surface, cprof, intent);
+
+		for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+			bool ok;
+
+			begin = bench_now_nsec();
+			ok = cm->get_surface_color_transform(cm, surface, output,
+							     &surf_xform);
+			if (iter >= BENCH_WARMUP)
+				bench_add_sample(&bench, bench_now_nsec() - begin);
+			assert(ok);
+			assert(!surf_xform.provisional);
+
+			if (iter == 0) {
+				stages = count_stages(surf_xform.transform);
+				pipeline = surf_xform.transform ?
+					weston_color_transform_string(surf_xform.transform) :
+					strdup("pipeline: identity\n");
+				/* Drop the newline */
+				pipeline[strlen(pipeline) - 1] = '\0';
+			}
+
+			weston_color_transform_unref(surf_xform.transform);
+			surf_xform.transform = NULL;
+		}
+
+		str_printf(&label, "%s-from-%s", arg->tag,
+			   source_pipelines[i]->color_space);
+		assert(label);
+		testlog("%s: %d stages, %s\n", label, stages, pipeline);
+
+		fp = bench_report_open(&bench, label);
+		if (fp) {
+			fprintf(fp, "\t\"output_profile\": \"%s\",\n",
+				arg->meta.name);
+			fprintf(fp, "\t\"source_profile\": \"%s\",\n",
+				source_pipelines[i]->color_space);
+			fprintf(fp, "\t\"stages\": %d,\n", stages);
+			fprintf(fp, "\t\"pipeline\": \"%s\",\n", pipeline);
+		}
+		bench_report_close(&bench, fp);
+
+		free(label);
+		free(pipeline);
+		weston_surface_unref(surface);
+		weston_color_profile_unref(cprof);
+	}
+}
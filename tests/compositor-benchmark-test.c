@@ -0,0 +1,367 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compositor micro-benchmarks
+ *
+ * These are not correctness tests and are not part of the regular test
+ * suite; run them with 'meson test --benchmark'. Every benchmark drives the
+ * headless backend with a fixed scene, discards a few warm-up iterations
+ * and reports the minimum, median and maximum of a fixed number of samples,
+ * which is far less noisy than the mean. Results are written as JSON, one
+ * file per benchmark and fixture, to WESTON_TEST_OUTPUT_PATH (or the current
+ * directory), for tracking across releases.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench_util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+#define BENCH_OUTPUT_WIDTH 640
+#define BENCH_OUTPUT_HEIGHT 480
+
+/* Scene size: N surfaces, N subsurfaces, N damage rectangles. */
+#define BENCH_N 64
+#define BENCH_SURFACE_SIZE 48
+#define BENCH_GRID_STEP 56
+#define BENCH_GRID_COLUMNS 8
+
+#define BENCH_COMMITS_PER_SAMPLE 100
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum weston_renderer_type renderer;
+	const char *renderer_name;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.renderer = WESTON_RENDERER_PIXMAN,
+		.renderer_name = "pixman",
+		.meta.name = "pixman"
+	},
+	{
+		.renderer = WESTON_RENDERER_GL,
+		.renderer_name = "gl",
+		.meta.name = "GL"
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.width = BENCH_OUTPUT_WIDTH;
+	setup.height = BENCH_OUTPUT_HEIGHT;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+/* Write the samples as JSON, along with the scene they were taken in. */
+static void
+bench_report(struct bench *bench)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	FILE *fp;
+
+	fp = bench_report_open(bench, arg->renderer_name);
+	if (fp) {
+		fprintf(fp, "\t\"renderer\": \"%s\",\n", arg->renderer_name);
+		fprintf(fp, "\t\"output\": [%d, %d],\n",
+			BENCH_OUTPUT_WIDTH, BENCH_OUTPUT_HEIGHT);
+	}
+	bench_report_close(bench, fp);
+}
+
+static struct wl_subcompositor *
+get_subcompositor(struct client *client)
+{
+	struct global *g;
+	struct wl_subcompositor *sub = NULL;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "wl_subcompositor") == 0) {
+			sub = wl_registry_bind(client->wl_registry, g->name,
+					       &wl_subcompositor_interface, 1);
+			break;
+		}
+	}
+
+	assert(sub && "no wl_subcompositor found");
+	return sub;
+}
+
+/* Map a surface of the benchmark grid at the given index. */
+static struct surface *
+create_grid_surface(struct client *client, unsigned int index)
+{
+	struct surface *surface;
+
+	surface = create_test_surface(client);
+	surface->width = BENCH_SURFACE_SIZE;
+	surface->height = BENCH_SURFACE_SIZE;
+	surface->x = (index % BENCH_GRID_COLUMNS) * BENCH_GRID_STEP;
+	surface->y = (index / BENCH_GRID_COLUMNS) * BENCH_GRID_STEP;
+	surface->buffer = create_shm_buffer_a8r8g8b8(client, surface->width,
+						     surface->height);
+
+	weston_test_move_surface(client->test->weston_test,
+				 surface->wl_surface, surface->x, surface->y);
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage_buffer(surface->wl_surface, 0, 0,
+				 surface->width, surface->height);
+	wl_surface_commit(surface->wl_surface);
+
+	return surface;
+}
+
+/* Repaint time: N surfaces all damaged at once, until the frame is done. */
+TEST(bench_repaint)
+{
+	struct bench bench = { .name = "repaint", .unit = "ns", .count = BENCH_N };
+	struct client *client;
+	struct surface *surfaces[BENCH_N];
+	int64_t begin;
+	unsigned int i;
+	int iter;
+	int done;
+
+	client = create_client();
+	for (i = 0; i < BENCH_N; i++)
+		surfaces[i] = create_grid_surface(client, i);
+	client_roundtrip(client);
+
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		begin = bench_now_nsec();
+		for (i = 0; i < BENCH_N; i++) {
+			wl_surface_attach(surfaces[i]->wl_surface,
+					  surfaces[i]->buffer->proxy, 0, 0);
+			wl_surface_damage_buffer(surfaces[i]->wl_surface, 0, 0,
+						 BENCH_SURFACE_SIZE,
+						 BENCH_SURFACE_SIZE);
+			if (i == BENCH_N - 1)
+				frame_callback_set(surfaces[i]->wl_surface, &done);
+			wl_surface_commit(surfaces[i]->wl_surface);
+		}
+		frame_callback_wait(client, &done);
+
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench, bench_now_nsec() - begin);
+	}
+
+	bench_report(&bench);
+
+	for (i = 0; i < BENCH_N; i++)
+		surface_destroy(surfaces[i]);
+	client_destroy(client);
+}
+
+/* Commit throughput: back-to-back commits of one surface, no repaint wait. */
+TEST(bench_commit_throughput)
+{
+	struct bench bench = {
+		.name = "commit_throughput",
+		.unit = "ns/commit",
+		.count = BENCH_COMMITS_PER_SAMPLE
+	};
+	struct client *client;
+	struct surface *surface;
+	int64_t begin;
+	int iter, i;
+
+	client = create_client_and_test_surface(0, 0, BENCH_SURFACE_SIZE,
+						BENCH_SURFACE_SIZE);
+	surface = client->surface;
+
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		begin = bench_now_nsec();
+		for (i = 0; i < BENCH_COMMITS_PER_SAMPLE; i++) {
+			wl_surface_attach(surface->wl_surface,
+					  surface->buffer->proxy, 0, 0);
+			wl_surface_damage_buffer(surface->wl_surface, 0, 0,
+						 surface->width,
+						 surface->height);
+			wl_surface_commit(surface->wl_surface);
+		}
+		client_roundtrip(client);
+
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench, (bench_now_nsec() - begin) /
+						 BENCH_COMMITS_PER_SAMPLE);
+	}
+
+	bench_report(&bench);
+	client_destroy(client);
+}
+
+/* Subsurface commit: a parent with N synchronized subsurfaces, each with
+ * pending content, applied and repainted by one parent commit. */
+TEST(bench_subsurfaces)
+{
+	struct bench bench = { .name = "subsurfaces", .unit = "ns", .count = BENCH_N };
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct wl_surface *surfs[BENCH_N];
+	struct wl_subsurface *subs[BENCH_N];
+	struct buffer *buf;
+	unsigned int i;
+	int64_t begin;
+	int iter;
+	int done;
+
+	client = create_client_and_test_surface(0, 0, BENCH_OUTPUT_WIDTH,
+						BENCH_OUTPUT_HEIGHT);
+	subco = get_subcompositor(client);
+	buf = create_shm_buffer_a8r8g8b8(client, BENCH_SURFACE_SIZE,
+					 BENCH_SURFACE_SIZE);
+
+	for (i = 0; i < BENCH_N; i++) {
+		surfs[i] = wl_compositor_create_surface(client->wl_compositor);
+		subs[i] = wl_subcompositor_get_subsurface(subco, surfs[i],
+							  client->surface->wl_surface);
+		wl_subsurface_set_position(subs[i],
+					   (i % BENCH_GRID_COLUMNS) * BENCH_GRID_STEP,
+					   (i / BENCH_GRID_COLUMNS) * BENCH_GRID_STEP);
+	}
+
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		begin = bench_now_nsec();
+		for (i = 0; i < BENCH_N; i++) {
+			wl_surface_attach(surfs[i], buf->proxy, 0, 0);
+			wl_surface_damage_buffer(surfs[i], 0, 0,
+						 BENCH_SURFACE_SIZE,
+						 BENCH_SURFACE_SIZE);
+			wl_surface_commit(surfs[i]);
+		}
+		frame_callback_set(client->surface->wl_surface, &done);
+		wl_surface_commit(client->surface->wl_surface);
+		frame_callback_wait(client, &done);
+
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench, bench_now_nsec() - begin);
+	}
+
+	bench_report(&bench);
+
+	for (i = 0; i < BENCH_N; i++) {
+		wl_subsurface_destroy(subs[i]);
+		wl_surface_destroy(surfs[i]);
+	}
+	buffer_destroy(buf);
+	wl_subcompositor_destroy(subco);
+	client_destroy(client);
+}
+
+/* Damage accumulation: N disjoint damage rectangles on one surface. */
+TEST(bench_damage_rects)
+{
+	struct bench bench = { .name = "damage_rects", .unit = "ns", .count = BENCH_N };
+	struct client *client;
+	struct surface *surface;
+	int64_t begin;
+	unsigned int i;
+	int iter;
+	int done;
+
+	client = create_client_and_test_surface(0, 0, BENCH_OUTPUT_WIDTH,
+						BENCH_OUTPUT_HEIGHT);
+	surface = client->surface;
+
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		begin = bench_now_nsec();
+		wl_surface_attach(surface->wl_surface, surface->buffer->proxy,
+				  0, 0);
+		for (i = 0; i < BENCH_N; i++)
+			wl_surface_damage_buffer(surface->wl_surface,
+						 (i % BENCH_GRID_COLUMNS) * BENCH_GRID_STEP,
+						 (i / BENCH_GRID_COLUMNS) * BENCH_GRID_STEP,
+						 BENCH_SURFACE_SIZE / 2,
+						 BENCH_SURFACE_SIZE / 2);
+		frame_callback_set(surface->wl_surface, &done);
+		wl_surface_commit(surface->wl_surface);
+		frame_callback_wait(client, &done);
+
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench, bench_now_nsec() - begin);
+	}
+
+	bench_report(&bench);
+	client_destroy(client);
+}
+
+/* Picking: move the pointer over a stack of N surfaces. The round trip of
+ * an empty request is measured alongside and subtracted, so what remains is
+ * mostly the view picking and focus update work. */
+TEST(bench_pick_view)
+{
+	struct bench bench = { .name = "pick_view", .unit = "ns", .count = BENCH_N };
+	struct client *client;
+	struct surface *surfaces[BENCH_N];
+	int64_t begin, roundtrip, move;
+	unsigned int i;
+	int iter;
+
+	client = create_client();
+	for (i = 0; i < BENCH_N; i++)
+		surfaces[i] = create_grid_surface(client, i);
+	client_roundtrip(client);
+
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		begin = bench_now_nsec();
+		client_roundtrip(client);
+		roundtrip = bench_now_nsec() - begin;
+
+		/* Alternate between the last and first surface of the grid,
+		 * so each move changes focus. */
+		i = (iter % 2) ? 0 : BENCH_N - 1;
+		begin = bench_now_nsec();
+		weston_test_move_pointer(client->test->weston_test, 0, 0, 0,
+					 surfaces[i]->x + BENCH_SURFACE_SIZE / 2,
+					 surfaces[i]->y + BENCH_SURFACE_SIZE / 2);
+		client_roundtrip(client);
+		move = bench_now_nsec() - begin;
+
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench, move > roundtrip ?
+					 move - roundtrip : 0);
+	}
+
+	bench_report(&bench);
+
+	for (i = 0; i < BENCH_N; i++)
+		surface_destroy(surfaces[i]);
+	client_destroy(client);
+}
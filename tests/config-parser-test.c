@@ -831,3 +831,91 @@ ZUC_TEST(config_test, section_from_null)
 	section = weston_config_get_section(NULL, "bucket", NULL, NULL);
 	ZUC_ASSERT_NULL(section);
 }
+
+ZUC_TEST(config_test, first_duplicate_key_wins)
+{
+	struct weston_config *config;
+	struct weston_config_section *section;
+	char *str;
+	int r;
+
+	config = load_config("[bucket]\n"
+			     "color=blue\n"
+			     "color=red\n"
+			     "[bucket]\n"
+			     "color=green\n"
+			     "material=plastic\n");
+	ZUC_ASSERT_NOT_NULL(config);
+
+	section = weston_config_get_section(config, "bucket", NULL, NULL);
+	r = weston_config_section_get_string(section, "color", &str, NULL);
+	ZUC_ASSERTG_EQ(0, r, out);
+	ZUC_ASSERTG_STREQ("blue", str, out_free);
+	free(str);
+
+	section = weston_config_get_section(config, "bucket", "color", "green");
+	r = weston_config_section_get_string(section, "material", &str, NULL);
+	ZUC_ASSERTG_EQ(0, r, out);
+	ZUC_ASSERTG_STREQ("plastic", str, out_free);
+
+out_free:
+	free(str);
+out:
+	weston_config_destroy(config);
+}
+
+ZUC_TEST(config_test, long_line)
+{
+	struct weston_config *config;
+	struct weston_config_section *section;
+	char text[2048];
+	char value[1500];
+	char *str = NULL;
+	int r;
+
+	memset(value, 'x', sizeof value - 1);
+	value[sizeof value - 1] = '\0';
+	snprintf(text, sizeof text, "[long]\nvalue=%s\nnext=1\n", value);
+
+	config = load_config(text);
+	ZUC_ASSERT_NOT_NULL(config);
+
+	section = weston_config_get_section(config, "long", NULL, NULL);
+	r = weston_config_section_get_string(section, "value", &str, NULL);
+	ZUC_ASSERTG_EQ(0, r, out);
+	ZUC_ASSERTG_STREQ(value, str, out);
+
+out:
+	free(str);
+	weston_config_destroy(config);
+}
+
+ZUC_BENCHMARK(config_bench, parse, iterations)
+{
+	uint64_t i;
+
+	for (i = 0; i < iterations; i++) {
+		struct weston_config *config = load_config(config_test_t1.data);
+
+		ZUC_ASSERT_NOT_NULL(config);
+		weston_config_destroy(config);
+	}
+}
+
+ZUC_BENCHMARK(config_bench, lookup, iterations)
+{
+	struct weston_config *config = load_config(config_test_t1.data);
+	struct weston_config_section *section;
+	int32_t n = 0;
+	uint64_t i;
+
+	ZUC_ASSERT_NOT_NULL(config);
+
+	for (i = 0; i < iterations; i++) {
+		section = weston_config_get_section(config, "bar", NULL, NULL);
+		weston_config_section_get_int(section, "number", &n, 0);
+		ZUC_DO_NOT_OPTIMIZE(n);
+	}
+
+	weston_config_destroy(config);
+}
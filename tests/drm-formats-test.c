@@ -26,9 +26,12 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include <libweston/libweston.h>
 #include <libweston-internal.h>
+#include "shared/timespec-util.h"
 #include "shared/weston-drm-fourcc.h"
 
 #include "weston-test-client-helper.h"
@@ -570,3 +573,107 @@ TEST(subtract_arrays_modifier_invalid)
         weston_drm_format_array_fini(&format_array_A);
         weston_drm_format_array_fini(&format_array_B);
 }
+
+#define BENCH_FORMATS 256
+#define BENCH_MODIFIERS 64
+#define BENCH_ITERATIONS 20
+
+/* Fill an array with format i * step for every i < BENCH_FORMATS, each with
+ * modifiers j * step for every j < BENCH_MODIFIERS. Both are added in
+ * reverse order, the worst case for keeping the array sorted. */
+static void
+bench_fill(struct weston_drm_format_array *formats, uint32_t *raw_formats,
+           uint64_t *raw_modifiers, unsigned int step)
+{
+        struct weston_drm_format *fmt;
+        int i, j;
+        int ret;
+
+        for (i = BENCH_FORMATS - 1; i >= 0; i--) {
+                raw_formats[i] = i * step;
+                fmt = weston_drm_format_array_add_format(formats, i * step);
+                assert(fmt);
+                for (j = BENCH_MODIFIERS - 1; j >= 0; j--) {
+                        raw_modifiers[j] = j * step;
+                        ret = weston_drm_format_add_modifier(fmt, j * step);
+                        assert(ret == 0);
+                }
+        }
+}
+
+/* The old unsorted approach: a linear scan per format and per modifier. */
+static unsigned int
+bench_intersect_linear(const uint32_t *formats_A, const uint64_t *mods_A,
+                       const uint32_t *formats_B, const uint64_t *mods_B)
+{
+        unsigned int i, j, k, l;
+        unsigned int pairs = 0;
+
+        for (i = 0; i < BENCH_FORMATS; i++) {
+                for (j = 0; j < BENCH_FORMATS; j++)
+                        if (formats_B[j] == formats_A[i])
+                                break;
+                if (j == BENCH_FORMATS)
+                        continue;
+
+                for (k = 0; k < BENCH_MODIFIERS; k++)
+                        for (l = 0; l < BENCH_MODIFIERS; l++)
+                                if (mods_B[l] == mods_A[k]) {
+                                        pairs++;
+                                        break;
+                                }
+        }
+
+        return pairs;
+}
+
+TEST(benchmark_intersect_arrays)
+{
+        struct weston_drm_format_array format_array_A, format_array_B;
+        struct weston_drm_format_array format_array_C;
+        uint32_t raw_formats_A[BENCH_FORMATS], raw_formats_B[BENCH_FORMATS];
+        uint64_t raw_mods_A[BENCH_MODIFIERS], raw_mods_B[BENCH_MODIFIERS];
+        struct timespec begin, end;
+        int64_t linear_ns, merge_ns;
+        unsigned int expected = 0;
+        unsigned int iter;
+        int ret;
+
+        weston_drm_format_array_init(&format_array_A);
+        weston_drm_format_array_init(&format_array_B);
+        weston_drm_format_array_init(&format_array_C);
+
+        bench_fill(&format_array_A, raw_formats_A, raw_mods_A, 2);
+        bench_fill(&format_array_B, raw_formats_B, raw_mods_B, 3);
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (iter = 0; iter < BENCH_ITERATIONS; iter++)
+                expected = bench_intersect_linear(raw_formats_A, raw_mods_A,
+                                                  raw_formats_B, raw_mods_B);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        linear_ns = timespec_sub_to_nsec(&end, &begin) / BENCH_ITERATIONS;
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (iter = 0; iter < BENCH_ITERATIONS; iter++) {
+                ret = weston_drm_format_array_replace(&format_array_C,
+                                                      &format_array_A);
+                assert(ret == 0);
+                ret = weston_drm_format_array_intersect(&format_array_C,
+                                                        &format_array_B);
+                assert(ret == 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        merge_ns = timespec_sub_to_nsec(&end, &begin) / BENCH_ITERATIONS;
+
+        /* Formats and modifiers in common are the multiples of 6. */
+        assert(expected > 0);
+        assert(weston_drm_format_array_count_pairs(&format_array_C) == expected);
+
+        testlog("intersecting %u x %u pairs: linear scan %" PRId64 " ns, "
+                "sorted merge (including copy) %" PRId64 " ns\n",
+                BENCH_FORMATS, BENCH_MODIFIERS, linear_ns, merge_ns);
+
+        weston_drm_format_array_fini(&format_array_A);
+        weston_drm_format_array_fini(&format_array_B);
+        weston_drm_format_array_fini(&format_array_C);
+}
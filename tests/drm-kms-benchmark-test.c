@@ -0,0 +1,303 @@
+/*
+ * Copyright 2026 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * DRM backend benchmarks
+ *
+ * Scripted client scenarios on the DRM backend, meant for VKMS in CI. The
+ * compositor metrics are copied at a post-repaint breakpoint every
+ * BENCH_FRAMES_PER_SAMPLE frames; each sample is the mean repaint-to-flip
+ * time over those frames. The JSON report also has the atomic commits,
+ * TEST_ONLY commits and plane assignments per repaint, and the cursor
+ * update cost, over the whole measured run, so that changes in the plane
+ * assignment show up next to the timings.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "bench_util.h"
+#include "libweston-internal.h"
+#include "metrics.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+#define BENCH_FRAMES_PER_SAMPLE 10
+#define BENCH_SURFACE_SIZE 256
+#define BENCH_CURSOR_SIZE 64
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.backend = WESTON_BACKEND_DRM;
+	setup.renderer = WESTON_RENDERER_PIXMAN;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+struct scenario {
+	const char *name;
+	struct wet_testsuite_data *suite_data;
+	struct client *client;
+	/* the surface whose frame callback paces the scenario */
+	struct surface *surface;
+	struct buffer *buffers[2];
+	int x, y;
+	unsigned int frame;
+};
+
+static void
+send_motion(struct client *client, int x, int y)
+{
+	weston_test_move_pointer(client->test->weston_test, 0, 0, 0, x, y);
+}
+
+/* Commit the next frame of the scenario, without waiting for it */
+static void
+scenario_commit(struct scenario *s, int *done)
+{
+	struct surface *surface = s->surface;
+	struct buffer *buffer = s->buffers[s->frame++ % 2];
+
+	wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+	wl_surface_damage_buffer(surface->wl_surface, 0, 0,
+				 surface->width, surface->height);
+	frame_callback_set(surface->wl_surface, done);
+	wl_surface_commit(surface->wl_surface);
+
+	/* The cursor scenario also moves the pointer every frame. */
+	if (s->x >= 0)
+		send_motion(s->client, s->x + s->frame % 32, s->y);
+}
+
+/* Run one frame and copy the metrics once it is repainted */
+static void
+scenario_frame_snapshot(struct scenario *s, struct weston_metrics *metrics)
+{
+	struct wet_testsuite_data *suite_data = s->suite_data;
+	int done;
+
+	client_push_breakpoint(s->client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) s->client->output->wl_output);
+	scenario_commit(s, &done);
+
+	RUN_INSIDE_BREAKPOINT(s->client, suite_data) {
+		assert(breakpoint->compositor->metrics);
+		*metrics = *breakpoint->compositor->metrics;
+	}
+
+	frame_callback_wait(s->client, &done);
+}
+
+static int64_t
+metric_delta(const struct weston_metrics *a, const struct weston_metrics *b,
+	     enum weston_metric metric)
+{
+	return b->values[metric] - a->values[metric];
+}
+
+static double
+metric_per_repaint(const struct weston_metrics *a,
+		   const struct weston_metrics *b, enum weston_metric metric)
+{
+	int64_t repaints = metric_delta(a, b, WESTON_METRIC_OUTPUT_REPAINTS);
+
+	return repaints > 0 ? (double) metric_delta(a, b, metric) / repaints : 0;
+}
+
+/* Mean of the histogram samples taken between a and b, in microseconds */
+static int64_t
+histogram_mean(const struct weston_metrics *a, const struct weston_metrics *b,
+	       enum weston_metric_histogram hist)
+{
+	uint64_t count = b->hist[hist].count - a->hist[hist].count;
+
+	if (count == 0)
+		return 0;
+
+	return (b->hist[hist].sum - a->hist[hist].sum) / count;
+}
+
+static void
+scenario_run(struct scenario *s)
+{
+	struct bench bench = {
+		.name = "repaint_to_flip",
+		.unit = "us",
+		.count = BENCH_FRAMES_PER_SAMPLE
+	};
+	struct weston_metrics prev, cur, first;
+	FILE *fp;
+	int iter, i;
+	int done;
+
+	scenario_frame_snapshot(s, &prev);
+	for (iter = 0; iter < BENCH_WARMUP + BENCH_SAMPLES; iter++) {
+		for (i = 0; i < BENCH_FRAMES_PER_SAMPLE - 1; i++) {
+			scenario_commit(s, &done);
+			frame_callback_wait(s->client, &done);
+		}
+		scenario_frame_snapshot(s, &cur);
+
+		if (iter == BENCH_WARMUP - 1)
+			first = cur;
+		if (iter >= BENCH_WARMUP)
+			bench_add_sample(&bench,
+					 histogram_mean(&prev, &cur,
+							WESTON_METRIC_HIST_DRM_REPAINT_TO_FLIP_USEC));
+		prev = cur;
+	}
+
+	/* Every repaint makes at most one real commit. */
+	assert(metric_delta(&first, &cur, WESTON_METRIC_DRM_ATOMIC_COMMITS) <=
+	       metric_delta(&first, &cur, WESTON_METRIC_OUTPUT_REPAINTS));
+
+	fp = bench_report_open(&bench, s->name);
+	if (fp) {
+		fprintf(fp, "\t\"scenario\": \"%s\",\n", s->name);
+		fprintf(fp, "\t\"repaints\": %" PRId64 ",\n",
+			metric_delta(&first, &cur,
+				     WESTON_METRIC_OUTPUT_REPAINTS));
+		fprintf(fp, "\t\"commits_per_repaint\": %.3f,\n",
+			metric_per_repaint(&first, &cur,
+					   WESTON_METRIC_DRM_ATOMIC_COMMITS));
+		fprintf(fp, "\t\"test_only_per_repaint\": %.3f,\n",
+			metric_per_repaint(&first, &cur,
+					   WESTON_METRIC_DRM_ATOMIC_TESTS));
+		fprintf(fp, "\t\"test_only_failures_per_repaint\": %.3f,\n",
+			metric_per_repaint(&first, &cur,
+					   WESTON_METRIC_DRM_ATOMIC_TEST_FAILURES));
+		fprintf(fp, "\t\"views_on_planes_per_repaint\": %.3f,\n",
+			metric_per_repaint(&first, &cur,
+					   WESTON_METRIC_DRM_VIEWS_ON_PLANES));
+		fprintf(fp, "\t\"views_on_cursor_per_repaint\": %.3f,\n",
+			metric_per_repaint(&first, &cur,
+					   WESTON_METRIC_DRM_VIEWS_ON_CURSOR));
+		fprintf(fp, "\t\"views_on_renderer_per_repaint\": %.3f,\n",
+			metric_per_repaint(&first, &cur,
+					   WESTON_METRIC_DRM_VIEWS_ON_RENDERER));
+		fprintf(fp, "\t\"cursor_uploads\": %" PRId64 ",\n",
+			metric_delta(&first, &cur,
+				     WESTON_METRIC_DRM_CURSOR_UPLOADS));
+		fprintf(fp, "\t\"cursor_update_mean_us\": %" PRId64 ",\n",
+			histogram_mean(&first, &cur,
+				       WESTON_METRIC_HIST_DRM_CURSOR_UPDATE_USEC));
+		fprintf(fp, "\t\"atomic_commit_mean_us\": %" PRId64 ",\n",
+			histogram_mean(&first, &cur,
+				       WESTON_METRIC_HIST_DRM_ATOMIC_COMMIT_USEC));
+	}
+	bench_report_close(&bench, fp);
+}
+
+static struct buffer *
+create_color_buffer(struct client *client, int size, uint8_t r, uint8_t g,
+		    uint8_t b)
+{
+	struct buffer *buffer;
+	pixman_color_t color;
+
+	color_rgb888(&color, r, g, b);
+	buffer = create_shm_buffer_a8r8g8b8(client, size, size);
+	fill_image_with_color(buffer->image, &color);
+
+	return buffer;
+}
+
+/* A surface repainted in full every frame: renderer composition or, when
+ * the buffer can be scanned out, a plane. */
+TEST(bench_drm_surface_damage)
+{
+	struct scenario s = {
+		.name = "surface-damage",
+		.suite_data = TEST_GET_SUITE_DATA(),
+		.x = -1
+	};
+
+	s.client = create_client_and_test_surface(0, 0, BENCH_SURFACE_SIZE,
+						  BENCH_SURFACE_SIZE);
+	s.surface = s.client->surface;
+	s.buffers[0] = create_color_buffer(s.client, BENCH_SURFACE_SIZE,
+					   255, 0, 0);
+	s.buffers[1] = create_color_buffer(s.client, BENCH_SURFACE_SIZE,
+					   0, 0, 255);
+
+	/* Keep the pointer off the surface. */
+	send_motion(s.client, BENCH_SURFACE_SIZE * 2, BENCH_SURFACE_SIZE * 2);
+	client_roundtrip(s.client);
+
+	scenario_run(&s);
+
+	buffer_destroy(s.buffers[0]);
+	buffer_destroy(s.buffers[1]);
+	client_destroy(s.client);
+}
+
+/* The pointer moving over a surface with a client cursor that switches
+ * between two images every frame: cursor plane and cursor uploads. */
+TEST(bench_drm_cursor)
+{
+	struct scenario s = {
+		.name = "cursor",
+		.suite_data = TEST_GET_SUITE_DATA()
+	};
+	struct surface *cursor;
+
+	s.client = create_client_and_test_surface(0, 0, BENCH_SURFACE_SIZE,
+						  BENCH_SURFACE_SIZE);
+
+	cursor = create_test_surface(s.client);
+	cursor->width = BENCH_CURSOR_SIZE;
+	cursor->height = BENCH_CURSOR_SIZE;
+	s.surface = cursor;
+	s.buffers[0] = create_color_buffer(s.client, BENCH_CURSOR_SIZE,
+					   0, 255, 0);
+	s.buffers[1] = create_color_buffer(s.client, BENCH_CURSOR_SIZE,
+					   255, 0, 255);
+
+	s.x = BENCH_SURFACE_SIZE / 4;
+	s.y = BENCH_SURFACE_SIZE / 4;
+	send_motion(s.client, s.x, s.y);
+	client_roundtrip(s.client);
+	assert(s.client->input->pointer->focus == s.client->surface);
+
+	wl_pointer_set_cursor(s.client->input->pointer->wl_pointer,
+			      s.client->input->pointer->serial,
+			      cursor->wl_surface, 0, 0);
+
+	scenario_run(&s);
+
+	buffer_destroy(s.buffers[0]);
+	buffer_destroy(s.buffers[1]);
+	surface_destroy(cursor);
+	client_destroy(s.client);
+}
@@ -481,6 +481,16 @@ TEST(two_surface_switching)
 		pnode = next_pnode_from_z(output, pnode);
 		assert(pnode);
 		assert_surface_is_background(suite_data, pnode->view->surface);
+
+		/* and the first application is suspended, not composited */
+		for (pnode = next_pnode_from_z(output, NULL); pnode;
+		     pnode = next_pnode_from_z(output, pnode)) {
+			struct weston_desktop_surface *other =
+				weston_surface_get_desktop_surface(pnode->view->surface);
+
+			assert(!pnode->view->is_suspended);
+			assert(!other || other == wds);
+		}
 	}
 
 	wl_display_roundtrip(xdg_client->client->wl_display);
@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <wayland-client.h>
 #include "libweston-internal.h"
@@ -461,3 +462,56 @@ TEST(output_matrix_to_standard_transform)
 		output_test_all_transforms(&output, 1024, 768, 1920, 1080, scale);
 	}
 }
+
+TEST(translate_scale_fast_path)
+{
+	static const float scales[][2] = {
+		{ 1.0f, 1.0f }, { 2.0f, 0.5f }, { -1.0f, 1.0f }, { 1.5f, -3.0f },
+	};
+	static const float offsets[][2] = {
+		{ 0.0f, 0.0f }, { 7.0f, -3.0f }, { 0.25f, 100.5f },
+	};
+	pixman_box32_t boxes[] = {
+		{ 0, 0, 1, 1 }, { -5, 3, 17, 40 }, { 100, -200, 1920, 1080 },
+	};
+	unsigned i, j, k;
+
+	for (i = 0; i < ARRAY_LENGTH(scales); i++) {
+		for (j = 0; j < ARRAY_LENGTH(offsets); j++) {
+			struct weston_matrix fast, full;
+			pixman_box32_t out[ARRAY_LENGTH(boxes)];
+			struct weston_coord c[ARRAY_LENGTH(boxes)];
+
+			weston_matrix_init(&fast);
+			weston_matrix_scale(&fast, scales[i][0], scales[i][1], 1);
+			weston_matrix_translate(&fast, offsets[j][0],
+						offsets[j][1], 0);
+			assert(!(fast.type & ~(WESTON_MATRIX_TRANSFORM_SCALE |
+					       WESTON_MATRIX_TRANSFORM_TRANSLATE)));
+
+			/* Force the general code path on the same matrix. */
+			full = fast;
+			full.type = WESTON_MATRIX_TRANSFORM_OTHER;
+
+			weston_matrix_transform_boxes(&fast, boxes, out,
+						      ARRAY_LENGTH(boxes));
+			for (k = 0; k < ARRAY_LENGTH(boxes); k++) {
+				pixman_box32_t e;
+
+				e = weston_matrix_transform_rect(&full, boxes[k]);
+				assert(memcmp(&e, &out[k], sizeof e) == 0);
+				c[k] = weston_coord(boxes[k].x1, boxes[k].y2);
+			}
+
+			weston_matrix_transform_coords(&fast, c,
+						       ARRAY_LENGTH(c));
+			for (k = 0; k < ARRAY_LENGTH(boxes); k++) {
+				struct weston_coord e;
+
+				e = weston_matrix_transform_coord(&full,
+					weston_coord(boxes[k].x1, boxes[k].y2));
+				assert(e.x == c[k].x && e.y == c[k].y);
+			}
+		}
+	}
+}
@@ -87,6 +87,10 @@ struct capturer {
 	} events;
 
 	char *last_failure;
+
+	/* version 2 damage events since the last capture request */
+	pixman_region32_t damage;
+	int damage_events;
 };
 
 static void
@@ -116,6 +120,22 @@ capture_source_handle_size(void *data,
 	capt->height = height;
 }
 
+static void
+capture_source_handle_damage(void *data,
+			     struct weston_capture_source_v1 *proxy,
+			     int32_t x, int32_t y,
+			     int32_t width, int32_t height)
+{
+	struct capturer *capt = data;
+
+	assert(capt->source == proxy);
+	assert(capt->state == CAPTURE_TASK_PENDING);
+
+	capt->damage_events++;
+	pixman_region32_union_rect(&capt->damage, &capt->damage,
+				   x, y, width, height);
+}
+
 static void
 capture_source_handle_complete(void *data,
 			       struct weston_capture_source_v1 *proxy)
@@ -159,23 +179,26 @@ capture_source_handle_failed(void *data,
 static const struct weston_capture_source_v1_listener capture_source_handlers = {
 	.format = capture_source_handle_format,
 	.size = capture_source_handle_size,
+	.damage = capture_source_handle_damage,
 	.complete = capture_source_handle_complete,
 	.retry = capture_source_handle_retry,
 	.failed = capture_source_handle_failed,
 };
 
 static struct capturer *
-capturer_create(struct client *client,
-		struct output *output,
-		enum weston_capture_v1_source src)
+capturer_create_version(struct client *client,
+			struct output *output,
+			enum weston_capture_v1_source src,
+			uint32_t version)
 {
 	struct capturer *capt;
 
 	capt = xzalloc(sizeof *capt);
+	pixman_region32_init(&capt->damage);
 
 	capt->factory = bind_to_singleton_global(client,
 						 &weston_capture_v1_interface,
-						 1);
+						 version);
 
 	capt->source = weston_capture_v1_create(capt->factory,
 						output->wl_output, src);
@@ -185,15 +208,38 @@ capturer_create(struct client *client,
 	return capt;
 }
 
+static struct capturer *
+capturer_create(struct client *client,
+		struct output *output,
+		enum weston_capture_v1_source src)
+{
+	return capturer_create_version(client, output, src, 1);
+}
+
 static void
 capturer_destroy(struct capturer *capt)
 {
 	weston_capture_source_v1_destroy(capt->source);
 	weston_capture_v1_destroy(capt->factory);
+	pixman_region32_fini(&capt->damage);
 	free(capt->last_failure);
 	free(capt);
 }
 
+static void
+capturer_shoot(struct client *client, struct capturer *capt,
+	       struct buffer *buf)
+{
+	capt->state = CAPTURE_TASK_PENDING;
+	capt->events.reply = false;
+	capt->damage_events = 0;
+	pixman_region32_clear(&capt->damage);
+
+	weston_capture_source_v1_capture(capt->source, buf->proxy);
+	while (!capt->events.reply)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+}
+
 /*
  * Use the guaranteed source and all the right parameters to check that
  * shooting succeeds on the first try.
@@ -338,3 +384,52 @@ TEST(writeback_on_headless_fails)
 	buffer_destroy(buf);
 	client_destroy(client);
 }
+
+/*
+ * With version 2, capturing into the same buffer again only reports what
+ * changed in between, which is nothing on an idle desktop, while a new
+ * buffer is always written completely.
+ */
+TEST(damage_on_same_buffer)
+{
+	struct client *client;
+	struct capturer *capt;
+	struct buffer *buf;
+	struct buffer *other;
+	pixman_box32_t *extents;
+
+	client = create_client();
+	capt = capturer_create_version(client, client->output,
+				       WESTON_CAPTURE_V1_SOURCE_FRAMEBUFFER, 2);
+	client_roundtrip(client);
+
+	assert(capt->events.format);
+	assert(capt->events.size);
+
+	buf = create_shm_buffer(client, capt->width, capt->height,
+				capt->drm_format);
+	other = create_shm_buffer(client, capt->width, capt->height,
+				  capt->drm_format);
+
+	capturer_shoot(client, capt, buf);
+	assert(capt->state == CAPTURE_TASK_COMPLETE);
+	extents = pixman_region32_extents(&capt->damage);
+	assert(capt->damage_events == 1);
+	assert(extents->x1 == 0 && extents->y1 == 0);
+	assert(extents->x2 == capt->width && extents->y2 == capt->height);
+
+	capturer_shoot(client, capt, buf);
+	assert(capt->state == CAPTURE_TASK_COMPLETE);
+	assert(capt->damage_events == 0);
+
+	capturer_shoot(client, capt, other);
+	assert(capt->state == CAPTURE_TASK_COMPLETE);
+	extents = pixman_region32_extents(&capt->damage);
+	assert(capt->damage_events == 1);
+	assert(extents->x2 == capt->width && extents->y2 == capt->height);
+
+	capturer_destroy(capt);
+	buffer_destroy(other);
+	buffer_destroy(buf);
+	client_destroy(client);
+}
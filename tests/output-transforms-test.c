@@ -48,6 +48,15 @@
 		.transform_name = #t,					\
 		.meta.name = "GL " #s " " #t,				\
 	}
+#define PIXMAN_THREADED(s, t, n)					\
+	{								\
+		.renderer = WESTON_RENDERER_PIXMAN,			\
+		.scale = s,						\
+		.transform = WL_OUTPUT_TRANSFORM_ ## t,			\
+		.transform_name = #t,					\
+		.render_threads = n,					\
+		.meta.name = "pixman " #s " " #t " " #n " threads",	\
+	}
 
 struct setup_args {
 	struct fixture_metadata meta;
@@ -55,6 +64,7 @@ struct setup_args {
 	int scale;
 	enum wl_output_transform transform;
 	const char *transform_name;
+	int render_threads;
 };
 
 static const struct setup_args my_setup_args[] = {
@@ -72,6 +82,10 @@ static const struct setup_args my_setup_args[] = {
 	RENDERERS(2, 180),
 	RENDERERS(2, FLIPPED),
 	RENDERERS(3, FLIPPED_270),
+	PIXMAN_THREADED(1, NORMAL, 4),
+	PIXMAN_THREADED(1, 90, 4),
+	PIXMAN_THREADED(2, FLIPPED_180, 2),
+	PIXMAN_THREADED(3, FLIPPED_270, 3),
 };
 
 static enum test_result_code
@@ -93,6 +107,14 @@ fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 	setup.transform = arg->transform;
 	setup.shell = SHELL_TEST_DESKTOP;
 
+	/* Banded compositing must give exactly the same screenshots */
+	if (arg->render_threads > 0) {
+		weston_ini_setup(&setup,
+				 cfgln("[core]"),
+				 cfgln("pixman-render-threads=%d",
+				       arg->render_threads));
+	}
+
 	return weston_test_harness_execute_as_client(harness, &setup);
 }
 DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
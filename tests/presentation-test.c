@@ -32,6 +32,8 @@
 #include <assert.h>
 #include <time.h>
 
+#include "libweston-internal.h"
+#include "metrics.h"
 #include "shared/helpers.h"
 #include "shared/xalloc.h"
 #include "shared/timespec-util.h"
@@ -252,3 +254,70 @@ TEST(test_presentation_feedback_simple)
 	wp_presentation_destroy(pres);
 	client_destroy(client);
 }
+
+static struct weston_surface *
+find_weston_surface(struct wet_testsuite_data *suite_data,
+		    struct weston_output *output, struct surface *surface)
+{
+	struct weston_paint_node *pnode;
+
+	wl_list_for_each(pnode, &output->paint_node_list, output_link) {
+		struct wl_resource *r = pnode->surface->resource;
+
+		if (r && wl_resource_get_client(r) == suite_data->wl_client &&
+		    wl_resource_get_id(r) ==
+		    wl_proxy_get_id((struct wl_proxy *) surface->wl_surface))
+			return pnode->surface;
+	}
+
+	return NULL;
+}
+
+TEST(test_presentation_commit_to_present)
+{
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	struct client *client;
+	struct feedback *fb;
+	struct wp_presentation *pres;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+	assert(client);
+	pres = get_presentation(client);
+
+	wl_surface_attach(client->surface->wl_surface,
+			  client->surface->buffer->proxy, 0, 0);
+	fb = feedback_create(client, client->surface->wl_surface, pres);
+	wl_surface_damage(client->surface->wl_surface, 0, 0, 100, 100);
+	wl_surface_commit(client->surface->wl_surface);
+	feedback_wait(fb);
+	assert(fb->result == FB_PRESENTED);
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+
+	wl_surface_attach(client->surface->wl_surface,
+			  client->surface->buffer->proxy, 0, 0);
+	wl_surface_damage(client->surface->wl_surface, 0, 0, 100, 100);
+	wl_surface_commit(client->surface->wl_surface);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor = breakpoint->compositor;
+		struct weston_head *head = breakpoint->resource;
+		struct weston_surface *surface;
+
+		/* The first commit was presented and accounted for, the
+		 * second one is being repainted and not latched yet. */
+		assert(compositor->metrics->hist[WESTON_METRIC_HIST_COMMIT_TO_PRESENT_USEC].count > 0);
+
+		surface = find_weston_surface(suite_data, head->output,
+					      client->surface);
+		assert(surface);
+		assert(surface->commit_seq >= 2);
+		assert(surface->repainted_commit_seq == surface->commit_seq - 1);
+	}
+
+	feedback_destroy(fb);
+	wp_presentation_destroy(pres);
+	client_destroy(client);
+}
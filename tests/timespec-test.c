@@ -306,3 +306,17 @@ ZUC_TEST(timespec_test, timespec_eq)
 	ZUC_ASSERT_FALSE(timespec_eq(&a, &b));
 	ZUC_ASSERT_FALSE(timespec_eq(&b, &a));
 }
+
+ZUC_BENCHMARK(timespec_bench, add_sub_nsec, iterations)
+{
+	struct timespec base = { .tv_sec = 1000, .tv_nsec = 999999999 };
+	struct timespec r;
+	int64_t nsec = 0;
+	uint64_t i;
+
+	for (i = 0; i < iterations; i++) {
+		timespec_add_nsec(&r, &base, i * 16666667);
+		nsec += timespec_sub_to_nsec(&r, &base);
+		ZUC_DO_NOT_OPTIMIZE(nsec);
+	}
+}
@@ -30,6 +30,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "weston-test-runner.h"
 #include "vertex-clipping.h"
 
@@ -758,6 +760,63 @@ TEST_P(quad_clip_box32_expected, quad_clip_box32_expected_data)
 	assert_vertices(clipped, clipped_n, tdata->clipped, tdata->clipped_n);
 }
 
+/* clipper_quad_clip_boxes32() tests: */
+
+/* Clips a few quads to a grid of boxes, some of them empty and some sharing
+ * edges with the quads, and checks that the batched variant gives exactly
+ * the same vertices as clipping to one box at a time. */
+TEST(quad_clip_boxes32_matches_box32)
+{
+	static const struct clipper_vertex polygons[][4] = {
+		QUAD(-2.5f, -2.5f, 2.5f, 2.5f),
+		QUAD(-4.0f, -1.0f, 3.0f, 1.0f),
+		{ { 0.0f, -3.0f }, { 3.0f, 0.0f }, { 0.0f, 3.0f }, { -3.0f, 0.0f } },
+		{ { -1.0f, -3.5f }, { 3.5f, -1.0f }, { 1.0f, 3.5f }, { -3.5f, 1.0f } },
+	};
+	static const bool aligned[] = { true, true, false, false };
+	struct pixman_box32 boxes[64];
+	struct clipper_vertex expected[64 * 8], clipped[64 * 8];
+	int counts[64];
+	int nboxes = 0, i, j, n, clipped_n;
+
+	for (i = -4; i < 4; i++) {
+		for (j = -4; j < 4; j++) {
+			boxes[nboxes++] = (struct pixman_box32)
+				BOX32(i, j, i + (i + j + 8) % 3, j + 1);
+		}
+	}
+
+	for (i = 0; i < (int) ARRAY_LENGTH(polygons); i++) {
+		struct clipper_quad quad;
+
+		clipper_quad_init(&quad, polygons[i], aligned[i]);
+
+		n = 0;
+		for (j = 0; j < nboxes; j++)
+			n += clipper_quad_clip_box32(&quad, &boxes[j],
+						     &expected[n]);
+
+		/* Also covers a count that is not a multiple of four. */
+		clipped_n = clipper_quad_clip_boxes32(&quad, boxes, nboxes - 1,
+						      clipped, counts);
+		n -= clipper_quad_clip_box32(&quad, &boxes[nboxes - 1],
+					     &expected[n]);
+		assert(clipped_n == n);
+		assert(memcmp(clipped, expected, n * sizeof *clipped) == 0);
+
+		n = 0;
+		for (j = 0; j < nboxes - 1; j++) {
+			struct clipper_vertex box_clipped[8];
+
+			assert(counts[j] ==
+			       clipper_quad_clip_box32(&quad, &boxes[j],
+						       box_clipped));
+			n += counts[j];
+		}
+		assert(n == clipped_n);
+	}
+}
+
 /* clipper_float_difference() tests: */
 
 TEST(float_difference_different)
@@ -1476,6 +1476,32 @@ fuzzy_match_pixels(uint32_t pix_a, uint32_t pix_b,
 	return ret;
 }
 
+/*
+ * Check a row of pixels against the fuzz without branching per pixel, so
+ * that the compiler can vectorize the loop. Returns true if every channel
+ * of every pixel is within the fuzz.
+ */
+static bool
+row_within_fuzz(const uint32_t *pix_a, const uint32_t *pix_b, int n,
+		const struct range *fuzz)
+{
+	unsigned bad = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		int shift;
+
+		for (shift = 0; shift < 32; shift += 8) {
+			int d = (int)((pix_b[i] >> shift) & 0xffu) -
+				(int)((pix_a[i] >> shift) & 0xffu);
+
+			bad |= (d < fuzz->a) | (d > fuzz->b);
+		}
+	}
+
+	return bad == 0;
+}
+
 /**
  * Test if a given region within two images are pixel-identical
  *
@@ -1502,28 +1528,28 @@ check_images_match(pixman_image_t *img_a, pixman_image_t *img_b,
 		   const struct rectangle *clip_rect, const struct range *prec)
 {
 	struct range fuzz = range_get(prec);
-	struct pixel_diff_stat diffstat = {};
 	struct image_header ih_a = image_header_from(img_a);
 	struct image_header ih_b = image_header_from(img_b);
 	pixman_box32_t box;
-	int x, y;
+	int width;
+	int y;
 	uint32_t *pix_a;
 	uint32_t *pix_b;
 
 	box = image_check_get_roi(&ih_a, &ih_b, clip_rect);
+	width = box.x2 - box.x1;
 
+	/* Rows are usually identical, so try memcmp() first, and stop at
+	 * the first row that is out of the fuzz. */
 	for (y = box.y1; y < box.y2; y++) {
 		pix_a = image_header_get_row_u32(&ih_a, y) + box.x1;
 		pix_b = image_header_get_row_u32(&ih_b, y) + box.x1;
 
-		for (x = box.x1; x < box.x2; x++) {
-			if (!fuzzy_match_pixels(*pix_a, *pix_b,
-						&fuzz, &diffstat))
-				return false;
+		if (memcmp(pix_a, pix_b, width * sizeof(uint32_t)) == 0)
+			continue;
 
-			pix_a++;
-			pix_b++;
-		}
+		if (!row_within_fuzz(pix_a, pix_b, width, &fuzz))
+			return false;
 	}
 
 	return true;
@@ -1754,6 +1780,50 @@ load_image_from_png(const char *fname)
 	return converted;
 }
 
+/*
+ * Decoded reference images, so that fixtures and tests comparing against
+ * the same reference file do not decode the PNG again. The images are
+ * only ever read, see verify_image().
+ */
+#define REFERENCE_IMAGE_CACHE_SIZE 8
+
+static struct reference_image_cache_entry {
+	char *fname;
+	pixman_image_t *image;
+} reference_image_cache[REFERENCE_IMAGE_CACHE_SIZE];
+static unsigned reference_image_cache_next;
+
+static pixman_image_t *
+load_reference_image(const char *fname)
+{
+	struct reference_image_cache_entry *entry;
+	pixman_image_t *image;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(reference_image_cache); i++) {
+		entry = &reference_image_cache[i];
+		if (entry->fname && strcmp(entry->fname, fname) == 0)
+			return pixman_image_ref(entry->image);
+	}
+
+	image = load_image_from_png(fname);
+	if (!image)
+		return NULL;
+
+	/* Replace the oldest entry */
+	entry = &reference_image_cache[reference_image_cache_next];
+	reference_image_cache_next = (reference_image_cache_next + 1) %
+				     REFERENCE_IMAGE_CACHE_SIZE;
+	if (entry->image) {
+		pixman_image_unref(entry->image);
+		free(entry->fname);
+	}
+	entry->fname = xstrdup(fname);
+	entry->image = pixman_image_ref(image);
+
+	return image;
+}
+
 struct output_capturer {
 	int width;
 	int height;
@@ -1976,7 +2046,7 @@ verify_image(pixman_image_t *shot,
 
 	if (ref_image) {
 		ref_fname = screenshot_reference_filename(ref_image, ref_seq_no);
-		ref = load_image_from_png(ref_fname);
+		ref = load_reference_image(ref_fname);
 	}
 
 	if (ref) {
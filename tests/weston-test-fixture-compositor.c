@@ -40,6 +40,7 @@
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
 #include "weston-test-fixture-compositor.h"
+#include "weston-test-runner.h"
 #include "weston.h"
 #include "test-config.h"
 
@@ -185,6 +186,17 @@ void
 compositor_setup_defaults_(struct compositor_setup *setup,
 			   const char *testset_name)
 {
+	static char worker_testset_name[256];
+	int worker = get_test_worker_number();
+
+	/* Parallel workers each run their own compositor, which must not
+	 * share a socket or a weston.ini with the other workers. */
+	if (worker > 0) {
+		snprintf(worker_testset_name, sizeof worker_testset_name,
+			 "%s-w%d", testset_name, worker);
+		testset_name = worker_testset_name;
+	}
+
 	*setup = (struct compositor_setup) {
 		.test_quirks = (struct weston_testsuite_quirks){ },
 		.backend = WESTON_BACKEND_HEADLESS,
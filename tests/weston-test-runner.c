@@ -60,6 +60,8 @@ struct weston_test_run_info {
 
 static const struct weston_test_run_info *test_run_info_;
 
+static int test_worker_nr_;
+
 /** Get the test name string with counter
  *
  * \return The test name with fixture number \c -f%%d added. For an array
@@ -93,6 +95,24 @@ get_test_fixture_index(void)
 	return test_run_info_->fixture_nr - 1;
 }
 
+/** Get the number of the parallel worker process running this fixture
+ *
+ * \return 0 when fixtures run sequentially in the test program itself,
+ * otherwise a number unique to this worker among the workers of the same
+ * test program.
+ *
+ * Anything a fixture creates under a fixed name, like the compositor
+ * socket or the weston.ini file, needs to include this to not collide
+ * with the other workers.
+ *
+ * \ingroup testharness_private
+ */
+int
+get_test_worker_number(void)
+{
+	return test_worker_nr_;
+}
+
 /** Print into test log
  *
  * This is exactly like printf() except the output goes to the test log,
@@ -208,6 +228,7 @@ struct weston_test_harness {
 	int32_t fixt_ind;
 	char *chosen_testname;
 	int32_t case_ind;
+	int32_t jobs;
 
 	struct wet_testsuite_data data;
 };
@@ -388,6 +409,9 @@ help(const char *exe)
 		"Options:\n"
 		"  -f, --fixture N  Run only fixture number N. 0 runs all (default).\n"
 		"  -h, --help       Print this help and exit with success.\n"
+		"  -j, --jobs N     Run up to N fixtures in parallel, each in its own\n"
+		"                   process and compositor. Defaults to $WESTON_TEST_JOBS,\n"
+		"                   or 1. Test logs of parallel fixtures interleave.\n"
 		"  -l, --list       List all tests in this executable and exit with success.\n"
 		"testname:          Optional; name of the test to execute instead of all tests.\n"
 		"number:            Optional; for a multi-case test, run the given case only.\n"
@@ -402,11 +426,12 @@ parse_command_line(struct weston_test_harness *harness, int argc, char **argv)
 	static const struct option opts[] = {
 		{ "fixture", required_argument, NULL,      'f' },
 		{ "help",    no_argument,       NULL,      'h' },
+		{ "jobs",    required_argument, NULL,      'j' },
 		{ "list",    no_argument,       NULL,      'l' },
 		{ 0,         0,                 NULL,      0  }
 	};
 
-	while ((c = getopt_long(argc, argv, "f:hl", opts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "f:hj:l", opts, NULL)) != -1) {
 		switch (c) {
 		case 'f':
 			if (!safe_strtoint(optarg, &harness->fixt_ind)) {
@@ -420,6 +445,15 @@ parse_command_line(struct weston_test_harness *harness, int argc, char **argv)
 		case 'h':
 			help(argv[0]);
 			exit(RESULT_OK);
+		case 'j':
+			if (!safe_strtoint(optarg, &harness->jobs) ||
+			    harness->jobs < 1) {
+				fprintf(stderr,
+					"Error: '%s' is not a valid number of jobs (command line).\n",
+					optarg);
+				exit(RESULT_HARD_ERROR);
+			}
+			break;
 		case 'l':
 			list_tests();
 			exit(RESULT_OK);
@@ -456,12 +490,24 @@ weston_test_harness_create(int argc, char **argv)
 {
 	const struct fixture_setup_array *fsa;
 	struct weston_test_harness *harness;
+	const char *jobs;
 
 	harness = zalloc(sizeof(*harness));
 	assert(harness);
 
 	harness->fixt_ind = -1;
 	harness->case_ind = -1;
+	harness->jobs = 1;
+
+	jobs = getenv("WESTON_TEST_JOBS");
+	if (jobs && (!safe_strtoint(jobs, &harness->jobs) ||
+		     harness->jobs < 1)) {
+		fprintf(stderr,
+			"Error: '%s' is not a valid number of jobs (WESTON_TEST_JOBS).\n",
+			jobs);
+		exit(RESULT_HARD_ERROR);
+	}
+
 	parse_command_line(harness, argc, argv);
 
 	fsa = fixture_setup_array_get_();
@@ -644,11 +690,197 @@ fixture_report(const struct wet_testsuite_data *d, enum test_result_code ret)
 		d->passed, d->skipped, d->failed, d->total);
 }
 
+/* Runs one fixture and returns what it contributes to the program result */
+static enum test_result_code
+run_fixture(struct weston_test_harness *harness,
+	    const struct fixture_setup_array *fsa, int fi)
+{
+	const void *arg = fixture_setup_array_get_arg(fsa, fi);
+	enum test_result_code ret;
+
+	harness->data.fixture_iteration = fi;
+	harness->data.fixture_name = fixture_setup_array_get_name(fsa, fi);
+	harness->data.passed = 0;
+	harness->data.skipped = 0;
+	harness->data.failed = 0;
+
+	testlog("--- Fixture %d (%s)...\n", fi + 1, harness->data.fixture_name);
+
+	ret = fixture_setup_run_(harness, arg);
+	fixture_report(&harness->data, ret);
+
+	if (ret == RESULT_SKIP) {
+		tap_skip_fixture(&harness->data);
+#if WESTON_TEST_SKIP_IS_FAILURE
+		return RESULT_FAIL;
+#else
+		return RESULT_OK;
+#endif
+	}
+
+	if (ret != RESULT_OK)
+		return ret;
+
+	return counts_to_result(&harness->data);
+}
+
+static enum test_result_code
+merge_result(enum test_result_code result, enum test_result_code ret)
+{
+	if (ret == RESULT_OK || result == RESULT_HARD_ERROR)
+		return result;
+
+	return ret;
+}
+
+struct fixture_worker {
+	pid_t pid;
+	FILE *out;	/* the worker's stdout, i.e. its TAP lines */
+	bool done;
+	enum test_result_code result;
+};
+
+static bool
+fixture_worker_start(struct fixture_worker *w,
+		     struct weston_test_harness *harness,
+		     const struct fixture_setup_array *fsa,
+		     int fi, int fi_begin)
+{
+	enum test_result_code ret;
+
+	w->out = tmpfile();
+	if (!w->out) {
+		fprintf(stderr, "Error: cannot create worker output file: %s\n",
+			strerror(errno));
+		return false;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	w->pid = fork();
+	if (w->pid == -1) {
+		fprintf(stderr, "Error: cannot fork fixture worker: %s\n",
+			strerror(errno));
+		fclose(w->out);
+		w->out = NULL;
+		return false;
+	}
+
+	if (w->pid > 0)
+		return true;
+
+	/* Every fixture reports exactly 'total' TAP lines, so each worker
+	 * knows its test numbers up front. */
+	if (dup2(fileno(w->out), STDOUT_FILENO) == -1)
+		exit(RESULT_HARD_ERROR);
+	test_worker_nr_ = fi + 1;
+	harness->data.counter = harness->data.total * (fi - fi_begin);
+
+	ret = run_fixture(harness, fsa, fi);
+	fflush(stdout);
+	weston_test_harness_destroy(harness);
+	exit(ret);
+}
+
+static void
+fixture_worker_flush(struct fixture_worker *w, int fi)
+{
+	char buf[4096];
+	size_t len;
+
+	rewind(w->out);
+	while ((len = fread(buf, 1, sizeof buf, w->out)) > 0)
+		fwrite(buf, 1, len, stdout);
+	fclose(w->out);
+	w->out = NULL;
+
+	if (w->result == RESULT_HARD_ERROR)
+		printf("Bail out! Fixture %d did not finish\n", fi + 1);
+	fflush(stdout);
+}
+
+/*
+ * Runs each fixture in a forked worker with its own compositor, up to
+ * harness->jobs at a time. The TAP output of each worker is kept aside and
+ * printed in fixture order, so the result is the same as a sequential run.
+ */
+static enum test_result_code
+run_fixtures_parallel(struct weston_test_harness *harness,
+		      const struct fixture_setup_array *fsa,
+		      int fi_begin, int fi_end)
+{
+	enum test_result_code result = RESULT_OK;
+	struct fixture_worker *workers;
+	int n = fi_end - fi_begin;
+	int next = 0;
+	int printed = 0;
+	int running = 0;
+	int status;
+	pid_t pid;
+	int i;
+
+	workers = zalloc(n * sizeof *workers);
+	assert(workers);
+
+	while (printed < n) {
+		while (next < n && running < harness->jobs) {
+			if (!fixture_worker_start(&workers[next], harness, fsa,
+						  fi_begin + next, fi_begin)) {
+				workers[next].done = true;
+				workers[next].result = RESULT_HARD_ERROR;
+			} else {
+				running++;
+			}
+			next++;
+		}
+
+		if (running > 0) {
+			pid = waitpid(-1, &status, 0);
+			if (pid == -1) {
+				if (errno == EINTR)
+					continue;
+				fprintf(stderr, "Error: waitpid: %s\n",
+					strerror(errno));
+				abort();
+			}
+
+			for (i = 0; i < next; i++) {
+				if (workers[i].done || workers[i].pid != pid)
+					continue;
+
+				workers[i].done = true;
+				if (WIFEXITED(status)) {
+					workers[i].result = WEXITSTATUS(status);
+				} else {
+					testlog("--- Fixture %d terminated by signal %d\n",
+						fi_begin + i + 1,
+						WTERMSIG(status));
+					workers[i].result = RESULT_HARD_ERROR;
+				}
+				running--;
+				break;
+			}
+		}
+
+		while (printed < next && workers[printed].done) {
+			if (workers[printed].out)
+				fixture_worker_flush(&workers[printed],
+						     fi_begin + printed);
+			result = merge_result(result, workers[printed].result);
+			printed++;
+		}
+	}
+
+	free(workers);
+
+	return result;
+}
+
 int
 main(int argc, char *argv[])
 {
 	struct weston_test_harness *harness;
-	enum test_result_code ret;
 	enum test_result_code result = RESULT_OK;
 	const struct fixture_setup_array *fsa;
 	const char *leak_dl_handle;
@@ -684,35 +916,12 @@ main(int argc, char *argv[])
 	tap_plan(&harness->data, fi_end - fi);
 	testlog("Iterating through %d fixtures.\n", fi_end - fi);
 
-	for (; fi < fi_end; fi++) {
-		const void *arg = fixture_setup_array_get_arg(fsa, fi);
-
-		harness->data.fixture_iteration = fi;
-		harness->data.fixture_name = fixture_setup_array_get_name(fsa,
-									  fi);
-		harness->data.passed = 0;
-		harness->data.skipped = 0;
-		harness->data.failed = 0;
-
-		testlog("--- Fixture %d (%s)...\n",
-			fi + 1, harness->data.fixture_name);
-
-		ret = fixture_setup_run_(harness, arg);
-		fixture_report(&harness->data, ret);
-
-		if (ret == RESULT_SKIP) {
-			tap_skip_fixture(&harness->data);
-#if WESTON_TEST_SKIP_IS_FAILURE
-			ret = RESULT_FAIL;
-#else
-			continue;
-#endif
-		}
-
-		if (ret != RESULT_OK && result != RESULT_HARD_ERROR)
-			result = ret;
-		else if (counts_to_result(&harness->data) != RESULT_OK)
-			result = RESULT_FAIL;
+	if (harness->jobs > 1 && fi_end - fi > 1) {
+		result = run_fixtures_parallel(harness, fsa, fi, fi_end);
+	} else {
+		for (; fi < fi_end; fi++)
+			result = merge_result(result,
+					      run_fixture(harness, fsa, fi));
 	}
 
 	weston_test_harness_destroy(harness);
@@ -38,8 +38,24 @@
 #include "shared/weston-drm-fourcc.h"
 #include "shared/xalloc.h"
 
+struct setup_args {
+	struct fixture_metadata meta;
+	bool shm_pbo_upload;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.meta.name = "GL",
+		.shm_pbo_upload = false,
+	},
+	{
+		.meta.name = "GL PBO upload",
+		.shm_pbo_upload = true,
+	},
+};
+
 static enum test_result_code
-fixture_setup(struct weston_test_harness *harness)
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 {
 	struct compositor_setup setup;
 
@@ -51,9 +67,15 @@ fixture_setup(struct weston_test_harness *harness)
 	setup.logging_scopes = "log,gl-shader-generator";
 	setup.refresh = HIGHEST_OUTPUT_REFRESH;
 
+	if (arg->shm_pbo_upload) {
+		weston_ini_setup(&setup,
+				 cfgln("[core]"),
+				 cfgln("gl-shm-pbo-upload=true"));
+	}
+
 	return weston_test_harness_execute_as_client(harness, &setup);
 }
-DECLARE_FIXTURE_SETUP(fixture_setup);
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
 
 struct yuv_buffer {
 	void *data;
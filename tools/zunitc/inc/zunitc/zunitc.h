@@ -248,6 +248,31 @@ zuc_set_random(int random);
 void
 zuc_set_output_junit(bool enable);
 
+/**
+ * Sets whether to run benchmarks instead of tests.
+ *
+ * When enabled, only tests defined with ZUC_BENCHMARK() are run, and
+ * they are timed. Otherwise benchmarks run a single iteration each,
+ * along with the tests.
+ *
+ * @param enable true to run benchmarks, false to run tests.
+ * @see ZUC_BENCHMARK()
+ */
+void
+zuc_set_benchmark(bool enable);
+
+/**
+ * Sets a fixed number of iterations per benchmark batch.
+ *
+ * Results are only comparable between runs with the same number of
+ * iterations per batch. By default it is calibrated for each benchmark,
+ * which usually but not always lands on the same count.
+ *
+ * @param iterations the iterations per batch, or 0 to calibrate.
+ */
+void
+zuc_set_benchmark_iterations(uint64_t iterations);
+
 /**
  * Defines a test case that can be registered to run.
  *
@@ -262,6 +287,7 @@ zuc_set_output_junit(bool enable);
 	{ \
 		#tcase, #test, 0,		\
 		zuctest_##tcase##_##test,	\
+		0,				\
 		0				\
 	}; \
 	\
@@ -292,11 +318,59 @@ zuc_set_output_junit(bool enable);
 	{ \
 		#tcase, #test, &tcase,		\
 		0,				\
-		zuctest_##tcase##_##test	\
+		zuctest_##tcase##_##test,	\
+		0				\
 	}; \
 	\
 	static void zuctest_##tcase##_##test(void *param)
 
+/**
+ * Defines a benchmark that will be registered and filtered like a test.
+ *
+ * The body should repeat the code being measured the given number of
+ * times. In a normal run it is called once with a single iteration, so
+ * that it stays working. When benchmarks are enabled with
+ * zuc_set_benchmark(), the iteration count is doubled until one batch
+ * takes at least ZUC_BENCH_MIN_BATCH_MS, then ZUC_BENCH_WARMUP batches
+ * are discarded and the median time per iteration and its median
+ * absolute deviation (MAD) over ZUC_BENCH_SAMPLES batches are reported.
+ * Set-up done in the body outside of the loop is included in the timing,
+ * so keep it small in comparison.
+ *
+ * Checks can be used as in tests; a failure stops the benchmark.
+ *
+ * @param tcase name to use as the containing test case.
+ * @param bench name used for the benchmark under a given test case.
+ * @param iterations name for the iteration count parameter, a uint64_t.
+ * @see ZUC_DO_NOT_OPTIMIZE()
+ */
+#define ZUC_BENCHMARK(tcase, bench, iterations) \
+	static void zucbench_##tcase##_##bench(uint64_t iterations); \
+	\
+	const struct zuc_registration zzz_##tcase##_##bench \
+	__attribute__ ((used, section ("zuc_tsect"))) = \
+	{ \
+		#tcase, #bench, 0,		\
+		0,				\
+		0,				\
+		zucbench_##tcase##_##bench	\
+	}; \
+	\
+	static void zucbench_##tcase##_##bench(uint64_t iterations)
+
+#define ZUC_BENCH_MIN_BATCH_MS 10
+#define ZUC_BENCH_WARMUP 3
+#define ZUC_BENCH_SAMPLES 21
+
+/**
+ * Keeps the compiler from optimizing away the computation of a variable
+ * in a benchmark, by pretending its memory is read.
+ *
+ * @param var the variable holding the result.
+ */
+#define ZUC_DO_NOT_OPTIMIZE(var) \
+	zucimpl_do_not_optimize(&(var))
+
 
 /**
  * Returns true if the currently executing test has encountered any skips.
@@ -66,6 +66,8 @@ typedef void (*zucimpl_test_fn)(void);
 
 typedef void (*zucimpl_test_fn_f)(void *);
 
+typedef void (*zucimpl_bench_fn)(uint64_t iterations);
+
 /**
  * Internal use structure for automatic test case registration.
  * Should not be used directly in code.
@@ -77,6 +79,7 @@ struct zuc_registration {
 	zucimpl_test_fn fn;		/**< function implementing base test. */
 	zucimpl_test_fn_f fn_f;	/**< function implementing test with
 					   fixture. */
+	zucimpl_bench_fn bench;		/**< function implementing benchmark. */
 } __attribute__ ((aligned (64)));
 
 
@@ -91,6 +94,12 @@ int
 zucimpl_tracepoint(char const *file, int line, const char *fmt, ...)
 	__attribute__ ((format (printf, 3, 4)));
 
+static inline void
+zucimpl_do_not_optimize(const void *ptr)
+{
+	__asm__ __volatile__("" : : "r"(ptr) : "memory");
+}
+
 int
 zucimpl_expect_pred2(char const *file, int line,
 		     enum zuc_check_op, enum zuc_check_valtype valtype,
@@ -36,6 +36,7 @@
 
 #include "zuc_event_listener.h"
 #include "zuc_types.h"
+#include "zunitc/zunitc.h"
 
 #include <libweston/zalloc.h>
 
@@ -303,6 +304,15 @@ test_ended(void *data, struct zuc_test *test)
 		printf(" %s.%s (%ld ms)\n",
 		       test->test_case->name, test->name, test->elapsed);
 	}
+
+	if (test->bench_iterations) {
+		styled_printf(bdata->use_color, STYLE_GOOD, "[    BENCH ]");
+		printf(" %s.%s: median %.1f ns, MAD %.1f ns "
+		       "(%d x %" PRIu64 " iterations)\n",
+		       test->test_case->name, test->name,
+		       test->bench_median_ns, test->bench_mad_ns,
+		       ZUC_BENCH_SAMPLES, test->bench_iterations);
+	}
 }
 
 const char *
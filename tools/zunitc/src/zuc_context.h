@@ -45,6 +45,8 @@ struct zuc_context {
 	bool break_on_failure;
 	bool output_tap;
 	bool output_junit;
+	bool benchmark;
+	uint64_t bench_iterations;
 	char *filter;
 
 	struct zuc_slinked *listeners;
@@ -39,6 +39,7 @@ struct zuc_test
 	struct zuc_case *test_case;
 	zucimpl_test_fn fn;
 	zucimpl_test_fn_f fn_f;
+	zucimpl_bench_fn bench;
 	char *name;
 	int disabled;
 	int skipped;
@@ -47,6 +48,11 @@ struct zuc_test
 	long elapsed;
 	struct zuc_event *events;
 	struct zuc_event *deferred;
+
+	/* benchmark results, bench_iterations is 0 if not timed */
+	uint64_t bench_iterations;
+	double bench_median_ns;
+	double bench_mad_ns;
 };
 
 /**
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -66,6 +67,7 @@ static char const DISABLED_PREFIX[] = "DISABLED_";
 
 #define MS_PER_SEC 1000L
 #define NANO_PER_MS 1000000L
+#define NANO_PER_SEC 1000000000LL
 
 /**
  * Simple single-linked list structure.
@@ -145,6 +147,18 @@ zuc_set_break_on_failure(bool break_on_failure)
 	g_ctx.break_on_failure = break_on_failure;
 }
 
+void
+zuc_set_benchmark(bool enable)
+{
+	g_ctx.benchmark = enable;
+}
+
+void
+zuc_set_benchmark_iterations(uint64_t iterations)
+{
+	g_ctx.bench_iterations = iterations;
+}
+
 void
 zuc_set_output_junit(bool enable)
 {
@@ -165,16 +179,17 @@ zuc_get_program_basename(void)
 
 static struct zuc_test *
 create_test(int order, zucimpl_test_fn fn, zucimpl_test_fn_f fn_f,
-	    char const *case_name, char const *test_name,
-	    struct zuc_case *parent)
+	    zucimpl_bench_fn bench, char const *case_name,
+	    char const *test_name, struct zuc_case *parent)
 {
 	struct zuc_test *test = zalloc(sizeof(struct zuc_test));
 	ZUC_ASSERTG_NOT_NULL(test, out);
 	test->order = order;
 	test->fn = fn;
 	test->fn_f = fn_f;
+	test->bench = bench;
 	test->name = strdup(test_name);
-	if ((!fn && !fn_f) ||
+	if ((!fn && !fn_f && !bench) ||
 	    (strncmp(DISABLED_PREFIX,
 		     test_name, sizeof(DISABLED_PREFIX) - 1) == 0))
 		test->disabled = 1;
@@ -277,7 +292,7 @@ register_tests(void)
 		if (order < case_array[case_num]->order)
 			case_array[case_num]->order = order;
 		case_array[case_num]->tests[idx] =
-			create_test(order, reg->fn, reg->fn_f,
+			create_test(order, reg->fn, reg->fn_f, reg->bench,
 				    reg->tcase, reg->test,
 				    case_array[case_num]);
 
@@ -408,6 +423,24 @@ out:
 	return parts;
 }
 
+static void
+prune_empty_cases(int *count, struct zuc_case **cases)
+{
+	int i;
+	int j;
+
+	/* Prune any cases with no more tests. */
+	for (i = *count - 1; i >= 0; --i) {
+		if (cases[i]->test_count < 1) {
+			free_test_case(cases[i]);
+			for (j = i + 1; j < *count; ++j)
+				cases[j - 1] = cases[j];
+			cases[*count - 1] = NULL;
+			(*count)--;
+		}
+	}
+}
+
 static void
 filter_cases(int *count, struct zuc_case **cases, char const *filter)
 {
@@ -463,16 +496,31 @@ filter_cases(int *count, struct zuc_case **cases, char const *filter)
 	free(buf);
 	buf = NULL;
 
-	/* Prune any cases with no more tests. */
-	for (i = *count - 1; i >= 0; --i) {
-		if (cases[i]->test_count < 1) {
-			free_test_case(cases[i]);
-			for (j = i + 1; j < *count; ++j)
-				cases[j - 1] = cases[j];
-			cases[*count - 1] = NULL;
-			(*count)--;
+	prune_empty_cases(count, cases);
+}
+
+/* Drop everything but benchmarks, for benchmark runs. */
+static void
+keep_benchmarks(int *count, struct zuc_case **cases)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < *count; ++i) {
+		for (j = cases[i]->test_count - 1; j >= 0; --j) {
+			int w;
+
+			if (cases[i]->tests[j]->bench)
+				continue;
+
+			free_test(cases[i]->tests[j]);
+			for (w = j + 1; w < cases[i]->test_count; w++)
+				cases[i]->tests[w - 1] = cases[i]->tests[w];
+			cases[i]->test_count--;
 		}
 	}
+
+	prune_empty_cases(count, cases);
 }
 
 static unsigned int
@@ -522,6 +570,8 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 	int opt_random = 0;
 	bool opt_break_on_failure = false;
 	bool opt_junit = false;
+	bool opt_benchmark = false;
+	int opt_bench_iterations = 0;
 	char *opt_filter = NULL;
 
 	char *help_param = NULL;
@@ -537,6 +587,9 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 		{ WESTON_OPTION_BOOLEAN, "zuc-output-xml", 0, &opt_junit },
 #endif
 		{ WESTON_OPTION_STRING, "zuc-filter", 0, &opt_filter },
+		{ WESTON_OPTION_BOOLEAN, "zuc-benchmark", 0, &opt_benchmark },
+		{ WESTON_OPTION_INTEGER, "zuc-bench-iterations", 0,
+		  &opt_bench_iterations },
 	};
 
 	/*
@@ -620,6 +673,8 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 
 	if (opt_help) {
 		printf("Usage: %s [OPTIONS]\n"
+		       "  --zuc-bench-iterations=N  [0 to calibrate]\n"
+		       "  --zuc-benchmark\n"
 		       "  --zuc-break-on-failure\n"
 		       "  --zuc-filter=FILTER\n"
 		       "  --zuc-list-tests\n"
@@ -641,6 +696,9 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 		zuc_set_random(opt_random);
 		zuc_set_break_on_failure(opt_break_on_failure);
 		zuc_set_output_junit(opt_junit);
+		zuc_set_benchmark(opt_benchmark);
+		zuc_set_benchmark_iterations(opt_bench_iterations > 0 ?
+					     opt_bench_iterations : 0);
 		rc = EXIT_SUCCESS;
 	}
 
@@ -1000,6 +1058,88 @@ zuc_list_tests(void)
 	}
 }
 
+static int64_t
+time_bench_batch(struct zuc_test *test, uint64_t iterations)
+{
+	struct timespec begin;
+	struct timespec end;
+
+	clock_gettime(TARGET_TIMER, &begin);
+	test->bench(iterations);
+	clock_gettime(TARGET_TIMER, &end);
+
+	return (end.tv_sec - begin.tv_sec) * NANO_PER_SEC +
+	       (end.tv_nsec - begin.tv_nsec);
+}
+
+static int
+compare_double(const void *lhs, const void *rhs)
+{
+	double a = *(const double *)lhs;
+	double b = *(const double *)rhs;
+
+	return (a > b) - (a < b);
+}
+
+/* Median of the odd-sized array, which gets sorted. */
+static double
+sorted_median(double *values, int count)
+{
+	qsort(values, count, sizeof(values[0]), compare_double);
+
+	return values[count / 2];
+}
+
+/**
+ * Times a benchmark: calibrates the batch size unless it was given,
+ * discards warm-up batches, then keeps the median and MAD of the time
+ * per iteration over the sampled batches.
+ */
+static void
+run_benchmark(struct zuc_test *test)
+{
+	double samples[ZUC_BENCH_SAMPLES];
+	uint64_t iterations = g_ctx.bench_iterations;
+	double median;
+	int i;
+
+	if (!g_ctx.benchmark) {
+		test->bench(1);
+		return;
+	}
+
+	if (iterations == 0) {
+		/* Stop doubling before a broken benchmark takes forever. */
+		for (iterations = 1; iterations < (UINT64_C(1) << 40);
+		     iterations *= 2) {
+			if (time_bench_batch(test, iterations) >=
+			    ZUC_BENCH_MIN_BATCH_MS * NANO_PER_MS)
+				break;
+			if (test_has_failure(test) || test->skipped)
+				return;
+		}
+	}
+
+	for (i = 0; i < ZUC_BENCH_WARMUP + ZUC_BENCH_SAMPLES; i++) {
+		int64_t nsec = time_bench_batch(test, iterations);
+
+		if (test_has_failure(test) || test->skipped)
+			return;
+
+		if (i >= ZUC_BENCH_WARMUP)
+			samples[i - ZUC_BENCH_WARMUP] =
+				(double) nsec / iterations;
+	}
+
+	median = sorted_median(samples, ZUC_BENCH_SAMPLES);
+	for (i = 0; i < ZUC_BENCH_SAMPLES; i++)
+		samples[i] = fabs(samples[i] - median);
+
+	test->bench_iterations = iterations;
+	test->bench_median_ns = median;
+	test->bench_mad_ns = sorted_median(samples, ZUC_BENCH_SAMPLES);
+}
+
 static void
 run_single_test(struct zuc_test *test,const struct zuc_fixture *fxt,
 		void *case_data)
@@ -1030,7 +1170,9 @@ run_single_test(struct zuc_test *test,const struct zuc_fixture *fxt,
 
 	/* Need to re-check these, as fixtures might have changed test state. */
 	if (!test->fatal && !test->skipped) {
-		if (test->fn_f)
+		if (test->bench)
+			run_benchmark(test);
+		else if (test->fn_f)
 			test->fn_f(test_data);
 		else
 			test->fn();
@@ -1124,6 +1266,7 @@ reset_test_values(struct zuc_case **cases, int case_count)
 			test->failed = 0;
 			test->fatal = 0;
 			test->elapsed = 0;
+			test->bench_iterations = 0;
 
 			free_events(&test->events);
 			free_events(&test->deferred);
@@ -1190,6 +1333,9 @@ zucimpl_run_tests(void)
 	if (g_ctx.fatal)
 		return EXIT_FAILURE;
 
+	if (g_ctx.benchmark)
+		keep_benchmarks(&g_ctx.case_count, g_ctx.cases);
+
 	if (g_ctx.listeners == NULL) {
 		zuc_add_event_listener(zuc_base_logger_create());
 		if (g_ctx.output_junit)
@@ -462,3 +462,17 @@ ZUC_TEST(base_test, zed)
 	/* an additional test for the same case but later in source */
 	ZUC_ASSERT_EQ(3, 5 - 2);
 }
+
+ZUC_BENCHMARK(base_bench, loop, iterations)
+{
+	uint64_t sum = 0;
+	uint64_t i;
+
+	/* a single iteration outside of benchmark runs */
+	ZUC_ASSERT_TRUE(iterations >= 1);
+
+	for (i = 0; i < iterations; i++) {
+		sum += i;
+		ZUC_DO_NOT_OPTIMIZE(sum);
+	}
+}
@@ -36,6 +36,13 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <cairo.h>
 
@@ -98,12 +105,97 @@ int clamp_uv(int u)
 		return clamp;
 }
 
+#ifdef __SSE2__
+/* 32-bit lanes of 16-bit pairs (d, d), for _mm_madd_epi16() */
+static inline __m128i
+dup_lo16(__m128i d)
+{
+	return _mm_or_si128(_mm_and_si128(d, _mm_set1_epi32(0xffff)),
+			    _mm_slli_epi32(d, 16));
+}
+
+/* rgb_to_yuv() and clamp_uv() on 2x4 pixels at a time, with the same
+ * results. _mm_madd_epi16() takes signed 16-bit factors, so coefficients
+ * above 32767 are split across a pair of lanes. Returns the number of
+ * pixels per row done. */
+static int
+convert_rows_yv12_sse2(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+		       unsigned char *y1, unsigned char *y2,
+		       unsigned char *u, unsigned char *v, int width)
+{
+	const __m128i lo_mask = _mm_set1_epi32(0xff);
+	const __m128i g_mask = _mm_set1_epi32(0xff00);
+	const __m128i y_rg = _mm_set1_epi32(19234 << 16 | 19595);
+	const __m128i y_bg = _mm_set1_epi32(19235 << 16 | 7472);
+	const __m128i u_coef = _mm_set1_epi32(23363 << 16 | 23364);
+	const __m128i v_coef = _mm_set1_epi32(18481 << 16 | 18481);
+	const __m128i bias = _mm_set1_epi32(128);
+	unsigned char *yrow[2] = { y1, y2 };
+	const uint32_t *prow[2] = { p1, p2 };
+	int x, row;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		__m128i ua = _mm_setzero_si128();
+		__m128i va = _mm_setzero_si128();
+		uint32_t packed;
+
+		for (row = 0; row < 2; row++) {
+			__m128i p = _mm_loadu_si128((const __m128i *) (prow[row] + x));
+			__m128i g = _mm_slli_epi32(_mm_and_si128(p, g_mask), 8);
+			__m128i c0 = _mm_and_si128(p, lo_mask);
+			__m128i c2 = _mm_and_si128(_mm_srli_epi32(p, 16), lo_mask);
+			__m128i r, b, y;
+
+			if (format == WCAP_FORMAT_XRGB8888) {
+				r = c2;
+				b = c0;
+			} else {
+				r = c0;
+				b = c2;
+			}
+
+			/* both halves are r | g << 16 resp. b | g << 16 */
+			y = _mm_add_epi32(_mm_madd_epi16(_mm_or_si128(r, g), y_rg),
+					  _mm_madd_epi16(_mm_or_si128(b, g), y_bg));
+			y = _mm_srli_epi32(y, 16);
+
+			ua = _mm_add_epi32(ua, _mm_madd_epi16(dup_lo16(_mm_sub_epi32(r, y)),
+							      u_coef));
+			va = _mm_add_epi32(va, _mm_madd_epi16(dup_lo16(_mm_sub_epi32(b, y)),
+							      v_coef));
+
+			y = _mm_packs_epi32(y, y);
+			packed = _mm_cvtsi128_si32(_mm_packus_epi16(y, y));
+			memcpy(yrow[row] + x, &packed, 4);
+		}
+
+		/* sum horizontal neighbours into lanes 0 and 2 */
+		ua = _mm_add_epi32(ua, _mm_shuffle_epi32(ua, _MM_SHUFFLE(2, 3, 0, 1)));
+		va = _mm_add_epi32(va, _mm_shuffle_epi32(va, _MM_SHUFFLE(2, 3, 0, 1)));
+		ua = _mm_add_epi32(_mm_srai_epi32(ua, 18), bias);
+		va = _mm_add_epi32(_mm_srai_epi32(va, 18), bias);
+		ua = _mm_packs_epi32(ua, ua);
+		va = _mm_packs_epi32(va, va);
+
+		packed = _mm_cvtsi128_si32(_mm_packus_epi16(ua, ua));
+		u[x / 2] = packed;
+		u[x / 2 + 1] = packed >> 16;
+		packed = _mm_cvtsi128_si32(_mm_packus_epi16(va, va));
+		v[x / 2] = packed;
+		v[x / 2 + 1] = packed >> 16;
+	}
+
+	return x;
+}
+#endif
+
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, const uint32_t *frame,
+		unsigned char *out)
 {
 	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
+	const uint32_t *p1, *p2, *end;
+	int i, x = 0, u_accum, v_accum, stride0, stride1;
 	uint32_t format = decoder->format;
 
 	stride0 = decoder->width;
@@ -113,10 +205,21 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
 		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
+		p1 = frame + decoder->width * i;
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
+#ifdef __SSE2__
+		x = convert_rows_yv12_sse2(format, p1, p2, y1, y2, u, v,
+					   decoder->width);
+#endif
+		y1 += x;
+		y2 += x;
+		p1 += x;
+		p2 += x;
+		u += x / 2;
+		v += x / 2;
+
 		while (p1 < end) {
 			u_accum = 0;
 			v_accum = 0;
@@ -138,11 +241,12 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, const uint32_t *frame,
+		  unsigned char *out)
 {
 
 	unsigned char *yp, *up, *vp;
-	uint32_t *rp, *end;
+	const uint32_t *rp, *end;
 	int u, v;
 	int i, stride, psize;
 	uint32_t format = decoder->format;
@@ -153,7 +257,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
+		rp = frame + decoder->width * i;
 		end = rp + decoder->width;
 		while (rp < end) {
 			u = 0;
@@ -169,39 +273,269 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
-static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+static int
+write_all(int fd, const void *data, size_t size)
 {
-	static unsigned char *out;
-	int size;
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			return -1;
+		p += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+/* Frames in flight between decoding, conversion and writing */
+#define YUV_PIPELINE_DEPTH 4
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
+/*
+ * yuv4mpeg2 output runs in three stages: the main thread decodes and
+ * copies each output frame into the next slot, a second thread converts
+ * it to YUV, and a third one writes it out. The slots form a ring; frame
+ * n uses slot n % YUV_PIPELINE_DEPTH, and the counters below tell which
+ * stage owns which slot.
+ */
+struct yuv_pipeline {
+	struct wcap_decoder *decoder;
+	int depth;
+	int fd;
+	size_t rgb_size, yuv_size;
+
+	struct {
+		uint32_t *rgb;
+		unsigned char *yuv;
+	} slots[YUV_PIPELINE_DEPTH];
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int decoded, converted, written;
+	bool done;	/* no more frames will be decoded */
+	bool failed;	/* writing failed, stop decoding */
+
+	pthread_t convert_thread;
+	pthread_t write_thread;
+};
+
+static void *
+yuv_pipeline_convert(void *data)
+{
+	struct yuv_pipeline *pl = data;
+	unsigned int n;
+
+	pthread_mutex_lock(&pl->mutex);
+	for (;;) {
+		while (pl->converted == pl->decoded && !pl->done)
+			pthread_cond_wait(&pl->cond, &pl->mutex);
+		if (pl->converted == pl->decoded)
+			break;
+		n = pl->converted % YUV_PIPELINE_DEPTH;
+		pthread_mutex_unlock(&pl->mutex);
+
+		if (pl->depth == 444)
+			convert_to_yuv444(pl->decoder, pl->slots[n].rgb,
+					  pl->slots[n].yuv);
+		else
+			convert_to_yv12(pl->decoder, pl->slots[n].rgb,
+					pl->slots[n].yuv);
+
+		pthread_mutex_lock(&pl->mutex);
+		pl->converted++;
+		pthread_cond_broadcast(&pl->cond);
 	}
-	if (out == NULL)
-		out = malloc(size);
+	pthread_mutex_unlock(&pl->mutex);
+
+	return NULL;
+}
+
+static void *
+yuv_pipeline_write(void *data)
+{
+	struct yuv_pipeline *pl = data;
+	static const char frame_header[] = "FRAME\n";
+	bool failed = false;
+	unsigned int n;
+
+	pthread_mutex_lock(&pl->mutex);
+	for (;;) {
+		while (pl->written == pl->converted &&
+		       !(pl->done && pl->written == pl->decoded))
+			pthread_cond_wait(&pl->cond, &pl->mutex);
+		if (pl->written == pl->converted)
+			break;
+		n = pl->written % YUV_PIPELINE_DEPTH;
+		pthread_mutex_unlock(&pl->mutex);
+
+		if (!failed &&
+		    (write_all(pl->fd, frame_header, strlen(frame_header)) < 0 ||
+		     write_all(pl->fd, pl->slots[n].yuv, pl->yuv_size) < 0)) {
+			fprintf(stderr, "writing yuv4mpeg2 frame failed: %s\n",
+				strerror(errno));
+			failed = true;
+		}
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
+		pthread_mutex_lock(&pl->mutex);
+		pl->failed = failed;
+		pl->written++;
+		pthread_cond_broadcast(&pl->cond);
 	}
+	pthread_mutex_unlock(&pl->mutex);
+
+	return NULL;
+}
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+static struct yuv_pipeline *
+yuv_pipeline_create(struct wcap_decoder *decoder, int depth, int fd)
+{
+	struct yuv_pipeline *pl;
+	int i;
+
+	pl = calloc(1, sizeof *pl);
+	if (!pl)
+		return NULL;
+
+	pl->decoder = decoder;
+	pl->depth = depth;
+	pl->fd = fd;
+	pl->rgb_size = (size_t) decoder->width * decoder->height * 4;
+	if (depth == 444)
+		pl->yuv_size = (size_t) decoder->width * decoder->height * 3;
+	else
+		pl->yuv_size = (size_t) decoder->width * decoder->height * 3 / 2;
+
+	for (i = 0; i < YUV_PIPELINE_DEPTH; i++) {
+		pl->slots[i].rgb = malloc(pl->rgb_size);
+		pl->slots[i].yuv = malloc(pl->yuv_size);
+		if (!pl->slots[i].rgb || !pl->slots[i].yuv)
+			goto err;
+	}
+
+	pthread_mutex_init(&pl->mutex, NULL);
+	pthread_cond_init(&pl->cond, NULL);
+
+	if (pthread_create(&pl->convert_thread, NULL,
+			   yuv_pipeline_convert, pl) != 0)
+		goto err_sync;
+	if (pthread_create(&pl->write_thread, NULL,
+			   yuv_pipeline_write, pl) != 0) {
+		pthread_mutex_lock(&pl->mutex);
+		pl->done = true;
+		pthread_cond_broadcast(&pl->cond);
+		pthread_mutex_unlock(&pl->mutex);
+		pthread_join(pl->convert_thread, NULL);
+		goto err_sync;
+	}
+
+	return pl;
+
+err_sync:
+	pthread_cond_destroy(&pl->cond);
+	pthread_mutex_destroy(&pl->mutex);
+err:
+	for (i = 0; i < YUV_PIPELINE_DEPTH; i++) {
+		free(pl->slots[i].rgb);
+		free(pl->slots[i].yuv);
+	}
+	free(pl);
+	return NULL;
+}
+
+/* Queue the decoder's current frame. Returns false once writing failed. */
+static bool
+yuv_pipeline_push(struct yuv_pipeline *pl)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&pl->mutex);
+	while (pl->decoded - pl->written == YUV_PIPELINE_DEPTH && !pl->failed)
+		pthread_cond_wait(&pl->cond, &pl->mutex);
+	if (pl->failed) {
+		pthread_mutex_unlock(&pl->mutex);
+		return false;
+	}
+	n = pl->decoded % YUV_PIPELINE_DEPTH;
+	pthread_mutex_unlock(&pl->mutex);
+
+	memcpy(pl->slots[n].rgb, pl->decoder->frame, pl->rgb_size);
+
+	pthread_mutex_lock(&pl->mutex);
+	pl->decoded++;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->mutex);
+
+	return true;
+}
+
+/* Drains the pipeline. Returns false if writing failed. */
+static bool
+yuv_pipeline_destroy(struct yuv_pipeline *pl)
+{
+	bool ok;
+	int i;
+
+	pthread_mutex_lock(&pl->mutex);
+	pl->done = true;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->mutex);
+
+	pthread_join(pl->convert_thread, NULL);
+	pthread_join(pl->write_thread, NULL);
+
+	ok = !pl->failed;
+	pthread_cond_destroy(&pl->cond);
+	pthread_mutex_destroy(&pl->mutex);
+	for (i = 0; i < YUV_PIPELINE_DEPTH; i++) {
+		free(pl->slots[i].rgb);
+		free(pl->slots[i].yuv);
+	}
+	free(pl);
+
+	return ok;
+}
+
+static int
+open_output(const char *path)
+{
+#ifdef F_SETPIPE_SZ
+	struct stat st;
+#endif
+	int fd = STDOUT_FILENO;
+
+	if (path) {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "opening %s failed: %s\n",
+				path, strerror(errno));
+			return -1;
+		}
+	}
+
+#ifdef F_SETPIPE_SZ
+	/* Encoders read whole frames; a bigger pipe means fewer round trips
+	 * between us and them. Failing this is harmless. */
+	if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+		fcntl(fd, F_SETPIPE_SZ, 1 << 20);
+#endif
+
+	return fd;
 }
 
 static void
 usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
-		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"[--help] [--yuv4mpeg2] [--output=<file>] [--frame=<frame>]\n"
+		"\t[--all] [--rate=<num:denom>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
+		"\t--output=<file>\t\twrite yuv4mpeg2 to a file or fifo instead\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
@@ -213,11 +547,14 @@ usage(int exit_code)
 int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
+	struct yuv_pipeline *pipeline = NULL;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
+	int num = 30, denom = 1, out_fd = STDOUT_FILENO;
+	const char *output = NULL;
 	char filename[200];
 	char *mode;
 	uint32_t msecs, frame_time;
+	bool ok = true;
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -228,6 +565,8 @@ int main(int argc, char *argv[])
 			usage(EXIT_SUCCESS);
 		} else if (strcmp(argv[i], "--all") == 0) {
 			all = 1;
+		} else if (strncmp(argv[i], "--output=", 9) == 0) {
+			output = argv[i] + 9;
 		} else if (sscanf(argv[i], "--frame=%d", &output_frame) == 1) {
 			;
 		} else if (sscanf(argv[i], "--rate=%d", &num) == 1) {
@@ -259,7 +598,13 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	if (yuv4mpeg2 && isatty(1)) {
+	if (yuv4mpeg2) {
+		out_fd = open_output(output);
+		if (out_fd < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	if (yuv4mpeg2 && isatty(out_fd)) {
 		fprintf(stderr, "Not dumping yuv4mpeg2 data to terminal.  Pipe output to a file or a process.\n");
 		fprintf(stderr, "For example, to encode to webm, use something like\n\n");
 		fprintf(stderr, "\t$ wcap-decode  --yuv4mpeg2 ../capture.wcap |\n"
@@ -274,15 +619,41 @@ int main(int argc, char *argv[])
 		} else {
 			mode = "C420jpeg";
 		}
-		printf("YUV4MPEG2 %s W%d H%d F%d:%d Ip A0:0\n",
-					 mode, decoder->width, decoder->height, num, denom);
-		fflush(stdout);
+		dprintf(out_fd, "YUV4MPEG2 %s W%d H%d F%d:%d Ip A0:0\n",
+			mode, decoder->width, decoder->height, num, denom);
+
+		pipeline = yuv_pipeline_create(decoder, yuv4mpeg2, out_fd);
+		if (!pipeline) {
+			fprintf(stderr, "Creating yuv4mpeg2 pipeline failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	frame_time = 1000 * denom / num;
+
+	/* A single frame only needs decoding from the keyframe before it. */
+	if (output_frame >= 0 && !all && !yuv4mpeg2) {
+		msecs = decoder->first_msecs + output_frame * frame_time;
+		if (wcap_decoder_seek(decoder, msecs)) {
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", output_frame);
+			write_png(decoder, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		} else {
+			fprintf(stderr, "frame %d is past the end of the file\n",
+				output_frame);
+		}
+
+		fprintf(stderr, "wcap file: size %dx%d\n",
+			decoder->width, decoder->height);
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
 	}
 
 	i = 0;
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
-	frame_time = 1000 * denom / num;
 	while (has_frame) {
 		if (all || i == output_frame) {
 			snprintf(filename, sizeof filename,
@@ -290,18 +661,23 @@ int main(int argc, char *argv[])
 			write_png(decoder, filename);
 			fprintf(stderr, "wrote %s\n", filename);
 		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
+		if (pipeline && !yuv_pipeline_push(pipeline))
+			break;
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
+	if (pipeline)
+		ok = yuv_pipeline_destroy(pipeline);
+	if (out_fd != STDOUT_FILENO)
+		close(out_fd);
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
 
 	wcap_decoder_destroy(decoder);
 
-	return EXIT_SUCCESS;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -90,23 +90,114 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
+	struct wcap_frame_header_v2 *header_v2;
+	uint32_t i, nrects;
 
-	if (decoder->p == decoder->end)
+	if (decoder->p >= decoder->end)
 		return 0;
 
-	header = decoder->p;
-	decoder->msecs = header->msecs;
+	if (decoder->version == 2) {
+		header_v2 = decoder->p;
+		decoder->msecs = header_v2->msecs;
+		nrects = header_v2->nrects;
+		if (header_v2->flags & WCAP_FRAME_KEYFRAME)
+			memset(decoder->frame, 0,
+			       decoder->width * decoder->height * 4);
+		rects = (void *) (header_v2 + 1);
+	} else {
+		header = decoder->p;
+		decoder->msecs = header->msecs;
+		nrects = header->nrects;
+		rects = (void *) (header + 1);
+	}
 	decoder->count++;
 
-	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
+	decoder->p = (uint32_t *) (rects + nrects);
+	for (i = 0; i < nrects; i++)
 		wcap_decoder_decode_rectangle(decoder, &rects[i]);
 
 	return 1;
 }
 
+/** Decode up to the first frame at or after the given time
+ *
+ * Like calling wcap_decoder_get_frame() until decoder->msecs reaches msecs,
+ * but starts from the last keyframe before that time if the file has an
+ * index, instead of from wherever the decoder currently is.
+ *
+ * \return 1 if such a frame exists, 0 if the recording ends before it.
+ */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	const struct wcap_index_entry *entry = NULL;
+	uint32_t i;
+
+	for (i = 0; i < decoder->index_count; i++) {
+		if (decoder->index[i].msecs >= msecs)
+			break;
+		entry = &decoder->index[i];
+	}
+
+	if (decoder->count > 0 && decoder->msecs >= msecs) {
+		/* The target is behind us, start over. */
+		decoder->p = decoder->frames;
+		decoder->count = 0;
+		memset(decoder->frame, 0, decoder->width * decoder->height * 4);
+	}
+
+	/* Skip ahead unless we are already past the keyframe. */
+	if (entry && (decoder->count == 0 || entry->frame >= decoder->count)) {
+		decoder->p = (char *) decoder->map + entry->offset;
+		decoder->count = entry->frame;
+	}
+
+	do {
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+	} while (decoder->msecs < msecs);
+
+	return 1;
+}
+
+static void
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	const struct wcap_index_trailer *trailer;
+	size_t frames_offset = (char *) decoder->frames - (char *) decoder->map;
+	size_t index_size;
+	uint32_t i;
+
+	/* The index is missing if the recorder did not stop cleanly;
+	 * such files can only be decoded sequentially. */
+	if (decoder->size < frames_offset + sizeof *trailer)
+		return;
+
+	trailer = (const void *) ((char *) decoder->map +
+				  decoder->size - sizeof *trailer);
+	if (trailer->magic != WCAP_INDEX_MAGIC)
+		return;
+
+	index_size = (size_t) trailer->count * sizeof *decoder->index;
+	if (trailer->offset < frames_offset ||
+	    trailer->offset + index_size + sizeof *trailer != decoder->size)
+		return;
+
+	decoder->index = (const void *) ((char *) decoder->map +
+					 trailer->offset);
+	decoder->index_count = trailer->count;
+	decoder->end = (char *) decoder->map + trailer->offset;
+
+	for (i = 0; i < decoder->index_count; i++) {
+		if (decoder->index[i].offset < frames_offset ||
+		    decoder->index[i].offset >= trailer->offset) {
+			decoder->index = NULL;
+			decoder->index_count = 0;
+			return;
+		}
+	}
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
@@ -137,12 +228,25 @@ wcap_decoder_create(const char *filename)
 	}
 
 	header = decoder->map;
+	decoder->version = header->magic == WCAP_HEADER_MAGIC_V2 ? 2 : 1;
 	decoder->format = header->format;
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
 	decoder->p = header + 1;
+	decoder->frames = decoder->p;
 	decoder->end = decoder->map + decoder->size;
+	decoder->index = NULL;
+	decoder->index_count = 0;
+
+	if (decoder->version == 2)
+		wcap_decoder_read_index(decoder);
+
+	/* Both frame header versions start with the timestamp. */
+	if (decoder->p < decoder->end)
+		decoder->first_msecs = *(uint32_t *) decoder->p;
+	else
+		decoder->first_msecs = 0;
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
@@ -29,6 +29,8 @@
 #include <stdint.h>
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57434958
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -46,6 +48,28 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+/* The frame is decoded against all zero pixels */
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+};
+
+struct wcap_index_entry {
+	uint32_t msecs;
+	uint32_t frame;
+	uint64_t offset;
+};
+
+/* Last bytes of a completely written version 2 file */
+struct wcap_index_trailer {
+	uint64_t offset;
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
@@ -54,14 +78,20 @@ struct wcap_decoder {
 	int fd;
 	size_t size;
 	void *map, *p, *end;
+	void *frames;
 	uint32_t *frame;
 	uint32_t format;
+	uint32_t version;
+	uint32_t first_msecs;
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+	const struct wcap_index_entry *index;
+	uint32_t index_count;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
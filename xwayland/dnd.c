@@ -142,6 +142,7 @@ handle_enter(struct weston_wm *wm, xcb_client_message_event_t *client_message)
 					  wm->atom.xdnd_type_list,
 					  XCB_ATOM_ANY, 0, 2048);
 		reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+		wm->round_trips++;
 		types = xcb_get_property_value(reply);
 		length = reply->value_len;
 	} else {
@@ -356,11 +356,27 @@ weston_xwayland_xserver_exited(struct weston_xwayland *xwayland)
 	}
 }
 
+static int
+weston_xwayland_spawn(struct weston_xwayland *xwayland)
+{
+	struct weston_xserver *wxs = (struct weston_xserver *)xwayland;
+
+	if (!wxs->loop)
+		return -1;
+	if (wxs->client)
+		return 0;
+
+	weston_xserver_handle_event(-1, 0, wxs);
+
+	return wxs->client ? 0 : -1;
+}
+
 const struct weston_xwayland_api api = {
 	weston_xwayland_get,
 	weston_xwayland_listen,
 	weston_xwayland_xserver_loaded,
 	weston_xwayland_xserver_exited,
+	weston_xwayland_spawn,
 };
 extern const struct weston_xwayland_surface_api surface_api;
 
@@ -43,6 +43,24 @@
 #define wm_log(...) do {} while (0)
 #endif
 
+static void
+wm_log_property(struct weston_wm *wm, xcb_get_property_reply_t *reply)
+{
+#ifdef WM_DEBUG
+	FILE *fp;
+	char *logstr;
+	size_t logsize;
+
+	fp = open_memstream(&logstr, &logsize);
+	if (fp) {
+		dump_property(fp, wm, wm->atom.wl_selection, reply);
+		if (fclose(fp) == 0)
+			wm_log("%s", logstr);
+		free(logstr);
+	}
+#endif
+}
+
 static int
 writable_callback(int fd, uint32_t mask, void *data)
 {
@@ -55,6 +73,8 @@ writable_callback(int fd, uint32_t mask, void *data)
 		wm->property_start;
 
 	len = write(fd, property + wm->property_start, remainder);
+	if (len == -1 && errno == EAGAIN)
+		return 1;
 	if (len == -1) {
 		free(wm->property_reply);
 		wm->property_reply = NULL;
@@ -66,9 +86,9 @@ writable_callback(int fd, uint32_t mask, void *data)
 		return 1;
 	}
 
-	weston_log("wrote %d (chunk size %d) of %d bytes\n",
-		wm->property_start + len,
-		len, xcb_get_property_value_length(wm->property_reply));
+	wm_log("wrote %d (chunk size %d) of %d bytes\n",
+	       wm->property_start + len,
+	       len, xcb_get_property_value_length(wm->property_reply));
 
 	wm->property_start += len;
 	if (len == remainder) {
@@ -106,34 +126,44 @@ weston_wm_write_property(struct weston_wm *wm, xcb_get_property_reply_t *reply)
 					     writable_callback, wm);
 }
 
+/* The selection data is read from our window with a GetProperty request
+ * whose reply is picked up by weston_wm_selection_poll(), instead of
+ * waiting for it: a big transfer then doesn't hold up window management
+ * while the X server copies the data. */
 static void
-weston_wm_get_incr_chunk(struct weston_wm *wm)
+weston_wm_request_selection_property(struct weston_wm *wm, bool incr_chunk)
 {
-	xcb_get_property_cookie_t cookie;
-	xcb_get_property_reply_t *reply;
-	FILE *fp;
-	char *logstr;
-	size_t logsize;
+	if (wm->selection_property_pending)
+		xcb_discard_reply(wm->conn,
+				  wm->selection_property_cookie.sequence);
+
+	wm->selection_property_cookie =
+		xcb_get_property(wm->conn,
+				 !incr_chunk, /* delete */
+				 wm->selection_window,
+				 wm->atom.wl_selection,
+				 XCB_GET_PROPERTY_TYPE_ANY,
+				 0, /* offset */
+				 0x1fffffff /* length */);
+	wm->selection_property_pending = true;
+	wm->selection_property_incr_chunk = incr_chunk;
+	xcb_flush(wm->conn);
+}
 
-	cookie = xcb_get_property(wm->conn,
-				  0, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
+static void
+weston_wm_get_incr_chunk(struct weston_wm *wm)
+{
+	weston_wm_request_selection_property(wm, true);
+}
 
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+static void
+weston_wm_handle_incr_chunk(struct weston_wm *wm,
+			    xcb_get_property_reply_t *reply)
+{
 	if (reply == NULL)
 		return;
 
-	fp = open_memstream(&logstr, &logsize);
-	if (fp) {
-		dump_property(fp, wm, wm->atom.wl_selection, reply);
-		if (fclose(fp) == 0)
-			wm_log("%s", logstr);
-		free(logstr);
-	}
+	wm_log_property(wm, reply);
 
 	if (xcb_get_property_value_length(reply) > 0) {
 		/* reply's ownership is transferred to wm, which is responsible
@@ -212,6 +242,7 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 				  4096 /* length */);
 
 	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	wm->round_trips++;
 	if (reply == NULL)
 		return;
 
@@ -260,29 +291,15 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 static void
 weston_wm_get_selection_data(struct weston_wm *wm)
 {
-	xcb_get_property_cookie_t cookie;
-	xcb_get_property_reply_t *reply;
-	FILE *fp;
-	char *logstr;
-	size_t logsize;
-
-	cookie = xcb_get_property(wm->conn,
-				  1, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
-
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	weston_wm_request_selection_property(wm, false);
+}
 
-	fp = open_memstream(&logstr, &logsize);
-	if (fp) {
-		dump_property(fp, wm, wm->atom.wl_selection, reply);
-		if (fclose(fp) == 0)
-			wm_log("%s", logstr);
-		free(logstr);
-	}
+static void
+weston_wm_handle_selection_data(struct weston_wm *wm,
+				xcb_get_property_reply_t *reply)
+{
+	if (reply)
+		wm_log_property(wm, reply);
 
 	if (reply == NULL) {
 		return;
@@ -297,6 +314,35 @@ weston_wm_get_selection_data(struct weston_wm *wm)
 	}
 }
 
+/** Handle the reply to a pending selection GetProperty, if it arrived
+ *
+ * \return 1 if a reply was handled, 0 otherwise.
+ */
+int
+weston_wm_selection_poll(struct weston_wm *wm)
+{
+	xcb_get_property_reply_t *reply = NULL;
+	xcb_generic_error_t *error = NULL;
+
+	if (!wm->selection_property_pending)
+		return 0;
+
+	if (!xcb_poll_for_reply(wm->conn,
+				wm->selection_property_cookie.sequence,
+				(void **) &reply, &error))
+		return 0;
+
+	wm->selection_property_pending = false;
+	free(error);
+
+	if (wm->selection_property_incr_chunk)
+		weston_wm_handle_incr_chunk(wm, reply);
+	else
+		weston_wm_handle_selection_data(wm, reply);
+
+	return 1;
+}
+
 static void
 weston_wm_handle_selection_notify(struct weston_wm *wm,
 				xcb_generic_event_t *event)
@@ -418,8 +464,8 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		return 1;
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
+	wm_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
+	       len, available, mask, len, (char *) p);
 
 	wm->source_data.size = current + len;
 	if (wm->source_data.size >= incr_chunk_size) {
@@ -48,6 +48,7 @@
 #include "shared/cairo-util.h"
 #include "shared/hash.h"
 #include "shared/helpers.h"
+#include "shared/xalloc.h"
 #include "shared/xcb-xwayland.h"
 #include "xwayland-shell-v1-server-protocol.h"
 
@@ -137,6 +138,14 @@ struct weston_output_weak_ref {
 	struct wl_listener destroy_listener;
 };
 
+/* What was last sent to the X server, to skip requests that would not
+ * change anything. Frame geometry only uses the size. */
+struct wm_geometry {
+	bool valid;
+	int x, y;
+	int width, height;
+};
+
 struct weston_wm_window {
 	struct weston_wm *wm;
 	xcb_window_t id;
@@ -150,7 +159,7 @@ struct weston_wm_window {
 	struct wl_listener surface_destroy_listener;
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
-	int properties_dirty;
+	uint32_t properties_dirty; /* enum wm_window_property bits */
 	int pid;
 	char *machine;
 	char *class;
@@ -182,6 +191,9 @@ struct weston_wm_window {
 	int decor_bottom;
 	int decor_left;
 	int decor_right;
+	struct wm_geometry configured;
+	struct wm_geometry frame_configured;
+	struct wm_geometry notified;
 };
 
 struct xwl_surface {
@@ -501,6 +513,50 @@ read_and_dump_property(FILE *fp, struct weston_wm *wm,
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+/* Properties read by weston_wm_window_read_properties(), as bits of
+ * weston_wm_window::properties_dirty. */
+enum wm_window_property {
+	WM_PROP_CLASS		= 1 << 0,
+	WM_PROP_NAME		= 1 << 1,
+	WM_PROP_TRANSIENT_FOR	= 1 << 2,
+	WM_PROP_PROTOCOLS	= 1 << 3,
+	WM_PROP_NORMAL_HINTS	= 1 << 4,
+	WM_PROP_NET_WM_STATE	= 1 << 5,
+	WM_PROP_WINDOW_TYPE	= 1 << 6,
+	WM_PROP_PID		= 1 << 7,
+	WM_PROP_MOTIF_HINTS	= 1 << 8,
+	WM_PROP_ALL		= (1 << 9) - 1,
+};
+
+/* Which cached properties a PropertyNotify for atom invalidates */
+static uint32_t
+weston_wm_property_mask(struct weston_wm *wm, xcb_atom_t atom)
+{
+	if (atom == XCB_ATOM_WM_CLASS)
+		return WM_PROP_CLASS;
+	/* WM_NAME and _NET_WM_NAME both set the title, and _NET_WM_NAME wins
+	 * when present, so always read them together. */
+	if (atom == XCB_ATOM_WM_NAME || atom == wm->atom.net_wm_name)
+		return WM_PROP_NAME;
+	if (atom == XCB_ATOM_WM_TRANSIENT_FOR)
+		return WM_PROP_TRANSIENT_FOR;
+	if (atom == wm->atom.wm_protocols)
+		return WM_PROP_PROTOCOLS;
+	if (atom == wm->atom.wm_normal_hints)
+		return WM_PROP_NORMAL_HINTS;
+	if (atom == wm->atom.net_wm_state)
+		return WM_PROP_NET_WM_STATE;
+	if (atom == wm->atom.net_wm_window_type)
+		return WM_PROP_WINDOW_TYPE;
+	/* The PID is only trusted if WM_CLIENT_MACHINE is this host. */
+	if (atom == wm->atom.net_wm_pid || atom == wm->atom.wm_client_machine)
+		return WM_PROP_PID;
+	if (atom == wm->atom.motif_wm_hints)
+		return WM_PROP_MOTIF_HINTS;
+
+	return 0;
+}
+
 static void
 weston_wm_window_read_properties(struct weston_wm_window *window)
 {
@@ -511,18 +567,19 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		xcb_atom_t atom;
 		xcb_atom_t type;
 		void *ptr;
+		uint32_t mask;
 	} props[] = {
-		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class) },
-		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name) },
-		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for) },
-		{ wm->atom.wm_protocols,       TYPE_WM_PROTOCOLS,          NULL },
-		{ wm->atom.wm_normal_hints,    TYPE_WM_NORMAL_HINTS,       NULL },
-		{ wm->atom.net_wm_state,       TYPE_NET_WM_STATE,          NULL },
-		{ wm->atom.net_wm_window_type, XCB_ATOM_ATOM,              F(type) },
-		{ wm->atom.net_wm_name,        XCB_ATOM_STRING,            F(name) },
-		{ wm->atom.net_wm_pid,         XCB_ATOM_CARDINAL,          F(pid) },
-		{ wm->atom.motif_wm_hints,     TYPE_MOTIF_WM_HINTS,        NULL },
-		{ wm->atom.wm_client_machine,  XCB_ATOM_WM_CLIENT_MACHINE, F(machine) },
+		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class),         WM_PROP_CLASS },
+		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name),          WM_PROP_NAME },
+		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for), WM_PROP_TRANSIENT_FOR },
+		{ wm->atom.wm_protocols,       TYPE_WM_PROTOCOLS,          NULL,             WM_PROP_PROTOCOLS },
+		{ wm->atom.wm_normal_hints,    TYPE_WM_NORMAL_HINTS,       NULL,             WM_PROP_NORMAL_HINTS },
+		{ wm->atom.net_wm_state,       TYPE_NET_WM_STATE,          NULL,             WM_PROP_NET_WM_STATE },
+		{ wm->atom.net_wm_window_type, XCB_ATOM_ATOM,              F(type),          WM_PROP_WINDOW_TYPE },
+		{ wm->atom.net_wm_name,        XCB_ATOM_STRING,            F(name),          WM_PROP_NAME },
+		{ wm->atom.net_wm_pid,         XCB_ATOM_CARDINAL,          F(pid),           WM_PROP_PID },
+		{ wm->atom.motif_wm_hints,     TYPE_MOTIF_WM_HINTS,        NULL,             WM_PROP_MOTIF_HINTS },
+		{ wm->atom.wm_client_machine,  XCB_ATOM_WM_CLIENT_MACHINE, F(machine),       WM_PROP_PID },
 	};
 #undef F
 
@@ -531,27 +588,45 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	void *p;
 	uint32_t *xid;
 	xcb_atom_t *atom;
-	uint32_t i;
+	uint32_t dirty;
+	uint32_t i, j;
 	char name[1024];
 
-	if (!window->properties_dirty)
+	dirty = window->properties_dirty;
+	if (!dirty)
 		return;
 	window->properties_dirty = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
+	/* Issue all requests before waiting for any reply, so this costs a
+	 * single round trip. */
+	for (i = 0; i < ARRAY_LENGTH(props); i++) {
+		if (!(props[i].mask & dirty))
+			continue;
+
 		cookie[i] = xcb_get_property(wm->conn,
 					     0, /* delete */
 					     window->id,
 					     props[i].atom,
 					     XCB_ATOM_ANY, 0, 2048);
+	}
+	wm->round_trips++;
 
-	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
-	window->size_hints.flags = 0;
-	window->motif_hints.flags = 0;
-	window->delete_window = 0;
-	window->take_focus = 0;
+	if (dirty & WM_PROP_MOTIF_HINTS) {
+		window->decorate = window->override_redirect ?
+				   0 : MWM_DECOR_EVERYTHING;
+		window->motif_hints.flags = 0;
+	}
+	if (dirty & WM_PROP_NORMAL_HINTS)
+		window->size_hints.flags = 0;
+	if (dirty & WM_PROP_PROTOCOLS) {
+		window->delete_window = 0;
+		window->take_focus = 0;
+	}
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
+		if (!(props[i].mask & dirty))
+			continue;
+
 		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
 		if (!reply)
 			/* Bad window, typically */
@@ -589,10 +664,10 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window) {
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window) {
 					window->delete_window = 1;
-				} else if (atom[i] == wm->atom.wm_take_focus) {
+				} else if (atom[j] == wm->atom.wm_take_focus) {
 					window->take_focus = 1;
 				}
 			break;
@@ -608,12 +683,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++) {
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++) {
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_vert)
+				if (atom[j] == wm->atom.net_wm_state_maximized_vert)
 					window->maximized_vert = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_horz)
+				if (atom[j] == wm->atom.net_wm_state_maximized_horz)
 					window->maximized_horz = 1;
 			}
 			break;
@@ -637,7 +712,7 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		free(reply);
 	}
 
-	if (window->pid > 0) {
+	if ((dirty & WM_PROP_PID) && window->pid > 0) {
 		gethostname(name, sizeof(name));
 		for (i = 0; i < sizeof(name); i++) {
 			if (name[i] == '\0')
@@ -694,6 +769,51 @@ weston_wm_window_get_child_position(struct weston_wm_window *window,
 	}
 }
 
+/** Record a geometry about to be sent
+ *
+ * \return false if it is the same as the last one sent.
+ */
+static bool
+wm_geometry_update(struct wm_geometry *g, int x, int y, int width, int height)
+{
+	if (g->valid && g->x == x && g->y == y &&
+	    g->width == width && g->height == height)
+		return false;
+
+	g->valid = true;
+	g->x = x;
+	g->y = y;
+	g->width = width;
+	g->height = height;
+
+	return true;
+}
+
+static void
+weston_wm_flush(void *data)
+{
+	struct weston_wm *wm = data;
+
+	wm->flush_source = NULL;
+	xcb_flush(wm->conn);
+}
+
+/** Flush the X connection once the current event loop iteration is done
+ *
+ * Focus, stacking and configure changes come in bursts, for example when
+ * alt-tabbing, and are sent in one write this way. Requests stay in order
+ * on the connection, so deferring the flush does not reorder anything.
+ */
+static void
+weston_wm_schedule_flush(struct weston_wm *wm)
+{
+	if (wm->flush_source)
+		return;
+
+	wm->flush_source = wl_event_loop_add_idle(wm->server->loop,
+						  weston_wm_flush, wm);
+}
+
 static void
 weston_wm_window_send_configure_notify(struct weston_wm_window *window)
 {
@@ -733,11 +853,41 @@ weston_wm_window_send_configure_notify(struct weston_wm_window *window)
 	configure_notify.override_redirect = 0;
 	configure_notify.pad1 = 0;
 
+	wm_geometry_update(&window->notified, configure_notify.x,
+			   configure_notify.y, window->width, window->height);
+
 	xcb_send_event(wm->conn, 0, window->id,
 		       XCB_EVENT_MASK_STRUCTURE_NOTIFY,
 		       (char *) &configure_notify);
 }
 
+/* Like weston_wm_window_send_configure_notify(), but only if the client
+ * has not been told about this geometry yet. Replies to configure
+ * requests must always be sent, even if nothing changed. */
+static void
+weston_wm_window_update_configure_notify(struct weston_wm_window *window)
+{
+	const struct weston_desktop_xwayland_interface *xwayland_api =
+		window->wm->server->compositor->xwayland_interface;
+	int32_t dx = 0, dy = 0;
+	int x, y;
+
+	if (window->override_redirect)
+		return;
+
+	weston_wm_window_get_child_position(window, &x, &y);
+	if (window->shsurf)
+		xwayland_api->get_position(window->shsurf, &dx, &dy);
+
+	if (window->notified.valid &&
+	    window->notified.x == x + dx && window->notified.y == y + dy &&
+	    window->notified.width == window->width &&
+	    window->notified.height == window->height)
+		return;
+
+	weston_wm_window_send_configure_notify(window);
+}
+
 static void
 weston_wm_configure_window(struct weston_wm *wm, xcb_window_t window_id,
 			   uint16_t mask, const uint32_t *values)
@@ -790,6 +940,9 @@ weston_wm_window_configure_frame(struct weston_wm_window *window)
 		return;
 
 	weston_wm_window_get_frame_size(window, &width, &height);
+	if (!wm_geometry_update(&window->frame_configured, 0, 0, width, height))
+		return;
+
 	values[0] = width;
 	values[1] = height;
 	mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
@@ -859,8 +1012,11 @@ weston_wm_handle_configure_request(struct weston_wm *wm, xcb_generic_event_t *ev
 	if (configure_request->value_mask & XCB_CONFIG_WINDOW_STACK_MODE) {
 		values[i++] = configure_request->stack_mode;
 		mask |= XCB_CONFIG_WINDOW_STACK_MODE;
+		wm->raised_frame_id = XCB_WINDOW_NONE;
 	}
 
+	wm_geometry_update(&window->configured, x, y,
+			   window->width, window->height);
 	weston_wm_configure_window(wm, window->id, mask, values);
 	weston_wm_window_configure_frame(window);
 	weston_wm_window_send_configure_notify(window);
@@ -980,10 +1136,15 @@ weston_wm_send_focus_window(struct weston_wm *wm,
 		xcb_set_input_focus (wm->conn, XCB_INPUT_FOCUS_POINTER_ROOT,
 				     window->id, XCB_TIME_CURRENT_TIME);
 
+		/* Still on top when focus comes back from a Wayland window */
+		if (wm->raised_frame_id == window->frame_id)
+			return;
+
 		values[0] = XCB_STACK_MODE_ABOVE;
 		weston_wm_configure_window(wm, window->frame_id,
 					   XCB_CONFIG_WINDOW_STACK_MODE,
 					   values);
+		wm->raised_frame_id = window->frame_id;
 	} else {
 		xcb_set_input_focus (wm->conn,
 				     XCB_INPUT_FOCUS_POINTER_ROOT,
@@ -1028,8 +1189,7 @@ weston_wm_window_activate(struct wl_listener *listener, void *data)
 		weston_wm_window_schedule_repaint(wm->focus_window);
 	}
 
-	xcb_flush(wm->conn);
-
+	weston_wm_schedule_flush(wm);
 }
 
 /** Control Xwayland wl_surface.commit behaviour
@@ -1064,7 +1224,7 @@ weston_wm_window_set_allow_commits(struct weston_wm_window *window, bool allow)
 			    XCB_ATOM_CARDINAL,
 			    32, /* format */
 			    1, property);
-	xcb_flush(wm->conn);
+	weston_wm_schedule_flush(wm);
 }
 
 #define ICCCM_WITHDRAWN_STATE	0
@@ -1199,6 +1359,8 @@ weston_wm_window_create_frame(struct weston_wm_window *window)
 			  XCB_CW_COLORMAP, values);
 
 	xcb_reparent_window(wm->conn, window->id, window->frame_id, x, y);
+	window->configured.valid = false;
+	wm_geometry_update(&window->frame_configured, 0, 0, width, height);
 
 	values[0] = 0;
 	weston_wm_configure_window(wm, window->id,
@@ -1315,6 +1477,9 @@ weston_wm_handle_map_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 
 	wm_printf(wm, "XCB_MAP_NOTIFY (window %d%s)\n", map_notify->window,
 		  map_notify->override_redirect ? ", override" : "");
+
+	/* Newly mapped windows go on top */
+	wm->raised_frame_id = XCB_WINDOW_NONE;
 }
 
 static void
@@ -1396,7 +1561,7 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 
 	cairo_destroy(cr);
 	cairo_surface_flush(window->cairo_surface);
-	xcb_flush(window->wm->conn);
+	weston_wm_schedule_flush(window->wm);
 }
 
 static void
@@ -1558,7 +1723,8 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		return;
 	}
 
-	window->properties_dirty = 1;
+	window->properties_dirty |=
+		weston_wm_property_mask(wm, property_notify->atom);
 
 	if (wm_debug_is_enabled(wm))
 		fp = open_memstream(&logstr, &logsize);
@@ -1579,12 +1745,6 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 			weston_log_scope_write(wm->server->wm_debug,
 						 logstr, logsize);
 		free(logstr);
-	} else {
-		/* read_and_dump_property() is a X11 roundtrip.
-		 * Mimic it to maintain ordering semantics between debug
-		 * and non-debug paths.
-		 */
-		get_atom_name(wm->conn, property_notify->atom);
 	}
 
 	if (property_notify->atom == wm->atom.net_wm_name ||
@@ -1616,7 +1776,7 @@ weston_wm_window_create(struct weston_wm *wm,
 
 	window->wm = wm;
 	window->id = id;
-	window->properties_dirty = 1;
+	window->properties_dirty = WM_PROP_ALL;
 	window->override_redirect = override;
 	window->width = width;
 	window->height = height;
@@ -1637,6 +1797,7 @@ weston_wm_window_create(struct weston_wm *wm,
 	weston_output_weak_ref_init(&window->legacy_fullscreen_output);
 
 	geometry_reply = xcb_get_geometry_reply(wm->conn, geometry_cookie, NULL);
+	wm->round_trips++;
 	/* technically we should use XRender and check the visual format's
 	alpha_mask, but checking depth is simpler and works in all known cases */
 	if (geometry_reply != NULL)
@@ -1666,7 +1827,11 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 		weston_wm_window_set_wm_state(window, ICCCM_WITHDRAWN_STATE);
 		weston_wm_window_set_virtual_desktop(window, -1);
 		hash_table_remove(wm->window_hash, window->frame_id);
+		if (wm->raised_frame_id == window->frame_id)
+			wm->raised_frame_id = XCB_WINDOW_NONE;
 		window->frame_id = XCB_WINDOW_NONE;
+		window->configured.valid = false;
+		window->frame_configured.valid = false;
 	}
 
 	if (window->frame)
@@ -2164,25 +2329,32 @@ static const struct cursor_alternatives cursors[] = {
 	{left_ptrs, ARRAY_LENGTH(left_ptrs)},
 };
 
+/* Cursors are loaded from the theme the first time they are shown;
+ * XCB_CURSOR_NONE marks the ones not loaded yet. */
 static void
 weston_wm_create_cursors(struct weston_wm *wm)
+{
+	wm->cursors = xcalloc(ARRAY_LENGTH(cursors), sizeof(xcb_cursor_t));
+	wm->last_cursor = -1;
+}
+
+static xcb_cursor_t
+weston_wm_get_cursor(struct weston_wm *wm, int cursor)
 {
 	const char *name;
-	int i, count = ARRAY_LENGTH(cursors);
 	size_t j;
 
-	wm->cursors = malloc(count * sizeof(xcb_cursor_t));
-	for (i = 0; i < count; i++) {
-		for (j = 0; j < cursors[i].count; j++) {
-			name = cursors[i].names[j];
-			wm->cursors[i] =
-				xcb_cursor_library_load_cursor(wm, name);
-			if (wm->cursors[i] != (xcb_cursor_t)-1)
-				break;
-		}
+	if (wm->cursors[cursor] != XCB_CURSOR_NONE)
+		return wm->cursors[cursor];
+
+	for (j = 0; j < cursors[cursor].count; j++) {
+		name = cursors[cursor].names[j];
+		wm->cursors[cursor] = xcb_cursor_library_load_cursor(wm, name);
+		if (wm->cursors[cursor] != (xcb_cursor_t)-1)
+			break;
 	}
 
-	wm->last_cursor = -1;
+	return wm->cursors[cursor];
 }
 
 static void
@@ -2190,8 +2362,12 @@ weston_wm_destroy_cursors(struct weston_wm *wm)
 {
 	uint8_t i;
 
-	for (i = 0; i < ARRAY_LENGTH(cursors); i++)
+	for (i = 0; i < ARRAY_LENGTH(cursors); i++) {
+		if (wm->cursors[i] == XCB_CURSOR_NONE ||
+		    wm->cursors[i] == (xcb_cursor_t)-1)
+			continue;
 		xcb_free_cursor(wm->conn, wm->cursors[i]);
+	}
 
 	free(wm->cursors);
 }
@@ -2234,7 +2410,7 @@ weston_wm_window_set_cursor(struct weston_wm *wm, xcb_window_t window_id,
 
 	wm->last_cursor = cursor;
 
-	cursor_value_list = wm->cursors[cursor];
+	cursor_value_list = weston_wm_get_cursor(wm, cursor);
 	xcb_change_window_attributes (wm->conn, window_id,
 				      XCB_CW_CURSOR, &cursor_value_list);
 	xcb_flush(wm->conn);
@@ -2458,6 +2634,18 @@ weston_wm_handle_focus_in(struct weston_wm *wm, xcb_generic_event_t *event)
 		weston_wm_send_focus_window(wm, wm->focus_window);
 }
 
+/* Round trips stall the whole compositor until Xwayland answers. Those
+ * made only to produce debug output are not counted. */
+static void
+weston_wm_report_round_trips(struct weston_wm *wm, xcb_generic_event_t *event)
+{
+	if (wm->round_trips == 0)
+		return;
+
+	wm_printf(wm, "XWM: event %d needed %u blocking round trip(s)\n",
+		  EVENT_TYPE(event), wm->round_trips);
+}
+
 static int
 weston_wm_handle_event(int fd, uint32_t mask, void *data)
 {
@@ -2466,13 +2654,17 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 	int count = 0;
 
 	while (event = xcb_poll_for_event(wm->conn), event != NULL) {
+		wm->round_trips = 0;
+
 		if (weston_wm_handle_selection_event(wm, event)) {
+			weston_wm_report_round_trips(wm, event);
 			free(event);
 			count++;
 			continue;
 		}
 
 		if (weston_wm_handle_dnd_event(wm, event)) {
+			weston_wm_report_round_trips(wm, event);
 			free(event);
 			count++;
 			continue;
@@ -2530,10 +2722,13 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 			break;
 		}
 
+		weston_wm_report_round_trips(wm, event);
 		free(event);
 		count++;
 	}
 
+	count += weston_wm_selection_poll(wm);
+
 	if (count != 0)
 		xcb_flush(wm->conn);
 
@@ -2943,6 +3138,8 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 void
 weston_wm_destroy(struct weston_wm *wm)
 {
+	if (wm->flush_source)
+		wl_event_source_remove(wm->flush_source);
 	wl_global_destroy(wm->xwayland_shell_global);
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
@@ -3019,22 +3216,25 @@ weston_wm_window_configure(void *data)
 		window->configure_source = NULL;
 	}
 
-	weston_wm_window_set_allow_commits(window, false);
-
 	weston_wm_window_get_child_position(window, &x, &y);
-	values[0] = x;
-	values[1] = y;
-	values[2] = window->width;
-	values[3] = window->height;
-	weston_wm_configure_window(wm, window->id,
-				   XCB_CONFIG_WINDOW_X |
-				   XCB_CONFIG_WINDOW_Y |
-				   XCB_CONFIG_WINDOW_WIDTH |
-				   XCB_CONFIG_WINDOW_HEIGHT,
-				   values);
+	if (wm_geometry_update(&window->configured, x, y,
+			       window->width, window->height)) {
+		weston_wm_window_set_allow_commits(window, false);
+
+		values[0] = x;
+		values[1] = y;
+		values[2] = window->width;
+		values[3] = window->height;
+		weston_wm_configure_window(wm, window->id,
+					   XCB_CONFIG_WINDOW_X |
+					   XCB_CONFIG_WINDOW_Y |
+					   XCB_CONFIG_WINDOW_WIDTH |
+					   XCB_CONFIG_WINDOW_HEIGHT,
+					   values);
+	}
 
 	weston_wm_window_configure_frame(window);
-	weston_wm_window_send_configure_notify(window);
+	weston_wm_window_update_configure_notify(window);
 	weston_wm_window_schedule_repaint(window);
 }
 
@@ -3126,7 +3326,7 @@ send_close(struct weston_surface *surface)
 	if (!window || !window->wm)
 		return;
 	weston_wm_window_close(window, XCB_CURRENT_TIME);
-	xcb_flush(window->wm->conn);
+	weston_wm_schedule_flush(window->wm);
 }
 
 static void
@@ -3155,8 +3355,8 @@ send_position(struct weston_surface *surface, int32_t x, int32_t y)
 		mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
 
 		weston_wm_configure_window(wm, window->frame_id, mask, values);
-		weston_wm_window_send_configure_notify(window);
-		xcb_flush(wm->conn);
+		weston_wm_window_update_configure_notify(window);
+		weston_wm_schedule_flush(wm);
 	}
 }
 
@@ -3367,7 +3567,6 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 	} else {
 		weston_wm_window_set_pending_state(window);
 		weston_wm_window_set_allow_commits(window, true);
-		xcb_flush(wm->conn);
 	}
 }
 
@@ -58,12 +58,16 @@ struct weston_wm {
 	xcb_connection_t *conn;
 	const xcb_query_extension_reply_t *xfixes;
 	struct wl_event_source *source;
+	/* Pending xcb_flush() at the end of the event loop iteration */
+	struct wl_event_source *flush_source;
 	xcb_screen_t *screen;
 	struct hash_table *window_hash;
 	struct weston_xserver *server;
 	struct wl_global *xwayland_shell_global;
 	xcb_window_t wm_window;
 	struct weston_wm_window *focus_window;
+	/* Frame last raised by focus, XCB_WINDOW_NONE if unknown */
+	xcb_window_t raised_frame_id;
 	struct theme *theme;
 	xcb_cursor_t *cursors;
 	int last_cursor;
@@ -88,6 +92,9 @@ struct weston_wm {
 	xcb_timestamp_t selection_timestamp;
 	int selection_property_set;
 	int flush_property_on_delete;
+	xcb_get_property_cookie_t selection_property_cookie;
+	bool selection_property_pending;
+	bool selection_property_incr_chunk;
 	struct wl_listener selection_listener;
 	struct wl_listener seat_create_listener;
 	struct wl_listener seat_destroy_listener;
@@ -98,6 +105,10 @@ struct weston_wm {
 	struct wl_list unpaired_surface_list;
 	bool shell_bound;
 
+	/* Blocking X11 round trips made while handling the current event,
+	 * only reported in the debug scope. */
+	unsigned int round_trips;
+
 	struct atom_x11 atom;
 };
 
@@ -108,6 +119,8 @@ dump_property(FILE *fp, struct weston_wm *wm, xcb_atom_t property,
 void
 weston_wm_selection_init(struct weston_wm *wm);
 int
+weston_wm_selection_poll(struct weston_wm *wm);
+int
 weston_wm_handle_selection_event(struct weston_wm *wm,
 				 xcb_generic_event_t *event);
 